@@ -0,0 +1,200 @@
+##
+#  \file   `synthetic_landmark.py`
+#  \brief  Scale a landmark up to stress sizes and make a child landmark with a known displacement
+#
+#  The base landmark is the input resampled to `scale` times as many pixels along each axis, at `1/scale` of its
+#  resolution, so it covers the same ground. Bilinear resampling leaves no texture at the new pixel size, so a
+#  deterministic sum of octaves of smoothed noise, `detail_m` meters at the finest octave, is added to give the
+#  detector features at every scale. The child is the base surface sampled `shift_px` pixels away and raised by
+#  `shift_z` meters, so `landmark_comparison` of the two should find that displacement everywhere.
+#
+#  \copyright Copyright 2024 California Institute of Technology
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+
+import argparse
+import struct
+
+import numpy as np
+
+from landmark_tools.landmark import Landmark
+
+# Rows resampled at once, so stress sizes do not hold the coordinate grids of the whole landmark
+ROWS_PER_CHUNK = 512
+
+
+def _bilinear(image, cols, rows):
+    """Sample `image` at fractional `cols`, `rows`, clamped to its edges. NaN pixels spread to their neighbors."""
+    height, width = image.shape
+    cols = np.clip(cols, 0, width - 1)
+    rows = np.clip(rows, 0, height - 1)
+    c0 = np.minimum(np.floor(cols).astype(np.int64), width - 2)
+    r0 = np.minimum(np.floor(rows).astype(np.int64), height - 2)
+    fc = cols - c0
+    fr = rows - r0
+    top = image[r0, c0] * (1 - fc) + image[r0, c0 + 1] * fc
+    bottom = image[r0 + 1, c0] * (1 - fc) + image[r0 + 1, c0 + 1] * fc
+    return top * (1 - fr) + bottom * fr
+
+
+def _detail(width, height, scale, amplitude, seed):
+    """Octaves of smoothed noise on a `width` x `height` grid, the finest with features of about four pixels."""
+    rng = np.random.default_rng(seed)
+    detail = np.zeros((height, width), dtype=np.float32)
+    cell = 4.0
+    octave_amplitude = amplitude
+    while cell < 4.0 * scale and cell < min(width, height) / 2:
+        coarse = rng.standard_normal((int(height / cell) + 2, int(width / cell) + 2)).astype(np.float32)
+        cols = np.arange(width, dtype=np.float64) / cell
+        for r in range(0, height, ROWS_PER_CHUNK):
+            rows = np.arange(r, min(r + ROWS_PER_CHUNK, height), dtype=np.float64) / cell
+            cc, rr = np.meshgrid(cols, rows)
+            detail[r:r + rows.size] += octave_amplitude * _bilinear(coarse, cc, rr)
+        cell *= 2.0
+        octave_amplitude *= 2.0
+    return detail
+
+
+def _resample(image, scale, shift_cols, shift_rows, dtype):
+    """Resample `image` onto a grid `scale` times finer, offset by the fine pixels `shift_cols`, `shift_rows`."""
+    height, width = image.shape
+    out_height = height * scale
+    out_width = width * scale
+    out = np.empty((out_height, out_width), dtype=dtype)
+    cols = (np.arange(out_width, dtype=np.float64) + shift_cols) / scale
+    for r in range(0, out_height, ROWS_PER_CHUNK):
+        rows = (np.arange(r, min(r + ROWS_PER_CHUNK, out_height), dtype=np.float64) + shift_rows) / scale
+        cc, rr = np.meshgrid(cols, rows)
+        values = _bilinear(image, cc, rr)
+        if np.issubdtype(dtype, np.integer):
+            values = np.rint(values)
+        out[r:r + rows.size] = values
+    return out
+
+
+def _resample_same(image, shift_cols, shift_rows):
+    """Sample `image` at its own pixels offset by `shift_cols`, `shift_rows`."""
+    height, width = image.shape
+    out = np.empty((height, width), dtype=np.float32)
+    cols = np.arange(width, dtype=np.float64) + shift_cols
+    for r in range(0, height, ROWS_PER_CHUNK):
+        rows = np.arange(r, min(r + ROWS_PER_CHUNK, height), dtype=np.float64) + shift_rows
+        cc, rr = np.meshgrid(cols, rows)
+        out[r:r + rows.size] = _bilinear(image, cc, rr)
+    return out
+
+
+def write_landmark(lmk_file, header, srm, ele):
+    """Write a landmark file from the header fields of a `Landmark` and its `srm` and `ele` arrays.
+
+    `Landmark.save` packs one value at a time, which takes minutes at stress sizes, so the arrays are written whole.
+    """
+    version = b'#! LVS Map v3.0'
+    version += b'0' * (32 - len(version))
+    num_rows, num_cols = ele.shape
+    with open(lmk_file, 'wb') as fp:
+        fp.write(version)
+        fp.write(header.lmk_id)
+        fp.write(struct.pack('>iii', header.BODY, num_cols, num_rows))
+        fp.write(struct.pack('>ddd', header.anchor_col, header.anchor_row, header.resolution))
+        fp.write(np.asarray(header.anchor_point, dtype='>f8').tobytes())
+        fp.write(np.asarray(header.mapRworld, dtype='>f8').tobytes())
+        fp.write(np.ascontiguousarray(srm, dtype=np.uint8).tobytes())
+        fp.write(np.ascontiguousarray(ele, dtype='>f4').tobytes())
+
+
+def read_header(lmk_file):
+    """Read the size and resolution of a landmark file without reading its arrays."""
+    with open(lmk_file, 'rb') as fp:
+        header = fp.read(100)
+    body, num_cols, num_rows = struct.unpack('>iii', header[64:76])
+    anchor_col, anchor_row, resolution = struct.unpack('>ddd', header[76:100])
+    return {"num_cols": num_cols, "num_rows": num_rows, "resolution": resolution}
+
+
+def make_synthetic_pair(input_lmk, base_lmk, child_lmk, scale, shift_px=(0.0, 0.0), shift_z=0.0,
+                        detail_m=None, seed=0):
+    """Write a base landmark `scale` times the size of `input_lmk` and a child displaced from it.
+
+    \\param input_lmk landmark to scale up
+    \\param base_lmk output base landmark
+    \\param child_lmk output child landmark, or None to only write the base
+    \\param scale pixels of the outputs along each axis for one pixel of the input
+    \\param shift_px x, y of the child surface relative to the base, in pixels of the outputs
+    \\param shift_z height of the child surface relative to the base, in meters
+    \\param detail_m amplitude of the finest octave of added detail in meters, by default a tenth of the output
+           resolution
+    \\param seed seed of the added detail
+    \\return header of the outputs, a `Landmark` whose `ele` and `srm` are those of the input
+    """
+    header = Landmark(input_lmk)
+    scale = int(scale)
+    ele = np.asarray(header.ele, dtype=np.float64)
+    srm = np.asarray(header.srm, dtype=np.float64)
+    resolution = header.resolution / scale
+    if detail_m is None:
+        detail_m = 0.1 * resolution
+
+    header.resolution = resolution
+    # Pixel centers of the input fall at the center of their block of output pixels
+    header.anchor_col = (header.anchor_col + 0.5) * scale - 0.5
+    header.anchor_row = (header.anchor_row + 0.5) * scale - 0.5
+    header.num_cols *= scale
+    header.num_rows *= scale
+    header.num_pixels = header.num_cols * header.num_rows
+
+    center = 0.5 * (scale - 1)
+    base_ele = _resample(ele, scale, -center, -center, np.float32)
+    detail = _detail(header.num_cols, header.num_rows, scale, detail_m, seed)
+    base_ele += detail
+    base_srm = _resample(srm, scale, -center, -center, np.uint8)
+    write_landmark(base_lmk, header, base_srm, base_ele)
+
+    if child_lmk is not None:
+        # The child is the base surface seen from a landmark whose pixels sit shift_px from those of the base. A
+        # pixel of the child at (c, r) holds the base surface at (c - shift_x, r - shift_y)
+        detail_image = detail.astype(np.float64)
+        del base_ele, base_srm, detail
+        child_ele = _resample(ele, scale, -center - shift_px[0], -center - shift_px[1], np.float32)
+        child_ele += _resample_same(detail_image, -shift_px[0], -shift_px[1]) + shift_z
+        child_srm = _resample(srm, scale, -center - shift_px[0], -center - shift_px[1], np.uint8)
+        write_landmark(child_lmk, header, child_srm, child_ele)
+    return header
+
+
+def get_args():
+    parser = argparse.ArgumentParser(
+        description="Scale a landmark up to a stress size and make a child landmark with a known displacement"
+    )
+    parser.add_argument("--input", type=str, required=True, help="Landmark to scale up")
+    parser.add_argument("--base", type=str, required=True, help="Output base landmark")
+    parser.add_argument("--child", type=str, default=None, help="Output child landmark")
+    parser.add_argument("--scale", type=int, default=4, help="Output pixels along each axis per input pixel")
+    parser.add_argument("--shift", type=float, nargs=2, default=[0.0, 0.0], metavar=("X", "Y"),
+                        help="Displacement of the child surface in output pixels")
+    parser.add_argument("--shift_z", type=float, default=0.0, help="Height of the child surface in meters")
+    parser.add_argument("--detail", type=float, default=None,
+                        help="Meters of added detail at the finest octave, a tenth of the resolution by default")
+    parser.add_argument("--seed", type=int, default=0, help="Seed of the added detail")
+    return parser.parse_args()
+
+
+def main():
+    args = get_args()
+    header = make_synthetic_pair(args.input, args.base, args.child, args.scale, tuple(args.shift), args.shift_z,
+                                 args.detail, args.seed)
+    print(f"Wrote {header.num_cols} x {header.num_rows} landmarks at {header.resolution} m/px")
+
+
+if __name__ == "__main__":
+    main()
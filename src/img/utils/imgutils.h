@@ -53,6 +53,18 @@ extern "C" {
 
 extern int match_pyr_point_deepest;
 
+/* Summation buffers of the Forstner interest functions. Zero-initialize
+   before int_forstner_ctx_alloc(). */
+typedef struct {
+    int nx_max;			/* max number of columns */
+    int n_max;			/* max size of NxN neighborhood */
+    int *m00_sums;		/* column sums of squared X gradients */
+    int *m10_sums;		/* column sums of X times Y gradients */
+    int *m11_sums;		/* column sums of squared Y gradients */
+    void *scan_buffer;		/* buffer of the vector row scan, or NULL */
+    unsigned long scan_bytes;	/* size of scan_buffer */
+    } ForstnerCtx;
+
 #ifdef __STDC__
 
 int alignstat_begin(
@@ -204,6 +216,69 @@ int int_forstner_cov(
 
 void int_forstner_free(void);
 
+int int_forstner_ctx_alloc(
+    ForstnerCtx *ctx,		/* output summation buffers */
+    int nxmax,			/* input max number of columns */
+    int nmax);			/* input max size of NxN int. neighborhood */
+
+void int_forstner_ctx_free(
+    ForstnerCtx *ctx);		/* input summation buffers */
+
+int int_forstner_ctx(
+    ForstnerCtx *ctx,		/* input summation buffers, or NULL */
+    const unsigned char *image,	/* input intensity image */
+    int xdim,			/* input size of X dimension */
+    int ydim,			/* input size of Y dimension */
+    int x0,			/* input left-most X coordinate */
+    int y0,			/* input upper-most Y coordinate */
+    int nx,			/* input number of columns */
+    int ny,			/* input number of rows */
+    int n,			/* input size of NxN interest neighborhood */
+    float *interest);		/* output interest image */
+
+int int_forstner_best_ctx(
+    ForstnerCtx *ctx,		/* input summation buffers, or NULL */
+    const unsigned char *image,	/* input intensity image */
+    int xdim,			/* input size of X dimension */
+    int ydim,			/* input size of Y dimension */
+    int x0,			/* input left-most X coordinate */
+    int y0,			/* input upper-most Y coordinate */
+    int nx,			/* input number of columns */
+    int ny,			/* input number of rows */
+    int n,			/* input size of NxN neighborhood around pix */
+    int *x,			/* output X coordinate of best point */
+    int *y,			/* output Y coordinate of best point */
+    double *intr);		/* output value of interest operation */
+
+int int_forstner_cov_ctx(
+    ForstnerCtx *ctx,		/* input summation buffers, or NULL */
+    const unsigned char *image,	/* input intensity image */
+    int xdim,			/* input size of X dimension */
+    int ydim,			/* input size of Y dimension */
+    int x0,			/* input left-most X coordinate */
+    int y0,			/* input upper-most Y coordinate */
+    int nx,			/* input number of columns */
+    int ny,			/* input number of rows */
+    int n,			/* input size of NxN neighborhood around pt */
+    float *c00,			/* output image of (0,0) elements of covar */
+    float *c01,			/* output image of (0,1) elements of covar */
+    float *c11);		/* output image of (1,1) elements of covar */
+
+int int_forstner_nbest_ctx(
+    ForstnerCtx *ctx,		/* input summation buffers, or NULL */
+    const unsigned char *image,	/* input intensity image */
+    int xdim,			/* input size of X dimension */
+    int ydim,			/* input size of Y dimension */
+    int x0,			/* input left-most X coordinate */
+    int y0,			/* input upper-most Y coordinate */
+    int nx,			/* input number of columns */
+    int ny,			/* input number of rows */
+    int n,			/* input size of NxN neighborhood around pt */
+    int max,			/* input maximum length of output lists */
+    int *num,			/* output number of points in output lists */
+    int pos2[][2],		/* output coordinates of best point */
+    float intr[]);		/* output values of interest operation */
+
 int int_forstner_nbest(
     const unsigned char *image,	/* input intensity image */
     int xdim,			/* input size of X dimension */
@@ -456,6 +531,12 @@ int int_forstner();
 int int_forstner_best();
 int int_forstner_cov();
 int int_forstner_nbest();
+int int_forstner_ctx_alloc();
+void int_forstner_ctx_free();
+int int_forstner_ctx();
+int int_forstner_best_ctx();
+int int_forstner_cov_ctx();
+int int_forstner_nbest_ctx();
 
 int int_moravec();
 int int_moravec_best();
@@ -32,14 +32,333 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 
 #include "imgutils.h"
 
-static int nx_max;
-static int n_max;
-static int *m00_sums;
-static int *m10_sums;
-static int *m11_sums;
+/* Buffers of int_forstner_alloc(), used by the functions without a context */
+static ForstnerCtx forstner_buffers;
+
+
+/******************************************************************************
+********************************   N-BEST LIST   ******************************
+*******************************************************************************
+
+    The list of int_forstner_nbest(). Points are offered in raster order; the
+    list keeps the "max" smallest interest values seen so far. It is a binary
+    max-heap on the values, so the worst point is always at index 0 and each
+    replacement costs O(log max) instead of a scan of the list. */
+
+typedef struct {
+    int max;			/* maximum length of the list */
+    int len;			/* number of points in the list */
+    int (*pos2)[2];		/* coordinates of the points */
+    float *intr;		/* values of the points */
+    } NBestList;
+
+static void nbest_swap(
+    NBestList *list,		/* input/output list */
+    int i,			/* input first index */
+    int j)			/* input second index */
+{
+    int x = list->pos2[i][0], y = list->pos2[i][1];
+    float v = list->intr[i];
+
+    list->pos2[i][0] = list->pos2[j][0];
+    list->pos2[i][1] = list->pos2[j][1];
+    list->intr[i]    = list->intr[j];
+    list->pos2[j][0] = x;
+    list->pos2[j][1] = y;
+    list->intr[j]    = v;
+    }
+
+static void nbest_add(
+    NBestList *list,		/* input/output list */
+    int x,			/* input X coordinate of the point */
+    int y,			/* input Y coordinate of the point */
+    double val)			/* input value of interest operation */
+{
+    int i, child;
+
+    /* If the list is not yet full, then add new point and sift it up */
+    if (list->len < list->max) {
+	i = list->len++;
+	list->pos2[i][0] = x;
+	list->pos2[i][1] = y;
+	list->intr[i]    = val;
+	while ((i > 0) && (list->intr[(i - 1) / 2] < list->intr[i])) {
+	    nbest_swap(list, i, (i - 1) / 2);
+	    i = (i - 1) / 2;
+	    }
+	return;
+	}
+
+    /* Skip any point which is worse than the worst in the list */
+    if ((list->max < 1) || (val > list->intr[0]))
+	return;
+
+    /* Replace the worst point, and sift the new one down */
+    list->pos2[0][0] = x;
+    list->pos2[0][1] = y;
+    list->intr[0]    = val;
+    i = 0;
+    for (;;) {
+	child = 2 * i + 1;
+	if (child >= list->len)
+	    break;
+	if ((child + 1 < list->len) && (list->intr[child + 1] > list->intr[child]))
+	    child++;
+	if (list->intr[child] <= list->intr[i])
+	    break;
+	nbest_swap(list, i, child);
+	i = child;
+	}
+    }
+
+
+/******************************************************************************
+********************************   VECTOR ROW SCAN   **************************
+*******************************************************************************
+
+    On x86-64 CPUs with AVX2 the interest functions work a row at a time:
+    the gradient products of whole rows update the column sums of the
+    neighborhood 8 pixels at a time, the column sums are added across the
+    neighborhood into the row of window sums, and the largest eigenvalue is
+    computed 4 pixels at a time. The sums are the same integers as those of
+    the scalar loops, and the eigenvalue takes the same double operations in
+    the same order, so every output is the same as the scalar one. */
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define INT_FORSTNER_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef INT_FORSTNER_AVX2
+
+typedef struct {
+    const unsigned char *image;	/* intensity image */
+    int xdim;			/* size of X dimension */
+    int w;			/* half size of the neighborhood */
+    int xa, xb;			/* first and last column with an interest */
+    int ya, yb;			/* first and last row with an interest */
+    int ncols;			/* columns of the column sums */
+    int *c00, *c10, *c11;	/* column sums, from column xa - w + 1 */
+    int *s00, *s10, *s11;	/* window sums of the row, from column xa */
+    double *val;		/* interest of the row, negative if none */
+    void *buffer;		/* memory of the arrays */
+    int owned;			/* TRUE if buffer is freed by scan_end() */
+    } ForstnerScan;
+
+/* Add (sign > 0) or subtract the gradient products of image row "r" to the
+   column sums */
+__attribute__((target("avx2")))
+static void scan_accumulate_row(
+    ForstnerScan *scan,
+    int r,
+    int sign)
+{
+    const unsigned char *row = scan->image + (size_t)r * scan->xdim +
+	(scan->xa - scan->w + 1);
+    const unsigned char *above = row - scan->xdim;
+    const unsigned char *below = row + scan->xdim;
+    int c, d0, d1, n = scan->ncols;
+
+    for (c=0; c+8<=n; c+=8) {
+	__m256i left  = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(row + c - 1)));
+	__m256i right = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(row + c + 1)));
+	__m256i up    = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(above + c)));
+	__m256i down  = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(below + c)));
+	__m256i g0 = _mm256_sub_epi32(right, left);
+	__m256i g1 = _mm256_sub_epi32(down, up);
+	__m256i p00 = _mm256_mullo_epi32(g0, g0);
+	__m256i p11 = _mm256_mullo_epi32(g1, g1);
+	__m256i p10 = _mm256_mullo_epi32(g1, g0);
+	__m256i *c00 = (__m256i *)(scan->c00 + c);
+	__m256i *c10 = (__m256i *)(scan->c10 + c);
+	__m256i *c11 = (__m256i *)(scan->c11 + c);
+	if (sign > 0) {
+	    _mm256_storeu_si256(c00, _mm256_add_epi32(_mm256_loadu_si256(c00), p00));
+	    _mm256_storeu_si256(c10, _mm256_add_epi32(_mm256_loadu_si256(c10), p10));
+	    _mm256_storeu_si256(c11, _mm256_add_epi32(_mm256_loadu_si256(c11), p11));
+	    }
+	else {
+	    _mm256_storeu_si256(c00, _mm256_sub_epi32(_mm256_loadu_si256(c00), p00));
+	    _mm256_storeu_si256(c10, _mm256_sub_epi32(_mm256_loadu_si256(c10), p10));
+	    _mm256_storeu_si256(c11, _mm256_sub_epi32(_mm256_loadu_si256(c11), p11));
+	    }
+	}
+    for (; c<n; c++) {
+	d0 = row[c + 1] - row[c - 1];
+	d1 = below[c] - above[c];
+	scan->c00[c] += sign * (d0 * d0);
+	scan->c10[c] += sign * (d1 * d0);
+	scan->c11[c] += sign * (d1 * d1);
+	}
+    }
+
+/* Window sums and interest of the row whose column sums are current */
+__attribute__((target("avx2")))
+static void scan_interest(
+    ForstnerScan *scan)
+{
+    int i, t, count = scan->xb - scan->xa + 1, span = 2 * scan->w - 1;
+    double a, b, d, det, m00, m01, m10, m11;
+
+    /* Add the column sums across the neighborhood */
+    for (i=0; i+8<=count; i+=8) {
+	__m256i s00 = _mm256_setzero_si256();
+	__m256i s10 = _mm256_setzero_si256();
+	__m256i s11 = _mm256_setzero_si256();
+	for (t=0; t<span; t++) {
+	    s00 = _mm256_add_epi32(s00, _mm256_loadu_si256((const __m256i *)(scan->c00 + i + t)));
+	    s10 = _mm256_add_epi32(s10, _mm256_loadu_si256((const __m256i *)(scan->c10 + i + t)));
+	    s11 = _mm256_add_epi32(s11, _mm256_loadu_si256((const __m256i *)(scan->c11 + i + t)));
+	    }
+	_mm256_storeu_si256((__m256i *)(scan->s00 + i), s00);
+	_mm256_storeu_si256((__m256i *)(scan->s10 + i), s10);
+	_mm256_storeu_si256((__m256i *)(scan->s11 + i), s11);
+	}
+    for (; i<count; i++) {
+	scan->s00[i] = scan->s10[i] = scan->s11[i] = 0;
+	for (t=0; t<span; t++) {
+	    scan->s00[i] += scan->c00[i + t];
+	    scan->s10[i] += scan->c10[i + t];
+	    scan->s11[i] += scan->c11[i + t];
+	    }
+	}
+
+    /* Invert the matrices to get covariances, as in the scalar loops */
+    const __m256d quarter_div = _mm256_set1_pd(4.0);
+    const __m256d min_det = _mm256_set1_pd(0.00001);
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d failed = _mm256_set1_pd(-2.0);
+    const __m256d sign_bit = _mm256_set1_pd(-0.0);
+    for (i=0; i+4<=count; i+=4) {
+	__m256d v00 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(scan->s00 + i)));
+	__m256d v10 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(scan->s10 + i)));
+	__m256d v11 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(scan->s11 + i)));
+	__m256d vdet = _mm256_div_pd(_mm256_sub_pd(_mm256_mul_pd(v00, v11), _mm256_mul_pd(v10, v10)),
+				     quarter_div);
+	__m256d va = _mm256_div_pd(v11, vdet);
+	__m256d vd = _mm256_div_pd(v00, vdet);
+	__m256d vb = _mm256_div_pd(_mm256_xor_pd(v10, sign_bit), vdet);
+	__m256d diff = _mm256_sub_pd(va, vd);
+	__m256d root = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(diff, diff),
+						    _mm256_mul_pd(_mm256_mul_pd(four, vb), vb)));
+	__m256d vval = _mm256_div_pd(_mm256_add_pd(_mm256_add_pd(va, vd), root), two);
+	vval = _mm256_blendv_pd(vval, failed, _mm256_cmp_pd(vdet, min_det, _CMP_LT_OQ));
+	_mm256_storeu_pd(scan->val + i, vval);
+	}
+    for (; i<count; i++) {
+	m00 = scan->s00[i];
+	m10 = scan->s10[i];
+	m11 = scan->s11[i];
+	m01 = m10;
+	det = (m00 * m11) - (m01 * m10);
+	det /= 4.0;
+	if (det < 0.00001) {
+	    scan->val[i] = -2.0;
+	    continue;
+	    }
+	a =  m11 / det;
+	d =  m00 / det;
+	b = -m01 / det;
+	scan->val[i] = ((a + d) + sqrt((a-d)*(a-d) + 4*b*b)) / 2.0;
+	}
+    }
+
+/* Memory of a scan of "nx" columns with an NxN neighborhood */
+static size_t scan_bytes(
+    int nx,
+    int n)
+{
+    return (3 * (size_t)(nx + n) + 3 * (size_t)nx) * sizeof(int) + (size_t)nx * sizeof(double);
+    }
+
+/* Set up the scan of the processed rectangle. The arrays are taken from the
+   context if it has a large enough scan buffer. Returns FALSE if the vector
+   path does not apply, with *status FAILURE if memory allocation failed */
+static int scan_begin(
+    ForstnerScan *scan,
+    ForstnerCtx *ctx,
+    const unsigned char *image,
+    int xdim, int ydim, int x0, int y0, int nx, int ny, int n,
+    int *status)
+{
+    size_t count, ints;
+    char *mem;
+
+    *status = SUCCESS;
+    if ((n < 3) || !__builtin_cpu_supports("avx2"))
+	return FALSE;
+
+    scan->image = image;
+    scan->xdim  = xdim;
+    scan->w     = n / 2;
+    scan->xa    = (x0 > scan->w) ? x0 : scan->w;
+    scan->ya    = (y0 > scan->w) ? y0 : scan->w;
+    scan->xb    = (x0 + nx - 1 < xdim - scan->w - 1) ? x0 + nx - 1 : xdim - scan->w - 1;
+    scan->yb    = (y0 + ny - 1 < ydim - scan->w - 1) ? y0 + ny - 1 : ydim - scan->w - 1;
+    scan->buffer = NULL;
+    scan->owned = FALSE;
+    if ((scan->xa > scan->xb) || (scan->ya > scan->yb))
+	return TRUE;
+
+    count = scan->xb - scan->xa + 1;
+    scan->ncols = count + 2 * scan->w - 2;
+    ints = 3 * (size_t)scan->ncols + 3 * count;
+    if ((ctx != NULL) && (ctx->scan_buffer != NULL) &&
+	(ints * sizeof(int) + count * sizeof(double) <= ctx->scan_bytes)) {
+	mem = (char *)ctx->scan_buffer;
+	memset(mem, 0, ints * sizeof(int) + count * sizeof(double));
+	}
+    else if ((mem = (char *)calloc(1, ints * sizeof(int) + count * sizeof(double))) != NULL)
+	scan->owned = TRUE;
+    else {
+	printf("int_forstner(): memory allocation error\n");
+	*status = FAILURE;
+	return FALSE;
+	}
+    scan->buffer = mem;
+    scan->val = (double *)mem;
+    scan->c00 = (int *)(mem + count * sizeof(double));
+    scan->c10 = scan->c00 + scan->ncols;
+    scan->c11 = scan->c10 + scan->ncols;
+    scan->s00 = scan->c11 + scan->ncols;
+    scan->s10 = scan->s00 + count;
+    scan->s11 = scan->s10 + count;
+    return TRUE;
+    }
+
+/* Compute the interest of row "y"; rows must be scanned from ya to yb */
+static const double *scan_row(
+    ForstnerScan *scan,
+    int y)
+{
+    int r;
+
+    if (y == scan->ya) {
+	for (r=y-scan->w+1; r<y+scan->w; r++)
+	    scan_accumulate_row(scan, r, 1);
+	}
+    else {
+	scan_accumulate_row(scan, y - scan->w, -1);
+	scan_accumulate_row(scan, y + scan->w - 1, 1);
+	}
+    scan_interest(scan);
+    return scan->val;
+    }
+
+static void scan_end(
+    ForstnerScan *scan)
+{
+    if (scan->owned)
+	free(scan->buffer);
+    scan->buffer = NULL;
+    }
+
+#endif /* INT_FORSTNER_AVX2 */
 
 
 /******************************************************************************
@@ -66,7 +385,8 @@ static int *m11_sums;
 
     */
 
-int int_forstner(
+int int_forstner_ctx(
+    ForstnerCtx *ctx,		/* input summation buffers, or NULL */
     const unsigned char *image,	/* input intensity image */
     int xdim,			/* input size of X dimension */
     int ydim,			/* input size of Y dimension */
@@ -89,13 +409,38 @@ int int_forstner(
 	return FAILURE;
 	}
 
+#ifdef INT_FORSTNER_AVX2
+    /* Use the vector row scan if the CPU supports it */
+    {
+	ForstnerScan scan;
+	int status;
+	if (scan_begin(&scan, ctx, image, xdim, ydim, x0, y0, nx, ny, n, &status)) {
+	    for (iy=y0; iy<y0+ny; iy++) {
+		for (ix=x0; ix<x0+nx; ix++)
+		    interest[(size_t)iy * xdim + ix] = -1.0;
+		}
+	    for (iy=scan.ya; (scan.buffer != NULL) && (iy<=scan.yb); iy++) {
+		const double *val = scan_row(&scan, iy);
+		float *out = interest + (size_t)iy * xdim + scan.xa;
+		for (ix=0; ix<=scan.xb-scan.xa; ix++)
+		    out[ix] = val[ix];
+		}
+	    scan_end(&scan);
+	    return SUCCESS;
+	    }
+	if (status == FAILURE)
+	    return FAILURE;
+    }
+#endif
+
     /* Use previously allocated buffers if available and appropriate */
-    if (((nx + n) <= (nx_max + n_max)) &&
-	(m00_sums != NULL) && (m10_sums != NULL) && (m11_sums != NULL)) {
+    if ((ctx != NULL) && ((nx + n) <= (ctx->nx_max + ctx->n_max)) &&
+	(ctx->m00_sums != NULL) && (ctx->m10_sums != NULL) &&
+	(ctx->m11_sums != NULL)) {
 	alloc = FALSE;
-	m00sums = m00_sums;
-	m10sums = m10_sums;
-	m11sums = m11_sums;
+	m00sums = ctx->m00_sums;
+	m10sums = ctx->m10_sums;
+	m11sums = ctx->m11_sums;
 	}
 
     /* Otherwise allocate summation buffers */
@@ -315,43 +660,71 @@ int int_forstner(
 
 
 /******************************************************************************
-********************************   INT_FORSTNER_ALLOC   ***********************
+********************************   INT_FORSTNER_CTX_ALLOC   *******************
 *******************************************************************************
 
-    This function allocates internal buffers which are used instead of having
-    the individual interest-generating functions allocate and free buffers
-    with each call. If used, however, the functions become non-reentrant. */
+    This function allocates the summation buffers of a context, which are
+    used instead of having the individual interest-generating functions
+    allocate and free buffers with each call. A context must not be used by
+    two calls at the same time; calls with different contexts are
+    independent. */
 
-int int_forstner_alloc(
+int int_forstner_ctx_alloc(
+    ForstnerCtx *ctx,		/* output summation buffers */
     int nxmax,			/* input max number of columns */
     int nmax)			/* input max size of NxN int. neighborhood */
 {
     /* Free any previously allocated buffers */
-    int_forstner_free();
+    int_forstner_ctx_free(ctx);
 
     /* Record the sizes we are allocating for */
-    nx_max = nxmax;
-    n_max  = nmax;
+    ctx->nx_max = nxmax;
+    ctx->n_max  = nmax;
 
-    if ((m00_sums = (int *)malloc((sizeof(int)) * (nxmax + nmax))) == NULL) {
+    if ((ctx->m00_sums = (int *)malloc((sizeof(int)) * (nxmax + nmax))) == NULL) {
 	printf("int_forstner(): memory allocation error\n");
+	int_forstner_ctx_free(ctx);
 	return FAILURE;
 	}
-    if ((m10_sums = (int *)malloc((sizeof(int)) * (nxmax + nmax))) == NULL) {
+    if ((ctx->m10_sums = (int *)malloc((sizeof(int)) * (nxmax + nmax))) == NULL) {
 	printf("int_forstner(): memory allocation error\n");
-	free((char *)m00_sums);
+	int_forstner_ctx_free(ctx);
 	return FAILURE;
 	}
-    if ((m11_sums = (int *)malloc((sizeof(int)) * (nxmax + nmax))) == NULL) {
+    if ((ctx->m11_sums = (int *)malloc((sizeof(int)) * (nxmax + nmax))) == NULL) {
 	printf("int_forstner(): memory allocation error\n");
-	free((char *)m00_sums);
-	free((char *)m10_sums);
+	int_forstner_ctx_free(ctx);
 	return FAILURE;
 	}
+#ifdef INT_FORSTNER_AVX2
+    ctx->scan_bytes = scan_bytes(nxmax, nmax);
+    if ((ctx->scan_buffer = malloc(ctx->scan_bytes)) == NULL) {
+	printf("int_forstner(): memory allocation error\n");
+	int_forstner_ctx_free(ctx);
+	return FAILURE;
+	}
+#endif
     return SUCCESS;
     }
 
 
+/******************************************************************************
+********************************   INT_FORSTNER_ALLOC   ***********************
+*******************************************************************************
+
+    This function allocates internal buffers which are used instead of having
+    the individual interest-generating functions allocate and free buffers
+    with each call. If used, however, the functions without a context become
+    non-reentrant. */
+
+int int_forstner_alloc(
+    int nxmax,			/* input max number of columns */
+    int nmax)			/* input max size of NxN int. neighborhood */
+{
+    return int_forstner_ctx_alloc(&forstner_buffers, nxmax, nmax);
+    }
+
+
 /******************************************************************************
 ********************************   INT_FORSTNER_BEST   ************************
 *******************************************************************************
@@ -359,7 +732,8 @@ int int_forstner_alloc(
     This function uses the interest operator developed by Forstner (?) to
     find the most interesting point in an image. */
 
-int int_forstner_best(
+int int_forstner_best_ctx(
+    ForstnerCtx *ctx,		/* input summation buffers, or NULL */
     const unsigned char *image,	/* input intensity image */
     int xdim,			/* input size of X dimension */
     int ydim,			/* input size of Y dimension */
@@ -384,13 +758,44 @@ int int_forstner_best(
 	return FAILURE;
 	}
 
+#ifdef INT_FORSTNER_AVX2
+    /* Use the vector row scan if the CPU supports it */
+    {
+	ForstnerScan scan;
+	int status;
+	if (scan_begin(&scan, ctx, image, xdim, ydim, x0, y0, nx, ny, n, &status)) {
+	    bval = -1;
+	    for (iy=scan.ya; (scan.buffer != NULL) && (iy<=scan.yb); iy++) {
+		const double *row = scan_row(&scan, iy);
+		for (i=0; i<=scan.xb-scan.xa; i++) {
+		    if (row[i] < 0)
+			continue;
+		    if ((bval < 0) || (bval > row[i])) {
+			bval = row[i];
+			bx = scan.xa + i - x0;
+			by = iy - y0;
+			}
+		    }
+		}
+	    scan_end(&scan);
+	    *x = bx + x0;
+	    *y = by + y0;
+	    *intr = bval;
+	    return SUCCESS;
+	    }
+	if (status == FAILURE)
+	    return FAILURE;
+    }
+#endif
+
     /* Use previously allocated buffers if available and appropriate */
-    if (((nx + n) <= (nx_max + n_max)) &&
-	(m00_sums != NULL) && (m10_sums != NULL) && (m11_sums != NULL)) {
+    if ((ctx != NULL) && ((nx + n) <= (ctx->nx_max + ctx->n_max)) &&
+	(ctx->m00_sums != NULL) && (ctx->m10_sums != NULL) &&
+	(ctx->m11_sums != NULL)) {
 	alloc = FALSE;
-	m00sums = m00_sums;
-	m10sums = m10_sums;
-	m11sums = m11_sums;
+	m00sums = ctx->m00_sums;
+	m10sums = ctx->m10_sums;
+	m11sums = ctx->m11_sums;
 	}
 
     /* Otherwise allocate summation buffers */
@@ -628,7 +1033,8 @@ int int_forstner_best(
     outputs will be set to identical negative values (depending on the
     problem). */
 
-int int_forstner_cov(
+int int_forstner_cov_ctx(
+    ForstnerCtx *ctx,		/* input summation buffers, or NULL */
     const unsigned char *image,	/* input intensity image */
     int xdim,			/* input size of X dimension */
     int ydim,			/* input size of Y dimension */
@@ -654,12 +1060,13 @@ int int_forstner_cov(
 	}
 
     /* Use previously allocated buffers if available and appropriate */
-    if (((nx + n) <= (nx_max + n_max)) &&
-	(m00_sums != NULL) && (m10_sums != NULL) && (m11_sums != NULL)) {
+    if ((ctx != NULL) && ((nx + n) <= (ctx->nx_max + ctx->n_max)) &&
+	(ctx->m00_sums != NULL) && (ctx->m10_sums != NULL) &&
+	(ctx->m11_sums != NULL)) {
 	alloc = FALSE;
-	m00sums = m00_sums;
-	m10sums = m10_sums;
-	m11sums = m11_sums;
+	m00sums = ctx->m00_sums;
+	m10sums = ctx->m10_sums;
+	m11sums = ctx->m11_sums;
 	}
 
     /* Otherwise allocate summation buffers */
@@ -892,15 +1299,33 @@ int int_forstner_cov(
 
 void int_forstner_free(void)
 {
-    if (m00_sums != NULL)
-	free((char *)m00_sums);
-    if (m10_sums != NULL)
-	free((char *)m10_sums);
-    if (m11_sums != NULL)
-	free((char *)m11_sums);
-    m00_sums = NULL;
-    m10_sums = NULL;
-    m11_sums = NULL;
+    int_forstner_ctx_free(&forstner_buffers);
+    }
+
+
+/******************************************************************************
+********************************   INT_FORSTNER_CTX_FREE   ********************
+*******************************************************************************
+
+    This function frees the buffers allocated by int_forstner_ctx_alloc(). */
+
+void int_forstner_ctx_free(
+    ForstnerCtx *ctx)		/* input summation buffers */
+{
+    if (ctx->m00_sums != NULL)
+	free((char *)ctx->m00_sums);
+    if (ctx->m10_sums != NULL)
+	free((char *)ctx->m10_sums);
+    if (ctx->m11_sums != NULL)
+	free((char *)ctx->m11_sums);
+    ctx->m00_sums = NULL;
+    ctx->m10_sums = NULL;
+    ctx->m11_sums = NULL;
+    free(ctx->scan_buffer);
+    ctx->scan_buffer = NULL;
+    ctx->scan_bytes = 0;
+    ctx->nx_max = 0;
+    ctx->n_max  = 0;
     }
 
 
@@ -912,7 +1337,8 @@ void int_forstner_free(void)
     find the N most interesting points in an image. The output points are
     in no special order. */
 
-int int_forstner_nbest(
+int int_forstner_nbest_ctx(
+    ForstnerCtx *ctx,		/* input summation buffers, or NULL */
     const unsigned char *image,	/* input intensity image */
     int xdim,			/* input size of X dimension */
     int ydim,			/* input size of Y dimension */
@@ -927,9 +1353,10 @@ int int_forstner_nbest(
     float intr[])		/* output values of interest operation */
 {
     int ix, iy, ix_start, iy_start, ix_stop, iy_stop, row_offset, start_offset;
-    int i, j, w, d0, d1, dd, first_row, first_col, len, worst = 0;
+    int i, j, w, d0, d1, dd, first_row, first_col;
     const unsigned char *img;
-    double a, b, d, det, m00 = 0, m01 = 0, m10 = 0, m11 = 0, val, wval = 0;
+    double a, b, d, det, m00 = 0, m01 = 0, m10 = 0, m11 = 0, val;
+    NBestList list;
     int *m00sums, *m10sums, *m11sums, *m00p = 0, *m10p = 0, *m11p = 0, alloc;
 
     /* Check that N is odd */
@@ -937,14 +1364,41 @@ int int_forstner_nbest(
 	printf("int_forstner_best(): N must be odd: %d\n", n);
 	return FAILURE;
 	}
+    list.max  = max;
+    list.len  = 0;
+    list.pos2 = pos2;
+    list.intr = intr;
+
+#ifdef INT_FORSTNER_AVX2
+    /* Use the vector row scan if the CPU supports it */
+    {
+	ForstnerScan scan;
+	int status;
+	if (scan_begin(&scan, ctx, image, xdim, ydim, x0, y0, nx, ny, n, &status)) {
+	    for (iy=scan.ya; (scan.buffer != NULL) && (iy<=scan.yb); iy++) {
+		const double *row = scan_row(&scan, iy);
+		for (i=0; i<=scan.xb-scan.xa; i++) {
+		    if (row[i] >= 0)
+			nbest_add(&list, scan.xa + i, iy, row[i]);
+		    }
+		}
+	    scan_end(&scan);
+	    *num = list.len;
+	    return SUCCESS;
+	    }
+	if (status == FAILURE)
+	    return FAILURE;
+    }
+#endif
 
     /* Use previously allocated buffers if available and appropriate */
-    if (((nx + n) <= (nx_max + n_max)) &&
-	(m00_sums != NULL) && (m10_sums != NULL) && (m11_sums != NULL)) {
+    if ((ctx != NULL) && ((nx + n) <= (ctx->nx_max + ctx->n_max)) &&
+	(ctx->m00_sums != NULL) && (ctx->m10_sums != NULL) &&
+	(ctx->m11_sums != NULL)) {
 	alloc = FALSE;
-	m00sums = m00_sums;
-	m10sums = m10_sums;
-	m11sums = m11_sums;
+	m00sums = ctx->m00_sums;
+	m10sums = ctx->m10_sums;
+	m11sums = ctx->m11_sums;
 	}
 
     /* Otherwise allocate summation buffers */
@@ -982,7 +1436,7 @@ int int_forstner_nbest(
     image += start_offset;
 
     /* Process each row */
-    *num = len = 0;
+    *num = 0;
     first_row = TRUE;
     for (iy=0; iy<ny; iy++) {
 
@@ -1140,35 +1594,8 @@ int int_forstner_nbest(
 	    b = -m01 / det;
 	    val = ((a + d) + sqrt((a-d)*(a-d) + 4*b*b)) / 2.0;
 
-	    /* If the list is not yet full, then add new point */
-	    if (len < max) {
-		pos2[len][0] = ix + x0;
-		pos2[len][1] = iy + y0;
-		intr[len]    = val;
-		if ((len == 0) || (val > wval)) {
-		    worst = len;
-		    wval  = val;
-		    }
-		len++;
-		continue;
-		}
-
-	    /* Skip any point which is worse than the worst in the list */
-	    if (val > wval)
-		continue;
-
-	    /* Add new point to list, and update pointer to worst entry */
-	    pos2[worst][0] = ix + x0;
-	    pos2[worst][1] = iy + y0;
-	    intr[worst]    = val;
-	    worst = 0;
-	    wval  = intr[0];
-	    for (i=1; i<max; i++) {
-		if (intr[i] > wval) {
-		    worst = i;
-		    wval  = intr[i];
-		    }
-		}
+	    /* Offer the point to the list */
+	    nbest_add(&list, ix + x0, iy + y0, val);
 	    }
 
 	/* Move to the start of the next row */
@@ -1185,7 +1612,82 @@ int int_forstner_nbest(
 	}
 
     /* Finish up */
-    *num = len;
+    *num = list.len;
 
     return SUCCESS;
     }
+
+
+/******************************************************************************
+********************************   CONTEXT-FREE ENTRY POINTS   ****************
+*******************************************************************************
+
+    These functions use the buffers of int_forstner_alloc() if they were
+    allocated, and allocate their own buffers otherwise. */
+
+int int_forstner(
+    const unsigned char *image,	/* input intensity image */
+    int xdim,			/* input size of X dimension */
+    int ydim,			/* input size of Y dimension */
+    int x0,			/* input left-most X coordinate */
+    int y0,			/* input upper-most Y coordinate */
+    int nx,			/* input number of columns */
+    int ny,			/* input number of rows */
+    int n,			/* input size of NxN interest neighborhood */
+    float *interest)		/* output interest image */
+{
+    return int_forstner_ctx(&forstner_buffers, image, xdim, ydim, x0, y0,
+	nx, ny, n, interest);
+    }
+
+int int_forstner_best(
+    const unsigned char *image,	/* input intensity image */
+    int xdim,			/* input size of X dimension */
+    int ydim,			/* input size of Y dimension */
+    int x0,			/* input left-most X coordinate */
+    int y0,			/* input upper-most Y coordinate */
+    int nx,			/* input number of columns */
+    int ny,			/* input number of rows */
+    int n,			/* input size of NxN neighborhood around pt */
+    int *x,			/* output X coordinate of best point */
+    int *y,			/* output Y coordinate of best point */
+    double *intr)		/* output value of interest operation */
+{
+    return int_forstner_best_ctx(&forstner_buffers, image, xdim, ydim, x0, y0,
+	nx, ny, n, x, y, intr);
+    }
+
+int int_forstner_cov(
+    const unsigned char *image,	/* input intensity image */
+    int xdim,			/* input size of X dimension */
+    int ydim,			/* input size of Y dimension */
+    int x0,			/* input left-most X coordinate */
+    int y0,			/* input upper-most Y coordinate */
+    int nx,			/* input number of columns */
+    int ny,			/* input number of rows */
+    int n,			/* input size of NxN neighborhood around pt */
+    float *c00,			/* output image of (0,0) elements of covar */
+    float *c01,			/* output image of (0,1) elements of covar */
+    float *c11)			/* output image of (1,1) elements of covar */
+{
+    return int_forstner_cov_ctx(&forstner_buffers, image, xdim, ydim, x0, y0,
+	nx, ny, n, c00, c01, c11);
+    }
+
+int int_forstner_nbest(
+    const unsigned char *image,	/* input intensity image */
+    int xdim,			/* input size of X dimension */
+    int ydim,			/* input size of Y dimension */
+    int x0,			/* input left-most X coordinate */
+    int y0,			/* input upper-most Y coordinate */
+    int nx,			/* input number of columns */
+    int ny,			/* input number of rows */
+    int n,			/* input size of NxN neighborhood around pt */
+    int max,			/* input maximum length of output lists */
+    int *num,			/* output number of points in output lists */
+    int pos2[][2],		/* output coordinates of best point */
+    float intr[])		/* output values of interest operation */
+{
+    return int_forstner_nbest_ctx(&forstner_buffers, image, xdim, ydim, x0, y0,
+	nx, ny, n, max, num, pos2, intr);
+    }
@@ -17,9 +17,15 @@
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "landmark_tools/data_interpolation/interpolate_data.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define INTERPOLATE_AVX2
+#include <immintrin.h>
+#endif
+
 double  inter_double_matrix(double *img, size_t xsize, size_t ysize, double  x, double  y)
 {
     
@@ -109,15 +115,19 @@ double  inter_float_matrix(float *img, size_t xsize, size_t ysize, double  x, do
     dx0 = 1.0 - dx;
     dy0 = 1.0 - dy;
     
+    // On the last column or row the neighbor past the edge has no weight
+    int64_t ix1 = ix + 1 < (int64_t)xsize ? ix + 1 : ix;
+    int64_t iy1 = iy + 1 < (int64_t)ysize ? iy + 1 : iy;
+    
     //Four neighboring elements
     // img[floor(x), floor(y)]
     p00 = img[iy*xsize + ix];
     // img[floor(x)+1, floor(y)]
-    p01 = img[iy*xsize + ix+1];
+    p01 = img[iy*xsize + ix1];
     // img[floor(x)+1, floor(y)+1]
-    p11 = img[(iy+1)*xsize + ix+1];
+    p11 = img[iy1*xsize + ix1];
     // img[floor(x), floor(y)+1]
-    p10 = img[(iy+1)*xsize + ix];
+    p10 = img[iy1*xsize + ix];
     
     if(isnan(p00) || isnan(p01) || isnan(p11) || isnan(p10))
     {
@@ -131,6 +141,86 @@ double  inter_float_matrix(float *img, size_t xsize, size_t ysize, double  x, do
 
 }
  
+int32_t inter_float_matrix_cell(size_t xsize, size_t ysize, double x, double y, int64_t idx[4], double *dx, double *dy)
+{
+    double round_x = round(x);
+    double round_y = round(y);
+    if(round_x<0 || round_y<0 || round_x>=xsize || round_y>=ysize){
+        return 0;
+    }
+    else if(x == round_x && y == round_y){
+        idx[0] = (int64_t)y*xsize + (int64_t)x;
+        return 1;
+    }
+    
+    // If close to edge, don't interpolate along that axis
+    if(x > xsize-1){
+        x = round_x;
+    }
+    if(y > ysize - 1){
+        y = round_y;
+    }
+    
+    int64_t ix = (int64_t)x;
+    int64_t iy = (int64_t)y;
+    int64_t ix1 = ix + 1 < (int64_t)xsize ? ix + 1 : ix;
+    int64_t iy1 = iy + 1 < (int64_t)ysize ? iy + 1 : iy;
+    *dx = (x - ix);
+    *dy = (y - iy);
+    idx[0] = iy*xsize + ix;
+    idx[1] = iy*xsize + ix1;
+    idx[2] = iy1*xsize + ix1;
+    idx[3] = iy1*xsize + ix;
+    return 2;
+}
+
+double  inter_half_matrix(const uint16_t *img, size_t xsize, size_t ysize, double  x, double  y)
+{
+    int64_t idx[4];
+    double dx = 0.0, dy = 0.0;
+    int32_t cell = inter_float_matrix_cell(xsize, ysize, x, y, idx, &dx, &dy);
+    if(cell == 0){
+        return NAN;
+    }else if(cell == 1){
+        return half_to_float(img[idx[0]]);
+    }
+    
+    float p00 = half_to_float(img[idx[0]]);
+    float p01 = half_to_float(img[idx[1]]);
+    float p11 = half_to_float(img[idx[2]]);
+    float p10 = half_to_float(img[idx[3]]);
+    if(isnan(p00) || isnan(p01) || isnan(p11) || isnan(p10))
+    {
+        return NAN;
+    }
+    return (1.0 - dy) * ((1.0 - dx) * p00 + dx * p01) + dy * ((1.0 - dx) * p10 + dx * p11);
+}
+
+double  inter_scaled_short_matrix(const int16_t *img, size_t xsize, size_t ysize, double offset, double scale,
+                                  double  x, double  y)
+{
+    int64_t idx[4];
+    double dx = 0.0, dy = 0.0;
+    int32_t cell = inter_float_matrix_cell(xsize, ysize, x, y, idx, &dx, &dy);
+    if(cell == 0){
+        return NAN;
+    }else if(cell == 1){
+        return img[idx[0]] == SCALED_SHORT_NAN ? NAN : offset + scale*img[idx[0]];
+    }
+    
+    int16_t p00 = img[idx[0]];
+    int16_t p01 = img[idx[1]];
+    int16_t p11 = img[idx[2]];
+    int16_t p10 = img[idx[3]];
+    if(p00 == SCALED_SHORT_NAN || p01 == SCALED_SHORT_NAN || p11 == SCALED_SHORT_NAN || p10 == SCALED_SHORT_NAN)
+    {
+        return NAN;
+    }
+    // Interpolate the codes, the scale is linear
+    double bv = (1.0 - dy) * ((1.0 - dx) * p00 + dx * p01) + dy * ((1.0 - dx) * p10 + dx * p11);
+    return offset + scale*bv;
+}
+
 bool  inter_uint8_matrix(uint8_t *img, size_t xsize, size_t ysize, double  x, double  y, uint8_t* val)
 {
     register double bv;
@@ -279,6 +369,287 @@ int32_t inter_unsigned_short_image(uint16_t *img, size_t xsize, size_t ysize, do
     }
 }
 
+#ifdef INTERPOLATE_AVX2
+/**
+ \brief Cells of 4 samples in the interior [`lo`, `x_hi`) x [`lo`, `y_hi`) of a matrix
+ 
+ Lanes outside the interior get the cell of (0, 0) and are left to the caller.
+ \param[in] xsize width of matrix
+ \param[in] x 4 x coordinates
+ \param[in] y 4 y coordinates
+ \param[in] lo lowest x and y of the interior
+ \param[in] x_hi x of the interior is below x_hi
+ \param[in] y_hi y of the interior is below y_hi
+ \param[out] idx row-major index of the top left neighbor of each lane
+ \param[out] dx fractional part of x
+ \param[out] dy fractional part of y
+ \return bit mask of the interior lanes
+ */
+__attribute__((target("avx2")))
+static int32_t inter_cell_x4(size_t xsize, const double *x, const double *y, double lo, double x_hi, double y_hi,
+                             __m256i *idx, __m256d *dx, __m256d *dy)
+{
+    __m256d vx = _mm256_loadu_pd(x);
+    __m256d vy = _mm256_loadu_pd(y);
+    __m256d inside = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(vx, _mm256_set1_pd(lo), _CMP_GE_OQ),
+                                                 _mm256_cmp_pd(vx, _mm256_set1_pd(x_hi), _CMP_LT_OQ)),
+                                   _mm256_and_pd(_mm256_cmp_pd(vy, _mm256_set1_pd(lo), _CMP_GE_OQ),
+                                                 _mm256_cmp_pd(vy, _mm256_set1_pd(y_hi), _CMP_LT_OQ)));
+    int32_t mask = _mm256_movemask_pd(inside);
+    if(mask == 0) return 0;
+    
+    // Lanes outside the interior sample (0, 0)
+    vx = _mm256_and_pd(vx, inside);
+    vy = _mm256_and_pd(vy, inside);
+    __m256d fx = _mm256_floor_pd(vx);
+    __m256d fy = _mm256_floor_pd(vy);
+    __m256i ix = _mm256_cvtepi32_epi64(_mm256_cvttpd_epi32(fx));
+    __m256i iy = _mm256_cvtepi32_epi64(_mm256_cvttpd_epi32(fy));
+    *idx = _mm256_add_epi64(_mm256_mul_epu32(iy, _mm256_set1_epi64x((int64_t)xsize)), ix);
+    *dx = _mm256_sub_pd(vx, fx);
+    *dy = _mm256_sub_pd(vy, fy);
+    return mask;
+}
+
+/**
+ \brief dy0 * (dx0 * p00 + dx * p01) + dy * (dx0 * p10 + dx * p11), in the order of the scalar functions
+ */
+__attribute__((target("avx2")))
+static __m256d bilinear_x4(__m256d p00, __m256d p01, __m256d p10, __m256d p11, __m256d dx, __m256d dy)
+{
+    __m256d one = _mm256_set1_pd(1.0);
+    __m256d dx0 = _mm256_sub_pd(one, dx);
+    __m256d dy0 = _mm256_sub_pd(one, dy);
+    __m256d top = _mm256_add_pd(_mm256_mul_pd(dx0, p00), _mm256_mul_pd(dx, p01));
+    __m256d bottom = _mm256_add_pd(_mm256_mul_pd(dx0, p10), _mm256_mul_pd(dx, p11));
+    return _mm256_add_pd(_mm256_mul_pd(dy0, top), _mm256_mul_pd(dy, bottom));
+}
+
+/**
+ \brief `inter_float_matrix` of the interior lanes of 4 samples
+ \return bit mask of the lanes set in `val`
+ */
+__attribute__((target("avx2")))
+static int32_t inter_float_matrix_x4(const float *img, size_t xsize, size_t ysize, const double *x, const double *y,
+                                     double *val)
+{
+    __m256i idx;
+    __m256d dx, dy;
+    int32_t mask = inter_cell_x4(xsize, x, y, 0.0, (double)xsize - 1, (double)ysize - 1, &idx, &dx, &dy);
+    if(mask == 0) return 0;
+    
+    __m256d p00 = _mm256_cvtps_pd(_mm256_i64gather_ps(img, idx, 4));
+    __m256d p01 = _mm256_cvtps_pd(_mm256_i64gather_ps(img + 1, idx, 4));
+    __m256d p10 = _mm256_cvtps_pd(_mm256_i64gather_ps(img + xsize, idx, 4));
+    __m256d p11 = _mm256_cvtps_pd(_mm256_i64gather_ps(img + xsize + 1, idx, 4));
+    __m256d bv = bilinear_x4(p00, p01, p10, p11, dx, dy);
+    
+    // A NAN neighbor gives NAN, and a pixel center gives the pixel
+    __m256d nan = _mm256_or_pd(_mm256_or_pd(_mm256_cmp_pd(p00, p00, _CMP_UNORD_Q), _mm256_cmp_pd(p01, p01, _CMP_UNORD_Q)),
+                               _mm256_or_pd(_mm256_cmp_pd(p10, p10, _CMP_UNORD_Q), _mm256_cmp_pd(p11, p11, _CMP_UNORD_Q)));
+    bv = _mm256_blendv_pd(bv, _mm256_set1_pd(NAN), nan);
+    __m256d zero = _mm256_setzero_pd();
+    __m256d center = _mm256_and_pd(_mm256_cmp_pd(dx, zero, _CMP_EQ_OQ), _mm256_cmp_pd(dy, zero, _CMP_EQ_OQ));
+    bv = _mm256_blendv_pd(bv, p00, center);
+    
+    double out[4];
+    _mm256_storeu_pd(out, bv);
+    for(int32_t k = 0; k < 4; k++){
+        if(mask & (1 << k)) val[k] = out[k];
+    }
+    return mask;
+}
+
+/**
+ \brief `inter_double_matrix` of the interior lanes of 4 samples
+ \return bit mask of the lanes set in `val`
+ */
+__attribute__((target("avx2")))
+static int32_t inter_double_matrix_x4(const double *img, size_t xsize, size_t ysize, const double *x, const double *y,
+                                      double *val)
+{
+    __m256i idx;
+    __m256d dx, dy;
+    int32_t mask = inter_cell_x4(xsize, x, y, 1.0, (double)xsize - 1, (double)ysize - 1, &idx, &dx, &dy);
+    if(mask == 0) return 0;
+    
+    __m256d p00 = _mm256_i64gather_pd(img, idx, 8);
+    __m256d p01 = _mm256_i64gather_pd(img + 1, idx, 8);
+    __m256d p10 = _mm256_i64gather_pd(img + xsize, idx, 8);
+    __m256d p11 = _mm256_i64gather_pd(img + xsize + 1, idx, 8);
+    __m256d bv = bilinear_x4(p00, p01, p10, p11, dx, dy);
+    
+    double out[4];
+    _mm256_storeu_pd(out, bv);
+    for(int32_t k = 0; k < 4; k++){
+        if(mask & (1 << k)) val[k] = out[k];
+    }
+    return mask;
+}
+
+/**
+ \brief `inter_uint8_matrix` of the interior lanes of 4 samples
+ \return bit mask of the lanes set in `val`
+ */
+__attribute__((target("avx2")))
+static int32_t inter_uint8_matrix_x4(const uint8_t *img, size_t xsize, size_t ysize, const double *x, const double *y,
+                                     uint8_t *val)
+{
+    // Each gather reads 4 bytes from a neighbor pair, so the last 3 columns are left to the scalar path
+    __m256i idx;
+    __m256d dx, dy;
+    int32_t mask = inter_cell_x4(xsize, x, y, 1.0, (double)xsize - 3, (double)ysize - 1, &idx, &dx, &dy);
+    if(mask == 0) return 0;
+    
+    __m128i pair = _mm256_i64gather_epi32((const int *)img, idx, 1);
+    __m128i pair_below = _mm256_i64gather_epi32((const int *)(img + xsize), idx, 1);
+    __m128i byte = _mm_set1_epi32(0xFF);
+    __m256d p00 = _mm256_cvtepi32_pd(_mm_and_si128(pair, byte));
+    __m256d p01 = _mm256_cvtepi32_pd(_mm_and_si128(_mm_srli_epi32(pair, 8), byte));
+    __m256d p10 = _mm256_cvtepi32_pd(_mm_and_si128(pair_below, byte));
+    __m256d p11 = _mm256_cvtepi32_pd(_mm_and_si128(_mm_srli_epi32(pair_below, 8), byte));
+    __m256d bv = bilinear_x4(p00, p01, p10, p11, dx, dy);
+    
+    // round() of the non-negative values: the fraction of bv is exact, unlike bv + 0.5
+    __m256d whole = _mm256_floor_pd(bv);
+    __m256d half_up = _mm256_cmp_pd(_mm256_sub_pd(bv, whole), _mm256_set1_pd(0.5), _CMP_GE_OQ);
+    whole = _mm256_add_pd(whole, _mm256_and_pd(half_up, _mm256_set1_pd(1.0)));
+    int32_t out[4];
+    _mm_storeu_si128((__m128i *)out, _mm256_cvttpd_epi32(whole));
+    for(int32_t k = 0; k < 4; k++){
+        if(mask & (1 << k)) val[k] = (uint8_t)out[k];
+    }
+    return mask;
+}
+
+/**
+ \brief Whether the vector kernels can index a `xsize` x `ysize` matrix on this processor
+ */
+static bool inter_use_avx2(size_t xsize, size_t ysize)
+{
+    return xsize >= 4 && ysize >= 2 && xsize < INT32_MAX && ysize < INT32_MAX && __builtin_cpu_supports("avx2");
+}
+#endif
+
+void inter_float_matrix_batch(const float *img, size_t xsize, size_t ysize, const double *x, const double *y,
+                              size_t n, double *val)
+{
+    size_t i = 0;
+#ifdef INTERPOLATE_AVX2
+    if(inter_use_avx2(xsize, ysize)){
+        for(; i + 4 <= n; i += 4){
+            int32_t mask = inter_float_matrix_x4(img, xsize, ysize, &x[i], &y[i], &val[i]);
+            if(mask == 0xF) continue;
+            for(int32_t k = 0; k < 4; k++){
+                if(!(mask & (1 << k))) val[i + k] = inter_float_matrix((float *)img, xsize, ysize, x[i + k], y[i + k]);
+            }
+        }
+    }
+#endif
+    for(; i < n; i++){
+        val[i] = inter_float_matrix((float *)img, xsize, ysize, x[i], y[i]);
+    }
+}
+
+void inter_double_matrix_batch(const double *img, size_t xsize, size_t ysize, const double *x, const double *y,
+                               size_t n, double *val)
+{
+    size_t i = 0;
+#ifdef INTERPOLATE_AVX2
+    if(inter_use_avx2(xsize, ysize)){
+        for(; i + 4 <= n; i += 4){
+            int32_t mask = inter_double_matrix_x4(img, xsize, ysize, &x[i], &y[i], &val[i]);
+            if(mask == 0xF) continue;
+            for(int32_t k = 0; k < 4; k++){
+                if(!(mask & (1 << k))) val[i + k] = inter_double_matrix((double *)img, xsize, ysize, x[i + k], y[i + k]);
+            }
+        }
+    }
+#endif
+    for(; i < n; i++){
+        val[i] = inter_double_matrix((double *)img, xsize, ysize, x[i], y[i]);
+    }
+}
+
+void inter_uint8_matrix_batch(const uint8_t *img, size_t xsize, size_t ysize, const double *x, const double *y,
+                              size_t n, uint8_t *val, bool *valid)
+{
+    size_t i = 0;
+#ifdef INTERPOLATE_AVX2
+    if(inter_use_avx2(xsize, ysize)){
+        for(; i + 4 <= n; i += 4){
+            int32_t mask = inter_uint8_matrix_x4(img, xsize, ysize, &x[i], &y[i], &val[i]);
+            for(int32_t k = 0; k < 4; k++){
+                bool in_bounds = true;
+                if(!(mask & (1 << k))){
+                    val[i + k] = 0;
+                    in_bounds = inter_uint8_matrix((uint8_t *)img, xsize, ysize, x[i + k], y[i + k], &val[i + k]);
+                }
+                if(valid != NULL) valid[i + k] = in_bounds;
+            }
+        }
+    }
+#endif
+    for(; i < n; i++){
+        val[i] = 0;
+        bool in_bounds = inter_uint8_matrix((uint8_t *)img, xsize, ysize, x[i], y[i], &val[i]);
+        if(valid != NULL) valid[i] = in_bounds;
+    }
+}
+
+void inter_affine_row(double x0, double y0, double dx, double dy, size_t n, double *x, double *y)
+{
+    for(size_t i = 0; i < n; i++){
+        x[i] = x0 + i*dx;
+        y[i] = y0 + i*dy;
+    }
+}
+
+#ifdef INTERPOLATE_AVX2
+/**
+ \brief `inter_homography_row` of the 4 pixels from column `u`
+ 
+ The products and sums are not fused and the divisions are exact, so the coordinates are those of the scalar loop.
+ */
+__attribute__((target("avx2")))
+static void inter_homography_row_x4(double h[3][3], const double row[3], int32_t u, double *x, double *y)
+{
+    __m256d vu = _mm256_cvtepi32_pd(_mm_add_epi32(_mm_set1_epi32(u), _mm_setr_epi32(0, 1, 2, 3)));
+    __m256d hp[3];
+    for(int32_t k = 0; k < 3; k++){
+        hp[k] = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(h[k][0]), vu), _mm256_set1_pd(row[k])),
+                              _mm256_set1_pd(h[k][2]*1.0));
+    }
+    _mm256_storeu_pd(x, _mm256_div_pd(hp[0], hp[2]));
+    _mm256_storeu_pd(y, _mm256_div_pd(hp[1], hp[2]));
+}
+#endif
+
+void inter_homography_row(double h[3][3], int32_t u0, int32_t v, size_t n, double *x, double *y)
+{
+    // The sums of homographyTransfer33 in the same order, with the term of the row computed once
+    double row[3];
+    for(int32_t k = 0; k < 3; k++){
+        row[k] = h[k][1]*v;
+    }
+    size_t i = 0;
+#ifdef INTERPOLATE_AVX2
+    if(__builtin_cpu_supports("avx2")){
+        for(; i + 4 <= n; i += 4){
+            inter_homography_row_x4(h, row, u0 + (int32_t)i, &x[i], &y[i]);
+        }
+    }
+#endif
+    for(; i < n; i++){
+        double u = (double)(u0 + (int32_t)i);
+        double hp0 = h[0][0]*u + row[0] + h[0][2]*1.0;
+        double hp1 = h[1][0]*u + row[1] + h[1][2]*1.0;
+        double hp2 = h[2][0]*u + row[2] + h[2][2]*1.0;
+        x[i] = hp0/hp2;
+        y[i] = hp1/hp2;
+    }
+}
+
 void rev_short(int16_t *longone)
 {
     struct long_bytes {
@@ -311,3 +682,76 @@ void rev_float(float *longone)
     longptr->byte2 = longptr->byte3;
     longptr->byte3 = temp;
 }
+
+float half_to_float(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1F;
+    uint32_t mantissa = h & 0x3FF;
+    uint32_t bits;
+    
+    if(exponent == 0x1F){
+        // Inf or NaN
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    }else if(exponent != 0){
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }else if(mantissa != 0){
+        // Subnormal half, normalize it
+        exponent = 113;
+        while((mantissa & 0x400) == 0){
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    }else{
+        bits = sign;
+    }
+    
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+uint16_t float_to_half(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    int32_t exponent = (int32_t)((bits >> 23) & 0xFF);
+    uint32_t mantissa = bits & 0x7FFFFF;
+    
+    if(exponent == 0xFF){
+        // Keep NaN a NaN by forcing a mantissa bit
+        return sign | 0x7C00 | (mantissa != 0 ? 0x200 | (mantissa >> 13) : 0);
+    }
+    
+    exponent -= 112;
+    if(exponent >= 0x1F){
+        // Overflow to infinity
+        return sign | 0x7C00;
+    }
+    if(exponent <= 0){
+        if(exponent < -10){
+            // Underflow to signed zero
+            return sign;
+        }
+        // Subnormal half
+        mantissa |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half_mantissa = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if(remainder > halfway || (remainder == halfway && (half_mantissa & 1))){
+            half_mantissa++;
+        }
+        return sign | (uint16_t)half_mantissa;
+    }
+    
+    // Round to nearest even. A mantissa carry correctly rolls into the exponent
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1FFF;
+    if(remainder > 0x1000 || (remainder == 0x1000 && (half & 1))){
+        half++;
+    }
+    return sign | (uint16_t)half;
+}
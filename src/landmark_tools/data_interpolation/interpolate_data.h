@@ -31,6 +31,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#define SCALED_SHORT_NAN INT16_MIN //reserved code of a NAN value in a scaled int16 matrix
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -67,6 +69,53 @@ double  inter_double_matrix(double *img, size_t xsize, size_t ysize, double  x,
  */
 double  inter_float_matrix(float *img, size_t xsize, size_t ysize, double  x, double  y);
 
+/**
+ \brief Find the neighbors used by `inter_float_matrix`, so that other storage of a matrix interpolates identically
+ 
+ \param[in] xsize width of matrix
+ \param[in] ysize height of matrix
+ \param[in] x coordinate
+ \param[in] y coordinate
+ \param[out] idx row-major indices of the neighbors p00, p01, p11, p10. At the last column and row they may be past
+                 the end of the row or matrix, and are read with a weight of 0
+ \param[out] dx fractional part of x
+ \param[out] dy fractional part of y
+ \return 0 if out of bounds, 1 if (x, y) is a pixel center and only idx[0] is set, 2 otherwise
+ */
+int32_t inter_float_matrix_cell(size_t xsize, size_t ysize, double x, double y, int64_t idx[4], double *dx, double *dy);
+
+/**
+ \brief Bilinear interpolation of a matrix of IEEE half precision floats at coordinate (x, y)
+ 
+ Same as `inter_float_matrix`, but the values are converted from half precision as they are read.
+ 
+ \param[in] img matrix of half precision bit patterns
+ \param[in] xsize width of matrix
+ \param[in] ysize height of matrix
+ \param[in] x coordinate
+ \param[in] y coordinate
+ \return interpolated value if in bounds, NAN if out of bounds or one of the neighbors is NAN
+ */
+double  inter_half_matrix(const uint16_t *img, size_t xsize, size_t ysize, double  x, double  y);
+
+/**
+ \brief Bilinear interpolation of a scaled int16 matrix at coordinate (x, y)
+ 
+ Same as `inter_float_matrix` for a matrix whose values are `offset + scale*img[i]`. 
+ The code `SCALED_SHORT_NAN` is a NAN value.
+ 
+ \param[in] img matrix of codes
+ \param[in] xsize width of matrix
+ \param[in] ysize height of matrix
+ \param[in] offset value of code 0
+ \param[in] scale value step between codes
+ \param[in] x coordinate
+ \param[in] y coordinate
+ \return interpolated value if in bounds, NAN if out of bounds or one of the neighbors is NAN
+ */
+double  inter_scaled_short_matrix(const int16_t *img, size_t xsize, size_t ysize, double offset, double scale,
+                                  double  x, double  y);
+
 /**
  \brief Bilinear interpolation of matrix at coordinate (x, y)
  
@@ -114,6 +163,77 @@ double  inter_short_elevation(short *img, size_t xsize, size_t ysize, double  x,
  */
 int32_t inter_unsigned_short_image(uint16_t *img, size_t xsize, size_t ysize, double  x, double  y, double *bv);
 
+/**
+ \brief `inter_float_matrix` of `n` coordinates
+ 
+ Samples inside the matrix are interpolated 4 at a time with vector gathers where the processor supports them, and the
+ samples near the edges with `inter_float_matrix`. The values are identical to those of `inter_float_matrix`.
+ 
+ \param[in] img matrix
+ \param[in] xsize width of matrix
+ \param[in] ysize height of matrix
+ \param[in] x `n` x coordinates
+ \param[in] y `n` y coordinates
+ \param[in] n number of coordinates
+ \param[out] val `n` interpolated values, NAN if out of bounds or one of the neighbors is NAN
+ */
+void inter_float_matrix_batch(const float *img, size_t xsize, size_t ysize, const double *x, const double *y,
+                              size_t n, double *val);
+
+/**
+ \brief `inter_double_matrix` of `n` coordinates, identical to `inter_double_matrix`
+ 
+ \param[in] img matrix
+ \param[in] xsize width of matrix
+ \param[in] ysize height of matrix
+ \param[in] x `n` x coordinates
+ \param[in] y `n` y coordinates
+ \param[in] n number of coordinates
+ \param[out] val `n` interpolated values, NAN if out of bounds
+ */
+void inter_double_matrix_batch(const double *img, size_t xsize, size_t ysize, const double *x, const double *y,
+                               size_t n, double *val);
+
+/**
+ \brief `inter_uint8_matrix` of `n` coordinates, identical to `inter_uint8_matrix`
+ 
+ \param[in] img matrix
+ \param[in] xsize width of matrix
+ \param[in] ysize height of matrix
+ \param[in] x `n` x coordinates
+ \param[in] y `n` y coordinates
+ \param[in] n number of coordinates
+ \param[out] val `n` interpolated values, 0 if out of bounds
+ \param[out] valid `n` flags, false if out of bounds, or NULL
+ */
+void inter_uint8_matrix_batch(const uint8_t *img, size_t xsize, size_t ysize, const double *x, const double *y,
+                              size_t n, uint8_t *val, bool *valid);
+
+/**
+ \brief Coordinates of `n` samples along a line, sample i at (`x0` + i*`dx`, `y0` + i*`dy`)
+ 
+ \param[in] x0 x coordinate of the first sample
+ \param[in] y0 y coordinate of the first sample
+ \param[in] dx x step between samples
+ \param[in] dy y step between samples
+ \param[in] n number of samples
+ \param[out] x `n` x coordinates
+ \param[out] y `n` y coordinates
+ */
+void inter_affine_row(double x0, double y0, double dx, double dy, size_t n, double *x, double *y);
+
+/**
+ \brief Coordinates of the pixels (`u0` + i, `v`) of a row mapped by a homography, identical to `homographyTransfer33`
+ 
+ \param[in] h homography
+ \param[in] u0 first column of the row
+ \param[in] v row
+ \param[in] n number of pixels
+ \param[out] x `n` x coordinates
+ \param[out] y `n` y coordinates
+ */
+void inter_homography_row(double h[3][3], int32_t u0, int32_t v, size_t n, double *x, double *y);
+
 /**
  \brief Reverse the byte order of a short
 
@@ -128,6 +248,24 @@ void rev_short(int16_t *longone);
 */
 void rev_float(float *longone);
 
+/**
+ \brief Convert an IEEE half precision bit pattern to float
+ 
+ \param[in] h half precision value
+ \return float value
+*/
+float half_to_float(uint16_t h);
+
+/**
+ \brief Convert a float to an IEEE half precision bit pattern, rounding to nearest even
+ 
+ Values beyond the half precision range become infinity. NAN stays NAN.
+ 
+ \param[in] f float value
+ \return half precision value
+*/
+uint16_t float_to_half(float f);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -18,25 +18,218 @@
 #include <stdio.h>               // for NULL, printf
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>              // for memset
 #include <float.h>
+#include <pthread.h>             // for pthread_create, pthread_join
+#include "landmark_tools/utils/parallel.h"
+#include "landmark_tools/utils/perf_stats.h"
 #include "landmark_tools/utils/safe_string.h"
 
-#include "img/utils/imgutils.h"  // for FAILURE, int_forstner, SUCCESS
+#include "img/utils/imgutils.h"  // for FAILURE, int_forstner_ctx, SUCCESS
 #include "landmark_tools/feature_selection/int_forstner_extended.h"
 
+#define FORSTNER_MAX_THREADS 64      /*!< \brief Maximum number of tiles computed at the same time */
+#define FORSTNER_MIN_TILE_ROWS 128   /*!< \brief Fewer rows per tile are not worth a thread */
+
+/**
+ \brief Rows of the interest image computed by one thread
+*/
+typedef struct {
+    const uint8_t *image;
+    int32_t xdim;
+    int32_t ydim;
+    int32_t first_row;
+    int32_t num_rows;
+    int32_t n;
+    float *interest;
+    ForstnerCtx *ctx;            /*!< \brief Summation buffers of the tile, or NULL to allocate them */
+} ForstnerTile;
+
+static void *forstner_tile_thread(void *arg)
+{
+    ForstnerTile *tile = (ForstnerTile *)arg;
+    
+    // Without its own buffers int_forstner_ctx allocates them for the call
+    ForstnerCtx local_ctx = {0};
+    ForstnerCtx *ctx = tile->ctx;
+    if (ctx == NULL) {
+        ctx = &local_ctx;
+        int_forstner_ctx_alloc(ctx, tile->xdim, tile->n);
+    }
+    int_forstner_ctx(ctx, tile->image, tile->xdim, tile->ydim, 0, tile->first_row, tile->xdim, tile->num_rows,
+                     tile->n, tile->interest);
+    int_forstner_ctx_free(&local_ctx);
+    return NULL;
+}
+
+/**
+ \brief Tiles computed at the same time for `num_threads`, 0 for `parallel_num_threads()`
+*/
+static int32_t forstner_max_tiles(int32_t num_threads)
+{
+    if (num_threads <= 0) num_threads = parallel_num_threads();
+    return num_threads > FORSTNER_MAX_THREADS ? FORSTNER_MAX_THREADS : num_threads;
+}
+
+/**
+ \brief Interest image of the whole image, computed in horizontal tiles on parallel threads
+
+ The sums of each tile start from its first row, and the integer sums make every value the same as that of a single
+ pass over the image. Tiles beyond the summation buffers of `scratch` allocate their own.
+*/
+static void forstner_interest_tiles(const uint8_t *image, int32_t xdim, int32_t ydim, int32_t n, float *interest,
+                                    ForstnerScratch *scratch)
+{
+    int32_t num_tiles = forstner_max_tiles(scratch->num_threads);
+    if (num_tiles > ydim / FORSTNER_MIN_TILE_ROWS) num_tiles = ydim / FORSTNER_MIN_TILE_ROWS;
+    if (num_tiles < 1) num_tiles = 1;
+    
+    ForstnerTile tiles[FORSTNER_MAX_THREADS];
+    pthread_t threads[FORSTNER_MAX_THREADS];
+    bool started[FORSTNER_MAX_THREADS];
+    for (int32_t t = 0; t < num_tiles; t++) {
+        int32_t first_row = (int32_t)((int64_t)ydim * t / num_tiles);
+        int32_t end_row = (int32_t)((int64_t)ydim * (t + 1) / num_tiles);
+        ForstnerCtx *ctx = NULL;
+        if (t < scratch->num_tile_ctx && scratch->tile_ctx[t].nx_max >= xdim && scratch->tile_ctx[t].n_max >= n) {
+            ctx = &scratch->tile_ctx[t];
+        }
+        tiles[t] = (ForstnerTile){image, xdim, ydim, first_row, end_row - first_row, n, interest, ctx};
+        
+        // The last tile, and any tile without a thread, is computed on this thread
+        started[t] = t + 1 < num_tiles && pthread_create(&threads[t], NULL, forstner_tile_thread, &tiles[t]) == 0;
+        if (!started[t]) {
+            forstner_tile_thread(&tiles[t]);
+        }
+    }
+    for (int32_t t = 0; t < num_tiles; t++) {
+        if (started[t]) pthread_join(threads[t], NULL);
+    }
+}
+
+/**
+ \brief Grow one buffer of a ForstnerScratch to `count` elements
+*/
+static bool forstner_scratch_grow(void **buffer, size_t *capacity, size_t count, size_t size)
+{
+    if (count <= *capacity) return true;
+    free(*buffer);
+    *buffer = malloc(count * size);
+    *capacity = (*buffer != NULL) ? count : 0;
+    return *buffer != NULL;
+}
+
+/**
+ \brief Cells of the candidate grid of a region of at most xdim x ydim pixels
+ 
+ The grid cells are at least minDist pixels and chosen for about 10000 cells, see
+ `int_forstner_nbest_even_distribution_scratch`.
+*/
+static size_t forstner_max_cells(int32_t xdim, int32_t ydim, int32_t minDist)
+{
+    size_t cell = minDist > 1 ? (size_t)minDist : 1;
+    size_t by_size = ((size_t)xdim / cell + 1) * ((size_t)ydim / cell + 1);
+    size_t by_count = 10002 + ((size_t)xdim + ydim) / cell;
+    return by_size < by_count ? by_size : by_count;
+}
+
+/**
+ \brief Cells of the occupancy grid of the accepted features, 0 without a minimum distance
+*/
+static size_t forstner_max_occupancy(int32_t xdim, int32_t ydim, int32_t minDist)
+{
+    int32_t minDist_xy = (int32_t)(minDist/1.414);
+    if (minDist_xy <= 0) return 0;
+    return ((size_t)xdim / minDist_xy + 1) * ((size_t)ydim / minDist_xy + 1);
+}
+
+bool forstner_scratch_reserve(ForstnerScratch *scratch, int32_t xdim, int32_t ydim, int32_t n, int32_t minDist)
+{
+    if ((n & 1) == 0) n++;
+    int32_t num_tiles = forstner_max_tiles(scratch->num_threads);
+    bool success = forstner_scratch_grow((void **)&scratch->interest, &scratch->interest_capacity,
+                                         (size_t)xdim * ydim, sizeof(float)) &&
+                   forstner_scratch_grow((void **)&scratch->index, &scratch->index_capacity,
+                                         forstner_max_cells(xdim, ydim, minDist), sizeof(int64_t)) &&
+                   forstner_scratch_grow((void **)&scratch->values, &scratch->values_capacity,
+                                         forstner_max_cells(xdim, ydim, minDist), sizeof(float)) &&
+                   forstner_scratch_grow((void **)&scratch->occupancy, &scratch->occupancy_capacity,
+                                         forstner_max_occupancy(xdim, ydim, minDist), sizeof(int32_t));
+    if (success && (num_tiles > scratch->num_tile_ctx ||
+                    (num_tiles > 0 && (scratch->tile_ctx[0].nx_max < xdim || scratch->tile_ctx[0].n_max < n)))) {
+        for (int32_t t = 0; t < scratch->num_tile_ctx; t++) {
+            int_forstner_ctx_free(&scratch->tile_ctx[t]);
+        }
+        free(scratch->tile_ctx);
+        scratch->num_tile_ctx = 0;
+        scratch->tile_ctx = (ForstnerCtx *)calloc(num_tiles, sizeof(ForstnerCtx));
+        success = scratch->tile_ctx != NULL;
+        for (int32_t t = 0; success && t < num_tiles; t++) {
+            success = int_forstner_ctx_alloc(&scratch->tile_ctx[t], xdim, n) == SUCCESS;
+            scratch->num_tile_ctx = t + 1;
+        }
+    }
+    if (!success) {
+        SAFE_PRINTF(256, "forstner_scratch_reserve() ==>> memory allocation error\n");
+        forstner_scratch_free(scratch);
+    }
+    return success;
+}
+
+size_t forstner_scratch_bytes(const ForstnerScratch *scratch)
+{
+    size_t bytes = scratch->interest_capacity * sizeof(float) + scratch->index_capacity * sizeof(int64_t) +
+                   scratch->values_capacity * sizeof(float) + scratch->occupancy_capacity * sizeof(int32_t);
+    for (int32_t t = 0; t < scratch->num_tile_ctx; t++) {
+        bytes += 3 * sizeof(int) * (size_t)(scratch->tile_ctx[t].nx_max + scratch->tile_ctx[t].n_max) +
+                 scratch->tile_ctx[t].scan_bytes;
+    }
+    return bytes + scratch->num_tile_ctx * sizeof(ForstnerCtx);
+}
+
+void forstner_scratch_free(ForstnerScratch *scratch)
+{
+    int32_t num_threads = scratch->num_threads;
+    free(scratch->interest);
+    free(scratch->index);
+    free(scratch->values);
+    free(scratch->occupancy);
+    for (int32_t t = 0; t < scratch->num_tile_ctx; t++) {
+        int_forstner_ctx_free(&scratch->tile_ctx[t]);
+    }
+    free(scratch->tile_ctx);
+    memset(scratch, 0, sizeof(ForstnerScratch));
+    scratch->num_threads = num_threads;
+}
+
 int32_t int_forstner_nbest_even_distribution(uint8_t *image, int32_t xdim, int32_t ydim, int32_t x0, int32_t y0,
                                         int32_t nx, int32_t ny, int32_t n, int32_t max, int32_t *num, int64_t (*pos2)[2], float *intr, int32_t minDist)
 {
-    
-    float *interest = (float *)malloc(sizeof(float)*xdim*ydim);
-    if(interest == NULL){
+    return int_forstner_nbest_even_distribution_scratch(NULL, image, xdim, ydim, x0, y0, nx, ny, n, max, num, pos2,
+                                                        intr, minDist);
+}
+
+static int32_t forstner_nbest_even_distribution(ForstnerScratch *scratch, uint8_t *image, int32_t xdim,
+                                               int32_t ydim, int32_t x0, int32_t y0, int32_t nx, int32_t ny,
+                                               int32_t n, int32_t max, int32_t *num, int64_t (*pos2)[2],
+                                               float *intr, int32_t minDist)
+{
+    // Without scratch memory the buffers are allocated for the call
+    ForstnerScratch local_scratch = {0};
+    if (scratch == NULL) {
+        scratch = &local_scratch;
+    }
+    if (!forstner_scratch_grow((void **)&scratch->interest, &scratch->interest_capacity, (size_t)xdim * ydim,
+                               sizeof(float))) {
+        forstner_scratch_free(&local_scratch);
         return FAILURE;
     }
-    for(size_t i = 0; i < xdim*ydim; ++i)
+    float *interest = scratch->interest;
+    for(int64_t i = 0; i < (int64_t)xdim*ydim; ++i)
     {
         interest[i] = FLT_MAX;
     }
-    int_forstner(image, xdim, ydim, 0, 0, xdim,  ydim, n, interest);
+    forstner_interest_tiles(image, xdim, ydim, n, interest, scratch);
 
     int32_t grid_size = minDist-1;
     
@@ -56,38 +249,31 @@ int32_t int_forstner_nbest_even_distribution(uint8_t *image, int32_t xdim, int32
        n++;
     }
     
-    int64_t *index = (int64_t *) malloc (length * sizeof (int64_t));
-    if (index == NULL)
+    if (!forstner_scratch_grow((void **)&scratch->index, &scratch->index_capacity, length, sizeof(int64_t)) ||
+        !forstner_scratch_grow((void **)&scratch->values, &scratch->values_capacity, length, sizeof(float)))
     {
-        free(interest);
-        return FAILURE;
-    }
-
-    float *subsetValues;
-    subsetValues = (float *) malloc (length * sizeof (float));
-    if (subsetValues == NULL)
-    {
-        free(interest);
-        free(index);
+        forstner_scratch_free(&local_scratch);
         return FAILURE;
     }
+    int64_t *index = scratch->index;
+    float *subsetValues = scratch->values;
     
-    for(size_t i = 0; i < length; ++i)
+    for(int32_t i = 0; i < length; ++i)
     {
         index[i] = 0;
         subsetValues[i] = 0.0;
     }
     
-    size_t k = 0;
-    for(size_t i = 0; i < grid_rows; ++i)
+    int32_t k = 0;
+    for(int32_t i = 0; i < grid_rows; ++i)
     {
-        size_t iy_start =y0+i*grid_size;
-        for(size_t j = 0; j < grid_cols; ++j)
+        int64_t iy_start =y0+(int64_t)i*grid_size;
+        for(int32_t j = 0; j < grid_cols; ++j)
         {
-            size_t ix_start = x0+j*grid_size;
-             for(size_t p = iy_start; p < iy_start+grid_size; ++p)
+            int64_t ix_start = x0+(int64_t)j*grid_size;
+             for(int64_t p = iy_start; p < iy_start+grid_size; ++p)
              {
-                 for(size_t q = ix_start; q< ix_start + grid_size; ++q)
+                 for(int64_t q = ix_start; q< ix_start + grid_size; ++q)
                  {
                      if(subsetValues[k] < interest[p*xdim + q] && interest[p*xdim + q] >0.0)  //800 is hyper
                      {
@@ -101,8 +287,28 @@ int32_t int_forstner_nbest_even_distribution(uint8_t *image, int32_t xdim, int32
     }
     sort_features_descent (length, subsetValues-1, index - 1); /* matrix in RECIPES has index starting 1 */
 
+    // Accepted features by cells of minDist_xy pixels. Two features closer than minDist_xy in both directions
+    // cannot share a cell, and a feature too close to a new one is in its cell or a neighbouring cell
+    int32_t occupancy_cols = minDist_xy > 0 ? nx / minDist_xy + 1 : 0;
+    int32_t occupancy_rows = minDist_xy > 0 ? ny / minDist_xy + 1 : 0;
+    int32_t *occupancy = NULL;
+    if (minDist_xy > 0)
+    {
+        if (!forstner_scratch_grow((void **)&scratch->occupancy, &scratch->occupancy_capacity,
+                                   (size_t)occupancy_cols * occupancy_rows, sizeof(int32_t)))
+        {
+            forstner_scratch_free(&local_scratch);
+            return FAILURE;
+        }
+        occupancy = scratch->occupancy;
+        for (int64_t i = 0; i < (int64_t)occupancy_cols * occupancy_rows; ++i)
+        {
+            occupancy[i] = -1;
+        }
+    }
+
     int32_t count = 0;
-    for (size_t i = 0; i < length; i++)
+    for (int32_t i = 0; i < length; i++)
     {
         int64_t row = index[i] / xdim;
         int64_t col = index[i] - row * xdim;
@@ -112,24 +318,39 @@ int32_t int_forstner_nbest_even_distribution(uint8_t *image, int32_t xdim, int32
        if (row >= y0 && row < (y0 + ny) && col >= x0 && col < (x0+nx))
        {
             bool too_close = false;
-            for (size_t j = 0; j < count; j++)
+            int32_t cell_row = 0, cell_col = 0;
+            if (occupancy != NULL)
             {
-                if (llabs(row - pos2[j][1]) < minDist_xy &&
-                      llabs(col - pos2[j][0]) < minDist_xy)
+                cell_row = (int32_t)(row - y0) / minDist_xy;
+                cell_col = (int32_t)(col - x0) / minDist_xy;
+                for (int32_t r = cell_row - 1; r <= cell_row + 1 && !too_close; r++)
                 {
-                    too_close = true;
-                    break;
+                    for (int32_t c = cell_col - 1; c <= cell_col + 1; c++)
+                    {
+                        if (r < 0 || r >= occupancy_rows || c < 0 || c >= occupancy_cols) continue;
+                        int32_t j = occupancy[r * occupancy_cols + c];
+                        if (j >= 0 && llabs(row - pos2[j][1]) < minDist_xy &&
+                            llabs(col - pos2[j][0]) < minDist_xy)
+                        {
+                            too_close = true;
+                            break;
+                        }
+                    }
                 }
             }
             if (!too_close)
             {
+                if (occupancy != NULL)
+                {
+                    occupancy[cell_row * occupancy_cols + cell_col] = count;
+                }
                 pos2[count][0] = col;
                 pos2[count][1] = row;
                 intr[count] = subsetValues[i];
                 count ++;
                 if (count == max)
                 {
-                    SAFE_PRINTF(128, "At feature i = %ld done length %d\n", i, length);
+                    SAFE_PRINTF(128, "At feature i = %d done length %d\n", i, length);
                     break;
                 }
             }
@@ -138,12 +359,22 @@ int32_t int_forstner_nbest_even_distribution(uint8_t *image, int32_t xdim, int32
 
     /* Finish up */
     *num = count;
-    free(interest);
-    free(subsetValues);
-    free(index);
+    forstner_scratch_free(&local_scratch);
     return SUCCESS;
 }
 
+int32_t int_forstner_nbest_even_distribution_scratch(ForstnerScratch *scratch, uint8_t *image, int32_t xdim,
+                                                     int32_t ydim, int32_t x0, int32_t y0, int32_t nx, int32_t ny,
+                                                     int32_t n, int32_t max, int32_t *num, int64_t (*pos2)[2],
+                                                     float *intr, int32_t minDist)
+{
+    PERF_PHASE_BEGIN(timer, PERF_DETECT);
+    int32_t status = forstner_nbest_even_distribution(scratch, image, xdim, ydim, x0, y0, nx, ny, n, max, num, pos2,
+                                                      intr, minDist);
+    PERF_PHASE_END(timer);
+    return status;
+}
+
 
 static void sort_features_descent(int32_t n, float ra[], int64_t rb[])
 {
@@ -24,12 +24,57 @@
 #ifndef _LANDMARK_TOOLS_INT_FORSTNER_EXTENDED_H_
 #define _LANDMARK_TOOLS_INT_FORSTNER_EXTENDED_H_
 
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
 #include <stdint.h>  // for int32_t, int64_t, uint8_t
 #include <stdint.h>  // for int32_t, int64_t, uint8_t
+
+#include "img/utils/imgutils.h"  // for ForstnerCtx
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
+/**
+ \brief Buffers of `int_forstner_nbest_even_distribution_scratch`, reused across calls
+
+ Zero-initialize, optionally set `num_threads`, then size with `forstner_scratch_reserve`. Buffers grow if a call
+ needs more. Must not be shared between threads.
+*/
+typedef struct {
+    int32_t num_threads;         /*!< \brief Tiles of the interest image computed at the same time. 0 for `parallel_num_threads()` */
+    size_t interest_capacity;    /*!< \brief Pixels `interest` holds */
+    float *interest;             /*!< \brief Interest image */
+    size_t index_capacity;       /*!< \brief Cells `index` holds */
+    int64_t *index;              /*!< \brief Best pixel of each grid cell */
+    size_t values_capacity;      /*!< \brief Cells `values` holds */
+    float *values;               /*!< \brief Interest of the best pixel of each grid cell */
+    size_t occupancy_capacity;   /*!< \brief Cells `occupancy` holds */
+    int32_t *occupancy;          /*!< \brief Accepted feature in each cell of the minimum distance grid */
+    int32_t num_tile_ctx;        /*!< \brief Tiles with summation buffers in `tile_ctx` */
+    ForstnerCtx *tile_ctx;       /*!< \brief Summation buffers of each tile */
+} ForstnerScratch;
+
+/**
+ \brief Size a ForstnerScratch for images of up to xdim x ydim pixels
+ \param[in,out] scratch scratch memory. Release with `forstner_scratch_free`
+ \param[in] xdim maximum size of X dimension
+ \param[in] ydim maximum size of Y dimension
+ \param[in] n size of NxN neighborhood around pixel
+ \param[in] minDist minimum distance between feature points
+ \return false if memory allocation fails
+*/
+bool forstner_scratch_reserve(ForstnerScratch *scratch, int32_t xdim, int32_t ydim, int32_t n, int32_t minDist);
+
+/**
+ \brief Bytes of memory held by a ForstnerScratch
+*/
+size_t forstner_scratch_bytes(const ForstnerScratch *scratch);
+
+/**
+ \brief Release the memory of a ForstnerScratch. `num_threads` is kept
+*/
+void forstner_scratch_free(ForstnerScratch *scratch);
+
 /**
 \brief TODO
 \param[in] image intensity image
@@ -49,6 +94,17 @@ extern "C" {
 int32_t int_forstner_nbest_even_distribution(uint8_t *image, int32_t xdim, int32_t ydim, int32_t x0, int32_t y0,
                                          int32_t nx, int32_t ny, int32_t n, int32_t max, int32_t *num, int64_t (*pos2)[2], float *int32_tr, int32_t minDist);
 
+/**
+\brief Same as `int_forstner_nbest_even_distribution`, with the buffers taken from `scratch`
+
+ With a scratch sized by `forstner_scratch_reserve` for the image, the call allocates no memory.
+\param[in,out] scratch scratch memory, or NULL to allocate the buffers for the call
+ */
+int32_t int_forstner_nbest_even_distribution_scratch(ForstnerScratch *scratch, uint8_t *image, int32_t xdim,
+                                                     int32_t ydim, int32_t x0, int32_t y0, int32_t nx, int32_t ny,
+                                                     int32_t n, int32_t max, int32_t *num, int64_t (*pos2)[2],
+                                                     float *intr, int32_t minDist);
+
 /**
  \brief TODO
  
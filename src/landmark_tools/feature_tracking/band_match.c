@@ -0,0 +1,543 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "landmark_tools/feature_tracking/band_match.h"
+#include "landmark_tools/feature_tracking/feature_match.h"
+#include "landmark_tools/landmark_util/estimate_homography.h"
+#include "landmark_tools/math/homography_util.h"
+#include "landmark_tools/utils/safe_string.h"
+
+/**
+ \brief Largest multiple of `multiple` not above `value`, for any sign of value
+*/
+static int32_t floor_multiple(int32_t value, int32_t multiple)
+{
+    int32_t quotient = value / multiple;
+    if (value % multiple != 0 && value < 0) quotient--;
+    return quotient * multiple;
+}
+
+static int32_t clamp_int(int32_t value, int32_t low, int32_t high)
+{
+    return value < low ? low : (value > high ? high : value);
+}
+
+/**
+ \brief Bounding box of the rectangle [left, right] x [top, bottom] of the child after the initial homography
+*/
+static void homography_range(double child2base[3][3], int32_t left, int32_t top, int32_t right, int32_t bottom,
+                             double min[2], double max[2])
+{
+    min[0] = min[1] = INFINITY;
+    max[0] = max[1] = -INFINITY;
+    for (int32_t k = 0; k < 4; k++) {
+        double corner[2] = {(k & 1) ? right : left, (k & 2) ? bottom : top};
+        double transformed[2];
+        homographyTransfer33D(child2base, corner, transformed);
+        for (int32_t d = 0; d < 2; d++) {
+            if (transformed[d] < min[d]) min[d] = transformed[d];
+            if (transformed[d] > max[d]) max[d] = transformed[d];
+        }
+    }
+}
+
+/**
+ \brief Windows of the child and base landmarks that give the exact comparison of an output rectangle
+
+ The windows cover the sliding window blocks with features whose influence reaches `output`, with the templates
+ and search windows of their points after the initial homography. Blocks of the window outside of those are
+ incomplete, but none of their features reach the output. Both windows start on the same block row and column,
+ since the matcher takes templates and search windows from the same coordinates of the two landmarks.
+ \return false if the windows are outside of the base landmark
+*/
+static bool match_windows(const Parameters *parameters, double child2base[3][3], const LMK *child_header,
+                          const LMK *base_header, const LandmarkRect *output, LandmarkRect *child_window,
+                          LandmarkRect *base_window)
+{
+    int32_t block_size = parameters->sliding.block_size;
+    int32_t radius = parameters->sliding.feature_influence_window;
+    int32_t half_template = parameters->matching.correlation_window_size / 2;
+    int32_t half_search = parameters->matching.search_window_size / 2;
+    int32_t margin = (half_template > half_search ? half_template : half_search) + 1;
+    int32_t start[2] = {output->left, output->top};
+    int32_t end[2] = {output->left + output->width, output->top + output->height};
+    int32_t first_block[2], last_block[2];
+    for (int32_t d = 0; d < 2; d++) {
+        first_block[d] = floor_multiple(start[d] - radius - 1, block_size);
+        if (first_block[d] < 0) first_block[d] = 0;
+        last_block[d] = floor_multiple(end[d] - 1 + radius, block_size);
+    }
+    double min[2], max[2];
+    homography_range(child2base, first_block[0], first_block[1], last_block[0] + block_size,
+                     last_block[1] + block_size, min, max);
+
+    int32_t window_start[2], window_end[2];
+    for (int32_t d = 0; d < 2; d++) {
+        double first = (first_block[d] < min[d] ? first_block[d] : min[d]) - margin;
+        double last = (last_block[d] + block_size > max[d] ? last_block[d] + block_size : max[d]) + margin;
+        window_start[d] = (first <= 0) ? 0 : floor_multiple((int32_t)floor(first), block_size);
+        window_end[d] = (last >= INT32_MAX - 1) ? INT32_MAX : (int32_t)ceil(last) + 1;
+    }
+    int32_t child_end[2] = {child_header->num_cols, child_header->num_rows};
+    int32_t base_end[2] = {base_header->num_cols, base_header->num_rows};
+    child_window->left = base_window->left = window_start[0];
+    child_window->top = base_window->top = window_start[1];
+    child_window->width = (window_end[0] < child_end[0] ? window_end[0] : child_end[0]) - window_start[0];
+    child_window->height = (window_end[1] < child_end[1] ? window_end[1] : child_end[1]) - window_start[1];
+    base_window->width = (window_end[0] < base_end[0] ? window_end[0] : base_end[0]) - window_start[0];
+    base_window->height = (window_end[1] < base_end[1] ? window_end[1] : base_end[1]) - window_start[1];
+    return base_window->width > 0 && base_window->height > 0;
+}
+
+/**
+ \brief Compare a child window against a base window, as blocks of the whole map
+
+ The local RANSAC is always seeded by the block positions, draws from rand() would depend on the windows matched
+ before this one.
+*/
+static bool match_window_pair(const Parameters *parameters, LMK *base, LMK *child, const LandmarkRect *window,
+                              int32_t max_nan_count_base, int32_t max_nan_count_child, CorrelationResults *results)
+{
+    Parameters seeded = *parameters;
+    seeded.sliding.seeded_ransac = true;
+    int32_t block_size = parameters->sliding.block_size;
+    if (!allocate_correlation_results(results, child->num_pixels)) {
+        return false;
+    }
+    MatchGrid grid;
+    if (!allocate_match_grid(&grid, parameters, child->num_cols, child->num_rows)) {
+        destroy_correlation_results(results);
+        return false;
+    }
+    grid.first_block_col = window->left / block_size;
+    grid.first_block_row = window->top / block_size;
+    bool success = MatchFeaturesWithLocalDistortion_grid(seeded, base, child, results, max_nan_count_base,
+                                                         max_nan_count_child, &grid);
+    free_match_grid(&grid);
+    if (!success) {
+        destroy_correlation_results(results);
+    }
+    return success;
+}
+
+/**
+ * \brief Bands of `MatchLandmarkFilesInBands`, written to raw files or to a raster
+ */
+static bool match_files_in_bands(
+    Parameters parameters,
+    const char *base_path,
+    const char *child_path,
+    int32_t band_rows,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    FILE *outputs[BAND_MATCH_NUM_OUTPUTS],
+    Results_Raster_Writer *raster
+) {
+    LMK base_header = {0}, child_header = {0};
+    if (!Read_LMK_Header(base_path, &base_header) || !Read_LMK_Header(child_path, &child_header)) {
+        return false;
+    }
+    int32_t block_size = parameters.sliding.block_size;
+    if (block_size < 1 || band_rows < 1) {
+        SAFE_PRINTF(256, "MatchLandmarkFilesInBands() ==>> invalid band of %d rows or block size %d\n",
+                    band_rows, block_size);
+        return false;
+    }
+    band_rows = ((band_rows + block_size - 1) / block_size) * block_size;
+
+    double child2base[3][3];
+    estimateHomographyUsingCorners(&base_header, &child_header, child2base);
+    int32_t num_cols = child_header.num_cols;
+    int32_t num_rows = child_header.num_rows;
+
+    bool success = true;
+    for (int32_t top = 0; top < num_rows && success; top += band_rows) {
+        int32_t bottom = (top + band_rows < num_rows) ? top + band_rows : num_rows;
+        LandmarkRect band = {0, top, num_cols, bottom - top};
+        LandmarkRect child_window, base_window;
+        if (!match_windows(&parameters, child2base, &child_header, &base_header, &band, &child_window,
+                           &base_window)) {
+            SAFE_PRINTF(256, "MatchLandmarkFilesInBands() ==>> rows %d to %d of %s are outside of %s\n",
+                        top, bottom, child_path, base_path);
+            return false;
+        }
+        SAFE_PRINTF(256, "Matching rows %d to %d of %d from rows %d to %d\n", top, bottom, num_rows,
+                    child_window.top, child_window.top + child_window.height);
+
+        // Bands span the whole width of the child, and the base windows start at the same column
+        LMK child = {0}, base = {0};
+        if (!Read_LMK_Window(child_path, 0, child_window.top, num_cols, child_window.height, &child)) {
+            return false;
+        }
+        if (!Read_LMK_Window(base_path, 0, base_window.top, base_window.width, base_window.height, &base)) {
+            free_lmk(&child);
+            return false;
+        }
+
+        CorrelationResults results;
+        success = match_window_pair(&parameters, &base, &child, &child_window, max_nan_count_base,
+                                    max_nan_count_child, &results);
+        if (success) {
+            // Write the rows of the band
+            float *maps[BAND_MATCH_NUM_OUTPUTS] = {results.delta_x, results.delta_y, results.delta_z,
+                                                    results.correlation};
+            size_t offset = (size_t)(top - child_window.top) * num_cols;
+            size_t count = (size_t)(bottom - top) * num_cols;
+            if (raster != NULL) {
+                const float *rows[BAND_MATCH_NUM_OUTPUTS];
+                for (int32_t k = 0; k < BAND_MATCH_NUM_OUTPUTS; k++) rows[k] = maps[k] + offset;
+                success = Append_Results_Raster_Rows(raster, rows, bottom - top);
+            }
+            for (int32_t k = 0; k < BAND_MATCH_NUM_OUTPUTS && success && raster == NULL; k++) {
+                if (fwrite(maps[k] + offset, sizeof(float), count, outputs[k]) != count) {
+                    SAFE_PRINTF(256, "MatchLandmarkFilesInBands() ==>> cannot write rows %d to %d\n", top, bottom);
+                    success = false;
+                }
+            }
+            destroy_correlation_results(&results);
+        }
+        free_lmk(&child);
+        free_lmk(&base);
+    }
+    return success;
+}
+
+bool MatchLandmarkFilesInBands(
+    Parameters parameters,
+    const char *base_path,
+    const char *child_path,
+    int32_t band_rows,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    FILE *outputs[BAND_MATCH_NUM_OUTPUTS]
+) {
+    return match_files_in_bands(parameters, base_path, child_path, band_rows, max_nan_count_base,
+                                max_nan_count_child, outputs, NULL);
+}
+
+bool MatchLandmarkFilesInBands_raster(
+    Parameters parameters,
+    const char *base_path,
+    const char *child_path,
+    int32_t band_rows,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    Results_Raster_Writer *raster
+) {
+    return match_files_in_bands(parameters, base_path, child_path, band_rows, max_nan_count_base,
+                                max_nan_count_child, NULL, raster);
+}
+
+bool MatchLandmarkFileRect(
+    Parameters parameters,
+    const char *base_path,
+    const char *child_path,
+    const LandmarkRect *output,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    CorrelationResults *results
+) {
+    LMK base_header = {0}, child_header = {0};
+    if (!Read_LMK_Header(base_path, &base_header) || !Read_LMK_Header(child_path, &child_header)) {
+        return false;
+    }
+    if (parameters.sliding.block_size < 1 || output->width < 1 || output->height < 1 || output->left < 0 ||
+        output->top < 0 || output->left + output->width > child_header.num_cols ||
+        output->top + output->height > child_header.num_rows) {
+        SAFE_PRINTF(256, "MatchLandmarkFileRect() ==>> invalid rectangle %d x %d at (%d, %d) of %s\n",
+                    output->width, output->height, output->left, output->top, child_path);
+        return false;
+    }
+    size_t num_pixels = (size_t)output->width * output->height;
+    if (!allocate_correlation_results(results, num_pixels)) {
+        return false;
+    }
+
+    double child2base[3][3];
+    estimateHomographyUsingCorners(&base_header, &child_header, child2base);
+    LandmarkRect child_window, base_window;
+    if (!match_windows(&parameters, child2base, &child_header, &base_header, output, &child_window,
+                       &base_window)) {
+        // Without a base window there are no matches, as in a comparison of the whole map
+        for (size_t i = 0; i < num_pixels; i++) {
+            results->delta_x[i] = results->delta_y[i] = results->delta_z[i] = results->correlation[i] = NAN;
+        }
+        return true;
+    }
+
+    LMK child = {0}, base = {0};
+    if (!Read_LMK_Window(child_path, child_window.left, child_window.top, child_window.width, child_window.height,
+                         &child)) {
+        destroy_correlation_results(results);
+        return false;
+    }
+    if (!Read_LMK_Window(base_path, base_window.left, base_window.top, base_window.width, base_window.height,
+                         &base)) {
+        free_lmk(&child);
+        destroy_correlation_results(results);
+        return false;
+    }
+    CorrelationResults window_results;
+    bool success = match_window_pair(&parameters, &base, &child, &child_window, max_nan_count_base,
+                                     max_nan_count_child, &window_results);
+    free_lmk(&child);
+    free_lmk(&base);
+    if (!success) {
+        destroy_correlation_results(results);
+        return false;
+    }
+
+    // Crop the rectangle out of the window
+    float *from[BAND_MATCH_NUM_OUTPUTS] = {window_results.delta_x, window_results.delta_y,
+                                           window_results.delta_z, window_results.correlation};
+    float *to[BAND_MATCH_NUM_OUTPUTS] = {results->delta_x, results->delta_y, results->delta_z,
+                                         results->correlation};
+    for (int32_t m = 0; m < BAND_MATCH_NUM_OUTPUTS; m++) {
+        for (int32_t row = 0; row < output->height; row++) {
+            memcpy(&to[m][(size_t)row * output->width],
+                   &from[m][(size_t)(output->top + row - child_window.top) * child_window.width +
+                            output->left - child_window.left],
+                   sizeof(float) * output->width);
+        }
+    }
+    destroy_correlation_results(&window_results);
+    return true;
+}
+
+size_t MatchLandmarkFilesInBands_memory(
+    const Parameters *parameters,
+    const LMK *base_header,
+    const LMK *child_header,
+    int32_t band_rows,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child
+) {
+    int32_t block_size = parameters->sliding.block_size;
+    if (block_size < 1 || band_rows < 1) return 0;
+    band_rows = ((band_rows + block_size - 1) / block_size) * block_size;
+
+    // Same windows as match_files_in_bands
+    double child2base[3][3];
+    estimateHomographyUsingCorners(base_header, child_header, child2base);
+    size_t peak = 0;
+    for (int32_t top = 0; top < child_header->num_rows; top += band_rows) {
+        int32_t bottom = (top + band_rows < child_header->num_rows) ? top + band_rows : child_header->num_rows;
+        LandmarkRect band = {0, top, child_header->num_cols, bottom - top};
+        LandmarkRect child_window, base_window;
+        if (!match_windows(parameters, child2base, child_header, base_header, &band, &child_window, &base_window)) {
+            return 0;
+        }
+        LMK child = {0}, base = {0};
+        child.num_cols = child_header->num_cols;
+        child.num_rows = child_window.height;
+        base.num_cols = base_window.width;
+        base.num_rows = base_window.height;
+        size_t bytes = MatchFeaturesWithLocalDistortion_memory(parameters, &base, &child, max_nan_count_base,
+                                                               max_nan_count_child);
+        if (bytes > peak) peak = bytes;
+    }
+    return peak;
+}
+
+int32_t MatchLandmarkFilesInBands_rows_within(
+    const Parameters *parameters,
+    const LMK *base_header,
+    const LMK *child_header,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    size_t bytes
+) {
+    int32_t block_size = parameters->sliding.block_size;
+    if (block_size < 1 || child_header->num_rows < 1) return 0;
+
+    // Bisect on the number of block rows, the windows grow with the bands
+    int32_t low = 0;
+    int32_t high = (child_header->num_rows + block_size - 1) / block_size;
+    while (low < high) {
+        int32_t middle = low + (high - low + 1) / 2;
+        size_t needed = MatchLandmarkFilesInBands_memory(parameters, base_header, child_header, middle * block_size,
+                                                         max_nan_count_base, max_nan_count_child);
+        if (needed > 0 && needed <= bytes) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low * block_size;
+}
+
+bool landmark_changed_rect(const LMK *before, const LMK *after, LandmarkRect *rect)
+{
+    memset(rect, 0, sizeof(LandmarkRect));
+    if (before->num_cols != after->num_cols || before->num_rows != after->num_rows) {
+        SAFE_PRINTF(256, "landmark_changed_rect() ==>> landmarks of %d x %d and %d x %d pixels\n",
+                    before->num_cols, before->num_rows, after->num_cols, after->num_rows);
+        return false;
+    }
+    int32_t left = after->num_cols, top = after->num_rows, right = -1, bottom = -1;
+    for (int32_t row = 0; row < after->num_rows; row++) {
+        size_t offset = (size_t)row * after->num_cols;
+        for (int32_t col = 0; col < after->num_cols; col++) {
+            float ele_before = before->ele[offset + col];
+            float ele_after = after->ele[offset + col];
+            bool same_ele = (ele_before == ele_after) || (isnan(ele_before) && isnan(ele_after));
+            if (same_ele && before->srm[offset + col] == after->srm[offset + col]) continue;
+            if (col < left) left = col;
+            if (col > right) right = col;
+            if (row < top) top = row;
+            bottom = row;
+        }
+    }
+    if (right >= 0) {
+        rect->left = left;
+        rect->top = top;
+        rect->width = right - left + 1;
+        rect->height = bottom - top + 1;
+    }
+    return true;
+}
+
+/**
+ \brief Output pixels whose value can depend on the pixels of a child rectangle
+*/
+static bool affected_output(const Parameters *parameters, const LMK *child, const LandmarkRect *dirty,
+                            LandmarkRect *output)
+{
+    int32_t block_size = parameters->sliding.block_size;
+    int32_t radius = parameters->sliding.feature_influence_window;
+    int32_t half_template = parameters->matching.correlation_window_size / 2;
+    int32_t half_search = parameters->matching.search_window_size / 2;
+    int32_t margin = (half_template > half_search ? half_template : half_search) + 1;
+    int32_t size[2] = {child->num_cols, child->num_rows};
+    int32_t start[2] = {dirty->left - margin, dirty->top - margin};
+    int32_t end[2] = {dirty->left + dirty->width + margin, dirty->top + dirty->height + margin};
+    int32_t output_start[2], output_end[2];
+    for (int32_t d = 0; d < 2; d++) {
+        // Blocks with a point whose template or search window overlaps the rectangle, including their border
+        // points shared with the next block
+        start[d] = clamp_int(start[d], 0, size[d]);
+        end[d] = clamp_int(end[d], 0, size[d]);
+        if (end[d] <= start[d]) return false;
+        int32_t first_block = floor_multiple(start[d] - 1, block_size);
+        if (first_block < 0) first_block = 0;
+        int32_t last_block = floor_multiple(end[d] - 1, block_size);
+        output_start[d] = clamp_int(first_block - radius, 0, size[d]);
+        output_end[d] = clamp_int(last_block + block_size + radius + 1, 0, size[d]);
+    }
+    output->left = output_start[0];
+    output->top = output_start[1];
+    output->width = output_end[0] - output_start[0];
+    output->height = output_end[1] - output_start[1];
+    return output->width > 0 && output->height > 0;
+}
+
+bool RematchLandmarkRegions(
+    Parameters parameters,
+    LMK *base_landmark,
+    LMK *child_landmark,
+    const LandmarkRect *child_dirty,
+    int32_t num_child_dirty,
+    const LandmarkRect *base_dirty,
+    int32_t num_base_dirty,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    CorrelationResults *results
+) {
+    if (parameters.sliding.block_size < 1) {
+        SAFE_PRINTF(256, "RematchLandmarkRegions() ==>> invalid block size %d\n", parameters.sliding.block_size);
+        return false;
+    }
+    double child2base[3][3], base2child[3][3];
+    estimateHomographyUsingCorners(base_landmark, child_landmark, child2base);
+    estimateHomographyUsingCorners(child_landmark, base_landmark, base2child);
+
+    int32_t num_cols = child_landmark->num_cols;
+    for (int32_t k = 0; k < num_child_dirty + num_base_dirty; k++) {
+        // Changes of the base reach the child points whose search windows cover them
+        LandmarkRect dirty;
+        if (k < num_child_dirty) {
+            dirty = child_dirty[k];
+        } else {
+            const LandmarkRect *rect = &base_dirty[k - num_child_dirty];
+            double min[2], max[2];
+            homography_range(base2child, rect->left, rect->top, rect->left + rect->width,
+                             rect->top + rect->height, min, max);
+            if (!(max[0] >= 0 && max[1] >= 0 && min[0] <= num_cols && min[1] <= child_landmark->num_rows)) {
+                continue;
+            }
+            dirty.left = (int32_t)floor(fmax(min[0], -1.0));
+            dirty.top = (int32_t)floor(fmax(min[1], -1.0));
+            dirty.width = (int32_t)ceil(fmin(max[0], (double)num_cols + 1.0)) - dirty.left + 1;
+            dirty.height = (int32_t)ceil(fmin(max[1], (double)child_landmark->num_rows + 1.0)) - dirty.top + 1;
+        }
+        if (dirty.width <= 0 || dirty.height <= 0) continue;
+
+        LandmarkRect output, child_window, base_window;
+        if (!affected_output(&parameters, child_landmark, &dirty, &output)) continue;
+        if (!match_windows(&parameters, child2base, child_landmark, base_landmark, &output, &child_window,
+                           &base_window)) {
+            // Without a base window there are no matches, as in a comparison of the whole map
+            for (int32_t row = output.top; row < output.top + output.height; row++) {
+                for (int32_t col = output.left; col < output.left + output.width; col++) {
+                    size_t index = (size_t)row * num_cols + col;
+                    results->delta_x[index] = results->delta_y[index] = NAN;
+                    results->delta_z[index] = results->correlation[index] = NAN;
+                }
+            }
+            continue;
+        }
+        SAFE_PRINTF(256, "Matching columns %d to %d, rows %d to %d again\n", output.left,
+                    output.left + output.width, output.top, output.top + output.height);
+
+        LMK child = {0}, base = {0};
+        if (!SubsetLMK(child_landmark, &child, child_window.left, child_window.top, child_window.width,
+                       child_window.height)) {
+            free_lmk(&child);
+            return false;
+        }
+        if (!SubsetLMK(base_landmark, &base, base_window.left, base_window.top, base_window.width,
+                       base_window.height)) {
+            free_lmk(&child);
+            free_lmk(&base);
+            return false;
+        }
+        CorrelationResults window_results;
+        bool success = match_window_pair(&parameters, &base, &child, &child_window, max_nan_count_base,
+                                         max_nan_count_child, &window_results);
+        free_lmk(&child);
+        free_lmk(&base);
+        if (!success) return false;
+
+        // Merge the affected pixels into the previous maps
+        float *from[BAND_MATCH_NUM_OUTPUTS] = {window_results.delta_x, window_results.delta_y,
+                                               window_results.delta_z, window_results.correlation};
+        float *to[BAND_MATCH_NUM_OUTPUTS] = {results->delta_x, results->delta_y, results->delta_z,
+                                             results->correlation};
+        for (int32_t m = 0; m < BAND_MATCH_NUM_OUTPUTS; m++) {
+            for (int32_t row = output.top; row < output.top + output.height; row++) {
+                memcpy(&to[m][(size_t)row * num_cols + output.left],
+                       &from[m][(size_t)(row - child_window.top) * child_window.width + output.left - child_window.left],
+                       sizeof(float) * output.width);
+            }
+        }
+        destroy_correlation_results(&window_results);
+    }
+    return true;
+}
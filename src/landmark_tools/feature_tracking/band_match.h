@@ -0,0 +1,220 @@
+/**
+ * \file band_match.h
+ * \brief Landmark comparison on windows of the maps
+ *
+ * A region of the output of `MatchFeaturesWithLocalDistortion` depends only on the sliding window blocks whose
+ * features reach it, and those on the templates and search windows of their points after the initial homography.
+ * Matching the windows of both landmarks holding those pixels gives the region exactly.
+ *
+ * Maps that do not fit in memory are compared in horizontal bands, each read from the files and written out
+ * before the next, so the memory use follows the band size rather than the map size. After a local edit, only the
+ * regions that depend on the changed pixels are compared again and merged into the previous output.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_BAND_MATCH_H_
+#define _LANDMARK_TOOLS_BAND_MATCH_H_
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for int32_t
+#include <stdio.h>    // for FILE
+
+#include "landmark_tools/feature_tracking/correlation_results.h"  // for CorrelationResults
+#include "landmark_tools/feature_tracking/parameters.h"  // for Parameters
+#include "landmark_tools/feature_tracking/results_raster.h"  // for Results_Raster_Writer
+#include "landmark_tools/landmark_util/landmark.h"  // for LMK
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define BAND_MATCH_NUM_OUTPUTS 4   /*!< \brief Maps written by `MatchLandmarkFilesInBands`: delta x, y, z and correlation */
+
+/**
+ * \brief Rectangle of landmark pixels
+ */
+typedef struct {
+    int32_t left;                /*!< \brief First column */
+    int32_t top;                 /*!< \brief First row */
+    int32_t width;               /*!< \brief Columns, 0 for an empty rectangle */
+    int32_t height;              /*!< \brief Rows, 0 for an empty rectangle */
+} LandmarkRect;
+
+/**
+ * \brief `MatchFeaturesWithLocalDistortion` of two landmark files, streamed in bands of rows
+ *
+ * Each band is matched on a window of both landmarks aligned to the sliding window blocks, with the local RANSAC
+ * seeded by the position of the blocks in the whole map (`seeded_ransac`). The output matches a whole-map comparison
+ * with `seeded_ransac` set, up to the rounding of the initial homography of each window.
+ *
+ * \param[in] parameters configuration settings
+ * \param[in] base_path Base landmark file
+ * \param[in] child_path Child landmark file
+ * \param[in] band_rows Rows of the child landmark per band, rounded up to a multiple of `block_size`
+ * \param[in] max_nan_count_base Maximum allowed NaN values in base landmark window
+ * \param[in] max_nan_count_child Maximum allowed NaN values in child landmark window
+ * \param[out] outputs Files receiving the delta x, delta y, delta z and correlation maps in that order, as
+ *                     num_cols x num_rows native floats of the child landmark, row by row
+ * \return false if a file cannot be read or written, or memory allocation fails
+ */
+bool MatchLandmarkFilesInBands(
+    Parameters parameters,
+    const char *base_path,
+    const char *child_path,
+    int32_t band_rows,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    FILE *outputs[BAND_MATCH_NUM_OUTPUTS]
+);
+
+/**
+ * \brief `MatchLandmarkFilesInBands`, with the maps streamed into one tiled raster
+ *
+ * The bands of the raster are the delta x, delta y, delta z and correlation maps, and a row of tiles is compressed
+ * and written as soon as the bands covering it are matched.
+ *
+ * \param[in] parameters configuration settings
+ * \param[in] base_path Base landmark file
+ * \param[in] child_path Child landmark file
+ * \param[in] band_rows Rows of the child landmark per band, rounded up to a multiple of `block_size`
+ * \param[in] max_nan_count_base Maximum allowed NaN values in base landmark window
+ * \param[in] max_nan_count_child Maximum allowed NaN values in child landmark window
+ * \param[in] raster Writer of 4 bands of the size of the child landmark
+ * \return false if a file cannot be read or written, or memory allocation fails
+ */
+bool MatchLandmarkFilesInBands_raster(
+    Parameters parameters,
+    const char *base_path,
+    const char *child_path,
+    int32_t band_rows,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    Results_Raster_Writer *raster
+);
+
+/**
+ * \brief `MatchFeaturesWithLocalDistortion` of one rectangle of a child landmark file, reading only its windows
+ *
+ * The windows of both landmarks that the rectangle depends on are read from the files and matched as blocks of the
+ * whole map with `seeded_ransac`, so that rectangles matched apart, on any process, tile the output of one
+ * comparison with `seeded_ransac` set, up to the rounding of the initial homography of each window.
+ *
+ * \param[in] parameters configuration settings
+ * \param[in] base_path Base landmark file
+ * \param[in] child_path Child landmark file
+ * \param[in] output Rectangle of the child landmark to compare
+ * \param[in] max_nan_count_base Maximum allowed NaN values in base landmark window
+ * \param[in] max_nan_count_child Maximum allowed NaN values in child landmark window
+ * \param[out] results Maps of output->width x output->height pixels. Release with `destroy_correlation_results`
+ * \return false if a file cannot be read, memory allocation fails or the rectangle is outside of the child.
+ * Rectangles whose windows miss the base landmark give NAN maps
+ */
+bool MatchLandmarkFileRect(
+    Parameters parameters,
+    const char *base_path,
+    const char *child_path,
+    const LandmarkRect *output,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    CorrelationResults *results
+);
+
+/**
+ * \brief Estimated peak bytes of `MatchLandmarkFilesInBands`, for landmarks of the sizes of two headers
+ *
+ * The largest `MatchFeaturesWithLocalDistortion_memory` of the windows of the bands, which are held one at a time.
+ *
+ * \param[in] parameters configuration settings
+ * \param[in] base_header Size and georeferencing of the base landmark
+ * \param[in] child_header Size and georeferencing of the child landmark
+ * \param[in] band_rows Rows of the child landmark per band, rounded up to a multiple of `block_size`
+ * \param[in] max_nan_count_base Maximum allowed NaN values in base landmark window
+ * \param[in] max_nan_count_child Maximum allowed NaN values in child landmark window
+ * \return bytes, or 0 if the bands are invalid or outside of the base landmark
+ */
+size_t MatchLandmarkFilesInBands_memory(
+    const Parameters *parameters,
+    const LMK *base_header,
+    const LMK *child_header,
+    int32_t band_rows,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child
+);
+
+/**
+ * \brief Most rows per band of `MatchLandmarkFilesInBands` whose estimated memory fits in `bytes`
+ *
+ * \return a multiple of `block_size`, or 0 if bands of one block row do not fit
+ */
+int32_t MatchLandmarkFilesInBands_rows_within(
+    const Parameters *parameters,
+    const LMK *base_header,
+    const LMK *child_header,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    size_t bytes
+);
+
+/**
+ * \brief Bounding rectangle of the pixels whose elevation or surface reflectance differ between two versions of a
+ * landmark
+ *
+ * \param[in] before Previous version
+ * \param[in] after Current version
+ * \param[out] rect Changed pixels, empty if the versions are the same
+ * \return false if the landmarks do not have the same size
+ */
+bool landmark_changed_rect(const LMK *before, const LMK *after, LandmarkRect *rect);
+
+/**
+ * \brief Update the output of `MatchFeaturesWithLocalDistortion` after changes to some pixels of the landmarks
+ *
+ * Only the blocks whose templates, search windows or feature influence windows reach a changed rectangle are
+ * matched again, on windows of both landmarks with `seeded_ransac`, and the pixels they determine replace those of
+ * `results`. If the previous comparison was run with the same parameters and `seeded_ransac` set, the merged maps are
+ * those of a comparison of the whole maps, up to the rounding of the initial homography of each window. Overlapping rectangles are matched again once per rectangle.
+ *
+ * \param[in] parameters configuration settings, the same as the previous comparison
+ * \param[in] base_landmark Current base landmark
+ * \param[in] child_landmark Current child landmark
+ * \param[in] child_dirty Changed rectangles of the child landmark
+ * \param[in] num_child_dirty Number of rectangles in `child_dirty`
+ * \param[in] base_dirty Changed rectangles of the base landmark
+ * \param[in] num_base_dirty Number of rectangles in `base_dirty`
+ * \param[in] max_nan_count_base Maximum allowed NaN values in base landmark window
+ * \param[in] max_nan_count_child Maximum allowed NaN values in child landmark window
+ * \param[in,out] results Previous comparison of the landmarks, updated in place
+ * \return false if memory allocation fails
+ */
+bool RematchLandmarkRegions(
+    Parameters parameters,
+    LMK *base_landmark,
+    LMK *child_landmark,
+    const LandmarkRect *child_dirty,
+    int32_t num_child_dirty,
+    const LandmarkRect *base_dirty,
+    int32_t num_base_dirty,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    CorrelationResults *results
+);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_BAND_MATCH_H_ */
@@ -0,0 +1,296 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cuda_runtime.h>
+
+#include "landmark_tools/feature_tracking/corr_cuda.h"
+#include "landmark_tools/utils/safe_string.h"
+
+struct CorrDeviceImage {
+    unsigned char *pixels;          // device copy, rows of `cols` bytes
+    const unsigned char *host;      // image the copy was made from
+    size_t cols;
+    size_t rows;
+};
+
+// One search as seen by the device
+struct DeviceTask {
+    size_t template_offset;         // first template pixel in the packed templates
+    size_t score_offset;            // first score in the packed scores
+    int32_t cols1, rows1;
+    int32_t left2, top2, cols2, rows2;
+};
+
+// Best offset of one search and the scores around it
+struct DeviceBest {
+    int32_t valid;
+    int32_t row, col;
+    double scores[9];
+};
+
+#define CUDA_CHECK(call, what) \
+    if((call) != cudaSuccess){ \
+        SAFE_PRINTF(256, "corr_cuda_batch() ==>> %s failed\n", what); \
+        success = false; \
+    }
+
+/**
+ \brief Score every offset of one search per block, with the arithmetic of corimg_long
+*/
+__global__ void score_kernel(const unsigned char *templates, const unsigned char *search, size_t search_cols,
+                             const DeviceTask *tasks, double *scores)
+{
+    const DeviceTask task = tasks[blockIdx.x];
+    const unsigned char *a = templates + task.template_offset;
+    long long n = task.cols1*task.rows1;
+
+    // Every thread sums the template itself, it is small compared to the search
+    long long suma = 0, sumasq = 0;
+    for(int32_t k = 0; k < n; k++){
+        long long pixel = a[k];
+        suma += pixel;
+        sumasq += pixel*pixel;
+    }
+    double normsumasq = (double)sumasq - (double)suma*(double)suma/n;
+    bool no_contrast = normsumasq == 0;
+
+    int32_t offset_cols = task.cols2 - task.cols1 + 1;
+    int32_t num_offsets = offset_cols*(task.rows2 - task.rows1 + 1);
+    for(int32_t k = threadIdx.x; k < num_offsets; k += blockDim.x){
+        int32_t row = k/offset_cols;
+        int32_t col = k%offset_cols;
+        const unsigned char *b = search + (size_t)(task.top2 + row)*search_cols + task.left2 + col;
+        long long sumb = 0, sumbsq = 0, sumab = 0;
+        for(int32_t r = 0; r < task.rows1; r++){
+            for(int32_t c = 0; c < task.cols1; c++){
+                long long pixel = b[(size_t)r*search_cols + c];
+                sumb += pixel;
+                sumbsq += pixel*pixel;
+                sumab += pixel*a[r*task.cols1 + c];
+            }
+        }
+        long long normsumab = 2*(n*sumab - suma*sumb)/n;
+        double normsumbsq = (double)sumbsq - (double)sumb*(double)sumb/n;
+        scores[task.score_offset + k] = no_contrast ? NAN : ((double)normsumab)/((double)(normsumasq + normsumbsq));
+    }
+}
+
+/**
+ \brief Find the first highest score of each search, in the same scan order as corimg_long
+*/
+__global__ void best_kernel(const DeviceTask *tasks, const double *scores, size_t n, DeviceBest *best)
+{
+    size_t t = blockIdx.x*(size_t)blockDim.x + threadIdx.x;
+    if(t >= n) return;
+    const DeviceTask task = tasks[t];
+    const double *s = scores + task.score_offset;
+    int32_t offset_cols = task.cols2 - task.cols1 + 1;
+    int32_t offset_rows = task.rows2 - task.rows1 + 1;
+
+    double bestval = -2.0;
+    int32_t bestr = -1, bestc = -1;
+    for(int32_t r = 0; r < offset_rows; r++){
+        for(int32_t c = 0; c < offset_cols; c++){
+            if(s[r*offset_cols + c] > bestval){
+                bestval = s[r*offset_cols + c];
+                bestr = r;
+                bestc = c;
+            }
+        }
+    }
+    best[t].valid = bestr >= 0;
+    best[t].row = bestr;
+    best[t].col = bestc;
+    for(int32_t k = 0; k < 9; k++){
+        int32_t r = bestr - 1 + k/3;
+        int32_t c = bestc - 1 + k%3;
+        bool inside = r >= 0 && c >= 0 && r < offset_rows && c < offset_cols;
+        best[t].scores[k] = inside ? s[r*offset_cols + c] : 0.0;
+    }
+}
+
+bool corr_cuda_available(void)
+{
+    int count = 0;
+    return cudaGetDeviceCount(&count) == cudaSuccess && count > 0;
+}
+
+CorrDeviceImage *corr_cuda_upload(const unsigned char *image, size_t stride, size_t cols, size_t rows)
+{
+    CorrDeviceImage *device = (CorrDeviceImage *)malloc(sizeof(CorrDeviceImage));
+    if(device == NULL) return NULL;
+    device->host = image;
+    device->cols = cols;
+    device->rows = rows;
+    if(cudaMalloc((void **)&device->pixels, cols*rows) != cudaSuccess){
+        SAFE_PRINTF(256, "corr_cuda_upload() ==>> cannot allocate %zu bytes on the device\n", cols*rows);
+        free(device);
+        return NULL;
+    }
+    if(cudaMemcpy2D(device->pixels, cols, image, stride, cols, rows, cudaMemcpyHostToDevice) != cudaSuccess){
+        SAFE_PRINTF(256, "corr_cuda_upload() ==>> copy to the device failed\n");
+        corr_cuda_free(device);
+        return NULL;
+    }
+    return device;
+}
+
+void corr_cuda_free(CorrDeviceImage *image)
+{
+    if(image == NULL) return;
+    cudaFree(image->pixels);
+    free(image);
+}
+
+bool corr_cuda_batch(const CorrDeviceImage *search, const CorrTask *tasks, size_t n, CorrResult *out)
+{
+    if(n == 0) return true;
+
+    // Pack the templates and lay out the scores of every search
+    DeviceTask *host_tasks = (DeviceTask *)malloc(sizeof(DeviceTask)*n);
+    DeviceBest *host_best = (DeviceBest *)malloc(sizeof(DeviceBest)*n);
+    if(host_tasks == NULL || host_best == NULL){
+        SAFE_PRINTF(256, "corr_cuda_batch() ==>> memory allocation error\n");
+        free(host_tasks);
+        free(host_best);
+        return false;
+    }
+    size_t template_bytes = 0, num_scores = 0;
+    bool success = true;
+    for(size_t i = 0; i < n && success; i++){
+        const CorrTask *task = &tasks[i];
+        success = task->img2 == search->host && task->cols2 >= task->cols1 && task->rows2 >= task->rows1 &&
+                  task->left2 + task->cols2 <= search->cols && task->top2 + task->rows2 <= search->rows;
+        host_tasks[i].template_offset = template_bytes;
+        host_tasks[i].score_offset = num_scores;
+        host_tasks[i].cols1 = (int32_t)task->cols1;
+        host_tasks[i].rows1 = (int32_t)task->rows1;
+        host_tasks[i].left2 = (int32_t)task->left2;
+        host_tasks[i].top2 = (int32_t)task->top2;
+        host_tasks[i].cols2 = (int32_t)task->cols2;
+        host_tasks[i].rows2 = (int32_t)task->rows2;
+        size_t scores = (task->cols2 - task->cols1 + 1)*(task->rows2 - task->rows1 + 1);
+        template_bytes += task->cols1*task->rows1;
+        num_scores += scores;
+    }
+    unsigned char *host_templates = success ? (unsigned char *)malloc(template_bytes) : NULL;
+    size_t *owners = success ? (size_t *)malloc(sizeof(size_t)*n) : NULL;
+    CorrSubpixelBatch peaks;
+    memset(&peaks, 0, sizeof(CorrSubpixelBatch));
+    if(success && (host_templates == NULL || owners == NULL || !corr_subpixel_batch_reserve(&peaks, n))){
+        SAFE_PRINTF(256, "corr_cuda_batch() ==>> memory allocation error\n");
+        success = false;
+    }
+    for(size_t i = 0; i < n && success; i++){
+        const CorrTask *task = &tasks[i];
+        for(size_t r = 0; r < task->rows1; r++){
+            memcpy(&host_templates[host_tasks[i].template_offset + r*task->cols1],
+                   task->img1 + (task->top1 + r)*task->rowBytes1 + task->left1, task->cols1);
+        }
+    }
+
+    unsigned char *device_templates = NULL;
+    DeviceTask *device_tasks = NULL;
+    double *device_scores = NULL;
+    DeviceBest *device_best = NULL;
+    if(success){
+        CUDA_CHECK(cudaMalloc((void **)&device_templates, template_bytes), "template allocation");
+    }
+    if(success){
+        CUDA_CHECK(cudaMalloc((void **)&device_tasks, sizeof(DeviceTask)*n), "task allocation");
+    }
+    if(success){
+        CUDA_CHECK(cudaMalloc((void **)&device_scores, sizeof(double)*num_scores), "score allocation");
+    }
+    if(success){
+        CUDA_CHECK(cudaMalloc((void **)&device_best, sizeof(DeviceBest)*n), "result allocation");
+    }
+    if(success){
+        CUDA_CHECK(cudaMemcpy(device_templates, host_templates, template_bytes, cudaMemcpyHostToDevice), "template copy");
+    }
+    if(success){
+        CUDA_CHECK(cudaMemcpy(device_tasks, host_tasks, sizeof(DeviceTask)*n, cudaMemcpyHostToDevice), "task copy");
+    }
+    if(success){
+        score_kernel<<<(unsigned int)n, CORR_CUDA_THREADS>>>(device_templates, search->pixels, search->cols,
+                                                             device_tasks, device_scores);
+        best_kernel<<<(unsigned int)((n + CORR_CUDA_THREADS - 1)/CORR_CUDA_THREADS), CORR_CUDA_THREADS>>>(
+            device_tasks, device_scores, n, device_best);
+        CUDA_CHECK(cudaGetLastError(), "kernel launch");
+    }
+    if(success){
+        CUDA_CHECK(cudaMemcpy(host_best, device_best, sizeof(DeviceBest)*n, cudaMemcpyDeviceToHost), "result copy");
+    }
+
+    // Subpixel refinement on the host, as at the end of corimg_long, of the peaks of consecutive tasks of one model
+    for(size_t first = 0; first < n && success;){
+        CorrSubpixelModel model = tasks[first].subpixel_model;
+        size_t last = first;
+        peaks.count = 0;
+        for(; last < n && tasks[last].subpixel_model == model; last++){
+            const CorrTask *task = &tasks[last];
+            const DeviceBest *best = &host_best[last];
+            CorrResult *result = &out[last];
+            int32_t offset_rows = (int32_t)(task->rows2 - task->rows1 + 1);
+            int32_t offset_cols = (int32_t)(task->cols2 - task->cols1 + 1);
+            result->covar[0] = result->covar[1] = result->covar[2] = 0.0;
+            result->success = false;
+            // A template without contrast scores NAN everywhere, which corimg_long rejects up front
+            if(!best->valid) continue;
+            // The pixel-resolution maximum must be interior, as in subpixel_long
+            if(best->row <= 0 || best->col <= 0 || best->row >= offset_rows - 1 || best->col >= offset_cols - 1){
+                continue;
+            }
+            for(int32_t k = 0; k < 9; k++){
+                peaks.scores[k][peaks.count] = best->scores[k];
+            }
+            owners[peaks.count++] = last;
+        }
+        corr_subpixel_refine(model, &peaks);
+        for(size_t j = 0; j < peaks.count; j++){
+            const CorrTask *task = &tasks[owners[j]];
+            const DeviceBest *best = &host_best[owners[j]];
+            CorrResult *result = &out[owners[j]];
+            if(!peaks.accepted[j]) continue;
+            result->bestrow = (double)best->row + peaks.sub_row[j];
+            result->bestcol = (double)best->col + peaks.sub_col[j];
+            result->bestval = peaks.val[j];
+            for(int32_t k = 0; k < 3; k++){
+                result->covar[k] = peaks.covar[k][j];
+            }
+            result->bestrow += task->top2 + (task->rows1 - 1)*0.5;
+            result->bestcol += task->left2 + (task->cols1 - 1)*0.5;
+            result->success = true;
+        }
+        first = last;
+    }
+
+    cudaFree(device_best);
+    cudaFree(device_scores);
+    cudaFree(device_tasks);
+    cudaFree(device_templates);
+    corr_subpixel_batch_free(&peaks);
+    free(owners);
+    free(host_templates);
+    free(host_best);
+    free(host_tasks);
+    return success;
+}
@@ -0,0 +1,86 @@
+/**
+ * \file corr_cuda.h
+ * \brief CUDA backend for batches of correlation searches
+ *
+ * Off by default. Only built when CMake is run with `-DWITH_CUDA=ON`, which defines `WITH_CUDA`; the `cuda-compile`
+ * CI job builds it, and `CorrCudaTest` compares it with `corimg_long_batch` on machines with a device. The search image is uploaded once
+ * and every search of a `corimg_long_batch` call is scored on the device, one thread block per search. Only the
+ * best offset and its 3x3 neighborhood of scores come back, and the subpixel fits of all the searches run on the host
+ * at once with `corr_subpixel_refine`. Scores use the same double precision arithmetic on exact integer sums as `corimg_long`, so the
+ * results are the same as the CPU path.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_CORR_CUDA_H_
+#define _LANDMARK_TOOLS_CORR_CUDA_H_
+
+#include <stdbool.h>  // for bool
+#include <stdio.h>    // for size_t
+
+#include "landmark_tools/feature_tracking/corr_image_long.h"  // for CorrTask, CorrResult
+
+/** \brief Threads per block of the scoring kernel */
+#define CORR_CUDA_THREADS 128
+
+/**
+ * \brief Search image resident in device memory
+ */
+typedef struct CorrDeviceImage CorrDeviceImage;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ \brief Check for a usable CUDA device
+ \return true if at least one device is present
+*/
+bool corr_cuda_available(void);
+
+/**
+ \brief Copy a search image to the device
+
+ \param[in] image pixels
+ \param[in] stride bytes between rows of `image`
+ \param[in] cols image width
+ \param[in] rows image height
+ \return device image, or NULL on failure. Release with `corr_cuda_free`
+*/
+CorrDeviceImage *corr_cuda_upload(const unsigned char *image, size_t stride, size_t cols, size_t rows);
+
+/**
+ \brief Release a device image
+*/
+void corr_cuda_free(CorrDeviceImage *image);
+
+/**
+ \brief Same as `corimg_long_batch`, with the scores computed on the device
+
+ Every task must search the image uploaded to `search`, that is `img2` is the host image passed to
+ `corr_cuda_upload` and `integral` is ignored. Templates are copied to the device per call.
+ \param[in] search device copy of the search image
+ \param[in] tasks templates and search windows
+ \param[in] n number of tasks
+ \param[out] out one result per task
+ \return false if a task does not search `search` or a CUDA call fails. The caller then falls back to the CPU
+*/
+bool corr_cuda_batch(const CorrDeviceImage *search, const CorrTask *tasks, size_t n, CorrResult *out);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_CORR_CUDA_H_ */
@@ -0,0 +1,126 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <gsl/gsl_fft_complex.h>
+
+#include "landmark_tools/feature_tracking/corr_fft.h"
+
+/**
+ \brief Smallest n >= m with no prime factors other than 2, 3 and 5, which GSL transforms efficiently
+*/
+static size_t fft_size(size_t m){
+    for(size_t n = m;; n++){
+        size_t k = n;
+        while(k % 2 == 0) k /= 2;
+        while(k % 3 == 0) k /= 3;
+        while(k % 5 == 0) k /= 5;
+        if(k == 1) return n;
+    }
+}
+
+bool corr_use_fft(size_t cols1, size_t rows1, size_t cols2, size_t rows2)
+{
+    if(cols2 < cols1 || rows2 < rows1) return false;
+    double direct = (double)((cols2 - cols1 + 1)*(rows2 - rows1 + 1))*(double)(cols1*rows1);
+    if(direct < CORR_FFT_MIN_WORK) return false;
+    double n = (double)fft_size(cols2)*(double)fft_size(rows2);
+    return direct > CORR_FFT_COST_RATIO*n*log2(n);
+}
+
+/**
+ \brief Transform every row, then every column, of a packed complex nx x ny array
+*/
+static void fft2(double *data, size_t nx, size_t ny, bool inverse,
+                 const gsl_fft_complex_wavetable *wx, const gsl_fft_complex_wavetable *wy,
+                 gsl_fft_complex_workspace *work){
+    for(size_t y = 0; y < ny; y++){
+        if(inverse) gsl_fft_complex_inverse(&data[2*y*nx], 1, nx, wx, work);
+        else gsl_fft_complex_forward(&data[2*y*nx], 1, nx, wx, work);
+    }
+    for(size_t x = 0; x < nx; x++){
+        if(inverse) gsl_fft_complex_inverse(&data[2*x], nx, ny, wy, work);
+        else gsl_fft_complex_forward(&data[2*x], nx, ny, wy, work);
+    }
+}
+
+bool corr_fft_sumab(const uint8_t *img1, size_t stride1, size_t cols1, size_t rows1,
+                    const uint8_t *img2, size_t stride2, size_t cols2, size_t rows2,
+                    double *sumab)
+{
+    // Circular correlation does not wrap for offsets inside the search window once the transform covers it
+    size_t nx = fft_size(cols2);
+    size_t ny = fft_size(rows2);
+    double *z = (double *)calloc(2*nx*ny, sizeof(double));
+    gsl_fft_complex_wavetable *wx = gsl_fft_complex_wavetable_alloc(nx);
+    gsl_fft_complex_wavetable *wy = (ny == nx) ? wx : gsl_fft_complex_wavetable_alloc(ny);
+    gsl_fft_complex_workspace *work = gsl_fft_complex_workspace_alloc(nx > ny ? nx : ny);
+    bool success = z != NULL && wx != NULL && wy != NULL && work != NULL;
+
+    if(success){
+        // Transform both images at once as z = a + i*b
+        for(size_t y = 0; y < rows1; y++){
+            for(size_t x = 0; x < cols1; x++){
+                z[2*(y*nx + x)] = img1[y*stride1 + x];
+            }
+        }
+        for(size_t y = 0; y < rows2; y++){
+            for(size_t x = 0; x < cols2; x++){
+                z[2*(y*nx + x) + 1] = img2[y*stride2 + x];
+            }
+        }
+        fft2(z, nx, ny, false, wx, wy, work);
+
+        // A(k) = (Z(k) + conj(Z(-k)))/2 and B(k) = (Z(k) - conj(Z(-k)))/2i. The cross power spectrum
+        // P(k) = conj(A(k))*B(k) is Hermitian, so each pair (k, -k) is computed once.
+        for(size_t y = 0; y < ny; y++){
+            size_t ym = (ny - y) % ny;
+            for(size_t x = 0; x < nx; x++){
+                size_t xm = (nx - x) % nx;
+                size_t k = y*nx + x;
+                size_t km = ym*nx + xm;
+                if(km < k) continue;
+                double zr = z[2*k], zi = z[2*k+1];
+                double mr = z[2*km], mi = z[2*km+1];
+                double ar = 0.5*(zr + mr), ai = 0.5*(zi - mi);
+                double br = 0.5*(zi + mi), bi = -0.5*(zr - mr);
+                double pr = ar*br + ai*bi;
+                double pi = ar*bi - ai*br;
+                z[2*k] = pr;
+                z[2*k+1] = (km == k) ? 0.0 : pi;
+                z[2*km] = pr;
+                z[2*km+1] = (km == k) ? 0.0 : -pi;
+            }
+        }
+        fft2(z, nx, ny, true, wx, wy, work);
+
+        size_t out_cols = cols2 - cols1 + 1;
+        size_t out_rows = rows2 - rows1 + 1;
+        for(size_t y = 0; y < out_rows; y++){
+            for(size_t x = 0; x < out_cols; x++){
+                sumab[y*out_cols + x] = round(z[2*(y*nx + x)]);
+            }
+        }
+    }
+
+    if(work != NULL) gsl_fft_complex_workspace_free(work);
+    if(wy != NULL && wy != wx) gsl_fft_complex_wavetable_free(wy);
+    if(wx != NULL) gsl_fft_complex_wavetable_free(wx);
+    free(z);
+    return success;
+}
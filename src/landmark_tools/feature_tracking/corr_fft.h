@@ -0,0 +1,76 @@
+/**
+ * \file corr_fft.h
+ * \brief FFT cross-correlation for large correlation searches
+ *
+ * The direct search in `corimg_long` costs (search offsets) x (template pixels). For large search windows and
+ * templates, the cross-correlation sum(a*b) for every offset is computed at once in the frequency domain instead.
+ * The sums of the search window are still computed with the running box filter in `corimg_long`. The FFT result is
+ * rounded to the nearest integer, which is exact for 8 bit images at the sizes used here, so both paths produce the
+ * same correlation scores.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_CORR_FFT_H_
+#define _LANDMARK_TOOLS_CORR_FFT_H_
+
+#include <stdbool.h>  // for bool
+#include <stdint.h>   // for uint8_t
+#include <stdio.h>    // for size_t
+
+/** \brief Searches with fewer (search offsets) x (template pixels) always use the direct kernel */
+#define CORR_FFT_MIN_WORK (1 << 24)
+/** \brief Cost of one FFT point relative to one multiply-add of the vectorized direct kernel, per log2 of the FFT size */
+#define CORR_FFT_COST_RATIO 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ \brief Decide whether the FFT path is cheaper than the direct search
+
+ \param[in] cols1 template width
+ \param[in] rows1 template height
+ \param[in] cols2 search window width
+ \param[in] rows2 search window height
+ \return true if `corr_fft_sumab` should be used
+*/
+bool corr_use_fft(size_t cols1, size_t rows1, size_t cols2, size_t rows2);
+
+/**
+ \brief Compute sum(a*b) for every placement of the template inside the search window
+
+ \param[in] img1 first pixel of the template
+ \param[in] stride1 bytes between rows of the template
+ \param[in] cols1 template width
+ \param[in] rows1 template height
+ \param[in] img2 first pixel of the search window
+ \param[in] stride2 bytes between rows of the search window
+ \param[in] cols2 search window width
+ \param[in] rows2 search window height
+ \param[out] sumab (rows2 - rows1 + 1) x (cols2 - cols1 + 1) array in row order
+ \return true on success
+ \return false if memory allocation fails
+*/
+bool corr_fft_sumab(const uint8_t *img1, size_t stride1, size_t cols1, size_t rows1,
+                    const uint8_t *img2, size_t stride2, size_t cols2, size_t rows2,
+                    double *sumab);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_CORR_FFT_H_ */
@@ -15,23 +15,19 @@
  */
 
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/parallel.h"
 #include "landmark_tools/utils/safe_string.h"
 
 #include "landmark_tools/feature_tracking/corr_image_long.h"
-
-/* Precomputed normal equations for the least squares fit of the correlation
- * scores.
- */
-static double fitmat[6][9] = {
-    {1.0/6, -2.0/6,  1.0/6,  1.0/6, -2.0/6,  1.0/6,  1.0/6, -2.0/6,  1.0/6 },
-    {1.0/6,  1.0/6,  1.0/6, -2.0/6, -2.0/6, -2.0/6,  1.0/6,  1.0/6,  1.0/6},
-    { 1.0/4,  0.0,   -1.0/4,  0.0,    0.0,    0.0,   -1.0/4,  0.0,    1.0/4},
-    {-1.0/6,  0.0,    1.0/6, -1.0/6,  0.0,    1.0/6, -1.0/6,  0.0,    1.0/6},
-    {-1.0/6, -1.0/6, -1.0/6,  0.0,    0.0,    0.0,    1.0/6,  1.0/6,  1.0/6},
-    {-1.0/9,  2.0/9, -1.0/9,  2.0/9,  5.0/9,  2.0/9, -1.0/9,  2.0/9, -1.0/9},
-};
+#include "landmark_tools/feature_tracking/corr_fft.h"
+#include "landmark_tools/feature_tracking/corr_kernels.h"
+#include "landmark_tools/feature_tracking/corr_kernels_fixed.h"
+#include "landmark_tools/feature_tracking/corr_subpixel.h"
 
 bool corimg_long_with_input_check(
                                      unsigned char *img1,
@@ -70,7 +66,160 @@ bool corimg_long_with_input_check(
                 bestrow, bestcol, bestval, covar);
 }
 
-bool corimg_long (
+bool corr_integral_image_build(CorrIntegralImage *integral, const unsigned char *image,
+                               size_t stride, size_t cols, size_t rows)
+{
+    size_t width = cols + 1;
+    integral->image = image;
+    integral->stride = stride;
+    integral->cols = cols;
+    integral->rows = rows;
+    integral->sum = (uint32_t *) mem_calloc (MEM_MATCHING, width * (rows + 1), sizeof (uint32_t));
+    integral->sumsq = (uint32_t *) mem_calloc (MEM_MATCHING, width * (rows + 1), sizeof (uint32_t));
+    if (integral->sum == NULL || integral->sumsq == NULL) {
+        SAFE_PRINTF(256, "corr_integral_image_build() ==>> memory allocation error\n");
+        corr_integral_image_free(integral);
+        return false;
+    }
+
+    /* Tables wrap modulo 2^32. Differences of four entries are exact while the window sum fits in 32 bits. */
+    for (size_t r = 0; r < rows; r++) {
+        const unsigned char *src = image + r * stride;
+        uint32_t rowsum = 0, rowsq = 0;
+        for (size_t c = 0; c < cols; c++) {
+            rowsum += src[c];
+            rowsq += (uint32_t) src[c] * src[c];
+            integral->sum[(r + 1) * width + c + 1] = integral->sum[r * width + c + 1] + rowsum;
+            integral->sumsq[(r + 1) * width + c + 1] = integral->sumsq[r * width + c + 1] + rowsq;
+        }
+    }
+    return true;
+}
+
+size_t corr_integral_image_bytes(size_t cols, size_t rows)
+{
+    return 2 * sizeof (uint32_t) * (cols + 1) * (rows + 1);
+}
+
+void corr_integral_image_free(CorrIntegralImage *integral)
+{
+    mem_free (integral->sum);
+    mem_free (integral->sumsq);
+    integral->sum = NULL;
+    integral->sumsq = NULL;
+}
+
+static void integral_window_sums(const CorrIntegralImage *integral, size_t left, size_t top,
+                                 size_t cols, size_t rows, uint64_t *sum, uint64_t *sumsq)
+{
+    size_t width = integral->cols + 1;
+    size_t i00 = top * width + left;
+    size_t i01 = i00 + cols;
+    size_t i10 = i00 + rows * width;
+    size_t i11 = i10 + cols;
+    *sum = (uint32_t) (integral->sum[i11] - integral->sum[i01] - integral->sum[i10] + integral->sum[i00]);
+    *sumsq = (uint32_t) (integral->sumsq[i11] - integral->sumsq[i01] - integral->sumsq[i10] + integral->sumsq[i00]);
+}
+
+static void *scratch_reserve(CorrContext *scratch, size_t size)
+{
+    if (size > scratch->size) {
+        free (scratch->buffer);
+        scratch->buffer = malloc (size);
+        scratch->size = (scratch->buffer != NULL) ? size : 0;
+    }
+    return scratch->buffer;
+}
+
+/* Keep the max_peaks best local maxima of the scores, best first */
+static int32_t find_peaks(const double *cbuff, size_t rows, size_t cols, CorrPeak *peaks, int32_t max_peaks)
+{
+    int32_t count = 0;
+    for (size_t r = 0; r < rows; r++) {
+        for (size_t c = 0; c < cols; c++) {
+            double val = cbuff[r * cols + c];
+            if (count == max_peaks && val <= peaks[count - 1].val) continue;
+            bool is_max = true;
+            for (size_t rr = (r > 0) ? r - 1 : 0; rr <= r + 1 && rr < rows && is_max; rr++) {
+                for (size_t cc = (c > 0) ? c - 1 : 0; cc <= c + 1 && cc < cols; cc++) {
+                    if ((rr != r || cc != c) && cbuff[rr * cols + cc] >= val) {
+                        is_max = false;
+                        break;
+                    }
+                }
+            }
+            if (!is_max) continue;
+
+            int32_t k = (count < max_peaks) ? count++ : count - 1;
+            while (k > 0 && peaks[k - 1].val < val) {
+                peaks[k] = peaks[k - 1];
+                k--;
+            }
+            peaks[k].row = r;
+            peaks[k].col = c;
+            peaks[k].val = val;
+        }
+    }
+    return count;
+}
+
+/* Variants of the search in corimg_long_core */
+typedef struct {
+    const CorrIntegralImage *integral;  /* window sums of b from tables instead of running column sums */
+    CorrContext *scratch;               /* reused buffer instead of malloc per call */
+    CorrPeak *peaks;                    /* return the best *num_peaks local maxima instead of the refined best */
+    int32_t *num_peaks;
+    bool prune;                         /* skip offsets that cannot beat max(best so far, prune_min) */
+    double prune_min;
+    CorrSubpixelBatch *subpixel;        /* add the best offset to this batch, which refines it, instead of refining */
+} CorrOptions;
+
+/* Bytes of scratch memory used by one search */
+static size_t scratch_bytes_needed(size_t cols1, size_t rows1, size_t cols2, size_t rows2, bool prune)
+{
+    size_t num_blocks = (rows1 + CORR_PRUNE_BLOCK_ROWS - 1) / CORR_PRUNE_BLOCK_ROWS;
+    size_t bytes = cols2 * 2 * sizeof(long) + (cols2 - cols1 + 1) * (rows2 - rows1 + 1) * sizeof (double);
+    if (prune) bytes += ((cols2 + 1) * (rows2 + 1) + 2 * num_blocks) * sizeof (double);
+    return bytes;
+}
+
+/* Correlation score of one offset from its integer window sums. 2*sum((a-abar)(b-bbar)) is formed exactly and
+ * truncated toward zero, which is what the floating point expression it replaced gave for templates of up to
+ * 2^18 pixels. Only the final ratio is computed in floating point.
+ */
+static inline double corr_score(int64_t n, uint64_t suma, double normsumasq, uint64_t sumb, uint64_t sumbsq,
+                                uint64_t sumab)
+{
+    int64_t normsumab = 2 * (n * (int64_t) sumab - (int64_t) suma * (int64_t) sumb) / n;
+    double normsumbsq = (double) sumbsq - (double) sumb * (double) sumb / n;
+    return ((double) normsumab) / ((double) (normsumasq + normsumbsq));
+}
+
+/* Exact correlation score of one offset, with the same arithmetic as the search loop */
+static double offset_coeff(const unsigned char *a, size_t stride_a, const unsigned char *b, size_t stride_b,
+                           size_t cols, size_t rows, uint64_t suma, double normsumasq, corr_dot_fn dot)
+{
+    uint64_t sumb = 0, sumbsq = 0;
+    for (size_t r = 0; r < rows; r++) {
+        for (size_t c = 0; c < cols; c++) {
+            uint32_t pixel = b[r * stride_b + c];
+            sumb += pixel;
+            sumbsq += pixel * pixel;
+        }
+    }
+    return corr_score(cols * rows, suma, normsumasq, sumb, sumbsq, dot(a, stride_a, b, stride_b, cols, rows));
+}
+
+/* Correlation search shared by corimg_long and its variants, see CorrOptions. If options->integral is not NULL,
+ * img2 is integral->image.
+ *
+ * With pruning, sum(a*b) of an offset is accumulated in blocks of CORR_PRUNE_BLOCK_ROWS rows. By Cauchy-Schwarz,
+ * the rows not yet accumulated add at most sum over blocks of |a_block| |b_block|. Once that bound shows the score
+ * cannot exceed the threshold, the offset is skipped and its score is left NAN. Skipped neighbors of the best offset
+ * are recomputed exactly before the subpixel fit, so the result equals the exhaustive search whenever the best score
+ * exceeds prune_min.
+ */
+static bool corimg_long_core (
         unsigned char *img1,
         size_t rowBytes1,
         size_t left1,
@@ -86,29 +235,45 @@ bool corimg_long (
         double *bestrow,
         double *bestcol,
         double *bestval,
-        double *covar)
+        double *covar,
+        const CorrOptions *options)
 {
+    static const CorrOptions no_options = {NULL, NULL, NULL, NULL, false, 0.0};
+    if (options == NULL) options = &no_options;
+    const CorrIntegralImage *integral = options->integral;
+    CorrContext *scratch = options->scratch;
+    CorrPeak *peaks = options->peaks;
+    int32_t *num_peaks = options->num_peaks;
+    bool prune = options->prune && peaks == NULL;
     size_t r, c;                /* row and col within window */
-    double sumabsq;                        /* sum((a+b)**2) */
-    long normsumab;              	      /* 2*sum((a-abar)(b-bbar)) */
-    double suma, sumasq, normsumasq;  /* sum(a), sum(a**2), sum((a-abar)**2) */
-    double sumb, sumbsq, normsumbsq;  /* sum(b), sum(b**2), sum((b-bbar)**2) */
+    uint64_t sumab;                   /* sum(a*b) */
+    uint64_t suma, sumasq;            /* sum(a), sum(a**2) */
+    double normsumasq;                /* sum((a-abar)**2) */
+    uint64_t sumb, sumbsq;            /* sum(b), sum(b**2) */
     long row, col;                    /* row and col offsets for window */
     long n;                            /* number of pixels in a window */
     long bestr, bestc;
     unsigned char *src, *dst;
     register unsigned char *s, *d, pixel;
-    register unsigned long *first, *last, *firstsq, *lastsq, longPixel;  //add unsigned
+    register unsigned long *first, *last, *firstsq, *lastsq;  //add unsigned
     double coeff, *coeffs;                    /* correlation for this window place */
     unsigned long *colsum;   /* running total for sum(b) */
     unsigned long *colsq;    /* running total for sum(b**2) */
     double *cbuff;
+    double *fft_sumab = NULL;               /* sum(a*b) for every offset, if the FFT path is used */
+    corr_sumab_fn fixed_sumab = NULL;       /* kernel specialized for this window size, if any */
+    corr_dot_fn dot = corr_select_dot();
     
     if (cols2 < cols1 || rows2 < rows1) return false;
 
     n = cols1 * rows1;
+    if (n > CORR_MAX_TEMPLATE_PIXELS) {
+        SAFE_PRINTF(256, "corimg_long() ==>> template of %ld pixels exceeds %d\n", n, CORR_MAX_TEMPLATE_PIXELS);
+        return false;
+    }
 
-    *bestval = -2.0;
+    /* With pruning, only offsets scoring above prune_min are candidates */
+    *bestval = prune ? options->prune_min : -2.0;
 
     /* calculate only once per call */
 
@@ -122,18 +287,68 @@ bool corimg_long (
             sumasq += pixel * pixel;
         }
     }
-    normsumasq = sumasq - suma * suma / n;
+    normsumasq = (double) sumasq - (double) suma * (double) suma / n;
     if (normsumasq == 0) {
         return false;
     }
 
-    colsum = (unsigned long *) malloc (cols2 * 2 * sizeof(long) +
-        (cols2 - cols1 + 1) * (rows2 - rows1 + 1) * sizeof (double));
+    size_t num_blocks = (rows1 + CORR_PRUNE_BLOCK_ROWS - 1) / CORR_PRUNE_BLOCK_ROWS;
+    size_t scratch_bytes = scratch_bytes_needed(cols1, rows1, cols2, rows2, prune);
+    colsum = (unsigned long *) ((scratch != NULL) ? scratch_reserve(scratch, scratch_bytes) : malloc (scratch_bytes));
     colsq  = colsum + cols2;
     cbuff = (double *) (colsq + cols2);
+    if (colsum == NULL) {
+        SAFE_PRINTF(256, "corimg_long() ==>> memory allocation error\n");
+        return false;
+    }
+
+    /* For pruning: summed-area table of b**2 over the search window, and |a| of each template row block */
+    double *sat_bsq = NULL, *norm_a = NULL, *norm_b = NULL;
+    size_t sat_width = cols2 + 1;
+    if (prune) {
+        sat_bsq = cbuff + (cols2 - cols1 + 1) * (rows2 - rows1 + 1);
+        norm_a = sat_bsq + sat_width * (rows2 + 1);
+        norm_b = norm_a + num_blocks;
+        for (c = 0; c <= cols2; c++) sat_bsq[c] = 0;
+        for (r = 0; r < rows2; r++) {
+            double rowsq = 0;
+            d = img2 + (top2 + r) * rowBytes2 + left2;
+            sat_bsq[(r + 1) * sat_width] = 0;
+            for (c = 0; c < cols2; c++) {
+                rowsq += (double) d[c] * d[c];
+                sat_bsq[(r + 1) * sat_width + c + 1] = sat_bsq[r * sat_width + c + 1] + rowsq;
+            }
+        }
+        for (size_t k = 0; k < num_blocks; k++) {
+            double blocksq = 0;
+            for (r = k * CORR_PRUNE_BLOCK_ROWS; r < rows1 && r < (k + 1) * CORR_PRUNE_BLOCK_ROWS; r++) {
+                s = img1 + (top1 + r) * rowBytes1 + left1;
+                for (c = 0; c < cols1; c++) blocksq += (double) s[c] * s[c];
+            }
+            norm_a[k] = sqrt(blocksq);
+        }
+    }
+    bestr = bestc = -1;
+
+    if (!prune && corr_use_fft(cols1, rows1, cols2, rows2)) {
+        fft_sumab = (double *) malloc ((cols2 - cols1 + 1) * (rows2 - rows1 + 1) * sizeof (double));
+        if (fft_sumab != NULL &&
+            !corr_fft_sumab(img1 + top1 * rowBytes1 + left1, rowBytes1, cols1, rows1,
+                            img2 + top2 * rowBytes2 + left2, rowBytes2, cols2, rows2, fft_sumab)) {
+            free (fft_sumab);
+            fft_sumab = NULL;
+        }
+    }
+    if (!prune && fft_sumab == NULL) {
+        /* sum(a*b) of every offset goes to cbuff, each entry is replaced by its score below */
+        fixed_sumab = corr_select_fixed(cols1, rows1, cols2, rows2);
+        if (fixed_sumab != NULL) {
+            fixed_sumab(img1 + top1 * rowBytes1 + left1, rowBytes1, img2 + top2 * rowBytes2 + left2, rowBytes2, cbuff);
+        }
+    }
 
     dst = img2 + (top2 * rowBytes2) + left2;
-    for (r = rows1; r--; dst += rowBytes2) {
+    for (r = (integral == NULL) ? rows1 : 0; r--; dst += rowBytes2) {
         if (r == (rows1 - 1)) {
             for (c = 0, d = dst; c < cols2; c++, d++) {
                 pixel = *d;
@@ -158,30 +373,66 @@ bool corimg_long (
         sumb = sumbsq = 0;
         first = last = colsum;
         firstsq = lastsq = colsq;
-        for (col = cols1; col--; last++, lastsq ++) {
+        for (col = (integral == NULL) ? cols1 : 0; col--; last++, lastsq ++) {
                 sumbsq += *lastsq;
                 sumb += *last;
         }
 
         for (col = 0; col <= cols2 - cols1; col++, coeffs++) {
+                if (integral != NULL) {
+                    integral_window_sums(integral, left2 + col, top2 + row, cols1, rows1, &sumb, &sumbsq);
+                }
                 
-                // out of magic: have to do it the naive way!
-                sumabsq = 0;
-                src = img1 + top1 * rowBytes1 + left1;
-                dst = img2 + ((top2 + row) * rowBytes2) + left2 + col;
-            for (r = rows1; r--; src += rowBytes1, dst += rowBytes2) {
-                for (c = cols1, s = src, d = dst; c--; s++, d++) {
-                    longPixel = *s + *d;
-                    sumabsq += longPixel * longPixel;
+                // sum(a*b) is an integer on every path, the FFT result is rounded to one
+                if (fft_sumab != NULL) {
+                    sumab = (uint64_t) fft_sumab[coeffs - cbuff];
+                } else if (fixed_sumab != NULL) {
+                    sumab = (uint64_t) *coeffs;
+                } else if (prune) {
+                    /* score > *bestval requires sum(a*b) > needed */
+                    double needed = 0.5 * (*bestval * (normsumasq + (double) sumbsq - (double) sumb * (double) sumb / n)
+                                           + 2 * (double) suma * (double) sumb / n);
+                    double remaining = 0;
+                    for (size_t k = 0; k < num_blocks; k++) {
+                        size_t r0 = row + k * CORR_PRUNE_BLOCK_ROWS;
+                        size_t r1 = row + (((k + 1) * CORR_PRUNE_BLOCK_ROWS < rows1) ?
+                                           (k + 1) * CORR_PRUNE_BLOCK_ROWS : rows1);
+                        double blocksq = sat_bsq[r1 * sat_width + col + cols1] - sat_bsq[r0 * sat_width + col + cols1]
+                                       - sat_bsq[r1 * sat_width + col] + sat_bsq[r0 * sat_width + col];
+                        norm_b[k] = sqrt(blocksq);
+                        remaining += norm_a[k] * norm_b[k];
+                    }
+                    sumab = 0;
+                    bool skip = false;
+                    src = img1 + top1 * rowBytes1 + left1;
+                    dst = img2 + ((top2 + row) * rowBytes2) + left2 + col;
+                    for (size_t k = 0; k < num_blocks; k++) {
+                        if ((double) sumab + remaining < needed - CORR_PRUNE_MARGIN * (fabs(needed) + 1.0)) {
+                            skip = true;
+                            break;
+                        }
+                        size_t block_rows = ((k + 1) * CORR_PRUNE_BLOCK_ROWS < rows1) ?
+                                            CORR_PRUNE_BLOCK_ROWS : rows1 - k * CORR_PRUNE_BLOCK_ROWS;
+                        sumab += dot(src + k * CORR_PRUNE_BLOCK_ROWS * rowBytes1, rowBytes1,
+                                     dst + k * CORR_PRUNE_BLOCK_ROWS * rowBytes2, rowBytes2, cols1, block_rows);
+                        remaining -= norm_a[k] * norm_b[k];
+                    }
+                    if (skip) {
+                        *coeffs = NAN;
+                        if (integral != NULL) continue;
+                        sumb -= *first++;
+                        sumb += *last++;
+                        sumbsq -= *firstsq++;
+                        sumbsq += *lastsq++;
+                        continue;
+                    }
+                } else {
+                    src = img1 + top1 * rowBytes1 + left1;
+                    dst = img2 + ((top2 + row) * rowBytes2) + left2 + col;
+                    sumab = dot(src, rowBytes1, dst, rowBytes2, cols1, rows1);
                 }
-            }
-            //2 * sum(img1*img2) = sum((img1+img2)**2) - sum(img1**2) - sum(img2**2)
-            normsumbsq = sumbsq - sumb * sumb / n;
-            normsumab = (long)(sumabsq - sumasq - sumbsq - 2 * suma * sumb / n);
-            /*normsumbsq = sumbsq  ;
-            normsumab = (long)(sumabsq - sumasq - sumbsq  );*/
 
-            *coeffs = coeff = ((double) normsumab) / ((double) (normsumasq + normsumbsq));
+            *coeffs = coeff = corr_score(n, suma, normsumasq, sumb, sumbsq, sumab);
             /*if(coeff < 0.0)
             {
                 printf("negative correlation \n");
@@ -192,6 +443,7 @@ bool corimg_long (
                 bestc = col;
             }
             
+            if (integral != NULL) continue;
             sumb -= *first++;
             sumb += *last++;
             sumbsq -= *firstsq++;
@@ -199,7 +451,7 @@ bool corimg_long (
         }
 
         /* update colsums */
-        if (row == (rows2 - rows1)) continue;
+        if (row == (rows2 - rows1) || integral != NULL) continue;
         dst = img2 + ((top2 + row) * rowBytes2) + left2;
         for (c = 0; c < cols2; c++, dst++) {
             pixel = *dst;
@@ -213,17 +465,55 @@ bool corimg_long (
             colsum[c] += pixel;
         }
     }
+    free (fft_sumab);
+
+    if (prune) {
+        /* Nothing beat prune_min */
+        if (bestr < 0) {
+            if (scratch == NULL) free (colsum);
+            return false;
+        }
+        /* The subpixel fit needs the exact scores around the best offset */
+        for (row = bestr - 1; row <= bestr + 1; row++) {
+            for (col = bestc - 1; col <= bestc + 1; col++) {
+                if (row < 0 || col < 0 || row > (long)(rows2 - rows1) || col > (long)(cols2 - cols1)) continue;
+                double *score = &cbuff[row * (cols2 - cols1 + 1) + col];
+                if (isnan(*score)) {
+                    *score = offset_coeff(img1 + top1 * rowBytes1 + left1, rowBytes1,
+                                          img2 + (top2 + row) * rowBytes2 + left2 + col, rowBytes2,
+                                          cols1, rows1, suma, normsumasq, dot);
+                }
+            }
+        }
+    }
+
+    if (peaks != NULL) {
+        *num_peaks = find_peaks(cbuff, rows2 - rows1 + 1, cols2 - cols1 + 1, peaks, *num_peaks);
+        if (scratch == NULL) free (colsum);
+        return *num_peaks > 0;
+    }
 
     /*...
     printf ("Pixel-resolution match coordinate: %d %d\n",
         bestr + top2 + height1/2, bestc + left2 + width1/2);
     ...*/
+    if (options->subpixel != NULL)
+    {
+        /* The caller refines the peak with the others of its batch and adds the offset of the window */
+        bool gathered = corr_subpixel_gather(options->subpixel, cbuff, rows2 - rows1 + 1, cols2 - cols1 + 1,
+                                             bestr, bestc);
+        *bestval = cbuff[bestr*(cols2 - cols1 + 1)+bestc];
+        *bestrow = bestr;
+        *bestcol = bestc;
+        if (scratch == NULL) free (colsum);
+        return gathered;
+    }
     if(covar != NULL)
     {
         if (subpixel_long (bestr, bestc, rows2 - rows1 + 1, cols2 - cols1 + 1, cbuff,
               bestrow, bestcol, bestval, covar) != true) {
                   //printf("subpixel error\n");
-            free (colsum);
+            if (scratch == NULL) free (colsum);
             return false;
         }
     }
@@ -236,7 +526,7 @@ bool corimg_long (
 /*
     *bestrow = bestr;
     *bestcol = bestc; */
-    free (colsum);
+    if (scratch == NULL) free (colsum);
     /* Offset to upper-left corner */
     *bestrow += top2 + (rows1 -1) * 0.5;
     *bestcol += left2 + (cols1 -1) * 0.5;
@@ -244,6 +534,298 @@ bool corimg_long (
     return true;
 }
 
+bool corimg_long (
+        unsigned char *img1,
+        size_t rowBytes1,
+        size_t left1,
+        size_t top1,
+        size_t cols1,
+        size_t rows1,
+        unsigned char *img2,
+        size_t rowBytes2,
+        size_t left2,
+        size_t top2,
+        size_t cols2,
+        size_t rows2,
+        double *bestrow,
+        double *bestcol,
+        double *bestval,
+        double *covar)
+{
+    return corimg_long_core(img1, rowBytes1, left1, top1, cols1, rows1,
+                            img2, rowBytes2, left2, top2, cols2, rows2,
+                            bestrow, bestcol, bestval, covar, NULL);
+}
+
+bool corr_context_init(CorrContext *ctx, size_t cols1, size_t rows1, size_t cols2, size_t rows2)
+{
+    ctx->buffer = NULL;
+    ctx->size = 0;
+    memset(&ctx->peaks, 0, sizeof(CorrSubpixelBatch));
+    if (cols2 < cols1 || rows2 < rows1) return true;
+    if (scratch_reserve(ctx, scratch_bytes_needed(cols1, rows1, cols2, rows2, true)) == NULL) {
+        SAFE_PRINTF(256, "corr_context_init() ==>> memory allocation error\n");
+        return false;
+    }
+    return true;
+}
+
+void corr_context_free(CorrContext *ctx)
+{
+    free (ctx->buffer);
+    ctx->buffer = NULL;
+    ctx->size = 0;
+    corr_subpixel_batch_free(&ctx->peaks);
+}
+
+bool corimg_long_ctx (
+        CorrContext *ctx,
+        unsigned char *img1,
+        size_t rowBytes1,
+        size_t left1,
+        size_t top1,
+        size_t cols1,
+        size_t rows1,
+        unsigned char *img2,
+        size_t rowBytes2,
+        size_t left2,
+        size_t top2,
+        size_t cols2,
+        size_t rows2,
+        double *bestrow,
+        double *bestcol,
+        double *bestval,
+        double *covar)
+{
+    CorrOptions options = {NULL, ctx, NULL, NULL, false, 0.0};
+    return corimg_long_core(img1, rowBytes1, left1, top1, cols1, rows1,
+                            img2, rowBytes2, left2, top2, cols2, rows2,
+                            bestrow, bestcol, bestval, covar, &options);
+}
+
+bool corimg_long_pruned (
+        unsigned char *img1,
+        size_t rowBytes1,
+        size_t left1,
+        size_t top1,
+        size_t cols1,
+        size_t rows1,
+        unsigned char *img2,
+        size_t rowBytes2,
+        size_t left2,
+        size_t top2,
+        size_t cols2,
+        size_t rows2,
+        double min_correlation,
+        double *bestrow,
+        double *bestcol,
+        double *bestval,
+        double *covar)
+{
+    CorrOptions options = {NULL, NULL, NULL, NULL, true, min_correlation};
+    return corimg_long_core(img1, rowBytes1, left1, top1, cols1, rows1,
+                            img2, rowBytes2, left2, top2, cols2, rows2,
+                            bestrow, bestcol, bestval, covar, &options);
+}
+
+bool corimg_long_integral (
+        unsigned char *img1,
+        size_t rowBytes1,
+        size_t left1,
+        size_t top1,
+        size_t cols1,
+        size_t rows1,
+        const CorrIntegralImage *integral,
+        size_t left2,
+        size_t top2,
+        size_t cols2,
+        size_t rows2,
+        double *bestrow,
+        double *bestcol,
+        double *bestval,
+        double *covar)
+{
+    if (left2 + cols2 > integral->cols || top2 + rows2 > integral->rows) return false;
+    CorrOptions options = {(cols1 * rows1 <= CORR_INTEGRAL_MAX_TEMPLATE_PIXELS) ? integral : NULL,
+                           NULL, NULL, NULL, false, 0.0};
+    return corimg_long_core(img1, rowBytes1, left1, top1, cols1, rows1,
+                            (unsigned char *) integral->image, integral->stride, left2, top2, cols2, rows2,
+                            bestrow, bestcol, bestval, covar, &options);
+}
+
+int32_t corimg_long_peaks (
+        unsigned char *img1,
+        size_t rowBytes1,
+        size_t left1,
+        size_t top1,
+        size_t cols1,
+        size_t rows1,
+        unsigned char *img2,
+        size_t rowBytes2,
+        size_t left2,
+        size_t top2,
+        size_t cols2,
+        size_t rows2,
+        CorrPeak *peaks,
+        int32_t max_peaks)
+{
+    double bestrow, bestcol, bestval;
+    int32_t num_peaks = max_peaks;
+    if (max_peaks <= 0) return 0;
+    CorrOptions options = {NULL, NULL, peaks, &num_peaks, false, 0.0};
+    if (!corimg_long_core(img1, rowBytes1, left1, top1, cols1, rows1,
+                          img2, rowBytes2, left2, top2, cols2, rows2,
+                          &bestrow, &bestcol, &bestval, NULL, &options)) {
+        return 0;
+    }
+    return num_peaks;
+}
+
+typedef struct {
+    const CorrTask *tasks;
+    CorrResult *out;
+    size_t n;
+    size_t next;
+    pthread_mutex_t mutex;
+} CorrBatch;
+
+/* Runs a task. With peaks, a successful search leaves its best offset in peaks for finish_tasks to refine */
+static void run_task(const CorrTask *task, CorrResult *result, CorrContext *scratch, CorrSubpixelBatch *peaks)
+{
+    unsigned char *img2 = task->img2;
+    size_t rowBytes2 = task->rowBytes2;
+    const CorrIntegralImage *integral = task->integral;
+    if (integral != NULL) {
+        img2 = (unsigned char *) integral->image;
+        rowBytes2 = integral->stride;
+        if (task->left2 + task->cols2 > integral->cols || task->top2 + task->rows2 > integral->rows) {
+            result->success = false;
+            return;
+        }
+        if (task->cols1 * task->rows1 > CORR_INTEGRAL_MAX_TEMPLATE_PIXELS) integral = NULL;
+    }
+    CorrOptions options = {integral, scratch, NULL, NULL, task->prune, task->min_correlation, peaks};
+    result->covar[0] = result->covar[1] = result->covar[2] = 0.0;
+    result->success = corimg_long_core(task->img1, task->rowBytes1, task->left1, task->top1, task->cols1, task->rows1,
+                                       img2, rowBytes2, task->left2, task->top2, task->cols2, task->rows2,
+                                       &result->bestrow, &result->bestcol, &result->bestval, result->covar,
+                                       &options);
+}
+
+/* Refines the peaks left by run_task, owners[j] being the task of peak j, and completes their results as the end
+ * of corimg_long_core does */
+static void finish_tasks(CorrSubpixelModel model, CorrSubpixelBatch *peaks, const size_t *owners,
+                         const CorrTask *tasks, CorrResult *out)
+{
+    corr_subpixel_refine(model, peaks);
+    for (size_t j = 0; j < peaks->count; j++) {
+        const CorrTask *task = &tasks[owners[j]];
+        CorrResult *result = &out[owners[j]];
+        result->success = peaks->accepted[j] != 0;
+        if (!result->success) continue;
+        result->bestrow += peaks->sub_row[j];
+        result->bestcol += peaks->sub_col[j];
+        result->bestval = peaks->val[j];
+        for (int32_t k = 0; k < 3; k++) {
+            result->covar[k] = peaks->covar[k][j];
+        }
+        result->bestrow += task->top2 + (task->rows1 -1) * 0.5;
+        result->bestcol += task->left2 + (task->cols1 -1) * 0.5;
+    }
+    peaks->count = 0;
+}
+
+static void batch_worker(CorrBatch *batch, CorrContext *scratch)
+{
+    /* Without room for the peaks of a chunk, each task is refined on its own */
+    CorrSubpixelBatch *peaks = corr_subpixel_batch_reserve(&scratch->peaks, CORR_BATCH_CHUNK) ? &scratch->peaks
+                                                                                              : NULL;
+    size_t owners[CORR_BATCH_CHUNK];
+    while (true) {
+        pthread_mutex_lock(&batch->mutex);
+        size_t first = batch->next;
+        batch->next += CORR_BATCH_CHUNK;
+        pthread_mutex_unlock(&batch->mutex);
+        if (first >= batch->n) break;
+
+        size_t last = (first + CORR_BATCH_CHUNK < batch->n) ? first + CORR_BATCH_CHUNK : batch->n;
+        if (peaks == NULL) {
+            for (size_t i = first; i < last; i++) {
+                run_task(&batch->tasks[i], &batch->out[i], scratch, NULL);
+            }
+            continue;
+        }
+        peaks->count = 0;
+        CorrSubpixelModel model = batch->tasks[first].subpixel_model;
+        for (size_t i = first; i < last; i++) {
+            /* A batch of peaks is refined with one model */
+            if (batch->tasks[i].subpixel_model != model) {
+                finish_tasks(model, peaks, owners, batch->tasks, batch->out);
+                model = batch->tasks[i].subpixel_model;
+            }
+            owners[peaks->count] = i;
+            run_task(&batch->tasks[i], &batch->out[i], scratch, peaks);
+        }
+        finish_tasks(model, peaks, owners, batch->tasks, batch->out);
+    }
+}
+
+static void *batch_thread(void *arg)
+{
+    CorrContext scratch = {NULL, 0, {0}};
+    batch_worker((CorrBatch *) arg, &scratch);
+    corr_context_free(&scratch);
+    return NULL;
+}
+
+bool corimg_long_batch(const CorrTask *tasks, size_t n, CorrResult *out)
+{
+    return corimg_long_batch_ctx(NULL, tasks, n, out);
+}
+
+bool corimg_long_batch_ctx(CorrContext *ctx, const CorrTask *tasks, size_t n, CorrResult *out)
+{
+    return corimg_long_batch_threads(ctx, tasks, n, out, 0);
+}
+
+bool corimg_long_batch_threads(CorrContext *ctx, const CorrTask *tasks, size_t n, CorrResult *out,
+                               int32_t num_threads)
+{
+    if (num_threads <= 0) num_threads = parallel_num_threads();
+    if (num_threads > CORR_BATCH_MAX_THREADS) num_threads = CORR_BATCH_MAX_THREADS;
+    if ((size_t) num_threads > (n + CORR_BATCH_CHUNK - 1) / CORR_BATCH_CHUNK) {
+        num_threads = (int32_t) ((n + CORR_BATCH_CHUNK - 1) / CORR_BATCH_CHUNK);
+    }
+
+    CorrBatch batch;
+    batch.tasks = tasks;
+    batch.out = out;
+    batch.n = n;
+    batch.next = 0;
+    if (pthread_mutex_init(&batch.mutex, NULL) != 0) {
+        SAFE_PRINTF(256, "corimg_long_batch() ==>> cannot create mutex\n");
+        return false;
+    }
+
+    pthread_t threads[CORR_BATCH_MAX_THREADS];
+    int32_t started = 0;
+    for (int32_t t = 1; t < num_threads; t++) {
+        if (pthread_create(&threads[started], NULL, batch_thread, &batch) != 0) break;
+        started++;
+    }
+    /* The calling thread also takes tasks, so the batch completes even if no thread could be started */
+    if (ctx != NULL) {
+        batch_worker(&batch, ctx);
+    } else {
+        batch_thread(&batch);
+    }
+    for (int32_t t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_mutex_destroy(&batch.mutex);
+    return true;
+}
+
 bool subpixel_long (size_t bestr, size_t bestc, size_t rows, size_t cols,
         double (*cbuff), double *bestrow, double *bestcol, double *bestval,
         double *covar)
@@ -288,7 +870,7 @@ bool subpixel_long (size_t bestr, size_t bestc, size_t rows, size_t cols,
     for (r=0; r<6; r++) {
         A[r] = 0.0;
         for (c=0; c<9; c++) {
-                A[r] += fitmat[r][c] * Q[c];
+                A[r] += corr_subpixel_fitmat[r][c] * Q[c];
         }
         /*printf ("A[%d] = %f\n", r, A[r]);*/
     }
@@ -33,6 +33,96 @@
 #include <stdbool.h>  // for bool
 #include <stdio.h>   // for size_t
 
+#include "landmark_tools/feature_tracking/corr_subpixel.h"  // for CorrSubpixelBatch, CorrSubpixelModel
+
+/** \brief Largest template `corimg_long` accepts, so that its 64 bit integer sums cannot overflow */
+#define CORR_MAX_TEMPLATE_PIXELS (1 << 22)
+
+/** \brief Largest template for which the 32 bit tables of `CorrIntegralImage` give exact window sums */
+#define CORR_INTEGRAL_MAX_TEMPLATE_PIXELS 66051
+
+/**
+ * \brief Summed-area tables of an image and of its squared pixels
+ *
+ * Built once per search image and shared by every `corimg_long_integral` call on it, so the window sums
+ * of each correlation are O(1) lookups instead of running column sums rebuilt per call.
+ */
+typedef struct {
+    const unsigned char *image;  /**< Image the tables were built from */
+    size_t stride;               /**< Bytes between rows of `image` */
+    size_t cols;                 /**< Image width */
+    size_t rows;                 /**< Image height */
+    uint32_t *sum;               /**< (cols+1) x (rows+1) sums of pixels, modulo 2^32 */
+    uint32_t *sumsq;             /**< (cols+1) x (rows+1) sums of squared pixels, modulo 2^32 */
+} CorrIntegralImage;
+
+/** \brief Rows of the template accumulated between the early-rejection tests of `corimg_long_pruned` */
+#define CORR_PRUNE_BLOCK_ROWS 4
+/** \brief Relative slack of the early-rejection bound, covering rounding of the square roots */
+#define CORR_PRUNE_MARGIN 1e-9
+
+/**
+ * \brief Scratch memory of the correlation search, reused across calls
+ *
+ * `corimg_long` allocates its column sums and score buffer on every call. A context keeps them between calls
+ * and only grows when a larger search comes along. A context must not be shared between threads.
+ */
+typedef struct {
+    void *buffer;              /**< Column sums and scores of the search */
+    size_t size;               /**< Bytes allocated in `buffer` */
+    CorrSubpixelBatch peaks;   /**< Peaks of the tasks of `corimg_long_batch` awaiting their refinement */
+} CorrContext;
+
+/** \brief Maximum number of threads used by `corimg_long_batch` */
+#define CORR_BATCH_MAX_THREADS 32
+/** \brief Number of consecutive tasks a thread of `corimg_long_batch` takes at a time */
+#define CORR_BATCH_CHUNK 8
+
+/**
+ * \brief One template and search window for `corimg_long_batch`
+ *
+ * The fields match the arguments of `corimg_long`. If `integral` is not NULL, the search window is read from
+ * `integral->image` as in `corimg_long_integral` and `img2` and `rowBytes2` are ignored.
+ */
+typedef struct {
+    unsigned char *img1;                /**< Template image */
+    size_t rowBytes1;                   /**< Bytes between rows of `img1` */
+    size_t left1;                       /**< Left column of the template in `img1` */
+    size_t top1;                        /**< Top row of the template in `img1` */
+    size_t cols1;                       /**< Template width */
+    size_t rows1;                       /**< Template height */
+    unsigned char *img2;                /**< Search image */
+    size_t rowBytes2;                   /**< Bytes between rows of `img2` */
+    size_t left2;                       /**< Left column of the search window in `img2` */
+    size_t top2;                        /**< Top row of the search window in `img2` */
+    size_t cols2;                       /**< Search window width */
+    size_t rows2;                       /**< Search window height */
+    const CorrIntegralImage *integral;  /**< Precomputed tables of the search image, or NULL */
+    bool prune;                         /**< Search as `corimg_long_pruned` */
+    double min_correlation;             /**< Threshold of the pruned search */
+    CorrSubpixelModel subpixel_model;   /**< Refinement of the best offset, `CORR_SUBPIXEL_QUADRATIC` as `corimg_long` */
+} CorrTask;
+
+/**
+ * \brief Result of one `CorrTask`
+ */
+typedef struct {
+    bool success;      /**< Return value of `corimg_long` */
+    double bestrow;    /**< Row of the best match in the search image */
+    double bestcol;    /**< Column of the best match in the search image */
+    double bestval;    /**< Correlation score of the best match */
+    double covar[3];   /**< Covariance of the subpixel peak */
+} CorrResult;
+
+/**
+ * \brief Local maximum of the correlation scores
+ */
+typedef struct {
+    size_t row;   /**< Row offset of the template top-left corner inside the search window */
+    size_t col;   /**< Column offset of the template top-left corner inside the search window */
+    double val;   /**< Correlation score */
+} CorrPeak;
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -105,6 +195,138 @@ bool corimg_long (unsigned char *img1, size_t rowBytes1,
                   size_t left2, size_t top2, size_t cols2, size_t rows2,
              double *bestrow, double *bestcol, double *bestval, double *covar);
 
+/**
+ \brief Allocate a context large enough for searches up to the given size
+
+ Larger searches still work, the buffer grows on first use.
+ \param[out] ctx context. Release with `corr_context_free`
+ \param[in] cols1 template width
+ \param[in] rows1 template height
+ \param[in] cols2 search window width
+ \param[in] rows2 search window height
+ \return false if memory allocation fails
+*/
+bool corr_context_init(CorrContext *ctx, size_t cols1, size_t rows1, size_t cols2, size_t rows2);
+
+/**
+ \brief Release the memory of a `CorrContext`
+*/
+void corr_context_free(CorrContext *ctx);
+
+/**
+ \brief Same as `corimg_long`, with scratch memory taken from `ctx` instead of allocated per call
+
+ \param[in,out] ctx scratch memory, from `corr_context_init` or zero initialized
+*/
+bool corimg_long_ctx (CorrContext *ctx, unsigned char *img1, size_t rowBytes1,
+                      size_t left1, size_t top1, size_t cols1, size_t rows1,
+                      unsigned char *img2, size_t rowBytes2,
+                      size_t left2, size_t top2, size_t cols2, size_t rows2,
+                      double *bestrow, double *bestcol, double *bestval, double *covar);
+
+/**
+ \brief Same as `corimg_long`, skipping search offsets that cannot score above `min_correlation`
+
+ Every offset first gets a Cauchy-Schwarz upper bound on its score from the template and window energies. The
+ template product is then accumulated in blocks of `CORR_PRUNE_BLOCK_ROWS` rows, tightening the bound after each
+ block, and the offset is dropped as soon as the bound falls below `min_correlation` or the best score so far.
+ The result is identical to `corimg_long` whenever its best score exceeds `min_correlation`.
+ \param[in] min_correlation matches scoring at or below this value are not needed
+ \return false if no offset scores above `min_correlation`, or as `corimg_long`
+*/
+bool corimg_long_pruned (unsigned char *img1, size_t rowBytes1,
+                         size_t left1, size_t top1, size_t cols1, size_t rows1,
+                         unsigned char *img2, size_t rowBytes2,
+                         size_t left2, size_t top2, size_t cols2, size_t rows2,
+                         double min_correlation,
+                         double *bestrow, double *bestcol, double *bestval, double *covar);
+
+/**
+ \brief Build the summed-area tables of an image
+
+ \param[out] integral tables. Release with `corr_integral_image_free`
+ \param[in] image pixels. Must stay valid while the tables are used
+ \param[in] stride bytes between rows of `image`
+ \param[in] cols image width
+ \param[in] rows image height
+ \return true on success
+ \return false if memory allocation fails
+*/
+bool corr_integral_image_build(CorrIntegralImage *integral, const unsigned char *image,
+                               size_t stride, size_t cols, size_t rows);
+
+/**
+ \brief Release the tables of `corr_integral_image_build`
+*/
+void corr_integral_image_free(CorrIntegralImage *integral);
+
+/**
+ \brief Bytes held by the tables of a cols x rows image
+*/
+size_t corr_integral_image_bytes(size_t cols, size_t rows);
+
+/**
+ \brief Same as `corimg_long`, with the search window sums read from precomputed tables
+
+ Scores are identical to `corimg_long` on `integral->image`.
+ \param[in] integral tables of the search image
+ \param[in] left2 left column of the search window in the search image
+ \param[in] top2 top row of the search window in the search image
+ \param[in] cols2 width of the search window
+ \param[in] rows2 height of the search window
+ \return false if the search window is outside the image or no match is found
+*/
+bool corimg_long_integral (unsigned char *img1, size_t rowBytes1,
+                           size_t left1, size_t top1, size_t cols1, size_t rows1,
+                           const CorrIntegralImage *integral,
+                           size_t left2, size_t top2, size_t cols2, size_t rows2,
+                           double *bestrow, double *bestcol, double *bestval, double *covar);
+
+/**
+ \brief Find the best local maxima of the correlation scores without subpixel refinement
+
+ Used for coarse levels of a pyramid search, where the refinement happens at full resolution.
+ The arguments before `peaks` are those of `corimg_long`.
+ \param[out] peaks best local maxima, best first
+ \param[in] max_peaks length of `peaks`
+ \return number of peaks found. 0 if the template has no contrast or the search window is too small
+*/
+int32_t corimg_long_peaks (unsigned char *img1, size_t rowBytes1,
+                           size_t left1, size_t top1, size_t cols1, size_t rows1,
+                           unsigned char *img2, size_t rowBytes2,
+                           size_t left2, size_t top2, size_t cols2, size_t rows2,
+                           CorrPeak *peaks, int32_t max_peaks);
+
+/**
+ \brief Run many correlations on all online processors
+
+ Every task is refined to subpixel with its `subpixel_model` and reports its covariance. The peaks of the tasks a
+ thread takes at a time are refined together by `corr_subpixel_refine`. Each thread reuses one scratch buffer for
+ all of its tasks. With `CORR_SUBPIXEL_QUADRATIC`, `out[i]` is identical to calling `corimg_long` on `tasks[i]`.
+ \param[in] tasks templates and search windows
+ \param[in] n number of tasks
+ \param[out] out one result per task
+ \return true if the batch ran. Per task success is in `out`
+ \return false if the batch could not be started
+*/
+bool corimg_long_batch(const CorrTask *tasks, size_t n, CorrResult *out);
+
+/**
+ \brief Same as `corimg_long_batch`, with the tasks of the calling thread using the scratch memory of `ctx`
+
+ \param[in,out] ctx scratch memory of the calling thread. If NULL, it is allocated for this batch
+*/
+bool corimg_long_batch_ctx(CorrContext *ctx, const CorrTask *tasks, size_t n, CorrResult *out);
+
+/**
+ \brief Same as `corimg_long_batch_ctx`, on at most num_threads threads
+
+ Callers that already run batches on several threads pass 1 to keep each batch on its own thread.
+ \param[in] num_threads maximum number of threads, including the calling thread. If 0, `parallel_num_threads()`
+*/
+bool corimg_long_batch_threads(CorrContext *ctx, const CorrTask *tasks, size_t n, CorrResult *out,
+                               int32_t num_threads);
+
 /**
  \brief TODO
  
@@ -0,0 +1,179 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "landmark_tools/feature_tracking/corr_kernels.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CORR_KERNELS_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define CORR_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+/* The vector kernels accumulate into 32 bit lanes. A lane receives at most 4 products of 255*255 per 16 pixels,
+ * so the lanes are added into the 64 bit total at least every CORR_FLUSH_PIXELS pixels to avoid overflow.
+ */
+#define CORR_FLUSH_PIXELS (1 << 17)
+
+static uint64_t dot_row_scalar(const uint8_t *a, const uint8_t *b, size_t n){
+    uint64_t sum = 0;
+    for(size_t c = 0; c < n; c++){
+        sum += (uint32_t)a[c] * b[c];
+    }
+    return sum;
+}
+
+uint64_t corr_dot_scalar(const uint8_t *a, size_t stride_a,
+                         const uint8_t *b, size_t stride_b,
+                         size_t cols, size_t rows)
+{
+    uint64_t sum = 0;
+    for(size_t r = 0; r < rows; r++, a += stride_a, b += stride_b){
+        sum += dot_row_scalar(a, b, cols);
+    }
+    return sum;
+}
+
+#ifdef CORR_KERNELS_X86
+
+__attribute__((target("avx2")))
+static uint64_t hsum_epi32_avx2(__m256i v){
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("avx2")))
+static uint64_t corr_dot_avx2(const uint8_t *a, size_t stride_a,
+                              const uint8_t *b, size_t stride_b,
+                              size_t cols, size_t rows)
+{
+    uint64_t sum = 0;
+    size_t pending = 0;
+    __m256i acc = _mm256_setzero_si256();
+    size_t vec_cols = cols & ~(size_t)15;
+    for(size_t r = 0; r < rows; r++, a += stride_a, b += stride_b){
+        for(size_t c = 0; c < vec_cols; c += 16){
+            __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(a + c)));
+            __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(b + c)));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+        }
+        sum += dot_row_scalar(a + vec_cols, b + vec_cols, cols - vec_cols);
+        pending += vec_cols;
+        if(pending >= CORR_FLUSH_PIXELS){
+            sum += hsum_epi32_avx2(acc);
+            acc = _mm256_setzero_si256();
+            pending = 0;
+        }
+    }
+    return sum + hsum_epi32_avx2(acc);
+}
+
+static uint64_t hsum_epi32_sse2(__m128i s){
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_cvtsi128_si32(s);
+}
+
+static uint64_t corr_dot_sse2(const uint8_t *a, size_t stride_a,
+                              const uint8_t *b, size_t stride_b,
+                              size_t cols, size_t rows)
+{
+    uint64_t sum = 0;
+    size_t pending = 0;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    size_t vec_cols = cols & ~(size_t)7;
+    for(size_t r = 0; r < rows; r++, a += stride_a, b += stride_b){
+        for(size_t c = 0; c < vec_cols; c += 8){
+            __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(a + c)), zero);
+            __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(b + c)), zero);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(va, vb));
+        }
+        sum += dot_row_scalar(a + vec_cols, b + vec_cols, cols - vec_cols);
+        pending += vec_cols;
+        if(pending >= CORR_FLUSH_PIXELS){
+            sum += hsum_epi32_sse2(acc);
+            acc = zero;
+            pending = 0;
+        }
+    }
+    return sum + hsum_epi32_sse2(acc);
+}
+
+#endif // CORR_KERNELS_X86
+
+#ifdef CORR_KERNELS_NEON
+
+static uint64_t corr_dot_neon(const uint8_t *a, size_t stride_a,
+                              const uint8_t *b, size_t stride_b,
+                              size_t cols, size_t rows)
+{
+    uint64_t sum = 0;
+    size_t pending = 0;
+    uint32x4_t acc = vdupq_n_u32(0);
+    size_t vec_cols = cols & ~(size_t)15;
+    for(size_t r = 0; r < rows; r++, a += stride_a, b += stride_b){
+        for(size_t c = 0; c < vec_cols; c += 16){
+            uint8x16_t va = vld1q_u8(a + c);
+            uint8x16_t vb = vld1q_u8(b + c);
+#ifdef __ARM_FEATURE_DOTPROD
+            acc = vdotq_u32(acc, va, vb);
+#else
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(va), vget_low_u8(vb)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(va), vget_high_u8(vb)));
+#endif
+        }
+        sum += dot_row_scalar(a + vec_cols, b + vec_cols, cols - vec_cols);
+        pending += vec_cols;
+        if(pending >= CORR_FLUSH_PIXELS){
+            sum += vaddvq_u32(acc);
+            acc = vdupq_n_u32(0);
+            pending = 0;
+        }
+    }
+    return sum + vaddvq_u32(acc);
+}
+
+#endif // CORR_KERNELS_NEON
+
+corr_dot_fn corr_select_dot(void)
+{
+#if defined(CORR_KERNELS_X86)
+    if(__builtin_cpu_supports("avx2")) return corr_dot_avx2;
+    return corr_dot_sse2;
+#elif defined(CORR_KERNELS_NEON)
+    return corr_dot_neon;
+#else
+    return corr_dot_scalar;
+#endif
+}
+
+const char *corr_dot_name(void)
+{
+#if defined(CORR_KERNELS_X86)
+    if(__builtin_cpu_supports("avx2")) return "avx2";
+    return "sse2";
+#elif defined(CORR_KERNELS_NEON) && defined(__ARM_FEATURE_DOTPROD)
+    return "neon_dotprod";
+#elif defined(CORR_KERNELS_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
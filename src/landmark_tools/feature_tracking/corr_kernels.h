@@ -0,0 +1,73 @@
+/**
+ * \file corr_kernels.h
+ * \brief Vectorized inner products for image correlation
+ *
+ * `corimg_long` needs sum(a*b) over the template for every search offset. The kernels here compute it with
+ * integer accumulation, so every kernel returns exactly the same value as the scalar loop. The fastest kernel
+ * supported by the CPU is chosen at run time: AVX2 or SSE2 on x86-64, NEON (with the dot product extension
+ * if the compiler targets it) on ARM64, and the scalar loop otherwise.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_CORR_KERNELS_H_
+#define _LANDMARK_TOOLS_CORR_KERNELS_H_
+
+#include <stdint.h>  // for uint8_t, uint64_t
+#include <stdio.h>   // for size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ \brief Sum of products of two image windows
+
+ \param[in] a first pixel of the first window
+ \param[in] stride_a bytes between rows of the first window
+ \param[in] b first pixel of the second window
+ \param[in] stride_b bytes between rows of the second window
+ \param[in] cols width of the windows
+ \param[in] rows height of the windows
+ \return sum(a*b)
+*/
+typedef uint64_t (*corr_dot_fn)(const uint8_t *a, size_t stride_a,
+                                const uint8_t *b, size_t stride_b,
+                                size_t cols, size_t rows);
+
+/**
+ \brief Reference implementation of `corr_dot_fn`
+*/
+uint64_t corr_dot_scalar(const uint8_t *a, size_t stride_a,
+                         const uint8_t *b, size_t stride_b,
+                         size_t cols, size_t rows);
+
+/**
+ \brief Select the fastest `corr_dot_fn` supported by this CPU
+
+ \return kernel function. Never NULL
+*/
+corr_dot_fn corr_select_dot(void);
+
+/**
+ \brief Name of the kernel returned by `corr_select_dot`, for logging
+*/
+const char *corr_dot_name(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_CORR_KERNELS_H_ */
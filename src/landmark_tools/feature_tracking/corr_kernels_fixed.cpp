@@ -0,0 +1,110 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "landmark_tools/feature_tracking/corr_kernels_fixed.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CORR_FIXED_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Offsets of one search row computed together. Each lane accumulates at most 25*25 products of 255*255,
+// so 32 bit lanes do not overflow.
+const int BLOCK = 8;
+
+template <int TW, int SW>
+struct CorrKernel {
+    static const int OFFSETS = SW - TW + 1;
+    static_assert(OFFSETS >= BLOCK, "search window too small for a register block");
+
+#ifdef CORR_FIXED_SSE2
+    // Adjacent template columns are paired so that one madd applies both to 8 offsets
+    static void block(const uint8_t *a, size_t stride_a, const uint8_t *b, size_t stride_b, double *sumab){
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc0 = zero, acc1 = zero;
+        for(int i = 0; i < TW; i++, a += stride_a, b += stride_b){
+            for(int j = 0; j + 1 < TW; j += 2){
+                __m128i w = _mm_set1_epi32(a[j] | (a[j+1] << 16));
+                __m128i b0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(b + j)), zero);
+                __m128i b1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(b + j + 1)), zero);
+                acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi16(b0, b1), w));
+                acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi16(b0, b1), w));
+            }
+            if(TW % 2){
+                __m128i w = _mm_set1_epi32(a[TW-1]);
+                __m128i b0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(b + TW - 1)), zero);
+                acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi16(b0, zero), w));
+                acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi16(b0, zero), w));
+            }
+        }
+        uint32_t sums[BLOCK];
+        _mm_storeu_si128((__m128i *)sums, acc0);
+        _mm_storeu_si128((__m128i *)(sums + 4), acc1);
+        for(int k = 0; k < BLOCK; k++) sumab[k] = sums[k];
+    }
+#else
+    static void block(const uint8_t *a, size_t stride_a, const uint8_t *b, size_t stride_b, double *sumab){
+        uint32_t acc[BLOCK] = {0};
+        for(int i = 0; i < TW; i++, a += stride_a, b += stride_b){
+            for(int j = 0; j < TW; j++){
+                uint32_t pixel = a[j];
+                for(int k = 0; k < BLOCK; k++) acc[k] += pixel * b[j + k];
+            }
+        }
+        for(int k = 0; k < BLOCK; k++) sumab[k] = acc[k];
+    }
+#endif
+
+    static void sumab(const uint8_t *a, size_t stride_a, const uint8_t *b, size_t stride_b, double *sumab){
+        for(int r = 0; r < OFFSETS; r++, b += stride_b, sumab += OFFSETS){
+            // The last block of a row overlaps the previous one instead of falling back to single offsets
+            for(int c = 0; c < OFFSETS; c += BLOCK){
+                int first = (c + BLOCK <= OFFSETS) ? c : OFFSETS - BLOCK;
+                block(a, stride_a, b + first, stride_b, sumab + first);
+            }
+        }
+    }
+};
+
+struct FixedKernel {
+    size_t template_size;
+    size_t search_size;
+    corr_sumab_fn fn;
+};
+
+const FixedKernel fixed_kernels[] = {
+    {15, 36, CorrKernel<15, 36>::sumab}, {15, 37, CorrKernel<15, 37>::sumab},
+    {15, 48, CorrKernel<15, 48>::sumab}, {15, 49, CorrKernel<15, 49>::sumab},
+    {21, 36, CorrKernel<21, 36>::sumab}, {21, 37, CorrKernel<21, 37>::sumab},
+    {21, 48, CorrKernel<21, 48>::sumab}, {21, 49, CorrKernel<21, 49>::sumab},
+    {25, 36, CorrKernel<25, 36>::sumab}, {25, 37, CorrKernel<25, 37>::sumab},
+    {25, 48, CorrKernel<25, 48>::sumab}, {25, 49, CorrKernel<25, 49>::sumab},
+};
+
+} // namespace
+
+corr_sumab_fn corr_select_fixed(size_t cols1, size_t rows1, size_t cols2, size_t rows2)
+{
+    if(cols1 != rows1 || cols2 != rows2) return NULL;
+    for(size_t k = 0; k < sizeof(fixed_kernels)/sizeof(fixed_kernels[0]); k++){
+        if(fixed_kernels[k].template_size == cols1 && fixed_kernels[k].search_size == cols2){
+            return fixed_kernels[k].fn;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,63 @@
+/**
+ * \file corr_kernels_fixed.h
+ * \brief Correlation kernels specialized for the common window sizes
+ *
+ * Matching almost always runs with a square template of 15, 21 or 25 pixels and a square search window of 36, 37,
+ * 48 or 49 pixels. For those sizes, sum(a*b) over every search offset is computed by a C++ template instance with
+ * the template loops fully unrolled, and several neighboring offsets held in registers so each template pixel is
+ * loaded once per block of offsets. The sums are exact integers, so the scores are the same as the generic loop.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_CORR_KERNELS_FIXED_H_
+#define _LANDMARK_TOOLS_CORR_KERNELS_FIXED_H_
+
+#include <stdint.h>  // for uint8_t
+#include <stdio.h>   // for size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ \brief Compute sum(a*b) for every placement of the template inside the search window
+
+ \param[in] a first pixel of the template
+ \param[in] stride_a bytes between rows of the template
+ \param[in] b first pixel of the search window
+ \param[in] stride_b bytes between rows of the search window
+ \param[out] sumab (rows2 - rows1 + 1) x (cols2 - cols1 + 1) array in row order
+*/
+typedef void (*corr_sumab_fn)(const uint8_t *a, size_t stride_a,
+                              const uint8_t *b, size_t stride_b,
+                              double *sumab);
+
+/**
+ \brief Select the kernel specialized for the given template and search window size
+
+ \param[in] cols1 template width
+ \param[in] rows1 template height
+ \param[in] cols2 search window width
+ \param[in] rows2 search window height
+ \return kernel function, or NULL if there is no kernel for this size
+*/
+corr_sumab_fn corr_select_fixed(size_t cols1, size_t rows1, size_t cols2, size_t rows2);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_CORR_KERNELS_FIXED_H_ */
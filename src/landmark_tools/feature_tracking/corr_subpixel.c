@@ -0,0 +1,330 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>     // for fabs, log, exp
+#include <stdint.h>   // for uintptr_t
+#include <stdio.h>    // for printf
+#include <stdlib.h>   // for malloc, free
+#include <string.h>   // for memcpy, memset
+
+#include "landmark_tools/feature_tracking/corr_subpixel.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CORR_SUBPIXEL_X86
+#include <immintrin.h>
+#endif
+
+const double corr_subpixel_fitmat[6][9] = {
+    {1.0/6, -2.0/6,  1.0/6,  1.0/6, -2.0/6,  1.0/6,  1.0/6, -2.0/6,  1.0/6 },
+    {1.0/6,  1.0/6,  1.0/6, -2.0/6, -2.0/6, -2.0/6,  1.0/6,  1.0/6,  1.0/6},
+    { 1.0/4,  0.0,   -1.0/4,  0.0,    0.0,    0.0,   -1.0/4,  0.0,    1.0/4},
+    {-1.0/6,  0.0,    1.0/6, -1.0/6,  0.0,    1.0/6, -1.0/6,  0.0,    1.0/6},
+    {-1.0/6, -1.0/6, -1.0/6,  0.0,    0.0,    0.0,    1.0/6,  1.0/6,  1.0/6},
+    {-1.0/9,  2.0/9, -1.0/9,  2.0/9,  5.0/9,  2.0/9, -1.0/9,  2.0/9, -1.0/9},
+};
+
+/**
+ * \brief Place the columns of a batch of `capacity` peaks in one block
+ *
+ * \param arena Block of the columns, aligned on a cache line, or NULL to only compute its size
+ * \return bytes of the block
+ */
+static size_t layout_columns(CorrSubpixelBatch *batch, size_t capacity, uint8_t *arena)
+{
+    size_t offset = 0;
+    // Each column starts on a cache line
+#define SUBPIXEL_COLUMN(field, bytes) do { \
+        offset = (offset + 63) & ~(size_t)63; \
+        if (arena != NULL) batch->field = (void *)(arena + offset); \
+        offset += (bytes); \
+    } while (0)
+    for (int32_t k = 0; k < 9; k++) {
+        SUBPIXEL_COLUMN(scores[k], sizeof(double) * capacity);
+    }
+    SUBPIXEL_COLUMN(sub_row, sizeof(double) * capacity);
+    SUBPIXEL_COLUMN(sub_col, sizeof(double) * capacity);
+    SUBPIXEL_COLUMN(val, sizeof(double) * capacity);
+    for (int32_t k = 0; k < 3; k++) {
+        SUBPIXEL_COLUMN(covar[k], sizeof(double) * capacity);
+    }
+    SUBPIXEL_COLUMN(accepted, sizeof(uint8_t) * capacity);
+#undef SUBPIXEL_COLUMN
+    return offset;
+}
+
+bool corr_subpixel_batch_reserve(CorrSubpixelBatch *batch, size_t capacity)
+{
+    if (capacity <= batch->capacity) return true;
+    void *arena = malloc(layout_columns(batch, capacity, NULL) + 63);
+    if (arena == NULL) {
+        printf("corr_subpixel_batch_reserve() ==>> memory allocation error\n");
+        return false;
+    }
+
+    CorrSubpixelBatch grown = *batch;
+    grown.capacity = capacity;
+    grown.arena = arena;
+    layout_columns(&grown, capacity, (uint8_t *)(((uintptr_t)arena + 63) & ~(uintptr_t)63));
+    if (batch->arena != NULL && batch->count > 0) {
+        for (int32_t k = 0; k < 9; k++) {
+            memcpy(grown.scores[k], batch->scores[k], sizeof(double) * batch->count);
+        }
+    }
+    free(batch->arena);
+    *batch = grown;
+    return true;
+}
+
+void corr_subpixel_batch_free(CorrSubpixelBatch *batch)
+{
+    free(batch->arena);
+    memset(batch, 0, sizeof(CorrSubpixelBatch));
+}
+
+bool corr_subpixel_gather(CorrSubpixelBatch *batch, const double *cbuff, size_t rows, size_t cols,
+                          size_t bestr, size_t bestc)
+{
+    /* Same test as subpixel_long: the pixel-resolution maximum must be interior */
+    if (bestr == 0 || bestc == 0 || bestr >= rows - 1 || bestc >= cols - 1) return false;
+    size_t i = batch->count++;
+    for (int32_t k = 0; k < 9; k++) {
+        batch->scores[k][i] = cbuff[(bestr - 1 + k / 3) * cols + (bestc - 1 + k % 3)];
+    }
+    return true;
+}
+
+/* Refinement of peak i. The expressions of each model are those of its vector kernel, term by term, so the two give
+ * the same results. CORR_SUBPIXEL_QUADRATIC follows subpixel_long in the same way.
+ */
+static void refine_peak(CorrSubpixelModel model, CorrSubpixelBatch *batch, size_t i)
+{
+    double q[9];
+    for (int32_t k = 0; k < 9; k++) {
+        q[k] = batch->scores[k][i];
+    }
+    double center = q[4];
+    bool reject = false;
+    for (int32_t k = 0; k < 9; k++) {
+        if (k != 4 && q[k] >= center) reject = true;
+    }
+
+    double subr = 0.0, subc = 0.0, interp = center, covar[3] = {0.0, 0.0, 0.0};
+    if (model == CORR_SUBPIXEL_QUADRATIC) {
+        double A[6];
+        for (int32_t r = 0; r < 6; r++) {
+            A[r] = 0.0;
+            for (int32_t c = 0; c < 9; c++) {
+                A[r] += corr_subpixel_fitmat[r][c] * q[c];
+            }
+        }
+        double denom = 4*A[0]*A[1] - A[2]*A[2];
+        reject = reject || fabs(denom) < CORR_SUBPIXEL_MIN_DET;
+        covar[0] = -2.0 * A[1]/denom;
+        covar[1] =  A[2] /denom;
+        covar[2] = -2.0 * A[0]/denom;
+        subc = (-2*A[1]*A[3] + A[2]*A[4]) / denom;
+        subr = (-2*A[0]*A[4] + A[2]*A[3]) / denom;
+        interp = A[0]*subc*subc + A[1]*subr*subr + A[2]*subc*subr + A[3]*subc + A[4]*subr + A[5];
+    } else {
+        if (model == CORR_SUBPIXEL_GAUSSIAN) {
+            for (int32_t k = 1; k < 8; k += 2) {
+                reject = reject || !(q[k] > 0.0);
+            }
+            reject = reject || !(center > 0.0);
+            if (!reject) {
+                for (int32_t k = 1; k < 8; k += 2) {
+                    q[k] = log(q[k]);
+                }
+                q[4] = log(center);
+            }
+        }
+        double gc = 0.5 * (q[5] - q[3]);
+        double gr = 0.5 * (q[7] - q[1]);
+        double hc = (q[3] - 2.0 * q[4]) + q[5];
+        double hr = (q[1] - 2.0 * q[4]) + q[7];
+        if (model == CORR_SUBPIXEL_TAYLOR) {
+            double hx = 0.25 * ((q[8] - q[6]) - (q[2] - q[0]));
+            double det = hc * hr - hx * hx;
+            reject = reject || fabs(det) < CORR_SUBPIXEL_MIN_DET;
+            subc = -(hr * gc - hx * gr) / det;
+            subr = -(hc * gr - hx * gc) / det;
+            covar[0] = -hr / det;
+            covar[1] = hx / det;
+            covar[2] = -hc / det;
+        } else {
+            reject = reject || fabs(hc * hr) < CORR_SUBPIXEL_MIN_DET;
+            subc = -gc / hc;
+            subr = -gr / hr;
+            covar[0] = -1.0 / hc;
+            covar[2] = -1.0 / hr;
+        }
+        interp = q[4] + 0.5 * (gc * subc + gr * subr);
+        if (model == CORR_SUBPIXEL_GAUSSIAN) interp = exp(interp);
+    }
+    reject = reject || fabs(subc) >= 1.0 || fabs(subr) >= 1.0;
+
+    batch->sub_row[i] = reject ? 0.0 : subr;
+    batch->sub_col[i] = reject ? 0.0 : subc;
+    batch->val[i] = reject ? center : interp;
+    for (int32_t k = 0; k < 3; k++) {
+        batch->covar[k][i] = reject ? 0.0 : covar[k];
+    }
+    batch->accepted[i] = !reject;
+}
+
+#ifdef CORR_SUBPIXEL_X86
+
+__attribute__((target("avx2")))
+static inline __m256d abs_pd(__m256d v)
+{
+    return _mm256_andnot_pd(_mm256_set1_pd(-0.0), v);
+}
+
+/* -v as in C, which unlike 0 - v turns +0 into -0 */
+__attribute__((target("avx2")))
+static inline __m256d neg_pd(__m256d v)
+{
+    return _mm256_xor_pd(_mm256_set1_pd(-0.0), v);
+}
+
+/* Writes four peaks from i. reject lanes are all ones for the peaks to reject */
+__attribute__((target("avx2")))
+static inline void store_peaks(CorrSubpixelBatch *batch, size_t i, __m256d reject, __m256d center,
+                               __m256d subr, __m256d subc, __m256d interp, const __m256d covar[3])
+{
+    const __m256d zero = _mm256_setzero_pd();
+    _mm256_storeu_pd(batch->sub_row + i, _mm256_blendv_pd(subr, zero, reject));
+    _mm256_storeu_pd(batch->sub_col + i, _mm256_blendv_pd(subc, zero, reject));
+    _mm256_storeu_pd(batch->val + i, _mm256_blendv_pd(interp, center, reject));
+    for (int32_t k = 0; k < 3; k++) {
+        _mm256_storeu_pd(batch->covar[k] + i, _mm256_blendv_pd(covar[k], zero, reject));
+    }
+    int32_t rejected = _mm256_movemask_pd(reject);
+    for (int32_t lane = 0; lane < 4; lane++) {
+        batch->accepted[i + lane] = !((rejected >> lane) & 1);
+    }
+}
+
+__attribute__((target("avx2")))
+static size_t refine_avx2(CorrSubpixelModel model, CorrSubpixelBatch *batch)
+{
+    if (model == CORR_SUBPIXEL_GAUSSIAN) return 0;
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d min_det = _mm256_set1_pd(CORR_SUBPIXEL_MIN_DET);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d two = _mm256_set1_pd(2.0);
+    size_t i = 0;
+    for (; i + 4 <= batch->count; i += 4) {
+        __m256d q[9];
+        for (int32_t k = 0; k < 9; k++) {
+            q[k] = _mm256_loadu_pd(batch->scores[k] + i);
+        }
+        __m256d center = q[4];
+        __m256d reject = _mm256_setzero_pd();
+        for (int32_t k = 0; k < 9; k++) {
+            if (k != 4) reject = _mm256_or_pd(reject, _mm256_cmp_pd(q[k], center, _CMP_GE_OQ));
+        }
+
+        __m256d subr, subc, interp, covar[3];
+        if (model == CORR_SUBPIXEL_QUADRATIC) {
+            __m256d A[6];
+            for (int32_t r = 0; r < 6; r++) {
+                A[r] = _mm256_setzero_pd();
+                for (int32_t c = 0; c < 9; c++) {
+                    A[r] = _mm256_add_pd(A[r], _mm256_mul_pd(_mm256_set1_pd(corr_subpixel_fitmat[r][c]), q[c]));
+                }
+            }
+            const __m256d minus_two = _mm256_set1_pd(-2.0);
+            __m256d denom = _mm256_sub_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(4.0), A[0]), A[1]),
+                                          _mm256_mul_pd(A[2], A[2]));
+            reject = _mm256_or_pd(reject, _mm256_cmp_pd(abs_pd(denom), min_det, _CMP_LT_OQ));
+            covar[0] = _mm256_div_pd(_mm256_mul_pd(minus_two, A[1]), denom);
+            covar[1] = _mm256_div_pd(A[2], denom);
+            covar[2] = _mm256_div_pd(_mm256_mul_pd(minus_two, A[0]), denom);
+            subc = _mm256_div_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(minus_two, A[1]), A[3]),
+                                               _mm256_mul_pd(A[2], A[4])), denom);
+            subr = _mm256_div_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(minus_two, A[0]), A[4]),
+                                               _mm256_mul_pd(A[2], A[3])), denom);
+            interp = _mm256_mul_pd(_mm256_mul_pd(A[0], subc), subc);
+            interp = _mm256_add_pd(interp, _mm256_mul_pd(_mm256_mul_pd(A[1], subr), subr));
+            interp = _mm256_add_pd(interp, _mm256_mul_pd(_mm256_mul_pd(A[2], subc), subr));
+            interp = _mm256_add_pd(interp, _mm256_mul_pd(A[3], subc));
+            interp = _mm256_add_pd(interp, _mm256_mul_pd(A[4], subr));
+            interp = _mm256_add_pd(interp, A[5]);
+        } else {
+            __m256d gc = _mm256_mul_pd(half, _mm256_sub_pd(q[5], q[3]));
+            __m256d gr = _mm256_mul_pd(half, _mm256_sub_pd(q[7], q[1]));
+            __m256d hc = _mm256_add_pd(_mm256_sub_pd(q[3], _mm256_mul_pd(two, q[4])), q[5]);
+            __m256d hr = _mm256_add_pd(_mm256_sub_pd(q[1], _mm256_mul_pd(two, q[4])), q[7]);
+            if (model == CORR_SUBPIXEL_TAYLOR) {
+                __m256d hx = _mm256_mul_pd(_mm256_set1_pd(0.25), _mm256_sub_pd(_mm256_sub_pd(q[8], q[6]),
+                                                                               _mm256_sub_pd(q[2], q[0])));
+                __m256d det = _mm256_sub_pd(_mm256_mul_pd(hc, hr), _mm256_mul_pd(hx, hx));
+                reject = _mm256_or_pd(reject, _mm256_cmp_pd(abs_pd(det), min_det, _CMP_LT_OQ));
+                subc = _mm256_div_pd(neg_pd(_mm256_sub_pd(_mm256_mul_pd(hr, gc), _mm256_mul_pd(hx, gr))), det);
+                subr = _mm256_div_pd(neg_pd(_mm256_sub_pd(_mm256_mul_pd(hc, gr), _mm256_mul_pd(hx, gc))), det);
+                covar[0] = _mm256_div_pd(neg_pd(hr), det);
+                covar[1] = _mm256_div_pd(hx, det);
+                covar[2] = _mm256_div_pd(neg_pd(hc), det);
+            } else {
+                reject = _mm256_or_pd(reject, _mm256_cmp_pd(abs_pd(_mm256_mul_pd(hc, hr)), min_det, _CMP_LT_OQ));
+                subc = _mm256_div_pd(neg_pd(gc), hc);
+                subr = _mm256_div_pd(neg_pd(gr), hr);
+                covar[0] = _mm256_div_pd(_mm256_set1_pd(-1.0), hc);
+                covar[1] = _mm256_setzero_pd();
+                covar[2] = _mm256_div_pd(_mm256_set1_pd(-1.0), hr);
+            }
+            interp = _mm256_add_pd(q[4], _mm256_mul_pd(half, _mm256_add_pd(_mm256_mul_pd(gc, subc),
+                                                                            _mm256_mul_pd(gr, subr))));
+        }
+        reject = _mm256_or_pd(reject, _mm256_cmp_pd(abs_pd(subc), one, _CMP_GE_OQ));
+        reject = _mm256_or_pd(reject, _mm256_cmp_pd(abs_pd(subr), one, _CMP_GE_OQ));
+        store_peaks(batch, i, reject, center, subr, subc, interp, covar);
+    }
+    return i;
+}
+
+#endif // CORR_SUBPIXEL_X86
+
+void corr_subpixel_refine(CorrSubpixelModel model, CorrSubpixelBatch *batch)
+{
+    size_t done = 0;
+#ifdef CORR_SUBPIXEL_X86
+    if (__builtin_cpu_supports("avx2")) done = refine_avx2(model, batch);
+#endif
+    for (size_t i = done; i < batch->count; i++) {
+        refine_peak(model, batch, i);
+    }
+}
+
+const char *corr_subpixel_kernel_name(void)
+{
+#ifdef CORR_SUBPIXEL_X86
+    if (__builtin_cpu_supports("avx2")) return "avx2";
+#endif
+    return "scalar";
+}
+
+const char *corr_subpixel_model_name(int32_t model)
+{
+    switch (model) {
+        case CORR_SUBPIXEL_QUADRATIC: return "quadratic";
+        case CORR_SUBPIXEL_PARABOLIC: return "parabolic";
+        case CORR_SUBPIXEL_GAUSSIAN:  return "gaussian";
+        case CORR_SUBPIXEL_TAYLOR:    return "taylor";
+        default:                      return NULL;
+    }
+}
@@ -0,0 +1,125 @@
+/**
+ * \file corr_subpixel.h
+ * \brief Subpixel refinement of many correlation peaks at once
+ *
+ * The 3x3 neighborhoods of the scores around the best offsets of many searches are gathered into columns, one per
+ * neighbor, and the fit, covariance and acceptance tests of every peak run as one loop over the columns. On x86-64
+ * CPUs with AVX2 the loop refines four peaks per step, chosen at run time as `corr_select_dot` is, except for
+ * `CORR_SUBPIXEL_GAUSSIAN` which needs logarithms. The vector and scalar loops give the same results, and
+ * `CORR_SUBPIXEL_QUADRATIC` gives exactly the offsets, score and covariance of `subpixel_long`.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_CORR_SUBPIXEL_H_
+#define _LANDMARK_TOOLS_CORR_SUBPIXEL_H_
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for int32_t, uint8_t
+
+/** \brief Smallest determinant of the curvature of a peak that is not rejected as ill conditioned */
+#define CORR_SUBPIXEL_MIN_DET 1.0e-6
+
+/**
+ * \brief Model fitted to the 3x3 scores around a peak
+ *
+ * Every model rejects a peak that is not strictly above its eight neighbors, whose curvature is ill conditioned, or
+ * whose offset is not within +/- 1 pixel. The covariance is the inverse of the negated curvature of the model.
+ */
+typedef enum {
+    CORR_SUBPIXEL_QUADRATIC = 0,  /**< Least squares biquadratic over the nine scores, as `subpixel_long` */
+    CORR_SUBPIXEL_PARABOLIC,      /**< Parabola through the center row and one through the center column */
+    CORR_SUBPIXEL_GAUSSIAN,       /**< Parabolas through the logarithm of the scores. Rejects peaks with scores <= 0 */
+    CORR_SUBPIXEL_TAYLOR,         /**< Newton step of the gradient and Hessian from central differences */
+    CORR_SUBPIXEL_NUM_MODELS
+} CorrSubpixelModel;
+
+/**
+ * \brief Peaks to refine and their refinements, one column per attribute held in a single block
+ *
+ * Zero-initialize, then size with `corr_subpixel_batch_reserve`. Must not be shared between threads.
+ */
+typedef struct {
+    size_t count;          /**< Peaks in the batch */
+    size_t capacity;       /**< Peaks the columns hold */
+    void *arena;           /**< Block holding the columns below */
+    double *scores[9];     /**< Score of each neighbor, in row order, the peak itself is `scores[4]` */
+    double *sub_row;       /**< Row offset of each refined peak from its offset of best score */
+    double *sub_col;       /**< Column offset of each refined peak from its offset of best score */
+    double *val;           /**< Score of the model at each refined peak */
+    double *covar[3];      /**< Covariance of each refined peak, in the order of `CorrResult.covar` */
+    uint8_t *accepted;     /**< Nonzero for the peaks that passed every test of their model */
+} CorrSubpixelBatch;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** \brief Least squares fit of a biquadratic a x^2 + b y^2 + c x y + d x + e y + f to 3x3 scores in row order */
+extern const double corr_subpixel_fitmat[6][9];
+
+/**
+ \brief Grow the columns of a batch to hold `capacity` peaks
+
+ \param[in,out] batch Batch. Release with `corr_subpixel_batch_free`
+ \param[in] capacity Peaks the columns must hold
+ \return false if memory allocation fails, the batch is left unchanged
+*/
+bool corr_subpixel_batch_reserve(CorrSubpixelBatch *batch, size_t capacity);
+
+/**
+ \brief Release the memory of a CorrSubpixelBatch
+*/
+void corr_subpixel_batch_free(CorrSubpixelBatch *batch);
+
+/**
+ \brief Add the 3x3 scores around the best offset of a search to a batch with room for it
+
+ \param[in,out] batch Batch with `count < capacity`
+ \param[in] cbuff scores of the search, `rows` x `cols` offsets by row
+ \param[in] rows rows of offsets
+ \param[in] cols columns of offsets
+ \param[in] bestr row of the best offset
+ \param[in] bestc column of the best offset
+ \return false if the best offset is on the border of the scores, the peak is not added then
+*/
+bool corr_subpixel_gather(CorrSubpixelBatch *batch, const double *cbuff, size_t rows, size_t cols,
+                          size_t bestr, size_t bestc);
+
+/**
+ \brief Refine every peak of a batch
+
+ Rejected peaks have zero offsets and covariance and the score of their center.
+ \param[in] model Model fitted to every peak
+ \param[in,out] batch Peaks. Their offsets, scores, covariances and acceptances are written
+*/
+void corr_subpixel_refine(CorrSubpixelModel model, CorrSubpixelBatch *batch);
+
+/**
+ \brief Name of the kernel used by `corr_subpixel_refine`, for logging
+*/
+const char *corr_subpixel_kernel_name(void);
+
+/**
+ \brief Name of a model in parameter files and logs, or NULL if `model` is not one
+*/
+const char *corr_subpixel_model_name(int32_t model);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_CORR_SUBPIXEL_H_ */
@@ -22,16 +22,20 @@
  */
 
 #include <math.h> // for NAN
+#include <stdio.h>   // for fopen, fprintf
 #include <stdlib.h>  // for malloc, free
 #include <stdbool.h> // for bool, false
+#include <string.h>  // for memset
 #include "landmark_tools/feature_tracking/correlation_results.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/safe_string.h"
 
 bool allocate_correlation_results(CorrelationResults* corr_struct, size_t num_pixels) {
     // Allocate memory for each array
-    corr_struct->delta_x = (float*)malloc(sizeof(float) * num_pixels);
-    corr_struct->delta_y = (float*)malloc(sizeof(float) * num_pixels);
-    corr_struct->delta_z = (float*)malloc(sizeof(float) * num_pixels);
-    corr_struct->correlation = (float*)malloc(sizeof(float) * num_pixels);
+    corr_struct->delta_x = (float*)mem_malloc(MEM_CORRELATION, sizeof(float) * num_pixels);
+    corr_struct->delta_y = (float*)mem_malloc(MEM_CORRELATION, sizeof(float) * num_pixels);
+    corr_struct->delta_z = (float*)mem_malloc(MEM_CORRELATION, sizeof(float) * num_pixels);
+    corr_struct->correlation = (float*)mem_malloc(MEM_CORRELATION, sizeof(float) * num_pixels);
     
     // Check if any allocation failed
     if (corr_struct->delta_x == NULL || corr_struct->delta_y == NULL ||
@@ -53,19 +57,108 @@ bool allocate_correlation_results(CorrelationResults* corr_struct, size_t num_pi
 
 void destroy_correlation_results(CorrelationResults* corr_struct) {
     if (corr_struct->delta_x != NULL) {
-        free(corr_struct->delta_x);
+        mem_free(corr_struct->delta_x);
         corr_struct->delta_x = NULL;
     }
     if (corr_struct->delta_y != NULL) {
-        free(corr_struct->delta_y);
+        mem_free(corr_struct->delta_y);
         corr_struct->delta_y = NULL;
     }
     if (corr_struct->delta_z != NULL) {
-        free(corr_struct->delta_z);
+        mem_free(corr_struct->delta_z);
         corr_struct->delta_z = NULL;
     }
     if (corr_struct->correlation != NULL) {
-        free(corr_struct->correlation);
+        mem_free(corr_struct->correlation);
         corr_struct->correlation = NULL;
     }
 } 
+
+/**
+ * \brief Resize every array of a list of matches, keeping the entries
+ */
+static bool resize_sparse_matches(SparseMatches* matches, size_t capacity) {
+    void** arrays[9] = {(void**)&matches->child_col, (void**)&matches->child_row,
+                        (void**)&matches->base_col, (void**)&matches->base_row,
+                        (void**)&matches->delta_x, (void**)&matches->delta_y, (void**)&matches->delta_z,
+                        (void**)&matches->correlation, (void**)&matches->block};
+    size_t sizes[9] = {sizeof(int32_t), sizeof(int32_t), sizeof(double), sizeof(double), sizeof(double),
+                       sizeof(double), sizeof(double), sizeof(double), sizeof(int32_t)};
+    for (int32_t i = 0; i < 9; ++i) {
+        void* grown = realloc(*arrays[i], sizes[i] * capacity);
+        if (grown == NULL) {
+            return false;
+        }
+        *arrays[i] = grown;
+    }
+    matches->capacity = capacity;
+    return true;
+}
+
+bool allocate_sparse_matches(SparseMatches* matches, size_t capacity) {
+    memset(matches, 0, sizeof(SparseMatches));
+    if (capacity < 1) {
+        capacity = 1;
+    }
+    if (!resize_sparse_matches(matches, capacity)) {
+        destroy_sparse_matches(matches);
+        return false;
+    }
+    return true;
+}
+
+bool sparse_matches_append(SparseMatches* matches, int32_t child_col, int32_t child_row,
+                           double base_col, double base_row, const double delta[3],
+                           double correlation, int32_t block) {
+    if (matches->count == matches->capacity && !resize_sparse_matches(matches, matches->capacity * 2)) {
+        printf("sparse_matches_append() ==>> memory allocation error\n");
+        return false;
+    }
+    size_t i = matches->count++;
+    matches->child_col[i] = child_col;
+    matches->child_row[i] = child_row;
+    matches->base_col[i] = base_col;
+    matches->base_row[i] = base_row;
+    matches->delta_x[i] = delta[0];
+    matches->delta_y[i] = delta[1];
+    matches->delta_z[i] = delta[2];
+    matches->correlation[i] = correlation;
+    matches->block[i] = block;
+    return true;
+}
+
+void destroy_sparse_matches(SparseMatches* matches) {
+    free(matches->child_col);
+    free(matches->child_row);
+    free(matches->base_col);
+    free(matches->base_row);
+    free(matches->delta_x);
+    free(matches->delta_y);
+    free(matches->delta_z);
+    free(matches->correlation);
+    free(matches->block);
+    memset(matches, 0, sizeof(SparseMatches));
+}
+
+bool write_sparse_matches(const char* filename, const SparseMatches* matches) {
+    FILE* fp = fopen(filename, "w");
+    if (fp == NULL) {
+        SAFE_PRINTF(512, "write_sparse_matches() ==>> cannot open %s\n", filename);
+        return false;
+    }
+    fprintf(fp, "child_col,child_row,base_col,base_row,delta_x,delta_y,delta_z,correlation,block\n");
+    for (size_t i = 0; i < matches->count; ++i) {
+        fprintf(fp, "%d,%d,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%d\n",
+                matches->child_col[i], matches->child_row[i], matches->base_col[i], matches->base_row[i],
+                matches->delta_x[i], matches->delta_y[i], matches->delta_z[i], matches->correlation[i],
+                matches->block[i]);
+    }
+    bool success = !ferror(fp);
+    if (fclose(fp) != 0) {
+        success = false;
+    }
+    if (!success) {
+        SAFE_PRINTF(512, "write_sparse_matches() ==>> cannot write %s\n", filename);
+    }
+    return success;
+}
@@ -24,6 +24,7 @@
 #ifndef _LANDMARK_TOOLS_CORRELATION_RESULTS_H_
 #define _LANDMARK_TOOLS_CORRELATION_RESULTS_H_
 
+#include <stddef.h>  // for size_t
 #include <stdint.h>  // for int32_t
 #include <stdbool.h> // for bool
 
@@ -67,6 +68,70 @@ bool allocate_correlation_results(CorrelationResults* corr_struct, size_t num_pi
  */
 void destroy_correlation_results(CorrelationResults* corr_struct);
 
+/**
+ * \brief Inlier matches of a comparison, one entry per matched feature
+ * 
+ * Entry i of every array describes the same match. The values are kept at the
+ * precision of the matcher, so the dense maps built from the list are those of
+ * a dense comparison. Without the maps, the memory follows the number of
+ * sliding window points rather than the number of pixels.
+ */
+typedef struct {
+    size_t count;          /**< Number of matches */
+    size_t capacity;       /**< Allocated entries of each array */
+    int32_t* child_col;    /**< Column of the feature in the child landmark */
+    int32_t* child_row;    /**< Row of the feature in the child landmark */
+    double* base_col;      /**< Matched column in the base landmark */
+    double* base_row;      /**< Matched row in the base landmark */
+    double* delta_x;       /**< Delta in x direction (east) */
+    double* delta_y;       /**< Delta in y direction (north) */
+    double* delta_z;       /**< Delta in z direction (up) */
+    double* correlation;   /**< Correlation value of the match */
+    int32_t* block;        /**< Sliding window block of the feature, block row * blocks per row + block column */
+} SparseMatches;
+
+/**
+ * \brief Allocate an empty list of matches
+ * 
+ * \param[out] matches List to allocate. Release with `destroy_sparse_matches`
+ * \param[in] capacity Initial number of entries, the list grows as needed
+ * \return true if allocation successful, false otherwise
+ */
+bool allocate_sparse_matches(SparseMatches* matches, size_t capacity);
+
+/**
+ * \brief Append one match to the list
+ * 
+ * \param[in,out] matches List to append to
+ * \param[in] child_col Column of the feature in the child landmark
+ * \param[in] child_row Row of the feature in the child landmark
+ * \param[in] base_col Matched column in the base landmark
+ * \param[in] base_row Matched row in the base landmark
+ * \param[in] delta Delta x, y and z of the match
+ * \param[in] correlation Correlation value of the match
+ * \param[in] block Sliding window block of the feature
+ * \return false if the list cannot grow
+ */
+bool sparse_matches_append(SparseMatches* matches, int32_t child_col, int32_t child_row,
+                           double base_col, double base_row, const double delta[3],
+                           double correlation, int32_t block);
+
+/**
+ * \brief Free memory allocated for a list of matches
+ * 
+ * \param[in,out] matches List to free memory for
+ */
+void destroy_sparse_matches(SparseMatches* matches);
+
+/**
+ * \brief Write a list of matches as a comma separated text file with a header line
+ * 
+ * \param[in] filename Output file
+ * \param[in] matches List to write
+ * \return true if the file was written, false otherwise
+ */
+bool write_sparse_matches(const char* filename, const SparseMatches* matches);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,367 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>    // for fopen, fprintf, fscanf, rename, remove
+#include <stdlib.h>   // for malloc, calloc, free, qsort
+#include <string.h>   // for memset, memcpy
+
+#include "landmark_tools/feature_tracking/distributed_match.h"
+#include "landmark_tools/feature_tracking/correlation_results.h"
+#include "landmark_tools/feature_tracking/nan_mask.h"
+#include "landmark_tools/feature_tracking/results_raster.h"
+#include "landmark_tools/landmark_util/landmark.h"
+#include "landmark_tools/utils/safe_string.h"
+
+#define DISTRIBUTED_PLAN_MAGIC "LMKPLAN1"
+#define DISTRIBUTED_STRIP_ROWS 256   //rows of the child read at a time to count the pixels with data
+#define DISTRIBUTED_READ_COST 8      //a pixel without data costs 1/8 of one with data, for reading and masking it
+#define DISTRIBUTED_PATH_SIZE 1024
+
+static int64_t tile_cost(const DistributedTile *tile)
+{
+    int64_t pixels = (int64_t)tile->rect.width * tile->rect.height;
+    return tile->valid_pixels + (pixels - tile->valid_pixels) / DISTRIBUTED_READ_COST + 1;
+}
+
+/**
+ \brief Cost of a tile, sorted to give the tiles to the ranks
+*/
+typedef struct {
+    int64_t cost;
+    int32_t tile;
+} TileCost;
+
+/**
+ \brief Most costly first, then by index
+*/
+static int compare_tile_costs(const void *a, const void *b)
+{
+    const TileCost *i = (const TileCost *)a;
+    const TileCost *j = (const TileCost *)b;
+    if (i->cost != j->cost) return i->cost > j->cost ? -1 : 1;
+    return (i->tile > j->tile) - (i->tile < j->tile);
+}
+
+/**
+ \brief Count the pixels with data of each tile, reading the child in strips of rows
+*/
+static bool count_valid_pixels(const char *child_path, DistributedPlan *plan)
+{
+    int32_t tiles_x = (plan->num_cols + plan->tile_size - 1) / plan->tile_size;
+    for (int32_t top = 0; top < plan->num_rows; top += DISTRIBUTED_STRIP_ROWS) {
+        int32_t nrows = (top + DISTRIBUTED_STRIP_ROWS < plan->num_rows) ? DISTRIBUTED_STRIP_ROWS
+                                                                          : plan->num_rows - top;
+        LMK strip = {0};
+        if (!Read_LMK_Window(child_path, 0, top, plan->num_cols, nrows, &strip)) {
+            return false;
+        }
+        NanMask mask;
+        bool success = nan_mask_from_floats(&mask, strip.ele, strip.num_cols, strip.num_rows, true);
+        free_lmk(&strip);
+        if (!success) {
+            printf("Plan_Distributed_Match() ==>> malloc() failed\n");
+            return false;
+        }
+
+        // A strip can cross the rows of two tiles when the tile size is not a multiple of its height
+        for (int32_t row = top; row < top + nrows; ) {
+            int32_t tile_row = row / plan->tile_size;
+            int32_t end = (tile_row + 1) * plan->tile_size;
+            if (end > top + nrows) end = top + nrows;
+            for (int32_t tx = 0; tx < tiles_x; tx++) {
+                DistributedTile *tile = &plan->tiles[tile_row * tiles_x + tx];
+                int32_t height = end - row;
+                int64_t pixels = (int64_t)tile->rect.width * height;
+                tile->valid_pixels += pixels - nan_mask_count(&mask, tile->rect.left, row - top, tile->rect.width,
+                                                              height);
+            }
+            row = end;
+        }
+        nan_mask_free(&mask);
+    }
+    return true;
+}
+
+bool Plan_Distributed_Match(const Parameters *parameters, const char *child_path, int32_t tile_size,
+                            int32_t num_ranks, DistributedPlan *plan)
+{
+    memset(plan, 0, sizeof(DistributedPlan));
+    int32_t block_size = parameters->sliding.block_size;
+    if (block_size < 1 || tile_size < 1 || num_ranks < 1) {
+        SAFE_PRINTF(256, "Plan_Distributed_Match() ==>> invalid tile size %d, block size %d or %d ranks\n",
+                    tile_size, block_size, num_ranks);
+        return false;
+    }
+    LMK child_header = {0};
+    if (!Read_LMK_Header(child_path, &child_header)) {
+        return false;
+    }
+    plan->num_cols = child_header.num_cols;
+    plan->num_rows = child_header.num_rows;
+    plan->tile_size = ((tile_size + block_size - 1) / block_size) * block_size;
+    plan->num_ranks = num_ranks;
+    int32_t tiles_x = (plan->num_cols + plan->tile_size - 1) / plan->tile_size;
+    int32_t tiles_y = (plan->num_rows + plan->tile_size - 1) / plan->tile_size;
+    plan->num_tiles = tiles_x * tiles_y;
+    plan->tiles = (DistributedTile *)calloc(plan->num_tiles > 0 ? plan->num_tiles : 1, sizeof(DistributedTile));
+    TileCost *order = (TileCost *)malloc(sizeof(TileCost) * (plan->num_tiles > 0 ? plan->num_tiles : 1));
+    int64_t *loads = (int64_t *)calloc(num_ranks, sizeof(int64_t));
+    if (plan->tiles == NULL || order == NULL || loads == NULL) {
+        printf("Plan_Distributed_Match() ==>> malloc() failed\n");
+        free(order);
+        free(loads);
+        free_distributed_plan(plan);
+        return false;
+    }
+    for (int32_t t = 0; t < plan->num_tiles; t++) {
+        LandmarkRect *rect = &plan->tiles[t].rect;
+        rect->left = (t % tiles_x) * plan->tile_size;
+        rect->top = (t / tiles_x) * plan->tile_size;
+        rect->width = (plan->num_cols - rect->left < plan->tile_size) ? plan->num_cols - rect->left : plan->tile_size;
+        rect->height = (plan->num_rows - rect->top < plan->tile_size) ? plan->num_rows - rect->top : plan->tile_size;
+    }
+    if (!count_valid_pixels(child_path, plan)) {
+        free(order);
+        free(loads);
+        free_distributed_plan(plan);
+        return false;
+    }
+
+    // Largest cost first to the least loaded rank, the lowest rank on ties, so every process plans the same
+    for (int32_t t = 0; t < plan->num_tiles; t++) {
+        order[t].cost = tile_cost(&plan->tiles[t]);
+        order[t].tile = t;
+    }
+    qsort(order, plan->num_tiles, sizeof(TileCost), compare_tile_costs);
+    for (int32_t k = 0; k < plan->num_tiles; k++) {
+        int32_t rank = 0;
+        for (int32_t r = 1; r < num_ranks; r++) {
+            if (loads[r] < loads[rank]) rank = r;
+        }
+        plan->tiles[order[k].tile].rank = rank;
+        loads[rank] += order[k].cost;
+    }
+    free(order);
+    free(loads);
+    return true;
+}
+
+void free_distributed_plan(DistributedPlan *plan)
+{
+    free(plan->tiles);
+    memset(plan, 0, sizeof(DistributedPlan));
+}
+
+void distributed_plan_costs(const DistributedPlan *plan, int64_t *costs)
+{
+    memset(costs, 0, sizeof(int64_t) * plan->num_ranks);
+    for (int32_t t = 0; t < plan->num_tiles; t++) {
+        costs[plan->tiles[t].rank] += tile_cost(&plan->tiles[t]);
+    }
+}
+
+bool Write_Distributed_Plan(const char *filename, const DistributedPlan *plan)
+{
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+        SAFE_PRINTF(1024, "Write_Distributed_Plan() ==>> cannot open %s\n", filename);
+        return false;
+    }
+    fprintf(fp, "%s\n%d %d %d %d %d\n", DISTRIBUTED_PLAN_MAGIC, plan->num_cols, plan->num_rows, plan->tile_size,
+            plan->num_ranks, plan->num_tiles);
+    for (int32_t t = 0; t < plan->num_tiles; t++) {
+        const DistributedTile *tile = &plan->tiles[t];
+        fprintf(fp, "%d %d %d %d %lld %d\n", tile->rect.left, tile->rect.top, tile->rect.width, tile->rect.height,
+                (long long)tile->valid_pixels, tile->rank);
+    }
+    bool success = ferror(fp) == 0;
+    if (fclose(fp) != 0) success = false;
+    if (!success) {
+        SAFE_PRINTF(1024, "Write_Distributed_Plan() ==>> cannot write %s\n", filename);
+    }
+    return success;
+}
+
+bool Read_Distributed_Plan(const char *filename, DistributedPlan *plan)
+{
+    memset(plan, 0, sizeof(DistributedPlan));
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        SAFE_PRINTF(1024, "Read_Distributed_Plan() ==>> cannot open %s\n", filename);
+        return false;
+    }
+    char magic[16] = "";
+    bool success = fscanf(fp, "%15s", magic) == 1 && strcmp(magic, DISTRIBUTED_PLAN_MAGIC) == 0 &&
+                   fscanf(fp, "%d %d %d %d %d", &plan->num_cols, &plan->num_rows, &plan->tile_size,
+                          &plan->num_ranks, &plan->num_tiles) == 5 &&
+                   plan->num_tiles >= 0 && plan->num_ranks >= 1 && plan->tile_size >= 1;
+    if (success) {
+        plan->tiles = (DistributedTile *)calloc(plan->num_tiles > 0 ? plan->num_tiles : 1, sizeof(DistributedTile));
+        if (plan->tiles == NULL) {
+            printf("Read_Distributed_Plan() ==>> malloc() failed\n");
+            success = false;
+        }
+    }
+    for (int32_t t = 0; t < plan->num_tiles && success; t++) {
+        DistributedTile *tile = &plan->tiles[t];
+        long long valid_pixels;
+        success = fscanf(fp, "%d %d %d %d %lld %d", &tile->rect.left, &tile->rect.top, &tile->rect.width,
+                         &tile->rect.height, &valid_pixels, &tile->rank) == 6 &&
+                  tile->rank >= 0 && tile->rank < plan->num_ranks;
+        tile->valid_pixels = valid_pixels;
+    }
+    fclose(fp);
+    if (!success) {
+        SAFE_PRINTF(1024, "Read_Distributed_Plan() ==>> %s is not a plan\n", filename);
+        free_distributed_plan(plan);
+    }
+    return success;
+}
+
+void distributed_tile_filename(char *buf, size_t buf_size, const char *work_dir, int32_t tile)
+{
+    snprintf(buf, buf_size, "%s/tile_%06d.lmkr", work_dir, tile);
+}
+
+static bool file_exists(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) return false;
+    fclose(fp);
+    return true;
+}
+
+bool Run_Distributed_Match_Rank(Parameters parameters, const char *base_path, const char *child_path,
+                                const DistributedPlan *plan, int32_t rank, int32_t max_nan_count_base,
+                                int32_t max_nan_count_child, const char *work_dir)
+{
+    if (rank < 0 || rank >= plan->num_ranks) {
+        SAFE_PRINTF(256, "Run_Distributed_Match_Rank() ==>> rank %d of a plan of %d ranks\n", rank,
+                    plan->num_ranks);
+        return false;
+    }
+    LMK child_header = {0};
+    if (!Read_LMK_Header(child_path, &child_header)) {
+        return false;
+    }
+    if (child_header.num_cols != plan->num_cols || child_header.num_rows != plan->num_rows) {
+        SAFE_PRINTF(1024, "Run_Distributed_Match_Rank() ==>> %s is %d x %d pixels, the plan is for %d x %d\n",
+                    child_path, child_header.num_cols, child_header.num_rows, plan->num_cols, plan->num_rows);
+        return false;
+    }
+
+    char path[DISTRIBUTED_PATH_SIZE];
+    char partial[DISTRIBUTED_PATH_SIZE + 8];
+    for (int32_t t = 0; t < plan->num_tiles; t++) {
+        const DistributedTile *tile = &plan->tiles[t];
+        if (tile->rank != rank) continue;
+        distributed_tile_filename(path, sizeof(path), work_dir, t);
+        if (file_exists(path)) {
+            SAFE_PRINTF(1024, "Tile %d is already in %s\n", t, path);
+            continue;
+        }
+        SAFE_PRINTF(256, "Rank %d matching tile %d, columns %d to %d, rows %d to %d\n", rank, t, tile->rect.left,
+                    tile->rect.left + tile->rect.width, tile->rect.top, tile->rect.top + tile->rect.height);
+
+        CorrelationResults results;
+        if (!MatchLandmarkFileRect(parameters, base_path, child_path, &tile->rect, max_nan_count_base,
+                                   max_nan_count_child, &results)) {
+            return false;
+        }
+        snprintf(partial, sizeof(partial), "%s.part", path);
+        bool success = Write_Correlation_Results_Raster(partial, &results, tile->rect.width, tile->rect.height,
+                                                        LMK_DEFAULT_TILE_SIZE, LMK_COMPRESSION_DEFLATE);
+        destroy_correlation_results(&results);
+        if (success && rename(partial, path) != 0) {
+            SAFE_PRINTF(2048, "Run_Distributed_Match_Rank() ==>> cannot rename %s to %s\n", partial, path);
+            success = false;
+        }
+        if (!success) {
+            remove(partial);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Gather_Distributed_Match(const DistributedPlan *plan, const char *work_dir, const char *output_path)
+{
+    // Every tile must be there before the output is started
+    char path[DISTRIBUTED_PATH_SIZE];
+    int32_t missing = 0;
+    for (int32_t t = 0; t < plan->num_tiles; t++) {
+        distributed_tile_filename(path, sizeof(path), work_dir, t);
+        if (!file_exists(path)) {
+            SAFE_PRINTF(1024, "Gather_Distributed_Match() ==>> tile %d of rank %d is missing, %s\n", t,
+                        plan->tiles[t].rank, path);
+            missing++;
+        }
+    }
+    if (missing > 0) return false;
+
+    Results_Raster_Writer *writer = Open_Results_Raster_Writer(output_path, plan->num_cols, plan->num_rows,
+                                                               RESULTS_RASTER_NUM_CORRELATION_BANDS,
+                                                               correlation_results_band_names,
+                                                               LMK_DEFAULT_TILE_SIZE, LMK_COMPRESSION_DEFLATE);
+    if (writer == NULL) {
+        return false;
+    }
+    size_t row_pixels = (size_t)plan->tile_size * plan->num_cols;
+    size_t row_floats = RESULTS_RASTER_NUM_CORRELATION_BANDS * (row_pixels > 0 ? row_pixels : 1);
+    float *rows = (float *)malloc(sizeof(float) * row_floats);
+    bool success = rows != NULL;
+    if (!success) {
+        printf("Gather_Distributed_Match() ==>> malloc() failed\n");
+    }
+
+    // The tiles of a row share their top and height, and follow each other from the left
+    for (int32_t first = 0; first < plan->num_tiles && success; ) {
+        int32_t top = plan->tiles[first].rect.top;
+        int32_t height = plan->tiles[first].rect.height;
+        float *bands[RESULTS_RASTER_NUM_CORRELATION_BANDS];
+        for (int32_t b = 0; b < RESULTS_RASTER_NUM_CORRELATION_BANDS; b++) bands[b] = rows + b * row_pixels;
+        int32_t t = first;
+        for (; t < plan->num_tiles && plan->tiles[t].rect.top == top && success; t++) {
+            const LandmarkRect *rect = &plan->tiles[t].rect;
+            CorrelationResults tile;
+            if (!allocate_correlation_results(&tile, (size_t)rect->width * rect->height)) {
+                success = false;
+                break;
+            }
+            distributed_tile_filename(path, sizeof(path), work_dir, t);
+            success = Read_Correlation_Results_Raster(path, &tile, rect->width, rect->height);
+            float *maps[RESULTS_RASTER_NUM_CORRELATION_BANDS] = {tile.delta_x, tile.delta_y, tile.delta_z,
+                                                                  tile.correlation};
+            for (int32_t b = 0; b < RESULTS_RASTER_NUM_CORRELATION_BANDS && success; b++) {
+                for (int32_t row = 0; row < rect->height; row++) {
+                    memcpy(&bands[b][(size_t)row * plan->num_cols + rect->left], &maps[b][(size_t)row * rect->width],
+                           sizeof(float) * rect->width);
+                }
+            }
+            destroy_correlation_results(&tile);
+        }
+        const float *const_bands[RESULTS_RASTER_NUM_CORRELATION_BANDS];
+        for (int32_t b = 0; b < RESULTS_RASTER_NUM_CORRELATION_BANDS; b++) const_bands[b] = bands[b];
+        success = success && Append_Results_Raster_Rows(writer, const_bands, height);
+        first = t;
+    }
+    free(rows);
+    success = Close_Results_Raster_Writer(writer) && success;
+    if (!success) {
+        SAFE_PRINTF(1024, "Gather_Distributed_Match() ==>> cannot write %s\n", output_path);
+    }
+    return success;
+}
@@ -0,0 +1,152 @@
+/**
+ * \file distributed_match.h
+ * \brief Landmark comparison split in tiles run by many processes over a shared filesystem
+ *
+ * Maps too large for one node are compared in three stages that share a work directory:
+ * - the plan splits the child landmark in tiles and gives each tile to a rank, balancing the ranks by the pixels
+ *   with data of their tiles, which the no-data masks of the child count
+ * - each rank compares its tiles with `MatchLandmarkFileRect`, reading only the windows of the landmarks that the
+ *   tile depends on, and writes each tile as a results raster. Tiles already written are skipped, so a rank that
+ *   failed can be run again
+ * - the gather stitches the tiles, row of tiles by row of tiles, into one results raster of the whole comparison
+ *
+ * The ranks do not communicate: they can be started by an MPI launcher, a batch scheduler or by hand, on any nodes
+ * that see the work directory, once the plan is written.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_DISTRIBUTED_MATCH_H_
+#define _LANDMARK_TOOLS_DISTRIBUTED_MATCH_H_
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for int32_t, int64_t
+
+#include "landmark_tools/feature_tracking/band_match.h"  // for LandmarkRect
+#include "landmark_tools/feature_tracking/parameters.h"  // for Parameters
+
+#define DISTRIBUTED_PLAN_FILENAME "plan.txt"   /*!< \brief Plan in the work directory */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Tile of the child landmark given to one rank
+ */
+typedef struct {
+    LandmarkRect rect;           /*!< \brief Pixels of the child landmark */
+    int64_t valid_pixels;        /*!< \brief Pixels of the tile with an elevation */
+    int32_t rank;                /*!< \brief Rank comparing the tile */
+} DistributedTile;
+
+/**
+ * \brief Tiles of a comparison and their ranks
+ */
+typedef struct {
+    int32_t num_cols;            /*!< \brief Width of the child landmark */
+    int32_t num_rows;            /*!< \brief Height of the child landmark */
+    int32_t tile_size;           /*!< \brief Width and height of the tiles, the last column and row may be smaller */
+    int32_t num_ranks;           /*!< \brief Ranks sharing the tiles */
+    int32_t num_tiles;           /*!< \brief Number of tiles, in row major order */
+    DistributedTile *tiles;      /*!< \brief Tiles */
+} DistributedPlan;
+
+/**
+ * \brief Split a child landmark in tiles and balance them across ranks
+ *
+ * The child is read in strips of rows to count the pixels with data of each tile. Each tile costs its pixels with
+ * data, plus a fraction of its other pixels for reading them, and the tiles are given from the most costly to the
+ * rank with the least cost so far.
+ *
+ * \param[in] parameters configuration settings, the tile size is rounded up to a multiple of `block_size`
+ * \param[in] child_path Child landmark file
+ * \param[in] tile_size Width and height of the tiles in pixels
+ * \param[in] num_ranks Number of ranks
+ * \param[out] plan Plan. Release with `free_distributed_plan`
+ * \return false if the file cannot be read, the arguments are invalid or memory allocation fails
+ */
+bool Plan_Distributed_Match(const Parameters *parameters, const char *child_path, int32_t tile_size,
+                            int32_t num_ranks, DistributedPlan *plan);
+
+/**
+ * \brief Release the tiles of a plan
+ */
+void free_distributed_plan(DistributedPlan *plan);
+
+/**
+ * \brief Sum of the costs of the tiles of each rank, as balanced by `Plan_Distributed_Match`
+ *
+ * \param[in] plan Plan
+ * \param[out] costs num_ranks costs
+ */
+void distributed_plan_costs(const DistributedPlan *plan, int64_t *costs);
+
+/**
+ * \brief Write a plan as text
+ * \return false on io error
+ */
+bool Write_Distributed_Plan(const char *filename, const DistributedPlan *plan);
+
+/**
+ * \brief Read a plan written by `Write_Distributed_Plan`
+ * \param[out] plan Plan. Release with `free_distributed_plan`
+ * \return false on io error, if the file is not a plan or memory allocation fails
+ */
+bool Read_Distributed_Plan(const char *filename, DistributedPlan *plan);
+
+/**
+ * \brief Filename of the results raster of one tile in the work directory
+ */
+void distributed_tile_filename(char *buf, size_t buf_size, const char *work_dir, int32_t tile);
+
+/**
+ * \brief Compare the tiles of one rank and write each to the work directory
+ *
+ * A tile is written under a temporary name and renamed when complete, so the tiles found in the work directory are
+ * whole. Tiles already there are not compared again.
+ *
+ * \param[in] parameters configuration settings, the same as for the plan
+ * \param[in] base_path Base landmark file
+ * \param[in] child_path Child landmark file
+ * \param[in] plan Plan of the comparison
+ * \param[in] rank Rank of this process, below `plan->num_ranks`
+ * \param[in] max_nan_count_base Maximum allowed NaN values in base landmark window
+ * \param[in] max_nan_count_child Maximum allowed NaN values in child landmark window
+ * \param[in] work_dir Directory shared by the ranks
+ * \return false if a file cannot be read or written, the child does not match the plan, or matching fails
+ */
+bool Run_Distributed_Match_Rank(Parameters parameters, const char *base_path, const char *child_path,
+                                const DistributedPlan *plan, int32_t rank, int32_t max_nan_count_base,
+                                int32_t max_nan_count_child, const char *work_dir);
+
+/**
+ * \brief Stitch the tiles of every rank into one results raster of the child landmark
+ *
+ * One row of tiles is held at a time, and written as soon as its tiles are read.
+ *
+ * \param[in] plan Plan of the comparison
+ * \param[in] work_dir Directory shared by the ranks
+ * \param[in] output_path Results raster of the whole comparison
+ * \return false if a tile is missing or cannot be read, the output cannot be written or memory allocation fails
+ */
+bool Gather_Distributed_Match(const DistributedPlan *plan, const char *work_dir, const char *output_path);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_DISTRIBUTED_MATCH_H_ */
@@ -18,18 +18,25 @@
 #include <stdlib.h>
 #include <math.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/parallel.h"
+#include "landmark_tools/utils/perf_stats.h"
 #include "landmark_tools/utils/safe_string.h"
 
 #include "landmark_tools/data_interpolation/interpolate_data.h"
 #include "landmark_tools/feature_tracking/corr_image_long.h"
 #include "landmark_tools/feature_tracking/feature_match.h"
+#include "landmark_tools/feature_tracking/match_journal.h"
 #include "landmark_tools/feature_tracking/parameters.h"
+#include "landmark_tools/feature_tracking/splat.h"
 #include "landmark_tools/math/homography_util.h"
 #include "landmark_tools/landmark_util/landmark.h"
 #include "landmark_tools/landmark_util/estimate_homography.h"
 
 #include "img/utils/imgutils.h"
 #include "math/mat3/mat3.h"
+#include "math/mat3/mat3_inline.h"
 
 int32_t MatchFeaturesOnly(
     Parameters parameters,
@@ -154,6 +161,157 @@ static int32_t count_nan_in_search_window(
     return nan_count;
 }
 
+/**
+ * \brief Average factor x factor blocks of an image window
+ *
+ * \param[in] image Source image
+ * \param[in] stride Bytes between rows of image
+ * \param[in] left Left column of the window
+ * \param[in] top Top row of the window
+ * \param[in] cols Window width
+ * \param[in] rows Window height
+ * \param[in] factor Downsampling factor
+ * \param[out] coarse (cols/factor) x (rows/factor) image
+ */
+static void downsample_window(
+    const uint8_t *image,
+    size_t stride,
+    size_t left,
+    size_t top,
+    size_t cols,
+    size_t rows,
+    size_t factor,
+    uint8_t *coarse
+) {
+    size_t coarse_cols = cols / factor;
+    size_t coarse_rows = rows / factor;
+    size_t area = factor * factor;
+    for(size_t r = 0; r < coarse_rows; ++r) {
+        for(size_t c = 0; c < coarse_cols; ++c) {
+            const uint8_t *src = image + (top + r * factor) * stride + left + c * factor;
+            uint32_t sum = 0;
+            for(size_t i = 0; i < factor; ++i, src += stride) {
+                for(size_t j = 0; j < factor; ++j) {
+                    sum += src[j];
+                }
+            }
+            coarse[r * coarse_cols + c] = (uint8_t)((sum + area / 2) / area);
+        }
+    }
+}
+
+/**
+ * \brief Coarse-to-fine version of corimg_long_batch
+ *
+ * Each task is correlated on 2^levels downsampled images. The best PYRAMID_NUM_PEAKS coarse peaks are refined
+ * at full resolution in windows of the template size plus a margin of one coarse pixel, and the best refined match wins.
+ *
+ * \param[in] tasks Full resolution correlation tasks
+ * \param[in] num_tasks Number of tasks
+ * \param[in] levels Number of pyramid levels
+ * \param[in] num_threads Threads of the full resolution batch, see `corimg_long_batch_threads`
+ * \param[out] results One result per task
+ * \return false if memory allocation fails
+ */
+static bool pyramid_match_batch(
+    const CorrTask *tasks,
+    int32_t num_tasks,
+    int32_t levels,
+    int32_t num_threads,
+    CorrResult *results
+) {
+    size_t max_template = 0, max_search = 0;
+    for(int32_t i = 0; i < num_tasks; ++i) {
+        if(tasks[i].cols2 < tasks[i].cols1 || tasks[i].rows2 < tasks[i].rows1) continue;
+        if(tasks[i].cols1 * tasks[i].rows1 > max_template) max_template = tasks[i].cols1 * tasks[i].rows1;
+        if(tasks[i].cols2 * tasks[i].rows2 > max_search) max_search = tasks[i].cols2 * tasks[i].rows2;
+    }
+    uint8_t *coarse_template = (uint8_t *)malloc(max_template > 0 ? max_template : 1);
+    uint8_t *coarse_search = (uint8_t *)malloc(max_search > 0 ? max_search : 1);
+    CorrTask *refine_tasks = (CorrTask *)malloc(sizeof(CorrTask) * num_tasks * PYRAMID_NUM_PEAKS);
+    CorrResult *refine_results = (CorrResult *)malloc(sizeof(CorrResult) * num_tasks * PYRAMID_NUM_PEAKS);
+    int32_t *refine_owner = (int32_t *)malloc(sizeof(int32_t) * num_tasks * PYRAMID_NUM_PEAKS);
+    bool success = coarse_template != NULL && coarse_search != NULL && refine_tasks != NULL &&
+                   refine_results != NULL && refine_owner != NULL;
+    
+    // Find the coarse peaks of every task
+    int32_t num_refine = 0;
+    for(int32_t i = 0; i < num_tasks && success; ++i) {
+        const CorrTask *task = &tasks[i];
+        results[i].success = false;
+        
+        // A search window smaller than the template fails only this task
+        if(task->cols2 < task->cols1 || task->rows2 < task->rows1) continue;
+        
+        // Use fewer levels if the template or search window would become too small
+        int32_t task_levels = levels;
+        while(task_levels > 0 && ((task->cols1 >> task_levels) < PYRAMID_MIN_TEMPLATE_SIZE ||
+                                  (task->rows1 >> task_levels) < PYRAMID_MIN_TEMPLATE_SIZE)) {
+            task_levels--;
+        }
+        size_t factor = (size_t)1 << task_levels;
+        const uint8_t *search_image = (task->integral != NULL) ? task->integral->image : task->img2;
+        size_t search_stride = (task->integral != NULL) ? task->integral->stride : task->rowBytes2;
+        
+        CorrPeak peaks[PYRAMID_NUM_PEAKS];
+        int32_t num_peaks = 0;
+        if(factor > 1) {
+            downsample_window(task->img1, task->rowBytes1, task->left1, task->top1, task->cols1, task->rows1,
+                              factor, coarse_template);
+            downsample_window(search_image, search_stride, task->left2, task->top2, task->cols2, task->rows2,
+                              factor, coarse_search);
+            size_t template_cols = task->cols1 / factor, template_rows = task->rows1 / factor;
+            size_t search_cols = task->cols2 / factor, search_rows = task->rows2 / factor;
+            num_peaks = corimg_long_peaks(coarse_template, template_cols, 0, 0, template_cols, template_rows,
+                                          coarse_search, search_cols, 0, 0, search_cols, search_rows,
+                                          peaks, PYRAMID_NUM_PEAKS);
+        }
+        if(num_peaks == 0) {
+            // No usable coarse level, search the whole window at full resolution
+            refine_tasks[num_refine] = *task;
+            refine_owner[num_refine++] = i;
+            continue;
+        }
+        
+        for(int32_t k = 0; k < num_peaks; ++k) {
+            // Keep the refinement window inside the original search window
+            size_t margin = factor + 1;
+            size_t col = peaks[k].col * factor, row = peaks[k].row * factor;
+            size_t left = (col > margin) ? col - margin : 0;
+            size_t top = (row > margin) ? row - margin : 0;
+            size_t right = col + task->cols1 + margin;
+            size_t bottom = row + task->rows1 + margin;
+            if(right > task->cols2) right = task->cols2;
+            if(bottom > task->rows2) bottom = task->rows2;
+            
+            CorrTask *refine = &refine_tasks[num_refine];
+            *refine = *task;
+            refine->left2 = task->left2 + left;
+            refine->top2 = task->top2 + top;
+            refine->cols2 = right - left;
+            refine->rows2 = bottom - top;
+            refine_owner[num_refine++] = i;
+        }
+    }
+    
+    // Refine all peaks at full resolution and keep the best per task
+    success = success && (num_refine == 0 || corimg_long_batch_threads(NULL, refine_tasks, num_refine,
+                                                                            refine_results, num_threads));
+    for(int32_t k = 0; k < num_refine && success; ++k) {
+        CorrResult *best = &results[refine_owner[k]];
+        if(refine_results[k].success && (!best->success || refine_results[k].bestval > best->bestval)) {
+            *best = refine_results[k];
+        }
+    }
+    
+    free(coarse_template);
+    free(coarse_search);
+    free(refine_tasks);
+    free(refine_results);
+    free(refine_owner);
+    return success;
+}
+
 int32_t MatchFeaturesWithNaNHandling(
     Parameters parameters,
     uint8_t *template_image,
@@ -172,26 +330,214 @@ int32_t MatchFeaturesWithNaNHandling(
     double *correlation_values,
     int32_t num_points
 )
+{
+    return MatchFeaturesWithSearchIntegral(
+        parameters,
+        template_image,
+        template_mask,
+        template_cols,
+        template_rows,
+        max_nan_count_template,
+        search_image,
+        search_mask,
+        search_cols,
+        search_rows,
+        max_nan_count_search,
+        NULL,
+        initial_homography,
+        template_points,
+        matched_points,
+        correlation_values,
+        num_points
+    );
+}
+
+static int32_t block_num_points(const Parameters *parameters)
+{
+    int32_t per_side = (parameters->sliding.block_size / parameters->sliding.step_size) + 1;
+    return per_side * per_side;
+}
+
+/**
+ \brief Grow the per-point buffers of a context to hold num_points templates of template_pixels each
+*/
+static bool reserve_match_points(MatchContext *ctx, int32_t num_points, size_t template_pixels)
+{
+    if (num_points < 1) num_points = 1;
+    if (num_points <= ctx->capacity && template_pixels <= ctx->template_pixels) return true;
+    if (num_points < ctx->capacity) num_points = ctx->capacity;
+    if (template_pixels < ctx->template_pixels) template_pixels = ctx->template_pixels;
+    
+    free(ctx->template_buffer);
+    free(ctx->tasks);
+    free(ctx->results);
+    free(ctx->task_points);
+    free(ctx->task_subpixel);
+    ctx->template_buffer = (uint8_t *)malloc(sizeof(uint8_t) * template_pixels * num_points);
+    ctx->tasks = (CorrTask *)malloc(sizeof(CorrTask) * num_points);
+    ctx->results = (CorrResult *)malloc(sizeof(CorrResult) * num_points);
+    ctx->task_points = (int32_t *)malloc(sizeof(int32_t) * num_points);
+    ctx->task_subpixel = (double *)malloc(sizeof(double) * 2 * num_points);
+    if (ctx->template_buffer == NULL || ctx->tasks == NULL || ctx->results == NULL ||
+        ctx->task_points == NULL || ctx->task_subpixel == NULL) {
+        SAFE_PRINTF(256, "reserve_match_points() ==>> memory allocation error\n");
+        ctx->capacity = 0;
+        ctx->template_pixels = 0;
+        return false;
+    }
+    ctx->capacity = num_points;
+    ctx->template_pixels = template_pixels;
+    return true;
+}
+
+bool allocate_match_context(MatchContext *ctx, const Parameters *parameters, int32_t max_points)
+{
+    memset(ctx, 0, sizeof(MatchContext));
+    size_t template_size = (size_t)parameters->matching.correlation_window_size;
+    size_t search_size = (size_t)parameters->matching.search_window_size;
+    int32_t block_points = block_num_points(parameters);
+    if (max_points <= 0) max_points = block_points;
+    
+    bool success = corr_context_init(&ctx->corr, template_size, template_size, search_size, search_size);
+    success = success && reserve_match_points(ctx, max_points, template_size * template_size);
+    success = success && feature_set_reserve(&ctx->block, block_points);
+    if (!success) {
+        free_match_context(ctx);
+    }
+    return success;
+}
+
+void free_match_context(MatchContext *ctx)
+{
+    corr_context_free(&ctx->corr);
+    free(ctx->template_buffer);
+    free(ctx->tasks);
+    free(ctx->results);
+    free(ctx->task_points);
+    free(ctx->task_subpixel);
+    feature_set_free(&ctx->block);
+#ifdef WITH_CUDA
+    corr_cuda_free(ctx->device_search);
+#endif
+    memset(ctx, 0, sizeof(MatchContext));
+}
+
+int32_t MatchFeaturesWithSearchIntegral(
+    Parameters parameters,
+    uint8_t *template_image,
+    uint8_t *template_mask,
+    size_t template_cols,
+    size_t template_rows,
+    int32_t max_nan_count_template,
+    uint8_t *search_image,
+    uint8_t *search_mask,
+    size_t search_cols,
+    size_t search_rows,
+    int32_t max_nan_count_search,
+    const CorrIntegralImage *search_integral,
+    double initial_homography[3][3],
+    double *template_points,
+    double *matched_points,
+    double *correlation_values,
+    int32_t num_points
+)
+{
+    MatchContext ctx;
+    memset(&ctx, 0, sizeof(MatchContext));
+    int32_t num_matches = MatchFeaturesWithSearchIntegral_ctx(
+        &ctx,
+        parameters,
+        template_image,
+        template_mask,
+        template_cols,
+        template_rows,
+        max_nan_count_template,
+        search_image,
+        search_mask,
+        search_cols,
+        search_rows,
+        max_nan_count_search,
+        search_integral,
+        initial_homography,
+        template_points,
+        matched_points,
+        correlation_values,
+        num_points
+    );
+    free_match_context(&ctx);
+    return num_matches;
+}
+
+/**
+ * \brief Correlate a batch of tasks with the search method of the parameters
+ */
+static bool correlate_tasks(
+    MatchContext *ctx,
+    const Parameters *parameters,
+    const CorrTask *tasks,
+    int32_t num_tasks,
+    CorrResult *results
+) {
+    if(parameters->matching.pyramid_levels > 0) {
+        return pyramid_match_batch(tasks, num_tasks, parameters->matching.pyramid_levels, ctx->corr_threads, results);
+    }
+#ifdef WITH_CUDA
+    // Tasks that do not search the uploaded image fall back to the CPU
+    if(ctx->device_search != NULL && !parameters->matching.prune_search &&
+       corr_cuda_batch(ctx->device_search, tasks, num_tasks, results)) {
+        return true;
+    }
+#endif
+    return corimg_long_batch_threads(&ctx->corr, tasks, num_tasks, results, ctx->corr_threads);
+}
+
+int32_t MatchFeaturesWithSearchIntegral_ctx(
+    MatchContext *ctx,
+    Parameters parameters,
+    uint8_t *template_image,
+    uint8_t *template_mask,
+    size_t template_cols,
+    size_t template_rows,
+    int32_t max_nan_count_template,
+    uint8_t *search_image,
+    uint8_t *search_mask,
+    size_t search_cols,
+    size_t search_rows,
+    int32_t max_nan_count_search,
+    const CorrIntegralImage *search_integral,
+    double initial_homography[3][3],
+    double *template_points,
+    double *matched_points,
+    double *correlation_values,
+    int32_t num_points
+)
 {
     // Extract correlation parameters
     int32_t template_size = parameters.matching.correlation_window_size;
     int32_t search_win_size = parameters.matching.search_window_size;
     int32_t half_search_win = search_win_size / 2;
+    int32_t half_template = template_size / 2;
     
-    // Allocate memory for feature matching
-    uint8_t *template_buffer = (uint8_t *)malloc(sizeof(uint8_t) * template_size * template_size);
-    
-    if(template_buffer == NULL) {
+    // One template per point so that all correlations run as one batch
+    size_t template_pixels = (size_t)template_size * template_size;
+    if(!reserve_match_points(ctx, num_points, template_pixels)) {
         SAFE_PRINTF(256, "MatchFeaturesWithNaNHandling(): memory allocation error\n");
         return 0;
     }
+    uint8_t *template_buffer = ctx->template_buffer;
+    CorrTask *tasks = ctx->tasks;
+    CorrResult *results = ctx->results;
+    int32_t *task_points = ctx->task_points;
+    double *task_subpixel = ctx->task_subpixel;
     
     // Compute inverse homography for coordinate transformation
     double inv_homography[3][3];
     inverseHomography33(initial_homography, inv_homography);
     
-    // Process each feature point
-    int32_t num_matches = 0;
+    // Prepare a correlation task for each feature point
+    int32_t num_tasks = 0;
+    int32_t nan_template_rejects = 0;
+    int32_t nan_search_rejects = 0;
     for(int32_t point_idx = 0; point_idx < num_points; ++point_idx) {
         // Transform point coordinates using initial homography
         double transformed_coords[2];
@@ -200,27 +546,12 @@ int32_t MatchFeaturesWithNaNHandling(
         // Convert to integer coordinates with sub-pixel offset
         int32_t center_x = (int32_t)(transformed_coords[0] + 0.5);
         int32_t center_y = (int32_t)(transformed_coords[1] + 0.5);
-        double subpixel_x = transformed_coords[0] - center_x;
-        double subpixel_y = transformed_coords[1] - center_y;
-        
-        // Extract template window
-        int32_t nan_count;
-        if(!extract_template_window(
-            template_image,
-            template_mask,
-            template_cols,
-            template_rows,
-            center_x,
-            center_y,
-            template_size,
-            template_buffer,
-            &nan_count
-        )) {
-            continue;
-        }
         
-        // Skip if too many NaN pixels in template
-        if((max_nan_count_template >= 0) && (nan_count > max_nan_count_template)) {
+        // With packed masks, windows with too many NaN pixels are rejected before any pixel is read
+        if((ctx->template_nan != NULL) && (max_nan_count_template >= 0) &&
+           (nan_mask_count(ctx->template_nan, center_x - half_template, center_y - half_template,
+                           template_size, template_size) > max_nan_count_template)) {
+            nan_template_rejects++;
             continue;
         }
         
@@ -233,11 +564,24 @@ int32_t MatchFeaturesWithNaNHandling(
         
         size_t search_width = search_win_size;
         size_t search_height = search_win_size;
-        if(search_left + search_win_size > search_cols) search_width = search_cols - search_left;
-        if(search_top + search_win_size > search_rows) search_height = search_rows - search_top;
+        if(search_left + search_win_size > search_cols)
+            search_width = ((size_t)search_left < search_cols) ? search_cols - search_left : 0;
+        if(search_top + search_win_size > search_rows)
+            search_height = ((size_t)search_top < search_rows) ? search_rows - search_top : 0;
+        
+        // Near the image edge the clipped search window may not hold the template
+        if(search_width < (size_t)template_size || search_height < (size_t)template_size) {
+            continue;
+        }
         
         // Check for masked pixels in search window
-        if((search_mask != NULL) && (max_nan_count_search >= 0)) {
+        if((ctx->search_nan != NULL) && (max_nan_count_search >= 0)) {
+            if(nan_mask_count(ctx->search_nan, search_left, search_top,
+                              (int32_t)search_width, (int32_t)search_height) > max_nan_count_search) {
+                nan_search_rejects++;
+                continue;
+            }
+        } else if((search_mask != NULL) && (max_nan_count_search >= 0)) {
             int32_t search_nan_count = count_nan_in_search_window(
                 search_mask,
                 search_cols,
@@ -247,43 +591,135 @@ int32_t MatchFeaturesWithNaNHandling(
                 search_height
             );
             if(search_nan_count > max_nan_count_search) {
+                nan_search_rejects++;
                 continue;
             }
         }
         
-        // Perform correlation matching
-        double best_correlation, best_row, best_col, correlation_cov[3];
-        if(corimg_long(
-            template_buffer,
+        // Extract template window
+        uint8_t *task_template = &template_buffer[num_tasks * template_pixels];
+        int32_t nan_count;
+        if(!extract_template_window(
+            template_image,
+            (ctx->template_nan != NULL) ? NULL : template_mask,
+            template_cols,
+            template_rows,
+            center_x,
+            center_y,
             template_size,
-            0, 0,
-            template_size, template_size,
-            search_image,
-            search_cols,
-            search_left, search_top,
-            search_width, search_height,
-            &best_row, &best_col, &best_correlation, correlation_cov
+            task_template,
+            &nan_count
         )) {
-            // Check if correlation is above threshold
-            if(best_correlation > parameters.matching.min_correlation) {
-                // Store matched point coordinates and correlation value
-                template_points[num_matches*2] = template_points[point_idx*2];
-                template_points[num_matches*2+1] = template_points[point_idx*2+1];
-                
-                matched_points[num_matches*2] = best_col + subpixel_x;
-                matched_points[num_matches*2+1] = best_row + subpixel_y;
-                correlation_values[num_matches] = best_correlation;
-                num_matches++;
-            }
+            continue;
         }
+        
+        // Skip if too many NaN pixels in template
+        if((ctx->template_nan == NULL) && (max_nan_count_template >= 0) && (nan_count > max_nan_count_template)) {
+            nan_template_rejects++;
+            continue;
+        }
+        
+        CorrTask *task = &tasks[num_tasks];
+        task->img1 = task_template;
+        task->rowBytes1 = template_size;
+        task->left1 = 0;
+        task->top1 = 0;
+        task->cols1 = template_size;
+        task->rows1 = template_size;
+        task->img2 = search_image;
+        task->rowBytes2 = search_cols;
+        task->left2 = search_left;
+        task->top2 = search_top;
+        task->cols2 = search_width;
+        task->rows2 = search_height;
+        task->integral = search_integral;
+        task->prune = parameters.matching.prune_search;
+        task->min_correlation = parameters.matching.min_correlation;
+        task->subpixel_model = (CorrSubpixelModel)parameters.matching.subpixel_model;
+        task_points[num_tasks] = point_idx;
+        task_subpixel[num_tasks*2] = transformed_coords[0] - center_x;
+        task_subpixel[num_tasks*2+1] = transformed_coords[1] - center_y;
+        num_tasks++;
     }
     
-    // Cleanup
-    free(template_buffer);
+    // Perform correlation matching. With a budget, the chunks correlated before it ends are kept.
+    int32_t num_matches = 0;
+    int32_t num_correlated = 0;
+    int32_t chunk_size = (ctx->budget != NULL) ? MATCH_BUDGET_CHUNK : num_tasks;
+    ctx->status = BUDGET_COMPLETE;
+    PERF_PHASE_BEGIN(timer, PERF_CORRELATE);
+    while(num_correlated < num_tasks) {
+        ctx->status = time_budget_status(ctx->budget);
+        if(ctx->status != BUDGET_COMPLETE) break;
+        int32_t count = (num_tasks - num_correlated < chunk_size) ? num_tasks - num_correlated : chunk_size;
+        if(!correlate_tasks(ctx, &parameters, &tasks[num_correlated], count, &results[num_correlated])) break;
+        num_correlated += count;
+    }
+    PERF_PHASE_END(timer);
+    
+    // Tasks are in point order, so points are compacted in place
+    for(int32_t task_idx = 0; task_idx < num_correlated; ++task_idx) {
+        // Check if correlation is above threshold
+        if(results[task_idx].success && results[task_idx].bestval > parameters.matching.min_correlation) {
+            int32_t point_idx = task_points[task_idx];
+            // Store matched point coordinates and correlation value
+            template_points[num_matches*2] = template_points[point_idx*2];
+            template_points[num_matches*2+1] = template_points[point_idx*2+1];
+            
+            matched_points[num_matches*2] = results[task_idx].bestcol + task_subpixel[task_idx*2];
+            matched_points[num_matches*2+1] = results[task_idx].bestrow + task_subpixel[task_idx*2+1];
+            correlation_values[num_matches] = results[task_idx].bestval;
+            num_matches++;
+        }
+    }
+    PERF_COUNT(PERF_FEATURES_TRIED, num_points);
+    PERF_COUNT(PERF_FEATURES_NAN_TEMPLATE, nan_template_rejects);
+    PERF_COUNT(PERF_FEATURES_NAN_SEARCH, nan_search_rejects);
+    PERF_COUNT(PERF_CORRELATION_BELOW_MIN, num_correlated - num_matches);
     
     return num_matches;
 }
 
+/**
+ * \brief `LMK_Col_Row2World`, read from the world layer of the landmark at whole pixels if it was computed
+ */
+static bool feature_world_point(const LMK *lmk, double col, double row, double p[3])
+{
+    const double *world = (const double *)LMK_Layer(lmk, LMK_LAYER_WORLD);
+    if (world != NULL && col == floor(col) && row == floor(row) && col >= 0 && row >= 0 &&
+        col < lmk->num_cols && row < lmk->num_rows) {
+        size_t index = (size_t)row * lmk->num_cols + (size_t)col;
+        copy3(&world[index * 3], p);
+        return !isnan(lmk->ele[index]);
+    }
+    return LMK_Col_Row2World(lmk, col, row, p);
+}
+
+/**
+ * \brief Delta between the matched points of a feature, in the map frame of the child landmark
+ */
+static bool matched_feature_delta(
+    const LMK* child_landmark,
+    const LMK* base_landmark,
+    double child_col,
+    double child_row,
+    double base_col,
+    double base_row,
+    double delta_map[3]
+) {
+    double child_world[3], base_world[3], delta_world[3];
+    
+    if (!feature_world_point(child_landmark, child_col, child_row, child_world) ||
+        !feature_world_point(base_landmark, base_col, base_row, base_world)) {
+        return false;
+    }
+    
+    // Compute delta in world coordinates and convert to map frame
+    sub3_inline(child_world, base_world, delta_world);
+    mult331_inline(child_landmark->mapRworld, delta_world, delta_map);
+    return true;
+}
+
 bool process_matched_feature(
     const LMK* child_landmark,
     const LMK* base_landmark,
@@ -299,17 +735,11 @@ bool process_matched_feature(
     int32_t feature_influence_window
 ) {
     // Convert points to world coordinates and compute delta in map frame
-    double child_world[3], base_world[3], delta_world[3], delta_map[3];
-    
-    if (!LMK_Col_Row2World(child_landmark, child_col, child_row, child_world) ||
-        !LMK_Col_Row2World(base_landmark, base_col, base_row, base_world)) {
+    double delta_map[3];
+    if (!matched_feature_delta(child_landmark, base_landmark, child_col, child_row, base_col, base_row, delta_map)) {
         return false;
     }
     
-    // Compute delta in world coordinates and convert to map frame
-    sub3(child_world, base_world, delta_world);
-    mult331(child_landmark->mapRworld, delta_world, delta_map);
-    
     // Update maps with Gaussian-weighted contributions
     int32_t row = (int32_t)child_row;
     int32_t col = (int32_t)child_col;
@@ -349,6 +779,306 @@ bool process_matched_feature(
     return true;
 }
 
+bool allocate_match_grid(MatchGrid *grid, const Parameters *parameters, int32_t num_cols, int32_t num_rows)
+{
+    memset(grid, 0, sizeof(MatchGrid));
+    int32_t block_size = parameters->sliding.block_size;
+    int32_t step_size = parameters->sliding.step_size;
+    if (block_size < 1 || step_size < 1 || num_cols < 1 || num_rows < 1) {
+        SAFE_PRINTF(256, "allocate_match_grid() ==>> invalid block size %d or step size %d\n", block_size, step_size);
+        return false;
+    }
+    grid->block_size = block_size;
+    grid->step_size = step_size;
+    grid->points_per_side = block_size / step_size + 1;
+    // The last point of a block is the first of the next one only if the steps land on the block border
+    grid->block_stride = (block_size % step_size == 0) ? grid->points_per_side - 1 : grid->points_per_side;
+    grid->blocks_per_row = (num_cols + block_size - 1) / block_size;
+    int32_t block_rows = (num_rows + block_size - 1) / block_size;
+    grid->num_blocks = grid->blocks_per_row * block_rows;
+    grid->cols = (grid->blocks_per_row - 1) * grid->block_stride + grid->points_per_side;
+    grid->rows = (block_rows - 1) * grid->block_stride + grid->points_per_side;
+    
+    size_t num_points = (size_t)grid->cols * grid->rows;
+    grid->matched = (uint8_t *)calloc(num_points, sizeof(uint8_t));
+    grid->base_points = (double *)malloc(sizeof(double) * 2 * num_points);
+    grid->covariances = (double *)malloc(sizeof(double) * num_points);
+    grid->block_matched = (uint8_t *)calloc(grid->num_blocks, sizeof(uint8_t));
+    if (grid->matched == NULL || grid->base_points == NULL || grid->covariances == NULL || grid->block_matched == NULL) {
+        SAFE_PRINTF(256, "allocate_match_grid() ==>> memory allocation error\n");
+        free_match_grid(grid);
+        return false;
+    }
+    return true;
+}
+
+void free_match_grid(MatchGrid *grid)
+{
+    free(grid->matched);
+    free(grid->base_points);
+    free(grid->covariances);
+    free(grid->block_matched);
+    memset(grid, 0, sizeof(MatchGrid));
+}
+
+/**
+ * \brief Sliding window blocks of `MatchFeaturesWithLocalDistortion` shared by the matching threads
+ *
+ * Threads take blocks in row order and store their matches in the grid. The calling thread accumulates the blocks
+ * in block order, so the results do not depend on which thread matched which block.
+ */
+typedef struct {
+    const Parameters *parameters;
+    LMK *base_landmark;
+    LMK *child_landmark;
+    const NanMask *base_nan_mask;
+    const NanMask *child_nan_mask;
+    int32_t max_nan_count_base;
+    int32_t max_nan_count_child;
+    const CorrIntegralImage *base_integral;
+    double (*base2child)[3];
+    CorrDeviceImage *device_search;
+    MatchGrid *grid;
+    int32_t next_block;          // next block to match
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} BlockQueue;
+
+static int32_t default_num_threads(void)
+{
+    return parallel_num_threads();
+}
+
+/**
+ * \brief Take the next block that is not in the grid yet. The caller holds the queue mutex
+ *
+ * \return block index, or -1 if every block is taken
+ */
+static int32_t take_block(BlockQueue *queue)
+{
+    while (queue->next_block < queue->grid->num_blocks && queue->grid->block_matched[queue->next_block]) {
+        queue->next_block++;
+    }
+    if (queue->next_block >= queue->grid->num_blocks) return -1;
+    return queue->next_block++;
+}
+
+/**
+ * \brief Match the grid points first reached by one block
+ *
+ * Points on the top and left border of a block belong to the blocks above and to the left, which come first in
+ * row order. A block is accumulated only after every earlier block, so those points are in the grid by then.
+ */
+static void match_block(BlockQueue *queue, MatchContext *ctx, int32_t block)
+{
+    const Parameters *parameters = queue->parameters;
+    MatchGrid *grid = queue->grid;
+    int32_t block_row = block / grid->blocks_per_row;
+    int32_t block_col = block % grid->blocks_per_row;
+    int32_t row_index = block_row * grid->block_size;
+    int32_t col_index = block_col * grid->block_size;
+    bool shared = grid->block_stride < grid->points_per_side;
+    FeatureSet *features = &ctx->block;
+    double *child_points = features->points;
+    
+    // Fill arrays with coordinates at STEP_SIZE intervals
+    int32_t num_points = 0;
+    for (int32_t j = 0; j < grid->points_per_side; j++) {
+        if (shared && j == 0 && block_row > 0) continue;
+        for (int32_t k = 0; k < grid->points_per_side; k++) {
+            if (shared && k == 0 && block_col > 0) continue;
+            child_points[num_points * 2] = col_index + k * grid->step_size;
+            child_points[num_points * 2 + 1] = row_index + j * grid->step_size;
+            num_points++;
+        }
+    }
+    
+    memset(features->scores, 0, sizeof(double) * num_points);
+    ctx->template_nan = queue->child_nan_mask;
+    ctx->search_nan = queue->base_nan_mask;
+    int32_t num_matched = MatchFeaturesWithSearchIntegral_ctx(
+        ctx,
+        *parameters,
+        queue->child_landmark->srm,
+        NULL,
+        queue->child_landmark->num_cols,
+        queue->child_landmark->num_rows,
+        queue->max_nan_count_child,
+        queue->base_landmark->srm,
+        NULL,
+        queue->base_landmark->num_cols,
+        queue->base_landmark->num_rows,
+        queue->max_nan_count_base,
+        queue->base_integral,
+        queue->base2child,
+        features->points,
+        features->matches,
+        features->scores,
+        num_points
+    );
+    features->count = num_matched;
+    
+    // Matched points are compacted in order, their grid position follows from their coordinates
+    for (int32_t i = 0; i < num_matched; i++) {
+        int32_t k = ((int32_t)child_points[i * 2] - col_index) / grid->step_size;
+        int32_t j = ((int32_t)child_points[i * 2 + 1] - row_index) / grid->step_size;
+        size_t index = (size_t)(block_row * grid->block_stride + j) * grid->cols + block_col * grid->block_stride + k;
+        grid->matched[index] = 1;
+        grid->base_points[index * 2] = features->matches[i * 2];
+        grid->base_points[index * 2 + 1] = features->matches[i * 2 + 1];
+        grid->covariances[index] = features->scores[i];
+    }
+    
+    pthread_mutex_lock(&queue->mutex);
+    grid->block_matched[block] = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static void *match_block_thread(void *arg)
+{
+    BlockQueue *queue = (BlockQueue *)arg;
+    MatchContext ctx;
+    // Without its own context a thread does not help, the other threads take its blocks
+    if (!allocate_match_context(&ctx, queue->parameters, 0)) return NULL;
+    ctx.corr_threads = 1;
+    ctx.device_search = queue->device_search;
+    
+    pthread_mutex_lock(&queue->mutex);
+    int32_t block;
+    while ((block = take_block(queue)) >= 0) {
+        pthread_mutex_unlock(&queue->mutex);
+        match_block(queue, &ctx, block);
+        pthread_mutex_lock(&queue->mutex);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    
+    // The device image belongs to the calling thread
+    ctx.device_search = NULL;
+    free_match_context(&ctx);
+    return NULL;
+}
+
+/**
+ * \brief Fit the local homography of one block from the grid and accumulate its inliers into `splat` and `sparse`
+ *
+ * \param[out] features Scratch for the matched points of one block, their matches and correlations
+ * \param[in,out] ransac_scratch Scratch memory of the local RANSAC
+ * \param[in,out] splat Weighted sums of the dense maps, or NULL
+ * \param[in,out] sparse List of the inliers, or NULL
+ * \return false if `sparse` cannot grow
+ */
+static bool accumulate_block(
+    const Parameters *parameters,
+    LMK *base_landmark,
+    LMK *child_landmark,
+    const MatchGrid *grid,
+    int32_t block,
+    FeatureSet *features,
+    RansacScratch *ransac_scratch,
+    SplatAccumulator *splat,
+    SparseMatches *sparse
+) {
+    int32_t block_row = block / grid->blocks_per_row;
+    int32_t block_col = block % grid->blocks_per_row;
+    int32_t points_per_side = grid->points_per_side;
+    double *child_points = features->points;
+    double *base_points = features->matches;
+    double *covariances = features->scores;
+    
+    // Gather the matches of the block in the order the points were sampled
+    int32_t num_matched_features = 0;
+    for (int32_t j = 0; j < points_per_side; j++) {
+        for (int32_t k = 0; k < points_per_side; k++) {
+            size_t index = (size_t)(block_row * grid->block_stride + j) * grid->cols + block_col * grid->block_stride + k;
+            if (!grid->matched[index]) continue;
+            child_points[num_matched_features * 2] = block_col * grid->block_size + k * grid->step_size;
+            child_points[num_matched_features * 2 + 1] = block_row * grid->block_size + j * grid->step_size;
+            base_points[num_matched_features * 2] = grid->base_points[index * 2];
+            base_points[num_matched_features * 2 + 1] = grid->base_points[index * 2 + 1];
+            covariances[num_matched_features] = grid->covariances[index];
+            num_matched_features++;
+        }
+    }
+    features->count = num_matched_features;
+    
+    log_message(LOG_LEVEL_DEBUG, "Found %d matched features in window", num_matched_features);
+    
+    if (num_matched_features > parameters->sliding.min_n_features) {
+        // Compute local homography for matched features. Blocks are accumulated in order, so the draws from rand()
+        // do not depend on the threads. With seeded_ransac, samples are drawn from the best correlated features
+        // first, from a generator seeded by the block so that the result does not depend on rand() either
+        RansacRng rng;
+        RansacOptions ransac;
+        if (parameters->sliding.seeded_ransac) {
+            ransac_rng_seed(&rng, ((uint64_t)(grid->first_block_row + block_row) << 32) |
+                                 (uint32_t)(grid->first_block_col + block_col));
+            ransac_default_options(&ransac, 3, &rng);
+            ransac.scores = covariances;
+        } else {
+            ransac_frame_options(&ransac, 3);
+        }
+        ransac.scratch = ransac_scratch;
+        double local_homography[3][3];
+        if (getHomographyFromPoints_RANSAC_ctx(child_points, base_points, num_matched_features, local_homography,
+                                               &ransac) < 0) {
+            return true;
+        }
+        
+        // Mark the inliers of the local homography
+        for (int32_t feature_index = 0; feature_index < num_matched_features; ++feature_index) {
+            double reprojection_error[2];
+            homographyTransfer33(local_homography, 
+                                (int32_t)child_points[feature_index * 2], 
+                                (int32_t)child_points[feature_index * 2 + 1], 
+                                reprojection_error);
+            
+            reprojection_error[0] -= base_points[feature_index * 2];
+            reprojection_error[1] -= base_points[feature_index * 2 + 1];
+            double error_magnitude = sqrt(reprojection_error[0] * reprojection_error[0] + 
+                                        reprojection_error[1] * reprojection_error[1]);
+            features->keep[feature_index] = error_magnitude < parameters->sliding.reprojection_threshold;
+        }
+        
+        // Accumulate the inliers, with their deltas computed a batch at a time in float if the landmarks allow it
+        LMK_LocalPair local_pair;
+        bool local_float = parameters->sliding.float_coordinates &&
+                           LMK_Local_Pair_Init(&local_pair, child_landmark, base_landmark);
+        double delta_batch[LMK_LOCAL_BATCH][3];
+        bool valid_batch[LMK_LOCAL_BATCH];
+        for (int32_t first = 0; first < num_matched_features; first += LMK_LOCAL_BATCH) {
+            int32_t count = num_matched_features - first < LMK_LOCAL_BATCH ? num_matched_features - first : LMK_LOCAL_BATCH;
+            if (local_float) {
+                LMK_Local_Pair_Delta_Batch(&local_pair, &child_points[first * 2], &base_points[first * 2],
+                                           (size_t)count, delta_batch, valid_batch);
+            }
+            for (int32_t i = 0; i < count; i++) {
+                int32_t feature_index = first + i;
+                if (!features->keep[feature_index]) continue;
+                double *delta_map = delta_batch[i];
+                bool valid = local_float ? valid_batch[i] :
+                             matched_feature_delta(child_landmark, base_landmark,
+                                                   child_points[feature_index * 2], child_points[feature_index * 2 + 1],
+                                                   base_points[feature_index * 2], base_points[feature_index * 2 + 1],
+                                                   delta_map);
+                if (!valid) continue;
+                if (splat != NULL) {
+                    splat_add(splat, child_points[feature_index * 2], child_points[feature_index * 2 + 1],
+                              delta_map, covariances[feature_index]);
+                }
+                if (sparse != NULL &&
+                    !sparse_matches_append(sparse, (int32_t)child_points[feature_index * 2],
+                                           (int32_t)child_points[feature_index * 2 + 1],
+                                           base_points[feature_index * 2], base_points[feature_index * 2 + 1],
+                                           delta_map, covariances[feature_index], block)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
 bool MatchFeaturesWithLocalDistortion(
     Parameters parameters,
     LMK *base_landmark,
@@ -357,163 +1087,299 @@ bool MatchFeaturesWithLocalDistortion(
     int32_t max_nan_count_base,
     int32_t max_nan_count_child
 ) {
+    MatchGrid grid;
+    if (!allocate_match_grid(&grid, &parameters, child_landmark->num_cols, child_landmark->num_rows)) {
+        printf("MatchFeaturesWithLocalDistortion(): memory allocation error\n");
+        return false;
+    }
+    bool success = MatchFeaturesWithLocalDistortion_grid(parameters, base_landmark, child_landmark, results,
+                                                         max_nan_count_base, max_nan_count_child, &grid);
+    free_match_grid(&grid);
+    return success;
+}
+
+size_t MatchFeaturesWithLocalDistortion_memory(
+    const Parameters *parameters,
+    const LMK *base_header,
+    const LMK *child_header,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child
+) {
+    size_t base_pixels = (size_t)base_header->num_cols * base_header->num_rows;
+    size_t child_pixels = (size_t)child_header->num_cols * child_header->num_rows;
+    
+    // Landmark arrays, and the delta x, y, z and correlation maps
+    size_t bytes = (base_pixels + child_pixels) * (sizeof(uint8_t) + sizeof(float));
+    bytes += child_pixels * 4 * sizeof(float);
+    
+    // prepare_match_base, then match_local_distortion
+    bytes += nan_mask_bytes(base_header->num_cols, base_header->num_rows, max_nan_count_base >= 0);
+    bytes += corr_integral_image_bytes(base_header->num_cols, base_header->num_rows);
+    bytes += nan_mask_bytes(child_header->num_cols, child_header->num_rows, max_nan_count_child >= 0);
+    bytes += splat_bytes(child_header->num_cols, child_header->num_rows, parameters->sliding.normalized_convolution);
+    return bytes;
+}
+
+bool prepare_match_base(MatchBase *base, LMK *base_landmark, int32_t max_nan_count_base)
+{
+    memset(base, 0, sizeof(MatchBase));
+    base->landmark = base_landmark;
+    base->max_nan_count = max_nan_count_base;
+    
+    // Only a mask that is checked needs window counts. It is kept with the landmark for later comparisons
+    base->nan_mask = lmk_nan_mask_layer(base_landmark, max_nan_count_base >= 0);
+    if (base->nan_mask == NULL) {
+        printf("prepare_match_base(): memory allocation error\n");
+        return false;
+    }
+    
+    // Without window sums matching falls back to corimg_long
+    base->have_integral = corr_integral_image_build(&base->integral, base_landmark->srm, base_landmark->num_cols,
+                                                    base_landmark->num_cols, base_landmark->num_rows);
+#ifdef WITH_CUDA
+    // Every block searches the base landmark, so it is copied to the device once
+    if (corr_cuda_available()) {
+        base->device_search = corr_cuda_upload(base_landmark->srm, base_landmark->num_cols,
+                                               base_landmark->num_cols, base_landmark->num_rows);
+    }
+#endif
+    return true;
+}
+
+void free_match_base(MatchBase *base)
+{
+    if (base->have_integral) corr_integral_image_free(&base->integral);
+#ifdef WITH_CUDA
+    corr_cuda_free(base->device_search);
+#endif
+    memset(base, 0, sizeof(MatchBase));
+}
+
+bool MatchFeaturesWithLocalDistortion_grid(
+    Parameters parameters,
+    LMK *base_landmark,
+    LMK *child_landmark,
+    CorrelationResults *results,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    MatchGrid *grid
+) {
+    MatchBase base;
+    if (!prepare_match_base(&base, base_landmark, max_nan_count_base)) {
+        return false;
+    }
+    bool success = MatchFeaturesWithLocalDistortion_base(parameters, &base, child_landmark, results,
+                                                         max_nan_count_child, grid);
+    free_match_base(&base);
+    return success;
+}
+
+/**
+ * \brief Shared body of `MatchFeaturesWithLocalDistortion_base` and `MatchFeaturesWithLocalDistortion_sparse`
+ *
+ * \param[out] results Dense maps, or NULL
+ * \param[in,out] sparse List the inliers are appended to, or NULL
+ */
+static bool match_local_distortion(
+    Parameters parameters,
+    const MatchBase *base,
+    LMK *child_landmark,
+    CorrelationResults *results,
+    SparseMatches *sparse,
+    int32_t max_nan_count_child,
+    MatchGrid *grid
+) {
+    LMK *base_landmark = base->landmark;
+    if (grid->block_size != parameters.sliding.block_size || grid->step_size != parameters.sliding.step_size ||
+        grid->blocks_per_row != (child_landmark->num_cols + grid->block_size - 1) / grid->block_size ||
+        grid->num_blocks != grid->blocks_per_row * ((child_landmark->num_rows + grid->block_size - 1) / grid->block_size)) {
+        printf("MatchFeaturesWithLocalDistortion_base(): grid does not match the block layout\n");
+        return false;
+    }
+    
     // Estimate initial homography between landmarks using corner points
     double base2child[3][3];
     estimateHomographyUsingCorners(base_landmark, child_landmark, base2child);
     
-    // Allocate memory for weights and NaN masks
-    float *weights = (float *)malloc(sizeof(float) * child_landmark->num_pixels);
-    uint8_t* child_nan_mask = (uint8_t*)malloc(sizeof(uint8_t) * child_landmark->num_pixels);
-    uint8_t* base_nan_mask = (uint8_t*)malloc(sizeof(uint8_t) * base_landmark->num_pixels);
+    // Allocate the weighted sums of the features, only the dense maps need them
+    SplatAccumulator splat = {0};
+    if (results != NULL &&
+        !splat_init(&splat, child_landmark->num_cols, child_landmark->num_rows,
+                    parameters.sliding.feature_influence_window, parameters.sliding.normalized_convolution)) {
+        return false;
+    }
     
-    if (weights == NULL || child_nan_mask == NULL || base_nan_mask == NULL) {
-        if (child_nan_mask) free(child_nan_mask);
-        if (base_nan_mask) free(base_nan_mask);
-        if (weights) free(weights);
+    // Only the masks that are checked need window counts
+    const NanMask *child_nan_mask = lmk_nan_mask_layer(child_landmark, max_nan_count_child >= 0);
+    if (child_nan_mask == NULL) {
+        splat_free(&splat);
         printf("MatchFeaturesWithLocalDistortion(): memory allocation error\n");
         return false;
     }
-        
-    // Initialize weights and create NaN masks
-    for (int32_t i = 0; i < child_landmark->num_pixels; i++) {
-        weights[i] = NAN;
-        
-        // Create NaN mask for child landmark
-        if (isnan(child_landmark->ele[i])) {
-            child_nan_mask[i] = 1;
-        } else {
-            child_nan_mask[i] = 0;
-        }
-        
-        // Create NaN mask for base landmark
-        if (isnan(base_landmark->ele[i])) {
-            base_nan_mask[i] = 1;
-        } else {
-            base_nan_mask[i] = 0;
-        }
+    
+    // Scratch memory shared by every block
+    MatchContext ctx;
+    if (!allocate_match_context(&ctx, &parameters, 0)) {
+        splat_free(&splat);
+        printf("MatchFeaturesWithLocalDistortion(): memory allocation error\n");
+        return false;
     }
+    // The device image belongs to the base, it is detached from the context before the context is released
+    ctx.device_search = base->device_search;
     
-    // Process landmarks in blocks
-    for (int32_t row_index = 0; row_index < child_landmark->num_rows; row_index += parameters.sliding.block_size) {
-        SAFE_PRINTF(128, "Processing row %d of %d\n", row_index, child_landmark->num_rows);
-        
-        for (int32_t col_index = 0; col_index < child_landmark->num_cols; col_index += parameters.sliding.block_size) {
-            // Extract feature points at STEP_SIZE intervals within the current block
-            int32_t size = ((parameters.sliding.block_size / parameters.sliding.step_size) + 1) * ((parameters.sliding.block_size / parameters.sliding.step_size) + 1);
-            double *child_points = (double *)malloc(sizeof(double) * size * 2);
-            double *base_points = (double *)malloc(sizeof(double) * size * 2);
-            
-            if (child_points == NULL || base_points == NULL) {
-                if (child_points != NULL) free(child_points);
-                if (base_points != NULL) free(base_points);
-                printf("MatchFeaturesWithLocalDistortion(): memory allocation error\n");
-                return false;
-            }
-            
-            // Fill arrays with coordinates at STEP_SIZE intervals
-            int32_t num_points = 0;
-            for (int32_t m = row_index; m <= row_index + parameters.sliding.block_size; m += parameters.sliding.step_size) {
-                for (int32_t n = col_index; n <= col_index + parameters.sliding.block_size; n += parameters.sliding.step_size) {
-                    child_points[num_points * 2] = n;
-                    child_points[num_points * 2 + 1] = m;
-                    num_points++;
-                }
-            }
-            
-            double covariances[num_points];
-            memset(covariances, 0, sizeof(double)*num_points);
-            int32_t num_matched_features = MatchFeaturesWithNaNHandling(
-                parameters,
-                child_landmark->srm,
-                child_nan_mask,
-                child_landmark->num_cols,
-                child_landmark->num_rows,
-                max_nan_count_child,
-                base_landmark->srm,
-                base_nan_mask,
-                base_landmark->num_cols,
-                base_landmark->num_rows,
-                max_nan_count_base,
-                base2child,
-                child_points,
-                base_points,
-                covariances,
-                num_points
-            );
-            
-            SAFE_PRINTF(128, "Found %d matched features in window\n", num_matched_features);
-            
-            if (num_matched_features > parameters.sliding.min_n_features) {
-                // Compute local homography for matched features
-                double local_homography[3][3];
-                getHomographyFromPoints_RANSAC_frame(child_points, base_points, num_matched_features, local_homography, 3);
-                
-                // Process each matched feature
-                for (int32_t feature_index = 0; feature_index < num_matched_features; ++feature_index) {
-                    // Check reprojection error
-                    double reprojection_error[2];
-                    homographyTransfer33(local_homography, 
-                                        (int32_t)child_points[feature_index * 2], 
-                                        (int32_t)child_points[feature_index * 2 + 1], 
-                                        reprojection_error);
-                    
-                    reprojection_error[0] -= base_points[feature_index * 2];
-                    reprojection_error[1] -= base_points[feature_index * 2 + 1];
-                    double error_magnitude = sqrt(reprojection_error[0] * reprojection_error[0] + 
-                                                reprojection_error[1] * reprojection_error[1]);
-                    
-                    // Process inlier features
-                    if (error_magnitude < parameters.sliding.reprojection_threshold) {
-                        process_matched_feature(
-                            child_landmark,
-                            base_landmark,
-                            child_points[feature_index * 2],
-                            child_points[feature_index * 2 + 1],
-                            base_points[feature_index * 2],
-                            base_points[feature_index * 2 + 1],
-                            covariances[feature_index],
-                            results,
-                            weights,
-                            child_landmark->num_cols,
-                            child_landmark->num_rows,
-                            parameters.sliding.feature_influence_window
-                        );
-                    }
-                }
+    // Blocks are matched in parallel and accumulated in row order on this thread
+    int32_t num_threads = parameters.sliding.num_threads > 0 ? parameters.sliding.num_threads : default_num_threads();
+    BlockQueue queue;
+    queue.parameters = &parameters;
+    queue.base_landmark = base_landmark;
+    queue.child_landmark = child_landmark;
+    queue.base_nan_mask = base->nan_mask;
+    queue.child_nan_mask = child_nan_mask;
+    queue.max_nan_count_base = base->max_nan_count;
+    queue.max_nan_count_child = max_nan_count_child;
+    queue.base_integral = base->have_integral ? &base->integral : NULL;
+    queue.base2child = base2child;
+    queue.device_search = ctx.device_search;
+    queue.grid = grid;
+    queue.next_block = 0;
+    if (num_threads > MATCH_MAX_THREADS) num_threads = MATCH_MAX_THREADS;
+    if (num_threads > grid->num_blocks) num_threads = grid->num_blocks;
+    if (num_threads < 1) num_threads = 1;
+    ctx.corr_threads = 1;
+    
+    // accumulate_block gathers into its own set, the context set is used by match_block
+    FeatureSet block_features = {0};
+    bool success = feature_set_reserve(&block_features, block_num_points(&parameters));
+    if (!success) {
+        printf("MatchFeaturesWithLocalDistortion(): memory allocation error\n");
+    }
+    if (success && pthread_mutex_init(&queue.mutex, NULL) != 0) {
+        printf("MatchFeaturesWithLocalDistortion(): cannot create mutex\n");
+        success = false;
+    }
+    if (success && pthread_cond_init(&queue.cond, NULL) != 0) {
+        printf("MatchFeaturesWithLocalDistortion(): cannot create condition variable\n");
+        pthread_mutex_destroy(&queue.mutex);
+        success = false;
+    }
+    if (!success) {
+        feature_set_free(&block_features);
+        ctx.device_search = NULL;
+        free_match_context(&ctx);
+        splat_free(&splat);
+        return false;
+    }
+    
+    pthread_t threads[MATCH_MAX_THREADS];
+    int32_t started = 0;
+    for (int32_t t = 1; t < num_threads; t++) {
+        if (pthread_create(&threads[started], NULL, match_block_thread, &queue) != 0) break;
+        started++;
+    }
+    
+    RansacScratch ransac_scratch = {0};
+    bool accumulated = true;
+    MatchJournal *journal = grid->journal;
+    
+    // This thread matches blocks too while the next block to accumulate is not ready, so every block completes
+    // even if no thread could be started
+    for (int32_t block = 0; block < grid->num_blocks; block++) {
+        pthread_mutex_lock(&queue.mutex);
+        while (!grid->block_matched[block]) {
+            int32_t next = take_block(&queue);
+            if (next >= 0) {
+                pthread_mutex_unlock(&queue.mutex);
+                match_block(&queue, &ctx, next);
+                pthread_mutex_lock(&queue.mutex);
+            } else {
+                pthread_cond_wait(&queue.cond, &queue.mutex);
             }
-            
-            
-            free(child_points);
-            free(base_points);
+        }
+        pthread_mutex_unlock(&queue.mutex);
+        
+        // A journal that cannot be written is dropped, the comparison goes on without checkpoints
+        if (journal != NULL && !match_journal_append(journal, grid, block)) {
+            printf("MatchFeaturesWithLocalDistortion(): cannot write the journal, continuing without it\n");
+            journal = NULL;
+        }
+        if (block % grid->blocks_per_row == 0) {
+            int32_t row = (block / grid->blocks_per_row) * grid->block_size;
+            log_progress("Matching rows", row, child_landmark->num_rows);
+            // The features of the blocks above are all in, the rows they alone reach are final
+            if (results != NULL) splat_finish_rows(&splat, results, row, parameters.sliding.max_delta_map);
+        }
+        // The other threads take the remaining blocks if the list of inliers cannot grow
+        if (!accumulate_block(&parameters, base_landmark, child_landmark, grid, block, &block_features,
+                              &ransac_scratch, results != NULL ? &splat : NULL, sparse)) {
+            accumulated = false;
+            break;
         }
     }
     
-    // Normalize results by weights
-    for (int32_t i = 0; i < child_landmark->num_pixels; ++i) {
-        if (!isnan(weights[i])) {
-            results->delta_x[i] /= weights[i];
-            results->delta_y[i] /= weights[i];
-            results->delta_z[i] /= weights[i];
-            results->correlation[i] /= weights[i];
-        } else {
-            results->delta_x[i] = NAN;
-            results->delta_y[i] = NAN;
-            results->delta_z[i] = NAN;
-            results->correlation[i] = NAN;
-        }
+    for (int32_t t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
     }
+    pthread_cond_destroy(&queue.cond);
+    pthread_mutex_destroy(&queue.mutex);
+    feature_set_free(&block_features);
+    ransac_scratch_free(&ransac_scratch);
     
-    // Filter outliers (points with large deltas)
-    for (int32_t i = 0; i < child_landmark->num_pixels; ++i) {
-        if (fabs(results->delta_y[i]) > parameters.sliding.max_delta_map) results->delta_y[i] = NAN;
-        if (fabs(results->delta_x[i]) > parameters.sliding.max_delta_map) results->delta_x[i] = NAN;
-        if (fabs(results->delta_z[i]) > parameters.sliding.max_delta_map) results->delta_z[i] = NAN;
+    // Turn the weighted sums of the remaining rows into the results, without the deltas over max_delta_map
+    if (!accumulated ||
+        (results != NULL && !splat_finish_filtered(&splat, results, parameters.sliding.max_delta_map))) {
+        ctx.device_search = NULL;
+        free_match_context(&ctx);
+        if (results != NULL) splat_free(&splat);
+        return false;
     }
     
     // Cleanup
-    free(weights);
-    free(child_nan_mask);
-    free(base_nan_mask);
+    ctx.device_search = NULL;
+    free_match_context(&ctx);
+    if (results != NULL) splat_free(&splat);
     
     return true;
 }
+
+bool MatchFeaturesWithLocalDistortion_base(
+    Parameters parameters,
+    const MatchBase *base,
+    LMK *child_landmark,
+    CorrelationResults *results,
+    int32_t max_nan_count_child,
+    MatchGrid *grid
+) {
+    return match_local_distortion(parameters, base, child_landmark, results, NULL, max_nan_count_child, grid);
+}
+
+bool MatchFeaturesWithLocalDistortion_sparse(
+    Parameters parameters,
+    const MatchBase *base,
+    LMK *child_landmark,
+    SparseMatches *matches,
+    int32_t max_nan_count_child,
+    MatchGrid *grid
+) {
+    return match_local_distortion(parameters, base, child_landmark, NULL, matches, max_nan_count_child, grid);
+}
+
+bool densify_sparse_matches(
+    Parameters parameters,
+    const SparseMatches *matches,
+    int32_t num_cols,
+    int32_t num_rows,
+    CorrelationResults *results
+) {
+    SplatAccumulator splat;
+    if (!splat_init(&splat, num_cols, num_rows, parameters.sliding.feature_influence_window,
+                    parameters.sliding.normalized_convolution)) {
+        return false;
+    }
+    for (size_t i = 0; i < matches->count; ++i) {
+        double delta_map[3] = {matches->delta_x[i], matches->delta_y[i], matches->delta_z[i]};
+        splat_add(&splat, matches->child_col[i], matches->child_row[i], delta_map, matches->correlation[i]);
+    }
+    bool success = splat_finish_filtered(&splat, results, parameters.sliding.max_delta_map);
+    splat_free(&splat);
+    return success;
+}
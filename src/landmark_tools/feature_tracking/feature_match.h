@@ -29,14 +29,108 @@
 #include <stdint.h>                               // for uint8_t, int32_t
 #include <stdint.h>                               // for uint8_t, int32_t
 
+#include "landmark_tools/feature_tracking/corr_image_long.h"
+#include "landmark_tools/feature_tracking/feature_set.h"  // for CorrIntegralImage
+#include "landmark_tools/feature_tracking/corr_cuda.h"  // for CorrDeviceImage
+#include "landmark_tools/feature_tracking/nan_mask.h"  // for NanMask
 #include "landmark_tools/feature_tracking/parameters.h"  // for FTP
 #include "landmark_tools/landmark_util/landmark.h"      // for LMK
+#include "landmark_tools/utils/time_budget.h"           // for TimeBudget
 #include "landmark_tools/feature_tracking/correlation_results.h"  // for CorrelationResults
 
+#define PYRAMID_NUM_PEAKS 3              /*!< \brief Coarse peaks refined at full resolution per feature when `pyramid_levels` > 0 */
+#define PYRAMID_MIN_TEMPLATE_SIZE 5      /*!< \brief Smallest downsampled template used by the pyramid search */
+#define MATCH_MAX_THREADS 256            /*!< \brief Maximum number of threads of `MatchFeaturesWithLocalDistortion` */
+#define MATCH_BUDGET_CHUNK 64            /*!< \brief Features correlated between checks of `MatchContext::budget` */
+
+/**
+ * \brief Scratch memory of the matching functions, reused across calls
+ *
+ * Created once per thread with `allocate_match_context` and passed to the `_ctx` matching functions, so that
+ * matching many blocks of points does not allocate per block. Buffers grow if a call needs more than the
+ * `Parameters` they were sized from.
+ */
+typedef struct {
+    CorrContext corr;            /*!< \brief Correlation scratch of the calling thread */
+    int32_t capacity;            /*!< \brief Points the per-point buffers hold */
+    size_t template_pixels;      /*!< \brief Pixels of one template in `template_buffer` */
+    uint8_t *template_buffer;    /*!< \brief One template per point */
+    CorrTask *tasks;             /*!< \brief One correlation per point */
+    CorrResult *results;         /*!< \brief Result of each task */
+    int32_t *task_points;        /*!< \brief Point index of each task */
+    double *task_subpixel;       /*!< \brief Subpixel offset of each task template */
+    FeatureSet block;            /*!< \brief Points of one sliding window block, their matches and correlations */
+    CorrDeviceImage *device_search; /*!< \brief Device copy of the search image, or NULL to search on the CPU */
+    int32_t corr_threads;        /*!< \brief Threads of each correlation batch. If 0, `parallel_num_threads()` */
+    const NanMask *template_nan; /*!< \brief If not NULL, counts the no-data pixels of templates instead of `template_mask` */
+    const NanMask *search_nan;   /*!< \brief If not NULL, counts the no-data pixels of search windows instead of `search_mask` */
+    const TimeBudget *budget;    /*!< \brief If not NULL, features are correlated in point order until the budget ends */
+    BudgetStatus status;         /*!< \brief Set by each `_ctx` call, `BUDGET_COMPLETE` unless `budget` ended first */
+} MatchContext;
+
+/**
+ * \brief Matches of the sliding window points of `MatchFeaturesWithLocalDistortion`
+ *
+ * When `block_size` is a multiple of `step_size`, neighbouring blocks share the points on their common border. The
+ * grid holds one match per distinct point, so each is correlated once and reused by the local RANSAC of every block
+ * containing it. A grid filled by `MatchFeaturesWithLocalDistortion_grid` can be passed again, with the same
+ * landmarks and matching parameters, to try other RANSAC or inlier settings without correlating again.
+ */
+typedef struct {
+    int32_t block_size;          /*!< \brief `block_size` the grid is laid out for */
+    int32_t step_size;           /*!< \brief `step_size` the grid is laid out for */
+    int32_t points_per_side;     /*!< \brief Points along one side of a block */
+    int32_t block_stride;        /*!< \brief Grid points between the first points of neighbouring blocks */
+    int32_t blocks_per_row;      /*!< \brief Blocks across the child landmark */
+    int32_t num_blocks;          /*!< \brief Blocks in the child landmark */
+    int32_t cols;                /*!< \brief Grid points per row */
+    int32_t rows;                /*!< \brief Grid rows */
+    uint8_t *matched;            /*!< \brief 1 if the point has a match */
+    double *base_points;         /*!< \brief Base landmark position of each match */
+    double *covariances;         /*!< \brief Correlation of each match */
+    uint8_t *block_matched;      /*!< \brief 1 once the points of a block are in the grid */
+    int32_t first_block_row;     /*!< \brief Block row of the child landmark within a larger map it was cut from, 0 by default.
+                                      With `seeded_ransac`, the local RANSAC of each block is seeded by its position
+                                      in that map */
+    int32_t first_block_col;     /*!< \brief Block column of the child landmark within that map, 0 by default */
+    struct MatchJournal *journal; /*!< \brief If not NULL, the blocks are appended to this journal as they are
+                                       accumulated, see `open_match_journal` */
+} MatchGrid;
+
+/**
+ * \brief Base landmark side of `MatchFeaturesWithLocalDistortion`, built once for any number of child landmarks
+ *
+ * Holds the no-data mask, window sums and device copy of the base that every block of every comparison searches.
+ * The base landmark must outlive it and stay unchanged.
+ */
+typedef struct {
+    LMK *landmark;               /*!< \brief Base landmark */
+    int32_t max_nan_count;       /*!< \brief Maximum allowed NaN values in base landmark window */
+    const NanMask *nan_mask;     /*!< \brief No-data mask layer of the base, with window counts if `max_nan_count` >= 0 */
+    bool have_integral;          /*!< \brief True if `integral` was built */
+    CorrIntegralImage integral;  /*!< \brief Window sums of the base surface reflectance */
+    CorrDeviceImage *device_search; /*!< \brief Device copy of the base surface reflectance, or NULL */
+} MatchBase;
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
+/**
+ * \brief Allocate the scratch memory of the matching functions
+ *
+ * \param[out] ctx Context. Release with `free_match_context`
+ * \param[in] parameters Window sizes the buffers are sized from
+ * \param[in] max_points Points per call. If 0, the points of one sliding window block
+ * \return false if memory allocation fails
+ */
+bool allocate_match_context(MatchContext *ctx, const Parameters *parameters, int32_t max_points);
+
+/**
+ * \brief Release the memory of a `MatchContext`
+ */
+void free_match_context(MatchContext *ctx);
+
 /**
  * \brief Apply sliding window correlation matcher for each pixel in template_image to find closest match in search_image.
  * 
@@ -116,6 +210,64 @@ int32_t MatchFeaturesWithNaNHandling(
     int32_t num_points
 );
 
+/**
+ * \brief Same as MatchFeaturesWithNaNHandling, with precomputed window sums of the search image
+ *
+ * Callers that match many batches of points against the same search image build `search_integral` once with
+ * `corr_integral_image_build` and pass it to every call.
+ *
+ * \param[in] search_integral Summed-area tables of search_image, or NULL to compute window sums per feature
+ */
+int32_t MatchFeaturesWithSearchIntegral(
+    Parameters parameters,
+    uint8_t *template_image,
+    uint8_t *template_mask,
+    size_t template_cols,
+    size_t template_rows,
+    int32_t max_nan_count_template,
+    uint8_t *search_image,
+    uint8_t *search_mask,
+    size_t search_cols,
+    size_t search_rows,
+    int32_t max_nan_count_search,
+    const CorrIntegralImage *search_integral,
+    double initial_homography[3][3],
+    double *template_points,
+    double *matched_points,
+    double *correlation_values,
+    int32_t num_points
+);
+
+/**
+ * \brief Same as MatchFeaturesWithSearchIntegral, with scratch memory taken from `ctx`
+ *
+ * With `ctx->budget` set, features are correlated `MATCH_BUDGET_CHUNK` at a time in the order of `template_points`,
+ * so callers pass the strongest features first. Once the budget ends, the matches of the features correlated so
+ * far are returned and `ctx->status` tells why the call stopped.
+ *
+ * \param[in,out] ctx Scratch memory from `allocate_match_context`. Must not be shared between threads
+ */
+int32_t MatchFeaturesWithSearchIntegral_ctx(
+    MatchContext *ctx,
+    Parameters parameters,
+    uint8_t *template_image,
+    uint8_t *template_mask,
+    size_t template_cols,
+    size_t template_rows,
+    int32_t max_nan_count_template,
+    uint8_t *search_image,
+    uint8_t *search_mask,
+    size_t search_cols,
+    size_t search_rows,
+    int32_t max_nan_count_search,
+    const CorrIntegralImage *search_integral,
+    double initial_homography[3][3],
+    double *template_points,
+    double *matched_points,
+    double *correlation_values,
+    int32_t num_points
+);
+
 /**
  * \brief Match features between two landmarks with local distortion handling
  * 
@@ -140,6 +292,132 @@ bool MatchFeaturesWithLocalDistortion(
     int32_t max_nan_count_child
 );
 
+/**
+ * \brief Estimated peak bytes of `MatchFeaturesWithLocalDistortion`, for landmarks of the sizes of two headers
+ *
+ * Counts both landmarks, the output maps and the no-data masks, window sums and splat accumulator of the
+ * matching, which are the allocations that grow with the maps. Buffers per block or per thread are left out.
+ *
+ * \param[in] parameters Configuration parameters for feature matching
+ * \param[in] base_header Size of the base landmark
+ * \param[in] child_header Size of the child landmark
+ * \param[in] max_nan_count_base Maximum allowed NaN values in base landmark window
+ * \param[in] max_nan_count_child Maximum allowed NaN values in child landmark window
+ * \return bytes
+ */
+size_t MatchFeaturesWithLocalDistortion_memory(
+    const Parameters *parameters,
+    const LMK *base_header,
+    const LMK *child_header,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child
+);
+
+/**
+ * \brief Allocate an empty `MatchGrid` for the sliding window blocks of a child landmark
+ *
+ * \param[out] grid Grid. Release with `free_match_grid`
+ * \param[in] parameters `block_size` and `step_size` of the blocks
+ * \param[in] num_cols Columns of the child landmark
+ * \param[in] num_rows Rows of the child landmark
+ * \return false if memory allocation fails or the block layout is invalid
+ */
+bool allocate_match_grid(MatchGrid *grid, const Parameters *parameters, int32_t num_cols, int32_t num_rows);
+
+/**
+ * \brief Release the memory of a `MatchGrid`
+ */
+void free_match_grid(MatchGrid *grid);
+
+/**
+ * \brief Same as `MatchFeaturesWithLocalDistortion`, keeping the matches in `grid`
+ *
+ * Blocks already in the grid are not matched again, only their local homography and inliers are recomputed.
+ * \param[in,out] grid Matches of the sliding window points, from `allocate_match_grid` with the same parameters
+ * \return false if the grid does not fit the parameters and landmark, or memory allocation fails
+ */
+bool MatchFeaturesWithLocalDistortion_grid(
+    Parameters parameters,
+    LMK *base_landmark,
+    LMK *child_landmark,
+    CorrelationResults *results,
+    int32_t max_nan_count_base,
+    int32_t max_nan_count_child,
+    MatchGrid *grid
+);
+
+/**
+ * \brief Build the base landmark side of `MatchFeaturesWithLocalDistortion`
+ *
+ * \param[out] base Release with `free_match_base`
+ * \param[in] base_landmark Base landmark, kept by reference
+ * \param[in] max_nan_count_base Maximum allowed NaN values in base landmark window
+ * \return false if memory allocation fails
+ */
+bool prepare_match_base(MatchBase *base, LMK *base_landmark, int32_t max_nan_count_base);
+
+/**
+ * \brief Release the memory of a `MatchBase`
+ */
+void free_match_base(MatchBase *base);
+
+/**
+ * \brief Same as `MatchFeaturesWithLocalDistortion_grid`, with a base prepared by `prepare_match_base`
+ *
+ * Calls with different child landmarks may share one base, one after another.
+ * \param[in] base Prepared base landmark
+ * \param[in,out] grid Matches of the sliding window points, from `allocate_match_grid` with the same parameters
+ * \return false if the grid does not fit the parameters and landmark, or memory allocation fails
+ */
+bool MatchFeaturesWithLocalDistortion_base(
+    Parameters parameters,
+    const MatchBase *base,
+    LMK *child_landmark,
+    CorrelationResults *results,
+    int32_t max_nan_count_child,
+    MatchGrid *grid
+);
+
+/**
+ * \brief Same as `MatchFeaturesWithLocalDistortion_base`, keeping the inliers of the local homographies instead of
+ * the dense maps
+ *
+ * The inliers are appended to `matches` in block order, then in the order of the points of each block.
+ * `densify_sparse_matches` turns them into the maps of `MatchFeaturesWithLocalDistortion_base`.
+ * \param[in] base Prepared base landmark
+ * \param[in,out] matches List the inliers are appended to, from `allocate_sparse_matches`
+ * \param[in,out] grid Matches of the sliding window points, from `allocate_match_grid` with the same parameters
+ * \return false if the grid does not fit the parameters and landmark, or memory allocation fails
+ */
+bool MatchFeaturesWithLocalDistortion_sparse(
+    Parameters parameters,
+    const MatchBase *base,
+    LMK *child_landmark,
+    SparseMatches *matches,
+    int32_t max_nan_count_child,
+    MatchGrid *grid
+);
+
+/**
+ * \brief Build the dense maps of a list of matches
+ *
+ * Each match is spread over its `feature_influence_window` and deltas larger than `max_delta_map` are
+ * discarded, as in `MatchFeaturesWithLocalDistortion`.
+ * \param[in] parameters configuration settings of the comparison
+ * \param[in] matches Matches from `MatchFeaturesWithLocalDistortion_sparse`
+ * \param[in] num_cols Width of the child landmark
+ * \param[in] num_rows Height of the child landmark
+ * \param[out] results Dense maps, allocated for num_cols x num_rows pixels
+ * \return false if memory allocation fails
+ */
+bool densify_sparse_matches(
+    Parameters parameters,
+    const SparseMatches *matches,
+    int32_t num_cols,
+    int32_t num_rows,
+    CorrelationResults *results
+);
+
 /**
  * \brief Process a matched feature point and update the correlation results
  * 
@@ -0,0 +1,100 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>    // for printf
+#include <stdlib.h>   // for malloc, free
+#include <string.h>   // for memcpy, memset
+
+#include "landmark_tools/feature_tracking/feature_set.h"
+
+/**
+ * \brief Place the columns of a set of `capacity` features in one block
+ *
+ * \param arena Block of the columns, aligned on a cache line, or NULL to only compute its size
+ * \return bytes of the block
+ */
+static size_t layout_columns(FeatureSet *set, int32_t capacity, uint8_t *arena)
+{
+    size_t num_features = (size_t)capacity;
+    size_t offset = 0;
+    // Each column starts on a cache line
+#define FEATURE_COLUMN(field, bytes) do { \
+        offset = (offset + 63) & ~(size_t)63; \
+        if (arena != NULL) set->field = (void *)(arena + offset); \
+        offset += (bytes); \
+    } while (0)
+    FEATURE_COLUMN(points, sizeof(double) * 2 * num_features);
+    FEATURE_COLUMN(matches, sizeof(double) * 2 * num_features);
+    FEATURE_COLUMN(scores, sizeof(double) * num_features);
+    FEATURE_COLUMN(strengths, sizeof(float) * num_features);
+    FEATURE_COLUMN(keep, sizeof(uint8_t) * num_features);
+#undef FEATURE_COLUMN
+    return offset;
+}
+
+bool feature_set_reserve(FeatureSet *set, int32_t capacity)
+{
+    if (capacity <= set->capacity) return true;
+    size_t bytes = layout_columns(set, capacity, NULL) + 63;
+    void *arena = malloc(bytes);
+    if (arena == NULL) {
+        printf("feature_set_reserve() ==>> memory allocation error\n");
+        return false;
+    }
+
+    FeatureSet grown = *set;
+    grown.capacity = capacity;
+    grown.bytes = bytes;
+    grown.arena = arena;
+    layout_columns(&grown, capacity, (uint8_t *)(((uintptr_t)arena + 63) & ~(uintptr_t)63));
+    if (set->arena != NULL && set->count > 0) {
+        size_t count = (size_t)set->count;
+        memcpy(grown.points, set->points, sizeof(double) * 2 * count);
+        memcpy(grown.matches, set->matches, sizeof(double) * 2 * count);
+        memcpy(grown.scores, set->scores, sizeof(double) * count);
+        memcpy(grown.strengths, set->strengths, sizeof(float) * count);
+        memcpy(grown.keep, set->keep, sizeof(uint8_t) * count);
+    }
+    free(set->arena);
+    *set = grown;
+    return true;
+}
+
+void feature_set_free(FeatureSet *set)
+{
+    free(set->arena);
+    memset(set, 0, sizeof(FeatureSet));
+}
+
+int32_t feature_set_compact(FeatureSet *set)
+{
+    int32_t kept = 0;
+    for (int32_t i = 0; i < set->count; i++) {
+        if (!set->keep[i]) continue;
+        if (kept != i) {
+            set->points[kept * 2] = set->points[i * 2];
+            set->points[kept * 2 + 1] = set->points[i * 2 + 1];
+            set->matches[kept * 2] = set->matches[i * 2];
+            set->matches[kept * 2 + 1] = set->matches[i * 2 + 1];
+            set->scores[kept] = set->scores[i];
+            set->strengths[kept] = set->strengths[i];
+            set->keep[kept] = 1;
+        }
+        kept++;
+    }
+    set->count = kept;
+    return kept;
+}
@@ -0,0 +1,79 @@
+/**
+ * \file feature_set.h
+ * \brief Features of one matching step, one column per attribute held in a single block
+ *
+ * Detection, correlation, RANSAC and splatting read and write the columns of the same set, so the features are not
+ * copied between layouts from one step to the next. Positions are columns of x, y pairs, the layout the correlation
+ * and homography functions take, and each other attribute is a column of its own. Every column starts on a cache
+ * line, so loops over one attribute read contiguous memory.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_FEATURE_SET_H_
+#define _LANDMARK_TOOLS_FEATURE_SET_H_
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for int32_t, uint8_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Set of features and their matches
+ *
+ * Zero-initialize, then size with `feature_set_reserve`. The columns grow if a step needs more features, and keep
+ * the first `count` features when they do. Must not be shared between threads.
+ */
+typedef struct {
+    int32_t count;               /*!< \brief Features in the set */
+    int32_t capacity;            /*!< \brief Features the columns hold */
+    size_t bytes;                /*!< \brief Bytes of `arena` */
+    void *arena;                 /*!< \brief Block holding the columns below */
+    double *points;              /*!< \brief x, y of each feature in the image it was found in */
+    double *matches;             /*!< \brief x, y of the match of each feature in the other image */
+    double *scores;              /*!< \brief Correlation of each match */
+    float *strengths;            /*!< \brief Detector interest of each feature */
+    uint8_t *keep;               /*!< \brief Nonzero for the features `feature_set_compact` keeps */
+} FeatureSet;
+
+/**
+ * \brief Grow the columns of a set to hold `capacity` features
+ *
+ * \param[in,out] set Feature set. Release with `feature_set_free`
+ * \param[in] capacity Features the columns must hold
+ * \return false if memory allocation fails, the set is left unchanged
+ */
+bool feature_set_reserve(FeatureSet *set, int32_t capacity);
+
+/**
+ * \brief Release the memory of a FeatureSet
+ */
+void feature_set_free(FeatureSet *set);
+
+/**
+ * \brief Move the features whose `keep` is nonzero to the front of the columns, in the same order
+ *
+ * \return features left in the set
+ */
+int32_t feature_set_compact(FeatureSet *set);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_FEATURE_SET_H_ */
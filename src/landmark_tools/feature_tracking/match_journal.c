@@ -0,0 +1,312 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>     // for NAN, isnan
+#include <stdlib.h>   // for calloc, free, malloc
+#include <string.h>   // for memcmp, memcpy, memset
+#if defined(LINUX_OS) || defined(MAC_OS)
+#include <unistd.h>   // for fsync, ftruncate
+#endif
+
+#include "landmark_tools/feature_tracking/match_journal.h"
+#include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/time_budget.h"
+
+#define JOURNAL_MAGIC "LMKJRNL1"
+#define JOURNAL_MAGIC_SIZE 8
+#define JOURNAL_BYTE_ORDER 0x0102030405060708LL
+#define JOURNAL_NUM_FIELDS 21
+
+/**
+ * \brief 64-bit hash of a buffer, eight bytes at a time
+ */
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(uint64_t));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * \brief Hash of the size and maps of a landmark
+ */
+static uint64_t hash_landmark(const LMK *lmk)
+{
+    size_t num_pixels = (size_t)lmk->num_cols * lmk->num_rows;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = hash_bytes(hash, &lmk->num_cols, sizeof(int32_t));
+    hash = hash_bytes(hash, &lmk->num_rows, sizeof(int32_t));
+    if (lmk->srm != NULL) hash = hash_bytes(hash, lmk->srm, num_pixels * sizeof(uint8_t));
+    if (lmk->ele != NULL) hash = hash_bytes(hash, lmk->ele, num_pixels * sizeof(float));
+    return hash;
+}
+
+/**
+ * \brief Fields of the journal header, which must all be equal to resume a comparison
+ */
+static void journal_fields(int64_t fields[JOURNAL_NUM_FIELDS], const Parameters *parameters,
+                           const LMK *base_landmark, const LMK *child_landmark, int32_t max_nan_count_base,
+                           int32_t max_nan_count_child, const MatchGrid *grid)
+{
+    uint32_t min_correlation_bits;
+    memcpy(&min_correlation_bits, &parameters->matching.min_correlation, sizeof(uint32_t));
+    int32_t k = 0;
+    fields[k++] = JOURNAL_BYTE_ORDER;
+    fields[k++] = child_landmark->num_cols;
+    fields[k++] = child_landmark->num_rows;
+    fields[k++] = base_landmark->num_cols;
+    fields[k++] = base_landmark->num_rows;
+    fields[k++] = grid->block_size;
+    fields[k++] = grid->step_size;
+    fields[k++] = grid->points_per_side;
+    fields[k++] = grid->block_stride;
+    fields[k++] = grid->first_block_row;
+    fields[k++] = grid->first_block_col;
+    fields[k++] = parameters->matching.correlation_window_size;
+    fields[k++] = parameters->matching.search_window_size;
+    fields[k++] = parameters->matching.pyramid_levels;
+    fields[k++] = parameters->matching.prune_search ? 1 : 0;
+    fields[k++] = parameters->matching.subpixel_model;
+    fields[k++] = max_nan_count_base;
+    fields[k++] = max_nan_count_child;
+    fields[k++] = min_correlation_bits;
+    fields[k++] = (int64_t)hash_landmark(child_landmark);
+    fields[k++] = (int64_t)hash_landmark(base_landmark);
+}
+
+/**
+ * \brief Grid indices of the points first reached by a block, in the order `match_block` samples them
+ *
+ * \param[out] indices At least points_per_side^2 indices
+ * \return number of points
+ */
+static int32_t block_point_indices(const MatchGrid *grid, int32_t block, size_t *indices)
+{
+    int32_t block_row = block / grid->blocks_per_row;
+    int32_t block_col = block % grid->blocks_per_row;
+    bool shared = grid->block_stride < grid->points_per_side;
+    int32_t num_points = 0;
+    for (int32_t j = 0; j < grid->points_per_side; j++) {
+        if (shared && j == 0 && block_row > 0) continue;
+        for (int32_t k = 0; k < grid->points_per_side; k++) {
+            if (shared && k == 0 && block_col > 0) continue;
+            indices[num_points++] = (size_t)(block_row * grid->block_stride + j) * grid->cols +
+                                    block_col * grid->block_stride + k;
+        }
+    }
+    return num_points;
+}
+
+/**
+ * \brief Bytes of the record of a block with `num_points` points
+ *
+ * A record is the block and point count as two int32, three doubles per point (base column and row, NAN if the point
+ * has no match, and covariance), then the hash of the preceding bytes.
+ */
+static size_t record_bytes(int32_t num_points)
+{
+    return 2 * sizeof(int32_t) + (size_t)num_points * 3 * sizeof(double) + sizeof(uint64_t);
+}
+
+/**
+ * \brief Read the records of a journal into the grid until the end of the file or the first damaged record
+ *
+ * \return offset of the end of the last whole record
+ */
+static long restore_records(MatchJournal *journal, FILE *fp, long offset, MatchGrid *grid, size_t *indices,
+                            uint8_t *record)
+{
+    for (;;) {
+        int32_t head[2];
+        if (fread(head, sizeof(int32_t), 2, fp) != 2) break;
+        int32_t block = head[0];
+        if (block < 0 || block >= grid->num_blocks) break;
+        int32_t num_points = block_point_indices(grid, block, indices);
+        if (head[1] != num_points) break;
+        size_t size = record_bytes(num_points);
+        memcpy(record, head, sizeof(head));
+        if (fread(record + sizeof(head), 1, size - sizeof(head), fp) != size - sizeof(head)) break;
+        uint64_t stored;
+        memcpy(&stored, record + size - sizeof(uint64_t), sizeof(uint64_t));
+        if (hash_bytes(0xcbf29ce484222325ULL, record, size - sizeof(uint64_t)) != stored) break;
+
+        const double *values = (const double *)(record + sizeof(head));
+        for (int32_t i = 0; i < num_points; i++) {
+            size_t index = indices[i];
+            grid->matched[index] = !isnan(values[i * 3]);
+            grid->base_points[index * 2] = values[i * 3];
+            grid->base_points[index * 2 + 1] = values[i * 3 + 1];
+            grid->covariances[index] = values[i * 3 + 2];
+        }
+        if (!journal->journaled[block]) journal->restored_blocks++;
+        grid->block_matched[block] = 1;
+        journal->journaled[block] = 1;
+        offset += (long)size;
+    }
+    return offset;
+}
+
+bool open_match_journal(MatchJournal *journal, const char *filename, const Parameters *parameters,
+                        const LMK *base_landmark, const LMK *child_landmark, int32_t max_nan_count_base,
+                        int32_t max_nan_count_child, MatchGrid *grid, double flush_seconds)
+{
+    memset(journal, 0, sizeof(MatchJournal));
+    journal->num_blocks = grid->num_blocks;
+    journal->flush_seconds = flush_seconds;
+    journal->journaled = (uint8_t *)calloc(grid->num_blocks > 0 ? grid->num_blocks : 1, sizeof(uint8_t));
+    int32_t max_points = grid->points_per_side * grid->points_per_side;
+    size_t *indices = (size_t *)malloc(sizeof(size_t) * max_points);
+    uint8_t *record = (uint8_t *)malloc(record_bytes(max_points));
+    if (journal->journaled == NULL || indices == NULL || record == NULL) {
+        printf("open_match_journal() ==>> memory allocation error\n");
+        free(indices);
+        free(record);
+        free(journal->journaled);
+        journal->journaled = NULL;
+        return false;
+    }
+
+    int64_t fields[JOURNAL_NUM_FIELDS];
+    journal_fields(fields, parameters, base_landmark, child_landmark, max_nan_count_base, max_nan_count_child, grid);
+    long header_size = (long)(JOURNAL_MAGIC_SIZE + sizeof(fields));
+
+    // Resume an existing journal of the same comparison, or start a new one
+    long offset = 0;
+    FILE *fp = fopen(filename, "r+b");
+    if (fp != NULL) {
+        char magic[JOURNAL_MAGIC_SIZE];
+        int64_t stored[JOURNAL_NUM_FIELDS];
+        bool is_journal = fread(magic, 1, JOURNAL_MAGIC_SIZE, fp) == JOURNAL_MAGIC_SIZE &&
+                          memcmp(magic, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) == 0 &&
+                          fread(stored, sizeof(int64_t), JOURNAL_NUM_FIELDS, fp) == JOURNAL_NUM_FIELDS;
+        if (!is_journal || memcmp(stored, fields, sizeof(fields)) != 0) {
+            SAFE_PRINTF(512, "open_match_journal() ==>> %s is not a journal of this comparison. Remove it to start "
+                        "over\n", filename);
+            fclose(fp);
+            free(indices);
+            free(record);
+            free(journal->journaled);
+            journal->journaled = NULL;
+            return false;
+        }
+        offset = restore_records(journal, fp, header_size, grid, indices, record);
+#if defined(LINUX_OS) || defined(MAC_OS)
+        // Drop a record cut short by the stop, so the next records follow the last whole one
+        fflush(fp);
+        if (ftruncate(fileno(fp), offset) != 0) {
+            SAFE_PRINTF(512, "open_match_journal() ==>> cannot truncate %s\n", filename);
+        }
+#endif
+        if (fseek(fp, offset, SEEK_SET) != 0) {
+            fclose(fp);
+            fp = NULL;
+        }
+        SAFE_PRINTF(512, "Restored %d of %d blocks from %s\n", journal->restored_blocks, grid->num_blocks, filename);
+    } else {
+        fp = fopen(filename, "wb");
+        if (fp != NULL && (fwrite(JOURNAL_MAGIC, 1, JOURNAL_MAGIC_SIZE, fp) != JOURNAL_MAGIC_SIZE ||
+                           fwrite(fields, sizeof(int64_t), JOURNAL_NUM_FIELDS, fp) != JOURNAL_NUM_FIELDS ||
+                           fflush(fp) != 0)) {
+            fclose(fp);
+            fp = NULL;
+        }
+    }
+    free(indices);
+    free(record);
+    if (fp == NULL) {
+        SAFE_PRINTF(512, "open_match_journal() ==>> cannot write %s\n", filename);
+        free(journal->journaled);
+        journal->journaled = NULL;
+        return false;
+    }
+    journal->fp = fp;
+    journal->last_flush = time_budget_now();
+    return true;
+}
+
+/**
+ * \brief Write the buffered records to disk
+ */
+static bool flush_journal(MatchJournal *journal)
+{
+    bool success = fflush(journal->fp) == 0;
+#if defined(LINUX_OS) || defined(MAC_OS)
+    success = success && fsync(fileno(journal->fp)) == 0;
+#endif
+    journal->dirty = false;
+    journal->last_flush = time_budget_now();
+    return success;
+}
+
+bool match_journal_append(MatchJournal *journal, const MatchGrid *grid, int32_t block)
+{
+    if (journal->fp == NULL || block < 0 || block >= journal->num_blocks || grid->num_blocks != journal->num_blocks) {
+        return false;
+    }
+    if (journal->journaled[block]) return true;
+
+    int32_t max_points = grid->points_per_side * grid->points_per_side;
+    size_t indices[max_points];
+    int32_t num_points = block_point_indices(grid, block, indices);
+    size_t size = record_bytes(num_points);
+    uint8_t *record = (uint8_t *)malloc(size);
+    if (record == NULL) {
+        printf("match_journal_append() ==>> memory allocation error\n");
+        return false;
+    }
+    int32_t head[2] = {block, num_points};
+    memcpy(record, head, sizeof(head));
+    double *values = (double *)(record + sizeof(head));
+    for (int32_t i = 0; i < num_points; i++) {
+        size_t index = indices[i];
+        values[i * 3] = grid->matched[index] ? grid->base_points[index * 2] : NAN;
+        values[i * 3 + 1] = grid->matched[index] ? grid->base_points[index * 2 + 1] : NAN;
+        values[i * 3 + 2] = grid->matched[index] ? grid->covariances[index] : 0.0;
+    }
+    uint64_t hash = hash_bytes(0xcbf29ce484222325ULL, record, size - sizeof(uint64_t));
+    memcpy(record + size - sizeof(uint64_t), &hash, sizeof(uint64_t));
+    bool success = fwrite(record, 1, size, journal->fp) == size;
+    free(record);
+    if (!success) return false;
+    journal->journaled[block] = 1;
+    journal->dirty = true;
+
+    if (time_budget_now() - journal->last_flush >= journal->flush_seconds) {
+        return flush_journal(journal);
+    }
+    return true;
+}
+
+bool close_match_journal(MatchJournal *journal)
+{
+    bool success = true;
+    if (journal->fp != NULL) {
+        if (journal->dirty) success = flush_journal(journal);
+        success = (fclose(journal->fp) == 0) && success;
+    }
+    free(journal->journaled);
+    memset(journal, 0, sizeof(MatchJournal));
+    return success;
+}
@@ -0,0 +1,101 @@
+/**
+ * \file match_journal.h
+ * \brief Checkpoint journal of the sliding window blocks of a comparison, to resume it after it was stopped
+ *
+ * The journal is a header describing the comparison followed by one record per matched block, holding the grid
+ * points the block matched. Records are appended as blocks are accumulated and flushed to disk at an interval, so a
+ * comparison that is stopped loses at most the blocks of the last interval. Opening the journal of the same
+ * comparison again restores its blocks into a `MatchGrid`, and `MatchFeaturesWithLocalDistortion_grid` then only
+ * matches the other blocks. The local homographies and dense maps are recomputed from the grid, which is quick next
+ * to the correlation, and are the same as those of a comparison that was not stopped.
+ *
+ * A record cut short by the stop is detected by its checksum and dropped.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_MATCH_JOURNAL_H_
+#define _LANDMARK_TOOLS_MATCH_JOURNAL_H_
+
+#include <stdbool.h>  // for bool
+#include <stdint.h>   // for int32_t, uint8_t
+#include <stdio.h>    // for FILE
+
+#include "landmark_tools/feature_tracking/feature_match.h"  // for MatchGrid
+#include "landmark_tools/feature_tracking/parameters.h"     // for Parameters
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK
+
+#define MATCH_JOURNAL_FLUSH_SECONDS 60.0  /*!< \brief Default interval between flushes of the journal to disk */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Open journal of a comparison
+ */
+typedef struct MatchJournal {
+    FILE *fp;                    /*!< \brief Journal file, positioned after its last whole record */
+    uint8_t *journaled;          /*!< \brief 1 for the blocks of the grid that are in the journal */
+    int32_t num_blocks;          /*!< \brief Blocks of the grid */
+    int32_t restored_blocks;     /*!< \brief Blocks read back from the journal when it was opened */
+    double flush_seconds;        /*!< \brief Interval between flushes to disk */
+    double last_flush;           /*!< \brief `time_budget_now` of the last flush */
+    bool dirty;                  /*!< \brief Records were written since the last flush */
+} MatchJournal;
+
+/**
+ * \brief Open or create the journal of a comparison and restore its blocks into `grid`
+ *
+ * An existing journal must have been written for the same landmarks, block layout, matching parameters and NaN
+ * counts. A journal of another comparison is left untouched and the call fails.
+ *
+ * \param[out] journal Open journal. Release with `close_match_journal`
+ * \param[in] filename Journal file
+ * \param[in] parameters configuration settings of the comparison
+ * \param[in] base_landmark Base landmark
+ * \param[in] child_landmark Child landmark
+ * \param[in] max_nan_count_base Maximum allowed NaN values in base landmark window
+ * \param[in] max_nan_count_child Maximum allowed NaN values in child landmark window
+ * \param[in,out] grid Grid of the comparison, from `allocate_match_grid`. The blocks of the journal are marked matched
+ * \param[in] flush_seconds Interval between flushes to disk, 0 to flush every block
+ * \return false if the file cannot be read or written, belongs to another comparison or memory allocation fails
+ */
+bool open_match_journal(MatchJournal *journal, const char *filename, const Parameters *parameters,
+                        const LMK *base_landmark, const LMK *child_landmark, int32_t max_nan_count_base,
+                        int32_t max_nan_count_child, MatchGrid *grid, double flush_seconds);
+
+/**
+ * \brief Append a matched block of the grid, unless it is in the journal already
+ *
+ * Called by `MatchFeaturesWithLocalDistortion_grid` for each block as it is accumulated, when `MatchGrid::journal` is
+ * set. The journal is flushed to disk when `flush_seconds` have passed since the last flush.
+ *
+ * \return false on io error
+ */
+bool match_journal_append(MatchJournal *journal, const MatchGrid *grid, int32_t block);
+
+/**
+ * \brief Flush the journal to disk and close it
+ *
+ * \return false on io error
+ */
+bool close_match_journal(MatchJournal *journal);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_MATCH_JOURNAL_H_ */
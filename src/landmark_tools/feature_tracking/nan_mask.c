@@ -0,0 +1,189 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "landmark_tools/feature_tracking/nan_mask.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
+#include "landmark_tools/utils/safe_string.h"
+
+static inline int32_t popcount64(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(word);
+#else
+    int32_t count = 0;
+    for (; word != 0; word &= word - 1) count++;
+    return count;
+#endif
+}
+
+/**
+ \brief Allocate zeroed bits for a mask
+*/
+static bool nan_mask_allocate(NanMask *mask, int32_t cols, int32_t rows)
+{
+    memset(mask, 0, sizeof(NanMask));
+    if (cols < 1 || rows < 1) {
+        SAFE_PRINTF(256, "nan_mask_allocate() ==>> invalid mask size %d x %d\n", cols, rows);
+        return false;
+    }
+    mask->cols = cols;
+    mask->rows = rows;
+    mask->words_per_row = ((size_t)cols + 63) / 64;
+    mask->bits = (uint64_t *)mem_calloc(MEM_MATCHING, mask->words_per_row * rows, sizeof(uint64_t));
+    if (mask->bits == NULL) {
+        SAFE_PRINTF(256, "nan_mask_allocate() ==>> memory allocation error\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ \brief Build the summed-area table of the bits of a mask
+*/
+static bool nan_mask_build_counts(NanMask *mask)
+{
+    size_t stride = (size_t)mask->cols + 1;
+    mask->counts = (uint32_t *)mem_malloc(MEM_MATCHING, sizeof(uint32_t) * stride * (mask->rows + 1));
+    if (mask->counts == NULL) {
+        SAFE_PRINTF(256, "nan_mask_build_counts() ==>> memory allocation error\n");
+        nan_mask_free(mask);
+        return false;
+    }
+    memset(mask->counts, 0, sizeof(uint32_t) * stride);
+    for (int32_t row = 0; row < mask->rows; row++) {
+        const uint32_t *above = &mask->counts[(size_t)row * stride];
+        uint32_t *counts = &mask->counts[(size_t)(row + 1) * stride];
+        uint32_t row_count = 0;
+        counts[0] = 0;
+        for (int32_t col = 0; col < mask->cols; col++) {
+            row_count += nan_mask_test(mask, col, row);
+            counts[col + 1] = above[col + 1] + row_count;
+        }
+    }
+    return true;
+}
+
+bool nan_mask_from_floats(NanMask *mask, const float *values, int32_t cols, int32_t rows, bool with_counts)
+{
+    if (!nan_mask_allocate(mask, cols, rows)) return false;
+    PERF_PHASE_BEGIN(timer, PERF_MASK);
+    for (int32_t row = 0; row < rows; row++) {
+        uint64_t *bits = &mask->bits[(size_t)row * mask->words_per_row];
+        const float *row_values = &values[(size_t)row * cols];
+        for (int32_t col = 0; col < cols; col++) {
+            if (isnan(row_values[col])) bits[col >> 6] |= (uint64_t)1 << (col & 63);
+        }
+    }
+    bool success = !with_counts || nan_mask_build_counts(mask);
+    PERF_PHASE_END(timer);
+    return success;
+}
+
+bool nan_mask_from_bytes(NanMask *mask, const uint8_t *bytes, int32_t cols, int32_t rows, bool with_counts)
+{
+    if (!nan_mask_allocate(mask, cols, rows)) return false;
+    PERF_PHASE_BEGIN(timer, PERF_MASK);
+    for (int32_t row = 0; row < rows; row++) {
+        uint64_t *bits = &mask->bits[(size_t)row * mask->words_per_row];
+        const uint8_t *row_bytes = &bytes[(size_t)row * cols];
+        for (int32_t col = 0; col < cols; col++) {
+            if (row_bytes[col] != 0) bits[col >> 6] |= (uint64_t)1 << (col & 63);
+        }
+    }
+    bool success = !with_counts || nan_mask_build_counts(mask);
+    PERF_PHASE_END(timer);
+    return success;
+}
+
+size_t nan_mask_bytes(int32_t cols, int32_t rows, bool with_counts)
+{
+    if (cols < 1 || rows < 1) return 0;
+    size_t bytes = sizeof(uint64_t) * (((size_t)cols + 63) / 64) * rows;
+    if (with_counts) bytes += sizeof(uint32_t) * ((size_t)cols + 1) * ((size_t)rows + 1);
+    return bytes;
+}
+
+void nan_mask_free(NanMask *mask)
+{
+    mem_free(mask->bits);
+    mem_free(mask->counts);
+    memset(mask, 0, sizeof(NanMask));
+}
+
+static void release_nan_layer(void *data)
+{
+    nan_mask_free((NanMask *)data);
+    free(data);
+}
+
+const NanMask *lmk_nan_mask_layer(LMK *lmk, bool with_counts)
+{
+    const NanMask *mask = (const NanMask *)LMK_Layer(lmk, LMK_LAYER_NAN_COUNTS);
+    if (mask == NULL && !with_counts) mask = (const NanMask *)LMK_Layer(lmk, LMK_LAYER_NAN_MASK);
+    if (mask != NULL) return mask;
+
+    NanMask *built = (NanMask *)malloc(sizeof(NanMask));
+    if (built == NULL || !nan_mask_from_floats(built, lmk->ele, lmk->num_cols, lmk->num_rows, with_counts)) {
+        free(built);
+        return NULL;
+    }
+    return (const NanMask *)LMK_Set_Layer(lmk, with_counts ? LMK_LAYER_NAN_COUNTS : LMK_LAYER_NAN_MASK, built,
+                                          release_nan_layer);
+}
+
+int32_t nan_mask_count(const NanMask *mask, int32_t left, int32_t top, int32_t width, int32_t height)
+{
+    if (width <= 0 || height <= 0) return 0;
+    int32_t first_col = left > 0 ? left : 0;
+    int32_t first_row = top > 0 ? top : 0;
+    int32_t end_col = left + width < mask->cols ? left + width : mask->cols;
+    int32_t end_row = top + height < mask->rows ? top + height : mask->rows;
+    if (end_col <= first_col || end_row <= first_row) return width * height;
+    int32_t outside = width * height - (end_col - first_col) * (end_row - first_row);
+
+    if (mask->counts != NULL) {
+        size_t stride = (size_t)mask->cols + 1;
+        const uint32_t *top_counts = &mask->counts[(size_t)first_row * stride];
+        const uint32_t *bottom_counts = &mask->counts[(size_t)end_row * stride];
+        return outside + (int32_t)(bottom_counts[end_col] - top_counts[end_col] -
+                                   bottom_counts[first_col] + top_counts[first_col]);
+    }
+
+    // Whole words between the partial first and last word of each row
+    size_t first_word = first_col >> 6;
+    size_t last_word = (end_col - 1) >> 6;
+    uint64_t first_bits = ~(uint64_t)0 << (first_col & 63);
+    uint64_t last_bits = ~(uint64_t)0 >> (63 - ((end_col - 1) & 63));
+    int32_t count = outside;
+    for (int32_t row = first_row; row < end_row; row++) {
+        const uint64_t *bits = &mask->bits[(size_t)row * mask->words_per_row];
+        if (first_word == last_word) {
+            count += popcount64(bits[first_word] & first_bits & last_bits);
+            continue;
+        }
+        count += popcount64(bits[first_word] & first_bits);
+        for (size_t word = first_word + 1; word < last_word; word++) {
+            count += popcount64(bits[word]);
+        }
+        count += popcount64(bits[last_word] & last_bits);
+    }
+    return count;
+}
@@ -0,0 +1,115 @@
+/**
+ * \file nan_mask.h
+ * \brief Packed no-data masks with constant time window counts
+ *
+ * One bit per pixel marks the pixels without data. The optional summed-area table of those bits gives the number of
+ * no-data pixels of any window from four lookups, so the `max_nan_count_*` tests of the matching functions do not
+ * depend on the window size. Without the table windows are counted 64 pixels at a time from the bits.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_NAN_MASK_H_
+#define _LANDMARK_TOOLS_NAN_MASK_H_
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for int32_t, uint32_t, uint64_t
+
+#include "landmark_tools/landmark_util/landmark.h"  // for LMK
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief No-data mask of an image
+ */
+typedef struct {
+    int32_t cols;                /**< Image width */
+    int32_t rows;                /**< Image height */
+    size_t words_per_row;        /**< 64 bit words of each row of `bits` */
+    uint64_t *bits;              /**< Bit `col % 64` of word `col / 64` of a row is set if the pixel has no data */
+    uint32_t *counts;            /**< (cols+1) x (rows+1) summed-area table of `bits`, or NULL */
+} NanMask;
+
+/**
+ * \brief Build the mask of the NAN values of a float image, such as the elevation of a landmark
+ *
+ * \param[out] mask Mask. Release with `nan_mask_free`
+ * \param[in] values cols x rows image
+ * \param[in] cols Image width
+ * \param[in] rows Image height
+ * \param[in] with_counts If true, also build the summed-area table
+ * \return false if memory allocation fails
+ */
+bool nan_mask_from_floats(NanMask *mask, const float *values, int32_t cols, int32_t rows, bool with_counts);
+
+/**
+ * \brief Build a mask from a byte mask, 0 where the image has data
+ *
+ * \param[out] mask Mask. Release with `nan_mask_free`
+ * \param[in] bytes cols x rows byte mask
+ * \param[in] cols Image width
+ * \param[in] rows Image height
+ * \param[in] with_counts If true, also build the summed-area table
+ * \return false if memory allocation fails
+ */
+bool nan_mask_from_bytes(NanMask *mask, const uint8_t *bytes, int32_t cols, int32_t rows, bool with_counts);
+
+/**
+ * \brief Release the memory of a mask
+ */
+void nan_mask_free(NanMask *mask);
+
+/**
+ * \brief Mask of the elevation of a landmark, kept with it as a derived layer
+ *
+ * The mask is built on the first call and returned by later ones until the elevation changes, see `LMK_Layer`. A
+ * mask with window counts also serves the calls that do not need them.
+ * \param[in,out] lmk landmark
+ * \param[in] with_counts If true, the mask has the summed-area table
+ * \return the mask owned by the landmark, or NULL if memory allocation fails
+ */
+const NanMask *lmk_nan_mask_layer(LMK *lmk, bool with_counts);
+
+/**
+ * \brief Bytes held by a mask of a cols x rows image
+ */
+size_t nan_mask_bytes(int32_t cols, int32_t rows, bool with_counts);
+
+/**
+ * \brief Number of no-data pixels in a window. Window pixels outside the image count as no data
+ *
+ * \param[in] left Left column of the window
+ * \param[in] top Top row of the window
+ * \param[in] width Window width
+ * \param[in] height Window height
+ */
+int32_t nan_mask_count(const NanMask *mask, int32_t left, int32_t top, int32_t width, int32_t height);
+
+/**
+ * \brief True if the pixel at (col, row), inside the image, has no data
+ */
+static inline bool nan_mask_test(const NanMask *mask, int32_t col, int32_t row)
+{
+    return (mask->bits[(size_t)row * mask->words_per_row + (col >> 6)] >> (col & 63)) & 1;
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_NAN_MASK_H_ */
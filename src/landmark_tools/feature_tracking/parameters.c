@@ -15,6 +15,7 @@
  */
 
 #include "landmark_tools/feature_tracking/parameters.h"
+#include "landmark_tools/feature_tracking/corr_subpixel.h"
 #include "landmark_tools/utils/safe_string.h"
 
 #include <stdio.h>          // for sscanf, fprintf, fopen, fgets, printf, FILE
@@ -29,6 +30,9 @@ void load_default_parameters (Parameters *ftParms)
     ftParms->matching.correlation_window_size = DEFAULT_CORRELATION_WINDOW_SIZE;
     ftParms->matching.search_window_size      = DEFAULT_SEARCH_WINDOW_SIZE;
     ftParms->matching.min_correlation         = (float)DEFAULT_MIN_CORRELATION;
+    ftParms->matching.pyramid_levels          = DEFAULT_PYRAMID_LEVELS;
+    ftParms->matching.prune_search            = DEFAULT_PRUNE_SEARCH;
+    ftParms->matching.subpixel_model          = DEFAULT_SUBPIXEL_MODEL;
     
     // Sliding window parameters
     ftParms->sliding.block_size               = DEFAULT_BLOCK_SIZE;
@@ -37,6 +41,10 @@ void load_default_parameters (Parameters *ftParms)
     ftParms->sliding.feature_influence_window = DEFAULT_FEATURE_INFLUENCE_WINDOW;
     ftParms->sliding.reprojection_threshold   = (float)DEFAULT_REPROJECTION_THRESHOLD;
     ftParms->sliding.max_delta_map            = (float)DEFAULT_MAX_DELTA_MAP;
+    ftParms->sliding.num_threads              = DEFAULT_NUM_THREADS;
+    ftParms->sliding.normalized_convolution   = DEFAULT_NORMALIZED_CONVOLUTION;
+    ftParms->sliding.float_coordinates        = DEFAULT_FLOAT_COORDINATES;
+    ftParms->sliding.seeded_ransac            = DEFAULT_SEEDED_RANSAC;
     
     // Feature detector parameters
     ftParms->detector.window_size             = DEFAULT_FORSTNER_FEATURE_WINDOW_SIZE;
@@ -51,15 +59,17 @@ bool read_parameterfile(char *filename, Parameters *ftParms)
     const char* parent_keys[] = {"feature_match", "forstner_feature_detector", "sliding_window"};
     const char* child_keys[] = {
         // Feature match parameters
-        "correlation_window_size", "search_window_size", "min_correlation",
+        "correlation_window_size", "search_window_size", "min_correlation", "pyramid_levels",
+        "prune_search", "subpixel_model",
         // Forstner detector parameters
         "window_size", "min_dist_feature", "num_features",
         // Sliding window parameters
         "block_size", "step_size", "min_n_features", "feature_influence_window",
-        "reprojection_threshold", "max_delta_map"
+        "reprojection_threshold", "max_delta_map", "num_threads",
+        "normalized_convolution", "float_coordinates", "seeded_ransac"
     };
-    size_t num_child_keys[] = {3, 3, 6};
-    const char* values[12] = {""};
+    size_t num_child_keys[] = {6, 3, 10};
+    const char* values[19] = {""};
     
     if(!parseYaml(filename,
                   parent_keys,
@@ -78,28 +88,46 @@ bool read_parameterfile(char *filename, Parameters *ftParms)
         ftParms->matching.search_window_size = atoi(values[1]);
     if(strncmp(values[2], "", strlen(values[2])) != 0)
         ftParms->matching.min_correlation = atof(values[2]);
-    
-    // Forstner feature detector parameters
     if(strncmp(values[3], "", strlen(values[3])) != 0)
-        ftParms->detector.window_size = atoi(values[3]);
+        ftParms->matching.pyramid_levels = atoi(values[3]);
     if(strncmp(values[4], "", strlen(values[4])) != 0)
-        ftParms->detector.min_dist_feature = atof(values[4]);
-    if(strncmp(values[5], "", strlen(values[5])) != 0)
-        ftParms->detector.num_features = atoi(values[5]);
+        ftParms->matching.prune_search = atoi(values[4]) != 0;
+    if(strncmp(values[5], "", strlen(values[5])) != 0) {
+        ftParms->matching.subpixel_model = atoi(values[5]);
+        for(int32_t model = 0; model < CORR_SUBPIXEL_NUM_MODELS; model++) {
+            if(strcmp(values[5], corr_subpixel_model_name(model)) == 0) ftParms->matching.subpixel_model = model;
+        }
+    }
     
-    // Sliding window parameters
+    // Forstner feature detector parameters
     if(strncmp(values[6], "", strlen(values[6])) != 0)
-        ftParms->sliding.block_size = atoi(values[6]);
+        ftParms->detector.window_size = atoi(values[6]);
     if(strncmp(values[7], "", strlen(values[7])) != 0)
-        ftParms->sliding.step_size = atoi(values[7]);
+        ftParms->detector.min_dist_feature = atof(values[7]);
     if(strncmp(values[8], "", strlen(values[8])) != 0)
-        ftParms->sliding.min_n_features = atoi(values[8]);
+        ftParms->detector.num_features = atoi(values[8]);
+    
+    // Sliding window parameters
     if(strncmp(values[9], "", strlen(values[9])) != 0)
-        ftParms->sliding.feature_influence_window = atoi(values[9]);
+        ftParms->sliding.block_size = atoi(values[9]);
     if(strncmp(values[10], "", strlen(values[10])) != 0)
-        ftParms->sliding.reprojection_threshold = atof(values[10]);
+        ftParms->sliding.step_size = atoi(values[10]);
     if(strncmp(values[11], "", strlen(values[11])) != 0)
-        ftParms->sliding.max_delta_map = atof(values[11]);
+        ftParms->sliding.min_n_features = atoi(values[11]);
+    if(strncmp(values[12], "", strlen(values[12])) != 0)
+        ftParms->sliding.feature_influence_window = atoi(values[12]);
+    if(strncmp(values[13], "", strlen(values[13])) != 0)
+        ftParms->sliding.reprojection_threshold = atof(values[13]);
+    if(strncmp(values[14], "", strlen(values[14])) != 0)
+        ftParms->sliding.max_delta_map = atof(values[14]);
+    if(strncmp(values[15], "", strlen(values[15])) != 0)
+        ftParms->sliding.num_threads = atoi(values[15]);
+    if(strncmp(values[16], "", strlen(values[16])) != 0)
+        ftParms->sliding.normalized_convolution = atoi(values[16]) != 0;
+    if(strncmp(values[17], "", strlen(values[17])) != 0)
+        ftParms->sliding.float_coordinates = atoi(values[17]) != 0;
+    if(strncmp(values[18], "", strlen(values[18])) != 0)
+        ftParms->sliding.seeded_ransac = atoi(values[18]) != 0;
     
     // Validate and adjust parameters
     if(ftParms->matching.correlation_window_size%2 == 0) 
@@ -111,10 +139,25 @@ bool read_parameterfile(char *filename, Parameters *ftParms)
         ftParms->matching.search_window_size +=2;
     }
     
+    // Ensure pyramid_levels is not negative
+    if(ftParms->matching.pyramid_levels < 0)
+        ftParms->matching.pyramid_levels = 0;
+    
+    // Ensure subpixel_model is one of the models
+    if(corr_subpixel_model_name(ftParms->matching.subpixel_model) == NULL) {
+        SAFE_PRINTF(128, "read_parameterfile() ==>> unknown subpixel_model %d, using %d\n",
+                    ftParms->matching.subpixel_model, DEFAULT_SUBPIXEL_MODEL);
+        ftParms->matching.subpixel_model = DEFAULT_SUBPIXEL_MODEL;
+    }
+    
     // Ensure step_size is at least 1
     if(ftParms->sliding.step_size < 1) 
         ftParms->sliding.step_size = 1;
     
+    // Ensure num_threads is not negative
+    if(ftParms->sliding.num_threads < 0)
+        ftParms->sliding.num_threads = 0;
+    
     // Ensure feature_influence_window is odd
     if(ftParms->sliding.feature_influence_window%2 == 0) 
         ftParms->sliding.feature_influence_window +=1;
@@ -132,6 +175,9 @@ void print_parameters(Parameters parameters)
     SAFE_PRINTF(128, "  correlation_window_size: %d\n", parameters.matching.correlation_window_size);
     SAFE_PRINTF(128, "  search_window_size: %d\n", parameters.matching.search_window_size);
     SAFE_PRINTF(128, "  min_correlation: %f\n", parameters.matching.min_correlation);
+    SAFE_PRINTF(128, "  pyramid_levels: %d\n", parameters.matching.pyramid_levels);
+    SAFE_PRINTF(128, "  prune_search: %d\n", parameters.matching.prune_search);
+    SAFE_PRINTF(128, "  subpixel_model: %d\n", parameters.matching.subpixel_model);
     
     SAFE_PRINTF(128, "forstner_feature_detector: \n");
     SAFE_PRINTF(128, "  window_size: %d\n", parameters.detector.window_size);
@@ -145,4 +191,8 @@ void print_parameters(Parameters parameters)
     SAFE_PRINTF(128, "  feature_influence_window: %d\n", parameters.sliding.feature_influence_window);
     SAFE_PRINTF(128, "  reprojection_threshold: %f\n", parameters.sliding.reprojection_threshold);
     SAFE_PRINTF(128, "  max_delta_map: %f\n", parameters.sliding.max_delta_map);
+    SAFE_PRINTF(128, "  num_threads: %d\n", parameters.sliding.num_threads);
+    SAFE_PRINTF(128, "  normalized_convolution: %d\n", parameters.sliding.normalized_convolution);
+    SAFE_PRINTF(128, "  float_coordinates: %d\n", parameters.sliding.float_coordinates);
+    SAFE_PRINTF(128, "  seeded_ransac: %d\n", parameters.sliding.seeded_ransac);
 }
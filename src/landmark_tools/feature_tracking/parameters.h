@@ -34,6 +34,9 @@
 #define DEFAULT_SEARCH_WINDOW_SIZE     36           /*!< \brief Default value for `Parameters.search_window_size`*/
 #define DEFAULT_FORSTNER_FEATURE_WINDOW_SIZE     9             /*!< \brief Default value for `Parameters.forstner_feature_window_size`*/
 #define DEFAULT_MIN_CORRELATION        0.3           /*!< \brief Default value for `Parameters.min_correlation`*/
+#define DEFAULT_PYRAMID_LEVELS         0             /*!< \brief Default value for `Parameters.pyramid_levels`*/
+#define DEFAULT_PRUNE_SEARCH           false         /*!< \brief Default value for `Parameters.prune_search`*/
+#define DEFAULT_SUBPIXEL_MODEL         0             /*!< \brief Default value for `Parameters.subpixel_model`*/
 #define DEFAULT_NUM_FEATURES           600           /*!< \brief Default value for `Parameters.num_features`*/
 #define DEFAULT_MIN_DIST_FEATURE       5.0             /*!< \brief Default value for `Parameters.min_dist_feature`*/
 #define DEFAULT_BLOCK_SIZE             200            /*!< \brief Default value for `Parameters.block_size`*/
@@ -42,6 +45,10 @@
 #define DEFAULT_FEATURE_INFLUENCE_WINDOW 7            /*!< \brief Default value for `Parameters.feature_influence_window`*/
 #define DEFAULT_REPROJECTION_THRESHOLD 5.0            /*!< \brief Default value for `Parameters.reprojection_threshold`*/
 #define DEFAULT_MAX_DELTA_MAP          500.0          /*!< \brief Default value for `Parameters.max_delta_map`*/
+#define DEFAULT_NUM_THREADS            0              /*!< \brief Default value for `Parameters.num_threads`*/
+#define DEFAULT_NORMALIZED_CONVOLUTION false          /*!< \brief Default value for `Parameters.normalized_convolution`*/
+#define DEFAULT_FLOAT_COORDINATES      false          /*!< \brief Default value for `Parameters.float_coordinates`*/
+#define DEFAULT_SEEDED_RANSAC          false          /*!< \brief Default value for `Parameters.seeded_ransac`*/
 
 /**
  * \brief Parameters for correlation-based feature matching
@@ -66,6 +73,7 @@ typedef struct {
      * where the template from the first image will be slid over to perform
      * the correlation matching. A larger search window allows for a more
      * extensive search area but increases computational cost quadratically.
+     * Very large searches are correlated in the frequency domain instead, see `corr_fft.h`.
      * Increase to compensate for large map tie error or distortion. Decrease to reduce outliers and improve speed.
      *
      * @note The search window size should be greater than or equal to
@@ -78,6 +86,37 @@ typedef struct {
      *
      * @note Required value range from [0.0, 1.0]*/
     float min_correlation;
+    
+    /**
+     * \brief Number of 2x downsampled levels for coarse-to-fine matching
+     *
+     * If 0, every feature is correlated over the whole search window at full resolution. Otherwise the template and
+     * search window are first correlated after downsampling by 2^pyramid_levels, and the best coarse peaks are refined
+     * at full resolution in small windows. Cost then grows much more slowly with `search_window_size`, which allows
+     * search windows of hundreds of pixels. Set to 1 or 2 for large map tie errors.
+     *
+     * @note Levels are reduced automatically if the downsampled template would be smaller than 5 pixels.
+     * Recommended value range from [0, 3] */
+    int32_t pyramid_levels;
+
+    /**
+     * \brief Skip search offsets that provably cannot score above `min_correlation`
+     *
+     * Matches scoring above `min_correlation` are unchanged, so only the run time differs. The saving is largest on
+     * low-texture terrain where most offsets score poorly.
+     */
+    bool prune_search;
+
+    /**
+     * \brief Model of the subpixel refinement of each match, a `CorrSubpixelModel`
+     *
+     * 0 (`quadratic`) fits a biquadratic to the 3x3 scores around the best offset by least squares. 1 (`parabolic`)
+     * fits a parabola through the center row and one through the center column, 2 (`gaussian`) fits them to the
+     * logarithm of the scores, which suits narrow peaks, and 3 (`taylor`) takes a Newton step from the gradient and
+     * Hessian of central differences. Parameter files take the number or the name.
+     *
+     * @note Only 0 gives the same matches as earlier versions */
+    int32_t subpixel_model;
 } MatchingParameters;
 
 /**
@@ -150,6 +189,46 @@ typedef struct {
      *
      * @note Recommended value range from [100.0, 1000.0] meters */
     float max_delta_map;
+    
+    /**
+     * \brief Number of threads matching blocks in parallel
+     *
+     * Blocks are matched concurrently and accumulated into the results in block order, so the output is the same
+     * for any number of threads.
+     *
+     * @note If 0, `parallel_num_threads()`. */
+    int32_t num_threads;
+    
+    /**
+     * \brief Build the delta maps by normalized convolution
+     *
+     * If true, every feature is recorded at its pixel and the maps are convolved once with the separable weight
+     * exp(-|dx|) * exp(-|dy|) instead of spreading exp(-distance) around every feature. It is faster with many
+     * features but the weights differ slightly, so the results are not identical.
+     *
+     * @note Default is false */
+    bool normalized_convolution;
+    
+    /**
+     * \brief Compute the deltas of the matched features in float anchor-relative coordinates
+     *
+     * If true and both landmarks are small enough for `LMK_Local_Pair_Init`, the deltas are computed from float map
+     * frame coordinates relative to the anchor points, in batches, rather than from double world positions. The
+     * deltas differ by at most `LMK_LOCAL_FLOAT_TOLERANCE` pixels, so the results are not identical.
+     *
+     * @note Default is false */
+    bool float_coordinates;
+    
+    /**
+     * \brief Seed the local RANSAC of each block by its position
+     *
+     * If true, the samples of each block are drawn from a generator seeded by the block position, best correlated
+     * features first (PROSAC), with adaptive stopping and with degenerate samples skipped. The results then do not
+     * depend on rand() and are the same when the map is compared in bands or tiles, but differ from those of the
+     * default, which draws from rand() as earlier versions did.
+     *
+     * @note Default is false */
+    bool seeded_ransac;
 } SlidingWindowParameters;
 
 /**
@@ -0,0 +1,457 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>                  // for fopen, fread, fwrite, fclose
+#include <stdlib.h>                 // for malloc, calloc, free
+#include <string.h>                 // for memcpy, memcmp, strncpy, strncmp
+
+#include <zlib.h>                   // for compress2, uncompress, compressBound
+
+#include "landmark_tools/feature_tracking/results_raster.h"
+#include "landmark_tools/utils/endian_read_write.h"
+#include "landmark_tools/utils/perf_stats.h"
+#include "landmark_tools/utils/safe_string.h"
+
+#define RASTER_MAGIC "LMKRSTR1"
+#define RASTER_MAGIC_SIZE 8
+#define RASTER_PARAMS_SIZE 20       //bytes of cols, rows, bands, tile size, compression
+#define RASTER_INDEX_ENTRY_SIZE 12  //bytes of offset, payload bytes
+
+const char *const correlation_results_band_names[RESULTS_RASTER_NUM_CORRELATION_BANDS] = {
+    "delta_x", "delta_y", "delta_z", "corr"
+};
+
+struct Results_Raster_Writer {
+    FILE *fp;
+    int32_t num_cols;
+    int32_t num_rows;
+    int32_t num_bands;
+    int32_t tile_size;
+    int32_t tile_cols;
+    enum LMK_Compression compression;
+    float *strip;          //!< num_bands planes of tile_size rows, the row of tiles being filled
+    int32_t strip_top;     //!< first row of the strip
+    int32_t next_row;      //!< next row expected by Append_Results_Raster_Rows
+    int64_t index_offset;
+    uint64_t offset;       //!< offset of the next payload
+    uint64_t *offsets;     //!< offset of each tile and band
+    uint32_t *bytes;       //!< stored bytes of each tile and band
+    uint8_t *raw;
+    uint8_t *shuffled;
+    uint8_t *encoded;
+    uLongf capacity;
+    bool error;
+};
+
+struct Results_Raster {
+    FILE *fp;
+    int32_t num_cols;
+    int32_t num_rows;
+    int32_t num_bands;
+    int32_t tile_size;
+    int32_t tile_cols;
+    char (*band_names)[RESULTS_RASTER_BAND_NAME_SIZE];
+    uint64_t *offsets;
+    uint32_t *bytes;
+};
+
+/**
+ \brief Split `n` floats into byte planes (or merge them back when `inverse` is true)
+ */
+static void shuffle_floats(const uint8_t *src, uint8_t *dst, size_t n, bool inverse)
+{
+    for(size_t i = 0; i < n; i++){
+        for(size_t b = 0; b < sizeof(float); b++){
+            if(inverse){
+                dst[i*sizeof(float) + b] = src[b*n + i];
+            }else{
+                dst[b*n + i] = src[i*sizeof(float) + b];
+            }
+        }
+    }
+}
+
+static void tile_extent(int32_t num_cols, int32_t num_rows, int32_t tile_size, int32_t tile_col, int32_t tile_row,
+                        int32_t *x0, int32_t *y0, int32_t *w, int32_t *h)
+{
+    *x0 = tile_col*tile_size;
+    *y0 = tile_row*tile_size;
+    *w = (*x0 + tile_size > num_cols) ? num_cols - *x0 : tile_size;
+    *h = (*y0 + tile_size > num_rows) ? num_rows - *y0 : tile_size;
+}
+
+static bool write_index(Results_Raster_Writer *writer, int32_t num_entries)
+{
+    for(int32_t i = 0; i < num_entries; i++){
+        if(write_big_endian_array(&writer->offsets[i], 64, false, 1, writer->fp) != 1) return false;
+        if(write_big_endian_array(&writer->bytes[i], 32, false, 1, writer->fp) != 1) return false;
+    }
+    return true;
+}
+
+static void free_writer(Results_Raster_Writer *writer)
+{
+    free(writer->strip);
+    free(writer->offsets);
+    free(writer->bytes);
+    free(writer->raw);
+    free(writer->shuffled);
+    free(writer->encoded);
+    free(writer);
+}
+
+Results_Raster_Writer *Open_Results_Raster_Writer(const char *filename, int32_t num_cols, int32_t num_rows,
+                                                  int32_t num_bands, const char *const band_names[],
+                                                  int32_t tile_size, enum LMK_Compression compression)
+{
+    if(num_cols <= 0 || num_rows <= 0 || num_bands <= 0 || tile_size <= 0 ||
+       compression == LMK_Compression_UNDEFINED){
+        SAFE_PRINTF(512, "Open_Results_Raster_Writer() ==>> invalid %d x %d x %d raster, tile size %d or compression\n",
+                    num_cols, num_rows, num_bands, tile_size);
+        return NULL;
+    }
+    Results_Raster_Writer *writer = (Results_Raster_Writer *)calloc(1, sizeof(Results_Raster_Writer));
+    if(writer == NULL){
+        SAFE_PRINTF(512, "Open_Results_Raster_Writer() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        return NULL;
+    }
+    writer->num_cols = num_cols;
+    writer->num_rows = num_rows;
+    writer->num_bands = num_bands;
+    writer->tile_size = tile_size;
+    writer->compression = compression;
+    writer->tile_cols = (num_cols + tile_size - 1)/tile_size;
+    int32_t tile_rows = (num_rows + tile_size - 1)/tile_size;
+    int32_t num_entries = writer->tile_cols*tile_rows*num_bands;
+
+    size_t tile_bytes = (size_t)tile_size*tile_size*sizeof(float);
+    writer->capacity = compressBound((uLong)tile_bytes);
+    writer->strip = (float *)malloc(sizeof(float)*num_bands*tile_size*(size_t)num_cols);
+    writer->offsets = (uint64_t *)calloc(num_entries, sizeof(uint64_t));
+    writer->bytes = (uint32_t *)calloc(num_entries, sizeof(uint32_t));
+    writer->raw = (uint8_t *)malloc(tile_bytes);
+    writer->shuffled = (uint8_t *)malloc(tile_bytes);
+    writer->encoded = (uint8_t *)malloc(writer->capacity);
+    if(writer->strip == NULL || writer->offsets == NULL || writer->bytes == NULL || writer->raw == NULL ||
+       writer->shuffled == NULL || writer->encoded == NULL){
+        SAFE_PRINTF(512, "Open_Results_Raster_Writer() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        free_writer(writer);
+        return NULL;
+    }
+
+    writer->fp = fopen(filename, "wb");
+    if(writer->fp == NULL){
+        SAFE_PRINTF(512, "Open_Results_Raster_Writer() ==>> cannot open file %s to write\n", filename);
+        free_writer(writer);
+        return NULL;
+    }
+    uint32_t params[5] = {(uint32_t)num_cols, (uint32_t)num_rows, (uint32_t)num_bands, (uint32_t)tile_size,
+                          (uint32_t)compression};
+    bool success = fwrite(RASTER_MAGIC, 1, RASTER_MAGIC_SIZE, writer->fp) == RASTER_MAGIC_SIZE &&
+                   write_big_endian_array(params, 32, false, 5, writer->fp) == 5;
+    for(int32_t b = 0; b < num_bands && success; b++){
+        char name[RESULTS_RASTER_BAND_NAME_SIZE] = {0};
+        strncpy(name, band_names[b], RESULTS_RASTER_BAND_NAME_SIZE - 1);
+        success = fwrite(name, 1, RESULTS_RASTER_BAND_NAME_SIZE, writer->fp) == RESULTS_RASTER_BAND_NAME_SIZE;
+    }
+    writer->index_offset = RASTER_MAGIC_SIZE + RASTER_PARAMS_SIZE + (int64_t)num_bands*RESULTS_RASTER_BAND_NAME_SIZE;
+    writer->offset = (uint64_t)writer->index_offset + (uint64_t)num_entries*RASTER_INDEX_ENTRY_SIZE;
+    // Placeholder index, rewritten once the payload sizes are known
+    success = success && write_index(writer, num_entries);
+    if(!success){
+        SAFE_PRINTF(512, "Open_Results_Raster_Writer() ==>> failed to write header of %s\n", filename);
+        fclose(writer->fp);
+        free_writer(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+/**
+ \brief Encode and write every tile of the strip, a row of tiles
+ */
+static bool write_strip(Results_Raster_Writer *writer)
+{
+    int32_t tile_row = writer->strip_top/writer->tile_size;
+    size_t plane = (size_t)writer->tile_size*writer->num_cols;
+    for(int32_t tile_col = 0; tile_col < writer->tile_cols; tile_col++){
+        int32_t x0, y0, w, h;
+        tile_extent(writer->num_cols, writer->num_rows, writer->tile_size, tile_col, tile_row, &x0, &y0, &w, &h);
+        size_t n = (size_t)w*h;
+        for(int32_t b = 0; b < writer->num_bands; b++){
+            float *tile = (float *)writer->raw;
+            for(int32_t r = 0; r < h; r++){
+                memcpy(&tile[(size_t)r*w], &writer->strip[b*plane + (size_t)r*writer->num_cols + x0],
+                       sizeof(float)*w);
+            }
+            swap_big_endian_array(tile, 32, (int64_t)n);
+            size_t raw_size = n*sizeof(float);
+            const uint8_t *stored = writer->raw;
+            uLongf stored_size = raw_size;
+            if(writer->compression == LMK_COMPRESSION_DEFLATE){
+                shuffle_floats(writer->raw, writer->shuffled, n, false);
+                uLongf out_size = writer->capacity;
+                // Payloads that do not shrink are stored raw, and recognized by their size
+                if(compress2(writer->encoded, &out_size, writer->shuffled, (uLong)raw_size,
+                             Z_DEFAULT_COMPRESSION) == Z_OK && out_size < raw_size){
+                    stored = writer->encoded;
+                    stored_size = out_size;
+                }
+            }
+            if(fwrite(stored, 1, stored_size, writer->fp) != stored_size) return false;
+            int32_t entry = (tile_row*writer->tile_cols + tile_col)*writer->num_bands + b;
+            writer->offsets[entry] = writer->offset;
+            writer->bytes[entry] = (uint32_t)stored_size;
+            writer->offset += stored_size;
+        }
+    }
+    return true;
+}
+
+bool Append_Results_Raster_Rows(Results_Raster_Writer *writer, const float *const bands[], int32_t nrows)
+{
+    if(writer->error) return false;
+    if(writer->next_row + nrows > writer->num_rows){
+        SAFE_PRINTF(512, "Append_Results_Raster_Rows() ==>> %d rows exceed raster height %d\n",
+                    writer->next_row + nrows, writer->num_rows);
+        return false;
+    }
+    size_t plane = (size_t)writer->tile_size*writer->num_cols;
+    int32_t appended = 0;
+    while(appended < nrows){
+        // Rows up to the end of the current row of tiles
+        int32_t strip_row = writer->next_row - writer->strip_top;
+        int32_t n = writer->tile_size - strip_row;
+        if(n > nrows - appended) n = nrows - appended;
+        for(int32_t b = 0; b < writer->num_bands; b++){
+            memcpy(&writer->strip[b*plane + (size_t)strip_row*writer->num_cols],
+                   &bands[b][(size_t)appended*writer->num_cols], sizeof(float)*n*writer->num_cols);
+        }
+        writer->next_row += n;
+        appended += n;
+
+        if(writer->next_row - writer->strip_top == writer->tile_size || writer->next_row == writer->num_rows){
+            if(!write_strip(writer)){
+                SAFE_PRINTF(512, "Append_Results_Raster_Rows() ==>> failed to write rows %d to %d\n",
+                            writer->strip_top, writer->next_row);
+                writer->error = true;
+                return false;
+            }
+            writer->strip_top = writer->next_row;
+        }
+    }
+    return true;
+}
+
+bool Close_Results_Raster_Writer(Results_Raster_Writer *writer)
+{
+    if(writer == NULL) return false;
+    bool success = !writer->error && writer->next_row == writer->num_rows;
+    if(writer->next_row != writer->num_rows){
+        SAFE_PRINTF(512, "Close_Results_Raster_Writer() ==>> raster is incomplete, %d of %d rows written\n",
+                    writer->next_row, writer->num_rows);
+    }
+    int32_t tile_rows = (writer->num_rows + writer->tile_size - 1)/writer->tile_size;
+    success = success && seek_file_offset(writer->fp, writer->index_offset);
+    success = success && write_index(writer, writer->tile_cols*tile_rows*writer->num_bands);
+    success &= fclose(writer->fp) == 0;
+    free_writer(writer);
+    return success;
+}
+
+bool Write_Correlation_Results_Raster(const char *filename, const CorrelationResults *results, int32_t num_cols,
+                                      int32_t num_rows, int32_t tile_size, enum LMK_Compression compression)
+{
+    PERF_PHASE_BEGIN(timer, PERF_WRITE);
+    Results_Raster_Writer *writer = Open_Results_Raster_Writer(filename, num_cols, num_rows,
+                                                               RESULTS_RASTER_NUM_CORRELATION_BANDS,
+                                                               correlation_results_band_names, tile_size,
+                                                               compression);
+    if(writer == NULL) {
+        PERF_PHASE_END(timer);
+        return false;
+    }
+    const float *bands[RESULTS_RASTER_NUM_CORRELATION_BANDS] = {results->delta_x, results->delta_y,
+                                                                results->delta_z, results->correlation};
+    bool success = Append_Results_Raster_Rows(writer, bands, num_rows);
+    success = Close_Results_Raster_Writer(writer) && success;
+    PERF_PHASE_END(timer);
+    return success;
+}
+
+void Close_Results_Raster(Results_Raster *raster)
+{
+    if(raster == NULL) return;
+    if(raster->fp != NULL) fclose(raster->fp);
+    free(raster->band_names);
+    free(raster->offsets);
+    free(raster->bytes);
+    free(raster);
+}
+
+Results_Raster *Open_Results_Raster(const char *filename, int32_t *num_cols, int32_t *num_rows,
+                                    int32_t *num_bands)
+{
+    Results_Raster *raster = (Results_Raster *)calloc(1, sizeof(Results_Raster));
+    if(raster == NULL){
+        SAFE_PRINTF(512, "Open_Results_Raster() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        return NULL;
+    }
+    raster->fp = fopen(filename, "rb");
+    if(raster->fp == NULL){
+        SAFE_PRINTF(512, "Open_Results_Raster() ==>> cannot open file %s to read\n", filename);
+        Close_Results_Raster(raster);
+        return NULL;
+    }
+    char magic[RASTER_MAGIC_SIZE];
+    uint32_t params[5];
+    if(fread(magic, 1, RASTER_MAGIC_SIZE, raster->fp) != RASTER_MAGIC_SIZE ||
+       memcmp(magic, RASTER_MAGIC, RASTER_MAGIC_SIZE) != 0 ||
+       read_big_endian_array(params, 32, false, 5, raster->fp) != 5 ||
+       params[0] == 0 || params[1] == 0 || params[2] == 0 || params[3] == 0 ||
+       params[0] > INT32_MAX || params[1] > INT32_MAX || params[2] > 1024 || params[3] > INT32_MAX ||
+       params[4] >= LMK_Compression_UNDEFINED){
+        SAFE_PRINTF(512, "Open_Results_Raster() ==>> %s is not a results raster\n", filename);
+        Close_Results_Raster(raster);
+        return NULL;
+    }
+    raster->num_cols = (int32_t)params[0];
+    raster->num_rows = (int32_t)params[1];
+    raster->num_bands = (int32_t)params[2];
+    raster->tile_size = (int32_t)params[3];
+    raster->tile_cols = (raster->num_cols + raster->tile_size - 1)/raster->tile_size;
+    int32_t tile_rows = (raster->num_rows + raster->tile_size - 1)/raster->tile_size;
+    size_t num_entries = (size_t)raster->tile_cols*tile_rows*raster->num_bands;
+
+    raster->band_names = malloc(sizeof(*raster->band_names)*raster->num_bands);
+    raster->offsets = (uint64_t *)malloc(sizeof(uint64_t)*num_entries);
+    raster->bytes = (uint32_t *)malloc(sizeof(uint32_t)*num_entries);
+    bool success = raster->band_names != NULL && raster->offsets != NULL && raster->bytes != NULL;
+    for(int32_t b = 0; b < raster->num_bands && success; b++){
+        success = fread(raster->band_names[b], 1, RESULTS_RASTER_BAND_NAME_SIZE, raster->fp) ==
+                  RESULTS_RASTER_BAND_NAME_SIZE;
+        raster->band_names[b][RESULTS_RASTER_BAND_NAME_SIZE - 1] = '\0';
+    }
+    for(size_t i = 0; i < num_entries && success; i++){
+        success = read_big_endian_array(&raster->offsets[i], 64, false, 1, raster->fp) == 1 &&
+                  read_big_endian_array(&raster->bytes[i], 32, false, 1, raster->fp) == 1;
+    }
+    if(!success){
+        SAFE_PRINTF(512, "Open_Results_Raster() ==>> failed to read the tile index of %s\n", filename);
+        Close_Results_Raster(raster);
+        return NULL;
+    }
+    *num_cols = raster->num_cols;
+    *num_rows = raster->num_rows;
+    *num_bands = raster->num_bands;
+    return raster;
+}
+
+int32_t Results_Raster_Band(const Results_Raster *raster, const char *name)
+{
+    for(int32_t b = 0; b < raster->num_bands; b++){
+        if(strncmp(raster->band_names[b], name, RESULTS_RASTER_BAND_NAME_SIZE) == 0) return b;
+    }
+    return -1;
+}
+
+bool Read_Results_Raster_Window(Results_Raster *raster, int32_t band, int32_t left, int32_t top, int32_t ncols,
+                                int32_t nrows, float *values)
+{
+    if(band < 0 || band >= raster->num_bands || left < 0 || top < 0 || ncols <= 0 || nrows <= 0 ||
+       left + ncols > raster->num_cols || top + nrows > raster->num_rows){
+        SAFE_PRINTF(512, "Read_Results_Raster_Window() ==>> band %d window %d %d %d %d is outside of the raster\n",
+                    band, left, top, ncols, nrows);
+        return false;
+    }
+    size_t tile_bytes = (size_t)raster->tile_size*raster->tile_size*sizeof(float);
+    uLong capacity = compressBound((uLong)tile_bytes);
+    uint8_t *stored = (uint8_t *)malloc(capacity);
+    uint8_t *shuffled = (uint8_t *)malloc(tile_bytes);
+    float *tile = (float *)malloc(tile_bytes);
+    bool success = stored != NULL && shuffled != NULL && tile != NULL;
+    if(!success){
+        SAFE_PRINTF(512, "Read_Results_Raster_Window() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+    }
+
+    int32_t first_col = left/raster->tile_size, last_col = (left + ncols - 1)/raster->tile_size;
+    int32_t first_row = top/raster->tile_size, last_row = (top + nrows - 1)/raster->tile_size;
+    for(int32_t tr = first_row; tr <= last_row && success; tr++){
+        for(int32_t tc = first_col; tc <= last_col && success; tc++){
+            int32_t x0, y0, w, h;
+            tile_extent(raster->num_cols, raster->num_rows, raster->tile_size, tc, tr, &x0, &y0, &w, &h);
+            size_t n = (size_t)w*h;
+            size_t entry = ((size_t)tr*raster->tile_cols + tc)*raster->num_bands + band;
+            uint32_t size = raster->bytes[entry];
+            success = size <= capacity && seek_file_offset(raster->fp, (int64_t)raster->offsets[entry]) &&
+                      fread(stored, 1, size, raster->fp) == size;
+            if(!success) break;
+            if(size == n*sizeof(float)){
+                memcpy(tile, stored, size);
+            }else{
+                uLongf out_size = (uLongf)(n*sizeof(float));
+                success = uncompress(shuffled, &out_size, stored, size) == Z_OK && out_size == n*sizeof(float);
+                if(!success) break;
+                shuffle_floats(shuffled, (uint8_t *)tile, n, true);
+            }
+            swap_big_endian_array(tile, 32, (int64_t)n);
+
+            // Overlap of the tile and the window
+            int32_t cx0 = x0 > left ? x0 : left;
+            int32_t cy0 = y0 > top ? y0 : top;
+            int32_t cx1 = (x0 + w < left + ncols) ? x0 + w : left + ncols;
+            int32_t cy1 = (y0 + h < top + nrows) ? y0 + h : top + nrows;
+            for(int32_t y = cy0; y < cy1; y++){
+                memcpy(&values[(size_t)(y - top)*ncols + (cx0 - left)], &tile[(size_t)(y - y0)*w + (cx0 - x0)],
+                       sizeof(float)*(cx1 - cx0));
+            }
+        }
+    }
+    if(!success && stored != NULL && shuffled != NULL && tile != NULL){
+        SAFE_PRINTF(512, "Read_Results_Raster_Window() ==>> failed to read band %d\n", band);
+    }
+    free(stored);
+    free(shuffled);
+    free(tile);
+    return success;
+}
+
+bool Read_Correlation_Results_Raster(const char *filename, CorrelationResults *results, int32_t num_cols,
+                                     int32_t num_rows)
+{
+    int32_t cols, rows, bands;
+    Results_Raster *raster = Open_Results_Raster(filename, &cols, &rows, &bands);
+    if(raster == NULL) return false;
+    bool success = cols == num_cols && rows == num_rows;
+    if(!success){
+        SAFE_PRINTF(512, "Read_Correlation_Results_Raster() ==>> %s holds %d by %d maps, expected %d by %d\n",
+                    filename, cols, rows, num_cols, num_rows);
+    }
+    float *maps[RESULTS_RASTER_NUM_CORRELATION_BANDS] = {results->delta_x, results->delta_y, results->delta_z,
+                                                         results->correlation};
+    for(int32_t k = 0; k < RESULTS_RASTER_NUM_CORRELATION_BANDS && success; k++){
+        int32_t band = Results_Raster_Band(raster, correlation_results_band_names[k]);
+        if(band < 0){
+            SAFE_PRINTF(512, "Read_Correlation_Results_Raster() ==>> %s has no %s band\n", filename,
+                        correlation_results_band_names[k]);
+            success = false;
+            break;
+        }
+        success = Read_Results_Raster_Window(raster, band, 0, 0, num_cols, num_rows, maps[k]);
+    }
+    Close_Results_Raster(raster);
+    return success;
+}
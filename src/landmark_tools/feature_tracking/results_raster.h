@@ -0,0 +1,159 @@
+/**
+ * \file results_raster.h
+ * \brief Tiled, compressed multi-band float raster holding the maps of a comparison
+ *
+ * The delta x, delta y, delta z and correlation maps of a comparison are stored in one file instead of one raw
+ * file per map. The format is
+ * - the magic `LMKRSTR1`
+ * - number of columns, rows and bands, tile size and compression (big endian uint32)
+ * - the name of each band, 16 bytes padded with NUL
+ * - the tile index: for each tile in row major order and each band of the tile, one (uint64 offset, uint32 bytes)
+ *   entry, big endian
+ * - the payloads in the order of the index
+ *
+ * Tiles on the right and bottom edges are cropped to the map size. Each payload is a tile of one band as big endian
+ * floats split into byte planes, deflated when that makes it smaller, as the elevation of v4 landmark files. NAN
+ * areas and the exponent bytes of the deltas compress well.
+ *
+ * Rows are appended in order and a row of tiles is written as soon as its last row arrives, so maps produced in
+ * bands are written without being held whole. Windows of one band are read by decoding only the tiles they overlap.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_RESULTS_RASTER_H_
+#define _LANDMARK_TOOLS_RESULTS_RASTER_H_
+
+#include <stdbool.h>  // for bool
+#include <stdint.h>   // for int32_t
+
+#include "landmark_tools/feature_tracking/correlation_results.h"  // for CorrelationResults
+#include "landmark_tools/landmark_util/landmark_tiled.h"          // for LMK_Compression
+
+#define RESULTS_RASTER_BAND_NAME_SIZE 16
+#define RESULTS_RASTER_NUM_CORRELATION_BANDS 4   /*!< \brief delta x, delta y, delta z and correlation */
+
+typedef struct Results_Raster_Writer Results_Raster_Writer;
+typedef struct Results_Raster Results_Raster;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Names of the bands of a `CorrelationResults` raster, in the order of the structure
+ */
+extern const char *const correlation_results_band_names[RESULTS_RASTER_NUM_CORRELATION_BANDS];
+
+/**
+ * \brief Open a raster for writing, write its header and reserve the tile index
+ * \param[in] filename
+ * \param[in] num_cols width of the maps
+ * \param[in] num_rows height of the maps
+ * \param[in] num_bands number of maps
+ * \param[in] band_names name of each map, truncated to RESULTS_RASTER_BAND_NAME_SIZE - 1 characters
+ * \param[in] tile_size width and height of a tile in pixels
+ * \param[in] compression per tile compression method
+ * \return writer or NULL if the arguments are invalid, the file cannot be opened or memory allocation fails
+ */
+Results_Raster_Writer *Open_Results_Raster_Writer(const char *filename, int32_t num_cols, int32_t num_rows,
+                                                  int32_t num_bands, const char *const band_names[],
+                                                  int32_t tile_size, enum LMK_Compression compression);
+
+/**
+ * \brief Append rows of every band
+ *
+ * Rows must be appended in order. The data is copied, so the caller may reuse the buffers on return.
+ * \param[in] writer
+ * \param[in] bands nrows*num_cols values of each band
+ * \param[in] nrows number of rows
+ * \return false on io error, if memory allocation fails or if more rows than the map height are appended
+ */
+bool Append_Results_Raster_Rows(Results_Raster_Writer *writer, const float *const bands[], int32_t nrows);
+
+/**
+ * \brief Write the tile index, close the file and free the writer
+ * \param[in] writer
+ * \return false on io error or if rows are missing
+ */
+bool Close_Results_Raster_Writer(Results_Raster_Writer *writer);
+
+/**
+ * \brief Write the maps of a comparison to one raster
+ * \param[in] filename
+ * \param[in] results maps of num_cols*num_rows values
+ * \param[in] num_cols width of the maps
+ * \param[in] num_rows height of the maps
+ * \param[in] tile_size width and height of a tile in pixels
+ * \param[in] compression per tile compression method
+ * \return false on io error or if memory allocation fails
+ */
+bool Write_Correlation_Results_Raster(const char *filename, const CorrelationResults *results, int32_t num_cols,
+                                      int32_t num_rows, int32_t tile_size, enum LMK_Compression compression);
+
+/**
+ * \brief Open a raster and read its header and tile index
+ * \param[in] filename
+ * \param[out] num_cols width of the maps
+ * \param[out] num_rows height of the maps
+ * \param[out] num_bands number of maps
+ * \return raster or NULL if the file cannot be read or is not a raster
+ */
+Results_Raster *Open_Results_Raster(const char *filename, int32_t *num_cols, int32_t *num_rows,
+                                    int32_t *num_bands);
+
+/**
+ * \brief Index of the band with a name
+ * \return band index, or -1 if the raster has no such band
+ */
+int32_t Results_Raster_Band(const Results_Raster *raster, const char *name);
+
+/**
+ * \brief Read a window of one band
+ *
+ * Only the tiles which overlap the window are read and decoded.
+ * \param[in] raster
+ * \param[in] band band index
+ * \param[in] left col index for start of window
+ * \param[in] top row index for start of window
+ * \param[in] ncols width of window
+ * \param[in] nrows height of window
+ * \param[out] values pre-allocated ncols*nrows array
+ * \return false on io error, corrupt tile, or if the window is outside of the maps
+ */
+bool Read_Results_Raster_Window(Results_Raster *raster, int32_t band, int32_t left, int32_t top, int32_t ncols,
+                                int32_t nrows, float *values);
+
+/**
+ * \brief Close the file and free the raster
+ */
+void Close_Results_Raster(Results_Raster *raster);
+
+/**
+ * \brief Read the maps of a comparison written by `Write_Correlation_Results_Raster`
+ * \param[in] filename
+ * \param[out] results pre-allocated maps of num_cols*num_rows values
+ * \param[in] num_cols expected width of the maps
+ * \param[in] num_rows expected height of the maps
+ * \return false on io error, or if the raster has another size or lacks a band
+ */
+bool Read_Correlation_Results_Raster(const char *filename, CorrelationResults *results, int32_t num_cols,
+                                     int32_t num_rows);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif //_LANDMARK_TOOLS_RESULTS_RASTER_H_
@@ -0,0 +1,346 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "landmark_tools/feature_tracking/splat.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/parallel.h"
+#include "landmark_tools/utils/perf_stats.h"
+#include "landmark_tools/utils/safe_string.h"
+
+#define SPLAT_CHANNELS 5
+#define SPLAT_WEIGHT 4
+#define SPLAT_STRIP 1024   // pixels normalized together
+
+bool splat_init(SplatAccumulator *splat, int32_t num_cols, int32_t num_rows, int32_t radius, bool separable)
+{
+    memset(splat, 0, sizeof(SplatAccumulator));
+    if (num_cols < 1 || num_rows < 1 || radius < 0) {
+        SAFE_PRINTF(256, "splat_init() ==>> invalid map size %d x %d or radius %d\n", num_cols, num_rows, radius);
+        return false;
+    }
+    splat->num_cols = num_cols;
+    splat->num_rows = num_rows;
+    splat->radius = radius;
+    splat->separable = separable;
+
+    int32_t width = 2 * radius + 1;
+    size_t num_pixels = (size_t)num_cols * num_rows;
+    splat->kernel = (float *)malloc(sizeof(float) * (separable ? radius + 1 : width * width));
+    bool success = splat->kernel != NULL;
+    for (int32_t k = 0; k < SPLAT_CHANNELS; k++) {
+        splat->sum[k] = (float *)mem_calloc(MEM_MATCHING, num_pixels, sizeof(float));
+        success = success && splat->sum[k] != NULL;
+    }
+    if (separable) {
+        splat->row_used = (uint8_t *)calloc(num_rows, sizeof(uint8_t));
+        success = success && splat->row_used != NULL;
+    }
+    if (!success) {
+        SAFE_PRINTF(256, "splat_init() ==>> memory allocation error\n");
+        splat_free(splat);
+        return false;
+    }
+
+    if (separable) {
+        for (int32_t d = 0; d <= radius; d++) {
+            splat->kernel[d] = (float)exp(-(double)d);
+        }
+    } else {
+        // Same weights as process_matched_feature
+        for (int32_t dm = -radius; dm <= radius; dm++) {
+            for (int32_t dn = -radius; dn <= radius; dn++) {
+                double distance = sqrt((double)dm * dm + (double)dn * dn);
+                splat->kernel[(dm + radius) * width + dn + radius] = (float)exp(-distance);
+            }
+        }
+    }
+    return true;
+}
+
+size_t splat_bytes(int32_t num_cols, int32_t num_rows, bool separable)
+{
+    if (num_cols < 1 || num_rows < 1) return 0;
+    size_t num_pixels = (size_t)num_cols * num_rows;
+    // The normalized convolution needs one more map for its vertical pass
+    return sizeof(float) * num_pixels * (SPLAT_CHANNELS + (separable ? 1 : 0));
+}
+
+void splat_free(SplatAccumulator *splat)
+{
+    free(splat->kernel);
+    for (int32_t k = 0; k < SPLAT_CHANNELS; k++) {
+        mem_free(splat->sum[k]);
+    }
+    free(splat->row_used);
+    memset(splat, 0, sizeof(SplatAccumulator));
+}
+
+void splat_add(SplatAccumulator *splat, double col, double row, const double delta[3], double correlation)
+{
+    int32_t center_row = (int32_t)row;
+    int32_t center_col = (int32_t)col;
+    int32_t num_cols = splat->num_cols;
+
+    if (splat->separable) {
+        if (center_row < 0 || center_row >= splat->num_rows || center_col < 0 || center_col >= num_cols) return;
+        size_t index = (size_t)center_row * num_cols + center_col;
+        splat->sum[0][index] += (float)delta[0];
+        splat->sum[1][index] += (float)delta[1];
+        splat->sum[2][index] += (float)delta[2];
+        splat->sum[3][index] += (float)correlation;
+        splat->sum[SPLAT_WEIGHT][index] += 1.0f;
+        splat->row_used[center_row] = 1;
+        return;
+    }
+
+    // Only the kernel path is timed, recording a feature for the separable path costs less than the timer
+    PERF_PHASE_BEGIN(timer, PERF_SPLAT);
+    int32_t radius = splat->radius;
+    int32_t width = 2 * radius + 1;
+    int32_t first_row = center_row - radius > 0 ? center_row - radius : 0;
+    int32_t last_row = center_row + radius < splat->num_rows - 1 ? center_row + radius : splat->num_rows - 1;
+    int32_t first_col = center_col - radius > 0 ? center_col - radius : 0;
+    int32_t last_col = center_col + radius < num_cols - 1 ? center_col + radius : num_cols - 1;
+    for (int32_t m = first_row; m <= last_row; m++) {
+        const float *weights = &splat->kernel[(m - center_row + radius) * width + radius];
+        size_t offset = (size_t)m * num_cols;
+        float *sum_x = splat->sum[0] + offset;
+        float *sum_y = splat->sum[1] + offset;
+        float *sum_z = splat->sum[2] + offset;
+        float *sum_correlation = splat->sum[3] + offset;
+        float *sum_weight = splat->sum[SPLAT_WEIGHT] + offset;
+        for (int32_t n = first_col; n <= last_col; n++) {
+            float weight = weights[n - center_col];
+            sum_x[n] += (float)(delta[0] * weight);
+            sum_y[n] += (float)(delta[1] * weight);
+            sum_z[n] += (float)(delta[2] * weight);
+            sum_correlation[n] += (float)(correlation * weight);
+            sum_weight[n] += weight;
+        }
+    }
+    PERF_PHASE_END(timer);
+}
+
+/**
+ \brief Rows of a pass of `splat_convolve` or of the normalization
+*/
+typedef struct {
+    SplatAccumulator *splat;
+    CorrelationResults *results;
+    float *sum;                  // channel of the vertical pass
+    float *out;                  // output of the vertical pass
+    ParallelScratch lines;       // line of the horizontal pass of each thread
+    float max_delta;
+} SplatJob;
+
+/**
+ \brief Rows per range of the parallel passes, about 64K pixels
+*/
+static size_t splat_chunk_rows(int32_t num_cols)
+{
+    size_t rows = 65536 / (size_t)num_cols;
+    return rows > 0 ? rows : 1;
+}
+
+/**
+ \brief Horizontal pass of every channel over a range of rows, only rows holding features are not zero
+*/
+static bool convolve_rows(void *user, int32_t thread, size_t begin, size_t end)
+{
+    SplatJob *job = (SplatJob *)user;
+    SplatAccumulator *splat = job->splat;
+    int32_t num_cols = splat->num_cols;
+    int32_t radius = splat->radius;
+    const float *kernel = splat->kernel;
+    float *line = (float *)parallel_scratch_reserve(&job->lines, thread, sizeof(float) * num_cols);
+    if (line == NULL) {
+        SAFE_PRINTF(256, "splat_finish() ==>> memory allocation error\n");
+        return false;
+    }
+    for (size_t m = begin; m < end; m++) {
+        if (!splat->row_used[m]) continue;
+        for (int32_t k = 0; k < SPLAT_CHANNELS; k++) {
+            float *row = &splat->sum[k][m * num_cols];
+            for (int32_t n = 0; n < num_cols; n++) {
+                float value = row[n] * kernel[0];
+                for (int32_t d = 1; d <= radius; d++) {
+                    if (n - d >= 0) value += row[n - d] * kernel[d];
+                    if (n + d < num_cols) value += row[n + d] * kernel[d];
+                }
+                line[n] = value;
+            }
+            memcpy(row, line, sizeof(float) * num_cols);
+        }
+    }
+    return true;
+}
+
+/**
+ \brief Vertical pass of one channel over a range of output rows, from the rows holding features
+*/
+static bool convolve_columns(void *user, int32_t thread, size_t begin, size_t end)
+{
+    (void)thread;
+    SplatJob *job = (SplatJob *)user;
+    const SplatAccumulator *splat = job->splat;
+    int32_t num_cols = splat->num_cols;
+    int32_t num_rows = splat->num_rows;
+    int32_t radius = splat->radius;
+    for (size_t m = begin; m < end; m++) {
+        float *out_row = &job->out[m * num_cols];
+        memset(out_row, 0, sizeof(float) * num_cols);
+        for (int32_t d = -radius; d <= radius; d++) {
+            int64_t source = (int64_t)m + d;
+            if (source < 0 || source >= num_rows || !splat->row_used[source]) continue;
+            const float *in_row = &job->sum[(size_t)source * num_cols];
+            float weight = splat->kernel[d < 0 ? -d : d];
+            for (int32_t n = 0; n < num_cols; n++) {
+                out_row[n] += in_row[n] * weight;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ \brief Convolve the recorded features with the separable kernel, in place
+*/
+static bool splat_convolve(SplatAccumulator *splat)
+{
+    size_t num_pixels = (size_t)splat->num_cols * splat->num_rows;
+    size_t chunk = splat_chunk_rows(splat->num_cols);
+    float *out = (float *)mem_malloc(MEM_MATCHING, sizeof(float) * num_pixels);
+    if (out == NULL) {
+        SAFE_PRINTF(256, "splat_finish() ==>> memory allocation error\n");
+        return false;
+    }
+
+    SplatJob job = {0};
+    job.splat = splat;
+    bool success = parallel_for((size_t)splat->num_rows, chunk, 0, convolve_rows, &job);
+    parallel_scratch_free(&job.lines);
+
+    // The output of a channel becomes its sums, and its old sums the output of the next channel
+    for (int32_t k = 0; success && k < SPLAT_CHANNELS; k++) {
+        job.sum = splat->sum[k];
+        job.out = out;
+        parallel_for((size_t)splat->num_rows, chunk, 0, convolve_columns, &job);
+        splat->sum[k] = out;
+        out = job.sum;
+    }
+
+    mem_free(out);
+    return success;
+}
+
+/**
+ \brief Largest float threshold t with |x| > t exactly when |x| > max_delta, for every float x
+*/
+static float float_threshold(double max_delta)
+{
+    float threshold = (float)max_delta;
+    if ((double)threshold > max_delta) threshold = nextafterf(threshold, -INFINITY);
+    return threshold;
+}
+
+/**
+ \brief Normalize one channel of a strip of pixels, setting the magnitudes over `max_delta` to NAN
+
+ Pixels no feature reached have zero sums and weights. They are divided by 2 rather than skipped, and the quiet
+ comparison isgreater does not trap on NAN, so the loop has no branches and is vectorized.
+*/
+static void normalize_strip(const float *sum, const float *sum_weight, float *output, size_t count, float max_delta)
+{
+    for (size_t i = 0; i < count; i++) {
+        float weight = sum_weight[i];
+        float value = sum[i] / (weight > 0 ? weight : 2.0f);
+        if (!isgreater(weight, 0.0f) | isgreater(fabsf(value), max_delta)) value = NAN;
+        output[i] = value;
+    }
+}
+
+/**
+ \brief Normalize and filter the pixels of rows [first_row, end_row) in one pass over memory
+
+ The channels are normalized one after the other over strips small enough that the weights stay in L1 cache.
+*/
+static void normalize_rows(const SplatAccumulator *splat, CorrelationResults *results, size_t first_row,
+                           size_t end_row, float max_delta)
+{
+    size_t end = end_row * splat->num_cols;
+    float *outputs[4] = {results->delta_x, results->delta_y, results->delta_z, results->correlation};
+    const float *sum_weight = splat->sum[SPLAT_WEIGHT];
+    for (size_t begin = first_row * splat->num_cols; begin < end; begin += SPLAT_STRIP) {
+        size_t count = end - begin < SPLAT_STRIP ? end - begin : SPLAT_STRIP;
+        for (int32_t k = 0; k < 4; k++) {
+            // The correlation is not filtered
+            normalize_strip(splat->sum[k] + begin, sum_weight + begin, outputs[k] + begin, count,
+                            k < 3 ? max_delta : INFINITY);
+        }
+    }
+}
+
+static bool normalize_range(void *user, int32_t thread, size_t begin, size_t end)
+{
+    (void)thread;
+    SplatJob *job = (SplatJob *)user;
+    size_t first = (size_t)job->splat->finished_rows;
+    normalize_rows(job->splat, job->results, first + begin, first + end, job->max_delta);
+    return true;
+}
+
+void splat_finish_rows(SplatAccumulator *splat, CorrelationResults *results, int32_t feature_row, double max_delta)
+{
+    if (splat->separable) return;
+    int32_t end_row = feature_row - splat->radius;
+    if (end_row > splat->num_rows) end_row = splat->num_rows;
+    if (end_row <= splat->finished_rows) return;
+
+    PERF_PHASE_BEGIN(timer, PERF_NORMALIZE);
+    normalize_rows(splat, results, (size_t)splat->finished_rows, (size_t)end_row, float_threshold(max_delta));
+    splat->finished_rows = end_row;
+    PERF_PHASE_END(timer);
+}
+
+bool splat_finish_filtered(SplatAccumulator *splat, CorrelationResults *results, double max_delta)
+{
+    if (splat->separable) {
+        PERF_PHASE_BEGIN(timer, PERF_SPLAT);
+        bool convolved = splat_convolve(splat);
+        PERF_PHASE_END(timer);
+        if (!convolved) return false;
+    }
+
+    PERF_PHASE_BEGIN(timer, PERF_NORMALIZE);
+    SplatJob job = {0};
+    job.splat = splat;
+    job.results = results;
+    job.max_delta = float_threshold(max_delta);
+    parallel_for((size_t)(splat->num_rows - splat->finished_rows), splat_chunk_rows(splat->num_cols), 0,
+                 normalize_range, &job);
+    splat->finished_rows = splat->num_rows;
+    PERF_PHASE_END(timer);
+    return true;
+}
+
+bool splat_finish(SplatAccumulator *splat, CorrelationResults *results)
+{
+    return splat_finish_filtered(splat, results, INFINITY);
+}
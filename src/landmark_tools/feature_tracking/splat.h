@@ -0,0 +1,126 @@
+/**
+ * \file splat.h
+ * \brief Accumulation of matched feature deltas into dense maps
+ *
+ * `MatchFeaturesWithLocalDistortion` spreads the delta and correlation of every inlier over a window around it with
+ * the weight exp(-distance). The weights of the window are computed once, and the weighted sums go to zeroed arrays
+ * that are turned into `CorrelationResults` in one pass at the end. Pixels that no feature reached become NAN there.
+ *
+ * In the normalized convolution mode the features are only recorded at their pixel, and the whole map is built at
+ * the end by convolving with the separable weight exp(-|dx|) * exp(-|dy|). The rows without features are skipped
+ * by the horizontal pass, so the cost no longer grows with the number of features.
+ *
+ * Normalizing the sums and dropping the deltas over `max_delta_map` is one pass over the map. Features are added in
+ * row order, so `splat_finish_rows` normalizes the rows no later feature can reach while the sums are still in cache,
+ * and `splat_finish_filtered` only the remaining rows, on the threads of the library.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_SPLAT_H_
+#define _LANDMARK_TOOLS_SPLAT_H_
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for int32_t, uint8_t
+
+#include "landmark_tools/feature_tracking/correlation_results.h"  // for CorrelationResults
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Weighted sums of the features accumulated so far
+ */
+typedef struct {
+    int32_t num_cols;            /**< Map width */
+    int32_t num_rows;            /**< Map height */
+    int32_t radius;              /**< Window of each feature is (2*radius+1)^2 pixels */
+    bool separable;              /**< Normalized convolution mode */
+    float *kernel;               /**< Weight of each window pixel, or of each 1D offset if `separable` */
+    float *sum[5];               /**< Weighted delta x, y, z, correlation and the weights themselves */
+    uint8_t *row_used;           /**< Rows holding a feature, if `separable` */
+    int32_t finished_rows;       /**< Rows already written to the results by `splat_finish_rows` */
+} SplatAccumulator;
+
+/**
+ * \brief Allocate zeroed sums and the window weights
+ *
+ * \param[out] splat Accumulator. Release with `splat_free`
+ * \param[in] num_cols Map width
+ * \param[in] num_rows Map height
+ * \param[in] radius `feature_influence_window` of the features
+ * \param[in] separable If true, build the map by normalized convolution in `splat_finish`
+ * \return false if memory allocation fails
+ */
+bool splat_init(SplatAccumulator *splat, int32_t num_cols, int32_t num_rows, int32_t radius, bool separable);
+
+/**
+ * \brief Release the memory of an accumulator
+ */
+void splat_free(SplatAccumulator *splat);
+
+/**
+ * \brief Bytes held by an accumulator of a num_cols x num_rows map, at its peak in `splat_finish`
+ */
+size_t splat_bytes(int32_t num_cols, int32_t num_rows, bool separable);
+
+/**
+ * \brief Add one feature
+ *
+ * \param[in] col Column of the feature, truncated to a pixel
+ * \param[in] row Row of the feature, truncated to a pixel
+ * \param[in] delta Delta of the feature in the map frame
+ * \param[in] correlation Correlation of the feature
+ */
+void splat_add(SplatAccumulator *splat, double col, double row, const double delta[3], double correlation);
+
+/**
+ * \brief Divide the sums by the weights into the results
+ *
+ * \param[in,out] splat Accumulator. Its sums are modified in the separable mode
+ * \param[out] results Maps of `num_cols` x `num_rows`. NAN where no feature contributed
+ * \return false if memory allocation fails
+ */
+bool splat_finish(SplatAccumulator *splat, CorrelationResults *results);
+
+/**
+ * \brief Divide the sums of the rows no later feature can reach by the weights into the results
+ *
+ * Does nothing in the separable mode, where every row depends on every feature until the convolution.
+ *
+ * \param[in] splat Accumulator
+ * \param[out] results Maps of `num_cols` x `num_rows`
+ * \param[in] feature_row Every feature still to be added is at this row or below
+ * \param[in] max_delta Deltas over this magnitude become NAN, INFINITY to keep every delta
+ */
+void splat_finish_rows(SplatAccumulator *splat, CorrelationResults *results, int32_t feature_row, double max_delta);
+
+/**
+ * \brief `splat_finish`, dropping the deltas over `max_delta` in the same pass
+ *
+ * Rows written by `splat_finish_rows` are not read again.
+ *
+ * \param[in] max_delta Deltas over this magnitude become NAN, INFINITY to keep every delta
+ * \return false if memory allocation fails
+ */
+bool splat_finish_filtered(SplatAccumulator *splat, CorrelationResults *results, double max_delta);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_SPLAT_H_ */
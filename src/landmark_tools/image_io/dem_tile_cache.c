@@ -0,0 +1,154 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "landmark_tools/image_io/dem_tile_cache.h"
+
+#include <math.h>    // for NAN, isnan
+#include <stdio.h>   // for printf
+#include <stdlib.h>  // for malloc, free
+#include <string.h>  // for memset, memmove
+
+#include "landmark_tools/data_interpolation/interpolate_data.h"  // for inter_float_matrix_cell
+#include "landmark_tools/utils/mem_stats.h"
+
+bool dem_tile_cache_init(DemTileCache *cache, const DemTileSource *source)
+{
+    memset(cache, 0, sizeof(DemTileCache));
+    if (source == NULL || source->read == NULL || source->tile_size <= 0 || source->max_tiles <= 0 ||
+        source->image_cols <= 0 || source->image_rows <= 0) {
+        printf("dem_tile_cache_init() ==>> invalid tile source\n");
+        return false;
+    }
+    size_t tile_values = (size_t)source->tile_size * source->tile_size;
+    cache->source = source;
+    cache->values = (float *)mem_malloc(MEM_DEM, tile_values * source->max_tiles * sizeof(float));
+    cache->tile_of_slot = (int64_t *)malloc(source->max_tiles * sizeof(int64_t));
+    cache->last_use = (uint64_t *)calloc(source->max_tiles, sizeof(uint64_t));
+    if (cache->values == NULL || cache->tile_of_slot == NULL || cache->last_use == NULL) {
+        printf("dem_tile_cache_init() ==>> malloc() failed\n");
+        dem_tile_cache_free(cache);
+        return false;
+    }
+    for (int32_t i = 0; i < source->max_tiles; i++) {
+        cache->tile_of_slot[i] = -1;
+    }
+    cache->tiles_x = (source->image_cols + source->tile_size - 1) / source->tile_size;
+    return true;
+}
+
+void dem_tile_cache_free(DemTileCache *cache)
+{
+    mem_free(cache->values);
+    free(cache->tile_of_slot);
+    free(cache->last_use);
+    cache->values = NULL;
+    cache->tile_of_slot = NULL;
+    cache->last_use = NULL;
+}
+
+/**
+ * \brief Slot holding a tile, reading it into the least recently used slot if no slot does
+ */
+static int32_t load_tile(DemTileCache *cache, int64_t tile)
+{
+    const DemTileSource *source = cache->source;
+    cache->clock++;
+    if (cache->tile_of_slot[cache->last_slot] == tile) {
+        cache->last_use[cache->last_slot] = cache->clock;
+        return cache->last_slot;
+    }
+
+    int32_t slot = 0;
+    for (int32_t i = 0; i < source->max_tiles; i++) {
+        if (cache->tile_of_slot[i] == tile) {
+            cache->last_use[i] = cache->clock;
+            cache->last_slot = i;
+            return i;
+        }
+        if (cache->last_use[i] < cache->last_use[slot]) slot = i;
+    }
+
+    // Tiles on the right and bottom edges are cut to the DEM, with the row stride of a whole tile
+    int32_t size = source->tile_size;
+    int32_t x0 = (int32_t)(tile % cache->tiles_x) * size;
+    int32_t y0 = (int32_t)(tile / cache->tiles_x) * size;
+    int32_t width = source->image_cols - x0 < size ? source->image_cols - x0 : size;
+    int32_t height = source->image_rows - y0 < size ? source->image_rows - y0 : size;
+    float *values = &cache->values[(size_t)slot * size * size];
+    if (!source->read(source->user, x0, y0, width, height, values)) {
+        cache->failed = true;
+        for (int32_t i = 0; i < width * height; i++) {
+            values[i] = NAN;
+        }
+    }
+    for (int32_t r = height - 1; r > 0; r--) {
+        memmove(&values[(size_t)r * size], &values[(size_t)r * width], width * sizeof(float));
+    }
+
+    cache->tile_of_slot[slot] = tile;
+    cache->last_use[slot] = cache->clock;
+    cache->last_slot = slot;
+    return slot;
+}
+
+float dem_tile_cache_value(DemTileCache *cache, int32_t x, int32_t y)
+{
+    const DemTileSource *source = cache->source;
+    if (x < 0 || y < 0 || x >= source->image_cols || y >= source->image_rows) {
+        return NAN;
+    }
+    int32_t size = source->tile_size;
+    int64_t tile = (int64_t)(y / size) * cache->tiles_x + x / size;
+    int32_t slot = load_tile(cache, tile);
+    return cache->values[(size_t)slot * size * size + (size_t)(y % size) * size + x % size];
+}
+
+/**
+ * \brief Value at a row-major index of the DEM. The indices past the end of the DEM that `inter_float_matrix_cell`
+ * gives at the last row have a weight of 0, and read as 0.
+ */
+static float index_value(DemTileCache *cache, int64_t idx)
+{
+    int64_t cols = cache->source->image_cols;
+    if (idx >= cols * cache->source->image_rows) {
+        return 0.0f;
+    }
+    return dem_tile_cache_value(cache, (int32_t)(idx % cols), (int32_t)(idx / cols));
+}
+
+double dem_tile_cache_interpolate(DemTileCache *cache, double x, double y)
+{
+    const DemTileSource *source = cache->source;
+    int64_t idx[4];
+    double dx = 0.0, dy = 0.0;
+    int32_t cell = inter_float_matrix_cell(source->image_cols, source->image_rows, x, y, idx, &dx, &dy);
+    if (cell == 0) {
+        return NAN;
+    } else if (cell == 1) {
+        return index_value(cache, idx[0]);
+    }
+
+    float p00 = index_value(cache, idx[0]);
+    float p01 = index_value(cache, idx[1]);
+    float p11 = index_value(cache, idx[2]);
+    float p10 = index_value(cache, idx[3]);
+    if (isnan(p00) || isnan(p01) || isnan(p11) || isnan(p10)) {
+        return NAN;
+    }
+    double dx0 = 1.0 - dx;
+    double dy0 = 1.0 - dy;
+    return dy0 * (dx0 * p00 + dx * p01) + dy * (dx0 * p10 + dx * p11);
+}
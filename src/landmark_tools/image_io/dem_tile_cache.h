@@ -0,0 +1,101 @@
+/**
+ * \file dem_tile_cache.h
+ * \brief DEM sampled through a cache of square tiles loaded on demand
+ *
+ * A `DemTileSource` reads tiles of a DEM that is not held in memory, such as an open GeoTiff. Each `DemTileCache`
+ * keeps up to `max_tiles` of them and replaces the least recently used one, so sampling follows the area of the
+ * DEM in use rather than its size. A cache is used by one thread; threads sampling the same source each hold one.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_DEM_TILE_CACHE_H_
+#define _LANDMARK_TOOLS_DEM_TILE_CACHE_H_
+
+#include <stdbool.h>  // for bool
+#include <stdint.h>   // for int32_t, uint64_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Read a window of the DEM as row-major floats
+ *
+ * Called by every cache of a source, possibly from several threads at once.
+ *
+ * \return false if the window cannot be read
+ */
+typedef bool (*DemTileReader)(void *user, int32_t x0, int32_t y0, int32_t width, int32_t height, float *values);
+
+/**
+ * \brief DEM read by tiles
+ */
+typedef struct {
+    DemTileReader read;          /*!< \brief Reads the tiles */
+    void *user;                  /*!< \brief First argument of `read` */
+    int32_t image_cols;          /*!< \brief Width of the DEM */
+    int32_t image_rows;          /*!< \brief Height of the DEM */
+    int32_t tile_size;           /*!< \brief Pixels on a side of a tile */
+    int32_t max_tiles;           /*!< \brief Tiles kept by each cache */
+} DemTileSource;
+
+/**
+ * \brief Tiles of a `DemTileSource` held by one thread
+ */
+typedef struct {
+    const DemTileSource *source;
+    float *values;               /*!< \brief max_tiles tiles of tile_size x tile_size values */
+    int64_t *tile_of_slot;       /*!< \brief Tile index held by each slot, -1 if empty */
+    uint64_t *last_use;          /*!< \brief Clock of the last read of each slot */
+    uint64_t clock;
+    int32_t last_slot;           /*!< \brief Slot of the last read */
+    int32_t tiles_x;             /*!< \brief Tiles across the DEM */
+    bool failed;                 /*!< \brief A tile could not be read, and reads as NAN */
+} DemTileCache;
+
+/**
+ * \brief Allocate an empty cache
+ *
+ * \param[out] cache
+ * \param[in] source DEM, kept by the cache
+ * \return false if the source is invalid or malloc fails
+ */
+bool dem_tile_cache_init(DemTileCache *cache, const DemTileSource *source);
+
+/**
+ * \brief Free the tiles of a cache
+ */
+void dem_tile_cache_free(DemTileCache *cache);
+
+/**
+ * \brief Value of DEM pixel (x, y), loading its tile if needed
+ *
+ * \return the value, or NAN outside the DEM
+ */
+float dem_tile_cache_value(DemTileCache *cache, int32_t x, int32_t y);
+
+/**
+ * \brief `inter_float_matrix` of the DEM
+ *
+ * \return interpolated value if in bounds, NAN if out of bounds or one of the neighbors is NAN
+ */
+double dem_tile_cache_interpolate(DemTileCache *cache, double x, double y);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_DEM_TILE_CACHE_H_ */
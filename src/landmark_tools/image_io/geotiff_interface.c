@@ -19,21 +19,19 @@
 #include <gdal.h>
 #include <ogr_srs_api.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <cpl_conv.h> // for CPLMalloc(), CPLFree()
+#include "landmark_tools/utils/log.h"
 #include "landmark_tools/utils/safe_string.h"
 
-bool readGeoTiff(const char* fileName, GeoTiffData* data) {
-    GDALAllRegister();
-    GDALDatasetH hDataset = GDALOpen(fileName, GA_ReadOnly);
-    if (hDataset == NULL) {
-        SAFE_FPRINTF(stderr, 512, "Failed to open file: %s\n", fileName);
-        return false;
-    }
-    
+/**
+ \brief Read the raster size, geotransform and projection of an open dataset
+ */
+static bool read_geotiff_metadata(GDALDatasetH hDataset, GeoTiffData* data) {
     data->imageSize[0] = GDALGetRasterXSize(hDataset);
     data->imageSize[1] = GDALGetRasterYSize(hDataset);
     double adfGeoTransform[6];
@@ -52,31 +50,30 @@ bool readGeoTiff(const char* fileName, GeoTiffData* data) {
             
             const char *pszProjectionType = OSRGetAttrValue(hSRS, "PROJECTION", 0);
             if(strncmp(pszProjectionType, "Transverse_Mercator", 20)==0){
-                printf("UTM Projection Detected\n");
+                log_message(LOG_LEVEL_INFO, "UTM Projection Detected");
                 data->projection = UTM;
             }else if(strncmp(pszProjectionType, "Polar_Stereographic", 20)==0){
-                printf("Polar Stereographic Projection Detected\n");
+                log_message(LOG_LEVEL_INFO, "Polar Stereographic Projection Detected");
                 data->projection = STEREO;
             }else if(strncmp(pszProjectionType, "Stereographic", 20)==0){
-                printf("Stereographic Projection Detected\n");
+                log_message(LOG_LEVEL_INFO, "Stereographic Projection Detected");
                 data->projection = STEREO;
             }else if(strncmp(pszProjectionType, "Oblique_Stereographic", 20)==0){
-                printf("Oblique Stereographic Projection Detected\n");
+                log_message(LOG_LEVEL_INFO, "Oblique Stereographic Projection Detected");
                 data->projection = STEREO;
             }else if(strncmp(pszProjectionType, "Equirectangular", 15)==0){
-                printf("Equirectangular Projection Detected\n");
+                log_message(LOG_LEVEL_INFO, "Equirectangular Projection Detected");
                 data->projection = EQUIDISTANT_CYLINDRICAL;
                 //            }else if(strncmp(pszProjectionType, "Lambert_Conformal_Conic_2SP", 28)==0){
                 //                data->projection = LAMBERT;
             }else if(strncmp(pszProjectionType, "Orthographic", 12)==0){
-                printf("Orthographic Projection Detected\n");
+                log_message(LOG_LEVEL_INFO, "Orthographic Projection Detected");
                 data->projection = ORTHOGRAPHIC;
                 //            }else if(strncmp(pszProjectionType, "Lambert_Conformal_Conic_2SP", 28)==0){
                 //                data->projection = LAMBERT;
             }else{
                 SAFE_FPRINTF(stderr, 512, "Projection type %s is not supported", pszProjectionType);
                 OSRDestroySpatialReference(hSRS);
-                GDALClose(hDataset);
                 return false;
             }
             
@@ -85,25 +82,80 @@ bool readGeoTiff(const char* fileName, GeoTiffData* data) {
             data->natOrigin[0] = OSRGetProjParm(hSRS, SRS_PP_LATITUDE_OF_ORIGIN, 0, NULL);
             data->natOrigin[1] = OSRGetProjParm(hSRS, SRS_PP_CENTRAL_MERIDIAN, 0, NULL);
         }else if(OSRIsGeographic(hSRS)){
-            printf("Geographic coordinate system detected\n");
+            log_message(LOG_LEVEL_INFO, "Geographic coordinate system detected");
             data->projection = GEOGRAPHIC;
         }else{
             fprintf(stderr, "Failed to find projection.\n");
-            GDALClose(hDataset);
             return false;
         }
         
         OSRDestroySpatialReference(hSRS);
     }else{
         fprintf(stderr, "GDALGetProjectionRef failed to read metadata.\n");
-        GDALClose(hDataset);
         return false;
     }
     
+    return true;
+}
+
+/**
+ \brief Read a window of band 1 of an open dataset into values as floats, with the band scale and offset applied
+
+ \param[in] x0, y0, width, height window in pixels of the raster
+ \param[in] buf_width, buf_height size of the output; smaller than the window to average it down
+ \param[out] values buf_width x buf_height floats
+ */
+static bool read_geotiff_values(GDALRasterBandH hBand, int32_t x0, int32_t y0, int32_t width, int32_t height,
+                                int32_t buf_width, int32_t buf_height, float* values) {
+    // Reduced reads average the window, and take an overview of the band if there is one
+    GDALRasterIOExtraArg extra;
+    INIT_RASTERIO_EXTRA_ARG(extra);
+    extra.eResampleAlg = GRIORA_Average;
+    
+    // GDAL converts the Float64, Int16 and UInt16 bands to float as it reads them
+    if (GDALRasterIOEx(hBand, GF_Read, x0, y0, width, height, values,
+                       buf_width, buf_height, GDT_Float32, 0, 0, &extra) != CE_None) {
+        fprintf(stderr, "Failed to read raster data.\n");
+        return false;
+    }
+    
+    int64_t num_values = (int64_t)buf_width * (int64_t)buf_height;
+    double offset = GDALGetRasterOffset(hBand, NULL);
+    double scale = GDALGetRasterScale(hBand, NULL);
+    if(offset!=0 || scale !=1){
+        for(int64_t i=0; i<num_values; i++)
+            values[i] = (values[i]*scale) + offset;
+    }
+    return true;
+}
+
+/**
+ \brief Band 1 of an open dataset, if it holds a supported data type
+ */
+static GDALRasterBandH dem_band(GDALDatasetH hDataset) {
     GDALRasterBandH hBand = GDALGetRasterBand(hDataset, 1); // Assume band 1 is DEM
     if (hBand == NULL) {
         fprintf(stderr, "Raster band not found.\n");
-        GDALClose(hDataset);
+        return NULL;
+    }
+    int32_t dataType = GDALGetRasterDataType(hBand);
+    if(dataType != GDT_Float32 && dataType != GDT_Float64 && dataType != GDT_Int16 && dataType != GDT_UInt16){
+        fprintf(stderr, "Only Float32 / Int16 / UInt16/ Geotiffs are currently supported.\n");
+        return NULL;
+    }
+    return hBand;
+}
+
+/**
+ \brief Read a window of band 1 of an open dataset into data->demValues as floats, with the band scale and offset applied
+
+ \param[in] x0, y0, width, height window in pixels of the raster
+ \param[in] buf_width, buf_height size of the output; smaller than the window to average it down
+ */
+static bool read_geotiff_band(GDALDatasetH hDataset, int32_t x0, int32_t y0, int32_t width, int32_t height,
+                              int32_t buf_width, int32_t buf_height, GeoTiffData* data) {
+    GDALRasterBandH hBand = dem_band(hDataset);
+    if (hBand == NULL) {
         return false;
     }
     
@@ -111,97 +163,170 @@ bool readGeoTiff(const char* fileName, GeoTiffData* data) {
     double noDataValue = GDALGetRasterNoDataValue(hBand, &bGotNoData);
     data->noDataValue = bGotNoData ? noDataValue : NAN; // Default NoData value if not found
     
-    data->demValues = (float *) malloc(sizeof(float) * data->imageSize[0] * data->imageSize[1]);
+    int64_t num_values = (int64_t)buf_width * (int64_t)buf_height;
+    data->demValues = (float *) malloc(sizeof(float) * num_values);
     if(data->demValues == NULL){
         fprintf(stderr, "Failure to allocate memory.\n");
-        GDALClose(hDataset);
         return false;
     }
     
-    int32_t dataType = GDALGetRasterDataType(hBand);
-    
-    if(dataType == GDT_Float32){
-        if (GDALRasterIO(hBand, GF_Read, 0, 0, data->imageSize[0], data->imageSize[1], data->demValues,
-                         data->imageSize[0], data->imageSize[1], GDT_Float32, 0, 0) != CE_None) {
-            fprintf(stderr, "Failed to read raster data.\n");
-            GDALClose(hDataset);
-            CPLFree(data->demValues);
-            return false;
-        }
-    } else if (dataType == GDT_Float64){
-        double *demValues_float64 = (double *) malloc(sizeof(double) * data->imageSize[0] * data->imageSize[1]);
-        if(demValues_float64 == NULL){
-            fprintf(stderr, "Failure to allocate memory.\n");
-            GDALClose(hDataset);
-            return false;
-        }
-        
-        if (GDALRasterIO(hBand, GF_Read, 0, 0, data->imageSize[0], data->imageSize[1], demValues_float64,
-                            data->imageSize[0], data->imageSize[1], GDT_Float64, 0, 0) != CE_None) {
-            fprintf(stderr, "Failed to read raster data.\n");
-            GDALClose(hDataset);
-            CPLFree(data->demValues);
-            return false;
-        }
-        
-        for(int64_t i=0; i<((int64_t)data->imageSize[0] * (int64_t)data->imageSize[1]); i++)
-            data->demValues[i] = (float)demValues_float64[i]; // Lose precision
-        
-        free(demValues_float64);
-    }else if(dataType == GDT_Int16){
-        int16_t *demValues_int16 = (int16_t *) malloc(sizeof(int16_t) * data->imageSize[0] * data->imageSize[1]);
-        if(demValues_int16 == NULL){
-            fprintf(stderr, "Failure to allocate memory.\n");
-            GDALClose(hDataset);
-            return false;
-        }
-        
-        if (GDALRasterIO(hBand, GF_Read, 0, 0, data->imageSize[0], data->imageSize[1], demValues_int16,
-                         data->imageSize[0], data->imageSize[1], GDT_Int16, 0, 0) != CE_None) {
-            fprintf(stderr, "Failed to read raster data.\n");
-            GDALClose(hDataset);
-            CPLFree(data->demValues);
-            return false;
-        }
-        
-        for(int64_t i=0; i<((int64_t)data->imageSize[0] * (int64_t)data->imageSize[1]); i++)
-            data->demValues[i] = (float)demValues_int16[i];
-        
-        free(demValues_int16);
-    }else if(dataType == GDT_UInt16){
-        uint16_t *demValues_uint16 = (uint16_t *) malloc(sizeof(uint16_t) * data->imageSize[0] * data->imageSize[1]);
-        if(demValues_uint16 == NULL){
-            fprintf(stderr, "Failure to allocate memory.\n");
-            GDALClose(hDataset);
-            return false;
-        }
-        
-        if (GDALRasterIO(hBand, GF_Read, 0, 0, data->imageSize[0], data->imageSize[1], demValues_uint16,
-                         data->imageSize[0], data->imageSize[1], GDT_UInt16, 0, 0) != CE_None) {
-            fprintf(stderr, "Failed to read raster data.\n");
-            GDALClose(hDataset);
-            CPLFree(data->demValues);
-            return false;
-        }
-        
-        for(int64_t i=0; i<((int64_t)data->imageSize[0] * (int64_t)data->imageSize[1]); i++)
-            data->demValues[i] = (float)demValues_uint16[i];
-        
-        free(demValues_uint16);
-    }else{
+    if (!read_geotiff_values(hBand, x0, y0, width, height, buf_width, buf_height, data->demValues)) {
         free(data->demValues);
-        fprintf(stderr, "Only Float32 / Int16 / UInt16/ Geotiffs are currently supported.\n");
-        GDALClose(hDataset);
+        data->demValues = NULL;
         return false;
     }
-    
-    double offset = GDALGetRasterOffset(hBand, NULL);
-    double scale = GDALGetRasterScale(hBand, NULL);
-    if(offset!=0 || scale !=1){
-        for(int64_t i=0; i<((int64_t)data->imageSize[0] * (int64_t)data->imageSize[1]); i++)
-            data->demValues[i] = (data->demValues[i]*scale) + offset;
+    return true;
+}
+
+bool readGeoTiffInfo(const char* fileName, GeoTiffData* data) {
+    GDALAllRegister();
+    GDALDatasetH hDataset = GDALOpen(fileName, GA_ReadOnly);
+    if (hDataset == NULL) {
+        SAFE_FPRINTF(stderr, 512, "Failed to open file: %s\n", fileName);
+        return false;
+    }
+    data->demValues = NULL;
+    bool success = read_geotiff_metadata(hDataset, data);
+    GDALRasterBandH hBand = GDALGetRasterBand(hDataset, 1);
+    if (success && hBand != NULL) {
+        int bGotNoData;
+        double noDataValue = GDALGetRasterNoDataValue(hBand, &bGotNoData);
+        data->noDataValue = bGotNoData ? noDataValue : NAN;
     }
+    GDALClose(hDataset);
+    return success;
+}
 
+bool readGeoTiff(const char* fileName, GeoTiffData* data) {
+    GDALAllRegister();
+    GDALDatasetH hDataset = GDALOpen(fileName, GA_ReadOnly);
+    if (hDataset == NULL) {
+        SAFE_FPRINTF(stderr, 512, "Failed to open file: %s\n", fileName);
+        return false;
+    }
+    
+    bool success = read_geotiff_metadata(hDataset, data) &&
+                   read_geotiff_band(hDataset, 0, 0, data->imageSize[0], data->imageSize[1],
+                                     data->imageSize[0], data->imageSize[1], data);
     GDALClose(hDataset);
+    return success;
+}
+
+struct GeoTiffFile {
+    GDALDatasetH dataset;
+    GeoTiffData info;                  // georeferencing of the whole raster, with no values
+    pthread_mutex_t mutex;             // GDAL datasets cannot be read by two threads at once
+};
+
+GeoTiffFile* openGeoTiff(const char* fileName, int64_t cache_bytes, GeoTiffData* info) {
+    GDALAllRegister();
+    if (cache_bytes > 0) GDALSetCacheMax64(cache_bytes);
+    GeoTiffFile *file = (GeoTiffFile *)calloc(1, sizeof(GeoTiffFile));
+    if (file == NULL) {
+        fprintf(stderr, "Failure to allocate memory.\n");
+        return NULL;
+    }
+    file->dataset = GDALOpen(fileName, GA_ReadOnly);
+    if (file->dataset == NULL) {
+        SAFE_FPRINTF(stderr, 512, "Failed to open file: %s\n", fileName);
+        free(file);
+        return NULL;
+    }
+    pthread_mutex_init(&file->mutex, NULL);
+    if (!read_geotiff_metadata(file->dataset, &file->info)) {
+        closeGeoTiff(file);
+        return NULL;
+    }
+    GDALRasterBandH hBand = GDALGetRasterBand(file->dataset, 1);
+    if (hBand != NULL) {
+        int bGotNoData;
+        double noDataValue = GDALGetRasterNoDataValue(hBand, &bGotNoData);
+        file->info.noDataValue = bGotNoData ? noDataValue : NAN;
+    }
+    if (info != NULL) *info = file->info;
+    return file;
+}
+
+bool readGeoTiffFileWindow(GeoTiffFile* file, int32_t x0, int32_t y0, int32_t width, int32_t height,
+                           int32_t decimation, GeoTiffData* data) {
+    *data = file->info;
+    if (decimation < 1) decimation = 1;
+    
+    // Grow the window to whole blocks of the file, so that no block is decoded for a part of it
+    int block_x = 1, block_y = 1;
+    GDALRasterBandH hBand = GDALGetRasterBand(file->dataset, 1);
+    if (hBand != NULL) GDALGetBlockSize(hBand, &block_x, &block_y);
+    if (block_x < 1) block_x = 1;
+    if (block_y < 1) block_y = 1;
+    int64_t left = x0 < 0 ? 0 : x0;
+    int64_t top = y0 < 0 ? 0 : y0;
+    int64_t right = (int64_t)x0 + width;
+    int64_t bottom = (int64_t)y0 + height;
+    left -= left % block_x;
+    top -= top % block_y;
+    right = ((right + block_x - 1)/block_x)*block_x;
+    bottom = ((bottom + block_y - 1)/block_y)*block_y;
+    if (right > data->imageSize[0]) right = data->imageSize[0];
+    if (bottom > data->imageSize[1]) bottom = data->imageSize[1];
+    
+    // Whole output pixels only
+    int32_t buf_width = (int32_t)((right - left)/decimation);
+    int32_t buf_height = (int32_t)((bottom - top)/decimation);
+    if (buf_width <= 0 || buf_height <= 0) {
+        fprintf(stderr, "readGeoTiffFileWindow() ==>> window is outside the raster\n");
+        return false;
+    }
+    
+    pthread_mutex_lock(&file->mutex);
+    bool success = read_geotiff_band(file->dataset, (int32_t)left, (int32_t)top, buf_width*decimation,
+                                     buf_height*decimation, buf_width, buf_height, data);
+    pthread_mutex_unlock(&file->mutex);
+    if (!success) {
+        return false;
+    }
+    
+    // Output pixel (0, 0) averages the DEM pixels [0, decimation) from the window corner, so it stands where
+    // DEM pixel (decimation - 1)/2 did
+    double center = (decimation - 1)/2.0;
+    data->origin[0] += (left + center)*data->pixelSize[0];
+    data->origin[1] += (top + center)*data->pixelSize[1];
+    data->pixelSize[0] *= decimation;
+    data->pixelSize[1] *= decimation;
+    data->imageSize[0] = buf_width;
+    data->imageSize[1] = buf_height;
     return true;
 }
+
+bool readGeoTiffFileValues(GeoTiffFile* file, int32_t x0, int32_t y0, int32_t width, int32_t height,
+                           float* values) {
+    if (x0 < 0 || y0 < 0 || width <= 0 || height <= 0 ||
+        (int64_t)x0 + width > file->info.imageSize[0] || (int64_t)y0 + height > file->info.imageSize[1]) {
+        fprintf(stderr, "readGeoTiffFileValues() ==>> window is outside the raster\n");
+        return false;
+    }
+    pthread_mutex_lock(&file->mutex);
+    GDALRasterBandH hBand = dem_band(file->dataset);
+    bool success = hBand != NULL && read_geotiff_values(hBand, x0, y0, width, height, width, height, values);
+    pthread_mutex_unlock(&file->mutex);
+    return success;
+}
+
+void closeGeoTiff(GeoTiffFile* file) {
+    if (file == NULL) return;
+    if (file->dataset != NULL) {
+        GDALClose(file->dataset);
+        pthread_mutex_destroy(&file->mutex);
+    }
+    free(file);
+}
+
+bool readGeoTiffWindow(const char* fileName, int32_t x0, int32_t y0, int32_t width, int32_t height,
+                       int32_t decimation, GeoTiffData* data) {
+    GeoTiffFile *file = openGeoTiff(fileName, 0, NULL);
+    if (file == NULL) {
+        return false;
+    }
+    bool success = readGeoTiffFileWindow(file, x0, y0, width, height, decimation, data);
+    closeGeoTiff(file);
+    return success;
+}
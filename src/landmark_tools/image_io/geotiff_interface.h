@@ -45,6 +45,84 @@ extern "C" {
 */
 bool readGeoTiff(const char* fileName, GeoTiffData* data);
 
+/**
+ \brief Read the size, georeferencing and no data value of a GeoTiff or PDS4 file without its raster
+ 
+ \param[in] fileName 
+ \param[out] data demValues is set to NULL
+ \return true if successful 
+ \return false if ioerror
+*/
+bool readGeoTiffInfo(const char* fileName, GeoTiffData* data);
+
+/**
+ \brief Read a window of a GeoTiff or PDS4 file into a GeoTiffData struct
+ 
+ The window is grown to whole blocks of the file and clipped to the raster. With a decimation above 1, each value
+ averages a square of that many DEM pixels on a side, taken from an overview of the file when it has one. The
+ origin, pixel size and image size of data describe the values read, so they are used as those of a whole file.
+ 
+ \param[in] fileName 
+ \param[in] x0 first column of the window in DEM pixels
+ \param[in] y0 first row of the window in DEM pixels
+ \param[in] width columns of the window in DEM pixels
+ \param[in] height rows of the window in DEM pixels
+ \param[in] decimation DEM pixels per value along each axis, 1 for the full resolution
+ \param[out] data 
+ \return true if successful 
+ \return false if ioerror or the window is outside the raster
+*/
+bool readGeoTiffWindow(const char* fileName, int32_t x0, int32_t y0, int32_t width, int32_t height,
+                       int32_t decimation, GeoTiffData* data);
+
+/**
+ \brief GeoTiff or PDS4 file kept open between reads
+ */
+typedef struct GeoTiffFile GeoTiffFile;
+
+/**
+ \brief Open a GeoTiff or PDS4 file for reading windows of it
+ 
+ GDAL keeps the blocks it decodes in its cache, so the blocks shared by windows read one after another are decoded
+ once while the cache holds them.
+ 
+ \param[in] fileName 
+ \param[in] cache_bytes size of the GDAL block cache in bytes, or 0 to keep the GDAL setting. The cache is shared by
+                        every open file
+ \param[out] info size, georeferencing and no data value of the file, with demValues set to NULL. May be NULL
+ \return NULL if ioerror
+*/
+GeoTiffFile* openGeoTiff(const char* fileName, int64_t cache_bytes, GeoTiffData* info);
+
+/**
+ \brief `readGeoTiffWindow` of an open file
+ 
+ Reads of one file from several threads run one at a time.
+*/
+bool readGeoTiffFileWindow(GeoTiffFile* file, int32_t x0, int32_t y0, int32_t width, int32_t height,
+                           int32_t decimation, GeoTiffData* data);
+
+/**
+ \brief Read a window of the DEM of an open file into a buffer, with the band scale and offset applied
+ 
+ Unlike `readGeoTiffFileWindow`, the window is not grown to the blocks of the file. It is the reader of the tiles of
+ a `DemTileCache`. Reads of one file from several threads run one at a time.
+ 
+ \param[in] file 
+ \param[in] x0, y0, width, height window in pixels of the raster, which must lie inside it
+ \param[out] values width x height floats, row by row
+ \return false if the window is outside the raster or ioerror
+*/
+bool readGeoTiffFileValues(GeoTiffFile* file, int32_t x0, int32_t y0, int32_t width, int32_t height,
+                           float* values);
+
+/**
+ \brief Close a file from `openGeoTiff`
+ 
+ \param[in] file may be NULL
+*/
+void closeGeoTiff(GeoTiffFile* file);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,769 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <ctype.h>                  // for isspace, isdigit, tolower
+#include <pthread.h>                // for pthread_create, pthread_mutex_t
+#include <stdio.h>                  // for fopen, fread, fwrite, fclose
+#include <stdlib.h>                 // for malloc, calloc, free
+#include <string.h>                 // for memcpy, memcmp, strlen
+#include <zlib.h>                   // for inflate, deflate, crc32
+
+#include "landmark_tools/image_io/image_stream.h"
+#include "landmark_tools/utils/safe_string.h"
+
+#define NUM_SLOTS 2
+#define PNG_CHUNK_BYTES (64*1024) //size of the IDAT chunks read or written at once
+
+static const uint8_t png_signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+typedef struct {
+    uint8_t *pixels;       //!< interleaved rows, as in the file
+    int32_t nrows;
+    bool full;
+} StreamSlot;
+
+struct Image_Reader {
+    FILE *fp;
+    bool png;
+    int32_t cols;
+    int32_t rows;
+    int32_t channels;
+    size_t row_bytes;
+    int32_t rows_per_slot;
+    int32_t next_row;      //!< next row returned by Read_Image_Rows
+    int32_t read_slot;     //!< slot the consumer reads next
+    int32_t slot_row;      //!< rows of read_slot already returned
+    bool closing;
+    bool error;
+    StreamSlot slots[NUM_SLOTS];
+    z_stream z;
+    bool z_init;
+    uint8_t *in;           //!< compressed bytes of the current IDAT chunk
+    uint32_t chunk_left;   //!< bytes of the current IDAT chunk not read yet
+    bool crc_pending;      //!< the crc of the current chunk is not read yet
+    uint8_t *filtered;     //!< filter type and bytes of one row
+    uint8_t *prev;         //!< previous decoded row
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+struct Image_Writer {
+    FILE *fp;
+    bool png;
+    int32_t cols;
+    int32_t rows;
+    int32_t channels;
+    size_t row_bytes;
+    const uint8_t *source; //!< channel separated image of Write_Image_Background, else rows come from the slots
+    int32_t rows_per_slot;
+    int32_t next_row;      //!< next row expected by Append_Image_Rows
+    int32_t fill_slot;     //!< slot the producer fills next
+    int32_t rows_written;  //!< rows encoded by the background thread
+    bool closing;
+    bool error;
+    StreamSlot slots[NUM_SLOTS];
+    z_stream z;
+    bool z_init;
+    uint8_t *out;          //!< compressed bytes of the next IDAT chunk
+    uint8_t *row;          //!< interleaved row of `source`
+    uint8_t *filtered;     //!< the row under each of the 5 png filters
+    uint8_t *prev;         //!< previous row
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static void interleave_pixels(const uint8_t *planes, size_t plane_stride, size_t n, int32_t channels, uint8_t *out)
+{
+    if(channels == 1){
+        memcpy(out, planes, n);
+        return;
+    }
+    const uint8_t *r = planes;
+    const uint8_t *g = planes + plane_stride;
+    const uint8_t *b = planes + 2*plane_stride;
+    for(size_t i = 0; i < n; i++){
+        out[3*i] = r[i];
+        out[3*i + 1] = g[i];
+        out[3*i + 2] = b[i];
+    }
+}
+
+static void separate_pixels(const uint8_t *in, size_t n, int32_t channels, uint8_t *planes, size_t plane_stride)
+{
+    if(channels == 1){
+        memcpy(planes, in, n);
+        return;
+    }
+    uint8_t *r = planes;
+    uint8_t *g = planes + plane_stride;
+    uint8_t *b = planes + 2*plane_stride;
+    for(size_t i = 0; i < n; i++){
+        r[i] = in[3*i];
+        g[i] = in[3*i + 1];
+        b[i] = in[3*i + 2];
+    }
+}
+
+static uint32_t read_be32(const uint8_t *bytes)
+{
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+static void put_be32(uint8_t *bytes, uint32_t value)
+{
+    bytes[0] = (uint8_t)(value >> 24);
+    bytes[1] = (uint8_t)(value >> 16);
+    bytes[2] = (uint8_t)(value >> 8);
+    bytes[3] = (uint8_t)value;
+}
+
+static int32_t paeth(int32_t a, int32_t b, int32_t c)
+{
+    int32_t p = a + b - c;
+    int32_t pa = abs(p - a);
+    int32_t pb = abs(p - b);
+    int32_t pc = abs(p - c);
+    if(pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+static int32_t slot_rows(size_t row_bytes, int32_t rows)
+{
+    int64_t n = IMAGE_STREAM_BUFFER_BYTES/(int64_t)row_bytes;
+    if(n < 1) n = 1;
+    if(n > rows) n = rows;
+    return (int32_t)n;
+}
+
+/**
+ \brief Read the next whitespace separated integer of a PGM header, skipping comments
+ */
+static bool read_pgm_value(FILE *fp, int32_t *value)
+{
+    int c = fgetc(fp);
+    while(c == '#' || isspace(c)){
+        if(c == '#'){
+            while(c != '\n' && c != EOF) c = fgetc(fp);
+        }
+        c = fgetc(fp);
+    }
+    if(!isdigit(c)) return false;
+    int64_t v = 0;
+    while(isdigit(c)){
+        v = v*10 + (c - '0');
+        if(v > INT32_MAX) return false;
+        c = fgetc(fp);
+    }
+    *value = (int32_t)v;
+    // A single whitespace character ends the value, which starts the pixels after maxval
+    return isspace(c);
+}
+
+static bool read_png_header(Image_Reader *reader)
+{
+    uint8_t ihdr[8 + 13];
+    if(fread(ihdr, 1, sizeof(ihdr), reader->fp) != sizeof(ihdr) || read_be32(ihdr) != 13 ||
+       memcmp(&ihdr[4], "IHDR", 4) != 0){
+        return false;
+    }
+    uint32_t cols = read_be32(&ihdr[8]);
+    uint32_t rows = read_be32(&ihdr[12]);
+    uint8_t depth = ihdr[16], color = ihdr[17], interlace = ihdr[20];
+    if(cols == 0 || rows == 0 || cols > INT32_MAX || rows > INT32_MAX || depth != 8 ||
+       (color != 0 && color != 2) || ihdr[18] != 0 || ihdr[19] != 0 || interlace != 0){
+        return false;
+    }
+    reader->cols = (int32_t)cols;
+    reader->rows = (int32_t)rows;
+    reader->channels = color == 2 ? 3 : 1;
+    reader->crc_pending = true;
+    return true;
+}
+
+/**
+ \brief Move to the next IDAT chunk holding data, skipping ancillary chunks
+ */
+static bool next_idat(Image_Reader *reader)
+{
+    while(reader->chunk_left == 0){
+        uint8_t header[8];
+        if(reader->crc_pending && fread(header, 1, 4, reader->fp) != 4) return false;
+        reader->crc_pending = false;
+        if(fread(header, 1, 8, reader->fp) != 8) return false;
+        uint32_t length = read_be32(header);
+        if(memcmp(&header[4], "IEND", 4) == 0) return false;
+        if(memcmp(&header[4], "IDAT", 4) == 0){
+            reader->chunk_left = length;
+            reader->crc_pending = true;
+        }else if(fseek(reader->fp, (long)length + 4, SEEK_CUR) != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool inflate_bytes(Image_Reader *reader, uint8_t *out, size_t n)
+{
+    z_stream *z = &reader->z;
+    z->next_out = out;
+    z->avail_out = (uInt)n;
+    while(z->avail_out > 0){
+        if(z->avail_in == 0){
+            if(!next_idat(reader)) return false;
+            uint32_t count = reader->chunk_left < PNG_CHUNK_BYTES ? reader->chunk_left : PNG_CHUNK_BYTES;
+            if(fread(reader->in, 1, count, reader->fp) != count) return false;
+            reader->chunk_left -= count;
+            z->next_in = reader->in;
+            z->avail_in = count;
+        }
+        int ret = inflate(z, Z_NO_FLUSH);
+        if(ret == Z_STREAM_END) return z->avail_out == 0;
+        if(ret != Z_OK && ret != Z_BUF_ERROR) return false;
+    }
+    return true;
+}
+
+static bool unfilter_row(uint8_t filter, uint8_t *row, const uint8_t *prev, size_t n, int32_t bpp)
+{
+    switch(filter){
+        case 0:
+            break;
+        case 1:
+            for(size_t i = bpp; i < n; i++) row[i] += row[i - bpp];
+            break;
+        case 2:
+            for(size_t i = 0; i < n; i++) row[i] += prev[i];
+            break;
+        case 3:
+            for(size_t i = 0; i < (size_t)bpp; i++) row[i] += prev[i] >> 1;
+            for(size_t i = bpp; i < n; i++) row[i] += (uint8_t)((row[i - bpp] + prev[i]) >> 1);
+            break;
+        case 4:
+            for(size_t i = 0; i < (size_t)bpp; i++) row[i] += prev[i];
+            for(size_t i = bpp; i < n; i++) row[i] += (uint8_t)paeth(row[i - bpp], prev[i], prev[i - bpp]);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static bool decode_rows(Image_Reader *reader, uint8_t *pixels, int32_t nrows)
+{
+    size_t n = reader->row_bytes;
+    if(!reader->png){
+        return fread(pixels, 1, n*nrows, reader->fp) == n*nrows;
+    }
+    for(int32_t i = 0; i < nrows; i++){
+        uint8_t *row = &pixels[(size_t)i*n];
+        if(!inflate_bytes(reader, reader->filtered, n + 1)) return false;
+        memcpy(row, reader->filtered + 1, n);
+        if(!unfilter_row(reader->filtered[0], row, reader->prev, n, reader->channels)) return false;
+        memcpy(reader->prev, row, n);
+    }
+    return true;
+}
+
+static void *reader_thread(void *arg)
+{
+    Image_Reader *reader = (Image_Reader *)arg;
+    int32_t fill_index = 0;
+    int32_t decoded = 0;
+
+    pthread_mutex_lock(&reader->mutex);
+    while(decoded < reader->rows){
+        StreamSlot *slot = &reader->slots[fill_index];
+        while(slot->full && !reader->closing){
+            pthread_cond_wait(&reader->cond, &reader->mutex);
+        }
+        if(reader->closing) break;
+
+        // Decoding happens without the lock so the consumer can read the other slot
+        pthread_mutex_unlock(&reader->mutex);
+        int32_t n = reader->rows - decoded < reader->rows_per_slot ? reader->rows - decoded : reader->rows_per_slot;
+        bool ok = decode_rows(reader, slot->pixels, n);
+        pthread_mutex_lock(&reader->mutex);
+
+        if(!ok){
+            reader->error = true;
+            pthread_cond_broadcast(&reader->cond);
+            break;
+        }
+        slot->nrows = n;
+        slot->full = true;
+        decoded += n;
+        fill_index = (fill_index + 1) % NUM_SLOTS;
+        pthread_cond_broadcast(&reader->cond);
+    }
+    pthread_mutex_unlock(&reader->mutex);
+    return NULL;
+}
+
+static void free_reader(Image_Reader *reader)
+{
+    for(int32_t i = 0; i < NUM_SLOTS; i++){
+        free(reader->slots[i].pixels);
+    }
+    if(reader->z_init) inflateEnd(&reader->z);
+    free(reader->in);
+    free(reader->filtered);
+    free(reader->prev);
+    if(reader->fp != NULL) fclose(reader->fp);
+    free(reader);
+}
+
+Image_Reader *Open_Image_Reader(const char *filename, int32_t *cols, int32_t *rows, int32_t *channels)
+{
+    Image_Reader *reader = (Image_Reader *)calloc(1, sizeof(Image_Reader));
+    if(reader == NULL){
+        SAFE_PRINTF(512, "Open_Image_Reader() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        return NULL;
+    }
+    reader->fp = fopen(filename, "rb");
+    uint8_t magic[8];
+    if(reader->fp == NULL || fread(magic, 1, 8, reader->fp) != 8){
+        free_reader(reader);
+        return NULL;
+    }
+
+    bool supported = false;
+    if(memcmp(magic, png_signature, 8) == 0){
+        reader->png = true;
+        supported = read_png_header(reader);
+    }else if(magic[0] == 'P' && magic[1] == '5' && fseek(reader->fp, 2, SEEK_SET) == 0){
+        int32_t maxval = 0;
+        reader->channels = 1;
+        supported = read_pgm_value(reader->fp, &reader->cols) && read_pgm_value(reader->fp, &reader->rows) &&
+                    read_pgm_value(reader->fp, &maxval) && maxval == 255 && reader->cols > 0 && reader->rows > 0;
+    }
+    if(!supported){
+        free_reader(reader);
+        return NULL;
+    }
+
+    reader->row_bytes = (size_t)reader->cols*reader->channels;
+    reader->rows_per_slot = slot_rows(reader->row_bytes, reader->rows);
+    bool allocated = true;
+    for(int32_t i = 0; i < NUM_SLOTS; i++){
+        reader->slots[i].pixels = (uint8_t *)malloc(reader->row_bytes*reader->rows_per_slot);
+        allocated &= reader->slots[i].pixels != NULL;
+    }
+    if(reader->png){
+        reader->in = (uint8_t *)malloc(PNG_CHUNK_BYTES);
+        reader->filtered = (uint8_t *)malloc(reader->row_bytes + 1);
+        reader->prev = (uint8_t *)calloc(reader->row_bytes, 1);
+        allocated &= reader->in != NULL && reader->filtered != NULL && reader->prev != NULL;
+        reader->z_init = allocated && inflateInit(&reader->z) == Z_OK;
+        allocated &= reader->z_init;
+    }
+    if(!allocated){
+        SAFE_PRINTF(512, "Open_Image_Reader() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        free_reader(reader);
+        return NULL;
+    }
+
+    pthread_mutex_init(&reader->mutex, NULL);
+    pthread_cond_init(&reader->cond, NULL);
+    if(pthread_create(&reader->thread, NULL, reader_thread, reader) != 0){
+        SAFE_PRINTF(512, "Open_Image_Reader() ==>> failed to start reader thread for %s\n", filename);
+        pthread_mutex_destroy(&reader->mutex);
+        pthread_cond_destroy(&reader->cond);
+        free_reader(reader);
+        return NULL;
+    }
+    *cols = reader->cols;
+    *rows = reader->rows;
+    *channels = reader->channels;
+    return reader;
+}
+
+bool Read_Image_Rows(Image_Reader *reader, uint8_t *rows, size_t plane_stride, int32_t nrows)
+{
+    if(reader->next_row + nrows > reader->rows){
+        SAFE_PRINTF(512, "Read_Image_Rows() ==>> %d rows exceed image height %d\n",
+                    reader->next_row + nrows, reader->rows);
+        return false;
+    }
+
+    int32_t done = 0;
+    while(done < nrows){
+        pthread_mutex_lock(&reader->mutex);
+        StreamSlot *slot = &reader->slots[reader->read_slot];
+        while(!slot->full && !reader->error){
+            pthread_cond_wait(&reader->cond, &reader->mutex);
+        }
+        bool full = slot->full;
+        pthread_mutex_unlock(&reader->mutex);
+        if(!full){
+            printf("Read_Image_Rows() ==>> failed to decode the image\n");
+            return false;
+        }
+
+        // The slot is owned by the consumer until it is marked empty
+        int32_t n = slot->nrows - reader->slot_row < nrows - done ? slot->nrows - reader->slot_row : nrows - done;
+        separate_pixels(&slot->pixels[(size_t)reader->slot_row*reader->row_bytes], (size_t)n*reader->cols,
+                        reader->channels, &rows[(size_t)done*reader->cols], plane_stride);
+        reader->slot_row += n;
+        reader->next_row += n;
+        done += n;
+
+        if(reader->slot_row == slot->nrows){
+            pthread_mutex_lock(&reader->mutex);
+            slot->full = false;
+            pthread_cond_broadcast(&reader->cond);
+            pthread_mutex_unlock(&reader->mutex);
+            reader->read_slot = (reader->read_slot + 1) % NUM_SLOTS;
+            reader->slot_row = 0;
+        }
+    }
+    return true;
+}
+
+void Close_Image_Reader(Image_Reader *reader)
+{
+    if(reader == NULL) return;
+    pthread_mutex_lock(&reader->mutex);
+    reader->closing = true;
+    pthread_cond_broadcast(&reader->cond);
+    pthread_mutex_unlock(&reader->mutex);
+    pthread_join(reader->thread, NULL);
+    pthread_mutex_destroy(&reader->mutex);
+    pthread_cond_destroy(&reader->cond);
+    free_reader(reader);
+}
+
+static bool write_chunk(FILE *fp, const char *type, const uint8_t *data, size_t n)
+{
+    uint8_t header[8];
+    put_be32(header, (uint32_t)n);
+    memcpy(&header[4], type, 4);
+    uLong crc = crc32(0L, (const Bytef *)type, 4);
+    if(n > 0) crc = crc32(crc, data, (uInt)n);
+    uint8_t crc_bytes[4];
+    put_be32(crc_bytes, (uint32_t)crc);
+    return fwrite(header, 1, 8, fp) == 8 && (n == 0 || fwrite(data, 1, n, fp) == n) && fwrite(crc_bytes, 1, 4, fp) == 4;
+}
+
+/**
+ \brief Compress bytes into the pending IDAT chunk, writing the chunk whenever it is full
+ */
+static bool deflate_bytes(Image_Writer *writer, const uint8_t *data, size_t n, int flush)
+{
+    z_stream *z = &writer->z;
+    z->next_in = (Bytef *)data;
+    z->avail_in = (uInt)n;
+    while(true){
+        int ret = deflate(z, flush);
+        if(ret == Z_STREAM_ERROR) return false;
+        bool done = flush == Z_FINISH ? ret == Z_STREAM_END : z->avail_in == 0 && z->avail_out > 0;
+        if(z->avail_out == 0 || (done && flush == Z_FINISH)){
+            size_t count = PNG_CHUNK_BYTES - z->avail_out;
+            if(count > 0 && !write_chunk(writer->fp, "IDAT", writer->out, count)) return false;
+            z->next_out = writer->out;
+            z->avail_out = PNG_CHUNK_BYTES;
+        }
+        if(done) return true;
+    }
+}
+
+/**
+ \brief Filter a row with each png filter and return the filtered row with the smallest sum of absolute values
+ */
+static const uint8_t *filter_row(Image_Writer *writer, const uint8_t *row)
+{
+    size_t n = writer->row_bytes;
+    size_t bpp = writer->channels;
+    const uint8_t *prev = writer->prev;
+    const uint8_t *best = NULL;
+    uint64_t best_cost = UINT64_MAX;
+    for(uint8_t filter = 0; filter < 5; filter++){
+        uint8_t *out = &writer->filtered[filter*(n + 1)];
+        uint8_t *bytes = out + 1;
+        out[0] = filter;
+        switch(filter){
+            case 0:
+                memcpy(bytes, row, n);
+                break;
+            case 1:
+                memcpy(bytes, row, bpp);
+                for(size_t i = bpp; i < n; i++) bytes[i] = row[i] - row[i - bpp];
+                break;
+            case 2:
+                for(size_t i = 0; i < n; i++) bytes[i] = row[i] - prev[i];
+                break;
+            case 3:
+                for(size_t i = 0; i < bpp; i++) bytes[i] = row[i] - (prev[i] >> 1);
+                for(size_t i = bpp; i < n; i++) bytes[i] = row[i] - (uint8_t)((row[i - bpp] + prev[i]) >> 1);
+                break;
+            default:
+                for(size_t i = 0; i < bpp; i++) bytes[i] = row[i] - prev[i];
+                for(size_t i = bpp; i < n; i++) bytes[i] = row[i] - (uint8_t)paeth(row[i - bpp], prev[i], prev[i - bpp]);
+                break;
+        }
+        uint64_t cost = 0;
+        for(size_t i = 0; i < n; i++) cost += (uint64_t)abs((int8_t)bytes[i]);
+        if(cost < best_cost){
+            best_cost = cost;
+            best = out;
+        }
+    }
+    return best;
+}
+
+static bool encode_row(Image_Writer *writer, const uint8_t *row)
+{
+    size_t n = writer->row_bytes;
+    if(!writer->png){
+        return fwrite(row, 1, n, writer->fp) == n;
+    }
+    bool ok = deflate_bytes(writer, filter_row(writer, row), n + 1, Z_NO_FLUSH);
+    memcpy(writer->prev, row, n);
+    return ok;
+}
+
+static void *writer_thread(void *arg)
+{
+    Image_Writer *writer = (Image_Writer *)arg;
+    if(writer->source != NULL){
+        size_t plane_stride = (size_t)writer->cols*writer->rows;
+        bool ok = true;
+        int32_t i = 0;
+        for(; i < writer->rows && ok; i++){
+            interleave_pixels(&writer->source[(size_t)i*writer->cols], plane_stride, writer->cols, writer->channels,
+                              writer->row);
+            ok = encode_row(writer, writer->row);
+        }
+        writer->error = !ok;
+        writer->rows_written = ok ? i : i - 1;
+        return NULL;
+    }
+
+    int32_t write_index = 0;
+    pthread_mutex_lock(&writer->mutex);
+    while(true){
+        StreamSlot *slot = &writer->slots[write_index];
+        while(!slot->full && !writer->closing){
+            pthread_cond_wait(&writer->cond, &writer->mutex);
+        }
+        if(!slot->full) break; // closing and nothing left to write
+
+        // Encoding and io happen without the lock so the producer can fill the other slot
+        pthread_mutex_unlock(&writer->mutex);
+        bool ok = true;
+        for(int32_t i = 0; i < slot->nrows && ok; i++){
+            ok = encode_row(writer, &slot->pixels[(size_t)i*writer->row_bytes]);
+        }
+        pthread_mutex_lock(&writer->mutex);
+
+        writer->error |= !ok;
+        writer->rows_written += slot->nrows;
+        slot->full = false;
+        write_index = (write_index + 1) % NUM_SLOTS;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    return NULL;
+}
+
+static void free_writer(Image_Writer *writer)
+{
+    for(int32_t i = 0; i < NUM_SLOTS; i++){
+        free(writer->slots[i].pixels);
+    }
+    if(writer->z_init) deflateEnd(&writer->z);
+    free(writer->out);
+    free(writer->row);
+    free(writer->filtered);
+    free(writer->prev);
+    free(writer);
+}
+
+static bool is_pgm_filename(const char *filename)
+{
+    size_t length = strlen(filename);
+    return length >= 4 && filename[length - 4] == '.' && tolower(filename[length - 3]) == 'p' &&
+           tolower(filename[length - 2]) == 'g' && tolower(filename[length - 1]) == 'm';
+}
+
+static bool write_image_header(Image_Writer *writer)
+{
+    if(!writer->png){
+        return fprintf(writer->fp, "P5\n%d %d\n255\n", writer->cols, writer->rows) > 0;
+    }
+    uint8_t ihdr[13];
+    put_be32(&ihdr[0], (uint32_t)writer->cols);
+    put_be32(&ihdr[4], (uint32_t)writer->rows);
+    ihdr[8] = 8;                                // bit depth
+    ihdr[9] = writer->channels == 3 ? 2 : 0;    // rgb or gray
+    ihdr[10] = 0;                               // deflate
+    ihdr[11] = 0;                               // adaptive filtering
+    ihdr[12] = 0;                               // no interlace
+    return fwrite(png_signature, 1, 8, writer->fp) == 8 && write_chunk(writer->fp, "IHDR", ihdr, sizeof(ihdr));
+}
+
+static Image_Writer *open_writer(const char *filename, const uint8_t *source, int32_t cols, int32_t rows,
+                                 int32_t channels)
+{
+    bool png = !is_pgm_filename(filename);
+    if(cols <= 0 || rows <= 0 || (channels != 1 && !(png && channels == 3))){
+        SAFE_PRINTF(512, "Open_Image_Writer() ==>> invalid image size %d x %d x %d for %s\n",
+                    cols, rows, channels, filename);
+        return NULL;
+    }
+
+    Image_Writer *writer = (Image_Writer *)calloc(1, sizeof(Image_Writer));
+    if(writer == NULL){
+        SAFE_PRINTF(512, "Open_Image_Writer() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        return NULL;
+    }
+    writer->png = png;
+    writer->cols = cols;
+    writer->rows = rows;
+    writer->channels = channels;
+    writer->row_bytes = (size_t)cols*channels;
+    writer->source = source;
+
+    bool allocated = true;
+    if(source != NULL){
+        writer->row = (uint8_t *)malloc(writer->row_bytes);
+        allocated &= writer->row != NULL;
+    }else{
+        writer->rows_per_slot = slot_rows(writer->row_bytes, rows);
+        for(int32_t i = 0; i < NUM_SLOTS; i++){
+            writer->slots[i].pixels = (uint8_t *)malloc(writer->row_bytes*writer->rows_per_slot);
+            allocated &= writer->slots[i].pixels != NULL;
+        }
+    }
+    if(png){
+        writer->out = (uint8_t *)malloc(PNG_CHUNK_BYTES);
+        writer->filtered = (uint8_t *)malloc(5*(writer->row_bytes + 1));
+        writer->prev = (uint8_t *)calloc(writer->row_bytes, 1);
+        allocated &= writer->out != NULL && writer->filtered != NULL && writer->prev != NULL;
+        writer->z_init = allocated && deflateInit(&writer->z, Z_DEFAULT_COMPRESSION) == Z_OK;
+        allocated &= writer->z_init;
+        writer->z.next_out = writer->out;
+        writer->z.avail_out = PNG_CHUNK_BYTES;
+    }
+    if(!allocated){
+        SAFE_PRINTF(512, "Open_Image_Writer() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        free_writer(writer);
+        return NULL;
+    }
+
+    writer->fp = fopen(filename, "wb");
+    if(writer->fp == NULL){
+        SAFE_PRINTF(512, "Open_Image_Writer() ==>> cannot open file %s to write\n", filename);
+        free_writer(writer);
+        return NULL;
+    }
+    if(!write_image_header(writer)){
+        SAFE_PRINTF(512, "Open_Image_Writer() ==>> failed to write header of %s\n", filename);
+        fclose(writer->fp);
+        free_writer(writer);
+        return NULL;
+    }
+
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    if(pthread_create(&writer->thread, NULL, writer_thread, writer) != 0){
+        SAFE_PRINTF(512, "Open_Image_Writer() ==>> failed to start writer thread for %s\n", filename);
+        pthread_mutex_destroy(&writer->mutex);
+        pthread_cond_destroy(&writer->cond);
+        fclose(writer->fp);
+        free_writer(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+Image_Writer *Open_Image_Writer(const char *filename, int32_t cols, int32_t rows, int32_t channels)
+{
+    return open_writer(filename, NULL, cols, rows, channels);
+}
+
+Image_Writer *Write_Image_Background(const char *filename, const uint8_t *img, int32_t cols, int32_t rows,
+                                     int32_t channels)
+{
+    Image_Writer *writer = open_writer(filename, img, cols, rows, channels);
+    if(writer != NULL) writer->next_row = rows;
+    return writer;
+}
+
+bool Append_Image_Rows(Image_Writer *writer, const uint8_t *rows, size_t plane_stride, int32_t nrows)
+{
+    if(writer->source != NULL || writer->next_row + nrows > writer->rows){
+        SAFE_PRINTF(512, "Append_Image_Rows() ==>> %d rows exceed image height %d\n",
+                    writer->next_row + nrows, writer->rows);
+        return false;
+    }
+
+    int32_t appended = 0;
+    while(appended < nrows){
+        int32_t n = nrows - appended;
+        if(n > writer->rows_per_slot) n = writer->rows_per_slot;
+
+        pthread_mutex_lock(&writer->mutex);
+        StreamSlot *slot = &writer->slots[writer->fill_slot];
+        while(slot->full && !writer->error){
+            pthread_cond_wait(&writer->cond, &writer->mutex);
+        }
+        bool error = writer->error;
+        pthread_mutex_unlock(&writer->mutex);
+        if(error) return false;
+
+        // The slot is owned by the producer until it is marked full
+        interleave_pixels(&rows[(size_t)appended*writer->cols], plane_stride, (size_t)n*writer->cols,
+                          writer->channels, slot->pixels);
+        slot->nrows = n;
+
+        pthread_mutex_lock(&writer->mutex);
+        slot->full = true;
+        pthread_cond_broadcast(&writer->cond);
+        pthread_mutex_unlock(&writer->mutex);
+
+        writer->fill_slot = (writer->fill_slot + 1) % NUM_SLOTS;
+        writer->next_row += n;
+        appended += n;
+    }
+    return true;
+}
+
+bool Close_Image_Writer(Image_Writer *writer)
+{
+    if(writer == NULL) return false;
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->closing = true;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->mutex);
+    pthread_join(writer->thread, NULL);
+    pthread_mutex_destroy(&writer->mutex);
+    pthread_cond_destroy(&writer->cond);
+
+    bool success = !writer->error && writer->rows_written == writer->rows;
+    if(writer->rows_written != writer->rows){
+        SAFE_PRINTF(512, "Close_Image_Writer() ==>> image is incomplete, %d of %d rows written\n",
+                    writer->rows_written, writer->rows);
+    }
+    if(success && writer->png){
+        success = deflate_bytes(writer, NULL, 0, Z_FINISH) && write_chunk(writer->fp, "IEND", NULL, 0);
+    }
+    success &= fclose(writer->fp) == 0;
+    free_writer(writer);
+    return success;
+}
@@ -0,0 +1,122 @@
+/**
+ * \file `image_stream.h`
+ * \brief Streaming PGM and PNG readers and writers with background decoding and encoding
+ *
+ * Images are read and written a band of rows at a time. A background thread decodes the next rows, or encodes the
+ * rows already appended, while the caller works on the current ones. Rows are exchanged channel separated, as in
+ * `load_channel_separated_image`, and interleaved while they are copied to or from the staging buffers, so no
+ * interleaved copy of the whole image is made.
+ *
+ * Readers support binary 8-bit PGM (P5) and non-interlaced 8-bit gray or RGB PNG files. Writers write PGM when the
+ * filename ends with `.pgm` and PNG otherwise.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_IMAGE_STREAM_H_
+#define _LANDMARK_TOOLS_IMAGE_STREAM_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stddef.h>                                          // for size_t
+#include <stdint.h>                                          // for int32_t, uint8_t
+
+#define IMAGE_STREAM_BUFFER_BYTES (4*1024*1024) //target size of one staging buffer
+
+typedef struct Image_Reader Image_Reader;
+typedef struct Image_Writer Image_Writer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Open a streaming reader and read the image header
+ *
+ * Nothing is printed for files of other formats or layouts, so callers can fall back to a whole-image decoder.
+ * \param[in] filename
+ * \param[out] cols image width
+ * \param[out] rows image height
+ * \param[out] channels 1 or 3
+ * \return reader or NULL if the file cannot be opened, is not supported or memory allocation fails
+ */
+Image_Reader *Open_Image_Reader(const char *filename, int32_t *cols, int32_t *rows, int32_t *channels);
+
+/**
+ * \brief Read the next rows of the image
+ *
+ * Rows are read in order. Channel `c` of the rows is stored at `rows + c*plane_stride`.
+ * \param[in] reader
+ * \param[out] rows nrows*cols values of each channel
+ * \param[in] plane_stride distance between the channels of `rows`, unused for 1 channel
+ * \param[in] nrows number of rows
+ * \return false on decoding or io error, or if more rows than the image height are read
+ */
+bool Read_Image_Rows(Image_Reader *reader, uint8_t *rows, size_t plane_stride, int32_t nrows);
+
+/**
+ * \brief Stop decoding, close the file and free the reader
+ * \param[in] reader
+ */
+void Close_Image_Reader(Image_Reader *reader);
+
+/**
+ * \brief Open a streaming writer and write the image header
+ * \param[in] filename
+ * \param[in] cols image width
+ * \param[in] rows image height
+ * \param[in] channels 1, or 3 for PNG
+ * \return writer or NULL if the file cannot be opened, the size is invalid or memory allocation fails
+ */
+Image_Writer *Open_Image_Writer(const char *filename, int32_t cols, int32_t rows, int32_t channels);
+
+/**
+ * \brief Append rows to the image
+ *
+ * Rows must be appended in order. The data is copied, so the caller may reuse the buffers on return.
+ * \param[in] writer
+ * \param[in] rows nrows*cols values of each channel
+ * \param[in] plane_stride distance between the channels of `rows`, unused for 1 channel
+ * \param[in] nrows number of rows
+ * \return false if a previous write failed or more rows than the image height are appended
+ */
+bool Append_Image_Rows(Image_Writer *writer, const uint8_t *rows, size_t plane_stride, int32_t nrows);
+
+/**
+ * \brief Write a whole channel separated image on a background thread
+ *
+ * The image is encoded straight from `img` without a staging copy, so `img` must not change or be freed until
+ * `Close_Image_Writer` returns.
+ * \param[in] filename
+ * \param[in] img cols*rows values of each channel
+ * \param[in] cols image width
+ * \param[in] rows image height
+ * \param[in] channels 1, or 3 for PNG
+ * \return writer or NULL if the writer cannot be opened
+ */
+Image_Writer *Write_Image_Background(const char *filename, const uint8_t *img, int32_t cols, int32_t rows,
+                                     int32_t channels);
+
+/**
+ * \brief Wait for pending writes, finish and close the file and free the writer
+ * \param[in] writer
+ * \return false on io error or if rows are missing
+ */
+bool Close_Image_Writer(Image_Writer *writer);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_IMAGE_STREAM_H_ */
@@ -15,37 +15,62 @@
  */
 
 #include "landmark_tools/image_io/image_utils.h"
+#include "landmark_tools/image_io/image_stream.h"
+#include "landmark_tools/utils/perf_stats.h"
 #include "landmark_tools/utils/safe_string.h"
 
 #include <stdlib.h>               // for malloc, free, EXIT_FAILURE
 
 #define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image.h"
-#include "stb/stb_image_write.h"  // for stbi_write_png
 
 
 void interleave_rgb(unsigned char *planar, size_t width, size_t height,
                     unsigned char *interleaved){
-    for (int32_t i = 0, j = 0; i < width * height * 3; i += 3, j++) {
-            interleaved[i] = planar[j];    // Red component
-            interleaved[i+1] = planar[j+width*height];  // Green component
-            interleaved[i+2] = planar[j+2*width*height];  // Blue component
-        }
-    
+    // Separate plane pointers and a size_t index let the compiler vectorize the loop
+    size_t n = width * height;
+    const unsigned char *red = planar;
+    const unsigned char *green = planar + n;
+    const unsigned char *blue = planar + 2 * n;
+    for (size_t j = 0; j < n; j++) {
+        interleaved[3 * j] = red[j];
+        interleaved[3 * j + 1] = green[j];
+        interleaved[3 * j + 2] = blue[j];
+    }
 }
 
 void channel_separated_rgb(unsigned char *interleaved, size_t width, size_t height,
                       unsigned char *planar){
-    for (int32_t i = 0, j = 0; i < width * height * 3; i += 3, j++) {
-            planar[j]   = interleaved[i];    // Red component
-            planar[j+width*height] = interleaved[i+1];  // Green component
-            planar[j+2*width*height]  = interleaved[i+2];  // Blue component
-        }
+    size_t n = width * height;
+    unsigned char *red = planar;
+    unsigned char *green = planar + n;
+    unsigned char *blue = planar + 2 * n;
+    for (size_t j = 0; j < n; j++) {
+        red[j] = interleaved[3 * j];
+        green[j] = interleaved[3 * j + 1];
+        blue[j] = interleaved[3 * j + 2];
+    }
 }
 
-uint8_t* load_channel_separated_image(const char* filename, int32_t *icols, int32_t *irows){
+static uint8_t* load_image(const char* filename, int32_t *icols, int32_t *irows){
     int32_t ichannels;
+
+    // PGM and plain PNG files are decoded in the background straight into the channel separated array
+    Image_Reader *reader = Open_Image_Reader(filename, icols, irows, &ichannels);
+    if (reader != NULL) {
+        size_t plane_pixels = (size_t)(*icols) * (*irows);
+        uint8_t *img = (uint8_t*)malloc(sizeof(uint8_t) * plane_pixels * ichannels);
+        if (img == NULL) {
+            printf("Failure to allocate memory for img\n");
+        } else if (!Read_Image_Rows(reader, img, plane_pixels, *irows)) {
+            SAFE_FPRINTF(stderr, 512, "Failure to load surface reflectance map from %s\n", filename);
+            free(img);
+            img = NULL;
+        }
+        Close_Image_Reader(reader);
+        return img;
+    }
+
     uint8_t *img_interleaved = stbi_load(filename, icols, irows, &ichannels, STBI_default);
     if (img_interleaved == NULL) {
         SAFE_FPRINTF(stderr, 512, "Failure to load surface reflectance map from %s\n", filename);
@@ -75,30 +100,24 @@ uint8_t* load_channel_separated_image(const char* filename, int32_t *icols, int3
     return img;
 }
 
+uint8_t* load_channel_separated_image(const char* filename, int32_t *icols, int32_t *irows){
+    PERF_PHASE_BEGIN(timer, PERF_LOAD);
+    uint8_t *img = load_image(filename, icols, irows);
+    PERF_PHASE_END(timer);
+    return img;
+}
+
 bool write_channel_separated_image(const char* filename, uint8_t *img, int32_t cols, int32_t rows, int32_t channels){
-    uint8_t *tmpImgInterleaved;
-    
-    if(channels == 3){
-        tmpImgInterleaved = (uint8_t *)malloc(sizeof(uint8_t)*cols*rows*channels);
-        if (tmpImgInterleaved == NULL)
-        {
-            SAFE_FPRINTF(stderr, 512, "write_channel_separated_image() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
-            return false;
-        }
-        
-        interleave_rgb(img, cols, rows,
-                       tmpImgInterleaved);
-    }else if(channels == 1){
-        tmpImgInterleaved = img;
-    }else{
+    if(channels != 1 && channels != 3){
         SAFE_FPRINTF(stderr, 512, "write_channel_separated_image() not supported for %d channels: %s, %d\n", channels, __FILE__, __LINE__);
         return false;
     }
 
-    int ret = stbi_write_png(filename, cols, rows, channels, tmpImgInterleaved, channels*cols*sizeof(uint8_t));
-    
-    if(channels == 3)
-        free(tmpImgInterleaved);
-    
-    return ret==1;
+    // Rows are interleaved into the staging buffers of the writer and encoded on its thread
+    PERF_PHASE_BEGIN(timer, PERF_WRITE);
+    Image_Writer *writer = Open_Image_Writer(filename, cols, rows, channels);
+    bool success = writer != NULL && Append_Image_Rows(writer, img, (size_t)cols*rows, rows);
+    success = writer != NULL && Close_Image_Writer(writer) && success;
+    PERF_PHASE_END(timer);
+    return success;
 }
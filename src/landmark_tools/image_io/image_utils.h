@@ -52,6 +52,8 @@ void channel_separated_rgb(unsigned char *interleaved, size_t width, size_t heig
 
 /**
  \brief Read an image from `filename` into a channel separated array
+
+ PGM and 8-bit gray or RGB PNG files are streamed with `Image_Reader`, other files are decoded whole with stb.
  
  \param[in] filename 
  \param[in] icols 
@@ -62,6 +64,8 @@ uint8_t* load_channel_separated_image(const char* filename, int32_t *icols, int3
 
 /**
  \brief Write a channel separated image to `filename`
+
+ The image is streamed with `Image_Writer`, as PGM if `filename` ends with `.pgm` and as PNG otherwise.
  
  \param[in] filename 
  \param[in] img 
@@ -19,6 +19,7 @@
  */
 
 #include <math.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,22 +27,29 @@
 #include <assert.h>
 
 #include "landmark_tools/landmark_registration/landmark_registration.h"
-#include "landmark_tools/feature_selection/int_forstner_extended.h"
+#include "landmark_tools/data_interpolation/interpolate_data.h"
 #include "landmark_tools/feature_tracking/corr_image_long.h"
+#include "landmark_tools/image_io/image_stream.h"
 #include "landmark_tools/image_io/image_utils.h"
 #include "landmark_tools/image_io/imagedraw.h"
-#include "landmark_tools/math/homography_util.h"
 #include "landmark_tools/landmark_util/landmark.h"
 #include "landmark_tools/landmark_util/estimate_homography.h"
+#include "landmark_tools/landmark_util/lmk_reader.h"
+#include "landmark_tools/landmark_util/lmk_overview.h"
 #include "landmark_tools/math/math_utils.h"
-#include "landmark_tools/math/point_line_plane_util.h"
+#include "landmark_tools/math/splitmix.h"
+#include "landmark_tools/utils/parallel.h"
 #include "math/mat3/mat3.h"
+#include "landmark_tools/utils/perf_stats.h"
 #include "landmark_tools/utils/write_array.h"
 #include "landmark_tools/utils/safe_string.h"
 // Constants for landmark registration
-#define GRID_DIVISION_FACTOR 20
 #define STRBUF_SIZE 256
 #define DEBUG_BUF_SIZE 128
+#define BUDGET_CHUNK_SIZE 64  // features correlated between checks of the time budget
+#define REGISTRATION_MAX_THREADS 32  // threads preparing templates and back-projecting matches
+#define REGISTRATION_MIN_ITEMS 16    // fewer items per thread are not worth a thread
+#define REGISTRATION_MIN_LEVEL_SIZE 64  // coarser pyramid levels leave too few pixels for features
 
 /**
  * \brief Visualizes the warped landmark data for debugging purposes
@@ -63,12 +71,16 @@ static void visualize_warped_landmark(const LMK *base_landmark, const LMK *child
     estimateHomographyUsingCorners(base_landmark, child_landmark, base_to_child_homography);
     inverseHomography33(base_to_child_homography, child_to_base_homography);
 
-    // Allocate memory for warped elevation data
+    // Allocate memory for warped elevation data and the warped coordinates of one row
     float *warped_elevation = (float *)malloc(sizeof(float)*base_landmark->num_pixels);
-    if (warped_elevation == NULL) {
+    double *warped_x = (double *)malloc(sizeof(double)*2*base_landmark->num_cols);
+    if (warped_elevation == NULL || warped_x == NULL) {
         printf("visualize_warped_landmark(): Failed to allocate memory for warped elevation data\n");
+        free(warped_elevation);
+        free(warped_x);
         return;
     }
+    double *warped_y = warped_x + base_landmark->num_cols;
 
     // Initialize buffers
     memset(visualization_buffer, 0, sizeof(uint8_t)*base_landmark->num_pixels);
@@ -76,12 +88,11 @@ static void visualize_warped_landmark(const LMK *base_landmark, const LMK *child
     
     // Warp base landmark data using estimated homography
     for(int row = 0; row < base_landmark->num_rows; row++) {
+        // Calculate warped coordinates
+        inter_homography_row(child_to_base_homography, 0, row, base_landmark->num_cols, warped_x, warped_y);
         for(int col = 0; col < base_landmark->num_cols; col++) {
-            // Calculate warped coordinates
-            int warped_row = (child_to_base_homography[1][0]*col + child_to_base_homography[1][1]*row + child_to_base_homography[1][2]) / 
-                           (child_to_base_homography[2][0]*col + child_to_base_homography[2][1]*row + child_to_base_homography[2][2]);
-            int warped_col = (child_to_base_homography[0][0]*col + child_to_base_homography[0][1]*row + child_to_base_homography[0][2]) / 
-                           (child_to_base_homography[2][0]*col + child_to_base_homography[2][1]*row + child_to_base_homography[2][2]);
+            int warped_row = (int)warped_y[col];
+            int warped_col = (int)warped_x[col];
             
             // Check if warped coordinates are within bounds
             if(warped_row >= 0 && warped_row < base_landmark->num_rows && 
@@ -105,107 +116,275 @@ static void visualize_warped_landmark(const LMK *base_landmark, const LMK *child
     write_data_to_file(elevation_filename, warped_elevation, sizeof(float), base_landmark->num_pixels);
 
     free(warped_elevation);
+    free(warped_x);
 }
 
 /**
- * \brief Helper function to free all allocated memory
- * 
- * \param lmk_child Pointer to child landmark structure
- * \param lmk_base Pointer to base landmark structure
- * \param match_pair_base Pointer to base match pairs array
- * \param match_pair_child Pointer to child match pairs array
- * \param template Pointer to template array
- * \param feature_coord Pointer to feature coordinates array
- * \param feature_strength Pointer to feature strength array
- * \param tmpimg Pointer to temporary image buffer
- * \param pts_3d_child Pointer to 3D child points array
- * \param pts_3d_base Pointer to 3D base points array
+ * \brief Work on the items [first, end) of a parallel loop
  */
-static void cleanup_memory(LMK *lmk_child, LMK *lmk_base,
-                         double *match_pair_base, double *match_pair_child,
-                         uint8_t *template, int64_t (*feature_coord)[2],
-                         float *feature_strength, uint8_t *tmpimg,
-                         double *pts_3d_child, double *pts_3d_base)
+typedef void (*RangeFunction)(void *arg, int32_t first, int32_t end);
+
+typedef struct {
+    RangeFunction function;
+    void *arg;
+    int32_t first;
+    int32_t end;
+} RangeJob;
+
+static void *range_thread(void *arg)
 {
-    free_lmk(lmk_child);
-    free_lmk(lmk_base);
-    if(match_pair_base != NULL) free(match_pair_base);
-    if(match_pair_child != NULL) free(match_pair_child);
-    if(template != NULL) free(template);
-    if(feature_coord != NULL) free(feature_coord);
-    if(feature_strength != NULL) free(feature_strength);
-    if(tmpimg != NULL) free(tmpimg);
-    if(pts_3d_child != NULL) free(pts_3d_child);
-    if(pts_3d_base != NULL) free(pts_3d_base);
+    RangeJob *job = (RangeJob *)arg;
+    job->function(job->arg, job->first, job->end);
+    return NULL;
 }
 
-int32_t RegisterLandmarks(Parameters parameters, const char *base_landmark_filename, const char *child_landmark_filename)
+/**
+ * \brief Run `function` on consecutive ranges of `n` items, one range per thread
+ *
+ * The ranges are disjoint, so functions writing only the outputs of their items need no locking. A range whose
+ * thread cannot be started runs on the calling thread.
+ *
+ * \param max_threads Maximum number of threads, including the calling thread. If 0, `parallel_num_threads()`
+ */
+static void parallel_ranges(RangeFunction function, void *arg, int32_t n, int32_t max_threads)
 {
-    // Initialize landmark structures
-    LMK lmk_child = {0};
-    LMK lmk_base = {0};
-    Read_LMK(child_landmark_filename, &lmk_child);
-    Read_LMK(base_landmark_filename, &lmk_base);
+    int32_t num_threads = max_threads;
+    if (num_threads <= 0) num_threads = parallel_num_threads();
+    if (num_threads > REGISTRATION_MAX_THREADS) num_threads = REGISTRATION_MAX_THREADS;
+    if (num_threads > n / REGISTRATION_MIN_ITEMS) num_threads = n / REGISTRATION_MIN_ITEMS;
+    if (num_threads < 1) num_threads = 1;
     
+    RangeJob jobs[REGISTRATION_MAX_THREADS];
+    pthread_t threads[REGISTRATION_MAX_THREADS];
+    bool started[REGISTRATION_MAX_THREADS];
+    for (int32_t t = 0; t < num_threads; t++) {
+        jobs[t].function = function;
+        jobs[t].arg = arg;
+        jobs[t].first = (int32_t)((int64_t)n * t / num_threads);
+        jobs[t].end = (int32_t)((int64_t)n * (t + 1) / num_threads);
+        started[t] = t > 0 && pthread_create(&threads[t], NULL, range_thread, &jobs[t]) == 0;
+    }
+    for (int32_t t = 0; t < num_threads; t++) {
+        if (!started[t]) range_thread(&jobs[t]);
+    }
+    for (int32_t t = 0; t < num_threads; t++) {
+        if (started[t]) pthread_join(threads[t], NULL);
+    }
+}
+
+/**
+ * \brief Inputs of `extract_templates`
+ */
+typedef struct {
+    const LMK *child;
+    double (*base_to_child)[3];
+    int32_t half_correlation_window;
+    size_t template_pixels;
+    const double *task_base_coords;
+    uint8_t *templates;
+} TemplateJob;
+
+/**
+ * \brief Sample the child landmark around the base coordinates of tasks [first, end) into their templates
+ */
+static void extract_templates(void *arg, int32_t first, int32_t end)
+{
+    const TemplateJob *job = (const TemplateJob *)arg;
+    int32_t half_correlation_window = job->half_correlation_window;
+    for (int32_t task_idx = first; task_idx < end; ++task_idx)
+    {
+        int32_t center_col = (int32_t)job->task_base_coords[task_idx*2];
+        int32_t center_row = (int32_t)job->task_base_coords[task_idx*2 + 1];
+        uint8_t *task_template = &job->templates[task_idx*job->template_pixels];
+        int32_t template_idx = 0;
+        for (int32_t row_offset = -half_correlation_window; row_offset <= half_correlation_window; ++row_offset)
+        {
+            for (int32_t col_offset = -half_correlation_window; col_offset <= half_correlation_window; ++col_offset)
+            {
+                double base_pt[2];
+                double child_pt[2];
+                base_pt[0] = center_col + col_offset;
+                base_pt[1] = center_row + row_offset;
+                homographyTransfer33D(job->base_to_child, base_pt, child_pt);
+                double interpolated_value = Interpolate_LMK_SRM(job->child, child_pt[0], child_pt[1]);
+                task_template[template_idx] = (int32_t)interpolated_value;
+                template_idx++;
+            }
+        }
+    }
+}
+
+/**
+ * \brief Inputs and outputs of `back_project_pairs`
+ */
+typedef struct {
+    const LMK *child;
+    const LMK *base;
+    const double *child_coords;
+    const double *base_coords;
+    double *child_points;
+    double *base_points;
+    bool *valid;
+} BackProjectionJob;
+
+/**
+ * \brief 3D points of the matched pairs [first, end) in both landmarks
+ */
+static void back_project_pairs(void *arg, int32_t first, int32_t end)
+{
+    const BackProjectionJob *job = (const BackProjectionJob *)arg;
+    for (int32_t i = first; i < end; ++i)
+    {
+        job->valid[i] = LMK_Col_Row2World(job->child, job->child_coords[i * 2], job->child_coords[i * 2 + 1],
+                                          &job->child_points[i * 3]) &
+                        LMK_Col_Row2World(job->base, job->base_coords[i * 2], job->base_coords[i * 2 + 1],
+                                          &job->base_points[i * 3]);
+    }
+}
+
+/**
+ * \brief Feature strength of a correlation task, to correlate the strongest features first
+ */
+typedef struct {
+    float strength;
+    int32_t task;
+} TaskStrength;
+
+static int compare_task_strength(const void *a, const void *b)
+{
+    const TaskStrength *left = (const TaskStrength *)a;
+    const TaskStrength *right = (const TaskStrength *)b;
+    if (left->strength != right->strength) return (left->strength > right->strength) ? -1 : 1;
+    return left->task - right->task;
+}
+
+/**
+ * \brief Reorder the correlation tasks of a workspace, their base coordinates and strengths by descending strength
+ */
+static void sort_tasks_by_strength(RegistrationWorkspace *workspace, int32_t num_tasks)
+{
+    TaskStrength *order = (TaskStrength *)workspace->task_order;
+    CorrTask *tasks = workspace->correlation_tasks;
+    double *task_base_coords = workspace->task_base_coords;
+    for (int32_t i = 0; i < num_tasks; i++) {
+        order[i].strength = workspace->task_strength[i];
+        order[i].task = i;
+    }
+    qsort(order, num_tasks, sizeof(TaskStrength), compare_task_strength);
+    for (int32_t i = 0; i < num_tasks; i++) {
+        workspace->task_strength[i] = order[i].strength;
+        workspace->sorted_tasks[i] = tasks[order[i].task];
+        workspace->sorted_coords[i * 2] = task_base_coords[order[i].task * 2];
+        workspace->sorted_coords[i * 2 + 1] = task_base_coords[order[i].task * 2 + 1];
+    }
+    memcpy(tasks, workspace->sorted_tasks, sizeof(CorrTask) * num_tasks);
+    memcpy(task_base_coords, workspace->sorted_coords, sizeof(double) * 2 * num_tasks);
+}
+
+/**
+ * \brief Correlate tasks a chunk at a time until the budget ends
+ *
+ * \return number of tasks correlated, the first ones of `tasks`
+ */
+static int32_t correlate_within_budget(RegistrationWorkspace *workspace, const CorrTask *tasks, int32_t num_tasks,
+                                       CorrResult *results, const TimeBudget *budget, BudgetStatus *status)
+{
+    int32_t chunk_size = (budget != NULL) ? BUDGET_CHUNK_SIZE : num_tasks;
+    int32_t num_correlated = 0;
+    *status = BUDGET_COMPLETE;
+    PERF_PHASE_BEGIN(timer, PERF_CORRELATE);
+    while (num_correlated < num_tasks) {
+        *status = time_budget_status(budget);
+        if (*status != BUDGET_COMPLETE) break;
+        int32_t count = (num_tasks - num_correlated < chunk_size) ? num_tasks - num_correlated : chunk_size;
+        if (!corimg_long_batch_threads(&workspace->corr, &tasks[num_correlated], count, &results[num_correlated],
+                                       workspace->num_threads)) break;
+        num_correlated += count;
+    }
+    PERF_PHASE_END(timer);
+    return num_correlated;
+}
+
+int32_t RegisterLandmarks(Parameters parameters, const char *base_landmark_filename, const char *child_landmark_filename)
+{
+    BudgetStatus status;
+    return RegisterLandmarks_budget(parameters, base_landmark_filename, child_landmark_filename, NULL, &status);
+}
+
+/**
+ * \brief Match the features of the child landmark in the base landmark and fit a rigid transformation to them
+ *
+ * \param parameters Matching parameters for feature detection and matching
+ * \param workspace Buffers of the registration, holding at least the features and landmark size of `parameters`
+ *        and `lmk_child`
+ * \param lmk_child Child landmark
+ * \param lmk_base Base landmark
+ * \param base_integral Window sums of the base surface reflectance, or NULL
+ * \param child_to_base_transform Initial homography from child to base pixels
+ * \param base_to_child_transform Inverse of `child_to_base_transform`
+ * \param search_window_size Search window of the correlation around the initial position of each feature
+ * \param budget Time budget and cancellation of the matching, or NULL to match every feature
+ * \param status Set to BUDGET_COMPLETE if every feature was correlated, otherwise to the reason matching stopped
+ * \param refined_rotation Rotation taking child world points to base world points
+ * \param refined_translation Translation applied after `refined_rotation`
+ * \return 1 on success, 0 on failure
+ */
+static int32_t register_level(Parameters parameters, RegistrationWorkspace *workspace, LMK *lmk_child,
+                              const LMK *lmk_base, const CorrIntegralImage *base_integral,
+                              double child_to_base_transform[3][3], double base_to_child_transform[3][3],
+                              int32_t search_window_size,
+                              const TimeBudget *budget, BudgetStatus *status,
+                              double refined_rotation[3][3], double refined_translation[3])
+{
+    *status = BUDGET_COMPLETE;
     // Extract matching parameters
     int32_t correlation_window_size = parameters.matching.correlation_window_size;
     int32_t half_correlation_window = parameters.matching.correlation_window_size / 2;
-    int32_t search_window_size = parameters.matching.search_window_size;
-    int32_t half_search_window = parameters.matching.search_window_size / 2;
+    int32_t half_search_window = search_window_size / 2;
     
-    // Calculate grid dimensions for feature matching
-    int32_t grid_cols = lmk_child.num_cols / GRID_DIVISION_FACTOR;
-    int32_t grid_rows = lmk_child.num_rows / GRID_DIVISION_FACTOR;
-    
-    // Allocate memory for feature matching
-    double *base_feature_coords = (double *)malloc(sizeof(double)*grid_cols*grid_rows);
-    double *child_feature_coords = (double *)malloc(sizeof(double)*grid_cols*grid_rows);
-    uint8_t *correlation_template = (uint8_t *)malloc(sizeof(uint8_t)*correlation_window_size*correlation_window_size);
-    
-    if(base_feature_coords==NULL || child_feature_coords == NULL || correlation_template == NULL){
-        printf("RegisterLandmarks(): memory allocation error\n");
-        cleanup_memory(&lmk_child, &lmk_base, base_feature_coords, child_feature_coords, 
-                      correlation_template, NULL, NULL, NULL, NULL, NULL);
-        return 0;
-    }
-    
-    // Calculate initial transformation between landmarks
-    double base_to_child_transform[3][3] = {0};
-    double child_to_base_transform[3][3] = {0};
-    mult333(lmk_child.mapRworld, lmk_base.worldRmap, child_to_base_transform);
-    inverseHomography33(child_to_base_transform, base_to_child_transform); 
+    // One template per detected feature, so that all correlations run as one batch. The matches are kept in one
+    // feature set from the correlation to the back projection
+    FeatureSet *matched = &workspace->matched;
+    matched->count = 0;
+    size_t template_pixels = (size_t)correlation_window_size*correlation_window_size;
+    uint8_t *correlation_template = workspace->correlation_template;
     
     // Detect Forstner features in child landmark
     int32_t num_detected_features = 0;
-    int64_t (*feature_pixel_coords)[2] = malloc(sizeof(int64_t[parameters.detector.num_features * 2]));
-    float *feature_quality_scores = malloc(sizeof(float) * parameters.detector.num_features);
-    int_forstner_nbest_even_distribution(lmk_child.srm, lmk_child.num_cols, lmk_child.num_rows, 
-                                        10, 10, lmk_child.num_cols-20, lmk_child.num_rows-20, 
-                                        parameters.detector.window_size, parameters.detector.num_features, 
-                                        &num_detected_features, feature_pixel_coords, feature_quality_scores, 
-                                        (int32_t)parameters.detector.min_dist_feature);
-    
-    uint8_t *visualization_buffer = NULL;
+    int64_t (*feature_pixel_coords)[2] = workspace->feature_pixel_coords;
+    float *feature_quality_scores = workspace->feature_quality_scores;
+    int_forstner_nbest_even_distribution_scratch(&workspace->forstner, lmk_child->srm,
+                                                 lmk_child->num_cols, lmk_child->num_rows,
+                                                 10, 10, lmk_child->num_cols-20, lmk_child->num_rows-20,
+                                                 parameters.detector.window_size, parameters.detector.num_features,
+                                                 &num_detected_features, feature_pixel_coords, feature_quality_scores,
+                                                 (int32_t)parameters.detector.min_dist_feature);
+    PERF_COUNT(PERF_FEATURES_TRIED, num_detected_features);
+    
     #ifdef DEBUG
     // Allocate temporary image for visualization
-    visualization_buffer = (uint8_t *)malloc(sizeof(uint8_t)*lmk_base.num_pixels);
+    uint8_t *visualization_buffer = (uint8_t *)malloc(sizeof(uint8_t)*lmk_base->num_pixels);
     if(visualization_buffer == NULL){
         printf("RegisterLandmarks(): memory allocation error\n");
-        cleanup_memory(&lmk_child, &lmk_base, base_feature_coords, child_feature_coords, 
-                      correlation_template, feature_pixel_coords, feature_quality_scores, NULL, NULL, NULL);
         return 0;
     }
-    memcpy(visualization_buffer, lmk_base.srm, sizeof(uint8_t)*lmk_base.num_pixels);
+    memcpy(visualization_buffer, lmk_base->srm, sizeof(uint8_t)*lmk_base->num_pixels);
     #endif
 
-    // Match features between landmarks
-    int32_t num_matched_pairs = 0;
+    // Prepare a correlation task for each feature inside the base landmark
+    CorrTask *correlation_tasks = workspace->correlation_tasks;
+    CorrResult *correlation_results = workspace->correlation_results;
+    double *task_base_coords = workspace->task_base_coords;
+    float *task_strength = workspace->task_strength;
+    
+    int32_t num_tasks = 0;
     for (int32_t feature_idx = 0; feature_idx < num_detected_features; ++feature_idx)
     {
         int64_t *child_feature_pixel = feature_pixel_coords[feature_idx];
         // Skip child features on NaN elevation
-        if (isnan(lmk_child.ele[child_feature_pixel[1] * lmk_child.num_cols + child_feature_pixel[0]]))
+        if (isnan(lmk_child->ele[child_feature_pixel[1] * lmk_child->num_cols + child_feature_pixel[0]]))
         {
+            PERF_COUNT(PERF_FEATURES_NAN_TEMPLATE, 1);
             continue;
         }
         
@@ -214,30 +393,14 @@ int32_t RegisterLandmarks(Parameters parameters, const char *base_landmark_filen
         homographyTransfer33(child_to_base_transform, (double)child_feature_pixel[0], (double)child_feature_pixel[1], base_feature_coord);
         
         // Check if transformed coordinates are within base landmark bounds
-        if(base_feature_coord[0] > 0 && base_feature_coord[0] < lmk_base.num_cols && 
-           base_feature_coord[1] > 0 && base_feature_coord[1] < lmk_base.num_rows)
+        if(base_feature_coord[0] > 0 && base_feature_coord[0] < lmk_base->num_cols && 
+           base_feature_coord[1] > 0 && base_feature_coord[1] < lmk_base->num_rows)
         {
             int32_t center_col = (int32_t)base_feature_coord[0];
             int32_t center_row = (int32_t)base_feature_coord[1];
-            double subpixel_offset_col = base_feature_coord[0] - center_col;
-            double subpixel_offset_row = base_feature_coord[1] - center_row;
             
-            // Extract correlation template around feature
-            int32_t template_idx = 0;
-            for (int32_t row_offset = -half_correlation_window; row_offset <= half_correlation_window; ++row_offset)
-            {
-                for (int32_t col_offset = -half_correlation_window; col_offset <= half_correlation_window; ++col_offset)
-                {
-                    double base_pt[2];
-                    double child_pt[2];
-                    base_pt[0] = center_col + col_offset;
-                    base_pt[1] = center_row + row_offset;
-                    homographyTransfer33D(child_to_base_transform, base_pt, child_pt);
-                    double interpolated_value = Interpolate_LMK_SRM(&lmk_child, child_pt[0], child_pt[1]);
-                    correlation_template[template_idx] = (int32_t)interpolated_value;
-                    template_idx++;
-                }
-            }
+            // The template around the feature is extracted below, for all tasks at once
+            uint8_t *task_template = &correlation_template[num_tasks*template_pixels];
             
             // Define search window bounds
             int64_t search_left = center_col - half_search_window;
@@ -246,160 +409,499 @@ int32_t RegisterLandmarks(Parameters parameters, const char *base_landmark_filen
             if (search_left < 0) search_left = 0;
             int64_t search_width = search_window_size;
             int64_t search_height = search_window_size;
-            if (search_left + search_window_size > lmk_base.num_cols)  search_width = lmk_base.num_cols - search_left - 1;
-            if (search_top + search_window_size > lmk_base.num_rows)  search_height = lmk_base.num_rows - search_top - 1;
+            if (search_left + search_window_size > lmk_base->num_cols)  search_width = lmk_base->num_cols - search_left - 1;
+            if (search_top + search_window_size > lmk_base->num_rows)  search_height = lmk_base->num_rows - search_top - 1;
             
-            // Perform correlation matching
-            double best_match_row = -1.0, best_match_col = -1.0, best_correlation_score = 0.0;
-            double correlation_covariance[3] = {0};
-            bool correlation_success = corimg_long(correlation_template,
-                                correlation_window_size,
-                                0, 0,
-                                correlation_window_size, correlation_window_size,
-                                lmk_base.srm,
-                                lmk_base.num_cols,
-                                search_left, search_top,
-                                search_width, search_height,
-                                &best_match_row, &best_match_col, &best_correlation_score, correlation_covariance);
+            CorrTask *task = &correlation_tasks[num_tasks];
+            task->img1 = task_template;
+            task->rowBytes1 = correlation_window_size;
+            task->left1 = 0;
+            task->top1 = 0;
+            task->cols1 = correlation_window_size;
+            task->rows1 = correlation_window_size;
+            task->img2 = lmk_base->srm;
+            task->rowBytes2 = lmk_base->num_cols;
+            task->left2 = search_left;
+            task->top2 = search_top;
+            task->cols2 = search_width;
+            task->rows2 = search_height;
+            task->integral = base_integral;
+            task->prune = parameters.matching.prune_search;
+            task->min_correlation = parameters.matching.min_correlation;
+            task->subpixel_model = (CorrSubpixelModel)parameters.matching.subpixel_model;
+            task_base_coords[num_tasks*2] = base_feature_coord[0];
+            task_base_coords[num_tasks*2 + 1] = base_feature_coord[1];
+            task_strength[num_tasks] = feature_quality_scores[feature_idx];
+            num_tasks++;
+        }
+    }
+    
+    // Extract the correlation templates, which sample the child landmark at every template pixel, in parallel
+    TemplateJob template_job = {lmk_child, base_to_child_transform, half_correlation_window, template_pixels,
+                                task_base_coords, correlation_template};
+    parallel_ranges(extract_templates, &template_job, num_tasks, workspace->num_threads);
+    
+    // Perform correlation matching. With a budget the strongest features go first, and matching stops with the
+    // features correlated so far once the budget ends.
+    int32_t num_matched_pairs = 0;
+    if (budget != NULL && num_tasks > 0)
+    {
+        sort_tasks_by_strength(workspace, num_tasks);
+    }
+    num_tasks = correlate_within_budget(workspace, correlation_tasks, num_tasks, correlation_results, budget, status);
+    if (*status != BUDGET_COMPLETE)
+    {
+        SAFE_PRINTF(128, "RegisterLandmarks(): matching stopped after %d features\n", num_tasks);
+    }
+    for (int32_t task_idx = 0; task_idx < num_tasks; ++task_idx)
+    {
+        const CorrResult *result = &correlation_results[task_idx];
+        double *base_feature_coord = &task_base_coords[task_idx*2];
+        double subpixel_offset_col = base_feature_coord[0] - (int32_t)base_feature_coord[0];
+        double subpixel_offset_row = base_feature_coord[1] - (int32_t)base_feature_coord[1];
+        
+        // If correlation successful and score above threshold, store match
+        if (result->success && result->bestval > parameters.matching.min_correlation)
+        {
+            double base_center[2];
+            double child_center[2];
+            base_center[0] = base_feature_coord[0];
+            base_center[1] = base_feature_coord[1];
+            homographyTransfer33D(base_to_child_transform, base_center, child_center);
             
-            // If correlation successful and score above threshold, store match
-            if (correlation_success && best_correlation_score > parameters.matching.min_correlation)
-            {
-                double base_center[2];
-                double child_center[2];
-                base_center[0] = base_feature_coord[0];
-                base_center[1] = base_feature_coord[1];
-                homographyTransfer33D(child_to_base_transform, base_center, child_center);
-                
-                // Store matched feature coordinates
-                child_feature_coords[num_matched_pairs * 2] = child_center[0];
-                child_feature_coords[num_matched_pairs * 2 + 1] = child_center[1];
-                // Adjust coordinates for subpixel alignment
-                base_feature_coords[num_matched_pairs * 2] = best_match_col + subpixel_offset_col;
-                base_feature_coords[num_matched_pairs * 2 + 1] = best_match_row + subpixel_offset_row;
-                
-                #ifdef DEBUG
-                // Draw match visualization
-                DrawArrow(visualization_buffer, lmk_base.num_cols, lmk_base.num_rows,
-                          base_feature_coord[0], base_feature_coord[1],
-                          best_match_col,
-                          best_match_row,
-                          255, 3);
-                #endif
-                num_matched_pairs++;
-            }
-            else
-            {
-                #ifdef DEBUG
-                // Draw unmatched feature
-                DrawFeatureBlock(visualization_buffer, lmk_base.num_cols, lmk_base.num_rows, 
-                               base_feature_coord[0], base_feature_coord[1], 255, 5);
-                #endif
-            }
+            // Store matched feature coordinates
+            matched->points[num_matched_pairs * 2] = child_center[0];
+            matched->points[num_matched_pairs * 2 + 1] = child_center[1];
+            // Adjust coordinates for subpixel alignment
+            matched->matches[num_matched_pairs * 2] = result->bestcol + subpixel_offset_col;
+            matched->matches[num_matched_pairs * 2 + 1] = result->bestrow + subpixel_offset_row;
+            matched->scores[num_matched_pairs] = result->bestval;
+            matched->strengths[num_matched_pairs] = task_strength[task_idx];
+            
+            #ifdef DEBUG
+            // Draw match visualization
+            DrawArrow(visualization_buffer, lmk_base->num_cols, lmk_base->num_rows,
+                      base_feature_coord[0], base_feature_coord[1],
+                      result->bestcol,
+                      result->bestrow,
+                      255, 3);
+            #endif
+            num_matched_pairs++;
+        }
+        else
+        {
+            #ifdef DEBUG
+            // Draw unmatched feature
+            DrawFeatureBlock(visualization_buffer, lmk_base->num_cols, lmk_base->num_rows, 
+                           base_feature_coord[0], base_feature_coord[1], 255, 5);
+            #endif
         }
     }
+    PERF_COUNT(PERF_CORRELATION_BELOW_MIN, num_tasks - num_matched_pairs);
+    matched->count = num_matched_pairs;
     
 #ifdef DEBUG
-    write_channel_separated_image("matched_point.png", visualization_buffer, lmk_base.num_cols, lmk_base.num_rows, 1);
+    // Encoded in the background while the homography is estimated, the buffer is redrawn after
+    Image_Writer *matched_point_writer = Write_Image_Background("matched_point.png", visualization_buffer,
+                                                                lmk_base->num_cols, lmk_base->num_rows, 1);
 #endif
     
-    // Calculate homography from matched feature pairs
+    // Calculate homography from matched feature pairs, drawing from rand() as getHomographyFromPoints_RANSAC_frame does
     double estimated_homography[3][3] = {0};
-    int32_t num_homography_inliers = getHomographyFromPoints_RANSAC_frame(child_feature_coords, base_feature_coords, 
-                                                                         num_matched_pairs, estimated_homography, 
-                                                                         parameters.sliding.reprojection_threshold);
-    
-    // Allocate memory for 3D point clouds
-    double *child_3d_points = (double *)malloc(sizeof(double)*num_matched_pairs * 3);
-    double *base_3d_points = (double *)malloc(sizeof(double)*num_matched_pairs * 3);
-    if(child_3d_points == NULL || base_3d_points == NULL){
-        printf("RegisterLandmarks(): memory allocation error\n");
-        cleanup_memory(&lmk_child, &lmk_base, base_feature_coords, child_feature_coords, 
-                      correlation_template, feature_pixel_coords, feature_quality_scores, visualization_buffer,
-                      child_3d_points, base_3d_points);
-        return 0;
-    }
+    RansacOptions homography_options;
+    ransac_frame_options(&homography_options, parameters.sliding.reprojection_threshold);
+    homography_options.scratch = &workspace->ransac;
+    getHomographyFromPoints_RANSAC_ctx(matched->points, matched->matches, matched->count,
+                                       estimated_homography, &homography_options);
+    
+    // 3D point clouds of the homography inliers
+    double *child_3d_points = workspace->child_3d_points;
+    double *base_3d_points = workspace->base_3d_points;
     
 #ifdef DEBUG
-    memcpy(visualization_buffer, lmk_base.srm, sizeof(uint8_t)*lmk_base.num_pixels);
+    if(matched_point_writer == NULL || !Close_Image_Writer(matched_point_writer)){
+        printf("RegisterLandmarks(): failed to write matched_point.png\n");
+    }
+    memcpy(visualization_buffer, lmk_base->srm, sizeof(uint8_t)*lmk_base->num_pixels);
 #endif
     
-    // Convert homography inliers to 3D point clouds
-    int32_t num_3d_points = 0;
-    for (int32_t pair_idx = 0; pair_idx < num_matched_pairs; ++pair_idx)
+    // Gather the homography inliers
+    for (int32_t pair_idx = 0; pair_idx < matched->count; ++pair_idx)
     {
         double child_pt[2] = {0}, projected_base_pt[2] = {0};
-        child_pt[0] = child_feature_coords[pair_idx * 2 + 0];
-        child_pt[1] = child_feature_coords[pair_idx * 2 + 1];
+        child_pt[0] = matched->points[pair_idx * 2 + 0];
+        child_pt[1] = matched->points[pair_idx * 2 + 1];
         homographyTransfer33(estimated_homography, child_pt[0], child_pt[1], projected_base_pt);
         
         double base_pt[2] = {0}, reprojection_error[2] = {0};
-        base_pt[0] = base_feature_coords[pair_idx * 2 + 0];
-        base_pt[1] = base_feature_coords[pair_idx * 2 + 1];
+        base_pt[0] = matched->matches[pair_idx * 2 + 0];
+        base_pt[1] = matched->matches[pair_idx * 2 + 1];
         reprojection_error[0] = projected_base_pt[0] - base_pt[0];
         reprojection_error[1] = projected_base_pt[1] - base_pt[1];
         double reprojection_error_magnitude = sqrt(reprojection_error[0] * reprojection_error[0] + 
                                                  reprojection_error[1] * reprojection_error[1]);
         
-        if (reprojection_error_magnitude < parameters.sliding.reprojection_threshold)
-        {
+        matched->keep[pair_idx] = reprojection_error_magnitude < parameters.sliding.reprojection_threshold;
 #ifdef DEBUG
-            DrawArrow(visualization_buffer, lmk_base.num_cols, lmk_base.num_rows,
+        if (matched->keep[pair_idx])
+        {
+            DrawArrow(visualization_buffer, lmk_base->num_cols, lmk_base->num_rows,
                       child_pt[0], child_pt[1],
                       base_pt[0], base_pt[1],
                       255, 3);
+        }
 #endif
-            
-            if (LMK_Col_Row2World(&lmk_child, child_pt[0], child_pt[1], &child_3d_points[num_3d_points * 3]) &
-                LMK_Col_Row2World(&lmk_base, base_pt[0], base_pt[1], &base_3d_points[num_3d_points * 3]))
+    }
+    // Inliers are compacted at the front of the set, in the same order
+    int32_t num_inliers = feature_set_compact(matched);
+    
+    // Convert homography inliers to 3D point clouds, in parallel, and keep the points with elevation in both
+    bool *valid_3d_points = workspace->valid_3d_points;
+    BackProjectionJob back_projection = {lmk_child, lmk_base, matched->points, matched->matches,
+                                         child_3d_points, base_3d_points, valid_3d_points};
+    parallel_ranges(back_project_pairs, &back_projection, num_inliers, workspace->num_threads);
+    int32_t num_3d_points = 0;
+    for (int32_t i = 0; i < num_inliers; ++i)
+    {
+        if (valid_3d_points[i])
+        {
+            if (num_3d_points != i)
             {
-                ++num_3d_points;
+                memcpy(&child_3d_points[num_3d_points * 3], &child_3d_points[i * 3], sizeof(double) * 3);
+                memcpy(&base_3d_points[num_3d_points * 3], &base_3d_points[i * 3], sizeof(double) * 3);
             }
+            ++num_3d_points;
         }
     }
 
 #ifdef DEBUG
     SAFE_PRINTF(128, "# of RANSAC inliers %d\n", num_3d_points);
-    write_channel_separated_image("RANSAC_inlier.png", visualization_buffer, lmk_base.num_cols, lmk_base.num_rows, 1);
+    write_channel_separated_image("RANSAC_inlier.png", visualization_buffer, lmk_base->num_cols, lmk_base->num_rows, 1);
+    free(visualization_buffer);
 #endif
     
     // Check for sufficient inliers, otherwise later call to Point_Clouds_rot_T_RANSAC will segfault
     if(num_3d_points == 0){
         printf("RegisterLandmarks(): no homography inliers within reprojection threshold\n");
-        cleanup_memory(&lmk_child, &lmk_base, base_feature_coords, child_feature_coords, 
-                      correlation_template, feature_pixel_coords, feature_quality_scores, visualization_buffer,
-                      child_3d_points, base_3d_points);
         return 0;
     }
     
     // Refine transformation using 3D point clouds
-    double refined_rotation[3][3] = {0};
-    double refined_translation[3] = {0};
-
-    if (!Point_Clouds_rot_T_RANSAC(child_3d_points, base_3d_points, num_3d_points, 
-                                                         refined_rotation, refined_translation, 
-                                                         parameters.sliding.min_n_features))
+    if (!Point_Clouds_rot_T_RANSAC_ctx(&workspace->point_cloud, child_3d_points, base_3d_points, num_3d_points,
+                                       refined_rotation, refined_translation,
+                                       parameters.sliding.min_n_features, splitmix64_seed_from_rand()))
     {
         printf("RegisterLandmarks(): Point_Clouds_rot_T_RANSAC did not find enough inliers\n");
-        cleanup_memory(&lmk_child, &lmk_base, base_feature_coords, child_feature_coords, 
-                      correlation_template, feature_pixel_coords, feature_quality_scores, visualization_buffer,
-                      child_3d_points, base_3d_points);
         return 0;
     }
-    prt33(refined_rotation);
-    prt3(refined_translation);
-    
-    // Update landmark structure with refined transformation
+    return 1;
+}
+
+/**
+ * \brief Move the child landmark by the rigid transformation found by `register_level`
+ */
+static void apply_rigid_transform(LMK *lmk_child, double rotation[3][3], const double translation[3])
+{
     double world_to_map_rotation[3][3] = {0}, transformed_point[3] = {0};
-    mult333(refined_rotation, lmk_child.worldRmap, world_to_map_rotation);
-    mult331(refined_rotation, lmk_child.anchor_point, transformed_point);
-    add3(transformed_point, refined_translation, lmk_child.anchor_point);
+    mult333(rotation, lmk_child->worldRmap, world_to_map_rotation);
+    mult331(rotation, lmk_child->anchor_point, transformed_point);
+    add3(transformed_point, translation, lmk_child->anchor_point);
+    
+    mult331(rotation, lmk_child->map_normal_vector, transformed_point);
+    copy3(transformed_point, lmk_child->map_normal_vector);
+    copy33(world_to_map_rotation, lmk_child->worldRmap);
+    trans33(world_to_map_rotation, lmk_child->mapRworld);
+    normalpoint2plane(lmk_child->map_normal_vector, lmk_child->anchor_point, lmk_child->map_plane_params);
+}
+
+/**
+ * \brief True if `coarse` has the header `Downsample_LMK_2x` gives the level below it, `finer`
+ */
+static bool is_coarser_level(const LMK *finer, const LMK *coarse)
+{
+    return coarse->num_cols == finer->num_cols / 2 && coarse->num_rows == finer->num_rows / 2 &&
+           coarse->resolution == 2.0 * finer->resolution &&
+           coarse->anchor_col == (finer->anchor_col - 0.5) / 2.0 &&
+           coarse->anchor_row == (finer->anchor_row - 0.5) / 2.0 &&
+           memcmp(coarse->anchor_point, finer->anchor_point, sizeof(finer->anchor_point)) == 0 &&
+           memcmp(coarse->mapRworld, finer->mapRworld, sizeof(finer->mapRworld)) == 0;
+}
+
+/**
+ * \brief Load level `level` of the pyramid of a landmark file, from its overview sidecar if it has one that matches
+ * the landmark, otherwise by downsampling the finer level already loaded
+ */
+static bool load_pyramid_level(const char *filename, int32_t level, const LMK *finer, LMK *lmk)
+{
+    if (LMK_Overview_Count(filename) >= level)
+    {
+        if (Read_LMK_Overview_Level(filename, level, lmk) && is_coarser_level(finer, lmk))
+        {
+            return true;
+        }
+        SAFE_PRINTF(512, "load_pyramid_level() ==>> level %d of the overviews of %s does not match it, "
+                    "downsampling instead\n", level, filename);
+        free_lmk(lmk);
+    }
+    return Downsample_LMK_2x(finer, lmk);
+}
+
+static void free_pyramid(LMK *pyramid, int32_t num_levels)
+{
+    for (int32_t level = 0; level < num_levels; ++level)
+    {
+        free_lmk(&pyramid[level]);
+    }
+}
+
+/**
+ * \brief True if the next coarser level of `lmk` leaves enough pixels for the features
+ */
+static bool can_downsample(const LMK *lmk)
+{
+    return lmk->num_cols / 2 >= REGISTRATION_MIN_LEVEL_SIZE && lmk->num_rows / 2 >= REGISTRATION_MIN_LEVEL_SIZE;
+}
+
+/**
+ * \brief Place the per-feature buffers of a workspace in one block
+ *
+ * \param arena Block of the buffers, or NULL to only compute its size
+ * \return bytes of the block
+ */
+static size_t layout_workspace(RegistrationWorkspace *workspace, uint8_t *arena)
+{
+    size_t num_features = (size_t)workspace->max_features;
+    size_t offset = 0;
+    // Each buffer starts on a cache line
+#define WORKSPACE_BUFFER(field, bytes) do { \
+        offset = (offset + 63) & ~(size_t)63; \
+        if (arena != NULL) workspace->field = (void *)(arena + offset); \
+        offset += (bytes); \
+    } while (0)
+    WORKSPACE_BUFFER(correlation_template, workspace->template_pixels * num_features);
+    WORKSPACE_BUFFER(feature_pixel_coords, sizeof(int64_t[2]) * num_features);
+    WORKSPACE_BUFFER(feature_quality_scores, sizeof(float) * num_features);
+    WORKSPACE_BUFFER(correlation_tasks, sizeof(CorrTask) * num_features);
+    WORKSPACE_BUFFER(correlation_results, sizeof(CorrResult) * num_features);
+    WORKSPACE_BUFFER(task_base_coords, sizeof(double) * 2 * num_features);
+    WORKSPACE_BUFFER(task_strength, sizeof(float) * num_features);
+    WORKSPACE_BUFFER(task_order, sizeof(TaskStrength) * num_features);
+    WORKSPACE_BUFFER(sorted_tasks, sizeof(CorrTask) * num_features);
+    WORKSPACE_BUFFER(sorted_coords, sizeof(double) * 2 * num_features);
+    WORKSPACE_BUFFER(child_3d_points, sizeof(double) * 3 * num_features);
+    WORKSPACE_BUFFER(base_3d_points, sizeof(double) * 3 * num_features);
+    WORKSPACE_BUFFER(valid_3d_points, sizeof(bool) * num_features);
+#undef WORKSPACE_BUFFER
+    return offset;
+}
+
+bool registration_workspace_init(RegistrationWorkspace *workspace, const Parameters *parameters,
+                                 int32_t max_cols, int32_t max_rows, int32_t num_threads)
+{
+    memset(workspace, 0, sizeof(RegistrationWorkspace));
+    if (max_cols < 1 || max_rows < 1 || parameters->detector.num_features < 1)
+    {
+        SAFE_PRINTF(256, "registration_workspace_init() ==>> invalid size %d x %d or %d features\n",
+                    max_cols, max_rows, parameters->detector.num_features);
+        return false;
+    }
+    workspace->max_cols = max_cols;
+    workspace->max_rows = max_rows;
+    workspace->max_features = parameters->detector.num_features;
+    workspace->correlation_window_size = parameters->matching.correlation_window_size;
+    workspace->search_window_size = parameters->matching.search_window_size;
+    workspace->template_pixels = (size_t)workspace->correlation_window_size * workspace->correlation_window_size;
+    workspace->num_threads = num_threads;
+    workspace->forstner.num_threads = num_threads;
+    workspace->point_cloud.num_threads = num_threads;
+    
+    size_t arena_bytes = layout_workspace(workspace, NULL);
+    workspace->arena = malloc(arena_bytes + 63);
+    bool success = workspace->arena != NULL;
+    if (success)
+    {
+        uint8_t *aligned = (uint8_t *)(((uintptr_t)workspace->arena + 63) & ~(uintptr_t)63);
+        layout_workspace(workspace, aligned);
+    }
+    
+    success = success &&
+              corr_context_init(&workspace->corr, workspace->correlation_window_size,
+                                workspace->correlation_window_size, workspace->search_window_size,
+                                workspace->search_window_size) &&
+              forstner_scratch_reserve(&workspace->forstner, max_cols, max_rows, parameters->detector.window_size,
+                                       (int32_t)parameters->detector.min_dist_feature) &&
+              feature_set_reserve(&workspace->matched, workspace->max_features) &&
+              ransac_scratch_reserve(&workspace->ransac, workspace->max_features) &&
+              point_cloud_scratch_reserve(&workspace->point_cloud, workspace->max_features);
+    if (!success)
+    {
+        printf("registration_workspace_init(): memory allocation error\n");
+        registration_workspace_free(workspace);
+        return false;
+    }
+    workspace->bytes = arena_bytes + 63 + workspace->matched.bytes + workspace->corr.size + forstner_scratch_bytes(&workspace->forstner) +
+                       ransac_scratch_bytes(&workspace->ransac) + point_cloud_scratch_bytes(&workspace->point_cloud);
+    return true;
+}
+
+void registration_workspace_free(RegistrationWorkspace *workspace)
+{
+    free(workspace->arena);
+    feature_set_free(&workspace->matched);
+    corr_context_free(&workspace->corr);
+    forstner_scratch_free(&workspace->forstner);
+    ransac_scratch_free(&workspace->ransac);
+    point_cloud_scratch_free(&workspace->point_cloud);
+    memset(workspace, 0, sizeof(RegistrationWorkspace));
+}
+
+bool prepare_registration_base(RegistrationBase *base, const char *base_landmark_filename, int32_t num_levels)
+{
+    memset(base, 0, sizeof(RegistrationBase));
+    if (num_levels > LMK_OVERVIEW_MAX_LEVELS) num_levels = LMK_OVERVIEW_MAX_LEVELS;
+    if (!Read_LMK(base_landmark_filename, &base->levels[0]))
+    {
+        SAFE_PRINTF(512, "prepare_registration_base() ==>> cannot read %s\n", base_landmark_filename);
+        return false;
+    }
+    base->num_levels = 1;
+    for (int32_t level = 1; level <= num_levels && can_downsample(&base->levels[level - 1]); ++level)
+    {
+        if (!load_pyramid_level(base_landmark_filename, level, &base->levels[level - 1], &base->levels[level]))
+        {
+            SAFE_PRINTF(512, "prepare_registration_base() ==>> cannot build pyramid level %d\n", level);
+            free_lmk(&base->levels[level]);
+            free_registration_base(base);
+            return false;
+        }
+        base->num_levels = level + 1;
+    }
+    
+    // Without window sums a level is searched with corimg_long
+    for (int32_t level = 0; level < base->num_levels; ++level)
+    {
+        const LMK *lmk = &base->levels[level];
+        base->have_integral[level] = corr_integral_image_build(&base->integral[level], lmk->srm, lmk->num_cols,
+                                                               lmk->num_cols, lmk->num_rows);
+    }
+    return true;
+}
+
+void free_registration_base(RegistrationBase *base)
+{
+    for (int32_t level = 0; level < base->num_levels; ++level)
+    {
+        if (base->have_integral[level]) corr_integral_image_free(&base->integral[level]);
+    }
+    free_pyramid(base->levels, base->num_levels);
+    memset(base, 0, sizeof(RegistrationBase));
+}
+
+int32_t RegisterLandmark_base(Parameters parameters, const RegistrationBase *base,
+                              const char *child_landmark_filename, int32_t num_levels,
+                              int32_t refine_search_window_size, const TimeBudget *budget,
+                              BudgetStatus *status)
+{
+    *status = BUDGET_COMPLETE;
+    if (num_levels > base->num_levels - 1) num_levels = base->num_levels - 1;
+    if (num_levels < 0) num_levels = 0;
+    if (refine_search_window_size <= 0)
+    {
+        refine_search_window_size = parameters.matching.correlation_window_size + 2 * REGISTRATION_REFINE_MARGIN;
+    }
+    
+    LMK child_pyramid[LMK_OVERVIEW_MAX_LEVELS + 1] = {0};
+    if (!Read_LMK(child_landmark_filename, &child_pyramid[0]))
+    {
+        printf("Failed to read landmark files\n");
+        return 0;
+    }
+    // The finest child level keeps its rasters in `lmk_child` with the pose it was read with
+    LMK lmk_child = child_pyramid[0];
+    
+    // Every level is registered in the buffers of the finest one
+    RegistrationWorkspace workspace;
+    if (!registration_workspace_init(&workspace, &parameters, lmk_child.num_cols, lmk_child.num_rows, 0))
+    {
+        free_lmk(&child_pyramid[0]);
+        return 0;
+    }
     
-    mult331(refined_rotation, lmk_child.map_normal_vector, transformed_point);
-    copy3(transformed_point, lmk_child.map_normal_vector);
-    copy33(world_to_map_rotation, lmk_child.worldRmap);
-    trans33(world_to_map_rotation, lmk_child.mapRworld);
-    normalpoint2plane(lmk_child.map_normal_vector, lmk_child.anchor_point, lmk_child.map_plane_params);
+    // Coarse levels stop before the landmarks get too small to hold the features
+    int32_t num_loaded = 1;
+    for (int32_t level = 1; level <= num_levels && can_downsample(&child_pyramid[level - 1]); ++level)
+    {
+        if (!load_pyramid_level(child_landmark_filename, level, &child_pyramid[level - 1], &child_pyramid[level]))
+        {
+            printf("RegisterLandmark_base(): cannot build pyramid level %d\n", level);
+            free_pyramid(child_pyramid, level + 1);
+            registration_workspace_free(&workspace);
+            return 0;
+        }
+        num_loaded = level + 1;
+    }
+    
+    // Every level shares the world frame of its landmark, so the transformation found on a coarse level moves the
+    // child landmark on the finer levels as well. Each level refines the composition of the coarser ones.
+    double total_rotation[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    double total_translation[3] = {0};
+    for (int32_t level = num_loaded - 1; level >= 0; --level)
+    {
+        LMK *level_child = &child_pyramid[level];
+        const LMK *level_base = &base->levels[level];
+        
+        // Calculate initial transformation between landmarks. A single level starts from the rotation between the
+        // landmark frames, the pyramid from the corners of the child moved by the coarser levels.
+        double child_to_base_transform[3][3], base_to_child_transform[3][3];
+        if (num_levels == 0)
+        {
+            mult333(level_child->mapRworld, (double (*)[3])level_base->worldRmap, child_to_base_transform);
+        }
+        else
+        {
+            if (level < num_loaded - 1) apply_rigid_transform(level_child, total_rotation, total_translation);
+            estimateHomographyUsingCorners(level_base, level_child, child_to_base_transform);
+        }
+        inverseHomography33(child_to_base_transform, base_to_child_transform);
+        
+        int32_t search_window_size = (level == num_loaded - 1) ? parameters.matching.search_window_size
+                                                                : refine_search_window_size;
+        double level_rotation[3][3] = {0};
+        double level_translation[3] = {0};
+        if (num_loaded > 1)
+        {
+            SAFE_PRINTF(128, "Registering pyramid level %d, %d x %d pixels\n", level, level_child->num_cols, level_child->num_rows);
+        }
+        if (!register_level(parameters, &workspace, level_child, level_base,
+                            base->have_integral[level] ? &base->integral[level] : NULL,
+                            child_to_base_transform, base_to_child_transform,
+                            search_window_size, budget, status, level_rotation, level_translation))
+        {
+            if (num_loaded > 1) printf("RegisterLandmark_base(): registration failed on pyramid level %d\n", level);
+            free_pyramid(child_pyramid, num_loaded);
+            registration_workspace_free(&workspace);
+            return 0;
+        }
+        
+        double rotation[3][3], rotated_translation[3];
+        mult333(level_rotation, total_rotation, rotation);
+        copy33(rotation, total_rotation);
+        mult331(level_rotation, total_translation, rotated_translation);
+        add3(rotated_translation, level_translation, total_translation);
+        
+        // Out of time, the coarser levels are the best estimate there is
+        if (*status != BUDGET_COMPLETE && level > 0)
+        {
+            SAFE_PRINTF(128, "RegisterLandmark_base(): stopped after pyramid level %d\n", level);
+            break;
+        }
+    }
+    registration_workspace_free(&workspace);
+    prt33(total_rotation);
+    prt3(total_translation);
+    
+    // Update landmark structure with refined transformation
+    apply_rigid_transform(&lmk_child, total_rotation, total_translation);
     
     // Save registered landmark
     char output_filename[STRBUF_SIZE];
@@ -407,12 +909,135 @@ int32_t RegisterLandmarks(Parameters parameters, const char *base_landmark_filen
     Write_LMK(output_filename, &lmk_child);
     
     #ifdef DEBUG
-    visualize_warped_landmark(&lmk_base, &lmk_child, visualization_buffer);
+    uint8_t *visualization_buffer = (uint8_t *)malloc(sizeof(uint8_t)*base->levels[0].num_pixels);
+    if(visualization_buffer != NULL) visualize_warped_landmark(&base->levels[0], &lmk_child, visualization_buffer);
+    free(visualization_buffer);
     #endif
     
-    // Clean up allocated memory
-    cleanup_memory(&lmk_child, &lmk_base, base_feature_coords, child_feature_coords, 
-                  correlation_template, feature_pixel_coords, feature_quality_scores, visualization_buffer,
-                  child_3d_points, base_3d_points);
+    free_pyramid(child_pyramid, num_loaded);
     return 1;
-} 
\ No newline at end of file
+}
+
+int32_t RegisterLandmark_workspace(Parameters parameters, RegistrationWorkspace *workspace, const LMK *base_landmark,
+                                   const CorrIntegralImage *base_integral, LMK *child_landmark,
+                                   const TimeBudget *budget, BudgetStatus *status)
+{
+    *status = BUDGET_COMPLETE;
+    if (child_landmark->num_cols > workspace->max_cols || child_landmark->num_rows > workspace->max_rows ||
+        parameters.detector.num_features > workspace->max_features ||
+        parameters.matching.correlation_window_size > workspace->correlation_window_size ||
+        parameters.matching.search_window_size > workspace->search_window_size)
+    {
+        SAFE_PRINTF(256, "RegisterLandmark_workspace(): %d x %d child landmark or parameters exceed the workspace\n",
+                    child_landmark->num_cols, child_landmark->num_rows);
+        return 0;
+    }
+    
+    double child_to_base_transform[3][3], base_to_child_transform[3][3];
+    mult333(child_landmark->mapRworld, (double (*)[3])base_landmark->worldRmap, child_to_base_transform);
+    inverseHomography33(child_to_base_transform, base_to_child_transform);
+    
+    double rotation[3][3] = {0};
+    double translation[3] = {0};
+    if (!register_level(parameters, workspace, child_landmark, base_landmark, base_integral,
+                        child_to_base_transform, base_to_child_transform, parameters.matching.search_window_size,
+                        budget, status, rotation, translation))
+    {
+        return 0;
+    }
+    apply_rigid_transform(child_landmark, rotation, translation);
+    return 1;
+}
+
+int32_t RegisterLandmarks_budget(Parameters parameters, const char *base_landmark_filename,
+                                 const char *child_landmark_filename, const TimeBudget *budget,
+                                 BudgetStatus *status)
+{
+    return RegisterLandmarks_multires(parameters, base_landmark_filename, child_landmark_filename, 0, 0,
+                                      budget, status);
+}
+
+int32_t RegisterLandmarks_multires(Parameters parameters, const char *base_landmark_filename,
+                                   const char *child_landmark_filename, int32_t num_levels,
+                                   int32_t refine_search_window_size, const TimeBudget *budget,
+                                   BudgetStatus *status)
+{
+    *status = BUDGET_COMPLETE;
+    RegistrationBase base;
+    if (!prepare_registration_base(&base, base_landmark_filename, num_levels))
+    {
+        printf("Failed to read landmark files\n");
+        return 0;
+    }
+    int32_t registered = RegisterLandmark_base(parameters, &base, child_landmark_filename, num_levels,
+                                               refine_search_window_size, budget, status);
+    free_registration_base(&base);
+    return registered;
+}
+
+/**
+ * \brief Children of `RegisterLandmarks_batch`, taken one at a time by its threads
+ */
+typedef struct {
+    const Parameters *parameters;
+    const RegistrationBase *base;
+    const char **child_landmark_filenames;
+    int32_t num_children;
+    int32_t num_levels;
+    int32_t refine_search_window_size;
+    int32_t *registered;
+    int32_t next_child;
+    pthread_mutex_t lock;
+} RegistrationBatch;
+
+static void *registration_batch_thread(void *arg)
+{
+    RegistrationBatch *batch = (RegistrationBatch *)arg;
+    while (true)
+    {
+        pthread_mutex_lock(&batch->lock);
+        int32_t child = batch->next_child++;
+        pthread_mutex_unlock(&batch->lock);
+        if (child >= batch->num_children) break;
+        
+        BudgetStatus status;
+        batch->registered[child] = RegisterLandmark_base(*batch->parameters, batch->base,
+                                                         batch->child_landmark_filenames[child], batch->num_levels,
+                                                         batch->refine_search_window_size, NULL, &status);
+    }
+    return NULL;
+}
+
+int32_t RegisterLandmarks_batch(Parameters parameters, const RegistrationBase *base,
+                                const char **child_landmark_filenames, int32_t num_children,
+                                int32_t num_levels, int32_t refine_search_window_size,
+                                int32_t num_threads, int32_t *registered)
+{
+    if (num_threads <= 0) num_threads = parallel_num_threads();
+    if (num_threads > REGISTRATION_MAX_THREADS) num_threads = REGISTRATION_MAX_THREADS;
+    if (num_threads > num_children) num_threads = num_children;
+    
+    RegistrationBatch batch = {&parameters, base, child_landmark_filenames, num_children, num_levels,
+                               refine_search_window_size, registered, 0};
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_t threads[REGISTRATION_MAX_THREADS];
+    bool started[REGISTRATION_MAX_THREADS] = {false};
+    for (int32_t t = 1; t < num_threads; t++)
+    {
+        started[t] = pthread_create(&threads[t], NULL, registration_batch_thread, &batch) == 0;
+    }
+    // The calling thread registers children too, so a batch progresses even if no thread starts
+    registration_batch_thread(&batch);
+    for (int32_t t = 1; t < num_threads; t++)
+    {
+        if (started[t]) pthread_join(threads[t], NULL);
+    }
+    pthread_mutex_destroy(&batch.lock);
+    
+    int32_t num_registered = 0;
+    for (int32_t child = 0; child < num_children; ++child)
+    {
+        num_registered += registered[child];
+    }
+    return num_registered;
+}
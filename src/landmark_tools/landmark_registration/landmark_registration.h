@@ -21,9 +21,75 @@
 #ifndef LANDMARK_REGISTRATION_H
 #define LANDMARK_REGISTRATION_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include "landmark_tools/landmark_util/landmark.h"
+#include "landmark_tools/feature_selection/int_forstner_extended.h"
 #include "landmark_tools/feature_tracking/parameters.h"
+#include "landmark_tools/feature_tracking/corr_image_long.h"
+#include "landmark_tools/feature_tracking/feature_set.h"
+#include "landmark_tools/math/homography_util.h"
+#include "landmark_tools/math/point_line_plane_util.h"
+#include "landmark_tools/landmark_util/lmk_overview.h"
+#include "landmark_tools/utils/time_budget.h"
+
+#define REGISTRATION_REFINE_MARGIN 4  //!< Default search margin of the finer pyramid levels, in pixels
+
+/**
+ * \brief Base landmark of many registrations, loaded and prepared once
+ *
+ * Holds the base landmark, its overview pyramid and the window sums every correlation search of a level reads.
+ * It is only read by the registrations, so any number of them may share it at the same time.
+ */
+typedef struct {
+    int32_t num_levels;                                       //!< Levels in `levels`, the landmark and its coarse levels
+    LMK levels[LMK_OVERVIEW_MAX_LEVELS + 1];                  //!< Level k has 2^k times the resolution of the landmark
+    bool have_integral[LMK_OVERVIEW_MAX_LEVELS + 1];          //!< True if the window sums of a level were built
+    CorrIntegralImage integral[LMK_OVERVIEW_MAX_LEVELS + 1];  //!< Window sums of the surface reflectance of each level
+} RegistrationBase;
+
+/**
+ * \brief Memory of the registration of child landmarks up to a maximum size, allocated once
+ *
+ * Holds the buffers of the feature detection, correlation, homography RANSAC and point cloud fit, sized from the
+ * `Parameters` and landmark size given to `registration_workspace_init`. `bytes` is the whole memory of a
+ * registration beyond the landmarks themselves, known before the first one runs. With one thread, registrations
+ * with `RegisterLandmark_workspace` allocate no memory and start no threads, so they take the same time every run.
+ * A workspace must not be shared between threads.
+ */
+typedef struct {
+    int32_t max_cols;                      //!< Widest child landmark
+    int32_t max_rows;                      //!< Tallest child landmark
+    int32_t max_features;                  //!< Features the per-feature buffers hold
+    int32_t correlation_window_size;       //!< Largest correlation template
+    int32_t search_window_size;            //!< Largest correlation search window
+    size_t template_pixels;                //!< Pixels of one template in `correlation_template`
+    int32_t num_threads;                   //!< Threads of each step, 0 for `parallel_num_threads()`
+    size_t bytes;                          //!< Heap memory held by the workspace
+    void *arena;                           //!< Block holding the per-feature buffers below
+    uint8_t *correlation_template;         //!< One template per feature
+    int64_t (*feature_pixel_coords)[2];    //!< Detected features
+    float *feature_quality_scores;         //!< Forstner interest of each feature
+    CorrTask *correlation_tasks;           //!< One correlation per feature inside the base
+    CorrResult *correlation_results;       //!< Result of each task
+    double *task_base_coords;              //!< Base coordinates of each task
+    float *task_strength;                  //!< Feature interest of each task
+    void *task_order;                      //!< Tasks sorted by strength
+    CorrTask *sorted_tasks;                //!< Tasks in strength order
+    double *sorted_coords;                 //!< Base coordinates in strength order
+    double *child_3d_points;               //!< World points of the inliers in the child
+    double *base_3d_points;                //!< World points of the inliers in the base
+    bool *valid_3d_points;                 //!< True if an inlier has elevation in both
+    FeatureSet matched;                    //!< Matched child features and their base matches, then homography inliers
+    CorrContext corr;                      //!< Correlation scratch of the calling thread
+    ForstnerScratch forstner;              //!< Feature detection scratch
+    RansacScratch ransac;                  //!< Homography RANSAC scratch
+    PointCloudScratch point_cloud;         //!< Point cloud RANSAC scratch
+} RegistrationWorkspace;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
 
 /**
  * \brief Registers two landmarks by finding corresponding features and estimating the transformation
@@ -44,4 +110,164 @@ int32_t RegisterLandmarks(Parameters parameters,
                          const char *base_landmark_filename, 
                          const char *child_landmark_filename);
 
-#endif // LANDMARK_REGISTRATION_H 
\ No newline at end of file
+/**
+ * \brief Same as RegisterLandmarks, stopping the feature matching when a time budget ends
+ * 
+ * With a budget, the child features are correlated from the strongest Forstner response down, a chunk at a time.
+ * Once the budget ends, the transformation is estimated from the features matched so far.
+ * 
+ * \param parameters Matching parameters for feature detection and matching
+ * \param base_landmark_filename Filename of the base landmark
+ * \param child_landmark_filename Filename of the child landmark
+ * \param budget Time budget and cancellation of the matching, or NULL to match every feature
+ * \param status Set to BUDGET_COMPLETE if every feature was correlated, otherwise to the reason matching stopped
+ * \return 1 on success, 0 on failure
+ */
+int32_t RegisterLandmarks_budget(Parameters parameters, 
+                                const char *base_landmark_filename, 
+                                const char *child_landmark_filename,
+                                const TimeBudget *budget,
+                                BudgetStatus *status);
+
+/**
+ * \brief Coarse-to-fine registration on the overview pyramids of the landmarks
+ * 
+ * The coarsest level is matched with `search_window_size`, so the offsets it resolves are 2^num_levels times
+ * larger than at full resolution. Each finer level starts from the transformation of the levels above and only
+ * searches `refine_search_window_size` pixels around it. Levels come from the ".ovr" sidecar of a landmark file
+ * when it has them, otherwise they are downsampled after reading the file.
+ * 
+ * \param parameters Matching parameters for feature detection and matching, shared by every level
+ * \param base_landmark_filename Filename of the base landmark
+ * \param child_landmark_filename Filename of the child landmark
+ * \param num_levels Number of coarse levels. Fewer are used if a level would be smaller than 64 pixels
+ * \param refine_search_window_size Search window of the finer levels, or 0 for the correlation window plus
+ *        REGISTRATION_REFINE_MARGIN pixels on each side
+ * \param budget Time budget and cancellation of the matching, or NULL to match every feature. When the budget
+ *        ends, the transformation of the levels registered so far is used
+ * \param status Set to BUDGET_COMPLETE if every feature was correlated, otherwise to the reason matching stopped
+ * \return 1 on success, 0 on failure
+ */
+int32_t RegisterLandmarks_multires(Parameters parameters, 
+                                  const char *base_landmark_filename, 
+                                  const char *child_landmark_filename,
+                                  int32_t num_levels,
+                                  int32_t refine_search_window_size,
+                                  const TimeBudget *budget,
+                                  BudgetStatus *status);
+
+/**
+ * \brief Load a base landmark and build what its registrations share
+ * 
+ * \param base Base landmark state. Release with `free_registration_base`
+ * \param base_landmark_filename Filename of the base landmark
+ * \param num_levels Number of coarse levels to prepare for `RegisterLandmark_base`, 0 for single level registration.
+ *        Fewer are prepared if a level would be smaller than 64 pixels
+ * \return false if the file cannot be read or memory allocation fails
+ */
+bool prepare_registration_base(RegistrationBase *base, const char *base_landmark_filename, int32_t num_levels);
+
+/**
+ * \brief Release the memory of a `RegistrationBase`
+ */
+void free_registration_base(RegistrationBase *base);
+
+/**
+ * \brief `RegisterLandmarks_multires` against a prepared base landmark
+ * 
+ * With `num_levels` 0 this is `RegisterLandmarks_budget`. The registered child is written to
+ * "child_landmark_filename"_registered.lmk.
+ * 
+ * \param parameters Matching parameters for feature detection and matching
+ * \param base Base landmark from `prepare_registration_base`
+ * \param child_landmark_filename Filename of the child landmark
+ * \param num_levels Number of coarse levels, at most those prepared in `base`
+ * \param refine_search_window_size Search window of the finer levels, or 0 for the default
+ * \param budget Time budget and cancellation of the matching, or NULL to match every feature
+ * \param status Set to BUDGET_COMPLETE if every feature was correlated, otherwise to the reason matching stopped
+ * \return 1 on success, 0 on failure
+ */
+int32_t RegisterLandmark_base(Parameters parameters,
+                              const RegistrationBase *base,
+                              const char *child_landmark_filename,
+                              int32_t num_levels,
+                              int32_t refine_search_window_size,
+                              const TimeBudget *budget,
+                              BudgetStatus *status);
+
+/**
+ * \brief Register many child landmarks against one prepared base landmark, several at a time
+ * 
+ * Each thread takes the next child of the list and registers it with `RegisterLandmark_base`. The random draws of
+ * the RANSAC steps are taken from rand() by whichever registration runs, so with more than one thread the results
+ * match those of one registration at a time up to the RANSAC draws.
+ * 
+ * \param parameters Matching parameters for feature detection and matching
+ * \param base Base landmark from `prepare_registration_base`
+ * \param child_landmark_filenames Filenames of the child landmarks
+ * \param num_children Number of child landmarks
+ * \param num_levels Number of coarse levels, at most those prepared in `base`
+ * \param refine_search_window_size Search window of the finer levels, or 0 for the default
+ * \param num_threads Registrations running at the same time, or 0 for `parallel_num_threads()`
+ * \param registered Set to 1 for each child that was registered, 0 otherwise
+ * \return number of child landmarks registered
+ */
+int32_t RegisterLandmarks_batch(Parameters parameters,
+                                const RegistrationBase *base,
+                                const char **child_landmark_filenames,
+                                int32_t num_children,
+                                int32_t num_levels,
+                                int32_t refine_search_window_size,
+                                int32_t num_threads,
+                                int32_t *registered);
+
+/**
+ * \brief Allocate the memory of registrations of child landmarks up to max_cols x max_rows
+ *
+ * \param workspace Workspace. Release with `registration_workspace_free`
+ * \param parameters Matching parameters of the registrations. Their number of features and window sizes are the
+ *        largest a registration with this workspace may use
+ * \param max_cols Widest child landmark
+ * \param max_rows Tallest child landmark
+ * \param num_threads Threads of each step of a registration, or 0 for `parallel_num_threads()`. 1 for registrations
+ *        that allocate no memory
+ * \return false if memory allocation fails
+ */
+bool registration_workspace_init(RegistrationWorkspace *workspace, const Parameters *parameters,
+                                 int32_t max_cols, int32_t max_rows, int32_t num_threads);
+
+/**
+ * \brief Release the memory of a `RegistrationWorkspace`
+ */
+void registration_workspace_free(RegistrationWorkspace *workspace);
+
+/**
+ * \brief Single level registration of landmarks in memory, with every buffer taken from a workspace
+ *
+ * Matches as `RegisterLandmarks_budget` and moves `child_landmark` by the transformation found, without reading or
+ * writing files. With a one thread workspace the call allocates no memory. Correlations that take the FFT path, which
+ * only happens with `prune_search` off and large search windows, still allocate their score buffer, and DEBUG builds
+ * allocate their visualization images.
+ *
+ * \param parameters Matching parameters, within those the workspace was sized for
+ * \param workspace Workspace from `registration_workspace_init`
+ * \param base_landmark Base landmark
+ * \param base_integral Window sums of the base surface reflectance from `corr_integral_image_build`, or NULL
+ * \param child_landmark Child landmark, at most the size of the workspace. Moved in place on success
+ * \param budget Time budget and cancellation of the matching, or NULL to match every feature
+ * \param status Set to BUDGET_COMPLETE if every feature was correlated, otherwise to the reason matching stopped
+ * \return 1 on success, 0 on failure or if the child landmark or parameters exceed the workspace
+ */
+int32_t RegisterLandmark_workspace(Parameters parameters,
+                                   RegistrationWorkspace *workspace,
+                                   const LMK *base_landmark,
+                                   const CorrIntegralImage *base_integral,
+                                   LMK *child_landmark,
+                                   const TimeBudget *budget,
+                                   BudgetStatus *status);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // LANDMARK_REGISTRATION_H
\ No newline at end of file
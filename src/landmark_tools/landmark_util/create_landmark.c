@@ -16,19 +16,34 @@
 
 #include "landmark_tools/landmark_util/create_landmark.h"
 
+#include <float.h>                  // for FLT_MAX
 #include <math.h>                   // for fabs, NAN
+#include <pthread.h>                // for pthread_create, pthread_join
+#include <stdlib.h>                 // for calloc, free
 #include <string.h>
 
 #include "landmark_tools/map_projection/datum_conversion.h"        // for LatLongHeight_ECEF_xyz, Planet
-#include "landmark_tools/landmark_util/landmark.h"    // for LMK_Col_Row_Elevation2World
+#include "landmark_tools/landmark_util/landmark.h"    // for LMK_Col_Row_Elevation2World_Batch
+#include "landmark_tools/landmark_util/lmk_writer.h"  // for Open_LMK_Writer, Append_LMK_Rows
+#include "landmark_tools/image_io/dem_tile_cache.h"              // for DemTileCache
 #include "landmark_tools/data_interpolation/interpolate_data.h"   // for inter_short_elevation, inter_uint8_matrix
 #include "landmark_tools/map_projection/equidistant_cylindrical_projection.h"
+#include "landmark_tools/map_projection/map_projection.h"          // for map_projection_forward
 #include "landmark_tools/map_projection/utm.h"                    // for latlong2utm
 #include "landmark_tools/map_projection/stereographic_projection.h"  // for LatLong2StereographicProjection
+#include "landmark_tools/utils/parallel.h"
 #include "landmark_tools/utils/two_level_yaml_parser.h"
 #include "landmark_tools/map_projection/orthographic_projection.h"
 
 #define ELEVATION_TOLERANCE 0.01
+#define CREATE_LANDMARK_WRITE_ROWS 64 //rows computed between each handoff to the streaming writer, and rows taken by a thread at a time
+#define CREATE_LANDMARK_TILE_COLS 256 //columns of a cache block of a band
+#define CREATE_LANDMARK_MAX_THREADS 64
+#define CREATE_LANDMARK_GRID_LEVELS 3 //elevations of the projection grid nodes
+#define CREATE_LANDMARK_GRID_HALF_RANGE 5000.0 //landmark elevation of the highest level in meters, the lowest is its negative
+#define CREATE_LANDMARK_GRID_DEM_ERROR 1e-3 //largest interpolation error of a DEM position in pixels
+#define CREATE_LANDMARK_FOOTPRINT_SAMPLES 64 //landmark pixels sampled along each axis to find the DEM footprint
+#define CREATE_LANDMARK_FOOTPRINT_ELEVATION 10000.0 //landmark elevation above and below the anchor covered by the DEM footprint in meters
 
 /**
  
@@ -163,6 +178,78 @@ bool ProjectLatLong(enum Projection proj, LMK* lmk, GeoTiffData* geotiff_info, d
 }
 
 
+bool CreateLandmarkFootprint(GeoTiffData* geotiff_info,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,
+            LMK* lmk,
+            float set_anchor_point_ele,
+            int32_t margin,
+            int32_t window[4],
+            int32_t *decimation)
+{
+    // The anchor elevation is unknown before the DEM is read, and only moves the landmark along its normal
+    double ele0 = isnan(set_anchor_point_ele) ? 0.0 : set_anchor_point_ele;
+    calculateAnchorRotation(lmk, anchor_latitude_degrees, anchor_longitude_degrees, ele0);
+    calculateDerivedValuesVectors(lmk);
+    
+    MapProjection projection;
+    if(!map_projection_init(&projection, proj, lmk->BODY, geotiff_info->natOrigin[0], geotiff_info->natOrigin[1])){
+        return false;
+    }
+    
+    // Each row of samples is projected with one batch call
+    const int32_t row_points = (CREATE_LANDMARK_FOOTPRINT_SAMPLES + 1)*3;
+    double latitude[row_points], longitude[row_points], map_projection_x[row_points], map_projection_y[row_points];
+    double dem_resolution = geotiff_info->pixelSize[0];
+    double min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    const double levels[3] = {-CREATE_LANDMARK_FOOTPRINT_ELEVATION, 0.0, CREATE_LANDMARK_FOOTPRINT_ELEVATION};
+    for(int32_t i = 0; i <= CREATE_LANDMARK_FOOTPRINT_SAMPLES; i++){
+        double lmk_y = (double)i*lmk->num_rows/CREATE_LANDMARK_FOOTPRINT_SAMPLES;
+        int32_t n = 0;
+        for(int32_t j = 0; j <= CREATE_LANDMARK_FOOTPRINT_SAMPLES; j++){
+            double lmk_x = (double)j*lmk->num_cols/CREATE_LANDMARK_FOOTPRINT_SAMPLES;
+            for(int32_t l = 0; l < 3; l++, n++){
+                double world_p[3], height;
+                LMK_Col_Row_Elevation2World(lmk, lmk_x, lmk_y, levels[l], world_p);
+                ECEF_to_LatLongHeight(world_p, &latitude[n], &longitude[n], &height, lmk->BODY);
+            }
+        }
+        map_projection_forward(&projection, latitude, longitude, n, map_projection_x, map_projection_y);
+        for(int32_t k = 0; k < n; k++){
+            double dem_x = (map_projection_x[k] - geotiff_info->origin[0])/dem_resolution;
+            double dem_y = (geotiff_info->origin[1] - map_projection_y[k])/dem_resolution;
+            if(!isfinite(dem_x) || !isfinite(dem_y)) continue;
+            min_x = fmin(min_x, dem_x);
+            max_x = fmax(max_x, dem_x);
+            min_y = fmin(min_y, dem_y);
+            max_y = fmax(max_y, dem_y);
+        }
+    }
+    
+    // The bilinear interpolation also reads the pixel after the largest position
+    double left = fmax(floor(min_x) - margin, 0.0);
+    double top = fmax(floor(min_y) - margin, 0.0);
+    double right = fmin(floor(max_x) + 2 + margin, (double)geotiff_info->imageSize[0]);
+    double bottom = fmin(floor(max_y) + 2 + margin, (double)geotiff_info->imageSize[1]);
+    if(!(left < right && top < bottom)){
+        printf("CreateLandmarkFootprint() ==>> landmark is outside the DEM\n");
+        return false;
+    }
+    window[0] = (int32_t)left;
+    window[1] = (int32_t)top;
+    window[2] = (int32_t)(right - left);
+    window[3] = (int32_t)(bottom - top);
+    
+    if(decimation != NULL){
+        // Geographic DEM pixels are in degrees, so they are never reduced
+        *decimation = 1;
+        if(proj != GEOGRAPHIC && lmk->resolution > fabs(dem_resolution)){
+            *decimation = (int32_t)floor(lmk->resolution/fabs(dem_resolution));
+        }
+    }
+    return true;
+}
+
 bool CreateLandmark_dem_only(GeoTiffData* geotiff_info,
             double anchor_latitude_degrees, double anchor_longitude_degrees,
             enum Projection proj,
@@ -181,11 +268,703 @@ bool CreateLandmark(GeoTiffData* geotiff_info,
             LMK* lmk,
             float set_anchor_point_ele)
 {
-    bool success = true;
-    
+    return CreateLandmark_Streaming(geotiff_info, srm_img, srm_width, srm_height,
+            anchor_latitude_degrees, anchor_longitude_degrees, proj, lmk, set_anchor_point_ele, NULL);
+}
+
+bool CreateLandmark_Streaming(GeoTiffData* geotiff_info,
+            uint8_t *srm_img, int32_t srm_width, int32_t srm_height,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename)
+{
+    return CreateLandmark_Parallel(geotiff_info, srm_img, srm_width, srm_height,
+            anchor_latitude_degrees, anchor_longitude_degrees, proj, lmk, set_anchor_point_ele, filename, 0);
+}
+
+/**
+ \brief Rows of the landmark shared by the threads of `CreateLandmark_Parallel`
+ */
+typedef struct {
+    GeoTiffData *geotiff_info;
+    const DemTileSource *tiles; //DEM read by tiles, or NULL to read geotiff_info->demValues
+    uint8_t *srm_img;
+    const float *srm_values;    //surface reflectance to normalize as it is sampled, used if srm_img is NULL
+    float srm_min;              //value of srm_values that maps to 0
+    float srm_max;              //value of srm_values that maps to 255
+    int32_t srm_width;
+    int32_t srm_height;
+    enum Projection proj;
+    MapProjection projection;   //constants of proj
+    LMK *lmk;
+    int32_t grid_step;          //pixels between the nodes of the projection grid, 0 to refine every pixel exactly
+    int32_t num_bands;          //bands of CREATE_LANDMARK_WRITE_ROWS rows
+    int32_t next_band;          //first band not yet taken by a thread
+    bool *band_done;
+    bool success;
+    pthread_mutex_t mutex;
+    pthread_cond_t band_finished;
+} CreateQueue;
+
+static int32_t default_num_threads(void){
+    return parallel_num_threads();
+}
+
+/**
+ \brief Surface reflectance at index i of srm_values, scaled from [srm_min, srm_max] to 0-255
+ */
+static uint8_t normalized_srm(const CreateQueue *queue, size_t i)
+{
+    float value = queue->srm_values[i];
+    if(isnan(value)){
+        return 0;
+    }
+    return (uint8_t)(255*(value - queue->srm_min)/(queue->srm_max - queue->srm_min));
+}
+
+/**
+ \brief `inter_uint8_matrix` of srm_values normalized to 0-255, converting only the pixels it reads
+ */
+static uint8_t inter_normalized_srm(const CreateQueue *queue, double x, double y)
+{
+    size_t xsize = queue->srm_width;
+    if(x >= 1 && x < queue->srm_width - 1 && y >= 1 && y < queue->srm_height - 1){
+        int64_t ix = (int64_t)x;
+        int64_t iy = (int64_t)y;
+        double dx = x - ix;
+        double dy = y - iy;
+        int64_t p00 = normalized_srm(queue, iy*xsize + ix);
+        int64_t p01 = normalized_srm(queue, iy*xsize + ix + 1);
+        int64_t p11 = normalized_srm(queue, (iy + 1)*xsize + ix + 1);
+        int64_t p10 = normalized_srm(queue, (iy + 1)*xsize + ix);
+        double bv = (1.0 - dy)*((1.0 - dx)*p00 + dx*p01) + dy*((1.0 - dx)*p10 + dx*p11);
+        return (uint8_t)round(bv);
+    }
+    return normalized_srm(queue, (int32_t)y*xsize + (int32_t)x);
+}
+
+/**
+ \brief Write the elevation of a landmark pixel and its surface reflectance at DEM pixel (dem_x, dem_y)
+ */
+static void store_pixel(const CreateQueue *queue, int32_t lmk_x, int32_t lmk_y, double dem_x, double dem_y,
+                        double elevation)
+{
+    LMK *lmk = queue->lmk;
+    bool has_srm = queue->srm_img != NULL || queue->srm_values != NULL;
+    if(has_srm && dem_x > 0 && dem_x < queue->srm_width && dem_y > 0 && dem_y < queue->srm_height){
+        //TODO SRM image must have same resolution and anchor as DEM
+        uint8_t val = 0;
+        if(queue->srm_img == NULL){
+            lmk->srm[lmk_y*lmk->num_cols + lmk_x] = (int32_t)inter_normalized_srm(queue, dem_x, dem_y);
+        }else if(inter_uint8_matrix(queue->srm_img, queue->srm_width, queue->srm_height, dem_x, dem_y, &val))
+            lmk->srm[lmk_y*lmk->num_cols + lmk_x] = (int32_t)(val);
+    }else{
+        lmk->srm[lmk_y*lmk->num_cols + lmk_x] = SRM_DEFAULT;
+    }
+
+    lmk->ele[lmk_y*lmk->num_cols + lmk_x] = elevation;
+}
+
+/**
+ \brief Interpolate the DEM at DEM pixel (x, y), from the tiles of the thread if the DEM is read by tiles
+ */
+static double sample_dem(const CreateQueue *queue, DemTileCache *cache, double x, double y)
+{
+    GeoTiffData *geotiff_info = queue->geotiff_info;
+    if(cache != NULL){
+        return dem_tile_cache_interpolate(cache, x, y);
+    }
+    return inter_float_matrix(geotiff_info->demValues, geotiff_info->imageSize[0], geotiff_info->imageSize[1], x, y);
+}
+
+/**
+ \brief Compute the elevation and surface reflectance of pixels left to right-1 of a landmark row
+ 
+ The pixels are refined together, so that each step projects the pixels still refined with one batch call. The
+ steps of each pixel are those of a refinement of the pixel alone.
+ \return false if a position cannot be projected to the DEM
+ */
+static bool create_landmark_span(const CreateQueue *queue, DemTileCache *cache, int32_t lmk_y, int32_t left, int32_t right)
+{
+    GeoTiffData *geotiff_info = queue->geotiff_info;
+    LMK *lmk = queue->lmk;
     double dem_origin_x = geotiff_info->origin[0]; //X
     double dem_origin_y = geotiff_info->origin[1]; //Y
     double dem_resolution = geotiff_info->pixelSize[0]; //res
+    bool success = true;
+
+    double last_elevation_estimate[CREATE_LANDMARK_TILE_COLS];
+    double elevation_estimate[CREATE_LANDMARK_TILE_COLS];
+    double dem_x[CREATE_LANDMARK_TILE_COLS];
+    double dem_y[CREATE_LANDMARK_TILE_COLS];
+    double latitude[CREATE_LANDMARK_TILE_COLS];
+    double longitude[CREATE_LANDMARK_TILE_COLS];
+    double map_projection_x[CREATE_LANDMARK_TILE_COLS];
+    double map_projection_y[CREATE_LANDMARK_TILE_COLS];
+    double heights[CREATE_LANDMARK_TILE_COLS];
+    double world_p[CREATE_LANDMARK_TILE_COLS][3];
+    double patch_col[CREATE_LANDMARK_TILE_COLS];
+    double patch_row[CREATE_LANDMARK_TILE_COLS];
+    double patch_ele[CREATE_LANDMARK_TILE_COLS];
+    int32_t active[CREATE_LANDMARK_TILE_COLS]; //pixels still refined, from left
+    int32_t num_active = right - left;
+    for(int32_t i = 0; i < num_active; i++){
+        active[i] = i;
+        last_elevation_estimate[i] = 0.0;
+        elevation_estimate[i] = 0.0;
+        dem_x[i] = -1;
+        dem_y[i] = -1;
+    }
+    
+    for(int32_t loop = 0; loop < 10 && num_active > 0; loop++){
+        //compute the patch positions in ecef, then in latitude and longitude, packed by active pixel
+        for(int32_t k = 0; k < num_active; k++){
+            patch_col[k] = (double)(left + active[k]);
+            patch_row[k] = (double)lmk_y;
+            patch_ele[k] = elevation_estimate[active[k]];
+        }
+        LMK_Col_Row_Elevation2World_Batch(lmk, patch_col, patch_row, patch_ele, num_active, world_p);
+        ECEF_to_LatLongHeight_Batch((const double (*)[3])world_p, num_active, latitude, longitude, heights, lmk->BODY);
+        
+        //compute patch positions in DEM projection coordinates
+        success &= map_projection_forward(&queue->projection, latitude, longitude, num_active, map_projection_x, map_projection_y);
+        
+        for(int32_t k = 0; k < num_active; k++){
+            int32_t i = active[k];
+            //compute patch position in DEM pixel coordinates
+            dem_x[i] = (map_projection_x[k] - dem_origin_x)/dem_resolution;
+            dem_y[i] = (dem_origin_y - map_projection_y[k])/dem_resolution;
+            
+            //TODO This iterative refinement method is time consuming.
+            if(dem_x[i] > 0 && dem_x[i] < geotiff_info->imageSize[0] && dem_y[i] > 0 && dem_y[i] < geotiff_info->imageSize[1])
+            {
+                // refine the elevation estimate by retrieving value from dem
+                heights[k] = sample_dem(queue, cache, dem_x[i], dem_y[i]);
+            } else {
+                // location is outside dem
+                heights[k] = NAN;
+            }
+        }
+        
+        //recalculate the elevation positions
+        LatLongHeight_to_ECEF_Batch(latitude, longitude, heights, num_active, world_p, lmk->BODY);
+        
+        World2LMK_Col_Row_Ele_Batch(lmk, (const double (*)[3])world_p, num_active, patch_col, patch_row, patch_ele);
+        int32_t still_active = 0;
+        for(int32_t k = 0; k < num_active; k++){
+            int32_t i = active[k];
+            if(!isnan(heights[k])){
+                last_elevation_estimate[i] = elevation_estimate[i];
+                elevation_estimate[i] = patch_ele[k];
+            }else{
+                // dem has non-data value at location, or location is outside dem
+                elevation_estimate[i] = NAN;
+            }
+            if(!isnan(elevation_estimate[i]) && fabs(last_elevation_estimate[i]-elevation_estimate[i])>ELEVATION_TOLERANCE){
+                active[still_active++] = i;
+            }
+        }
+        num_active = still_active;
+    }
+
+    for(int32_t i = 0; i < right - left; i++){
+        store_pixel(queue, left + i, lmk_y, dem_x[i], dem_y[i], elevation_estimate[i]);
+    }
+    return success;
+}
+
+/**
+ \brief Where a point of the landmark frame falls in the DEM
+ */
+typedef struct {
+    double dem_x;               //DEM column
+    double dem_y;               //DEM row
+    double height;              //height above the reference body at which the landmark elevation of the vertical through the point is that of the point
+    double height_to_ele;       //landmark elevation gained per meter of height along the local vertical
+} ProjectionSample;
+
+/**
+ \brief Nodes of the projection grid covering one band
+ 
+ Node (i, j) is landmark pixel (j*step, i*step). Each node holds the projection at the CREATE_LANDMARK_GRID_LEVELS
+ elevations -CREATE_LANDMARK_GRID_HALF_RANGE, 0 and CREATE_LANDMARK_GRID_HALF_RANGE, and each grid cell records
+ whether interpolating the nodes meets the error bound.
+ */
+typedef struct {
+    int32_t step;
+    int32_t first_row;          //first node row
+    int32_t num_rows;           //node rows
+    int32_t num_cols;           //node columns
+    ProjectionSample *nodes;    //num_rows x num_cols x CREATE_LANDMARK_GRID_LEVELS samples
+    bool *cell_ok;              //(num_rows-1) x (num_cols-1) cells
+} ProjectionGrid;
+
+/**
+ \brief Exact projection of the landmark points (lmk_x[i], lmk_y[i], ele[i]) into the DEM
+ 
+ The points are converted CREATE_LANDMARK_TILE_COLS at a time, with one batch call per conversion, so the
+ projection is selected once per batch rather than once per point.
+ \param[out] ok whether each point can be projected
+ \return false if the projection is not supported
+ */
+static bool project_landmark_points(const CreateQueue *queue, const double *lmk_x, const double *lmk_y, const double *ele,
+                                    int32_t n, ProjectionSample *samples, bool *ok)
+{
+    GeoTiffData *geotiff_info = queue->geotiff_info;
+    LMK *lmk = queue->lmk;
+    double world_p[CREATE_LANDMARK_TILE_COLS][3];
+    double above[CREATE_LANDMARK_TILE_COLS][3];
+    double latitude[CREATE_LANDMARK_TILE_COLS];
+    double longitude[CREATE_LANDMARK_TILE_COLS];
+    double height[CREATE_LANDMARK_TILE_COLS];
+    double height_above[CREATE_LANDMARK_TILE_COLS];
+    double map_projection_x[CREATE_LANDMARK_TILE_COLS];
+    double map_projection_y[CREATE_LANDMARK_TILE_COLS];
+    double col[CREATE_LANDMARK_TILE_COLS];
+    double row[CREATE_LANDMARK_TILE_COLS];
+    double ele_on_vertical[CREATE_LANDMARK_TILE_COLS];
+    double ele_above[CREATE_LANDMARK_TILE_COLS];
+    for(int32_t first = 0; first < n; first += CREATE_LANDMARK_TILE_COLS){
+        int32_t count = n - first < CREATE_LANDMARK_TILE_COLS ? n - first : CREATE_LANDMARK_TILE_COLS;
+        LMK_Col_Row_Elevation2World_Batch(lmk, &lmk_x[first], &lmk_y[first], &ele[first], count, world_p);
+        ECEF_to_LatLongHeight_Batch((const double (*)[3])world_p, count, latitude, longitude, height, lmk->BODY);
+        if(!map_projection_forward(&queue->projection, latitude, longitude, count, map_projection_x, map_projection_y)){
+            memset(ok, 0, n*sizeof(bool));
+            return false;
+        }
+        
+        // The landmark elevation is linear along the local vertical, so two points give the elevation of the exact
+        // refinement for any height. The conversion back from latitude and longitude need not return the point itself.
+        for(int32_t k = 0; k < count; k++){
+            height_above[k] = height[k] + 1.0;
+        }
+        LatLongHeight_to_ECEF_Batch(latitude, longitude, height, count, world_p, lmk->BODY);
+        LatLongHeight_to_ECEF_Batch(latitude, longitude, height_above, count, above, lmk->BODY);
+        World2LMK_Col_Row_Ele_Batch(lmk, (const double (*)[3])world_p, count, col, row, ele_on_vertical);
+        World2LMK_Col_Row_Ele_Batch(lmk, (const double (*)[3])above, count, col, row, ele_above);
+        for(int32_t k = 0; k < count; k++){
+            ProjectionSample *sample = &samples[first + k];
+            sample->dem_x = (map_projection_x[k] - geotiff_info->origin[0])/geotiff_info->pixelSize[0];
+            sample->dem_y = (geotiff_info->origin[1] - map_projection_y[k])/geotiff_info->pixelSize[0];
+            sample->height_to_ele = ele_above[k] - ele_on_vertical[k];
+            sample->height = height[k] - (ele_on_vertical[k] - ele[first + k])/sample->height_to_ele;
+            ok[first + k] = isfinite(sample->dem_x) && isfinite(sample->dem_y) && isfinite(sample->height);
+        }
+    }
+    return true;
+}
+
+/**
+ \brief Interpolate the nodes of cell (cell_x, cell_y) bilinearly at fractions (fx, fy) of the cell, at every level
+ */
+static void interpolate_levels(const ProjectionGrid *grid, int32_t cell_x, int32_t cell_y, double fx, double fy,
+                               ProjectionSample levels[CREATE_LANDMARK_GRID_LEVELS])
+{
+    const ProjectionSample *n00 = &grid->nodes[((size_t)(cell_y - grid->first_row)*grid->num_cols + cell_x)*CREATE_LANDMARK_GRID_LEVELS];
+    const ProjectionSample *n10 = n00 + CREATE_LANDMARK_GRID_LEVELS;
+    const ProjectionSample *n01 = n00 + (size_t)grid->num_cols*CREATE_LANDMARK_GRID_LEVELS;
+    const ProjectionSample *n11 = n01 + CREATE_LANDMARK_GRID_LEVELS;
+    double w00 = (1.0 - fx)*(1.0 - fy), w10 = fx*(1.0 - fy), w01 = (1.0 - fx)*fy, w11 = fx*fy;
+    for(int32_t l = 0; l < CREATE_LANDMARK_GRID_LEVELS; l++){
+        levels[l].dem_x = w00*n00[l].dem_x + w10*n10[l].dem_x + w01*n01[l].dem_x + w11*n11[l].dem_x;
+        levels[l].dem_y = w00*n00[l].dem_y + w10*n10[l].dem_y + w01*n01[l].dem_y + w11*n11[l].dem_y;
+        levels[l].height = w00*n00[l].height + w10*n10[l].height + w01*n01[l].height + w11*n11[l].height;
+        levels[l].height_to_ele = w00*n00[l].height_to_ele + w10*n10[l].height_to_ele + w01*n01[l].height_to_ele + w11*n11[l].height_to_ele;
+    }
+}
+
+/**
+ \brief Interpolate the levels of a point quadratically at elevation ele
+ */
+static void interpolate_elevation(const ProjectionSample levels[CREATE_LANDMARK_GRID_LEVELS], double ele, ProjectionSample *sample)
+{
+    double t = ele/CREATE_LANDMARK_GRID_HALF_RANGE;
+    double w[CREATE_LANDMARK_GRID_LEVELS] = {0.5*t*(t - 1.0), 1.0 - t*t, 0.5*t*(t + 1.0)};
+    sample->dem_x = w[0]*levels[0].dem_x + w[1]*levels[1].dem_x + w[2]*levels[2].dem_x;
+    sample->dem_y = w[0]*levels[0].dem_y + w[1]*levels[1].dem_y + w[2]*levels[2].dem_y;
+    sample->height = w[0]*levels[0].height + w[1]*levels[1].height + w[2]*levels[2].height;
+    sample->height_to_ele = w[0]*levels[0].height_to_ele + w[1]*levels[1].height_to_ele + w[2]*levels[2].height_to_ele;
+}
+
+/**
+ \brief Compute the grid nodes covering rows top to bottom-1 and test the interpolation error of each cell
+ 
+ The error of a cell is measured against the exact projection at its center, at the levels and halfway between
+ them. A cell is interpolated if the DEM position is off by at most CREATE_LANDMARK_GRID_DEM_ERROR pixels and the
+ elevation update by at most a tenth of ELEVATION_TOLERANCE.
+ \return false if memory allocation fails
+ */
+static bool build_projection_grid(const CreateQueue *queue, int32_t top, int32_t bottom, ProjectionGrid *grid)
+{
+    const LMK *lmk = queue->lmk;
+    int32_t step = queue->grid_step;
+    grid->step = step;
+    grid->first_row = top/step;
+    grid->num_rows = (bottom - 1)/step + 2 - grid->first_row;
+    grid->num_cols = (lmk->num_cols - 1)/step + 2;
+    size_t num_nodes = (size_t)grid->num_rows*grid->num_cols;
+    
+    // Points of one row of nodes or cell centers, projected together
+    const int32_t checks_per_cell = 5;
+    size_t row_points = (size_t)grid->num_cols*checks_per_cell;
+    grid->nodes = (ProjectionSample *)malloc(num_nodes*CREATE_LANDMARK_GRID_LEVELS*sizeof(ProjectionSample));
+    grid->cell_ok = (bool *)malloc(num_nodes*sizeof(bool));
+    bool *level_ok = (bool *)malloc(num_nodes*CREATE_LANDMARK_GRID_LEVELS*sizeof(bool));
+    double *point_x = (double *)malloc(row_points*sizeof(double));
+    double *point_y = (double *)malloc(row_points*sizeof(double));
+    double *point_ele = (double *)malloc(row_points*sizeof(double));
+    ProjectionSample *exact = (ProjectionSample *)malloc(row_points*sizeof(ProjectionSample));
+    bool *exact_ok = (bool *)malloc(row_points*sizeof(bool));
+    if(grid->nodes == NULL || grid->cell_ok == NULL || level_ok == NULL || point_x == NULL || point_y == NULL ||
+       point_ele == NULL || exact == NULL || exact_ok == NULL){
+        printf("build_projection_grid() ==>> malloc() failed\n");
+        free(grid->nodes);
+        free(grid->cell_ok);
+        free(level_ok);
+        free(point_x);
+        free(point_y);
+        free(point_ele);
+        free(exact);
+        free(exact_ok);
+        return false;
+    }
+    
+    for(int32_t i = 0; i < grid->num_rows; i++){
+        int32_t n = 0;
+        for(int32_t j = 0; j < grid->num_cols; j++){
+            for(int32_t l = 0; l < CREATE_LANDMARK_GRID_LEVELS; l++, n++){
+                point_x[n] = (double)j*step;
+                point_y[n] = (double)(grid->first_row + i)*step;
+                point_ele[n] = (l - 1)*CREATE_LANDMARK_GRID_HALF_RANGE;
+            }
+        }
+        size_t first = (size_t)i*grid->num_cols*CREATE_LANDMARK_GRID_LEVELS;
+        project_landmark_points(queue, point_x, point_y, point_ele, n, &grid->nodes[first], &level_ok[first]);
+    }
+    
+    ProjectionSample levels[CREATE_LANDMARK_GRID_LEVELS];
+    const double checks[5] = {-CREATE_LANDMARK_GRID_HALF_RANGE, -0.5*CREATE_LANDMARK_GRID_HALF_RANGE, 0.0,
+                              0.5*CREATE_LANDMARK_GRID_HALF_RANGE, CREATE_LANDMARK_GRID_HALF_RANGE};
+    for(int32_t i = 0; i + 1 < grid->num_rows; i++){
+        int32_t n = 0;
+        for(int32_t j = 0; j + 1 < grid->num_cols; j++){
+            for(int32_t c = 0; c < checks_per_cell; c++, n++){
+                point_x[n] = (j + 0.5)*step;
+                point_y[n] = (grid->first_row + i + 0.5)*step;
+                point_ele[n] = checks[c];
+            }
+        }
+        project_landmark_points(queue, point_x, point_y, point_ele, n, exact, exact_ok);
+        
+        for(int32_t j = 0; j + 1 < grid->num_cols; j++){
+            size_t node = (size_t)i*grid->num_cols + j;
+            bool ok = true;
+            for(int32_t l = 0; l < CREATE_LANDMARK_GRID_LEVELS; l++){
+                ok = ok && level_ok[node*CREATE_LANDMARK_GRID_LEVELS + l] &&
+                     level_ok[(node + 1)*CREATE_LANDMARK_GRID_LEVELS + l] &&
+                     level_ok[(node + grid->num_cols)*CREATE_LANDMARK_GRID_LEVELS + l] &&
+                     level_ok[(node + grid->num_cols + 1)*CREATE_LANDMARK_GRID_LEVELS + l];
+            }
+            interpolate_levels(grid, j, grid->first_row + i, 0.5, 0.5, levels);
+            for(int32_t c = 0; c < checks_per_cell && ok; c++){
+                const ProjectionSample *sample = &exact[j*checks_per_cell + c];
+                ProjectionSample interpolated;
+                interpolate_elevation(levels, checks[c], &interpolated);
+                double ele_error = fabs(sample->height - interpolated.height) +
+                                   fabs(sample->height_to_ele - interpolated.height_to_ele)*CREATE_LANDMARK_GRID_HALF_RANGE;
+                ok = exact_ok[j*checks_per_cell + c] && fabs(sample->dem_x - interpolated.dem_x) <= CREATE_LANDMARK_GRID_DEM_ERROR &&
+                     fabs(sample->dem_y - interpolated.dem_y) <= CREATE_LANDMARK_GRID_DEM_ERROR &&
+                     ele_error <= 0.1*ELEVATION_TOLERANCE;
+            }
+            grid->cell_ok[i*(grid->num_cols - 1) + j] = ok;
+        }
+    }
+    free(level_ok);
+    free(point_x);
+    free(point_y);
+    free(point_ele);
+    free(exact);
+    free(exact_ok);
+    return true;
+}
+
+/**
+ \brief Compute one landmark pixel from the projection grid, as `create_landmark_pixel` does with the exact
+ projection. Falls back to the exact refinement outside the cells that meet the error bound or the elevation range
+ of the levels.
+ \return false if a position cannot be projected to the DEM
+ */
+static bool create_landmark_pixel_grid(const CreateQueue *queue, DemTileCache *cache, const ProjectionGrid *grid, int32_t lmk_x, int32_t lmk_y)
+{
+    GeoTiffData *geotiff_info = queue->geotiff_info;
+    int32_t cell_x = lmk_x/grid->step;
+    int32_t cell_y = lmk_y/grid->step;
+    if(!grid->cell_ok[(cell_y - grid->first_row)*(grid->num_cols - 1) + cell_x]){
+        return create_landmark_span(queue, cache, lmk_y, lmk_x, lmk_x + 1);
+    }
+    double fx = (double)(lmk_x - cell_x*grid->step)/grid->step;
+    double fy = (double)(lmk_y - cell_y*grid->step)/grid->step;
+    
+    int32_t loop = 0;
+    double last_elevation_estimate = 0.0;
+    double elevation_estimate = 0.0;
+    ProjectionSample levels[CREATE_LANDMARK_GRID_LEVELS], sample;
+    interpolate_levels(grid, cell_x, cell_y, fx, fy, levels);
+    do{
+        if(fabs(elevation_estimate) > CREATE_LANDMARK_GRID_HALF_RANGE){
+            return create_landmark_span(queue, cache, lmk_y, lmk_x, lmk_x + 1);
+        }
+        interpolate_elevation(levels, elevation_estimate, &sample);
+        if(sample.dem_x > 0 && sample.dem_x < geotiff_info->imageSize[0] && sample.dem_y > 0 && sample.dem_y < geotiff_info->imageSize[1])
+        {
+            double elevation_refined = sample_dem(queue, cache, sample.dem_x, sample.dem_y);
+            if(!isnan(elevation_refined)){
+                last_elevation_estimate = elevation_estimate;
+                elevation_estimate += (elevation_refined - sample.height)*sample.height_to_ele;
+            }else{
+                // dem has non-data value at location
+                elevation_estimate = NAN;
+            }
+        } else {
+            // location is outside dem
+            elevation_estimate = NAN;
+        }
+        loop ++;
+    }while(loop<10 && !isnan(elevation_estimate) && fabs(last_elevation_estimate-elevation_estimate)>ELEVATION_TOLERANCE);
+    
+    store_pixel(queue, lmk_x, lmk_y, sample.dem_x, sample.dem_y, elevation_estimate);
+    return true;
+}
+
+/**
+ \brief Compute the rows of one band, one block of CREATE_LANDMARK_TILE_COLS columns at a time so that the DEM
+ footprint of the block stays in cache
+ \param[in] cache tiles of the calling thread, or NULL if the DEM is in memory
+ */
+static bool create_landmark_band(const CreateQueue *queue, DemTileCache *cache, int32_t band)
+{
+    const LMK *lmk = queue->lmk;
+    int32_t top = band*CREATE_LANDMARK_WRITE_ROWS;
+    int32_t bottom = (top + CREATE_LANDMARK_WRITE_ROWS < lmk->num_rows) ? top + CREATE_LANDMARK_WRITE_ROWS : lmk->num_rows;
+    ProjectionGrid grid = {0};
+    bool use_grid = queue->grid_step > 0;
+    if(use_grid && !build_projection_grid(queue, top, bottom, &grid)){
+        return false;
+    }
+    bool success = true;
+    for(int32_t left = 0; left < lmk->num_cols; left += CREATE_LANDMARK_TILE_COLS){
+        int32_t right = (left + CREATE_LANDMARK_TILE_COLS < lmk->num_cols) ? left + CREATE_LANDMARK_TILE_COLS : lmk->num_cols;
+        for(int32_t lmk_y = top; lmk_y < bottom; ++lmk_y){
+            if(!use_grid){
+                success &= create_landmark_span(queue, cache, lmk_y, left, right);
+                continue;
+            }
+            for(int32_t lmk_x = left; lmk_x < right; ++lmk_x){
+                success &= create_landmark_pixel_grid(queue, cache, &grid, lmk_x, lmk_y);
+            }
+        }
+    }
+    free(grid.nodes);
+    free(grid.cell_ok);
+    return success && (cache == NULL || !cache->failed);
+}
+
+/**
+ \brief Take the next band of the queue, or -1 if every band is taken
+ */
+static int32_t take_band(CreateQueue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    int32_t band = (queue->next_band < queue->num_bands) ? queue->next_band++ : -1;
+    pthread_mutex_unlock(&queue->mutex);
+    return band;
+}
+
+static void finish_band(CreateQueue *queue, int32_t band, bool success)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->band_done[band] = true;
+    queue->success &= success;
+    pthread_cond_broadcast(&queue->band_finished);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static void *create_thread(void *arg)
+{
+    CreateQueue *queue = (CreateQueue *)arg;
+    DemTileCache cache;
+    // Without its own tiles, a thread leaves the bands to the others
+    if(queue->tiles != NULL && !dem_tile_cache_init(&cache, queue->tiles)){
+        return NULL;
+    }
+    int32_t band;
+    while((band = take_band(queue)) >= 0){
+        finish_band(queue, band, create_landmark_band(queue, queue->tiles != NULL ? &cache : NULL, band));
+    }
+    if(queue->tiles != NULL) dem_tile_cache_free(&cache);
+    return NULL;
+}
+
+bool CreateLandmark_Parallel(GeoTiffData* geotiff_info,
+            uint8_t *srm_img, int32_t srm_width, int32_t srm_height,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename,
+            int32_t num_threads)
+{
+    return CreateLandmark_ProjectionGrid(geotiff_info, srm_img, srm_width, srm_height,
+            anchor_latitude_degrees, anchor_longitude_degrees, proj, lmk, set_anchor_point_ele, filename, num_threads, 0);
+}
+
+bool CreateLandmark_ProjectionGrid(GeoTiffData* geotiff_info,
+            uint8_t *srm_img, int32_t srm_width, int32_t srm_height,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename,
+            int32_t num_threads,
+            int32_t grid_step)
+{
+    return CreateLandmark_TileCache(geotiff_info, NULL, srm_img, srm_width, srm_height,
+            anchor_latitude_degrees, anchor_longitude_degrees, proj, lmk, set_anchor_point_ele, filename, num_threads,
+            grid_step);
+}
+
+static bool create_landmark_queue(CreateQueue *queue_in, GeoTiffData* geotiff_info,
+            const DemTileSource *tiles,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename,
+            int32_t num_threads,
+            int32_t grid_step);
+
+bool CreateLandmark_TileCache(GeoTiffData* geotiff_info,
+            const DemTileSource *tiles,
+            uint8_t *srm_img, int32_t srm_width, int32_t srm_height,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename,
+            int32_t num_threads,
+            int32_t grid_step)
+{
+    CreateQueue queue = {0};
+    queue.srm_img = srm_img;
+    queue.srm_width = srm_width;
+    queue.srm_height = srm_height;
+    return create_landmark_queue(&queue, geotiff_info, tiles, anchor_latitude_degrees, anchor_longitude_degrees,
+                                 proj, lmk, set_anchor_point_ele, filename, num_threads, grid_step);
+}
+
+/**
+ \brief Range of values scanned by a thread of `CreateLandmarkFromImage`
+ */
+typedef struct {
+    const float *values;
+    size_t first;
+    size_t last;
+    float min;
+    float max;
+} SrmRange;
+
+static void *srm_range_thread(void *arg)
+{
+    SrmRange *range = (SrmRange *)arg;
+    float min = range->min, max = range->max;
+    for(size_t i = range->first; i < range->last; i++){
+        float value = range->values[i];
+        if(value < min) min = value;
+        if(value > max) max = value;
+    }
+    range->min = min;
+    range->max = max;
+    return NULL;
+}
+
+bool CreateLandmarkFromImage(GeoTiffData* geotiff_info,
+            const GeoTiffData* srm_info,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename,
+            int32_t num_threads)
+{
+    if(srm_info->imageSize[0] != geotiff_info->imageSize[0] || srm_info->imageSize[1] != geotiff_info->imageSize[1] ||
+       srm_info->projection != geotiff_info->projection){
+        printf("CreateLandmarkFromImage() ==>> surface reflectance and DEM do not match in size\n");
+        return false;
+    }
+    if(num_threads <= 0) num_threads = default_num_threads();
+    if(num_threads > CREATE_LANDMARK_MAX_THREADS) num_threads = CREATE_LANDMARK_MAX_THREADS;
+    
+    // Range of the surface reflectance, with the bounds of the whole-image normalization of create_landmark_from_img
+    size_t num_values = (size_t)srm_info->imageSize[0]*srm_info->imageSize[1];
+    SrmRange ranges[CREATE_LANDMARK_MAX_THREADS];
+    pthread_t threads[CREATE_LANDMARK_MAX_THREADS];
+    bool started[CREATE_LANDMARK_MAX_THREADS] = {false};
+    for(int32_t t = 0; t < num_threads; t++){
+        ranges[t].values = srm_info->demValues;
+        ranges[t].first = num_values*t/num_threads;
+        ranges[t].last = num_values*(t + 1)/num_threads;
+        ranges[t].min = FLT_MAX;
+        ranges[t].max = 0;
+        if(t > 0) started[t] = pthread_create(&threads[t], NULL, srm_range_thread, &ranges[t]) == 0;
+    }
+    srm_range_thread(&ranges[0]);
+    
+    CreateQueue queue = {0};
+    queue.srm_values = srm_info->demValues;
+    queue.srm_min = FLT_MAX;
+    queue.srm_max = 0;
+    for(int32_t t = 0; t < num_threads; t++){
+        if(t > 0 && started[t]) pthread_join(threads[t], NULL);
+        if(t > 0 && !started[t]) srm_range_thread(&ranges[t]);
+        if(ranges[t].min < queue.srm_min) queue.srm_min = ranges[t].min;
+        if(ranges[t].max > queue.srm_max) queue.srm_max = ranges[t].max;
+    }
+    queue.srm_width = srm_info->imageSize[0];
+    queue.srm_height = srm_info->imageSize[1];
+    return create_landmark_queue(&queue, geotiff_info, NULL, anchor_latitude_degrees, anchor_longitude_degrees,
+                                 proj, lmk, set_anchor_point_ele, filename, num_threads, 0);
+}
+
+/**
+ \brief Create a landmark with the surface reflectance already set in queue
+ */
+size_t CreateLandmark_memory(const LMK *lmk, int32_t dem_cols, int32_t dem_rows, const DemTileSource *tiles,
+            int32_t num_threads)
+{
+    size_t bytes = (size_t)lmk->num_cols*lmk->num_rows*(sizeof(uint8_t) + sizeof(float));
+    if(tiles == NULL){
+        return bytes + (size_t)dem_cols*dem_rows*sizeof(float);
+    }
+    // Same thread count as create_landmark_queue, each thread holding a cache
+    if(num_threads <= 0) num_threads = default_num_threads();
+    if(num_threads > CREATE_LANDMARK_MAX_THREADS) num_threads = CREATE_LANDMARK_MAX_THREADS;
+    size_t tile_bytes = (size_t)tiles->tile_size*tiles->tile_size*sizeof(float);
+    return bytes + tile_bytes*tiles->max_tiles*num_threads;
+}
+
+static bool create_landmark_queue(CreateQueue *queue_in, GeoTiffData* geotiff_info,
+            const DemTileSource *tiles,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename,
+            int32_t num_threads,
+            int32_t grid_step)
+{
+    bool success = true;
     
     // Anchor point in DEM projection coordinates
     double x_anchor, y_anchor;
@@ -194,8 +973,24 @@ bool CreateLandmark(GeoTiffData* geotiff_info,
         return success;
     }
     
+    // Tiles of the calling thread
+    DemTileCache cache;
+    DemTileCache *main_cache = NULL;
+    if(tiles != NULL){
+        if(!dem_tile_cache_init(&cache, tiles)){
+            return false;
+        }
+        main_cache = &cache;
+    }
+    
     //Calculate map normal, map to col/row transforms etc.
-    double ele0 = getCenterElevation(geotiff_info, lmk, x_anchor, y_anchor);
+    double ele0;
+    if(main_cache != NULL){
+        ele0 = dem_tile_cache_interpolate(main_cache, (x_anchor - geotiff_info->origin[0])/geotiff_info->pixelSize[0],
+                                          (geotiff_info->origin[1] - y_anchor)/geotiff_info->pixelSize[0]);
+    }else{
+        ele0 = getCenterElevation(geotiff_info, lmk, x_anchor, y_anchor);
+    }
     if(isnan(ele0)){
         //printf("Error: Center of DEM is non-data value. Cannot convert to landmark\n");
         //return false;
@@ -208,66 +1003,84 @@ bool CreateLandmark(GeoTiffData* geotiff_info,
     calculateAnchorRotation(lmk, anchor_latitude_degrees, anchor_longitude_degrees, ele0);
     calculateDerivedValuesVectors(lmk);
     
-    for(int32_t lmk_y = 0; lmk_y < lmk->num_rows; ++lmk_y)
-    {
-        for(int32_t lmk_x = 0; lmk_x < lmk->num_cols; ++lmk_x)
-        {
-            int32_t loop = 0;
-            double last_elevation_estimate = 0.0;
-            double elevation_estimate = 0.0;
-            double dem_x = -1;
-            double dem_y = -1;
-            do{
-                double world_p[3];
-                //to compute the patch position in ecef
-                LMK_Col_Row_Elevation2World(lmk,  (double)lmk_x, (double)lmk_y, elevation_estimate, world_p);
-                
-                //compute patch position in DEM projection coordinates
-                double map_projection_x, map_projection_y, latitude, longitude;
-                double temp_elevation_estimate;
-                ECEF_to_LatLongHeight(world_p,
-                    &latitude, &longitude, &temp_elevation_estimate,
-                    lmk->BODY);
-                success &= ProjectLatLong(proj, lmk, geotiff_info, latitude, longitude, &map_projection_x, &map_projection_y);
-                
-                //compute patch position in DEM pixel coordinates
-                dem_x = (map_projection_x - dem_origin_x)/dem_resolution;
-                dem_y = (dem_origin_y - map_projection_y)/dem_resolution;
-                
-                //TODO This iterative refinement method is time consuming.
-                if(dem_x > 0 && dem_x < geotiff_info->imageSize[0] && dem_y > 0 && dem_y < geotiff_info->imageSize[1])
-                {
-                    // refine the elevation estimate by retrieving value from dem and recalculating elevation position
-                    double elevation_refined = inter_float_matrix(geotiff_info->demValues, geotiff_info->imageSize[0], geotiff_info->imageSize[1], dem_x, dem_y)  ;
-                    if(!isnan(elevation_refined)){
-                        last_elevation_estimate = elevation_estimate;
-                        
-                        LatLongHeight_to_ECEF(latitude, longitude, elevation_refined, world_p, lmk->BODY);
-                        double temp_lmk_x, temp_lmk_y;
-                        World2LMK_Col_Row_Ele(lmk, world_p, &temp_lmk_x, &temp_lmk_y, &elevation_estimate);
-                    }else{
-                        // dem has non-data value at location
-                        elevation_estimate = NAN;
-                    }
-                } else {
-                    // location is outside dem
-                    elevation_estimate = NAN;
-                }
-                loop ++;
-            }while(loop<10 && !isnan(elevation_estimate) && fabs(last_elevation_estimate-elevation_estimate)>ELEVATION_TOLERANCE);
-
-            if(srm_img != NULL && dem_x > 0 && dem_x < srm_width && dem_y > 0 && dem_y < srm_height){
-                //TODO SRM image must have same resolution and anchor as DEM
-                uint8_t val = 0;
-                if(inter_uint8_matrix(srm_img, srm_width, srm_height, dem_x, dem_y, &val))
-                    lmk->srm[lmk_y*lmk->num_cols + lmk_x] = (int32_t)(val);
-            }else{
-                lmk->srm[lmk_y*lmk->num_cols + lmk_x] = SRM_DEFAULT;
+    CreateQueue queue = *queue_in;
+    queue.geotiff_info = geotiff_info;
+    queue.tiles = tiles;
+    queue.proj = proj;
+    map_projection_init(&queue.projection, proj, lmk->BODY, geotiff_info->natOrigin[0], geotiff_info->natOrigin[1]);
+    queue.lmk = lmk;
+    queue.grid_step = grid_step > 0 ? grid_step : 0;
+    queue.success = true;
+    queue.num_bands = (lmk->num_rows + CREATE_LANDMARK_WRITE_ROWS - 1)/CREATE_LANDMARK_WRITE_ROWS;
+    queue.band_done = (bool *)calloc(queue.num_bands > 0 ? queue.num_bands : 1, sizeof(bool));
+    if(queue.band_done == NULL){
+        printf("CreateLandmark_TileCache() ==>> malloc() failed\n");
+        if(main_cache != NULL) dem_tile_cache_free(main_cache);
+        return false;
+    }
+    
+    // The header is complete, so finished bands can be written while the next bands are computed
+    LMK_Writer *writer = NULL;
+    if(filename != NULL){
+        writer = Open_LMK_Writer(filename, lmk);
+        if(writer == NULL){
+            free(queue.band_done);
+            if(main_cache != NULL) dem_tile_cache_free(main_cache);
+            return false;
+        }
+    }
+    
+    if(num_threads <= 0) num_threads = default_num_threads();
+    if(num_threads > CREATE_LANDMARK_MAX_THREADS) num_threads = CREATE_LANDMARK_MAX_THREADS;
+    if(num_threads > queue.num_bands) num_threads = queue.num_bands;
+    pthread_t threads[CREATE_LANDMARK_MAX_THREADS];
+    int32_t started = 0;
+    pthread_mutex_init(&queue.mutex, NULL);
+    pthread_cond_init(&queue.band_finished, NULL);
+    for(int32_t t = 1; t < num_threads; t++){
+        if(pthread_create(&threads[started], NULL, create_thread, &queue) != 0) break;
+        started++;
+    }
+    
+    // The calling thread also computes bands, and hands the finished bands to the writer in order
+    int32_t next_write = 0;
+    while(next_write < queue.num_bands){
+        pthread_mutex_lock(&queue.mutex);
+        bool ready = queue.band_done[next_write];
+        pthread_mutex_unlock(&queue.mutex);
+        if(ready){
+            if(writer != NULL){
+                int32_t top = next_write*CREATE_LANDMARK_WRITE_ROWS;
+                int32_t nrows = (top + CREATE_LANDMARK_WRITE_ROWS < lmk->num_rows) ? CREATE_LANDMARK_WRITE_ROWS : lmk->num_rows - top;
+                int64_t first = (int64_t)top*lmk->num_cols;
+                success &= Append_LMK_Rows(writer, &lmk->srm[first], &lmk->ele[first], nrows);
             }
-
-            lmk->ele[lmk_y*lmk->num_cols + lmk_x] = elevation_estimate;
-            
+            next_write++;
+            continue;
+        }
+        int32_t band = take_band(&queue);
+        if(band >= 0){
+            finish_band(&queue, band, create_landmark_band(&queue, main_cache, band));
+            continue;
+        }
+        pthread_mutex_lock(&queue.mutex);
+        while(!queue.band_done[next_write]){
+            pthread_cond_wait(&queue.band_finished, &queue.mutex);
         }
+        pthread_mutex_unlock(&queue.mutex);
+    }
+    for(int32_t t = 0; t < started; t++){
+        pthread_join(threads[t], NULL);
+    }
+    pthread_cond_destroy(&queue.band_finished);
+    pthread_mutex_destroy(&queue.mutex);
+    free(queue.band_done);
+    if(main_cache != NULL) dem_tile_cache_free(main_cache);
+    
+    if(writer != NULL){
+        success &= queue.success;
+        success &= Close_LMK_Writer(writer);
+        return success;
     }
     return true;
 }
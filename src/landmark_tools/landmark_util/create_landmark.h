@@ -29,6 +29,7 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "landmark_tools/image_io/dem_tile_cache.h"
 #include "landmark_tools/image_io/geotiff_interface.h"
 #include "landmark_tools/landmark_util/landmark.h"
 #include "landmark_tools/map_projection/datum_conversion.h"
@@ -126,6 +127,200 @@ bool CreateLandmark(GeoTiffData* geotiff_info,
             LMK* lmk,
             float set_anchor_point_ele);
 
+/**
+ \brief Same as `CreateLandmark`, but also write the landmark file while it is being created
+ 
+ Finished rows are handed to a streaming writer, so disk io overlaps with the computation of later rows.
+ The file is identical to the output of `Write_LMK`.
+ 
+ \param[in] geotiff_info 
+ \param[in] srm_img surface reflectance model scaled to uint8 image. Must be coaligned with DEM. May be NULL
+ \param[in] icols width of srm_img
+ \param[in] irows height of srm_img
+ \param[in] anchor_latitude_degrees 
+ \param[in] anchor_longitude_degrees 
+ \param[in] proj 
+ \param[out] lmk 
+ \param[in] set_anchor_point_ele 
+ \param[in] filename output landmark file. If NULL, nothing is written
+ \return true on success
+ \return false if the anchor cannot be projected or the file cannot be written
+*/
+bool CreateLandmark_Streaming(GeoTiffData* geotiff_info,
+            uint8_t *srm_img, int32_t icols, int32_t irows,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,  
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename);
+
+/**
+ \brief Same as `CreateLandmark_Streaming`, with the rows computed by several threads
+ 
+ Threads take bands of rows, and compute each band in blocks of columns so that the part of the DEM a block
+ reads stays in cache. Every pixel is computed as by a single thread, so the landmark does not depend on
+ the number of threads. Finished bands are written in order while the next bands are computed.
+ 
+ \param[in] geotiff_info 
+ \param[in] srm_img surface reflectance model scaled to uint8 image. Must be coaligned with DEM. May be NULL
+ \param[in] icols width of srm_img
+ \param[in] irows height of srm_img
+ \param[in] anchor_latitude_degrees 
+ \param[in] anchor_longitude_degrees 
+ \param[in] proj 
+ \param[out] lmk 
+ \param[in] set_anchor_point_ele 
+ \param[in] filename output landmark file. If NULL, nothing is written
+ \param[in] num_threads number of threads. If 0, `parallel_num_threads()` is used
+ \return true on success
+ \return false if the anchor cannot be projected or the file cannot be written
+*/
+bool CreateLandmark_Parallel(GeoTiffData* geotiff_info,
+            uint8_t *srm_img, int32_t icols, int32_t irows,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,  
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename,
+            int32_t num_threads);
+
+/**
+ \brief Same as `CreateLandmark_Parallel`, with the projection to the DEM interpolated from a coarse grid
+ 
+ The exact projection of the landmark frame into the DEM is computed every `grid_step` pixels at three elevations,
+ and interpolated bilinearly between the nodes and quadratically in elevation for the refinement of the other pixels.
+ Cells of the grid where the interpolation is off by more than 0.001 DEM pixels, or would move the elevation by more
+ than a tenth of the refinement tolerance, are refined exactly, as are pixels more than 5 km above or below the
+ anchor.
+ 
+ \param[in] geotiff_info 
+ \param[in] srm_img surface reflectance model scaled to uint8 image. Must be coaligned with DEM. May be NULL
+ \param[in] icols width of srm_img
+ \param[in] irows height of srm_img
+ \param[in] anchor_latitude_degrees 
+ \param[in] anchor_longitude_degrees 
+ \param[in] proj 
+ \param[out] lmk 
+ \param[in] set_anchor_point_ele 
+ \param[in] filename output landmark file. If NULL, nothing is written
+ \param[in] num_threads number of threads. If 0, `parallel_num_threads()` is used
+ \param[in] grid_step pixels between the grid nodes, such as 16. If 0, every pixel is refined exactly
+ \return true on success
+ \return false if the anchor cannot be projected or the file cannot be written
+*/
+bool CreateLandmark_ProjectionGrid(GeoTiffData* geotiff_info,
+            uint8_t *srm_img, int32_t icols, int32_t irows,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,  
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename,
+            int32_t num_threads,
+            int32_t grid_step);
+
+/**
+ \brief Same as `CreateLandmark_ProjectionGrid`, with the DEM optionally read by tiles instead of held in memory
+ 
+ Each thread samples the DEM through its own `DemTileCache` of `tiles`, so the memory used is that of
+ `tiles->max_tiles` tiles per thread. The bands of rows taken by a thread cover a compact part of the DEM, so most
+ samples hit tiles already loaded. The output is that of the DEM read whole.
+ 
+ \param[in] geotiff_info georeferencing of the DEM. demValues is not used when tiles is not NULL
+ \param[in] tiles DEM read by tiles covering geotiff_info->imageSize, or NULL to sample geotiff_info->demValues
+ \param[in] srm_img surface reflectance model scaled to uint8 image. Must be coaligned with DEM. May be NULL
+ \param[in] icols width of srm_img
+ \param[in] irows height of srm_img
+ \param[in] anchor_latitude_degrees 
+ \param[in] anchor_longitude_degrees 
+ \param[in] proj 
+ \param[out] lmk 
+ \param[in] set_anchor_point_ele 
+ \param[in] filename output landmark file. If NULL, nothing is written
+ \param[in] num_threads number of threads. If 0, `parallel_num_threads()` is used
+ \param[in] grid_step pixels between the grid nodes, such as 16. If 0, every pixel is refined exactly
+ \return true on success
+ \return false if the anchor cannot be projected, a tile cannot be read or the file cannot be written
+*/
+bool CreateLandmark_TileCache(GeoTiffData* geotiff_info,
+            const DemTileSource *tiles,
+            uint8_t *srm_img, int32_t icols, int32_t irows,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,  
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename,
+            int32_t num_threads,
+            int32_t grid_step);
+
+/**
+ \brief Create a landmark from a DEM and a coaligned floating point surface reflectance image, such as a PDS4 orthoimage
+ 
+ The surface reflectance is scaled to 0-255 over the range of the whole image, as create_landmark_from_img always
+ did, with the minimum taken from FLT_MAX and the maximum from 0. The range is found with one pass split over the
+ threads, and the pixels are scaled as the landmark samples them, so no 8 bit copy of the image is made.
+ 
+ \param[in] geotiff_info DEM
+ \param[in] srm_info surface reflectance, with the size and projection of the DEM
+ \param[in] anchor_latitude_degrees 
+ \param[in] anchor_longitude_degrees 
+ \param[in] proj 
+ \param[out] lmk 
+ \param[in] set_anchor_point_ele 
+ \param[in] filename output landmark file. If NULL, nothing is written
+ \param[in] num_threads number of threads. If 0, `parallel_num_threads()` is used
+ \return false if the images do not match or the landmark cannot be created
+*/
+bool CreateLandmarkFromImage(GeoTiffData* geotiff_info,
+            const GeoTiffData* srm_info,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,
+            LMK* lmk,
+            float set_anchor_point_ele,
+            const char *filename,
+            int32_t num_threads);
+
+/**
+ \brief Find the window of a DEM that a landmark reads
+ 
+ The landmark frame is set up at the anchor and projected into the DEM on a grid of its pixels, 10 km above and below
+ the anchor as well as at its elevation. Only the size and georeferencing of geotiff_info are used, so it may come
+ from `readGeoTiffInfo`, and the window passed to `readGeoTiffWindow`.
+ 
+ \param[in] geotiff_info DEM georeferencing
+ \param[in] anchor_latitude_degrees 
+ \param[in] anchor_longitude_degrees 
+ \param[in] proj 
+ \param[in,out] lmk landmark size and resolution. Its anchor rotation is set
+ \param[in] set_anchor_point_ele anchor elevation, or NAN for 0
+ \param[in] margin DEM pixels added on every side
+ \param[out] window first column, first row, columns and rows of the window in DEM pixels, clipped to the DEM
+ \param[out] decimation DEM pixels per landmark pixel, rounded down and at least 1. May be NULL
+ \return false if the landmark does not overlap the DEM
+*/
+bool CreateLandmarkFootprint(GeoTiffData* geotiff_info,
+            double anchor_latitude_degrees, double anchor_longitude_degrees,
+            enum Projection proj,
+            LMK* lmk,
+            float set_anchor_point_ele,
+            int32_t margin,
+            int32_t window[4],
+            int32_t *decimation);
+
+/**
+ \brief Estimated peak bytes of creating a landmark
+ 
+ Counts the landmark arrays with either the DEM window held whole or the tile caches of the threads, which are the
+ allocations that grow with the maps.
+ 
+ \param[in] lmk landmark size
+ \param[in] dem_cols width of the DEM window, when it is held whole
+ \param[in] dem_rows height of the DEM window, when it is held whole
+ \param[in] tiles DEM read by tiles, or NULL if the window is held whole
+ \param[in] num_threads threads of `CreateLandmark_TileCache`. If 0, `parallel_num_threads()`
+ \return bytes
+*/
+size_t CreateLandmark_memory(const LMK *lmk, int32_t dem_cols, int32_t dem_rows, const DemTileSource *tiles,
+            int32_t num_threads);
 
 // /**
 //  * @brief Create a lmk structure from a lambert projection 
@@ -17,42 +17,302 @@
 #include <float.h>
 #include <math.h>                                                   // for fabs
 #include <stdio.h>                  // for fprintf, fread, fwrite, fclose
+#include <pthread.h>                                                // for pthread_mutex_lock
 #include <stdlib.h>                                                 // for free
 #include <string.h>
 
+#if defined(LINUX_OS) || defined(MAC_OS)
+#include <fcntl.h>                                                  // for open
+#include <sys/mman.h>                                               // for mmap, munmap
+#include <sys/stat.h>                                               // for fstat
+#include <unistd.h>                                                 // for close
+#define LMK_HAVE_MMAP
+#endif
+
 #include "landmark_tools/data_interpolation/interpolate_data.h"
 #include "landmark_tools/landmark_util/landmark.h"
+#include "landmark_tools/landmark_util/landmark_tiled.h"
+#include "landmark_tools/landmark_util/lmk_overview.h"      // for Remove_LMK_Overviews
+#include "landmark_tools/landmark_util/lmk_resample.h"
 #include "landmark_tools/math/math_utils.h"
 #include "landmark_tools/math/point_line_plane_util.h"  // for normalpoint2plane, PointRayInters...
 #include "landmark_tools/utils/endian_read_write.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
 #include "math/mat3/mat3.h"                                         // for dot3
+#include "math/mat3/mat3_inline.h"                                  // for dot3_inline, mult331_inline
 #include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/perf_stats.h"
 
 #define INTERSECTION_MAX_ITERATIONS 100
 
+/**
+ \brief Pixels and count of the landmarks holding them
+
+ Only the pixels are counted in the MEM_LANDMARK memory statistics.
+*/
+struct LMK_Raster {
+    int32_t refs;
+    size_t bytes;
+    uint8_t *data;
+};
+
+static uint8_t *raster_data(const LMK_Raster *raster)
+{
+    return raster->data;
+}
+
+/**
+ \brief New buffer of `bytes` held by one landmark
+*/
+static LMK_Raster *new_raster(size_t bytes)
+{
+    LMK_Raster *raster = (LMK_Raster *)malloc(sizeof(LMK_Raster));
+    if(raster == NULL) return NULL;
+    raster->data = (uint8_t *)mem_malloc(MEM_LANDMARK, bytes);
+    if(raster->data == NULL){
+        free(raster);
+        return NULL;
+    }
+    raster->refs = 1;
+    raster->bytes = bytes;
+    return raster;
+}
+
+/**
+ \brief True if `array` points into `raster`
+
+ Landmarks copied as a struct and given other arrays keep a stale raster, which is ignored.
+*/
+static bool raster_holds(const LMK_Raster *raster, const void *array)
+{
+    if(raster == NULL || array == NULL) return false;
+    const uint8_t *data = raster_data(raster);
+    return (const uint8_t *)array >= data && (const uint8_t *)array <= data + raster->bytes;
+}
+
+static int32_t raster_refs(const LMK_Raster *raster)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(&raster->refs, __ATOMIC_ACQUIRE);
+#else
+    return raster->refs;
+#endif
+}
+
+static void retain_raster(LMK_Raster *raster)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_add_fetch(&raster->refs, 1, __ATOMIC_RELAXED);
+#else
+    raster->refs++;
+#endif
+}
+
+static void release_raster(LMK_Raster *raster)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    int32_t refs = __atomic_sub_fetch(&raster->refs, 1, __ATOMIC_ACQ_REL);
+#else
+    int32_t refs = --raster->refs;
+#endif
+    if(refs == 0){
+        mem_free(raster->data);
+        free(raster);
+    }
+}
+
+/**
+ \brief Release one array of a landmark, through its raster if it has one
+*/
+static void release_array(void **array, LMK_Raster **raster)
+{
+    if(raster_holds(*raster, *array)){
+        release_raster(*raster);
+    }else if(*array != NULL){
+        mem_free(*array);
+    }
+    *array = NULL;
+    *raster = NULL;
+}
+
+/**
+ \brief Point `to` at the array of `from`, or at a copy of it if it is not held by a raster
+*/
+static bool share_array(const void *from_array, LMK_Raster *from_raster, size_t bytes, void **to_array,
+                        LMK_Raster **to_raster)
+{
+    if(raster_holds(from_raster, from_array)){
+        retain_raster(from_raster);
+        *to_array = (void *)from_array;
+        *to_raster = from_raster;
+        return true;
+    }
+    *to_raster = new_raster(bytes);
+    if(*to_raster == NULL) return false;
+    *to_array = raster_data(*to_raster);
+    if(from_array != NULL) memcpy(*to_array, from_array, bytes);
+    return true;
+}
+
+/**
+ \brief Give a landmark its own copy of an array it shares
+*/
+static void *writable_array(void **array, LMK_Raster **raster, size_t bytes, const char *caller)
+{
+    if(!raster_holds(*raster, *array) || raster_refs(*raster) == 1) return *array;
+    LMK_Raster *copy = new_raster(bytes);
+    if(copy == NULL){
+        log_message(LOG_LEVEL_ERROR, "%s() ==>> malloc() failed", caller);
+        return NULL;
+    }
+    memcpy(raster_data(copy), *array, bytes);
+    release_raster(*raster);
+    *raster = copy;
+    *array = raster_data(copy);
+    return *array;
+}
+
+/**
+ \brief Derived layers and the landmark state they were computed from
+
+ A landmark copied as a struct and given another elevation array keeps stale layers, which are ignored.
+*/
+struct LMK_Layers {
+    const float *ele;
+    int32_t num_cols;
+    int32_t num_rows;
+    double resolution;
+    double anchor_col;
+    double anchor_row;
+    double anchor_point[3];
+    double mapRworld[3][3];
+    void *data[LMK_NUM_LAYERS];
+    void (*release[LMK_NUM_LAYERS])(void *data);
+};
+
+// Layers are stored under one lock, and read without it once stored
+static pthread_mutex_t layers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ \brief True if `layers` were computed from the current elevation and map frame of `lmk`
+*/
+static bool layers_match(const LMK_Layers *layers, const LMK *lmk)
+{
+    return layers != NULL && layers->ele == lmk->ele && lmk->ele != NULL &&
+           layers->num_cols == lmk->num_cols && layers->num_rows == lmk->num_rows &&
+           layers->resolution == lmk->resolution && layers->anchor_col == lmk->anchor_col &&
+           layers->anchor_row == lmk->anchor_row &&
+           memcmp(layers->anchor_point, lmk->anchor_point, sizeof(layers->anchor_point)) == 0 &&
+           memcmp(layers->mapRworld, lmk->mapRworld, sizeof(layers->mapRworld)) == 0;
+}
+
+static LMK_Layers *load_layers(const LMK *lmk)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(&lmk->layers, __ATOMIC_ACQUIRE);
+#else
+    return lmk->layers;
+#endif
+}
+
+static void release_layers(LMK_Layers *layers)
+{
+    for(int32_t k = 0; k < LMK_NUM_LAYERS; k++){
+        if(layers->data[k] != NULL) layers->release[k](layers->data[k]);
+    }
+    free(layers);
+}
+
+const void *LMK_Layer(const LMK *lmk, LMK_LayerKind kind)
+{
+    LMK_Layers *layers = load_layers(lmk);
+    if(!layers_match(layers, lmk)) return NULL;
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(&layers->data[kind], __ATOMIC_ACQUIRE);
+#else
+    return layers->data[kind];
+#endif
+}
+
+const void *LMK_Set_Layer(LMK *lmk, LMK_LayerKind kind, void *data, void (*release)(void *data))
+{
+    pthread_mutex_lock(&layers_lock);
+    LMK_Layers *layers = lmk->layers;
+    if(!layers_match(layers, lmk)){
+        // Layers of the same array under another map frame are out of date, stale ones belong to another landmark
+        if(layers != NULL && layers->ele == lmk->ele) release_layers(layers);
+        layers = (LMK_Layers *)calloc(1, sizeof(LMK_Layers));
+        if(layers == NULL){
+            pthread_mutex_unlock(&layers_lock);
+            printf("LMK_Set_Layer() ==>> malloc() failed\n");
+            release(data);
+            return NULL;
+        }
+        layers->ele = lmk->ele;
+        layers->num_cols = lmk->num_cols;
+        layers->num_rows = lmk->num_rows;
+        layers->resolution = lmk->resolution;
+        layers->anchor_col = lmk->anchor_col;
+        layers->anchor_row = lmk->anchor_row;
+        copy3(lmk->anchor_point, layers->anchor_point);
+        copy33(lmk->mapRworld, layers->mapRworld);
+#if defined(__GNUC__) || defined(__clang__)
+        __atomic_store_n(&lmk->layers, layers, __ATOMIC_RELEASE);
+#else
+        lmk->layers = layers;
+#endif
+    }
+    if(layers->data[kind] != NULL){
+        // Computed by another thread meanwhile
+        release(data);
+    }else{
+        layers->release[kind] = release;
+#if defined(__GNUC__) || defined(__clang__)
+        __atomic_store_n(&layers->data[kind], data, __ATOMIC_RELEASE);
+#else
+        layers->data[kind] = data;
+#endif
+    }
+    const void *stored = layers->data[kind];
+    pthread_mutex_unlock(&layers_lock);
+    return stored;
+}
+
+void LMK_Drop_Layers(LMK *lmk)
+{
+    pthread_mutex_lock(&layers_lock);
+    LMK_Layers *layers = lmk->layers;
+    if(layers != NULL && layers->ele == lmk->ele) release_layers(layers);
+    lmk->layers = NULL;
+    pthread_mutex_unlock(&layers_lock);
+}
+
 bool allocate_lmk_arrays(LMK* lmk, int32_t num_cols, int32_t num_rows) {
     free_lmk(lmk); //Clear out any previously allocated memory
     
-    lmk->srm = (uint8_t *)malloc(sizeof(uint8_t)*lmk->num_cols*lmk->num_rows);
+    lmk->srm_raster = new_raster(sizeof(uint8_t)*lmk->num_cols*lmk->num_rows);
 
-    if (lmk->srm == NULL)
+    if (lmk->srm_raster == NULL)
     {
         SAFE_PRINTF(512, "allocate_lmk_arrays() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
         return false;
     }else{
+        lmk->srm = raster_data(lmk->srm_raster);
         for(int32_t i = 0; i < lmk->num_cols*lmk->num_rows; ++i)
         {
             lmk->srm[i] = SRM_DEFAULT;
         }
     }
     
-    lmk->ele = (float *)malloc(sizeof(float)*lmk->num_cols*lmk->num_rows);
-    if (lmk->ele == NULL)
+    lmk->ele_raster = new_raster(sizeof(float)*lmk->num_cols*lmk->num_rows);
+    if (lmk->ele_raster == NULL)
     {
         SAFE_PRINTF(512, "allocate_lmk_arrays() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
-        free(lmk->srm);
+        release_array((void **)&lmk->srm, &lmk->srm_raster);
         return false;
     }else{
+        lmk->ele = (float *)raster_data(lmk->ele_raster);
         for(int32_t i = 0; i < lmk->num_cols*lmk->num_rows; ++i)
         {
             lmk->ele[i] = NAN;
@@ -64,12 +324,43 @@ bool allocate_lmk_arrays(LMK* lmk, int32_t num_cols, int32_t num_rows) {
 
 
 void free_lmk(LMK* lmk) {
-    if(lmk->srm != NULL){
-        free(lmk->srm);
-    }
-    if(lmk->ele != NULL){
-        free(lmk->ele);
+    LMK_Drop_Layers(lmk);
+    release_array((void **)&lmk->srm, &lmk->srm_raster);
+    release_array((void **)&lmk->ele, &lmk->ele_raster);
+}
+
+bool Share_LMK(const LMK *from, LMK *to)
+{
+    free_lmk(to);
+    Copy_LMK_Header(from, to);
+    size_t num_pixels = (size_t)from->num_pixels;
+    if(!share_array(from->srm, from->srm_raster, sizeof(uint8_t)*num_pixels, (void **)&to->srm, &to->srm_raster) ||
+       !share_array(from->ele, from->ele_raster, sizeof(float)*num_pixels, (void **)&to->ele, &to->ele_raster)){
+        SAFE_PRINTF(512, "Share_LMK() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        free_lmk(to);
+        return false;
     }
+    return true;
+}
+
+uint8_t *LMK_Srm_Writable(LMK *lmk)
+{
+    return (uint8_t *)writable_array((void **)&lmk->srm, &lmk->srm_raster, sizeof(uint8_t)*lmk->num_pixels,
+                                     "LMK_Srm_Writable");
+}
+
+float *LMK_Ele_Writable(LMK *lmk)
+{
+    // The caller is about to change the elevation the layers were computed from
+    LMK_Drop_Layers(lmk);
+    return (float *)writable_array((void **)&lmk->ele, &lmk->ele_raster, sizeof(float)*lmk->num_pixels,
+                                   "LMK_Ele_Writable");
+}
+
+bool LMK_Is_Shared(const LMK *lmk)
+{
+    return (raster_holds(lmk->srm_raster, lmk->srm) && raster_refs(lmk->srm_raster) > 1) ||
+           (raster_holds(lmk->ele_raster, lmk->ele) && raster_refs(lmk->ele_raster) > 1);
 }
 
 
@@ -153,22 +444,13 @@ void Copy_LMK_Header(const LMK *from, LMK *to){
     
 }
 
-bool Write_LMK(const char *filename, const LMK *lmk)
+bool write_lmk_header(FILE *fp, const LMK *lmk, const char *version_string)
 {
-    FILE *fp;
-    fp = fopen(filename, "wb");
-    if(fp == NULL)
-    {
-        SAFE_PRINTF(512, "Write_LMK() ==>> cannot open file %s to write\n", filename);
-        return false;
-    }
-
-    size_t version_size = 32;
-    char version[version_size];
-    strncpy(version, "#! LVS Map v3.0", 16);
-    if(fwrite(version, sizeof(uint8_t), version_size, fp) != version_size) return false;
+    char version[LMK_VERSION_SIZE] = {0};
+    strncpy(version, version_string, LMK_VERSION_SIZE-1);
+    if(fwrite(version, sizeof(uint8_t), LMK_VERSION_SIZE, fp) != LMK_VERSION_SIZE) return false;
 
-     if(fwrite(&lmk->lmk_id, sizeof(uint8_t), LMK_ID_SIZE, fp) != LMK_ID_SIZE) return false;
+    if(fwrite(&lmk->lmk_id, sizeof(uint8_t), LMK_ID_SIZE, fp) != LMK_ID_SIZE) return false;
 
     uint32_t big_endian_32 = htonl(lmk->BODY);    
     if(fwrite(&big_endian_32, sizeof(uint32_t), 1, fp)  != 1) return false;
@@ -185,17 +467,15 @@ bool Write_LMK(const char *filename, const LMK *lmk)
     if(write_big_endian_array(lmk->mapRworld[0], 64, true, 3, fp)!= 3) return false;
     if(write_big_endian_array(lmk->mapRworld[1], 64, true, 3, fp)!= 3) return false;
     if(write_big_endian_array(lmk->mapRworld[2], 64, true, 3, fp)!= 3) return false;
-    
-    if(fwrite(lmk->srm, sizeof(uint8_t), lmk->num_pixels, fp)!= lmk->num_pixels) return false;
-    if(write_big_endian_array(lmk->ele, 32, true, lmk->num_pixels, fp)!= lmk->num_pixels) return false;
-    
-    fclose(fp);
-    
-    //Write ascii header file
+    return true;
+}
+
+bool write_lmk_ascii_header(const char *filename, const LMK *lmk)
+{
     size_t buf_size = 256;
     char buf[buf_size];
     snprintf(buf, buf_size, "%s.txt", filename);
-    fp = fopen(buf, "w");
+    FILE *fp = fopen(buf, "w");
     if(fp == NULL)
     {
         SAFE_PRINTF(512, "Write_LMK() ==>> cannot open file %s to write\n", buf);
@@ -213,51 +493,159 @@ bool Write_LMK(const char *filename, const LMK *lmk)
     SAFE_FPRINTF(fp, 512, "LMK_WORLD_2_MAP_ROT %f %f %f \n", lmk->mapRworld[2][0], lmk->mapRworld[2][1], lmk->mapRworld[2][2]  );
     
     fclose(fp);
-    
     return true;
 }
 
-bool Read_LMK(const char *filename, LMK *lmk)
+static bool write_lmk_file(const char *filename, const LMK *lmk)
 {
+    // An overview sidecar of the file it replaces would no longer match
+    if(!Remove_LMK_Overviews(filename)) return false;
+
     FILE *fp;
-    fp = fopen(filename, "rb");
+    fp = fopen(filename, "wb");
     if(fp == NULL)
     {
-        SAFE_PRINTF(512, "Read_LMK() ==>> cannot open file %s to read\n", filename);
+        SAFE_PRINTF(512, "Write_LMK() ==>> cannot open file %s to write\n", filename);
+        return false;
+    }
+
+    if(!write_lmk_header(fp, lmk, LMK_VERSION_V3)){
+        fclose(fp);
         return false;
     }
     
-    strncpy(lmk->filename, filename, LMK_FILENAME_SIZE);
-    uint32_t big_endian_32 = 0;
-    uint64_t big_endian_64 = 0;
+    if(fwrite(lmk->srm, sizeof(uint8_t), lmk->num_pixels, fp)!= lmk->num_pixels) return false;
+    if(write_big_endian_array(lmk->ele, 32, true, lmk->num_pixels, fp)!= lmk->num_pixels) return false;
+    
+    fclose(fp);
+    
+    //Write ascii header file
+    return write_lmk_ascii_header(filename, lmk);
+}
 
-    // Version comment
-    size_t char_array_size = 32;
-    char char_array[char_array_size];
-    if(fread(char_array, sizeof(char), char_array_size, fp) != char_array_size) return false;
-    SAFE_PRINTF(char_array_size, "%s\n", char_array);
+bool Write_LMK(const char *filename, const LMK *lmk)
+{
+    PERF_PHASE_BEGIN(timer, PERF_WRITE);
+    bool success = write_lmk_file(filename, lmk);
+    PERF_PHASE_END(timer);
+    return success;
+}
+
+static uint32_t decode_big_endian_32(const uint8_t *buf){
+    uint32_t val;
+    memcpy(&val, buf, sizeof(uint32_t));
+    swap_big_endian_array(&val, 32, 1);
+    return val;
+}
 
-    if(fread(lmk->lmk_id, sizeof(char), LMK_ID_SIZE, fp) != LMK_ID_SIZE) return false;
+static double decode_big_endian_double(const uint8_t *buf){
+    double val;
+    memcpy(&val, buf, sizeof(double));
+    swap_big_endian_array(&val, 64, 1);
+    return val;
+}
 
-    if(fread(&big_endian_32, sizeof(uint32_t), 1, fp) != 1) return false;
-    lmk->BODY = ntohl(big_endian_32);
-    if(fread(&big_endian_32, sizeof(uint32_t), 1, fp) != 1) return false;
-    lmk->num_cols = ntohl(big_endian_32);
-    if(fread(&big_endian_32, sizeof(uint32_t), 1, fp) != 1) return false;
-    lmk->num_rows = ntohl(big_endian_32);
+/**
+ \brief Decode the fixed size header block of a landmark file and fill the derived values
+ 
+ \param[in] header first LMK_HEADER_SIZE bytes of the file
+ \param[out] lmk
+ \param[in] print_version if true, print the version comment
+ \return major version of the file format
+*/
+static int32_t decode_lmk_header(const uint8_t header[LMK_HEADER_SIZE], LMK *lmk, bool print_version){
+    const uint8_t *ptr = header;
+    
+    // Version comment
+    char version[LMK_VERSION_SIZE];
+    memcpy(version, ptr, LMK_VERSION_SIZE);
+    version[LMK_VERSION_SIZE-1] = '\0';
+    if(print_version) log_message(LOG_LEVEL_INFO, "%s", version);
+    ptr += LMK_VERSION_SIZE;
     
-    if(!read_double_big_endian(fp, &lmk->anchor_col)) return false;
-    if(!read_double_big_endian(fp, &lmk->anchor_row)) return false;
-    if(!read_double_big_endian(fp, &lmk->resolution)) return false;
+    memcpy(lmk->lmk_id, ptr, LMK_ID_SIZE);
+    ptr += LMK_ID_SIZE;
     
-    if(read_big_endian_array(lmk->anchor_point, 64, true, 3, fp) != 3) return false;
-    if(read_big_endian_array(lmk->mapRworld[0], 64, true, 3, fp) != 3) return false;
-    if(read_big_endian_array(lmk->mapRworld[1], 64, true, 3, fp) != 3) return false;
-    if(read_big_endian_array(lmk->mapRworld[2], 64, true, 3, fp) != 3) return false;
+    lmk->BODY = decode_big_endian_32(ptr);
+    lmk->num_cols = decode_big_endian_32(ptr + 4);
+    lmk->num_rows = decode_big_endian_32(ptr + 8);
+    ptr += 12;
+    
+    lmk->anchor_col = decode_big_endian_double(ptr);
+    lmk->anchor_row = decode_big_endian_double(ptr + 8);
+    lmk->resolution = decode_big_endian_double(ptr + 16);
+    ptr += 24;
+    
+    for(int32_t i = 0; i < 3; i++){
+        lmk->anchor_point[i] = decode_big_endian_double(ptr + 8*i);
+    }
+    ptr += 24;
+    for(int32_t i = 0; i < 3; i++){
+        for(int32_t j = 0; j < 3; j++){
+            lmk->mapRworld[i][j] = decode_big_endian_double(ptr + 8*(3*i+j));
+        }
+    }
     
     calculateDerivedValuesVectors(lmk);
     
+    return strncmp(version, LMK_VERSION_V4, LMK_VERSION_SIZE) == 0 ? 4 : 3;
+}
+
+void Subset_LMK_Header(const LMK *lmk, LMK *lmk_sub, int32_t left, int32_t top, int32_t ncols, int32_t nrows)
+{
+    Copy_LMK_Header(lmk, lmk_sub);
+    lmk_sub->num_cols = ncols;
+    lmk_sub->num_rows = nrows;
+
+    lmk_sub->anchor_col = (double)ncols/2.0 ;
+    lmk_sub->anchor_row = (double)nrows/2.0 ;
+    
+    LMK_Col_Row_Elevation2World( lmk,  left + lmk_sub->anchor_col, top + lmk_sub->anchor_row, 0.0, lmk_sub->anchor_point);
+    calculateDerivedValuesVectors(lmk_sub);
+    lmk_sub->num_pixels = (int64_t)ncols*nrows;
+}
+
+/**
+ \brief Fill the header of `lmk_sub` for a region of interest of `lmk` and allocate its arrays
+ 
+ Shared by SubsetLMK and Read_LMK_Window. Only the header values of `lmk` are used.
+*/
+static bool subset_lmk_header(const LMK *lmk, LMK *lmk_sub, int32_t left, int32_t top, int32_t ncols, int32_t nrows)
+{
+    Subset_LMK_Header(lmk, lmk_sub, left, top, ncols, nrows);
+    return allocate_lmk_arrays(lmk_sub, lmk_sub->num_cols, lmk_sub->num_rows);
+}
+
+int32_t read_lmk_header_fp(FILE *fp, LMK *lmk, bool print_version){
+    uint8_t header[LMK_HEADER_SIZE];
+    if(fread(header, sizeof(uint8_t), LMK_HEADER_SIZE, fp) != LMK_HEADER_SIZE) return 0;
+    return decode_lmk_header(header, lmk, print_version);
+}
+
+static bool read_lmk_file(const char *filename, LMK *lmk)
+{
+    FILE *fp;
+    fp = fopen(filename, "rb");
+    if(fp == NULL)
+    {
+        SAFE_PRINTF(512, "Read_LMK() ==>> cannot open file %s to read\n", filename);
+        return false;
+    }
+    
+    strncpy(lmk->filename, filename, LMK_FILENAME_SIZE);
+
+    int32_t version = read_lmk_header_fp(fp, lmk, true);
+    if(version == 0){
+        fclose(fp);
+        return false;
+    }
+    
     if(allocate_lmk_arrays(lmk, lmk->num_cols, lmk->num_rows)){
+        if(version == 4){
+            bool success = read_lmk_tiled_region(fp, lmk, 0, 0, lmk->num_cols, lmk->num_rows, lmk->srm, lmk->ele);
+            fclose(fp);
+            return success;
+        }
         if(fread(lmk->srm, sizeof(uint8_t), lmk->num_pixels, fp) != lmk->num_pixels) return false;
         if(read_big_endian_array(lmk->ele, 32, true, lmk->num_pixels, fp) != lmk->num_pixels) return false;
         fclose(fp);
@@ -270,6 +658,212 @@ bool Read_LMK(const char *filename, LMK *lmk)
     }
 }
 
+bool Read_LMK(const char *filename, LMK *lmk)
+{
+    PERF_PHASE_BEGIN(timer, PERF_LOAD);
+    bool success = read_lmk_file(filename, lmk);
+    PERF_PHASE_END(timer);
+    return success;
+}
+
+bool Read_LMK_Header(const char *filename, LMK *lmk)
+{
+    FILE *fp;
+    fp = fopen(filename, "rb");
+    if(fp == NULL)
+    {
+        SAFE_PRINTF(512, "Read_LMK_Header() ==>> cannot open file %s to read\n", filename);
+        return false;
+    }
+    
+    strncpy(lmk->filename, filename, LMK_FILENAME_SIZE);
+    int32_t version = read_lmk_header_fp(fp, lmk, false);
+    fclose(fp);
+    return version != 0;
+}
+
+bool Read_LMK_Window(const char *filename, int32_t left, int32_t top, int32_t ncols, int32_t nrows, LMK *lmk_sub)
+{
+    FILE *fp;
+    fp = fopen(filename, "rb");
+    if(fp == NULL)
+    {
+        SAFE_PRINTF(512, "Read_LMK_Window() ==>> cannot open file %s to read\n", filename);
+        return false;
+    }
+    
+    LMK lmk = {0};
+    int32_t version = read_lmk_header_fp(fp, &lmk, true);
+    if(version == 0){
+        fclose(fp);
+        return false;
+    }
+    
+    if(left < 0 || top < 0 || ncols <= 0 || nrows <= 0 ||
+       left + ncols > lmk.num_cols || top + nrows > lmk.num_rows)
+    {
+        SAFE_PRINTF(512, "Read_LMK_Window() ==>> roi %d %d %d %d is outside of %s (%d x %d)\n",
+                    left, top, ncols, nrows, filename, lmk.num_cols, lmk.num_rows);
+        fclose(fp);
+        return false;
+    }
+    
+    if(!subset_lmk_header(&lmk, lmk_sub, left, top, ncols, nrows)){
+        fclose(fp);
+        return false;
+    }
+    strncpy(lmk_sub->filename, filename, LMK_FILENAME_SIZE);
+    
+    if(version == 4){
+        bool success = read_lmk_tiled_region(fp, &lmk, left, top, ncols, nrows, lmk_sub->srm, lmk_sub->ele);
+        fclose(fp);
+        return success;
+    }
+    
+    int64_t srm_offset = LMK_HEADER_SIZE;
+    int64_t ele_offset = LMK_HEADER_SIZE + lmk.num_pixels*(int64_t)sizeof(uint8_t);
+    
+    // Full width windows are contiguous on disk and can be read in one call
+    int32_t rows_per_read = (ncols == lmk.num_cols) ? nrows : 1;
+    bool success = true;
+    for(int32_t m = 0; m < nrows && success; m += rows_per_read)
+    {
+        int64_t src_index = (int64_t)(top + m)*lmk.num_cols + left;
+        int64_t count = (int64_t)ncols*rows_per_read;
+        success &= seek_file_offset(fp, srm_offset + src_index);
+        success &= success && fread(&lmk_sub->srm[(int64_t)m*ncols], sizeof(uint8_t), count, fp) == count;
+        success &= success && seek_file_offset(fp, ele_offset + src_index*(int64_t)sizeof(float));
+        success &= success && read_big_endian_array(&lmk_sub->ele[(int64_t)m*ncols], 32, true, count, fp) == count;
+    }
+    fclose(fp);
+    
+    if(!success)
+    {
+        SAFE_PRINTF(512, "Read_LMK_Window() ==>> %s is truncated\n", filename);
+        free_lmk(lmk_sub);
+        lmk_sub->srm = NULL;
+        lmk_sub->ele = NULL;
+    }
+    return success;
+}
+
+bool Open_LMK_View(const char *filename, LMK_View *view)
+{
+    memset(view, 0, sizeof(LMK_View));
+    
+#ifdef LMK_HAVE_MMAP
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+    {
+        SAFE_PRINTF(512, "Open_LMK_View() ==>> cannot open file %s to read\n", filename);
+        return false;
+    }
+    
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < LMK_HEADER_SIZE)
+    {
+        SAFE_PRINTF(512, "Open_LMK_View() ==>> %s is not a landmark file\n", filename);
+        close(fd);
+        return false;
+    }
+    
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping stays valid after the descriptor is closed
+    if(map == MAP_FAILED)
+    {
+        SAFE_PRINTF(512, "Open_LMK_View() ==>> mmap() failed for %s\n", filename);
+        return false;
+    }
+    
+    view->map = (const uint8_t *)map;
+    view->map_size = (size_t)st.st_size;
+    strncpy(view->lmk.filename, filename, LMK_FILENAME_SIZE);
+    if(decode_lmk_header(view->map, &view->lmk, true) == 4)
+    {
+        // Tiled files are not contiguous, so decode them like Read_LMK
+        munmap(map, view->map_size);
+        memset(view, 0, sizeof(LMK_View));
+        return Read_LMK(filename, &view->lmk);
+    }
+    
+    size_t expected_size = LMK_HEADER_SIZE + (size_t)view->lmk.num_pixels*(sizeof(uint8_t) + sizeof(float));
+    if(view->lmk.num_cols <= 0 || view->lmk.num_rows <= 0 || view->map_size < expected_size)
+    {
+        SAFE_PRINTF(512, "Open_LMK_View() ==>> %s is truncated\n", filename);
+        Close_LMK_View(view);
+        return false;
+    }
+    
+#ifdef MADV_RANDOM
+    // Views are typically used to sample a few windows of a large map
+    madvise(map, view->map_size, MADV_RANDOM);
+#endif
+    
+    view->lmk.srm = (uint8_t *)(view->map + LMK_HEADER_SIZE);
+    view->ele_be = view->map + LMK_HEADER_SIZE + view->lmk.num_pixels;
+    view->lmk.ele = NULL;
+    return true;
+#else
+    if(!Read_LMK(filename, &view->lmk)) return false;
+    view->map = NULL;
+    view->map_size = 0;
+    view->ele_be = NULL;
+    return true;
+#endif
+}
+
+void Close_LMK_View(LMK_View *view)
+{
+    if(view->map != NULL)
+    {
+#ifdef LMK_HAVE_MMAP
+        munmap((void *)view->map, view->map_size);
+#endif
+        // srm belongs to the mapping, only the decoded elevation and its layers are owned
+        LMK_Drop_Layers(&view->lmk);
+        if(view->lmk.ele != NULL) free(view->lmk.ele);
+    }
+    else
+    {
+        free_lmk(&view->lmk);
+    }
+    view->map = NULL;
+    view->map_size = 0;
+    view->ele_be = NULL;
+    view->lmk.srm = NULL;
+    view->lmk.ele = NULL;
+}
+
+bool LMK_View_Decode_Ele(LMK_View *view)
+{
+    if(view->lmk.ele != NULL) return true;
+    if(view->ele_be == NULL) return false;
+    
+    view->lmk.ele = (float *)malloc(sizeof(float)*view->lmk.num_pixels);
+    if(view->lmk.ele == NULL)
+    {
+        SAFE_PRINTF(512, "LMK_View_Decode_Ele() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        return false;
+    }
+    memcpy(view->lmk.ele, view->ele_be, sizeof(float)*view->lmk.num_pixels);
+    swap_big_endian_array(view->lmk.ele, 32, view->lmk.num_pixels);
+    return true;
+}
+
+float LMK_View_Ele(const LMK_View *view, int32_t col, int32_t row)
+{
+    if(col < 0 || row < 0 || col >= view->lmk.num_cols || row >= view->lmk.num_rows) return NAN;
+    
+    int64_t index = (int64_t)row*view->lmk.num_cols + col;
+    if(view->lmk.ele != NULL) return view->lmk.ele[index];
+    if(view->ele_be == NULL) return NAN;
+    
+    float val;
+    memcpy(&val, view->ele_be + index*sizeof(float), sizeof(float));
+    swap_big_endian_array(&val, 32, 1);
+    return val;
+}
+
 void LMK_Col_Row_Elevation2World(const LMK *lmk,  double col, double row, double ele, double p[3])
 {
     if (lmk == NULL || p == NULL) {
@@ -285,13 +879,163 @@ void LMK_Col_Row_Elevation2World(const LMK *lmk,  double col, double row, double
     pim[1] = row;
     pim[2] = 1;
     
-    pm[0] = dot3(lmk->col_row2mapxy[0], pim);
-    pm[1] = dot3(lmk->col_row2mapxy[1], pim);
+    pm[0] = dot3_inline(lmk->col_row2mapxy[0], pim);
+    pm[1] = dot3_inline(lmk->col_row2mapxy[1], pim);
     pm[2] = ele;
-    mult331(lmk->worldRmap, pm, p1);
-    add3(p1, lmk->anchor_point, p);
+    mult331_inline(lmk->worldRmap, pm, p1);
+    add3_inline(p1, lmk->anchor_point, p);
+}
+
+
+void LMK_Col_Row_Elevation2World_Batch(const LMK *lmk, const double *col, const double *row, const double *ele,
+                                       size_t n, double (*p)[3])
+{
+    // The same arithmetic as LMK_Col_Row_Elevation2World, with the transforms held in locals across the loop
+    const double a00 = lmk->col_row2mapxy[0][0], a01 = lmk->col_row2mapxy[0][1], a02 = lmk->col_row2mapxy[0][2];
+    const double a10 = lmk->col_row2mapxy[1][0], a11 = lmk->col_row2mapxy[1][1], a12 = lmk->col_row2mapxy[1][2];
+    const double r00 = lmk->worldRmap[0][0], r01 = lmk->worldRmap[0][1], r02 = lmk->worldRmap[0][2];
+    const double r10 = lmk->worldRmap[1][0], r11 = lmk->worldRmap[1][1], r12 = lmk->worldRmap[1][2];
+    const double r20 = lmk->worldRmap[2][0], r21 = lmk->worldRmap[2][1], r22 = lmk->worldRmap[2][2];
+    const double t0 = lmk->anchor_point[0], t1 = lmk->anchor_point[1], t2 = lmk->anchor_point[2];
+    for(size_t i = 0; i < n; i++){
+        double x = a00*col[i] + a01*row[i] + a02;
+        double y = a10*col[i] + a11*row[i] + a12;
+        double z = ele == NULL ? 0.0 : ele[i];
+        p[i][0] = (r00*x + r01*y + r02*z) + t0;
+        p[i][1] = (r10*x + r11*y + r12*z) + t1;
+        p[i][2] = (r20*x + r21*y + r22*z) + t2;
+    }
+}
+
+
+double LMK_Local_Extent(const LMK *lmk)
+{
+    // Bound of every term of the local x and y of a pixel, the largest at one of the corners
+    double extent = 0.0;
+    double cols[2] = {0.0, lmk->num_cols > 0 ? lmk->num_cols - 1.0 : 0.0};
+    double rows[2] = {0.0, lmk->num_rows > 0 ? lmk->num_rows - 1.0 : 0.0};
+    for(int32_t k = 0; k < 2; k++){
+        for(int32_t c = 0; c < 2; c++){
+            for(int32_t r = 0; r < 2; r++){
+                double terms = fabs(lmk->col_row2mapxy[k][0]*cols[c]) + fabs(lmk->col_row2mapxy[k][1]*rows[r]) +
+                               fabs(lmk->col_row2mapxy[k][2]);
+                if(terms > extent) extent = terms;
+            }
+        }
+    }
+    return extent;
+}
+
+/**
+ \brief True if float local coordinates within `extent` meters are within the tolerance of the landmark
+ */
+static bool local_float_fits(const LMK *lmk, double extent)
+{
+    // Whole columns and rows stay exact in float below 2^24
+    return lmk->resolution > 0 && lmk->num_cols < (1 << 24) && lmk->num_rows < (1 << 24) &&
+           LMK_LOCAL_FLOAT_ERROR*extent <= LMK_LOCAL_FLOAT_TOLERANCE*lmk->resolution;
+}
+
+bool LMK_Local_Float_Fits(const LMK *lmk)
+{
+    return local_float_fits(lmk, LMK_Local_Extent(lmk));
+}
+
+void LMK_Col_Row_Elevation2Local_Batch(const LMK *lmk, const float *col, const float *row, const float *ele,
+                                       size_t n, float *x, float *y, float *z)
+{
+    const float a00 = (float)lmk->col_row2mapxy[0][0], a01 = (float)lmk->col_row2mapxy[0][1];
+    const float a02 = (float)lmk->col_row2mapxy[0][2];
+    const float a10 = (float)lmk->col_row2mapxy[1][0], a11 = (float)lmk->col_row2mapxy[1][1];
+    const float a12 = (float)lmk->col_row2mapxy[1][2];
+    for(size_t i = 0; i < n; i++){
+        x[i] = a00*col[i] + a01*row[i] + a02;
+        y[i] = a10*col[i] + a11*row[i] + a12;
+        z[i] = ele == NULL ? 0.0f : ele[i];
+    }
+}
+
+void LMK_Local2World_Batch(const LMK *lmk, const float *x, const float *y, const float *z, size_t n,
+                           double (*p)[3])
+{
+    const double r00 = lmk->worldRmap[0][0], r01 = lmk->worldRmap[0][1], r02 = lmk->worldRmap[0][2];
+    const double r10 = lmk->worldRmap[1][0], r11 = lmk->worldRmap[1][1], r12 = lmk->worldRmap[1][2];
+    const double r20 = lmk->worldRmap[2][0], r21 = lmk->worldRmap[2][1], r22 = lmk->worldRmap[2][2];
+    const double t0 = lmk->anchor_point[0], t1 = lmk->anchor_point[1], t2 = lmk->anchor_point[2];
+    for(size_t i = 0; i < n; i++){
+        p[i][0] = (r00*x[i] + r01*y[i] + r02*z[i]) + t0;
+        p[i][1] = (r10*x[i] + r11*y[i] + r12*z[i]) + t1;
+        p[i][2] = (r20*x[i] + r21*y[i] + r22*z[i]) + t2;
+    }
+}
+
+bool LMK_Local_Pair_Init(LMK_LocalPair *pair, const LMK *child, const LMK *base)
+{
+    pair->child = child;
+    pair->base = base;
+    double childRbase[3][3], anchor_offset[3], base_offset[3];
+    mult333((double (*)[3])child->mapRworld, (double (*)[3])base->worldRmap, childRbase);
+    sub3(base->anchor_point, child->anchor_point, anchor_offset);
+    mult331(child->mapRworld, anchor_offset, base_offset);
+    double offset = 0.0;
+    for(int32_t k = 0; k < 3; k++){
+        pair->base_offset[k] = (float)base_offset[k];
+        if(fabs(base_offset[k]) > offset) offset = fabs(base_offset[k]);
+        for(int32_t j = 0; j < 3; j++) pair->childRbase[k][j] = (float)childRbase[k][j];
+    }
+    // A rotated base coordinate sums its x and y, at most sqrt(2) times the larger, and then the anchor offset
+    return local_float_fits(child, LMK_Local_Extent(child)) &&
+           local_float_fits(child, 1.5*LMK_Local_Extent(base) + offset);
 }
 
+void LMK_Local_Pair_Delta_Batch(const LMK_LocalPair *pair, const double *child_points, const double *base_points,
+                                size_t n, double (*delta)[3], bool *valid)
+{
+    double col[LMK_LOCAL_BATCH], row[LMK_LOCAL_BATCH], child_ele[LMK_LOCAL_BATCH], base_ele[LMK_LOCAL_BATCH];
+    float fcol[LMK_LOCAL_BATCH], frow[LMK_LOCAL_BATCH], fele[LMK_LOCAL_BATCH];
+    float cx[LMK_LOCAL_BATCH], cy[LMK_LOCAL_BATCH], cz[LMK_LOCAL_BATCH];
+    float bx[LMK_LOCAL_BATCH], by[LMK_LOCAL_BATCH], bz[LMK_LOCAL_BATCH];
+    const float (*R)[3] = pair->childRbase;
+    const float *t = pair->base_offset;
+    for(size_t first = 0; first < n; first += LMK_LOCAL_BATCH){
+        size_t m = n - first < LMK_LOCAL_BATCH ? n - first : LMK_LOCAL_BATCH;
+
+        // Elevations are interpolated in double like LMK_Col_Row2World, then the points go to float
+        for(size_t i = 0; i < m; i++){
+            col[i] = child_points[(first + i)*2];
+            row[i] = child_points[(first + i)*2 + 1];
+        }
+        Interpolate_LMK_ELE_Batch(pair->child, col, row, m, child_ele);
+        for(size_t i = 0; i < m; i++){
+            fcol[i] = (float)col[i];
+            frow[i] = (float)row[i];
+            fele[i] = (float)child_ele[i];
+        }
+        LMK_Col_Row_Elevation2Local_Batch(pair->child, fcol, frow, fele, m, cx, cy, cz);
+
+        for(size_t i = 0; i < m; i++){
+            col[i] = base_points[(first + i)*2];
+            row[i] = base_points[(first + i)*2 + 1];
+        }
+        Interpolate_LMK_ELE_Batch(pair->base, col, row, m, base_ele);
+        for(size_t i = 0; i < m; i++){
+            fcol[i] = (float)col[i];
+            frow[i] = (float)row[i];
+            fele[i] = (float)base_ele[i];
+        }
+        LMK_Col_Row_Elevation2Local_Batch(pair->base, fcol, frow, fele, m, bx, by, bz);
+
+        for(size_t i = 0; i < m; i++){
+            float dx = cx[i] - ((R[0][0]*bx[i] + R[0][1]*by[i] + R[0][2]*bz[i]) + t[0]);
+            float dy = cy[i] - ((R[1][0]*bx[i] + R[1][1]*by[i] + R[1][2]*bz[i]) + t[1]);
+            float dz = cz[i] - ((R[2][0]*bx[i] + R[2][1]*by[i] + R[2][2]*bz[i]) + t[2]);
+            delta[first + i][0] = dx;
+            delta[first + i][1] = dy;
+            delta[first + i][2] = dz;
+            valid[first + i] = !isnan(child_ele[i]) && !isnan(base_ele[i]);
+        }
+    }
+}
 
 bool LMK_Col_Row2World(const LMK *lmk,  double col, double row,  double p[3])
 {
@@ -319,22 +1063,58 @@ double  Interpolate_LMK_SRM(const LMK *lmk, double  col, double  row)
 }
 
 
+void Interpolate_LMK_ELE_Batch(const LMK *lmk, const double *col, const double *row, size_t n, double *ele)
+{
+    inter_float_matrix_batch(lmk->ele, lmk->num_cols, lmk->num_rows, col, row, n, ele);
+}
+
+
+void Interpolate_LMK_SRM_Batch(const LMK *lmk, const double *col, const double *row, size_t n, uint8_t *srm,
+                               bool *valid)
+{
+    inter_uint8_matrix_batch(lmk->srm, lmk->num_cols, lmk->num_rows, col, row, n, srm, valid);
+}
+
+
 void World2LMK_Col_Row_Ele(const LMK *lmk, double p[3], double *col, double *row, double *ele)
 {
     double pm[3];
     double pi[3];
     double pw[3];
-    sub3(p, lmk->anchor_point, pw);
-    mult331(lmk->mapRworld, pw, pm);
+    sub3_inline(p, lmk->anchor_point, pw);
+    mult331_inline(lmk->mapRworld, pw, pm);
     *ele = pm[2];
     pm[2] = 1;
-    pi[0] = dot3(lmk->mapxy2col_row[0], pm );
-    pi[1] = dot3(lmk->mapxy2col_row[1], pm );
+    pi[0] = dot3_inline(lmk->mapxy2col_row[0], pm );
+    pi[1] = dot3_inline(lmk->mapxy2col_row[1], pm );
     *col = pi[0];
     *row = pi[1];
 }
 
 
+void World2LMK_Col_Row_Ele_Batch(const LMK *lmk, const double (*p)[3], size_t n, double *col, double *row,
+                                 double *ele)
+{
+    // The same arithmetic as World2LMK_Col_Row_Ele, with the transforms held in locals across the loop
+    const double r00 = lmk->mapRworld[0][0], r01 = lmk->mapRworld[0][1], r02 = lmk->mapRworld[0][2];
+    const double r10 = lmk->mapRworld[1][0], r11 = lmk->mapRworld[1][1], r12 = lmk->mapRworld[1][2];
+    const double r20 = lmk->mapRworld[2][0], r21 = lmk->mapRworld[2][1], r22 = lmk->mapRworld[2][2];
+    const double b00 = lmk->mapxy2col_row[0][0], b01 = lmk->mapxy2col_row[0][1], b02 = lmk->mapxy2col_row[0][2];
+    const double b10 = lmk->mapxy2col_row[1][0], b11 = lmk->mapxy2col_row[1][1], b12 = lmk->mapxy2col_row[1][2];
+    const double t0 = lmk->anchor_point[0], t1 = lmk->anchor_point[1], t2 = lmk->anchor_point[2];
+    for(size_t i = 0; i < n; i++){
+        double w0 = p[i][0] - t0;
+        double w1 = p[i][1] - t1;
+        double w2 = p[i][2] - t2;
+        double x = r00*w0 + r01*w1 + r02*w2;
+        double y = r10*w0 + r11*w1 + r12*w2;
+        if(ele != NULL) ele[i] = r20*w0 + r21*w1 + r22*w2;
+        col[i] = b00*x + b01*y + b02;
+        row[i] = b10*x + b11*y + b12;
+    }
+}
+
+
 bool Intersect_LMK_map_plane_params_World( const LMK *lmk, double c[3], double ray[3],  double point3d[3])
 {
     double r;
@@ -512,32 +1292,32 @@ bool Intersect_LMK_ELE_low_slant_angle(const LMK *lmk, double c[3], double ray[3
 
 bool SubsetLMK(const LMK *lmk, LMK *lmk_sub, int32_t left, int32_t top, int32_t ncols, int32_t nrows)
 {
-    Copy_LMK_Header(lmk, lmk_sub);
-    lmk_sub->num_cols = ncols;
-    lmk_sub->num_rows = nrows;
+    // Whole rows are contiguous in the arrays of lmk, so the roi is a view of them at an offset
+    if(left == 0 && ncols == lmk->num_cols && top >= 0 && nrows >= 0 && top + nrows <= lmk->num_rows &&
+       raster_holds(lmk->srm_raster, lmk->srm) && raster_holds(lmk->ele_raster, lmk->ele)){
+        free_lmk(lmk_sub);
+        Subset_LMK_Header(lmk, lmk_sub, left, top, ncols, nrows);
+        size_t offset = (size_t)top*lmk->num_cols;
+        retain_raster(lmk->srm_raster);
+        retain_raster(lmk->ele_raster);
+        lmk_sub->srm = lmk->srm + offset;
+        lmk_sub->srm_raster = lmk->srm_raster;
+        lmk_sub->ele = lmk->ele + offset;
+        lmk_sub->ele_raster = lmk->ele_raster;
+        return true;
+    }
 
-    lmk_sub->anchor_col = (double)ncols/2.0 ;
-    lmk_sub->anchor_row = (double)nrows/2.0 ;
-    lmk_sub->num_pixels = ncols*nrows;
-    
-    LMK_Col_Row_Elevation2World( lmk,  left + lmk_sub->anchor_col, top + lmk_sub->anchor_row, 0.0, lmk_sub->anchor_point);
-    normalpoint2plane(lmk_sub->map_normal_vector, lmk_sub->anchor_point, lmk_sub->map_plane_params);
-    double center_ele = 0.0;
-    
-    uint8_t success = allocate_lmk_arrays(lmk_sub, lmk_sub->num_cols, lmk_sub->num_rows);
-    if(!success){
-        return success;
+    if(!subset_lmk_header(lmk, lmk_sub, left, top, ncols, nrows)){
+        return false;
     }
     
-	for(int32_t i = top, m = 0; i < top+nrows; ++i, ++m)
-	{
-		for(int32_t j = left, n = 0 ; j < left+ncols; ++j, n++)
-		{
-			lmk_sub->ele[m*ncols + n] = lmk->ele[i*lmk->num_cols + j] ;
-			lmk_sub->srm[m*ncols + n] = lmk->srm[i*lmk->num_cols + j];
-			 
-		}
-	}
+    // The roi keeps the pixel grid, so its rows are copied whole
+    for(int32_t m = 0; m < nrows; ++m)
+    {
+        size_t from = (size_t)(top + m)*lmk->num_cols + left;
+        memcpy(&lmk_sub->ele[(size_t)m*ncols], &lmk->ele[from], sizeof(float)*ncols);
+        memcpy(&lmk_sub->srm[(size_t)m*ncols], &lmk->srm[from], sizeof(uint8_t)*ncols);
+    }
     
     return true;
 }
@@ -552,47 +1332,12 @@ bool RescaleLMK(const LMK *lmk, LMK *lmk_out, double out_lmk_res)
 
 bool  ResampleLMK(const LMK *lmk, LMK *lmk_sub,  double scale)
 {
-	Copy_LMK_Header( lmk, lmk_sub);
-	lmk_sub->num_cols = (int32_t)(lmk_sub->num_cols/scale);
-	lmk_sub->num_rows = (int32_t)(lmk_sub->num_rows/scale);
-	lmk_sub->resolution = lmk->resolution*scale;
-	scale3(scale, lmk->col_row2mapxy[0], lmk_sub->col_row2mapxy[0]);
-	scale3(scale, lmk->col_row2mapxy[1], lmk_sub->col_row2mapxy[1]);
-
-	scale3(1/scale, lmk->mapxy2col_row[0], lmk_sub->mapxy2col_row[0]);
-	scale3(1/scale, lmk->mapxy2col_row[1], lmk_sub->mapxy2col_row[1]);
-
-	lmk_sub->anchor_col = (float)lmk_sub->num_cols/2.0;
-	lmk_sub->anchor_row = (float)lmk_sub->num_rows/2.0  ;
-	lmk_sub->num_pixels = lmk_sub->num_cols*lmk_sub->num_rows;
-
-	double x =  lmk_sub->anchor_col*scale ;
-	double y =   lmk_sub->anchor_row*scale;
-    LMK_Col_Row2World(lmk,  x,  y, lmk_sub->anchor_point);
-    bool success = allocate_lmk_arrays(lmk_sub, lmk_sub->num_cols, lmk_sub->num_rows);
-    if(!success){
-        return false;
-    }
-
-	for(int32_t i = 0, k = 0; i < lmk_sub->num_rows; ++i)
-	{
-		for(int32_t j =0 ; j <  lmk_sub->num_cols; ++j)
-		{
-            double p[3], ele;
-            x = j*scale;
-            y = i*scale;
-			double d = Interpolate_LMK_ELE(lmk ,  x,  y);
-			lmk_sub->ele[k] = (float)d;
-			lmk_sub->srm[k] = (uint8_t)Interpolate_LMK_SRM(lmk, x, y);
-			k++;
-		}
-	}
-    
-    return true;
+    return Resample_LMK_Filtered(lmk, lmk_sub, scale, LMK_RESAMPLE_BILINEAR);
 }
 
 
-bool Crop_IntepolateLMK(const LMK *lmk, LMK *lmk_sub, int32_t left, int32_t top, int32_t ncols, int32_t nrows)
+void Crop_LMK_Header(const LMK *lmk, LMK *lmk_sub, int32_t left, int32_t top, int32_t ncols, int32_t nrows,
+                     double center_ele)
 {
     Copy_LMK_Header(lmk, lmk_sub);
     lmk_sub->num_cols = ncols;
@@ -605,31 +1350,61 @@ bool Crop_IntepolateLMK(const LMK *lmk, LMK *lmk_sub, int32_t left, int32_t top,
     int32_t crop_center_col_in_source = left + lmk_sub->anchor_col;
     int32_t crop_center_row_in_source = top + lmk_sub->anchor_row;
     double crop_center_point[3];
-    LMK_Col_Row2World(lmk, crop_center_col_in_source, crop_center_row_in_source, crop_center_point);
-    double center_ele, anchor_latitude_degrees, anchor_longitude_degrees;
-    ECEF_to_LatLongHeight(crop_center_point, &anchor_latitude_degrees, &anchor_longitude_degrees, &center_ele, lmk->BODY);
-    calculateAnchorRotation(lmk_sub, anchor_latitude_degrees, anchor_longitude_degrees, center_ele);
+    LMK_Col_Row_Elevation2World(lmk, crop_center_col_in_source, crop_center_row_in_source, center_ele, crop_center_point);
+    double anchor_ele, anchor_latitude_degrees, anchor_longitude_degrees;
+    ECEF_to_LatLongHeight(crop_center_point, &anchor_latitude_degrees, &anchor_longitude_degrees, &anchor_ele, lmk->BODY);
+    calculateAnchorRotation(lmk_sub, anchor_latitude_degrees, anchor_longitude_degrees, anchor_ele);
     calculateDerivedValuesVectors(lmk_sub);
+}
+
+
+bool Crop_IntepolateLMK(const LMK *lmk, LMK *lmk_sub, int32_t left, int32_t top, int32_t ncols, int32_t nrows)
+{
+    double center_ele = Interpolate_LMK_ELE(lmk, left + ncols/2, top + nrows/2);
+    Crop_LMK_Header(lmk, lmk_sub, left, top, ncols, nrows, center_ele);
     
     uint8_t success = allocate_lmk_arrays(lmk_sub, lmk_sub->num_cols, lmk_sub->num_rows);
     if(!success){
         return false;
     }
     
-    for(int32_t i = 0, k = 0; i < lmk_sub->num_rows; ++i)
+    // One row of the crop is transformed and interpolated at a time: its pixel coordinates, the source positions and
+    // elevations, the world points on the source surface and their pixel coordinates in the crop
+    double *cols = (double *)malloc(sizeof(double)*10*ncols);
+    if(cols == NULL){
+        printf("Crop_IntepolateLMK() ==>> malloc() failed\n");
+        return false;
+    }
+    double *rows = cols + ncols;
+    double *x = rows + ncols;
+    double *y = x + ncols;
+    double *ele = y + ncols;
+    double *crop_col = ele + ncols;
+    double *crop_row = crop_col + ncols;
+    double (*p)[3] = (double (*)[3])(crop_row + ncols);
+    for(int32_t j = 0; j < ncols; ++j)
+    {
+        cols[j] = (double)j;
+    }
+    for(int32_t i = 0; i < lmk_sub->num_rows; ++i)
     {
-        for(int32_t j =0 ; j <  lmk_sub->num_cols; ++j)
+        for(int32_t j = 0; j < ncols; ++j)
+        {
+            rows[j] = (double)i;
+        }
+        LMK_Col_Row_Elevation2World_Batch(lmk_sub, cols, rows, NULL, ncols, p);
+        World2LMK_Col_Row_Ele_Batch(lmk, (const double (*)[3])p, ncols, x, y, NULL);
+        Interpolate_LMK_ELE_Batch(lmk, x, y, ncols, ele);
+        LMK_Col_Row_Elevation2World_Batch(lmk, x, y, ele, ncols, p);
+        World2LMK_Col_Row_Ele_Batch(lmk_sub, (const double (*)[3])p, ncols, crop_col, crop_row, ele);
+        float *ele_row = &lmk_sub->ele[(size_t)i*ncols];
+        for(int32_t j = 0; j < ncols; ++j)
         {
-            double p[3], x, y, temp_ele, temp_col, temp_row, ele_in_crop;
-            LMK_Col_Row_Elevation2World(lmk_sub,  (double)j,  (double)i, 0.0,   p);
-            World2LMK_Col_Row_Ele(lmk, p, &x, &y, &temp_ele);
-            LMK_Col_Row2World(lmk, x, y, p);
-            World2LMK_Col_Row_Ele(lmk_sub, p, &temp_col, &temp_row, &ele_in_crop);
-            lmk_sub->ele[k] = ele_in_crop;
-            lmk_sub->srm[k] = Interpolate_LMK_SRM(lmk, x, y);
-            k++;
+            ele_row[j] = (float)ele[j];
         }
+        Interpolate_LMK_SRM_Batch(lmk, x, y, ncols, &lmk_sub->srm[(size_t)i*ncols], NULL);
     }
+    free(cols);
     
     return true;
 }
@@ -26,6 +26,7 @@
 #ifndef _LANDMARK_TOOLS_LANDMARK_H_
 #define _LANDMARK_TOOLS_LANDMARK_H_
 
+#include <float.h>                                           // for FLT_EPSILON
 #include <inttypes.h>
 #include <stdbool.h>                                         // for bool
 #include <stdint.h>                                          // for int32_t
@@ -37,6 +38,38 @@
 #define SRM_DEFAULT 100 //pixel value when no known surface reflectance model
 #define LMK_FILENAME_SIZE 256
 #define LMK_ID_SIZE 32
+#define LMK_VERSION_SIZE 32
+#define LMK_VERSION_V3 "#! LVS Map v3.0"
+#define LMK_VERSION_V4 "#! LVS Map v4.0" //tiled format, see landmark_tiled.h
+#define LMK_HEADER_SIZE 196 //bytes preceding the srm block in a landmark file
+#define LMK_LOCAL_FLOAT_ERROR (8.0*FLT_EPSILON) //bound of the float local coordinate error, relative to their extent
+#define LMK_LOCAL_FLOAT_TOLERANCE 0.01 //largest float local coordinate error allowed, in pixels
+#define LMK_LOCAL_BATCH 64 //locations converted at a time by the float local coordinate functions
+
+/**
+ * \brief Reference counted buffer holding the `srm` or `ele` array of one or more landmarks
+ *
+ * Landmarks sharing a buffer read the same pixels. `LMK_Srm_Writable` and `LMK_Ele_Writable` copy a shared array
+ * before it is written, so one landmark never sees the writes of another.
+ */
+typedef struct LMK_Raster LMK_Raster;
+
+/**
+ * \brief Rasters derived from the elevation of a landmark, computed on first use and kept with it
+ */
+typedef enum {
+  LMK_LAYER_NAN_MASK = 0,  //!< `NanMask` of `ele` without window counts, see `lmk_nan_mask_layer`
+  LMK_LAYER_NAN_COUNTS,    //!< `NanMask` of `ele` with window counts
+  LMK_LAYER_WORLD,         //!< World frame point of each pixel, 3 doubles per pixel, see `LMK_World_Layer`
+  LMK_LAYER_SLOPE,         //!< Slope in degrees, one float per pixel, see `LMK_Slope_Layer`
+  LMK_LAYER_HILLSHADE,     //!< Shaded relief, one byte per pixel, see `LMK_Hillshade_Layer`
+  LMK_NUM_LAYERS
+} LMK_LayerKind;
+
+/**
+ * \brief Derived layers of a landmark, keyed by its elevation array and map frame
+ */
+typedef struct LMK_Layers LMK_Layers;
 
 typedef struct {
 
@@ -61,8 +94,27 @@ typedef struct {
   double mapxy2col_row[2][3]; //!< Inverse transform of col_row2mapxy
   double map_normal_vector[3]; //!< Lm frame z-direction expressed in P frame. Equal to last column of worldRmap
   double map_plane_params[4]; //!< The map plane parameters describe the map plane in P frame coordinates
+
+  //Ownership of the arrays
+  LMK_Raster *srm_raster; //!< Buffer holding `srm`, NULL if `srm` was set without `allocate_lmk_arrays`
+  LMK_Raster *ele_raster; //!< Buffer holding `ele`, NULL if `ele` was set without `allocate_lmk_arrays`
+  LMK_Layers *layers;     //!< Derived layers, NULL until the first one is computed
 } LMK;
 
+/**
+ * \brief Read-only view of a memory-mapped landmark file
+ *
+ * `lmk.srm` points directly into the mapping. `lmk.ele` is NULL until `LMK_View_Decode_Ele` is called,
+ * because elevation is stored big-endian on disk. Individual elevation values can be sampled without
+ * decoding the whole array using `LMK_View_Ele`.
+ */
+typedef struct {
+  LMK lmk;               //!< Header, derived fields, and array pointers
+  const uint8_t *map;    //!< Start of the file mapping. NULL if the platform fell back to reading the file
+  size_t map_size;       //!< Size of the mapping in bytes
+  const uint8_t *ele_be; //!< Big endian elevation block
+} LMK_View;
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -79,7 +131,7 @@ extern "C" {
 bool allocate_lmk_arrays(LMK* lmk, int32_t num_cols, int32_t num_rows);
 
 /**
- \brief 
+ \brief Release the arrays of a landmark. Shared arrays are freed with their last landmark
  
  \param[] lmk 
 */
@@ -112,6 +164,62 @@ void calculateDerivedValuesVectors(LMK* lmk);
  */
 bool Copy_LMK(const LMK *from, LMK *to);
 
+/**
+ * \brief Make a copy of a landmark structure that shares the arrays of `from` until one of them is written
+ *
+ * Arrays that `from` does not hold in an `LMK_Raster` are copied.
+ *  \param[in] from original landmark structure
+ *  \param[out] to new copy. Release with `free_lmk`, get writable arrays with `LMK_Srm_Writable` and `LMK_Ele_Writable`
+ *  \return true if success
+ * \return false if memory allocation fails
+ */
+bool Share_LMK(const LMK *from, LMK *to);
+
+/**
+ * \brief The `srm` array of a landmark, copied first if another landmark shares it
+ *
+ * \return the array, or NULL if memory allocation fails
+ */
+uint8_t *LMK_Srm_Writable(LMK *lmk);
+
+/**
+ * \brief The `ele` array of a landmark, copied first if another landmark shares it
+ *
+ * \return the array, or NULL if memory allocation fails
+ */
+float *LMK_Ele_Writable(LMK *lmk);
+
+/**
+ * \brief True if the `srm` or `ele` array of a landmark is shared with another landmark
+ */
+bool LMK_Is_Shared(const LMK *lmk);
+
+/**
+ * \brief A derived layer of a landmark, if it was computed for its current `ele` array and map frame
+ *
+ * Layers are kept until `free_lmk`, `LMK_Ele_Writable` or `LMK_Drop_Layers`. Code writing `ele` in place without
+ * `LMK_Ele_Writable` drops the layers itself. Safe to call from any thread.
+ * \return the layer, or NULL if it was not computed
+ */
+const void *LMK_Layer(const LMK *lmk, LMK_LayerKind kind);
+
+/**
+ * \brief Keep a derived layer with a landmark
+ *
+ * If another thread stored the layer first, `data` is released and the stored layer is returned.
+ * \param[in,out] lmk landmark
+ * \param[in] kind layer
+ * \param[in] data layer computed from the current `ele` and map frame of `lmk`, owned by the landmark from then on
+ * \param[in] release frees `data`
+ * \return the layer held by the landmark, or NULL if memory allocation fails and `data` was released
+ */
+const void *LMK_Set_Layer(LMK *lmk, LMK_LayerKind kind, void *data, void (*release)(void *data));
+
+/**
+ * \brief Release the derived layers of a landmark, after its elevation or map frame changed
+ */
+void LMK_Drop_Layers(LMK *lmk);
+
 /**
  * \brief Copy the header values of a landmark structure
  *  \param[in] from original landmark structure
@@ -128,8 +236,38 @@ void Copy_LMK_Header(const LMK *from, LMK *to);
  */
 bool Write_LMK(const char *filename, const LMK *lmk);
 
+/**
+ * \brief Write the fixed size header block shared by all landmark file versions
+ * \param[in] fp file pointer
+ * \param[in] lmk landmark
+ * \param[in] version_string version comment stored in the first LMK_VERSION_SIZE bytes
+ * \return true on success
+ * \return false on io error
+ */
+bool write_lmk_header(FILE *fp, const LMK *lmk, const char *version_string);
+
+/**
+ * \brief Read and decode the fixed size header block and calculate the derived values
+ * \param[in] fp file pointer positioned at the start of the header block
+ * \param[out] lmk landmark. The pixel arrays are not read
+ * \param[in] print_version if true, print the version comment
+ * \return major version of the file format or 0 on io error
+ */
+int32_t read_lmk_header_fp(FILE *fp, LMK *lmk, bool print_version);
+
+/**
+ * \brief Write the ascii copy of the landmark header to "filename".txt
+ * \param[in] filename cstring containing landmark filename
+ * \param[in] lmk landmark
+ * \return true on success
+ * \return false if fopen cannot open file to write
+ */
+bool write_lmk_ascii_header(const char *filename, const LMK *lmk);
+
 /**
  * \brief Read landmark file into landmark structure
+ *
+ * Supports both the contiguous v3 format and the tiled v4 format.
  * \param[in] filename location of landmark file
  * \param[in] lmk landmark structure
  * \return true on success
@@ -137,6 +275,68 @@ bool Write_LMK(const char *filename, const LMK *lmk);
  */
 bool Read_LMK(const char *filename, LMK *lmk);
 
+/**
+ * \brief Read only the header of a landmark file and calculate the derived values
+ *
+ * The pixel arrays are not read and `lmk->srm` and `lmk->ele` are left unchanged.
+ * \param[in] filename location of landmark file
+ * \param[out] lmk landmark structure
+ * \return true on success
+ * \return false if the file cannot be opened or is shorter than the header
+ */
+bool Read_LMK_Header(const char *filename, LMK *lmk);
+
+/**
+ * \brief Read a region of interest (roi) of a landmark file into a landmark structure
+ *
+ * Only the rows of the roi are read from disk. The result is identical to `Read_LMK` followed by `SubsetLMK`.
+ * \param[in] filename location of landmark file
+ * \param[in] left col index for start of roi
+ * \param[in] top row index for start of roi
+ * \param[in] ncols width of roi
+ * \param[in] nrows height of roi
+ * \param[out] lmk_sub landmark structure containing the roi
+ * \return true on success
+ * \return false if the file cannot be read or the roi is outside of the landmark
+ */
+bool Read_LMK_Window(const char *filename, int32_t left, int32_t top, int32_t ncols, int32_t nrows, LMK *lmk_sub);
+
+/**
+ * \brief Memory-map a landmark file without copying the pixel arrays
+ *
+ * On platforms without mmap this falls back to `Read_LMK`.
+ * \param[in] filename location of landmark file
+ * \param[out] view landmark view. Must be released with `Close_LMK_View`
+ * \return true on success
+ * \return false if the file cannot be opened, mapped, or is truncated
+ */
+bool Open_LMK_View(const char *filename, LMK_View *view);
+
+/**
+ * \brief Unmap a landmark view and free any decoded elevation
+ * \param[in,out] view
+ */
+void Close_LMK_View(LMK_View *view);
+
+/**
+ * \brief Decode the full elevation array of a view into `view->lmk.ele`
+ *
+ * After this call `view->lmk` can be used with any function that takes a `const LMK*`.
+ * \param[in,out] view
+ * \return true on success
+ * \return false if memory allocation fails
+ */
+bool LMK_View_Decode_Ele(LMK_View *view);
+
+/**
+ * \brief Decode a single elevation value directly from the mapping
+ * \param[in] view
+ * \param[in] col column index
+ * \param[in] row row index
+ * \return elevation value or NAN if (col, row) is out of bounds
+ */
+float LMK_View_Ele(const LMK_View *view, int32_t col, int32_t row);
+
 /**
  \brief Given landmark column, row; and elevation calculate the corresponding position in the world frame
  
@@ -150,6 +350,94 @@ bool Read_LMK(const char *filename, LMK *lmk);
 void LMK_Col_Row_Elevation2World(const LMK *lmk, double x, double y, double ele,
                                     double p[3]);
 
+/**
+ \brief `LMK_Col_Row_Elevation2World` of `n` pixel locations, such as a row of the landmark
+ 
+ \param[in] lmk
+ \param[in] col `n` column coordinates
+ \param[in] row `n` row coordinates
+ \param[in] ele `n` elevations, or NULL for zero elevation
+ \param[in] n number of locations
+ \param[out] p `n` world positions
+ */
+void LMK_Col_Row_Elevation2World_Batch(const LMK *lmk, const double *col, const double *row, const double *ele,
+                                       size_t n, double (*p)[3]);
+
+/**
+ \brief Largest distance of a pixel of the landmark from its anchor point in the map plane, in meters
+ */
+double LMK_Local_Extent(const LMK *lmk);
+
+/**
+ \brief True if float local coordinates of the landmark are within `LMK_LOCAL_FLOAT_TOLERANCE` pixels
+ 
+ Local coordinates are map frame coordinates relative to the anchor point, so their magnitude is the size of the
+ landmark rather than the ~10^6 m of the world frame. Computed in float, x and y are within `LMK_LOCAL_FLOAT_ERROR`
+ times `LMK_Local_Extent` of the double values, and z within the same fraction of the elevation, which is stored in
+ float already. The landmark fits if that is `LMK_LOCAL_FLOAT_TOLERANCE` pixels or less, up to about 7000 x 7000
+ pixels anchored at the center.
+ */
+bool LMK_Local_Float_Fits(const LMK *lmk);
+
+/**
+ \brief Map frame coordinates relative to the anchor point of `n` pixel locations, in float
+ 
+ The arithmetic of `LMK_Col_Row_Elevation2World` before the rotation to the world frame, over separate x, y and z
+ arrays so that the loop runs on 8 float lanes. Check `LMK_Local_Float_Fits` for the precision.
+ \param[in] lmk
+ \param[in] col `n` column coordinates
+ \param[in] row `n` row coordinates
+ \param[in] ele `n` elevations, or NULL for zero elevation
+ \param[in] n number of locations
+ \param[out] x `n` map x coordinates
+ \param[out] y `n` map y coordinates
+ \param[out] z `n` map z coordinates
+ */
+void LMK_Col_Row_Elevation2Local_Batch(const LMK *lmk, const float *col, const float *row, const float *ele,
+                                       size_t n, float *x, float *y, float *z);
+
+/**
+ \brief World positions of `n` local coordinates of `LMK_Col_Row_Elevation2Local_Batch`, promoted to double
+ */
+void LMK_Local2World_Batch(const LMK *lmk, const float *x, const float *y, const float *z, size_t n,
+                           double (*p)[3]);
+
+/**
+ \brief Transform between the local coordinates of two landmarks, for the deltas of matched features
+ */
+typedef struct {
+  const LMK *child;
+  const LMK *base;
+  float childRbase[3][3];  //!< Rotation from the base map frame to the child map frame
+  float base_offset[3];    //!< Base anchor point relative to the child anchor point, in the child map frame
+} LMK_LocalPair;
+
+/**
+ \brief Set up the float deltas between matched points of two landmarks
+ 
+ \param[out] pair transform
+ \param[in] child landmark whose map frame holds the deltas
+ \param[in] base other landmark
+ \return false if float local coordinates are not precise enough for the pair, see `LMK_Local_Float_Fits`. The
+ rotated base coordinates and the offset between the anchors count in the extent, so two landmarks of up to about
+ 4500 x 4500 pixels anchored at their centers fit
+ */
+bool LMK_Local_Pair_Init(LMK_LocalPair *pair, const LMK *child, const LMK *base);
+
+/**
+ \brief Deltas between matched points in the child map frame, as `LMK_Col_Row2World` of both points would give
+ 
+ The elevations are interpolated as in `LMK_Col_Row2World` and the rest is done in float.
+ \param[in] pair transform of `LMK_Local_Pair_Init`
+ \param[in] child_points `n` x, y pairs of child pixel locations
+ \param[in] base_points `n` x, y pairs of base pixel locations
+ \param[in] n number of matches
+ \param[out] delta `n` child minus base positions in the child map frame
+ \param[out] valid `n` flags, false where either point has no elevation
+ */
+void LMK_Local_Pair_Delta_Batch(const LMK_LocalPair *pair, const double *child_points, const double *base_points,
+                                size_t n, double (*delta)[3], bool *valid);
+
 /**
  \brief Given landmark column and row; interpolate the elevation calculate the corresponding position in the world frame
  
@@ -187,6 +475,30 @@ double Interpolate_LMK_ELE(const LMK *lmk, double x, double y);
  */
 double Interpolate_LMK_SRM(const LMK *lmk, double x, double y);
 
+/**
+ \brief `Interpolate_LMK_ELE` of `n` pixel locations, with `inter_float_matrix_batch`
+ 
+ \param[in] lmk
+ \param[in] col `n` column coordinates
+ \param[in] row `n` row coordinates
+ \param[in] n number of locations
+ \param[out] ele `n` elevation values
+ */
+void Interpolate_LMK_ELE_Batch(const LMK *lmk, const double *col, const double *row, size_t n, double *ele);
+
+/**
+ \brief `Interpolate_LMK_SRM` of `n` pixel locations, with `inter_uint8_matrix_batch`
+ 
+ \param[in] lmk
+ \param[in] col `n` column coordinates
+ \param[in] row `n` row coordinates
+ \param[in] n number of locations
+ \param[out] srm `n` surface reflectance values
+ \param[out] valid `n` flags, false where the location is out of bounds and `srm` is 0, or NULL
+ */
+void Interpolate_LMK_SRM_Batch(const LMK *lmk, const double *col, const double *row, size_t n, uint8_t *srm,
+                               bool *valid);
+
 /**
  \brief Give a 3d point in world frame to caculate the col, row and altitude in landmark frame
  
@@ -201,6 +513,19 @@ double Interpolate_LMK_SRM(const LMK *lmk, double x, double y);
 void World2LMK_Col_Row_Ele(const LMK *lmk, double p[3], double *x, double *y,
                               double *ele);
 
+/**
+ \brief `World2LMK_Col_Row_Ele` of `n` points
+ 
+ \param[in] lmk
+ \param[in] p `n` points in world coordinates
+ \param[in] n number of points
+ \param[out] col `n` column coordinates in landmark frame
+ \param[out] row `n` row coordinates in landmark frame
+ \param[out] ele `n` elevations in landmark frame, or NULL
+ */
+void World2LMK_Col_Row_Ele_Batch(const LMK *lmk, const double (*p)[3], size_t n, double *col, double *row,
+                                 double *ele);
+
 /**
  \brief Find the intersection between a ray in the world frame and the landmark tangent plane
  
@@ -224,7 +549,7 @@ bool Intersect_LMK_map_plane_params_World(const LMK *lmk, double c[3],
  For low elevation angles, it might overlook occluding terrain between the camera and the map plane that is too far from the first estimate.
  If you want to find the intersection for low elevation angles (`<10` degrees)>, use `Intersect_LMK_ELE_low_slant_angle`
  
- TODO implement a standard algorithim for ray-tracing height-fields
+ For exact ray-tracing of the height-field at any slant angle, use `Intersect_LMK_ELE_Pyramid` in `lmk_height_pyramid.h`
  \param[in] lmk
  \param[in] c 3d ray endpoint in world frame
  \param[in] ray ray vector in world frame
@@ -242,7 +567,7 @@ bool Intersect_LMK_ELE(const LMK *lmk, double c[3], double ray[3],
  This is a forward projection algorithm which iterates along the ray in small steps until an intersection is found.
  To limit the search range, [`mine`, `maxe`] define maximum and minimum bounds on the elevation, and `max_range` defines a maximum distance to traverse between `mine` and `maxe`
  
- This code is slow. Avoid using it unless it is necessary
+ This code is slow. Avoid using it unless it is necessary. `Intersect_LMK_ELE_Pyramid` finds the exact intersection much faster
  
  \param[in] lmk
  \param[in] c 3d ray endpoint in world frame
@@ -264,6 +589,8 @@ bool Intersect_LMK_ELE_low_slant_angle(const LMK *lmk, double c[3], double ray[3
  * This function moves the anchor point of the landmark to the center of the region of interest, but keeps the same normal vector and elevation values
  * As a result, the anchor point will not have a zero value in the `lmk_sub.ele` array.
  *
+ * A roi of whole rows shares the arrays of `lmk` rather than copying them, as `Share_LMK` does.
+ *
  * \param[in] lmk
  * \param[out] lmk_sub
  * \param[in] left col index for start of roi
@@ -276,9 +603,24 @@ bool Intersect_LMK_ELE_low_slant_angle(const LMK *lmk, double c[3], double ray[3
 bool SubsetLMK(const LMK *lmk, LMK *lmk_sub, int32_t left, int32_t top,
                   int32_t ncols, int32_t nrows);
 
+/**
+ * \brief Header of a landmark subset with `SubsetLMK`, without its pixel arrays
+ *
+ * \param[in] lmk input landmark header
+ * \param[out] lmk_sub header of the roi
+ * \param[in] left col index for start of roi
+ * \param[in] top row index for start of roi
+ * \param[in] ncols width of roi
+ * \param[in] nrows height of roi
+ */
+void Subset_LMK_Header(const LMK *lmk, LMK *lmk_sub, int32_t left, int32_t top, int32_t ncols, int32_t nrows);
+
 /**
  * \brief Resample the landmark struct such that the new resolution is `scale*old_resolution`
  *
+ * Interpolates bilinearly. `Resample_LMK_Filtered` also averages the footprint of each output pixel or applies a
+ * Lanczos filter.
+ *
  * \param[in] lmk input landmark
  * \param[out] lmk_sub rescaled landmark
  * \param[in] scale
@@ -301,6 +643,20 @@ bool ResampleLMK(const LMK *lmk_from, LMK *lmk_to, double scale);
 bool Crop_IntepolateLMK(const LMK *lmk, LMK *lmk_sub, int32_t left, int32_t top,
                         int32_t ncols, int32_t nrows);
 
+/**
+ * \brief Header of a landmark cropped with `Crop_IntepolateLMK`, without its pixel arrays
+ *
+ * \param[in] lmk input landmark header
+ * \param[out] lmk_sub cropped landmark header
+ * \param[in] left col index for start of roi
+ * \param[in] top row index for start of roi
+ * \param[in] ncols width of roi
+ * \param[in] nrows height of roi
+ * \param[in] center_ele elevation of `lmk` at pixel (left + ncols/2, top + nrows/2)
+ */
+void Crop_LMK_Header(const LMK *lmk, LMK *lmk_sub, int32_t left, int32_t top, int32_t ncols, int32_t nrows,
+                     double center_ele);
+
 /**
  * \brief Rescale the resolution of a landmark struct
  *
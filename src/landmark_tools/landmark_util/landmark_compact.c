@@ -0,0 +1,263 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>                   // for NAN, isnan, lround
+#include <stdio.h>                  // for fopen, fread, fclose
+#include <stdlib.h>                 // for malloc, free
+#include <string.h>                 // for memcpy, strncmp
+
+#include "landmark_tools/landmark_util/landmark_compact.h"
+#include "landmark_tools/landmark_util/landmark_tiled.h"
+#include "landmark_tools/data_interpolation/interpolate_data.h"
+#include "landmark_tools/utils/endian_read_write.h"
+#include "landmark_tools/utils/safe_string.h"
+
+#define COMPACT_BAND_ROWS 256 //rows converted at a time when the file is not stored in the requested encoding
+
+size_t lmk_ele_encoding_width(enum LMK_Ele_Encoding encoding){
+    return encoding == LMK_ELE_FLOAT32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+void set_lmk_ele_int16_range(LMK_Compact_Ele *ele, double min_ele, double max_ele){
+    if(!(min_ele <= max_ele)){
+        // No valid elevation
+        min_ele = 0.0;
+        max_ele = 0.0;
+    }
+    ele->offset = 0.5*(min_ele + max_ele);
+    ele->scale = (max_ele - min_ele)/(2.0*LMK_ELE_INT16_MAX_CODE);
+    if(ele->scale <= 0.0) ele->scale = 1.0;
+}
+
+void encode_lmk_ele_values(const LMK_Compact_Ele *ele, const float *src, void *dst, int64_t n){
+    if(ele->encoding == LMK_ELE_FLOAT32){
+        memcpy(dst, src, n*sizeof(float));
+    }else if(ele->encoding == LMK_ELE_FLOAT16){
+        uint16_t *half = (uint16_t *)dst;
+        for(int64_t i = 0; i < n; i++){
+            half[i] = float_to_half(src[i]);
+        }
+    }else{
+        int16_t *codes = (int16_t *)dst;
+        double inv_scale = 1.0/ele->scale;
+        for(int64_t i = 0; i < n; i++){
+            if(isnan(src[i])){
+                codes[i] = LMK_ELE_INT16_NAN;
+                continue;
+            }
+            long code = lround((src[i] - ele->offset)*inv_scale);
+            if(code > LMK_ELE_INT16_MAX_CODE) code = LMK_ELE_INT16_MAX_CODE;
+            if(code < -LMK_ELE_INT16_MAX_CODE) code = -LMK_ELE_INT16_MAX_CODE;
+            codes[i] = (int16_t)code;
+        }
+    }
+}
+
+void decode_lmk_ele_values(const LMK_Compact_Ele *ele, const void *src, float *dst, int64_t n){
+    if(ele->encoding == LMK_ELE_FLOAT32){
+        memcpy(dst, src, n*sizeof(float));
+    }else if(ele->encoding == LMK_ELE_FLOAT16){
+        const uint16_t *half = (const uint16_t *)src;
+        for(int64_t i = 0; i < n; i++){
+            dst[i] = half_to_float(half[i]);
+        }
+    }else{
+        const int16_t *codes = (const int16_t *)src;
+        for(int64_t i = 0; i < n; i++){
+            dst[i] = codes[i] == LMK_ELE_INT16_NAN ? NAN : (float)(ele->offset + ele->scale*codes[i]);
+        }
+    }
+}
+
+static void ele_range(const float *ele, int64_t n, double *min_ele, double *max_ele){
+    for(int64_t i = 0; i < n; i++){
+        if(ele[i] < *min_ele) *min_ele = ele[i];
+        if(ele[i] > *max_ele) *max_ele = ele[i];
+    }
+}
+
+static bool allocate_compact_ele(LMK_Compact_Ele *ele, enum LMK_Ele_Encoding encoding, int32_t num_cols, int32_t num_rows){
+    ele->encoding = encoding;
+    ele->num_cols = num_cols;
+    ele->num_rows = num_rows;
+    ele->data = malloc((size_t)num_cols*num_rows*lmk_ele_encoding_width(encoding));
+    if(ele->data == NULL){
+        SAFE_PRINTF(512, "allocate_compact_ele() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        return false;
+    }
+    return true;
+}
+
+bool Encode_LMK_Ele(const LMK *lmk, enum LMK_Ele_Encoding encoding, LMK_Compact_Ele *ele){
+    if(encoding == LMK_Ele_Encoding_UNDEFINED) return false;
+    if(!allocate_compact_ele(ele, encoding, lmk->num_cols, lmk->num_rows)) return false;
+
+    if(encoding == LMK_ELE_INT16){
+        double min_ele = INFINITY, max_ele = -INFINITY;
+        ele_range(lmk->ele, lmk->num_pixels, &min_ele, &max_ele);
+        set_lmk_ele_int16_range(ele, min_ele, max_ele);
+    }
+    encode_lmk_ele_values(ele, lmk->ele, ele->data, lmk->num_pixels);
+    return true;
+}
+
+/**
+ \brief Encoding of the elevation stored in a landmark file
+ \param[out] tiled true if the file is in the tiled v4 format
+ \return false on io error
+*/
+static bool stored_encoding(FILE *fp, bool *tiled, enum LMK_Ele_Encoding *encoding){
+    char version[LMK_VERSION_SIZE];
+    if(!seek_file_offset(fp, 0) || fread(version, 1, LMK_VERSION_SIZE, fp) != LMK_VERSION_SIZE) return false;
+
+    *tiled = strncmp(version, LMK_VERSION_V4, LMK_VERSION_SIZE) == 0;
+    *encoding = LMK_ELE_FLOAT32;
+    if(*tiled){
+        // Flags are the second of the tile parameters following the header block
+        uint32_t params[2];
+        if(!seek_file_offset(fp, LMK_HEADER_SIZE) || read_big_endian_array(params, 32, false, 2, fp) != 2) return false;
+        if(params[1] & LMK_TILED_ELE_INT16){
+            *encoding = LMK_ELE_INT16;
+        }else if(params[1] & LMK_TILED_ELE_FLOAT16){
+            *encoding = LMK_ELE_FLOAT16;
+        }
+    }
+    return true;
+}
+
+/**
+ \brief Read full width rows of a landmark file as float elevation
+ \param[out] srm nrows*num_cols surface reflectance values
+ \param[out] ele nrows*num_cols elevation values
+*/
+static bool read_band(FILE *fp, const LMK *lmk, bool tiled, int32_t top, int32_t nrows, uint8_t *srm, float *ele){
+    if(tiled){
+        return seek_file_offset(fp, LMK_HEADER_SIZE) &&
+               read_lmk_tiled_region(fp, lmk, 0, top, lmk->num_cols, nrows, srm, ele);
+    }
+    int64_t first = (int64_t)top*lmk->num_cols;
+    int64_t count = (int64_t)nrows*lmk->num_cols;
+    return seek_file_offset(fp, LMK_HEADER_SIZE + first) &&
+           fread(srm, sizeof(uint8_t), count, fp) == (size_t)count &&
+           seek_file_offset(fp, LMK_HEADER_SIZE + lmk->num_pixels + first*(int64_t)sizeof(float)) &&
+           read_big_endian_array(ele, 32, true, count, fp) == count;
+}
+
+bool Read_LMK_Compact(const char *filename, enum LMK_Ele_Encoding encoding, LMK *lmk, LMK_Compact_Ele *ele){
+    ele->data = NULL;
+    if(encoding == LMK_Ele_Encoding_UNDEFINED) return false;
+    if(!Read_LMK_Header(filename, lmk)) return false;
+
+    FILE *fp = fopen(filename, "rb");
+    if(fp == NULL){
+        SAFE_PRINTF(512, "Read_LMK_Compact() ==>> cannot open file %s to read\n", filename);
+        return false;
+    }
+
+    bool tiled = false;
+    enum LMK_Ele_Encoding stored = LMK_ELE_FLOAT32;
+    lmk->ele = NULL;
+    lmk->srm = (uint8_t *)malloc(lmk->num_pixels*sizeof(uint8_t));
+    bool success = lmk->srm != NULL && stored_encoding(fp, &tiled, &stored);
+
+    if(success && tiled && stored == encoding){
+        // Copy the tiles without conversion
+        success = seek_file_offset(fp, LMK_HEADER_SIZE) &&
+                  read_lmk_tiled_region_compact(fp, lmk, 0, 0, lmk->num_cols, lmk->num_rows, lmk->srm, ele);
+        fclose(fp);
+        if(!success) free_lmk(lmk);
+        return success;
+    }
+
+    // Convert in bands so that the full precision map is never in memory. The int16 range needs an extra pass.
+    int32_t band_rows = COMPACT_BAND_ROWS < lmk->num_rows ? COMPACT_BAND_ROWS : lmk->num_rows;
+    float *band = (float *)malloc((size_t)band_rows*lmk->num_cols*sizeof(float));
+    success = success && band != NULL && allocate_compact_ele(ele, encoding, lmk->num_cols, lmk->num_rows);
+
+    int32_t first_pass = encoding == LMK_ELE_INT16 ? 0 : 1;
+    double min_ele = INFINITY, max_ele = -INFINITY;
+    for(int32_t pass = first_pass; pass < 2 && success; pass++){
+        if(pass == 1 && encoding == LMK_ELE_INT16){
+            set_lmk_ele_int16_range(ele, min_ele, max_ele);
+        }
+        for(int32_t top = 0; top < lmk->num_rows && success; top += band_rows){
+            int32_t nrows = (top + band_rows > lmk->num_rows) ? lmk->num_rows - top : band_rows;
+            int64_t first = (int64_t)top*lmk->num_cols;
+            int64_t count = (int64_t)nrows*lmk->num_cols;
+            success &= read_band(fp, lmk, tiled, top, nrows, &lmk->srm[first], band);
+            if(!success) break;
+
+            if(pass == 0){
+                ele_range(band, count, &min_ele, &max_ele);
+            }else{
+                encode_lmk_ele_values(ele, band, (uint8_t *)ele->data + first*lmk_ele_encoding_width(encoding), count);
+            }
+        }
+    }
+    fclose(fp);
+    free(band);
+
+    if(!success){
+        SAFE_PRINTF(512, "Read_LMK_Compact() ==>> failed to read %s\n", filename);
+        free_lmk_compact_ele(ele);
+        free_lmk(lmk);
+    }
+    return success;
+}
+
+void free_lmk_compact_ele(LMK_Compact_Ele *ele){
+    if(ele->data != NULL){
+        free(ele->data);
+        ele->data = NULL;
+    }
+}
+
+float LMK_Compact_Ele_Value(const LMK_Compact_Ele *ele, int32_t col, int32_t row){
+    if(col < 0 || row < 0 || col >= ele->num_cols || row >= ele->num_rows){
+        return NAN;
+    }
+    float value;
+    decode_lmk_ele_values(ele, (const uint8_t *)ele->data + ((int64_t)row*ele->num_cols + col)*lmk_ele_encoding_width(ele->encoding),
+                          &value, 1);
+    return value;
+}
+
+double Interpolate_LMK_Compact_ELE(const LMK_Compact_Ele *ele, double col, double row){
+    if(ele->encoding == LMK_ELE_FLOAT16){
+        return inter_half_matrix((const uint16_t *)ele->data, ele->num_cols, ele->num_rows, col, row);
+    }else if(ele->encoding == LMK_ELE_INT16){
+        return inter_scaled_short_matrix((const int16_t *)ele->data, ele->num_cols, ele->num_rows,
+                                         ele->offset, ele->scale, col, row);
+    }
+    return inter_float_matrix((float *)ele->data, ele->num_cols, ele->num_rows, col, row);
+}
+
+enum LMK_Ele_Encoding strToLMKEleEncoding(const char *str){
+    enum LMK_Ele_Encoding encoding = LMK_ELE_FLOAT32;
+    if(str != NULL){
+        if(strncmp(str, "FLOAT32", strlen(str))==0){
+            encoding = LMK_ELE_FLOAT32;
+        }else if(strncmp(str, "FLOAT16", strlen(str))==0){
+            encoding = LMK_ELE_FLOAT16;
+        }else if(strncmp(str, "INT16", strlen(str))==0){
+            encoding = LMK_ELE_INT16;
+        }else{
+            printf("Value of str must be \"FLOAT32\", \"FLOAT16\", or \"INT16\"");
+            encoding = LMK_Ele_Encoding_UNDEFINED;
+        }
+    }
+    return encoding;
+}
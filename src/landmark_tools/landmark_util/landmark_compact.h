@@ -0,0 +1,153 @@
+/**
+ * \file `landmark_compact.h`
+ * \brief Compact 16-bit encodings of the landmark elevation map
+ *
+ * A landmark elevation map can be held in memory, and stored in the tiled v4 format, as IEEE half precision
+ * floats or as scaled int16 codes, `ele = offset + scale*code`, with the code `LMK_ELE_INT16_NAN` reserved for NAN.
+ * Both halve the size of the elevation map. Half precision keeps about 3 significant digits, so it is only
+ * suitable for elevations relative to a nearby reference. The scaled int16 encoding spreads 65534 steps
+ * over the elevation range of the map, which is millimeter precision for a map with 60 m of relief.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LANDMARK_COMPACT_H_
+#define _LANDMARK_TOOLS_LANDMARK_COMPACT_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stddef.h>                                          // for size_t
+#include <stdint.h>                                          // for int32_t
+
+#include "landmark_tools/data_interpolation/interpolate_data.h"  // for SCALED_SHORT_NAN
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK
+
+#define LMK_ELE_INT16_NAN SCALED_SHORT_NAN
+#define LMK_ELE_INT16_MAX_CODE 32767
+
+enum LMK_Ele_Encoding {
+    LMK_ELE_FLOAT32 = 0,
+    LMK_ELE_FLOAT16 = 1,
+    LMK_ELE_INT16 = 2,
+    LMK_Ele_Encoding_UNDEFINED
+};
+
+typedef struct {
+  enum LMK_Ele_Encoding encoding;
+  double offset;     //!< elevation of code 0, LMK_ELE_INT16 only
+  double scale;      //!< elevation step between codes, LMK_ELE_INT16 only
+  int32_t num_cols;  //!< width of elevation map
+  int32_t num_rows;  //!< height of elevation map
+  void *data;        //!< float, uint16_t half precision, or int16_t codes depending on `encoding`
+} LMK_Compact_Ele;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Bytes used by one elevation value
+ * \param[in] encoding
+ * \return 4 for LMK_ELE_FLOAT32, 2 otherwise
+ */
+size_t lmk_ele_encoding_width(enum LMK_Ele_Encoding encoding);
+
+/**
+ * \brief Choose the offset and scale of the int16 encoding so that codes cover [min_ele, max_ele]
+ * \param[in,out] ele encoding parameters
+ * \param[in] min_ele minimum elevation
+ * \param[in] max_ele maximum elevation
+ */
+void set_lmk_ele_int16_range(LMK_Compact_Ele *ele, double min_ele, double max_ele);
+
+/**
+ * \brief Encode `n` elevation values with the encoding and scale of `ele`
+ * \param[in] ele encoding parameters. `ele->data` is not used
+ * \param[in] src float elevation values
+ * \param[out] dst n encoded values
+ * \param[in] n number of values
+ */
+void encode_lmk_ele_values(const LMK_Compact_Ele *ele, const float *src, void *dst, int64_t n);
+
+/**
+ * \brief Decode `n` elevation values with the encoding and scale of `ele`
+ * \param[in] ele encoding parameters. `ele->data` is not used
+ * \param[in] src n encoded values
+ * \param[out] dst float elevation values
+ * \param[in] n number of values
+ */
+void decode_lmk_ele_values(const LMK_Compact_Ele *ele, const void *src, float *dst, int64_t n);
+
+/**
+ * \brief Encode the elevation map of a landmark
+ *
+ * For LMK_ELE_INT16 the offset and scale are chosen from the elevation range of the map.
+ * \param[in] lmk landmark
+ * \param[in] encoding
+ * \param[out] ele must be released with `free_lmk_compact_ele`
+ * \return true on success
+ * \return false if memory allocation fails
+ */
+bool Encode_LMK_Ele(const LMK *lmk, enum LMK_Ele_Encoding encoding, LMK_Compact_Ele *ele);
+
+/**
+ * \brief Read a landmark file with a compact elevation map
+ *
+ * The full precision elevation map is never held in memory. If the file is a v4 file stored with `encoding`,
+ * the tiles are copied without conversion. Otherwise the file is converted in bands of rows.
+ * \param[in] filename location of landmark file
+ * \param[in] encoding encoding of the elevation map in memory
+ * \param[out] lmk header and surface reflectance map. `lmk->ele` is NULL
+ * \param[out] ele elevation map. Must be released with `free_lmk_compact_ele`
+ * \return true on success
+ * \return false on io error or if memory allocation fails
+ */
+bool Read_LMK_Compact(const char *filename, enum LMK_Ele_Encoding encoding, LMK *lmk, LMK_Compact_Ele *ele);
+
+/**
+ * \brief Free the elevation map of a compact elevation structure
+ * \param[in,out] ele
+ */
+void free_lmk_compact_ele(LMK_Compact_Ele *ele);
+
+/**
+ * \brief Elevation at a pixel of a compact elevation map
+ * \param[in] ele
+ * \param[in] col
+ * \param[in] row
+ * \return elevation in meters, NAN if out of bounds
+ */
+float LMK_Compact_Ele_Value(const LMK_Compact_Ele *ele, int32_t col, int32_t row);
+
+/**
+ * \brief Same as `Interpolate_LMK_ELE` for a compact elevation map
+ * \param[in] ele
+ * \param[in] col
+ * \param[in] row
+ * \return interpolated elevation, NAN if out of bounds or next to a NAN value
+ */
+double Interpolate_LMK_Compact_ELE(const LMK_Compact_Ele *ele, double col, double row);
+
+/**
+ * \brief Convert string to LMK_Ele_Encoding enum
+ * \param[in] str FLOAT32, FLOAT16, or INT16
+ * \return LMK_Ele_Encoding or LMK_Ele_Encoding_UNDEFINED
+ */
+enum LMK_Ele_Encoding strToLMKEleEncoding(const char *str);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _LANDMARK_TOOLS_LANDMARK_COMPACT_H_
@@ -0,0 +1,416 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>                   // for INFINITY
+#include <stdio.h>                  // for fread, fwrite, fclose
+#include <stdlib.h>                 // for malloc, free
+#include <string.h>                 // for memcpy, strncmp
+
+#include <zlib.h>                   // for compress2, uncompress, compressBound
+
+#include "landmark_tools/landmark_util/landmark_tiled.h"
+#include "landmark_tools/landmark_util/lmk_overview.h"
+#include "landmark_tools/utils/endian_read_write.h"
+#include "landmark_tools/utils/safe_string.h"
+
+#define TILE_PARAMS_SIZE 16     //bytes of tile size, flags, compression, num tiles
+#define TILE_CODEC_SIZE 16      //bytes of int16 elevation offset and scale
+#define TILE_INDEX_ENTRY_SIZE 16 //bytes of offset, srm bytes, ele bytes
+
+typedef struct {
+    int32_t tile_size;
+    uint32_t flags;
+    enum LMK_Compression compression;
+    LMK_Compact_Ele codec; //!< elevation encoding, `data` is not used
+    int32_t tile_cols;
+    int32_t tile_rows;
+    uint64_t *offsets;
+    uint32_t *srm_bytes;
+    uint32_t *ele_bytes;
+} TileIndex;
+
+static bool host_is_little_endian(void){
+    uint16_t one = 1;
+    return *(uint8_t *)&one == 1;
+}
+
+static uint32_t encoding_flags(enum LMK_Ele_Encoding encoding){
+    if(encoding == LMK_ELE_FLOAT16) return LMK_TILED_ELE_FLOAT16;
+    if(encoding == LMK_ELE_INT16) return LMK_TILED_ELE_INT16;
+    return 0;
+}
+
+static enum LMK_Ele_Encoding flags_encoding(uint32_t flags){
+    if(flags & LMK_TILED_ELE_INT16) return LMK_ELE_INT16;
+    if(flags & LMK_TILED_ELE_FLOAT16) return LMK_ELE_FLOAT16;
+    return LMK_ELE_FLOAT32;
+}
+
+static void free_tile_index(TileIndex *index){
+    free(index->offsets);
+    free(index->srm_bytes);
+    free(index->ele_bytes);
+}
+
+static bool allocate_tile_index(TileIndex *index, int32_t num_tiles){
+    index->offsets = (uint64_t *)calloc(num_tiles, sizeof(uint64_t));
+    index->srm_bytes = (uint32_t *)calloc(num_tiles, sizeof(uint32_t));
+    index->ele_bytes = (uint32_t *)calloc(num_tiles, sizeof(uint32_t));
+    if(index->offsets == NULL || index->srm_bytes == NULL || index->ele_bytes == NULL){
+        SAFE_PRINTF(512, "allocate_tile_index() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        free_tile_index(index);
+        return false;
+    }
+    return true;
+}
+
+/**
+ \brief Split `n` values of `width` bytes into byte planes (or merge them back when `inverse` is true)
+*/
+static void shuffle_bytes(const uint8_t *src, uint8_t *dst, int64_t n, int32_t width, bool inverse){
+    for(int64_t i = 0; i < n; i++){
+        for(int32_t b = 0; b < width; b++){
+            if(inverse){
+                dst[i*width + b] = src[b*n + i];
+            }else{
+                dst[b*n + i] = src[i*width + b];
+            }
+        }
+    }
+}
+
+/**
+ \brief Compress `raw` into `out` if that makes it smaller, otherwise copy it
+ \return number of bytes stored in `out`
+*/
+static uint32_t encode_block(const uint8_t *raw, uint32_t raw_size, uint8_t *out, uLongf out_capacity,
+                             enum LMK_Compression compression){
+    if(compression == LMK_COMPRESSION_DEFLATE){
+        uLongf out_size = out_capacity;
+        if(compress2(out, &out_size, raw, raw_size, Z_DEFAULT_COMPRESSION) == Z_OK && out_size < raw_size){
+            return (uint32_t)out_size;
+        }
+    }
+    memcpy(out, raw, raw_size);
+    return raw_size;
+}
+
+static bool decode_block(const uint8_t *stored, uint32_t stored_size, uint8_t *raw, uint32_t raw_size){
+    if(stored_size == raw_size){
+        memcpy(raw, stored, raw_size);
+        return true;
+    }
+    uLongf out_size = raw_size;
+    return uncompress(raw, &out_size, stored, stored_size) == Z_OK && out_size == raw_size;
+}
+
+static void tile_extent(const LMK *lmk, const TileIndex *index, int32_t tile_col, int32_t tile_row,
+                        int32_t *x0, int32_t *y0, int32_t *w, int32_t *h){
+    *x0 = tile_col*index->tile_size;
+    *y0 = tile_row*index->tile_size;
+    *w = (*x0 + index->tile_size > lmk->num_cols) ? lmk->num_cols - *x0 : index->tile_size;
+    *h = (*y0 + index->tile_size > lmk->num_rows) ? lmk->num_rows - *y0 : index->tile_size;
+}
+
+static bool write_tile_index(FILE *fp, const TileIndex *index, int32_t num_tiles){
+    for(int32_t i = 0; i < num_tiles; i++){
+        if(write_big_endian_array(&index->offsets[i], 64, false, 1, fp) != 1) return false;
+        if(write_big_endian_array(&index->srm_bytes[i], 32, false, 1, fp) != 1) return false;
+        if(write_big_endian_array(&index->ele_bytes[i], 32, false, 1, fp) != 1) return false;
+    }
+    return true;
+}
+
+bool Write_LMK_Tiled(const char *filename, const LMK *lmk, int32_t tile_size,
+                     enum LMK_Compression compression, enum LMK_Ele_Encoding ele_encoding, bool little_endian)
+{
+    if(tile_size <= 0 || compression == LMK_Compression_UNDEFINED || ele_encoding == LMK_Ele_Encoding_UNDEFINED){
+        SAFE_PRINTF(512, "Write_LMK_Tiled() ==>> invalid tile size %d, compression, or elevation encoding\n", tile_size);
+        return false;
+    }
+
+    if(!Remove_LMK_Overviews(filename)) return false;
+
+    FILE *fp;
+    fp = fopen(filename, "wb");
+    if(fp == NULL)
+    {
+        SAFE_PRINTF(512, "Write_LMK_Tiled() ==>> cannot open file %s to write\n", filename);
+        return false;
+    }
+
+    TileIndex index = {0};
+    index.tile_size = tile_size;
+    index.flags = (little_endian ? LMK_TILED_LITTLE_ENDIAN : 0) | encoding_flags(ele_encoding);
+    index.compression = compression;
+    index.codec.encoding = ele_encoding;
+    if(ele_encoding == LMK_ELE_INT16){
+        double min_ele = INFINITY, max_ele = -INFINITY;
+        for(int64_t i = 0; i < lmk->num_pixels; i++){
+            if(lmk->ele[i] < min_ele) min_ele = lmk->ele[i];
+            if(lmk->ele[i] > max_ele) max_ele = lmk->ele[i];
+        }
+        set_lmk_ele_int16_range(&index.codec, min_ele, max_ele);
+    }
+    int32_t ele_width = (int32_t)lmk_ele_encoding_width(ele_encoding);
+    index.tile_cols = (lmk->num_cols + tile_size - 1)/tile_size;
+    index.tile_rows = (lmk->num_rows + tile_size - 1)/tile_size;
+    int32_t num_tiles = index.tile_cols*index.tile_rows;
+
+    size_t tile_pixels = (size_t)tile_size*tile_size;
+    uLongf capacity = compressBound((uLong)(tile_pixels*sizeof(float)));
+    uint8_t *raw = (uint8_t *)malloc(tile_pixels*sizeof(float));
+    uint8_t *codes = (uint8_t *)malloc(tile_pixels*sizeof(float));
+    uint8_t *shuffled = (uint8_t *)malloc(tile_pixels*sizeof(float));
+    uint8_t *encoded = (uint8_t *)malloc(capacity);
+    if(raw == NULL || codes == NULL || shuffled == NULL || encoded == NULL || !allocate_tile_index(&index, num_tiles)){
+        SAFE_PRINTF(512, "Write_LMK_Tiled() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        free(raw);
+        free(codes);
+        free(shuffled);
+        free(encoded);
+        fclose(fp);
+        return false;
+    }
+
+    uint32_t params[4] = {(uint32_t)tile_size, index.flags, (uint32_t)compression, (uint32_t)num_tiles};
+    bool success = write_lmk_header(fp, lmk, LMK_VERSION_V4);
+    success = success && write_big_endian_array(params, 32, false, 4, fp) == 4;
+    uint64_t index_offset = LMK_HEADER_SIZE + TILE_PARAMS_SIZE;
+    if(ele_encoding == LMK_ELE_INT16){
+        double codec[2] = {index.codec.offset, index.codec.scale};
+        success = success && write_big_endian_array(codec, 64, false, 2, fp) == 2;
+        index_offset += TILE_CODEC_SIZE;
+    }
+    // Placeholder index, rewritten once the tile sizes are known
+    success = success && write_tile_index(fp, &index, num_tiles);
+
+    bool swap = little_endian != host_is_little_endian();
+    uint64_t offset = index_offset + (uint64_t)num_tiles*TILE_INDEX_ENTRY_SIZE;
+    for(int32_t t = 0; t < num_tiles && success; t++){
+        int32_t x0, y0, w, h;
+        tile_extent(lmk, &index, t % index.tile_cols, t / index.tile_cols, &x0, &y0, &w, &h);
+        uint32_t n = (uint32_t)(w*h);
+
+        for(int32_t r = 0; r < h; r++){
+            memcpy(&raw[r*w], &lmk->srm[(int64_t)(y0 + r)*lmk->num_cols + x0], w);
+        }
+        index.srm_bytes[t] = encode_block(raw, n, encoded, capacity, compression);
+        success &= fwrite(encoded, 1, index.srm_bytes[t], fp) == index.srm_bytes[t];
+
+        for(int32_t r = 0; r < h; r++){
+            memcpy(&raw[r*w*sizeof(float)], &lmk->ele[(int64_t)(y0 + r)*lmk->num_cols + x0], w*sizeof(float));
+        }
+        encode_lmk_ele_values(&index.codec, (const float *)raw, codes, n);
+        if(swap) swap_big_endian_array(codes, 8*ele_width, n);
+        const uint8_t *ele_src = codes;
+        if(compression == LMK_COMPRESSION_DEFLATE){
+            shuffle_bytes(codes, shuffled, n, ele_width, false);
+            ele_src = shuffled;
+        }
+        index.ele_bytes[t] = encode_block(ele_src, n*ele_width, encoded, capacity, compression);
+        success &= success && fwrite(encoded, 1, index.ele_bytes[t], fp) == index.ele_bytes[t];
+
+        index.offsets[t] = offset;
+        offset += index.srm_bytes[t] + index.ele_bytes[t];
+    }
+
+    success = success && seek_file_offset(fp, (int64_t)index_offset);
+    success = success && write_tile_index(fp, &index, num_tiles);
+
+    free(raw);
+    free(codes);
+    free(shuffled);
+    free(encoded);
+    free_tile_index(&index);
+    fclose(fp);
+
+    if(!success){
+        SAFE_PRINTF(512, "Write_LMK_Tiled() ==>> failed to write %s\n", filename);
+        return false;
+    }
+
+    //Write ascii header file
+    return write_lmk_ascii_header(filename, lmk);
+}
+
+/**
+ \brief Read the tile parameters, elevation encoding and tile index following the header block
+*/
+static bool read_tile_index(FILE *fp, const LMK *lmk, TileIndex *index){
+    uint32_t params[4];
+    if(read_big_endian_array(params, 32, false, 4, fp) != 4) return false;
+
+    index->tile_size = (int32_t)params[0];
+    index->flags = params[1];
+    index->compression = (enum LMK_Compression)params[2];
+    if(index->tile_size <= 0 || index->compression >= LMK_Compression_UNDEFINED){
+        SAFE_PRINTF(512, "read_lmk_tiled_region() ==>> unsupported tile size %d or compression %u\n", index->tile_size, params[2]);
+        return false;
+    }
+    index->tile_cols = (lmk->num_cols + index->tile_size - 1)/index->tile_size;
+    index->tile_rows = (lmk->num_rows + index->tile_size - 1)/index->tile_size;
+    int32_t num_tiles = index->tile_cols*index->tile_rows;
+    if((int32_t)params[3] != num_tiles){
+        SAFE_PRINTF(512, "read_lmk_tiled_region() ==>> tile index has %u tiles, expected %d\n", params[3], num_tiles);
+        return false;
+    }
+
+    index->codec.encoding = flags_encoding(index->flags);
+    if(index->codec.encoding == LMK_ELE_INT16){
+        double codec[2];
+        if(read_big_endian_array(codec, 64, false, 2, fp) != 2) return false;
+        index->codec.offset = codec[0];
+        index->codec.scale = codec[1];
+    }
+
+    if(!allocate_tile_index(index, num_tiles)) return false;
+    bool success = true;
+    for(int32_t i = 0; i < num_tiles && success; i++){
+        success &= read_big_endian_array(&index->offsets[i], 64, false, 1, fp) == 1;
+        success &= read_big_endian_array(&index->srm_bytes[i], 32, false, 1, fp) == 1;
+        success &= read_big_endian_array(&index->ele_bytes[i], 32, false, 1, fp) == 1;
+    }
+    if(!success) free_tile_index(index);
+    return success;
+}
+
+/**
+ \brief Decode the tiles overlapping a region
+ \param[out] ele float elevation if `keep_encoding` is false, otherwise values in the encoding of the file
+*/
+static bool read_tiles(FILE *fp, const LMK *lmk, const TileIndex *index, int32_t left, int32_t top, int32_t ncols, int32_t nrows,
+                       uint8_t *srm, void *ele, bool keep_encoding)
+{
+    bool success = true;
+    size_t tile_bytes = (size_t)index->tile_size*index->tile_size*sizeof(float);
+    uint8_t *stored = (uint8_t *)malloc(compressBound((uLong)tile_bytes));
+    uint8_t *raw = (uint8_t *)malloc(tile_bytes);
+    uint8_t *shuffled = (uint8_t *)malloc(tile_bytes);
+    if(stored == NULL || raw == NULL || shuffled == NULL){
+        SAFE_PRINTF(512, "read_lmk_tiled_region() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        success = false;
+    }
+
+    int32_t ele_width = (int32_t)lmk_ele_encoding_width(index->codec.encoding);
+    int32_t out_width = keep_encoding ? ele_width : (int32_t)sizeof(float);
+    uint8_t *ele_out = (uint8_t *)ele;
+    bool swap = ((index->flags & LMK_TILED_LITTLE_ENDIAN) != 0) != host_is_little_endian();
+    int32_t first_col = left/index->tile_size, last_col = (left + ncols - 1)/index->tile_size;
+    int32_t first_row = top/index->tile_size, last_row = (top + nrows - 1)/index->tile_size;
+    for(int32_t tr = first_row; tr <= last_row && success; tr++){
+        for(int32_t tc = first_col; tc <= last_col && success; tc++){
+            int32_t t = tr*index->tile_cols + tc;
+            int32_t x0, y0, w, h;
+            tile_extent(lmk, index, tc, tr, &x0, &y0, &w, &h);
+            uint32_t n = (uint32_t)(w*h);
+            if(index->srm_bytes[t] > compressBound((uLong)tile_bytes) || index->ele_bytes[t] > compressBound((uLong)tile_bytes)){
+                success = false;
+                break;
+            }
+
+            // Overlap of the tile and the requested region
+            int32_t cx0 = x0 > left ? x0 : left;
+            int32_t cy0 = y0 > top ? y0 : top;
+            int32_t cx1 = (x0 + w < left + ncols) ? x0 + w : left + ncols;
+            int32_t cy1 = (y0 + h < top + nrows) ? y0 + h : top + nrows;
+
+            success &= seek_file_offset(fp, (int64_t)index->offsets[t]);
+            success &= success && fread(stored, 1, index->srm_bytes[t], fp) == index->srm_bytes[t];
+            success &= success && decode_block(stored, index->srm_bytes[t], raw, n);
+            for(int32_t y = cy0; y < cy1 && success; y++){
+                memcpy(&srm[(int64_t)(y - top)*ncols + (cx0 - left)], &raw[(y - y0)*w + (cx0 - x0)], cx1 - cx0);
+            }
+
+            success &= success && fread(stored, 1, index->ele_bytes[t], fp) == index->ele_bytes[t];
+            if(success && index->compression == LMK_COMPRESSION_DEFLATE){
+                success &= decode_block(stored, index->ele_bytes[t], shuffled, n*ele_width);
+                shuffle_bytes(shuffled, raw, n, ele_width, true);
+            }else if(success){
+                success &= decode_block(stored, index->ele_bytes[t], raw, n*ele_width);
+            }
+            if(swap && success) swap_big_endian_array(raw, 8*ele_width, n);
+            const uint8_t *tile_ele = raw;
+            if(!keep_encoding && index->codec.encoding != LMK_ELE_FLOAT32 && success){
+                decode_lmk_ele_values(&index->codec, raw, (float *)shuffled, n);
+                tile_ele = shuffled;
+            }
+            for(int32_t y = cy0; y < cy1 && success; y++){
+                memcpy(&ele_out[((int64_t)(y - top)*ncols + (cx0 - left))*out_width],
+                       &tile_ele[((y - y0)*w + (cx0 - x0))*out_width], (cx1 - cx0)*out_width);
+            }
+        }
+    }
+
+    free(stored);
+    free(raw);
+    free(shuffled);
+    return success;
+}
+
+bool read_lmk_tiled_region(FILE *fp, const LMK *lmk, int32_t left, int32_t top, int32_t ncols, int32_t nrows,
+                           uint8_t *srm, float *ele)
+{
+    TileIndex index = {0};
+    if(!read_tile_index(fp, lmk, &index)) return false;
+
+    bool success = read_tiles(fp, lmk, &index, left, top, ncols, nrows, srm, ele, false);
+    if(!success){
+        SAFE_PRINTF(512, "read_lmk_tiled_region() ==>> failed to read tiles of %s\n", lmk->filename);
+    }
+    free_tile_index(&index);
+    return success;
+}
+
+bool read_lmk_tiled_region_compact(FILE *fp, const LMK *lmk, int32_t left, int32_t top, int32_t ncols, int32_t nrows,
+                                   uint8_t *srm, LMK_Compact_Ele *ele)
+{
+    TileIndex index = {0};
+    if(!read_tile_index(fp, lmk, &index)) return false;
+
+    *ele = index.codec;
+    ele->num_cols = ncols;
+    ele->num_rows = nrows;
+    ele->data = malloc((size_t)ncols*nrows*lmk_ele_encoding_width(ele->encoding));
+    if(ele->data == NULL){
+        SAFE_PRINTF(512, "read_lmk_tiled_region_compact() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        free_tile_index(&index);
+        return false;
+    }
+
+    bool success = read_tiles(fp, lmk, &index, left, top, ncols, nrows, srm, ele->data, true);
+    if(!success){
+        SAFE_PRINTF(512, "read_lmk_tiled_region_compact() ==>> failed to read tiles of %s\n", lmk->filename);
+        free_lmk_compact_ele(ele);
+    }
+    free_tile_index(&index);
+    return success;
+}
+
+enum LMK_Compression strToLMKCompression(const char *str){
+    enum LMK_Compression compression = LMK_COMPRESSION_NONE;
+    if(str != NULL){
+        if(strncmp(str, "NONE", strlen(str))==0){
+            compression = LMK_COMPRESSION_NONE;
+        }else if(strncmp(str, "DEFLATE", strlen(str))==0){
+            compression = LMK_COMPRESSION_DEFLATE;
+        }else{
+            printf("Value of str must be \"NONE\" or \"DEFLATE\"");
+            compression = LMK_Compression_UNDEFINED;
+        }
+    }
+    return compression;
+}
@@ -0,0 +1,113 @@
+/**
+ * \file `landmark_tiled.h`
+ * \brief Tiled and indexed v4 landmark file format
+ *
+ * The v4 format starts with the same header as v3 (with version `LMK_VERSION_V4`), followed by
+ * - tile size, flags, compression method and number of tiles (big endian uint32)
+ * - the tile index: one (uint64 offset, uint32 srm bytes, uint32 ele bytes) entry per tile, big endian
+ * - tile payloads in row major tile order. Each payload is the srm block of the tile followed by the ele block.
+ *
+ * Tiles on the right and bottom edges are cropped to the map size. When compression is enabled, every block
+ * that does not shrink is stored raw, which is detected on read by comparing the stored size to the raw size.
+ * Elevation bytes are split into byte planes before deflate so that the exponent bytes compress together.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LANDMARK_TILED_H_
+#define _LANDMARK_TOOLS_LANDMARK_TILED_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stdint.h>                                          // for int32_t
+#include <stdio.h>                                           // for FILE
+
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK
+#include "landmark_tools/landmark_util/landmark_compact.h"  // for LMK_Ele_Encoding
+
+#define LMK_DEFAULT_TILE_SIZE 256
+#define LMK_TILED_LITTLE_ENDIAN 0x1 //!< flag: elevation is stored in little endian byte order
+#define LMK_TILED_ELE_FLOAT16 0x2   //!< flag: elevation is stored as half precision floats
+#define LMK_TILED_ELE_INT16 0x4     //!< flag: elevation is stored as scaled int16 codes. Offset and scale follow the tile parameters
+
+enum LMK_Compression {
+    LMK_COMPRESSION_NONE = 0,
+    LMK_COMPRESSION_DEFLATE = 1,
+    LMK_Compression_UNDEFINED
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Write a landmark file in the tiled v4 format and also write an ascii file of landmark header to "filename".txt
+ * \param[in] filename cstring containing filename
+ * \param[in] lmk landmark
+ * \param[in] tile_size width and height of a tile in pixels
+ * \param[in] compression per tile compression method
+ * \param[in] ele_encoding encoding of the stored elevation, see landmark_compact.h
+ * \param[in] little_endian if true, elevation is stored in little endian byte order
+ * \return true on success
+ * \return false on io error or if memory allocation fails
+ */
+bool Write_LMK_Tiled(const char *filename, const LMK *lmk, int32_t tile_size,
+                     enum LMK_Compression compression, enum LMK_Ele_Encoding ele_encoding, bool little_endian);
+
+/**
+ * \brief Read a region of the pixel arrays of a v4 landmark file
+ *
+ * Only the tiles which overlap the region are read and decoded.
+ * \param[in] fp file pointer positioned directly after the LMK_HEADER_SIZE header block
+ * \param[in] lmk header of the landmark file
+ * \param[in] left col index for start of region
+ * \param[in] top row index for start of region
+ * \param[in] ncols width of region
+ * \param[in] nrows height of region
+ * \param[out] srm pre-allocated ncols*nrows surface reflectance array
+ * \param[out] ele pre-allocated ncols*nrows elevation array
+ * \return true on success
+ * \return false on io error, corrupt tile, or if memory allocation fails
+ */
+bool read_lmk_tiled_region(FILE *fp, const LMK *lmk, int32_t left, int32_t top, int32_t ncols, int32_t nrows,
+                           uint8_t *srm, float *ele);
+
+/**
+ * \brief Same as `read_lmk_tiled_region`, but the elevation is kept in the encoding stored in the file
+ * \param[in] fp file pointer positioned directly after the LMK_HEADER_SIZE header block
+ * \param[in] lmk header of the landmark file
+ * \param[in] left col index for start of region
+ * \param[in] top row index for start of region
+ * \param[in] ncols width of region
+ * \param[in] nrows height of region
+ * \param[out] srm pre-allocated ncols*nrows surface reflectance array
+ * \param[out] ele elevation of the region. Must be released with `free_lmk_compact_ele`
+ * \return true on success
+ * \return false on io error, corrupt tile, or if memory allocation fails
+ */
+bool read_lmk_tiled_region_compact(FILE *fp, const LMK *lmk, int32_t left, int32_t top, int32_t ncols, int32_t nrows,
+                                   uint8_t *srm, LMK_Compact_Ele *ele);
+
+/**
+ * \brief Convert string to LMK_Compression enum
+ * \param[in] str NONE or DEFLATE
+ * \return LMK_Compression or LMK_Compression_UNDEFINED
+ */
+enum LMK_Compression strToLMKCompression(const char *str);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _LANDMARK_TOOLS_LANDMARK_TILED_H_
@@ -0,0 +1,439 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <float.h>                  // for DBL_MAX
+#include <math.h>                   // for sqrt, cos, fabs
+#include <stdio.h>                  // for fopen, fclose
+#include <stdlib.h>                 // for malloc, free, qsort
+#include <string.h>                 // for memset, strncpy
+
+#include "landmark_tools/landmark_util/lmk_catalog.h"
+#include "landmark_tools/math/math_constants.h"  // for DEG2RAD
+#include "landmark_tools/utils/endian_read_write.h"
+#include "landmark_tools/utils/safe_string.h"
+#include "math/mat3/mat3.h"         // for dot3
+
+#define LMK_CATALOG_VERSION "#! LMK Catalog v1.0"
+#define CATALOG_STACK_SIZE 1024 //nodes pending in a query before the stack moves to the heap
+#define LATLONG_SAMPLES 9
+
+typedef struct {
+    uint64_t code;
+    int32_t index;
+} MortonKey;
+
+/**
+ \brief Spread the lower 21 bits of `v` so there are two zero bits between each bit
+*/
+static uint64_t spread_bits(uint64_t v){
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+static int compare_morton(const void *a, const void *b){
+    uint64_t ca = ((const MortonKey *)a)->code;
+    uint64_t cb = ((const MortonKey *)b)->code;
+    return (ca > cb) - (ca < cb);
+}
+
+static bool boxes_overlap(const double amin[3], const double amax[3], const double bmin[3], const double bmax[3]){
+    return amin[0] <= bmax[0] && amax[0] >= bmin[0] &&
+           amin[1] <= bmax[1] && amax[1] >= bmin[1] &&
+           amin[2] <= bmax[2] && amax[2] >= bmin[2];
+}
+
+static void reset_box(double bmin[3], double bmax[3]){
+    for(int32_t k = 0; k < 3; k++){
+        bmin[k] = DBL_MAX;
+        bmax[k] = -DBL_MAX;
+    }
+}
+
+static void expand_box(double bmin[3], double bmax[3], const double p_min[3], const double p_max[3]){
+    for(int32_t k = 0; k < 3; k++){
+        if(p_min[k] < bmin[k]) bmin[k] = p_min[k];
+        if(p_max[k] > bmax[k]) bmax[k] = p_max[k];
+    }
+}
+
+/**
+ \brief World frame bounding box of the landmark extent between -margin and +margin elevation
+*/
+static void footprint_box(const LMK *lmk, double margin, double bmin[3], double bmax[3]){
+    reset_box(bmin, bmax);
+    double cols[2] = {-0.5, lmk->num_cols - 0.5};
+    double rows[2] = {-0.5, lmk->num_rows - 0.5};
+    double eles[2] = {-margin, margin};
+    for(int32_t i = 0; i < 2; i++){
+        for(int32_t j = 0; j < 2; j++){
+            for(int32_t k = 0; k < 2; k++){
+                double p[3];
+                LMK_Col_Row_Elevation2World(lmk, cols[i], rows[j], eles[k], p);
+                expand_box(bmin, bmax, p, p);
+            }
+        }
+    }
+}
+
+/**
+ \brief Pack the entries into a static R-tree, bottom up, in the order they are stored
+*/
+static bool build_tree(LMK_Catalog *catalog){
+    catalog->num_nodes = 0;
+    catalog->nodes = NULL;
+    catalog->root = -1;
+    if(catalog->num_entries == 0) return true;
+
+    // Upper bound on number of nodes: n/B + n/B^2 + ... + levels
+    int32_t capacity = 0;
+    for(int32_t n = catalog->num_entries; n > 1; n = (n + LMK_CATALOG_NODE_SIZE - 1)/LMK_CATALOG_NODE_SIZE){
+        capacity += (n + LMK_CATALOG_NODE_SIZE - 1)/LMK_CATALOG_NODE_SIZE;
+    }
+    capacity += 1;
+    catalog->nodes = (LMK_Catalog_Node *)malloc(capacity*sizeof(LMK_Catalog_Node));
+    if(catalog->nodes == NULL){
+        SAFE_PRINTF(512, "build_tree() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        return false;
+    }
+
+    // Leaf level
+    int32_t level_start = 0;
+    for(int32_t i = 0; i < catalog->num_entries; i += LMK_CATALOG_NODE_SIZE){
+        LMK_Catalog_Node *node = &catalog->nodes[catalog->num_nodes++];
+        node->first = i;
+        node->count = (catalog->num_entries - i < LMK_CATALOG_NODE_SIZE) ? catalog->num_entries - i : LMK_CATALOG_NODE_SIZE;
+        node->leaf = true;
+        reset_box(node->bbox_min, node->bbox_max);
+        for(int32_t j = i; j < i + node->count; j++){
+            expand_box(node->bbox_min, node->bbox_max, catalog->entries[j].bbox_min, catalog->entries[j].bbox_max);
+        }
+    }
+
+    // Internal levels until a single root remains
+    int32_t level_count = catalog->num_nodes;
+    while(level_count > 1){
+        int32_t next_start = catalog->num_nodes;
+        for(int32_t i = level_start; i < level_start + level_count; i += LMK_CATALOG_NODE_SIZE){
+            LMK_Catalog_Node *node = &catalog->nodes[catalog->num_nodes++];
+            node->first = i;
+            node->count = (level_start + level_count - i < LMK_CATALOG_NODE_SIZE) ? level_start + level_count - i : LMK_CATALOG_NODE_SIZE;
+            node->leaf = false;
+            reset_box(node->bbox_min, node->bbox_max);
+            for(int32_t j = i; j < i + node->count; j++){
+                expand_box(node->bbox_min, node->bbox_max, catalog->nodes[j].bbox_min, catalog->nodes[j].bbox_max);
+            }
+        }
+        level_count = catalog->num_nodes - next_start;
+        level_start = next_start;
+    }
+    catalog->root = catalog->num_nodes - 1;
+    return true;
+}
+
+bool Build_LMK_Catalog(char **filenames, int32_t num_files, double margin, LMK_Catalog *catalog)
+{
+    memset(catalog, 0, sizeof(LMK_Catalog));
+    catalog->root = -1;
+
+    LMK_Catalog_Entry *entries = (LMK_Catalog_Entry *)malloc((num_files > 0 ? num_files : 1)*sizeof(LMK_Catalog_Entry));
+    MortonKey *keys = (MortonKey *)malloc((num_files > 0 ? num_files : 1)*sizeof(MortonKey));
+    if(entries == NULL || keys == NULL){
+        SAFE_PRINTF(512, "Build_LMK_Catalog() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        free(entries);
+        free(keys);
+        return false;
+    }
+
+    int32_t count = 0;
+    double world_min[3], world_max[3];
+    reset_box(world_min, world_max);
+    for(int32_t i = 0; i < num_files; i++){
+        LMK lmk = {0};
+        if(!Read_LMK_Header(filenames[i], &lmk)){
+            SAFE_PRINTF(512, "Build_LMK_Catalog() ==>> skipping %s\n", filenames[i]);
+            continue;
+        }
+        LMK_Catalog_Entry *entry = &entries[count++];
+        strncpy(entry->filename, filenames[i], LMK_FILENAME_SIZE - 1);
+        entry->filename[LMK_FILENAME_SIZE - 1] = '\0';
+        entry->BODY = lmk.BODY;
+        footprint_box(&lmk, margin, entry->bbox_min, entry->bbox_max);
+        expand_box(world_min, world_max, entry->bbox_min, entry->bbox_max);
+    }
+
+    // Morton order of box centers keeps neighboring footprints in the same branch
+    for(int32_t i = 0; i < count; i++){
+        uint64_t code = 0;
+        for(int32_t k = 0; k < 3; k++){
+            double extent = world_max[k] - world_min[k];
+            double center = 0.5*(entries[i].bbox_min[k] + entries[i].bbox_max[k]);
+            double normalized = extent > 0 ? (center - world_min[k])/extent : 0.0;
+            code |= spread_bits((uint64_t)(normalized*0x1fffff)) << k;
+        }
+        keys[i].code = code;
+        keys[i].index = i;
+    }
+    qsort(keys, count, sizeof(MortonKey), compare_morton);
+
+    catalog->entries = (LMK_Catalog_Entry *)malloc((count > 0 ? count : 1)*sizeof(LMK_Catalog_Entry));
+    if(catalog->entries == NULL){
+        SAFE_PRINTF(512, "Build_LMK_Catalog() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        free(entries);
+        free(keys);
+        return false;
+    }
+    for(int32_t i = 0; i < count; i++){
+        catalog->entries[i] = entries[keys[i].index];
+    }
+    catalog->num_entries = count;
+    free(entries);
+    free(keys);
+
+    if(!build_tree(catalog)){
+        free_lmk_catalog(catalog);
+        return false;
+    }
+    return true;
+}
+
+void free_lmk_catalog(LMK_Catalog *catalog)
+{
+    free(catalog->entries);
+    free(catalog->nodes);
+    catalog->entries = NULL;
+    catalog->nodes = NULL;
+    catalog->num_entries = 0;
+    catalog->num_nodes = 0;
+    catalog->root = -1;
+}
+
+bool Write_LMK_Catalog(const char *filename, const LMK_Catalog *catalog)
+{
+    FILE *fp;
+    fp = fopen(filename, "wb");
+    if(fp == NULL)
+    {
+        SAFE_PRINTF(512, "Write_LMK_Catalog() ==>> cannot open file %s to write\n", filename);
+        return false;
+    }
+
+    char version[LMK_VERSION_SIZE] = {0};
+    strncpy(version, LMK_CATALOG_VERSION, LMK_VERSION_SIZE - 1);
+    bool success = fwrite(version, sizeof(uint8_t), LMK_VERSION_SIZE, fp) == LMK_VERSION_SIZE;
+
+    int32_t counts[3] = {catalog->num_entries, catalog->num_nodes, catalog->root};
+    success = success && write_big_endian_array(counts, 32, false, 3, fp) == 3;
+
+    for(int32_t i = 0; i < catalog->num_entries && success; i++){
+        const LMK_Catalog_Entry *entry = &catalog->entries[i];
+        int32_t body = entry->BODY;
+        success &= fwrite(entry->filename, sizeof(char), LMK_FILENAME_SIZE, fp) == LMK_FILENAME_SIZE;
+        success &= write_big_endian_array(&body, 32, false, 1, fp) == 1;
+        success &= write_big_endian_array(entry->bbox_min, 64, true, 3, fp) == 3;
+        success &= write_big_endian_array(entry->bbox_max, 64, true, 3, fp) == 3;
+    }
+    for(int32_t i = 0; i < catalog->num_nodes && success; i++){
+        const LMK_Catalog_Node *node = &catalog->nodes[i];
+        int32_t fields[3] = {node->first, node->count, node->leaf};
+        success &= write_big_endian_array(node->bbox_min, 64, true, 3, fp) == 3;
+        success &= write_big_endian_array(node->bbox_max, 64, true, 3, fp) == 3;
+        success &= write_big_endian_array(fields, 32, false, 3, fp) == 3;
+    }
+    fclose(fp);
+
+    if(!success){
+        SAFE_PRINTF(512, "Write_LMK_Catalog() ==>> failed to write %s\n", filename);
+    }
+    return success;
+}
+
+bool Read_LMK_Catalog(const char *filename, LMK_Catalog *catalog)
+{
+    memset(catalog, 0, sizeof(LMK_Catalog));
+    catalog->root = -1;
+
+    FILE *fp;
+    fp = fopen(filename, "rb");
+    if(fp == NULL)
+    {
+        SAFE_PRINTF(512, "Read_LMK_Catalog() ==>> cannot open file %s to read\n", filename);
+        return false;
+    }
+
+    char version[LMK_VERSION_SIZE];
+    int32_t counts[3];
+    if(fread(version, sizeof(char), LMK_VERSION_SIZE, fp) != LMK_VERSION_SIZE ||
+       strncmp(version, LMK_CATALOG_VERSION, strlen(LMK_CATALOG_VERSION)) != 0 ||
+       read_big_endian_array(counts, 32, false, 3, fp) != 3 ||
+       counts[0] < 0 || counts[1] < 0 || counts[2] >= counts[1])
+    {
+        SAFE_PRINTF(512, "Read_LMK_Catalog() ==>> %s is not a landmark catalog\n", filename);
+        fclose(fp);
+        return false;
+    }
+
+    catalog->entries = (LMK_Catalog_Entry *)malloc((counts[0] > 0 ? counts[0] : 1)*sizeof(LMK_Catalog_Entry));
+    catalog->nodes = (LMK_Catalog_Node *)malloc((counts[1] > 0 ? counts[1] : 1)*sizeof(LMK_Catalog_Node));
+    if(catalog->entries == NULL || catalog->nodes == NULL){
+        SAFE_PRINTF(512, "Read_LMK_Catalog() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        free_lmk_catalog(catalog);
+        fclose(fp);
+        return false;
+    }
+    catalog->num_entries = counts[0];
+    catalog->num_nodes = counts[1];
+    catalog->root = counts[2];
+
+    bool success = true;
+    for(int32_t i = 0; i < catalog->num_entries && success; i++){
+        LMK_Catalog_Entry *entry = &catalog->entries[i];
+        int32_t body;
+        success &= fread(entry->filename, sizeof(char), LMK_FILENAME_SIZE, fp) == LMK_FILENAME_SIZE;
+        success &= read_big_endian_array(&body, 32, false, 1, fp) == 1;
+        success &= read_big_endian_array(entry->bbox_min, 64, true, 3, fp) == 3;
+        success &= read_big_endian_array(entry->bbox_max, 64, true, 3, fp) == 3;
+        entry->filename[LMK_FILENAME_SIZE - 1] = '\0';
+        entry->BODY = (enum Planet)body;
+    }
+    for(int32_t i = 0; i < catalog->num_nodes && success; i++){
+        LMK_Catalog_Node *node = &catalog->nodes[i];
+        int32_t fields[3];
+        success &= read_big_endian_array(node->bbox_min, 64, true, 3, fp) == 3;
+        success &= read_big_endian_array(node->bbox_max, 64, true, 3, fp) == 3;
+        success &= read_big_endian_array(fields, 32, false, 3, fp) == 3;
+        node->first = fields[0];
+        node->count = fields[1];
+        node->leaf = fields[2] != 0;
+        int32_t limit = node->leaf ? catalog->num_entries : catalog->num_nodes;
+        success &= node->first >= 0 && node->count >= 0 && node->first + node->count <= limit;
+    }
+    fclose(fp);
+
+    if(!success){
+        SAFE_PRINTF(512, "Read_LMK_Catalog() ==>> %s is truncated or corrupt\n", filename);
+        free_lmk_catalog(catalog);
+    }
+    return success;
+}
+
+/**
+ \brief Shared traversal for the query functions. Entries of a different body are skipped unless `body` is Planet_UNDEFINED
+
+ The pending nodes are held on the stack of the caller and moved to a growing heap block if a tree is too wide or
+ deep for it. A tree visits each node at most once, so a catalog that visits more nodes than it has is corrupt.
+*/
+static int32_t query_tree(const LMK_Catalog *catalog, const double bbox_min[3], const double bbox_max[3],
+                          enum Planet body, int32_t *results, int32_t max_results)
+{
+    if(catalog->root < 0) return 0;
+
+    int32_t found = 0;
+    int32_t local[CATALOG_STACK_SIZE];
+    int32_t *stack = local;
+    int32_t capacity = CATALOG_STACK_SIZE;
+    int32_t top = 0;
+    int32_t visited = 0;
+    stack[top++] = catalog->root;
+    while(top > 0){
+        if(++visited > catalog->num_nodes){
+            SAFE_PRINTF(512, "query_tree() ==>> catalog tree is corrupt, a node is reached more than once\n");
+            found = -1;
+            break;
+        }
+        const LMK_Catalog_Node *node = &catalog->nodes[stack[--top]];
+        if(!boxes_overlap(node->bbox_min, node->bbox_max, bbox_min, bbox_max)) continue;
+        if(!node->leaf && top + node->count > capacity){
+            int32_t grown = capacity;
+            while(top + node->count > grown) grown *= 2;
+            int32_t *larger = (int32_t *)malloc(grown*sizeof(int32_t));
+            if(larger == NULL){
+                SAFE_PRINTF(512, "query_tree() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+                found = -1;
+                break;
+            }
+            memcpy(larger, stack, top*sizeof(int32_t));
+            if(stack != local) free(stack);
+            stack = larger;
+            capacity = grown;
+        }
+        for(int32_t i = node->first; i < node->first + node->count; i++){
+            if(node->leaf){
+                const LMK_Catalog_Entry *entry = &catalog->entries[i];
+                if(body != Planet_UNDEFINED && entry->BODY != body) continue;
+                if(!boxes_overlap(entry->bbox_min, entry->bbox_max, bbox_min, bbox_max)) continue;
+                if(found < max_results) results[found] = i;
+                found++;
+            }else{
+                stack[top++] = i;
+            }
+        }
+    }
+    if(stack != local) free(stack);
+    return found;
+}
+
+int32_t LMK_Catalog_Query_Box(const LMK_Catalog *catalog, const double bbox_min[3], const double bbox_max[3],
+                              int32_t *results, int32_t max_results)
+{
+    return query_tree(catalog, bbox_min, bbox_max, Planet_UNDEFINED, results, max_results);
+}
+
+int32_t LMK_Catalog_Query_Point(const LMK_Catalog *catalog, const double p[3], double radius,
+                                int32_t *results, int32_t max_results)
+{
+    double bbox_min[3], bbox_max[3];
+    for(int32_t k = 0; k < 3; k++){
+        bbox_min[k] = p[k] - radius;
+        bbox_max[k] = p[k] + radius;
+    }
+    return query_tree(catalog, bbox_min, bbox_max, Planet_UNDEFINED, results, max_results);
+}
+
+int32_t LMK_Catalog_Query_LatLong(const LMK_Catalog *catalog, enum Planet body,
+                                  double lat_min, double lat_max, double lon_min, double lon_max,
+                                  double ele_min, double ele_max, int32_t *results, int32_t max_results)
+{
+    double bbox_min[3], bbox_max[3];
+    double max_radius = 0.0;
+    reset_box(bbox_min, bbox_max);
+    for(int32_t i = 0; i < LATLONG_SAMPLES; i++){
+        double lat = lat_min + (lat_max - lat_min)*i/(LATLONG_SAMPLES - 1);
+        for(int32_t j = 0; j < LATLONG_SAMPLES; j++){
+            double lon = lon_min + (lon_max - lon_min)*j/(LATLONG_SAMPLES - 1);
+            double p[3];
+            LatLongHeight_to_ECEF(lat, lon, ele_min, p, body);
+            expand_box(bbox_min, bbox_max, p, p);
+            LatLongHeight_to_ECEF(lat, lon, ele_max, p, body);
+            expand_box(bbox_min, bbox_max, p, p);
+            double radius = sqrt(dot3(p, p));
+            if(radius > max_radius) max_radius = radius;
+        }
+    }
+    
+    // Pad by the sagitta of the arc between neighboring samples so the box stays conservative
+    double step = fmax(fabs(lat_max - lat_min), fabs(lon_max - lon_min))/(LATLONG_SAMPLES - 1)*DEG2RAD;
+    double pad = max_radius*(1.0 - cos(0.5*step));
+    for(int32_t k = 0; k < 3; k++){
+        bbox_min[k] -= pad;
+        bbox_max[k] += pad;
+    }
+    return query_tree(catalog, bbox_min, bbox_max, body, results, max_results);
+}
@@ -0,0 +1,153 @@
+/**
+ * \file `lmk_catalog.h`
+ * \brief Spatial index over the world frame footprints of many landmark files
+ *
+ * Footprints are computed from the landmark headers only. Each footprint is the world frame axis aligned
+ * bounding box of the landmark extent in the local map frame, padded by a margin in the map-normal direction
+ * to account for the unknown elevation range. The boxes are packed into a static R-tree in Morton order
+ * so that queries visit only the branches which overlap the query box.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LMK_CATALOG_H_
+#define _LANDMARK_TOOLS_LMK_CATALOG_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stdint.h>                                          // for int32_t
+
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK_FILENAME_SIZE
+#include "landmark_tools/map_projection/datum_conversion.h"  // for Planet
+
+#define LMK_CATALOG_NODE_SIZE 16 //maximum number of children of a tree node
+#define LMK_CATALOG_DEFAULT_MARGIN 10000.0 //meters of elevation range padded around the map plane
+
+typedef struct {
+  char filename[LMK_FILENAME_SIZE];
+  enum Planet BODY;
+  double bbox_min[3]; //!< Minimum corner of the footprint in world frame
+  double bbox_max[3]; //!< Maximum corner of the footprint in world frame
+} LMK_Catalog_Entry;
+
+typedef struct {
+  double bbox_min[3];
+  double bbox_max[3];
+  int32_t first; //!< index of first child in `nodes` or in `entries` if this is a leaf
+  int32_t count; //!< number of children
+  bool leaf;
+} LMK_Catalog_Node;
+
+typedef struct {
+  int32_t num_entries;
+  LMK_Catalog_Entry *entries;
+  int32_t num_nodes;
+  LMK_Catalog_Node *nodes;
+  int32_t root; //!< index of root node, -1 if the catalog is empty
+} LMK_Catalog;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Build a catalog from the headers of landmark files
+ *
+ * Files that cannot be read are reported and skipped.
+ * \param[in] filenames landmark file paths
+ * \param[in] num_files length of `filenames`
+ * \param[in] margin meters to pad the footprint above and below the map plane
+ * \param[out] catalog must be released with `free_lmk_catalog`
+ * \return true on success
+ * \return false if memory allocation fails
+ */
+bool Build_LMK_Catalog(char **filenames, int32_t num_files, double margin, LMK_Catalog *catalog);
+
+/**
+ * \brief Write a catalog to disk
+ * \param[in] filename output catalog file
+ * \param[in] catalog
+ * \return true on success
+ * \return false on io error
+ */
+bool Write_LMK_Catalog(const char *filename, const LMK_Catalog *catalog);
+
+/**
+ * \brief Read a catalog written by `Write_LMK_Catalog`
+ * \param[in] filename catalog file
+ * \param[out] catalog must be released with `free_lmk_catalog`
+ * \return true on success
+ * \return false on io error or if memory allocation fails
+ */
+bool Read_LMK_Catalog(const char *filename, LMK_Catalog *catalog);
+
+/**
+ * \brief Free memory allocated by `Build_LMK_Catalog` or `Read_LMK_Catalog`
+ * \param[in,out] catalog
+ */
+void free_lmk_catalog(LMK_Catalog *catalog);
+
+/**
+ * \brief Find the landmarks whose footprint overlaps a world frame box
+ * \param[in] catalog
+ * \param[in] bbox_min minimum corner of query box in world frame
+ * \param[in] bbox_max maximum corner of query box in world frame
+ * \param[out] results indices into `catalog->entries`. May be NULL if `max_results` is 0
+ * \param[in] max_results capacity of `results`
+ * \return total number of overlapping landmarks, which may be larger than `max_results`
+ * \return -1 if memory allocation fails or the tree of the catalog is corrupt
+ */
+int32_t LMK_Catalog_Query_Box(const LMK_Catalog *catalog, const double bbox_min[3], const double bbox_max[3],
+                              int32_t *results, int32_t max_results);
+
+/**
+ * \brief Find the landmarks whose footprint contains a world frame point, such as a ray hit
+ * \param[in] catalog
+ * \param[in] p point in world frame
+ * \param[in] radius search radius in meters
+ * \param[out] results indices into `catalog->entries`
+ * \param[in] max_results capacity of `results`
+ * \return total number of overlapping landmarks, which may be larger than `max_results`
+ * \return -1 if memory allocation fails or the tree of the catalog is corrupt
+ */
+int32_t LMK_Catalog_Query_Point(const LMK_Catalog *catalog, const double p[3], double radius,
+                                int32_t *results, int32_t max_results);
+
+/**
+ * \brief Find the landmarks of a body whose footprint overlaps a latitude/longitude box
+ *
+ * The box is converted to a world frame bounding box by sampling it between `ele_min` and `ele_max`.
+ * The bounding box is padded for the curvature between samples, so the result may include near misses but no false negatives.
+ * \param[in] catalog
+ * \param[in] body planetary body of the query
+ * \param[in] lat_min minimum latitude in degrees
+ * \param[in] lat_max maximum latitude in degrees
+ * \param[in] lon_min minimum longitude in degrees
+ * \param[in] lon_max maximum longitude in degrees
+ * \param[in] ele_min minimum height in meters
+ * \param[in] ele_max maximum height in meters
+ * \param[out] results indices into `catalog->entries`
+ * \param[in] max_results capacity of `results`
+ * \return total number of overlapping landmarks, which may be larger than `max_results`
+ * \return -1 if memory allocation fails or the tree of the catalog is corrupt
+ */
+int32_t LMK_Catalog_Query_LatLong(const LMK_Catalog *catalog, enum Planet body,
+                                  double lat_min, double lat_max, double lon_min, double lon_max,
+                                  double ele_min, double ele_max, int32_t *results, int32_t max_results);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _LANDMARK_TOOLS_LMK_CATALOG_H_
@@ -0,0 +1,353 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>                   // for cos, sin, log, sqrt
+#include <stdio.h>                  // for printf, snprintf
+#include <stdlib.h>                 // for malloc, free
+#include <string.h>                 // for memcpy, strlen, strcmp
+
+#include "landmark_tools/landmark_util/lmk_distort.h"
+#include "landmark_tools/landmark_util/lmk_writer.h"
+#include "landmark_tools/math/math_constants.h"
+#include "landmark_tools/utils/parallel.h"
+#include "landmark_tools/utils/safe_string.h"
+#include "math/mat3/mat3.h"
+
+#define LMK_DISTORT_CHUNK 256       //samples drawn together
+
+/**
+ \brief Distortion of a band of rows shared by its threads, which take rows in turn
+ */
+typedef struct {
+    const LMK *lmk;
+    const LMK_Distortion *distortion;
+    uint64_t seed;
+    uint64_t variant;
+    int32_t first_row;
+    int32_t nrows;
+    uint8_t *srm;
+    float *ele;
+} DistortJob;
+
+/**
+ \brief One row of a variant, displaced in place by each stage of the pipeline
+ */
+typedef struct {
+    const LMK *lmk;
+    const LMK_Distortion *distortion;
+    uint64_t seed;
+    uint64_t variant;
+    int32_t row;
+    float *ele;
+} DistortRow;
+
+typedef void (*DistortStage)(const DistortRow *row);
+
+#define LMK_DISTORT_MAX_STAGES 3
+
+void LMK_Distortion_Init(LMK_Distortion *distortion)
+{
+    memset(distortion, 0, sizeof(LMK_Distortion));
+}
+
+/**
+ \brief Philox4x32-10 block `ctr` under `key`
+ */
+static void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4])
+{
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for(int32_t round = 0; round < 10; round++){
+        uint64_t p0 = (uint64_t)0xD2511F53u*c0;
+        uint64_t p1 = (uint64_t)0xCD9E8D57u*c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c0 = n0;
+        c1 = (uint32_t)p1;
+        c2 = n2;
+        c3 = (uint32_t)p0;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+void LMK_Gaussian_Samples(uint64_t seed, uint64_t variant, uint64_t first, size_t n, double mean, double stddev,
+                          double *samples)
+{
+    // Block b of the variant gives the Box-Muller pair of samples 2b and 2b + 1
+    const uint32_t key[2] = {(uint32_t)seed, (uint32_t)(seed >> 32)};
+    double u1[LMK_DISTORT_CHUNK/2], u2[LMK_DISTORT_CHUNK/2], pairs[LMK_DISTORT_CHUNK];
+    uint64_t end = first + n;
+    uint64_t block = first >> 1;
+    while(2*block < end){
+        int32_t count = LMK_DISTORT_CHUNK/2;
+        if((end + 1)/2 - block < (uint64_t)count) count = (int32_t)((end + 1)/2 - block);
+
+        // Uniforms in (0, 1] for the radius and [0, 1) for the angle, with 53 bits each
+        for(int32_t j = 0; j < count; j++){
+            uint32_t ctr[4] = {(uint32_t)(block + j), (uint32_t)((block + j) >> 32),
+                               (uint32_t)variant, (uint32_t)(variant >> 32)};
+            uint32_t bits[4];
+            philox4x32(ctr, key, bits);
+            u1[j] = ((double)((((uint64_t)bits[0] << 21) | (bits[1] >> 11)) + 1))*0x1p-53;
+            u2[j] = (double)(((uint64_t)bits[2] << 21) | (bits[3] >> 11))*0x1p-53;
+        }
+        for(int32_t j = 0; j < count; j++){
+            double mag = stddev*sqrt(-2.0*log(u1[j]));
+            double angle = 2.0*PI*u2[j];
+            pairs[2*j] = mag*cos(angle) + mean;
+            pairs[2*j + 1] = mag*sin(angle) + mean;
+        }
+
+        // Copy the samples of the chunk that were requested
+        uint64_t from = 2*block < first ? first : 2*block;
+        uint64_t to = 2*(block + count) < end ? 2*(block + count) : end;
+        memcpy(&samples[from - first], &pairs[from - 2*block], (size_t)(to - from)*sizeof(double));
+        block += count;
+    }
+}
+
+void LMK_Distort_Header(const LMK *lmk, const LMK_Distortion *distortion, LMK *header)
+{
+    Copy_LMK_Header(lmk, header);
+    if(distortion->rotate_degrees != 0.0){
+        double rot_z = distortion->rotate_degrees*DEG2RAD;
+        double Rz[3][3] = {{cos(rot_z), -sin(rot_z), 0.0}, {sin(rot_z), cos(rot_z), 0.0}, {0.0, 0.0, 1.0}};
+        mult333(Rz, (double (*)[3])lmk->mapRworld, header->mapRworld);
+    }
+    double translate_world[3];
+    mult331((double (*)[3])lmk->worldRmap, (double *)distortion->translate, translate_world);
+    add3(lmk->anchor_point, translate_world, header->anchor_point);
+    calculateDerivedValuesVectors(header);
+}
+
+static void gaussian_stage(const DistortRow *row)
+{
+    const LMK_Distortion *distortion = row->distortion;
+    int32_t cols = row->lmk->num_cols;
+    uint64_t first = (uint64_t)row->row*cols;
+    double noise[LMK_DISTORT_CHUNK];
+    for(int32_t i = 0; i < cols; i += LMK_DISTORT_CHUNK){
+        int32_t n = cols - i < LMK_DISTORT_CHUNK ? cols - i : LMK_DISTORT_CHUNK;
+        LMK_Gaussian_Samples(row->seed, row->variant, first + i, n, distortion->gaussian_mean,
+                             distortion->gaussian_stddev, noise);
+        for(int32_t k = 0; k < n; k++){
+            row->ele[i + k] = (float)(row->ele[i + k] + noise[k]);
+        }
+    }
+}
+
+static void cubic_stage(const DistortRow *row)
+{
+    const double *c = row->distortion->cubic_coefficients;
+    for(int32_t k = 0; k < row->lmk->num_cols; k++){
+        double z = row->ele[k];
+        row->ele[k] = (float)(z + ((c[0]*z + c[1])*z + c[2])*z + c[3]);
+    }
+}
+
+/**
+ \brief One cycle of a sine wave along the wave axis, centered on the middle of the landmark
+ 
+ The phase is linear along the row, so the wave is evaluated by rotating (cos, sin) of the phase by a fixed angle per
+ pixel over the columns where the wave is nonzero.
+ */
+static void sine_stage(const DistortRow *row)
+{
+    const LMK_Distortion *distortion = row->distortion;
+    const LMK *lmk = row->lmk;
+    double azimuth = distortion->sine_azimuth*DEG2RAD;
+    double cos_a = cos(azimuth);
+    double sin_a = sin(azimuth);
+    double half_width = 0.5/distortion->sine_frequency;
+    double center_x = lmk->num_cols*0.5;
+    double row_distance = (row->row - lmk->num_rows*0.5)*sin_a;
+
+    // Columns whose distance (x - center_x)*cos_a + row_distance along the wave axis is within the half width
+    double x0 = 0.0;
+    double x1 = lmk->num_cols - 1;
+    if(cos_a != 0.0){
+        double a = center_x + (-half_width - row_distance)/cos_a;
+        double b = center_x + (half_width - row_distance)/cos_a;
+        if(a > b){
+            double t = a;
+            a = b;
+            b = t;
+        }
+        if(a > x0) x0 = ceil(a);
+        if(b < x1) x1 = floor(b);
+    }else if(fabs(row_distance) > half_width){
+        return;
+    }
+    if(x0 > x1) return;
+
+    double phase = PI*(((x0 - center_x)*cos_a + row_distance)/half_width + 1.0);
+    double step = PI*cos_a/half_width;
+    double c = cos(phase), s = sin(phase);
+    double cos_step = cos(step), sin_step = sin(step);
+    for(int32_t k = (int32_t)x0; k <= (int32_t)x1; k++){
+        row->ele[k] = (float)(row->ele[k] + distortion->sine_amplitude*s);
+        double next_c = c*cos_step - s*sin_step;
+        s = s*cos_step + c*sin_step;
+        c = next_c;
+    }
+}
+
+/**
+ \brief The requested stages, in the order they are applied
+ \return number of stages
+ */
+static int32_t distort_stages(const LMK_Distortion *distortion, DistortStage stages[LMK_DISTORT_MAX_STAGES])
+{
+    int32_t n = 0;
+    if(distortion->gaussian) stages[n++] = gaussian_stage;
+    if(distortion->cubic) stages[n++] = cubic_stage;
+    if(distortion->sine && distortion->sine_frequency > 0.0) stages[n++] = sine_stage;
+    return n;
+}
+
+void LMK_Distort_Rows(const LMK *lmk, const LMK_Distortion *distortion, uint64_t seed, uint64_t variant,
+                      int32_t first_row, int32_t nrows, uint8_t *srm, float *ele)
+{
+    DistortStage stages[LMK_DISTORT_MAX_STAGES];
+    int32_t num_stages = distort_stages(distortion, stages);
+    size_t first = (size_t)first_row*lmk->num_cols;
+    if(srm != NULL) memcpy(srm, &lmk->srm[first], (size_t)nrows*lmk->num_cols*sizeof(uint8_t));
+
+    // Each row goes through every stage while it is in cache
+    for(int32_t i = 0; i < nrows; i++){
+        DistortRow row = {lmk, distortion, seed, variant, first_row + i, &ele[(size_t)i*lmk->num_cols]};
+        memcpy(row.ele, &lmk->ele[first + (size_t)i*lmk->num_cols], lmk->num_cols*sizeof(float));
+        for(int32_t s = 0; s < num_stages; s++){
+            stages[s](&row);
+        }
+    }
+}
+
+static bool distort_rows(void *user, int32_t thread, size_t begin, size_t end)
+{
+    (void)thread;
+    DistortJob *job = (DistortJob *)user;
+    for(size_t i = begin; i < end; i++){
+        size_t offset = i*job->lmk->num_cols;
+        LMK_Distort_Rows(job->lmk, job->distortion, job->seed, job->variant, job->first_row + (int32_t)i, 1,
+                         job->srm != NULL ? &job->srm[offset] : NULL, &job->ele[offset]);
+    }
+    return true;
+}
+
+/**
+ \brief `LMK_Distort_Rows` on all processors
+ */
+static void distort_band(const LMK *lmk, const LMK_Distortion *distortion, uint64_t seed, uint64_t variant,
+                         int32_t first_row, int32_t nrows, uint8_t *srm, float *ele)
+{
+    DistortJob job;
+    job.lmk = lmk;
+    job.distortion = distortion;
+    job.seed = seed;
+    job.variant = variant;
+    job.first_row = first_row;
+    job.nrows = nrows;
+    job.srm = srm;
+    job.ele = ele;
+
+    parallel_for(nrows > 0 ? (size_t)nrows : 0, 1, 0, distort_rows, &job);
+}
+
+bool Distort_LMK(const LMK *lmk, const LMK_Distortion *distortion, uint64_t seed, uint64_t variant, LMK *lmk_out)
+{
+    // The stages only change elevations, so the output starts as a copy on write of the input
+    if(!Share_LMK(lmk, lmk_out)){
+        return false;
+    }
+    LMK_Distort_Header(lmk, distortion, lmk_out);
+    DistortStage stages[LMK_DISTORT_MAX_STAGES];
+    if(distort_stages(distortion, stages) == 0){
+        return true;
+    }
+    float *ele = LMK_Ele_Writable(lmk_out);
+    if(ele == NULL){
+        free_lmk(lmk_out);
+        return false;
+    }
+    distort_band(lmk, distortion, seed, variant, 0, lmk->num_rows, NULL, ele);
+    return true;
+}
+
+bool Write_LMK_Distorted_Variants(const LMK *lmk, const LMK_Distortion *distortion, uint64_t seed,
+                                  int32_t num_variants, const char *output)
+{
+    // The prefix of the variant filenames
+    char prefix[1024];
+    size_t length = strlen(output);
+    if(length >= sizeof(prefix)){
+        printf("Write_LMK_Distorted_Variants() ==>> output filepath is too long\n");
+        return false;
+    }
+    memcpy(prefix, output, length + 1);
+    if(length >= 4 && strcmp(&prefix[length - 4], ".lmk") == 0) prefix[length - 4] = '\0';
+
+    int32_t band_rows = LMK_WRITER_BUFFER_BYTES/(5*(lmk->num_cols > 0 ? lmk->num_cols : 1));
+    if(band_rows < 1) band_rows = 1;
+    if(band_rows > lmk->num_rows) band_rows = lmk->num_rows;
+    size_t band_pixels = (size_t)band_rows*lmk->num_cols;
+    uint8_t *srm = (uint8_t *)malloc(band_pixels*sizeof(uint8_t));
+    float *ele = (float *)malloc(band_pixels*sizeof(float));
+    if(srm == NULL || ele == NULL){
+        printf("Write_LMK_Distorted_Variants() ==>> malloc() failed\n");
+        free(srm);
+        free(ele);
+        return false;
+    }
+
+    LMK header = {0};
+    LMK_Distort_Header(lmk, distortion, &header);
+    bool success = true;
+    for(int32_t v = 0; v < num_variants && success; v++){
+        char filename[1100];
+        if(num_variants == 1){
+            snprintf(filename, sizeof(filename), "%s", output);
+        }else{
+            snprintf(filename, sizeof(filename), "%s_%04d.lmk", prefix, v);
+        }
+        LMK_Writer *writer = Open_LMK_Writer(filename, &header);
+        if(writer == NULL){
+            SAFE_PRINTF(1200, "Write_LMK_Distorted_Variants() ==>> failed to open %s\n", filename);
+            success = false;
+            break;
+        }
+
+        // The writer copies each band, so the next band is distorted while it is written
+        for(int32_t row = 0; row < lmk->num_rows && success; row += band_rows){
+            int32_t nrows = lmk->num_rows - row < band_rows ? lmk->num_rows - row : band_rows;
+            distort_band(lmk, distortion, seed, (uint64_t)v, row, nrows, srm, ele);
+            success = Append_LMK_Rows(writer, srm, ele, nrows);
+        }
+        success = Close_LMK_Writer(writer) && success;
+        if(!success){
+            SAFE_PRINTF(1200, "Write_LMK_Distorted_Variants() ==>> failed to write %s\n", filename);
+        }
+    }
+
+    free(srm);
+    free(ele);
+    return success;
+}
@@ -0,0 +1,133 @@
+/**
+ * \file `lmk_distort.h`
+ * \brief Simulated map errors, for Monte Carlo campaigns of many distorted variants of one landmark
+ *
+ * The rotation and translation change the header. The elevation displacements are stages applied in turn to one row
+ * at a time, in the order gaussian, cubic, sine, so every requested perturbation is one pass over the rasters.
+ *
+ * Random draws come from a counter based generator (Philox4x32-10) keyed by the campaign seed: the noise of pixel i of
+ * variant v depends only on (seed, v, i). Variants are reproducible independently of each other and of the number of
+ * threads that compute them.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LMK_DISTORT_H_
+#define _LANDMARK_TOOLS_LMK_DISTORT_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stddef.h>                                          // for size_t
+#include <stdint.h>                                          // for uint64_t
+
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Distortion applied to every variant
+ */
+typedef struct {
+    double translate[3];        //!< map tie error in meters, in the map frame of the input landmark
+    double rotate_degrees;      //!< in-plane map orientation error
+    bool gaussian;              //!< whether to displace each elevation by gaussian noise
+    double gaussian_mean;       //!< mean of the elevation noise in meters
+    double gaussian_stddev;     //!< standard deviation of the elevation noise in meters
+    bool cubic;                 //!< whether to displace each elevation z by a cubic polynomial of z
+    double cubic_coefficients[4]; //!< coefficients of the cubic displacement, highest degree first
+    bool sine;                  //!< whether to displace the elevations by one cycle of a sine wave through the center
+    double sine_amplitude;      //!< amplitude of the wave in meters
+    double sine_frequency;      //!< cycles per pixel along the wave axis
+    double sine_azimuth;        //!< direction of the wave axis in degrees from the columns toward the rows
+} LMK_Distortion;
+
+/**
+ * \brief Distortion that leaves the landmark unchanged
+ */
+void LMK_Distortion_Init(LMK_Distortion *distortion);
+
+/**
+ * \brief Normal samples `first` to `first + n - 1` of one variant
+ *
+ * \param[in] seed campaign seed
+ * \param[in] variant
+ * \param[in] first index of the first sample
+ * \param[in] n number of samples
+ * \param[in] mean
+ * \param[in] stddev
+ * \param[out] samples
+ */
+void LMK_Gaussian_Samples(uint64_t seed, uint64_t variant, uint64_t first, size_t n, double mean, double stddev,
+                          double *samples);
+
+/**
+ * \brief Header of a distorted landmark: the rotation and translation
+ *
+ * \param[in] lmk input landmark
+ * \param[in] distortion
+ * \param[out] header input header with the rotated map frame and translated anchor point
+ */
+void LMK_Distort_Header(const LMK *lmk, const LMK_Distortion *distortion, LMK *header);
+
+/**
+ * \brief Distorted pixels of rows `first_row` to `first_row + nrows - 1` of one variant
+ *
+ * \param[in] lmk input landmark
+ * \param[in] distortion
+ * \param[in] seed campaign seed
+ * \param[in] variant
+ * \param[in] first_row
+ * \param[in] nrows
+ * \param[out] srm nrows*num_cols surface reflectance values, or NULL to leave them out. They are not distorted
+ * \param[out] ele nrows*num_cols elevation values
+ */
+void LMK_Distort_Rows(const LMK *lmk, const LMK_Distortion *distortion, uint64_t seed, uint64_t variant,
+                      int32_t first_row, int32_t nrows, uint8_t *srm, float *ele);
+
+/**
+ * \brief One distorted variant of a landmark in memory, computed on all processors
+ *
+ * \param[in] lmk input landmark
+ * \param[in] distortion
+ * \param[in] seed campaign seed
+ * \param[in] variant
+ * \param[out] lmk_out distorted landmark. It shares the surface reflectance map of `lmk`, and also the elevation map
+ * if the distortion only moves the map frame, see `Share_LMK`
+ * \return false if memory allocation fails
+ */
+bool Distort_LMK(const LMK *lmk, const LMK_Distortion *distortion, uint64_t seed, uint64_t variant, LMK *lmk_out);
+
+/**
+ * \brief Write variants `0` to `num_variants - 1` of a landmark
+ *
+ * Bands of rows are distorted on all processors while the previous band is written with `LMK_Writer`. One variant is
+ * written to `output`. Several are written to `<output>_<variant>.lmk`, after removing a `.lmk` suffix from `output`.
+ *
+ * \param[in] lmk input landmark
+ * \param[in] distortion
+ * \param[in] seed campaign seed
+ * \param[in] num_variants
+ * \param[in] output output filepath
+ * \return false on io error or if memory allocation fails
+ */
+bool Write_LMK_Distorted_Variants(const LMK *lmk, const LMK_Distortion *distortion, uint64_t seed,
+                                  int32_t num_variants, const char *output);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_LMK_DISTORT_H_ */
@@ -0,0 +1,190 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>                   // for isnan
+#include <stdio.h>                  // for printf
+#include <stdlib.h>                 // for malloc, free
+#include <string.h>                 // for memcpy
+
+#include "landmark_tools/landmark_util/landmark.h"
+#include "landmark_tools/landmark_util/lmk_edit.h"
+#include "landmark_tools/landmark_util/lmk_reader.h"
+#include "landmark_tools/landmark_util/lmk_writer.h"
+#include "landmark_tools/utils/safe_string.h"
+
+/**
+ \brief Output rows of `ncols` pixels that fill one buffer of the writer
+ */
+static int32_t band_rows(int32_t ncols)
+{
+    int64_t rows = LMK_WRITER_BUFFER_BYTES/((int64_t)ncols*(sizeof(uint8_t) + sizeof(float)));
+    return rows < 1 ? 1 : (int32_t)rows;
+}
+
+bool Subset_LMK_File(const char *infile, const char *outfile, int32_t left, int32_t top, int32_t ncols,
+                     int32_t nrows)
+{
+    LMK lmk = {0};
+    LMK_Row_Reader *reader = Open_LMK_Row_Reader(infile, &lmk);
+    if(reader == NULL) return false;
+
+    if(left < 0 || top < 0 || ncols <= 0 || nrows <= 0 ||
+       left + ncols > lmk.num_cols || top + nrows > lmk.num_rows)
+    {
+        SAFE_PRINTF(512, "Subset_LMK_File() ==>> roi %d %d %d %d is outside of %s (%d x %d)\n",
+                    left, top, ncols, nrows, infile, lmk.num_cols, lmk.num_rows);
+        Close_LMK_Row_Reader(reader);
+        return false;
+    }
+
+    LMK header = {0};
+    Subset_LMK_Header(&lmk, &header, left, top, ncols, nrows);
+    int32_t rows = band_rows(ncols);
+    if(rows > nrows) rows = nrows;
+
+    // Full width rois are appended straight from the rows read
+    bool full_width = ncols == lmk.num_cols;
+    uint8_t *srm = full_width ? NULL : (uint8_t *)malloc(sizeof(uint8_t)*ncols*rows);
+    float *ele = full_width ? NULL : (float *)malloc(sizeof(float)*ncols*rows);
+    LMK_Writer *writer = full_width || (srm != NULL && ele != NULL) ? Open_LMK_Writer(outfile, &header) : NULL;
+    bool success = writer != NULL;
+
+    LMK band = {0};
+    for(int32_t m = 0; m < nrows && success; m += rows){
+        int32_t n = m + rows < nrows ? rows : nrows - m;
+        success &= Read_LMK_Rows(reader, top + m, n, &band);
+        if(success && !full_width){
+            for(int32_t i = 0; i < n; i++){
+                size_t from = (size_t)i*lmk.num_cols + left;
+                memcpy(&srm[(size_t)i*ncols], &band.srm[from], sizeof(uint8_t)*ncols);
+                memcpy(&ele[(size_t)i*ncols], &band.ele[from], sizeof(float)*ncols);
+            }
+        }
+        success = success && Append_LMK_Rows(writer, full_width ? band.srm : srm, full_width ? band.ele : ele, n);
+    }
+    if(writer != NULL){
+        success = Close_LMK_Writer(writer) && success;
+    }
+    if(!success){
+        SAFE_PRINTF(512, "Subset_LMK_File() ==>> failed to subset %s\n", infile);
+    }
+    free(srm);
+    free(ele);
+    Close_LMK_Row_Reader(reader);
+    return success;
+}
+
+bool Crop_Interpolate_LMK_File(const char *infile, const char *outfile, int32_t left, int32_t top, int32_t ncols,
+                               int32_t nrows)
+{
+    LMK lmk = {0};
+    LMK_Row_Reader *reader = Open_LMK_Row_Reader(infile, &lmk);
+    if(reader == NULL) return false;
+    if(ncols <= 0 || nrows <= 0){
+        printf("Crop_Interpolate_LMK_File() ==>> invalid roi size\n");
+        Close_LMK_Row_Reader(reader);
+        return false;
+    }
+
+    LMK band = {0};
+    int32_t band_top = 0;
+    int32_t center_col = left + ncols/2;
+    int32_t center_row = top + nrows/2;
+    if(!Read_LMK_Rows_Interpolate(reader, center_row, center_row, &band, &band_top)){
+        Close_LMK_Row_Reader(reader);
+        return false;
+    }
+    LMK header = {0};
+    Crop_LMK_Header(&lmk, &header, left, top, ncols, nrows,
+                    Interpolate_LMK_ELE(&band, center_col, center_row - band_top));
+    int32_t rows = band_rows(ncols);
+    if(rows > nrows) rows = nrows;
+
+    // The source positions of a band of output rows, then the buffers of `Crop_IntepolateLMK` for one row
+    size_t band_pixels = (size_t)ncols*rows;
+    double *x = (double *)malloc(sizeof(double)*(2*band_pixels + 9*(size_t)ncols));
+    uint8_t *srm = (uint8_t *)malloc(sizeof(uint8_t)*band_pixels);
+    float *ele_out = (float *)malloc(sizeof(float)*band_pixels);
+    LMK_Writer *writer = x != NULL && srm != NULL && ele_out != NULL ? Open_LMK_Writer(outfile, &header) : NULL;
+    bool success = writer != NULL;
+    double *y = x + band_pixels;
+    double *cols = y + band_pixels;
+    double *crop_rows = cols + ncols;
+    double *band_y = crop_rows + ncols;
+    double *ele = band_y + ncols;
+    double *crop_col = ele + ncols;
+    double *crop_row = crop_col + ncols;
+    double (*p)[3] = (double (*)[3])(crop_row + ncols);
+    for(int32_t j = 0; j < ncols && success; ++j)
+    {
+        cols[j] = (double)j;
+    }
+
+    for(int32_t m = 0; m < nrows && success; m += rows){
+        int32_t n = m + rows < nrows ? rows : nrows - m;
+
+        // The positions do not depend on the elevations, so they give the input rows to read
+        double y_min = INFINITY, y_max = -INFINITY;
+        for(int32_t i = 0; i < n; ++i)
+        {
+            double *xi = &x[(size_t)i*ncols];
+            double *yi = &y[(size_t)i*ncols];
+            for(int32_t j = 0; j < ncols; ++j)
+            {
+                crop_rows[j] = (double)(m + i);
+            }
+            LMK_Col_Row_Elevation2World_Batch(&header, cols, crop_rows, NULL, ncols, p);
+            World2LMK_Col_Row_Ele_Batch(&lmk, (const double (*)[3])p, ncols, xi, yi, NULL);
+            for(int32_t j = 0; j < ncols; ++j)
+            {
+                if(yi[j] < y_min) y_min = yi[j];
+                if(yi[j] > y_max) y_max = yi[j];
+            }
+        }
+        success &= Read_LMK_Rows_Interpolate(reader, y_min, y_max, &band, &band_top);
+
+        for(int32_t i = 0; i < n && success; ++i)
+        {
+            double *xi = &x[(size_t)i*ncols];
+            double *yi = &y[(size_t)i*ncols];
+            for(int32_t j = 0; j < ncols; ++j)
+            {
+                band_y[j] = yi[j] - band_top;
+            }
+            Interpolate_LMK_ELE_Batch(&band, xi, band_y, ncols, ele);
+            LMK_Col_Row_Elevation2World_Batch(&lmk, xi, yi, ele, ncols, p);
+            World2LMK_Col_Row_Ele_Batch(&header, (const double (*)[3])p, ncols, crop_col, crop_row, ele);
+            float *ele_row = &ele_out[(size_t)i*ncols];
+            for(int32_t j = 0; j < ncols; ++j)
+            {
+                ele_row[j] = (float)ele[j];
+            }
+            Interpolate_LMK_SRM_Batch(&band, xi, band_y, ncols, &srm[(size_t)i*ncols], NULL);
+        }
+        success = success && Append_LMK_Rows(writer, srm, ele_out, n);
+    }
+    if(writer != NULL){
+        success = Close_LMK_Writer(writer) && success;
+    }
+    if(!success){
+        SAFE_PRINTF(512, "Crop_Interpolate_LMK_File() ==>> failed to crop %s\n", infile);
+    }
+    free(x);
+    free(srm);
+    free(ele_out);
+    Close_LMK_Row_Reader(reader);
+    return success;
+}
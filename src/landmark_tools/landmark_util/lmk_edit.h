@@ -0,0 +1,69 @@
+/**
+ * \file `lmk_edit.h`
+ * \brief Crop and subset landmark files a band of rows at a time
+ *
+ * The input is read with `LMK_Row_Reader` and the output written with `LMK_Writer`, so only the input rows needed by
+ * the current band of output rows are in memory and landmarks larger than memory can be edited. The output files are
+ * identical to the in-memory operations followed by `Write_LMK`. See `Resample_LMK_File` for resampling.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LMK_EDIT_H_
+#define _LANDMARK_TOOLS_LMK_EDIT_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stdint.h>                                          // for int32_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Write a region of interest of a landmark file to a new landmark file, as `Read_LMK_Window`
+ *
+ * Only the rows of the roi are read. `outfile` must differ from `infile`.
+ * \param[in] infile input landmark filepath
+ * \param[in] outfile output landmark filepath
+ * \param[in] left col index for start of roi
+ * \param[in] top row index for start of roi
+ * \param[in] ncols width of roi
+ * \param[in] nrows height of roi
+ * \return false on io error, if memory allocation fails or if the roi is outside of the landmark
+ */
+bool Subset_LMK_File(const char *infile, const char *outfile, int32_t left, int32_t top, int32_t ncols,
+                     int32_t nrows);
+
+/**
+ * \brief Crop a landmark file to a new landmark file with a tangent plane at the center of the roi, as
+ * `Crop_IntepolateLMK`
+ *
+ * Only the input rows under each band of output rows are read. `outfile` must differ from `infile`.
+ * \param[in] infile input landmark filepath
+ * \param[in] outfile output landmark filepath
+ * \param[in] left col index for start of roi
+ * \param[in] top row index for start of roi
+ * \param[in] ncols width of roi
+ * \param[in] nrows height of roi
+ * \return false on io error or if memory allocation fails
+ */
+bool Crop_Interpolate_LMK_File(const char *infile, const char *outfile, int32_t left, int32_t top, int32_t ncols,
+                               int32_t nrows);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_LMK_EDIT_H_ */
@@ -0,0 +1,387 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>                   // for INFINITY, isnan, fabs, sqrt
+#include <stdio.h>                  // for printf
+#include <stdlib.h>                 // for malloc, free
+#include <string.h>                 // for memset
+
+#include "landmark_tools/landmark_util/lmk_height_pyramid.h"
+#include "landmark_tools/utils/parallel.h"
+#include "landmark_tools/utils/safe_string.h"
+#include "math/mat3/mat3.h"
+
+#define LMK_RAY_PACKET_SIZE 256     //neighbouring rays traced together by one thread
+#define LMK_PYRAMID_EDGE 1e-6       //pixels the map box is widened by, so rays along its edges are not lost to rounding
+
+/**
+ \brief Ray in landmark (col, row, elevation) coordinates, where the surface is a height field
+ */
+typedef struct {
+    const LMK *lmk;
+    const LMK_HeightPyramid *pyramid;
+    double p0[3];               //(col, row, elevation) of the ray endpoint
+    double d[3];                //(col, row, elevation) change per unit of the ray parameter
+} PyramidRay;
+
+bool LMK_Height_Pyramid_Build(LMK_HeightPyramid *pyramid, const LMK *lmk)
+{
+    memset(pyramid, 0, sizeof(LMK_HeightPyramid));
+    if(lmk->num_cols < 2 || lmk->num_rows < 2){
+        SAFE_PRINTF(512, "LMK_Height_Pyramid_Build() ==>> landmark of size %d x %d is too small\n", lmk->num_cols, lmk->num_rows);
+        return false;
+    }
+
+    int32_t cols = lmk->num_cols - 1;
+    int32_t rows = lmk->num_rows - 1;
+    for(int32_t level = 0; level < LMK_HEIGHT_PYRAMID_MAX_LEVELS; level++){
+        pyramid->cols[level] = cols;
+        pyramid->rows[level] = rows;
+        pyramid->min_ele[level] = (float *)malloc(sizeof(float)*cols*rows);
+        pyramid->max_ele[level] = (float *)malloc(sizeof(float)*cols*rows);
+        pyramid->num_levels = level + 1;
+        if(pyramid->min_ele[level] == NULL || pyramid->max_ele[level] == NULL){
+            printf("LMK_Height_Pyramid_Build() ==>> malloc() failed\n");
+            LMK_Height_Pyramid_Free(pyramid);
+            return false;
+        }
+
+        float *min_ele = pyramid->min_ele[level];
+        float *max_ele = pyramid->max_ele[level];
+        for(int32_t y = 0; y < rows; y++){
+            for(int32_t x = 0; x < cols; x++){
+                float low = INFINITY;
+                float high = -INFINITY;
+                if(level == 0){
+                    // The corners of the bilinear patch bound it
+                    const float *ele = &lmk->ele[(size_t)y*lmk->num_cols + x];
+                    float corners[4] = {ele[0], ele[1], ele[lmk->num_cols], ele[lmk->num_cols + 1]};
+                    bool hole = false;
+                    for(int32_t k = 0; k < 4; k++){
+                        hole = hole || isnan(corners[k]);
+                        if(corners[k] < low) low = corners[k];
+                        if(corners[k] > high) high = corners[k];
+                    }
+                    if(hole){
+                        low = INFINITY;
+                        high = -INFINITY;
+                    }
+                }else{
+                    int32_t fine_cols = pyramid->cols[level - 1];
+                    int32_t fine_rows = pyramid->rows[level - 1];
+                    for(int32_t fy = 2*y; fy < 2*y + 2 && fy < fine_rows; fy++){
+                        for(int32_t fx = 2*x; fx < 2*x + 2 && fx < fine_cols; fx++){
+                            size_t i = (size_t)fy*fine_cols + fx;
+                            if(pyramid->min_ele[level - 1][i] < low) low = pyramid->min_ele[level - 1][i];
+                            if(pyramid->max_ele[level - 1][i] > high) high = pyramid->max_ele[level - 1][i];
+                        }
+                    }
+                }
+                min_ele[(size_t)y*cols + x] = low;
+                max_ele[(size_t)y*cols + x] = high;
+            }
+        }
+
+        if(cols == 1 && rows == 1) break;
+        cols = (cols + 1)/2;
+        rows = (rows + 1)/2;
+    }
+    return true;
+}
+
+void LMK_Height_Pyramid_Free(LMK_HeightPyramid *pyramid)
+{
+    for(int32_t level = 0; level < pyramid->num_levels; level++){
+        free(pyramid->min_ele[level]);
+        free(pyramid->max_ele[level]);
+    }
+    memset(pyramid, 0, sizeof(LMK_HeightPyramid));
+}
+
+/**
+ \brief Clip the ray parameter interval [t0, t1] to the part of the ray inside [x0, x1] x [y0, y1]
+ \return false if the ray misses the box in the interval
+ */
+static bool clip_ray_box(const PyramidRay *ray, double x0, double x1, double y0, double y1, double *t0, double *t1)
+{
+    double low[2] = {x0, y0};
+    double high[2] = {x1, y1};
+    for(int32_t k = 0; k < 2; k++){
+        if(ray->d[k] == 0.0){
+            if(ray->p0[k] < low[k] || ray->p0[k] > high[k]) return false;
+            continue;
+        }
+        double ta = (low[k] - ray->p0[k])/ray->d[k];
+        double tb = (high[k] - ray->p0[k])/ray->d[k];
+        if(ta > tb){
+            double swap = ta;
+            ta = tb;
+            tb = swap;
+        }
+        if(ta > *t0) *t0 = ta;
+        if(tb < *t1) *t1 = tb;
+    }
+    return *t0 <= *t1;
+}
+
+/**
+ \brief First parameter in [t0, t1] where the ray is on or below the bilinear patch of level 0 cell (x, y)
+ \return false if the ray stays above the patch
+ */
+static bool intersect_patch(const PyramidRay *ray, int32_t x, int32_t y, double t0, double t1, double *t_hit)
+{
+    const LMK *lmk = ray->lmk;
+    const float *ele = &lmk->ele[(size_t)y*lmk->num_cols + x];
+    double h00 = ele[0];
+    double h10 = ele[1];
+    double h01 = ele[lmk->num_cols];
+    double h11 = ele[lmk->num_cols + 1];
+
+    // Height above the ray along the ray, with u and v the position in the patch: f(t) = a t^2 + b t + c
+    double u0 = ray->p0[0] - x;
+    double v0 = ray->p0[1] - y;
+    double du = ray->d[0];
+    double dv = ray->d[1];
+    double hu = h10 - h00;
+    double hv = h01 - h00;
+    double huv = h00 - h10 - h01 + h11;
+    double a = huv*du*dv;
+    double b = hu*du + hv*dv + huv*(u0*dv + v0*du) - ray->d[2];
+    double c = h00 + hu*u0 + hv*v0 + huv*u0*v0 - ray->p0[2];
+
+    double f0 = (a*t0 + b)*t0 + c;
+    if(f0 >= 0.0){
+        *t_hit = t0;
+        return true;
+    }
+
+    double roots[2];
+    int32_t num_roots = 0;
+    if(a == 0.0){
+        if(b != 0.0) roots[num_roots++] = -c/b;
+    }else{
+        double disc = b*b - 4.0*a*c;
+        if(disc >= 0.0){
+            // Stable form of the quadratic roots, also for a small next to b
+            double q = -0.5*(b + (b >= 0.0 ? sqrt(disc) : -sqrt(disc)));
+            roots[num_roots++] = q/a;
+            if(q != 0.0) roots[num_roots++] = c/q;
+        }
+    }
+
+    double best = INFINITY;
+    for(int32_t k = 0; k < num_roots; k++){
+        if(roots[k] >= t0 && roots[k] <= t1 && roots[k] < best) best = roots[k];
+    }
+    if(best == INFINITY){
+        // A crossing lost to rounding at the end of the interval
+        double f1 = (a*t1 + b)*t1 + c;
+        if(f1 < 0.0) return false;
+        best = t1;
+    }
+    *t_hit = best;
+    return true;
+}
+
+/**
+ \brief First hit of the ray in the parameter interval [t0, t1] inside a cell of the pyramid
+ */
+static bool trace_cell(const PyramidRay *ray, int32_t level, int32_t x, int32_t y, double t0, double t1,
+                       double *t_hit)
+{
+    const LMK_HeightPyramid *pyramid = ray->pyramid;
+    size_t i = (size_t)y*pyramid->cols[level] + x;
+    double z0 = ray->p0[2] + ray->d[2]*t0;
+    double z1 = ray->p0[2] + ray->d[2]*t1;
+    if((z0 > z1 ? z1 : z0) > pyramid->max_ele[level][i]){
+        // The ray passes above every patch of the cell, or the cell is a hole
+        return false;
+    }
+    if(level == 0){
+        return intersect_patch(ray, x, y, t0, t1, t_hit);
+    }
+
+    // Visit the cells below in the order the ray crosses them
+    int32_t size = 1 << (level - 1);
+    int32_t child_x[4], child_y[4];
+    double child_t0[4], child_t1[4];
+    int32_t num_children = 0;
+    for(int32_t cy = 2*y; cy < 2*y + 2 && cy < pyramid->rows[level - 1]; cy++){
+        for(int32_t cx = 2*x; cx < 2*x + 2 && cx < pyramid->cols[level - 1]; cx++){
+            double x0 = cx == 0 ? -LMK_PYRAMID_EDGE : (double)cx*size;
+            double y0 = cy == 0 ? -LMK_PYRAMID_EDGE : (double)cy*size;
+            double x1 = (double)(cx + 1)*size < ray->lmk->num_cols - 1 ? (double)(cx + 1)*size : ray->lmk->num_cols - 1 + LMK_PYRAMID_EDGE;
+            double y1 = (double)(cy + 1)*size < ray->lmk->num_rows - 1 ? (double)(cy + 1)*size : ray->lmk->num_rows - 1 + LMK_PYRAMID_EDGE;
+            double ct0 = t0;
+            double ct1 = t1;
+            if(!clip_ray_box(ray, x0, x1, y0, y1, &ct0, &ct1)) continue;
+            int32_t k = num_children++;
+            for(; k > 0 && child_t0[k - 1] > ct0; k--){
+                child_x[k] = child_x[k - 1];
+                child_y[k] = child_y[k - 1];
+                child_t0[k] = child_t0[k - 1];
+                child_t1[k] = child_t1[k - 1];
+            }
+            child_x[k] = cx;
+            child_y[k] = cy;
+            child_t0[k] = ct0;
+            child_t1[k] = ct1;
+        }
+    }
+    for(int32_t k = 0; k < num_children; k++){
+        if(trace_cell(ray, level - 1, child_x[k], child_y[k], child_t0[k], child_t1[k], t_hit)) return true;
+    }
+    return false;
+}
+
+/**
+ \brief Set the direction of a ray whose endpoint `p0` is set, and find its first hit
+ \param[in,out] r ray
+ \param[in] ray ray vector in world frame
+ \param[in] max_range maximum distance to traverse ray in meters, or a negative value for no limit
+ \param[out] t_hit ray parameter of the hit
+ */
+static bool trace_ray(PyramidRay *r, const double ray[3], double max_range, double *t_hit)
+{
+    const LMK *lmk = r->lmk;
+    const LMK_HeightPyramid *pyramid = r->pyramid;
+    double pm[3];
+    mult331((double (*)[3])lmk->mapRworld, (double *)ray, pm);
+    r->d[0] = lmk->mapxy2col_row[0][0]*pm[0] + lmk->mapxy2col_row[0][1]*pm[1];
+    r->d[1] = lmk->mapxy2col_row[1][0]*pm[0] + lmk->mapxy2col_row[1][1]*pm[1];
+    r->d[2] = pm[2];
+
+    double ray_length = mag3((double *)ray);
+    if(ray_length == 0.0) return false;
+    double t0 = 0.0;
+    double t1 = max_range < 0.0 ? INFINITY : max_range/ray_length;
+
+    // Limit the ray to the box of the map and to the elevation range of the map
+    int32_t top = pyramid->num_levels - 1;
+    if(!clip_ray_box(r, -LMK_PYRAMID_EDGE, lmk->num_cols - 1 + LMK_PYRAMID_EDGE, -LMK_PYRAMID_EDGE,
+                     lmk->num_rows - 1 + LMK_PYRAMID_EDGE, &t0, &t1)) return false;
+    double low = pyramid->min_ele[top][0];
+    double high = pyramid->max_ele[top][0];
+    if(low > high) return false;
+    if(r->d[2] != 0.0){
+        double ta = (low - r->p0[2])/r->d[2];
+        double tb = (high - r->p0[2])/r->d[2];
+        if(ta > tb){
+            double swap = ta;
+            ta = tb;
+            tb = swap;
+        }
+        if(ta > t0) t0 = ta;
+        if(tb < t1) t1 = tb;
+    }else if(r->p0[2] > high || r->p0[2] < low){
+        return false;
+    }
+    if(!(t0 <= t1) || isinf(t1)) return false;
+
+    return trace_cell(r, top, 0, 0, t0, t1, t_hit);
+}
+
+bool Intersect_LMK_ELE_Pyramid(const LMK *lmk, const LMK_HeightPyramid *pyramid, const double c[3],
+                               const double ray[3], double max_range, double point3d[3])
+{
+    if(pyramid->num_levels == 0) return false;
+
+    // World2LMK_Col_Row_Ele is affine, so the ray is a line in (col, row, elevation)
+    PyramidRay r;
+    r.lmk = lmk;
+    r.pyramid = pyramid;
+    World2LMK_Col_Row_Ele(lmk, (double *)c, &r.p0[0], &r.p0[1], &r.p0[2]);
+
+    double t_hit;
+    if(!trace_ray(&r, ray, max_range, &t_hit)) return false;
+    for(int32_t k = 0; k < 3; k++){
+        point3d[k] = c[k] + t_hit*ray[k];
+    }
+    return true;
+}
+
+/**
+ \brief Rays of a batch shared by its threads, which take packets of neighbouring rays in turn
+ */
+typedef struct {
+    PyramidRay origin;          //ray endpoint shared by every ray, in (col, row, elevation)
+    const double *c;
+    const double (*rays)[3];
+    size_t num_rays;
+    double max_range;
+    double (*hits)[3];
+    bool *flags;
+    double (*col_row)[2];
+    size_t num_hits[PARALLEL_MAX_THREADS];  //hits found by each thread
+} RayBatch;
+
+/**
+ \brief `ParallelRangeFn` tracing a packet of rays
+ */
+static bool trace_ray_packet(void *user, int32_t thread, size_t begin, size_t end)
+{
+    RayBatch *batch = (RayBatch *)user;
+    PyramidRay r = batch->origin;
+    for(size_t i = begin; i < end; i++){
+        double t_hit;
+        bool hit = trace_ray(&r, batch->rays[i], batch->max_range, &t_hit);
+        batch->flags[i] = hit;
+        if(!hit){
+            for(int32_t k = 0; k < 3; k++) batch->hits[i][k] = NAN;
+            if(batch->col_row != NULL) batch->col_row[i][0] = batch->col_row[i][1] = NAN;
+            continue;
+        }
+        batch->num_hits[thread]++;
+        for(int32_t k = 0; k < 3; k++){
+            batch->hits[i][k] = batch->c[k] + t_hit*batch->rays[i][k];
+        }
+        if(batch->col_row != NULL){
+            batch->col_row[i][0] = r.p0[0] + t_hit*r.d[0];
+            batch->col_row[i][1] = r.p0[1] + t_hit*r.d[1];
+        }
+    }
+    return true;
+}
+
+size_t Intersect_LMK_ELE_Batch(const LMK *lmk, const LMK_HeightPyramid *pyramid, const double c[3],
+                               const double (*rays)[3], size_t num_rays, double max_range, double (*hits)[3],
+                               bool *flags, double (*col_row)[2])
+{
+    RayBatch batch;
+    batch.origin.lmk = lmk;
+    batch.origin.pyramid = pyramid;
+    World2LMK_Col_Row_Ele(lmk, (double *)c, &batch.origin.p0[0], &batch.origin.p0[1], &batch.origin.p0[2]);
+    batch.c = c;
+    batch.rays = rays;
+    batch.num_rays = pyramid->num_levels == 0 ? 0 : num_rays;
+    batch.max_range = max_range;
+    batch.hits = hits;
+    batch.flags = flags;
+    batch.col_row = col_row;
+    memset(batch.num_hits, 0, sizeof(batch.num_hits));
+    if(pyramid->num_levels == 0){
+        for(size_t i = 0; i < num_rays; i++){
+            flags[i] = false;
+            for(int32_t k = 0; k < 3; k++) hits[i][k] = NAN;
+            if(col_row != NULL) col_row[i][0] = col_row[i][1] = NAN;
+        }
+        return 0;
+    }
+    parallel_for(num_rays, LMK_RAY_PACKET_SIZE, 0, trace_ray_packet, &batch);
+    size_t num_hits = 0;
+    for(int32_t t = 0; t < PARALLEL_MAX_THREADS; t++) num_hits += batch.num_hits[t];
+    return num_hits;
+}
@@ -0,0 +1,112 @@
+/**
+ * \file `lmk_height_pyramid.h`
+ * \brief Min-max pyramid of a landmark elevation map for ray casting
+ *
+ * The surface is the bilinear interpolation of the elevation map, as in `Interpolate_LMK_ELE`. Cell (x, y) of level 0
+ * is the patch between pixels (x, y) and (x + 1, y + 1), and is bounded by the minimum and maximum of its four corners.
+ * A cell of level k + 1 bounds the 2x2 cells of level k below it. Patches with a NAN corner are no-data holes and
+ * are empty at every level.
+ *
+ * A ray is traced down the pyramid, skipping every cell whose bounds it passes above, and is intersected
+ * exactly with the bilinear patches it reaches. Max-mipmap ray casting of height fields is described in
+ * Tevs, Ihrke and Seidel, "Maximum Mipmaps for Fast, Accurate, and Scalable Dynamic Height Field Rendering", 2008.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LMK_HEIGHT_PYRAMID_H_
+#define _LANDMARK_TOOLS_LMK_HEIGHT_PYRAMID_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stddef.h>                                          // for size_t
+#include <stdint.h>                                          // for int32_t
+
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK
+
+#define LMK_HEIGHT_PYRAMID_MAX_LEVELS 32
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Elevation bounds of the cells of every level
+ */
+typedef struct {
+    int32_t num_levels;
+    int32_t cols[LMK_HEIGHT_PYRAMID_MAX_LEVELS];   //!< Cells across each level
+    int32_t rows[LMK_HEIGHT_PYRAMID_MAX_LEVELS];   //!< Cells down each level
+    float *min_ele[LMK_HEIGHT_PYRAMID_MAX_LEVELS]; //!< Lowest elevation of each cell, INFINITY if empty
+    float *max_ele[LMK_HEIGHT_PYRAMID_MAX_LEVELS]; //!< Highest elevation of each cell, -INFINITY if empty
+} LMK_HeightPyramid;
+
+/**
+ * \brief Build the pyramid of a landmark
+ *
+ * The pyramid must be rebuilt when the elevation map changes.
+ * \param[out] pyramid
+ * \param[in] lmk landmark of at least 2x2 pixels
+ * \return false if the landmark is too small or memory allocation fails
+ */
+bool LMK_Height_Pyramid_Build(LMK_HeightPyramid *pyramid, const LMK *lmk);
+
+/**
+ * \brief Free the levels of a pyramid
+ */
+void LMK_Height_Pyramid_Free(LMK_HeightPyramid *pyramid);
+
+/**
+ * \brief Find the first intersection of a ray in the world frame with the landmark elevation map
+ *
+ * The intersection is the first point of the ray between the lowest and highest elevations of the map that is on or
+ * below the bilinear surface. It is exact at any slant angle, and the cost grows with the logarithm of the map size
+ * rather than with the length of the ray.
+ * \param[in] lmk landmark the pyramid was built from
+ * \param[in] pyramid
+ * \param[in] c 3d ray endpoint in world frame
+ * \param[in] ray ray vector in world frame
+ * \param[in] max_range maximum distance to traverse ray in meters, or a negative value for no limit
+ * \param[out] point3d intersection point in world frame
+ * \return true if success
+ * \return false if the ray misses the map within `max_range`
+ */
+bool Intersect_LMK_ELE_Pyramid(const LMK *lmk, const LMK_HeightPyramid *pyramid, const double c[3],
+                               const double ray[3], double max_range, double point3d[3]);
+
+/**
+ * \brief Intersect many rays from one endpoint with the landmark elevation map, such as the pixels of a camera image
+ *
+ * Each ray gets the same hit as `Intersect_LMK_ELE_Pyramid`. The rays are traced on all processors in packets of
+ * neighbouring rays, so rays of neighbouring pixels should be neighbours in `rays`.
+ * \param[in] lmk landmark the pyramid was built from
+ * \param[in] pyramid
+ * \param[in] c 3d ray endpoint in world frame
+ * \param[in] rays `num_rays` ray vectors in world frame
+ * \param[in] num_rays
+ * \param[in] max_range maximum distance to traverse each ray in meters, or a negative value for no limit
+ * \param[out] hits `num_rays` intersection points in world frame, NAN for rays that miss the map
+ * \param[out] flags `num_rays` flags, true for rays that hit the map
+ * \param[out] col_row `num_rays` landmark (col, row) of the intersection points, or NULL to skip
+ * \return number of rays that hit the map
+ */
+size_t Intersect_LMK_ELE_Batch(const LMK *lmk, const LMK_HeightPyramid *pyramid, const double c[3],
+                               const double (*rays)[3], size_t num_rays, double max_range, double (*hits)[3],
+                               bool *flags, double (*col_row)[2]);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_LMK_HEIGHT_PYRAMID_H_ */
@@ -0,0 +1,327 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>                   // for atan, cos, sin, sqrt, isnan
+#include <stdio.h>                  // for printf, fopen, fread, fwrite
+#include <string.h>                 // for memcmp, memcpy
+
+#include "landmark_tools/landmark_util/lmk_layers.h"
+#include "landmark_tools/math/math_constants.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/parallel.h"
+
+#define LAYERS_MAGIC "LMKLAYR1"
+#define LAYERS_MAGIC_SIZE 8
+#define LAYERS_BYTE_ORDER 0x01020304u   // read back reversed on a machine of the other byte order
+#define LAYERS_NUM_FIELDS 15            // resolution, anchor column and row, anchor point, mapRworld
+
+/**
+ * \brief Layers held in a layer file, in file order
+ */
+static const LMK_LayerKind saved_layers[] = {LMK_LAYER_WORLD, LMK_LAYER_SLOPE, LMK_LAYER_HILLSHADE};
+#define NUM_SAVED_LAYERS ((int32_t)(sizeof(saved_layers)/sizeof(saved_layers[0])))
+
+/**
+ * \brief Layer computed by its threads, which take landmark rows in turn
+ */
+typedef struct {
+    const LMK *lmk;
+    void *data;
+    double sun[3];              //direction toward the sun in map frame, for the hillshade
+} LayerJob;
+
+static void release_layer(void *data)
+{
+    mem_free(data);
+}
+
+static size_t layer_bytes(LMK_LayerKind kind, size_t num_pixels)
+{
+    switch(kind){
+        case LMK_LAYER_WORLD: return num_pixels*3*sizeof(double);
+        case LMK_LAYER_SLOPE: return num_pixels*sizeof(float);
+        case LMK_LAYER_HILLSHADE: return num_pixels*sizeof(uint8_t);
+        default: return 0;
+    }
+}
+
+/**
+ \brief Map frame gradient of the elevation at a pixel
+
+ \param[out] g dz/dx and dz/dy in the map frame
+ \return false if the pixel or a neighbor it uses has no elevation
+ */
+static bool pixel_gradient(const LMK *lmk, int32_t col, int32_t row, double g[2])
+{
+    int32_t left = col > 0 ? col - 1 : col;
+    int32_t right = col + 1 < lmk->num_cols ? col + 1 : col;
+    int32_t up = row > 0 ? row - 1 : row;
+    int32_t down = row + 1 < lmk->num_rows ? row + 1 : row;
+    const float *ele = lmk->ele;
+    size_t cols = (size_t)lmk->num_cols;
+    float center = ele[(size_t)row*cols + col];
+    float ele_left = ele[(size_t)row*cols + left], ele_right = ele[(size_t)row*cols + right];
+    float ele_up = ele[(size_t)up*cols + col], ele_down = ele[(size_t)down*cols + col];
+    if(isnan(center) || isnan(ele_left) || isnan(ele_right) || isnan(ele_up) || isnan(ele_down)) return false;
+
+    // Derivatives along the columns and rows, zero across a landmark one pixel wide
+    double dcol = right > left ? (double)(ele_right - ele_left)/(right - left) : 0.0;
+    double drow = down > up ? (double)(ele_down - ele_up)/(down - up) : 0.0;
+
+    // [dcol, drow] is the transpose of the Jacobian of col_row2mapxy times the map gradient
+    double a = lmk->col_row2mapxy[0][0], b = lmk->col_row2mapxy[0][1];
+    double c = lmk->col_row2mapxy[1][0], d = lmk->col_row2mapxy[1][1];
+    double det = a*d - b*c;
+    if(det == 0.0) return false;
+    g[0] = (d*dcol - c*drow)/det;
+    g[1] = (a*drow - b*dcol)/det;
+    return true;
+}
+
+static bool world_rows(void *user, int32_t thread, size_t begin, size_t end)
+{
+    (void)thread;
+    LayerJob *job = (LayerJob *)user;
+    const LMK *lmk = job->lmk;
+    double (*world)[3] = (double (*)[3])job->data;
+    for(size_t i = begin; i < end; i++){
+        for(int32_t j = 0; j < lmk->num_cols; j++){
+            size_t index = i*lmk->num_cols + j;
+            double ele = lmk->ele[index];
+            if(isnan(ele)){
+                world[index][0] = world[index][1] = world[index][2] = NAN;
+            }else{
+                // The arithmetic of LMK_Col_Row2World at a whole pixel, so readers of the layer get the same point
+                LMK_Col_Row_Elevation2World(lmk, (double)j, (double)i, ele, world[index]);
+            }
+        }
+    }
+    return true;
+}
+
+static bool slope_rows(void *user, int32_t thread, size_t begin, size_t end)
+{
+    (void)thread;
+    LayerJob *job = (LayerJob *)user;
+    const LMK *lmk = job->lmk;
+    float *slope = (float *)job->data;
+    for(size_t i = begin; i < end; i++){
+        for(int32_t j = 0; j < lmk->num_cols; j++){
+            double g[2];
+            slope[i*lmk->num_cols + j] = pixel_gradient(lmk, j, (int32_t)i, g) ?
+                                         (float)(atan(sqrt(g[0]*g[0] + g[1]*g[1]))*RAD2DEG) : NAN;
+        }
+    }
+    return true;
+}
+
+static bool hillshade_rows(void *user, int32_t thread, size_t begin, size_t end)
+{
+    (void)thread;
+    LayerJob *job = (LayerJob *)user;
+    const LMK *lmk = job->lmk;
+    uint8_t *shade = (uint8_t *)job->data;
+    for(size_t i = begin; i < end; i++){
+        for(int32_t j = 0; j < lmk->num_cols; j++){
+            double g[2];
+            uint8_t value = 0;
+            if(pixel_gradient(lmk, j, (int32_t)i, g)){
+                // Cosine of the incidence angle on the surface normal (-gx, -gy, 1)
+                double r = (-g[0]*job->sun[0] - g[1]*job->sun[1] + job->sun[2])/sqrt(g[0]*g[0] + g[1]*g[1] + 1.0);
+                double scaled = 255.0*r + 0.5;
+                value = scaled >= 255.0 ? 255 : (scaled <= 0.0 ? 0 : (uint8_t)scaled);
+            }
+            shade[i*lmk->num_cols + j] = value;
+        }
+    }
+    return true;
+}
+
+/**
+ \brief The layer of a landmark, computed by `rows` the first time
+ */
+static const void *compute_layer(LMK *lmk, LMK_LayerKind kind, ParallelRangeFn rows, LayerJob *job)
+{
+    const void *layer = LMK_Layer(lmk, kind);
+    if(layer != NULL) return layer;
+    if(lmk->ele == NULL || lmk->num_pixels <= 0) return NULL;
+
+    job->lmk = lmk;
+    job->data = mem_malloc(MEM_LANDMARK, layer_bytes(kind, (size_t)lmk->num_pixels));
+    if(job->data == NULL){
+        printf("compute_layer() ==>> malloc() failed\n");
+        return NULL;
+    }
+    parallel_for((size_t)lmk->num_rows, 1, 0, rows, job);
+    return LMK_Set_Layer(lmk, kind, job->data, release_layer);
+}
+
+const double *LMK_World_Layer(LMK *lmk)
+{
+    LayerJob job;
+    return (const double *)compute_layer(lmk, LMK_LAYER_WORLD, world_rows, &job);
+}
+
+const float *LMK_Slope_Layer(LMK *lmk)
+{
+    LayerJob job;
+    return (const float *)compute_layer(lmk, LMK_LAYER_SLOPE, slope_rows, &job);
+}
+
+const uint8_t *LMK_Hillshade_Layer(LMK *lmk)
+{
+    LayerJob job;
+    double azimuth = LMK_HILLSHADE_AZIMUTH*DEG2RAD;
+    double altitude = LMK_HILLSHADE_ALTITUDE*DEG2RAD;
+    job.sun[0] = sin(azimuth)*cos(altitude);
+    job.sun[1] = cos(azimuth)*cos(altitude);
+    job.sun[2] = sin(altitude);
+    return (const uint8_t *)compute_layer(lmk, LMK_LAYER_HILLSHADE, hillshade_rows, &job);
+}
+
+/**
+ * \brief FNV-1a style hash of the elevation the layers were computed from
+ */
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(uint64_t));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * \brief Header fields of a layer file, which must all be equal to load the layers
+ */
+static void layers_fields(const LMK *lmk, int32_t size[2], double fields[LAYERS_NUM_FIELDS], uint64_t *hash)
+{
+    size[0] = lmk->num_cols;
+    size[1] = lmk->num_rows;
+    fields[0] = lmk->resolution;
+    fields[1] = lmk->anchor_col;
+    fields[2] = lmk->anchor_row;
+    memcpy(&fields[3], lmk->anchor_point, 3*sizeof(double));
+    memcpy(&fields[6], lmk->mapRworld, 9*sizeof(double));
+    *hash = hash_bytes(0xcbf29ce484222325ULL, lmk->ele, (size_t)lmk->num_pixels*sizeof(float));
+}
+
+bool LMK_Save_Layers(const LMK *lmk, const char *filename)
+{
+    if(lmk->ele == NULL){
+        printf("LMK_Save_Layers() ==>> landmark has no elevation\n");
+        return false;
+    }
+    FILE *fp = fopen(filename, "wb");
+    if(fp == NULL){
+        printf("LMK_Save_Layers() ==>> cannot open %s\n", filename);
+        return false;
+    }
+
+    uint32_t byte_order = LAYERS_BYTE_ORDER;
+    int32_t size[2];
+    double fields[LAYERS_NUM_FIELDS];
+    uint64_t hash;
+    layers_fields(lmk, size, fields, &hash);
+    bool success = fwrite(LAYERS_MAGIC, 1, LAYERS_MAGIC_SIZE, fp) == LAYERS_MAGIC_SIZE &&
+                   fwrite(&byte_order, sizeof(uint32_t), 1, fp) == 1 &&
+                   fwrite(size, sizeof(int32_t), 2, fp) == 2 &&
+                   fwrite(fields, sizeof(double), LAYERS_NUM_FIELDS, fp) == LAYERS_NUM_FIELDS &&
+                   fwrite(&hash, sizeof(uint64_t), 1, fp) == 1;
+
+    // Each computed layer is its kind, its size in bytes and its array
+    for(int32_t k = 0; success && k < NUM_SAVED_LAYERS; k++){
+        const void *layer = LMK_Layer(lmk, saved_layers[k]);
+        if(layer == NULL) continue;
+        int32_t kind = saved_layers[k];
+        uint64_t bytes = layer_bytes(saved_layers[k], (size_t)lmk->num_pixels);
+        success = fwrite(&kind, sizeof(int32_t), 1, fp) == 1 &&
+                  fwrite(&bytes, sizeof(uint64_t), 1, fp) == 1 &&
+                  fwrite(layer, 1, bytes, fp) == bytes;
+    }
+    success &= fclose(fp) == 0;
+    if(!success) printf("LMK_Save_Layers() ==>> cannot write %s\n", filename);
+    return success;
+}
+
+bool LMK_Load_Layers(LMK *lmk, const char *filename)
+{
+    if(lmk->ele == NULL){
+        printf("LMK_Load_Layers() ==>> landmark has no elevation\n");
+        return false;
+    }
+    FILE *fp = fopen(filename, "rb");
+    if(fp == NULL){
+        printf("LMK_Load_Layers() ==>> cannot open %s\n", filename);
+        return false;
+    }
+
+    char magic[LAYERS_MAGIC_SIZE];
+    uint32_t byte_order = 0;
+    int32_t size[2], stored_size[2];
+    double fields[LAYERS_NUM_FIELDS], stored_fields[LAYERS_NUM_FIELDS];
+    uint64_t hash, stored_hash;
+    bool header = fread(magic, 1, LAYERS_MAGIC_SIZE, fp) == LAYERS_MAGIC_SIZE &&
+                  memcmp(magic, LAYERS_MAGIC, LAYERS_MAGIC_SIZE) == 0 &&
+                  fread(&byte_order, sizeof(uint32_t), 1, fp) == 1 && byte_order == LAYERS_BYTE_ORDER &&
+                  fread(stored_size, sizeof(int32_t), 2, fp) == 2 &&
+                  fread(stored_fields, sizeof(double), LAYERS_NUM_FIELDS, fp) == LAYERS_NUM_FIELDS &&
+                  fread(&stored_hash, sizeof(uint64_t), 1, fp) == 1;
+    if(!header){
+        fclose(fp);
+        printf("LMK_Load_Layers() ==>> %s is not a layer file of this machine\n", filename);
+        return false;
+    }
+    layers_fields(lmk, size, fields, &hash);
+    if(memcmp(size, stored_size, sizeof(size)) != 0 || memcmp(fields, stored_fields, sizeof(fields)) != 0 ||
+       hash != stored_hash){
+        fclose(fp);
+        printf("LMK_Load_Layers() ==>> %s was written for another elevation or map frame\n", filename);
+        return false;
+    }
+
+    // Every layer is read before any is kept, so a truncated file leaves the landmark as it was
+    void *data[LMK_NUM_LAYERS] = {NULL};
+    bool success = true;
+    int32_t kind;
+    uint64_t bytes;
+    while(success && fread(&kind, sizeof(int32_t), 1, fp) == 1){
+        success = fread(&bytes, sizeof(uint64_t), 1, fp) == 1 && kind >= 0 && kind < LMK_NUM_LAYERS &&
+                  data[kind] == NULL && bytes > 0 &&
+                  bytes == layer_bytes((LMK_LayerKind)kind, (size_t)lmk->num_pixels);
+        if(success) data[kind] = mem_malloc(MEM_LANDMARK, (size_t)bytes);
+        success = success && data[kind] != NULL && fread(data[kind], 1, (size_t)bytes, fp) == bytes;
+    }
+    fclose(fp);
+    if(!success){
+        for(int32_t k = 0; k < LMK_NUM_LAYERS; k++) mem_free(data[k]);
+        printf("LMK_Load_Layers() ==>> cannot read %s\n", filename);
+        return false;
+    }
+
+    // LMK_Set_Layer takes each array, and releases it if the layer was already computed
+    for(int32_t k = 0; k < LMK_NUM_LAYERS; k++){
+        if(data[k] != NULL) success &= LMK_Set_Layer(lmk, (LMK_LayerKind)k, data[k], release_layer) != NULL;
+    }
+    return success;
+}
@@ -0,0 +1,88 @@
+/**
+ * \file `lmk_layers.h`
+ * \brief Rasters derived from the elevation of a landmark, computed once and kept with it
+ *
+ * The world point of each pixel, the slope and the shaded relief are computed on the first call of their getter and
+ * held by the landmark until its elevation or map frame changes, see `LMK_Layer`. Later calls, from any thread,
+ * return the same array. The layers can be written next to the landmark file with `LMK_Save_Layers` and read back
+ * with `LMK_Load_Layers`, which checks they were computed from the same elevation.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LMK_LAYERS_H_
+#define _LANDMARK_TOOLS_LMK_LAYERS_H_
+
+#include <stdbool.h>                                // for bool
+#include <stdint.h>                                 // for uint8_t
+
+#include "landmark_tools/landmark_util/landmark.h"  // for LMK, LMK_LayerKind
+
+#define LMK_LAYERS_SIDECAR_SUFFIX ".layers"  //!< Suffix of the layer file written next to a landmark file
+#define LMK_HILLSHADE_AZIMUTH 315.0          //!< Sun azimuth of the shaded relief, degrees clockwise from map +y
+#define LMK_HILLSHADE_ALTITUDE 45.0          //!< Sun elevation of the shaded relief, degrees above the map plane
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief World frame point of each pixel, `LMK_Col_Row_Elevation2World` of its column, row and elevation
+ *
+ * Pixels without elevation hold NAN. The layer takes 24 bytes per pixel, so callers that only benefit from it use
+ * `LMK_Layer(lmk, LMK_LAYER_WORLD)` rather than forcing it.
+ * \return num_pixels x 3 doubles, or NULL if memory allocation fails
+ */
+const double *LMK_World_Layer(LMK *lmk);
+
+/**
+ * \brief Slope of each pixel in degrees, from central differences of the elevation
+ *
+ * Edge pixels use one-sided differences. Pixels whose elevation or a neighbor's is NAN hold NAN.
+ * \return num_pixels floats, or NULL if memory allocation fails
+ */
+const float *LMK_Slope_Layer(LMK *lmk);
+
+/**
+ * \brief Shaded relief of the elevation lit from `LMK_HILLSHADE_AZIMUTH` and `LMK_HILLSHADE_ALTITUDE`
+ *
+ * 255 faces the sun and 0 faces away from it. Pixels whose slope is NAN hold 0.
+ * \return num_pixels bytes, or NULL if memory allocation fails
+ */
+const uint8_t *LMK_Hillshade_Layer(LMK *lmk);
+
+/**
+ * \brief Write the world, slope and hillshade layers that were computed for a landmark
+ *
+ * \param[in] lmk landmark
+ * \param[in] filename layer file, by convention the landmark file followed by `LMK_LAYERS_SIDECAR_SUFFIX`
+ * \return false if the file cannot be written
+ */
+bool LMK_Save_Layers(const LMK *lmk, const char *filename);
+
+/**
+ * \brief Keep the layers of a file of `LMK_Save_Layers` with a landmark
+ *
+ * \param[in,out] lmk landmark
+ * \param[in] filename layer file
+ * \return false if the file cannot be read or was written for another elevation or map frame. No layer is kept then
+ */
+bool LMK_Load_Layers(LMK *lmk, const char *filename);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_LMK_LAYERS_H_ */
@@ -0,0 +1,387 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <errno.h>                  // for errno, ENOENT
+#include <math.h>                   // for NAN, isnan, fabs, log
+#include <stdio.h>                  // for fopen, fread, fwrite, fclose, remove
+#include <stdlib.h>                 // for malloc, free
+#include <string.h>                 // for memcpy, memset, strncmp, strncpy
+#include <sys/stat.h>               // for stat
+
+#include "landmark_tools/landmark_util/lmk_overview.h"
+#include "landmark_tools/utils/endian_read_write.h"
+#include "landmark_tools/utils/safe_string.h"
+
+#define OVERVIEW_FINGERPRINT_SIZE 48 //bytes of the fingerprint of the landmark file
+#define OVERVIEW_PREAMBLE_SIZE (LMK_VERSION_SIZE + 4 + OVERVIEW_FINGERPRINT_SIZE) //bytes before the level offsets
+
+/**
+ \brief Identity of the landmark file a sidecar was built from
+ */
+typedef struct {
+    int32_t num_cols;
+    int32_t num_rows;
+    double resolution;
+    uint64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t header_hash;       //FNV-1a of the first LMK_HEADER_SIZE bytes of the file
+} OverviewFingerprint;
+
+static void sidecar_name(const char *filename, char *sidecar){
+    snprintf(sidecar, LMK_FILENAME_SIZE, "%s%s", filename, LMK_OVERVIEW_EXTENSION);
+}
+
+/**
+ \brief Fingerprint of a landmark file on disk
+ \return false if the file cannot be read
+ */
+static bool fingerprint_lmk_file(const char *filename, OverviewFingerprint *fingerprint){
+    memset(fingerprint, 0, sizeof(OverviewFingerprint));
+    struct stat st;
+    LMK header = {0};
+    if(stat(filename, &st) != 0 || !Read_LMK_Header(filename, &header)) return false;
+    fingerprint->num_cols = header.num_cols;
+    fingerprint->num_rows = header.num_rows;
+    fingerprint->resolution = header.resolution;
+    fingerprint->file_size = (uint64_t)st.st_size;
+    fingerprint->mtime_sec = (int64_t)st.st_mtime;
+#if defined(LINUX_OS)
+    fingerprint->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+#elif defined(MAC_OS)
+    fingerprint->mtime_nsec = (int64_t)st.st_mtimespec.tv_nsec;
+#endif
+
+    FILE *fp = fopen(filename, "rb");
+    if(fp == NULL) return false;
+    uint8_t bytes[LMK_HEADER_SIZE];
+    size_t n = fread(bytes, 1, LMK_HEADER_SIZE, fp);
+    fclose(fp);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < n; i++){
+        hash = (hash ^ bytes[i])*0x100000001b3ull;
+    }
+    fingerprint->header_hash = hash;
+    return true;
+}
+
+static bool write_fingerprint(FILE *fp, const OverviewFingerprint *fingerprint){
+    int32_t dims[2] = {fingerprint->num_cols, fingerprint->num_rows};
+    uint64_t words[4] = {fingerprint->file_size, (uint64_t)fingerprint->mtime_sec, (uint64_t)fingerprint->mtime_nsec,
+                         fingerprint->header_hash};
+    return write_big_endian_array(dims, 32, false, 2, fp) == 2 &&
+           write_double_big_endian(fp, fingerprint->resolution) &&
+           write_big_endian_array(words, 64, false, 4, fp) == 4;
+}
+
+static bool read_fingerprint(FILE *fp, OverviewFingerprint *fingerprint){
+    int32_t dims[2];
+    uint64_t words[4];
+    if(read_big_endian_array(dims, 32, false, 2, fp) != 2 ||
+       !read_double_big_endian(fp, &fingerprint->resolution) ||
+       read_big_endian_array(words, 64, false, 4, fp) != 4){
+        return false;
+    }
+    fingerprint->num_cols = dims[0];
+    fingerprint->num_rows = dims[1];
+    fingerprint->file_size = words[0];
+    fingerprint->mtime_sec = (int64_t)words[1];
+    fingerprint->mtime_nsec = (int64_t)words[2];
+    fingerprint->header_hash = words[3];
+    return true;
+}
+
+static bool same_fingerprint(const OverviewFingerprint *a, const OverviewFingerprint *b){
+    return a->num_cols == b->num_cols && a->num_rows == b->num_rows && a->resolution == b->resolution &&
+           a->file_size == b->file_size && a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec &&
+           a->header_hash == b->header_hash;
+}
+
+/**
+ \brief Header of the next coarser level
+ */
+static void downsample_header_2x(const LMK *lmk, LMK *coarse)
+{
+    // Coarse pixel (c, r) is centered on fine pixel coordinate (2c + 0.5, 2r + 0.5)
+    Copy_LMK_Header(lmk, coarse);
+    coarse->num_cols = lmk->num_cols/2;
+    coarse->num_rows = lmk->num_rows/2;
+    coarse->resolution = 2.0*lmk->resolution;
+    coarse->anchor_col = (lmk->anchor_col - 0.5)/2.0;
+    coarse->anchor_row = (lmk->anchor_row - 0.5)/2.0;
+    calculateDerivedValuesVectors(coarse);
+}
+
+/**
+ \brief Average the 2x2 blocks of fine rows `2r` and `2r + 1` into coarse row `r`
+ \param[in] cols number of coarse columns
+ */
+static void downsample_rows_2x(const float *ele0, const float *ele1, const uint8_t *srm0, const uint8_t *srm1,
+                               int32_t cols, float *ele, uint8_t *srm)
+{
+    for(int32_t c = 0; c < cols; c++){
+        float e = ele0[2*c] + ele0[2*c+1] + ele1[2*c] + ele1[2*c+1];
+        // NAN propagates through the sum
+        ele[c] = isnan(e) ? NAN : 0.25f*e;
+        srm[c] = (uint8_t)((srm0[2*c] + srm0[2*c+1] + srm1[2*c] + srm1[2*c+1] + 2)/4);
+    }
+}
+
+bool Downsample_LMK_2x(const LMK *lmk, LMK *coarse)
+{
+    if(lmk->num_cols < 2 || lmk->num_rows < 2){
+        SAFE_PRINTF(512, "Downsample_LMK_2x() ==>> landmark of size %d x %d is too small\n", lmk->num_cols, lmk->num_rows);
+        return false;
+    }
+
+    downsample_header_2x(lmk, coarse);
+    if(!allocate_lmk_arrays(coarse, coarse->num_cols, coarse->num_rows)){
+        return false;
+    }
+
+    for(int32_t r = 0; r < coarse->num_rows; r++){
+        const float *ele0 = &lmk->ele[(int64_t)(2*r)*lmk->num_cols];
+        const uint8_t *srm0 = &lmk->srm[(int64_t)(2*r)*lmk->num_cols];
+        int64_t k = (int64_t)r*coarse->num_cols;
+        downsample_rows_2x(ele0, ele0 + lmk->num_cols, srm0, srm0 + lmk->num_cols, coarse->num_cols,
+                           &coarse->ele[k], &coarse->srm[k]);
+    }
+    return true;
+}
+
+/**
+ \brief Level of the pyramid being written, which receives the rows of the level below it one at a time
+ */
+typedef struct {
+    LMK header;
+    uint64_t offset;            //file offset of the header
+    int32_t rows_in;            //rows received from the level below
+    float *ele_even;            //even row received from the level below
+    uint8_t *srm_even;
+    float *ele;                 //row being written
+    uint8_t *srm;
+} OverviewLevel;
+
+/**
+ \brief Give row `levels[0].rows_in` of the level below to `levels[0]`, and the coarse rows it completes to the levels above
+ \param[in] num_levels number of levels in `levels`
+ */
+static bool push_overview_row(FILE *fp, OverviewLevel *levels, int32_t num_levels, const float *ele,
+                              const uint8_t *srm)
+{
+    if(num_levels == 0) return true;
+    OverviewLevel *level = &levels[0];
+    int32_t cols = level->header.num_cols;
+    int32_t r = level->rows_in++/2;
+    if(r >= level->header.num_rows) return true;
+    if(level->rows_in % 2 == 1){
+        memcpy(level->ele_even, ele, sizeof(float)*2*cols);
+        memcpy(level->srm_even, srm, sizeof(uint8_t)*2*cols);
+        return true;
+    }
+
+    downsample_rows_2x(level->ele_even, ele, level->srm_even, srm, cols, level->ele, level->srm);
+    uint64_t srm_offset = level->offset + LMK_HEADER_SIZE + (uint64_t)r*cols;
+    uint64_t ele_offset = level->offset + LMK_HEADER_SIZE + (uint64_t)level->header.num_pixels +
+                          (uint64_t)r*cols*sizeof(float);
+    bool success = seek_file_offset(fp, (int64_t)srm_offset) &&
+                   fwrite(level->srm, sizeof(uint8_t), cols, fp) == (size_t)cols &&
+                   seek_file_offset(fp, (int64_t)ele_offset) &&
+                   write_big_endian_array(level->ele, 32, true, cols, fp) == cols;
+    return success && push_overview_row(fp, levels + 1, num_levels - 1, level->ele, level->srm);
+}
+
+bool Write_LMK_Overviews(const char *filename, const LMK *lmk, int32_t max_levels)
+{
+    if(max_levels > LMK_OVERVIEW_MAX_LEVELS) max_levels = LMK_OVERVIEW_MAX_LEVELS;
+
+    // Count the levels and their offsets from the level sizes
+    OverviewLevel levels[LMK_OVERVIEW_MAX_LEVELS];
+    uint64_t offsets[LMK_OVERVIEW_MAX_LEVELS];
+    int32_t num_levels = 0;
+    int64_t cols = lmk->num_cols, rows = lmk->num_rows;
+    while(num_levels < max_levels && cols/2 >= LMK_OVERVIEW_MIN_SIZE && rows/2 >= LMK_OVERVIEW_MIN_SIZE){
+        cols /= 2;
+        rows /= 2;
+        num_levels++;
+    }
+    uint64_t offset = OVERVIEW_PREAMBLE_SIZE + sizeof(uint64_t)*(uint64_t)num_levels;
+    bool success = true;
+    for(int32_t k = 0; k < num_levels; k++){
+        OverviewLevel *level = &levels[k];
+        memset(level, 0, sizeof(OverviewLevel));
+        downsample_header_2x(k == 0 ? lmk : &levels[k-1].header, &level->header);
+        level->offset = offsets[k] = offset;
+        offset += LMK_HEADER_SIZE + (uint64_t)level->header.num_pixels*(sizeof(uint8_t) + sizeof(float));
+        cols = level->header.num_cols;
+        level->ele_even = (float *)malloc(sizeof(float)*2*cols);
+        level->srm_even = (uint8_t *)malloc(sizeof(uint8_t)*2*cols);
+        level->ele = (float *)malloc(sizeof(float)*cols);
+        level->srm = (uint8_t *)malloc(sizeof(uint8_t)*cols);
+        if(level->ele_even == NULL || level->srm_even == NULL || level->ele == NULL || level->srm == NULL){
+            printf("Write_LMK_Overviews() ==>> malloc() failed\n");
+            success = false;
+        }
+    }
+
+    char sidecar[LMK_FILENAME_SIZE];
+    sidecar_name(filename, sidecar);
+    OverviewFingerprint fingerprint;
+    if(success && (!fingerprint_lmk_file(filename, &fingerprint) || fingerprint.num_cols != lmk->num_cols ||
+                   fingerprint.num_rows != lmk->num_rows || fingerprint.resolution != lmk->resolution)){
+        SAFE_PRINTF(512, "Write_LMK_Overviews() ==>> %s must be written before its overviews\n", filename);
+        success = false;
+    }
+    FILE *fp = NULL;
+    if(success){
+        fp = fopen(sidecar, "wb");
+        if(fp == NULL){
+            SAFE_PRINTF(512, "Write_LMK_Overviews() ==>> cannot open file %s to write\n", sidecar);
+            success = false;
+        }
+    }
+
+    if(fp != NULL){
+        char version[LMK_VERSION_SIZE] = {0};
+        strncpy(version, LMK_OVERVIEW_VERSION, LMK_VERSION_SIZE-1);
+        uint32_t count = (uint32_t)num_levels;
+        success = fwrite(version, 1, LMK_VERSION_SIZE, fp) == LMK_VERSION_SIZE;
+        success = success && write_big_endian_array(&count, 32, false, 1, fp) == 1;
+        success = success && write_fingerprint(fp, &fingerprint);
+        success = success && write_big_endian_array(offsets, 64, false, num_levels, fp) == num_levels;
+        for(int32_t k = 0; k < num_levels && success; k++){
+            success = seek_file_offset(fp, (int64_t)offsets[k]) && write_lmk_header(fp, &levels[k].header, LMK_VERSION_V3);
+        }
+
+        // One pass over the landmark: every level is written as soon as the two rows below each of its rows are
+        for(int32_t r = 0; r < lmk->num_rows && success; r++){
+            success = push_overview_row(fp, levels, num_levels, &lmk->ele[(int64_t)r*lmk->num_cols],
+                                        &lmk->srm[(int64_t)r*lmk->num_cols]);
+        }
+        fclose(fp);
+        if(!success){
+            SAFE_PRINTF(512, "Write_LMK_Overviews() ==>> failed to write %s\n", sidecar);
+        }
+    }
+
+    for(int32_t k = 0; k < num_levels; k++){
+        free(levels[k].ele_even);
+        free(levels[k].srm_even);
+        free(levels[k].ele);
+        free(levels[k].srm);
+    }
+    return success;
+}
+
+/**
+ \brief Open a sidecar and read its level offsets
+ \return number of levels, 0 if the sidecar is missing, invalid, or was not built from the landmark file as it is
+*/
+static int32_t open_sidecar(const char *filename, FILE **fp, uint64_t offsets[LMK_OVERVIEW_MAX_LEVELS]){
+    char sidecar[LMK_FILENAME_SIZE];
+    sidecar_name(filename, sidecar);
+    *fp = fopen(sidecar, "rb");
+    if(*fp == NULL) return 0;
+
+    char version[LMK_VERSION_SIZE];
+    uint32_t count = 0;
+    OverviewFingerprint stored, current;
+    bool success = fread(version, 1, LMK_VERSION_SIZE, *fp) == LMK_VERSION_SIZE &&
+                   strncmp(version, LMK_OVERVIEW_VERSION, LMK_VERSION_SIZE) == 0;
+    success = success && read_big_endian_array(&count, 32, false, 1, *fp) == 1 && count <= LMK_OVERVIEW_MAX_LEVELS;
+    success = success && read_fingerprint(*fp, &stored);
+    success = success && read_big_endian_array(offsets, 64, false, count, *fp) == (int64_t)count;
+    if(!success){
+        SAFE_PRINTF(512, "open_sidecar() ==>> %s is not an overview file\n", sidecar);
+        fclose(*fp);
+        *fp = NULL;
+        return 0;
+    }
+    if(!fingerprint_lmk_file(filename, &current) || !same_fingerprint(&stored, &current)){
+        SAFE_PRINTF(512, "open_sidecar() ==>> %s is stale, %s changed after it was built\n", sidecar, filename);
+        fclose(*fp);
+        *fp = NULL;
+        return 0;
+    }
+    return (int32_t)count;
+}
+
+bool Remove_LMK_Overviews(const char *filename)
+{
+    char sidecar[LMK_FILENAME_SIZE];
+    sidecar_name(filename, sidecar);
+    if(remove(sidecar) != 0 && errno != ENOENT){
+        SAFE_PRINTF(512, "Remove_LMK_Overviews() ==>> cannot remove stale overviews %s\n", sidecar);
+        return false;
+    }
+    return true;
+}
+
+int32_t LMK_Overview_Count(const char *filename)
+{
+    FILE *fp;
+    uint64_t offsets[LMK_OVERVIEW_MAX_LEVELS];
+    int32_t count = open_sidecar(filename, &fp, offsets);
+    if(fp != NULL) fclose(fp);
+    return count;
+}
+
+bool Read_LMK_Overview_Level(const char *filename, int32_t level, LMK *lmk)
+{
+    if(level == 0) return Read_LMK(filename, lmk);
+
+    FILE *fp;
+    uint64_t offsets[LMK_OVERVIEW_MAX_LEVELS];
+    int32_t count = open_sidecar(filename, &fp, offsets);
+    if(level < 0 || level > count){
+        SAFE_PRINTF(512, "Read_LMK_Overview_Level() ==>> %s has no overview level %d\n", filename, level);
+        if(fp != NULL) fclose(fp);
+        return false;
+    }
+
+    bool success = seek_file_offset(fp, (int64_t)offsets[level-1]) && read_lmk_header_fp(fp, lmk, false) != 0;
+    success = success && allocate_lmk_arrays(lmk, lmk->num_cols, lmk->num_rows);
+    success = success && fread(lmk->srm, sizeof(uint8_t), lmk->num_pixels, fp) == (size_t)lmk->num_pixels;
+    success = success && read_big_endian_array(lmk->ele, 32, true, lmk->num_pixels, fp) == lmk->num_pixels;
+    fclose(fp);
+
+    strncpy(lmk->filename, filename, LMK_FILENAME_SIZE);
+    if(!success){
+        SAFE_PRINTF(512, "Read_LMK_Overview_Level() ==>> failed to read level %d of %s\n", level, filename);
+    }
+    return success;
+}
+
+bool Read_LMK_Overview(const char *filename, double resolution, LMK *lmk, int32_t *level)
+{
+    LMK header = {0};
+    if(!Read_LMK_Header(filename, &header)) return false;
+
+    // Level k has exactly 2^k times the landmark resolution
+    int32_t count = LMK_Overview_Count(filename);
+    int32_t best = 0;
+    double best_error = INFINITY;
+    for(int32_t k = 0; k <= count; k++){
+        double error = fabs(log(header.resolution*(double)(1 << k)/resolution));
+        if(error < best_error){
+            best_error = error;
+            best = k;
+        }
+    }
+
+    if(level != NULL) *level = best;
+    return Read_LMK_Overview_Level(filename, best, lmk);
+}
@@ -0,0 +1,114 @@
+/**
+ * \file `lmk_overview.h`
+ * \brief Overview pyramid of a landmark stored in a sidecar file
+ *
+ * Level k of the pyramid has 2^k times the resolution of the landmark. Each level is computed from the level below
+ * by averaging 2x2 blocks of pixels. A coarse elevation value is NAN if any of the four fine values is NAN, so the
+ * NAN mask of every level is the conservative reduction of the NAN mask below it. The tangent plane of the landmark
+ * is kept and the anchor pixel is rescaled, so every level shares the world frame geometry of the landmark.
+ *
+ * The levels are stored in "filename".ovr, so they are generated once and loaded at the requested resolution
+ * instead of calling `ResampleLMK` at run time. They are written in one pass over the rows of the landmark, with two
+ * rows of every level in memory.
+ *
+ * The sidecar records a fingerprint of the landmark file it was built from: its size, resolution, file size,
+ * modification time and a hash of its header. A sidecar whose fingerprint does not match the landmark file is stale
+ * and is treated as missing. The writers of landmark files and `Open_LMK_Patch` edits remove the sidecar of the file they
+ * change.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LMK_OVERVIEW_H_
+#define _LANDMARK_TOOLS_LMK_OVERVIEW_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stdint.h>                                          // for int32_t
+
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK
+
+#define LMK_OVERVIEW_VERSION "#! LVS Map Overviews v1.1"
+#define LMK_OVERVIEW_EXTENSION ".ovr"
+#define LMK_OVERVIEW_MAX_LEVELS 16
+#define LMK_OVERVIEW_MIN_SIZE 16 //levels are not generated below this width or height
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Compute the next coarser level of the pyramid
+ * \param[in] lmk landmark or pyramid level
+ * \param[out] coarse level with half the width and height and twice the resolution
+ * \return true on success
+ * \return false if `lmk` is smaller than 2x2 or memory allocation fails
+ */
+bool Downsample_LMK_2x(const LMK *lmk, LMK *coarse);
+
+/**
+ * \brief Build the pyramid of a landmark and write it to "filename".ovr
+ *
+ * Must be called after the landmark file is written, since the sidecar records its fingerprint.
+ * \param[in] filename location of the landmark file the pyramid belongs to
+ * \param[in] lmk landmark
+ * \param[in] max_levels number of coarse levels. Fewer are written if a level would be smaller than LMK_OVERVIEW_MIN_SIZE
+ * \return true on success
+ * \return false on io error, if memory allocation fails, or if the landmark file does not match `lmk`
+ */
+bool Write_LMK_Overviews(const char *filename, const LMK *lmk, int32_t max_levels);
+
+/**
+ * \brief Remove the sidecar of a landmark file, before the file is rewritten or changed in place
+ * \param[in] filename location of the landmark file
+ * \return false if the sidecar exists and cannot be removed
+ */
+bool Remove_LMK_Overviews(const char *filename);
+
+/**
+ * \brief Number of coarse levels in the sidecar of a landmark file
+ * \param[in] filename location of the landmark file
+ * \return number of levels, 0 if there is no sidecar or it is stale
+ */
+int32_t LMK_Overview_Count(const char *filename);
+
+/**
+ * \brief Read one level of the pyramid
+ * \param[in] filename location of the landmark file
+ * \param[in] level 0 for the landmark file itself, k for the level with 2^k times the resolution
+ * \param[out] lmk landmark structure
+ * \return true on success
+ * \return false if the level does not exist, the sidecar is stale, or the level cannot be read
+ */
+bool Read_LMK_Overview_Level(const char *filename, int32_t level, LMK *lmk);
+
+/**
+ * \brief Read the level of the pyramid closest to a requested resolution
+ *
+ * Closest is measured by the ratio of resolutions. If there is no sidecar or it is stale, the landmark file itself
+ * is read.
+ * \param[in] filename location of the landmark file
+ * \param[in] resolution requested meters/pixel
+ * \param[out] lmk landmark structure
+ * \param[out] level level that was read. May be NULL
+ * \return true on success
+ * \return false on io error
+ */
+bool Read_LMK_Overview(const char *filename, double resolution, LMK *lmk, int32_t *level);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _LANDMARK_TOOLS_LMK_OVERVIEW_H_
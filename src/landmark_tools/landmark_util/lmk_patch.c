@@ -0,0 +1,155 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>                  // for fopen, fwrite, fclose
+#include <string.h>                 // for memset, strncpy
+
+#include "landmark_tools/landmark_util/lmk_overview.h"
+#include "landmark_tools/landmark_util/lmk_patch.h"
+#include "landmark_tools/utils/endian_read_write.h"
+#include "landmark_tools/utils/safe_string.h"
+#include "math/mat3/mat3.h"
+
+bool Open_LMK_Patch(const char *filename, LMK_Patch *patch)
+{
+    memset(patch, 0, sizeof(LMK_Patch));
+    patch->fp = fopen(filename, "r+b");
+    if(patch->fp == NULL){
+        SAFE_PRINTF(512, "Open_LMK_Patch() ==>> cannot open file %s to update\n", filename);
+        return false;
+    }
+    strncpy(patch->header.filename, filename, LMK_FILENAME_SIZE - 1);
+    patch->version = read_lmk_header_fp(patch->fp, &patch->header, false);
+    if(patch->version == 0 || !seek_file_offset(patch->fp, 0) ||
+       fread(patch->version_string, sizeof(char), LMK_VERSION_SIZE, patch->fp) != LMK_VERSION_SIZE){
+        SAFE_PRINTF(512, "Open_LMK_Patch() ==>> cannot read the header of %s\n", filename);
+        fclose(patch->fp);
+        patch->fp = NULL;
+        return false;
+    }
+    patch->version_string[LMK_VERSION_SIZE - 1] = '\0';
+    return true;
+}
+
+/**
+ \brief Remove the overview sidecar before the first change to the file
+ */
+static bool begin_change(LMK_Patch *patch)
+{
+    if(!patch->changed){
+        if(!Remove_LMK_Overviews(patch->header.filename)){
+            patch->error = true;
+            return false;
+        }
+        patch->changed = true;
+    }
+    return true;
+}
+
+bool LMK_Patch_Header(LMK_Patch *patch, const LMK *header)
+{
+    LMK *lmk = &patch->header;
+    if(header->num_cols != lmk->num_cols || header->num_rows != lmk->num_rows){
+        printf("LMK_Patch_Header() ==>> the size of a landmark cannot be patched\n");
+        return false;
+    }
+    if(!begin_change(patch)) return false;
+    lmk->BODY = header->BODY;
+    strncpy(lmk->lmk_id, header->lmk_id, LMK_ID_SIZE);
+    lmk->anchor_col = header->anchor_col;
+    lmk->anchor_row = header->anchor_row;
+    lmk->resolution = header->resolution;
+    copy3(header->anchor_point, lmk->anchor_point);
+    copy33(header->mapRworld, lmk->mapRworld);
+    calculateDerivedValuesVectors(lmk);
+
+    // The header block has a fixed size, so it is rewritten whole
+    patch->header_changed = true;
+    if(!seek_file_offset(patch->fp, 0) || !write_lmk_header(patch->fp, lmk, patch->version_string)){
+        printf("LMK_Patch_Header() ==>> failed to write the header\n");
+        patch->error = true;
+        return false;
+    }
+    return true;
+}
+
+/**
+ \brief Whether a window can be patched in the pixel blocks of the file
+ */
+static bool check_window(const LMK_Patch *patch, int32_t left, int32_t top, int32_t ncols, int32_t nrows,
+                         const char *caller)
+{
+    if(patch->version != 3){
+        SAFE_PRINTF(256, "%s() ==>> pixels of tiled landmark files cannot be patched\n", caller);
+        return false;
+    }
+    if(left < 0 || top < 0 || ncols < 0 || nrows < 0 ||
+       left + ncols > patch->header.num_cols || top + nrows > patch->header.num_rows){
+        SAFE_PRINTF(256, "%s() ==>> window is outside of the landmark\n", caller);
+        return false;
+    }
+    return true;
+}
+
+bool LMK_Patch_SRM(LMK_Patch *patch, int32_t left, int32_t top, int32_t ncols, int32_t nrows, const uint8_t *srm)
+{
+    if(!check_window(patch, left, top, ncols, nrows, "LMK_Patch_SRM") || !begin_change(patch)) return false;
+    int64_t cols = patch->header.num_cols;
+
+    // Full width windows are contiguous in the file
+    int32_t rows_per_write = ncols == cols ? nrows : 1;
+    for(int32_t i = 0; i < nrows; i += rows_per_write){
+        int64_t offset = LMK_HEADER_SIZE + (top + i)*cols + left;
+        size_t count = (size_t)ncols*rows_per_write;
+        if(!seek_file_offset(patch->fp, offset) ||
+           fwrite(&srm[(size_t)i*ncols], sizeof(uint8_t), count, patch->fp) != count){
+            printf("LMK_Patch_SRM() ==>> failed to write the surface reflectance map\n");
+            patch->error = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LMK_Patch_Ele(LMK_Patch *patch, int32_t left, int32_t top, int32_t ncols, int32_t nrows, const float *ele)
+{
+    if(!check_window(patch, left, top, ncols, nrows, "LMK_Patch_Ele") || !begin_change(patch)) return false;
+    int64_t cols = patch->header.num_cols;
+
+    int32_t rows_per_write = ncols == cols ? nrows : 1;
+    for(int32_t i = 0; i < nrows; i += rows_per_write){
+        int64_t offset = LMK_HEADER_SIZE + patch->header.num_pixels + ((top + i)*cols + left)*(int64_t)sizeof(float);
+        int64_t count = (int64_t)ncols*rows_per_write;
+        if(!seek_file_offset(patch->fp, offset) ||
+           write_big_endian_array(&ele[(size_t)i*ncols], 32, true, count, patch->fp) != count){
+            printf("LMK_Patch_Ele() ==>> failed to write the elevation map\n");
+            patch->error = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Close_LMK_Patch(LMK_Patch *patch)
+{
+    if(patch->fp == NULL) return false;
+    bool success = fclose(patch->fp) == 0 && !patch->error;
+    patch->fp = NULL;
+    if(success && patch->header_changed){
+        success = write_lmk_ascii_header(patch->header.filename, &patch->header);
+    }
+    return success;
+}
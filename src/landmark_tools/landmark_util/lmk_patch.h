@@ -0,0 +1,104 @@
+/**
+ * \file `lmk_patch.h`
+ * \brief Update the header, surface reflectance or elevation of a landmark file in place
+ *
+ * Only the bytes that change are written, so editing the header or the srm of a large landmark does not rewrite the
+ * elevation block. The ascii header file is rewritten when the header changes. Pixel windows can be patched in
+ * uncompressed (v3) landmark files only; the header of any version can be patched. The overview sidecar of the file
+ * is removed before its first change.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LMK_PATCH_H_
+#define _LANDMARK_TOOLS_LMK_PATCH_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stdint.h>                                          // for int32_t
+#include <stdio.h>                                           // for FILE
+
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK
+
+/**
+ * \brief Landmark file open for patching
+ */
+typedef struct {
+    FILE *fp;
+    LMK header;                             //!< current header of the file, without pixel arrays
+    int32_t version;                        //!< major version of the file format
+    char version_string[LMK_VERSION_SIZE];  //!< version comment of the file, kept when the header is rewritten
+    bool header_changed;
+    bool changed;                           //!< a block of the file was written, and its overview sidecar removed
+    bool error;
+} LMK_Patch;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Open a landmark file for reading and writing and read its header
+ * \param[in] filename
+ * \param[out] patch
+ * \return false if the file cannot be opened or has no valid header
+ */
+bool Open_LMK_Patch(const char *filename, LMK_Patch *patch);
+
+/**
+ * \brief Rewrite the header fields of the file
+ *
+ * The body, id, anchor pixel, resolution, anchor point and rotation are taken from `header`. The size must not change.
+ * \param[in] patch
+ * \param[in] header
+ * \return false on io error or if the size of `header` differs from the file
+ */
+bool LMK_Patch_Header(LMK_Patch *patch, const LMK *header);
+
+/**
+ * \brief Overwrite a window of the surface reflectance map
+ * \param[in] patch
+ * \param[in] left col index of the window
+ * \param[in] top row index of the window
+ * \param[in] ncols width of the window
+ * \param[in] nrows height of the window
+ * \param[in] srm ncols*nrows surface reflectance values
+ * \return false on io error, for tiled files, or if the window is outside of the landmark
+ */
+bool LMK_Patch_SRM(LMK_Patch *patch, int32_t left, int32_t top, int32_t ncols, int32_t nrows, const uint8_t *srm);
+
+/**
+ * \brief Overwrite a window of the elevation map
+ * \param[in] patch
+ * \param[in] left col index of the window
+ * \param[in] top row index of the window
+ * \param[in] ncols width of the window
+ * \param[in] nrows height of the window
+ * \param[in] ele ncols*nrows elevation values
+ * \return false on io error, for tiled files, or if the window is outside of the landmark
+ */
+bool LMK_Patch_Ele(LMK_Patch *patch, int32_t left, int32_t top, int32_t ncols, int32_t nrows, const float *ele);
+
+/**
+ * \brief Close the file, and write the ascii header file if the header changed
+ * \param[in] patch
+ * \return false if any patch or the ascii header failed
+ */
+bool Close_LMK_Patch(LMK_Patch *patch);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_LMK_PATCH_H_ */
@@ -0,0 +1,358 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <pthread.h>                // for pthread_create, pthread_mutex_t
+#include <math.h>                   // for floor
+#include <stdio.h>                  // for fopen, fread, fclose
+#include <stdlib.h>                 // for malloc, free
+#include <string.h>                 // for strcmp, strncmp, memmove
+
+#include "landmark_tools/landmark_util/lmk_reader.h"
+#include "landmark_tools/landmark_util/landmark_tiled.h"
+#include "landmark_tools/utils/endian_read_write.h"
+#include "landmark_tools/utils/parallel.h"
+#include "landmark_tools/utils/safe_string.h"
+
+typedef struct {
+    const char *filename;
+    const LMK *lmk;
+    bool tiled;
+    int32_t top;
+    int32_t nrows;
+} ReadBand;
+
+typedef struct {
+    ReadBand *bands;
+    int32_t num_bands;
+    int32_t next_band;
+    bool error;
+    pthread_mutex_t mutex;
+} ReadQueue;
+
+static int32_t default_num_threads(void){
+    return parallel_num_threads();
+}
+
+/**
+ \brief Read full width rows [top, top + nrows) of an open landmark file into `srm` and `ele`
+*/
+static bool read_rows(FILE *fp, const LMK *lmk, bool tiled, int32_t top, int32_t nrows, uint8_t *srm, float *ele){
+    int64_t first = (int64_t)top*lmk->num_cols;
+    int64_t count = (int64_t)nrows*lmk->num_cols;
+    if(tiled){
+        return seek_file_offset(fp, LMK_HEADER_SIZE) &&
+               read_lmk_tiled_region(fp, lmk, 0, top, lmk->num_cols, nrows, srm, ele);
+    }
+    return seek_file_offset(fp, LMK_HEADER_SIZE + first) &&
+           fread(srm, sizeof(uint8_t), count, fp) == (size_t)count &&
+           seek_file_offset(fp, LMK_HEADER_SIZE + lmk->num_pixels + first*(int64_t)sizeof(float)) &&
+           read_big_endian_array(ele, 32, true, count, fp) == count;
+}
+
+static bool read_band(const ReadBand *band){
+    FILE *fp = fopen(band->filename, "rb");
+    if(fp == NULL) return false;
+
+    const LMK *lmk = band->lmk;
+    int64_t first = (int64_t)band->top*lmk->num_cols;
+    bool success = read_rows(fp, lmk, band->tiled, band->top, band->nrows, &lmk->srm[first], &lmk->ele[first]);
+    fclose(fp);
+    return success;
+}
+
+static void *read_thread(void *arg){
+    ReadQueue *queue = (ReadQueue *)arg;
+    while(true){
+        pthread_mutex_lock(&queue->mutex);
+        int32_t b = queue->error ? queue->num_bands : queue->next_band++;
+        pthread_mutex_unlock(&queue->mutex);
+        if(b >= queue->num_bands) break;
+
+        if(!read_band(&queue->bands[b])){
+            SAFE_PRINTF(512, "Read_LMK_Many() ==>> failed to read rows %d to %d of %s\n",
+                        queue->bands[b].top, queue->bands[b].top + queue->bands[b].nrows, queue->bands[b].filename);
+            pthread_mutex_lock(&queue->mutex);
+            queue->error = true;
+            pthread_mutex_unlock(&queue->mutex);
+        }
+    }
+    return NULL;
+}
+
+/**
+ \brief Read the header, allocate the pixel arrays and find the file format version
+*/
+static bool open_lmk(const char *filename, LMK *lmk, bool *tiled){
+    if(!Read_LMK_Header(filename, lmk)) return false;
+
+    FILE *fp = fopen(filename, "rb");
+    char version[LMK_VERSION_SIZE];
+    bool success = fp != NULL && fread(version, 1, LMK_VERSION_SIZE, fp) == LMK_VERSION_SIZE;
+    if(fp != NULL) fclose(fp);
+    if(!success) return false;
+
+    *tiled = strncmp(version, LMK_VERSION_V4, LMK_VERSION_SIZE) == 0;
+    return allocate_lmk_arrays(lmk, lmk->num_cols, lmk->num_rows);
+}
+
+bool Read_LMK_Many(const char **filenames, int32_t num_files, LMK *lmks, int32_t num_threads)
+{
+    if(num_threads <= 0) num_threads = default_num_threads();
+    if(num_threads > LMK_READER_MAX_THREADS) num_threads = LMK_READER_MAX_THREADS;
+
+    bool success = true;
+    bool *tiled = (bool *)calloc(num_files, sizeof(bool));
+    int32_t *first = (int32_t *)malloc(num_files*sizeof(int32_t));
+    for(int32_t i = 0; i < num_files; i++){
+        lmks[i].srm = NULL;
+        lmks[i].ele = NULL;
+        lmks[i].srm_raster = NULL;
+        lmks[i].ele_raster = NULL;
+        lmks[i].layers = NULL;
+    }
+    success &= tiled != NULL && first != NULL;
+
+    // Files listed more than once are only read for their first entry
+    for(int32_t i = 0; i < num_files && success; i++){
+        first[i] = i;
+        for(int32_t j = 0; j < i; j++){
+            if(strcmp(filenames[i], filenames[j]) == 0){
+                first[i] = j;
+                break;
+            }
+        }
+    }
+    int64_t total_bytes = 0;
+    for(int32_t i = 0; i < num_files && success; i++){
+        if(first[i] != i) continue;
+        success &= open_lmk(filenames[i], &lmks[i], &tiled[i]);
+        if(!success){
+            SAFE_PRINTF(512, "Read_LMK_Many() ==>> cannot read %s\n", filenames[i]);
+        }else{
+            total_bytes += lmks[i].num_pixels*(int64_t)(sizeof(uint8_t) + sizeof(float));
+        }
+    }
+
+    // Split the files into bands so that every thread has work, but not into bands so small that seeks dominate
+    int64_t band_bytes = total_bytes/num_threads;
+    if(band_bytes < LMK_READER_MIN_BAND_BYTES) band_bytes = LMK_READER_MIN_BAND_BYTES;
+    int32_t num_bands = 0;
+    int32_t *band_rows = (int32_t *)calloc(num_files, sizeof(int32_t));
+    success &= band_rows != NULL;
+    for(int32_t i = 0; i < num_files && success; i++){
+        if(first[i] != i) continue;
+        int64_t row_bytes = (int64_t)lmks[i].num_cols*(sizeof(uint8_t) + sizeof(float));
+        int64_t rows = band_bytes/row_bytes;
+        if(tiled[i]){
+            // Align bands to the default tile size so that tiles are rarely decoded twice
+            rows = ((rows + LMK_DEFAULT_TILE_SIZE - 1)/LMK_DEFAULT_TILE_SIZE)*LMK_DEFAULT_TILE_SIZE;
+        }
+        if(rows < 1) rows = 1;
+        if(rows > lmks[i].num_rows) rows = lmks[i].num_rows;
+        band_rows[i] = (int32_t)rows;
+        num_bands += (lmks[i].num_rows + band_rows[i] - 1)/band_rows[i];
+    }
+
+    ReadQueue queue = {0};
+    queue.bands = success ? (ReadBand *)malloc(num_bands*sizeof(ReadBand)) : NULL;
+    success &= queue.bands != NULL;
+    for(int32_t i = 0; i < num_files && success; i++){
+        if(first[i] != i) continue;
+        for(int32_t top = 0; top < lmks[i].num_rows; top += band_rows[i]){
+            ReadBand *band = &queue.bands[queue.num_bands++];
+            band->filename = filenames[i];
+            band->lmk = &lmks[i];
+            band->tiled = tiled[i];
+            band->top = top;
+            band->nrows = (top + band_rows[i] > lmks[i].num_rows) ? lmks[i].num_rows - top : band_rows[i];
+        }
+    }
+
+    if(success){
+        if(num_threads > queue.num_bands) num_threads = queue.num_bands;
+        pthread_t threads[LMK_READER_MAX_THREADS];
+        int32_t started = 0;
+        pthread_mutex_init(&queue.mutex, NULL);
+        for(int32_t t = 1; t < num_threads; t++){
+            if(pthread_create(&threads[started], NULL, read_thread, &queue) != 0) break;
+            started++;
+        }
+        // The calling thread also takes bands
+        read_thread(&queue);
+        for(int32_t t = 0; t < started; t++){
+            pthread_join(threads[t], NULL);
+        }
+        pthread_mutex_destroy(&queue.mutex);
+        success &= !queue.error;
+    }
+
+    for(int32_t i = 0; i < num_files && success; i++){
+        if(first[i] == i) continue;
+        success &= Share_LMK(&lmks[first[i]], &lmks[i]);
+        strncpy(lmks[i].filename, lmks[first[i]].filename, LMK_FILENAME_SIZE);
+    }
+
+    if(!success){
+        for(int32_t i = 0; i < num_files; i++){
+            free_lmk(&lmks[i]);
+            lmks[i].srm = NULL;
+            lmks[i].ele = NULL;
+        }
+    }
+    free(queue.bands);
+    free(band_rows);
+    free(tiled);
+    free(first);
+    return success;
+}
+
+bool Read_LMK_Parallel(const char *filename, LMK *lmk, int32_t num_threads)
+{
+    return Read_LMK_Many(&filename, 1, lmk, num_threads);
+}
+
+struct LMK_Row_Reader {
+    FILE *fp;
+    LMK header;
+    bool tiled;
+    uint8_t *srm;               //rows [top, top + nrows) of the file
+    float *ele;
+    int32_t capacity;           //rows allocated in srm and ele
+    int32_t top;
+    int32_t nrows;
+};
+
+LMK_Row_Reader *Open_LMK_Row_Reader(const char *filename, LMK *header)
+{
+    LMK_Row_Reader *reader = (LMK_Row_Reader *)calloc(1, sizeof(LMK_Row_Reader));
+    if(reader == NULL){
+        SAFE_PRINTF(512, "Open_LMK_Row_Reader() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        return NULL;
+    }
+    reader->fp = fopen(filename, "rb");
+    if(reader->fp == NULL){
+        SAFE_PRINTF(512, "Open_LMK_Row_Reader() ==>> cannot open file %s to read\n", filename);
+        free(reader);
+        return NULL;
+    }
+    int32_t version = read_lmk_header_fp(reader->fp, &reader->header, true);
+    if(version == 0){
+        SAFE_PRINTF(512, "Open_LMK_Row_Reader() ==>> cannot read the header of %s\n", filename);
+        fclose(reader->fp);
+        free(reader);
+        return NULL;
+    }
+    reader->tiled = version == 4;
+    strncpy(reader->header.filename, filename, LMK_FILENAME_SIZE - 1);
+    reader->header.srm = NULL;
+    reader->header.ele = NULL;
+
+    Copy_LMK_Header(&reader->header, header);
+    strncpy(header->filename, reader->header.filename, LMK_FILENAME_SIZE);
+    header->srm = NULL;
+    header->ele = NULL;
+    return reader;
+}
+
+bool Read_LMK_Rows(LMK_Row_Reader *reader, int32_t top, int32_t nrows, LMK *band)
+{
+    const LMK *lmk = &reader->header;
+    if(top < 0 || nrows < 0 || top + nrows > lmk->num_rows){
+        SAFE_PRINTF(512, "Read_LMK_Rows() ==>> rows %d to %d are outside of %s\n", top, top + nrows,
+                    lmk->filename);
+        return false;
+    }
+    size_t cols = lmk->num_cols;
+
+    // Rows held from the previous call are kept. Larger windows move them to new buffers.
+    uint8_t *srm = reader->srm;
+    float *ele = reader->ele;
+    if(nrows > reader->capacity){
+        srm = (uint8_t *)malloc(sizeof(uint8_t)*cols*nrows);
+        ele = (float *)malloc(sizeof(float)*cols*nrows);
+        if(srm == NULL || ele == NULL){
+            SAFE_PRINTF(512, "Read_LMK_Rows() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+            free(srm);
+            free(ele);
+            return false;
+        }
+    }
+    int32_t keep0 = reader->top > top ? reader->top : top;
+    int32_t keep1 = reader->top + reader->nrows < top + nrows ? reader->top + reader->nrows : top + nrows;
+    if(keep1 > keep0){
+        memmove(&srm[(keep0 - top)*cols], &reader->srm[(keep0 - reader->top)*cols],
+                sizeof(uint8_t)*cols*(keep1 - keep0));
+        memmove(&ele[(keep0 - top)*cols], &reader->ele[(keep0 - reader->top)*cols],
+                sizeof(float)*cols*(keep1 - keep0));
+    }else{
+        keep0 = keep1 = top + nrows;
+    }
+    if(srm != reader->srm){
+        free(reader->srm);
+        free(reader->ele);
+        reader->srm = srm;
+        reader->ele = ele;
+        reader->capacity = nrows;
+    }
+    reader->top = top;
+    reader->nrows = nrows;
+
+    // Only the rows before and after the kept rows are read
+    bool success = true;
+    if(keep0 > top){
+        success &= read_rows(reader->fp, lmk, reader->tiled, top, keep0 - top, srm, ele);
+    }
+    if(success && top + nrows > keep1){
+        success &= read_rows(reader->fp, lmk, reader->tiled, keep1, top + nrows - keep1,
+                             &srm[(keep1 - top)*cols], &ele[(keep1 - top)*cols]);
+    }
+    if(!success){
+        SAFE_PRINTF(512, "Read_LMK_Rows() ==>> failed to read rows %d to %d of %s\n", top, top + nrows,
+                    lmk->filename);
+        reader->nrows = 0;
+        return false;
+    }
+
+    Copy_LMK_Header(lmk, band);
+    strncpy(band->filename, lmk->filename, LMK_FILENAME_SIZE);
+    band->num_rows = nrows;
+    band->num_pixels = (int64_t)nrows*lmk->num_cols;
+    band->srm = srm;
+    band->ele = ele;
+    return true;
+}
+
+bool Read_LMK_Rows_Interpolate(LMK_Row_Reader *reader, double row_min, double row_max, LMK *band, int32_t *top)
+{
+    // Bilinear interpolation at row y uses rows floor(y) and floor(y) + 1. The row above is also read, because
+    // `inter_uint8_matrix` takes the nearest pixel on the first row of a matrix.
+    int32_t num_rows = reader->header.num_rows;
+    double first = floor(row_min) - 1.0;
+    double last = floor(row_max) + 2.0;
+    int32_t k0 = first < 0.0 ? 0 : (first > num_rows ? num_rows : (int32_t)first);
+    int32_t k1 = last < k0 ? k0 : (last > num_rows ? num_rows : (int32_t)last);
+    *top = k0;
+    return Read_LMK_Rows(reader, k0, k1 - k0, band);
+}
+
+void Close_LMK_Row_Reader(LMK_Row_Reader *reader)
+{
+    if(reader == NULL) return;
+    fclose(reader->fp);
+    free(reader->srm);
+    free(reader->ele);
+    free(reader);
+}
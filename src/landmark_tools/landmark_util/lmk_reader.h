@@ -0,0 +1,109 @@
+/**
+ * \file `lmk_reader.h`
+ * \brief Multi-threaded loading of landmark files
+ *
+ * The pixel arrays of each landmark are split into bands of rows. Worker threads read and byte swap the bands
+ * of all files concurrently, each thread with its own file handle, so several landmarks load in parallel and
+ * a single large landmark is decoded by several threads. The result is identical to calling `Read_LMK` on each file.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LMK_READER_H_
+#define _LANDMARK_TOOLS_LMK_READER_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stdint.h>                                          // for int32_t
+
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK
+
+#define LMK_READER_MAX_THREADS 32
+#define LMK_READER_MIN_BAND_BYTES (8*1024*1024) //bands smaller than this are not split further
+
+typedef struct LMK_Row_Reader LMK_Row_Reader;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Read several landmark files concurrently
+ * \param[in] filenames landmark file paths
+ * \param[in] num_files length of `filenames` and `lmks`
+ * \param[out] lmks landmark structures, one per file. A file listed twice is read once and its landmarks share
+ * the arrays, see `Share_LMK`
+ * \param[in] num_threads number of worker threads. If 0, `parallel_num_threads()` is used
+ * \return true if every file was read
+ * \return false otherwise. All landmarks are freed
+ */
+bool Read_LMK_Many(const char **filenames, int32_t num_files, LMK *lmks, int32_t num_threads);
+
+/**
+ * \brief Read one landmark file using several threads to read and decode the pixel arrays
+ * \param[in] filename location of landmark file
+ * \param[out] lmk landmark structure
+ * \param[in] num_threads number of worker threads. If 0, `parallel_num_threads()` is used
+ * \return true on success
+ * \return false on io error or if memory allocation fails
+ */
+bool Read_LMK_Parallel(const char *filename, LMK *lmk, int32_t num_threads);
+
+/**
+ * \brief Open a landmark file to read bands of full width rows in turn
+ *
+ * Operations that stream a landmark read a sliding window of rows, so only rows of the window are in memory.
+ * \param[in] filename location of landmark file
+ * \param[out] header landmark header. The pixel arrays are set to NULL
+ * \return reader or NULL if the file cannot be opened or has no valid header
+ */
+LMK_Row_Reader *Open_LMK_Row_Reader(const char *filename, LMK *header);
+
+/**
+ * \brief Read rows [top, top + nrows) of the landmark
+ *
+ * Rows held from the previous call are not read again, so windows that slide down the file read every row once.
+ * \param[in] reader
+ * \param[in] top first row of the window
+ * \param[in] nrows number of rows of the window, can be 0
+ * \param[out] band landmark header with `num_rows` = nrows and the pixel arrays of the window. The arrays belong to
+ *  the reader and are valid until the next call. Row `top` of the landmark is row 0 of `band`
+ * \return false on io error, if memory allocation fails or if the rows are outside of the landmark
+ */
+bool Read_LMK_Rows(LMK_Row_Reader *reader, int32_t top, int32_t nrows, LMK *band);
+
+/**
+ * \brief Read the rows needed to interpolate the landmark at rows `row_min` to `row_max`
+ *
+ * Interpolating `band` at (col, row - top) gives the same value as interpolating the landmark at (col, row).
+ * \param[in] reader
+ * \param[in] row_min
+ * \param[in] row_max
+ * \param[out] band see `Read_LMK_Rows`
+ * \param[out] top landmark row of row 0 of `band`
+ * \return false on io error or if memory allocation fails
+ */
+bool Read_LMK_Rows_Interpolate(LMK_Row_Reader *reader, double row_min, double row_max, LMK *band, int32_t *top);
+
+/**
+ * \brief Close the file and free the reader
+ * \param[in] reader
+ */
+void Close_LMK_Row_Reader(LMK_Row_Reader *reader);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _LANDMARK_TOOLS_LMK_READER_H_
@@ -0,0 +1,226 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>                   // for acos, cos, sin, sqrt, floor, isnan
+#include <stdio.h>                  // for printf
+#include <string.h>                 // for memset
+
+#include "landmark_tools/landmark_util/lmk_render.h"
+#include "landmark_tools/math/math_constants.h"
+#include "landmark_tools/utils/parallel.h"
+#include "math/mat3/mat3.h"
+#include "math/mat3/mat3_inline.h"
+
+/**
+ \brief Rendering shared by its threads, which take image rows in turn
+ */
+typedef struct {
+    const LMK *lmk;
+    const LMK_HeightPyramid *pyramid;
+    const LMK_RenderCamera *camera;
+    const LMK_RenderSettings *settings;
+    double sun_map[3];          //direction toward the sun in map frame
+    double up[3];               //map frame up in world frame
+    double shadow_offset;       //height above the surface of the shadow ray endpoints in meters
+    uint8_t *image;
+} RenderJob;
+
+void LMK_Render_Nadir_Camera(const LMK *lmk, LMK_RenderCamera *camera)
+{
+    memset(camera, 0, sizeof(LMK_RenderCamera));
+    camera->width = lmk->num_cols;
+    camera->height = lmk->num_rows;
+    camera->orthographic = true;
+    camera->scale = lmk->resolution;
+    camera->principal_point[0] = (lmk->num_cols - 1)*0.5;
+    camera->principal_point[1] = (lmk->num_rows - 1)*0.5;
+
+    // Image columns along map x, image rows along map -y and the boresight down
+    for(int32_t k = 0; k < 3; k++){
+        camera->camRworld[0][k] = lmk->mapRworld[0][k];
+        camera->camRworld[1][k] = -lmk->mapRworld[1][k];
+        camera->camRworld[2][k] = -lmk->mapRworld[2][k];
+    }
+
+    // Any height above the map works for an orthographic camera
+    float max_ele = 0.0f;
+    for(int32_t i = 0; i < lmk->num_pixels; i++){
+        if(lmk->ele[i] > max_ele) max_ele = lmk->ele[i];
+    }
+    LMK_Col_Row_Elevation2World(lmk, camera->principal_point[0], camera->principal_point[1],
+                                max_ele + 1000.0*lmk->resolution, camera->center);
+}
+
+void LMK_Render_Sun_Direction(const LMK *lmk, double elevation, double azimuth, double sun[3])
+{
+    double el = elevation*PI/180.0;
+    double az = azimuth*PI/180.0;
+    double sun_map[3] = {sin(az)*cos(el), cos(az)*cos(el), sin(el)};
+    mult133(sun_map, (double (*)[3])lmk->mapRworld, sun);
+}
+
+/**
+ \brief Unit normal in map frame of the bilinear surface at landmark (x, y)
+ */
+static void surface_normal(const LMK *lmk, double x, double y, double normal[3])
+{
+    int32_t i = (int32_t)floor(x);
+    int32_t j = (int32_t)floor(y);
+    if(i > lmk->num_cols - 2) i = lmk->num_cols - 2;
+    if(j > lmk->num_rows - 2) j = lmk->num_rows - 2;
+    if(i < 0) i = 0;
+    if(j < 0) j = 0;
+    double u = x - i;
+    double v = y - j;
+    const float *ele = &lmk->ele[(size_t)j*lmk->num_cols + i];
+    double h00 = ele[0];
+    double h10 = ele[1];
+    double h01 = ele[lmk->num_cols];
+    double h11 = ele[lmk->num_cols + 1];
+    double dh_dcol = (h10 - h00)*(1.0 - v) + (h11 - h01)*v;
+    double dh_drow = (h01 - h00)*(1.0 - u) + (h11 - h10)*u;
+
+    // Map x runs with the columns and map y against the rows
+    normal[0] = -dh_dcol/lmk->resolution;
+    normal[1] = dh_drow/lmk->resolution;
+    normal[2] = 1.0;
+    unit3(normal, normal);
+}
+
+/**
+ \brief Reflectance of the surface, not yet scaled by the albedo
+ \param[in] shader
+ \param[in] normal unit surface normal
+ \param[in] sun unit vector toward the sun
+ \param[in] view unit vector toward the camera
+ */
+static double reflectance(enum LMK_RenderShader shader, const double normal[3], const double sun[3],
+                          const double view[3])
+{
+    double cos_incidence = dot3_inline(normal, sun);
+    if(cos_incidence <= 0.0) return 0.0;
+    if(shader == LMK_RENDER_LAMBERT) return cos_incidence;
+
+    double cos_emission = dot3_inline(normal, view);
+    if(cos_emission < 1e-4) cos_emission = 1e-4;
+    double cos_phase = dot3_inline(view, sun);
+    if(cos_phase > 1.0) cos_phase = 1.0;
+    if(cos_phase < -1.0) cos_phase = -1.0;
+    double phase = acos(cos_phase)*180.0/PI;
+    double lambda = 1.0 + (-0.019 + (0.000242 - 0.00000146*phase)*phase)*phase;
+    double denominator = cos_incidence + cos_emission;
+    if(denominator <= 1e-4) return 0.0;
+    double r = 2.0*lambda*(cos_incidence/denominator) + (1.0 - lambda)*cos_incidence;
+    return r < 0.0 ? 0.0 : (r > 1.0 ? 1.0 : r);
+}
+
+/**
+ \brief Render pixel (u, v)
+ */
+static uint8_t render_pixel(const RenderJob *job, int32_t u, int32_t v)
+{
+    const LMK *lmk = job->lmk;
+    const LMK_RenderCamera *camera = job->camera;
+    const LMK_RenderSettings *settings = job->settings;
+
+    double a = u - camera->principal_point[0];
+    double b = v - camera->principal_point[1];
+    double ray_cam[3];
+    double c[3];
+    copy3_inline(camera->center, c);
+    if(camera->orthographic){
+        for(int32_t k = 0; k < 3; k++){
+            c[k] += camera->scale*(a*camera->camRworld[0][k] + b*camera->camRworld[1][k]);
+        }
+        ray_cam[0] = 0.0;
+        ray_cam[1] = 0.0;
+    }else{
+        ray_cam[0] = a/camera->focal_length;
+        ray_cam[1] = b/camera->focal_length;
+    }
+    ray_cam[2] = 1.0;
+    double ray[3];
+    mult133_inline(ray_cam, camera->camRworld, ray);
+
+    double hit[3];
+    if(!Intersect_LMK_ELE_Pyramid(lmk, job->pyramid, c, ray, -1.0, hit)) return 0;
+    double x, y, ele;
+    World2LMK_Col_Row_Ele(lmk, hit, &x, &y, &ele);
+
+    double normal[3];
+    surface_normal(lmk, x, y, normal);
+    double view_world[3], view[3];
+    scale3_inline(-1.0, ray, view_world);
+    mult331_inline(lmk->mapRworld, view_world, view);
+    unit3(view, view);
+    double r = reflectance(settings->shader, normal, job->sun_map, view);
+    if(r <= 0.0) return 0;
+
+    if(settings->shadows){
+        double start[3], shadow[3];
+        for(int32_t k = 0; k < 3; k++){
+            start[k] = hit[k] + job->shadow_offset*job->up[k];
+        }
+        if(Intersect_LMK_ELE_Pyramid(lmk, job->pyramid, start, settings->sun, -1.0, shadow)) return 0;
+    }
+
+    double albedo = settings->albedo;
+    if(settings->use_srm){
+        double srm = Interpolate_LMK_SRM(lmk, x, y);
+        if(isnan(srm)) return 0;
+        albedo *= srm/255.0;
+    }
+    double value = 255.0*albedo*r + 0.5;
+    return value >= 255.0 ? 255 : (value <= 0.0 ? 0 : (uint8_t)value);
+}
+
+static bool render_rows(void *user, int32_t thread, size_t begin, size_t end)
+{
+    (void)thread;
+    RenderJob *job = (RenderJob *)user;
+    for(size_t v = begin; v < end; v++){
+        uint8_t *row = &job->image[v*job->camera->width];
+        for(int32_t u = 0; u < job->camera->width; u++){
+            row[u] = render_pixel(job, u, (int32_t)v);
+        }
+    }
+    return true;
+}
+
+bool LMK_Render(const LMK *lmk, const LMK_HeightPyramid *pyramid, const LMK_RenderCamera *camera,
+                const LMK_RenderSettings *settings, uint8_t *image)
+{
+    if(settings->use_srm && lmk->srm == NULL){
+        printf("LMK_Render() ==>> landmark has no srm layer\n");
+        return false;
+    }
+
+    RenderJob job;
+    job.lmk = lmk;
+    job.pyramid = pyramid;
+    job.camera = camera;
+    job.settings = settings;
+    mult331((double (*)[3])lmk->mapRworld, (double *)settings->sun, job.sun_map);
+    unit3(job.sun_map, job.sun_map);
+    for(int32_t k = 0; k < 3; k++){
+        job.up[k] = lmk->mapRworld[2][k];
+    }
+    job.shadow_offset = 1e-3*lmk->resolution;
+    job.image = image;
+
+    parallel_for(camera->height > 0 ? (size_t)camera->height : 0, 1, 0, render_rows, &job);
+    return true;
+}
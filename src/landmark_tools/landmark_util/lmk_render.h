@@ -0,0 +1,107 @@
+/**
+ * \file `lmk_render.h`
+ * \brief Render simulated camera images of a landmark
+ *
+ * Each pixel is a ray cast into the elevation map with `Intersect_LMK_ELE_Pyramid`. The hit is shaded by the sun
+ * with the normal of the bilinear surface, a shadow ray toward the sun and, optionally, the albedo of the `srm`
+ * layer. This replaces the `landmark_2_point` PLY export and the Blender scripts `render_ply.py` and
+ * `batch_render.py`, and uses the same shaders.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LMK_RENDER_H_
+#define _LANDMARK_TOOLS_LMK_RENDER_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stdint.h>                                          // for int32_t, uint8_t
+
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK
+#include "landmark_tools/landmark_util/lmk_height_pyramid.h" // for LMK_HeightPyramid
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Reflectance model of the surface
+ */
+enum LMK_RenderShader {
+    LMK_RENDER_LAMBERT,         //!< cosine of the incidence angle
+    LMK_RENDER_LUNAR_LAMBERT,   //!< lunar-Lambert model with the phase correction of `lunar_lambert.osl`
+};
+
+/**
+ * \brief Pinhole or orthographic camera
+ *
+ * The camera frame has x along the image columns, y along the image rows and z along the boresight.
+ */
+typedef struct {
+    int32_t width;
+    int32_t height;
+    bool orthographic;
+    double center[3];               //!< camera center in world frame
+    double camRworld[3][3];         //!< rotation from world frame to camera frame
+    double focal_length;            //!< pinhole focal length in pixels
+    double scale;                   //!< orthographic pixel size in meters
+    double principal_point[2];      //!< (col, row) of the boresight in the image
+} LMK_RenderCamera;
+
+/**
+ * \brief Lighting and surface of a rendering
+ */
+typedef struct {
+    enum LMK_RenderShader shader;
+    double sun[3];                  //!< direction toward the sun in world frame
+    double albedo;                  //!< reflectance of the surface, 1 for pixels of 255 where the sun is at normal incidence
+    bool use_srm;                   //!< multiply the albedo by the `srm` layer over 255
+    bool shadows;                   //!< cast shadow rays toward the sun
+} LMK_RenderSettings;
+
+/**
+ * \brief Orthographic camera looking straight down on the landmark with one image pixel per landmark pixel
+ *
+ * This is the camera of `render_ply.py`. Pixel (u, v) of the image sees landmark pixel (u, v).
+ * \param[in] lmk
+ * \param[out] camera
+ */
+void LMK_Render_Nadir_Camera(const LMK *lmk, LMK_RenderCamera *camera);
+
+/**
+ * \brief Direction toward the sun in world frame
+ * \param[in] lmk
+ * \param[in] elevation sun elevation above the landmark plane in degrees
+ * \param[in] azimuth sun azimuth in degrees, clockwise from the up direction of the landmark image toward its right
+ * \param[out] sun unit vector toward the sun in world frame
+ */
+void LMK_Render_Sun_Direction(const LMK *lmk, double elevation, double azimuth, double sun[3]);
+
+/**
+ * \brief Render a camera image of a landmark on all processors
+ * \param[in] lmk
+ * \param[in] pyramid height pyramid of `lmk`
+ * \param[in] camera
+ * \param[in] settings
+ * \param[out] image `camera->width` x `camera->height` image, 0 where the rays miss the map
+ * \return false if the landmark has no `srm` layer and `settings->use_srm` is set
+ */
+bool LMK_Render(const LMK *lmk, const LMK_HeightPyramid *pyramid, const LMK_RenderCamera *camera,
+                const LMK_RenderSettings *settings, uint8_t *image);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_LMK_RENDER_H_ */
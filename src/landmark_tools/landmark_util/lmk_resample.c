@@ -0,0 +1,449 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>                   // for NAN, isnan, ceil, floor, round, sin
+#include <stdio.h>                  // for printf
+#include <stdlib.h>                 // for malloc, free
+#include <string.h>                 // for memset, strncmp, strlen
+
+#include "landmark_tools/data_interpolation/interpolate_data.h"
+#include "landmark_tools/landmark_util/lmk_reader.h"
+#include "landmark_tools/landmark_util/lmk_resample.h"
+#include "landmark_tools/landmark_util/lmk_writer.h"
+#include "landmark_tools/math/math_constants.h"
+#include "landmark_tools/utils/parallel.h"
+#include "math/mat3/mat3.h"
+
+#define LMK_RESAMPLE_BAND 16        //output rows resampled together by one thread
+#define LANCZOS_LOBES 3
+
+/**
+ \brief Filter weights of the input pixels of every output pixel along one axis
+ */
+typedef struct {
+    int32_t *first;             //first input pixel of each output pixel
+    int32_t *count;             //number of input pixels of each output pixel
+    double *weights;            //`max_count` weights of each output pixel
+    double *total;              //sum of the weights of each output pixel
+    int32_t max_count;
+    bool box;                   //every weight is 1, for odd integer scales of the area filter
+} ResampleAxis;
+
+/**
+ \brief Resampling shared by its threads, which take bands of output rows in turn
+ */
+typedef struct {
+    const LMK *lmk;
+    const LMK *src;             //input rows [src_top, src_top + src->num_rows) of lmk
+    int32_t src_top;
+    LMK *out;                   //output rows [out_top, out_top + out->num_rows)
+    int32_t out_top;
+    double scale;
+    enum LMK_ResampleFilter filter;
+    ResampleAxis cols;
+    ResampleAxis rows;
+    int32_t band_rows;          //most input rows read by a band
+    ParallelScratch scratch;    //buffers of each thread, kept between the chunks of a streamed resampling
+} ResampleJob;
+
+static double lanczos(double t)
+{
+    if(t == 0.0) return 1.0;
+    if(fabs(t) >= LANCZOS_LOBES) return 0.0;
+    double pt = PI*t;
+    return LANCZOS_LOBES*sin(pt)*sin(pt/LANCZOS_LOBES)/(pt*pt);
+}
+
+static void free_axis(ResampleAxis *axis)
+{
+    free(axis->first);
+    free(axis->count);
+    free(axis->weights);
+    free(axis->total);
+}
+
+/**
+ \brief Weights of the `n_out` output pixels of an axis of `n_in` input pixels
+ \return false if memory allocation fails
+ */
+static bool init_axis(ResampleAxis *axis, int32_t n_in, int32_t n_out, double scale, enum LMK_ResampleFilter filter)
+{
+    // Output pixels cover scale input pixels, and at least one
+    double width = scale > 1.0 ? scale : 1.0;
+    double radius = filter == LMK_RESAMPLE_AREA ? 0.5*width + 0.5 : LANCZOS_LOBES*width;
+    axis->max_count = (int32_t)ceil(2.0*radius) + 1;
+    axis->box = filter == LMK_RESAMPLE_AREA && scale == round(scale) && (int64_t)scale % 2 == 1;
+    axis->first = (int32_t *)malloc(sizeof(int32_t)*n_out);
+    axis->count = (int32_t *)malloc(sizeof(int32_t)*n_out);
+    axis->weights = (double *)malloc(sizeof(double)*n_out*axis->max_count);
+    axis->total = (double *)malloc(sizeof(double)*n_out);
+    if(axis->first == NULL || axis->count == NULL || axis->weights == NULL || axis->total == NULL){
+        free_axis(axis);
+        return false;
+    }
+
+    for(int32_t j = 0; j < n_out; j++){
+        double c = j*scale;
+        int32_t lo = (int32_t)ceil(c - radius);
+        int32_t hi = (int32_t)floor(c + radius);
+        if(lo < 0) lo = 0;
+        if(hi > n_in - 1) hi = n_in - 1;
+        double *w = &axis->weights[(size_t)j*axis->max_count];
+        int32_t count = 0;
+        double total = 0.0;
+        axis->first[j] = lo;
+        for(int32_t k = lo; k <= hi && count < axis->max_count; k++){
+            double weight;
+            if(filter == LMK_RESAMPLE_AREA){
+                // Overlap of input pixel [k - 0.5, k + 0.5] with the output pixel
+                double left = k - 0.5 > c - 0.5*width ? k - 0.5 : c - 0.5*width;
+                double right = k + 0.5 < c + 0.5*width ? k + 0.5 : c + 0.5*width;
+                weight = right > left ? right - left : 0.0;
+            }else{
+                weight = lanczos((k - c)/width);
+            }
+            if(count == 0 && weight == 0.0){
+                axis->first[j] = k + 1;
+                continue;
+            }
+            w[count++] = weight;
+            total += weight;
+        }
+        while(count > 0 && w[count - 1] == 0.0) count--;
+        axis->count[j] = count;
+        axis->total[j] = total;
+    }
+    return true;
+}
+
+/**
+ \brief Filter an input row along the columns
+ \param[out] ele_sum weighted sum of the valid elevations of each output column
+ \param[out] ele_weight sum of the weights of the valid elevations of each output column
+ \param[out] srm_sum weighted sum of the surface reflectance of each output column
+ */
+static void filter_row(const ResampleAxis *axis, int32_t n_out, const float *ele, const uint8_t *srm,
+                       double *ele_sum, double *ele_weight, double *srm_sum)
+{
+    for(int32_t j = 0; j < n_out; j++){
+        const float *e = &ele[axis->first[j]];
+        const uint8_t *s = &srm[axis->first[j]];
+        int32_t count = axis->count[j];
+        double se = 0.0, sw = 0.0, ss = 0.0;
+        if(axis->box){
+            int32_t valid = 0;
+            for(int32_t t = 0; t < count; t++){
+                if(!isnan(e[t])){
+                    se += e[t];
+                    valid++;
+                }
+                ss += s[t];
+            }
+            sw = valid;
+        }else{
+            const double *w = &axis->weights[(size_t)j*axis->max_count];
+            for(int32_t t = 0; t < count; t++){
+                if(!isnan(e[t])){
+                    se += w[t]*e[t];
+                    sw += w[t];
+                }
+                ss += w[t]*s[t];
+            }
+        }
+        ele_sum[j] = se;
+        ele_weight[j] = sw;
+        srm_sum[j] = ss;
+    }
+}
+
+/**
+ \brief Resample output rows [i0, i1) with the separable filter
+ \param[in] scratch 3 `band_rows` x `out->num_cols` buffers of filtered input rows, then 3 accumulator rows
+ */
+static void resample_band_filtered(const ResampleJob *job, int32_t i0, int32_t i1, double *scratch)
+{
+    const LMK *lmk = job->lmk;
+    LMK *out = job->out;
+    int32_t n_out = out->num_cols;
+    size_t plane = (size_t)job->band_rows*n_out;
+    double *ele_sum = scratch;
+    double *ele_weight = ele_sum + plane;
+    double *srm_sum = ele_weight + plane;
+    double *acc_ele = srm_sum + plane;
+    double *acc_weight = acc_ele + n_out;
+    double *acc_srm = acc_weight + n_out;
+
+    // Each input row of the band is filtered along the columns once
+    int32_t k0 = job->rows.first[i0];
+    int32_t k1 = k0;
+    for(int32_t i = i0; i < i1; i++){
+        int32_t end = job->rows.first[i] + job->rows.count[i];
+        if(end > k1) k1 = end;
+    }
+    for(int32_t k = k0; k < k1; k++){
+        size_t b = (size_t)(k - k0)*n_out;
+        size_t from = (size_t)(k - job->src_top)*lmk->num_cols;
+        filter_row(&job->cols, n_out, &job->src->ele[from], &job->src->srm[from], &ele_sum[b], &ele_weight[b],
+                   &srm_sum[b]);
+    }
+
+    for(int32_t i = i0; i < i1; i++){
+        for(int32_t j = 0; j < n_out; j++){
+            acc_ele[j] = acc_weight[j] = acc_srm[j] = 0.0;
+        }
+        const double *w = &job->rows.weights[(size_t)i*job->rows.max_count];
+        for(int32_t t = 0; t < job->rows.count[i]; t++){
+            double wy = job->rows.box ? 1.0 : w[t];
+            size_t b = (size_t)(job->rows.first[i] + t - k0)*n_out;
+            for(int32_t j = 0; j < n_out; j++){
+                acc_ele[j] += wy*ele_sum[b + j];
+                acc_weight[j] += wy*ele_weight[b + j];
+                acc_srm[j] += wy*srm_sum[b + j];
+            }
+        }
+        float *ele = &out->ele[(size_t)(i - job->out_top)*n_out];
+        uint8_t *srm = &out->srm[(size_t)(i - job->out_top)*n_out];
+        for(int32_t j = 0; j < n_out; j++){
+            double total = job->rows.total[i]*job->cols.total[j];
+            // Less than half of the footprint on valid elevations gives NAN
+            ele[j] = (acc_weight[j] > 0.0 && acc_weight[j] >= 0.5*total) ? (float)(acc_ele[j]/acc_weight[j]) : NAN;
+            double value = total > 0.0 ? acc_srm[j]/total + 0.5 : 0.0;
+            srm[j] = value >= 255.0 ? 255 : (value <= 0.0 ? 0 : (uint8_t)value);
+        }
+    }
+}
+
+/**
+ \brief Resample output rows [i0, i1) with `Interpolate_LMK_ELE` and `Interpolate_LMK_SRM` at the pixel centers
+ \param[in] scratch 3 `out->num_cols` buffers
+ */
+static void resample_band_bilinear(const ResampleJob *job, int32_t i0, int32_t i1, double *scratch)
+{
+    LMK *out = job->out;
+    int32_t n_out = out->num_cols;
+    double *x = scratch;
+    double *y = x + n_out;
+    double *ele = y + n_out;
+    for(int32_t i = i0; i < i1; i++){
+        size_t row = (size_t)(i - job->out_top)*n_out;
+        inter_affine_row(0.0, i*job->scale - job->src_top, job->scale, 0.0, n_out, x, y);
+        Interpolate_LMK_ELE_Batch(job->src, x, y, n_out, ele);
+        for(int32_t j = 0; j < n_out; j++){
+            out->ele[row + j] = (float)ele[j];
+        }
+        Interpolate_LMK_SRM_Batch(job->src, x, y, n_out, &out->srm[row], NULL);
+    }
+}
+
+static bool resample_bands(void *user, int32_t thread, size_t begin, size_t end)
+{
+    ResampleJob *job = (ResampleJob *)user;
+    int32_t n_out = job->out->num_cols;
+    size_t scratch_size = job->filter == LMK_RESAMPLE_BILINEAR ? 3*(size_t)n_out
+                                                               : 3*((size_t)job->band_rows + 1)*n_out;
+    double *scratch = (double *)parallel_scratch_reserve(&job->scratch, thread, sizeof(double)*scratch_size);
+    if(scratch == NULL) return false;
+
+    int32_t i0 = job->out_top + (int32_t)begin;
+    int32_t i1 = job->out_top + (int32_t)end;
+    if(job->filter == LMK_RESAMPLE_BILINEAR){
+        resample_band_bilinear(job, i0, i1, scratch);
+    }else{
+        resample_band_filtered(job, i0, i1, scratch);
+    }
+    return true;
+}
+
+/**
+ \brief Header of the resampled landmark, without its anchor point
+ */
+static void resample_header(const LMK *lmk, LMK *lmk_sub, double scale)
+{
+    Copy_LMK_Header(lmk, lmk_sub);
+    lmk_sub->num_cols = (int32_t)(lmk_sub->num_cols/scale);
+    lmk_sub->num_rows = (int32_t)(lmk_sub->num_rows/scale);
+    lmk_sub->resolution = lmk->resolution*scale;
+    scale3(scale, lmk->col_row2mapxy[0], lmk_sub->col_row2mapxy[0]);
+    scale3(scale, lmk->col_row2mapxy[1], lmk_sub->col_row2mapxy[1]);
+
+    scale3(1/scale, lmk->mapxy2col_row[0], lmk_sub->mapxy2col_row[0]);
+    scale3(1/scale, lmk->mapxy2col_row[1], lmk_sub->mapxy2col_row[1]);
+
+    lmk_sub->anchor_col = (float)lmk_sub->num_cols/2.0;
+    lmk_sub->anchor_row = (float)lmk_sub->num_rows/2.0;
+    lmk_sub->num_pixels = lmk_sub->num_cols*lmk_sub->num_rows;
+}
+
+/**
+ \brief Filter weights of a resampling of `lmk` to `lmk_sub`
+ \return false if memory allocation fails
+ */
+static bool init_job(ResampleJob *job, const LMK *lmk, const LMK *lmk_sub, double scale,
+                     enum LMK_ResampleFilter filter)
+{
+    memset(job, 0, sizeof(ResampleJob));
+    job->lmk = lmk;
+    job->scale = scale;
+    job->filter = filter;
+    if(filter == LMK_RESAMPLE_BILINEAR) return true;
+
+    if(!init_axis(&job->cols, lmk->num_cols, lmk_sub->num_cols, scale, filter)){
+        return false;
+    }
+    if(!init_axis(&job->rows, lmk->num_rows, lmk_sub->num_rows, scale, filter)){
+        free_axis(&job->cols);
+        return false;
+    }
+    for(int32_t i0 = 0; i0 < lmk_sub->num_rows; i0 += LMK_RESAMPLE_BAND){
+        int32_t i1 = i0 + LMK_RESAMPLE_BAND < lmk_sub->num_rows ? i0 + LMK_RESAMPLE_BAND : lmk_sub->num_rows;
+        for(int32_t i = i0; i < i1; i++){
+            int32_t band_rows = job->rows.first[i] + job->rows.count[i] - job->rows.first[i0];
+            if(band_rows > job->band_rows) job->band_rows = band_rows;
+        }
+    }
+    return true;
+}
+
+static void free_job(ResampleJob *job)
+{
+    parallel_scratch_free(&job->scratch);
+    if(job->filter != LMK_RESAMPLE_BILINEAR){
+        free_axis(&job->cols);
+        free_axis(&job->rows);
+    }
+}
+
+/**
+ \brief Resample the output rows of `out` from the input rows of `src`, in bands of LMK_RESAMPLE_BAND rows
+ \return false if a thread could not allocate its buffers
+ */
+static bool run_job(ResampleJob *job, const LMK *src, int32_t src_top, LMK *out, int32_t out_top)
+{
+    job->src = src;
+    job->src_top = src_top;
+    job->out = out;
+    job->out_top = out_top;
+    return parallel_for((size_t)out->num_rows, LMK_RESAMPLE_BAND, 0, resample_bands, job);
+}
+
+bool Resample_LMK_Filtered(const LMK *lmk, LMK *lmk_sub, double scale, enum LMK_ResampleFilter filter)
+{
+    resample_header(lmk, lmk_sub, scale);
+    double x = lmk_sub->anchor_col*scale;
+    double y = lmk_sub->anchor_row*scale;
+    LMK_Col_Row2World(lmk, x, y, lmk_sub->anchor_point);
+    if(!allocate_lmk_arrays(lmk_sub, lmk_sub->num_cols, lmk_sub->num_rows)){
+        return false;
+    }
+    if(lmk_sub->num_pixels == 0) return true;
+
+    ResampleJob job;
+    if(!init_job(&job, lmk, lmk_sub, scale, filter)){
+        printf("Resample_LMK_Filtered() ==>> malloc() failed\n");
+        return false;
+    }
+    bool success = run_job(&job, lmk, 0, lmk_sub, 0);
+    free_job(&job);
+    if(!success){
+        printf("Resample_LMK_Filtered() ==>> malloc() failed\n");
+    }
+    return success;
+}
+
+bool Resample_LMK_File(const char *infile, const char *outfile, double scale, enum LMK_ResampleFilter filter)
+{
+    LMK lmk = {0};
+    LMK_Row_Reader *reader = Open_LMK_Row_Reader(infile, &lmk);
+    if(reader == NULL) return false;
+
+    LMK header = {0};
+    resample_header(&lmk, &header, scale);
+    double x = header.anchor_col*scale;
+    double y = header.anchor_row*scale;
+    LMK band = {0};
+    int32_t top = 0;
+    bool success = Read_LMK_Rows_Interpolate(reader, y, y, &band, &top);
+    if(success){
+        double ele = Interpolate_LMK_ELE(&band, x, y - top);
+        LMK_Col_Row_Elevation2World(&lmk, x, y, ele, header.anchor_point);
+    }
+
+    ResampleJob job;
+    success = success && init_job(&job, &lmk, &header, scale, filter);
+    if(!success){
+        printf("Resample_LMK_File() ==>> failed to read the landmark or allocate the filter\n");
+        Close_LMK_Row_Reader(reader);
+        return false;
+    }
+
+    // Whole bands of output rows are resampled together, from the input rows of their filter support
+    int64_t row_bytes = (int64_t)header.num_cols*(sizeof(uint8_t) + sizeof(float));
+    int32_t chunk_rows = (int32_t)(LMK_WRITER_BUFFER_BYTES/row_bytes/LMK_RESAMPLE_BAND)*LMK_RESAMPLE_BAND;
+    if(chunk_rows < LMK_RESAMPLE_BAND) chunk_rows = LMK_RESAMPLE_BAND;
+    LMK chunk = {0};
+    Copy_LMK_Header(&header, &chunk);
+    chunk.srm = (uint8_t *)malloc(sizeof(uint8_t)*header.num_cols*chunk_rows);
+    chunk.ele = (float *)malloc(sizeof(float)*header.num_cols*chunk_rows);
+    LMK_Writer *writer = chunk.srm != NULL && chunk.ele != NULL ? Open_LMK_Writer(outfile, &header) : NULL;
+    success = writer != NULL;
+
+    for(int32_t i0 = 0; i0 < header.num_rows && success; i0 += chunk_rows){
+        int32_t i1 = i0 + chunk_rows < header.num_rows ? i0 + chunk_rows : header.num_rows;
+        if(filter == LMK_RESAMPLE_BILINEAR){
+            success &= Read_LMK_Rows_Interpolate(reader, i0*scale, (i1 - 1)*scale, &band, &top);
+        }else{
+            int32_t k0 = job.rows.first[i0];
+            int32_t k1 = k0;
+            for(int32_t i = i0; i < i1; i++){
+                int32_t end = job.rows.first[i] + job.rows.count[i];
+                if(end > k1) k1 = end;
+            }
+            top = k0;
+            success &= Read_LMK_Rows(reader, k0, k1 - k0, &band);
+        }
+        chunk.num_rows = i1 - i0;
+        success = success && run_job(&job, &band, top, &chunk, i0);
+        success = success && Append_LMK_Rows(writer, chunk.srm, chunk.ele, chunk.num_rows);
+    }
+    if(writer != NULL){
+        success = Close_LMK_Writer(writer) && success;
+    }
+    if(!success){
+        printf("Resample_LMK_File() ==>> failed to resample %s\n", infile);
+    }
+    free(chunk.srm);
+    free(chunk.ele);
+    free_job(&job);
+    Close_LMK_Row_Reader(reader);
+    return success;
+}
+
+enum LMK_ResampleFilter strToLMKResampleFilter(const char *str){
+    enum LMK_ResampleFilter filter = LMK_RESAMPLE_BILINEAR;
+    if(str != NULL){
+        if(strncmp(str, "BILINEAR", strlen(str))==0){
+            filter = LMK_RESAMPLE_BILINEAR;
+        }else if(strncmp(str, "AREA", strlen(str))==0){
+            filter = LMK_RESAMPLE_AREA;
+        }else if(strncmp(str, "LANCZOS", strlen(str))==0){
+            filter = LMK_RESAMPLE_LANCZOS;
+        }else{
+            printf("Value of str must be \"BILINEAR\", \"AREA\", or \"LANCZOS\"\n");
+            filter = LMK_ResampleFilter_UNDEFINED;
+        }
+    }
+    return filter;
+}
@@ -0,0 +1,86 @@
+/**
+ * \file `lmk_resample.h`
+ * \brief Filtered resampling of landmarks
+ *
+ * Output pixel (j, i) is centered on input pixel coordinate (j*scale, i*scale), as in `ResampleLMK`. The area and
+ * Lanczos filters are separable: every input row is filtered along the columns once per band of output rows, and the
+ * filtered rows are combined along the rows. The bands are resampled on all processors.
+ *
+ * Elevations are NAN-aware: NAN input pixels are left out and the weights of the others renormalized, and an output
+ * elevation is NAN when less than half of its filter weight falls on valid pixels.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LMK_RESAMPLE_H_
+#define _LANDMARK_TOOLS_LMK_RESAMPLE_H_
+
+#include <stdbool.h>                                         // for bool
+
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Resampling filter
+ */
+enum LMK_ResampleFilter {
+    LMK_RESAMPLE_BILINEAR,      //!< bilinear interpolation at the output pixel centers, without pre-filtering
+    LMK_RESAMPLE_AREA,          //!< average over the footprint of the output pixel, box sums for odd integer scales
+    LMK_RESAMPLE_LANCZOS,       //!< Lanczos-3 kernel, stretched by the scale when downsampling
+    LMK_ResampleFilter_UNDEFINED
+};
+
+/**
+ * \brief Convert string to LMK_ResampleFilter
+ *
+ * \param[in] str "BILINEAR", "AREA", or "LANCZOS"
+ * \return LMK_ResampleFilter or LMK_ResampleFilter_UNDEFINED, LMK_RESAMPLE_BILINEAR if str is NULL
+ */
+enum LMK_ResampleFilter strToLMKResampleFilter(const char *str);
+
+/**
+ * \brief Resample the landmark struct such that the new resolution is `scale*old_resolution`
+ *
+ * \param[in] lmk input landmark
+ * \param[out] lmk_out resampled landmark
+ * \param[in] scale
+ * \param[in] filter
+ * \return true on success
+ * \return false if memory allocation fails
+ */
+bool Resample_LMK_Filtered(const LMK *lmk, LMK *lmk_out, double scale, enum LMK_ResampleFilter filter);
+
+/**
+ * \brief Resample a landmark file to a new landmark file, a band of rows at a time
+ *
+ * Only the input rows under the filter support of the current band of output rows are in memory, so landmarks larger
+ * than memory can be resampled. The output file is identical to `Resample_LMK_Filtered` followed by `Write_LMK`.
+ * `outfile` must differ from `infile`.
+ * \param[in] infile input landmark filepath
+ * \param[in] outfile output landmark filepath
+ * \param[in] scale
+ * \param[in] filter
+ * \return false on io error or if memory allocation fails
+ */
+bool Resample_LMK_File(const char *infile, const char *outfile, double scale, enum LMK_ResampleFilter filter);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_LMK_RESAMPLE_H_ */
@@ -0,0 +1,230 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <pthread.h>                // for pthread_create, pthread_mutex_t
+#include <stdio.h>                  // for fopen, fwrite, fclose
+#include <stdlib.h>                 // for malloc, free
+#include <string.h>                 // for memcpy, strncpy
+
+#include "landmark_tools/landmark_util/lmk_overview.h"
+#include "landmark_tools/landmark_util/lmk_writer.h"
+#include "landmark_tools/utils/endian_read_write.h"
+#include "landmark_tools/utils/safe_string.h"
+
+#define NUM_SLOTS 2
+
+typedef struct {
+    uint8_t *srm;
+    float *ele;
+    int32_t first_row;
+    int32_t nrows;
+    bool full;
+} WriterSlot;
+
+struct LMK_Writer {
+    FILE *fp;
+    LMK header;
+    int32_t rows_per_slot;
+    int32_t next_row;      //!< next row expected by Append_LMK_Rows
+    int32_t fill_slot;     //!< slot the producer fills next
+    int32_t rows_written;  //!< rows written by the background thread
+    bool closing;
+    bool error;
+    WriterSlot slots[NUM_SLOTS];
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static bool write_slot(LMK_Writer *writer, WriterSlot *slot){
+    int64_t cols = writer->header.num_cols;
+    int64_t count = cols*slot->nrows;
+    int64_t srm_offset = LMK_HEADER_SIZE + slot->first_row*cols;
+    int64_t ele_offset = LMK_HEADER_SIZE + writer->header.num_pixels + slot->first_row*cols*(int64_t)sizeof(float);
+
+    swap_big_endian_array(slot->ele, 32, count);
+    return seek_file_offset(writer->fp, srm_offset) &&
+           fwrite(slot->srm, sizeof(uint8_t), count, writer->fp) == (size_t)count &&
+           seek_file_offset(writer->fp, ele_offset) &&
+           fwrite(slot->ele, sizeof(float), count, writer->fp) == (size_t)count;
+}
+
+static void *writer_thread(void *arg){
+    LMK_Writer *writer = (LMK_Writer *)arg;
+    int32_t write_index = 0;
+
+    pthread_mutex_lock(&writer->mutex);
+    while(true){
+        WriterSlot *slot = &writer->slots[write_index];
+        while(!slot->full && !writer->closing){
+            pthread_cond_wait(&writer->cond, &writer->mutex);
+        }
+        if(!slot->full) break; // closing and nothing left to write
+
+        // Swap and io happen without the lock so the producer can fill the other slot
+        pthread_mutex_unlock(&writer->mutex);
+        bool ok = write_slot(writer, slot);
+        pthread_mutex_lock(&writer->mutex);
+
+        writer->error |= !ok;
+        writer->rows_written += slot->nrows;
+        slot->full = false;
+        write_index = (write_index + 1) % NUM_SLOTS;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    return NULL;
+}
+
+static void free_writer(LMK_Writer *writer){
+    for(int32_t i = 0; i < NUM_SLOTS; i++){
+        free(writer->slots[i].srm);
+        free(writer->slots[i].ele);
+    }
+    free(writer);
+}
+
+LMK_Writer *Open_LMK_Writer(const char *filename, const LMK *header)
+{
+    if(header->num_cols <= 0 || header->num_rows <= 0){
+        SAFE_PRINTF(512, "Open_LMK_Writer() ==>> invalid landmark size %d x %d\n", header->num_cols, header->num_rows);
+        return NULL;
+    }
+
+    LMK_Writer *writer = (LMK_Writer *)calloc(1, sizeof(LMK_Writer));
+    if(writer == NULL){
+        SAFE_PRINTF(512, "Open_LMK_Writer() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    Copy_LMK_Header(header, &writer->header);
+    strncpy(writer->header.filename, filename, LMK_FILENAME_SIZE - 1);
+    writer->header.num_pixels = (int64_t)header->num_cols*header->num_rows;
+    writer->header.srm = NULL;
+    writer->header.ele = NULL;
+
+    int64_t row_bytes = (int64_t)header->num_cols*(sizeof(uint8_t) + sizeof(float));
+    writer->rows_per_slot = (int32_t)(LMK_WRITER_BUFFER_BYTES/row_bytes);
+    if(writer->rows_per_slot < 1) writer->rows_per_slot = 1;
+    if(writer->rows_per_slot > header->num_rows) writer->rows_per_slot = header->num_rows;
+
+    size_t slot_pixels = (size_t)writer->rows_per_slot*header->num_cols;
+    for(int32_t i = 0; i < NUM_SLOTS; i++){
+        writer->slots[i].srm = (uint8_t *)malloc(slot_pixels*sizeof(uint8_t));
+        writer->slots[i].ele = (float *)malloc(slot_pixels*sizeof(float));
+        if(writer->slots[i].srm == NULL || writer->slots[i].ele == NULL){
+            SAFE_PRINTF(512, "Open_LMK_Writer() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+            free_writer(writer);
+            return NULL;
+        }
+    }
+
+    if(!Remove_LMK_Overviews(filename)){
+        free_writer(writer);
+        return NULL;
+    }
+    writer->fp = fopen(filename, "wb");
+    if(writer->fp == NULL){
+        SAFE_PRINTF(512, "Open_LMK_Writer() ==>> cannot open file %s to write\n", filename);
+        free_writer(writer);
+        return NULL;
+    }
+    if(!write_lmk_header(writer->fp, &writer->header, LMK_VERSION_V3)){
+        SAFE_PRINTF(512, "Open_LMK_Writer() ==>> failed to write header of %s\n", filename);
+        fclose(writer->fp);
+        free_writer(writer);
+        return NULL;
+    }
+
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    if(pthread_create(&writer->thread, NULL, writer_thread, writer) != 0){
+        SAFE_PRINTF(512, "Open_LMK_Writer() ==>> failed to start writer thread for %s\n", filename);
+        pthread_mutex_destroy(&writer->mutex);
+        pthread_cond_destroy(&writer->cond);
+        fclose(writer->fp);
+        free_writer(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+bool Append_LMK_Rows(LMK_Writer *writer, const uint8_t *srm, const float *ele, int32_t nrows)
+{
+    int32_t cols = writer->header.num_cols;
+    if(writer->next_row + nrows > writer->header.num_rows){
+        SAFE_PRINTF(512, "Append_LMK_Rows() ==>> %d rows exceed landmark height %d\n",
+                    writer->next_row + nrows, writer->header.num_rows);
+        return false;
+    }
+
+    int32_t appended = 0;
+    while(appended < nrows){
+        int32_t n = nrows - appended;
+        if(n > writer->rows_per_slot) n = writer->rows_per_slot;
+
+        pthread_mutex_lock(&writer->mutex);
+        WriterSlot *slot = &writer->slots[writer->fill_slot];
+        while(slot->full && !writer->error){
+            pthread_cond_wait(&writer->cond, &writer->mutex);
+        }
+        bool error = writer->error;
+        pthread_mutex_unlock(&writer->mutex);
+        if(error) return false;
+
+        // The slot is owned by the producer until it is marked full
+        size_t offset = (size_t)appended*cols;
+        memcpy(slot->srm, srm + offset, (size_t)n*cols*sizeof(uint8_t));
+        memcpy(slot->ele, ele + offset, (size_t)n*cols*sizeof(float));
+        slot->first_row = writer->next_row;
+        slot->nrows = n;
+
+        pthread_mutex_lock(&writer->mutex);
+        slot->full = true;
+        pthread_cond_broadcast(&writer->cond);
+        pthread_mutex_unlock(&writer->mutex);
+
+        writer->fill_slot = (writer->fill_slot + 1) % NUM_SLOTS;
+        writer->next_row += n;
+        appended += n;
+    }
+    return true;
+}
+
+bool Close_LMK_Writer(LMK_Writer *writer)
+{
+    if(writer == NULL) return false;
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->closing = true;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->mutex);
+    pthread_join(writer->thread, NULL);
+    pthread_mutex_destroy(&writer->mutex);
+    pthread_cond_destroy(&writer->cond);
+
+    bool success = !writer->error && writer->rows_written == writer->header.num_rows;
+    if(writer->rows_written != writer->header.num_rows){
+        SAFE_PRINTF(512, "Close_LMK_Writer() ==>> %s is incomplete, %d of %d rows written\n",
+                    writer->header.filename, writer->rows_written, writer->header.num_rows);
+    }
+    success &= fclose(writer->fp) == 0;
+
+    //Write ascii header file
+    success = success && write_lmk_ascii_header(writer->header.filename, &writer->header);
+    free_writer(writer);
+    return success;
+}
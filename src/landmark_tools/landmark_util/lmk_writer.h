@@ -0,0 +1,73 @@
+/**
+ * \file `lmk_writer.h`
+ * \brief Streaming landmark file writer with background byte swapping and io
+ *
+ * The header of the landmark must be known when the writer is opened. Row blocks are then appended in order,
+ * copied into one of two staging buffers, and written by a background thread while the caller produces
+ * the next rows. The output is a v3 landmark file identical to the output of `Write_LMK`.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LMK_WRITER_H_
+#define _LANDMARK_TOOLS_LMK_WRITER_H_
+
+#include <stdbool.h>                                         // for bool
+#include <stdint.h>                                          // for int32_t
+
+#include "landmark_tools/landmark_util/landmark.h"          // for LMK
+
+#define LMK_WRITER_BUFFER_BYTES (4*1024*1024) //target size of one staging buffer
+
+typedef struct LMK_Writer LMK_Writer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Open a streaming writer and write the landmark header
+ * \param[in] filename cstring containing filename
+ * \param[in] header landmark header. The pixel arrays are not used
+ * \return writer or NULL if the file cannot be opened or memory allocation fails
+ */
+LMK_Writer *Open_LMK_Writer(const char *filename, const LMK *header);
+
+/**
+ * \brief Append rows to the landmark file
+ *
+ * Rows must be appended in order. The data is copied, so the caller may reuse the buffers on return.
+ * \param[in] writer
+ * \param[in] srm nrows*num_cols surface reflectance values
+ * \param[in] ele nrows*num_cols elevation values
+ * \param[in] nrows number of rows
+ * \return true on success
+ * \return false if a previous write failed or more rows than the landmark height are appended
+ */
+bool Append_LMK_Rows(LMK_Writer *writer, const uint8_t *srm, const float *ele, int32_t nrows);
+
+/**
+ * \brief Wait for pending writes, close the file, write the ascii header file and free the writer
+ * \param[in] writer
+ * \return true if every row of the landmark was written
+ * \return false on io error or if rows are missing
+ */
+bool Close_LMK_Writer(LMK_Writer *writer);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _LANDMARK_TOOLS_LMK_WRITER_H_
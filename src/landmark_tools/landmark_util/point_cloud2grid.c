@@ -15,237 +15,1084 @@
  */
 
 #include <math.h>                   // for exp, fabs, sqrt
+#include <pthread.h>                // for pthread_create, pthread_join
 #include <stdbool.h>
 #include <stdio.h>                  // for fopen, snprintf, fclose, FILE, fgets
 #include <stdlib.h>                 // for malloc
 #include <string.h>
 #include <float.h>
+#if defined(LINUX_OS) || defined(MAC_OS)
+#include <fcntl.h>                  // for open
+#include <sys/mman.h>               // for mmap, munmap
+#include <sys/stat.h>               // for fstat
+#include <unistd.h>                 // for close
+#define POINT_HAVE_MMAP
+#endif
 
 #include "landmark_tools/landmark_util/landmark.h"    // for Write_LMK_PLY_Facet_Window
 #include "landmark_tools/landmark_util/point_cloud2grid.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/parallel.h"
 #include "landmark_tools/utils/safe_string.h"
 #include "rply.h"
 #include "math/mat3/mat3.h"
+#include "math/mat3/mat3_inline.h"
 
-static int32_t vertex_index = 0;
-static double *pts_array = 0;
-static uint8_t *bv_array = 0;
+#define POINT_GRID_MAX_THREADS 64
+#define POINT_GRID_TILE_SIZE 128   //landmark pixels on a side of the tiles gridded by one thread at a time
+#define POINT_GRID_RADIUS 4         //pixels on each side of a point reached by the smoothing kernel
 
+/**
+ \brief Work of one thread in a phase of a `PointGrid`
+ */
+typedef struct {
+    PointGrid *grid;
+    int32_t thread;
+} PointGridTask;
 
-bool point2lmk( double *pts, uint8_t *bv, size_t num_pts, LMK *lmk, enum PointFrame frame, bool smooth)
+/**
+ \brief Blocks of work of the same size, each given to one call of `work`
+ */
+typedef struct {
+    char *blocks;
+    size_t block_size;
+    void *(*work)(void *);
+} PointBlocks;
+
+static int32_t point_grid_num_threads(void){
+    int32_t n = parallel_num_threads();
+    return n < POINT_GRID_MAX_THREADS ? n : POINT_GRID_MAX_THREADS;
+}
+
+static bool run_point_blocks(void *user, int32_t thread, size_t begin, size_t end)
 {
-    float* weight_map = (float *)malloc(sizeof(float)*lmk->num_cols*lmk->num_rows);
-    float* srm1 = (float *)malloc(sizeof(float)*lmk->num_cols*lmk->num_rows);
-    float* ele1 = (float *)malloc(sizeof(float)*lmk->num_cols*lmk->num_rows);
-    float* nearest = (float *)malloc(sizeof(float)*lmk->num_cols*lmk->num_rows);
-    
-    if(weight_map == NULL || srm1 == NULL || ele1 == NULL || nearest == NULL){
-        if(weight_map != NULL) free(weight_map);
-        if(srm1 != NULL) free(srm1);
-        if(ele1 != NULL) free(ele1);
-        if(nearest != NULL) free(nearest);
+    (void)thread;
+    PointBlocks *loop = (PointBlocks *)user;
+    for(size_t b = begin; b < end; b++){
+        loop->work(loop->blocks + b*loop->block_size);
+    }
+    return true;
+}
+
+/**
+ \brief Call `work` once on each of `num_blocks` blocks, across the threads of `parallel_for`
+ */
+static void run_blocks(void *blocks, size_t block_size, int32_t num_blocks, void *(*work)(void *))
+{
+    PointBlocks loop = {(char *)blocks, block_size, work};
+    parallel_for(num_blocks > 0 ? (size_t)num_blocks : 0, 1, num_blocks, run_point_blocks, &loop);
+}
+
+/**
+ \brief Landmark coordinates of point i of the current chunk
+ */
+static void project_point(const PointGrid *grid, size_t i, double *x, double *y, double *ele)
+{
+    const LMK *lmk = grid->lmk;
+    const double *pts = grid->pts;
+    if (grid->frame == WORLD){
+        World2LMK_Col_Row_Ele(lmk, (double *)&pts[i*3], x, y, ele);
+    }else if(grid->frame == LOCAL){
+        double pw[3], pm[3];
+        sub3(&pts[i*3], lmk->anchor_point, pw);
+        mult331(lmk->mapRworld, pw, pm);
+        *x = pm[0];
+        *y = pm[1];
+        *ele = pm[2];
+    }else{
+        *x = pts[i*3];
+        *y = pts[i*3+1];
+        *ele = pts[i*3+2] * lmk->resolution;
+    }
+}
+
+/**
+ \brief Nearest pixel of point i, and the range of tiles its kernel reaches
+ \return false if the point is off the landmark
+ */
+static bool point_tiles(const PointGrid *grid, size_t i, double *x, double *y, double *ele, int32_t *ix, int32_t *iy,
+                        int32_t tiles[4])
+{
+    const LMK *lmk = grid->lmk;
+    project_point(grid, i, x, y, ele);
+    if(!(fabs(*x) < INT32_MAX && fabs(*y) < INT32_MAX)){
         return false;
     }
-    
-    memset(weight_map, 0, sizeof(float)*lmk->num_cols*lmk->num_rows);
-    memset(srm1, 0, sizeof(float)*lmk->num_cols*lmk->num_rows);
-    memset(ele1, 0, sizeof(float)*lmk->num_cols*lmk->num_rows);
-    for(int32_t i = 0; i < num_pts; ++i){
-        nearest[i] = FLT_MAX;
+    *ix = round(*x);
+    *iy = round(*y);
+    if(*ix < 0 || *iy < 0 || *ix >= lmk->num_cols || *iy >= lmk->num_rows){
+        return false;
     }
-    
-    for(int32_t i = 0; i < num_pts; ++i)
-    {
+    if(grid->num_tiles == 1){
+        return true;
+    }
+    int32_t radius = grid->smooth ? POINT_GRID_RADIUS : 0;
+    int32_t cmin = *ix - radius < 0 ? 0 : *ix - radius;
+    int32_t cmax = *ix + radius >= lmk->num_cols ? lmk->num_cols - 1 : *ix + radius;
+    int32_t rmin = *iy - radius < 0 ? 0 : *iy - radius;
+    int32_t rmax = *iy + radius >= lmk->num_rows ? lmk->num_rows - 1 : *iy + radius;
+    tiles[0] = cmin/grid->tile_size;
+    tiles[1] = cmax/grid->tile_size;
+    tiles[2] = rmin/grid->tile_size;
+    tiles[3] = rmax/grid->tile_size;
+    return true;
+}
+
+/**
+ \brief Count the tile entries of the points of one thread, or with counts set to the first slots, bin them
+ */
+static void bin_points(PointGrid *grid, int32_t thread, bool scatter)
+{
+    size_t first = grid->num_pts*thread/grid->num_threads;
+    size_t last = grid->num_pts*(thread + 1)/grid->num_threads;
+    size_t *counts = &grid->counts[(size_t)thread*grid->num_tiles];
+    for(size_t i = first; i < last; i++){
         double x, y, ele;
-        if (frame == WORLD){
-            World2LMK_Col_Row_Ele(lmk, &pts[i*3], &x, &y, &ele);
-        }else if(frame == LOCAL){
-            double pw[3], pm[3]; 
-            sub3(&pts[i*3], lmk->anchor_point, pw);
-            mult331(lmk->mapRworld, pw, pm);
-            x = pm[0];
-            y = pm[1];
-            ele = pm[2];
-        }else{
-            x = pts[i*3];
-            y = pts[i*3+1];
-            ele = pts[i*3+2] * lmk->resolution;
+        int32_t ix, iy, tiles[4];
+        if(!point_tiles(grid, i, &x, &y, &ele, &ix, &iy, tiles)) continue;
+        for(int32_t ty = tiles[2]; ty <= tiles[3]; ty++){
+            for(int32_t tx = tiles[0]; tx <= tiles[1]; tx++){
+                int32_t tile = ty*grid->tiles_x + tx;
+                if(scatter){
+                    grid->order[counts[tile]] = i;
+                }
+                counts[tile]++;
+            }
         }
+    }
+}
 
+/**
+ \brief Pixel bounds of a tile
+ */
+static void tile_bounds(const PointGrid *grid, int32_t tile, int32_t *left, int32_t *top, int32_t *right,
+                        int32_t *bottom)
+{
+    const LMK *lmk = grid->lmk;
+    *left = (tile % grid->tiles_x)*grid->tile_size;
+    *top = (tile / grid->tiles_x)*grid->tile_size;
+    *right = grid->tile_size < lmk->num_cols - *left ? *left + grid->tile_size : lmk->num_cols;
+    *bottom = grid->tile_size < lmk->num_rows - *top ? *top + grid->tile_size : lmk->num_rows;
+}
 
-        int32_t ix = round(x);
-        int32_t iy = round(y);
-        uint8_t bb = bv[i];
-        
-        if(ix >= 0 && iy >= 0 && ix < lmk->num_cols && iy < lmk->num_rows)
-        {
-            if(smooth){
-                int32_t cmin = ix - 4;
-                int32_t  cmax = ix + 4;
-                if(cmin < 0) cmin = 0;
-                if(cmax >= lmk->num_cols) cmax =lmk->num_cols-1;
-                
-                int32_t rmin = iy - 4;
-                int32_t rmax = iy + 4;
-                if(rmin < 0) rmin = 0;
-                if(rmax >= lmk->num_rows) rmax = lmk->num_rows-1;
-                for(int32_t m = rmin; m <= rmax; ++m)
+/**
+ \brief Add the points of the current chunk that reach one tile, in input order
+ */
+static void grid_tile(PointGrid *grid, int32_t tile)
+{
+    LMK *lmk = grid->lmk;
+    int32_t left, top, right, bottom;
+    tile_bounds(grid, tile, &left, &top, &right, &bottom);
+    float *ele1 = grid->ele1;
+    float *srm1 = grid->srm1;
+    float *weight_map = grid->weight_map;
+    float *nearest = grid->nearest;
+
+    for(size_t k = grid->tile_start[tile]; k < grid->tile_start[tile + 1]; k++){
+        double x, y, ele;
+        int32_t ix, iy, tiles[4];
+        size_t point = k;
+        if(grid->order != NULL){
+            point = grid->order[k];
+            project_point(grid, point, &x, &y, &ele);
+            ix = round(x);
+            iy = round(y);
+        }else if(!point_tiles(grid, point, &x, &y, &ele, &ix, &iy, tiles)){
+            continue;
+        }
+        uint8_t bb = grid->bv[point];
+        if(grid->smooth){
+            // The part of the 9x9 kernel inside this tile
+            int32_t cmin = ix - POINT_GRID_RADIUS < left ? left : ix - POINT_GRID_RADIUS;
+            int32_t cmax = ix + POINT_GRID_RADIUS >= right ? right - 1 : ix + POINT_GRID_RADIUS;
+            int32_t rmin = iy - POINT_GRID_RADIUS < top ? top : iy - POINT_GRID_RADIUS;
+            int32_t rmax = iy + POINT_GRID_RADIUS >= bottom ? bottom - 1 : iy + POINT_GRID_RADIUS;
+            double dx2[2*POINT_GRID_RADIUS + 1];
+            for(int32_t n = cmin; n <= cmax; ++n){
+                dx2[n - cmin] = (n- x)*(n-x);
+            }
+            for(int32_t m = rmin; m <= rmax; ++m)
+            {
+                double dy2 = (m- y)*(m-y);
+                for(int32_t n = cmin; n <= cmax; ++n)
                 {
-                    for(int32_t n = cmin; n <= cmax; ++n)
-                    {
-                        double d = 2.0*sqrt((m- y)*(m-y) + (n- x)*(n-x));
-                        double wt = exp(-d);
-                        ele1[m*lmk->num_cols + n] += wt*ele;
-                        srm1[m*lmk->num_cols + n] +=wt*(double)bb;
-                        weight_map[m*lmk->num_cols + n] +=wt;
-                    }
-                }
-            }else{
-                double d = 2.0*sqrt((iy- y)*(iy-y) + (ix- x)*(ix-x));
-                if(nearest[iy*lmk->num_cols + ix] > d){
-                    ele1[iy*lmk->num_cols + ix] = ele;
-                    srm1[iy*lmk->num_cols + ix] = bb;
-                    weight_map[iy*lmk->num_cols + ix] = 1;
-                    nearest[iy*lmk->num_cols + ix] = d;
+                    double d = 2.0*sqrt(dy2 + dx2[n - cmin]);
+                    double wt = exp(-d);
+                    ele1[m*lmk->num_cols + n] += wt*ele;
+                    srm1[m*lmk->num_cols + n] +=wt*(double)bb;
+                    weight_map[m*lmk->num_cols + n] +=wt;
                 }
             }
-            
+        }else{
+            // Ties go to the first point of the input
+            double d = 2.0*sqrt((iy- y)*(iy-y) + (ix- x)*(ix-x));
+            if(nearest[iy*lmk->num_cols + ix] > d){
+                ele1[iy*lmk->num_cols + ix] = ele;
+                srm1[iy*lmk->num_cols + ix] = bb;
+                weight_map[iy*lmk->num_cols + ix] = 1;
+                nearest[iy*lmk->num_cols + ix] = d;
+            }
         }
-        
     }
-    
-    for(int32_t i = 0; i <lmk->num_pixels; ++i)
-    {
-        if(weight_map[i] > 0.0)
-        {
-            lmk->ele[i] = ele1[i]/weight_map[i];
-            double srm = srm1[i]/weight_map[i];
-            if(srm > 255) srm = 255;
-            if(srm <0 ) srm = 0;
-            lmk->srm[i] = srm;
+}
+
+/**
+ \brief Write the landmark pixels of one tile from the sums
+ */
+static void finish_tile(PointGrid *grid, int32_t tile)
+{
+    LMK *lmk = grid->lmk;
+    int32_t left, top, right, bottom;
+    tile_bounds(grid, tile, &left, &top, &right, &bottom);
+    for(int32_t m = top; m < bottom; ++m){
+        for(int32_t n = left; n < right; ++n){
+            size_t i = (size_t)m*lmk->num_cols + n;
+            if(grid->weight_map[i] > 0.0)
+            {
+                lmk->ele[i] = grid->ele1[i]/grid->weight_map[i];
+                double srm = grid->srm1[i]/grid->weight_map[i];
+                if(srm > 255) srm = 255;
+                if(srm <0 ) srm = 0;
+                lmk->srm[i] = srm;
+            }
+            else
+            {
+                lmk->ele[i] = NAN;
+                lmk->srm[i] = 0;
+            }
         }
-        else
-        {
-            lmk->ele[i] = NAN;
-            lmk->srm[i] = 0;
+    }
+}
+
+static void *count_thread(void *arg)
+{
+    PointGridTask *task = (PointGridTask *)arg;
+    bin_points(task->grid, task->thread, false);
+    return NULL;
+}
+
+static void *scatter_thread(void *arg)
+{
+    PointGridTask *task = (PointGridTask *)arg;
+    bin_points(task->grid, task->thread, true);
+    return NULL;
+}
+
+/**
+ \brief Next tile not yet taken by a thread
+ \return -1 when every tile is taken
+ */
+static int32_t take_tile(PointGrid *grid)
+{
+    pthread_mutex_lock(&grid->mutex);
+    int32_t tile = grid->next_tile < grid->num_tiles ? grid->next_tile++ : -1;
+    pthread_mutex_unlock(&grid->mutex);
+    return tile;
+}
+
+static void *grid_thread(void *arg)
+{
+    PointGrid *grid = ((PointGridTask *)arg)->grid;
+    for(int32_t tile = take_tile(grid); tile >= 0; tile = take_tile(grid)){
+        grid_tile(grid, tile);
+    }
+    return NULL;
+}
+
+static void *finish_thread(void *arg)
+{
+    PointGrid *grid = ((PointGridTask *)arg)->grid;
+    for(int32_t tile = take_tile(grid); tile >= 0; tile = take_tile(grid)){
+        finish_tile(grid, tile);
+    }
+    return NULL;
+}
+
+/**
+ \brief Run a phase once for every thread index of the grid
+ */
+static void run_phase(PointGrid *grid, void *(*phase)(void *))
+{
+    PointGridTask tasks[POINT_GRID_MAX_THREADS];
+    grid->next_tile = 0;
+    for(int32_t t = 0; t < grid->num_threads; t++){
+        tasks[t].grid = grid;
+        tasks[t].thread = t;
+    }
+    run_blocks(tasks, sizeof(PointGridTask), grid->num_threads, phase);
+}
+
+bool point_grid_init(PointGrid *grid, LMK *lmk, enum PointFrame frame, bool smooth)
+{
+    memset(grid, 0, sizeof(PointGrid));
+    pthread_mutex_init(&grid->mutex, NULL);
+    grid->lmk = lmk;
+    grid->frame = frame;
+    grid->smooth = smooth;
+    grid->num_threads = point_grid_num_threads();
+
+    // One thread grids the points in a single tile, without sorting them
+    grid->tile_size = grid->num_threads > 1 ? POINT_GRID_TILE_SIZE : INT32_MAX;
+    grid->tiles_x = grid->num_threads > 1 ? (lmk->num_cols + POINT_GRID_TILE_SIZE - 1)/POINT_GRID_TILE_SIZE : 1;
+    grid->num_tiles = grid->num_threads > 1 ? grid->tiles_x*((lmk->num_rows + POINT_GRID_TILE_SIZE - 1)/POINT_GRID_TILE_SIZE) : 1;
+
+    size_t num_pixels = (size_t)lmk->num_cols*lmk->num_rows;
+    grid->weight_map = (float *)mem_calloc(MEM_GRIDDING, num_pixels, sizeof(float));
+    grid->srm1 = (float *)mem_calloc(MEM_GRIDDING, num_pixels, sizeof(float));
+    grid->ele1 = (float *)mem_calloc(MEM_GRIDDING, num_pixels, sizeof(float));
+    grid->nearest = (float *)mem_malloc(MEM_GRIDDING, sizeof(float)*num_pixels);
+    grid->counts = (size_t *)malloc(sizeof(size_t)*((size_t)grid->num_threads*grid->num_tiles + 1));
+    grid->tile_start = (size_t *)malloc(sizeof(size_t)*(grid->num_tiles + 1));
+    if(grid->weight_map == NULL || grid->srm1 == NULL || grid->ele1 == NULL || grid->nearest == NULL ||
+       grid->counts == NULL || grid->tile_start == NULL){
+        printf("point_grid_init() ==>> malloc() failed\n");
+        point_grid_free(grid);
+        return false;
+    }
+    for(size_t i = 0; i < num_pixels; ++i){
+        grid->nearest[i] = FLT_MAX;
+    }
+    return true;
+}
+
+bool point_grid_add(PointGrid *grid, const double *pts, const uint8_t *bv, size_t num_pts)
+{
+    grid->pts = pts;
+    grid->bv = bv;
+    grid->num_pts = num_pts;
+
+    if(grid->num_tiles == 1){
+        grid->tile_start[0] = 0;
+        grid->tile_start[1] = num_pts;
+    }else{
+        // Counting sort of the points by tile. The slots of a tile follow the threads in order, and each thread
+        // covers a range of the input, so the points of a tile stay in input order.
+        memset(grid->counts, 0, sizeof(size_t)*grid->num_threads*grid->num_tiles);
+        run_phase(grid, count_thread);
+        size_t slot = 0;
+        for(int32_t tile = 0; tile < grid->num_tiles; tile++){
+            grid->tile_start[tile] = slot;
+            for(int32_t t = 0; t < grid->num_threads; t++){
+                size_t count = grid->counts[(size_t)t*grid->num_tiles + tile];
+                grid->counts[(size_t)t*grid->num_tiles + tile] = slot;
+                slot += count;
+            }
         }
+        grid->tile_start[grid->num_tiles] = slot;
+        if(slot > grid->order_capacity){
+            size_t *order = (size_t *)realloc(grid->order, sizeof(size_t)*slot);
+            if(order == NULL){
+                printf("point_grid_add() ==>> malloc() failed\n");
+                return false;
+            }
+            grid->order = order;
+            grid->order_capacity = slot;
+        }
+        run_phase(grid, scatter_thread);
     }
-    
-    if(weight_map != NULL) free(weight_map);
-    if(srm1 != NULL) free(srm1);
-    if(ele1 != NULL) free(ele1);
-    if(nearest != NULL) free(nearest);
+
+    run_phase(grid, grid_thread);
+    grid->pts = NULL;
+    grid->bv = NULL;
+    grid->num_pts = 0;
     return true;
 }
 
+void point_grid_finish(PointGrid *grid)
+{
+    run_phase(grid, finish_thread);
+}
+
+size_t point_grid_bytes(const LMK *lmk, size_t chunk_size)
+{
+    size_t num_pixels = (size_t)lmk->num_cols*lmk->num_rows;
+    if(chunk_size == 0) chunk_size = POINT_CHUNK_SIZE;
+    // Landmark arrays, then weight_map, srm1, ele1 and nearest
+    size_t bytes = num_pixels*(sizeof(uint8_t) + sizeof(float));
+    bytes += 4*num_pixels*sizeof(float);
+    return bytes + chunk_size*(3*sizeof(double) + sizeof(uint8_t));
+}
+
+void point_grid_free(PointGrid *grid)
+{
+    pthread_mutex_destroy(&grid->mutex);
+    mem_free(grid->weight_map);
+    mem_free(grid->srm1);
+    mem_free(grid->ele1);
+    mem_free(grid->nearest);
+    free(grid->counts);
+    free(grid->tile_start);
+    free(grid->order);
+    memset(grid, 0, sizeof(PointGrid));
+}
+
+bool point2lmk( double *pts, uint8_t *bv, size_t num_pts, LMK *lmk, enum PointFrame frame, bool smooth)
+{
+    PointGrid grid;
+    if(!point_grid_init(&grid, lmk, frame, smooth)){
+        return false;
+    }
+    bool success = point_grid_add(&grid, pts, bv, num_pts);
+    if(success){
+        point_grid_finish(&grid);
+    }
+    point_grid_free(&grid);
+    return success;
+}
+
+/**
+ \brief Points of a PLY file buffered until a chunk is full
+ */
+typedef struct {
+    double *pts;
+    uint8_t *bv;
+    size_t count;                   //points in the buffer
+    size_t chunk_size;
+    PointChunkCallback callback;
+    void *user;
+    bool failed;                    //the callback returned false
+} PlyChunk;
+
+static bool alloc_ply_chunk(PlyChunk *chunk, size_t chunk_size, PointChunkCallback callback, void *user)
+{
+    memset(chunk, 0, sizeof(PlyChunk));
+    chunk->chunk_size = chunk_size > 0 ? chunk_size : POINT_CHUNK_SIZE;
+    chunk->callback = callback;
+    chunk->user = user;
+    chunk->pts = (double *)malloc(sizeof(double)*3*chunk->chunk_size);
+    chunk->bv = (uint8_t *)malloc(chunk->chunk_size);
+    if(chunk->pts == NULL || chunk->bv == NULL){
+        printf("readinply_chunks() ==>> malloc() failed\n");
+        free(chunk->pts);
+        free(chunk->bv);
+        return false;
+    }
+    return true;
+}
+
+/**
+ \brief Pass the buffered points to the callback
+ */
+static bool flush_ply_chunk(PlyChunk *chunk)
+{
+    if(chunk->count > 0 && !chunk->callback(chunk->user, chunk->pts, chunk->bv, chunk->count)){
+        chunk->failed = true;
+    }
+    chunk->count = 0;
+    return !chunk->failed;
+}
+
 static int vertex_cb(p_ply_argument argument) {
-    if(pts_array == NULL) return 0;
+    PlyChunk *chunk;
     long coord_offset;
-    ply_get_argument_user_data(argument, NULL, &coord_offset);
-    double value = ply_get_argument_value(argument);
-    pts_array[vertex_index*3+coord_offset] = value;
+    ply_get_argument_user_data(argument, (void **)&chunk, &coord_offset);
+    chunk->pts[chunk->count*3+coord_offset] = ply_get_argument_value(argument);
     return 1;
 }
 
 static int intensity_cb(p_ply_argument argument) {
-    if(bv_array == NULL) return 0;
-    ply_get_argument_user_data(argument, NULL, NULL);
+    PlyChunk *chunk;
+    ply_get_argument_user_data(argument, (void **)&chunk, NULL);
     double value = ply_get_argument_value(argument);
-    bv_array[vertex_index] = value;
-    vertex_index ++;
+    chunk->bv[chunk->count] = value;
+    chunk->count ++;
+    if(chunk->count == chunk->chunk_size && !flush_ply_chunk(chunk)) return 0;
     return 1;
 }
 
+#if defined(POINT_HAVE_MMAP) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/**
+ \brief Scalar types of the PLY format
+ */
+static const struct {
+    const char *name;
+    const char *alias;
+    int32_t size;
+    bool is_float;
+    bool is_signed;
+} ply_scalar_types[] = {
+    {"char", "int8", 1, false, true},
+    {"uchar", "uint8", 1, false, false},
+    {"short", "int16", 2, false, true},
+    {"ushort", "uint16", 2, false, false},
+    {"int", "int32", 4, false, true},
+    {"uint", "uint32", 4, false, false},
+    {"float", "float32", 4, true, true},
+    {"double", "float64", 8, true, true},
+};
 
-bool readinply(char * plyname, double **pts, uint8_t **bv, size_t *num_pts)
+/**
+ \brief Scalar property of the PLY vertex records
+ */
+typedef struct {
+    int32_t type;                   //index in ply_scalar_types
+    size_t offset;                  //bytes from the start of a record
+} PlyField;
+
+/**
+ \return index of a type in ply_scalar_types, -1 if unknown
+ */
+static int32_t ply_scalar_type(const char *name)
 {
-    if(bv_array != NULL) free(bv_array);
-    if(pts_array != NULL) free(pts_array);
-    vertex_index = 0;
-    
-    p_ply ply = ply_open(plyname, NULL, 0, NULL);
-    if (!ply) {
-        return false;
+    for(int32_t k = 0; k < (int32_t)(sizeof(ply_scalar_types)/sizeof(ply_scalar_types[0])); k++){
+        if(strcmp(name, ply_scalar_types[k].name) == 0 || strcmp(name, ply_scalar_types[k].alias) == 0) return k;
     }
-    
-    if (!ply_read_header(ply)) {
-        return false;
+    return -1;
+}
+
+/**
+ \brief Value of a field of a little-endian record as a double, as returned by rply
+ */
+static double ply_field_value(const uint8_t *record, PlyField field)
+{
+    const uint8_t *p = record + field.offset;
+    switch(field.type){
+        case 0: { int8_t v; memcpy(&v, p, 1); return v; }
+        case 1: { uint8_t v; memcpy(&v, p, 1); return v; }
+        case 2: { int16_t v; memcpy(&v, p, 2); return v; }
+        case 3: { uint16_t v; memcpy(&v, p, 2); return v; }
+        case 4: { int32_t v; memcpy(&v, p, 4); return v; }
+        case 5: { uint32_t v; memcpy(&v, p, 4); return v; }
+        case 6: { float v; memcpy(&v, p, 4); return v; }
+        default: { double v; memcpy(&v, p, 8); return v; }
     }
-    
-    size_t n = ply_set_read_cb(ply, "vertex", "x", vertex_cb, pts, 0);
-    ply_set_read_cb(ply, "vertex", "y", vertex_cb, pts, 1);
-    ply_set_read_cb(ply, "vertex", "z", vertex_cb, pts, 2);
-    ply_set_read_cb(ply, "vertex", "intensity", intensity_cb, bv, 0);
-    
-    pts_array = malloc(n * 3 * sizeof(double));
-    bv_array = malloc(n *sizeof(uint8_t));
-    if(pts_array == NULL || bv_array == NULL){
-        printf("Failure to allocate memory\n");
-        if(pts_array!=NULL) free(pts_array);
-        if(bv_array!=NULL) free(bv_array);
+}
+
+/**
+ \brief Stream the vertices of a mapped binary little-endian PLY file without rply
+ \return 1 on success, 0 on failure, and -1 if the file needs rply: it is not binary little-endian, or the vertex
+ element is not the first element or has list properties
+ */
+static int32_t readinply_mapped(const char *plyname, PlyChunk *chunk)
+{
+    int fd = open(plyname, O_RDONLY);
+    if(fd < 0) return -1;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size <= 0){
+        close(fd);
+        return -1;
+    }
+    size_t map_size = (size_t)st.st_size;
+    void *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping stays valid after the descriptor is closed
+    if(map == MAP_FAILED) return -1;
+
+    // Parse the header: one vertex element first, with scalar properties
+    const char *text = (const char *)map;
+    size_t pos = 0;
+    size_t num_vertices = 0;
+    size_t stride = 0;
+    int32_t element = 0;
+    PlyField fields[4];
+    bool found[4] = {false, false, false, false};
+    const char *names[4] = {"x", "y", "z", "intensity"};
+    int32_t status = -1;
+    bool header = true;
+    int32_t line_number = 0;
+    while(header){
+        char line[256];
+        size_t len = 0;
+        while(pos + len < map_size && text[pos + len] != '\n' && len < sizeof(line) - 1){
+            len++;
+        }
+        if(pos + len >= map_size || text[pos + len] != '\n') break;
+        memcpy(line, text + pos, len);
+        line[len] = '\0';
+        pos += len + 1;
+
+        char word[3][64];
+        int32_t num_words = sscanf(line, "%63s %63s %63s", word[0], word[1], word[2]);
+        if(line_number++ == 0){
+            if(strcmp(line, "ply") != 0) break;
+        }else if(num_words >= 1 && strcmp(word[0], "format") == 0){
+            if(num_words < 2 || strcmp(word[1], "binary_little_endian") != 0) break;
+        }else if(num_words >= 1 && (strcmp(word[0], "comment") == 0 || strcmp(word[0], "obj_info") == 0)){
+            continue;
+        }else if(num_words == 3 && strcmp(word[0], "element") == 0){
+            element++;
+            if(element == 1){
+                unsigned long long count;
+                if(strcmp(word[1], "vertex") != 0 || sscanf(word[2], "%llu", &count) != 1) break;
+                num_vertices = (size_t)count;
+            }
+        }else if(num_words >= 1 && strcmp(word[0], "property") == 0){
+            if(element != 1) continue;
+            int32_t type = num_words == 3 ? ply_scalar_type(word[1]) : -1;
+            if(type < 0) break;
+            for(int32_t k = 0; k < 4; k++){
+                if(!found[k] && strcmp(word[2], names[k]) == 0){
+                    fields[k].type = type;
+                    fields[k].offset = stride;
+                    found[k] = true;
+                }
+            }
+            stride += (size_t)ply_scalar_types[type].size;
+        }else if(num_words == 1 && strcmp(word[0], "end_header") == 0){
+            header = false;
+        }else{
+            break;
+        }
+    }
+
+    if(!header && element >= 1 && found[0] && found[1] && found[2] && found[3]){
+        if(stride == 0 || (map_size - pos)/stride < num_vertices){
+            SAFE_PRINTF(512, "readinply_chunks() ==>> %s is truncated\n", plyname);
+            status = 0;
+        }else{
+#ifdef MADV_SEQUENTIAL
+            madvise(map, map_size, MADV_SEQUENTIAL);
+#endif
+            const uint8_t *record = (const uint8_t *)map + pos;
+            status = 1;
+            for(size_t i = 0; i < num_vertices && status == 1; i++, record += stride){
+                double *p = &chunk->pts[chunk->count*3];
+                p[0] = ply_field_value(record, fields[0]);
+                p[1] = ply_field_value(record, fields[1]);
+                p[2] = ply_field_value(record, fields[2]);
+                chunk->bv[chunk->count] = ply_field_value(record, fields[3]);
+                chunk->count++;
+                if(chunk->count == chunk->chunk_size && !flush_ply_chunk(chunk)) status = 0;
+            }
+        }
+    }
+    munmap(map, map_size);
+    return status;
+}
+#endif
+
+bool readinply_chunks(const char *plyname, size_t chunk_size, PointChunkCallback callback, void *user)
+{
+    PlyChunk chunk;
+    if(!alloc_ply_chunk(&chunk, chunk_size, callback, user)){
         return false;
     }
-    
-    *pts = pts_array;
-    *bv = bv_array;
-    *num_pts = n;
-    
-    if (!ply_read(ply)) {
+
+    int32_t status = -1;
+#if defined(POINT_HAVE_MMAP) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    status = readinply_mapped(plyname, &chunk);
+#endif
+    if(status < 0){
+        status = 0;
+        p_ply ply = ply_open(plyname, NULL, 0, NULL);
+        if(ply != NULL){
+            if(ply_read_header(ply)){
+                ply_set_read_cb(ply, "vertex", "x", vertex_cb, &chunk, 0);
+                ply_set_read_cb(ply, "vertex", "y", vertex_cb, &chunk, 1);
+                ply_set_read_cb(ply, "vertex", "z", vertex_cb, &chunk, 2);
+                if(ply_set_read_cb(ply, "vertex", "intensity", intensity_cb, &chunk, 0) > 0){
+                    status = ply_read(ply) ? 1 : 0;
+                }else{
+                    SAFE_PRINTF(512, "readinply_chunks() ==>> %s has no vertex intensity\n", plyname);
+                }
+            }
+            ply_close(ply);
+        }
+    }
+
+    bool success = status == 1 && !chunk.failed && flush_ply_chunk(&chunk);
+    free(chunk.pts);
+    free(chunk.bv);
+    return success;
+}
+
+/**
+ \brief Points of a PLY file gathered into one array
+ */
+typedef struct {
+    double *pts;
+    uint8_t *bv;
+    size_t num_pts;
+    size_t capacity;
+} PointArray;
+
+static bool append_points(void *user, const double *pts, const uint8_t *bv, size_t num_pts)
+{
+    PointArray *array = (PointArray *)user;
+    if(array->num_pts + num_pts > array->capacity){
+        size_t capacity = array->capacity > 0 ? array->capacity : num_pts;
+        while(capacity < array->num_pts + num_pts) capacity *= 2;
+        double *grown_pts = (double *)realloc(array->pts, sizeof(double)*3*capacity);
+        if(grown_pts == NULL) return false;
+        array->pts = grown_pts;
+        uint8_t *grown_bv = (uint8_t *)realloc(array->bv, capacity);
+        if(grown_bv == NULL) return false;
+        array->bv = grown_bv;
+        array->capacity = capacity;
+    }
+    memcpy(&array->pts[array->num_pts*3], pts, sizeof(double)*3*num_pts);
+    memcpy(&array->bv[array->num_pts], bv, num_pts);
+    array->num_pts += num_pts;
+    return true;
+}
+
+bool readinply(char * plyname, double **pts, uint8_t **bv, size_t *num_pts)
+{
+    PointArray array = {0};
+    if(!readinply_chunks(plyname, POINT_CHUNK_SIZE, append_points, &array)){
+        free(array.pts);
+        free(array.bv);
         return false;
     }
-    ply_close(ply);
+    *pts = array.pts;
+    *bv = array.bv;
+    *num_pts = array.num_pts;
     return true;
 }
 
 
-bool readinpoints_ascii(char * plyname, double **pts, uint8_t **bv, size_t *num_pts)
+#define POINT_ASCII_BLOCK_SIZE (16 << 20)  //bytes of text parsed by one thread at a time
+
+/**
+ \brief Exact powers of ten of the fast path of `parse_point_double`
+ */
+static const double point_pow10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool is_point_space(char c)
 {
-    FILE *fp = fopen(plyname, "r");
-    if(fp == NULL)
-    {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/**
+ \brief Parse a double like the `%lf` of sscanf
+
+ Numbers with at most 15 significant digits and a decimal exponent of at most 22 are one exactly rounded
+ multiplication or division of two exact doubles, so they give the same value as strtod. Other numbers, and forms like
+ `nan` or hexadecimal, go to strtod.
+ \param[in,out] cursor first character, then the end of the number
+ \param[in] end end of the line
+ \return false if there is no number
+ */
+static bool parse_point_double(const char **cursor, const char *end, double *value)
+{
+    const char *p = *cursor;
+    while(p < end && is_point_space(*p)) p++;
+    const char *start = p;
+
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')){
+        negative = *p == '-';
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int32_t digits = 0;         //significant digits in mantissa
+    int32_t exponent = 0;
+    bool any_digit = false;
+    for(; p < end && *p >= '0' && *p <= '9'; p++){
+        any_digit = true;
+        if(digits < 19){
+            mantissa = mantissa*10 + (uint64_t)(*p - '0');
+            if(mantissa > 0) digits++;
+        }else{
+            digits++;
+            exponent++;
+        }
+    }
+    if(p < end && *p == '.'){
+        for(p++; p < end && *p >= '0' && *p <= '9'; p++){
+            any_digit = true;
+            if(digits < 19){
+                mantissa = mantissa*10 + (uint64_t)(*p - '0');
+                if(mantissa > 0) digits++;
+                exponent--;
+            }else{
+                digits++;
+            }
+        }
+    }
+    bool fast = any_digit && digits <= 15;
+    if(fast && p < end && (*p == 'e' || *p == 'E')){
+        const char *q = p + 1;
+        bool negative_exponent = false;
+        if(q < end && (*q == '-' || *q == '+')){
+            negative_exponent = *q == '-';
+            q++;
+        }
+        int32_t e = 0;
+        const char *first = q;
+        for(; q < end && *q >= '0' && *q <= '9'; q++){
+            if(e < 10000) e = e*10 + (*q - '0');
+        }
+        if(q == first){
+            fast = false;
+        }else{
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+    if(fast && (p == end || is_point_space(*p)) && exponent >= -22 && exponent <= 22){
+        double v = (double)mantissa;
+        v = exponent < 0 ? v/point_pow10[-exponent] : v*point_pow10[exponent];
+        *value = negative ? -v : v;
+        *cursor = p;
+        return true;
+    }
+
+    // strtod needs a terminated string, and the text of a mapped file is not
+    char token[64];
+    size_t len = 0;
+    while(start + len < end && !is_point_space(start[len]) && len < sizeof(token) - 1){
+        token[len] = start[len];
+        len++;
+    }
+    token[len] = '\0';
+    char *token_end;
+    *value = strtod(token, &token_end);
+    if(token_end == token) return false;
+    *cursor = start + (token_end - token);
+    return true;
+}
+
+/**
+ \brief Parse an integer like the `%ld` of sscanf
+ */
+static bool parse_point_long(const char **cursor, const char *end, long *value)
+{
+    const char *p = *cursor;
+    while(p < end && is_point_space(*p)) p++;
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')){
+        negative = *p == '-';
+        p++;
+    }
+    const char *first = p;
+    unsigned long v = 0;
+    for(; p < end && *p >= '0' && *p <= '9'; p++){
+        v = v*10 + (unsigned long)(*p - '0');
+    }
+    if(p == first) return false;
+    *value = negative ? -(long)v : (long)v;
+    *cursor = p;
+    return true;
+}
+
+/**
+ \brief Text of whole lines parsed by one thread, and its points
+ */
+typedef struct {
+    const char *text;
+    size_t size;
+    double *pts;
+    uint8_t *bv;
+    size_t num_pts;
+    size_t capacity;
+    bool failed;                    //malloc failed
+} AsciiBlock;
+
+static void *parse_block_thread(void *arg)
+{
+    AsciiBlock *block = (AsciiBlock *)arg;
+    block->num_pts = 0;
+    const char *p = block->text;
+    const char *text_end = block->text + block->size;
+    while(p < text_end){
+        const char *line_end = memchr(p, '\n', (size_t)(text_end - p));
+        if(line_end == NULL) line_end = text_end;
+
+        if(block->num_pts == block->capacity){
+            size_t capacity = block->capacity > 0 ? block->capacity*2 : 1024;
+            double *grown_pts = (double *)realloc(block->pts, sizeof(double)*3*capacity);
+            if(grown_pts != NULL) block->pts = grown_pts;
+            uint8_t *grown_bv = grown_pts != NULL ? (uint8_t *)realloc(block->bv, capacity) : NULL;
+            if(grown_bv == NULL){
+                block->failed = true;
+                return NULL;
+            }
+            block->bv = grown_bv;
+            block->capacity = capacity;
+        }
+
+        const char *cursor = p;
+        double *point = &block->pts[block->num_pts*3];
+        long intensity;
+        if(parse_point_double(&cursor, line_end, &point[0]) && parse_point_double(&cursor, line_end, &point[1]) &&
+           parse_point_double(&cursor, line_end, &point[2]) && parse_point_long(&cursor, line_end, &intensity)){
+            block->bv[block->num_pts] = (uint8_t)intensity;
+            block->num_pts++;
+        }else{
+            int32_t len = line_end - p < 256 ? (int32_t)(line_end - p) : 256;
+            SAFE_PRINTF(512, "Failure to scan point values from line %.*s\n", len, p);
+            printf("Ignoring line and continuing\n");
+        }
+        p = line_end + 1;
+    }
+    return NULL;
+}
+
+/**
+ \brief Text file read by windows of whole lines
+ */
+typedef struct {
+    FILE *fp;                       //NULL if the file is mapped
+    const char *map;
+    size_t map_size;
+    size_t pos;                     //start of the next window in the mapping
+    char *buffer;                   //window read from fp
+    size_t buffer_size;
+    size_t buffer_used;             //bytes of the buffer read from fp
+    size_t window_size;             //bytes of the buffer in the last window
+    bool failed;                    //malloc failed
+} AsciiSource;
+
+static bool open_ascii_source(AsciiSource *source, const char *filename, size_t window)
+{
+    memset(source, 0, sizeof(AsciiSource));
+#ifdef POINT_HAVE_MMAP
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size > 0){
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED){
+            close(fd); // The mapping stays valid after the descriptor is closed
+#ifdef MADV_SEQUENTIAL
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+            source->map = (const char *)map;
+            source->map_size = (size_t)st.st_size;
+            return true;
+        }
+    }
+    close(fd);
+#endif
+    source->fp = fopen(filename, "rb");
+    if(source->fp == NULL) return false;
+    source->buffer_size = window;
+    source->buffer = (char *)malloc(window);
+    if(source->buffer == NULL){
+        printf("readinpoints_ascii_chunks() ==>> malloc() failed\n");
+        fclose(source->fp);
         return false;
     }
-    
-    //Count the number of lines so that we know how much memory to allocate
-    int buf_size = 128;
-    char buf[buf_size];
-    memset(&buf, 0, buf_size);
-    
-    int32_t line_count;
-    while (fgets(buf, buf_size, fp) != NULL) {
-        line_count++;
+    return true;
+}
+
+static void close_ascii_source(AsciiSource *source)
+{
+#ifdef POINT_HAVE_MMAP
+    if(source->map != NULL) munmap((void *)source->map, source->map_size);
+#endif
+    if(source->fp != NULL) fclose(source->fp);
+    free(source->buffer);
+}
+
+/**
+ \brief Next window of about `window` bytes ending at a line end
+ \return false at the end of the file, or if malloc fails with `failed` set
+ */
+static bool next_ascii_window(AsciiSource *source, size_t window, const char **text, size_t *size)
+{
+    if(source->fp == NULL){
+        if(source->pos >= source->map_size) return false;
+        size_t end = source->map_size - source->pos > window ? source->pos + window : source->map_size;
+        if(end < source->map_size){
+            const char *line_end = memchr(source->map + end, '\n', source->map_size - end);
+            end = line_end != NULL ? (size_t)(line_end - source->map) + 1 : source->map_size;
+        }
+        *text = source->map + source->pos;
+        *size = end - source->pos;
+        source->pos = end;
+        return true;
     }
-    
-    double *pts_array = malloc(line_count * 3 * sizeof(double));
-    uint8_t *bv_array = malloc(line_count *sizeof(uint8_t));
-    if(pts_array == NULL || bv_array == NULL){
-        printf("Failure to allocate memory\n");
-        if(pts_array!=NULL) free(pts_array);
-        if(bv_array!=NULL) free(bv_array);
+
+    // Keep the partial line after the last window
+    memmove(source->buffer, source->buffer + source->window_size, source->buffer_used - source->window_size);
+    source->buffer_used -= source->window_size;
+    source->window_size = 0;
+    while(true){
+        source->buffer_used += fread(source->buffer + source->buffer_used, 1, source->buffer_size - source->buffer_used,
+                                     source->fp);
+        if(source->buffer_used < source->buffer_size){
+            // End of the file
+            source->window_size = source->buffer_used;
+            break;
+        }
+        const char *line_end = NULL;
+        for(size_t i = source->buffer_used; i > 0 && line_end == NULL; i--){
+            if(source->buffer[i - 1] == '\n') line_end = &source->buffer[i - 1];
+        }
+        if(line_end != NULL){
+            source->window_size = (size_t)(line_end - source->buffer) + 1;
+            break;
+        }
+        // A line longer than the buffer
+        char *grown = (char *)realloc(source->buffer, source->buffer_size*2);
+        if(grown == NULL){
+            printf("readinpoints_ascii_chunks() ==>> malloc() failed\n");
+            source->failed = true;
+            return false;
+        }
+        source->buffer = grown;
+        source->buffer_size *= 2;
+    }
+    *text = source->buffer;
+    *size = source->window_size;
+    return source->window_size > 0;
+}
+
+bool readinpoints_ascii_chunks(const char *filename, PointChunkCallback callback, void *user)
+{
+    int32_t num_threads = point_grid_num_threads();
+    size_t window = (size_t)num_threads*POINT_ASCII_BLOCK_SIZE;
+    AsciiSource source;
+    if(!open_ascii_source(&source, filename, window)){
         return false;
     }
-    
-    *pts = pts_array;
-    *bv = bv_array;
-    
-    rewind(fp);
-    
-    // Read each line
-    *num_pts = 0;
-    for(int32_t i = 0; i< line_count; i++){
-        if(fgets(buf, buf_size, fp)){
-            // Note that bv_array is type uint8_t but the value should be formated as int64_t.
-            if(sscanf(buf, "%lf %lf %lf %ld", &pts_array[*num_pts*3], &pts_array[*num_pts*3+1], &pts_array[*num_pts*3+2] , &bv_array[*num_pts]) == 4){
-                 *num_pts += 1;
-            }else{
-                SAFE_PRINTF(512, "Failure to scan point values from line %s\n", buf);
-                printf("Ignoring line and continuing\n");
+
+    AsciiBlock blocks[POINT_GRID_MAX_THREADS];
+    memset(blocks, 0, sizeof(blocks));
+    bool success = true;
+    const char *text;
+    size_t size;
+    while(success && next_ascii_window(&source, window, &text, &size)){
+        // Split the window at line ends, and parse the blocks in parallel
+        size_t start = 0;
+        for(int32_t t = 0; t < num_threads; t++){
+            size_t end = t == num_threads - 1 ? size : size*(t + 1)/num_threads;
+            if(end < start) end = start;
+            if(end > start && end < size){
+                const char *line_end = memchr(text + end - 1, '\n', size - (end - 1));
+                end = line_end != NULL ? (size_t)(line_end - text) + 1 : size;
+            }
+            blocks[t].text = text + start;
+            blocks[t].size = end - start;
+            start = end;
+        }
+        run_blocks(blocks, sizeof(AsciiBlock), num_threads, parse_block_thread);
+
+        // The blocks follow the file, so the points reach the callback in file order
+        for(int32_t t = 0; t < num_threads && success; t++){
+            if(blocks[t].failed){
+                printf("readinpoints_ascii_chunks() ==>> malloc() failed\n");
+                success = false;
+            }else if(blocks[t].num_pts > 0){
+                success = callback(user, blocks[t].pts, blocks[t].bv, blocks[t].num_pts);
             }
         }
     }
 
-    fclose(fp);
-    
+    for(int32_t t = 0; t < num_threads; t++){
+        free(blocks[t].pts);
+        free(blocks[t].bv);
+    }
+    success = success && !source.failed;
+    close_ascii_source(&source);
+    return success;
+}
+
+bool readinpoints_ascii(char * plyname, double **pts, uint8_t **bv, size_t *num_pts)
+{
+    PointArray array = {0};
+    if(!readinpoints_ascii_chunks(plyname, append_points, &array)){
+        free(array.pts);
+        free(array.bv);
+        return false;
+    }
+    *pts = array.pts;
+    *bv = array.bv;
+    *num_pts = array.num_pts;
     return true;
 }
 
@@ -273,7 +1120,7 @@ enum e_ply_storage_mode_ strToPlyFileType(char *str){
         }else if(strncmp(str, "PLY_BIG_ENDIAN", strlen(str))==0){
             filetype = PLY_BIG_ENDIAN;
         }else if(strncmp(str, "PLY_LITTLE_ENDIAN", strlen(str))==0){
-            filetype = PLY_BIG_ENDIAN;
+            filetype = PLY_LITTLE_ENDIAN;
         }else{
             printf("Value of str must be \"PLY_BIG_ENDIAN\" or \"PLY_LITTLE_ENDIAN\" or \"PLY_ASCII\"\n");
             filetype = PLY_DEFAULT;
@@ -317,26 +1164,44 @@ enum PointStructure strToStructure(char *str){
     return structure;
 }
 
-bool writePoints(LMK *lmk,  p_ply oply, enum PointFrame frame){
-    for(int32_t i = 0; i <lmk->num_rows; i++)
+/**
+ \brief Coordinates of landmark pixel (j, i) in the frame of a point file
+
+ \param[in] world world layer of the landmark, or NULL if it was not computed
+ */
+static void pixel_point(const LMK *lmk, const double *world, int32_t j, int32_t i, double ele, enum PointFrame frame,
+                        double dp[3])
+{
+    if(frame == WORLD && world != NULL){
+        memcpy(dp, &world[((size_t)i*lmk->num_cols + j)*3], 3*sizeof(double));
+    }else if(frame == WORLD){
+        LMK_Col_Row_Elevation2World(lmk, (double)j, (double)i, ele, dp);
+    }else if(frame == LOCAL){
+        double draster[3] = {j, i, 1};
+        dp[0] = dot3_inline(lmk->col_row2mapxy[0], draster);
+        dp[1] = dot3_inline(lmk->col_row2mapxy[1], draster);
+        dp[2] = ele;
+    }else{
+        dp[0] = j;
+        dp[1] = i;
+        dp[2] = ele / lmk->resolution;
+    }
+}
+
+/**
+ \brief Write the vertices of the valid pixels of a window of the landmark with rply
+ */
+static bool writePoints(LMK *lmk,  p_ply oply, enum PointFrame frame, int32_t min_i, int32_t max_i, int32_t min_j,
+                        int32_t max_j){
+    const double *world = (const double *)LMK_Layer(lmk, LMK_LAYER_WORLD);
+    for(int32_t i = min_i; i < max_i; i++)
     {
-        for(int32_t j = 0; j < lmk->num_cols; j++)
+        for(int32_t j = min_j; j < max_j; j++)
         {
-            double ele = Interpolate_LMK_ELE(lmk, j,  i);
+            double ele = lmk->ele[i *lmk->num_cols + j];
             if(!isnan(ele)){
                 double dp[3];
-                if(frame == WORLD){
-                    LMK_Col_Row2World( lmk,  (double)j , (double)i , dp);
-                }else if(frame == LOCAL){
-                    double draster[3] = {j, i, 1};
-                    dp[0] = dot3(lmk->col_row2mapxy[0], draster);
-                    dp[1] = dot3(lmk->col_row2mapxy[1], draster);
-                    dp[2] = ele;
-                }else{
-                    dp[0] = j;
-                    dp[1] = i;
-                    dp[2] = ele / lmk->resolution;
-                }
+                pixel_point(lmk, world, j, i, ele, frame, dp);
 
                 uint8_t uc = lmk->srm[i *lmk->num_cols + j ];
                 if (!ply_write(oply, dp[0])) return false;
@@ -350,6 +1215,277 @@ bool writePoints(LMK *lmk,  p_ply oply, enum PointFrame frame){
     return true;
 }
 
+#define PLY_EXPORT_BLOCK_ROWS 64     //landmark rows encoded by one thread at a time
+#define PLY_VERTEX_BYTES 25          //x, y, z doubles and the uint8 intensity
+#define PLY_FACE_BYTES 16            //int32 count and three int32 indices
+
+/**
+ \brief Window of a landmark exported to a binary little-endian PLY file
+ */
+typedef struct {
+    const LMK *lmk;
+    const double *world;        //world layer of the landmark, or NULL
+    enum PointFrame frame;
+    int32_t min_i, max_i, min_j, max_j;
+    int64_t *row_vertices;      //max_i - min_i + 1 index of the first vertex of each row of the window
+    int64_t *row_faces;         //max_i - min_i faces of each row
+    bool faces;                 //encode faces rather than vertices
+} PlyExport;
+
+/**
+ \brief Rows of a PlyExport encoded by one thread
+ */
+typedef struct {
+    const PlyExport *job;
+    int32_t first_row, last_row;
+    uint8_t *bytes;
+    size_t size;
+} PlyBlock;
+
+static bool ply_pixel_valid(const LMK *lmk, int32_t i, int32_t j)
+{
+    return !isnan(lmk->ele[(size_t)i*lmk->num_cols + j]);
+}
+
+static void *count_ply_rows_thread(void *arg)
+{
+    PlyBlock *block = (PlyBlock *)arg;
+    const PlyExport *e = block->job;
+    for(int32_t i = block->first_row; i < block->last_row; i++){
+        int64_t vertices = 0;
+        int64_t faces = 0;
+        for(int32_t j = e->min_j; j < e->max_j; j++){
+            bool ul_valid = ply_pixel_valid(e->lmk, i, j);
+            vertices += ul_valid;
+            if(e->row_faces != NULL && i < e->max_i-1 && j < e->max_j-1){
+                bool ur_valid = ply_pixel_valid(e->lmk, i, j+1);
+                bool lr_valid = ply_pixel_valid(e->lmk, i+1, j+1);
+                bool ll_valid = ply_pixel_valid(e->lmk, i+1, j);
+                faces += ul_valid && ur_valid && lr_valid;
+                faces += ul_valid && lr_valid && ll_valid;
+            }
+        }
+        e->row_vertices[i - e->min_i + 1] = vertices;
+        if(e->row_faces != NULL) e->row_faces[i - e->min_i] = faces;
+    }
+    return NULL;
+}
+
+static uint8_t *put_ply_int32(uint8_t *out, int32_t value)
+{
+    memcpy(out, &value, sizeof(int32_t));
+    return out + sizeof(int32_t);
+}
+
+static void *encode_ply_rows_thread(void *arg)
+{
+    PlyBlock *block = (PlyBlock *)arg;
+    const PlyExport *e = block->job;
+    const LMK *lmk = e->lmk;
+    uint8_t *out = block->bytes;
+    for(int32_t i = block->first_row; i < block->last_row; i++){
+        if(!e->faces){
+            for(int32_t j = e->min_j; j < e->max_j; j++){
+                double ele = lmk->ele[(size_t)i*lmk->num_cols + j];
+                if(isnan(ele)) continue;
+                double dp[3];
+                pixel_point(lmk, e->world, j, i, ele, e->frame, dp);
+                memcpy(out, dp, 3*sizeof(double));
+                out[24] = lmk->srm[(size_t)i*lmk->num_cols + j];
+                out += PLY_VERTEX_BYTES;
+            }
+        }else if(i < e->max_i-1){
+            // Vertex indices follow the valid pixels of rows i and i + 1
+            int32_t ul_index = (int32_t)e->row_vertices[i - e->min_i];
+            int32_t ll_index = (int32_t)e->row_vertices[i - e->min_i + 1];
+            for(int32_t j = e->min_j; j < e->max_j-1; j++){
+                bool ul_valid = ply_pixel_valid(lmk, i, j);
+                bool ur_valid = ply_pixel_valid(lmk, i, j+1);
+                bool lr_valid = ply_pixel_valid(lmk, i+1, j+1);
+                bool ll_valid = ply_pixel_valid(lmk, i+1, j);
+                int32_t ur_index = ul_index + ul_valid;
+                int32_t lr_index = ll_index + ll_valid;
+                if(ul_valid && ur_valid && lr_valid){
+                    out = put_ply_int32(out, 3);
+                    out = put_ply_int32(out, ul_index);
+                    out = put_ply_int32(out, ur_index);
+                    out = put_ply_int32(out, lr_index);
+                }
+                if(ul_valid && lr_valid && ll_valid){
+                    out = put_ply_int32(out, 3);
+                    out = put_ply_int32(out, ul_index);
+                    out = put_ply_int32(out, lr_index);
+                    out = put_ply_int32(out, ll_index);
+                }
+                ul_index = ur_index;
+                ll_index = lr_index;
+            }
+        }
+    }
+    block->size = (size_t)(out - block->bytes);
+    return NULL;
+}
+
+/**
+ \brief Run one function per block on all threads
+ */
+static void run_ply_blocks(PlyBlock *blocks, int32_t num_blocks, void *(*work)(void *))
+{
+    run_blocks(blocks, sizeof(PlyBlock), num_blocks, work);
+}
+
+/**
+ \brief Blocks encoded in the last round, written by the writer thread while the next round is encoded
+ */
+typedef struct {
+    FILE *fp;
+    PlyBlock *blocks;
+    int32_t num_blocks;
+    bool success;
+} PlyWrite;
+
+static void *write_ply_blocks_thread(void *arg)
+{
+    PlyWrite *pending = (PlyWrite *)arg;
+    for(int32_t t = 0; t < pending->num_blocks && pending->success; t++){
+        pending->success = fwrite(pending->blocks[t].bytes, 1, pending->blocks[t].size, pending->fp) == pending->blocks[t].size;
+    }
+    return NULL;
+}
+
+/**
+ \brief Encode the rows of the window in rounds of one block per thread, and write each round on a writer thread
+ while the next one is encoded
+ */
+static bool write_ply_rows(FILE *fp, const PlyExport *e, int32_t num_threads, size_t row_bytes)
+{
+    PlyBlock blocks[2][POINT_GRID_MAX_THREADS];
+    memset(blocks, 0, sizeof(blocks));
+    bool success = true;
+    for(int32_t s = 0; s < 2 && success; s++){
+        for(int32_t t = 0; t < num_threads && success; t++){
+            blocks[s][t].job = e;
+            blocks[s][t].bytes = (uint8_t *)malloc(row_bytes*PLY_EXPORT_BLOCK_ROWS + 1);
+            success = blocks[s][t].bytes != NULL;
+        }
+    }
+    if(!success) printf("write_ply_rows() ==>> malloc() failed\n");
+
+    PlyWrite pending = {fp, NULL, 0, true};
+    pthread_t writer;
+    bool writing = false;
+    int32_t rows_per_round = num_threads*PLY_EXPORT_BLOCK_ROWS;
+    for(int32_t row = e->min_i, s = 0; row < e->max_i && success; row += rows_per_round, s = 1 - s){
+        int32_t num_blocks = 0;
+        for(int32_t first = row; first < e->max_i && first < row + rows_per_round; first += PLY_EXPORT_BLOCK_ROWS){
+            blocks[s][num_blocks].first_row = first;
+            blocks[s][num_blocks].last_row = first + PLY_EXPORT_BLOCK_ROWS < e->max_i ? first + PLY_EXPORT_BLOCK_ROWS : e->max_i;
+            num_blocks++;
+        }
+        run_ply_blocks(blocks[s], num_blocks, encode_ply_rows_thread);
+
+        if(writing) pthread_join(writer, NULL);
+        success = pending.success;
+        pending.blocks = blocks[s];
+        pending.num_blocks = num_blocks;
+        writing = success && pthread_create(&writer, NULL, write_ply_blocks_thread, &pending) == 0;
+        if(success && !writing) write_ply_blocks_thread(&pending);
+    }
+    if(writing) pthread_join(writer, NULL);
+    success = success && pending.success;
+
+    for(int32_t s = 0; s < 2; s++){
+        for(int32_t t = 0; t < num_threads; t++){
+            free(blocks[s][t].bytes);
+        }
+    }
+    return success;
+}
+
+/**
+ \brief Export a window of a landmark to a binary little-endian PLY file without rply
+
+ The file is byte for byte the one written by rply.
+ \param[in] faces write the triangles of the valid pixels after the vertices
+ */
+static bool write_lmk_ply_binary(const char *filename, const LMK *lmk, enum PointFrame frame, int32_t min_i,
+                                 int32_t max_i, int32_t min_j, int32_t max_j, bool faces)
+{
+    int32_t num_threads = point_grid_num_threads();
+    int32_t rows = max_i - min_i;
+    PlyExport e = {lmk, (const double *)LMK_Layer(lmk, LMK_LAYER_WORLD), frame, min_i, max_i, min_j, max_j, NULL,
+                   NULL, false};
+    e.row_vertices = (int64_t *)malloc(sizeof(int64_t)*(rows + 1));
+    e.row_faces = faces ? (int64_t *)malloc(sizeof(int64_t)*rows) : NULL;
+    if(e.row_vertices == NULL || (faces && e.row_faces == NULL)){
+        printf("write_lmk_ply_binary() ==>> malloc() failed\n");
+        free(e.row_vertices);
+        free(e.row_faces);
+        return false;
+    }
+
+    // Count the vertices and faces of each row, and number the vertices
+    PlyBlock blocks[POINT_GRID_MAX_THREADS];
+    memset(blocks, 0, sizeof(blocks));
+    int32_t num_blocks = rows < num_threads ? rows : num_threads;
+    for(int32_t t = 0; t < num_blocks; t++){
+        blocks[t].job = &e;
+        blocks[t].first_row = min_i + (int32_t)((int64_t)rows*t/num_blocks);
+        blocks[t].last_row = min_i + (int32_t)((int64_t)rows*(t + 1)/num_blocks);
+    }
+    if(num_blocks > 0) run_ply_blocks(blocks, num_blocks, count_ply_rows_thread);
+    int64_t num_faces = 0;
+    e.row_vertices[0] = 0;
+    for(int32_t r = 0; r < rows; r++){
+        e.row_vertices[r + 1] += e.row_vertices[r];
+        if(faces) num_faces += e.row_faces[r];
+    }
+    int64_t num_vertices = e.row_vertices[rows];
+
+    FILE *fp = fopen(filename, "wb");
+    if(fp == NULL){
+        SAFE_PRINTF(512, "write_lmk_ply_binary() ==>> cannot open %s to write\n", filename);
+        free(e.row_vertices);
+        free(e.row_faces);
+        return false;
+    }
+    // Every block of writes is large, so stdio buffering would only copy the bytes once more
+    setvbuf(fp, NULL, _IONBF, 0);
+    char header[512];
+    int32_t len = snprintf(header, sizeof(header),
+                           "ply\nformat binary_little_endian 1.0\nelement vertex %lld\n"
+                           "property double x\nproperty double y\nproperty double z\nproperty uint8 intensity\n",
+                           (long long)num_vertices);
+    if(faces){
+        len += snprintf(header + len, sizeof(header) - len,
+                        "element face %lld\nproperty list int32 int32 vertex_indices\n", (long long)num_faces);
+    }
+    len += snprintf(header + len, sizeof(header) - len, "end_header\n");
+    bool success = fwrite(header, 1, len, fp) == (size_t)len;
+
+    int32_t width = max_j - min_j;
+    success = success && write_ply_rows(fp, &e, num_threads, (size_t)width*PLY_VERTEX_BYTES);
+    if(faces){
+        e.faces = true;
+        success = success && write_ply_rows(fp, &e, num_threads, (size_t)(width > 0 ? width - 1 : 0)*2*PLY_FACE_BYTES);
+    }
+    success = (fclose(fp) == 0) && success;
+    free(e.row_vertices);
+    free(e.row_faces);
+    return success;
+}
+
+/**
+ \brief Whether a PLY storage mode is written as binary little-endian on this processor
+ */
+static bool ply_binary_little_endian(enum e_ply_storage_mode_ filetype)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return filetype == PLY_LITTLE_ENDIAN || filetype == PLY_DEFAULT;
+#else
+    return false;
+#endif
+}
 
 bool Write_LMK_PLY_Facet_Window(const char *filename, LMK *lmk, int32_t x0, int32_t y0, int32_t c, int32_t r,
                                 enum e_ply_storage_mode_ filetype, enum PointFrame frame)
@@ -373,6 +1509,10 @@ bool Write_LMK_PLY_Facet_Window(const char *filename, LMK *lmk, int32_t x0, int3
     if(max_i <= min_i) return false;
     if(max_j <= min_j) return false;
     
+    if(ply_binary_little_endian(filetype)){
+        return write_lmk_ply_binary(filename, lmk, frame, min_i, max_i, min_j, max_j, true);
+    }
+    
     p_ply oply = ply_create(filename, filetype, NULL, 0, NULL);
     if (!oply) return false;
     
@@ -380,12 +1520,14 @@ bool Write_LMK_PLY_Facet_Window(const char *filename, LMK *lmk, int32_t x0, int3
     
     //Find number of points with data values
     //Map index of each vertex in the file to index in lmk elevation array
-    int32_t* vertex_indices = (int32_t*)malloc(sizeof(int32_t)*c*r);
+    int32_t window_cols = max_j - min_j;
+    size_t window_size = (size_t)window_cols*(max_i - min_i);
+    int32_t* vertex_indices = (int32_t*)malloc(sizeof(int32_t)*window_size);
     if(vertex_indices == NULL){
         printf("Failure to allocate memory for vertex_indices array\n");
         return false;
     }
-    memset(vertex_indices, -1, sizeof(int32_t)*c*r);
+    memset(vertex_indices, -1, sizeof(int32_t)*window_size);
     
     int32_t numpts = 0;
     int32_t num_faces = 0;
@@ -395,7 +1537,7 @@ bool Write_LMK_PLY_Facet_Window(const char *filename, LMK *lmk, int32_t x0, int3
         {
             bool ul_valid = !isnan( lmk->ele[i *lmk->num_cols + j] );
             if(ul_valid){
-                vertex_indices[i *lmk->num_cols + j] = numpts;
+                vertex_indices[(i - min_i)*window_cols + (j - min_j)] = numpts;
                 numpts ++;
             }
              
@@ -425,7 +1567,7 @@ bool Write_LMK_PLY_Facet_Window(const char *filename, LMK *lmk, int32_t x0, int3
     if (!ply_write_header(oply)) return false;
     
     // Write point values
-    if(!writePoints(lmk, oply, frame)){
+    if(!writePoints(lmk, oply, frame, min_i, max_i, min_j, max_j)){
         return false;
     }
     
@@ -441,10 +1583,10 @@ bool Write_LMK_PLY_Facet_Window(const char *filename, LMK *lmk, int32_t x0, int3
             
             double dp[3];
             
-            int32_t ul_index = vertex_indices[i*lmk->num_cols + j];
-            int32_t ur_index = vertex_indices[i*lmk->num_cols + (j+1)];
-            int32_t ll_index = vertex_indices[(i+1)*lmk->num_cols + j];
-            int32_t lr_index = vertex_indices[(i+1)*lmk->num_cols + (j+1)];
+            int32_t ul_index = vertex_indices[(i - min_i)*window_cols + (j - min_j)];
+            int32_t ur_index = vertex_indices[(i - min_i)*window_cols + (j+1 - min_j)];
+            int32_t ll_index = vertex_indices[(i+1 - min_i)*window_cols + (j - min_j)];
+            int32_t lr_index = vertex_indices[(i+1 - min_i)*window_cols + (j+1 - min_j)];
             
 //            if(ul_index == 0 || ur_index == 0 || ll_index == 0 || lr_index == 0){
 //                printf("Debug");
@@ -471,6 +1613,7 @@ bool Write_LMK_PLY_Facet_Window(const char *filename, LMK *lmk, int32_t x0, int3
             }
         }
     }
+    free(vertex_indices);
     
     if (!ply_close(oply)) return false;
     
@@ -486,6 +1629,10 @@ bool Write_LMK_PLY_Facet(const char *filename, LMK *lmk, enum e_ply_storage_mode
 
 bool Write_LMK_PLY_Points(const char *filename, LMK *lmk, enum e_ply_storage_mode_ filetype, enum PointFrame frame)
 {
+    if(ply_binary_little_endian(filetype)){
+        return write_lmk_ply_binary(filename, lmk, frame, 0, lmk->num_rows, 0, lmk->num_cols, false);
+    }
+    
     p_ply oply = ply_create(filename, filetype, NULL, 0, NULL);
     if (!oply) return false;
     
@@ -512,7 +1659,7 @@ bool Write_LMK_PLY_Points(const char *filename, LMK *lmk, enum e_ply_storage_mod
     if (!ply_write_header(oply)) return false;
     
     // Write point values
-    if(!writePoints(lmk, oply, frame)){
+    if(!writePoints(lmk, oply, frame, 0, lmk->num_rows, 0, lmk->num_cols)){
         return false;
     }
     
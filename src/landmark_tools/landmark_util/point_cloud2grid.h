@@ -27,6 +27,7 @@
 #define _LANDMARK_TOOLS_POINT_CLOUD2GRID_H_
 
 #include <stdbool.h>                                // for bool
+#include <pthread.h>                                // for pthread_mutex_t
 #include <stddef.h>                                 // for size_t
 #include <stddef.h>                                 // for size_t
 #include <stdint.h>                                 // for int32_t, uint8_t
@@ -44,8 +45,52 @@ enum PointFileType{POINT, PLY, UNDEFINED};
 enum PointStructure{POINTCLOUD, MESH};
 enum PointFrame{WORLD, LOCAL, RASTER};
 
+#define POINT_CHUNK_SIZE 262144      //points passed at a time by readinply_chunks by default
+
+/**
+ \brief Landmark gridded from points added in chunks, shared by the threads that grid it
+ 
+ The landmark is split in tiles. A point is binned into every tile that its kernel reaches, so that a tile holds all
+ the points that contribute to its pixels and no pixel is written by two threads.
+ */
+typedef struct {
+    LMK *lmk;
+    enum PointFrame frame;
+    bool smooth;
+    int32_t num_threads;
+    int32_t tile_size;          //landmark pixels on a side of a tile
+    int32_t tiles_x;            //tiles across the landmark
+    int32_t num_tiles;
+    const double *pts;          //chunk being gridded
+    const uint8_t *bv;
+    size_t num_pts;
+    size_t *counts;             //num_threads x num_tiles entries binned by each thread, then the next slot of each
+    size_t *tile_start;         //num_tiles + 1 first slots of the tiles in order
+    size_t *order;              //point indices binned by tile, or NULL for one tile holding every point
+    size_t order_capacity;
+    float *ele1;                //weighted sums of the elevation
+    float *srm1;                //weighted sums of the intensity
+    float *weight_map;          //sums of the weights
+    float *nearest;             //distance of the nearest point so far
+    int32_t next_tile;          //first tile not yet taken by a thread
+    pthread_mutex_t mutex;
+} PointGrid;
+
+/**
+ \brief Receives the points of a file a chunk at a time
+ \param[in] user user data given to the reader
+ \param[in] pts array of (X,Y,Z) coordinates, only valid during the call
+ \param[in] bv array of point intensities
+ \param[in] num_pts number of points in the chunk
+ \return false to stop reading
+ */
+typedef bool (*PointChunkCallback)(void *user, const double *pts, const uint8_t *bv, size_t num_pts);
+
 /** 
  \brief Projects points in pts to landmark coordinates and uses inverse distance weighting to calculate elevations on a grid.
+ 
+ The landmark is split in tiles gridded on all processors. Each tile sees the points that reach it in input order, so
+ the result does not depend on the number of threads, and of equally near points the first one is kept.
  \param[in] pts array of (X,Y,Z) coordinates in ECEF reference frame
  \param[in] bv array of point intensities for each point in `pts`
  \param[in] num_pts number of points in pts
@@ -54,7 +99,60 @@ enum PointFrame{WORLD, LOCAL, RASTER};
  */
 bool point2lmk( double *pts, uint8_t *bv, size_t num_pts, LMK *lmk, enum PointFrame frame, bool smooth);
 
+/**
+ \brief Start gridding points onto a landmark, for point clouds added in chunks
+ 
+ Adding the points of `point2lmk` in any number of chunks gives the same landmark.
+ \param[out] grid
+ \param[in,out] lmk should have complete header at the time of input
+ \param[in] frame reference frame of the points
+ \param[in] smooth as in `point2lmk`
+ \return false if malloc fails
+ */
+bool point_grid_init(PointGrid *grid, LMK *lmk, enum PointFrame frame, bool smooth);
+
+/**
+ \brief Grid the next chunk of points
+ \return false if malloc fails
+ */
+bool point_grid_add(PointGrid *grid, const double *pts, const uint8_t *bv, size_t num_pts);
+
+/**
+ \brief Write the elevations and intensities of the landmark from the points added so far
+ */
+void point_grid_finish(PointGrid *grid);
+
+/**
+ \brief Free the sums of a grid initialized by `point_grid_init`
+ */
+void point_grid_free(PointGrid *grid);
+
+/**
+ \brief Estimated peak bytes of gridding a point cloud into a landmark
+ 
+ Counts the landmark arrays, the sums of `point_grid_init` and a chunk of points.
+ \param[in] lmk landmark size
+ \param[in] chunk_size points per chunk, or 0 for POINT_CHUNK_SIZE
+ \return bytes
+ */
+size_t point_grid_bytes(const LMK *lmk, size_t chunk_size);
+
+/** \brief Read the vertices of a .ply file and pass them to a callback in chunks
+ *
+ * Only one chunk of points is in memory at a time. Binary little-endian files whose first element is the vertex
+ * element, without list properties, are memory-mapped and decoded directly; other files are read with rply.
+ * \param[in] plyname filename
+ * \param[in] chunk_size points per call of `callback`, or 0 for POINT_CHUNK_SIZE
+ * \param[in] callback receives the points in file order
+ * \param[in] user first argument of `callback`
+ * \return true if success
+ * \return false if the file cannot be read, has no vertex intensity, or the callback returns false
+ */
+bool readinply_chunks(const char *plyname, size_t chunk_size, PointChunkCallback callback, void *user);
+
 /** \brief Open a .ply file and read the points into an array
+ *
+ * Reads through `readinply_chunks`; the arrays are allocated with malloc and owned by the caller.
  * \param[in] plyname filename
  * \param[out] pts coordinate array
  * \param[out] bv intensity array
@@ -64,7 +162,23 @@ bool point2lmk( double *pts, uint8_t *bv, size_t num_pts, LMK *lmk, enum PointFr
  */
 bool readinply(char * plyname, double **pts, uint8_t **bv, size_t *num_pts);
 
+/** \brief Read an ascii file containing one point on every line in the form: `X Y Z intensity`, and pass the points
+ * to a callback in chunks
+ *
+ * The file is memory-mapped where possible and read by windows of whole lines. Each thread parses the lines of one
+ * block of a window; the blocks reach the callback in file order. Lines that do not start with four numbers are
+ * skipped with a message.
+ * \param[in] filename filename
+ * \param[in] callback receives the points in file order
+ * \param[in] user first argument of `callback`
+ * \return true if success
+ * \return false if the file cannot be opened, malloc fails, or the callback returns false
+ */
+bool readinpoints_ascii_chunks(const char *filename, PointChunkCallback callback, void *user);
+
 /** \brief Open an ascii file containing one point on every line in the form: `X Y Z intensity`
+ *
+ * Reads through `readinpoints_ascii_chunks`.
  * \param[in] plyname filename
  * \param[out] pts coordinate array
  * \param[out] bv intensity array
@@ -110,6 +224,9 @@ enum PointFrame strToFrame(char *frame_str);
  * \brief Write a small patch of landmark to a ply facet
  *
  * This subroutine is used to validating the spatial geometry accuracy of landmark after data manupliation
+ *
+ * Binary little-endian files, including PLY_DEFAULT on little-endian processors, are encoded on all threads in
+ * blocks of rows and written by a writer thread. Other formats are written with rply.
  * \param[in] filename filename for ply facet
  * \param[in] lmk landmark structure
  * \param[in] x0 center col coordinate of landmark
@@ -133,6 +250,8 @@ bool Write_LMK_PLY_Facet(const char *filename, LMK *lmk, enum e_ply_storage_mode
 
 /**
  * \brief Write landmark into a point cloud ply file format
+ *
+ * Binary little-endian files are written like in `Write_LMK_PLY_Facet_Window`.
  * \param[in] filename filename for ply facet
  * \param[in] lmk landmark structure
  * \return true on success
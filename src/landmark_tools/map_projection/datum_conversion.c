@@ -99,6 +99,72 @@ void ECEF_to_LatLongHeight(double p[3], double *latitude_degrees, double *longit
 }
 
 
+void LatLongHeight_to_ECEF_Batch(const double *latitude_degrees, const double *longitude_degrees, const double *elevation_meters, size_t n, double (*p)[3], enum Planet body)
+{
+    double A = ellipsoids[body].a;
+    double e2 = ellipsoids[body].e2;
+
+    if(e2 == 0.0){
+        // N is the radius
+        for(size_t i = 0; i < n; i++){
+            double cs = cos(latitude_degrees[i]*DEG2RAD);
+            double si = sin(latitude_degrees[i]*DEG2RAD);
+            double R = A + elevation_meters[i];
+            p[i][0] = R*cs*cos(longitude_degrees[i]*DEG2RAD);
+            p[i][1] = R*cs*sin(longitude_degrees[i]*DEG2RAD);
+            p[i][2] = R*si;
+        }
+        return;
+    }
+    for(size_t i = 0; i < n; i++){
+        double cs = cos(latitude_degrees[i]*DEG2RAD);
+        double si = sin(latitude_degrees[i]*DEG2RAD);
+        double N = A/sqrt(1-e2*si*si);
+        p[i][0] = (N + elevation_meters[i])*cs*cos(longitude_degrees[i]*DEG2RAD);
+        p[i][1] = (N + elevation_meters[i])*cs*sin(longitude_degrees[i]*DEG2RAD);
+        p[i][2] = (N*(1 - e2) + elevation_meters[i])*si;
+    }
+}
+
+
+void ECEF_to_LatLongHeight_Batch(const double (*p)[3], size_t n, double *latitude_degrees, double *longitude_degrees, double *elevation_meters, enum Planet body)
+{
+    double A = ellipsoids[body].a;
+    double e2 = ellipsoids[body].e2;
+    double B = ellipsoids[body].b;
+    double e2H = ellipsoids[body].e2B;
+
+    if(e2 == 0.0){
+        // The Bowring correction vanishes, so the latitude is atan(z/d) as in ECEF_to_LatLongHeight
+        for(size_t i = 0; i < n; i++){
+            double d = sqrt(p[i][0]*p[i][0] + p[i][1]*p[i][1]);
+            double latitude_radians = atan(p[i][2]/d);
+            latitude_degrees[i] = latitude_radians*RAD2DEG;
+            longitude_degrees[i] = atan2(p[i][1], p[i][0])*RAD2DEG;
+            elevation_meters[i] = d/cos(latitude_radians) - A;
+        }
+        return;
+    }
+    for(size_t i = 0; i < n; i++){
+        double d = sqrt(p[i][0]*p[i][0] + p[i][1]*p[i][1]);
+        // parametric latitude from tan(ph) = z*A/(d*B)
+        double zA = p[i][2]*A;
+        double dB = d*B;
+        double r = sqrt(zA*zA + dB*dB);
+        double cs = dB/r;
+        double si = zA/r;
+        double num = p[i][2] + e2H*B*si*si*si;
+        double den = d - e2*A*cs*cs*cs;
+        double h = sqrt(num*num + den*den);
+        double sin_lat = num/h;
+        double cos_lat = den/h;
+        latitude_degrees[i] = atan2(num, den)*RAD2DEG;
+        longitude_degrees[i] = atan2(p[i][1], p[i][0])*RAD2DEG;
+        elevation_meters[i] = d*cos_lat + p[i][2]*sin_lat - A*sqrt(1-e2*sin_lat*sin_lat);
+    }
+}
+
+
 void localmap2ECEF_rot_sphere(double lat, double lg, double elv, double rot_l_b[3][3], double radius)
 {
     double p1[3] = {0};
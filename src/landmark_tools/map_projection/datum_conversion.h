@@ -106,6 +106,38 @@ void LatLongHeight_to_ECEF_sphere(double latitude_degrees, double longitude_degr
  */
 void ECEF_to_LatLongHeight_sphere(double p[3], double *latitude_degrees, double *longitude_degrees, double *ele, double radius_meters);
 
+/**
+ \brief Convert arrays of latitude, longitude and height to Body-Centric-Body-Fixed coordinates using an ellipsoid model of the Body.
+ 
+ The points are those of `LatLongHeight_to_ECEF`. The ellipsoid is looked up once, and bodies with no eccentricity
+ skip the prime vertical radius.
+ 
+ \param[in] latitude_degrees n latitudes in degrees
+ \param[in] longitude_degrees n longitudes in degrees
+ \param[in] elevation_meters n elevations in meters
+ \param[in] n number of points
+ \param[out] p n (x,y,z) coordinates in body-centric-body-fixed frame
+ \param[in] body Plantary model
+ */
+void LatLongHeight_to_ECEF_Batch(const double *latitude_degrees, const double *longitude_degrees, const double *elevation_meters, size_t n, double (*p)[3], enum Planet body);
+
+/**
+ \brief Convert arrays of Body-Centric-Body-Fixed coordinates to latitude, longitude and height using an ellipsoid model of the Body.
+ 
+ Uses the single Bowring iteration of `ECEF_to_LatLongHeight` with the sines and cosines of the latitudes taken
+ from their tangents, which leaves two arc tangents and a few square roots per point. The height is measured along
+ the normal of the latitude found, which stays defined at the poles. Results agree with `ECEF_to_LatLongHeight` to
+ within rounding; for bodies with no eccentricity they are the same.
+ 
+ \param[in] p n points to convert
+ \param[in] n number of points
+ \param[out] latitude_degrees n latitudes in degrees
+ \param[out] longitude_degrees n longitudes in degrees
+ \param[out] elevation_meters n elevations in meters
+ \param[in] body Plantary model
+ */
+void ECEF_to_LatLongHeight_Batch(const double (*p)[3], size_t n, double *latitude_degrees, double *longitude_degrees, double *elevation_meters, enum Planet body);
+
 /**
  \brief Calculate the rotation between the local map frame and the Body-Centric-Body-Fixed frame with an ellipsoid Planet model
   the rotation is from east north up to ecef frame
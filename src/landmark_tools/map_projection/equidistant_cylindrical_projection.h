@@ -27,6 +27,10 @@
 
 #include "landmark_tools/map_projection/datum_conversion.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
 /**
  \brief Takes a latitude and longitude and converts it to x,y coordinates on a equidistant cylindrical projection
  
@@ -52,5 +56,8 @@ void LatLong2EquidistantCylindricalProjection(double latitude, double longitude,
  \param[out] longitude 
 */
 void EquidistantCylindricalProjection2LatLong( double x, double y, double standard_parallel, double central_meridian, enum Planet body, double *latitude, double *longitude );
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
 
 #endif /* _LANDMARK_TOOLS_EQUIDISTANT_CYLINDRICAL_PROJECTION_H_ */
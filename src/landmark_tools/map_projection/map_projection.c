@@ -0,0 +1,230 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "landmark_tools/map_projection/map_projection.h"
+#include "landmark_tools/math/math_constants.h"  // for E2, Ae, DEG2RAD
+
+// Series coefficients of the UTM meridian distance, as in latlong2utm
+#define UTM_K0 0.9996
+#define UTM_E2B (E2/(1-E2))
+#define UTM_M1 (1.0-E2/4.0 - 3.0*E2*E2/64 - 5*E2*E2*E2/256)
+#define UTM_M2 (3.0*E2/8.0 + 3*E2*E2/32.0 + 45*E2*E2*E2/1024)
+#define UTM_M3 (15.0*E2*E2/256 +45*E2*E2*E2/1024.0)
+#define UTM_M4 (35.0*E2*E2*E2/3072)
+
+bool map_projection_init(MapProjection *projection, enum Projection type, enum Planet body,
+                         double origin_latitude, double origin_longitude)
+{
+    memset(projection, 0, sizeof(MapProjection));
+    if (type < 0 || type >= Projection_UNDEFINED || body < 0 || body >= Planet_UNDEFINED) {
+        return false;
+    }
+    projection->projection = type;
+    //TODO is there a way to use the other ellipse parameters?
+    projection->radius = ellipsoids[body].a;
+    projection->origin_latitude = origin_latitude;
+    projection->origin_longitude = origin_longitude;
+    projection->lat0_rad = origin_latitude*DEG2RAD;
+    projection->lon0_rad = origin_longitude*DEG2RAD;
+    projection->sin_lat0 = sin(projection->lat0_rad);
+    projection->cos_lat0 = cos(projection->lat0_rad);
+    projection->x_scale = projection->radius*projection->cos_lat0;
+    return true;
+}
+
+static void utm_forward(const MapProjection *projection, const double *latitude, const double *longitude, size_t n,
+                        double *x, double *y)
+{
+    double lg_r0 = projection->lon0_rad;
+    for (size_t i = 0; i < n; i++) {
+        double lat_r = latitude[i]*DEG2RAD;
+        double lg_r = longitude[i]*DEG2RAD;
+        double si = sin(lat_r);
+        double cs = cos(lat_r);
+        double ta = tan(lat_r);
+        double N = Ae/sqrt(1-E2*si*si);
+        double T = ta*ta;
+        double C = UTM_E2B*cs*cs;
+        double A = (lg_r - lg_r0)*cs;
+        double M = Ae*(UTM_M1*lat_r - UTM_M2*sin(lat_r*2) + UTM_M3*sin(lat_r*4) - (UTM_M4*sin(lat_r*6)));
+        x[i] = UTM_K0*N*(A +(1-T+C)*A*A*A/6.0 + (5-18.0*T + T*T +72*C -58*UTM_E2B)*A*A*A*A*A/120.0)+ 500000;
+        y[i] = UTM_K0*(M + N*ta*(A*A/2 + (5-T + 9*C + 4*C*C)*A*A*A*A/24.0 +
+                                 (61-58*T +T*T +600*C -330*UTM_E2B)*A*A*A*A*A*A/720));
+    }
+}
+
+static void stereographic_forward(const MapProjection *projection, const double *latitude, const double *longitude,
+                                  size_t n, double *x, double *y)
+{
+    double R = projection->radius;
+    double sin_lat0 = projection->sin_lat0;
+    double cos_lat0 = projection->cos_lat0;
+    double long0_rad = projection->lon0_rad;
+    for (size_t i = 0; i < n; i++) {
+        double lat_rad = latitude[i]*DEG2RAD;
+        double dlg = longitude[i]*DEG2RAD - long0_rad;
+        double sin_lat = sin(lat_rad);
+        double cos_lat = cos(lat_rad);
+        double cos_dlg = cos(dlg);
+        double k = 2.0/(1+sin_lat0*sin_lat+cos_lat0*cos_lat*cos_dlg);
+        x[i] = R*k*cos_lat*sin(dlg);
+        y[i] = R*k*(cos_lat0*sin_lat-sin_lat0*cos_lat*cos_dlg);
+    }
+}
+
+static void equidistant_cylindrical_forward(const MapProjection *projection, const double *latitude,
+                                            const double *longitude, size_t n, double *x, double *y)
+{
+    double R = projection->radius;
+    double x_scale = projection->x_scale;
+    double lon0_rad = projection->lon0_rad;
+    for (size_t i = 0; i < n; i++) {
+        double delta_longitude = longitude[i]*DEG2RAD - lon0_rad;
+        delta_longitude -= (delta_longitude > PI) ? 2*PI : 0.0;
+        delta_longitude += (delta_longitude < -PI) ? 2*PI : 0.0;
+        x[i] = x_scale*delta_longitude;
+        y[i] = R*(latitude[i]*DEG2RAD);
+    }
+}
+
+static void orthographic_forward(const MapProjection *projection, const double *latitude, const double *longitude,
+                                 size_t n, double *x, double *y)
+{
+    double R = projection->radius;
+    double sin_lat0 = projection->sin_lat0;
+    double cos_lat0 = projection->cos_lat0;
+    double lg0 = projection->origin_longitude;
+    for (size_t i = 0; i < n; i++) {
+        double lat_rad = latitude[i]*DEG2RAD;
+        double dlg = (longitude[i]-lg0)*DEG2RAD;
+        double cos_lat = cos(lat_rad);
+        x[i] = R*cos_lat*sin(dlg);
+        y[i] = R*(cos_lat0*sin(lat_rad)-sin_lat0*cos_lat*cos(dlg));
+    }
+}
+
+bool map_projection_forward(const MapProjection *projection, const double *latitude, const double *longitude,
+                            size_t n, double *x, double *y)
+{
+    switch (projection->projection) {
+        case UTM:
+            utm_forward(projection, latitude, longitude, n, x, y);
+            return true;
+        case STEREO:
+            stereographic_forward(projection, latitude, longitude, n, x, y);
+            return true;
+        case EQUIDISTANT_CYLINDRICAL:
+            equidistant_cylindrical_forward(projection, latitude, longitude, n, x, y);
+            return true;
+        case GEOGRAPHIC:
+            memmove(x, longitude, n*sizeof(double));
+            memmove(y, latitude, n*sizeof(double));
+            return true;
+        case ORTHOGRAPHIC:
+            orthographic_forward(projection, latitude, longitude, n, x, y);
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void utm_inverse(const MapProjection *projection, const double *x, const double *y, size_t n,
+                        double *latitude, double *longitude)
+{
+    double lg0 = projection->origin_longitude;
+    double e1 = (1-sqrt(1-E2))/(1+sqrt(1-E2));
+    for (size_t i = 0; i < n; i++) {
+        double M = y[i]/UTM_K0;
+        double xi = x[i]-500000;
+        double mu = M/(Ae*(1-E2/4.0 - 3.0*E2*E2/64.0 - 5.0*E2*E2*E2/256));
+        double ph1 = mu +(3.0*e1/2.0 - 27.0*e1*e1*e1/32.0)*sin(2*mu) +
+            (21.0*e1*e1/16.0 - 55.0*e1*e1*e1*e1/32.0)*sin(4.0*mu) +
+            (151*e1*e1*e1/96)*sin(6.0*mu) +
+            (1097.0*e1*e1*e1*e1/512.0)*sin(8.0*mu);
+        double sin_ph1 = sin(ph1);
+        double cos_ph1 = cos(ph1);
+        double tan_ph1 = tan(ph1);
+        double c1 = UTM_E2B*cos_ph1*cos_ph1;
+        double t1 = tan_ph1*tan_ph1;
+        double n1 = Ae/sqrt(1-E2*sin_ph1*sin_ph1);
+        double r1 = Ae*(1-E2)/(1-E2*sin_ph1*sin_ph1)/sqrt(1-E2*sin_ph1*sin_ph1);
+        double d = xi/(n1*UTM_K0);
+        double ph = (d*d/2 - (5.0 + 3.0*t1 + 10.0*c1 - 4.0*c1*c1 - 9.0*UTM_E2B)*d*d*d*d/24.0
+            +(61.0 + 90.0*t1 + 298*c1 + 45 *t1*t1 - 253*UTM_E2B - 3*c1*c1)*d*d*d*d*d*d/720);
+        ph = ph*(n1*tan_ph1/r1);
+        ph = ph1 - ph;
+        double lamd = (d-(1+2.0*t1 + c1)*d*d*d/6.0 +
+            (5.0 - 2.0*c1 + 28*t1 - 3.0*c1*c1 + 8*UTM_E2B + 24.0*t1*t1)*d*d*d*d*d/120.0)/cos_ph1;
+        latitude[i] = ph*180.0/3.1415926;
+        longitude[i] = lamd*180.0/3.1415926 + lg0;
+    }
+}
+
+/**
+ \brief Inverse of the azimuthal projections, with c(rho) the angular distance of a point from the origin
+ */
+static void azimuthal_inverse(const MapProjection *projection, const double *x, const double *y, size_t n,
+                              bool stereographic, double *latitude, double *longitude)
+{
+    double R = projection->radius;
+    double sin_lat0 = projection->sin_lat0;
+    double cos_lat0 = projection->cos_lat0;
+    for (size_t i = 0; i < n; i++) {
+        double rho = sqrt(x[i]*x[i] + y[i]*y[i]);
+        if (rho < 0.000001) {
+            latitude[i] = projection->origin_latitude;
+            longitude[i] = projection->origin_longitude;
+            continue;
+        }
+        double c = stereographic ? 2*atan(rho/(2*R)) : asin(rho/R);
+        double sinc = sin(c);
+        double cosc = cos(c);
+        latitude[i] = asin(cosc*sin_lat0 + y[i]*sinc*cos_lat0/rho)*RAD2DEG;
+        longitude[i] = projection->origin_longitude +
+                       atan2(x[i]*sinc, rho*cos_lat0*cosc - y[i]*sin_lat0*sinc)*RAD2DEG;
+    }
+}
+
+bool map_projection_inverse(const MapProjection *projection, const double *x, const double *y, size_t n,
+                            double *latitude, double *longitude)
+{
+    switch (projection->projection) {
+        case UTM:
+            utm_inverse(projection, x, y, n, latitude, longitude);
+            return true;
+        case STEREO:
+            azimuthal_inverse(projection, x, y, n, true, latitude, longitude);
+            return true;
+        case EQUIDISTANT_CYLINDRICAL:
+            for (size_t i = 0; i < n; i++) {
+                latitude[i] = y[i]/projection->radius*RAD2DEG;
+                longitude[i] = projection->origin_longitude + x[i]/projection->x_scale*RAD2DEG;
+            }
+            return true;
+        case GEOGRAPHIC:
+            memmove(latitude, y, n*sizeof(double));
+            memmove(longitude, x, n*sizeof(double));
+            return true;
+        case ORTHOGRAPHIC:
+            azimuthal_inverse(projection, x, y, n, false, latitude, longitude);
+            return true;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,103 @@
+/**
+ * \file map_projection.h
+ * \brief Map projections of arrays of points with the constants of the projection computed once
+ *
+ * A `MapProjection` holds the projection type, the body radius and the trigonometry of the origin. The batch calls
+ * select the projection once per array and run one straight loop over the points, which the compiler can unroll
+ * and vectorize. The forward projections give the same values as `latlong2utm`,
+ * `LatLong2StereographicProjection`, `LatLong2EquidistantCylindricalProjection` and `orthographic_map_projection`.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_MAP_PROJECTION_H_
+#define _LANDMARK_TOOLS_MAP_PROJECTION_H_
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+
+#include "landmark_tools/map_projection/datum_conversion.h"  // for Projection, Planet
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Constants of a map projection
+ */
+typedef struct {
+    enum Projection projection;  /*!< \brief Projection type */
+    double radius;               /*!< \brief Equatorial radius of the body in meters */
+    double origin_latitude;      /*!< \brief Latitude of the origin in degrees */
+    double origin_longitude;     /*!< \brief Longitude of the origin in degrees */
+    double lat0_rad;             /*!< \brief Latitude of the origin in radians */
+    double lon0_rad;             /*!< \brief Longitude of the origin in radians */
+    double sin_lat0;             /*!< \brief Sine of the origin latitude */
+    double cos_lat0;             /*!< \brief Cosine of the origin latitude */
+    double x_scale;              /*!< \brief Meters per radian of longitude of the equidistant cylindrical projection */
+} MapProjection;
+
+/**
+ * \brief Set up a map projection
+ *
+ * The origin is the natural origin of a GeoTIFF. It is the standard parallel and central meridian of the
+ * equidistant cylindrical projection, and the center of the stereographic and orthographic projections. UTM only
+ * uses the longitude, and always projects on the GRS 80 ellipsoid.
+ *
+ * \param[out] projection Projection constants
+ * \param[in] type Projection type
+ * \param[in] body Planetary body
+ * \param[in] origin_latitude Latitude of the origin in degrees
+ * \param[in] origin_longitude Longitude of the origin in degrees
+ * \return false if the projection type or body is not supported
+ */
+bool map_projection_init(MapProjection *projection, enum Projection type, enum Planet body,
+                         double origin_latitude, double origin_longitude);
+
+/**
+ * \brief Project points from latitude and longitude to map coordinates
+ *
+ * \param[in] projection Projection constants from `map_projection_init`
+ * \param[in] latitude n latitudes in degrees
+ * \param[in] longitude n longitudes in degrees
+ * \param[in] n Number of points
+ * \param[out] x n map x coordinates. For GEOGRAPHIC, the longitude
+ * \param[out] y n map y coordinates. For GEOGRAPHIC, the latitude
+ * \return false if the projection type is not supported
+ */
+bool map_projection_forward(const MapProjection *projection, const double *latitude, const double *longitude,
+                            size_t n, double *x, double *y);
+
+/**
+ * \brief Inverse of `map_projection_forward`
+ *
+ * Unlike the scalar inverse functions, every projection returns degrees.
+ *
+ * \param[in] projection Projection constants from `map_projection_init`
+ * \param[in] x n map x coordinates
+ * \param[in] y n map y coordinates
+ * \param[in] n Number of points
+ * \param[out] latitude n latitudes in degrees
+ * \param[out] longitude n longitudes in degrees
+ * \return false if the projection type is not supported
+ */
+bool map_projection_inverse(const MapProjection *projection, const double *x, const double *y, size_t n,
+                            double *latitude, double *longitude);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_MAP_PROJECTION_H_ */
@@ -0,0 +1,205 @@
+/**
+ * \file fixed_matrix.h
+ * \brief Small dense linear algebra on caller stack storage
+ *
+ * These are the routines of `double_matrix.c` for matrices of at most FIXED_MATRIX_MAXDIM rows, with the same
+ * arithmetic. They are inline so that calls with a constant size, such as the 8x8 systems of the homography solvers,
+ * compile to loops of known length, and they never allocate memory.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_FIXED_MATRIX_H_
+#define _LANDMARK_TOOLS_FIXED_MATRIX_H_
+
+#include <float.h>    // for DBL_EPSILON
+#include <math.h>     // for fabs, sqrt
+#include <stdbool.h>  // for bool
+#include <stdint.h>   // for int32_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define FIXED_MATRIX_MAXDIM 9
+#define FIXED_JACOBI_MAX_SWEEPS 50
+
+/**
+ * \brief LU decomposition of the transpose of a row-major matrix with scaled partial pivoting, as `LUDecomposeD`
+ *
+ * \param[in] a n x n matrix
+ * \param[out] lu n x n decomposition
+ * \param[out] ps pivot sequence of n rows
+ * \param[in] n size, at most FIXED_MATRIX_MAXDIM
+ * \return false if the matrix is singular
+ */
+static inline bool fixed_lu_decompose(const double *a, double *lu, int32_t *ps, int32_t n)
+{
+    double scales[FIXED_MATRIX_MAXDIM];
+    for (int32_t i = 0; i < n; i++) {
+        // The largest element of each row, for row equilibration
+        double biggest = 0.0;
+        for (int32_t j = 0; j < n; j++) {
+            double tempf = fabs(lu[i*n + j] = a[j*n + i]);
+            if (biggest < tempf) biggest = tempf;
+        }
+        if (biggest == 0.0) return false;
+        scales[i] = 1.0 / biggest;
+        ps[i] = i;
+    }
+
+    for (int32_t k = 0; k < n-1; k++) {
+        // The largest element of each column to pivot around
+        double biggest = 0.0;
+        int32_t pivotindex = k;
+        for (int32_t i = k; i < n; i++) {
+            double tempf = fabs(lu[ps[i]*n + k]) * scales[ps[i]];
+            if (biggest < tempf) {
+                biggest = tempf;
+                pivotindex = i;
+            }
+        }
+        if (biggest == 0.0) return false;
+        if (pivotindex != k) {
+            int32_t j = ps[k];
+            ps[k] = ps[pivotindex];
+            ps[pivotindex] = j;
+        }
+
+        // Pivot, eliminating an extra variable each time
+        double pivot = lu[ps[k]*n + k];
+        for (int32_t i = k+1; i < n; i++) {
+            double mult = lu[ps[i]*n + k] = lu[ps[i]*n + k] / pivot;
+            if (mult != 0.0) {
+                for (int32_t j = k+1; j < n; j++)
+                    lu[ps[i]*n + j] -= mult * lu[ps[k]*n + j];
+            }
+        }
+    }
+    return lu[ps[n-1]*n + n-1] != 0.0;
+}
+
+/**
+ * \brief Solve with a decomposition of `fixed_lu_decompose`, as `LUSolveD`
+ *
+ * \param[in] lu n x n decomposition
+ * \param[in] ps pivot sequence
+ * \param[in] b right hand side
+ * \param[out] x solution
+ * \param[in] n size
+ */
+static inline void fixed_lu_solve(const double *lu, const int32_t *ps, const double *b, double *x, int32_t n)
+{
+    for (int32_t i = 0; i < n; i++) {
+        double dot = 0.0;
+        for (int32_t j = 0; j < i; j++)
+            dot += lu[ps[i]*n + j] * x[j];
+        x[i] = b[ps[i]] - dot;
+    }
+    for (int32_t i = n-1; i >= 0; i--) {
+        double dot = 0.0;
+        for (int32_t j = i+1; j < n; j++)
+            dot += lu[ps[i]*n + j] * x[j];
+        x[i] = (x[i] - dot) / lu[ps[i]*n + i];
+    }
+}
+
+/**
+ * \brief Inverse of a square row-major matrix, as `InvertMatrixD`
+ *
+ * \param[in] a n x n matrix
+ * \param[out] inv n x n inverse
+ * \param[in] n size, at most FIXED_MATRIX_MAXDIM
+ * \return false if the matrix is singular
+ */
+static inline bool fixed_invert(const double *a, double *inv, int32_t n)
+{
+    double lu[FIXED_MATRIX_MAXDIM*FIXED_MATRIX_MAXDIM];
+    int32_t ps[FIXED_MATRIX_MAXDIM];
+    double b[FIXED_MATRIX_MAXDIM];
+    if (!fixed_lu_decompose(a, lu, ps, n)) return false;
+    for (int32_t i = 0; i < n; i++) {
+        for (int32_t j = 0; j < n; j++)
+            b[j] = 0;
+        b[i] = 1;
+        fixed_lu_solve(lu, ps, b, &inv[i*n], n);
+    }
+    return true;
+}
+
+/**
+ * \brief Eigen decomposition of a symmetric row-major matrix by cyclic Jacobi rotations
+ *
+ * \param[in,out] a n x n symmetric matrix, diagonalized in place
+ * \param[out] w n eigenvalues, unsorted
+ * \param[out] v n x n matrix with the unit eigenvector of `w[i]` in column i
+ * \param[in] n size
+ * \return false if the rotations did not converge
+ */
+static inline bool fixed_jacobi(double *a, double *w, double *v, int32_t n)
+{
+    for (int32_t i = 0; i < n; i++) {
+        for (int32_t j = 0; j < n; j++)
+            v[i*n + j] = (i == j) ? 1.0 : 0.0;
+    }
+    bool converged = false;
+    for (int32_t sweep = 0; sweep < FIXED_JACOBI_MAX_SWEEPS && !converged; sweep++) {
+        converged = true;
+        for (int32_t p = 0; p < n-1; p++) {
+            for (int32_t q = p+1; q < n; q++) {
+                double apq = a[p*n + q];
+                if (apq == 0.0) continue;
+                // Off diagonal elements below the precision of both diagonal elements are dropped
+                double g = 100.0*fabs(apq);
+                if (sweep > 3 && fabs(a[p*n + p]) + g == fabs(a[p*n + p]) && fabs(a[q*n + q]) + g == fabs(a[q*n + q])) {
+                    a[p*n + q] = a[q*n + p] = 0.0;
+                    continue;
+                }
+                converged = false;
+
+                // Rotation that zeroes a[p][q]
+                double theta = (a[q*n + q] - a[p*n + p]) / (2.0*apq);
+                double t = (fabs(theta) > 1.0/DBL_EPSILON) ? 0.5/theta
+                                                            : ((theta >= 0.0) ? 1.0 : -1.0)/(fabs(theta) + sqrt(theta*theta + 1.0));
+                double c = 1.0/sqrt(t*t + 1.0);
+                double s = t*c;
+                for (int32_t k = 0; k < n; k++) {
+                    double akp = a[k*n + p], akq = a[k*n + q];
+                    a[k*n + p] = c*akp - s*akq;
+                    a[k*n + q] = s*akp + c*akq;
+                }
+                for (int32_t k = 0; k < n; k++) {
+                    double apk = a[p*n + k], aqk = a[q*n + k];
+                    a[p*n + k] = c*apk - s*aqk;
+                    a[q*n + k] = s*apk + c*aqk;
+                }
+                for (int32_t k = 0; k < n; k++) {
+                    double vkp = v[k*n + p], vkq = v[k*n + q];
+                    v[k*n + p] = c*vkp - s*vkq;
+                    v[k*n + q] = s*vkp + c*vkq;
+                }
+            }
+        }
+    }
+    for (int32_t i = 0; i < n; i++)
+        w[i] = a[i*n + i];
+    return converged;
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _LANDMARK_TOOLS_FIXED_MATRIX_H_
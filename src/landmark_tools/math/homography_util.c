@@ -14,24 +14,22 @@
  *  limitations under the License.
  */
 
-#include <math.h>                                                // for fabs
+#include <float.h>                                               // for DBL_MAX
+#include <math.h>                                                // for fabs, round
 #include <stdio.h>                                               // for printf
 #include <stdlib.h>                                              // for free
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/parallel.h"
+#include "landmark_tools/utils/perf_stats.h"
 #include "landmark_tools/utils/safe_string.h"
 
 #include "landmark_tools/data_interpolation/interpolate_data.h"  // for inte...
 #include "landmark_tools/math/homography_util.h"
-#include "landmark_tools/math/double_matrix.h"                   // for Line...
+#include "landmark_tools/math/fixed_matrix.h"                    // for fixed_invert, fixed_jacobi
 #include "landmark_tools/math/math_utils.h"                      // for prt3
+#include "landmark_tools/math/splitmix.h"                        // for splitmix64_uniform
 #include "math/mat3/mat3.h"                                      // for mult331
 
-#include <gsl/gsl_linalg.h>
-#include <gsl/gsl_eigen.h>
-#include <gsl/gsl_matrix.h>
-#include <gsl/gsl_vector.h>
-
-#define RANSAC_MAX_ITERATIONS 200
-
 int32_t convertTo33(double h[9], double h_out[3][3])
 {
     h_out[0][0] = h[0];
@@ -131,31 +129,108 @@ int32_t inverseHomography33(double h[3][3], double invh[3][3])
     return 1;
 }
 //homo is from out to in
-int32_t transferImage(double homo[3][3], uint8_t *in_img, int32_t cols, int32_t rows, uint8_t *outimg, int32_t cols2, int32_t rows2)
+
+/**
+ \brief Warping shared by its threads, which take output rows in turn
+ */
+typedef struct {
+    double (*homo)[3];
+    uint8_t *in_img;
+    uint8_t *in_mask;               //NULL when only the image is warped
+    int32_t cols;
+    int32_t rows;
+    uint8_t *outimg;
+    uint8_t *outmask;
+    int32_t left;                   //output pixel of outimg[0]
+    int32_t top;
+    int32_t cols2;
+    int32_t rows2;
+    int32_t num_threads;            //0 for parallel_num_threads()
+    ParallelScratch scratch;        //coordinates of a row for each thread
+} TransferJob;
+
+/**
+ \brief Whether `transferImage` of the 0 or 255 image of the valid pixels of `mask` gives 0 at (x, y)
+ 
+ This is the arithmetic of `inter_uint8_matrix` on that image, without building it.
+ */
+static uint8_t transfer_mask_pixel(const uint8_t *mask, int32_t cols, int32_t rows, double x, double y)
 {
-    int32_t i, j;
-    double op[2];
-    for(i = 0; i < rows2; ++i)
-    {
-        for(j = 0; j < cols2; ++j)
+    if(x >= 1 && x < cols-1 && y >= 1 && y < rows - 1){
+        int64_t ix = (int64_t)x;
+        int64_t iy = (int64_t)y;
+        double dx = (x - ix);
+        double dy = (y - iy);
+        double dx0 = 1.0 - dx;
+        double dy0 = 1.0 - dy;
+        const uint8_t *m = &mask[iy*cols + ix];
+        int64_t p00 = m[0] == 0 ? 255 : 0;
+        int64_t p01 = m[1] == 0 ? 255 : 0;
+        int64_t p11 = m[cols + 1] == 0 ? 255 : 0;
+        int64_t p10 = m[cols] == 0 ? 255 : 0;
+        double bv = dy0 * (dx0 * p00 + dx * p01) + dy * (dx0 * p10 + dx * p11);
+        return (uint8_t)round(bv) == 0 ? 1 : 0;
+    }
+    return mask[(int32_t)y*cols + (int32_t)x] != 0 ? 1 : 0;
+}
+
+static bool transfer_rows(void *user, int32_t thread, size_t begin, size_t end)
+{
+    TransferJob *job = (TransferJob *)user;
+    double *x = (double *)parallel_scratch_reserve(&job->scratch, thread, sizeof(double)*2*job->cols2);
+    if(x == NULL) return false;
+    double *y = x + job->cols2;
+    for(int32_t i = (int32_t)begin; i < (int32_t)end; i++){
+        // The coordinates of the row are shared by the image and the mask
+        uint8_t *out = &job->outimg[(size_t)i*job->cols2];
+        inter_homography_row(job->homo, job->left, job->top + i, job->cols2, x, y);
+        for(int32_t j = 0; j < job->cols2; ++j)
         {
-            homographyTransfer33(homo, j, i,  op);
-            if(op[0] > 0 && op[0] < cols-1 && op[1] > 0 && op[1] < rows - 1)
-            {
-                uint8_t val = 0;
-                if(inter_uint8_matrix(in_img, cols, rows, op[0], op[1], &val)){
-                    outimg[i*cols2 + j] = (int32_t)val;
-                }
-            }
-            else
-            {
-                outimg[i*cols2 + j] = 0;
+            bool inside = x[j] > 0 && x[j] < job->cols-1 && y[j] > 0 && y[j] < job->rows - 1;
+            if(job->outmask != NULL){
+                job->outmask[(size_t)i*job->cols2 + j] =
+                    inside ? transfer_mask_pixel(job->in_mask, job->cols, job->rows, x[j], y[j]) : 1;
             }
+            // Out of bounds samples are 0, and so is one at (-1, -1)
+            if(!inside) x[j] = y[j] = -1.0;
         }
+        inter_uint8_matrix_batch(job->in_img, job->cols, job->rows, x, y, job->cols2, out, NULL);
+    }
+    return true;
+}
+
+static int32_t transfer(TransferJob *job)
+{
+    bool success = parallel_for(job->rows2 > 0 ? (size_t)job->rows2 : 0, 1, job->num_threads, transfer_rows, job);
+    parallel_scratch_free(&job->scratch);
+    if(!success){
+        printf("transferImage() ==>> malloc() failed\n");
+        return 0;
     }
     return 1;
 }
 
+int32_t transferImage(double homo[3][3], uint8_t *in_img, int32_t cols, int32_t rows, uint8_t *outimg, int32_t cols2, int32_t rows2)
+{
+    TransferJob job = {homo, in_img, NULL, cols, rows, outimg, NULL, 0, 0, cols2, rows2, 0};
+    return transfer(&job);
+}
+
+int32_t transferImageMask(double homo[3][3], uint8_t *in_img, uint8_t *in_mask, int32_t cols, int32_t rows,
+                          uint8_t *outimg, uint8_t *outmask, int32_t cols2, int32_t rows2)
+{
+    TransferJob job = {homo, in_img, in_mask, cols, rows, outimg, outmask, 0, 0, cols2, rows2, 0};
+    return transfer(&job);
+}
+
+int32_t transferImageMaskWindow(double homo[3][3], uint8_t *in_img, uint8_t *in_mask, int32_t cols, int32_t rows,
+                                uint8_t *outimg, uint8_t *outmask, int32_t left, int32_t top, int32_t cols2,
+                                int32_t rows2, int32_t num_threads)
+{
+    TransferJob job = {homo, in_img, in_mask, cols, rows, outimg, outmask, left, top, cols2, rows2, num_threads};
+    return transfer(&job);
+}
+
 
 int32_t  Convert2ImageCoordinate33(double homo[3][3], double homo_out[3][3],  double inm[3][3])
 {
@@ -201,168 +276,50 @@ int32_t  Convert2ImageCoordinate33(double homo[3][3], double homo_out[3][3],  do
 
 bool getHomographyFromPoints_Eigenvalue(double *prefeatures, double *curfeatures, int32_t num_features, double intrisicM[3][3], double h[3][3])
 {
-    // Copy intrinsic matrix to gsl_matrix
-    gsl_matrix *M = gsl_matrix_alloc(3, 3);
-    if (M == NULL) {
-        SAFE_PRINTF(512, "getHomographyFromPoints_Eigenvalue -> Could not allocate memory for matrix M: %s, %d\n", __FILE__, __LINE__);
-        return false;
-    }
-
-    for (size_t i = 0; i < 3; i++) {
-       for (size_t j = 0; j < 3; j++) {
-           gsl_matrix_set(M, i, j, intrisicM[i][j]);
-       }
-    }
-
-    // Calculate inverse 
-    gsl_matrix *invM = gsl_matrix_inverse(M);
-    if(invM == NULL){
+    // Normalized image coordinates
+    double invM[3][3];
+    if(det33(intrisicM) == 0.0)
+    {
         SAFE_PRINTF(512, "getHomographyFromPoints_Eigenvalue() ==>> Could calculate inverse of intrinsics matrix: %s, %d\n", __FILE__, __LINE__);
-        if(M != NULL){
-            gsl_matrix_free(M);
-        }
         return false;
     }
+    inv33(intrisicM, invM);
     
-    // Allocate gsl_matrices
-    gsl_matrix *ATA = gsl_matrix_alloc(9, 9);
-    gsl_matrix *A = gsl_matrix_alloc(9,1);
-    gsl_matrix *temp_ATA = gsl_matrix_alloc(9, 9);
-    gsl_matrix *point = gsl_matrix_alloc(3,1);
-    gsl_matrix *curpoint_p = gsl_matrix_alloc(3,1);
-    gsl_matrix *prepoint_p = gsl_matrix_alloc(3,1);
-
-    if (ATA == NULL || A == NULL || temp_ATA == NULL || point == NULL || curpoint_p == NULL || prepoint_p == NULL) {
-        SAFE_PRINTF(512, "getHomographyFromPoints_Eigenvalue() ==>> Could not allocate memory for gsl matrix or vector: %s, %d\n", __FILE__, __LINE__);
-        if(M != NULL){
-            gsl_matrix_free(M);
-        }
-        if(invM != NULL){
-            gsl_matrix_free(invM);
-        }
-        if(ATA != NULL){
-            gsl_matrix_free(ATA);
-        }
-        if(A != NULL){
-            gsl_matrix_free(A);
-        }
-        if(temp_ATA != NULL){
-            gsl_matrix_free(temp_ATA);
-        }
-        if(point != NULL){
-            gsl_matrix_free(point);
-        }
-        if(curpoint_p != NULL){
-            gsl_matrix_free(curpoint_p);
-        }
-        if(prepoint_p != NULL){
-            gsl_matrix_free(prepoint_p);
-        }
-        return false;
-    }
-
+    // Normal equations of the 9 entries of the homography, two rows of the design matrix per correspondence
+    double ATA[81] = {0};
     for(int32_t i = 0; i < num_features; ++i)
     {
-        gsl_matrix_set(point, 0, 0, prefeatures[i*2]);
-        gsl_matrix_set(point, 0, 1, prefeatures[i*2 +1]);
-        gsl_matrix_set(point, 0, 2, 1.0);
-        gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, invM, point, 0.0, prepoint_p);
-        
-        gsl_matrix_set(point, 0, 0, curfeatures[i*2]);
-        gsl_matrix_set(point, 0, 1, curfeatures[i*2 +1]);
-        gsl_matrix_set(point, 0, 2, 1.0);
-        gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, invM, point, 0.0, curpoint_p);
-
-        gsl_matrix_set(A, 0, 0, gsl_matrix_get(prepoint_p, 0, 0));
-        gsl_matrix_set(A, 1, 0, gsl_matrix_get(prepoint_p, 1, 0));
-        gsl_matrix_set(A, 2, 0, 1.0);
-        gsl_matrix_set(A, 3, 0, 0.0);
-        gsl_matrix_set(A, 4, 0, 0.0);
-        gsl_matrix_set(A, 5, 0, 0.0);
-        gsl_matrix_set(A, 6, 0, -1*gsl_matrix_get(curpoint_p, 0, 0)*gsl_matrix_get(prepoint_p, 0, 0));
-        gsl_matrix_set(A, 7, 0, -1*gsl_matrix_get(curpoint_p, 0, 0)*gsl_matrix_get(prepoint_p, 1, 0));
-        gsl_matrix_set(A, 8, 0, -1*gsl_matrix_get(curpoint_p, 0, 0));
-
-        gsl_blas_dgemm(CblasNoTrans, CblasTrans, 1.0, A, A, 0.0, temp_ATA);
-        gsl_matrix_add(temp_ATA, ATA);
-
-
-        gsl_matrix_set(A, 0, 0, 0.0);
-        gsl_matrix_set(A, 1, 0, 0.0);
-        gsl_matrix_set(A, 2, 0, 0.0);
-        gsl_matrix_set(A, 3, 0, gsl_matrix_get(prepoint_p, 0, 0));
-        gsl_matrix_set(A, 4, 0, gsl_matrix_get(prepoint_p, 1, 0));
-        gsl_matrix_set(A, 5, 0, 1.0);
-        gsl_matrix_set(A, 6, 0, -1*gsl_matrix_get(curpoint_p, 0, 0)*gsl_matrix_get(prepoint_p, 0, 0));
-        gsl_matrix_set(A, 7, 0, -1*gsl_matrix_get(curpoint_p, 0, 0)*gsl_matrix_get(prepoint_p, 1, 0));
-        gsl_matrix_set(A, 8, 0, -1*gsl_matrix_get(curpoint_p, 0, 0));
-
-        gsl_blas_dgemm(CblasNoTrans, CblasTrans, 1.0, A, A, 0.0, temp_ATA);
-        gsl_matrix_add(temp_ATA, ATA);
+        double point[3], prepoint_p[3], curpoint_p[3];
+        point[0] = prefeatures[i*2];
+        point[1] = prefeatures[i*2 +1];
+        point[2] = 1.0;
+        mult331(invM, point, prepoint_p);
+        point[0] = curfeatures[i*2];
+        point[1] = curfeatures[i*2 +1];
+        mult331(invM, point, curpoint_p);
         
-    }
-
-    if(temp_ATA != NULL){
-        gsl_matrix_free(temp_ATA);
-    }
-    if(point != NULL){
-        gsl_matrix_free(point);
-    }
-    if(curpoint_p != NULL){
-        gsl_matrix_free(curpoint_p);
-    }
-    if(prepoint_p != NULL){
-        gsl_matrix_free(prepoint_p);
+        double A[2][9] = {
+            {prepoint_p[0], prepoint_p[1], 1.0, 0.0, 0.0, 0.0,
+             -curpoint_p[0]*prepoint_p[0], -curpoint_p[0]*prepoint_p[1], -curpoint_p[0]},
+            {0.0, 0.0, 0.0, prepoint_p[0], prepoint_p[1], 1.0,
+             -curpoint_p[1]*prepoint_p[0], -curpoint_p[1]*prepoint_p[1], -curpoint_p[1]}};
+        for(int32_t r = 0; r < 2; ++r)
+        {
+            for(int32_t j = 0; j < 9; ++j)
+            {
+                for(int32_t k = 0; k < 9; ++k)
+                {
+                    ATA[j*9 + k] += A[r][j]*A[r][k];
+                }
+            }
+        }
     }
   
     //Calculate eigen decomposition
-    uint32_t iter = 0;
-    gsl_matrix *eigenvectors = gsl_matrix_alloc(9, 9);
-    gsl_vector *eigenvalues = gsl_vector_alloc(9);
-    if (eigenvectors == NULL || eigenvalues == NULL) {
-        SAFE_PRINTF(512, "getHomographyFromPoints_Eigenvalue() ==>> Could not allocate memory for gsl matrix or vector: %s, %d\n", __FILE__, __LINE__);
-        if(M != NULL){
-            gsl_matrix_free(M);
-        }
-        if(invM != NULL){
-            gsl_matrix_free(invM);
-        }
-        if(ATA != NULL){
-            gsl_matrix_free(ATA);
-        }
-        if(A != NULL){
-            gsl_matrix_free(A);
-        }
-        if(eigenvectors != NULL){
-            gsl_matrix_free(eigenvectors);
-        }
-        if(eigenvalues != NULL){
-            gsl_vector_free(eigenvalues);
-        }
-        return false;
-    }
-
-    if (!gsl_eigen_jacobi(ATA, eigenvalues, eigenvectors, 100, &iter))
+    double eigenvalues[9], eigenvectors[81];
+    if (!fixed_jacobi(ATA, eigenvalues, eigenvectors, 9))
     {
-        SAFE_PRINTF(512, "getHomographyFromPoints_Eigenvalue() ==>> gsl_eigen_jacobi() failed, %s, %d\n", __FILE__, __LINE__);
-        if(M != NULL){
-            gsl_matrix_free(M);
-        }
-        if(invM != NULL){
-            gsl_matrix_free(invM);
-        }
-        if(ATA != NULL){
-            gsl_matrix_free(ATA);
-        }
-        if(A != NULL){
-            gsl_matrix_free(A);
-        }
-        if(eigenvectors != NULL){
-            gsl_matrix_free(eigenvectors);
-        }
-        if(eigenvalues != NULL){
-            gsl_vector_free(eigenvalues);
-        }
+        SAFE_PRINTF(512, "getHomographyFromPoints_Eigenvalue() ==>> fixed_jacobi() failed, %s, %d\n", __FILE__, __LINE__);
         return false;
     }
 
@@ -371,7 +328,7 @@ bool getHomographyFromPoints_Eigenvalue(double *prefeatures, double *curfeatures
     size_t smallest_index = 0;
     for(size_t i = 0; i < 9; ++i)
     {
-        double eigenvalue = fabs(gsl_vector_get(eigenvalues, i));
+        double eigenvalue = fabs(eigenvalues[i]);
         if(eigenvalue < smallest_eigenvalue)
         {
             smallest_index = i;
@@ -379,18 +336,12 @@ bool getHomographyFromPoints_Eigenvalue(double *prefeatures, double *curfeatures
         }
     }
 
+    // The eigenvector is column smallest_index
     double hi[3][3];
-    hi[0][0] = gsl_matrix_get(eigenvectors, smallest_index, 0); //[0*9+ smallest_index];
-    hi[0][1] = gsl_matrix_get(eigenvectors, smallest_index, 1); //[1*9+ smallest_index];
-    hi[0][2] = gsl_matrix_get(eigenvectors, smallest_index, 2); //[2*9+ smallest_index];
-
-    hi[1][0] = gsl_matrix_get(eigenvectors, smallest_index, 3); //[3*9+ smallest_index];
-    hi[1][1] = gsl_matrix_get(eigenvectors, smallest_index, 4); //[4*9+ smallest_index];
-    hi[1][2] = gsl_matrix_get(eigenvectors, smallest_index, 5); //[5*9+ smallest_index];
-    
-    hi[2][0] = gsl_matrix_get(eigenvectors, smallest_index, 6); //[6*9+ smallest_index];
-    hi[2][1] = gsl_matrix_get(eigenvectors, smallest_index, 7); //[7*9+ smallest_index];
-    hi[2][2] = gsl_matrix_get(eigenvectors, smallest_index, 8); //[8*9+ smallest_index];
+    for(size_t k = 0; k < 9; ++k)
+    {
+        hi[k/3][k%3] = eigenvectors[k*9 + smallest_index];
+    }
     
     smallest_eigenvalue = 1.0/hi[2][2];
     scale33(smallest_eigenvalue, hi, hi);
@@ -440,7 +391,7 @@ int32_t getHomographyFromPoints_RANSAC(double *prefeature, double *curfeature, i
         nm = 0;
         while(nm < 4)
         {
-            p1 = (int32_t)(rand()*num_features/RAND_MAX);
+            p1 = (int32_t)(rand()%num_features);
             flag = 1;
             
             for(i = 0; i < nm; ++i)
@@ -513,7 +464,7 @@ int32_t getHomographyFromPoints_RANSAC(double *prefeature, double *curfeature, i
     // to compute the epipole on both images
     if(k > 4)
     {
-        SAFE_PRINTF(128, "total points used in homography are %d\n", k);
+        log_message(LOG_LEVEL_DEBUG, "total points used in homography are %d", k);
         getHomographyFromPoints_Eigenvalue(features1, features2, k, intrisicM, h);
         
     }
@@ -523,80 +474,55 @@ int32_t getHomographyFromPoints_RANSAC(double *prefeature, double *curfeature, i
     return 1;
 }
 
-int32_t getHomographyFromPoints(double *points2d1,
-                                double *points2d2, int32_t num_pts_plane, double homo[3][3])
+/**
+ \brief Least squares homography, with h[2][2] = 1, of the points shifted by -p10 and -p20
+ 
+ The 8x8 normal equations are summed one row of the design matrix at a time, in the order of `LinearTransformD`, and
+ solved on the stack.
+*/
+static int32_t homography_least_squares(const double *points2d1, const double *points2d2, int32_t num_pts_plane,
+                                        const double p10[2], const double p20[2], double homo[3][3])
 {
-    //double *r, *rt, *l;
-    double  a[64], inva[64], b[8], m[8];
+    double a[64] = {0}, inva[64], b[8] = {0}, m[8];
     double ipoint[2];
     double ipoint1[2];
-    double r[8];
-    double rtr[64];
-    int32_t i, k, j;
+    int32_t i, j, k;
     
-    for(j = 0; j < 64; ++j)
-    {
-        a[j] = 0.0;
-    }
-    for(j = 0; j < 8; ++j)
-    {
-        b[j] = 0.0;
-    }
-    for(i = 0,k = 0; i < num_pts_plane; ++i)
+    for(i = 0; i < num_pts_plane; ++i)
     {
-        ipoint[0] = points2d1[i*2+0];
-        ipoint[1] = points2d1[i*2+1];
-        ipoint1[0] = points2d2[i*2+0];
-        ipoint1[1] = points2d2[i*2+1];
-        r[  0] = (double)ipoint[0];
-        r[  1] = (double)ipoint[1];
-        r[  2] = 1.0;
-        r[  3] = 0.0;
-        r[  4] = 0.0;
-        r[  5] = 0.0;
-        r[  6] = (double)(-ipoint[0]*ipoint1[0]);
-        r[  7] = (double)(-ipoint1[0]*ipoint[1]);
-        LinearTransformD(r, r, rtr, 8, 1, 8);
-        for(j = 0; j < 64; ++j)
-        {
-            a[j] +=rtr[j];
-        }
-        
-        for(j = 0; j < 8; ++j)
-        {
-            b[j] +=r[j]*(double)ipoint1[0];
-        }
-        
-        
-        r[0] = 0.0;
-        r[1] = 0.0;
-        r[2] = 0.0;
-        r[3] = (double)ipoint[0];
-        r[4] = (double)ipoint[1];
-        r[5] = 1.0;
-        r[6] = (double)(-ipoint[0]*ipoint1[1]);
-        r[7] = (double)(-ipoint[1]*ipoint1[1]);
-        LinearTransformD(r, r, rtr, 8, 1, 8);
-        for(j = 0; j < 64; ++j)
-        {
-            a[j] +=rtr[j];
-        }
-        
-        for(j = 0; j < 8; ++j)
+        ipoint[0] = points2d1[i*2+0] - p10[0];
+        ipoint[1] = points2d1[i*2+1] - p10[1];
+        ipoint1[0] = points2d2[i*2+0] - p20[0];
+        ipoint1[1] = points2d2[i*2+1] - p20[1];
+        const double r[2][8] = {
+            {ipoint[0], ipoint[1], 1.0, 0.0, 0.0, 0.0, -ipoint[0]*ipoint1[0], -ipoint1[0]*ipoint[1]},
+            {0.0, 0.0, 0.0, ipoint[0], ipoint[1], 1.0, -ipoint[0]*ipoint1[1], -ipoint[1]*ipoint1[1]}};
+        for(int32_t row = 0; row < 2; ++row)
         {
-            b[j] +=r[j]*(double)ipoint1[1];
+            for(j = 0; j < 8; ++j)
+            {
+                for(k = 0; k < 8; ++k)
+                {
+                    a[j*8 + k] += r[row][j]*r[row][k];
+                }
+                b[j] += r[row][j]*ipoint1[row];
+            }
         }
-        
     }
     
-    
-    if(InvertMatrixD(a, inva, 8, 8) == 0)
+    if(!fixed_invert(a, inva, 8))
     {
-        
         return (0);
     }
     
-    LinearTransformD(inva, b, m, 8, 8, 1);
+    for(j = 0; j < 8; ++j)
+    {
+        m[j] = 0.0;
+        for(k = 0; k < 8; ++k)
+        {
+            m[j] += inva[j*8 + k]*b[k];
+        }
+    }
     homo[0][0] = m[0];
     homo[0][1] = m[1];
     homo[0][2] = m[2];
@@ -609,44 +535,25 @@ int32_t getHomographyFromPoints(double *points2d1,
     homo[2][1] = m[7];
     homo[2][2] = 1.0;
     
-    
     return 1;
 }
 
+int32_t getHomographyFromPoints(double *points2d1,
+                                double *points2d2, int32_t num_pts_plane, double homo[3][3])
+{
+    const double origin[2] = {0.0, 0.0};
+    return homography_least_squares(points2d1, points2d2, num_pts_plane, origin, origin, homo);
+}
+
 
-int32_t getHomographyFromPointsNormalize(double *points2d1,
-                                         double *points2d2, int32_t num_pts_plane, double homo[3][3])
+/**
+ \brief getHomographyFromPointsNormalize without allocation
+*/
+static int32_t homography_normalize(const double *points2d1,
+                                    const double *points2d2, int32_t num_pts_plane, double homo[3][3])
 {
-    double *r, *rt, *l;
-    double  a[64], inva[64], b[8], m[8];
-    double ipoint[2];
-    double ipoint1[2];
     double p10[2], p20[2];
-    int32_t i, k;
-    
-    r = (double *)malloc(sizeof(double)*num_pts_plane*16);
-    if (r == NULL)
-    {
-        SAFE_PRINTF(512, "getHomographyFromPointsNormalize() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
-        return 0;
-    }
-    
-    rt = (double *)malloc(sizeof(double)*num_pts_plane*16);
-    if (rt == NULL)
-    {
-        free(r);
-        SAFE_PRINTF(512, "getHomographyFromPointsNormalize() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
-        return 0;
-    }
-    
-    l = (double *)malloc(sizeof(double)*num_pts_plane*2);
-    if (l == NULL)
-    {
-        free(r);
-        free(rt);
-        SAFE_PRINTF(512, "getHomographyFromPointsNormalize() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
-        return 0;
-    }
+    int32_t i;
     
     p10[0] = 0;
     p10[1] = 0;
@@ -663,246 +570,343 @@ int32_t getHomographyFromPointsNormalize(double *points2d1,
     p10[1] = p10[1]/num_pts_plane;
     p20[0] = p20[0]/num_pts_plane;
     p20[1] = p20[1]/num_pts_plane;
-  
-    for(i = 0,k = 0; i < num_pts_plane; ++i)
-    {
-        ipoint[0] = points2d1[i*2+0] - p10[0];
-        ipoint[1] = points2d1[i*2+1] - p10[1];
-        ipoint1[0] = points2d2[i*2+0] - p20[0];
-        ipoint1[1] = points2d2[i*2+1] - p20[1];
-        r[k*16 + 0] = (double)ipoint[0];
-        r[k*16 + 1] = (double)ipoint[1];
-        r[k*16 + 2] = 1.0;
-        r[k*16 + 3] = 0.0;
-        r[k*16 + 4] = 0.0;
-        r[k*16 + 5] = 0.0;
-        r[k*16 + 6] = (double)(-ipoint[0]*ipoint1[0]);
-        r[k*16 + 7] = (double)(-ipoint1[0]*ipoint[1]);
-        l[i*2 +0] = (double)ipoint1[0];
-        r[k*16 + 8] = 0.0;
-        r[k*16 + 9] = 0.0;
-        r[k*16 + 10] = 0.0;
-        r[k*16 + 11] = (double)ipoint[0];
-        r[k*16 + 12] = (double)ipoint[1];
-        r[k*16 + 13] = 1.0;
-        r[k*16 + 14] = (double)(-ipoint[0]*ipoint1[1]);
-        r[k*16 + 15] = (double)(-ipoint[1]*ipoint1[1]);
-        l[i*2 +1] = (double)ipoint1[1];
-        k++;
-    }
-    TransposeMatrixD(r, rt, num_pts_plane*2, 8);
-    LinearTransformD(rt, r, a, 8, num_pts_plane*2, 8);
-    LinearTransformD(rt, l, b, 8, num_pts_plane*2, 1);
     
-    if(InvertMatrixD(a, inva, 8, 8) == 0)
+    if(homography_least_squares(points2d1, points2d2, num_pts_plane, p10, p20, homo) == 0)
     {
-        free(r);
-        free(rt);
-        free(l);
         return (0);
     }
     
-    LinearTransformD(inva, b, m, 8, 8, 1);
-    homo[0][0] = m[0];
-    homo[0][1] = m[1];
-    homo[0][2] = m[2];
-    
-    homo[1][0] = m[3];
-    homo[1][1] = m[4];
-    homo[1][2] = m[5];
-    
-    homo[2][0] = m[6];
-    homo[2][1] = m[7];
-    homo[2][2] = 1.0;
-    
-    
     p10[0] = -p10[0];
     p10[1] = -p10[1];
     p20[0] = -p20[0];
     p20[1] = -p20[1];
     ShiftHomographyOrigin(homo, p10, p20);
     
-    free(r);
-    free(rt);
-    free(l);
     return 1;
 }
 
+int32_t getHomographyFromPointsNormalize(double *points2d1,
+                                         double *points2d2, int32_t num_pts_plane, double homo[3][3])
+{
+    return homography_normalize(points2d1, points2d2, num_pts_plane, homo);
+}
 
-int32_t getHomographyFromPoints_RANSAC_frame(double *prefeature, double *curfeature, int32_t num_features, double h[3][3], double tol)
+
+void ransac_rng_seed(RansacRng *rng, uint64_t seed)
+{
+    rng->state = seed;
+}
+
+uint32_t ransac_rng_uniform(RansacRng *rng, uint32_t n)
+{
+    return splitmix64_uniform(&rng->state, n);
+}
+
+void ransac_default_options(RansacOptions *options, double tol, RansacRng *rng)
+{
+    options->tol = tol;
+    options->max_iterations = RANSAC_MAX_ITERATIONS;
+    options->confidence = RANSAC_DEFAULT_CONFIDENCE;
+    options->scores = NULL;
+    options->rng = rng;
+    options->scratch = NULL;
+}
+
+void ransac_frame_options(RansacOptions *options, double tol)
+{
+    ransac_default_options(options, tol, NULL);
+    options->confidence = 0.0;
+}
+
+// Samples and inliers of both images and the PROSAC ordered points
+#define RANSAC_SCRATCH_PER_POINT (4 + 4)
+
+bool ransac_scratch_reserve(RansacScratch *scratch, int32_t num_features)
+{
+    if (num_features <= scratch->capacity) return true;
+    free(scratch->points);
+    free(scratch->ranks);
+    scratch->points = (double *)malloc(sizeof(double)*num_features*RANSAC_SCRATCH_PER_POINT);
+    scratch->ranks = (RansacRank *)malloc(sizeof(RansacRank)*num_features);
+    if (scratch->points == NULL || scratch->ranks == NULL)
+    {
+        SAFE_PRINTF(512, "ransac_scratch_reserve() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        ransac_scratch_free(scratch);
+        return false;
+    }
+    scratch->capacity = num_features;
+    return true;
+}
+
+size_t ransac_scratch_bytes(const RansacScratch *scratch)
+{
+    return (sizeof(double)*RANSAC_SCRATCH_PER_POINT + sizeof(RansacRank))*(size_t)scratch->capacity;
+}
+
+void ransac_scratch_free(RansacScratch *scratch)
+{
+    free(scratch->points);
+    free(scratch->ranks);
+    scratch->points = NULL;
+    scratch->ranks = NULL;
+    scratch->capacity = 0;
+}
+
+/**
+ \brief Samples needed to draw one all-inlier sample of 4 with the given confidence
+*/
+static int32_t ransac_needed_iterations(int32_t num_inliers, int32_t num_features, double confidence, int32_t max_iterations)
+{
+    if (confidence <= 0.0 || confidence >= 1.0 || num_inliers <= 0) return max_iterations;
+    double w = (double)num_inliers/num_features;
+    double all_inliers = w*w*w*w;
+    if (all_inliers >= 1.0) return 1;
+    double needed = ceil(log(1.0 - confidence)/log(1.0 - all_inliers));
+    if (!(needed < max_iterations)) return max_iterations;
+    return needed < 1.0 ? 1 : (int32_t)needed;
+}
+
+/**
+ \brief Count the correspondences within tol of h, and copy them to inliers1 and inliers2 if not NULL
+*/
+static int32_t homography_inliers(const double *prefeature, const double *curfeature, int32_t num_features, double h[3][3],
+                                  double tol, double *inliers1, double *inliers2)
 {
     double d[3], d3[3];
-    double  s;
-    int32_t i, j, k, bestk, nm, index[9], p1, flag;
+    double s;
+    int32_t i, k;
+    for(i = 0, k = 0; i < num_features; ++i)
+    {
+        d[0] = prefeature[i*2+0];
+        d[1] = prefeature[i*2+1];
+        d[2] = 1.0;
+        mult331(h, d, d3);
+        d3[0] = d3[0]/d3[2];
+        d3[1] = d3[1]/d3[2];
+        d3[0] -= curfeature[i*2+0];
+        d3[1] -= curfeature[i*2+1];
+        s = sqrt(d3[0]*d3[0] + d3[1]*d3[1]);
+        if(s < tol)
+        {
+            if(inliers1 != NULL)
+            {
+                inliers1[k*2+0] = prefeature[i*2+0];
+                inliers1[k*2+1] = prefeature[i*2+1];
+                inliers2[k*2+0] = curfeature[i*2+0];
+                inliers2[k*2+1] = curfeature[i*2+1];
+            }
+            k++;
+        }
+    }
+    return k;
+}
+
+/**
+ \brief Order correspondences by decreasing score, ties by index
+*/
+static int compare_ransac_rank(const void *a, const void *b)
+{
+    const RansacRank *ra = (const RansacRank *)a;
+    const RansacRank *rb = (const RansacRank *)b;
+    if(ra->score != rb->score) return (ra->score > rb->score) ? -1 : 1;
+    return (ra->index > rb->index) - (ra->index < rb->index);
+}
+
+/**
+ \brief Draw distinct indices, index[first..3] from [0, n), from rand() if rng is NULL
+*/
+static void ransac_draw(RansacRng *rng, int32_t n, int32_t first, int32_t index[4])
+{
+    int32_t nm = first;
+    while(nm < 4)
+    {
+        int32_t p1 = (rng != NULL) ? (int32_t)ransac_rng_uniform(rng, (uint32_t)n) : (int32_t)(rand()%n);
+        int32_t flag = 1;
+        for(int32_t i = 0; i < nm; ++i)
+        {
+            if(index[i] == p1)
+                flag = 0;
+        }
+        if(flag == 1)
+        {
+            index[nm++] = p1;
+        }
+    }
+}
+
+static int32_t ransac_homography(const double *prefeature, const double *curfeature, int32_t num_features,
+                                 double h[3][3], const RansacOptions *options)
+{
+    int32_t i, j, k, bestk, iter;
+    int32_t index[4];
     double besthomo[3][3];
-    double *features1, *features2;
     double homo_loc[3][3];
-    double min_offset;
     double px_norm, py_norm, norm_ratio; //this is for test the correcness of homography;
-    int32_t iter;
-    min_offset = tol;
-    //int32_t heap_ok;
-    //normalize the data
-    //num_features = 9;
-    //convert to image coordinate system
+    double min_offset = options->tol;
+    
     if(num_features < 5)
     {
-        SAFE_PRINTF(512, "getHomographyFromPoints_RANSAC_frame() ==>> too few points to be used for ransac method here, , %s, %d\n", __FILE__, __LINE__);
+        SAFE_PRINTF(512, "getHomographyFromPoints_RANSAC_ctx() ==>> too few points to be used for ransac method here, , %s, %d\n", __FILE__, __LINE__);
         return -1;
     }
     
-    //heap_ok = check_for_heap_integrity(__FILE__, __LINE__);
-    
-    //add checking for return NULL
-    features1 = (double *)malloc(sizeof(double)*num_features*2);
-    if (features1 == NULL)
+    RansacScratch local_scratch = {0};
+    RansacScratch *scratch = (options->scratch != NULL) ? options->scratch : &local_scratch;
+    if(!ransac_scratch_reserve(scratch, num_features))
     {
-        SAFE_PRINTF(512, "getHomographyFromPoints_RANSAC_frame() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
         return -1;
     }
+    double *features1 = scratch->points;
+    double *features2 = features1 + num_features*2;
     
-    features2 = (double *)malloc(sizeof(double)*num_features*2);
-    if (features2 == NULL)
+    // PROSAC draws the samples from the best scored correspondences first
+    const double *sample1 = prefeature;
+    const double *sample2 = curfeature;
+    bool prosac = options->scores != NULL && options->rng != NULL;
+    if(prosac)
     {
-        free(features1);
-        SAFE_PRINTF(512, "getHomographyFromPoints_RANSAC_frame() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
-        return -1;
+        double *ordered1 = features2 + num_features*2;
+        double *ordered2 = ordered1 + num_features*2;
+        for(i = 0; i < num_features; ++i)
+        {
+            scratch->ranks[i].score = options->scores[i];
+            scratch->ranks[i].index = i;
+        }
+        qsort(scratch->ranks, num_features, sizeof(RansacRank), compare_ransac_rank);
+        for(i = 0; i < num_features; ++i)
+        {
+            int32_t p1 = scratch->ranks[i].index;
+            ordered1[i*2+0] = prefeature[p1*2+0];
+            ordered1[i*2+1] = prefeature[p1*2+1];
+            ordered2[i*2+0] = curfeature[p1*2+0];
+            ordered2[i*2+1] = curfeature[p1*2+1];
+        }
+        sample1 = ordered1;
+        sample2 = ordered2;
     }
     
+    // Growth function of the PROSAC sampling set (Chum and Matas, CVPR 2005)
+    int32_t subset = 4;
+    double subset_samples = options->max_iterations;
+    for(i = 0; i < 4; ++i)
+    {
+        subset_samples *= (double)(4 - i)/(num_features - i);
+    }
+    int32_t subset_grows_at = 1;
     
+    int32_t iterations = options->max_iterations;
     bestk = 0;
-    for(j = 0; j < RANSAC_MAX_ITERATIONS; ++j)
+    for(j = 0; j < iterations; ++j)
     {
-        nm = 0;
-        while(nm < 4)
+        if(prosac)
         {
-            p1 = (int32_t)(rand()%num_features);
-            flag = 1;
-            
-            for(i = 0; i < nm; ++i)
+            while(subset < num_features && j + 1 >= subset_grows_at)
             {
-                if(index[i] == p1)
-                    flag = 0;
+                double next_samples = subset_samples*(subset + 1)/(subset + 1 - 4);
+                subset_grows_at += (int32_t)ceil(next_samples - subset_samples);
+                subset_samples = next_samples;
+                subset++;
             }
-            
-            if(flag == 1)
+            if(j + 1 <= subset_grows_at)
             {
-                features1[nm*2+0] = prefeature[p1*2+0];
-                features1[nm*2+1] = prefeature[p1*2+1];
-                features2[nm*2+0] = curfeature[p1*2+0];
-                features2[nm*2+1] = curfeature[p1*2+1];
-                index[nm] = p1;
-                nm++;
-            }
-        }
-        //pfc=0
-        if(getHomographyFromPointsNormalize(features1, features2, 4,  homo_loc) != 0)
-        {
-            px_norm = sqrt(homo_loc[0][0]*homo_loc[0][0] + homo_loc[0][1]*homo_loc[0][1]);
-            py_norm = sqrt(homo_loc[1][0]*homo_loc[1][0] + homo_loc[1][1]*homo_loc[1][1]);
-            if(px_norm > py_norm)
-            {
-                norm_ratio = py_norm/px_norm;
+                // The newest correspondence and 3 better ones
+                index[0] = subset - 1;
+                ransac_draw(options->rng, subset - 1, 1, index);
             }
             else
             {
-                norm_ratio = px_norm/py_norm;
-            }
-            if(norm_ratio > 0.3)
-            {
-                for(i = 0, k= 0; i < num_features; ++i)
-                {
-                    d[0] = prefeature[i*2+0];
-                    d[1] = prefeature[i*2+1];
-                    d[2] = 1.0;
-                    mult331(homo_loc, d, d3);
-                    d3[0] = d3[0]/d3[2];
-                    d3[1] = d3[1]/d3[2];
-                    d[0] = curfeature[i*2+0];
-                    d[1] = curfeature[i*2+1];
-                    d[2] = 1.0;
-                    d3[0] -=d[0];
-                    d3[1] -=d[1];
-                    s = sqrt(d3[0]*d3[0] + d3[1] *d3[1]);
-                    if(s < min_offset)
-                    {
-                        k++;
-                    }
-                }
-                
-                if(k > bestk)
-                {
-                    copy33(homo_loc, besthomo);
-                    //printf("besthomo\n");
-                    // prt33(besthomo);
-                    bestk = k;
-                }
+                ransac_draw(options->rng, subset, 0, index);
             }
         }
         else
         {
-            free(features1);
-            free(features2);
-            SAFE_PRINTF(512, "getHomographyFromPoints_RANSAC_frame() ==>> getHomographyFromPointsNormalize() failed, %s, %d\n", __FILE__, __LINE__);
+            ransac_draw(options->rng, num_features, 0, index);
+        }
+        for(i = 0; i < 4; ++i)
+        {
+            features1[i*2+0] = sample1[index[i]*2+0];
+            features1[i*2+1] = sample1[index[i]*2+1];
+            features2[i*2+0] = sample2[index[i]*2+0];
+            features2[i*2+1] = sample2[index[i]*2+1];
+        }
+        
+        // Degenerate samples, such as collinear points, have no homography. Without a generator they end the
+        // estimate, as they always have with rand()
+        if(homography_normalize(features1, features2, 4, homo_loc) == 0)
+        {
+            if(options->rng != NULL) continue;
+            ransac_scratch_free(&local_scratch);
+            SAFE_PRINTF(512, "getHomographyFromPoints_RANSAC_ctx() ==>> getHomographyFromPointsNormalize() failed, %s, %d\n", __FILE__, __LINE__);
             return -1;
         }
+        px_norm = sqrt(homo_loc[0][0]*homo_loc[0][0] + homo_loc[0][1]*homo_loc[0][1]);
+        py_norm = sqrt(homo_loc[1][0]*homo_loc[1][0] + homo_loc[1][1]*homo_loc[1][1]);
+        if(px_norm > py_norm)
+        {
+            norm_ratio = py_norm/px_norm;
+        }
+        else
+        {
+            norm_ratio = px_norm/py_norm;
+        }
+        if(norm_ratio > 0.3)
+        {
+            k = homography_inliers(prefeature, curfeature, num_features, homo_loc, min_offset, NULL, NULL);
+            if(k > bestk)
+            {
+                copy33(homo_loc, besthomo);
+                bestk = k;
+                int32_t needed = ransac_needed_iterations(bestk, num_features, options->confidence, options->max_iterations);
+                if(needed < iterations) iterations = needed;
+            }
+        }
     }
     
+    k = bestk;
     if(bestk > 10)
     {
         for(iter = 0; iter < 3; ++iter)
         {
-            for(i = 0, k= 0; i < num_features; ++i)
-            {
-                d[0] = prefeature[i*2+0];
-                d[1] = prefeature[i*2+1];
-                d[2] = 1.0;
-                mult331(besthomo, d, d3);
-                d3[0] = d3[0]/d3[2];
-                d3[1] = d3[1]/d3[2];
-                d[0] = curfeature[i*2+0];
-                d[1] = curfeature[i*2+1];
-                d[2] = 1.0;
-                d3[0] -=d[0];
-                d3[1] -=d[1];
-                s = sqrt(d3[0]*d3[0] + d3[1] *d3[1]);
-                if(s < min_offset)
-                {
-                    features1[k*2+0] = prefeature[i*2+0];
-                    features1[k*2+1] = prefeature[i*2+1];
-                    features2[k*2+0] = curfeature[i*2+0];
-                    features2[k*2+1] = curfeature[i*2+1];
-                    k++;
-                }
-            }
-            if(getHomographyFromPointsNormalize(features1, features2, k,  h) == 0)
+            k = homography_inliers(prefeature, curfeature, num_features, besthomo, min_offset, features1, features2);
+            if(homography_normalize(features1, features2, k, h) == 0)
             {
-                free(features1);
-                free(features2);
-                SAFE_PRINTF(512, "getHomographyFromPoints_RANSAC_frame() ==>> getHomographyFromPointsNormalize() failed, %s, %d\n", __FILE__, __LINE__);
+                ransac_scratch_free(&local_scratch);
+                SAFE_PRINTF(512, "getHomographyFromPoints_RANSAC_ctx() ==>> getHomographyFromPointsNormalize() failed, %s, %d\n", __FILE__, __LINE__);
                 return -1;
             }
             
             copy33(h, besthomo);
         }
     }
+    else if(bestk >= 4)
+    {
+        copy33(besthomo, h);
+    }
+    ransac_scratch_free(&local_scratch);
     
-    //heap_ok = check_for_heap_integrity(__FILE__, __LINE__);
-    
-    // to compute the epipole on both images
     if(k >= 4)
     {
-        free(features1);
-        free(features2);
-        SAFE_PRINTF(128, "best feat for homography %d\n", k);
+        log_message(LOG_LEVEL_DEBUG, "best feat for homography %d", k);
         return k;
     }
-    else
-    {
-        free(features1);
-        free(features2);
-        return -1;
-    }
+    return -1;
+}
+
+int32_t getHomographyFromPoints_RANSAC_ctx(const double *prefeature, const double *curfeature, int32_t num_features,
+                                           double h[3][3], const RansacOptions *options)
+{
+    PERF_PHASE_BEGIN(timer, PERF_RANSAC);
+    int32_t num_inliers = ransac_homography(prefeature, curfeature, num_features, h, options);
+    PERF_PHASE_END(timer);
+    if(num_inliers >= 0) PERF_COUNT(PERF_RANSAC_OUTLIERS, num_features - num_inliers);
+    return num_inliers;
+}
+
+int32_t getHomographyFromPoints_RANSAC_frame(double *prefeature, double *curfeature, int32_t num_features, double h[3][3], double tol)
+{
+    RansacOptions options;
+    ransac_frame_options(&options, tol);
+    return getHomographyFromPoints_RANSAC_ctx(prefeature, curfeature, num_features, h, &options);
 }
 
 
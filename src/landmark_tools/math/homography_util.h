@@ -21,6 +21,7 @@
 #ifndef _LANDMARK_TOOLS_HOMOGRAPHY_UTIL_H_
 #define _LANDMARK_TOOLS_HOMOGRAPHY_UTIL_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #ifdef __cplusplus
@@ -51,6 +52,104 @@ int32_t  getHomographyFromPoints_RANSAC(double *points2d1,
 int32_t  getHomographyFromPoints_RANSAC_frame(double *points2d1, 
 					   double *points2d2, int32_t num_pts_plane, double homo[3][3], double tol);
 
+#define RANSAC_MAX_ITERATIONS 200       /*!< \brief Default upper bound on the number of RANSAC samples */
+#define RANSAC_DEFAULT_CONFIDENCE 0.99   /*!< \brief Probability of drawing one all-inlier sample before stopping */
+
+/**
+ \brief State of the splitmix64 generator (see splitmix.h) of one RANSAC caller
+*/
+typedef struct {
+    uint64_t state;
+} RansacRng;
+
+/**
+ \brief Rank of one correspondence in the PROSAC order
+*/
+typedef struct {
+    double score;
+    int32_t index;
+} RansacRank;
+
+/**
+ \brief Scratch memory of getHomographyFromPoints_RANSAC_ctx, reused across calls
+
+ Zero-initialize before the first `ransac_scratch_reserve`.
+*/
+typedef struct {
+    int32_t capacity;            /*!< \brief Correspondences the buffers hold */
+    double *points;              /*!< \brief Samples, inliers and least squares scratch */
+    RansacRank *ranks;           /*!< \brief PROSAC order */
+} RansacScratch;
+
+/**
+ \brief Settings of getHomographyFromPoints_RANSAC_ctx
+*/
+typedef struct {
+    double tol;                  /*!< \brief Inlier reprojection distance in pixels */
+    int32_t max_iterations;      /*!< \brief Upper bound on the number of samples */
+    double confidence;           /*!< \brief Stop once an all-inlier sample was drawn with this probability. 0 to draw `max_iterations` samples */
+    const double *scores;        /*!< \brief Quality of each correspondence, higher is better. If not NULL, samples are drawn in PROSAC order */
+    RansacRng *rng;              /*!< \brief Random number generator of the caller. If NULL, the samples are drawn from rand()
+                                      in the order getHomographyFromPoints_RANSAC_frame has always drawn them, `scores`
+                                      is ignored and a degenerate sample fails the estimate */
+    RansacScratch *scratch;      /*!< \brief Scratch memory, or NULL to allocate per call */
+} RansacOptions;
+
+/**
+ \brief Seed a random number generator. The same seed draws the same samples
+*/
+void ransac_rng_seed(RansacRng *rng, uint64_t seed);
+
+/**
+ \brief Uniform random integer in [0, n)
+*/
+uint32_t ransac_rng_uniform(RansacRng *rng, uint32_t n);
+
+/**
+ \brief Options of a seeded estimate: `RANSAC_MAX_ITERATIONS` samples at most from `rng`, adaptive stopping with
+ `RANSAC_DEFAULT_CONFIDENCE`, uniform sampling and scratch memory allocated per call
+*/
+void ransac_default_options(RansacOptions *options, double tol, RansacRng *rng);
+
+/**
+ \brief Options matching getHomographyFromPoints_RANSAC_frame: `RANSAC_MAX_ITERATIONS` samples from rand(), uniform
+ sampling and scratch memory allocated per call. For the same srand() the result is that of earlier versions
+*/
+void ransac_frame_options(RansacOptions *options, double tol);
+
+/**
+ \brief Grow scratch memory to hold num_features correspondences
+ \return false if memory allocation fails
+*/
+bool ransac_scratch_reserve(RansacScratch *scratch, int32_t num_features);
+
+/**
+ \brief Bytes of memory held by a RansacScratch
+*/
+size_t ransac_scratch_bytes(const RansacScratch *scratch);
+
+/**
+ \brief Release the memory of a RansacScratch
+*/
+void ransac_scratch_free(RansacScratch *scratch);
+
+/**
+ \brief Reentrant getHomographyFromPoints_RANSAC_frame
+
+ Unless `confidence` is 0, samples stop once the best hypothesis so far makes another all-inlier sample unlikely
+ to improve on it, which takes a few samples when most correspondences are inliers. Degenerate samples drawn from
+ `rng` are skipped.
+
+ \param[in] prefeature Feature (x,y) coordinates in the first image
+ \param[in] curfeature Matching (x,y) coordinates in the second image
+ \param[in] num_features Number of correspondences, at least 5
+ \param[out] h Homography from the first image to the second. Set whenever the return value is not -1
+ \param[in] options Settings, see RansacOptions
+ \return number of inliers of h, or -1 on error or if no sample had 4 inliers
+*/
+int32_t getHomographyFromPoints_RANSAC_ctx(const double *prefeature, const double *curfeature, int32_t num_features,
+                                           double h[3][3], const RansacOptions *options);
+
 /**
  \brief Calculate the homography from point correspondences using the method of 
  Homography construction from Juyang Weng's paper IEEE SP Vol. 39 Np 12 Dec 1991
@@ -69,8 +168,64 @@ bool getHomographyFromPoints_Eigenvalue(double *prefeatures, double *curfeatures
 
 int32_t ShiftHomographyOrigin(double homo[3][3], double p10[2], double p20[2]);
 
+/**
+ \brief Warp an image with a homography from output pixels to input pixels, on all processors
+ 
+ Pixels that map outside the interior of the input image are 0.
+ \param[in] homo homography from `outimg` pixel (col, row) to `in_img` pixel
+ \param[in] in_img `cols` x `rows` image
+ \param[in] cols
+ \param[in] rows
+ \param[out] outimg `cols2` x `rows2` image
+ \param[in] cols2
+ \param[in] rows2
+ \return 1 on success, 0 if memory allocation fails
+ */
 int32_t transferImage(double homo[3][3], uint8_t *in_img, int32_t cols, int32_t rows, uint8_t *outimg, int32_t cols2, int32_t rows2);
 
+/**
+ \brief `transferImage` of an image and of its NAN mask in one pass
+ 
+ `outmask` is the NAN mask obtained by warping the 255 or 0 image of the valid pixels of `in_mask` with
+ `transferImage` and marking its 0 pixels: it is 1 where the output pixel maps outside the input or mostly onto NAN
+ input pixels.
+ \param[in] homo homography from `outimg` pixel (col, row) to `in_img` pixel
+ \param[in] in_img `cols` x `rows` image
+ \param[in] in_mask `cols` x `rows` mask, non-zero for NAN pixels
+ \param[in] cols
+ \param[in] rows
+ \param[out] outimg `cols2` x `rows2` image
+ \param[out] outmask `cols2` x `rows2` mask, 1 for NAN pixels
+ \param[in] cols2
+ \param[in] rows2
+ \return 1 on success, 0 if memory allocation fails
+ */
+int32_t transferImageMask(double homo[3][3], uint8_t *in_img, uint8_t *in_mask, int32_t cols, int32_t rows,
+                          uint8_t *outimg, uint8_t *outmask, int32_t cols2, int32_t rows2);
+
+/**
+ \brief `transferImageMask` of a window of the output image only
+
+ The pixels are those of the full output image at (`left` + col, `top` + row), so warping an image window by window
+ gives the same pixels as `transferImageMask`.
+ \param[in] homo homography from output pixel (col, row) to `in_img` pixel
+ \param[in] in_img `cols` x `rows` image
+ \param[in] in_mask `cols` x `rows` mask, non-zero for NAN pixels
+ \param[in] cols
+ \param[in] rows
+ \param[out] outimg `cols2` x `rows2` window
+ \param[out] outmask `cols2` x `rows2` mask of the window, 1 for NAN pixels
+ \param[in] left output column of the first window column
+ \param[in] top output row of the first window row
+ \param[in] cols2
+ \param[in] rows2
+ \param[in] num_threads threads warping the rows, 0 for `parallel_num_threads()`
+ \return 1 on success, 0 if memory allocation fails
+ */
+int32_t transferImageMaskWindow(double homo[3][3], uint8_t *in_img, uint8_t *in_mask, int32_t cols, int32_t rows,
+                                uint8_t *outimg, uint8_t *outmask, int32_t left, int32_t top, int32_t cols2,
+                                int32_t rows2, int32_t num_threads);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
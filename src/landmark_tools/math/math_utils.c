@@ -18,10 +18,10 @@
 #include <stdio.h>                               // for printf, NULL
 
 #include <gsl/gsl_linalg.h>
-#include <gsl/gsl_eigen.h>
 #include <gsl/gsl_matrix.h>
 #include <gsl/gsl_vector.h>
 
+#include "landmark_tools/math/fixed_matrix.h"    // for fixed_jacobi
 #include "landmark_tools/math/math_constants.h"  // for PI
 #include "landmark_tools/math/math_utils.h"
 #include "math/mat3/mat3.h"                      // for mult333, zero33, copy33
@@ -85,148 +85,61 @@ double trace33(double a[3][3])
 
 bool svd33(double a[3][3], double s[3], double v[3][3])
 {
-    // Allocate gsl_matrix for input matrix `A`
-    gsl_matrix *A = gsl_matrix_alloc(3, 3);
-    if (A == NULL) {
-        fprintf(stderr, "Error: Could not allocate memory for matrix A\n");
-        return false;
-    }
+    // The gsl matrices are views of stack arrays, so the decomposition allocates no memory
+    double a_data[9], v_data[9], s_data[3], work_data[3];
     for (size_t i = 0; i < 3; i++) {
        for (size_t j = 0; j < 3; j++) {
-           gsl_matrix_set(A, i, j, a[i][j]);
+           a_data[i*3 + j] = a[i][j];
        }
     }
-
-    // Allocate memory for the singular value decomposition components
-    gsl_matrix *V = gsl_matrix_alloc(3, 3);
-    gsl_vector *S = gsl_vector_alloc(3);
-    gsl_vector *work = gsl_vector_alloc(3);
-    if (V == NULL || S == NULL || work == NULL) {
-        fprintf(stderr, "Error: Could not allocate memory for gsl matrix\n");
-        if(A != NULL)
-            gsl_matrix_free(A);
-        if(V != NULL)
-            gsl_matrix_free(V);
-        if(S != NULL)
-            gsl_vector_free(S);
-        if(work != NULL)
-            gsl_vector_free(work);
-        return false;
-    }
+    gsl_matrix_view A = gsl_matrix_view_array(a_data, 3, 3);
+    gsl_matrix_view V = gsl_matrix_view_array(v_data, 3, 3);
+    gsl_vector_view S = gsl_vector_view_array(s_data, 3);
+    gsl_vector_view work = gsl_vector_view_array(work_data, 3);
 
     // Perform the Singular Value Decomposition (SVD)
-    int status = gsl_linalg_SV_decomp(A, V, S, work);
+    int status = gsl_linalg_SV_decomp(&A.matrix, &V.matrix, &S.vector, &work.vector);
     if (status != GSL_SUCCESS) {
         fprintf(stderr, "Error: SVD decomposition failed\n");
-        if(A != NULL)
-            gsl_matrix_free(A);
-        if(V != NULL)
-            gsl_matrix_free(V);
-        if(S != NULL)
-            gsl_vector_free(S);
-        if(work != NULL)
-            gsl_vector_free(work);
         return false;
     }
 
     // Extract the singular values
     for (size_t i = 0; i < 3; i++) {
-        s[i] = gsl_vector_get(S, i);
+        s[i] = gsl_vector_get(&S.vector, i);
     }
 
     // Extract the left singular vectors (U stored in `A`) and right singular vectors (`V`)
     for (size_t i = 0; i < 3; i++) {
        for (size_t j = 0; j < 3; j++) {
-           a[i][j] = gsl_matrix_get(A, i, j);
-           v[i][j] = gsl_matrix_get(V, i, j);
+           a[i][j] = gsl_matrix_get(&A.matrix, i, j);
+           v[i][j] = gsl_matrix_get(&V.matrix, i, j);
        }
     }
-
-    // Free allocated memory
-    if(A != NULL)
-        gsl_matrix_free(A);
-    if(V != NULL)
-        gsl_matrix_free(V);
-    if(S != NULL)
-        gsl_vector_free(S);
-    if(work != NULL)
-        gsl_vector_free(work);
-    
     return true;
 }
 
 
 bool jacobi33(double a[3][3], double w[3], double v[3][3])
 {
-    // Allocate gsl_matrix for the input matrix `a`
-    gsl_matrix *A_gsl = gsl_matrix_alloc(3, 3);
-    if (A_gsl == NULL) {
-        fprintf(stderr, "Error: Could not allocate memory for matrix A_gsl\n");
-        return false;
-    }
+    // Jacobi rotations on a stack copy, so nothing is allocated
+    double a_data[9], v_data[9];
     for (size_t i = 0; i < 3; i++) {
         for (size_t j = 0; j < 3; j++) {
-            gsl_matrix_set(A_gsl, i, j, a[i][j]);
+            a_data[i*3 + j] = a[i][j];
         }
     }
-
-    // Allocate gsl_vector for the eigenvalues
-    gsl_vector *eigenvalues = gsl_vector_alloc(3);
-    gsl_matrix *eigenvectors = gsl_matrix_alloc(3, 3);
-    gsl_eigen_symmv_workspace *workspace = gsl_eigen_symmv_alloc(3);
-    
-    if (eigenvalues == NULL || eigenvectors == NULL || workspace == NULL) {
-        fprintf(stderr, "Error: Could not allocate memory for gsl operation\n");
-        if(workspace != NULL)
-            gsl_eigen_symmv_free(workspace);
-        if(A_gsl != NULL)
-            gsl_matrix_free(A_gsl);
-        if(eigenvalues != NULL)
-            gsl_vector_free(eigenvalues);
-        if(eigenvectors != NULL)
-            gsl_matrix_free(eigenvectors);
-        return false;
-    }
-
-    // Perform eigenvalue and eigenvector computation
-    int status = gsl_eigen_symmv(A_gsl, eigenvalues, eigenvectors, workspace);
-    if (status != GSL_SUCCESS) {
+    if (!fixed_jacobi(a_data, w, v_data, 3)) {
         fprintf(stderr, "Error: Eigenvalue/eigenvector computation failed\n");
-        if(workspace != NULL)
-            gsl_eigen_symmv_free(workspace);
-        if(A_gsl != NULL)
-            gsl_matrix_free(A_gsl);
-        if(eigenvalues != NULL)
-            gsl_vector_free(eigenvalues);
-        if(eigenvectors != NULL)
-            gsl_matrix_free(eigenvectors);
         return false;
     }
 
-    // Optionally sort the eigenvalues and eigenvectors
-    // gsl_eigen_symmv_sort(eigenvalues, eigenvectors, GSL_EIGEN_SORT_ABS_ASC);
-
-    // Copy the eigenvalues to `w`
-    for (size_t i = 0; i < 3; i++) {
-        w[i] = gsl_vector_get(eigenvalues, i);
-    }
-
     // Copy the eigenvectors to `v`
     for (size_t i = 0; i < 3; i++) {
         for (size_t j = 0; j < 3; j++) {
-            v[i][j] = gsl_matrix_get(eigenvectors, i, j);
+            v[i][j] = v_data[i*3 + j];
         }
     }
-
-    // Free allocated memory
-    if(workspace != NULL)
-        gsl_eigen_symmv_free(workspace);
-    if(A_gsl != NULL)
-        gsl_matrix_free(A_gsl);
-    if(eigenvalues != NULL)
-        gsl_vector_free(eigenvalues);
-    if(eigenvectors != NULL)
-        gsl_matrix_free(eigenvectors);
     return true;
 }
 
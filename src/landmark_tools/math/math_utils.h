@@ -92,10 +92,10 @@ double trace33(double a[3][3]);
 bool svd33(double a[3][3], double s[3], double v[3][3]);
 
 /**
- \brief
+ \brief Eigen decomposition of a symmetric matrix
  \param[in] a
- \param[out] w eigenvalues
- \param[out] v eigenvectors
+ \param[out] w eigenvalues, unsorted
+ \param[out] v eigenvectors, the one of `w[i]` in column i
  \return true on success
  \return false on error
  */
@@ -18,12 +18,22 @@
 
 #include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PC_RANSAC_AVX2
+#include <immintrin.h>
+#endif
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/parallel.h"
 #include "landmark_tools/utils/safe_string.h"
 
 #include "landmark_tools/math/math_constants.h"
 #include "landmark_tools/math/math_utils.h"
 #include "landmark_tools/math/point_line_plane_util.h"
+#include "landmark_tools/math/splitmix.h"
 #include "landmark_tools/math/double_matrix.h"
 #include "landmark_tools/math/math_utils.h"
 #include "math/mat3/mat3.h"
@@ -134,91 +144,329 @@ int32_t  Point_Clouds_rot_T(double *ptsA, double *ptsB, int32_t num_pts, double
     return 1;
 }
 
-#define PC_RANSAC_MAX_ITERATIONS 30
+#define PC_RANSAC_MAX_ITERATIONS 1000  // hypotheses drawn when the inlier ratio stays low
+#define PC_RANSAC_CONFIDENCE 0.999     // probability of drawing one all-inlier sample before stopping
+#define PC_RANSAC_ROUND 32             // hypotheses scored together between two checks of the stopping rule
+#define PC_RANSAC_BLOCK 512            // correspondences scored against every hypothesis of a round while in cache
+#define PC_RANSAC_MAX_THREADS 32
+#define PC_RANSAC_MIN_THREAD_PTS 4096  // correspondences per thread worth a thread
+
+/**
+ \brief Correspondences split by coordinate, so that scoring a hypothesis reads each coordinate as a contiguous array
+*/
+typedef struct {
+    int32_t num_pts;
+    double *ax, *ay, *az;
+    double *bx, *by, *bz;
+} PcPoints;
+
+/**
+ \brief Correspondences [first, end) with a squared distance below tol2 after the transformation
+*/
+static int32_t pc_count_inliers_scalar(const PcPoints *pts, int32_t first, int32_t end, double bRa[3][3],
+                                       const double T[3], double tol2)
+{
+    const double *ax = pts->ax, *ay = pts->ay, *az = pts->az;
+    const double *bx = pts->bx, *by = pts->by, *bz = pts->bz;
+    int32_t k = 0;
+    for(int32_t i = first; i < end; ++i)
+    {
+        double dx = bRa[0][0]*ax[i] + bRa[0][1]*ay[i] + bRa[0][2]*az[i] + T[0] - bx[i];
+        double dy = bRa[1][0]*ax[i] + bRa[1][1]*ay[i] + bRa[1][2]*az[i] + T[1] - by[i];
+        double dz = bRa[2][0]*ax[i] + bRa[2][1]*ay[i] + bRa[2][2]*az[i] + T[2] - bz[i];
+        k += (dx*dx + dy*dy + dz*dz) < tol2;
+    }
+    return k;
+}
+
+#ifdef PC_RANSAC_AVX2
+/**
+ \brief `pc_count_inliers_scalar` of 4 correspondences at a time, with the same operations in the same order
+*/
+__attribute__((target("avx2")))
+static int32_t pc_count_inliers_avx2(const PcPoints *pts, int32_t first, int32_t end, double bRa[3][3],
+                                     const double T[3], double tol2)
+{
+    __m256d r[3][3], t[3];
+    for(int32_t i = 0; i < 3; ++i)
+    {
+        for(int32_t j = 0; j < 3; ++j) r[i][j] = _mm256_set1_pd(bRa[i][j]);
+        t[i] = _mm256_set1_pd(T[i]);
+    }
+    const __m256d limit = _mm256_set1_pd(tol2);
+    __m256i count = _mm256_setzero_si256();
+    int32_t i = first;
+    for(; i + 4 <= end; i += 4)
+    {
+        __m256d ax = _mm256_loadu_pd(&pts->ax[i]);
+        __m256d ay = _mm256_loadu_pd(&pts->ay[i]);
+        __m256d az = _mm256_loadu_pd(&pts->az[i]);
+        const double *b[3] = {&pts->bx[i], &pts->by[i], &pts->bz[i]};
+        __m256d d2 = _mm256_setzero_pd();
+        for(int32_t row = 0; row < 3; ++row)
+        {
+            __m256d d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(r[row][0], ax), _mm256_mul_pd(r[row][1], ay)),
+                                      _mm256_mul_pd(r[row][2], az));
+            d = _mm256_sub_pd(_mm256_add_pd(d, t[row]), _mm256_loadu_pd(b[row]));
+            d2 = (row == 0) ? _mm256_mul_pd(d, d) : _mm256_add_pd(d2, _mm256_mul_pd(d, d));
+        }
+        // Lanes of the mask are -1 for inliers
+        count = _mm256_sub_epi64(count, _mm256_castpd_si256(_mm256_cmp_pd(d2, limit, _CMP_LT_OQ)));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, count);
+    return (int32_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + pc_count_inliers_scalar(pts, i, end, bRa, T, tol2);
+}
+#endif
+
+/**
+ \brief Hypotheses of one round and their inlier counts
+*/
+typedef struct {
+    const PcPoints *pts;
+    double tol2;                         // squared inlier distance, negative if no distance is small enough
+    bool use_avx2;
+    int32_t count;                       // hypotheses in the round
+    double bRa[PC_RANSAC_ROUND][3][3];
+    double T[PC_RANSAC_ROUND][3];
+    int32_t inliers[PC_RANSAC_ROUND];
+} PcRound;
+
+typedef struct {
+    const PcRound *round;
+    int32_t first;                       // correspondences of the thread
+    int32_t end;
+    int32_t inliers[PC_RANSAC_ROUND];    // inliers of each hypothesis among them
+} PcRoundThread;
+
+/**
+ \brief Score every hypothesis of a round on the correspondences of one thread
+
+ The correspondences are taken a block at a time, and the block is scored against all hypotheses while it is in
+ cache, so the point clouds are read once per round rather than once per hypothesis.
+*/
+static void *pc_round_thread(void *arg)
+{
+    PcRoundThread *thread = (PcRoundThread *)arg;
+    const PcRound *round = thread->round;
+    memset(thread->inliers, 0, sizeof(thread->inliers));
+    for(int32_t first = thread->first; first < thread->end; first += PC_RANSAC_BLOCK)
+    {
+        int32_t end = (thread->end - first < PC_RANSAC_BLOCK) ? thread->end : first + PC_RANSAC_BLOCK;
+        for(int32_t h = 0; h < round->count; ++h)
+        {
+            double (*bRa)[3] = (double (*)[3])round->bRa[h];
+#ifdef PC_RANSAC_AVX2
+            if(round->use_avx2)
+            {
+                thread->inliers[h] += pc_count_inliers_avx2(round->pts, first, end, bRa, round->T[h], round->tol2);
+                continue;
+            }
+#endif
+            thread->inliers[h] += pc_count_inliers_scalar(round->pts, first, end, bRa, round->T[h], round->tol2);
+        }
+    }
+    return NULL;
+}
+
+/**
+ \brief Transformation of hypothesis `h`, fit to 3 correspondences drawn from its own stream
+
+ The stream is seeded from the call seed and h only, so the hypotheses do not depend on the rounds or threads.
+*/
+static void pc_hypothesis(const double *ptsA, const double *ptsB, int32_t num_pts, uint64_t seed, int32_t h,
+                          double bRa[3][3], double T[3])
+{
+    uint64_t state = seed + (uint64_t)h * 0xD1B54A32D192ED03ULL;
+    state = splitmix64_next(&state);
+    double Am[9], Bm[9];
+    int32_t index[3];
+    int32_t nm = 0;
+    while(nm < 3)
+    {
+        int32_t p1 = (int32_t)splitmix64_uniform(&state, (uint32_t)num_pts);
+        int32_t flag = 1;
+        for(int32_t i = 0; i < nm; ++i)
+        {
+            if(index[i] == p1)
+                flag = 0;
+        }
+        if(flag == 1)
+        {
+            copy3(&ptsA[3*p1], &Am[nm*3]);
+            copy3(&ptsB[3*p1], &Bm[nm*3]);
+            index[nm] = p1;
+            nm++;
+        }
+    }
+    Point_Clouds_rot_T(Am, Bm, 3, bRa, T);
+}
+
+/**
+ \brief Hypotheses needed for PC_RANSAC_CONFIDENCE with the inlier ratio of the best hypothesis
+*/
+static int32_t pc_needed_iterations(int32_t num_inliers, int32_t num_pts)
+{
+    if (num_inliers <= 0) return PC_RANSAC_MAX_ITERATIONS;
+    double w = (double)num_inliers/num_pts;
+    double all_inliers = w*w*w;
+    if (all_inliers >= 1.0) return 1;
+    double needed = ceil(log(1.0 - PC_RANSAC_CONFIDENCE)/log(1.0 - all_inliers));
+    if (!(needed < PC_RANSAC_MAX_ITERATIONS)) return PC_RANSAC_MAX_ITERATIONS;
+    return needed < 1.0 ? 1 : (int32_t)needed;
+}
+
 int32_t  Point_Clouds_rot_T_RANSAC(double *ptsA, double *ptsB, int32_t num_pts, double bRa[3][3], double T[3], double tol)
 {
-    double Pam[3];
-    double Pbm[3];
-    double pa[3], pb[3];
-    double A[3][3];
-    double Aab[3][3];
-    double  Am[9], Bm[9], s;
-    double bRa_tmp[3][3], Ttmp[3];
-    double p[3];
-    double  n[3], bestT[3],  bestR[3][3];
-    double *ptsA_tmp;
-    double *ptsB_tmp;
-    
-    ptsA_tmp = (double *)malloc(sizeof(double)*num_pts*3);
-    if (ptsA_tmp == NULL)
+    return Point_Clouds_rot_T_RANSAC_seeded(ptsA, ptsB, num_pts, bRa, T, tol, splitmix64_seed_from_rand());
+}
+
+int32_t  Point_Clouds_rot_T_RANSAC_seeded(double *ptsA, double *ptsB, int32_t num_pts, double bRa[3][3], double T[3],
+                                          double tol, uint64_t seed)
+{
+    return Point_Clouds_rot_T_RANSAC_ctx(NULL, ptsA, ptsB, num_pts, bRa, T, tol, seed);
+}
+
+bool point_cloud_scratch_reserve(PointCloudScratch *scratch, int32_t num_pts)
+{
+    if (scratch->round == NULL)
     {
-        SAFE_PRINTF(512, "Point_Clouds_rot_T_RANSAC() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
-        return 0;
+        scratch->round = malloc(sizeof(PcRound));
+    }
+    if (num_pts > scratch->capacity)
+    {
+        free(scratch->points);
+        scratch->points = (double *)malloc(sizeof(double)*num_pts*12);
+        scratch->capacity = (scratch->points != NULL) ? num_pts : 0;
     }
+    if (scratch->round == NULL || scratch->points == NULL)
+    {
+        SAFE_PRINTF(512, "point_cloud_scratch_reserve() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        point_cloud_scratch_free(scratch);
+        return false;
+    }
+    return true;
+}
 
-    ptsB_tmp = (double *)malloc(sizeof(double)*num_pts*3);
-    if (ptsB_tmp == NULL)
+size_t point_cloud_scratch_bytes(const PointCloudScratch *scratch)
+{
+    return sizeof(double)*(size_t)scratch->capacity*12 + (scratch->round != NULL ? sizeof(PcRound) : 0);
+}
+
+void point_cloud_scratch_free(PointCloudScratch *scratch)
+{
+    free(scratch->points);
+    free(scratch->round);
+    scratch->points = NULL;
+    scratch->round = NULL;
+    scratch->capacity = 0;
+}
+
+int32_t  Point_Clouds_rot_T_RANSAC_ctx(PointCloudScratch *scratch, double *ptsA, double *ptsB, int32_t num_pts,
+                                       double bRa[3][3], double T[3], double tol, uint64_t seed)
+{
+    if(num_pts < 3)
     {
-        SAFE_PRINTF(512, "Point_Clouds_rot_T_RANSAC() ==>> malloc() failed, %s, %d\n", __FILE__, __LINE__);
+        printf("too few points for estimating the rotation and translation\n");
         return 0;
     }
     
-    int32_t index[3], flag, bestk, nm ;
-    int32_t i, j, p1;
-    int32_t k;
-    n[0] = 1.0;
-    n[1] = 1.0;
-    n[2] = 1.0;
-    bestk = 0;
-    for(int32_t iter = 0; iter <  PC_RANSAC_MAX_ITERATIONS; ++iter)
-    {
-        SAFE_PRINTF(128, "iter = %d\n", iter);
-        nm = 0;
-        while(nm < 3)
+    PointCloudScratch local_scratch = {0};
+    if (scratch == NULL)
+    {
+        scratch = &local_scratch;
+    }
+    if (!point_cloud_scratch_reserve(scratch, num_pts))
+    {
+        return 0;
+    }
+    // Inliers of both clouds, then the coordinates of both by axis
+    double *ptsA_tmp = scratch->points;
+    double *ptsB_tmp = ptsA_tmp + num_pts*3;
+    double *coords = ptsB_tmp + num_pts*3;
+    PcRound *round = (PcRound *)scratch->round;
+    
+    PcPoints pts = {num_pts, &coords[0], &coords[num_pts], &coords[2*num_pts],
+                    &coords[3*num_pts], &coords[4*num_pts], &coords[5*num_pts]};
+    for(int32_t i = 0; i < num_pts; ++i)
+    {
+        pts.ax[i] = ptsA[3*i];
+        pts.ay[i] = ptsA[3*i + 1];
+        pts.az[i] = ptsA[3*i + 2];
+        pts.bx[i] = ptsB[3*i];
+        pts.by[i] = ptsB[3*i + 1];
+        pts.bz[i] = ptsB[3*i + 2];
+    }
+    
+    int32_t num_threads = scratch->num_threads;
+    if (num_threads <= 0) num_threads = parallel_num_threads();
+    if (num_threads > num_pts / PC_RANSAC_MIN_THREAD_PTS) num_threads = num_pts / PC_RANSAC_MIN_THREAD_PTS;
+    if (num_threads > PC_RANSAC_MAX_THREADS) num_threads = PC_RANSAC_MAX_THREADS;
+    if (num_threads < 1) num_threads = 1;
+    
+    round->pts = &pts;
+    round->tol2 = (tol > 0) ? tol*tol : -1.0;
+#ifdef PC_RANSAC_AVX2
+    round->use_avx2 = __builtin_cpu_supports("avx2");
+#else
+    round->use_avx2 = false;
+#endif
+    PcRoundThread threads[PC_RANSAC_MAX_THREADS];
+    for(int32_t t = 0; t < num_threads; ++t)
+    {
+        threads[t].round = round;
+        threads[t].first = (int32_t)((int64_t)num_pts * t / num_threads);
+        threads[t].end = (int32_t)((int64_t)num_pts * (t + 1) / num_threads);
+    }
+    
+    // Rounds of hypotheses until the best one gives the confidence. The first best score wins ties, as if the
+    // hypotheses were scored one after another.
+    double bestT[3] = {0}, bestR[3][3] = {{0}};
+    int32_t bestk = 0;
+    int32_t needed = PC_RANSAC_MAX_ITERATIONS;
+    int32_t iterations = 0;
+    while(iterations < needed)
+    {
+        round->count = (needed - iterations < PC_RANSAC_ROUND) ? needed - iterations : PC_RANSAC_ROUND;
+        for(int32_t h = 0; h < round->count; ++h)
         {
-            p1 = (int32_t)(rand()%num_pts);
-            if(p1 < num_pts && p1 >= 0)
-            {
-                flag = 1;
-                
-                for(i = 0; i < nm; ++i)
-                {
-                    if(index[i] == p1)
-                        flag = 0;
-                }
-                
-                if(flag == 1)
-                {
-                    copy3(&ptsA[3*p1], &Am[nm*3]);
-                    copy3(&ptsB[3*p1], &Bm[nm*3]);
-                    index[nm] = p1;
-                    nm++;
-                }
-            }
+            pc_hypothesis(ptsA, ptsB, num_pts, seed, iterations + h, round->bRa[h], round->T[h]);
         }
-        Point_Clouds_rot_T(Am, Bm,3, bRa_tmp, Ttmp);
-        //  prt33(bRa_tmp);
-        //  prt3(Ttmp);
-        //Pb = RPa + T
-        for(i = 0, k = 0; i < num_pts; ++i)
+        
+        pthread_t handles[PC_RANSAC_MAX_THREADS];
+        bool started[PC_RANSAC_MAX_THREADS];
+        for(int32_t t = 0; t < num_threads; ++t)
         {
-            mult331(bRa_tmp,&ptsA[3*i], p );
-            add3(p, Ttmp, p);
-            sub3(p, &ptsB[3*i], p);
-            if(mag3(p) < tol)
-            {
-                k++;
-            }
+            started[t] = t > 0 && pthread_create(&handles[t], NULL, pc_round_thread, &threads[t]) == 0;
         }
-        if(k > bestk)
+        for(int32_t t = 0; t < num_threads; ++t)
         {
-            bestk = k;
-            copy33(bRa_tmp, bestR);
-            copy3(Ttmp, bestT);
+            if(!started[t]) pc_round_thread(&threads[t]);
         }
+        for(int32_t t = 0; t < num_threads; ++t)
+        {
+            if(started[t]) pthread_join(handles[t], NULL);
+        }
+        
+        for(int32_t h = 0; h < round->count; ++h)
+        {
+            int32_t k = 0;
+            for(int32_t t = 0; t < num_threads; ++t) k += threads[t].inliers[h];
+            if(k > bestk)
+            {
+                bestk = k;
+                copy33(round->bRa[h], bestR);
+                copy3(round->T[h], bestT);
+            }
+        }
+        iterations += round->count;
+        needed = pc_needed_iterations(bestk, num_pts);
     }
-    SAFE_PRINTF(128, "bestk %d\n", bestk);
-    for(i = 0, k = 0; i < num_pts; ++i)
+    log_message(LOG_LEVEL_DEBUG, "bestk %d after %d hypotheses", bestk, iterations);
+    
+    int32_t k = 0;
+    double p[3];
+    for(int32_t i = 0; i < num_pts; ++i)
     {
         mult331(bestR,&ptsA[3*i], p );
         add3(p, bestT, p);
@@ -238,14 +486,12 @@ int32_t  Point_Clouds_rot_T_RANSAC(double *ptsA, double *ptsB, int32_t num_pts,
     else
     {
       // [THP 2024/10/21] Return 0 if RANSAC failed
-      free( ptsA_tmp );
-      free( ptsB_tmp );
+      point_cloud_scratch_free(&local_scratch);
       return 0;
     }
     prt3(T);
     prt33(bRa);
     
-    free( ptsA_tmp );
-    free( ptsB_tmp );
+    point_cloud_scratch_free(&local_scratch);
     return 1;
 }
@@ -1,6 +1,8 @@
 #ifndef _LANDMARK_TOOLS_POINT_LINE_PLANE_UTIL_H_
 #define _LANDMARK_TOOLS_POINT_LINE_PLANE_UTIL_H_
 //2D
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -103,18 +105,68 @@ int32_t normalpoint2plane(const double vec[3], const double p[3], double plane[4
 int32_t  Point_Clouds_rot_T(double *ptsA, double *ptsB, int32_t num_pts, double bRa[3][3], double T[3]);
 
 /**
- \brief TODO
+ \brief Rigid transformation Pb = bRa*Pa + T of two point clouds with outliers
  
- \param[] ptsA 
- \param[] ptsB 
- \param[] num_pts 
- \param[] bRa 
- \param[] T 
- \param[] tol 
- \return int32_t 
+ Hypotheses from 3 random correspondences are scored in rounds, with the correspondences split between threads,
+ until one of them has enough inliers for a 0.999 probability of an all-inlier sample, or 1000 hypotheses. The
+ transformation is then fit to the inliers of the best hypothesis.
+ 
+ \param[in] ptsA num_pts x 3 points
+ \param[in] ptsB num_pts x 3 corresponding points
+ \param[in] num_pts number of correspondences
+ \param[out] bRa rotation
+ \param[out] T translation
+ \param[in] tol distance of an inlier after the transformation
+ \return 1 on success, 0 if fewer than 7 inliers are found 
 */
 int32_t  Point_Clouds_rot_T_RANSAC(double *ptsA, double *ptsB, int32_t num_pts, double bRa[3][3], double T[3], double tol);
 
+/**
+ \brief Same as `Point_Clouds_rot_T_RANSAC` with the samples drawn from `seed` instead of rand()
+ 
+ The result only depends on the points and the seed, not on the number of threads.
+*/
+int32_t  Point_Clouds_rot_T_RANSAC_seeded(double *ptsA, double *ptsB, int32_t num_pts, double bRa[3][3], double T[3],
+                                          double tol, uint64_t seed);
+
+/**
+ \brief Scratch memory of `Point_Clouds_rot_T_RANSAC_ctx`, reused across calls
+ 
+ Zero-initialize, optionally set `num_threads`, then size with `point_cloud_scratch_reserve`. Must not be shared
+ between threads.
+*/
+typedef struct {
+    int32_t num_threads;         /*!< \brief Threads scoring the hypotheses. 0 for `parallel_num_threads()` */
+    int32_t capacity;            /*!< \brief Correspondences `points` holds */
+    double *points;              /*!< \brief Inliers and coordinate copies of both point clouds */
+    void *round;                 /*!< \brief Hypotheses of one round */
+} PointCloudScratch;
+
+/**
+ \brief Grow scratch memory to hold num_pts correspondences
+ \return false if memory allocation fails
+*/
+bool point_cloud_scratch_reserve(PointCloudScratch *scratch, int32_t num_pts);
+
+/**
+ \brief Bytes of memory held by a PointCloudScratch
+*/
+size_t point_cloud_scratch_bytes(const PointCloudScratch *scratch);
+
+/**
+ \brief Release the memory of a PointCloudScratch. `num_threads` is kept
+*/
+void point_cloud_scratch_free(PointCloudScratch *scratch);
+
+/**
+ \brief Same as `Point_Clouds_rot_T_RANSAC_seeded`, with scratch memory taken from `scratch`
+ 
+ With `num_threads` 1 and a scratch reserved for num_pts correspondences, the call allocates no memory.
+ \param[in,out] scratch scratch memory, or NULL to allocate it for the call
+*/
+int32_t  Point_Clouds_rot_T_RANSAC_ctx(PointCloudScratch *scratch, double *ptsA, double *ptsB, int32_t num_pts,
+                                       double bRa[3][3], double T[3], double tol, uint64_t seed);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,67 @@
+/**
+ * \file splitmix.h
+ * \brief splitmix64 generator of the seeded RANSAC estimators
+ *
+ * The state is one 64-bit word, so a caller can seed a generator per call, block or hypothesis and draw the same
+ * samples for the same seed on any thread.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_SPLITMIX_H_
+#define _LANDMARK_TOOLS_SPLITMIX_H_
+
+#include <stdint.h>   // for uint64_t, uint32_t
+#include <stdlib.h>   // for rand
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Next 64 random bits
+ */
+static inline uint64_t splitmix64_next(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * \brief Uniform random integer in [0, n), from the high 32 bits of the next draw
+ */
+static inline uint32_t splitmix64_uniform(uint64_t *state, uint32_t n)
+{
+    return (uint32_t)(((splitmix64_next(state) >> 32) * n) >> 32);
+}
+
+/**
+ * \brief Seed for the entry points that keep their rand() interface
+ *
+ * The seed is taken from rand(), so srand() still makes their calls repeatable, and each call advances rand() once
+ * however many samples it draws.
+ */
+static inline uint64_t splitmix64_seed_from_rand(void)
+{
+    return (uint64_t)rand();
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_SPLITMIX_H_ */
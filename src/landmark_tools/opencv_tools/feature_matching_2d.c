@@ -21,6 +21,7 @@
 
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -33,6 +34,8 @@
 #include "landmark_tools/opencv_tools/homography_estimation.h"
 #include "landmark_tools/opencv_tools/opencv_image_io.h"
 #include "math/mat3/mat3.h"                                 // for mult331
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/parallel.h"
 #include "landmark_tools/utils/safe_string.h"
 
 WarpingMethod StrToWarpingMethod(const char* str){
@@ -124,6 +127,399 @@ bool process_matched_feature_2d(
     return true;
 }
 
+/**
+ * \brief Fit the local homography of one block and accumulate its inlier matches
+ *
+ * \param[in] child_points Matched points of the block
+ * \param[in] base_points Matches of `child_points`
+ * \param[in] correlation_values Correlation of each match
+ * \param[in] num_matched_features Number of matches
+ */
+static void accumulate_block_2d(
+    const Parameters *parameters,
+    double *child_points,
+    double *base_points,
+    double *correlation_values,
+    int32_t num_matched_features,
+    CorrelationResults *results,
+    float *weights,
+    int32_t num_cols,
+    int32_t num_rows
+) {
+    log_message(LOG_LEVEL_DEBUG, "Found %d matched features in window", num_matched_features);
+
+    // Process matched features if enough were found
+    if(num_matched_features > parameters->sliding.min_n_features) {
+        // Estimate local homography for the matched features
+        double patch_homo[3][3];
+        getHomographyFromPoints_RANSAC_frame(child_points, base_points, num_matched_features, patch_homo, 3);
+
+        // Process each matched feature
+        for(int32_t feature_index = 0; feature_index < num_matched_features; ++feature_index) {
+            // Check if feature is an inlier by computing reprojection error
+            double reprojection_err[2];
+            homographyTransfer33(patch_homo, 
+                                (int32_t)child_points[feature_index * 2], 
+                                (int32_t)child_points[feature_index * 2 + 1], 
+                                reprojection_err);
+            reprojection_err[0] -= base_points[feature_index * 2];
+            reprojection_err[1] -= base_points[feature_index * 2 + 1];
+            double mag_reprojection = sqrt(reprojection_err[0] * reprojection_err[0] + 
+                                            reprojection_err[1] * reprojection_err[1]);
+
+            // Process inlier features
+            if (mag_reprojection < parameters->sliding.reprojection_threshold) {
+                process_matched_feature_2d(
+                    child_points[feature_index * 2],
+                    child_points[feature_index * 2 + 1],
+                    base_points[feature_index * 2],
+                    base_points[feature_index * 2 + 1],
+                    correlation_values[feature_index],
+                    results,
+                    weights,
+                    num_cols,
+                    num_rows,
+                    parameters->sliding.feature_influence_window
+                );
+            }
+        }
+    }
+}
+
+/**
+ * \brief Sample the points of the block at (`col_index`, `row_index`) every `step_size` pixels
+ *
+ * \return number of points
+ */
+static int32_t block_points_2d(const Parameters *parameters, int32_t col_index, int32_t row_index, double *child_points)
+{
+    int32_t pts_in_block = 0;
+    for(int32_t m = row_index; m <= row_index+parameters->sliding.block_size; m+=parameters->sliding.step_size) {
+        for(int32_t n = col_index; n <= col_index+parameters->sliding.block_size; n+=parameters->sliding.step_size) {
+            child_points[pts_in_block*2] = n;
+            child_points[pts_in_block*2+1] = m;
+            pts_in_block++;
+        }
+    }
+    return pts_in_block;
+}
+
+/**
+ * \brief Tiles of one row of tiles of the child image, shared by the matching threads
+ *
+ * Threads take tiles in turn and store the matches of their blocks. The calling thread then fits the local
+ * homographies of the blocks in the order of the untiled loop, so the results do not depend on the tiling or on
+ * which thread matched which tile.
+ */
+typedef struct {
+    const Parameters *parameters;
+    uint8_t *base_image;
+    uint8_t *base_nan_mask;
+    int32_t base_cols;
+    int32_t base_rows;
+    uint8_t *child_image;
+    uint8_t *child_nan_mask;
+    int32_t child_cols;
+    int32_t child_rows;
+    int32_t base_nan_max_count;
+    int32_t child_nan_max_count;
+    double (*base2child)[3];
+    bool warp_image;                    // warp the base under each tile, else search the base through base2child
+    const CorrIntegralImage *base_integral; // window sums of the base when it is not warped, or NULL
+    int32_t reach;                      // pixels around the points of a tile that the search windows read
+    int32_t tile_size;                  // multiple of block_size
+    int32_t tiles_per_row;
+    int32_t tile_top;                   // child row of the current row of tiles
+    int32_t blocks_per_row;
+    int32_t points_per_block;
+    double *child_points;               // points_per_block points for each block of the row of tiles
+    double *base_points;
+    double *correlations;
+    int32_t *num_matched;
+    int32_t next_tile;
+    bool error;
+    pthread_mutex_t mutex;
+} TileRowJob;
+
+#define MATCH_2D_MAX_THREADS 64
+
+static int32_t match_2d_num_threads(const Parameters *parameters)
+{
+    if (parameters->sliding.num_threads > 0) {
+        return parameters->sliding.num_threads < MATCH_2D_MAX_THREADS ? parameters->sliding.num_threads
+                                                                       : MATCH_2D_MAX_THREADS;
+    }
+    int32_t n = parallel_num_threads();
+    return n < MATCH_2D_MAX_THREADS ? n : MATCH_2D_MAX_THREADS;
+}
+
+/**
+ * \brief Window of the warped base image that the blocks of a tile search
+ */
+static void tile_window(const TileRowJob *job, int32_t tile, int32_t *left, int32_t *top, int32_t *cols,
+                        int32_t *rows)
+{
+    // Block points reach block_size past the last block of the tile
+    int32_t tile_left = tile * job->tile_size;
+    int32_t right = tile_left + job->tile_size + job->parameters->sliding.block_size + job->reach + 1;
+    int32_t bottom = job->tile_top + job->tile_size + job->parameters->sliding.block_size + job->reach + 1;
+    *left = tile_left - job->reach > 0 ? tile_left - job->reach : 0;
+    *top = job->tile_top - job->reach > 0 ? job->tile_top - job->reach : 0;
+    *cols = (right < job->child_cols ? right : job->child_cols) - *left;
+    *rows = (bottom < job->child_rows ? bottom : job->child_rows) - *top;
+}
+
+/**
+ * \brief Match the points of every block of one tile
+ *
+ * With image warping, the matcher sees the tile window of the warped base and the same window of the child, so
+ * that templates and search windows are read from the same pixels as in the whole images.
+ * \param[out] window Four planes of `window_pixels`: warped base, its nan mask, child and child nan mask
+ * \return false if memory allocation fails
+ */
+static bool match_tile_2d(TileRowJob *job, MatchContext *ctx, uint8_t *window, size_t window_pixels, int32_t tile)
+{
+    const Parameters *parameters = job->parameters;
+    int32_t block_size = parameters->sliding.block_size;
+    uint8_t *search_image = job->base_image;
+    uint8_t *search_mask = job->base_nan_mask;
+    int32_t search_cols = job->base_cols;
+    int32_t search_rows = job->base_rows;
+    uint8_t *template_image = job->child_image;
+    uint8_t *template_mask = job->child_nan_mask;
+    int32_t template_cols = job->child_cols;
+    int32_t template_rows = job->child_rows;
+    const CorrIntegralImage *search_integral = job->base_integral;
+    double homography[3][3];
+    copy33(job->base2child, homography);
+
+    int32_t left = 0, top = 0;
+    CorrIntegralImage window_integral;
+    bool have_window_integral = false;
+    if (job->warp_image) {
+        // Warp only the base under the tile, the matches are then shifted back to the child frame
+        tile_window(job, tile, &left, &top, &search_cols, &search_rows);
+        search_image = window;
+        search_mask = window + window_pixels;
+        template_image = window + 2 * window_pixels;
+        template_mask = window + 3 * window_pixels;
+        template_cols = search_cols;
+        template_rows = search_rows;
+        if (!transferImageMaskWindow(job->base2child, job->base_image, job->base_nan_mask, job->base_cols,
+                                     job->base_rows, search_image, search_mask, left, top, search_cols,
+                                     search_rows, 1)) {
+            return false;
+        }
+        for (int32_t row = 0; row < search_rows; row++) {
+            size_t from = (size_t)(top + row) * job->child_cols + left;
+            memcpy(&template_image[(size_t)row * search_cols], &job->child_image[from], search_cols);
+            memcpy(&template_mask[(size_t)row * search_cols], &job->child_nan_mask[from], search_cols);
+        }
+        have_window_integral = corr_integral_image_build(&window_integral, search_image, search_cols, search_cols,
+                                                         search_rows);
+        search_integral = have_window_integral ? &window_integral : NULL;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                homography[i][j] = (i == j) ? 1. : 0.;
+            }
+        }
+    }
+
+    int32_t first_block_col = tile * (job->tile_size / block_size);
+    int32_t last_block_col = first_block_col + job->tile_size / block_size;
+    if (last_block_col > job->blocks_per_row) last_block_col = job->blocks_per_row;
+    for(int32_t row_index = job->tile_top;
+        row_index < job->child_rows && row_index < job->tile_top + job->tile_size; row_index += block_size) {
+        int32_t block_row = (row_index - job->tile_top) / block_size;
+        for(int32_t block_col = first_block_col; block_col < last_block_col; block_col++) {
+            size_t slot = (size_t)block_row * job->blocks_per_row + block_col;
+            int32_t pts_in_block = block_points_2d(parameters, block_col * block_size - left, row_index - top,
+                                                   ctx->block.points);
+            int32_t num_matched = MatchFeaturesWithSearchIntegral_ctx(
+                ctx,
+                *parameters,
+                template_image,
+                template_mask,
+                template_cols,
+                template_rows,
+                job->child_nan_max_count,
+                search_image,
+                search_mask,
+                search_cols,
+                search_rows,
+                job->base_nan_max_count,
+                search_integral,
+                homography,
+                ctx->block.points,
+                ctx->block.matches,
+                &job->correlations[slot * job->points_per_block],
+                pts_in_block
+            );
+            double *child_points = &job->child_points[slot * job->points_per_block * 2];
+            double *base_points = &job->base_points[slot * job->points_per_block * 2];
+            for (int32_t i = 0; i < num_matched; i++) {
+                child_points[i * 2] = ctx->block.points[i * 2] + left;
+                child_points[i * 2 + 1] = ctx->block.points[i * 2 + 1] + top;
+                base_points[i * 2] = ctx->block.matches[i * 2] + left;
+                base_points[i * 2 + 1] = ctx->block.matches[i * 2 + 1] + top;
+            }
+            job->num_matched[slot] = num_matched;
+        }
+    }
+    if (have_window_integral) corr_integral_image_free(&window_integral);
+    return true;
+}
+
+static void *match_tile_thread(void *arg)
+{
+    TileRowJob *job = (TileRowJob *)arg;
+    // Threads that cannot allocate their buffers leave their tiles to the others
+    MatchContext ctx;
+    if (!allocate_match_context(&ctx, job->parameters, 0)) return NULL;
+    ctx.corr_threads = 1;
+    uint8_t *window = NULL;
+    size_t window_pixels = 0;
+    if (job->warp_image) {
+        // Largest window of any tile
+        int32_t side = job->tile_size + 2 * job->reach + job->parameters->sliding.block_size + 1;
+        window_pixels = (size_t)(side < job->child_cols ? side : job->child_cols) *
+                        (side < job->child_rows ? side : job->child_rows);
+        window = (uint8_t *)malloc(sizeof(uint8_t) * 4 * window_pixels);
+        if (window == NULL) {
+            free_match_context(&ctx);
+            return NULL;
+        }
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&job->mutex);
+        int32_t tile = job->error ? job->tiles_per_row : job->next_tile++;
+        pthread_mutex_unlock(&job->mutex);
+        if (tile >= job->tiles_per_row) break;
+        if (!match_tile_2d(job, &ctx, window, window_pixels, tile)) {
+            pthread_mutex_lock(&job->mutex);
+            job->error = true;
+            pthread_mutex_unlock(&job->mutex);
+        }
+    }
+    free(window);
+    free_match_context(&ctx);
+    return NULL;
+}
+
+/**
+ * \brief Block matching of `MatchFeatures_local_distortion_2d` one row of tiles at a time
+ *
+ * With `warp_image`, only the base under each tile is warped, so memory is bounded by the tile size instead of the
+ * child image size. Tiles of a row are matched in parallel.
+ * \return false if memory allocation fails
+ */
+static bool match_tiles_2d(
+    const Parameters *parameters,
+    uint8_t *base_image,
+    uint8_t *base_nan_mask,
+    int32_t base_image_num_rows,
+    int32_t base_image_num_cols,
+    uint8_t *child_image,
+    uint8_t *child_nan_mask,
+    int32_t child_image_num_rows,
+    int32_t child_image_num_cols,
+    double base2child[3][3],
+    bool warp_image,
+    int32_t tile_size,
+    int32_t child_nan_max_count,
+    int32_t base_nan_max_count,
+    CorrelationResults *results,
+    float *weights
+) {
+    int32_t block_size = parameters->sliding.block_size;
+    TileRowJob job;
+    memset(&job, 0, sizeof(TileRowJob));
+    job.parameters = parameters;
+    job.base_image = base_image;
+    job.base_nan_mask = base_nan_mask;
+    job.base_cols = base_image_num_cols;
+    job.base_rows = base_image_num_rows;
+    job.child_image = child_image;
+    job.child_nan_mask = child_nan_mask;
+    job.child_cols = child_image_num_cols;
+    job.child_rows = child_image_num_rows;
+    job.base_nan_max_count = base_nan_max_count;
+    job.child_nan_max_count = child_nan_max_count;
+    job.base2child = base2child;
+    job.warp_image = warp_image;
+    job.reach = parameters->matching.search_window_size + parameters->matching.correlation_window_size;
+    // Tiles hold whole blocks
+    job.tile_size = ((tile_size + block_size - 1) / block_size) * block_size;
+    job.tiles_per_row = (child_image_num_cols + job.tile_size - 1) / job.tile_size;
+    job.blocks_per_row = (child_image_num_cols + block_size - 1) / block_size;
+    int32_t points_per_side = block_size / parameters->sliding.step_size + 1;
+    job.points_per_block = points_per_side * points_per_side;
+
+    size_t num_slots = (size_t)(job.tile_size / block_size) * job.blocks_per_row;
+    size_t num_points = num_slots * job.points_per_block;
+    job.child_points = (double *)malloc(sizeof(double) * 2 * num_points);
+    job.base_points = (double *)malloc(sizeof(double) * 2 * num_points);
+    job.correlations = (double *)malloc(sizeof(double) * num_points);
+    job.num_matched = (int32_t *)malloc(sizeof(int32_t) * num_slots);
+    CorrIntegralImage base_integral;
+    bool have_integral = !warp_image && corr_integral_image_build(&base_integral, base_image, base_image_num_cols,
+                                                                  base_image_num_cols, base_image_num_rows);
+    job.base_integral = have_integral ? &base_integral : NULL;
+    bool success = job.child_points != NULL && job.base_points != NULL && job.correlations != NULL &&
+                   job.num_matched != NULL && pthread_mutex_init(&job.mutex, NULL) == 0;
+    bool have_mutex = success;
+
+    int32_t num_threads = match_2d_num_threads(parameters);
+    if (num_threads > job.tiles_per_row) num_threads = job.tiles_per_row;
+    for (int32_t tile_top = 0; tile_top < child_image_num_rows && success; tile_top += job.tile_size) {
+        job.tile_top = tile_top;
+        job.next_tile = 0;
+        pthread_t threads[MATCH_2D_MAX_THREADS];
+        bool started[MATCH_2D_MAX_THREADS] = {false};
+        for (int32_t t = 1; t < num_threads; t++) {
+            started[t] = pthread_create(&threads[t], NULL, match_tile_thread, &job) == 0;
+        }
+        match_tile_thread(&job);
+        for (int32_t t = 1; t < num_threads; t++) {
+            if (started[t]) pthread_join(threads[t], NULL);
+        }
+        if (job.error || job.next_tile < job.tiles_per_row) {
+            success = false;
+            break;
+        }
+
+        // Local homographies in the block order of the untiled loop
+        for (int32_t row_index = tile_top;
+             row_index < child_image_num_rows && row_index < tile_top + job.tile_size; row_index += block_size) {
+            log_progress("Matching rows", row_index, child_image_num_rows);
+            int32_t block_row = (row_index - tile_top) / block_size;
+            for (int32_t block_col = 0; block_col < job.blocks_per_row; block_col++) {
+                size_t slot = (size_t)block_row * job.blocks_per_row + block_col;
+                accumulate_block_2d(
+                    parameters,
+                    &job.child_points[slot * job.points_per_block * 2],
+                    &job.base_points[slot * job.points_per_block * 2],
+                    &job.correlations[slot * job.points_per_block],
+                    job.num_matched[slot],
+                    results,
+                    weights,
+                    child_image_num_cols,
+                    child_image_num_rows
+                );
+            }
+        }
+    }
+
+    if (have_mutex) pthread_mutex_destroy(&job.mutex);
+    if (have_integral) corr_integral_image_free(&base_integral);
+    free(job.child_points);
+    free(job.base_points);
+    free(job.correlations);
+    free(job.num_matched);
+    return success;
+}
+
 bool MatchFeatures_local_distortion_2d(
     Parameters parameters,
     uint8_t **base_image,
@@ -139,13 +535,25 @@ bool MatchFeatures_local_distortion_2d(
     char *output_dir,
     double homography_max_dist_between_matching_keypoints,
     int32_t child_nan_max_count,
-    int32_t base_nan_max_count
+    int32_t base_nan_max_count,
+    HomographyBaseFeatures *base_features,
+    int32_t tile_size
 ) {
     // Initialize homography matrix
     double base2child[3][3];
     
     // Estimate initial homography between images using feature matching
-    if( !estimateHomographyFromFeatureMatching(
+    bool success_homography = base_features != NULL ? estimateHomographyFromBaseFeatures(
+        base_features,
+        *base_image,
+        *child_image,
+        *child_nan_mask,
+        *child_image_num_rows,
+        *child_image_num_cols,
+        base2child,
+        output_dir,
+        homography_max_dist_between_matching_keypoints
+    ) : estimateHomographyFromFeatureMatching(
         *base_image,
         *base_nan_mask,
         *base_image_num_rows,
@@ -157,60 +565,45 @@ bool MatchFeatures_local_distortion_2d(
         base2child,
         output_dir,
         homography_max_dist_between_matching_keypoints
-    )) {
+    );
+    if( !success_homography ) {
         printf("MatchFeatures_local_distortion_2d(): homography estimation failed\n");
         return false;
     }
 
+    if (warp_image_or_template != WarpingMethod_IMAGE && warp_image_or_template != WarpingMethod_TEMPLATE) {
+        printf("MatchFeatures_local_distortion_2d(): invalid warping method\n");
+        return false;
+    }
+
     // [THP 2024/08/14] Optionally warp the base image onto the child image
-    if (warp_image_or_template == WarpingMethod_IMAGE) {
-        // Warp image directly
+    // In tiled mode the base is warped tile by tile during matching
+    if (warp_image_or_template == WarpingMethod_IMAGE && tile_size <= 0) {
+        // Warp image and nan mask directly, in one pass
         uint8_t *warped_base_image = malloc(
             sizeof(uint8_t) * (*child_image_num_rows) * (*child_image_num_cols)
         );
-        transferImage(
-            base2child,
-            *base_image,
-            *base_image_num_cols,
-            *base_image_num_rows,
-            warped_base_image,
-            *child_image_num_cols,
-            *child_image_num_rows
-        );
-        // transferImage sets pixels that project out of bounds to zero. These should be
-        // marked as not to be used in the mask so as nan. Therefore, warp on the opposite
-        // mask then flip again.
-        uint8_t *base_not_nan_mask = malloc(
-            sizeof(uint8_t) * (*base_image_num_rows) * (*base_image_num_cols)
-        );
-        // Stretch to 0-to-255 to make interpolation finer-grained
-        for (int i = 0; i < (*base_image_num_rows) * (*base_image_num_cols); ++i)
-        {
-            if ((*base_nan_mask)[i] == 0)
-                base_not_nan_mask[i] = 255;
-            else
-                base_not_nan_mask[i] = 0;
-        }
-        // warp not nan mask
         uint8_t *warped_base_mask = malloc(
             sizeof(uint8_t) * (*child_image_num_rows) * (*child_image_num_cols)
         );
-        transferImage(
-            base2child,
-            base_not_nan_mask,
-            *base_image_num_cols,
-            *base_image_num_rows,
-            warped_base_mask,
-            *child_image_num_cols,
-            *child_image_num_rows
-        );
-        // flip mask back
-        for (int i = 0; i < (*child_image_num_rows) * (*child_image_num_cols); ++i)
-        {
-            if (warped_base_mask[i] == 0)
-                warped_base_mask[i] = 1;
-            else
-                warped_base_mask[i] = 0;
+        // transferImageMask marks pixels that project out of bounds, or mostly onto
+        // nan pixels, as nan in the warped mask
+        if (warped_base_image == NULL || warped_base_mask == NULL ||
+            !transferImageMask(
+                base2child,
+                *base_image,
+                *base_nan_mask,
+                *base_image_num_cols,
+                *base_image_num_rows,
+                warped_base_image,
+                warped_base_mask,
+                *child_image_num_cols,
+                *child_image_num_rows
+            )) {
+            printf("MatchFeatures_local_distortion_2d(): image warping failed\n");
+            free(warped_base_image);
+            free(warped_base_mask);
+            return false;
         }
         // Reassign variables and free memory
         free_image(base_image);
@@ -239,9 +632,6 @@ bool MatchFeatures_local_distortion_2d(
 #endif
     } else if (warp_image_or_template == WarpingMethod_TEMPLATE) {
         // Do nothing - templates will be warped during matching
-    } else {
-        printf("MatchFeatures_local_distortion_2d(): invalid warping method\n");
-        return false;
     }
 
     // Initialize arrays for correlation results
@@ -257,97 +647,91 @@ bool MatchFeatures_local_distortion_2d(
         weights[i] = NAN;
     }
 
-    // Process image in sliding windows
-    for(int32_t row_index = 0; row_index < *child_image_num_rows; row_index += parameters.sliding.block_size) {
-        SAFE_PRINTF(512, "Processing row %d of %d\n", row_index, *child_image_num_rows);
-        
-        for(int32_t col_index = 0; col_index < *child_image_num_cols; col_index += parameters.sliding.block_size) {
-            // Extract feature points at regular intervals within the current block
-            int32_t size = ((parameters.sliding.block_size/parameters.sliding.step_size)+1) * 
-                          ((parameters.sliding.block_size/parameters.sliding.step_size)+1);
-            double *child_points = (double *)malloc(sizeof(double)*size*2);
-            double *base_points = (double *)malloc(sizeof(double)*size*2);
-
-            if(child_points == NULL || base_points == NULL) {
-                if(child_points != NULL) free(child_points);
-                if(weights != NULL) free(weights);
-                printf("MatchFeatures_local_distortion_2d(): memory allocation error\n");
-                return false;
-            }
+    if (tile_size > 0) {
+        if (!match_tiles_2d(
+            &parameters,
+            *base_image,
+            *base_nan_mask,
+            *base_image_num_rows,
+            *base_image_num_cols,
+            *child_image,
+            *child_nan_mask,
+            *child_image_num_rows,
+            *child_image_num_cols,
+            base2child,
+            warp_image_or_template == WarpingMethod_IMAGE,
+            tile_size,
+            child_nan_max_count,
+            base_nan_max_count,
+            results,
+            weights
+        )) {
+            free(weights);
+            printf("MatchFeatures_local_distortion_2d(): memory allocation error\n");
+            return false;
+        }
+    } else {
+        // Window sums of the base image are shared by every block
+        CorrIntegralImage base_integral;
+        bool have_integral = corr_integral_image_build(&base_integral, *base_image, *base_image_num_cols,
+                                                       *base_image_num_cols, *base_image_num_rows);
 
-            // Sample points at regular intervals within the block
-            int32_t pts_in_block = 0;
-            for(int32_t m = row_index; m <= row_index+parameters.sliding.block_size; m+=parameters.sliding.step_size) {
-                for(int32_t n = col_index; n <= col_index+parameters.sliding.block_size; n+=parameters.sliding.step_size) {
-                    child_points[pts_in_block*2] = n;
-                    child_points[pts_in_block*2+1] = m;
-                    pts_in_block++;
-                }
-            }
+        // Scratch memory shared by every block
+        MatchContext ctx;
+        if(!allocate_match_context(&ctx, &parameters, 0)) {
+            free(weights);
+            if(have_integral) corr_integral_image_free(&base_integral);
+            printf("MatchFeatures_local_distortion_2d(): memory allocation error\n");
+            return false;
+        }
+        double *child_points = ctx.block.points;
+        double *base_points = ctx.block.matches;
+        double *correlation_values = ctx.block.scores;
 
-            double correlation_values[pts_in_block];
-            int32_t num_matched_features = MatchFeaturesWithNaNHandling(
-                parameters,
-                *child_image,
-                *child_nan_mask,
-                *child_image_num_cols,
-                *child_image_num_rows,
-                child_nan_max_count,
-                *base_image,
-                *base_nan_mask,
-                *base_image_num_cols,
-                *base_image_num_rows,
-                base_nan_max_count,
-                base2child,
-                child_points,
-                base_points,
-                correlation_values,
-                pts_in_block
-            );
+        // Process image in sliding windows
+        for(int32_t row_index = 0; row_index < *child_image_num_rows; row_index += parameters.sliding.block_size) {
+            log_progress("Matching rows", row_index, *child_image_num_rows);
+            
+            for(int32_t col_index = 0; col_index < *child_image_num_cols; col_index += parameters.sliding.block_size) {
+                // Sample points at regular intervals within the block
+                int32_t pts_in_block = block_points_2d(&parameters, col_index, row_index, child_points);
 
-            SAFE_PRINTF(512, "Found %d matched features in window\n", num_matched_features);
-
-            // Process matched features if enough were found
-            if(num_matched_features > parameters.sliding.min_n_features) {
-                // Estimate local homography for the matched features
-                double patch_homo[3][3];
-                getHomographyFromPoints_RANSAC_frame(child_points, base_points, num_matched_features, patch_homo, 3);
-
-                // Process each matched feature
-                for(int32_t feature_index = 0; feature_index < num_matched_features; ++feature_index) {
-                    // Check if feature is an inlier by computing reprojection error
-                    double reprojection_err[2];
-                    homographyTransfer33(patch_homo, 
-                                        (int32_t)child_points[feature_index * 2], 
-                                        (int32_t)child_points[feature_index * 2 + 1], 
-                                        reprojection_err);
-                    reprojection_err[0] -= base_points[feature_index * 2];
-                    reprojection_err[1] -= base_points[feature_index * 2 + 1];
-                    double mag_reprojection = sqrt(reprojection_err[0] * reprojection_err[0] + 
-                                                    reprojection_err[1] * reprojection_err[1]);
-
-                    // Process inlier features
-                    if (mag_reprojection < parameters.sliding.reprojection_threshold) {
-                        process_matched_feature_2d(
-                            child_points[feature_index * 2],
-                            child_points[feature_index * 2 + 1],
-                            base_points[feature_index * 2],
-                            base_points[feature_index * 2 + 1],
-                            correlation_values[feature_index],
-                            results,
-                            weights,
-                            *child_image_num_cols,
-                            *child_image_num_rows,
-                            parameters.sliding.feature_influence_window
-                        );
-                    }
-                }
-            }
+                int32_t num_matched_features = MatchFeaturesWithSearchIntegral_ctx(
+                    &ctx,
+                    parameters,
+                    *child_image,
+                    *child_nan_mask,
+                    *child_image_num_cols,
+                    *child_image_num_rows,
+                    child_nan_max_count,
+                    *base_image,
+                    *base_nan_mask,
+                    *base_image_num_cols,
+                    *base_image_num_rows,
+                    base_nan_max_count,
+                    have_integral ? &base_integral : NULL,
+                    base2child,
+                    child_points,
+                    base_points,
+                    correlation_values,
+                    pts_in_block
+                );
 
-            // Clean up memory for this block
-            if(child_points != NULL) free(child_points);
-            if(base_points != NULL) free(base_points); 
+                accumulate_block_2d(
+                    &parameters,
+                    child_points,
+                    base_points,
+                    correlation_values,
+                    num_matched_features,
+                    results,
+                    weights,
+                    *child_image_num_cols,
+                    *child_image_num_rows
+                );
+            }
         }
+        free_match_context(&ctx);
+        if(have_integral) corr_integral_image_free(&base_integral);
     }
 
     // Normalize correlation results by accumulated weights
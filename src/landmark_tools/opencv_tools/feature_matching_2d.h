@@ -27,6 +27,7 @@
 
 #include "landmark_tools/feature_tracking/parameters.h"
 #include "landmark_tools/feature_tracking/correlation_results.h"
+#include "landmark_tools/opencv_tools/homography_estimation.h"
 
 typedef enum {
     WarpingMethod_IMAGE,
@@ -92,6 +93,11 @@ bool process_matched_feature_2d(
  * \param[in] homography_max_dist_between_matching_keypoints Maximum distance between matching keypoints
  * \param[in] child_nan_max_count Maximum number of NaN pixels allowed in child image window
  * \param[in] base_nan_max_count Maximum number of NaN pixels allowed in base image window
+ * \param[in,out] base_features Precomputed features of the base image, or NULL to compute them for this match
+ * \param[in] tile_size If > 0, the child image is matched in square tiles of about this many pixels, rounded up to
+ * whole blocks, on `parameters.sliding.num_threads` threads. With image warping only the base under each tile is
+ * warped and the base image is left unwarped. The results are the same as untiled, up to the rounding of the
+ * subpixel positions within each tile window
  * \return true if matching was successful, false otherwise
  */
 bool MatchFeatures_local_distortion_2d(
@@ -109,7 +115,9 @@ bool MatchFeatures_local_distortion_2d(
     char *output_dir,
     double homography_max_dist_between_matching_keypoints,
     int32_t child_nan_max_count,
-    int32_t base_nan_max_count
+    int32_t base_nan_max_count,
+    HomographyBaseFeatures *base_features,
+    int32_t tile_size
 );
 
 #endif // FEATURE_MATCHING_2D_H 
\ No newline at end of file
@@ -16,31 +16,61 @@
 #include "landmark_tools/math/homography_util.h"
 #include "landmark_tools/utils/safe_string.h"
 
-/**
- * \brief Estimate homography between two images using feature matching
- * 
- * This function estimates a homography transformation between a base image and a
- * child image using feature matching. It tries multiple feature matching methods
- * and selects the best one based on the number of inliers.
- * 
- * \param[in] base_image Base image data
- * \param[in] base_nan_mask Mask for NaN pixels in base image
- * \param[in] base_image_num_rows Number of rows in base image
- * \param[in] base_image_num_cols Number of columns in base image
- * \param[in] child_image Child image data
- * \param[in] child_nan_mask Mask for NaN pixels in child image
- * \param[in] child_image_num_rows Number of rows in child image
- * \param[in] child_image_num_cols Number of columns in child image
- * \param[out] base2child Estimated homography matrix (3x3)
- * \param[in] output_dir Directory for saving debug outputs
- * \param[in] homography_max_dist_between_matching_keypoints Maximum allowed distance between matching keypoints
- * \return true if homography estimation was successful, false otherwise
- */
-bool estimateHomographyFromFeatureMatching(
+bool initHomographyBaseFeatures(
+    HomographyBaseFeatures *features,
     uint8_t *base_image,
     uint8_t *base_nan_mask,
     int base_image_num_rows,
     int base_image_num_cols,
+    const char *cache_prefix
+) {
+    bool success = false;
+    features->use_index = false;
+    for (int i_method = 0; i_method < HOMOGRAPHY_MATCH_METHOD_COUNT; ++i_method) {
+        HomographyMatchMethod method = (HomographyMatchMethod) i_method;
+        HomographyFeatureSet *set = NULL;
+        char path[256];
+        if (cache_prefix != NULL) {
+            snprintf(path, sizeof(path), "%s_%s.yml.gz", cache_prefix, HomographyMatchMethodToStr(method));
+            FILE *fp = fopen(path, "rb");
+            if (fp != NULL) {
+                fclose(fp);
+                set = load_homography_feature_set(path);
+                if (set != NULL && !homography_feature_set_matches(set, method, base_image_num_rows, base_image_num_cols)) {
+                    SAFE_PRINTF(512, "Feature file %s does not match the base image, computing the features again\n", path);
+                    free_homography_feature_set(set);
+                    set = NULL;
+                }
+            }
+        }
+        if (set == NULL) {
+            set = create_homography_feature_set(
+                base_image,
+                base_nan_mask,
+                base_image_num_rows,
+                base_image_num_cols,
+                method
+            );
+            if (set != NULL && cache_prefix != NULL) {
+                save_homography_feature_set(set, path);
+            }
+        }
+        features->sets[i_method] = set;
+        success |= set != NULL;
+    }
+    return success;
+}
+
+void freeHomographyBaseFeatures(HomographyBaseFeatures *features) {
+    for (int i_method = 0; i_method < HOMOGRAPHY_MATCH_METHOD_COUNT; ++i_method) {
+        free_homography_feature_set(features->sets[i_method]);
+        features->sets[i_method] = NULL;
+    }
+}
+
+bool estimateHomographyFromBaseFeatures(
+    HomographyBaseFeatures *features,
+    uint8_t *base_image,
     uint8_t *child_image,
     uint8_t *child_nan_mask,
     int child_image_num_rows,
@@ -55,12 +85,13 @@ bool estimateHomographyFromFeatureMatching(
     double homography_arr_best[3][3];
 
     // Try multiple feature matching methods
-    int method_count = 3;
-    HomographyMatchMethod method_arr[3] = {SIFT, ORB};
-
-    for (int i_method = 0; i_method < method_count; ++i_method) {
+    for (int i_method = 0; i_method < HOMOGRAPHY_MATCH_METHOD_COUNT; ++i_method) {
+        HomographyMatchMethod method = (HomographyMatchMethod) i_method;
+        if (features->sets[i_method] == NULL) {
+            continue;
+        }
         double homography_arr_local[3][3];
-        const char* homography_match_method = HomographyMatchMethodToStr(method_arr[i_method]);
+        const char* homography_match_method = HomographyMatchMethodToStr(method);
         uint32_t homography_min_inlier_count = 4;
         uint32_t homography_found_inlier_count = 0;
         bool do_draw_homography_image = true;
@@ -87,24 +118,28 @@ bool estimateHomographyFromFeatureMatching(
         SAFE_PRINTF(128, "Calculate homography with feature matching method %s\n", homography_match_method);
         
         // Try to estimate homography with current method
-        bool success_homography_local = calc_homography_from_feature_matching(
-            base_image,
-            base_nan_mask,
-            base_image_num_rows,
-            base_image_num_cols,
+        HomographyFeatureSet *child_features = create_homography_feature_set(
             child_image,
             child_nan_mask,
             child_image_num_rows,
             child_image_num_cols,
+            method
+        );
+        bool success_homography_local = child_features != NULL && calc_homography_from_feature_sets(
+            features->sets[i_method],
+            child_features,
+            base_image,
+            child_image,
             homography_arr_local,
-            method_arr[i_method],
             homography_min_inlier_count,
             &homography_found_inlier_count,
             do_draw_homography_image,
             path_draw_match_image,
             path_draw_inlier_image,
-            homography_max_dist_between_matching_keypoints
+            homography_max_dist_between_matching_keypoints,
+            features->use_index
         );
+        free_homography_feature_set(child_features);
 
         if (success_homography_local) {
             success_homography = true; // At least one method succeeded
@@ -116,7 +151,7 @@ bool estimateHomographyFromFeatureMatching(
             if (homography_found_inlier_count > homography_found_inlier_count_best) {
                 printf("  New best!\n");
                 homography_found_inlier_count_best = homography_found_inlier_count;
-                best_method = method_arr[i_method];
+                best_method = method;
                 for (int row = 0; row < 3; ++row) {
                     for (int col = 0; col < 3; ++col) {
                         homography_arr_best[row][col] = homography_arr_local[row][col];
@@ -140,4 +175,40 @@ bool estimateHomographyFromFeatureMatching(
     }
 
     return success_homography;
-} 
\ No newline at end of file
+} 
+
+bool estimateHomographyFromFeatureMatching(
+    uint8_t *base_image,
+    uint8_t *base_nan_mask,
+    int base_image_num_rows,
+    int base_image_num_cols,
+    uint8_t *child_image,
+    uint8_t *child_nan_mask,
+    int child_image_num_rows,
+    int child_image_num_cols,
+    double base2child[3][3],
+    char *output_dir,
+    double homography_max_dist_between_matching_keypoints
+) {
+    HomographyBaseFeatures features;
+    bool success_homography = initHomographyBaseFeatures(
+        &features,
+        base_image,
+        base_nan_mask,
+        base_image_num_rows,
+        base_image_num_cols,
+        NULL
+    ) && estimateHomographyFromBaseFeatures(
+        &features,
+        base_image,
+        child_image,
+        child_nan_mask,
+        child_image_num_rows,
+        child_image_num_cols,
+        base2child,
+        output_dir,
+        homography_max_dist_between_matching_keypoints
+    );
+    freeHomographyBaseFeatures(&features);
+    return success_homography;
+}
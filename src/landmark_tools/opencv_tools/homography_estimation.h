@@ -12,6 +12,77 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "landmark_tools/opencv_tools/homography_match_method.h"
+#include "landmark_tools/opencv_tools/opencv_feature_matching.h"
+
+/**
+ * \brief Features of a base image for every homography match method
+ *
+ * Computed once and matched against any number of child images.
+ */
+typedef struct {
+    HomographyFeatureSet *sets[HOMOGRAPHY_MATCH_METHOD_COUNT];  ///< indexed by HomographyMatchMethod, NULL on failure
+    bool use_index;  ///< match with approximate FLANN indexes of the base descriptors instead of brute force
+} HomographyBaseFeatures;
+
+/**
+ * \brief Compute or load the features of a base image for every homography match method
+ *
+ * With a cache prefix, the features of each method are loaded from `<cache_prefix>_<METHOD>.yml.gz` when that file
+ * exists and was computed on an image of the same size, and are otherwise computed and saved there.
+ *
+ * \param[out] features Base features, free with `freeHomographyBaseFeatures`
+ * \param[in] base_image Base image data
+ * \param[in] base_nan_mask Mask for NaN pixels in base image
+ * \param[in] base_image_num_rows Number of rows in base image
+ * \param[in] base_image_num_cols Number of columns in base image
+ * \param[in] cache_prefix Path prefix of the feature files, or NULL to always compute the features
+ * \return true if the features of at least one method are available
+ */
+bool initHomographyBaseFeatures(
+    HomographyBaseFeatures *features,
+    uint8_t *base_image,
+    uint8_t *base_nan_mask,
+    int base_image_num_rows,
+    int base_image_num_cols,
+    const char *cache_prefix
+);
+
+/**
+ * \brief Free the feature sets of a base image
+ *
+ * \param[in] features Base features
+ */
+void freeHomographyBaseFeatures(HomographyBaseFeatures *features);
+
+/**
+ * \brief Estimate homography between a base image with precomputed features and a child image
+ *
+ * Same as `estimateHomographyFromFeatureMatching`, only the features of the child image are computed.
+ *
+ * \param[in] features Base features from `initHomographyBaseFeatures`
+ * \param[in] base_image Base image data, used to draw the matches
+ * \param[in] child_image Child image data
+ * \param[in] child_nan_mask Mask for NaN pixels in child image
+ * \param[in] child_image_num_rows Number of rows in child image
+ * \param[in] child_image_num_cols Number of columns in child image
+ * \param[out] base2child Estimated homography matrix (3x3)
+ * \param[in] output_dir Directory for saving debug outputs
+ * \param[in] homography_max_dist_between_matching_keypoints Maximum allowed distance between matching keypoints
+ * \return true if homography estimation was successful, false otherwise
+ */
+bool estimateHomographyFromBaseFeatures(
+    HomographyBaseFeatures *features,
+    uint8_t *base_image,
+    uint8_t *child_image,
+    uint8_t *child_nan_mask,
+    int child_image_num_rows,
+    int child_image_num_cols,
+    double base2child[3][3],
+    char *output_dir,
+    double homography_max_dist_between_matching_keypoints
+);
+
 /**
  * \brief Estimate homography between two images using feature matching
  * 
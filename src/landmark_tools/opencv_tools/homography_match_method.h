@@ -30,6 +30,8 @@ typedef enum {
     ORB    ///< Oriented FAST and Rotated BRIEF
 } HomographyMatchMethod;
 
+#define HOMOGRAPHY_MATCH_METHOD_COUNT 2   ///< number of HomographyMatchMethod values
+
 /**
  * \brief Convert HomographyMatchMethod enum to string representation
  * 
@@ -24,6 +24,18 @@
 
 #include "opencv_feature_matching.h"
 
+/**
+ \brief Keypoints and descriptors of one image for one match method
+ */
+struct HomographyFeatureSet {
+    HomographyMatchMethod method;
+    int num_rows;
+    int num_cols;
+    std::vector<cv::KeyPoint> keypoints;
+    cv::Mat descriptors;
+    cv::Ptr<cv::DescriptorMatcher> index;   // FLANN index of the descriptors, built by the first indexed match
+};
+
 const char* HomographyMatchMethodToStr(HomographyMatchMethod method){
     switch (method)
     {
@@ -39,117 +51,198 @@ const char* HomographyMatchMethodToStr(HomographyMatchMethod method){
     }
 }
 
+HomographyFeatureSet *create_homography_feature_set(
+    uint8_t *image,
+    uint8_t *nan_mask,
+    int num_rows,
+    int num_cols,
+    HomographyMatchMethod method
+)
+{
+    cv::Ptr<cv::Feature2D> detector;
+    if (method == ORB)
+    {
+        detector = cv::ORB::create();
+    }
+    else if (method == SIFT)
+    {
+        detector = cv::SIFT::create();
+    }
+    else
+    {
+      printf("Unrecognized homography match method: %u\n", method);
+      return NULL;
+    }
+
+    // Wrap the buffers without copying
+    cv::Mat image_mat = cv::Mat(num_rows, num_cols, CV_8UC1, image);
+    cv::Mat nan_mask_mat = cv::Mat(num_rows, num_cols, CV_8UC1, nan_mask);
+    // Feature detection masks are such that non-zero is region of interest
+    cv::Mat mask_mat;
+    cv::compare(nan_mask_mat, 0, mask_mat, cv::CMP_EQ);
+
+    HomographyFeatureSet *features = new HomographyFeatureSet();
+    features->method = method;
+    features->num_rows = num_rows;
+    features->num_cols = num_cols;
+
+    // Detect keypoints
+    detector->detect(image_mat, features->keypoints, mask_mat);
+
+    // TODO: filter keypoints based on masks
+
+    // Compute descriptors
+    detector->compute(image_mat, features->keypoints, features->descriptors);
+    return features;
+}
+
+HomographyFeatureSet *load_homography_feature_set(const char *path)
+{
+    HomographyFeatureSet *features = new HomographyFeatureSet();
+    try
+    {
+        cv::FileStorage fs(path, cv::FileStorage::READ);
+        if (!fs.isOpened())
+        {
+            delete features;
+            return NULL;
+        }
+        int method = -1;
+        fs["method"] >> method;
+        fs["num_rows"] >> features->num_rows;
+        fs["num_cols"] >> features->num_cols;
+        cv::read(fs["keypoints"], features->keypoints);
+        fs["descriptors"] >> features->descriptors;
+        if ((method != SIFT && method != ORB) || features->keypoints.size() != (size_t) features->descriptors.rows)
+        {
+            printf("load_homography_feature_set() ==>> %s is not a feature set\n", path);
+            delete features;
+            return NULL;
+        }
+        features->method = (HomographyMatchMethod) method;
+    }
+    catch (const cv::Exception &e)
+    {
+        printf("load_homography_feature_set() ==>> cannot read %s: %s\n", path, e.what());
+        delete features;
+        return NULL;
+    }
+    return features;
+}
+
+bool save_homography_feature_set(const HomographyFeatureSet *features, const char *path)
+{
+    try
+    {
+        cv::FileStorage fs(path, cv::FileStorage::WRITE);
+        if (!fs.isOpened())
+        {
+            printf("save_homography_feature_set() ==>> cannot open %s to write\n", path);
+            return false;
+        }
+        fs << "method" << (int) features->method;
+        fs << "num_rows" << features->num_rows;
+        fs << "num_cols" << features->num_cols;
+        cv::write(fs, "keypoints", features->keypoints);
+        fs << "descriptors" << features->descriptors;
+    }
+    catch (const cv::Exception &e)
+    {
+        printf("save_homography_feature_set() ==>> cannot write %s: %s\n", path, e.what());
+        return false;
+    }
+    return true;
+}
+
+bool homography_feature_set_matches(
+    const HomographyFeatureSet *features,
+    HomographyMatchMethod method,
+    int num_rows,
+    int num_cols
+)
+{
+    return features->method == method && features->num_rows == num_rows && features->num_cols == num_cols;
+}
+
+void free_homography_feature_set(HomographyFeatureSet *features)
+{
+    delete features;
+}
+
+/**
+ \brief Match every descriptor of `query` to its nearest descriptor of the indexed `train`, as (train, query) pairs
+ */
+static void match_with_index(HomographyFeatureSet *train, const cv::Mat &query, std::vector<cv::DMatch> &matches)
+{
+    if (train->index.empty())
+    {
+        // Binary ORB descriptors are hashed, SIFT descriptors go to randomized kd-trees
+        if (train->method == ORB)
+        {
+            train->index = cv::makePtr<cv::FlannBasedMatcher>(cv::makePtr<cv::flann::LshIndexParams>(12, 20, 2));
+        }
+        else
+        {
+            train->index = cv::makePtr<cv::FlannBasedMatcher>();
+        }
+        train->index->add(std::vector<cv::Mat>(1, train->descriptors));
+        train->index->train();
+    }
+    std::vector<cv::DMatch> query_matches;
+    train->index->match(query, query_matches);
+    matches.clear();
+    for (size_t i = 0; i < query_matches.size(); i++)
+    {
+        // LSH buckets can leave a query without neighbour
+        if (query_matches[i].trainIdx < 0)
+        {
+            continue;
+        }
+        matches.push_back(cv::DMatch(query_matches[i].trainIdx, query_matches[i].queryIdx, query_matches[i].distance));
+    }
+}
+
 // This returns the matrix such that
 // homography_arr * base_point is the corresponding point on the child image
 // modulo normalizations
-bool calc_homography_from_feature_matching(
+bool calc_homography_from_feature_sets(
+    HomographyFeatureSet *base_features,
+    const HomographyFeatureSet *child_features,
     uint8_t *base_image,
-    uint8_t *base_nan_mask,
-    int base_image_num_rows,
-    int base_image_num_cols,
     uint8_t *child_image,
-    uint8_t *child_nan_mask,
-    int child_image_num_rows,
-    int child_image_num_cols,
     double homography_arr[3][3],
-    HomographyMatchMethod homography_match_method,
     uint32_t homography_min_inlier_count,
     uint32_t *p_homography_found_inlier_count,
     bool do_draw_homography_image,
     char *path_draw_match_image,
     char *path_draw_inlier_image,
-    double homography_max_dist_between_matching_keypoints
+    double homography_max_dist_between_matching_keypoints,
+    bool use_index
 )
 {
-    // Build cv::Mat objects
-    cv::Mat base_image_mat = cv::Mat(base_image_num_rows, base_image_num_cols, CV_8UC1, base_image);
-    cv::Mat child_image_mat = cv::Mat(child_image_num_rows, child_image_num_cols, CV_8UC1, child_image);
-    cv::Mat base_mask_mat = cv::Mat(base_image_num_rows, base_image_num_cols, CV_8UC1);
-    cv::Mat child_mask_mat = cv::Mat(child_image_num_rows, child_image_num_cols, CV_8UC1);
-    // Feature detection masks are such that non-zero is region of interest
-    int base_pixel = 0;
-    for (int row = 0; row < base_image_num_rows; ++row)
+    if (base_features->method != child_features->method)
     {
-        for (int col = 0; col < base_image_num_cols; ++col)
-        {
-            if (base_nan_mask[base_pixel] > 0)
-            {
-                base_mask_mat.at<uint8_t>(row, col) = 0;
-            }
-            else
-            {
-                base_mask_mat.at<uint8_t>(row, col) = 1;
-            }
-            base_pixel += 1;
-        }
-    }
-    int child_pixel = 0;
-    for (int row = 0; row < child_image_num_rows; ++row)
-    {
-        for (int col = 0; col < child_image_num_cols; ++col)
-        {
-            if (child_nan_mask[child_pixel] > 0)
-            {
-                child_mask_mat.at<uint8_t>(row, col) = 0;
-            }
-            else
-            {
-                child_mask_mat.at<uint8_t>(row, col) = 1;
-            }
-            child_pixel += 1;
-        }
+      printf("calc_homography_from_feature_sets() ==>> feature sets of different match methods\n");
+      return false;
     }
-
-    std::vector<cv::KeyPoint> base_keypoints, child_keypoints;
+    const std::vector<cv::KeyPoint> &base_keypoints = base_features->keypoints;
+    const std::vector<cv::KeyPoint> &child_keypoints = child_features->keypoints;
     std::vector<cv::DMatch> matches;
 
-    cv::Mat base_descriptors, child_descriptors;
-    cv::Ptr<cv::FeatureDetector> detector;
-    cv::Ptr<cv::DescriptorExtractor> descriptor;
-    cv::Ptr<cv::DescriptorMatcher> matcher;
-
-    if (homography_match_method == ORB)
+    // Compute matches
+    if (base_features->descriptors.empty() || child_features->descriptors.empty())
     {
-        detector = cv::ORB::create();
-        descriptor = cv::ORB::create();
-        matcher = cv::BFMatcher::create(cv::NORM_HAMMING);
-
-        // Detect keypoints
-        detector->detect(base_image_mat, base_keypoints, base_mask_mat);
-        detector->detect(child_image_mat, child_keypoints, child_mask_mat);
-
-        // TODO: filter keypoints based on masks
-
-        // Compute descriptors
-        descriptor->compute(base_image_mat, base_keypoints, base_descriptors);
-        descriptor->compute(child_image_mat, child_keypoints, child_descriptors);
-
-        // Compute matches
-        matcher->match(base_descriptors, child_descriptors, matches);
+        // No keypoints on one side, so no matches
     }
-    else if (homography_match_method == SIFT)
+    else if (use_index)
     {
-        detector = cv::SIFT::create();
-        descriptor = cv::SIFT::create();
-        matcher = cv::BFMatcher::create(cv::NORM_L1);
-
-        // Detect keypoints
-        detector->detect(base_image_mat, base_keypoints, base_mask_mat);
-        detector->detect(child_image_mat, child_keypoints, child_mask_mat);
-
-        // TODO: filter keypoints based on masks
-
-        // Compute descriptors
-        descriptor->compute(base_image_mat, base_keypoints, base_descriptors);
-        descriptor->compute(child_image_mat, child_keypoints, child_descriptors);
-
-        // Compute matches
-        matcher->match(base_descriptors, child_descriptors, matches);
+        match_with_index(base_features, child_features->descriptors, matches);
     }
     else
     {
-      printf("Unrecognized homography match method: %u\n", homography_match_method);
-      return false;
+        cv::Ptr<cv::DescriptorMatcher> matcher =
+            cv::BFMatcher::create(base_features->method == ORB ? cv::NORM_HAMMING : cv::NORM_L1);
+        matcher->match(base_features->descriptors, child_features->descriptors, matches);
     }
 
     // Filter matches
@@ -248,6 +341,8 @@ bool calc_homography_from_feature_matching(
     // Draw matches
     if (do_draw_homography_image)
     {
+      cv::Mat base_image_mat = cv::Mat(base_features->num_rows, base_features->num_cols, CV_8UC1, base_image);
+      cv::Mat child_image_mat = cv::Mat(child_features->num_rows, child_features->num_cols, CV_8UC1, child_image);
       cv::Mat match_mat;
       cv::drawMatches(
           base_image_mat,
@@ -281,3 +376,44 @@ bool calc_homography_from_feature_matching(
     return true;
 }
 
+bool calc_homography_from_feature_matching(
+    uint8_t *base_image,
+    uint8_t *base_nan_mask,
+    int base_image_num_rows,
+    int base_image_num_cols,
+    uint8_t *child_image,
+    uint8_t *child_nan_mask,
+    int child_image_num_rows,
+    int child_image_num_cols,
+    double homography_arr[3][3],
+    HomographyMatchMethod homography_match_method,
+    uint32_t homography_min_inlier_count,
+    uint32_t *p_homography_found_inlier_count,
+    bool do_draw_homography_image,
+    char *path_draw_match_image,
+    char *path_draw_inlier_image,
+    double homography_max_dist_between_matching_keypoints
+)
+{
+    HomographyFeatureSet *base_features = create_homography_feature_set(
+        base_image, base_nan_mask, base_image_num_rows, base_image_num_cols, homography_match_method);
+    HomographyFeatureSet *child_features = create_homography_feature_set(
+        child_image, child_nan_mask, child_image_num_rows, child_image_num_cols, homography_match_method);
+    bool success = base_features != NULL && child_features != NULL && calc_homography_from_feature_sets(
+        base_features,
+        child_features,
+        base_image,
+        child_image,
+        homography_arr,
+        homography_min_inlier_count,
+        p_homography_found_inlier_count,
+        do_draw_homography_image,
+        path_draw_match_image,
+        path_draw_inlier_image,
+        homography_max_dist_between_matching_keypoints,
+        false
+    );
+    free_homography_feature_set(base_features);
+    free_homography_feature_set(child_features);
+    return success;
+}
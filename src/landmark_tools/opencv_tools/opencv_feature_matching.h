@@ -28,6 +28,98 @@ extern "C" {
 
 #include "landmark_tools/opencv_tools/homography_match_method.h"
 
+/**
+ \brief Keypoints and descriptors of one image for one match method
+
+ A base image matched against many child images only needs its features detected once. The set can be saved and
+ loaded again by later runs, and keeps the FLANN index of its descriptors once one is built.
+*/
+typedef struct HomographyFeatureSet HomographyFeatureSet;
+
+/**
+ \brief Detect the keypoints of an image and compute their descriptors
+
+ \param[in] image num_rows*num_cols image
+ \param[in] nan_mask num_rows*num_cols mask, non-zero where the image has no data
+ \param[in] num_rows
+ \param[in] num_cols
+ \param[in] method
+ \return the feature set, or NULL for an unknown method. Free with `free_homography_feature_set`.
+*/
+HomographyFeatureSet *create_homography_feature_set(
+    uint8_t *image,
+    uint8_t *nan_mask,
+    int num_rows,
+    int num_cols,
+    HomographyMatchMethod method
+);
+
+/**
+ \brief Load a feature set written by `save_homography_feature_set`
+
+ \param[in] path
+ \return the feature set, or NULL if the file cannot be read
+*/
+HomographyFeatureSet *load_homography_feature_set(const char *path);
+
+/**
+ \brief Write a feature set to a file readable by `load_homography_feature_set`
+
+ The format is chosen from the extension by cv::FileStorage, e.g. `.yml.gz`.
+ \param[in] features
+ \param[in] path
+ \return false if the file cannot be written
+*/
+bool save_homography_feature_set(const HomographyFeatureSet *features, const char *path);
+
+/**
+ \brief Whether a feature set was computed with `method` on an image of `num_rows` x `num_cols`
+*/
+bool homography_feature_set_matches(
+    const HomographyFeatureSet *features,
+    HomographyMatchMethod method,
+    int num_rows,
+    int num_cols
+);
+
+/**
+ \brief Free a feature set. NULL is ignored.
+*/
+void free_homography_feature_set(HomographyFeatureSet *features);
+
+/**
+ \brief Calculate the homography from base to child image from precomputed feature sets
+
+ Same as `calc_homography_from_feature_matching` without detecting the features again.
+ \param[in,out] base_features features of the base image. The FLANN index is built and kept when `use_index` is set.
+ \param[in] child_features features of the child image, computed with the same method
+ \param[in] base_image only used to draw the matches
+ \param[in] child_image only used to draw the matches
+ \param[out] homography_arr
+ \param[in] homography_min_inlier_count
+ \param[out] p_homography_found_inlier_count
+ \param[in] do_draw_homography_image
+ \param[in] path_draw_match_image
+ \param[in] path_draw_inlier_image
+ \param[in] homography_max_dist_between_matching_keypoints
+ \param[in] use_index match with an approximate FLANN index of the base descriptors instead of the exact brute force
+ \return false if the homography is not found
+*/
+bool calc_homography_from_feature_sets(
+    HomographyFeatureSet *base_features,
+    const HomographyFeatureSet *child_features,
+    uint8_t *base_image,
+    uint8_t *child_image,
+    double homography_arr[3][3],
+    uint32_t homography_min_inlier_count,
+    uint32_t *p_homography_found_inlier_count,
+    bool do_draw_homography_image,
+    char *path_draw_match_image,
+    char *path_draw_inlier_image,
+    double homography_max_dist_between_matching_keypoints,
+    bool use_index
+);
+
 /**
  \brief TODO
  
@@ -15,13 +15,41 @@
  */
 
 #include "opencv_image_io.h"
+#include "landmark_tools/image_io/image_stream.h"
 
 #include <opencv2/opencv.hpp>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <strings.h>                // for strcasecmp
+
+static bool has_extension(const char* filename, const char* extension) {
+    size_t length = strlen(filename);
+    size_t extension_length = strlen(extension);
+    return length >= extension_length && strcasecmp(filename + length - extension_length, extension) == 0;
+}
 
 uint8_t* readPGMToArray(const char* filename, int* width, int* height) {
+    // Gray PGM and PNG files are decoded on a background thread while the rows are copied out
+    int32_t cols, rows, channels;
+    Image_Reader* reader = Open_Image_Reader(filename, &cols, &rows, &channels);
+    if (reader != NULL && channels == 1) {
+        uint8_t* array = (uint8_t*)malloc((size_t)cols * rows * sizeof(uint8_t));
+        if (array == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed.\n");
+        } else if (!Read_Image_Rows(reader, array, 0, rows)) {
+            fprintf(stderr, "Error: Could not read the image.\n");
+            free(array);
+            array = NULL;
+        }
+        Close_Image_Reader(reader);
+        *width = cols;
+        *height = rows;
+        return array;
+    }
+    Close_Image_Reader(reader);
+
     // Load the image in grayscale mode (CV_8U means 8-bit unsigned single-channel)
     cv::Mat image = cv::imread(filename, cv::IMREAD_GRAYSCALE);
 
@@ -35,19 +63,35 @@ uint8_t* readPGMToArray(const char* filename, int* width, int* height) {
     *height = image.rows;
 
     // Allocate memory for the uint8_t array
-    uint8_t* array = (uint8_t*)malloc(*width * *height * sizeof(uint8_t));
+    size_t num_pixels = (size_t)image.cols * image.rows;
+    uint8_t* array = (uint8_t*)malloc(num_pixels * sizeof(uint8_t));
     if (array == NULL) {
         fprintf(stderr, "Error: Memory allocation failed.\n");
         return NULL;
     }
 
-    // Copy image data to the uint8_t array
-    memcpy(array, image.data, *width * *height * sizeof(uint8_t));
+    // Copy image data to the uint8_t array through a view of it, which also handles padded rows
+    cv::Mat array_mat(image.rows, image.cols, CV_8UC1, array);
+    image.copyTo(array_mat);
 
     return array;
 }
 
 bool writePGMFromArray(const char* filename, const uint8_t* array, int width, int height) {
+    if (has_extension(filename, ".pgm") || has_extension(filename, ".png")) {
+        // Rows are encoded on the writer thread while the next ones are staged
+        Image_Writer* writer = Open_Image_Writer(filename, width, height, 1);
+        if (writer == NULL) {
+            return false;
+        }
+        bool success = Append_Image_Rows(writer, array, 0, height);
+        if (!Close_Image_Writer(writer) || !success) {
+            fprintf(stderr, "Error: Could not write the image.\n");
+            return false;
+        }
+        return true;
+    }
+
     // Create a cv::Mat from the array data with the specified width and height
     cv::Mat image(height, width, CV_8UC1, (void*)array);
 
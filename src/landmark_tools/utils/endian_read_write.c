@@ -16,6 +16,7 @@
 
 #include "landmark_tools/utils/endian_read_write.h"
 #include <inttypes.h> 
+#include <string.h>      // for memcpy
 
 #if defined(LINUX_OS) || defined(MAC_OS)
 
@@ -38,48 +39,151 @@
 
 #endif
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define ENDIAN_SWAP_X86
+#include <tmmintrin.h>   // for _mm_shuffle_epi8
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>    // for vrev16q_u8, vrev32q_u8, vrev64q_u8
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define HOST_IS_BIG_ENDIAN 1
+#else
+#define HOST_IS_BIG_ENDIAN 0
+#endif
+
+/** Size in bytes of the staging buffer used by write_big_endian_array */
+#define ENDIAN_CHUNK_BYTES 65536
+
+static bool is_supported_width(uint8_t byte_width, bool isfloat){
+    if(isfloat){
+        return byte_width == 32 || byte_width == 64;
+    }
+    return byte_width == 16 || byte_width == 32 || byte_width == 64;
+}
+
+/* Swap the elements of bytes[i, nbytes). The shift expressions are recognized by the compiler as bswap
+ * instructions. */
+static void swap_bytes_scalar(uint8_t *bytes, uint8_t byte_width, size_t i, size_t nbytes){
+    if(byte_width == 16){
+        for(; i < nbytes; i += 2){
+            uint16_t v;
+            memcpy(&v, bytes + i, 2);
+            v = (uint16_t)((v >> 8) | (v << 8));
+            memcpy(bytes + i, &v, 2);
+        }
+    }else if(byte_width == 32){
+        for(; i < nbytes; i += 4){
+            uint32_t v;
+            memcpy(&v, bytes + i, 4);
+            v = (v >> 24) | ((v >> 8) & 0x0000FF00u) | ((v << 8) & 0x00FF0000u) | (v << 24);
+            memcpy(bytes + i, &v, 4);
+        }
+    }else if(byte_width == 64){
+        for(; i < nbytes; i += 8){
+            uint64_t v;
+            memcpy(&v, bytes + i, 8);
+            v = ((v & 0x00000000000000FFull) << 56) | ((v & 0x000000000000FF00ull) << 40) |
+                ((v & 0x0000000000FF0000ull) << 24) | ((v & 0x00000000FF000000ull) << 8)  |
+                ((v & 0x000000FF00000000ull) >> 8)  | ((v & 0x0000FF0000000000ull) >> 24) |
+                ((v & 0x00FF000000000000ull) >> 40) | ((v & 0xFF00000000000000ull) >> 56);
+            memcpy(bytes + i, &v, 8);
+        }
+    }
+}
+
+#ifdef ENDIAN_SWAP_X86
+
+/* Returns the bytes swapped, a multiple of 16. The default x86-64 target has no SSSE3, so the shuffle is compiled
+ * for it here and chosen at run time. */
+__attribute__((target("ssse3")))
+static size_t swap_bytes_ssse3(uint8_t *bytes, uint8_t byte_width, size_t nbytes){
+    __m128i mask;
+    if(byte_width == 16){
+        mask = _mm_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+    }else if(byte_width == 32){
+        mask = _mm_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+    }else{
+        mask = _mm_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+    }
+    size_t i = 0;
+    for(; i + 16 <= nbytes; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+        _mm_storeu_si128((__m128i *)(bytes + i), _mm_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+
+#endif // ENDIAN_SWAP_X86
+
+void swap_big_endian_array_scalar(void* array, uint8_t byte_width, int64_t size){
+#if HOST_IS_BIG_ENDIAN
+    (void)array; (void)byte_width; (void)size;
+#else
+    swap_bytes_scalar((uint8_t *)array, byte_width, 0, (size_t)size * (byte_width / 8));
+#endif
+}
+
+void swap_big_endian_array(void* array, uint8_t byte_width, int64_t size){
+#if HOST_IS_BIG_ENDIAN
+    (void)array; (void)byte_width; (void)size;
+#else
+    uint8_t *bytes = (uint8_t *)array;
+    size_t nbytes = (size_t)size * (byte_width / 8);
+    size_t i = 0;
+
+#if defined(ENDIAN_SWAP_X86)
+    if(__builtin_cpu_supports("ssse3")){
+        i = swap_bytes_ssse3(bytes, byte_width, nbytes);
+    }
+#elif defined(__ARM_NEON)
+    for(; i + 16 <= nbytes; i += 16){
+        uint8x16_t v = vld1q_u8(bytes + i);
+        if(byte_width == 16){
+            v = vrev16q_u8(v);
+        }else if(byte_width == 32){
+            v = vrev32q_u8(v);
+        }else{
+            v = vrev64q_u8(v);
+        }
+        vst1q_u8(bytes + i, v);
+    }
+#endif
+
+    swap_bytes_scalar(bytes, byte_width, i, nbytes);
+#endif
+}
+
+const char *swap_big_endian_kernel_name(void){
+#if HOST_IS_BIG_ENDIAN
+    return "none";
+#elif defined(ENDIAN_SWAP_X86)
+    if(__builtin_cpu_supports("ssse3")) return "ssse3";
+    return "scalar";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
 int64_t read_big_endian_array(void* array, uint8_t byte_width, bool isfloat, int64_t size, FILE *fp){
     if(array == NULL){
         printf("array must be pre-allocated\n");
         return 0;
     }
     
-    for(int32_t i = 0; i< size; i++){
-        if(isfloat){
-            if(byte_width == 32){
-                float* ptr = (float*)array;
-                if(!read_float_big_endian(fp, &ptr[i])) return i;
-            }else if(byte_width == 64){
-                double* ptr = (double*)array;
-                if(!read_double_big_endian(fp, &ptr[i])) return i;
-            }else{
-                printf("read_big_endian_array: Unsupported float numerical type %" PRId64 "\n", size);
-                return 0;
-            }
-        }else{
-            if(byte_width == 32){
-                uint32_t big_endian_32;
-                if(fread(&big_endian_32, sizeof(uint32_t), 1, fp) != 1) return i;
-                uint32_t* ptr = (uint32_t*)array;
-                ptr[i] = ntohl(big_endian_32);
-            }else if(byte_width == 64){
-                uint64_t big_endian_64;
-                if(fread(&big_endian_64, sizeof(uint64_t), 1, fp) != 1) return i;
-                uint64_t* ptr = (uint64_t*)array;
-                ptr[i] = ntohll(big_endian_64);
-            }else if(byte_width == 16){
-                uint16_t big_endian_16;
-                if(fread(&big_endian_16, sizeof(uint16_t), 1, fp) != 1) return i;
-                uint16_t* ptr = (uint16_t*)array;
-                ptr[i] = ntohs(big_endian_16);
-            }else{
-                printf("read_big_endian_array: Unsupported int numerical type %" PRId64 "\n", size);
-                return 0;
-            }
-            
-        }
+    if(!is_supported_width(byte_width, isfloat)){
+        printf("read_big_endian_array: Unsupported %s numerical type %d\n", isfloat ? "float" : "int", byte_width);
+        return 0;
     }
-    return size;
+    
+    if(size <= 0) return 0;
+    
+    /* Read straight into the destination, then swap in place */
+    size_t count = fread(array, byte_width / 8, (size_t)size, fp);
+    swap_big_endian_array(array, byte_width, (int64_t)count);
+    return (int64_t)count;
 }
 
 bool read_double_big_endian(FILE *fp, double *val) {
@@ -118,39 +222,32 @@ bool read_float_big_endian(FILE *fp, float *val) {
 
 
 int64_t write_big_endian_array(const void* array, uint8_t byte_width, bool isfloat, int64_t size, FILE *fp){
-    for(int32_t i = 0; i< size; i++){
-        if(isfloat){
-            if(byte_width == 32){
-                float* ptr = (float*)array;
-                if(!write_float_big_endian(fp, ptr[i])) return i;
-            }else if(byte_width == 64){
-                double* ptr = (double*)array;
-                if(!write_double_big_endian(fp, ptr[i])) return i;
-            }else{
-                printf("write_big_endian_array: Unsupported float numerical type %" PRId64 "\n", size);
-                return 0;
-            }
-            
-        }else{
-            if(byte_width == 32){
-                uint32_t* ptr = (uint32_t*)array;
-                uint32_t big_endian_32 = htonl(ptr[i]);
-                if(fwrite(&big_endian_32, sizeof(uint32_t), 1, fp) != 1) return i;
-            }else if(byte_width == 64){
-                uint64_t* ptr = (uint64_t*)array;
-                uint64_t big_endian_64 = htonll(ptr[i]);
-                if(fwrite(&big_endian_64, sizeof(uint64_t), 1, fp)!= 1) return i;
-            }else if(byte_width == 16){
-                uint16_t* ptr = (uint16_t*)array;
-                uint16_t big_endian_16 = htons(ptr[i]);
-                if(fwrite(&big_endian_16, sizeof(uint16_t), 1, fp)!= 1) return i;
-            }else{
-                printf("write_big_endian_array: Unsupported float numerical type %" PRId64 "\n", size);
-                return 0;
-            }
-        }
+    if(!is_supported_width(byte_width, isfloat)){
+        printf("write_big_endian_array: Unsupported %s numerical type %d\n", isfloat ? "float" : "int", byte_width);
+        return 0;
     }
-    return size;
+    
+    if(size <= 0) return 0;
+    
+    size_t width = byte_width / 8;
+#if HOST_IS_BIG_ENDIAN
+    return (int64_t)fwrite(array, width, (size_t)size, fp);
+#else
+    /* The caller's array is const, so stage chunks in a local buffer */
+    uint8_t buffer[ENDIAN_CHUNK_BYTES];
+    size_t chunk = ENDIAN_CHUNK_BYTES / width;
+    const uint8_t *src = (const uint8_t *)array;
+    int64_t written = 0;
+    while(written < size){
+        size_t n = (size_t)(size - written) < chunk ? (size_t)(size - written) : chunk;
+        memcpy(buffer, src + (size_t)written * width, n * width);
+        swap_big_endian_array(buffer, byte_width, (int64_t)n);
+        size_t out = fwrite(buffer, width, n, fp);
+        written += (int64_t)out;
+        if(out != n) break;
+    }
+    return written;
+#endif
 }
 
 bool write_double_big_endian(FILE *fp, double val) {
@@ -182,3 +279,13 @@ bool write_float_big_endian(FILE *fp, float val) {
     
     return true;
 }
+
+bool seek_file_offset(FILE *fp, int64_t offset){
+#if defined(LINUX_OS) || defined(MAC_OS)
+    return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#elif defined(WINDOWS_OS)
+    return _fseeki64(fp, offset, SEEK_SET) == 0;
+#else
+    return fseek(fp, (long)offset, SEEK_SET) == 0;
+#endif
+}
@@ -26,6 +26,10 @@
 #include <stdint.h>   // for int64_t, uint8_t
 #include <stdio.h>    // for FILE
 
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
 /**
  \brief Read a big endian byte array from a file 
  Supports floating point and integer types
@@ -36,9 +40,32 @@
  \param[in] size the total number of elements in the array
  \param[in] fp file pointer
  \return int64_t number of elements sucessfully read
+
+ The array is read with a single bulk fread and byte-swapped in place. 
 */
 int64_t read_big_endian_array(void* array, uint8_t byte_width, bool isfloat, int64_t size, FILE *fp);
 
+/**
+ \brief Convert an array between big endian and host byte order in place
+ Uses NEON byte shuffles, or SSSE3 ones on x86-64 CPUs that support it, chosen at run time. No-op on big endian
+ hosts.
+ 
+ \param[in,out] array values to convert
+ \param[in] byte_width the bit width of an array element (16, 32 or 64)
+ \param[in] size the total number of elements in the array
+*/
+void swap_big_endian_array(void* array, uint8_t byte_width, int64_t size);
+
+/**
+ \brief Reference element by element version of `swap_big_endian_array`
+*/
+void swap_big_endian_array_scalar(void* array, uint8_t byte_width, int64_t size);
+
+/**
+ \brief Name of the byte shuffle used by `swap_big_endian_array`, for logging
+*/
+const char *swap_big_endian_kernel_name(void);
+
 /**
  \brief Read a double stored in big endian byte order from a file 
  
@@ -69,6 +96,8 @@ bool read_float_big_endian(FILE *fp, float *val);
  \param[in] size the total number of elements in the array
  \param[in] fp file pointer
  \return int64_t number of points successfully written
+
+ Elements are byte-swapped into a fixed size staging buffer and written in chunks.
 */
 int64_t write_big_endian_array(const void* array, uint8_t byte_width, bool isfloat, int64_t size, FILE *fp);
 
@@ -92,4 +121,18 @@ bool write_double_big_endian(FILE *fp, double val);
 */
 bool write_float_big_endian(FILE *fp, float val);
 
+/**
+ \brief Seek to an absolute byte offset, using 64 bit offsets where the platform provides them
+ 
+ \param[in] fp file pointer
+ \param[in] offset byte offset from the start of the file
+ \return true on success
+ \return false on io error
+*/
+bool seek_file_offset(FILE *fp, int64_t offset);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
 #endif /* _LANDMARK_TOOLS_ENDIAN_READ_WRITE_H_ */
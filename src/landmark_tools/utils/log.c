@@ -0,0 +1,161 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <pthread.h>  // for pthread_mutex_t
+#include <stdarg.h>   // for va_list
+#include <stdio.h>    // for printf, vsnprintf
+#include <stdlib.h>   // for getenv
+#include <string.h>   // for strcmp
+
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/time_budget.h"
+
+#define LOG_MESSAGE_SIZE 1024
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LogSink log_sink = NULL;
+static void *log_user = NULL;
+static int32_t log_max_level = LOG_LEVEL_INFO;
+static ProgressSink progress_sink = NULL;
+static void *progress_user = NULL;
+static double progress_interval = LOG_PROGRESS_INTERVAL;
+static const char *progress_task = NULL;   // task of the last report
+static double progress_time = 0;           // time_budget_now of the last report
+
+void log_set_sink(LogSink sink, void *user, LogLevel max_level)
+{
+    pthread_mutex_lock(&log_mutex);
+    log_sink = sink;
+    log_user = user;
+    log_max_level = max_level;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+void log_set_progress_sink(ProgressSink sink, void *user, double min_interval_seconds)
+{
+    pthread_mutex_lock(&log_mutex);
+    progress_sink = sink;
+    progress_user = user;
+    progress_interval = min_interval_seconds;
+    progress_task = NULL;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+/**
+ * \brief Level of a name of `-log_level`
+ * \return false if the name is not a level or silent
+ */
+static bool parse_level(const char *name, LogLevel *level, bool *silent)
+{
+    const char *names[] = {"error", "warning", "info", "debug"};
+    *silent = strcmp(name, "silent") == 0;
+    if (*silent) return true;
+    for (int32_t k = 0; k < 4; k++) {
+        if (strcmp(name, names[k]) == 0) {
+            *level = (LogLevel)k;
+            return true;
+        }
+    }
+    return false;
+}
+
+void log_init(int32_t *argc, char **argv)
+{
+    const char *name = NULL;
+    for (int32_t i = 1; i + 1 < *argc; i++) {
+        if (strcmp(argv[i], LOG_LEVEL_ARG) == 0) {
+            name = argv[i + 1];
+            for (int32_t j = i; j + 2 <= *argc; j++) argv[j] = argv[j + 2];
+            *argc -= 2;
+            break;
+        }
+    }
+    if (name == NULL) name = getenv(LOG_LEVEL_ENV);
+
+    LogLevel level = LOG_LEVEL_INFO;
+    bool silent = false;
+    if (name != NULL && name[0] != '\0' && !parse_level(name, &level, &silent)) {
+        printf("log_init() ==>> unknown log level %.64s, using info\n", name);
+    }
+    if (silent) {
+        log_set_sink(NULL, NULL, LOG_LEVEL_ERROR);
+        log_set_progress_sink(NULL, NULL, LOG_PROGRESS_INTERVAL);
+        return;
+    }
+    log_set_sink(log_stdout_sink, NULL, level);
+    log_set_progress_sink(level >= LOG_LEVEL_INFO ? log_stdout_progress : NULL, NULL, LOG_PROGRESS_INTERVAL);
+}
+
+bool log_enabled(LogLevel level)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    LogSink sink = __atomic_load_n(&log_sink, __ATOMIC_RELAXED);
+    int32_t max_level = __atomic_load_n(&log_max_level, __ATOMIC_RELAXED);
+#else
+    LogSink sink = log_sink;
+    int32_t max_level = log_max_level;
+#endif
+    return sink != NULL && (int32_t)level <= max_level;
+}
+
+void log_message(LogLevel level, const char *format, ...)
+{
+    if (!log_enabled(level)) return;
+    char message[LOG_MESSAGE_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    pthread_mutex_lock(&log_mutex);
+    if (log_sink != NULL && (int32_t)level <= log_max_level) log_sink(log_user, level, message);
+    pthread_mutex_unlock(&log_mutex);
+}
+
+void log_progress(const char *task, int64_t done, int64_t total)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    if (__atomic_load_n(&progress_sink, __ATOMIC_RELAXED) == NULL) return;
+#else
+    if (progress_sink == NULL) return;
+#endif
+    double now = time_budget_now();
+    pthread_mutex_lock(&log_mutex);
+    bool first = progress_task == NULL || strcmp(progress_task, task) != 0 || done <= 0;
+    bool last = done >= total;
+    if (progress_sink != NULL && (first || last || now - progress_time >= progress_interval)) {
+        progress_sink(progress_user, task, done, total);
+        progress_task = task;
+        progress_time = now;
+    }
+    pthread_mutex_unlock(&log_mutex);
+}
+
+void log_stdout_sink(void *user, LogLevel level, const char *message)
+{
+    (void)user;
+    if (level == LOG_LEVEL_WARNING) {
+        printf("Warning: %s\n", message);
+    } else {
+        printf("%s\n", message);
+    }
+}
+
+void log_stdout_progress(void *user, const char *task, int64_t done, int64_t total)
+{
+    (void)user;
+    printf("%s: %lld of %lld\n", task, (long long)done, (long long)total);
+}
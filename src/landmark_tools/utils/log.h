@@ -0,0 +1,130 @@
+/**
+ * \file log.h
+ * \brief Log messages and progress of the library, sent to sinks registered once by the application
+ *
+ * The library is silent until a sink is registered with `log_set_sink` or `log_set_progress_sink`, so it can be
+ * embedded in a service or a Python process without writing to its standard output. The executables call `log_init`,
+ * which prints to standard output at the level of `-log_level <error|warning|info|debug|silent>` or the
+ * `LANDMARK_TOOLS_LOG_LEVEL` environment variable, `info` by default.
+ *
+ * Messages above the level of the sink are dropped before they are formatted. Progress reports of a task are
+ * rate limited to one per `min_interval_seconds`, and the first and last report of a task are always sent. Sinks are
+ * called one at a time, from any thread of the library.
+ *
+ * Errors are still printed directly by the functions that detect them.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_LOG_H_
+#define _LANDMARK_TOOLS_LOG_H_
+
+#include <stdbool.h>  // for bool
+#include <stdint.h>   // for int32_t, int64_t
+
+#define LOG_LEVEL_ENV "LANDMARK_TOOLS_LOG_LEVEL"  //!< Environment variable holding the level of the executables
+#define LOG_LEVEL_ARG "-log_level"                //!< Command line option holding the level of the executables
+#define LOG_PROGRESS_INTERVAL 1.0                 //!< Seconds between progress reports of the executables
+
+/**
+ * \brief Importance of a message
+ */
+typedef enum {
+    LOG_LEVEL_ERROR = 0,       /*!< \brief The call fails */
+    LOG_LEVEL_WARNING = 1,     /*!< \brief The call goes on with a degraded result */
+    LOG_LEVEL_INFO = 2,        /*!< \brief What the call reads, detects or writes */
+    LOG_LEVEL_DEBUG = 3        /*!< \brief Details of each block or feature */
+} LogLevel;
+
+/**
+ * \brief Receives one message, without a trailing newline
+ */
+typedef void (*LogSink)(void *user, LogLevel level, const char *message);
+
+/**
+ * \brief Receives the progress of a task, `done` of `total` units
+ */
+typedef void (*ProgressSink)(void *user, const char *task, int64_t done, int64_t total);
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Register the sink of the messages
+ *
+ * \param[in] sink called for each message up to `max_level`, or NULL to drop every message
+ * \param[in] user first argument of `sink`
+ * \param[in] max_level most detailed level sent to `sink`
+ */
+void log_set_sink(LogSink sink, void *user, LogLevel max_level);
+
+/**
+ * \brief Register the sink of the progress reports
+ *
+ * \param[in] sink called with the progress of tasks, or NULL to drop every report
+ * \param[in] user first argument of `sink`
+ * \param[in] min_interval_seconds least time between two reports of the same task
+ */
+void log_set_progress_sink(ProgressSink sink, void *user, double min_interval_seconds);
+
+/**
+ * \brief Print the messages and progress to standard output, at the level of `-log_level` or
+ * `LANDMARK_TOOLS_LOG_LEVEL`, at the start of `main`
+ *
+ * `-log_level <level>` is removed from the arguments, so the option parsing of the executable does not see it.
+ * \param[in,out] argc number of arguments
+ * \param[in,out] argv arguments, including the program name
+ */
+void log_init(int32_t *argc, char **argv);
+
+/**
+ * \brief True if a message of `level` reaches the sink, to skip preparing messages that would be dropped
+ */
+bool log_enabled(LogLevel level);
+
+/**
+ * \brief Send a printf formatted message to the sink
+ */
+void log_message(LogLevel level, const char *format, ...)
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+/**
+ * \brief Report the progress of a task to the progress sink, at most once per interval
+ *
+ * \param[in] task name of the task, a string constant
+ * \param[in] done units done so far
+ * \param[in] total units of the task
+ */
+void log_progress(const char *task, int64_t done, int64_t total);
+
+/**
+ * \brief Sink of `log_init`, printing each message on a line of standard output
+ */
+void log_stdout_sink(void *user, LogLevel level, const char *message);
+
+/**
+ * \brief Progress sink of `log_init`, printing each report on a line of standard output
+ */
+void log_stdout_progress(void *user, const char *task, int64_t done, int64_t total);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_LOG_H_ */
@@ -0,0 +1,417 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <pthread.h>  // for pthread_mutex_lock
+#include <stdlib.h>   // for malloc, calloc, free, getenv, atexit, strtod
+#include <string.h>   // for strcmp, strncmp, strcspn, strrchr, memset
+
+#if defined(LINUX_OS) || defined(MAC_OS)
+#include <sys/mman.h> // for mmap, munmap, madvise
+#define MEM_HAVE_MMAP
+#endif
+
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/parallel.h"
+#include "landmark_tools/utils/safe_string.h"
+
+#define MEM_STATS_PATH_SIZE 1024
+#define MEM_STATS_PROGRAM_SIZE 128
+#define MEM_TOUCH_PAGE_BYTES 4096   // bytes apart of the writes of the first touch
+
+static const char *subsystem_names[MEM_NUM_SUBSYSTEMS] = {
+    "landmark", "gridding", "dem", "matching", "correlation"
+};
+
+/**
+ * \brief A tracked allocation
+ */
+typedef struct {
+    void *ptr;
+    size_t bytes;
+    size_t mapped;      // bytes of the mapping holding ptr, 0 if ptr is from malloc
+    int32_t subsystem;
+} MemEntry;
+
+// Tracked allocations are few and large, so they are kept in an array searched from the newest
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static MemEntry *entries = NULL;
+static size_t num_entries = 0;
+static size_t entries_capacity = 0;
+static MemStats totals = {{0}};
+static bool report_registered = false;
+static char report_path[MEM_STATS_PATH_SIZE] = "";
+static char program_name[MEM_STATS_PROGRAM_SIZE] = "";
+static uint32_t page_policy = 0;
+
+/**
+ * \brief Index of the entry of `ptr`, or -1. Must hold mem_lock
+ */
+static int64_t find_entry(const void *ptr)
+{
+    for (size_t i = num_entries; i > 0; i--) {
+        if (entries[i - 1].ptr == ptr) return (int64_t)(i - 1);
+    }
+    return -1;
+}
+
+/**
+ * \brief Remove an entry and its bytes. Must hold mem_lock
+ */
+static void remove_entry(int64_t index)
+{
+    MemEntry *entry = &entries[index];
+    totals.current[entry->subsystem] -= entry->bytes;
+    totals.current_total -= entry->bytes;
+    entries[index] = entries[num_entries - 1];
+    num_entries--;
+}
+
+/**
+ * \brief Reserve `bytes` for `subsystem` if they fit in the budget. Must hold mem_lock
+ */
+static bool reserve_bytes(MemSubsystem subsystem, size_t bytes)
+{
+    if (totals.budget > 0 && totals.current_total + bytes > totals.budget) {
+        SAFE_PRINTF(512, "mem_malloc() ==>> %zu bytes of %s memory would exceed the budget of %zu bytes, %zu held\n",
+                    bytes, subsystem_names[subsystem], totals.budget, totals.current_total);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Count an allocation. Must hold mem_lock
+ * \return false if the entry cannot be stored, the allocation is then not counted
+ */
+static bool add_entry(MemSubsystem subsystem, void *ptr, size_t bytes, size_t mapped)
+{
+    // An address freed with plain free() can come back from malloc, its old entry is stale
+    int64_t stale = find_entry(ptr);
+    if (stale >= 0) remove_entry(stale);
+
+    if (num_entries == entries_capacity) {
+        size_t capacity = entries_capacity > 0 ? entries_capacity * 2 : 64;
+        MemEntry *grown = (MemEntry *)realloc(entries, capacity * sizeof(MemEntry));
+        if (grown == NULL) return false;
+        entries = grown;
+        entries_capacity = capacity;
+    }
+    entries[num_entries].ptr = ptr;
+    entries[num_entries].bytes = bytes;
+    entries[num_entries].mapped = mapped;
+    entries[num_entries].subsystem = subsystem;
+    num_entries++;
+
+    totals.current[subsystem] += bytes;
+    totals.current_total += bytes;
+    if (totals.current[subsystem] > totals.peak[subsystem]) totals.peak[subsystem] = totals.current[subsystem];
+    if (totals.current_total > totals.peak_total) totals.peak_total = totals.current_total;
+    return true;
+}
+
+#ifdef MEM_HAVE_MMAP
+/**
+ * \brief Anonymous mapping of at least `bytes`, starting on a huge page, following `policy`
+ *
+ * \param[out] mapped bytes of the mapping
+ * \return NULL if the pages cannot be mapped
+ */
+static void *map_pages(size_t bytes, uint32_t policy, size_t *mapped)
+{
+    size_t length = (bytes + MEM_HUGE_PAGE_BYTES - 1) & ~(MEM_HUGE_PAGE_BYTES - 1);
+#ifdef MAP_HUGETLB
+    if (policy & MEM_POLICY_HUGETLB) {
+        void *ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            *mapped = length;
+            return ptr;
+        }
+    }
+#endif
+
+    // Mapped one huge page longer and trimmed, so that the transparent huge pages line up with the array
+    uint8_t *region = (uint8_t *)mmap(NULL, length + MEM_HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((void *)region == MAP_FAILED) return NULL;
+    uint8_t *ptr = (uint8_t *)(((uintptr_t)region + MEM_HUGE_PAGE_BYTES - 1) & ~(uintptr_t)(MEM_HUGE_PAGE_BYTES - 1));
+    if (ptr > region) munmap(region, ptr - region);
+    if (ptr + length < region + length + MEM_HUGE_PAGE_BYTES) {
+        munmap(ptr + length, region + length + MEM_HUGE_PAGE_BYTES - (ptr + length));
+    }
+#ifdef MADV_HUGEPAGE
+    if (policy & (MEM_POLICY_HUGE_PAGES | MEM_POLICY_HUGETLB)) madvise(ptr, length, MADV_HUGEPAGE);
+#endif
+    *mapped = length;
+    return ptr;
+}
+#endif
+
+/**
+ * \brief Write the pages [begin, end) of a mapping, so that each is placed on the node of the thread touching it
+ */
+static bool touch_pages(void *user, int32_t thread, size_t begin, size_t end)
+{
+    (void)thread;
+    volatile uint8_t *data = (volatile uint8_t *)user;
+    for (size_t page = begin; page < end; page++) data[page * MEM_TOUCH_PAGE_BYTES] = 0;
+    return true;
+}
+
+static void *tracked_alloc(MemSubsystem subsystem, size_t count, size_t size, bool zero)
+{
+    if ((int32_t)subsystem < 0 || subsystem >= MEM_NUM_SUBSYSTEMS) return NULL;
+    if (size > 0 && count > SIZE_MAX / size) return NULL;
+    size_t bytes = count * size;
+
+    // The budget is checked and the bytes counted under one lock, so threads cannot overrun it together
+    pthread_mutex_lock(&mem_lock);
+    void *ptr = NULL;
+    size_t mapped = 0;
+    uint32_t policy = page_policy;
+    if (reserve_bytes(subsystem, bytes)) {
+#ifdef MEM_HAVE_MMAP
+        // Mapped pages read as zero, so they serve mem_calloc too
+        if (policy != 0 && bytes >= MEM_POLICY_MIN_BYTES) ptr = map_pages(bytes, policy, &mapped);
+        if (ptr != NULL && !add_entry(subsystem, ptr, bytes, mapped)) {
+            // A mapping must be counted for mem_free to unmap it
+            munmap(ptr, mapped);
+            ptr = NULL;
+            mapped = 0;
+        }
+#endif
+        if (ptr == NULL) {
+            ptr = zero ? calloc(count, size) : malloc(bytes);
+            if (ptr != NULL) add_entry(subsystem, ptr, bytes, 0);
+        }
+    }
+    pthread_mutex_unlock(&mem_lock);
+
+    // Huge pages are touched whole by one thread each, pages of other mappings in strips of the same size
+    if (mapped > 0 && (policy & MEM_POLICY_FIRST_TOUCH)) {
+        parallel_for(mapped / MEM_TOUCH_PAGE_BYTES, MEM_HUGE_PAGE_BYTES / MEM_TOUCH_PAGE_BYTES, 0, touch_pages, ptr);
+    }
+    return ptr;
+}
+
+void *mem_malloc(MemSubsystem subsystem, size_t bytes)
+{
+    return tracked_alloc(subsystem, bytes, 1, false);
+}
+
+void *mem_calloc(MemSubsystem subsystem, size_t count, size_t size)
+{
+    return tracked_alloc(subsystem, count, size, true);
+}
+
+void mem_free(void *ptr)
+{
+    if (ptr == NULL) return;
+    pthread_mutex_lock(&mem_lock);
+    size_t mapped = 0;
+    int64_t index = find_entry(ptr);
+    if (index >= 0) {
+        mapped = entries[index].mapped;
+        remove_entry(index);
+    }
+    pthread_mutex_unlock(&mem_lock);
+#ifdef MEM_HAVE_MMAP
+    if (mapped > 0) {
+        munmap(ptr, mapped);
+        return;
+    }
+#endif
+    free(ptr);
+}
+
+void mem_stats_set_policy(uint32_t flags)
+{
+    pthread_mutex_lock(&mem_lock);
+    page_policy = flags;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+uint32_t mem_stats_policy(void)
+{
+    pthread_mutex_lock(&mem_lock);
+    uint32_t flags = page_policy;
+    pthread_mutex_unlock(&mem_lock);
+    return flags;
+}
+
+void mem_stats_set_budget(size_t bytes)
+{
+    pthread_mutex_lock(&mem_lock);
+    totals.budget = bytes;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+size_t mem_stats_budget(void)
+{
+    pthread_mutex_lock(&mem_lock);
+    size_t budget = totals.budget;
+    pthread_mutex_unlock(&mem_lock);
+    return budget;
+}
+
+bool mem_stats_fits(size_t bytes)
+{
+    pthread_mutex_lock(&mem_lock);
+    bool fits = totals.budget == 0 || totals.current_total + bytes <= totals.budget;
+    pthread_mutex_unlock(&mem_lock);
+    return fits;
+}
+
+void mem_stats_reset_peaks(void)
+{
+    pthread_mutex_lock(&mem_lock);
+    for (int32_t k = 0; k < MEM_NUM_SUBSYSTEMS; k++) totals.peak[k] = totals.current[k];
+    totals.peak_total = totals.current_total;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void mem_stats_snapshot(MemStats *stats)
+{
+    pthread_mutex_lock(&mem_lock);
+    *stats = totals;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+bool mem_stats_write(FILE *fp)
+{
+    MemStats stats;
+    mem_stats_snapshot(&stats);
+    fprintf(fp, "{\n  \"program\": \"");
+    // Program names are paths, only quotes and backslashes need escaping
+    for (const char *c = program_name; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', fp);
+        fputc(*c, fp);
+    }
+    fprintf(fp, "\",\n  \"budget_bytes\": %zu,\n  \"current_bytes\": %zu,\n  \"peak_bytes\": %zu,\n",
+            stats.budget, stats.current_total, stats.peak_total);
+    fprintf(fp, "  \"subsystems\": {\n");
+    for (int32_t k = 0; k < MEM_NUM_SUBSYSTEMS; k++) {
+        fprintf(fp, "    \"%s\": {\"current_bytes\": %zu, \"peak_bytes\": %zu}%s\n", subsystem_names[k],
+                stats.current[k], stats.peak[k], k + 1 < MEM_NUM_SUBSYSTEMS ? "," : "");
+    }
+    fprintf(fp, "  }\n}\n");
+    return ferror(fp) == 0;
+}
+
+bool mem_stats_print_estimate(const char *program, size_t bytes)
+{
+    size_t budget = mem_stats_budget();
+    bool fits = budget == 0 || bytes <= budget;
+    SAFE_PRINTF(512, "{\"program\": \"%s\", \"estimated_bytes\": %zu, \"estimated_mb\": %.1f, \"budget_bytes\": %zu, "
+                "\"fits\": %s}\n", program, bytes, (double)bytes / (1 << 20), budget, fits ? "true" : "false");
+    return fits;
+}
+
+static void write_report_at_exit(void)
+{
+    if (report_path[0] == '\0') return;
+    if (strcmp(report_path, "-") == 0) {
+        mem_stats_write(stdout);
+        fflush(stdout);
+        return;
+    }
+    FILE *fp = fopen(report_path, "w");
+    if (fp == NULL) {
+        SAFE_PRINTF(1024, "mem_stats() ==>> cannot open %s\n", report_path);
+        return;
+    }
+    if (!mem_stats_write(fp)) {
+        SAFE_PRINTF(1024, "mem_stats() ==>> cannot write %s\n", report_path);
+    }
+    fclose(fp);
+}
+
+/**
+ * \brief Remove `name <value>` from the arguments
+ * \return the value, or NULL if the option is not there
+ */
+static const char *take_option(int32_t *argc, char **argv, const char *name)
+{
+    for (int32_t i = 1; i + 1 < *argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            const char *value = argv[i + 1];
+            for (int32_t j = i; j + 2 <= *argc; j++) argv[j] = argv[j + 2];
+            *argc -= 2;
+            return value;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Flags of a comma separated `-memory_policy`
+ * \return false if a flag is unknown
+ */
+static bool parse_policy(const char *text, uint32_t *flags)
+{
+    const char *names[] = {"huge", "hugetlb", "first_touch"};
+    const uint32_t values[] = {MEM_POLICY_HUGE_PAGES, MEM_POLICY_HUGETLB, MEM_POLICY_FIRST_TOUCH};
+    *flags = 0;
+    while (*text != '\0') {
+        size_t length = strcspn(text, ",");
+        bool known = length == 7 && strncmp(text, "default", 7) == 0;
+        for (int32_t k = 0; k < 3 && !known; k++) {
+            if (strlen(names[k]) == length && strncmp(text, names[k], length) == 0) {
+                *flags |= values[k];
+                known = true;
+            }
+        }
+        if (!known) return false;
+        text += length;
+        if (*text == ',') text++;
+    }
+    return true;
+}
+
+void mem_stats_init(int32_t *argc, char **argv)
+{
+    const char *program = (*argc > 0 && argv[0] != NULL) ? argv[0] : "";
+    const char *slash = strrchr(program, '/');
+    snprintf(program_name, sizeof(program_name), "%s", slash != NULL ? slash + 1 : program);
+
+    const char *budget = take_option(argc, argv, MEM_STATS_BUDGET_ARG);
+    if (budget == NULL) budget = getenv(MEM_STATS_BUDGET_ENV);
+    if (budget != NULL && budget[0] != '\0') {
+        double megabytes = strtod(budget, NULL);
+        if (megabytes > 0) {
+            mem_stats_set_budget((size_t)(megabytes * (1 << 20)));
+        } else {
+            SAFE_PRINTF(256, "mem_stats_init() ==>> ignoring the memory budget %s\n", budget);
+        }
+    }
+
+    const char *path = take_option(argc, argv, MEM_STATS_ARG);
+    if (path == NULL) path = getenv(MEM_STATS_ENV);
+    if (path != NULL && path[0] != '\0') {
+        snprintf(report_path, sizeof(report_path), "%s", path);
+        if (!report_registered) report_registered = atexit(write_report_at_exit) == 0;
+    }
+
+    const char *policy = take_option(argc, argv, MEM_POLICY_ARG);
+    if (policy == NULL) policy = getenv(MEM_POLICY_ENV);
+    if (policy != NULL && policy[0] != '\0') {
+        uint32_t flags = 0;
+        if (parse_policy(policy, &flags)) {
+            mem_stats_set_policy(flags);
+        } else {
+            SAFE_PRINTF(256, "mem_stats_init() ==>> ignoring the memory policy %.64s\n", policy);
+        }
+    }
+}
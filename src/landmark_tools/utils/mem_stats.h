@@ -0,0 +1,174 @@
+/**
+ * \file mem_stats.h
+ * \brief Current and peak bytes of the large rasters of each subsystem, and a memory budget for a run
+ *
+ * The landmark arrays, correlation maps and matching rasters are allocated with `mem_malloc` or `mem_calloc` and
+ * released with `mem_free`, which keep the bytes held by each subsystem and the peak they reached. Smaller buffers
+ * use malloc directly and are not counted.
+ *
+ * With a budget set, by `-memory_budget_mb <MB>` on the command line of any executable, the
+ * `LANDMARK_TOOLS_MEMORY_BUDGET_MB` environment variable or `mem_stats_set_budget`, a tracked allocation that would
+ * take the total over the budget fails as if malloc had failed. Tools that can estimate their use up front check
+ * the estimate against the budget before starting, and switch to their streaming mode or stop. `-memory_stats
+ * <file>` or `LANDMARK_TOOLS_MEMORY_STATS=<file>` writes a JSON summary at exit, `-` for standard output.
+ *
+ * `-memory_policy <flags>`, `LANDMARK_TOOLS_MEMORY_POLICY` or `mem_stats_set_policy` choose how tracked allocations
+ * of at least `MEM_POLICY_MIN_BYTES` get their pages, with a comma separated list of `huge` (transparent huge
+ * pages), `hugetlb` (huge pages reserved by the system, else transparent ones) and `first_touch` (pages touched
+ * first by the threads of `parallel_for`, so that they spread over the NUMA nodes the threads run on), or
+ * `default` for malloc.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_MEM_STATS_H_
+#define _LANDMARK_TOOLS_MEM_STATS_H_
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for int32_t, uint32_t
+#include <stdio.h>    // for FILE
+
+#define MEM_STATS_BUDGET_ENV "LANDMARK_TOOLS_MEMORY_BUDGET_MB"  //!< Environment variable holding the budget in MB
+#define MEM_STATS_BUDGET_ARG "-memory_budget_mb"                //!< Command line option holding the budget in MB
+#define MEM_STATS_ENV "LANDMARK_TOOLS_MEMORY_STATS"             //!< Environment variable naming the summary file
+#define MEM_STATS_ARG "-memory_stats"                           //!< Command line option naming the summary file
+#define MEM_POLICY_ENV "LANDMARK_TOOLS_MEMORY_POLICY"           //!< Environment variable holding the page policy
+#define MEM_POLICY_ARG "-memory_policy"                         //!< Command line option holding the page policy
+#define MEM_POLICY_MIN_BYTES ((size_t)8 << 20)                  //!< Smallest allocation following the page policy
+#define MEM_HUGE_PAGE_BYTES ((size_t)2 << 20)                   //!< Huge page size that mappings are aligned to
+
+/**
+ * \brief Flags of the page policy of large tracked allocations, 0 for malloc
+ */
+typedef enum {
+    MEM_POLICY_HUGE_PAGES = 1,      /*!< \brief Map the pages and advise transparent huge pages */
+    MEM_POLICY_HUGETLB = 2,         /*!< \brief Map huge pages reserved by the system, else as MEM_POLICY_HUGE_PAGES */
+    MEM_POLICY_FIRST_TOUCH = 4      /*!< \brief Map the pages and touch them first from the threads of parallel_for */
+} MemPolicy;
+
+/**
+ * \brief Owners of the tracked memory
+ */
+typedef enum {
+    MEM_LANDMARK = 0,     /*!< \brief Elevation and surface reflectance arrays of landmarks */
+    MEM_GRIDDING,         /*!< \brief Accumulation maps of point clouds gridded into landmarks */
+    MEM_DEM,              /*!< \brief DEM tiles cached while creating landmarks */
+    MEM_MATCHING,         /*!< \brief No-data masks, window sums and splat accumulators of the matching */
+    MEM_CORRELATION,      /*!< \brief Delta and correlation maps of comparisons */
+    MEM_NUM_SUBSYSTEMS
+} MemSubsystem;
+
+/**
+ * \brief Bytes held so far
+ */
+typedef struct {
+    size_t current[MEM_NUM_SUBSYSTEMS];   /*!< \brief Bytes held now by each subsystem */
+    size_t peak[MEM_NUM_SUBSYSTEMS];      /*!< \brief Most bytes held at once by each subsystem */
+    size_t current_total;                 /*!< \brief Bytes held now by all subsystems */
+    size_t peak_total;                    /*!< \brief Most bytes held at once by all subsystems */
+    size_t budget;                        /*!< \brief Budget in bytes, 0 for none */
+} MemStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Set the budget and the summary file from the command line or the environment, at the start of `main`
+ *
+ * `-memory_budget_mb <MB>`, `-memory_stats <file>` and `-memory_policy <flags>` are removed from the arguments, so the
+ * option parsing of the executable does not see them.
+ * \param[in,out] argc number of arguments
+ * \param[in,out] argv arguments, including the program name
+ */
+void mem_stats_init(int32_t *argc, char **argv);
+
+/**
+ * \brief malloc counted for `subsystem`
+ *
+ * \return NULL if malloc fails or the allocation does not fit in the budget
+ */
+void *mem_malloc(MemSubsystem subsystem, size_t bytes);
+
+/**
+ * \brief calloc counted for `subsystem`
+ *
+ * \return NULL if calloc fails or the allocation does not fit in the budget
+ */
+void *mem_calloc(MemSubsystem subsystem, size_t count, size_t size);
+
+/**
+ * \brief Set the page policy of the next tracked allocations
+ *
+ * \param[in] flags `MemPolicy` flags, 0 for malloc. Ignored where pages cannot be mapped
+ */
+void mem_stats_set_policy(uint32_t flags);
+
+/**
+ * \brief Page policy of the tracked allocations
+ */
+uint32_t mem_stats_policy(void);
+
+/**
+ * \brief Free memory of `mem_malloc` or `mem_calloc`. Pointers from plain malloc are freed without being counted
+ */
+void mem_free(void *ptr);
+
+/**
+ * \brief Set the budget in bytes, 0 for none
+ */
+void mem_stats_set_budget(size_t bytes);
+
+/**
+ * \brief Budget in bytes, 0 for none
+ */
+size_t mem_stats_budget(void);
+
+/**
+ * \brief True if `bytes` more fit in the budget, or if there is no budget
+ */
+bool mem_stats_fits(size_t bytes);
+
+/**
+ * \brief Clear the peaks, keeping the bytes held now
+ */
+void mem_stats_reset_peaks(void);
+
+/**
+ * \brief Copy of the bytes held so far
+ */
+void mem_stats_snapshot(MemStats *stats);
+
+/**
+ * \brief Write the JSON summary
+ * \return false on io error
+ */
+bool mem_stats_write(FILE *fp);
+
+/**
+ * \brief Print an estimate from `-estimate_memory`, and whether it fits in the budget
+ *
+ * \param[in] program name of the tool
+ * \param[in] bytes estimated peak bytes of the large arrays
+ * \return true if the estimate fits in the budget
+ */
+bool mem_stats_print_estimate(const char *program, size_t bytes);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_MEM_STATS_H_ */
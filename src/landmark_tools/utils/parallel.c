@@ -0,0 +1,212 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <pthread.h>  // for pthread_create, pthread_join, pthread_mutex_t
+#include <stdlib.h>   // for getenv, atoi, malloc, free
+#if defined(LINUX_OS) || defined(MAC_OS)
+#include <unistd.h>   // for sysconf
+#endif
+
+#include "landmark_tools/utils/parallel.h"
+
+static int32_t configured_threads = 0;
+
+/**
+ * \brief Loop shared by its threads
+ */
+typedef struct {
+    ParallelRangeFn range_fn;    // set for parallel_for
+    ParallelTileFn tile_fn;      // set for parallel_for_tiles
+    void *user;
+    size_t num_tasks;
+    size_t count;                // items of parallel_for
+    size_t chunk;
+    int32_t cols;                // grid of parallel_for_tiles
+    int32_t rows;
+    int32_t tile_cols;
+    int32_t tile_rows;
+    int32_t tiles_x;
+    size_t next_task;
+    bool failed;
+    pthread_mutex_t mutex;
+} ParallelLoop;
+
+/**
+ * \brief A thread of a loop
+ */
+typedef struct {
+    ParallelLoop *loop;
+    int32_t thread;
+} ParallelWorker;
+
+int32_t parallel_num_threads(void)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    int32_t n = __atomic_load_n(&configured_threads, __ATOMIC_RELAXED);
+#else
+    int32_t n = configured_threads;
+#endif
+    if (n <= 0) {
+        const char *env = getenv(PARALLEL_NUM_THREADS_ENV);
+        n = (env != NULL) ? atoi(env) : 0;
+    }
+#if defined(LINUX_OS) || defined(MAC_OS)
+    if (n <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        n = online > 0 ? (online < PARALLEL_MAX_THREADS ? (int32_t)online : PARALLEL_MAX_THREADS) : 1;
+    }
+#endif
+    if (n < 1) n = 1;
+    return n < PARALLEL_MAX_THREADS ? n : PARALLEL_MAX_THREADS;
+}
+
+void parallel_set_num_threads(int32_t num_threads)
+{
+    if (num_threads < 0) num_threads = 0;
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(&configured_threads, num_threads, __ATOMIC_RELAXED);
+#else
+    configured_threads = num_threads;
+#endif
+}
+
+/**
+ * \brief Next task of the loop, or false once they are all taken or one failed
+ */
+static bool take_task(ParallelLoop *loop, size_t *task)
+{
+    pthread_mutex_lock(&loop->mutex);
+    bool taken = !loop->failed && loop->next_task < loop->num_tasks;
+    if (taken) *task = loop->next_task++;
+    pthread_mutex_unlock(&loop->mutex);
+    return taken;
+}
+
+static bool run_task(const ParallelLoop *loop, int32_t thread, size_t task)
+{
+    if (loop->range_fn != NULL) {
+        size_t begin = task * loop->chunk;
+        size_t end = (loop->count - begin > loop->chunk) ? begin + loop->chunk : loop->count;
+        return loop->range_fn(loop->user, thread, begin, end);
+    }
+    int32_t left = (int32_t)(task % loop->tiles_x) * loop->tile_cols;
+    int32_t top = (int32_t)(task / loop->tiles_x) * loop->tile_rows;
+    int32_t width = (loop->cols - left < loop->tile_cols) ? loop->cols - left : loop->tile_cols;
+    int32_t height = (loop->rows - top < loop->tile_rows) ? loop->rows - top : loop->tile_rows;
+    return loop->tile_fn(loop->user, thread, left, top, width, height);
+}
+
+static void *run_worker(void *arg)
+{
+    ParallelWorker *worker = (ParallelWorker *)arg;
+    ParallelLoop *loop = worker->loop;
+    size_t task;
+    while (take_task(loop, &task)) {
+        if (!run_task(loop, worker->thread, task)) {
+            pthread_mutex_lock(&loop->mutex);
+            loop->failed = true;
+            pthread_mutex_unlock(&loop->mutex);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Run the tasks of a loop on up to num_threads threads, the calling thread included
+ */
+static bool run_loop(ParallelLoop *loop, int32_t num_threads)
+{
+    if (loop->num_tasks == 0) return true;
+    if (num_threads <= 0) num_threads = parallel_num_threads();
+    if (num_threads > PARALLEL_MAX_THREADS) num_threads = PARALLEL_MAX_THREADS;
+    if ((size_t)num_threads > loop->num_tasks) num_threads = (int32_t)loop->num_tasks;
+    loop->next_task = 0;
+    loop->failed = false;
+    pthread_mutex_init(&loop->mutex, NULL);
+
+    // Threads that cannot be started leave their tasks to the others
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    bool started[PARALLEL_MAX_THREADS] = {false};
+    ParallelWorker workers[PARALLEL_MAX_THREADS];
+    for (int32_t t = 0; t < num_threads; t++) {
+        workers[t].loop = loop;
+        workers[t].thread = t;
+    }
+    for (int32_t t = 1; t < num_threads; t++) {
+        started[t] = pthread_create(&threads[t], NULL, run_worker, &workers[t]) == 0;
+    }
+    run_worker(&workers[0]);
+    for (int32_t t = 1; t < num_threads; t++) {
+        if (started[t]) pthread_join(threads[t], NULL);
+    }
+    pthread_mutex_destroy(&loop->mutex);
+    return !loop->failed;
+}
+
+bool parallel_for(size_t count, size_t chunk, int32_t num_threads, ParallelRangeFn fn, void *user)
+{
+    ParallelLoop loop = {0};
+    loop.range_fn = fn;
+    loop.user = user;
+    loop.count = count;
+    loop.chunk = chunk > 0 ? chunk : 1;
+    loop.num_tasks = (count + loop.chunk - 1) / loop.chunk;
+    return run_loop(&loop, num_threads);
+}
+
+bool parallel_for_tiles(int32_t cols, int32_t rows, int32_t tile_cols, int32_t tile_rows, int32_t num_threads,
+                        ParallelTileFn fn, void *user)
+{
+    if (cols <= 0 || rows <= 0) return true;
+    ParallelLoop loop = {0};
+    loop.tile_fn = fn;
+    loop.user = user;
+    loop.cols = cols;
+    loop.rows = rows;
+    loop.tile_cols = tile_cols > 0 ? tile_cols : 1;
+    loop.tile_rows = tile_rows > 0 ? tile_rows : 1;
+    loop.tiles_x = (cols - 1) / loop.tile_cols + 1;
+    loop.num_tasks = (size_t)loop.tiles_x * ((rows - 1) / loop.tile_rows + 1);
+    return run_loop(&loop, num_threads);
+}
+
+void *parallel_scratch_reserve(ParallelScratch *scratch, int32_t thread, size_t bytes)
+{
+    if (thread < 0 || thread >= PARALLEL_MAX_THREADS) return NULL;
+    if (scratch->buffers[thread] != NULL && scratch->sizes[thread] >= bytes) {
+        return scratch->buffers[thread];
+    }
+    free(scratch->buffers[thread]);
+    scratch->buffers[thread] = malloc(bytes > 0 ? bytes : 1);
+    scratch->sizes[thread] = scratch->buffers[thread] != NULL ? bytes : 0;
+    return scratch->buffers[thread];
+}
+
+void parallel_scratch_free(ParallelScratch *scratch)
+{
+    for (int32_t t = 0; t < PARALLEL_MAX_THREADS; t++) {
+        free(scratch->buffers[t]);
+        scratch->buffers[t] = NULL;
+        scratch->sizes[t] = 0;
+    }
+}
+
+double parallel_sum(const double *partials, size_t count)
+{
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) sum += partials[i];
+    return sum;
+}
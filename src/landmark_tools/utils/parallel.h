@@ -0,0 +1,138 @@
+/**
+ * \file parallel.h
+ * \brief Thread count, parallel loops, per-thread scratch memory and deterministic sums shared by the library
+ *
+ * The number of threads is set once for the process, by `parallel_set_num_threads` or the
+ * `LANDMARK_TOOLS_NUM_THREADS` environment variable, and otherwise follows the online processors. Every parallel
+ * part of the library sizes itself from `parallel_num_threads`.
+ *
+ * `parallel_for` and `parallel_for_tiles` split a loop into tasks that the threads take one at a time from a shared
+ * counter, so fast threads take more of them. The calling thread is thread 0 and runs tasks too; threads that
+ * cannot be started leave their tasks to the others. Nested loops start threads of their own.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_PARALLEL_H_
+#define _LANDMARK_TOOLS_PARALLEL_H_
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for int32_t
+
+#define PARALLEL_NUM_THREADS_ENV "LANDMARK_TOOLS_NUM_THREADS"  //!< Environment variable holding the thread count
+#define PARALLEL_MAX_THREADS 64                                 //!< Most threads of one loop
+
+/**
+ * \brief Work on the items [begin, end) of a `parallel_for`
+ *
+ * \param[in] user argument of the loop
+ * \param[in] thread index of the running thread, 0 for the calling thread, below the thread count of the loop
+ * \return false to stop the loop, which then returns false
+ */
+typedef bool (*ParallelRangeFn)(void *user, int32_t thread, size_t begin, size_t end);
+
+/**
+ * \brief Work on a tile of a `parallel_for_tiles`
+ *
+ * \param[in] user argument of the loop
+ * \param[in] thread index of the running thread, 0 for the calling thread, below the thread count of the loop
+ * \param[in] left first column of the tile
+ * \param[in] top first row of the tile
+ * \param[in] width columns of the tile
+ * \param[in] height rows of the tile
+ * \return false to stop the loop, which then returns false
+ */
+typedef bool (*ParallelTileFn)(void *user, int32_t thread, int32_t left, int32_t top, int32_t width, int32_t height);
+
+/**
+ * \brief Buffers of each thread of a loop, grown on demand and kept between loops
+ */
+typedef struct {
+    void *buffers[PARALLEL_MAX_THREADS];   /*!< \brief Buffer of each thread, or NULL */
+    size_t sizes[PARALLEL_MAX_THREADS];    /*!< \brief Bytes of each buffer */
+} ParallelScratch;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Threads of the loops of the library
+ *
+ * \return the count of `parallel_set_num_threads`, else `LANDMARK_TOOLS_NUM_THREADS`, else the online processors,
+ * between 1 and PARALLEL_MAX_THREADS
+ */
+int32_t parallel_num_threads(void);
+
+/**
+ * \brief Set the threads of the loops of the library
+ *
+ * \param[in] num_threads thread count, or 0 to go back to `LANDMARK_TOOLS_NUM_THREADS` or the online processors
+ */
+void parallel_set_num_threads(int32_t num_threads);
+
+/**
+ * \brief Run `fn` over [0, count) in ranges of `chunk` items
+ *
+ * \param[in] count number of items
+ * \param[in] chunk items per range, at least 1
+ * \param[in] num_threads most threads, or 0 for `parallel_num_threads`
+ * \param[in] fn work on a range
+ * \param[in] user first argument of `fn`
+ * \return false if `fn` returned false for a range
+ */
+bool parallel_for(size_t count, size_t chunk, int32_t num_threads, ParallelRangeFn fn, void *user);
+
+/**
+ * \brief Run `fn` over the tiles of a cols x rows grid, taken in row-major order
+ *
+ * \param[in] cols grid width
+ * \param[in] rows grid height
+ * \param[in] tile_cols tile width, at least 1. The last column of tiles may be narrower
+ * \param[in] tile_rows tile height, at least 1. The last row of tiles may be shorter
+ * \param[in] num_threads most threads, or 0 for `parallel_num_threads`
+ * \param[in] fn work on a tile
+ * \param[in] user first argument of `fn`
+ * \return false if `fn` returned false for a tile
+ */
+bool parallel_for_tiles(int32_t cols, int32_t rows, int32_t tile_cols, int32_t tile_rows, int32_t num_threads,
+                        ParallelTileFn fn, void *user);
+
+/**
+ * \brief Buffer of `thread` of at least `bytes`, keeping its contents only when it does not grow
+ *
+ * \return NULL if malloc fails
+ */
+void *parallel_scratch_reserve(ParallelScratch *scratch, int32_t thread, size_t bytes);
+
+/**
+ * \brief Free the buffers of every thread
+ */
+void parallel_scratch_free(ParallelScratch *scratch);
+
+/**
+ * \brief Sum of values in index order
+ *
+ * Loops that store one partial result per range of fixed size, rather than per thread, get the same sum for any
+ * thread count and schedule.
+ */
+double parallel_sum(const double *partials, size_t count);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_PARALLEL_H_ */
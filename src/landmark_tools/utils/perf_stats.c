@@ -0,0 +1,240 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>  // for getenv, atexit
+#include <string.h>  // for strcmp, strrchr
+#include <time.h>    // for clock_gettime
+
+#include "landmark_tools/utils/perf_stats.h"
+#include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/time_budget.h"
+
+#define PERF_STATS_PATH_SIZE 1024
+#define PERF_STATS_PROGRAM_SIZE 128
+
+static const char *phase_names[PERF_NUM_PHASES] = {
+    "load", "mask", "detect", "correlate", "ransac", "splat", "normalize", "write"
+};
+
+static const char *counter_names[PERF_NUM_COUNTERS] = {
+    "features_tried", "features_nan_template", "features_nan_search", "correlation_below_min", "ransac_outliers"
+};
+
+// Totals in nanoseconds, so that they can be added with integer atomics
+static int32_t enabled = 0;
+static int64_t phase_calls[PERF_NUM_PHASES];
+static int64_t phase_wall_ns[PERF_NUM_PHASES];
+static int64_t phase_cpu_ns[PERF_NUM_PHASES];
+static int64_t counters[PERF_NUM_COUNTERS];
+static double start_wall = 0;
+static double start_cpu = 0;
+static bool report_registered = false;
+static char report_path[PERF_STATS_PATH_SIZE] = "";
+static char program_name[PERF_STATS_PROGRAM_SIZE] = "";
+
+static inline void atomic_add(int64_t *value, int64_t n)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_fetch_add(value, n, __ATOMIC_RELAXED);
+#else
+    *value += n;
+#endif
+}
+
+static inline int64_t atomic_load(const int64_t *value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+#else
+    return *value;
+#endif
+}
+
+static inline bool is_enabled(void)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(&enabled, __ATOMIC_RELAXED) != 0;
+#else
+    return enabled != 0;
+#endif
+}
+
+/**
+ * \brief CPU time of the calling thread in seconds
+ */
+static double thread_cpu_now(void)
+{
+#if defined(LINUX_OS) || defined(MAC_OS)
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (double)now.tv_sec + 1e-9 * (double)now.tv_nsec;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/**
+ * \brief CPU time of every thread of the process in seconds
+ */
+static double process_cpu_now(void)
+{
+#if defined(LINUX_OS) || defined(MAC_OS)
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (double)now.tv_sec + 1e-9 * (double)now.tv_nsec;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static void write_report_at_exit(void)
+{
+    if (!is_enabled() || report_path[0] == '\0') return;
+    if (strcmp(report_path, "-") == 0) {
+        perf_stats_write(stdout);
+        fflush(stdout);
+        return;
+    }
+    FILE *fp = fopen(report_path, "w");
+    if (fp == NULL) {
+        SAFE_PRINTF(1024, "perf_stats() ==>> cannot open %s\n", report_path);
+        return;
+    }
+    if (!perf_stats_write(fp)) {
+        SAFE_PRINTF(1024, "perf_stats() ==>> cannot write %s\n", report_path);
+    }
+    fclose(fp);
+}
+
+void perf_stats_init(int32_t *argc, char **argv)
+{
+    const char *path = NULL;
+    for (int32_t i = 1; i + 1 < *argc; i++) {
+        if (strcmp(argv[i], PERF_STATS_ARG) == 0) {
+            path = argv[i + 1];
+            for (int32_t j = i; j + 2 <= *argc; j++) argv[j] = argv[j + 2];
+            *argc -= 2;
+            break;
+        }
+    }
+    if (path == NULL) path = getenv(PERF_STATS_ENV);
+    if (path == NULL || path[0] == '\0') return;
+
+#ifndef LANDMARK_TOOLS_PERF_STATS
+    printf("perf_stats_init() ==>> built without LANDMARK_TOOLS_PERF_STATS, phases and counters are not collected\n");
+#endif
+    const char *program = (*argc > 0 && argv[0] != NULL) ? argv[0] : "";
+    const char *slash = strrchr(program, '/');
+    perf_stats_enable(path, slash != NULL ? slash + 1 : program);
+}
+
+void perf_stats_enable(const char *output_path, const char *program)
+{
+    snprintf(report_path, sizeof(report_path), "%s", output_path != NULL ? output_path : "");
+    snprintf(program_name, sizeof(program_name), "%s", program != NULL ? program : "");
+    if (output_path != NULL && !report_registered) {
+        report_registered = atexit(write_report_at_exit) == 0;
+    }
+    if (!is_enabled()) {
+        start_wall = time_budget_now();
+        start_cpu = process_cpu_now();
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(&enabled, 1, __ATOMIC_RELAXED);
+#else
+    enabled = 1;
+#endif
+}
+
+bool perf_stats_enabled(void)
+{
+    return is_enabled();
+}
+
+void perf_stats_reset(void)
+{
+    for (int32_t i = 0; i < PERF_NUM_PHASES; i++) {
+        phase_calls[i] = 0;
+        phase_wall_ns[i] = 0;
+        phase_cpu_ns[i] = 0;
+    }
+    for (int32_t i = 0; i < PERF_NUM_COUNTERS; i++) counters[i] = 0;
+    start_wall = time_budget_now();
+    start_cpu = process_cpu_now();
+}
+
+void perf_timer_begin(PerfTimer *timer, PerfPhase phase)
+{
+    if (!is_enabled()) {
+        timer->phase = -1;
+        return;
+    }
+    timer->phase = phase;
+    timer->wall = time_budget_now();
+    timer->cpu = thread_cpu_now();
+}
+
+void perf_timer_end(PerfTimer *timer)
+{
+    if (timer->phase < 0 || timer->phase >= PERF_NUM_PHASES) return;
+    double wall = time_budget_now() - timer->wall;
+    double cpu = thread_cpu_now() - timer->cpu;
+    atomic_add(&phase_calls[timer->phase], 1);
+    atomic_add(&phase_wall_ns[timer->phase], (int64_t)(wall * 1e9));
+    atomic_add(&phase_cpu_ns[timer->phase], (int64_t)(cpu * 1e9));
+}
+
+void perf_count(PerfCounter counter, int64_t n)
+{
+    if (!is_enabled() || n == 0) return;
+    atomic_add(&counters[counter], n);
+}
+
+void perf_stats_snapshot(PerfStats *stats)
+{
+    for (int32_t i = 0; i < PERF_NUM_PHASES; i++) {
+        stats->calls[i] = atomic_load(&phase_calls[i]);
+        stats->wall_seconds[i] = 1e-9 * (double)atomic_load(&phase_wall_ns[i]);
+        stats->cpu_seconds[i] = 1e-9 * (double)atomic_load(&phase_cpu_ns[i]);
+    }
+    for (int32_t i = 0; i < PERF_NUM_COUNTERS; i++) stats->counters[i] = atomic_load(&counters[i]);
+}
+
+bool perf_stats_write(FILE *fp)
+{
+    PerfStats stats;
+    perf_stats_snapshot(&stats);
+    fprintf(fp, "{\n  \"program\": \"");
+    // Program names are paths, only quotes and backslashes need escaping
+    for (const char *c = program_name; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', fp);
+        fputc(*c, fp);
+    }
+    fprintf(fp, "\",\n  \"elapsed_seconds\": %.6f,\n", time_budget_now() - start_wall);
+    fprintf(fp, "  \"process_cpu_seconds\": %.6f,\n  \"phases\": {\n", process_cpu_now() - start_cpu);
+    for (int32_t i = 0; i < PERF_NUM_PHASES; i++) {
+        fprintf(fp, "    \"%s\": {\"calls\": %lld, \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f}%s\n", phase_names[i],
+                (long long)stats.calls[i], stats.wall_seconds[i], stats.cpu_seconds[i],
+                i + 1 < PERF_NUM_PHASES ? "," : "");
+    }
+    fprintf(fp, "  },\n  \"counters\": {\n");
+    for (int32_t i = 0; i < PERF_NUM_COUNTERS; i++) {
+        fprintf(fp, "    \"%s\": %lld%s\n", counter_names[i], (long long)stats.counters[i],
+                i + 1 < PERF_NUM_COUNTERS ? "," : "");
+    }
+    fprintf(fp, "  }\n}\n");
+    return ferror(fp) == 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * \file perf_stats.h
+ * \brief Wall and CPU time of the processing phases and counters of the matching, reported at exit
+ *
+ * The `PERF_PHASE_BEGIN`, `PERF_PHASE_END` and `PERF_COUNT` macros compile to nothing unless
+ * `LANDMARK_TOOLS_PERF_STATS` is defined, which the `WITH_PERF_STATS` CMake option does. When compiled in, they
+ * only read one flag until collection is enabled, by `-perf_stats <file>` on the command line of any executable or
+ * by the `LANDMARK_TOOLS_PERF_STATS=<file>` environment variable. A file of `-` is standard output.
+ *
+ * At exit a JSON summary is written with, for each phase, the number of calls and their wall and CPU time summed
+ * over the threads that ran them, and each counter. Phases can nest and run on many threads at once, so their times
+ * can add up to more than the elapsed time.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_PERF_STATS_H_
+#define _LANDMARK_TOOLS_PERF_STATS_H_
+
+#include <stdbool.h>  // for bool
+#include <stdint.h>   // for int32_t, int64_t
+#include <stdio.h>    // for FILE
+
+#define PERF_STATS_ENV "LANDMARK_TOOLS_PERF_STATS"  //!< Environment variable naming the summary file
+#define PERF_STATS_ARG "-perf_stats"                //!< Command line option naming the summary file
+
+/**
+ * \brief Timed phases
+ */
+typedef enum {
+    PERF_LOAD = 0,       /*!< \brief Reading landmarks and images */
+    PERF_MASK,           /*!< \brief Building no-data masks */
+    PERF_DETECT,         /*!< \brief Feature detection */
+    PERF_CORRELATE,      /*!< \brief Correlation searches */
+    PERF_RANSAC,         /*!< \brief Homography RANSAC */
+    PERF_SPLAT,          /*!< \brief Adding matched features to the dense maps */
+    PERF_NORMALIZE,      /*!< \brief Turning the weighted sums into the dense maps */
+    PERF_WRITE,          /*!< \brief Writing landmarks, images and maps */
+    PERF_NUM_PHASES
+} PerfPhase;
+
+/**
+ * \brief Counters
+ */
+typedef enum {
+    PERF_FEATURES_TRIED = 0,       /*!< \brief Features given to the matching */
+    PERF_FEATURES_NAN_TEMPLATE,    /*!< \brief Features rejected for no-data in their template */
+    PERF_FEATURES_NAN_SEARCH,      /*!< \brief Features rejected for no-data in their search window */
+    PERF_CORRELATION_BELOW_MIN,    /*!< \brief Correlations failed or not above `min_correlation` */
+    PERF_RANSAC_OUTLIERS,          /*!< \brief Correspondences outside the consensus of a homography RANSAC */
+    PERF_NUM_COUNTERS
+} PerfCounter;
+
+/**
+ * \brief Start of a phase, on the stack of the thread running it
+ */
+typedef struct {
+    int32_t phase;      /*!< \brief Timed phase, or -1 if collection was disabled at the start */
+    double wall;        /*!< \brief Monotonic time at the start, in seconds */
+    double cpu;         /*!< \brief CPU time of the thread at the start, in seconds */
+} PerfTimer;
+
+/**
+ * \brief Totals collected so far
+ */
+typedef struct {
+    int64_t calls[PERF_NUM_PHASES];
+    double wall_seconds[PERF_NUM_PHASES];
+    double cpu_seconds[PERF_NUM_PHASES];
+    int64_t counters[PERF_NUM_COUNTERS];
+} PerfStats;
+
+#ifdef LANDMARK_TOOLS_PERF_STATS
+#define PERF_PHASE_BEGIN(timer, phase) PerfTimer timer; perf_timer_begin(&timer, phase)
+#define PERF_PHASE_END(timer) perf_timer_end(&timer)
+#define PERF_COUNT(counter, n) perf_count(counter, n)
+#else
+// The arguments of PERF_COUNT stay referenced, but unevaluated, so that tallies kept only for it do not warn
+#define PERF_PHASE_BEGIN(timer, phase) ((void)0)
+#define PERF_PHASE_END(timer) ((void)0)
+#define PERF_COUNT(counter, n) ((void)sizeof(counter), (void)sizeof(n))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief Enable collection from the command line or the environment, at the start of `main`
+ *
+ * `-perf_stats <file>` is removed from the arguments, so the option parsing of the executable does not see it.
+ * \param[in,out] argc number of arguments
+ * \param[in,out] argv arguments, including the program name
+ */
+void perf_stats_init(int32_t *argc, char **argv);
+
+/**
+ * \brief Enable collection and write the summary to `output_path` at exit
+ *
+ * \param[in] output_path summary file, `-` for standard output, or NULL to collect without writing at exit
+ * \param[in] program name of the program in the summary
+ */
+void perf_stats_enable(const char *output_path, const char *program);
+
+/**
+ * \brief True if collection is enabled
+ */
+bool perf_stats_enabled(void);
+
+/**
+ * \brief Clear the totals
+ */
+void perf_stats_reset(void);
+
+/**
+ * \brief Start timing a phase
+ */
+void perf_timer_begin(PerfTimer *timer, PerfPhase phase);
+
+/**
+ * \brief Add the time since `perf_timer_begin` to the phase
+ */
+void perf_timer_end(PerfTimer *timer);
+
+/**
+ * \brief Add to a counter. Safe to call from any thread
+ */
+void perf_count(PerfCounter counter, int64_t n);
+
+/**
+ * \brief Copy of the totals collected so far
+ */
+void perf_stats_snapshot(PerfStats *stats);
+
+/**
+ * \brief Write the JSON summary
+ * \return false on io error
+ */
+bool perf_stats_write(FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_PERF_STATS_H_ */
@@ -0,0 +1,57 @@
+/**
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <time.h>
+
+#include "landmark_tools/utils/time_budget.h"
+
+double time_budget_now(void)
+{
+#if defined(LINUX_OS) || defined(MAC_OS)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + 1e-9 * (double)now.tv_nsec;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+void time_budget_init(TimeBudget *budget, double seconds)
+{
+    budget->deadline = (seconds > 0) ? time_budget_now() + seconds : 0;
+    budget->cancelled = 0;
+}
+
+void time_budget_cancel(TimeBudget *budget)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(&budget->cancelled, 1, __ATOMIC_RELEASE);
+#else
+    budget->cancelled = 1;
+#endif
+}
+
+BudgetStatus time_budget_status(const TimeBudget *budget)
+{
+    if (budget == NULL) return BUDGET_COMPLETE;
+#if defined(__GNUC__) || defined(__clang__)
+    if (__atomic_load_n(&budget->cancelled, __ATOMIC_ACQUIRE)) return BUDGET_CANCELLED;
+#else
+    if (budget->cancelled) return BUDGET_CANCELLED;
+#endif
+    if (budget->deadline > 0 && time_budget_now() >= budget->deadline) return BUDGET_EXPIRED;
+    return BUDGET_COMPLETE;
+}
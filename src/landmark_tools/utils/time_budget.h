@@ -0,0 +1,80 @@
+/**
+ * \file time_budget.h
+ * \brief Wall-clock budget and cooperative cancellation of long running calls
+ *
+ * A `TimeBudget` is shared by the caller and a running call. The call checks it between units of work and, once
+ * the deadline passes or another thread cancels it, stops and returns what it has so far along with a
+ * `BudgetStatus`.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _LANDMARK_TOOLS_TIME_BUDGET_H_
+#define _LANDMARK_TOOLS_TIME_BUDGET_H_
+
+#include <stdbool.h>  // for bool
+#include <stdint.h>   // for int32_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief How a call with a `TimeBudget` ended
+ */
+typedef enum {
+    BUDGET_COMPLETE = 0,         /*!< \brief All the work was done */
+    BUDGET_EXPIRED = 1,          /*!< \brief The deadline passed, the result is partial */
+    BUDGET_CANCELLED = 2         /*!< \brief `time_budget_cancel` was called, the result is partial */
+} BudgetStatus;
+
+/**
+ * \brief Deadline and cancellation flag
+ */
+typedef struct {
+    double deadline;             /*!< \brief `time_budget_now` value the work must stop at, or 0 for no deadline */
+    volatile int32_t cancelled;  /*!< \brief Set by `time_budget_cancel`, from any thread */
+} TimeBudget;
+
+/**
+ * \brief Monotonic clock in seconds, for `TimeBudget::deadline`
+ */
+double time_budget_now(void);
+
+/**
+ * \brief Start a budget of `seconds` from now
+ *
+ * \param[out] budget Budget
+ * \param[in] seconds Time allowed. If 0 or less, there is no deadline and the budget only ends when cancelled
+ */
+void time_budget_init(TimeBudget *budget, double seconds);
+
+/**
+ * \brief Ask the calls using `budget` to stop. Safe to call from any thread
+ */
+void time_budget_cancel(TimeBudget *budget);
+
+/**
+ * \brief State of a budget. A NULL budget never ends
+ *
+ * \return BUDGET_COMPLETE while work may continue, otherwise the reason to stop
+ */
+BudgetStatus time_budget_status(const TimeBudget *budget);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _LANDMARK_TOOLS_TIME_BUDGET_H_ */
@@ -53,9 +53,11 @@ bool parseYaml(const char *yaml_filename,
         total_child_keys += num_child_keys[i];
     }
     
+    // Keys missing from the file are reported as empty strings
     bool child_observed[total_child_keys];
     for(size_t i =0; i< total_child_keys; i ++){
         child_observed[i] = false;
+        values[i] = "";
     }
     
     size_t current_key_size = 50;
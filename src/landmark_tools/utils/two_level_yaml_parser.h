@@ -34,7 +34,7 @@
  \param[in] child_keys flattened array of cstrings containing the keys for the inner level of nesting
  \param[in] num_child_keys array of number of child keys for each parent key
  \param[in] must_include_all flag to make all keys required
- \param[out] values array of cstrings of the corresponding values for each child key
+ \param[out] values array of cstrings of the corresponding values for each child key, "" for keys missing from the file
  \return true if file is successfully parsed
  \return false if file parsing fails or if required key is missing
  */
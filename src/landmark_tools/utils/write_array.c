@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include "landmark_tools/utils/perf_stats.h"
 #include "landmark_tools/utils/safe_string.h"
 #include "landmark_tools/utils/write_array.h"
 
@@ -10,8 +11,10 @@ int write_data_to_file(const char* filename, const void* data, size_t element_si
         return -1;
     }
     
+    PERF_PHASE_BEGIN(timer, PERF_WRITE);
     size_t written = fwrite(data, element_size, num_elements, fp);
     fclose(fp);
+    PERF_PHASE_END(timer);
     
     if (written != num_elements) {
         SAFE_FPRINTF(stderr, 512, "Error: Failed to write all data to file '%s'\n", filename);
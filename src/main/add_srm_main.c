@@ -24,12 +24,16 @@
 #include <stdint.h>                                 // for int32_t
 #include <stdio.h>                                  // for printf
 #include <stdlib.h>                                 // for NULL, EXIT_FAILURE
-#include <string.h>                                 // for strncmp
+#include <string.h>                                 // for strcmp
 
 #include "landmark_tools/landmark_util/landmark.h"  // for free_lmk, Crop_In...
+#include "landmark_tools/landmark_util/lmk_patch.h" // for Open_LMK_Patch, LMK...
 #include "landmark_tools/utils/parse_args.h"        // for m_getarg, CFO_STRING
 #include "landmark_tools/image_io/image_utils.h"             // for load_cha...
 #include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
 
 static void show_usage_and_exit(void)
 {
@@ -38,13 +42,17 @@ static void show_usage_and_exit(void)
     printf("------------------\n");
     printf("  Required arguments:\n");
     printf("    -input   <filename> - input landmark filepath\n");
-    printf("    -output   <filename> - output landmark filepath\n");
     printf("    -srm   <filename> - input surface image\n");
+    printf("  Optional arguments:\n");
+    printf("    -output   <filename> - output landmark filepath. Without it, the srm of the input file is updated in place\n");
     exit(EXIT_FAILURE);
 }
 
 int32_t main (int32_t argc, char **argv)
 {
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
     char *infile=NULL;
     char *outfile=NULL;
     char *srmfile=NULL;
@@ -68,16 +76,10 @@ int32_t main (int32_t argc, char **argv)
     }
     
     // Required arguments
-    if(infile==NULL | outfile==NULL | srmfile==NULL){
+    if(infile==NULL | srmfile==NULL){
         show_usage_and_exit();
     }
     
-    LMK lmk = {0};
-    if(!Read_LMK(infile, &lmk)){
-        SAFE_PRINTF(256, "Failed to read landmark file: %s\n", infile);
-        return EXIT_FAILURE;
-    }
-    
     int32_t icols, irows;
     uint8_t *srm_img = load_channel_separated_image(srmfile, &icols, &irows);
     
@@ -86,11 +88,42 @@ int32_t main (int32_t argc, char **argv)
         return EXIT_FAILURE;
     }
     
+    // Without an output, or with the input as output, only the srm block of the file is rewritten
+    LMK_Patch patch = {0};
+    if((outfile == NULL || strcmp(outfile, infile) == 0) && Open_LMK_Patch(infile, &patch) && patch.version == 3){
+        bool success = true;
+        if(icols!= patch.header.num_cols || irows!=patch.header.num_rows){
+            SAFE_PRINTF(256, "SRM dimensions (%dx%d) differ from landmark dimensions (%dx%d)\n", icols, irows, patch.header.num_cols, patch.header.num_rows);
+            success = false;
+        }else{
+            success = LMK_Patch_SRM(&patch, 0, 0, icols, irows, srm_img);
+        }
+        success = Close_LMK_Patch(&patch) && success;
+        free(srm_img);
+        
+        if(success){
+            SAFE_PRINTF(256, "Landmark file updated: %s\n", infile);
+            return EXIT_SUCCESS;
+        }else{
+            return EXIT_FAILURE;
+        }
+    }
+    // Tiled landmarks are rewritten whole
+    if(patch.fp != NULL) Close_LMK_Patch(&patch);
+    if(outfile == NULL) outfile = infile;
+    
+    LMK lmk = {0};
+    if(!Read_LMK(infile, &lmk)){
+        SAFE_PRINTF(256, "Failed to read landmark file: %s\n", infile);
+        return EXIT_FAILURE;
+    }
+    
     if(icols!= lmk.num_cols || irows!=lmk.num_rows){
         SAFE_PRINTF(256, "SRM dimensions (%dx%d) differ from landmark dimensions (%dx%d)\n", icols, irows, lmk.num_cols, lmk.num_rows);
         return EXIT_FAILURE;
     }
     
+    mem_free(lmk.srm);
     lmk.srm = srm_img;
     bool success = Write_LMK(outfile, &lmk);
     
@@ -0,0 +1,347 @@
+/**
+ * \file create_landmark_batch_main.c
+ * \brief Create many landmark files from one GeoTiff DEM
+ *
+ * The DEM and the surface reflectance map are opened once. Each landmark reads only its footprint of the DEM, with
+ * the blocks shared by neighbouring landmarks kept in the GDAL block cache, and is computed on all threads while the
+ * footprint of the next landmark is read.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*-----------------------------------------------------------*/
+/*------------------------ Includes -------------------------*/
+/*-----------------------------------------------------------*/
+#include <math.h>                                            // for NAN, lround
+#include <pthread.h>                                         // for pthread_create, pthread_join
+#include <stdbool.h>                                         // for bool, false
+#include <stdint.h>                                          // for int32_t
+#include <stdio.h>                                           // for printf
+#include <stdlib.h>                                          // for free, malloc
+#include <string.h>                                          // for strcspn, strncpy
+
+#include "landmark_tools/image_io/geotiff_interface.h"       // for openGeoTiff, readGeoTiffFileWindow
+#include "landmark_tools/image_io/image_utils.h"             // for load_channel_separated_image
+#include "landmark_tools/landmark_util/create_landmark.h"    // for CreateLandmark_ProjectionGrid
+#include "landmark_tools/landmark_util/landmark.h"           // for free_lmk
+#include "landmark_tools/map_projection/datum_conversion.h"  // for strToPlanet
+#include "landmark_tools/utils/parse_args.h"                 // for m_getarg
+#include "landmark_tools/utils/safe_string.h"                // for SAFE_PRINTF
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
+
+#define DEM_WINDOW_MARGIN 16 //DEM pixels read around the landmark footprint
+
+/**
+ * \brief Display usage information and exit
+ */
+void show_usage_and_exit()
+{
+    printf("Create many landmark files from one GeoTiff DEM\n");
+    printf("Usage for create_landmark_batch:\n");
+    printf("------------------\n");
+    printf("  Required arguments:\n");
+    printf("    -geotif_file <filename> - input dem tif file name\n");
+    printf("    -manifest <filename> - text file with one line per landmark: <lmk_filepath> <center_lat> <center_long> <width_meters> <height_meters> <res>\n");
+    printf("  Optional arguments:\n");
+    printf("    -planet <Moon or Earth> - (default Moon)\n");
+    printf("    -srm_file <filename> - png image file containing surface reflectance map coaligned with the DEM\n");
+    printf("    -projection_grid_step <int> - interpolate the DEM projection between grid nodes this many pixels apart, such as 16 (default 0, project every pixel)\n");
+    printf("    -cache_mb <int> - size of the GDAL block cache in megabytes (default GDAL setting)\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * \brief One landmark of the manifest
+ */
+typedef struct {
+    char lmk_path[LMK_FILENAME_SIZE];
+    double latitude;
+    double longitude;
+    float width_meters;
+    float height_meters;
+    float resolution;
+} BatchEntry;
+
+/**
+ * \brief Inputs shared by every landmark
+ */
+typedef struct {
+    GeoTiffFile *dem_file;
+    GeoTiffData dem_info;        // georeferencing of the whole DEM
+    enum Planet planet;
+    uint8_t *srm_img;            // coaligned with the whole DEM, or NULL
+    int32_t srm_width;
+    int32_t srm_height;
+} BatchInputs;
+
+/**
+ * \brief Landmark set up and DEM footprint read by a loader thread
+ */
+typedef struct {
+    const BatchInputs *inputs;
+    const BatchEntry *entry;
+    LMK landmark;
+    GeoTiffData dem;
+    uint8_t *srm_img;            // crop of the surface reflectance map to dem, or NULL
+    int32_t srm_width;
+    int32_t srm_height;
+    bool success;
+} LandmarkLoad;
+
+/**
+ \brief Read the manifest, one landmark per line. Empty lines and lines starting with # are skipped.
+ \return number of entries or -1 on error
+*/
+static int32_t read_manifest(const char *manifest_path, BatchEntry **entries)
+{
+    FILE *fp = fopen(manifest_path, "r");
+    if (fp == NULL) {
+        SAFE_PRINTF(512, "Cannot open %s\n", manifest_path);
+        return -1;
+    }
+
+    int32_t capacity = 64;
+    int32_t count = 0;
+    BatchEntry *list = (BatchEntry *)malloc(capacity * sizeof(BatchEntry));
+    char line[LMK_FILENAME_SIZE + 256];
+    bool success = list != NULL;
+    while (success && fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        if (count == capacity) {
+            capacity *= 2;
+            BatchEntry *grown = (BatchEntry *)realloc(list, capacity * sizeof(BatchEntry));
+            if (grown == NULL) {
+                success = false;
+                break;
+            }
+            list = grown;
+        }
+        char format[64];
+        snprintf(format, sizeof(format), "%%%ds %%lf %%lf %%f %%f %%f", LMK_FILENAME_SIZE - 1);
+        BatchEntry *entry = &list[count];
+        if (sscanf(line, format, entry->lmk_path, &entry->latitude, &entry->longitude, &entry->width_meters,
+                   &entry->height_meters, &entry->resolution) != 6 || entry->resolution <= 0) {
+            SAFE_PRINTF(1024, "read_manifest() ==>> expected <lmk_filepath> <center_lat> <center_long> <width_meters> <height_meters> <res> in line '%s'\n", line);
+            success = false;
+            break;
+        }
+        count++;
+    }
+    fclose(fp);
+
+    if (!success) {
+        if (list == NULL) printf("read_manifest() ==>> malloc() failed\n");
+        free(list);
+        return -1;
+    }
+    *entries = list;
+    return count;
+}
+
+/**
+ * \brief Copy the part of the surface reflectance map under a DEM window
+ *
+ * \return false if malloc fails
+ */
+static bool crop_srm(const BatchInputs *inputs, const GeoTiffData *dem, LandmarkLoad *load)
+{
+    int32_t x0 = (int32_t)lround((dem->origin[0] - inputs->dem_info.origin[0])/inputs->dem_info.pixelSize[0]);
+    int32_t y0 = (int32_t)lround((dem->origin[1] - inputs->dem_info.origin[1])/inputs->dem_info.pixelSize[1]);
+    int32_t cols = inputs->srm_width - x0 < dem->imageSize[0] ? inputs->srm_width - x0 : dem->imageSize[0];
+    int32_t rows = inputs->srm_height - y0 < dem->imageSize[1] ? inputs->srm_height - y0 : dem->imageSize[1];
+    if (cols <= 0 || rows <= 0) {
+        return true;
+    }
+    load->srm_img = (uint8_t *)malloc((size_t)cols * rows);
+    if (load->srm_img == NULL) {
+        printf("crop_srm() ==>> malloc() failed\n");
+        return false;
+    }
+    for (int32_t r = 0; r < rows; r++) {
+        memcpy(&load->srm_img[(size_t)r * cols], &inputs->srm_img[((size_t)r + y0) * inputs->srm_width + x0], cols);
+    }
+    load->srm_width = cols;
+    load->srm_height = rows;
+    return true;
+}
+
+static void *load_landmark_thread(void *arg)
+{
+    LandmarkLoad *load = (LandmarkLoad *)arg;
+    const BatchInputs *inputs = load->inputs;
+    const BatchEntry *entry = load->entry;
+    LMK *lmk = &load->landmark;
+
+    lmk->BODY = inputs->planet;
+    lmk->num_cols = (int32_t)(entry->width_meters / entry->resolution);
+    lmk->num_rows = (int32_t)(entry->height_meters / entry->resolution);
+    lmk->num_pixels = lmk->num_cols * lmk->num_rows;
+    lmk->anchor_col = (float)lmk->num_cols / 2.0;
+    lmk->anchor_row = (float)lmk->num_rows / 2.0;
+    lmk->resolution = entry->resolution;
+    strncpy(lmk->filename, entry->lmk_path, LMK_FILENAME_SIZE - 1);
+
+    //TODO lmk_id described in the D_101723_LVS_Ref_Map_Product_ICD document
+    strncpy(lmk->lmk_id, "0", LMK_ID_SIZE);
+
+    int32_t window[4];
+    load->success = lmk->num_pixels > 0 && allocate_lmk_arrays(lmk, lmk->num_cols, lmk->num_rows) &&
+                    CreateLandmarkFootprint((GeoTiffData *)&inputs->dem_info, entry->latitude, entry->longitude,
+                                            inputs->dem_info.projection, lmk, NAN, DEM_WINDOW_MARGIN, window, NULL) &&
+                    readGeoTiffFileWindow(inputs->dem_file, window[0], window[1], window[2], window[3], 1,
+                                          &load->dem);
+    if (load->success && inputs->srm_img != NULL) {
+        load->success = crop_srm(inputs, &load->dem, load);
+    }
+    return NULL;
+}
+
+/**
+ * \brief Start setting up a landmark in the background, or set it up now if no thread can be started
+ *
+ * \return true if `thread` must be joined
+ */
+static bool start_landmark_load(LandmarkLoad *load, const BatchInputs *inputs, const BatchEntry *entry,
+                                pthread_t *thread)
+{
+    memset(load, 0, sizeof(LandmarkLoad));
+    load->inputs = inputs;
+    load->entry = entry;
+    if (pthread_create(thread, NULL, load_landmark_thread, load) == 0) {
+        return true;
+    }
+    load_landmark_thread(load);
+    return false;
+}
+
+static void free_landmark_load(LandmarkLoad *load)
+{
+    free_lmk(&load->landmark);
+    free(load->dem.demValues);
+    free(load->srm_img);
+    load->dem.demValues = NULL;
+    load->srm_img = NULL;
+}
+
+/**
+ * \brief Main function for batch landmark creation
+ *
+ * \param argc Number of command line arguments
+ * \param argv Array of command line argument strings
+ * \return EXIT_SUCCESS if every landmark is created, EXIT_FAILURE otherwise
+ */
+int32_t main(int32_t argc, char **argv)
+{
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
+    char *input_geotif_file_name = NULL;
+    char *manifest_path = NULL;
+    char *planet_str = NULL;
+    char *srm_file_name = NULL;
+    int32_t projection_grid_step = 0;
+    int32_t cache_mb = 0;
+
+    argc--;
+    argv++;
+
+    if (argc == 0) show_usage_and_exit();
+
+    while (argc > 0) {
+        if (argc == 1) show_usage_and_exit();
+        if ((m_getarg(argv, "-geotif_file", &input_geotif_file_name, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-manifest", &manifest_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-planet", &planet_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-srm_file", &srm_file_name, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-projection_grid_step", &projection_grid_step, CFO_INT) != 1) &&
+            (m_getarg(argv, "-cache_mb", &cache_mb, CFO_INT) != 1))
+            show_usage_and_exit();
+
+        argc -= 2;
+        argv += 2;
+    }
+    if (input_geotif_file_name == NULL || manifest_path == NULL) show_usage_and_exit();
+
+    BatchInputs inputs = {0};
+    inputs.planet = Moon;
+    if (planet_str != NULL) {
+        inputs.planet = strToPlanet(planet_str);
+        if (inputs.planet == Planet_UNDEFINED) {
+            SAFE_PRINTF(256, "Unknown planet %s\n", planet_str);
+            return EXIT_FAILURE;
+        }
+    }
+
+    BatchEntry *entries = NULL;
+    int32_t num_entries = read_manifest(manifest_path, &entries);
+    if (num_entries < 0) {
+        return EXIT_FAILURE;
+    }
+
+    inputs.dem_file = openGeoTiff(input_geotif_file_name, (int64_t)cache_mb * 1024 * 1024, &inputs.dem_info);
+    if (inputs.dem_file == NULL) {
+        free(entries);
+        return EXIT_FAILURE;
+    }
+    if (srm_file_name != NULL) {
+        inputs.srm_img = load_channel_separated_image(srm_file_name, &inputs.srm_width, &inputs.srm_height);
+        if (inputs.srm_img == NULL) {
+            SAFE_PRINTF(256, "Failure to load surface reflectance map from %s\n", srm_file_name);
+            closeGeoTiff(inputs.dem_file);
+            free(entries);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int32_t num_failed = 0;
+    LandmarkLoad loads[2];
+    pthread_t threads[2];
+    bool joinable[2] = {false, false};
+    if (num_entries > 0) {
+        joinable[0] = start_landmark_load(&loads[0], &inputs, &entries[0], &threads[0]);
+    }
+    for (int32_t i = 0; i < num_entries; i++) {
+        LandmarkLoad *load = &loads[i % 2];
+        if (joinable[i % 2]) pthread_join(threads[i % 2], NULL);
+        joinable[i % 2] = false;
+
+        // Read the footprint of the next landmark while this one is computed
+        if (i + 1 < num_entries) {
+            joinable[(i + 1) % 2] = start_landmark_load(&loads[(i + 1) % 2], &inputs, &entries[i + 1],
+                                                        &threads[(i + 1) % 2]);
+        }
+
+        SAFE_PRINTF(1024, "Landmark %d of %d: %s\n", i + 1, num_entries, entries[i].lmk_path);
+        bool success = load->success &&
+                       CreateLandmark_ProjectionGrid(&load->dem, load->srm_img, load->srm_width, load->srm_height,
+                                                     entries[i].latitude, entries[i].longitude,
+                                                     load->dem.projection, &load->landmark, NAN,
+                                                     load->landmark.filename, 0, projection_grid_step);
+        if (!success) {
+            SAFE_PRINTF(1024, "Failed to create %s\n", entries[i].lmk_path);
+            num_failed++;
+        }
+        free_landmark_load(load);
+    }
+
+    SAFE_PRINTF(256, "%d of %d landmarks created\n", num_entries - num_failed, num_entries);
+    free(inputs.srm_img);
+    closeGeoTiff(inputs.dem_file);
+    free(entries);
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -37,6 +37,9 @@
 #include "landmark_tools/utils/safe_string.h"
 
 #include "landmark_tools/image_io/geotiff_struct.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
 
 #ifdef USE_GEOTIFF
 #include "landmark_tools/image_io/geotiff_interface.h"       // for st_geoti...
@@ -66,6 +69,9 @@ static void show_usage(void)
 /////////////////////////////////////////////////////////////////////////
 int32_t main(int32_t argc, char** argv)
 {
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
     float lmkcols=0.0, lmkrows = 0.0;
     float lmkres = 0.0;
     char* input_ele_lbl_file_name=0;
@@ -162,49 +168,14 @@ int32_t main(int32_t argc, char** argv)
     bool ok = false;
     if(input_srm_lbl_file_name == NULL && srm_file_name == NULL){
         printf("Creating landmark with empty surface reflectance map.\n");
-        ok = CreateLandmark_dem_only(&info_ele, anchor_latitude_degrees, anchor_longitude_degrees, info_ele.projection, &lmk, set_anchor_point_ele);
+        ok = CreateLandmark_Streaming(&info_ele, NULL, 0, 0, anchor_latitude_degrees, anchor_longitude_degrees, info_ele.projection, &lmk, set_anchor_point_ele, lmk.filename);
+    }else if(srm_file_name == NULL){
+        //Normalize the srm image as the landmark samples it
+        ok = CreateLandmarkFromImage(&info_ele, &info_srm, anchor_latitude_degrees, anchor_longitude_degrees, info_ele.projection, &lmk, set_anchor_point_ele, lmk.filename, 0);
     }else{
         //Load the surface reflectance map
         int32_t icols, irows;
-        uint8_t *srm_img;
-        if(srm_file_name != NULL)
-            srm_img = load_channel_separated_image(srm_file_name, &icols, &irows);
-        else{
-            //check if the size matches with ele
-            if((int)info_ele.imageSize[0] != info_srm.imageSize[0] || (int)info_ele.imageSize[1] != info_srm.imageSize[1] || info_ele.projection != info_srm.projection){
-                printf("Loaded srm img and ele img do not match in size-wise\n");
-                return EXIT_FAILURE;
-            }
-            
-            icols = info_srm.imageSize[0];
-            irows = info_srm.imageSize[1];
-            srm_img = malloc(icols*irows*sizeof(uint8_t));
-            if(srm_img == NULL){
-                fprintf(stderr, "Failure to allocate memory.\n");
-                return EXIT_FAILURE;
-            }
-            
-            //Normalize srm image
-            float max = 0;
-            float min = FLT_MAX;
-            for(size_t i=0; i<irows*icols; i++){
-                if(info_srm.demValues[i] < min){
-                    min = info_srm.demValues[i];
-                }
-                
-                if(info_srm.demValues[i]> max){
-                    max = info_srm.demValues[i];
-                }
-            }
-            
-            for(size_t i=0; i<irows*icols; i++){
-                srm_img[i] = (uint8_t) (255*(info_srm.demValues[i] - min)/(max-min));
-            }
-            
-#ifdef DEBUG
-            write_channel_separated_image("srm.png", srm_img, icols, irows, 1);
-#endif
-        }
+        uint8_t *srm_img = load_channel_separated_image(srm_file_name, &icols, &irows);
         
 #ifdef DEBUG
         uint8_t *ele_img = malloc(icols*irows*sizeof(uint8_t));
@@ -230,14 +201,10 @@ int32_t main(int32_t argc, char** argv)
             return EXIT_FAILURE;
         }
         
-        ok = CreateLandmark(&info_ele, srm_img, icols, irows, anchor_latitude_degrees, anchor_longitude_degrees, info_ele.projection, &lmk, set_anchor_point_ele);
+        ok = CreateLandmark_Streaming(&info_ele, srm_img, icols, irows, anchor_latitude_degrees, anchor_longitude_degrees, info_ele.projection, &lmk, set_anchor_point_ele, lmk.filename);
         if(srm_img) free(srm_img);
     }
     
-    if (ok){
-        ok = Write_LMK(lmk.filename, &lmk);
-    }
-    
     free_lmk(&lmk);
     free(info_ele.demValues);
     free(info_srm.demValues);
@@ -34,11 +34,82 @@
 #include "landmark_tools/utils/safe_string.h"                // for SAFE_FPRINTF
 
 #include "landmark_tools/image_io/geotiff_struct.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
 
 #ifdef USE_GEOTIFF
 #include "landmark_tools/image_io/geotiff_interface.h"       // for st_geoti...
 #endif //USE_GEOTIFF
 
+#define DEM_WINDOW_MARGIN 16 //DEM pixels read around the landmark footprint
+#define DEM_TILE_SIZE 256 //DEM pixels on a side of the tiles read with -dem_tile_cache_mb
+
+#ifdef USE_GEOTIFF
+/**
+ \brief `DemTileReader` of an open geotiff
+ */
+static bool read_geotiff_tile(void *user, int32_t x0, int32_t y0, int32_t width, int32_t height, float *values)
+{
+    return readGeoTiffFileValues((GeoTiffFile *)user, x0, y0, width, height, values);
+}
+#endif //USE_GEOTIFF
+
+/**
+ \brief Tiles of each cache of -dem_tile_cache_mb, at least 1
+ */
+static int32_t tiles_per_cache(int32_t dem_tile_cache_mb)
+{
+    int64_t tile_bytes = (int64_t)DEM_TILE_SIZE*DEM_TILE_SIZE*sizeof(float);
+    int64_t max_tiles = ((int64_t)dem_tile_cache_mb << 20)/tile_bytes;
+    return max_tiles < 1 ? 1 : (max_tiles > INT32_MAX ? INT32_MAX : (int32_t)max_tiles);
+}
+
+/**
+ \brief Print the estimated memory of creating the landmark with -estimate_memory, or check it against the budget
+ 
+ \param[in] lmk landmark size
+ \param[in] dem_cols width of the DEM held whole, unused if dem_tile_cache_mb > 0
+ \param[in] dem_rows height of the DEM held whole, unused if dem_tile_cache_mb > 0
+ \param[in] dem_tile_cache_mb MB of tiles per thread, 0 if the DEM is held whole
+ \param[in] print if true, print the estimate
+ \return false if the estimate does not fit in the budget
+ */
+static bool check_memory_budget(const LMK *lmk, int32_t dem_cols, int32_t dem_rows, int32_t dem_tile_cache_mb, bool print)
+{
+    DemTileSource tiles = {0};
+    tiles.tile_size = DEM_TILE_SIZE;
+    tiles.max_tiles = tiles_per_cache(dem_tile_cache_mb);
+    size_t bytes = CreateLandmark_memory(lmk, dem_cols, dem_rows, dem_tile_cache_mb > 0 ? &tiles : NULL, 0);
+    if (print) {
+        return mem_stats_print_estimate("create_landmark", bytes);
+    }
+    if (mem_stats_fits(bytes)) {
+        return true;
+    }
+    SAFE_PRINTF(512, "Creating the landmark needs about %zu MB, over the memory budget of %zu MB\n", bytes >> 20,
+                mem_stats_budget() >> 20);
+    return false;
+}
+
+#ifdef USE_GEOTIFF
+/**
+ \brief MB of tiles per thread that fit in the memory budget next to the landmark, or 0 if none fit
+ */
+static int32_t tile_cache_mb_within_budget(const LMK *lmk)
+{
+    DemTileSource tiles = {0};
+    tiles.tile_size = DEM_TILE_SIZE;
+    tiles.max_tiles = tiles_per_cache(1);
+    size_t lmk_bytes = CreateLandmark_memory(lmk, 0, 0, NULL, 0);
+    size_t mb_per_thread = CreateLandmark_memory(lmk, 0, 0, &tiles, 0) - lmk_bytes;
+    size_t budget = mem_stats_budget();
+    if (budget <= lmk_bytes || mb_per_thread == 0) return 0;
+    size_t mb = (budget - lmk_bytes)/mb_per_thread;
+    return mb > INT32_MAX ? INT32_MAX : (int32_t)mb;
+}
+#endif //USE_GEOTIFF
+
 static void show_usage(void)
 {
     printf("Usage for create_landmark:\n");
@@ -59,11 +130,18 @@ static void show_usage(void)
     printf("    -nodata_value <int> - (default NaN)\n");
     printf("    -srm_file <filename> - png image file containing surface reflectance map\n");
     printf("    -set_anchor_point_ele <float> - (default NAN, use ele based on a point at anchor lat long)\n");
+    printf("    -projection_grid_step <int> - interpolate the DEM projection between grid nodes this many pixels apart, such as 16 (default 0, project every pixel)\n");
+    printf("    -dem_overviews <0 or 1> - read the geotif averaged down to the landmark resolution when it is coarser, from overviews if the file has them (default 0). Not used with -srm_file\n");
+    printf("    -dem_tile_cache_mb <int> - sample the geotif through a cache of this many MB of %dx%d tiles per thread instead of reading the landmark footprint (default 0, read the footprint)\n", DEM_TILE_SIZE, DEM_TILE_SIZE);
+    printf("    -estimate_memory <0 or 1> - print the estimated memory and exit, with failure if it does not fit in -memory_budget_mb (default 0). A footprint over the budget is read through tiles that fit\n");
 }
 
 /////////////////////////////////////////////////////////////////////////
 int32_t main(int32_t argc, char** argv)
 {
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
     float lmkcols=0.0, lmkrows = 0.0;
     float lmkres = 0.0;
     char* projection_type=NULL;
@@ -75,6 +153,16 @@ int32_t main(int32_t argc, char** argv)
     double lat0 = 0.0, long0 = 0.0;
     double nodata_value = NAN;
     float set_anchor_point_ele = NAN;
+    int32_t projection_grid_step = 0;
+    int32_t dem_overviews = 0;
+    int32_t dem_tile_cache_mb = 0;
+    int32_t estimate_memory = 0;
+    DemTileSource *tiles = NULL; // DEM read by tiles, or NULL if it is in geotiff_info.demValues
+    int32_t srm_offset[2] = {0, 0}; // DEM pixel of the first value read, for the srm image coaligned with the whole DEM
+#ifdef USE_GEOTIFF
+    GeoTiffFile *dem_file = NULL;
+    DemTileSource dem_tiles = {0};
+#endif //USE_GEOTIFF
 
     
     argc--;
@@ -109,6 +197,10 @@ int32_t main(int32_t argc, char** argv)
             m_getarg(argv, "-nodata_value", &nodata_value, CFO_DOUBLE);
             m_getarg(argv, "-srm_file", &srm_file_name, CFO_STRING);
             m_getarg(argv, "-set_anchor_point_ele", &set_anchor_point_ele, CFO_FLOAT); // if not specified, use ele based on a point at anchor point
+            m_getarg(argv, "-projection_grid_step", &projection_grid_step, CFO_INT);
+            m_getarg(argv, "-dem_overviews", &dem_overviews, CFO_INT);
+            m_getarg(argv, "-dem_tile_cache_mb", &dem_tile_cache_mb, CFO_INT);
+            m_getarg(argv, "-estimate_memory", &estimate_memory, CFO_INT);
         }
         argv+=2;
     }
@@ -147,6 +239,15 @@ int32_t main(int32_t argc, char** argv)
             return EXIT_FAILURE;
         }
         
+        // The binary DEM is read whole
+        if (estimate_memory || mem_stats_budget() > 0) {
+            bool fits = check_memory_budget(&lmk, geotiff_info.imageSize[0], geotiff_info.imageSize[1], 0, estimate_memory);
+            if (estimate_memory || !fits) {
+                free_lmk(&lmk);
+                return fits ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+        }
+        
         // Load DEM and srm image
         geotiff_info.demValues = (float *)malloc(sizeof(float)* geotiff_info.imageSize[0]*geotiff_info.imageSize[1]);
         if(geotiff_info.demValues == NULL){
@@ -220,12 +321,78 @@ int32_t main(int32_t argc, char** argv)
         //TODO lmk_id described in the D_101723_LVS_Ref_Map_Product_ICD document
         strncpy(lmk.lmk_id, "0", LMK_ID_SIZE);
         
+        // Check the landmark and the DEM it reads against the memory budget before allocating either
+        if (estimate_memory || mem_stats_budget() > 0) {
+            int32_t dem_size[2] = {0, 0};
+            GeoTiffData footprint_info = {0};
+            int32_t footprint[4];
+            int32_t footprint_decimation = 1;
+            if (dem_tile_cache_mb <= 0) {
+                if (!readGeoTiffInfo(input_geotif_file_name, &footprint_info)) {
+                    return EXIT_FAILURE;
+                }
+                dem_size[0] = footprint_info.imageSize[0];
+                dem_size[1] = footprint_info.imageSize[1];
+                if (CreateLandmarkFootprint(&footprint_info, lat0, long0, footprint_info.projection, &lmk,
+                                            set_anchor_point_ele, DEM_WINDOW_MARGIN, footprint, &footprint_decimation)) {
+                    if (!dem_overviews || srm_file_name != NULL) footprint_decimation = 1;
+                    dem_size[0] = (footprint[2] + footprint_decimation - 1)/footprint_decimation;
+                    dem_size[1] = (footprint[3] + footprint_decimation - 1)/footprint_decimation;
+                }
+            }
+            bool fits = check_memory_budget(&lmk, dem_size[0], dem_size[1], dem_tile_cache_mb, estimate_memory);
+            if (estimate_memory) {
+                return fits ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+            // Read the DEM through tiles that fit next to the landmark rather than whole
+            if (!fits && dem_tile_cache_mb <= 0) {
+                dem_tile_cache_mb = tile_cache_mb_within_budget(&lmk);
+                fits = dem_tile_cache_mb > 0;
+                if (fits) {
+                    SAFE_PRINTF(256, "Reading the DEM through %d MB of tiles per thread\n", dem_tile_cache_mb);
+                }
+            }
+            if (!fits) {
+                return EXIT_FAILURE;
+            }
+        }
+        
         if(!allocate_lmk_arrays(&lmk, lmk.num_cols, lmk.num_rows)){
             free_lmk(&lmk);
             return EXIT_FAILURE;
         }
             
-        bool ok = readGeoTiff(input_geotif_file_name, &geotiff_info);
+        // Read only the part of the DEM under the landmark
+        GeoTiffData dem_info = {0};
+        int32_t window[4];
+        int32_t decimation = 1;
+        bool ok = true;
+        if (dem_tile_cache_mb > 0) {
+            // Keep the file open and read the tiles the landmark samples
+            dem_file = openGeoTiff(input_geotif_file_name, 0, &geotiff_info);
+            ok = dem_file != NULL;
+            if (ok) {
+                dem_tiles.read = read_geotiff_tile;
+                dem_tiles.user = dem_file;
+                dem_tiles.image_cols = geotiff_info.imageSize[0];
+                dem_tiles.image_rows = geotiff_info.imageSize[1];
+                dem_tiles.tile_size = DEM_TILE_SIZE;
+                dem_tiles.max_tiles = tiles_per_cache(dem_tile_cache_mb);
+                tiles = &dem_tiles;
+            }
+        } else {
+            ok = readGeoTiffInfo(input_geotif_file_name, &dem_info);
+            if (ok && CreateLandmarkFootprint(&dem_info, lat0, long0, dem_info.projection, &lmk, set_anchor_point_ele,
+                                              DEM_WINDOW_MARGIN, window, &decimation)) {
+                if (!dem_overviews || srm_file_name != NULL) decimation = 1;
+                ok = readGeoTiffWindow(input_geotif_file_name, window[0], window[1], window[2], window[3], decimation,
+                                       &geotiff_info);
+                srm_offset[0] = (int32_t)lround((geotiff_info.origin[0] - dem_info.origin[0])/dem_info.pixelSize[0]);
+                srm_offset[1] = (int32_t)lround((geotiff_info.origin[1] - dem_info.origin[1])/dem_info.pixelSize[1]);
+            } else if (ok) {
+                ok = readGeoTiff(input_geotif_file_name, &geotiff_info);
+            }
+        }
         if (!ok)
         {
             free_lmk(&lmk);
@@ -234,22 +401,24 @@ int32_t main(int32_t argc, char** argv)
         }
         
 #ifdef DEBUG
-        uint8_t *ele_img = malloc(geotiff_info.imageSize[0]*geotiff_info.imageSize[1]*sizeof(uint8_t));
-        float max = 0;
-        float min = FLT_MAX;
-        for(size_t i=0; i<geotiff_info.imageSize[0]*geotiff_info.imageSize[1]; i++){
-            if(geotiff_info.demValues[i] < min){
-                min = geotiff_info.demValues[i];
-            }
+        if (tiles == NULL) {
+            uint8_t *ele_img = malloc(geotiff_info.imageSize[0]*geotiff_info.imageSize[1]*sizeof(uint8_t));
+            float max = 0;
+            float min = FLT_MAX;
+            for(size_t i=0; i<geotiff_info.imageSize[0]*geotiff_info.imageSize[1]; i++){
+                if(geotiff_info.demValues[i] < min){
+                    min = geotiff_info.demValues[i];
+                }
             
-            if(geotiff_info.demValues[i]> max){
-                max = geotiff_info.demValues[i];
+                if(geotiff_info.demValues[i]> max){
+                    max = geotiff_info.demValues[i];
+                }
             }
+            for(size_t i=0; i<geotiff_info.imageSize[0]*geotiff_info.imageSize[1]; i++){
+                ele_img[i] = (uint8_t) (255*(geotiff_info.demValues[i] - min)/(max-min));
+            }
+            write_channel_separated_image("ele.png", ele_img, geotiff_info.imageSize[0], geotiff_info.imageSize[1], 1);
         }
-        for(size_t i=0; i<geotiff_info.imageSize[0]*geotiff_info.imageSize[1]; i++){
-            ele_img[i] = (uint8_t) (255*(geotiff_info.demValues[i] - min)/(max-min));
-        }
-        write_channel_separated_image("ele.png", ele_img, geotiff_info.imageSize[0], geotiff_info.imageSize[1], 1);
 #endif
         
         #else
@@ -261,7 +430,7 @@ int32_t main(int32_t argc, char** argv)
     bool ok = false;
     if(srm_file_name == NULL){
         printf("Creating landmark with empty surface reflectance map.\n");
-        ok = CreateLandmark_dem_only(&geotiff_info, anchor_latitude_degrees, anchor_longitude_degrees, geotiff_info.projection, &lmk, set_anchor_point_ele);
+        ok = CreateLandmark_TileCache(&geotiff_info, tiles, NULL, 0, 0, anchor_latitude_degrees, anchor_longitude_degrees, geotiff_info.projection, &lmk, set_anchor_point_ele, lmk.filename, 0, projection_grid_step);
     }else{
         //Load the surface reflectance map
         int32_t icols, irows;
@@ -272,16 +441,28 @@ int32_t main(int32_t argc, char** argv)
             return EXIT_FAILURE;
         }
         
-        ok = CreateLandmark(&geotiff_info, srm_img, icols, irows, anchor_latitude_degrees, anchor_longitude_degrees, geotiff_info.projection, &lmk, set_anchor_point_ele);
-        if(srm_img) free(srm_img);
-    }
+        // Crop the map to the part of the DEM that was read
+        if(srm_offset[0] > 0 || srm_offset[1] > 0){
+            int32_t cols = icols - srm_offset[0] < geotiff_info.imageSize[0] ? icols - srm_offset[0] : geotiff_info.imageSize[0];
+            int32_t rows = irows - srm_offset[1] < geotiff_info.imageSize[1] ? irows - srm_offset[1] : geotiff_info.imageSize[1];
+            if(cols < 0) cols = 0;
+            if(rows < 0) rows = 0;
+            for(int32_t r = 0; r < rows; r++){
+                memmove(&srm_img[(size_t)r*cols], &srm_img[((size_t)r + srm_offset[1])*icols + srm_offset[0]], cols);
+            }
+            icols = cols;
+            irows = rows;
+        }
         
-    if (ok){
-        ok = Write_LMK(lmk.filename, &lmk);
+        ok = CreateLandmark_TileCache(&geotiff_info, tiles, srm_img, icols, irows, anchor_latitude_degrees, anchor_longitude_degrees, geotiff_info.projection, &lmk, set_anchor_point_ele, lmk.filename, 0, projection_grid_step);
+        if(srm_img) free(srm_img);
     }
 
     free_lmk(&lmk);
     free(geotiff_info.demValues);
+#ifdef USE_GEOTIFF
+    closeGeoTiff(dem_file);
+#endif //USE_GEOTIFF
     
     if(ok){
         return EXIT_SUCCESS;
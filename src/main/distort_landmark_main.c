@@ -23,15 +23,18 @@
 #include <stdint.h>                                 // for int32_t
 #include <stdio.h>                                  // for printf, sscanf
 #include <stdlib.h>                                 // for NULL, EXIT_FAILURE
-#include <string.h>                                 // for strncmp
+#include <string.h>                                 // for strcmp
 #include <math.h>
 #include <time.h>
 
 #include "landmark_tools/landmark_util/landmark.h"  // for free_lmk, Crop_In...
-#include "landmark_tools/math/math_constants.h"
+#include "landmark_tools/landmark_util/lmk_distort.h" // for Write_LMK_Distorted_Variants
+#include "landmark_tools/landmark_util/lmk_patch.h" // for Open_LMK_Patch, LMK_Patch_Header
 #include "landmark_tools/utils/parse_args.h"        // for m_getarg, CFO_STRING
-#include "math/mat3/mat3.h"
 #include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
 
 void  show_usage_and_exit()
 {
@@ -46,138 +49,18 @@ void  show_usage_and_exit()
     printf("    -rotate <in-plane rotation degrees> - simulates map orientation error\n");
     printf("    -random_displace <mean> <stddev> - simulates correlation noise with gaussian elevation displacement\n");
     printf("    -sine_wave <amplitude> <frequency> <azimuth> - simulates image jitter with elevation displacement\n");
-//    printf("    -cubic  <a> <b> <c> <d> - simulates camera model error with elevation displacement\n");
+    printf("    -variants <N> - number of randomly displaced variants, written to <output>_<variant>.lmk when N > 1 (default 1)\n");
+    printf("    -seed <N> - seed of the random displacement, the same seed gives the same variants (default: time)\n");
+    printf("    -cubic  <a> <b> <c> <d> - simulates camera model error with elevation displacement a*z^3 + b*z^2 + c*z + d\n");
     
     exit(EXIT_FAILURE);
 }
 
-void rotateLandmark(LMK* lmk, float rot_z_degrees){
-    
-    float rot_z = rot_z_degrees*DEG2RAD;
-    
-//    float3 Rx[3][3] = {0}, Ry[3][3] = {0};
-    float3 Rz[3][3]= {0};
-    
-//    Rx[0][0] = 1;
-//    Rx[1][1] = cos(rot_x);
-//    Rx[1][2] = -1*sin(rot_x);
-//    Rx[2][1] = sin(rot_x);
-//    Rx[2][2] = cos(rot_x);
-//    
-//    Ry[0][0] = cos(rot_y);
-//    Ry[0][2] = sin(rot_y);
-//    Ry[1][1] = 1;
-//    Ry[2][0] = -1*sin(rot_y);
-//    Ry[2][2] = cos(rot_y);
-    
-    Rz[0][0] = cos(rot_z);
-    Rz[0][1] = -1*sin(rot_z);
-    Rz[1][0] = sin(rot_z);
-    Rz[1][1] = cos(rot_z);
-    Rz[2][2] = 1;
-    
-//    float3 Rxy[3][3]={0};
-//    mult333(Rx, Ry, Rxy);
-//    float3 Rxyz[3][3]={0};
-//    mult333(Rxy, Rz, Rxyz);
-    
-    float3 R[3][3]={0};
-    mult333(Rz, lmk->mapRworld, R);
-    copy33(R, lmk->mapRworld);
-}
-
-void translateLandmark(LMK* lmk, float translate_x, float translate_y, float translate_z){
-    double translateMap[3] = {translate_x, translate_y, translate_z};
-    double translateWorld[3];
-    
-    mult331(lmk->worldRmap, translateMap, translateWorld);
-    
-    lmk->anchor_point[0] += translateWorld[0];
-    lmk->anchor_point[1] += translateWorld[1];
-    lmk->anchor_point[2] += translateWorld[2];
-}
-
-//Based on Wikipedia C++ implementation
-double sampleBoxMuller(double mean, double stddev) {
-    static double x1=0, x2=0;
-    static bool call = false;
-
-    if (call) {
-        call = !call;
-        return x2;
-    }
-
-    double u1, u2;
-    do {
-        u1 = (double) rand() / RAND_MAX;
-    } while (u1 == 0);
-    u2 = (double) rand() / RAND_MAX;
-    
-    double two_pi = 2.0 * PI;
-    double mag = stddev * sqrt(-2.0 * log(u1));
-    x1  = mag * cos(two_pi * u2) + mean;
-    x2  = mag * sin(two_pi * u2) + mean;
-
-    call = !call;
-
-    return x1;
-}
-
-//TODO do we want to displace the elevation or the 3d point?
-void displaceElevationGaussian(LMK* lmk, float mean, float stddev){
-    for(size_t i =0; i<lmk->num_pixels; i++){
-        lmk->ele[i] += sampleBoxMuller(mean, stddev);
-    }
-}
-
-bool displaceElevationCubic(LMK* lmk, float cubic_a, float cubic_b, float cubic_c, float cubic_d){
-    return false;
-}
-
-void displaceElevationSine(
-        LMK* lmk,
-        float sine_amplitude,
-        float sine_frequency,
-        float sine_azimuth
-) {
-    float sine_azimuth_rad = sine_azimuth * PI / 180.0f;
-    float cos_a = cosf(sine_azimuth_rad);
-    float sin_a = sinf(sine_azimuth_rad);
-
-    // One-cycle width along the wave's axis
-    float width = 1.0f / sine_frequency;
-
-    // Center of the matrix
-    float center_x = (float)lmk->num_cols * 0.5f;
-    float center_y = (float)lmk->num_rows * 0.5f;
-
-    // Half-width to check distance in [-half_width, +half_width]
-    float half_width = 0.5f * width;
-
-    for (size_t y = 0; y < lmk->num_rows; y++) {
-        for (size_t x = 0; x < lmk->num_cols; x++) {
-
-            // Vector from center to (x,y)
-            float dx = (float)x - center_x;
-            float dy = (float)y - center_y;
-
-            // Distance along wave axis
-            float distance = dx * cos_a + dy * sin_a;
-
-            // Only apply wave if distance is within one cycle's range
-            if (distance >= -half_width && distance <= half_width) {
-                // Map distance in [-half_width, +half_width] to [-π, +π]
-                // or [0..2π], as you prefer. Here we do [0..2π] for one full cycle:
-                float normalized = (distance + half_width) / (2.0f * half_width);
-                float phase = 2.0f * PI * normalized;
-                lmk->srm[y * lmk->num_cols + x] += sine_amplitude * sinf(phase);
-            }
-        }
-    }
-}
-
 int32_t main (int32_t argc, char **argv)
 {
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
     char *infile=NULL;
     char *outfile=NULL;
     
@@ -196,6 +79,8 @@ int32_t main (int32_t argc, char **argv)
     float sine_amplitude = 0;
     float sine_frequency = 0;
     float sine_azimuth = 0;
+    int32_t num_variants = 1;
+    char *seed_str = NULL;
     
     argc--;
     argv++;
@@ -206,7 +91,9 @@ int32_t main (int32_t argc, char **argv)
         //Arguments with one value
         if ((m_getarg(argv, "-input", &infile,  CFO_STRING) == 1) ||
             (m_getarg(argv, "-output", &outfile,  CFO_STRING) == 1) ||
-            (m_getarg(argv, "-rotate", &rot_z, CFO_FLOAT) == 1))
+            (m_getarg(argv, "-rotate", &rot_z, CFO_FLOAT) == 1) ||
+            (m_getarg(argv, "-variants", &num_variants, CFO_INT) == 1) ||
+            (m_getarg(argv, "-seed", &seed_str, CFO_STRING) == 1))
         {
             argv+=2;
         }else if (m_getarg(argv, "-translate", &translate_x, CFO_FLOAT) == 1){
@@ -214,7 +101,7 @@ int32_t main (int32_t argc, char **argv)
             if( (sscanf(argv[2], "%f", (&translate_y)) == 1) &&
                (sscanf(argv[3], "%f", (&translate_z)) == 1)){
                 argv +=4;
-                i += 3;
+                i += 2;
             }else{
                 printf("Error reading -translate value.\n");
                 show_usage_and_exit();
@@ -224,7 +111,7 @@ int32_t main (int32_t argc, char **argv)
             // random_displace has two values
             if( (sscanf(argv[2], "%f", (&stddev)) == 1)){
                 argv +=3;
-                i += 2;
+                i += 1;
             }else{
                 printf("Error reading -random_displace value.\n");
                 show_usage_and_exit();
@@ -234,7 +121,7 @@ int32_t main (int32_t argc, char **argv)
             if( (sscanf(argv[2], "%f", (&sine_frequency)) == 1) &&
                (sscanf(argv[3], "%f", (&sine_azimuth)) == 1)){
                 argv +=4;
-                i += 3;
+                i += 2;
             }else{
                 printf("Error reading -sine_wave value.\n");
                 show_usage_and_exit();
@@ -245,7 +132,7 @@ int32_t main (int32_t argc, char **argv)
                (sscanf(argv[3], "%f", (&cubic_c)) == 1) &&
                (sscanf(argv[4], "%f", (&cubic_d)) == 1)){
                 argv +=5;
-                i += 4;
+                i += 3;
             }else{
                 printf("Error reading -cubic value.\n");
                 show_usage_and_exit();
@@ -257,58 +144,94 @@ int32_t main (int32_t argc, char **argv)
     }
     
     // Required arguments
-    if(infile==NULL | outfile==NULL ){
+    if(infile==NULL | outfile==NULL || num_variants < 1){
         show_usage_and_exit();
     }
+    uint64_t seed = seed_str == NULL ? (uint64_t)time(NULL) : strtoull(seed_str, NULL, 10);
     
-    LMK lmk = {0};
-    if(!Read_LMK(infile, &lmk)){
-        SAFE_PRINTF(256, "Failed to read landmark file: %s\n", infile);
-        free_lmk(&lmk);
-        return EXIT_FAILURE;
-    }
-    
+    LMK_Distortion distortion;
+    LMK_Distortion_Init(&distortion);
     if(rot_z != 0){
-        SAFE_PRINTF(256, "Rotating landmark in plane by %f degrees...", rot_z);
-        rotateLandmark(&lmk, rot_z);
-        printf("done.\n");
+        SAFE_PRINTF(256, "Rotating landmark in plane by %f degrees\n", rot_z);
+        distortion.rotate_degrees = rot_z;
     }
     
     if(translate_x != 0 || translate_y != 0 || translate_z != 0){
-        SAFE_PRINTF(256, "Translating landmark by (%f, %f, %f)...", translate_x, translate_y, translate_z);
-        translateLandmark(&lmk, translate_x, translate_y, translate_z);
-        printf("done.\n");
+        SAFE_PRINTF(256, "Translating landmark by (%f, %f, %f)\n", translate_x, translate_y, translate_z);
+        distortion.translate[0] = translate_x;
+        distortion.translate[1] = translate_y;
+        distortion.translate[2] = translate_z;
     }
     
     if(stddev != -1){
-        SAFE_PRINTF(256, "Applying random displacement to landmark with mu=%f, sigma=%f ...", mean, stddev);
-        srand(time(NULL)); //seed random number generator
-        displaceElevationGaussian(&lmk, mean, stddev);
-        printf("done.\n");
+        SAFE_PRINTF(256, "Applying random displacement to landmark with mu=%f, sigma=%f, seed=%llu\n", mean, stddev,
+                    (unsigned long long)seed);
+        distortion.gaussian = true;
+        distortion.gaussian_mean = mean;
+        distortion.gaussian_stddev = stddev;
+    }else if(num_variants > 1){
+        printf("-variants requires -random_displace\n");
+        show_usage_and_exit();
     }
     
     if(cubic_a !=0 || cubic_b != 0 || cubic_c != 0 || cubic_d != 0 ){
-        SAFE_PRINTF(256, "Applying cubic displacement to landmark: f(z) = %fz^3 + %fz^2 + %fz + %f ...", cubic_a, cubic_b, cubic_c, cubic_d);
-        if(!displaceElevationCubic(&lmk, cubic_a, cubic_b, cubic_c, cubic_d)){
-            printf("Failed to displace landmark\n");
-            free_lmk(&lmk);
+        SAFE_PRINTF(256, "Applying cubic displacement to landmark: f(z) = %fz^3 + %fz^2 + %fz + %f\n", cubic_a, cubic_b, cubic_c, cubic_d);
+        distortion.cubic = true;
+        distortion.cubic_coefficients[0] = cubic_a;
+        distortion.cubic_coefficients[1] = cubic_b;
+        distortion.cubic_coefficients[2] = cubic_c;
+        distortion.cubic_coefficients[3] = cubic_d;
+    }
+    
+    if(sine_amplitude !=0 || sine_frequency != 0 || sine_azimuth != 0 ){
+        if(sine_frequency <= 0){
+            printf("-sine_wave frequency must be positive\n");
+            show_usage_and_exit();
+        }
+        SAFE_PRINTF(256, "Applying sine displacement to landmark: z(x,y) = %fsin(2PI*%fx*cos(%f) +y*cos(%f))\n", sine_amplitude, sine_frequency, sine_azimuth, sine_azimuth);
+        distortion.sine = true;
+        distortion.sine_amplitude = sine_amplitude;
+        distortion.sine_frequency = sine_frequency;
+        distortion.sine_azimuth = sine_azimuth;
+    }
+    
+    // A rotation or translation of the landmark in place only changes its header
+    if(!distortion.gaussian && !distortion.cubic && !distortion.sine && num_variants == 1 &&
+       strcmp(outfile, infile) == 0){
+        LMK_Patch patch;
+        if(!Open_LMK_Patch(infile, &patch)){
+            return EXIT_FAILURE;
+        }
+        LMK header;
+        LMK_Distort_Header(&patch.header, &distortion, &header);
+        bool success = LMK_Patch_Header(&patch, &header);
+        success = Close_LMK_Patch(&patch) && success;
+        if(success){
+            SAFE_PRINTF(256, "Landmark file updated: %s\n", infile);
+            return EXIT_SUCCESS;
+        }else{
             return EXIT_FAILURE;
         }
-        printf("done.\n");
     }
     
-    if(sine_amplitude !=0 || sine_frequency != 0 || sine_azimuth != 0 ){
-        SAFE_PRINTF(256, "Applying sine displacement to landmark: z(x,y) = %fsin(2PI*%fx*cos(%f) +y*cos(%f))...", sine_amplitude, sine_frequency, sine_azimuth, sine_azimuth);
-        displaceElevationSine(&lmk, sine_amplitude, sine_frequency, sine_azimuth);
-        printf("done.\n");
+    LMK lmk = {0};
+    if(!Read_LMK(infile, &lmk)){
+        SAFE_PRINTF(256, "Failed to read landmark file: %s\n", infile);
+        free_lmk(&lmk);
+        return EXIT_FAILURE;
     }
     
-    bool success = Write_LMK(outfile, &lmk);
+    // Every perturbation is applied in one pass over the rasters as the landmark is written
+    bool success = Write_LMK_Distorted_Variants(&lmk, &distortion, seed, num_variants, outfile);
     
     free_lmk(&lmk);
     
     if(success){
-        SAFE_PRINTF(256, "Landmark file written to: %s\n", outfile);
+        if(num_variants == 1){
+            SAFE_PRINTF(256, "Landmark file written to: %s\n", outfile);
+        }else{
+            SAFE_PRINTF(256, "%d landmark variants written\n", num_variants);
+        }
         return EXIT_SUCCESS;
     }else{
         return EXIT_FAILURE;
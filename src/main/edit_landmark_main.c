@@ -26,8 +26,16 @@
 #include <string.h>                                 // for strncmp
 
 #include "landmark_tools/landmark_util/landmark.h"  // for free_lmk, Crop_In...
+#include "landmark_tools/landmark_util/landmark_tiled.h"  // for Write_LMK_Tiled
+#include "landmark_tools/landmark_util/lmk_edit.h"        // for Crop_Interpolate_LMK_File
+#include "landmark_tools/landmark_util/lmk_overview.h"    // for Write_LMK_Overviews
+#include "landmark_tools/landmark_util/lmk_reader.h"      // for Read_LMK_Parallel
+#include "landmark_tools/landmark_util/lmk_resample.h"    // for Resample_LMK_File
 #include "landmark_tools/utils/parse_args.h"        // for m_getarg, CFO_STRING
 #include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
 
 void  show_usage_and_exit()
 {
@@ -42,12 +50,20 @@ void  show_usage_and_exit()
     printf("    -operation   <CROP|RESCALE|SUBSET> - what operation to perform\n");
     printf("  Optional arguments:\n");
     printf("    -scale   <double> - scale for RESCALE operation\n");
+    printf("    -filter   <BILINEAR|AREA|LANCZOS> - resampling filter for RESCALE operation (default BILINEAR)\n");
     printf("    -roi   <left> <top> <width> <height> - roi for crop and subset operations\n");
+    printf("    -tile_size   <int> - write output in the tiled v4 format with this tile size\n");
+    printf("    -compression   <NONE|DEFLATE> - tile compression for the v4 format (default DEFLATE)\n");
+    printf("    -ele_encoding   <FLOAT32|FLOAT16|INT16> - elevation encoding for the v4 format (default FLOAT32)\n");
+    printf("    -overviews   <int> - also write an overview pyramid with this many 2x levels to <output>.ovr\n");
     exit(EXIT_FAILURE);
 }
 
 int32_t main (int32_t argc, char **argv)
 {
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
     char *infile=NULL;
     char *outfile=NULL;
     char *operation=NULL;
@@ -56,6 +72,11 @@ int32_t main (int32_t argc, char **argv)
     int32_t roi_top = -1;
     int32_t roi_width = -1;
     int32_t roi_height = -1;
+    int32_t tile_size = 0;
+    char *compression_str = NULL;
+    char *ele_encoding_str = NULL;
+    char *filter_str = NULL;
+    int32_t overview_levels = 0;
     
     argc--;
     argv++;
@@ -67,7 +88,12 @@ int32_t main (int32_t argc, char **argv)
         if ((m_getarg(argv, "-input", &infile,  CFO_STRING) == 1) ||
             (m_getarg(argv, "-output", &outfile,  CFO_STRING) == 1) ||
             (m_getarg(argv, "-operation", &operation, CFO_STRING) == 1) ||
-            (m_getarg(argv, "-scale", &scale, CFO_DOUBLE) == 1))
+            (m_getarg(argv, "-scale", &scale, CFO_DOUBLE) == 1) ||
+            (m_getarg(argv, "-filter", &filter_str, CFO_STRING) == 1) ||
+            (m_getarg(argv, "-tile_size", &tile_size, CFO_INT) == 1) ||
+            (m_getarg(argv, "-compression", &compression_str, CFO_STRING) == 1) ||
+            (m_getarg(argv, "-ele_encoding", &ele_encoding_str, CFO_STRING) == 1) ||
+            (m_getarg(argv, "-overviews", &overview_levels, CFO_INT) == 1))
         {
             argv+=2;
         }else if (m_getarg(argv, "-roi", &roi_left, CFO_INT) == 1){
@@ -92,42 +118,71 @@ int32_t main (int32_t argc, char **argv)
         show_usage_and_exit();
     }
     
+    bool is_rescale = strncmp(operation, "RESCALE", strlen(operation))==0;
+    bool is_crop = strncmp(operation, "CROP", strlen(operation))==0;
+    bool is_subset = strncmp(operation, "SUBSET", strlen(operation))==0;
+    if((is_rescale && scale == 1.0) || ((is_crop || is_subset) && (roi_left == -1 || roi_top == -1 || roi_height == -1 || roi_width == -1))){
+        printf(is_rescale ? "Failed to parse scale factor\n" : "Failed to parse roi factor\n");
+        show_usage_and_exit();
+    }
+    enum LMK_ResampleFilter filter = strToLMKResampleFilter(filter_str);
+    if(filter == LMK_ResampleFilter_UNDEFINED){
+        show_usage_and_exit();
+    }
+    
+    // v3 output is streamed a band of rows at a time, so only the rows of the current band are in memory
+    if(tile_size <= 0 && overview_levels <= 0 && strcmp(infile, outfile) != 0){
+        bool success = false;
+        if(is_rescale){
+            success = Resample_LMK_File(infile, outfile, scale, filter);
+        }else if(is_crop){
+            success = Crop_Interpolate_LMK_File(infile, outfile, roi_left, roi_top, roi_width, roi_height);
+        }else if(is_subset){
+            success = Subset_LMK_File(infile, outfile, roi_left, roi_top, roi_width, roi_height);
+        }else{
+            show_usage_and_exit();
+        }
+        if(success){
+            SAFE_PRINTF(256, "Landmark file written to: %s\n", outfile);
+            return EXIT_SUCCESS;
+        }else{
+            return EXIT_FAILURE;
+        }
+    }
+    
+    // The tiled format and overviews are written from the whole output landmark
     LMK lmk = {0};
     LMK lmk_out = {0};
-    if(!Read_LMK(infile, &lmk)){
+    
+    // SUBSET only needs the roi, which is read directly from disk
+    if(!is_subset && !Read_LMK_Parallel(infile, &lmk, 0)){
         SAFE_PRINTF(256, "Failed to read landmark file: %s\n", infile);
         return EXIT_FAILURE;
     }
     
     bool success = true;
-    if(strncmp(operation, "RESCALE", strlen(operation))==0){
-        if(scale == 1.0){
-            printf("Failed to parse scale factor\n");
-            show_usage_and_exit();
-        }
-        
-        success &= ResampleLMK(&lmk, &lmk_out, scale);
-        
-    }else if(strncmp(operation, "CROP", strlen(operation))==0){
-        if(roi_left == -1 || roi_top == -1 || roi_height == -1 || roi_width == -1){
-            printf("Failed to parse roi factor\n");
-            show_usage_and_exit();
-        }
-        
+    if(is_rescale){
+        success &= Resample_LMK_Filtered(&lmk, &lmk_out, scale, filter);
+    }else if(is_crop){
         success &= Crop_IntepolateLMK(&lmk, &lmk_out, roi_left, roi_top, roi_width, roi_height);
-    }else if(strncmp(operation, "SUBSET", strlen(operation))==0){
-        if(roi_left == -1 || roi_top == -1 || roi_height == -1 || roi_width == -1){
-            printf("Failed to parse roi factor\n");
-            show_usage_and_exit();
-        }
-        
-        success &= SubsetLMK(&lmk, &lmk_out, roi_left, roi_top, roi_width, roi_height);
+    }else if(is_subset){
+        success &= Read_LMK_Window(infile, roi_left, roi_top, roi_width, roi_height, &lmk_out);
     }else{
         show_usage_and_exit();
     }
     
     if(success){
-        success &= Write_LMK(outfile, &lmk_out);
+        if(tile_size > 0){
+            enum LMK_Compression compression = compression_str == NULL ? LMK_COMPRESSION_DEFLATE : strToLMKCompression(compression_str);
+            enum LMK_Ele_Encoding ele_encoding = strToLMKEleEncoding(ele_encoding_str);
+            success &= Write_LMK_Tiled(outfile, &lmk_out, tile_size, compression, ele_encoding, false);
+        }else{
+            success &= Write_LMK(outfile, &lmk_out);
+        }
+    }
+    
+    if(success && overview_levels > 0){
+        success &= Write_LMK_Overviews(outfile, &lmk_out, overview_levels);
     }
     
     free_lmk(&lmk);
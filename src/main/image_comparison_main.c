@@ -46,6 +46,9 @@
 #include "landmark_tools/feature_tracking/correlation_results.h"  // for CorrelationResults
 #include "landmark_tools/opencv_tools/homography_estimation.h" // for estimateHomographyFromFeatureMatching
 #include "landmark_tools/utils/write_array.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
 
 void show_usage_and_exit()
 {
@@ -64,6 +67,9 @@ void show_usage_and_exit()
     printf("    -warp    <image(default)/template> \n");
     printf("    -homography_max_dist_between_matching_keypoints    <0 or greater> \n");
     printf("    -c    <ftp_config_filepath> \n");
+    printf("    -base_features    <feature_filepath_prefix, to reuse the base image features across runs> \n");
+    printf("    -match_index    <0(default, exact)/1(approximate FLANN index)> \n");
+    printf("    -tile_size    <0(default, whole image) or tile width in pixels, to bound memory and match tiles in parallel> \n");
     exit(EXIT_FAILURE);
 }
 
@@ -149,6 +155,9 @@ static bool load_mask(const char *mask_file,
 
 int32_t main (int32_t argc, char **argv)
 {
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
     // Initialize variables
     char *base_image_file = NULL;
     char *child_image_file = NULL;
@@ -158,6 +167,9 @@ int32_t main (int32_t argc, char **argv)
     char *output_dir = NULL;
     char *output_filename_prefix = NULL;
     char *parameter_file = NULL;
+    char *base_features_prefix = NULL;
+    int32_t match_index = 0;
+    int32_t tile_size = 0;
     
     // Set this to > 0 to reject matches that are more than N pixels apart on any direction
     // Only use this if images are expected to be in about the same frame
@@ -192,7 +204,10 @@ int32_t main (int32_t argc, char **argv)
             (m_getarg(argv, "-output_dir",    &output_dir,         CFO_STRING)!=1) &&
             (m_getarg(argv, "-output_filename_prefix",    &output_filename_prefix,         CFO_STRING)!=1) &&
             (m_getarg(argv, "-homography_max_dist_between_matching_keypoints",    &homography_max_dist_between_matching_keypoints,         CFO_DOUBLE)!=1) &&
-            (m_getarg(argv, "-c",    &parameter_file,         CFO_STRING)!=1))
+            (m_getarg(argv, "-c",    &parameter_file,         CFO_STRING)!=1) &&
+            (m_getarg(argv, "-base_features",    &base_features_prefix,         CFO_STRING)!=1) &&
+            (m_getarg(argv, "-match_index",    &match_index,         CFO_INT)!=1) &&
+            (m_getarg(argv, "-tile_size",    &tile_size,         CFO_INT)!=1))
             show_usage_and_exit( );
 
         argc-=2;
@@ -258,6 +273,23 @@ int32_t main (int32_t argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    // Base image features, loaded from or saved to the feature files when a prefix is given
+    HomographyBaseFeatures base_features = {0};
+    bool use_base_features = base_features_prefix != NULL || match_index != 0;
+    if (use_base_features) {
+        if (!initHomographyBaseFeatures(
+            &base_features,
+            base_image,
+            base_nan_mask,
+            base_image_num_rows,
+            base_image_num_cols,
+            base_features_prefix
+        )) {
+            printf("Failed to compute the base image features\n");
+        }
+        base_features.use_index = match_index != 0;
+    }
+
     // Initialize output correlation
     int child_image_num_pixels = child_image_num_rows * child_image_num_cols;
     allocate_correlation_results(&corr_struct, child_image_num_pixels);
@@ -276,8 +308,11 @@ int32_t main (int32_t argc, char **argv)
         output_dir,
         homography_max_dist_between_matching_keypoints,
         child_nan_max_count,
-        base_nan_max_count
+        base_nan_max_count,
+        use_base_features ? &base_features : NULL,
+        tile_size
     );
+    freeHomographyBaseFeatures(&base_features);
 
     if (!success)
     {
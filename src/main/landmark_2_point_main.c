@@ -30,6 +30,9 @@
 #include "landmark_tools/utils/parse_args.h"             // for m_getarg
 #include "rply.h"                                        // for e_ply_storag...
 #include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
 void show_usage_and_exit()
 {
     printf("Write a landmark to a ply mesh or pointcloud.\n");
@@ -48,6 +51,9 @@ void show_usage_and_exit()
 
 int32_t main(int32_t argc, char **argv)
 {
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
     char *pointfile= NULL;
     char *lmkfile = NULL;
     char *filetype_str = NULL;
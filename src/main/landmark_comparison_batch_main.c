@@ -0,0 +1,297 @@
+/**
+ * \file landmark_comparison_batch_main.c
+ * \brief Compare many child landmark files against one base landmark
+ *
+ * The base landmark is loaded and prepared once, and the comparisons run one after another, each on all matching
+ * threads. The next child landmark is read while the current one is compared.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*-----------------------------------------------------------*/
+/*------------------------ Includes -------------------------*/
+/*-----------------------------------------------------------*/
+#include <pthread.h>                                        // for pthread_create, pthread_join
+#include <stdbool.h>                                        // for false, bool
+#include <stdint.h>                                         // for int32_t
+#include <stdio.h>                                          // for printf, NULL
+#include <stdlib.h>                                         // for free, malloc
+#include <string.h>                                         // for strcspn
+
+#include "landmark_tools/feature_tracking/feature_match.h"  // for MatchFeat...
+#include "landmark_tools/feature_tracking/parameters.h"     // for Parameters, Read...
+#include "landmark_tools/landmark_util/landmark.h"          // for free_lmk
+#include "landmark_tools/feature_tracking/correlation_results.h"  // for CorrelationResults
+#include "landmark_tools/utils/parse_args.h"                // for m_getarg
+#include "landmark_tools/utils/write_array.h"
+#include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
+
+/**
+ * \brief Display usage information and exit
+ */
+void show_usage_and_exit()
+{
+    printf("Compare many landmark files against one base landmark using a dense patch-based correlation matcher\n");
+    printf("Usage for landmark_comparison_batch:\n");
+    printf("------------------\n");
+    printf("  Required arguments:\n");
+    printf("    -manifest <filename> - text file with one line per comparison: <lmk_filepath> <output_prefix>\n");
+    printf("    -l2   <lmk_filepath> - Base landmark file every landmark of the manifest is compared to\n");
+    printf("    -c    <parameters_config_filepath> - Configuration file for matching parameters\n");
+    printf("    -nan_max_count1     <-1 to ignore, 0 or greater to filter> - Max NaN count for manifest landmarks\n");
+    printf("    -nan_max_count2     <-1 to ignore, 0 or greater to filter> - Max NaN count for the base landmark\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * \brief One comparison of the manifest
+ */
+typedef struct {
+    char child_path[LMK_FILENAME_SIZE];
+    char output_prefix[LMK_FILENAME_SIZE];
+} BatchEntry;
+
+/**
+ * \brief Child landmark read by a loader thread
+ */
+typedef struct {
+    const char *path;
+    LMK landmark;
+    bool success;
+} ChildLoad;
+
+/**
+ \brief Read the manifest, one child landmark and output prefix per line. Empty lines and lines starting with # are
+ skipped.
+ \return number of entries or -1 on error
+*/
+static int32_t read_manifest(const char *manifest_path, BatchEntry **entries)
+{
+    FILE *fp = fopen(manifest_path, "r");
+    if (fp == NULL) {
+        SAFE_PRINTF(512, "Cannot open %s\n", manifest_path);
+        return -1;
+    }
+
+    int32_t capacity = 64;
+    int32_t count = 0;
+    BatchEntry *list = (BatchEntry *)malloc(capacity * sizeof(BatchEntry));
+    char line[2 * LMK_FILENAME_SIZE + 2];
+    bool success = list != NULL;
+    while (success && fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        if (count == capacity) {
+            capacity *= 2;
+            BatchEntry *grown = (BatchEntry *)realloc(list, capacity * sizeof(BatchEntry));
+            if (grown == NULL) {
+                success = false;
+                break;
+            }
+            list = grown;
+        }
+        char format[32];
+        snprintf(format, sizeof(format), "%%%ds %%%ds", LMK_FILENAME_SIZE - 1, LMK_FILENAME_SIZE - 1);
+        if (sscanf(line, format, list[count].child_path, list[count].output_prefix) != 2) {
+            SAFE_PRINTF(512, "read_manifest() ==>> expected <lmk_filepath> <output_prefix> in line '%s'\n", line);
+            success = false;
+            break;
+        }
+        count++;
+    }
+    fclose(fp);
+
+    if (!success) {
+        if (list == NULL) printf("read_manifest() ==>> malloc() failed\n");
+        free(list);
+        return -1;
+    }
+    *entries = list;
+    return count;
+}
+
+static void *load_child_thread(void *arg)
+{
+    ChildLoad *load = (ChildLoad *)arg;
+    load->success = Read_LMK(load->path, &load->landmark);
+    return NULL;
+}
+
+/**
+ * \brief Start reading a child landmark in the background, or read it now if no thread can be started
+ *
+ * \return true if `thread` must be joined
+ */
+static bool start_child_load(ChildLoad *load, const char *path, pthread_t *thread)
+{
+    memset(load, 0, sizeof(ChildLoad));
+    load->path = path;
+    if (pthread_create(thread, NULL, load_child_thread, load) == 0) {
+        return true;
+    }
+    load_child_thread(load);
+    return false;
+}
+
+/**
+ * \brief Compare one child landmark to the prepared base and save the maps with the naming of landmark_comparison
+ *
+ * \return true on success
+ */
+static bool compare_child(const Parameters *parameters, const MatchBase *base, LMK *child_landmark,
+                          int32_t max_nan_count_child, const char *output_prefix)
+{
+    CorrelationResults results;
+    if (!allocate_correlation_results(&results, child_landmark->num_pixels)) {
+        return false;
+    }
+    MatchGrid grid;
+    if (!allocate_match_grid(&grid, parameters, child_landmark->num_cols, child_landmark->num_rows)) {
+        destroy_correlation_results(&results);
+        return false;
+    }
+    bool success = MatchFeaturesWithLocalDistortion_base(*parameters, base, child_landmark, &results,
+                                                         max_nan_count_child, &grid);
+    free_match_grid(&grid);
+
+    if (success) {
+        SAFE_PRINTF(256, "Saving results to %s\n", output_prefix);
+        const char *map_names[4] = {"delta_x", "delta_y", "delta_z", "corr"};
+        float *maps[4] = {results.delta_x, results.delta_y, results.delta_z, results.correlation};
+        size_t buf_size = 256;
+        char buf[buf_size];
+        for (int32_t k = 0; k < 4 && success; k++) {
+            snprintf(buf, buf_size, "%s_%s_%dby%d.raw", output_prefix, map_names[k],
+                     child_landmark->num_cols, child_landmark->num_rows);
+            success = write_data_to_file(buf, maps[k], sizeof(float), child_landmark->num_pixels) == 0;
+        }
+    }
+    destroy_correlation_results(&results);
+    return success;
+}
+
+/**
+ * \brief Main function for batch landmark comparison
+ *
+ * \param argc Number of command line arguments
+ * \param argv Array of command line argument strings
+ * \return EXIT_SUCCESS if every comparison succeeds, EXIT_FAILURE otherwise
+ */
+int32_t main(int32_t argc, char **argv)
+{
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
+    char *manifest_path = NULL;
+    char *base_landmark_path = NULL;
+    char *parameters_path = NULL;
+    char *nan_max_count1_str = NULL;
+    char *nan_max_count2_str = NULL;
+
+    argc--;
+    argv++;
+
+    if (argc == 0) show_usage_and_exit();
+
+    while (argc > 0) {
+        if (argc == 1) show_usage_and_exit();
+        if ((m_getarg(argv, "-manifest", &manifest_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-l2", &base_landmark_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-c", &parameters_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-nan_max_count1", &nan_max_count1_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-nan_max_count2", &nan_max_count2_str, CFO_STRING) != 1))
+            show_usage_and_exit();
+
+        argc -= 2;
+        argv += 2;
+    }
+    if (manifest_path == NULL || base_landmark_path == NULL) show_usage_and_exit();
+
+    // Load and validate parameters
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    if (parameters_path == NULL) {
+        printf("No parameter file provided. Using defaults.\n");
+    } else if (!read_parameterfile(parameters_path, &parameters)) {
+        SAFE_PRINTF(256, "Cannot load %s\n", parameters_path);
+        return EXIT_FAILURE;
+    }
+    print_parameters(parameters);
+
+    int32_t max_nan_count_child = -1; // Default: do not check for NaN in child landmarks
+    int32_t max_nan_count_base = 0;   // Default: do not allow any NaN in base landmark
+    if (nan_max_count1_str != NULL) {
+        max_nan_count_child = atoi(nan_max_count1_str);
+    }
+    if (nan_max_count2_str != NULL) {
+        max_nan_count_base = atoi(nan_max_count2_str);
+    }
+
+    BatchEntry *entries = NULL;
+    int32_t num_entries = read_manifest(manifest_path, &entries);
+    if (num_entries < 0) {
+        return EXIT_FAILURE;
+    }
+
+    // The base side is prepared once for every comparison
+    LMK base_landmark = {0};
+    if (!Read_LMK(base_landmark_path, &base_landmark)) {
+        free(entries);
+        return EXIT_FAILURE;
+    }
+    MatchBase base;
+    if (!prepare_match_base(&base, &base_landmark, max_nan_count_base)) {
+        free_lmk(&base_landmark);
+        free(entries);
+        return EXIT_FAILURE;
+    }
+
+    int32_t num_failed = 0;
+    ChildLoad loads[2];
+    pthread_t threads[2];
+    bool joinable[2] = {false, false};
+    if (num_entries > 0) {
+        joinable[0] = start_child_load(&loads[0], entries[0].child_path, &threads[0]);
+    }
+    for (int32_t i = 0; i < num_entries; i++) {
+        ChildLoad *load = &loads[i % 2];
+        if (joinable[i % 2]) pthread_join(threads[i % 2], NULL);
+        joinable[i % 2] = false;
+
+        // Read the next child while this one is compared
+        if (i + 1 < num_entries) {
+            joinable[(i + 1) % 2] = start_child_load(&loads[(i + 1) % 2], entries[i + 1].child_path,
+                                                     &threads[(i + 1) % 2]);
+        }
+
+        SAFE_PRINTF(1024, "Comparison %d of %d: %s\n", i + 1, num_entries, entries[i].child_path);
+        bool success = load->success && compare_child(&parameters, &base, &load->landmark, max_nan_count_child,
+                                                      entries[i].output_prefix);
+        if (!success) {
+            SAFE_PRINTF(1024, "Failed to compare %s\n", entries[i].child_path);
+            num_failed++;
+        }
+        free_lmk(&load->landmark);
+    }
+
+    SAFE_PRINTF(256, "%d of %d comparisons succeeded\n", num_entries - num_failed, num_entries);
+    free_match_base(&base);
+    free_lmk(&base_landmark);
+    free(entries);
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
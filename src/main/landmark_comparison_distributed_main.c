@@ -0,0 +1,251 @@
+/**
+ * \file landmark_comparison_distributed_main.c
+ *
+ * \brief Compare two landmark files on many processes that share a work directory
+ *
+ * The comparison runs in stages: `plan` splits the child landmark in tiles balanced across the ranks, `work` compares
+ * the tiles of one rank, reading only the windows of the landmarks they need, and `gather` stitches the tiles into
+ * one results raster. The ranks of the `work` stage can run at the same time on any nodes that see the work
+ * directory, started by an MPI launcher, a batch scheduler or by hand.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*-----------------------------------------------------------*/
+/*------------------------ Includes -------------------------*/
+/*-----------------------------------------------------------*/
+#include <errno.h>                                          // for errno, EEXIST
+#include <stdbool.h>                                        // for false, bool
+#include <stdint.h>                                         // for int32_t
+#include <stdio.h>                                          // for printf, NULL
+#include <stdlib.h>                                         // for atoi, getenv
+#include <string.h>                                         // for strcmp, strerror
+#include <sys/stat.h>                                       // for mkdir, stat
+
+#include "landmark_tools/feature_tracking/distributed_match.h"  // for Plan_Distributed_Match
+#include "landmark_tools/feature_tracking/parameters.h"         // for Parameters, read_parameterfile
+#include "landmark_tools/utils/parse_args.h"                    // for m_getarg
+#include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
+
+#define DEFAULT_TILE_SIZE 2048
+
+/**
+ * \brief Display usage information and exit
+ */
+void show_usage_and_exit()
+{
+    printf("Compare landmark files in tiles on many processes that share a work directory\n");
+    printf("Usage for landmark_comparison_distributed:\n");
+    printf("------------------\n");
+    printf("  Required arguments:\n");
+    printf("    -stage <plan, work, gather or all> - Stage of the comparison. all runs the three stages as one rank\n");
+    printf("    -work_dir <directory> - Directory shared by the ranks, holding the plan and the tiles.\n");
+    printf("             Created by plan if it is missing\n");
+    printf("    -l1   <lmk_filepath> - First landmark file to compare (not needed by gather)\n");
+    printf("    -l2   <lmk_filepath> - Second landmark file to compare (not needed by gather)\n");
+    printf("  Optional arguments:\n");
+    printf("    -c    <parameters_config_filepath> - Configuration file for matching parameters, the same for every\n");
+    printf("             stage\n");
+    printf("    -o    <output_prefix> - Prefix of the <output_prefix>_results_<cols>by<rows>.lmkr raster written by\n");
+    printf("             gather (required for gather and all)\n");
+    printf("    -num_ranks <n> - Ranks sharing the tiles, for plan. Defaults to the size of an MPI or Slurm job\n");
+    printf("    -rank <r> - Rank of this process, for work. Defaults to the rank of an MPI or Slurm job, else 0\n");
+    printf("    -tile_size <pixels> - Width and height of the tiles, for plan (default %d)\n", DEFAULT_TILE_SIZE);
+    printf("    -nan_max_count1     <-1 to ignore, 0 or greater to filter> - Max NaN count for first landmark\n");
+    printf("    -nan_max_count2     <-1 to ignore, 0 or greater to filter> - Max NaN count for second landmark\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * \brief First of the environment variables that is set, as set by MPI launchers and Slurm
+ * \return the value, or `fallback` if none is set
+ */
+static int32_t launcher_value(const char *const names[], int32_t num_names, int32_t fallback)
+{
+    for (int32_t k = 0; k < num_names; k++) {
+        const char *value = getenv(names[k]);
+        if (value != NULL && value[0] != '\0') return atoi(value);
+    }
+    return fallback;
+}
+
+/**
+ * \brief Create a directory and its missing parents, as `mkdir -p`
+ * \return true if the directory exists afterwards
+ */
+static bool make_directories(const char *path)
+{
+    size_t buf_size = 1024;
+    char partial[buf_size];
+    if (snprintf(partial, buf_size, "%s", path) >= (int)buf_size) return false;
+    for (char *p = partial + 1; ; p++) {
+        if (*p != '/' && *p != '\0') continue;
+        char end = *p;
+        *p = '\0';
+        if (mkdir(partial, 0777) != 0 && errno != EEXIST) return false;
+        *p = end;
+        if (end == '\0') break;
+    }
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
+    char *stage = NULL;                  // plan, work, gather or all
+    char *child_landmark_path = NULL;    // Path to first landmark file
+    char *base_landmark_path = NULL;     // Path to second landmark file
+    char *output_prefix = NULL;          // Prefix for output files
+    char *parameters_path = NULL;        // Path to parameters config file
+    char *work_dir = NULL;               // Directory shared by the ranks
+    char *num_ranks_str = NULL;          // Ranks of the plan
+    char *rank_str = NULL;               // Rank of this process
+    char *tile_size_str = NULL;          // Tile size of the plan
+    char *nan_max_count1_str = NULL;     // String value for first landmark's max NaN count
+    char *nan_max_count2_str = NULL;     // String value for second landmark's max NaN count
+
+    argc--;
+    argv++;
+
+    if (argc == 0) show_usage_and_exit();
+
+    while (argc > 0)
+    {
+        if (argc == 1) show_usage_and_exit();
+        if ((m_getarg(argv, "-stage", &stage, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-l1", &child_landmark_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-l2", &base_landmark_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-o", &output_prefix, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-c", &parameters_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-work_dir", &work_dir, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-num_ranks", &num_ranks_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-rank", &rank_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-tile_size", &tile_size_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-nan_max_count1", &nan_max_count1_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-nan_max_count2", &nan_max_count2_str, CFO_STRING) != 1))
+            show_usage_and_exit();
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (stage == NULL || work_dir == NULL) show_usage_and_exit();
+    bool all = strcmp(stage, "all") == 0;
+    bool plan_stage = all || strcmp(stage, "plan") == 0;
+    bool work_stage = all || strcmp(stage, "work") == 0;
+    bool gather_stage = all || strcmp(stage, "gather") == 0;
+    if (!plan_stage && !work_stage && !gather_stage) {
+        SAFE_PRINTF(256, "Unknown stage %s\n", stage);
+        show_usage_and_exit();
+    }
+    if ((plan_stage || work_stage) && (child_landmark_path == NULL || base_landmark_path == NULL)) {
+        printf("-l1 and -l2 are required to plan and compare the tiles\n");
+        show_usage_and_exit();
+    }
+    if (gather_stage && output_prefix == NULL) {
+        printf("-o is required to gather the tiles\n");
+        show_usage_and_exit();
+    }
+
+    // Load and validate parameters
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    if (parameters_path == NULL) {
+        printf("No parameter file provided. Using defaults.\n");
+    } else {
+        int32_t success = read_parameterfile(parameters_path, &parameters);
+        if (!success) {
+            SAFE_PRINTF(256, "Cannot load %s\n", parameters_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int32_t max_nan_count_child = -1; // Default: do not check for NaN in child landmark
+    int32_t max_nan_count_base = 0;   // Default: do not allow any NaN in base landmark
+    if (nan_max_count1_str != NULL) {
+        max_nan_count_child = atoi(nan_max_count1_str);
+    }
+    if (nan_max_count2_str != NULL) {
+        max_nan_count_base = atoi(nan_max_count2_str);
+    }
+
+    const char *const size_names[] = {"OMPI_COMM_WORLD_SIZE", "PMI_SIZE", "SLURM_NTASKS"};
+    const char *const rank_names[] = {"OMPI_COMM_WORLD_RANK", "PMI_RANK", "PMIX_RANK", "SLURM_PROCID"};
+    int32_t num_ranks = num_ranks_str != NULL ? atoi(num_ranks_str) : launcher_value(size_names, 3, 1);
+    int32_t rank = rank_str != NULL ? atoi(rank_str) : launcher_value(rank_names, 4, 0);
+    int32_t tile_size = tile_size_str != NULL ? atoi(tile_size_str) : DEFAULT_TILE_SIZE;
+    if (all) {
+        num_ranks = 1;
+        rank = 0;
+    }
+
+    size_t buf_size = 1024;
+    char plan_path[buf_size];
+    snprintf(plan_path, buf_size, "%s/%s", work_dir, DISTRIBUTED_PLAN_FILENAME);
+    DistributedPlan plan;
+    if (plan_stage) {
+        if (!make_directories(work_dir)) {
+            SAFE_PRINTF(1024, "Cannot create the work directory %s: %s\n", work_dir, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        if (!Plan_Distributed_Match(&parameters, child_landmark_path, tile_size, num_ranks, &plan)) {
+            return EXIT_FAILURE;
+        }
+        int64_t *costs = (int64_t *)malloc(sizeof(int64_t) * num_ranks);
+        if (costs != NULL) {
+            distributed_plan_costs(&plan, costs);
+            for (int32_t r = 0; r < num_ranks; r++) {
+                SAFE_PRINTF(256, "Rank %d: cost %lld\n", r, (long long)costs[r]);
+            }
+            free(costs);
+        }
+        bool written = Write_Distributed_Plan(plan_path, &plan);
+        if (written) {
+            SAFE_PRINTF(1024, "Planned %d tiles of %d pixels for %d ranks in %s\n", plan.num_tiles, plan.tile_size,
+                        num_ranks, plan_path);
+        } else {
+            SAFE_PRINTF(1024, "Cannot write the plan %s\n", plan_path);
+        }
+        free_distributed_plan(&plan);
+        if (!written) return EXIT_FAILURE;
+    }
+
+    if (!work_stage && !gather_stage) return EXIT_SUCCESS;
+    if (!Read_Distributed_Plan(plan_path, &plan)) {
+        return EXIT_FAILURE;
+    }
+    bool success = true;
+    if (work_stage) {
+        success = Run_Distributed_Match_Rank(parameters, base_landmark_path, child_landmark_path, &plan, rank,
+                                             max_nan_count_base, max_nan_count_child, work_dir);
+        if (!success) {
+            SAFE_PRINTF(256, "Rank %d failed to match its tiles.\n", rank);
+        }
+    }
+    if (success && gather_stage) {
+        char output_path[buf_size];
+        snprintf(output_path, buf_size, "%s_results_%dby%d.lmkr", output_prefix, plan.num_cols, plan.num_rows);
+        SAFE_PRINTF(1024, "Saving results to %s\n", output_path);
+        success = Gather_Distributed_Match(&plan, work_dir, output_path);
+    }
+    free_distributed_plan(&plan);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
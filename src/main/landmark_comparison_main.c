@@ -33,18 +33,26 @@
 #include <stdint.h>                                         // for int32_t
 #include <stdio.h>                                          // for printf, NULL
 #include <stdlib.h>                                         // for free, malloc
+#include <string.h>                                         // for strcmp
 
 #include "landmark_tools/image_io/image_utils.h"             // for load_cha...
+#include "landmark_tools/feature_tracking/band_match.h"     // for MatchLandmarkFilesInBands
 #include "landmark_tools/feature_tracking/feature_match.h"  // for MatchFeat...
+#include "landmark_tools/feature_tracking/match_journal.h"  // for open_match_journal
 #include "landmark_tools/feature_tracking/parameters.h"            // for Parameters, Read...
 #include "landmark_tools/math/homography_util.h"
 #include "landmark_tools/landmark_util/landmark.h"          // for free_lmk
 #include "landmark_tools/landmark_util/estimate_homography.h"
+#include "landmark_tools/landmark_util/lmk_reader.h"       // for Read_LMK_Many
 #include "landmark_tools/utils/parse_args.h"                // for m_getarg
 #include "math/mat3/mat3.h"                                 // for mult331
 #include "landmark_tools/feature_tracking/correlation_results.h"  // for CorrelationResults
+#include "landmark_tools/feature_tracking/results_raster.h"       // for Write_Correlation_Results_Raster
 #include "landmark_tools/utils/write_array.h"
 #include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
 
 /**
  * \brief Display usage information and exit
@@ -64,9 +72,305 @@ void show_usage_and_exit()
     printf("    -c    <parameters_config_filepath> - Configuration file for matching parameters\n");
     printf("    -nan_max_count1     <-1 to ignore, 0 or greater to filter> - Max NaN count for first landmark\n");
     printf("    -nan_max_count2     <-1 to ignore, 0 or greater to filter> - Max NaN count for second landmark\n");
+    printf("  Optional arguments:\n");
+    printf("    -band_rows <rows> - Compare in bands of this many rows, reading only the rows each band needs\n");
+    printf("    -prev_o  <output_prefix> - Output prefix of a previous comparison to update where the landmarks changed\n");
+    printf("    -prev_l1 <lmk_filepath> - Previous version of the first landmark, compared with -l1 to find the changes\n");
+    printf("    -prev_l2 <lmk_filepath> - Previous version of the second landmark, compared with -l2 to find the changes\n");
+    printf("    -sparse  <csv_filepath> - Write the matched features to this file instead of the dense maps\n");
+    printf("    -format  <RAW or RASTER> - Write the maps as four raw files (default), or as the bands of one tiled and\n");
+    printf("             compressed <output_prefix>_results_<cols>by<rows>.lmkr raster\n");
+    printf("    -checkpoint <journal_filepath> - Journal of the matched blocks. A comparison stopped before the end\n");
+    printf("             resumes from the blocks in the journal when it is run again with the same arguments\n");
+    printf("    -checkpoint_seconds <seconds> - Interval between flushes of the journal to disk (default %g)\n",
+           MATCH_JOURNAL_FLUSH_SECONDS);
+    printf("    -estimate_memory <0 or 1> - If 1, print the estimated memory of the comparison and exit, with failure\n");
+    printf("             if it does not fit in -memory_budget_mb. Without -band_rows, a comparison over the budget is\n");
+    printf("             made in bands that fit\n");
     exit(EXIT_FAILURE);
 }
 
+/**
+ * \brief Filename of the raster holding all the maps of a comparison
+ */
+static void results_raster_filename(char *buf, size_t buf_size, const char *prefix, int32_t num_cols,
+                                    int32_t num_rows)
+{
+    snprintf(buf, buf_size, "%s_results_%dby%d.lmkr", prefix, num_cols, num_rows);
+}
+
+/**
+ * \brief Compare two landmark files in bands of rows, writing the output maps as the bands complete
+ *
+ * \return EXIT_SUCCESS on success, EXIT_FAILURE on error
+ */
+static int32_t compare_in_bands(const Parameters *parameters, const char *base_landmark_path,
+                                const char *child_landmark_path, const char *output_prefix, int32_t band_rows,
+                                int32_t max_nan_count_base, int32_t max_nan_count_child, bool raster)
+{
+    LMK child_header = {0};
+    if (!Read_LMK_Header(child_landmark_path, &child_header)) {
+        return EXIT_FAILURE;
+    }
+    
+    if (raster) {
+        size_t buf_size = 256;
+        char buf[buf_size];
+        results_raster_filename(buf, buf_size, output_prefix, child_header.num_cols, child_header.num_rows);
+        Results_Raster_Writer *writer = Open_Results_Raster_Writer(buf, child_header.num_cols, child_header.num_rows,
+                                                                   RESULTS_RASTER_NUM_CORRELATION_BANDS,
+                                                                   correlation_results_band_names,
+                                                                   LMK_DEFAULT_TILE_SIZE, LMK_COMPRESSION_DEFLATE);
+        SAFE_PRINTF(256, "Saving results to %s\n", buf);
+        bool success = writer != NULL &&
+                       MatchLandmarkFilesInBands_raster(*parameters, base_landmark_path, child_landmark_path,
+                                                        band_rows, max_nan_count_base, max_nan_count_child, writer);
+        success = Close_Results_Raster_Writer(writer) && success;
+        if (!success) {
+            printf("Failed to match features.\n");
+        }
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    const char *map_names[BAND_MATCH_NUM_OUTPUTS] = {"delta_x", "delta_y", "delta_z", "corr"};
+    FILE *outputs[BAND_MATCH_NUM_OUTPUTS] = {NULL};
+    size_t buf_size = 256;
+    char buf[buf_size];
+    bool success = true;
+    for (int32_t k = 0; k < BAND_MATCH_NUM_OUTPUTS && success; k++) {
+        snprintf(buf, buf_size, "%s_%s_%dby%d.raw", output_prefix, map_names[k],
+                 child_header.num_cols, child_header.num_rows);
+        outputs[k] = fopen(buf, "wb");
+        if (outputs[k] == NULL) {
+            SAFE_PRINTF(512, "Error: Could not open file '%s' for writing\n", buf);
+            success = false;
+        }
+    }
+    
+    SAFE_PRINTF(256, "Saving results to %s\n", output_prefix);
+    success = success && MatchLandmarkFilesInBands(*parameters, base_landmark_path, child_landmark_path, band_rows,
+                                                   max_nan_count_base, max_nan_count_child, outputs);
+    for (int32_t k = 0; k < BAND_MATCH_NUM_OUTPUTS; k++) {
+        if (outputs[k] != NULL && fclose(outputs[k]) != 0) success = false;
+    }
+    if (!success) {
+        printf("Failed to match features.\n");
+    }
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * \brief Estimate the memory of a comparison, and choose bands that fit in the budget if it does not
+ *
+ * \param[in] band_rows rows per band given on the command line, 0 to load the whole landmarks
+ * \param[in] print if true, print the estimate
+ * \param[in] can_band if true, a comparison of the whole landmarks over the budget is moved to bands
+ * \return rows per band to compare with, 0 for the whole landmarks, or -1 if it does not fit in the budget
+ */
+static int32_t fit_memory_budget(const Parameters *parameters, const char *base_landmark_path,
+                                 const char *child_landmark_path, int32_t band_rows, int32_t max_nan_count_base,
+                                 int32_t max_nan_count_child, bool print, bool can_band)
+{
+    LMK child_header = {0}, base_header = {0};
+    if (!Read_LMK_Header(child_landmark_path, &child_header) || !Read_LMK_Header(base_landmark_path, &base_header)) {
+        return -1;
+    }
+    size_t bytes = (band_rows > 0)
+        ? MatchLandmarkFilesInBands_memory(parameters, &base_header, &child_header, band_rows, max_nan_count_base,
+                                           max_nan_count_child)
+        : MatchFeaturesWithLocalDistortion_memory(parameters, &base_header, &child_header, max_nan_count_base,
+                                                  max_nan_count_child);
+    if (print) {
+        return mem_stats_print_estimate("landmark_comparison", bytes) ? band_rows : -1;
+    }
+    if (mem_stats_fits(bytes)) {
+        return band_rows;
+    }
+    
+    size_t budget = mem_stats_budget();
+    int32_t fitting_rows = (band_rows == 0 && can_band)
+        ? MatchLandmarkFilesInBands_rows_within(parameters, &base_header, &child_header, max_nan_count_base,
+                                                max_nan_count_child, budget)
+        : 0;
+    if (fitting_rows == 0) {
+        SAFE_PRINTF(512, "The comparison needs about %zu MB, over the memory budget of %zu MB\n", bytes >> 20,
+                    budget >> 20);
+        return -1;
+    }
+    SAFE_PRINTF(512, "The comparison needs about %zu MB, over the memory budget of %zu MB. Comparing in bands of "
+                "%d rows\n", bytes >> 20, budget >> 20, fitting_rows);
+    return fitting_rows;
+}
+
+/**
+ * \brief Changed pixels between a landmark and its previous version
+ *
+ * \return false if the previous version cannot be read or does not have the same size
+ */
+static bool changed_rect_from_file(const char *previous_path, const LMK *current, LandmarkRect *rect)
+{
+    LMK previous = {0};
+    if (!Read_LMK(previous_path, &previous)) {
+        return false;
+    }
+    bool success = landmark_changed_rect(&previous, current, rect);
+    free_lmk(&previous);
+    return success;
+}
+
+/**
+ * \brief Load the output of a previous comparison and match again the regions where the landmarks changed
+ *
+ * \return true on success, false if a file cannot be read or matching fails
+ */
+static bool update_previous_results(const Parameters *parameters, LMK *base_landmark, LMK *child_landmark,
+                                    const char *previous_prefix, const char *previous_base_path,
+                                    const char *previous_child_path, int32_t max_nan_count_base,
+                                    int32_t max_nan_count_child, CorrelationResults *results)
+{
+    const char *map_names[BAND_MATCH_NUM_OUTPUTS] = {"delta_x", "delta_y", "delta_z", "corr"};
+    float *maps[BAND_MATCH_NUM_OUTPUTS] = {results->delta_x, results->delta_y, results->delta_z,
+                                           results->correlation};
+    size_t buf_size = 256;
+    char buf[buf_size];
+    // The previous comparison is read from its raster when it was written as one
+    results_raster_filename(buf, buf_size, previous_prefix, child_landmark->num_cols, child_landmark->num_rows);
+    FILE *raster_fp = fopen(buf, "rb");
+    bool from_raster = raster_fp != NULL;
+    if (raster_fp != NULL) fclose(raster_fp);
+    if (from_raster && !Read_Correlation_Results_Raster(buf, results, child_landmark->num_cols,
+                                                        child_landmark->num_rows)) {
+        return false;
+    }
+    for (int32_t k = 0; k < BAND_MATCH_NUM_OUTPUTS && !from_raster; k++) {
+        snprintf(buf, buf_size, "%s_%s_%dby%d.raw", previous_prefix, map_names[k],
+                 child_landmark->num_cols, child_landmark->num_rows);
+        FILE *fp = fopen(buf, "rb");
+        if (fp == NULL) {
+            SAFE_PRINTF(512, "Error: Could not open file '%s' for reading\n", buf);
+            return false;
+        }
+        size_t count = fread(maps[k], sizeof(float), child_landmark->num_pixels, fp);
+        fclose(fp);
+        if (count != (size_t)child_landmark->num_pixels) {
+            SAFE_PRINTF(512, "Error: '%s' does not hold a %d by %d map\n", buf, child_landmark->num_cols,
+                        child_landmark->num_rows);
+            return false;
+        }
+    }
+    
+    // A landmark without a previous version is unchanged
+    LandmarkRect child_dirty = {0}, base_dirty = {0};
+    if (previous_child_path != NULL && !changed_rect_from_file(previous_child_path, child_landmark, &child_dirty)) {
+        return false;
+    }
+    if (previous_base_path != NULL && !changed_rect_from_file(previous_base_path, base_landmark, &base_dirty)) {
+        return false;
+    }
+    SAFE_PRINTF(256, "Changed pixels: %d x %d of the first landmark, %d x %d of the second\n",
+                child_dirty.width, child_dirty.height, base_dirty.width, base_dirty.height);
+    return RematchLandmarkRegions(*parameters, base_landmark, child_landmark, &child_dirty, 1, &base_dirty, 1,
+                                  max_nan_count_base, max_nan_count_child, results);
+}
+
+/**
+ * \brief Checkpoint journal of -checkpoint, or none
+ */
+typedef struct {
+    const char *path;            // journal file, or NULL
+    double flush_seconds;        // interval between flushes to disk
+} Checkpoint;
+
+/**
+ * \brief Allocate the grid of a comparison and, with a checkpoint, restore the blocks of its journal
+ *
+ * \return false if memory allocation fails or the journal cannot be opened
+ */
+static bool open_grid(const Parameters *parameters, LMK *base_landmark, LMK *child_landmark,
+                      int32_t max_nan_count_base, int32_t max_nan_count_child, const Checkpoint *checkpoint,
+                      MatchGrid *grid, MatchJournal *journal)
+{
+    if (!allocate_match_grid(grid, parameters, child_landmark->num_cols, child_landmark->num_rows)) {
+        return false;
+    }
+    if (checkpoint->path == NULL) {
+        return true;
+    }
+    if (!open_match_journal(journal, checkpoint->path, parameters, base_landmark, child_landmark, max_nan_count_base,
+                            max_nan_count_child, grid, checkpoint->flush_seconds)) {
+        free_match_grid(grid);
+        return false;
+    }
+    grid->journal = journal;
+    return true;
+}
+
+/**
+ * \brief Close the journal of `open_grid` and free the grid
+ *
+ * \return false if the journal cannot be written
+ */
+static bool close_grid(MatchGrid *grid)
+{
+    bool success = grid->journal == NULL || close_match_journal(grid->journal);
+    free_match_grid(grid);
+    return success;
+}
+
+/**
+ * \brief Compare two landmarks into the dense maps, resuming from and writing to the journal of a checkpoint
+ *
+ * \return true on success, false if matching fails or the journal cannot be opened
+ */
+static bool compare_checkpointed(const Parameters *parameters, LMK *base_landmark, LMK *child_landmark,
+                                 int32_t max_nan_count_base, int32_t max_nan_count_child,
+                                 const Checkpoint *checkpoint, CorrelationResults *results)
+{
+    MatchGrid grid;
+    MatchJournal journal;
+    if (!open_grid(parameters, base_landmark, child_landmark, max_nan_count_base, max_nan_count_child, checkpoint,
+                   &grid, &journal)) {
+        return false;
+    }
+    bool success = MatchFeaturesWithLocalDistortion_grid(*parameters, base_landmark, child_landmark, results,
+                                                         max_nan_count_base, max_nan_count_child, &grid);
+    return close_grid(&grid) && success;
+}
+
+/**
+ * \brief Compare two landmarks and write the inliers of the local homographies without building the dense maps
+ *
+ * \return true on success, false if matching fails or the file cannot be written
+ */
+static bool compare_sparse(const Parameters *parameters, LMK *base_landmark, LMK *child_landmark,
+                           int32_t max_nan_count_base, int32_t max_nan_count_child, const Checkpoint *checkpoint,
+                           const char *sparse_path)
+{
+    MatchBase base;
+    if (!prepare_match_base(&base, base_landmark, max_nan_count_base)) {
+        return false;
+    }
+    MatchGrid grid;
+    MatchJournal journal;
+    if (!open_grid(parameters, base_landmark, child_landmark, max_nan_count_base, max_nan_count_child, checkpoint,
+                   &grid, &journal)) {
+        free_match_base(&base);
+        return false;
+    }
+    SparseMatches matches;
+    bool success = allocate_sparse_matches(&matches, 1024);
+    success = success && MatchFeaturesWithLocalDistortion_sparse(*parameters, &base, child_landmark, &matches,
+                                                                 max_nan_count_child, &grid);
+    success = close_grid(&grid) && success;
+    free_match_base(&base);
+    if (success) {
+        SAFE_PRINTF(512, "Saving %zu matches to %s\n", matches.count, sparse_path);
+        success = write_sparse_matches(sparse_path, &matches);
+    }
+    destroy_sparse_matches(&matches);
+    return success;
+}
+
 /**
  * \brief Main function for landmark comparison
  * 
@@ -80,6 +384,9 @@ void show_usage_and_exit()
  */
 int32_t main(int32_t argc, char **argv)
 {
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
     // Parse command line arguments
     char *child_landmark_path = NULL;    // Path to first landmark file
     char *base_landmark_path = NULL;     // Path to second landmark file
@@ -87,6 +394,15 @@ int32_t main(int32_t argc, char **argv)
     char *parameters_path = NULL;        // Path to parameters config file
     char *nan_max_count1_str = NULL;     // String value for first landmark's max NaN count
     char *nan_max_count2_str = NULL;     // String value for second landmark's max NaN count
+    char *band_rows_str = NULL;          // String value for the rows per band of the streaming mode
+    char *previous_prefix = NULL;        // Output prefix of the comparison to update
+    char *previous_child_path = NULL;    // Previous version of the child landmark
+    char *previous_base_path = NULL;     // Previous version of the base landmark
+    char *sparse_path = NULL;            // Output file of the matched features
+    char *format_str = NULL;             // Output format of the maps
+    char *estimate_memory_str = NULL;    // 1 to print the estimated memory and exit
+    char *checkpoint_path = NULL;        // Journal of the matched blocks
+    char *checkpoint_seconds_str = NULL; // Interval between flushes of the journal
     
     argc--;
     argv++;
@@ -101,7 +417,16 @@ int32_t main(int32_t argc, char **argv)
             (m_getarg(argv, "-o", &output_prefix, CFO_STRING) != 1) &&
             (m_getarg(argv, "-c", &parameters_path, CFO_STRING) != 1) &&
             (m_getarg(argv, "-nan_max_count1", &nan_max_count1_str, CFO_STRING) != 1) &&
-            (m_getarg(argv, "-nan_max_count2", &nan_max_count2_str, CFO_STRING) != 1))
+            (m_getarg(argv, "-nan_max_count2", &nan_max_count2_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-band_rows", &band_rows_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-prev_o", &previous_prefix, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-prev_l1", &previous_child_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-prev_l2", &previous_base_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-sparse", &sparse_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-format", &format_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-checkpoint", &checkpoint_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-checkpoint_seconds", &checkpoint_seconds_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-estimate_memory", &estimate_memory_str, CFO_STRING) != 1))
             show_usage_and_exit();
         
         argc -= 2;
@@ -122,17 +447,6 @@ int32_t main(int32_t argc, char **argv)
     }
     print_parameters(parameters);
     
-    // Load landmarks
-    LMK child_landmark = {0};
-    LMK base_landmark = {0};
-    int success = Read_LMK(child_landmark_path, &child_landmark);
-    success &= Read_LMK(base_landmark_path, &base_landmark);
-    if (!success) {
-        free_lmk(&child_landmark);
-        free_lmk(&base_landmark);
-        return EXIT_FAILURE;
-    }
-
     // Parse NaN count parameters
     int32_t max_nan_count_child = -1; // Default: do not check for NaN in child landmark
     int32_t max_nan_count_base = 0;   // Default: do not allow any NaN in base landmark
@@ -143,22 +457,90 @@ int32_t main(int32_t argc, char **argv)
         max_nan_count_base = atoi(nan_max_count2_str);
     }
     
+    bool raster = false;
+    if (format_str != NULL) {
+        if (strcmp(format_str, "RASTER") == 0) {
+            raster = true;
+        } else if (strcmp(format_str, "RAW") != 0) {
+            SAFE_PRINTF(256, "Unknown output format %s\n", format_str);
+            show_usage_and_exit();
+        }
+    }
+    
+    Checkpoint checkpoint = {checkpoint_path, MATCH_JOURNAL_FLUSH_SECONDS};
+    if (checkpoint_seconds_str != NULL) {
+        checkpoint.flush_seconds = atof(checkpoint_seconds_str);
+    }
+    if (checkpoint_path != NULL && (previous_prefix != NULL || band_rows_str != NULL)) {
+        printf("-checkpoint cannot be used with -prev_o or -band_rows\n");
+        show_usage_and_exit();
+    }
+    
+    // Check the estimated memory against the budget before reading the landmarks
+    int32_t band_rows = band_rows_str != NULL ? atoi(band_rows_str) : 0;
+    bool estimate_memory = estimate_memory_str != NULL && atoi(estimate_memory_str) != 0;
+    if (estimate_memory || mem_stats_budget() > 0) {
+        band_rows = fit_memory_budget(&parameters, base_landmark_path, child_landmark_path, band_rows,
+                                      max_nan_count_base, max_nan_count_child, estimate_memory,
+                                      previous_prefix == NULL && sparse_path == NULL && checkpoint_path == NULL);
+        if (estimate_memory || band_rows < 0) {
+            return band_rows >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    
+    // Stream the comparison band by band, without loading the landmarks
+    if (band_rows_str != NULL || band_rows > 0) {
+        return compare_in_bands(&parameters, base_landmark_path, child_landmark_path, output_prefix,
+                                band_rows, max_nan_count_base, max_nan_count_child, raster);
+    }
+    
+    // Load landmarks
+    LMK landmarks[2] = {0};
+    const char *landmark_paths[2] = {child_landmark_path, base_landmark_path};
+    if (!Read_LMK_Many(landmark_paths, 2, landmarks, 0)) {
+        return EXIT_FAILURE;
+    }
+    LMK child_landmark = landmarks[0];
+    LMK base_landmark = landmarks[1];
+    int success = true;
+
 #ifdef DEBUG
     write_channel_separated_image("basemap.png", base_landmark.srm, base_landmark.num_cols, base_landmark.num_rows, 1);
     write_channel_separated_image("childmap.png", child_landmark.srm, child_landmark.num_cols, child_landmark.num_rows, 1);
 #endif
 
+    // Keep only the matched features, the dense maps can be built from them later
+    if (sparse_path != NULL) {
+        success = compare_sparse(&parameters, &base_landmark, &child_landmark, max_nan_count_base,
+                                 max_nan_count_child, &checkpoint, sparse_path);
+        if (!success) {
+            printf("Failed to match features. Exiting without output.\n");
+        }
+        free_lmk(&child_landmark);
+        free_lmk(&base_landmark);
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     // Perform feature matching
     CorrelationResults results;
     allocate_correlation_results(&results, child_landmark.num_pixels);
-    success &= MatchFeaturesWithLocalDistortion(
-        parameters,
-        &base_landmark,
-        &child_landmark,
-        &results,
-        max_nan_count_base,
-        max_nan_count_child
-    );
+    if (previous_prefix != NULL) {
+        success &= update_previous_results(&parameters, &base_landmark, &child_landmark, previous_prefix,
+                                           previous_base_path, previous_child_path, max_nan_count_base,
+                                           max_nan_count_child, &results);
+    } else if (checkpoint_path != NULL) {
+        success &= compare_checkpointed(&parameters, &base_landmark, &child_landmark, max_nan_count_base,
+                                        max_nan_count_child, &checkpoint, &results);
+    } else {
+        success &= MatchFeaturesWithLocalDistortion(
+            parameters,
+            &base_landmark,
+            &child_landmark,
+            &results,
+            max_nan_count_base,
+            max_nan_count_child
+        );
+    }
     
     if (!success) {
         printf("Failed to match features. Exiting without output.\n");
@@ -174,6 +556,16 @@ int32_t main(int32_t argc, char **argv)
     size_t buf_size = 256;
     char buf[buf_size];
     
+    if (raster) {
+        results_raster_filename(buf, buf_size, output_prefix, child_landmark.num_cols, child_landmark.num_rows);
+        success = Write_Correlation_Results_Raster(buf, &results, child_landmark.num_cols, child_landmark.num_rows,
+                                                   LMK_DEFAULT_TILE_SIZE, LMK_COMPRESSION_DEFLATE);
+        free_lmk(&child_landmark);
+        free_lmk(&base_landmark);
+        destroy_correlation_results(&results);
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    
     // Save delta x map
     snprintf(buf, buf_size, "%s_delta_x_%dby%d.raw", output_prefix, child_landmark.num_cols, child_landmark.num_rows);
     if (write_data_to_file(buf, results.delta_x, sizeof(float), child_landmark.num_pixels) != 0) {
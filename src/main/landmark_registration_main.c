@@ -22,6 +22,7 @@
 /*------------------------ Includes -------------------------*/
 /*-----------------------------------------------------------*/
 #include <math.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>                  // for fprintf, printf, fclose, fopen
 #include <stdlib.h>                 // for malloc, exit, free
@@ -42,6 +43,11 @@
 #include "math/mat3/mat3.h"                   // for mult331, mult333, sub3, zero3, copy3
 #include "landmark_tools/landmark_registration/landmark_registration.h"
 #include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
+
+#define CHILD_LIST_LINE_SIZE 1024
 
 void show_usage_and_exit()
 {
@@ -52,14 +58,106 @@ void show_usage_and_exit()
     printf("    -base   <filename> - base landmark\n");
     printf("    -child   <filename> - child landmark\n");
     printf("    -parameters   <filename> - parameter file\n");
+    printf("  Optional arguments:\n");
+    printf("    -time_budget   <seconds> - stop matching features after this time and register with the matches so far\n");
+    printf("    -levels   <n> - register coarse-to-fine on n pyramid levels, each halving the resolution\n");
+    printf("    -refine_search   <pixels> - search window of the finer pyramid levels\n");
+    printf("    -child_list   <filename> - text file with one child landmark per line, registered instead of -child\n");
+    printf("    -threads   <n> - child landmarks of -child_list registered at the same time, 0 for one per processor\n");
     exit(EXIT_FAILURE);
 }
 
+/**
+ \brief Read the child landmark filenames of a list, one per line. Empty lines and lines starting with # are skipped.
+ \return number of filenames or -1 on error
+*/
+static int32_t read_child_list(const char *list_path, char ***filenames)
+{
+    FILE *fp = fopen(list_path, "r");
+    if (fp == NULL) {
+        SAFE_PRINTF(512, "Cannot open %s\n", list_path);
+        return -1;
+    }
+    
+    int32_t capacity = 64;
+    int32_t count = 0;
+    char **list = (char **)malloc(capacity * sizeof(char *));
+    char line[CHILD_LIST_LINE_SIZE];
+    bool success = list != NULL;
+    while (success && fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        if (count == capacity) {
+            capacity *= 2;
+            char **grown = (char **)realloc(list, capacity * sizeof(char *));
+            if (grown == NULL) {
+                success = false;
+                break;
+            }
+            list = grown;
+        }
+        list[count] = (char *)malloc(strlen(line) + 1);
+        if (list[count] == NULL) {
+            success = false;
+            break;
+        }
+        strcpy(list[count], line);
+        count++;
+    }
+    fclose(fp);
+    
+    if (!success) {
+        printf("read_child_list() ==>> malloc() failed\n");
+        for (int32_t i = 0; i < count; i++) free(list[i]);
+        free(list);
+        return -1;
+    }
+    *filenames = list;
+    return count;
+}
+
+/**
+ \brief Register every child landmark of a list against one base landmark, loaded once
+*/
+static int32_t register_child_list(Parameters parameters, const char *baselmkfile, const char *list_path,
+                                   int32_t num_levels, int32_t refine_search_window_size, int32_t num_threads)
+{
+    char **filenames = NULL;
+    int32_t num_children = read_child_list(list_path, &filenames);
+    if (num_children < 0) return EXIT_FAILURE;
+    
+    int32_t num_registered = 0;
+    RegistrationBase base;
+    int32_t *registered = (int32_t *)calloc(num_children > 0 ? num_children : 1, sizeof(int32_t));
+    if (registered != NULL && prepare_registration_base(&base, baselmkfile, num_levels)) {
+        num_registered = RegisterLandmarks_batch(parameters, &base, (const char **)filenames, num_children,
+                                                 num_levels, refine_search_window_size, num_threads, registered);
+        for (int32_t i = 0; i < num_children; i++) {
+            if (!registered[i]) SAFE_PRINTF(1024, "Failed to register %s\n", filenames[i]);
+        }
+        free_registration_base(&base);
+    }
+    SAFE_PRINTF(256, "%d of %d child landmarks registered\n", num_registered, num_children);
+    
+    free(registered);
+    for (int32_t i = 0; i < num_children; i++) free(filenames[i]);
+    free(filenames);
+    return num_registered == num_children ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int32_t main(int32_t argc, char **argv)
 {
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
     char *baselmkfile = NULL;
     char *childlmkfile  = NULL;
     char *parametersfile = NULL;
+    double time_budget_seconds = 0;
+    int32_t num_levels = 0;
+    int32_t refine_search_window_size = 0;
+    char *child_list_file = NULL;
+    int32_t num_threads = 0;
     
     argc--;
     argv++;
@@ -71,7 +169,12 @@ int32_t main(int32_t argc, char **argv)
         if (argc==1) show_usage_and_exit();
         if((m_getarg(argv, "-base",   &baselmkfile, CFO_STRING)!=1) &&
            (m_getarg(argv, "-child",   &childlmkfile,  CFO_STRING)!=1) &&
-           (m_getarg(argv, "-parameters",   &parametersfile,  CFO_STRING)!=1))
+           (m_getarg(argv, "-parameters",   &parametersfile,  CFO_STRING)!=1) &&
+           (m_getarg(argv, "-time_budget",   &time_budget_seconds,  CFO_DOUBLE)!=1) &&
+           (m_getarg(argv, "-levels",   &num_levels,  CFO_INT)!=1) &&
+           (m_getarg(argv, "-refine_search",   &refine_search_window_size,  CFO_INT)!=1) &&
+           (m_getarg(argv, "-child_list",   &child_list_file,  CFO_STRING)!=1) &&
+           (m_getarg(argv, "-threads",   &num_threads,  CFO_INT)!=1))
             if(argc == 2) break;
         argc-=2;
         argv+=2;
@@ -90,7 +193,24 @@ int32_t main(int32_t argc, char **argv)
     }
     print_parameters(parameters);
     
-    if(RegisterLandmarks(parameters, baselmkfile, childlmkfile)){
+    if(child_list_file != NULL){
+        return register_child_list(parameters, baselmkfile, child_list_file, num_levels,
+                                   refine_search_window_size, num_threads);
+    }
+    
+    TimeBudget budget;
+    time_budget_init(&budget, time_budget_seconds);
+    BudgetStatus status;
+    const TimeBudget *matching_budget = time_budget_seconds > 0 ? &budget : NULL;
+    int32_t registered = 0;
+    if(num_levels > 0){
+        registered = RegisterLandmarks_multires(parameters, baselmkfile, childlmkfile, num_levels,
+                                                refine_search_window_size, matching_budget, &status);
+    }else{
+        registered = RegisterLandmarks_budget(parameters, baselmkfile, childlmkfile, matching_budget, &status);
+    }
+    if(registered){
+        if(status != BUDGET_COMPLETE) printf("Time budget ended, registered with the features matched in time\n");
         return EXIT_SUCCESS;
     }else{
         return EXIT_FAILURE;
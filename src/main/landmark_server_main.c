@@ -0,0 +1,683 @@
+/**
+ * \file landmark_server_main.c
+ * \brief Serve landmark comparisons and registrations against base landmarks kept in memory
+ *
+ * The server reads the matching parameters once, loads a set of base landmarks with their comparison and
+ * registration state, and answers requests on a TCP socket until it is shut down. A request is one line of words
+ * separated by spaces, and each request gets one response line starting with `OK` or `ERROR`:
+ * - `LOAD <name> <lmk_filepath>` - load a base landmark and build its comparison state
+ * - `UNLOAD <name>` - release a base landmark once the requests using it end
+ * - `LIST` - names of the loaded base landmarks
+ * - `COMPARE <name> <lmk_filepath> <output_prefix> [RAW|RASTER]` - compare a landmark to a base, with the output
+ *   files of landmark_comparison
+ * - `REGISTER <name> <lmk_filepath>` - register a landmark to a base, writing <lmk_filepath>_registered.lmk
+ * - `QUIT` - close the connection
+ * - `SHUTDOWN` - stop accepting connections, wait for the running requests and exit
+ *
+ * Each connection is served by its own thread. Registrations share a base at the same time. Comparisons against one
+ * base run one after another, each on all matching threads, and comparisons against different bases run at the same
+ * time. The registration state of a base is built by its first registration.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*-----------------------------------------------------------*/
+/*------------------------ Includes -------------------------*/
+/*-----------------------------------------------------------*/
+#include <arpa/inet.h>                                      // for inet_pton, htons
+#include <errno.h>                                          // for errno, EINTR
+#include <netinet/in.h>                                     // for sockaddr_in
+#include <pthread.h>                                        // for pthread_create, pthread_mutex_t
+#include <signal.h>                                         // for signal, SIGPIPE
+#include <stdarg.h>                                         // for va_list
+#include <stdbool.h>                                        // for false, bool
+#include <stdint.h>                                         // for int32_t
+#include <stdio.h>                                          // for printf, NULL
+#include <stdlib.h>                                         // for free, malloc
+#include <string.h>                                         // for strcmp, strcspn
+#include <sys/socket.h>                                     // for socket, accept
+#include <unistd.h>                                         // for close, write
+
+#include "landmark_tools/feature_tracking/feature_match.h"  // for MatchBase
+#include "landmark_tools/feature_tracking/parameters.h"     // for Parameters, Read...
+#include "landmark_tools/feature_tracking/correlation_results.h"  // for CorrelationResults
+#include "landmark_tools/feature_tracking/results_raster.h"       // for Write_Correlation_Results_Raster
+#include "landmark_tools/landmark_registration/landmark_registration.h"  // for RegistrationBase
+#include "landmark_tools/landmark_util/landmark.h"          // for free_lmk
+#include "landmark_tools/utils/parse_args.h"                // for m_getarg
+#include "landmark_tools/utils/time_budget.h"               // for TimeBudget
+#include "landmark_tools/utils/write_array.h"
+#include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
+
+#define SERVER_MAX_BASES 64                 //!< Base landmarks loaded at the same time
+#define SERVER_NAME_SIZE 64                 //!< Longest base name, with the terminating NUL
+#define SERVER_LINE_SIZE (4 * LMK_FILENAME_SIZE)  //!< Longest request or response line
+#define SERVER_DEFAULT_PORT 7070
+
+/**
+ * \brief Display usage information and exit
+ */
+void show_usage_and_exit()
+{
+    printf("Serve landmark comparisons and registrations against base landmarks kept in memory\n");
+    printf("Usage for landmark_server:\n");
+    printf("------------------\n");
+    printf("  Optional arguments:\n");
+    printf("    -port  <port> - TCP port to listen on (default %d)\n", SERVER_DEFAULT_PORT);
+    printf("    -host  <ipv4 address> - Address to listen on (default 127.0.0.1)\n");
+    printf("    -bases <filename> - text file with one base landmark per line: <name> <lmk_filepath>\n");
+    printf("    -c     <parameters_config_filepath> - Configuration file for matching parameters\n");
+    printf("    -nan_max_count1     <-1 to ignore, 0 or greater to filter> - Max NaN count for compared landmarks\n");
+    printf("    -nan_max_count2     <-1 to ignore, 0 or greater to filter> - Max NaN count for base landmarks\n");
+    printf("    -levels   <n> - register coarse-to-fine on n pyramid levels, each halving the resolution\n");
+    printf("    -refine_search   <pixels> - search window of the finer pyramid levels\n");
+    printf("    -time_budget   <seconds> - stop matching the features of a registration after this time\n");
+    printf("  Requests, one per line:\n");
+    printf("    LOAD <name> <lmk_filepath>\n");
+    printf("    UNLOAD <name>\n");
+    printf("    LIST\n");
+    printf("    COMPARE <name> <lmk_filepath> <output_prefix> [RAW|RASTER]\n");
+    printf("    REGISTER <name> <lmk_filepath>\n");
+    printf("    QUIT\n");
+    printf("    SHUTDOWN\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * \brief Base landmark kept in memory with the state its requests share
+ */
+typedef struct {
+    char name[SERVER_NAME_SIZE];
+    char path[LMK_FILENAME_SIZE];
+    LMK landmark;                           //!< Base landmark of the comparisons
+    MatchBase match;                        //!< Comparison state, used by one comparison at a time
+    pthread_mutex_t lock;                   //!< Held by comparisons and while `registration` is built
+    bool have_registration;                 //!< True once `registration` was built
+    RegistrationBase registration;          //!< Registration state, shared by any number of registrations
+    int32_t users;                          //!< Requests using the base, guarded by the server lock
+} ResidentBase;
+
+/**
+ * \brief State shared by the connection threads
+ */
+typedef struct {
+    Parameters parameters;
+    int32_t max_nan_count_child;
+    int32_t max_nan_count_base;
+    int32_t num_levels;
+    int32_t refine_search_window_size;
+    double time_budget_seconds;
+    int listen_fd;
+    pthread_mutex_t lock;                   //!< Guards the fields below
+    pthread_cond_t idle;                    //!< Signaled when `busy` drops to 0
+    ResidentBase *bases[SERVER_MAX_BASES];  //!< Loaded bases, NULL for free slots
+    int32_t busy;                           //!< Requests running
+    bool stopping;                          //!< Set by SHUTDOWN
+} Server;
+
+/**
+ * \brief Connection served by a thread
+ */
+typedef struct {
+    Server *server;
+    int fd;
+} Connection;
+
+/**
+ * \brief Free a base landmark and its state
+ */
+static void free_resident_base(ResidentBase *base)
+{
+    if (base->have_registration) free_registration_base(&base->registration);
+    free_match_base(&base->match);
+    free_lmk(&base->landmark);
+    pthread_mutex_destroy(&base->lock);
+    free(base);
+}
+
+/**
+ * \brief Read a base landmark and build its comparison state
+ *
+ * \return base or NULL if the file cannot be read or memory allocation fails
+ */
+static ResidentBase *load_resident_base(const char *name, const char *path, int32_t max_nan_count_base)
+{
+    ResidentBase *base = (ResidentBase *)calloc(1, sizeof(ResidentBase));
+    if (base == NULL) {
+        printf("load_resident_base() ==>> malloc() failed\n");
+        return NULL;
+    }
+    snprintf(base->name, sizeof(base->name), "%s", name);
+    snprintf(base->path, sizeof(base->path), "%s", path);
+    if (!Read_LMK(path, &base->landmark)) {
+        free(base);
+        return NULL;
+    }
+    if (!prepare_match_base(&base->match, &base->landmark, max_nan_count_base)) {
+        free_lmk(&base->landmark);
+        free(base);
+        return NULL;
+    }
+    pthread_mutex_init(&base->lock, NULL);
+    return base;
+}
+
+/**
+ * \brief Find a loaded base by name. Call with the server lock held
+ */
+static ResidentBase *find_base_locked(Server *server, const char *name, int32_t *slot)
+{
+    for (int32_t i = 0; i < SERVER_MAX_BASES; i++) {
+        if (server->bases[i] != NULL && strcmp(server->bases[i]->name, name) == 0) {
+            if (slot != NULL) *slot = i;
+            return server->bases[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Take a reference to a loaded base
+ *
+ * \return base or NULL if no base has this name
+ */
+static ResidentBase *acquire_base(Server *server, const char *name)
+{
+    pthread_mutex_lock(&server->lock);
+    ResidentBase *base = find_base_locked(server, name, NULL);
+    if (base != NULL) base->users++;
+    pthread_mutex_unlock(&server->lock);
+    return base;
+}
+
+/**
+ * \brief Drop a reference to a base, freeing it if it was unloaded and this was the last request using it
+ */
+static void release_base(Server *server, ResidentBase *base)
+{
+    pthread_mutex_lock(&server->lock);
+    base->users--;
+    bool unloaded = true;
+    for (int32_t i = 0; i < SERVER_MAX_BASES; i++) {
+        if (server->bases[i] == base) unloaded = false;
+    }
+    bool free_now = unloaded && base->users == 0;
+    pthread_mutex_unlock(&server->lock);
+    if (free_now) free_resident_base(base);
+}
+
+/**
+ * \brief Add a base to the server
+ *
+ * \return NULL on success or the reason it failed
+ */
+static const char *add_base(Server *server, const char *name, const char *path)
+{
+    if (strlen(name) >= SERVER_NAME_SIZE) return "base name too long";
+    pthread_mutex_lock(&server->lock);
+    bool exists = find_base_locked(server, name, NULL) != NULL;
+    pthread_mutex_unlock(&server->lock);
+    if (exists) return "a base with this name is loaded";
+
+    SAFE_PRINTF(1024, "Loading base %s from %s\n", name, path);
+    ResidentBase *base = load_resident_base(name, path, server->max_nan_count_base);
+    if (base == NULL) return "cannot load base landmark";
+
+    // Another connection may have loaded the same name while the file was read
+    const char *error = NULL;
+    pthread_mutex_lock(&server->lock);
+    int32_t free_slot = -1;
+    for (int32_t i = SERVER_MAX_BASES - 1; i >= 0; i--) {
+        if (server->bases[i] == NULL) free_slot = i;
+    }
+    if (find_base_locked(server, name, NULL) != NULL) {
+        error = "a base with this name is loaded";
+    } else if (free_slot < 0) {
+        error = "too many bases loaded";
+    } else {
+        server->bases[free_slot] = base;
+    }
+    pthread_mutex_unlock(&server->lock);
+    if (error != NULL) free_resident_base(base);
+    return error;
+}
+
+/**
+ * \brief Load the bases of a list, one <name> <lmk_filepath> per line. Empty lines and lines starting with # are
+ * skipped.
+ *
+ * \return false if the list cannot be read or a base cannot be loaded
+ */
+static bool load_base_list(Server *server, const char *list_path)
+{
+    FILE *fp = fopen(list_path, "r");
+    if (fp == NULL) {
+        SAFE_PRINTF(512, "Cannot open %s\n", list_path);
+        return false;
+    }
+    char line[SERVER_LINE_SIZE];
+    char format[32];
+    snprintf(format, sizeof(format), "%%%ds %%%ds", SERVER_NAME_SIZE - 1, LMK_FILENAME_SIZE - 1);
+    bool success = true;
+    while (success && fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char name[SERVER_NAME_SIZE];
+        char path[LMK_FILENAME_SIZE];
+        if (sscanf(line, format, name, path) != 2) {
+            SAFE_PRINTF(512, "load_base_list() ==>> expected <name> <lmk_filepath> in line '%s'\n", line);
+            success = false;
+            break;
+        }
+        const char *error = add_base(server, name, path);
+        if (error != NULL) {
+            SAFE_PRINTF(1024, "Cannot load base %s: %s\n", name, error);
+            success = false;
+        }
+    }
+    fclose(fp);
+    return success;
+}
+
+/**
+ * \brief Write one response line to a connection
+ *
+ * \return false if the connection is closed
+ */
+static bool respond(int fd, const char *format, ...)
+{
+    char line[SERVER_LINE_SIZE];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    if (n < 0) return false;
+    if ((size_t)n > sizeof(line) - 2) n = (int)sizeof(line) - 2;
+    line[n++] = '\n';
+
+    int32_t sent = 0;
+    while (sent < n) {
+        ssize_t count = write(fd, line + sent, n - sent);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        sent += (int32_t)count;
+    }
+    return true;
+}
+
+/**
+ * \brief Compare a landmark to a base and save the maps with the naming of landmark_comparison
+ *
+ * \return NULL on success or the reason it failed
+ */
+static const char *compare_to_base(Server *server, ResidentBase *base, const char *child_path,
+                                   const char *output_prefix, bool raster, LMK *child_landmark)
+{
+    if (!Read_LMK(child_path, child_landmark)) return "cannot load landmark";
+
+    CorrelationResults results;
+    if (!allocate_correlation_results(&results, child_landmark->num_pixels)) {
+        return "memory allocation failed";
+    }
+    MatchGrid grid;
+    if (!allocate_match_grid(&grid, &server->parameters, child_landmark->num_cols, child_landmark->num_rows)) {
+        destroy_correlation_results(&results);
+        return "memory allocation failed";
+    }
+    // The comparison state of the base holds the device copy and is used by one comparison at a time
+    pthread_mutex_lock(&base->lock);
+    bool success = MatchFeaturesWithLocalDistortion_base(server->parameters, &base->match, child_landmark, &results,
+                                                         server->max_nan_count_child, &grid);
+    pthread_mutex_unlock(&base->lock);
+    free_match_grid(&grid);
+    if (!success) {
+        destroy_correlation_results(&results);
+        return "matching failed";
+    }
+
+    size_t buf_size = 256;
+    char buf[buf_size];
+    if (raster) {
+        snprintf(buf, buf_size, "%s_results_%dby%d.lmkr", output_prefix, child_landmark->num_cols,
+                 child_landmark->num_rows);
+        success = Write_Correlation_Results_Raster(buf, &results, child_landmark->num_cols, child_landmark->num_rows,
+                                                   LMK_DEFAULT_TILE_SIZE, LMK_COMPRESSION_DEFLATE);
+    } else {
+        const char *map_names[4] = {"delta_x", "delta_y", "delta_z", "corr"};
+        float *maps[4] = {results.delta_x, results.delta_y, results.delta_z, results.correlation};
+        for (int32_t k = 0; k < 4 && success; k++) {
+            snprintf(buf, buf_size, "%s_%s_%dby%d.raw", output_prefix, map_names[k],
+                     child_landmark->num_cols, child_landmark->num_rows);
+            success = write_data_to_file(buf, maps[k], sizeof(float), child_landmark->num_pixels) == 0;
+        }
+    }
+    destroy_correlation_results(&results);
+    return success ? NULL : "cannot write results";
+}
+
+/**
+ * \brief Register a landmark to a base, building the registration state of the base on first use
+ *
+ * \return NULL on success or the reason it failed
+ */
+static const char *register_to_base(Server *server, ResidentBase *base, const char *child_path,
+                                    BudgetStatus *status)
+{
+    pthread_mutex_lock(&base->lock);
+    if (!base->have_registration) {
+        base->have_registration = prepare_registration_base(&base->registration, base->path, server->num_levels);
+    }
+    bool have_registration = base->have_registration;
+    pthread_mutex_unlock(&base->lock);
+    if (!have_registration) return "cannot prepare base landmark for registration";
+
+    TimeBudget budget;
+    time_budget_init(&budget, server->time_budget_seconds);
+    const TimeBudget *matching_budget = server->time_budget_seconds > 0 ? &budget : NULL;
+    int32_t registered = RegisterLandmark_base(server->parameters, &base->registration, child_path,
+                                               server->num_levels, server->refine_search_window_size,
+                                               matching_budget, status);
+    return registered ? NULL : "registration failed";
+}
+
+/**
+ * \brief Run one request line and write its response
+ *
+ * \return false if the connection must be closed
+ */
+static bool handle_request(Server *server, int fd, char *line)
+{
+    char command[16] = "";
+    char arg1[LMK_FILENAME_SIZE] = "";
+    char arg2[LMK_FILENAME_SIZE] = "";
+    char arg3[LMK_FILENAME_SIZE] = "";
+    char arg4[16] = "";
+    char format[64];
+    snprintf(format, sizeof(format), "%%15s %%%ds %%%ds %%%ds %%15s", LMK_FILENAME_SIZE - 1, LMK_FILENAME_SIZE - 1,
+             LMK_FILENAME_SIZE - 1);
+    int32_t num_words = sscanf(line, format, command, arg1, arg2, arg3, arg4);
+    if (num_words <= 0) return respond(fd, "ERROR empty request");
+
+    if (strcmp(command, "QUIT") == 0) {
+        respond(fd, "OK");
+        return false;
+    }
+    if (strcmp(command, "SHUTDOWN") == 0) {
+        pthread_mutex_lock(&server->lock);
+        server->stopping = true;
+        pthread_mutex_unlock(&server->lock);
+        // Wake up accept()
+        shutdown(server->listen_fd, SHUT_RDWR);
+        respond(fd, "OK");
+        return false;
+    }
+    if (strcmp(command, "LIST") == 0) {
+        char names[SERVER_LINE_SIZE] = "";
+        size_t length = 0;
+        int32_t count = 0;
+        pthread_mutex_lock(&server->lock);
+        for (int32_t i = 0; i < SERVER_MAX_BASES; i++) {
+            if (server->bases[i] == NULL) continue;
+            int n = snprintf(names + length, sizeof(names) - length, " %s", server->bases[i]->name);
+            if (n > 0 && length + n < sizeof(names)) length += n;
+            count++;
+        }
+        pthread_mutex_unlock(&server->lock);
+        return respond(fd, "OK %d%s", count, names);
+    }
+    if (strcmp(command, "LOAD") == 0) {
+        if (num_words != 3) return respond(fd, "ERROR usage: LOAD <name> <lmk_filepath>");
+        const char *error = add_base(server, arg1, arg2);
+        return error == NULL ? respond(fd, "OK") : respond(fd, "ERROR %s", error);
+    }
+    if (strcmp(command, "UNLOAD") == 0) {
+        if (num_words != 2) return respond(fd, "ERROR usage: UNLOAD <name>");
+        pthread_mutex_lock(&server->lock);
+        int32_t slot = -1;
+        ResidentBase *base = find_base_locked(server, arg1, &slot);
+        bool free_now = false;
+        if (base != NULL) {
+            server->bases[slot] = NULL;
+            free_now = base->users == 0;
+        }
+        pthread_mutex_unlock(&server->lock);
+        if (base == NULL) return respond(fd, "ERROR no base named %s", arg1);
+        if (free_now) free_resident_base(base);
+        return respond(fd, "OK");
+    }
+    if (strcmp(command, "COMPARE") == 0) {
+        if (num_words < 4 || num_words > 5) {
+            return respond(fd, "ERROR usage: COMPARE <name> <lmk_filepath> <output_prefix> [RAW|RASTER]");
+        }
+        bool raster = num_words == 5 && strcmp(arg4, "RASTER") == 0;
+        if (num_words == 5 && !raster && strcmp(arg4, "RAW") != 0) {
+            return respond(fd, "ERROR unknown output format %s", arg4);
+        }
+        ResidentBase *base = acquire_base(server, arg1);
+        if (base == NULL) return respond(fd, "ERROR no base named %s", arg1);
+        LMK child_landmark = {0};
+        const char *error = compare_to_base(server, base, arg2, arg3, raster, &child_landmark);
+        release_base(server, base);
+        bool connected = error == NULL ? respond(fd, "OK %d %d", child_landmark.num_cols, child_landmark.num_rows)
+                                       : respond(fd, "ERROR %s", error);
+        free_lmk(&child_landmark);
+        return connected;
+    }
+    if (strcmp(command, "REGISTER") == 0) {
+        if (num_words != 3) return respond(fd, "ERROR usage: REGISTER <name> <lmk_filepath>");
+        ResidentBase *base = acquire_base(server, arg1);
+        if (base == NULL) return respond(fd, "ERROR no base named %s", arg1);
+        BudgetStatus status = BUDGET_COMPLETE;
+        const char *error = register_to_base(server, base, arg2, &status);
+        release_base(server, base);
+        if (error != NULL) return respond(fd, "ERROR %s", error);
+        return respond(fd, "OK %s_registered.lmk%s", arg2, status == BUDGET_COMPLETE ? "" : " partial");
+    }
+    return respond(fd, "ERROR unknown request %s", command);
+}
+
+/**
+ * \brief Read and answer the requests of a connection until it is closed
+ */
+static void *connection_thread(void *arg)
+{
+    Connection *connection = (Connection *)arg;
+    Server *server = connection->server;
+    FILE *input = fdopen(connection->fd, "r");
+    char line[SERVER_LINE_SIZE];
+    bool open = input != NULL;
+    while (open && fgets(line, sizeof(line), input) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        pthread_mutex_lock(&server->lock);
+        bool stopping = server->stopping;
+        if (!stopping) server->busy++;
+        pthread_mutex_unlock(&server->lock);
+        if (stopping) {
+            respond(connection->fd, "ERROR server is shutting down");
+            break;
+        }
+
+        open = handle_request(server, connection->fd, line);
+
+        pthread_mutex_lock(&server->lock);
+        server->busy--;
+        if (server->busy == 0) pthread_cond_broadcast(&server->idle);
+        pthread_mutex_unlock(&server->lock);
+    }
+    if (input != NULL) {
+        fclose(input);
+    } else {
+        close(connection->fd);
+    }
+    free(connection);
+    return NULL;
+}
+
+/**
+ * \brief Main function of the landmark server
+ *
+ * \return EXIT_SUCCESS after SHUTDOWN, EXIT_FAILURE if the server cannot start
+ */
+int32_t main(int32_t argc, char **argv)
+{
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
+    int32_t port = SERVER_DEFAULT_PORT;
+    char *host = "127.0.0.1";
+    char *bases_path = NULL;
+    char *parameters_path = NULL;
+    char *nan_max_count1_str = NULL;
+    char *nan_max_count2_str = NULL;
+    int32_t num_levels = 0;
+    int32_t refine_search_window_size = 0;
+    double time_budget_seconds = 0;
+
+    argc--;
+    argv++;
+
+    while (argc > 0) {
+        if (argc == 1) show_usage_and_exit();
+        if ((m_getarg(argv, "-port", &port, CFO_INT) != 1) &&
+            (m_getarg(argv, "-host", &host, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-bases", &bases_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-c", &parameters_path, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-nan_max_count1", &nan_max_count1_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-nan_max_count2", &nan_max_count2_str, CFO_STRING) != 1) &&
+            (m_getarg(argv, "-levels", &num_levels, CFO_INT) != 1) &&
+            (m_getarg(argv, "-refine_search", &refine_search_window_size, CFO_INT) != 1) &&
+            (m_getarg(argv, "-time_budget", &time_budget_seconds, CFO_DOUBLE) != 1))
+            show_usage_and_exit();
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    Server *server = (Server *)calloc(1, sizeof(Server));
+    if (server == NULL) {
+        printf("main() ==>> malloc() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    // Parameters are read once for every request
+    load_default_parameters(&server->parameters);
+    if (parameters_path == NULL) {
+        printf("No parameter file provided. Using defaults.\n");
+    } else if (!read_parameterfile(parameters_path, &server->parameters)) {
+        SAFE_PRINTF(256, "Cannot load %s\n", parameters_path);
+        free(server);
+        return EXIT_FAILURE;
+    }
+    print_parameters(server->parameters);
+
+    server->max_nan_count_child = -1; // Default: do not check for NaN in compared landmarks
+    server->max_nan_count_base = 0;   // Default: do not allow any NaN in base landmarks
+    if (nan_max_count1_str != NULL) {
+        server->max_nan_count_child = atoi(nan_max_count1_str);
+    }
+    if (nan_max_count2_str != NULL) {
+        server->max_nan_count_base = atoi(nan_max_count2_str);
+    }
+    server->num_levels = num_levels;
+    server->refine_search_window_size = refine_search_window_size;
+    server->time_budget_seconds = time_budget_seconds;
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->idle, NULL);
+
+    // Clients closing their connection must not stop the server
+    signal(SIGPIPE, SIG_IGN);
+
+    bool success = bases_path == NULL || load_base_list(server, bases_path);
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)port);
+    if (success && inet_pton(AF_INET, host, &address.sin_addr) != 1) {
+        SAFE_PRINTF(256, "Invalid address %s\n", host);
+        success = false;
+    }
+    server->listen_fd = success ? socket(AF_INET, SOCK_STREAM, 0) : -1;
+    if (success && server->listen_fd < 0) {
+        printf("main() ==>> socket() failed\n");
+        success = false;
+    }
+    if (success) {
+        int reuse = 1;
+        setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+            listen(server->listen_fd, 16) != 0) {
+            SAFE_PRINTF(256, "Cannot listen on %s:%d\n", host, port);
+            success = false;
+        }
+    }
+
+    if (success) {
+        SAFE_PRINTF(256, "Listening on %s:%d\n", host, port);
+        fflush(stdout);
+    }
+    while (success) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        pthread_mutex_lock(&server->lock);
+        bool stopping = server->stopping;
+        pthread_mutex_unlock(&server->lock);
+        if (stopping) {
+            if (fd >= 0) close(fd);
+            break;
+        }
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            printf("main() ==>> accept() failed\n");
+            success = false;
+            break;
+        }
+
+        Connection *connection = (Connection *)malloc(sizeof(Connection));
+        pthread_t thread;
+        if (connection == NULL) {
+            printf("main() ==>> malloc() failed\n");
+            close(fd);
+            continue;
+        }
+        connection->server = server;
+        connection->fd = fd;
+        if (pthread_create(&thread, NULL, connection_thread, connection) != 0) {
+            printf("main() ==>> pthread_create() failed\n");
+            close(fd);
+            free(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    if (server->listen_fd >= 0) close(server->listen_fd);
+
+    // Idle connections are dropped at exit, running requests finish first
+    pthread_mutex_lock(&server->lock);
+    server->stopping = true;
+    while (server->busy > 0) {
+        pthread_cond_wait(&server->idle, &server->lock);
+    }
+    for (int32_t i = 0; i < SERVER_MAX_BASES; i++) {
+        if (server->bases[i] != NULL && server->bases[i]->users == 0) free_resident_base(server->bases[i]);
+        server->bases[i] = NULL;
+    }
+    pthread_mutex_unlock(&server->lock);
+    printf("Server stopped\n");
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,206 @@
+/**
+ * \file lmk_catalog_main.c
+ * \brief Build and query a spatial index over the footprints of many landmark files
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdbool.h>                                        // for bool
+#include <stdint.h>                                         // for int32_t
+#include <stdio.h>                                          // for printf, sscanf
+#include <stdlib.h>                                         // for EXIT_FAILURE
+#include <string.h>                                         // for strcspn
+
+#include "landmark_tools/landmark_util/lmk_catalog.h"       // for LMK_Catalog
+#include "landmark_tools/map_projection/datum_conversion.h" // for strToPlanet
+#include "landmark_tools/utils/parse_args.h"                // for m_getarg
+#include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
+
+#define MAX_QUERY_RESULTS 4096
+
+void show_usage_and_exit()
+{
+    printf("Build or query a spatial index of landmark footprints\n\n");
+    printf("Usage for lmk_catalog:\n");
+    printf("------------------\n");
+    printf("  Build a catalog:\n");
+    printf("    -build   <filename> - output catalog filepath\n");
+    printf("    -list   <filename> - text file with one landmark filepath per line\n");
+    printf("    -margin   <double> - meters to pad footprints above and below the map plane (default 10000)\n");
+    printf("  Query a catalog:\n");
+    printf("    -catalog   <filename> - catalog filepath\n");
+    printf("    -point   <x> <y> <z> - world frame point, such as a ray hit\n");
+    printf("    -radius   <double> - search radius around point in meters (default 0)\n");
+    printf("  OR\n");
+    printf("    -latlon   <lat_min> <lat_max> <lon_min> <lon_max> - latitude/longitude box in degrees\n");
+    printf("    -planet   <Moon|Earth|Mars> - planetary body for latlon query (default Moon)\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ \brief Read the list of landmark filepaths, one per line
+ \return number of filepaths or -1 on error
+*/
+static int32_t read_file_list(const char *list_path, char ***filenames)
+{
+    FILE *fp = fopen(list_path, "r");
+    if(fp == NULL){
+        SAFE_PRINTF(512, "Cannot open %s\n", list_path);
+        return -1;
+    }
+
+    int32_t capacity = 256;
+    int32_t count = 0;
+    char **names = (char **)malloc(capacity*sizeof(char *));
+    char line[LMK_FILENAME_SIZE];
+    while(names != NULL && fgets(line, LMK_FILENAME_SIZE, fp) != NULL){
+        line[strcspn(line, "\r\n")] = '\0';
+        if(line[0] == '\0' || line[0] == '#') continue;
+        if(count == capacity){
+            capacity *= 2;
+            char **grown = (char **)realloc(names, capacity*sizeof(char *));
+            if(grown == NULL) break;
+            names = grown;
+        }
+        names[count] = (char *)malloc(strlen(line) + 1);
+        if(names[count] == NULL) break;
+        strcpy(names[count], line);
+        count++;
+    }
+    fclose(fp);
+
+    if(names == NULL){
+        printf("read_file_list() ==>> malloc() failed\n");
+        return -1;
+    }
+    *filenames = names;
+    return count;
+}
+
+int32_t main (int32_t argc, char **argv)
+{
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
+    char *build_path = NULL;
+    char *list_path = NULL;
+    char *catalog_path = NULL;
+    char *planet_str = NULL;
+    double margin = LMK_CATALOG_DEFAULT_MARGIN;
+    double radius = 0.0;
+    double point[3];
+    double latlon[4];
+    bool has_point = false;
+    bool has_latlon = false;
+
+    argc--;
+    argv++;
+
+    if (argc==0) show_usage_and_exit();
+
+    while (argc > 0) {
+        if (argc == 1) show_usage_and_exit();
+        if ((m_getarg(argv, "-build", &build_path, CFO_STRING) == 1) ||
+            (m_getarg(argv, "-list", &list_path, CFO_STRING) == 1) ||
+            (m_getarg(argv, "-catalog", &catalog_path, CFO_STRING) == 1) ||
+            (m_getarg(argv, "-planet", &planet_str, CFO_STRING) == 1) ||
+            (m_getarg(argv, "-margin", &margin, CFO_DOUBLE) == 1) ||
+            (m_getarg(argv, "-radius", &radius, CFO_DOUBLE) == 1))
+        {
+            argc -= 2;
+            argv += 2;
+        }else if (strcmp(argv[0], "-point") == 0 && argc >= 4){
+            has_point = sscanf(argv[1], "%lf", &point[0]) == 1 &&
+                        sscanf(argv[2], "%lf", &point[1]) == 1 &&
+                        sscanf(argv[3], "%lf", &point[2]) == 1;
+            if(!has_point){
+                printf("Error reading point value.\n");
+                show_usage_and_exit();
+            }
+            argc -= 4;
+            argv += 4;
+        }else if (strcmp(argv[0], "-latlon") == 0 && argc >= 5){
+            has_latlon = true;
+            for(int32_t k = 0; k < 4; k++){
+                has_latlon &= sscanf(argv[k+1], "%lf", &latlon[k]) == 1;
+            }
+            if(!has_latlon){
+                printf("Error reading latlon value.\n");
+                show_usage_and_exit();
+            }
+            argc -= 5;
+            argv += 5;
+        }else{
+            //Undefined argument
+            show_usage_and_exit();
+        }
+    }
+
+    LMK_Catalog catalog = {0};
+    if(build_path != NULL){
+        if(list_path == NULL) show_usage_and_exit();
+
+        char **filenames = NULL;
+        int32_t num_files = read_file_list(list_path, &filenames);
+        if(num_files < 0) return EXIT_FAILURE;
+
+        bool success = Build_LMK_Catalog(filenames, num_files, margin, &catalog);
+        for(int32_t i = 0; i < num_files; i++){
+            free(filenames[i]);
+        }
+        free(filenames);
+
+        success = success && Write_LMK_Catalog(build_path, &catalog);
+        if(success){
+            SAFE_PRINTF(512, "Catalog of %d landmarks written to: %s\n", catalog.num_entries, build_path);
+        }
+        free_lmk_catalog(&catalog);
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if(catalog_path == NULL || has_point == has_latlon) show_usage_and_exit();
+    if(!Read_LMK_Catalog(catalog_path, &catalog)) return EXIT_FAILURE;
+
+    int32_t results[MAX_QUERY_RESULTS];
+    int32_t found;
+    if(has_point){
+        found = LMK_Catalog_Query_Point(&catalog, point, radius, results, MAX_QUERY_RESULTS);
+    }else{
+        enum Planet body = strToPlanet(planet_str);
+        if(body == Planet_UNDEFINED){
+            free_lmk_catalog(&catalog);
+            show_usage_and_exit();
+        }
+        found = LMK_Catalog_Query_LatLong(&catalog, body, latlon[0], latlon[1], latlon[2], latlon[3],
+                                          -margin, margin, results, MAX_QUERY_RESULTS);
+    }
+    if(found < 0){
+        free_lmk_catalog(&catalog);
+        return EXIT_FAILURE;
+    }
+
+    for(int32_t i = 0; i < found && i < MAX_QUERY_RESULTS; i++){
+        SAFE_PRINTF(512, "%s\n", catalog.entries[results[i]].filename);
+    }
+    if(found > MAX_QUERY_RESULTS){
+        SAFE_PRINTF(512, "%d more results not shown\n", found - MAX_QUERY_RESULTS);
+    }
+
+    free_lmk_catalog(&catalog);
+    return EXIT_SUCCESS;
+}
@@ -30,6 +30,9 @@
 #include "landmark_tools/landmark_util/point_cloud2grid.h"
 #include "landmark_tools/utils/parse_args.h"                 // for m_getarg
 #include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
 void show_usage_and_exit()
 {
     printf("Convert point cloud to landmark format.\n");
@@ -48,18 +51,30 @@ void show_usage_and_exit()
     printf("    -filetype <POINT|PLY> - file format of input file. Use PLY if file was created by landmark_2_point. POINT is a legacy format.\n");
     printf("    -frame <WORLD|LOCAL|RASTER> - reference frame of the input pointcloud (default WORLD)\n");
     printf("    -smooth <true|false> - if true, use inverse distance weighting to calculate elevations on a grid. if false, assign point to nearest raster neighbor. (default true)\n");
+    printf("    -estimate_memory <0|1> - if 1, print the estimated memory and exit, with failure if it does not fit in -memory_budget_mb (default 0)\n");
 	exit(EXIT_FAILURE);
 }
 
+/**
+ \brief Grid a chunk of the point cloud as it is read
+ */
+static bool grid_points(void *user, const double *pts, const uint8_t *bv, size_t num_pts)
+{
+    return point_grid_add((PointGrid *)user, pts, bv, num_pts);
+}
 
 int32_t main(int32_t argc, char **argv)
 {
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
     char *pointfile= NULL;
     char *lmkfile = NULL;
     char *filetype_str = NULL;
     char *planet_str = NULL;
     char *frame_str = NULL;
     char *smooth_str = NULL;
+    char *estimate_memory_str = NULL;
     float res;
     float lat;
     float lg;
@@ -87,7 +102,8 @@ int32_t main(int32_t argc, char **argv)
             (m_getarg(argv, "-planet",    &planet_str,        CFO_STRING)!=1) &&
             (m_getarg(argv, "-filetype",   &filetype_str,        CFO_STRING)!=1) &&
             (m_getarg(argv, "-frame",   &frame_str,        CFO_STRING)!=1) &&
-            (m_getarg(argv, "-smooth",   &smooth_str,        CFO_STRING)!=1))
+            (m_getarg(argv, "-smooth",   &smooth_str,        CFO_STRING)!=1) &&
+            (m_getarg(argv, "-estimate_memory",   &estimate_memory_str,        CFO_STRING)!=1))
             show_usage_and_exit();
         
         argc-=2;
@@ -105,24 +121,6 @@ int32_t main(int32_t argc, char **argv)
     }
     
     enum PointFrame frame = strToFrame(frame_str);
-    
-    // Read Point Cloud
-    bool read_success = false;
-    
-    double *pts;
-    uint8_t *bv;
-    size_t num_pts;
-    
-    if(filetype == POINT){
-        read_success = readinpoints_ascii(pointfile, &pts, &bv, &num_pts);
-    }else if(filetype == PLY){
-        read_success = readinply(pointfile, &pts, &bv, &num_pts);
-    }
-    
-    if(!read_success){
-        SAFE_PRINTF(256, "Unable to read %s\n", pointfile);
-        return EXIT_FAILURE;
-    }
 
     bool smooth = true;
     if(smooth_str != NULL && strncmp(smooth_str, "false", 5) == 0){
@@ -142,10 +140,19 @@ int32_t main(int32_t argc, char **argv)
     strncpy(lmk.filename, lmkfile, LMK_FILENAME_SIZE);
     strncpy(lmk.lmk_id, "0", LMK_ID_SIZE); //TODO Described in the D_101723_LVS_Ref_Map_Product_ICD document
     
+    // Check the landmark and the gridding sums against the memory budget before allocating them
+    bool estimate_memory = estimate_memory_str != NULL && atoi(estimate_memory_str) != 0;
+    if(estimate_memory){
+        return mem_stats_print_estimate("point_2_landmark", point_grid_bytes(&lmk, 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if(!mem_stats_fits(point_grid_bytes(&lmk, 0))){
+        SAFE_PRINTF(256, "Gridding the landmark needs about %zu MB, over the memory budget of %zu MB\n",
+                    point_grid_bytes(&lmk, 0) >> 20, mem_stats_budget() >> 20);
+        return EXIT_FAILURE;
+    }
+    
     if(!allocate_lmk_arrays(&lmk, lmk.num_cols, lmk.num_rows)){
         free_lmk(&lmk);
-        free(pts);
-        free(bv);
         printf("Failed to allocate landmark memory\n");
         return EXIT_FAILURE;
     }
@@ -156,10 +163,28 @@ int32_t main(int32_t argc, char **argv)
     calculateAnchorRotation(&lmk, lat, lg, ele);
     calculateDerivedValuesVectors(&lmk);
     
-    // Transform points to landmark coordinate frame
-    bool success = point2lmk(pts, bv, num_pts, &lmk, frame, smooth);
-    free(pts);
-    free(bv);
+    // Read the point cloud and transform the points to landmark coordinate frame, a chunk at a time
+    bool read_success = true;
+    bool success = false;
+    PointGrid grid;
+    if(point_grid_init(&grid, &lmk, frame, smooth)){
+        if(filetype == POINT){
+            read_success = readinpoints_ascii_chunks(pointfile, grid_points, &grid);
+        }else{
+            read_success = readinply_chunks(pointfile, POINT_CHUNK_SIZE, grid_points, &grid);
+        }
+        if(read_success){
+            point_grid_finish(&grid);
+            success = true;
+        }
+        point_grid_free(&grid);
+    }
+    
+    if(!read_success){
+        free_lmk(&lmk);
+        SAFE_PRINTF(256, "Unable to read %s\n", pointfile);
+        return EXIT_FAILURE;
+    }
     if(!success){
         free_lmk(&lmk);
         printf("Failed to convert points to landmark coordinate frame\n");
@@ -0,0 +1,174 @@
+/**
+ * \file render_landmark_main.c
+ * \date 2024
+ *
+ * \brief Render nadir images of a landmark lit by the sun, without a PLY export or Blender
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>                                            // for NAN, isnan
+#include <stdbool.h>                                         // for bool
+#include <stdint.h>                                          // for int32_t
+#include <stdio.h>                                           // for printf, fopen
+#include <stdlib.h>                                          // for NULL, EXIT_F...
+#include <string.h>                                          // for strcmp
+
+#include "landmark_tools/image_io/image_utils.h"             // for write_channel_separated_image
+#include "landmark_tools/landmark_util/landmark.h"           // for Read_LMK
+#include "landmark_tools/landmark_util/lmk_height_pyramid.h" // for LMK_Height_Pyramid_Build
+#include "landmark_tools/landmark_util/lmk_render.h"         // for LMK_Render
+#include "landmark_tools/utils/parse_args.h"                 // for m_getarg
+#include "landmark_tools/utils/safe_string.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/perf_stats.h"
+
+void show_usage_and_exit()
+{
+    printf("Render a nadir orthographic image of a landmark for one or more sun angles.\n");
+    printf("Usage for render_landmark:\n");
+    printf("------------------\n");
+    printf("  Required arguments:\n");
+    printf("    -landmark   <filename> - input lmkfile\n");
+    printf("    -output  <filename> - output PNG filepath, or prefix of the output files with -angles\n");
+    printf("    -sun_elevation <degrees> -sun_azimuth <degrees> - sun angle, or\n");
+    printf("    -angles <filename> - CSV file with one <timestamp, elevation_in_degrees, azimuth_in_degrees> line per image\n");
+    printf("  Optional arguments:\n");
+    printf("    -shader <LAMBERT|LUNAR_LAMBERT> - (default LAMBERT)\n");
+    printf("    -albedo <value> - reflectance of the surface (default 1.0)\n");
+    printf("    -use_srm <0|1> - multiply the albedo by the landmark surface reflectance map (default 0)\n");
+    printf("    -shadows <0|1> - cast shadows (default 1)\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ \brief Render one image and write it to `filename`
+ */
+static bool render_to_file(const LMK *lmk, const LMK_HeightPyramid *pyramid, const LMK_RenderCamera *camera,
+                           LMK_RenderSettings *settings, double elevation, double azimuth, uint8_t *image,
+                           const char *filename)
+{
+    LMK_Render_Sun_Direction(lmk, elevation, azimuth, settings->sun);
+    if(!LMK_Render(lmk, pyramid, camera, settings, image)) return false;
+    if(!write_channel_separated_image(filename, image, camera->width, camera->height, 1)){
+        SAFE_PRINTF(256, "Failed to write image at %s\n", filename);
+        return false;
+    }
+    SAFE_PRINTF(256, "Image saved at %s\n", filename);
+    return true;
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+    perf_stats_init(&argc, argv);
+    mem_stats_init(&argc, argv);
+    log_init(&argc, argv);
+    char *lmkfile = NULL;
+    char *outfile = NULL;
+    char *anglefile = NULL;
+    char *shader_str = NULL;
+    double sun_elevation = NAN;
+    double sun_azimuth = NAN;
+    double albedo = 1.0;
+    int32_t use_srm = 0;
+    int32_t shadows = 1;
+
+    argc--;
+    argv++;
+
+    if (argc==0) show_usage_and_exit();
+
+    while (argc>0)
+    {
+        if (argc==1) show_usage_and_exit();
+        if ((m_getarg(argv, "-landmark",   &lmkfile,        CFO_STRING)!=1) &&
+            (m_getarg(argv, "-output",   &outfile,        CFO_STRING)!=1) &&
+            (m_getarg(argv, "-angles",   &anglefile,        CFO_STRING)!=1) &&
+            (m_getarg(argv, "-shader",   &shader_str,        CFO_STRING)!=1) &&
+            (m_getarg(argv, "-sun_elevation",   &sun_elevation,        CFO_DOUBLE)!=1) &&
+            (m_getarg(argv, "-sun_azimuth",   &sun_azimuth,        CFO_DOUBLE)!=1) &&
+            (m_getarg(argv, "-albedo",   &albedo,        CFO_DOUBLE)!=1) &&
+            (m_getarg(argv, "-use_srm",   &use_srm,        CFO_INT)!=1) &&
+            (m_getarg(argv, "-shadows",   &shadows,        CFO_INT)!=1))
+            show_usage_and_exit();
+
+        argc-=2;
+        argv+=2;
+    }
+
+    if(lmkfile == NULL || outfile == NULL) show_usage_and_exit();
+    if(anglefile == NULL && (isnan(sun_elevation) || isnan(sun_azimuth))) show_usage_and_exit();
+
+    LMK_RenderSettings settings = {0};
+    settings.shader = LMK_RENDER_LAMBERT;
+    if(shader_str != NULL){
+        if(strcmp(shader_str, "LUNAR_LAMBERT") == 0){
+            settings.shader = LMK_RENDER_LUNAR_LAMBERT;
+        }else if(strcmp(shader_str, "LAMBERT") != 0){
+            show_usage_and_exit();
+        }
+    }
+    settings.albedo = albedo;
+    settings.use_srm = use_srm != 0;
+    settings.shadows = shadows != 0;
+
+    LMK lmk = {0};
+    if(!Read_LMK(lmkfile, &lmk)){
+        SAFE_PRINTF(256, "Failed to read landmark file at %s\n", lmkfile);
+        return EXIT_FAILURE;
+    }
+
+    // The pyramid and the image are shared by every sun angle
+    LMK_HeightPyramid pyramid;
+    if(!LMK_Height_Pyramid_Build(&pyramid, &lmk)){
+        free_lmk(&lmk);
+        return EXIT_FAILURE;
+    }
+    LMK_RenderCamera camera;
+    LMK_Render_Nadir_Camera(&lmk, &camera);
+    uint8_t *image = (uint8_t *)malloc(sizeof(uint8_t)*camera.width*camera.height);
+    if(image == NULL){
+        printf("render_landmark ==>> malloc() failed\n");
+        LMK_Height_Pyramid_Free(&pyramid);
+        free_lmk(&lmk);
+        return EXIT_FAILURE;
+    }
+
+    bool success = true;
+    if(anglefile == NULL){
+        success = render_to_file(&lmk, &pyramid, &camera, &settings, sun_elevation, sun_azimuth, image, outfile);
+    }else{
+        FILE *fp = fopen(anglefile, "r");
+        if(fp == NULL){
+            SAFE_PRINTF(256, "Failed to open angle file at %s\n", anglefile);
+            success = false;
+        }else{
+            char line[512];
+            while(success && fgets(line, sizeof(line), fp) != NULL){
+                if(sscanf(line, "%*[^,], %lf , %lf", &sun_elevation, &sun_azimuth) != 2) continue;
+                char filename[1024];
+                snprintf(filename, sizeof(filename), "%s_%0.3fe_%0.3fa.png", outfile, sun_elevation, sun_azimuth);
+                success = render_to_file(&lmk, &pyramid, &camera, &settings, sun_elevation, sun_azimuth, image,
+                                         filename);
+            }
+            fclose(fp);
+        }
+    }
+
+    free(image);
+    LMK_Height_Pyramid_Free(&pyramid);
+    free_lmk(&lmk);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,122 @@
+/**
+ * \file mat3_inline.h
+ * \brief Inline versions of the MAT3 vector functions called per pixel
+ *
+ * Each function has the arithmetic of the MAT3 function of the same name without the suffix, so results are
+ * identical, but the calls can be inlined and the loops around them vectorized. Unlike MAT3 they do not check for NULL
+ * arguments. Outputs may alias inputs.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _MAT3_INLINE_H
+#define _MAT3_INLINE_H
+
+#include <math.h>
+
+#include "math/mat3/mat3.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* c = a + b */
+static inline float3 *add3_inline(const float3 a[3], const float3 b[3], float3 c[3])
+{
+    c[0] = a[0] + b[0];
+    c[1] = a[1] + b[1];
+    c[2] = a[2] + b[2];
+    return c;
+}
+
+/* c = a - b */
+static inline float3 *sub3_inline(const float3 a[3], const float3 b[3], float3 c[3])
+{
+    c[0] = a[0] - b[0];
+    c[1] = a[1] - b[1];
+    c[2] = a[2] - b[2];
+    return c;
+}
+
+/* b = s * a */
+static inline float3 *scale3_inline(float3 s, const float3 a[3], float3 b[3])
+{
+    b[0] = s * a[0];
+    b[1] = s * a[1];
+    b[2] = s * a[2];
+    return b;
+}
+
+/* b = a */
+static inline float3 *copy3_inline(const float3 a[3], float3 b[3])
+{
+    b[0] = a[0];
+    b[1] = a[1];
+    b[2] = a[2];
+    return b;
+}
+
+/* Inner product of a and b */
+static inline float3 dot3_inline(const float3 a[3], const float3 b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+/* c = a x b */
+static inline float3 *cross3_inline(const float3 a[3], const float3 b[3], float3 c[3])
+{
+    float3 d0 = a[1] * b[2]  -  a[2] * b[1];
+    float3 d1 = a[2] * b[0]  -  a[0] * b[2];
+    float3 d2 = a[0] * b[1]  -  a[1] * b[0];
+    c[0] = d0;
+    c[1] = d1;
+    c[2] = d2;
+    return c;
+}
+
+/* u = m v */
+static inline float3 *mult331_inline(const float3 m[3][3], const float3 v[3], float3 u[3])
+{
+    float3 v0 = v[0], v1 = v[1], v2 = v[2];
+    u[0] = m[0][0] * v0  +  m[0][1] * v1  +  m[0][2] * v2;
+    u[1] = m[1][0] * v0  +  m[1][1] * v1  +  m[1][2] * v2;
+    u[2] = m[2][0] * v0  +  m[2][1] * v1  +  m[2][2] * v2;
+    return u;
+}
+
+/* c = a^T b */
+static inline float3 *mult133_inline(const float3 a[3], const float3 b[3][3], float3 c[3])
+{
+    float3 a0 = a[0], a1 = a[1], a2 = a[2];
+    float3 c0 = a0 * b[0][0]  +  a1 * b[1][0]  +  a2 * b[2][0];
+    float3 c1 = a0 * b[0][1]  +  a1 * b[1][1]  +  a2 * b[2][1];
+    float3 c2 = a0 * b[0][2]  +  a1 * b[1][2]  +  a2 * b[2][2];
+    c[0] = c0;
+    c[1] = c1;
+    c[2] = c2;
+    return c;
+}
+
+/* Magnitude of a */
+static inline float3 mag3_inline(const float3 a[3])
+{
+    return sqrt(a[0] * a[0]  +  a[1] * a[1]  +  a[2] * a[2]);
+}
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,730 @@
+/**
+ * \file landmark_tools_module.c
+ *
+ * \brief Python extension `landmark_tools._landmark_tools` over the landmark_tools library
+ *
+ * `LMK` and `CorrelationResults` objects hold the C structures. Their `ele`, `srm` and delta maps are `Array`
+ * objects exporting the C arrays through the buffer protocol, so `numpy.asarray(lmk.ele)` is a writable view of the
+ * elevations with no copy. An `Array` keeps its landmark or results alive.
+ *
+ * The `slope` and `hillshade` layers of an `LMK` are computed on first access and kept with it, and are read-only
+ * views. After changing `ele` in place, `drop_layers()` makes the next access compute them again. Taking a writable
+ * view of `ele` drops the layers too, and while a view of a layer is held `ele` is exported read-only and
+ * `drop_layers()` raises `BufferError`. Layers computed while a writable view of `ele` is held are dropped when the
+ * last one is released. An `Array` of dropped layers raises `BufferError` instead of exporting them.
+ *
+ * `create_landmark` reads the DEM and reflectance map from any C contiguous buffer, and it and `match` release the GIL
+ * while the library runs, so other Python threads keep running. The buffers passed to them must not be changed by
+ * another thread until they return.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>  // for PyMemberDef, T_INT, T_DOUBLE
+
+#include <math.h>     // for NAN, isnan
+#include <stdbool.h>  // for bool
+#include <stdint.h>   // for int32_t, uint8_t
+#include <string.h>   // for strcmp, strncpy
+
+#include "landmark_tools/feature_tracking/correlation_results.h"  // for CorrelationResults
+#include "landmark_tools/feature_tracking/feature_match.h"         // for MatchFeaturesWithLocalDistortion
+#include "landmark_tools/feature_tracking/parameters.h"            // for Parameters, read_parameterfile
+#include "landmark_tools/image_io/geotiff_struct.h"                // for GeoTiffData
+#include "landmark_tools/landmark_util/create_landmark.h"          // for CreateLandmark_TileCache
+#include "landmark_tools/landmark_util/landmark.h"                 // for LMK, Read_LMK, Write_LMK
+#include "landmark_tools/landmark_util/lmk_layers.h"               // for LMK_Slope_Layer, LMK_Hillshade_Layer
+#include "landmark_tools/map_projection/datum_conversion.h"        // for strToProjection, strToPlanet
+#include "landmark_tools/utils/parallel.h"                         // for parallel_num_threads
+
+/*-----------------------------------------------------------*/
+/*-------------------------- Array --------------------------*/
+/*-----------------------------------------------------------*/
+
+/**
+ * \brief What an `Array` views
+ */
+enum ArrayKind {
+    ARRAY_MAP,                /*!< \brief Map that is valid as long as its owner */
+    ARRAY_LMK_ELE,            /*!< \brief Elevation of an `LMK`, which its layers are computed from */
+    ARRAY_LMK_LAYER           /*!< \brief Derived layer of an `LMK`, valid until the layers are dropped */
+};
+
+/**
+ * \brief Rows x columns array owned by an `LMK` or `CorrelationResults` object
+ */
+typedef struct {
+    PyObject_HEAD
+    PyObject *owner;          /*!< \brief Object holding the memory */
+    void *data;               /*!< \brief First element */
+    const char *format;       /*!< \brief struct format of the elements, "f" or "B" */
+    int readonly;             /*!< \brief 1 for the derived layers of a landmark */
+    enum ArrayKind kind;
+    uint64_t generation;      /*!< \brief Layers generation of the `LMK` owner, for ARRAY_LMK_LAYER */
+    Py_ssize_t itemsize;      /*!< \brief Bytes of one element */
+    Py_ssize_t shape[2];      /*!< \brief Rows, columns */
+    Py_ssize_t strides[2];    /*!< \brief Bytes between rows, between columns */
+} ArrayObject;
+
+static PyTypeObject ArrayType;
+
+static int lmk_array_export(ArrayObject *array, int flags, void **data, int *readonly);
+static void lmk_array_release(ArrayObject *array, int readonly);
+
+static PyObject *new_array(PyObject *owner, void *data, const char *format, Py_ssize_t itemsize, int32_t cols,
+                           int32_t rows)
+{
+    if (data == NULL) {
+        Py_RETURN_NONE;
+    }
+    ArrayObject *array = PyObject_New(ArrayObject, &ArrayType);
+    if (array == NULL) return NULL;
+    Py_INCREF(owner);
+    array->owner = owner;
+    array->data = data;
+    array->format = format;
+    array->readonly = 0;
+    array->kind = ARRAY_MAP;
+    array->generation = 0;
+    array->itemsize = itemsize;
+    array->shape[0] = rows;
+    array->shape[1] = cols;
+    array->strides[0] = itemsize * cols;
+    array->strides[1] = itemsize;
+    return (PyObject *)array;
+}
+
+static void array_dealloc(ArrayObject *self)
+{
+    Py_XDECREF(self->owner);
+    PyObject_Free(self);
+}
+
+static int array_getbuffer(ArrayObject *self, Py_buffer *view, int flags)
+{
+    view->obj = NULL;
+    if (self->readonly && (flags & PyBUF_WRITABLE)) {
+        PyErr_SetString(PyExc_BufferError, "Array is read-only");
+        return -1;
+    }
+    void *data = self->data;
+    int readonly = self->readonly;
+    if (self->kind != ARRAY_MAP && lmk_array_export(self, flags, &data, &readonly) < 0) return -1;
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->buf = data;
+    view->len = self->shape[0] * self->shape[1] * self->itemsize;
+    view->readonly = readonly;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char *)self->format : NULL;
+    view->ndim = 2;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static void array_releasebuffer(ArrayObject *self, Py_buffer *view)
+{
+    if (self->kind != ARRAY_MAP) lmk_array_release(self, view->readonly);
+}
+
+static PyObject *array_get_shape(ArrayObject *self, void *closure)
+{
+    (void)closure;
+    return Py_BuildValue("(nn)", self->shape[0], self->shape[1]);
+}
+
+static PyBufferProcs array_as_buffer = {
+    .bf_getbuffer = (getbufferproc)array_getbuffer,
+    .bf_releasebuffer = (releasebufferproc)array_releasebuffer,
+};
+
+static PyGetSetDef array_getset[] = {
+    {"shape", (getter)array_get_shape, NULL, "Rows and columns", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject ArrayType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "landmark_tools._landmark_tools.Array",
+    .tp_basicsize = sizeof(ArrayObject),
+    .tp_dealloc = (destructor)array_dealloc,
+    .tp_as_buffer = &array_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Rows x columns map of a landmark or of correlation results, without a copy. Use numpy.asarray",
+    .tp_getset = array_getset,
+};
+
+/*-----------------------------------------------------------*/
+/*--------------------------- LMK ---------------------------*/
+/*-----------------------------------------------------------*/
+
+typedef struct {
+    PyObject_HEAD
+    LMK lmk;
+    Py_ssize_t layer_exports;     /*!< \brief Buffers of the slope and hillshade layers not yet released */
+    Py_ssize_t ele_exports;       /*!< \brief Writable buffers of the elevation not yet released */
+    uint64_t layers_generation;   /*!< \brief Incremented each time the layers are dropped */
+} LMKObject;
+
+static PyTypeObject LMKType;
+
+static LMKObject *new_lmk_object(void)
+{
+    LMKObject *self = PyObject_New(LMKObject, &LMKType);
+    if (self != NULL) {
+        memset(&self->lmk, 0, sizeof(LMK));
+        self->layer_exports = 0;
+        self->ele_exports = 0;
+        self->layers_generation = 0;
+    }
+    return self;
+}
+
+/**
+ * \brief Check out the elevation or a layer of the `LMK` owner of `array` for a buffer
+ *
+ * The elevation is exported writable, and the layers computed from it are dropped, unless a view of a layer is held.
+ * Then it is exported read-only. A layer is exported only if it was not dropped since `array` was made.
+ */
+static int lmk_array_export(ArrayObject *array, int flags, void **data, int *readonly)
+{
+    LMKObject *owner = (LMKObject *)array->owner;
+    if (array->kind == ARRAY_LMK_LAYER) {
+        if (array->generation != owner->layers_generation) {
+            PyErr_SetString(PyExc_BufferError, "the layers were dropped, get the layer from the landmark again");
+            return -1;
+        }
+        owner->layer_exports++;
+        return 0;
+    }
+    if (owner->layer_exports > 0) {
+        if (flags & PyBUF_WRITABLE) {
+            PyErr_SetString(PyExc_BufferError, "ele is read-only while a view of the slope or hillshade is held");
+            return -1;
+        }
+        *readonly = 1;
+        return 0;
+    }
+    // LMK_Ele_Writable drops the layers and unshares the array
+    *data = LMK_Ele_Writable(&owner->lmk);
+    owner->layers_generation++;
+    if (*data == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    array->data = *data;
+    owner->ele_exports++;
+    return 0;
+}
+
+static void lmk_array_release(ArrayObject *array, int readonly)
+{
+    LMKObject *owner = (LMKObject *)array->owner;
+    if (array->kind == ARRAY_LMK_LAYER) {
+        owner->layer_exports--;
+    } else if (!readonly && --owner->ele_exports == 0 && owner->layer_exports == 0) {
+        // Layers computed while the elevation could be written may be out of date
+        LMK_Drop_Layers(&owner->lmk);
+        owner->layers_generation++;
+    }
+}
+
+static void lmk_dealloc(LMKObject *self)
+{
+    free_lmk(&self->lmk);
+    PyObject_Free(self);
+}
+
+static PyObject *lmk_get_ele(LMKObject *self, void *closure)
+{
+    (void)closure;
+    PyObject *array = new_array((PyObject *)self, self->lmk.ele, "f", sizeof(float), self->lmk.num_cols,
+                                self->lmk.num_rows);
+    if (array != NULL && array != Py_None) ((ArrayObject *)array)->kind = ARRAY_LMK_ELE;
+    return array;
+}
+
+static PyObject *lmk_get_srm(LMKObject *self, void *closure)
+{
+    (void)closure;
+    return new_array((PyObject *)self, self->lmk.srm, "B", sizeof(uint8_t), self->lmk.num_cols, self->lmk.num_rows);
+}
+
+/**
+ * \brief Read-only `Array` of a derived layer of a landmark
+ */
+static PyObject *new_layer_array(LMKObject *self, const void *layer, const char *format, Py_ssize_t itemsize)
+{
+    if (layer == NULL && self->lmk.ele != NULL) return PyErr_NoMemory();
+    PyObject *array = new_array((PyObject *)self, (void *)layer, format, itemsize, self->lmk.num_cols,
+                                self->lmk.num_rows);
+    if (array != NULL && array != Py_None) {
+        ArrayObject *layer_array = (ArrayObject *)array;
+        layer_array->readonly = 1;
+        layer_array->kind = ARRAY_LMK_LAYER;
+        layer_array->generation = self->layers_generation;
+    }
+    return array;
+}
+
+static PyObject *lmk_get_slope(LMKObject *self, void *closure)
+{
+    (void)closure;
+    return new_layer_array(self, LMK_Slope_Layer(&self->lmk), "f", sizeof(float));
+}
+
+static PyObject *lmk_get_hillshade(LMKObject *self, void *closure)
+{
+    (void)closure;
+    return new_layer_array(self, LMK_Hillshade_Layer(&self->lmk), "B", sizeof(uint8_t));
+}
+
+static PyObject *lmk_drop_layers(LMKObject *self, PyObject *unused)
+{
+    (void)unused;
+    if (self->layer_exports > 0) {
+        PyErr_SetString(PyExc_BufferError, "a view of the slope or hillshade layer is still held");
+        return NULL;
+    }
+    LMK_Drop_Layers(&self->lmk);
+    self->layers_generation++;
+    Py_RETURN_NONE;
+}
+
+static PyObject *lmk_get_shape(LMKObject *self, void *closure)
+{
+    (void)closure;
+    return Py_BuildValue("(ii)", self->lmk.num_rows, self->lmk.num_cols);
+}
+
+static PyObject *lmk_get_anchor_point(LMKObject *self, void *closure)
+{
+    (void)closure;
+    const double *p = self->lmk.anchor_point;
+    return Py_BuildValue("(ddd)", p[0], p[1], p[2]);
+}
+
+static PyObject *lmk_get_mapRworld(LMKObject *self, void *closure)
+{
+    (void)closure;
+    double (*r)[3] = self->lmk.mapRworld;
+    return Py_BuildValue("((ddd)(ddd)(ddd))", r[0][0], r[0][1], r[0][2], r[1][0], r[1][1], r[1][2],
+                         r[2][0], r[2][1], r[2][2]);
+}
+
+static PyObject *lmk_get_lmk_id(LMKObject *self, void *closure)
+{
+    (void)closure;
+    return PyUnicode_FromStringAndSize(self->lmk.lmk_id, strnlen(self->lmk.lmk_id, LMK_ID_SIZE));
+}
+
+static PyObject *lmk_get_body(LMKObject *self, void *closure)
+{
+    (void)closure;
+    switch (self->lmk.BODY) {
+        case Earth: return PyUnicode_FromString("Earth");
+        case Moon: return PyUnicode_FromString("Moon");
+        case Mars: return PyUnicode_FromString("Mars");
+        default: Py_RETURN_NONE;
+    }
+}
+
+static PyObject *lmk_write(LMKObject *self, PyObject *args)
+{
+    PyObject *path = NULL;
+    if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path)) return NULL;
+    bool written;
+    Py_BEGIN_ALLOW_THREADS
+    written = Write_LMK(PyBytes_AS_STRING(path), &self->lmk);
+    Py_END_ALLOW_THREADS
+    if (!written) {
+        PyErr_Format(PyExc_OSError, "cannot write landmark file %s", PyBytes_AS_STRING(path));
+        Py_DECREF(path);
+        return NULL;
+    }
+    Py_DECREF(path);
+    Py_RETURN_NONE;
+}
+
+static PyObject *lmk_copy(LMKObject *self, PyObject *unused)
+{
+    (void)unused;
+    LMKObject *copy = new_lmk_object();
+    if (copy == NULL) return NULL;
+    if (!Copy_LMK(&self->lmk, &copy->lmk)) {
+        Py_DECREF(copy);
+        return PyErr_NoMemory();
+    }
+    return (PyObject *)copy;
+}
+
+#define LMK_MEMBER(name, type, doc) {#name, type, offsetof(LMKObject, lmk) + offsetof(LMK, name), READONLY, doc}
+
+static PyMemberDef lmk_members[] = {
+    LMK_MEMBER(num_cols, T_INT, "Width of the landmark"),
+    LMK_MEMBER(num_rows, T_INT, "Height of the landmark"),
+    LMK_MEMBER(anchor_col, T_DOUBLE, "Pixel column of the anchor point"),
+    LMK_MEMBER(anchor_row, T_DOUBLE, "Pixel row of the anchor point"),
+    LMK_MEMBER(resolution, T_DOUBLE, "Meters per pixel"),
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyGetSetDef lmk_getset[] = {
+    {"ele", (getter)lmk_get_ele, NULL, "Elevation map in meters, float32 rows x cols", NULL},
+    {"srm", (getter)lmk_get_srm, NULL, "Surface reflectance map, uint8 rows x cols", NULL},
+    {"slope", (getter)lmk_get_slope, NULL, "Slope in degrees, read-only float32 rows x cols", NULL},
+    {"hillshade", (getter)lmk_get_hillshade, NULL, "Shaded relief, read-only uint8 rows x cols", NULL},
+    {"shape", (getter)lmk_get_shape, NULL, "Rows and columns", NULL},
+    {"anchor_point", (getter)lmk_get_anchor_point, NULL, "World frame position of the map frame origin", NULL},
+    {"mapRworld", (getter)lmk_get_mapRworld, NULL, "Rotation from world frame to map frame", NULL},
+    {"lmk_id", (getter)lmk_get_lmk_id, NULL, "Identifier of the landmark", NULL},
+    {"body", (getter)lmk_get_body, NULL, "Planetary body", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyMethodDef lmk_methods[] = {
+    {"write", (PyCFunction)lmk_write, METH_VARARGS, "write(path)\n\nWrite the landmark file"},
+    {"copy", (PyCFunction)lmk_copy, METH_NOARGS, "copy()\n\nCopy of the landmark and its maps"},
+    {"drop_layers", (PyCFunction)lmk_drop_layers, METH_NOARGS,
+     "drop_layers()\n\nRelease the slope and hillshade layers, after changing ele in place. Raises BufferError "
+     "while a view of them is held"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject LMKType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "landmark_tools._landmark_tools.LMK",
+    .tp_basicsize = sizeof(LMKObject),
+    .tp_dealloc = (destructor)lmk_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Landmark. Made by read_lmk or create_landmark",
+    .tp_methods = lmk_methods,
+    .tp_members = lmk_members,
+    .tp_getset = lmk_getset,
+};
+
+/*-----------------------------------------------------------*/
+/*------------------- CorrelationResults --------------------*/
+/*-----------------------------------------------------------*/
+
+typedef struct {
+    PyObject_HEAD
+    CorrelationResults results;
+    int32_t num_cols;
+    int32_t num_rows;
+} ResultsObject;
+
+static PyTypeObject ResultsType;
+
+static void results_dealloc(ResultsObject *self)
+{
+    destroy_correlation_results(&self->results);
+    PyObject_Free(self);
+}
+
+/**
+ * \brief Map of the results selected by the closure, the offset of its pointer in `CorrelationResults`
+ */
+static PyObject *results_get_map(ResultsObject *self, void *closure)
+{
+    float *map = *(float **)((char *)&self->results + (size_t)closure);
+    return new_array((PyObject *)self, map, "f", sizeof(float), self->num_cols, self->num_rows);
+}
+
+static PyObject *results_get_shape(ResultsObject *self, void *closure)
+{
+    (void)closure;
+    return Py_BuildValue("(ii)", self->num_rows, self->num_cols);
+}
+
+#define RESULTS_MAP(name, doc) {#name, (getter)results_get_map, NULL, doc, (void *)offsetof(CorrelationResults, name)}
+
+static PyGetSetDef results_getset[] = {
+    RESULTS_MAP(delta_x, "Delta in x direction (east), float32 rows x cols of the child landmark"),
+    RESULTS_MAP(delta_y, "Delta in y direction (north), float32 rows x cols of the child landmark"),
+    RESULTS_MAP(delta_z, "Delta in z direction (up), float32 rows x cols of the child landmark"),
+    RESULTS_MAP(correlation, "Correlation value, float32 rows x cols of the child landmark"),
+    {"shape", (getter)results_get_shape, NULL, "Rows and columns", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject ResultsType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "landmark_tools._landmark_tools.CorrelationResults",
+    .tp_basicsize = sizeof(ResultsObject),
+    .tp_dealloc = (destructor)results_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Delta maps and correlation of a comparison. Made by match",
+    .tp_getset = results_getset,
+};
+
+/*-----------------------------------------------------------*/
+/*------------------------ Functions ------------------------*/
+/*-----------------------------------------------------------*/
+
+/**
+ * \brief Get a C contiguous rows x cols buffer of `format` elements
+ * \return false with an exception set if `obj` is not one
+ */
+static bool get_map_buffer(PyObject *obj, const char *name, char format, Py_ssize_t itemsize, Py_buffer *view)
+{
+    if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) return false;
+    const char *f = view->format != NULL ? view->format : "B";
+    if (f[0] == '@' || f[0] == '=' || (f[0] == '<' && PY_LITTLE_ENDIAN) || (f[0] == '>' && PY_BIG_ENDIAN)) f++;
+    if (view->ndim != 2 || view->itemsize != itemsize || f[0] != format || f[1] != '\0') {
+        PyErr_Format(PyExc_ValueError, "%s must be a 2-D C contiguous array of %s", name,
+                     format == 'f' ? "float32" : "uint8");
+        PyBuffer_Release(view);
+        return false;
+    }
+    return true;
+}
+
+static PyObject *py_read_lmk(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *path = NULL;
+    if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path)) return NULL;
+    LMKObject *self = new_lmk_object();
+    if (self == NULL) {
+        Py_DECREF(path);
+        return NULL;
+    }
+    bool read;
+    Py_BEGIN_ALLOW_THREADS
+    read = Read_LMK(PyBytes_AS_STRING(path), &self->lmk);
+    Py_END_ALLOW_THREADS
+    if (!read) {
+        PyErr_Format(PyExc_OSError, "cannot read landmark file %s", PyBytes_AS_STRING(path));
+        Py_DECREF(path);
+        Py_DECREF(self);
+        return NULL;
+    }
+    Py_DECREF(path);
+    return (PyObject *)self;
+}
+
+static PyObject *py_create_landmark(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    (void)module;
+    static char *keywords[] = {"dem", "srm", "projection", "origin", "pixel_size", "num_cols", "num_rows",
+                               "resolution", "anchor_lat", "anchor_lon", "planet", "nodata", "nat_origin",
+                               "false_easting", "false_northing", "set_anchor_point_ele", "lmk_id",
+                               "projection_grid_step", NULL};
+    PyObject *dem_obj = NULL;
+    PyObject *srm_obj = Py_None;
+    const char *projection_str = NULL;
+    // Keyword-only arguments are all optional to the parser, the required ones are checked below
+    double origin[2] = {NAN, NAN};
+    double pixel_size[2] = {NAN, NAN};
+    int32_t num_cols = 0, num_rows = 0;
+    double resolution = 0.0, anchor_lat = NAN, anchor_lon = NAN;
+    const char *planet_str = "Moon";
+    double nodata = NAN;
+    double nat_origin[2] = {0.0, 0.0};
+    double false_easting = 0.0, false_northing = 0.0;
+    float set_anchor_point_ele = NAN;
+    const char *lmk_id = "0";
+    int32_t grid_step = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O$s(dd)(dd)iidddsd(dd)ddfsi", keywords, &dem_obj, &srm_obj,
+                                     &projection_str, &origin[0], &origin[1], &pixel_size[0], &pixel_size[1],
+                                     &num_cols, &num_rows, &resolution, &anchor_lat, &anchor_lon, &planet_str,
+                                     &nodata, &nat_origin[0], &nat_origin[1], &false_easting, &false_northing,
+                                     &set_anchor_point_ele, &lmk_id, &grid_step)) {
+        return NULL;
+    }
+    if (projection_str == NULL || isnan(origin[0]) || isnan(pixel_size[0]) || isnan(anchor_lat) ||
+        isnan(anchor_lon)) {
+        PyErr_SetString(PyExc_TypeError, "create_landmark() needs projection, origin, pixel_size, num_cols, "
+                        "num_rows, resolution, anchor_lat and anchor_lon");
+        return NULL;
+    }
+    if (num_cols <= 0 || num_rows <= 0 || resolution <= 0) {
+        PyErr_SetString(PyExc_ValueError, "num_cols, num_rows and resolution must be positive");
+        return NULL;
+    }
+
+    GeoTiffData geotiff_info = {0};
+    geotiff_info.projection = strToProjection((char *)projection_str);
+    enum Planet planet = strToPlanet((char *)planet_str);
+    if (geotiff_info.projection == Projection_UNDEFINED || planet == Planet_UNDEFINED) {
+        PyErr_SetString(PyExc_ValueError, "unknown projection or planet");
+        return NULL;
+    }
+
+    Py_buffer dem, srm = {0};
+    if (!get_map_buffer(dem_obj, "dem", 'f', sizeof(float), &dem)) return NULL;
+    bool has_srm = srm_obj != Py_None;
+    if (has_srm && !get_map_buffer(srm_obj, "srm", 'B', sizeof(uint8_t), &srm)) {
+        PyBuffer_Release(&dem);
+        return NULL;
+    }
+    geotiff_info.origin[0] = origin[0];
+    geotiff_info.origin[1] = origin[1];
+    geotiff_info.pixelSize[0] = pixel_size[0];
+    geotiff_info.pixelSize[1] = pixel_size[1];
+    geotiff_info.imageSize[0] = (int32_t)dem.shape[1];
+    geotiff_info.imageSize[1] = (int32_t)dem.shape[0];
+    geotiff_info.noDataValue = nodata;
+    geotiff_info.demValues = (float *)dem.buf;
+    geotiff_info.natOrigin[0] = nat_origin[0];
+    geotiff_info.natOrigin[1] = nat_origin[1];
+    geotiff_info.falseEasting = false_easting;
+    geotiff_info.falseNorthing = false_northing;
+    geotiff_info.bits_per_sample = 32;
+
+    LMKObject *self = new_lmk_object();
+    if (self == NULL) {
+        PyBuffer_Release(&dem);
+        if (has_srm) PyBuffer_Release(&srm);
+        return NULL;
+    }
+    LMK *lmk = &self->lmk;
+    lmk->BODY = planet;
+    lmk->num_cols = num_cols;
+    lmk->num_rows = num_rows;
+    lmk->num_pixels = (int64_t)num_cols * num_rows;
+    lmk->anchor_col = (float)num_cols / 2.0;
+    lmk->anchor_row = (float)num_rows / 2.0;
+    lmk->resolution = resolution;
+    strncpy(lmk->lmk_id, lmk_id, LMK_ID_SIZE - 1);
+    bool created = allocate_lmk_arrays(lmk, num_cols, num_rows);
+    if (created) {
+        Py_BEGIN_ALLOW_THREADS
+        created = CreateLandmark_TileCache(&geotiff_info, NULL, has_srm ? (uint8_t *)srm.buf : NULL,
+                                           has_srm ? (int32_t)srm.shape[1] : 0, has_srm ? (int32_t)srm.shape[0] : 0,
+                                           anchor_lat, anchor_lon, geotiff_info.projection, lmk,
+                                           set_anchor_point_ele, NULL, 0, grid_step);
+        Py_END_ALLOW_THREADS
+    }
+    PyBuffer_Release(&dem);
+    if (has_srm) PyBuffer_Release(&srm);
+    if (!created) {
+        PyErr_SetString(PyExc_RuntimeError, "cannot create the landmark");
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject *)self;
+}
+
+static PyObject *py_match(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    (void)module;
+    static char *keywords[] = {"base", "child", "config", "max_nan_count_base", "max_nan_count_child", NULL};
+    LMKObject *base = NULL, *child = NULL;
+    PyObject *config = NULL;
+    int32_t max_nan_count_base = 0;
+    int32_t max_nan_count_child = -1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!|O&ii", keywords, &LMKType, &base, &LMKType, &child,
+                                     PyUnicode_FSConverter, &config, &max_nan_count_base, &max_nan_count_child)) {
+        return NULL;
+    }
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    if (config != NULL) {
+        bool read = read_parameterfile(PyBytes_AS_STRING(config), &parameters);
+        if (!read) PyErr_Format(PyExc_OSError, "cannot load %s", PyBytes_AS_STRING(config));
+        Py_DECREF(config);
+        if (!read) return NULL;
+    }
+
+    ResultsObject *self = PyObject_New(ResultsObject, &ResultsType);
+    if (self == NULL) return NULL;
+    self->num_cols = child->lmk.num_cols;
+    self->num_rows = child->lmk.num_rows;
+    if (!allocate_correlation_results(&self->results, child->lmk.num_pixels)) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    bool matched;
+    Py_BEGIN_ALLOW_THREADS
+    matched = MatchFeaturesWithLocalDistortion(parameters, &base->lmk, &child->lmk, &self->results,
+                                               max_nan_count_base, max_nan_count_child);
+    Py_END_ALLOW_THREADS
+    if (!matched) {
+        PyErr_SetString(PyExc_RuntimeError, "failed to match features");
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject *)self;
+}
+
+static PyObject *py_num_threads(PyObject *module, PyObject *unused)
+{
+    (void)module;
+    (void)unused;
+    return PyLong_FromLong(parallel_num_threads());
+}
+
+static PyObject *py_set_num_threads(PyObject *module, PyObject *args)
+{
+    (void)module;
+    int32_t num_threads;
+    if (!PyArg_ParseTuple(args, "i", &num_threads)) return NULL;
+    parallel_set_num_threads(num_threads);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef module_methods[] = {
+    {"read_lmk", (PyCFunction)py_read_lmk, METH_VARARGS, "read_lmk(path)\n\nRead a landmark file"},
+    {"create_landmark", (PyCFunction)(void (*)(void))py_create_landmark, METH_VARARGS | METH_KEYWORDS,
+     "create_landmark(dem, srm=None, *, projection, origin, pixel_size, num_cols, num_rows, resolution,\n"
+     "                anchor_lat, anchor_lon, planet='Moon', nodata=nan, nat_origin=(0, 0), false_easting=0,\n"
+     "                false_northing=0, set_anchor_point_ele=nan, lmk_id='0', projection_grid_step=0)\n\n"
+     "Create a landmark from a float32 DEM and an optional uint8 reflectance map coaligned with it.\n"
+     "origin and pixel_size are the top left corner and pixel size of the DEM in the projection,\n"
+     "as read from a GeoTIFF."},
+    {"match", (PyCFunction)(void (*)(void))py_match, METH_VARARGS | METH_KEYWORDS,
+     "match(base, child, config=None, max_nan_count_base=0, max_nan_count_child=-1)\n\n"
+     "Compare two landmarks as landmark_comparison does, with the parameters of a configuration file or the\n"
+     "defaults. Returns CorrelationResults of the size of child."},
+    {"num_threads", py_num_threads, METH_NOARGS, "num_threads()\n\nThreads of the library"},
+    {"set_num_threads", py_set_num_threads, METH_VARARGS,
+     "set_num_threads(n)\n\nSet the threads of the library, 0 for LANDMARK_TOOLS_NUM_THREADS or the processors"},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef landmark_tools_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "landmark_tools._landmark_tools",
+    .m_doc = "Landmarks and comparisons of the landmark_tools library, with maps shared with NumPy",
+    .m_size = -1,
+    .m_methods = module_methods,
+};
+
+PyMODINIT_FUNC PyInit__landmark_tools(void)
+{
+    if (PyType_Ready(&ArrayType) < 0 || PyType_Ready(&LMKType) < 0 || PyType_Ready(&ResultsType) < 0) {
+        return NULL;
+    }
+    PyObject *module = PyModule_Create(&landmark_tools_module);
+    if (module == NULL) return NULL;
+    PyTypeObject *types[] = {&ArrayType, &LMKType, &ResultsType};
+    const char *names[] = {"Array", "LMK", "CorrelationResults"};
+    for (int32_t k = 0; k < 3; k++) {
+        Py_INCREF(types[k]);
+        if (PyModule_AddObject(module, names[k], (PyObject *)types[k]) < 0) {
+            Py_DECREF(types[k]);
+            Py_DECREF(module);
+            return NULL;
+        }
+    }
+    return module;
+}
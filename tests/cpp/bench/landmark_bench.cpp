@@ -0,0 +1,384 @@
+/**
+ * \file landmark_bench.cpp
+ * \brief Micro benchmarks of the inner kernels and end-to-end runs on the gold standard maps
+ *
+ * Run with `--benchmark_format=json` or `--benchmark_out=<file> --benchmark_out_format=json` to track regressions,
+ * or build the `landmark_bench_json` target which writes landmark_bench.json in the build directory.
+ *
+ * \copyright Copyright 2024 California Institute of Technology
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "img/utils/imgutils.h"
+#include "landmark_tools/data_interpolation/interpolate_data.h"
+#include "landmark_tools/feature_tracking/corr_image_long.h"
+#include "landmark_tools/feature_tracking/correlation_results.h"
+#include "landmark_tools/feature_tracking/feature_match.h"
+#include "landmark_tools/feature_tracking/parameters.h"
+#include "landmark_tools/image_io/geotiff_struct.h"
+#include "landmark_tools/landmark_registration/landmark_registration.h"
+#include "landmark_tools/landmark_util/create_landmark.h"
+#include "landmark_tools/landmark_util/landmark.h"
+#include "landmark_tools/landmark_util/point_cloud2grid.h"
+#include "landmark_tools/map_projection/datum_conversion.h"
+#include "landmark_tools/math/homography_util.h"
+#include "landmark_tools/utils/endian_read_write.h"
+
+#ifndef LANDMARK_BENCH_DATA_DIR
+#define LANDMARK_BENCH_DATA_DIR "tests/gold_standard_data"
+#endif
+
+namespace {
+
+std::string data_path(const char *name)
+{
+    return std::string(LANDMARK_BENCH_DATA_DIR) + "/" + name;
+}
+
+/**
+ * \brief Smooth texture with noise, the same for every run
+ */
+std::vector<uint8_t> make_texture(int32_t cols, int32_t rows, uint32_t seed)
+{
+    std::vector<uint8_t> image((size_t)cols * rows);
+    uint32_t state = seed;
+    for (int32_t r = 0; r < rows; r++) {
+        for (int32_t c = 0; c < cols; c++) {
+            state = state * 1664525u + 1013904223u;
+            double noise = (double)(state >> 24) / 255.0 - 0.5;
+            double value = 128.0 + 50.0 * std::sin(c * 0.13) * std::cos(r * 0.07) +
+                           30.0 * std::sin((c + 2 * r) * 0.031) + 20.0 * noise;
+            image[(size_t)r * cols + c] = (uint8_t)std::fmin(255.0, std::fmax(0.0, value));
+        }
+    }
+    return image;
+}
+
+/**
+ * \brief Landmark read once and kept for every benchmark using it
+ */
+const LMK *gold_landmark(const char *name)
+{
+    struct Cached {
+        std::string name;
+        LMK lmk;
+        bool valid;
+    };
+    static std::vector<Cached *> cache;
+    for (Cached *cached : cache) {
+        if (cached->name == name) return cached->valid ? &cached->lmk : nullptr;
+    }
+    Cached *cached = new Cached{name, LMK{}, false};
+    cached->valid = Read_LMK(data_path(name).c_str(), &cached->lmk);
+    cache.push_back(cached);
+    return cached->valid ? &cached->lmk : nullptr;
+}
+
+/*----------------------------- Micro benchmarks ------------------------------*/
+
+// Args: template size, search size
+void BM_corimg_long(benchmark::State &state)
+{
+    const int32_t size = 256;
+    const size_t template_size = (size_t)state.range(0);
+    const size_t search_size = (size_t)state.range(1);
+    std::vector<uint8_t> image = make_texture(size, size, 1);
+    const size_t search_left = (size - search_size) / 2;
+    const size_t template_left = search_left + (search_size - template_size) / 2 + 3;
+    double best_row, best_col, best_value, covar[3];
+    for (auto _ : state) {
+        bool found = corimg_long(image.data(), size, template_left, template_left, template_size, template_size,
+                                 image.data(), size, search_left, search_left, search_size, search_size,
+                                 &best_row, &best_col, &best_value, covar);
+        benchmark::DoNotOptimize(found);
+        benchmark::DoNotOptimize(best_value);
+    }
+    const int64_t offsets = (int64_t)(search_size - template_size + 1) * (search_size - template_size + 1);
+    state.SetItemsProcessed(state.iterations() * offsets);
+}
+BENCHMARK(BM_corimg_long)->ArgsProduct({{11, 21, 31}, {48, 64, 96}});
+
+// Arg: image width and height
+void BM_int_forstner_nbest(benchmark::State &state)
+{
+    const int32_t size = (int32_t)state.range(0);
+    const int32_t max = 500;
+    std::vector<uint8_t> image = make_texture(size, size, 2);
+    std::vector<int> pos(max * 2);
+    std::vector<float> values(max);
+    int num = 0;
+    for (auto _ : state) {
+        int status = int_forstner_nbest(image.data(), size, size, 0, 0, size, size, 9, max, &num,
+                                        (int (*)[2])pos.data(), values.data());
+        benchmark::DoNotOptimize(status);
+        benchmark::DoNotOptimize(values.data());
+    }
+    state.SetItemsProcessed(state.iterations() * (int64_t)size * size);
+}
+BENCHMARK(BM_int_forstner_nbest)->Arg(256)->Arg(512)->Arg(1024);
+
+void BM_inter_float_matrix(benchmark::State &state)
+{
+    const size_t size = 1024;
+    const size_t num_samples = 4096;
+    std::vector<float> grid(size * size);
+    for (size_t i = 0; i < grid.size(); i++) grid[i] = (float)std::sin(i * 0.001);
+    std::vector<double> x(num_samples), y(num_samples);
+    uint32_t seed = 3;
+    for (size_t i = 0; i < num_samples; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        x[i] = (seed >> 8) % (size * 16) / 16.0;
+        seed = seed * 1664525u + 1013904223u;
+        y[i] = (seed >> 8) % (size * 16) / 16.0;
+    }
+    for (auto _ : state) {
+        double sum = 0;
+        for (size_t i = 0; i < num_samples; i++) sum += inter_float_matrix(grid.data(), size, size, x[i], y[i]);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * (int64_t)num_samples);
+}
+BENCHMARK(BM_inter_float_matrix);
+
+// Arg: number of correspondences, 30% of them outliers
+void BM_getHomographyFromPoints_RANSAC_frame(benchmark::State &state)
+{
+    const int32_t num_points = (int32_t)state.range(0);
+    const double truth[3][3] = {{1.02, 0.01, 4.0}, {-0.015, 0.99, -2.5}, {1e-5, -2e-5, 1.0}};
+    std::vector<double> points1(num_points * 2), points2(num_points * 2);
+    uint32_t seed = 4;
+    for (int32_t i = 0; i < num_points; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        double x = (seed >> 8) % 5000 / 10.0;
+        seed = seed * 1664525u + 1013904223u;
+        double y = (seed >> 8) % 5000 / 10.0;
+        double w = truth[2][0] * x + truth[2][1] * y + truth[2][2];
+        points1[i * 2] = x;
+        points1[i * 2 + 1] = y;
+        points2[i * 2] = (truth[0][0] * x + truth[0][1] * y + truth[0][2]) / w;
+        points2[i * 2 + 1] = (truth[1][0] * x + truth[1][1] * y + truth[1][2]) / w;
+        if (i % 10 < 3) {
+            seed = seed * 1664525u + 1013904223u;
+            points2[i * 2] += (double)((seed >> 8) % 200) - 100.0;
+        }
+    }
+    srand(1);
+    double homography[3][3];
+    for (auto _ : state) {
+        int32_t status = getHomographyFromPoints_RANSAC_frame(points1.data(), points2.data(), num_points,
+                                                              homography, 3);
+        benchmark::DoNotOptimize(status);
+        benchmark::DoNotOptimize(homography);
+    }
+}
+BENCHMARK(BM_getHomographyFromPoints_RANSAC_frame)->Arg(50)->Arg(200)->Arg(1000);
+
+// Arg: number of floats
+void BM_read_big_endian_array(benchmark::State &state)
+{
+    const int64_t count = state.range(0);
+    FILE *fp = tmpfile();
+    if (fp == nullptr) {
+        state.SkipWithError("cannot create a temporary file");
+        return;
+    }
+    std::vector<uint8_t> bytes(count * 4);
+    for (size_t i = 0; i < bytes.size(); i++) bytes[i] = (uint8_t)(i * 31);
+    fwrite(bytes.data(), 1, bytes.size(), fp);
+    std::vector<float> values(count);
+    for (auto _ : state) {
+        rewind(fp);
+        int64_t read = read_big_endian_array(values.data(), 32, true, count, fp);
+        benchmark::DoNotOptimize(read);
+        benchmark::DoNotOptimize(values.data());
+    }
+    fclose(fp);
+    state.SetBytesProcessed(state.iterations() * count * 4);
+}
+BENCHMARK(BM_read_big_endian_array)->Arg(1 << 16)->Arg(1 << 20);
+
+// Arg: planet
+void BM_ECEF_to_LatLongHeight(benchmark::State &state)
+{
+    const enum Planet body = (enum Planet)state.range(0);
+    const size_t num_points = 1024;
+    std::vector<double> points(num_points * 3);
+    for (size_t i = 0; i < num_points; i++) {
+        double latitude = -89.0 + 178.0 * i / num_points;
+        double longitude = -180.0 + 360.0 * ((i * 37) % num_points) / num_points;
+        LatLongHeight_to_ECEF(latitude, longitude, 1000.0 * (i % 7), &points[i * 3], body);
+    }
+    for (auto _ : state) {
+        double sum = 0;
+        for (size_t i = 0; i < num_points; i++) {
+            double latitude, longitude, height;
+            ECEF_to_LatLongHeight(&points[i * 3], &latitude, &longitude, &height, body);
+            sum += latitude + longitude + height;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * (int64_t)num_points);
+}
+BENCHMARK(BM_ECEF_to_LatLongHeight)->Arg(Earth)->Arg(Moon);
+
+/*----------------------------- End-to-end runs -------------------------------*/
+
+// equal_rectangular_WY.raw into a 500x500, 10m landmark, as tests/test_create_landmark.py
+void BM_CreateLandmark(benchmark::State &state)
+{
+    GeoTiffData dem = {};
+    dem.projection = GEOGRAPHIC;
+    dem.imageSize[0] = 1311;
+    dem.imageSize[1] = 938;
+    dem.bits_per_sample = 32;
+    dem.origin[0] = -107.5081027;
+    dem.origin[1] = 44.5936521;
+    dem.pixelSize[0] = 0.000098783643545;
+    dem.pixelSize[1] = 0.000098783643545;
+    dem.noDataValue = NAN;
+    std::vector<float> values((size_t)dem.imageSize[0] * dem.imageSize[1]);
+    FILE *fp = fopen(data_path("equal_rectangular_WY.raw").c_str(), "rb");
+    size_t count = 0;
+    if (fp != nullptr) {
+        count = fread(values.data(), sizeof(float), values.size(), fp);
+        fclose(fp);
+    }
+    if (count != values.size()) {
+        state.SkipWithError("cannot read equal_rectangular_WY.raw");
+        return;
+    }
+    dem.demValues = values.data();
+
+    for (auto _ : state) {
+        LMK lmk = {};
+        lmk.BODY = Earth;
+        lmk.num_cols = 500;
+        lmk.num_rows = 500;
+        lmk.num_pixels = (int64_t)lmk.num_cols * lmk.num_rows;
+        lmk.anchor_col = lmk.num_cols / 2.0f;
+        lmk.anchor_row = lmk.num_rows / 2.0f;
+        lmk.resolution = 10;
+        if (!allocate_lmk_arrays(&lmk, lmk.num_cols, lmk.num_rows) ||
+            !CreateLandmark(&dem, NULL, 0, 0, 44.55, -107.44, GEOGRAPHIC, &lmk, NAN)) {
+            free_lmk(&lmk);
+            state.SkipWithError("CreateLandmark failed");
+            break;
+        }
+        free_lmk(&lmk);
+    }
+}
+BENCHMARK(BM_CreateLandmark)->Unit(benchmark::kMillisecond);
+
+// Every pixel of UTM_WY.lmk_demo.lmk as a world point, gridded back onto the landmark
+void BM_point2lmk(benchmark::State &state)
+{
+    const LMK *source = gold_landmark("UTM_WY.lmk_demo.lmk");
+    if (source == nullptr) {
+        state.SkipWithError("cannot read UTM_WY.lmk_demo.lmk");
+        return;
+    }
+    std::vector<double> points;
+    std::vector<uint8_t> intensity;
+    for (int32_t r = 0; r < source->num_rows; r++) {
+        for (int32_t c = 0; c < source->num_cols; c++) {
+            float ele = source->ele[(size_t)r * source->num_cols + c];
+            if (std::isnan(ele)) continue;
+            double p[3];
+            LMK_Col_Row_Elevation2World(source, c, r, ele, p);
+            points.insert(points.end(), p, p + 3);
+            intensity.push_back(source->srm[(size_t)r * source->num_cols + c]);
+        }
+    }
+
+    for (auto _ : state) {
+        LMK grid = *source;
+        grid.ele = NULL;
+        grid.srm = NULL;
+        if (!allocate_lmk_arrays(&grid, source->num_cols, source->num_rows) ||
+            !point2lmk(points.data(), intensity.data(), intensity.size(), &grid, WORLD, true)) {
+            free_lmk(&grid);
+            state.SkipWithError("point2lmk failed");
+            break;
+        }
+        free_lmk(&grid);
+    }
+    state.SetItemsProcessed(state.iterations() * (int64_t)intensity.size());
+}
+BENCHMARK(BM_point2lmk)->Unit(benchmark::kMillisecond);
+
+// The comparison of tests/test_landmark_comparison.py
+void BM_MatchFeaturesWithLocalDistortion(benchmark::State &state)
+{
+    const LMK *child = gold_landmark("UTM_WY.lmk_demo.lmk");
+    const LMK *base = gold_landmark("equal_rectangular_WY.lmk_demo.lmk");
+    if (child == nullptr || base == nullptr) {
+        state.SkipWithError("cannot read the gold standard landmarks");
+        return;
+    }
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    CorrelationResults results;
+    if (!allocate_correlation_results(&results, child->num_pixels)) {
+        state.SkipWithError("memory allocation failed");
+        return;
+    }
+    for (auto _ : state) {
+        bool success = MatchFeaturesWithLocalDistortion(parameters, (LMK *)base, (LMK *)child, &results, 0, -1);
+        if (!success) {
+            state.SkipWithError("MatchFeaturesWithLocalDistortion failed");
+            break;
+        }
+    }
+    destroy_correlation_results(&results);
+}
+BENCHMARK(BM_MatchFeaturesWithLocalDistortion)->Unit(benchmark::kMillisecond);
+
+// Registration of the UTM landmark to the equal rectangular one, from files as landmark_registration
+void BM_RegisterLandmarks(benchmark::State &state)
+{
+    namespace fs = std::filesystem;
+    std::error_code error;
+    fs::path directory = fs::temp_directory_path(error) / "landmark_bench";
+    fs::create_directories(directory, error);
+    fs::path child = directory / "UTM_WY.lmk_demo.lmk";
+    fs::copy_file(data_path("UTM_WY.lmk_demo.lmk"), child, fs::copy_options::overwrite_existing, error);
+    if (error) {
+        state.SkipWithError("cannot copy UTM_WY.lmk_demo.lmk to a temporary directory");
+        return;
+    }
+    const std::string base = data_path("equal_rectangular_WY.lmk_demo.lmk");
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    srand(1);
+    for (auto _ : state) {
+        if (!RegisterLandmarks(parameters, base.c_str(), child.c_str())) {
+            state.SkipWithError("RegisterLandmarks failed");
+            break;
+        }
+    }
+    fs::remove_all(directory, error);
+}
+BENCHMARK(BM_RegisterLandmarks)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
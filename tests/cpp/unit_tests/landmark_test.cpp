@@ -1,6 +1,69 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "img/utils/imgutils.h"
+#include "landmark_tools/feature_selection/int_forstner_extended.h"
+#include "landmark_tools/feature_tracking/band_match.h"
+#include "landmark_tools/feature_tracking/corr_cuda.h"
+#include "landmark_tools/feature_tracking/corr_fft.h"
+#include "landmark_tools/feature_tracking/corr_image_long.h"
+#include "landmark_tools/feature_tracking/corr_kernels.h"
+#include "landmark_tools/feature_tracking/corr_kernels_fixed.h"
+#include "landmark_tools/feature_tracking/corr_subpixel.h"
+#include "landmark_tools/feature_tracking/distributed_match.h"
+#include "landmark_tools/feature_tracking/feature_match.h"
+#include "landmark_tools/feature_tracking/feature_set.h"
+#include "landmark_tools/feature_tracking/match_journal.h"
+#include "landmark_tools/feature_tracking/nan_mask.h"
+#include "landmark_tools/feature_tracking/results_raster.h"
+#include "landmark_tools/feature_tracking/splat.h"
+#include "landmark_tools/data_interpolation/interpolate_data.h"
+#include "landmark_tools/image_io/dem_tile_cache.h"
+#include "landmark_tools/image_io/image_stream.h"
+#include "landmark_tools/landmark_registration/landmark_registration.h"
 #include "landmark_tools/landmark_util/landmark.h"
+#include "landmark_tools/math/fixed_matrix.h"
+#include "landmark_tools/math/homography_util.h"
+#include "landmark_tools/math/math_utils.h"
+#include "landmark_tools/landmark_util/landmark_compact.h"
+#include "landmark_tools/landmark_util/landmark_tiled.h"
+#include "landmark_tools/landmark_util/lmk_catalog.h"
+#include "landmark_tools/landmark_util/lmk_distort.h"
+#include "landmark_tools/landmark_util/lmk_edit.h"
+#include "landmark_tools/landmark_util/lmk_height_pyramid.h"
+#include "landmark_tools/landmark_util/lmk_layers.h"
+#include "landmark_tools/landmark_util/lmk_overview.h"
+#include "landmark_tools/landmark_util/lmk_patch.h"
+#include "landmark_tools/landmark_util/lmk_render.h"
+#include "landmark_tools/landmark_util/lmk_resample.h"
+#include "landmark_tools/landmark_util/lmk_writer.h"
 #include "landmark_tools/map_projection/datum_conversion.h"
+#include "landmark_tools/map_projection/equidistant_cylindrical_projection.h"
+#include "landmark_tools/map_projection/map_projection.h"
+#include "landmark_tools/map_projection/orthographic_projection.h"
+#include "landmark_tools/map_projection/stereographic_projection.h"
+#include "landmark_tools/map_projection/utm.h"
+#include "landmark_tools/utils/endian_read_write.h"
+#include "landmark_tools/utils/log.h"
+#include "landmark_tools/utils/mem_stats.h"
+#include "landmark_tools/utils/parallel.h"
+#include "landmark_tools/utils/perf_stats.h"
+
+// Path of a scratch file in the test temporary directory
+static std::string temp_file(const char *name) {
+    return ::testing::TempDir() + name;
+}
+
+// Remove a landmark written by a test and its ascii header
+static void remove_lmk(const std::string &path) {
+    remove(path.c_str());
+    remove((path + ".txt").c_str());
+}
 
 // Test fixture for landmark tests
 class LandmarkTest : public ::testing::Test {
@@ -88,6 +151,2514 @@ TEST_F(LandmarkTest, LMK_Col_Row2World_Test) {
     EXPECT_NEAR(world_point[2], lmk->anchor_point[2], 1e-6);
 }
 
+// The batch transforms give the per point results for a row of pixels
+TEST_F(LandmarkTest, CoordinateBatchTest) {
+    const int n = 17;
+    double col[n], row[n], ele[n], p[n][3];
+    for (int k = 0; k < n; k++) {
+        col[k] = 3.25 * k;
+        row[k] = 12.0;
+        ele[k] = 0.5 * k - 4.0;
+    }
+    LMK_Col_Row_Elevation2World_Batch(lmk, col, row, ele, n, p);
+
+    double col_out[n], row_out[n], ele_out[n];
+    World2LMK_Col_Row_Ele_Batch(lmk, p, n, col_out, row_out, ele_out);
+    for (int k = 0; k < n; k++) {
+        double expected[3], c, r, e;
+        LMK_Col_Row_Elevation2World(lmk, col[k], row[k], ele[k], expected);
+        EXPECT_EQ(p[k][0], expected[0]);
+        EXPECT_EQ(p[k][1], expected[1]);
+        EXPECT_EQ(p[k][2], expected[2]);
+        World2LMK_Col_Row_Ele(lmk, expected, &c, &r, &e);
+        EXPECT_EQ(col_out[k], c);
+        EXPECT_EQ(row_out[k], r);
+        EXPECT_EQ(ele_out[k], e);
+        EXPECT_NEAR(col_out[k], col[k], 1e-6);
+        EXPECT_NEAR(ele_out[k], ele[k], 1e-6);
+    }
+}
+
+// Test write/read round trip through the bulk big endian array path
+TEST_F(LandmarkTest, WriteReadRoundTripTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->ele[i] = 0.25f * i - 100.0f;
+        lmk->srm[i] = (uint8_t)(i % 256);
+    }
+    std::string path = temp_file("roundtrip_test.lmk");
+    EXPECT_TRUE(Write_LMK(path.c_str(), lmk));
+
+    LMK read = {0};
+    EXPECT_TRUE(Read_LMK(path.c_str(), &read));
+    EXPECT_EQ(read.num_cols, lmk->num_cols);
+    EXPECT_EQ(read.num_rows, lmk->num_rows);
+    EXPECT_EQ(read.anchor_point[1], lmk->anchor_point[1]);
+    EXPECT_EQ(memcmp(read.ele, lmk->ele, sizeof(float) * lmk->num_pixels), 0);
+    EXPECT_EQ(memcmp(read.srm, lmk->srm, lmk->num_pixels), 0);
+    free_lmk(&read);
+    remove_lmk(path);
+}
+
+// Test the byte shuffle of swap_big_endian_array matches the scalar swap for every width and odd lengths
+TEST(EndianTest, SwapKernelTest) {
+    std::vector<uint8_t> bytes(8 * 37 + 3);
+    for (size_t i = 0; i < bytes.size(); i++) {
+        bytes[i] = (uint8_t)(i * 37 + 11);
+    }
+    const uint8_t widths[] = {16, 32, 64};
+    for (uint8_t width : widths) {
+        for (int64_t size : {1, 3, 8, 9, 17, 37}) {
+            std::vector<uint8_t> fast(bytes), scalar(bytes);
+            swap_big_endian_array(fast.data(), width, size);
+            swap_big_endian_array_scalar(scalar.data(), width, size);
+            EXPECT_EQ(fast, scalar) << swap_big_endian_kernel_name() << " " << (int)width << " " << size;
+        }
+    }
+    uint32_t v = 0x11223344u;
+    swap_big_endian_array_scalar(&v, 32, 1);
+    EXPECT_EQ(v, 0x44332211u);
+}
+
+// Test the tiled v4 format is read back by Read_LMK and Read_LMK_Window
+TEST_F(LandmarkTest, TiledRoundTripTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->ele[i] = 0.5f * (i % 37);
+        lmk->srm[i] = (uint8_t)(i / 3);
+    }
+    std::string path = temp_file("tiled_test.lmk");
+    EXPECT_TRUE(Write_LMK_Tiled(path.c_str(), lmk, 32, LMK_COMPRESSION_DEFLATE, LMK_ELE_FLOAT32, false));
+
+    LMK read = {0};
+    EXPECT_TRUE(Read_LMK(path.c_str(), &read));
+    EXPECT_EQ(memcmp(read.ele, lmk->ele, sizeof(float) * lmk->num_pixels), 0);
+    EXPECT_EQ(memcmp(read.srm, lmk->srm, lmk->num_pixels), 0);
+
+    LMK window = {0};
+    EXPECT_TRUE(Read_LMK_Window(path.c_str(), 20, 30, 50, 40, &window));
+    EXPECT_EQ(window.ele[0], lmk->ele[30 * lmk->num_cols + 20]);
+    EXPECT_EQ(window.srm[49 + 39 * 50], lmk->srm[69 * lmk->num_cols + 69]);
+    free_lmk(&read);
+    free_lmk(&window);
+    remove_lmk(path);
+}
+
+// Read a whole file into memory
+static std::vector<char> read_file(const std::string &path) {
+    std::vector<char> bytes;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) return bytes;
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) bytes.insert(bytes.end(), buffer, buffer + n);
+    fclose(fp);
+    return bytes;
+}
+
+// Test the streaming writer gives the same bytes as Write_LMK, for appends of uneven row counts
+TEST_F(LandmarkTest, StreamingWriterTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->ele[i] = 0.125f * i - 300.0f;
+        lmk->srm[i] = (uint8_t)(i * 13);
+    }
+    lmk->ele[17] = NAN;
+    std::string whole = temp_file("writer_whole.lmk"), streamed = temp_file("writer_streamed.lmk");
+    ASSERT_TRUE(Write_LMK(whole.c_str(), lmk));
+
+    LMK_Writer *writer = Open_LMK_Writer(streamed.c_str(), lmk);
+    ASSERT_NE(writer, nullptr);
+    const int32_t blocks[] = {1, 7, 64, 28};
+    int32_t row = 0;
+    for (int32_t nrows : blocks) {
+        ASSERT_TRUE(Append_LMK_Rows(writer, lmk->srm + (size_t)row * lmk->num_cols,
+                                    lmk->ele + (size_t)row * lmk->num_cols, nrows));
+        row += nrows;
+    }
+    ASSERT_EQ(row, lmk->num_rows);
+    ASSERT_TRUE(Close_LMK_Writer(writer));
+
+    for (const char *suffix : {"", ".txt"}) {
+        std::vector<char> expected = read_file(whole + suffix), actual = read_file(streamed + suffix);
+        ASSERT_FALSE(expected.empty()) << suffix;
+        ASSERT_EQ(actual.size(), expected.size()) << suffix;
+        EXPECT_EQ(memcmp(actual.data(), expected.data(), expected.size()), 0) << suffix;
+    }
+    remove_lmk(whole);
+    remove_lmk(streamed);
+}
+
+// Test a catalog of landmark headers finds the overlapping landmarks before and after a write/read round trip
+TEST_F(LandmarkTest, CatalogBuildQueryTest) {
+    const double offsets[] = {0.0, 1000.0, 5000.0};
+    std::vector<std::string> paths;
+    for (double offset : offsets) {
+        lmk->anchor_point[0] = 1000.0 + offset;
+        paths.push_back(temp_file(("catalog_" + std::to_string((int)offset) + ".lmk").c_str()));
+        ASSERT_TRUE(Write_LMK(paths.back().c_str(), lmk));
+    }
+    paths.push_back(temp_file("catalog_missing.lmk"));
+    std::vector<char *> names;
+    for (std::string &path : paths) names.push_back(&path[0]);
+
+    LMK_Catalog catalog;
+    ASSERT_TRUE(Build_LMK_Catalog(names.data(), (int32_t)names.size(), 10.0, &catalog));
+    EXPECT_EQ(catalog.num_entries, 3);
+
+    int32_t results[4];
+    double point[3] = {2000.0, 2000.0, 100.0};
+    ASSERT_EQ(LMK_Catalog_Query_Point(&catalog, point, 1.0, results, 4), 1);
+    EXPECT_EQ(paths[1], catalog.entries[results[0]].filename);
+    double far_point[3] = {3500.0, 2000.0, 100.0};
+    EXPECT_EQ(LMK_Catalog_Query_Point(&catalog, far_point, 1.0, results, 4), 0);
+    double bbox_min[3] = {0.0, 0.0, 0.0}, bbox_max[3] = {7000.0, 4000.0, 200.0};
+    EXPECT_EQ(LMK_Catalog_Query_Box(&catalog, bbox_min, bbox_max, results, 2), 3);
+    EXPECT_EQ(LMK_Catalog_Query_Box(&catalog, bbox_min, bbox_max, NULL, 0), 3);
+
+    std::string catalog_path = temp_file("catalog_test.cat");
+    ASSERT_TRUE(Write_LMK_Catalog(catalog_path.c_str(), &catalog));
+    LMK_Catalog read;
+    ASSERT_TRUE(Read_LMK_Catalog(catalog_path.c_str(), &read));
+    EXPECT_EQ(read.num_entries, catalog.num_entries);
+    EXPECT_EQ(read.num_nodes, catalog.num_nodes);
+    ASSERT_EQ(LMK_Catalog_Query_Point(&read, point, 1.0, results, 4), 1);
+    EXPECT_EQ(paths[1], read.entries[results[0]].filename);
+
+    free_lmk_catalog(&read);
+    free_lmk_catalog(&catalog);
+    remove(catalog_path.c_str());
+    for (size_t i = 0; i + 1 < paths.size(); i++) remove_lmk(paths[i]);
+}
+
+// Test a query visits every branch of a tree too deep for the stack of the caller, and rejects a cyclic tree
+TEST(CatalogTest, DeepTreeQueryTest) {
+    // Each internal node has 15 leaf children followed by the next internal node, which is visited first, so the
+    // leaves pending on the stack grow by 15 at each level
+    const int32_t depth = 80;
+    const int32_t leaves_per_level = LMK_CATALOG_NODE_SIZE - 1;
+    std::vector<LMK_Catalog_Entry> entries(depth * leaves_per_level + 1);
+    std::vector<LMK_Catalog_Node> nodes(depth * LMK_CATALOG_NODE_SIZE + 1);
+    const double unit_min[3] = {0.0, 0.0, 0.0}, unit_max[3] = {1.0, 1.0, 1.0};
+    int32_t next_entry = 0;
+    for (size_t n = 0; n < nodes.size(); n++) {
+        LMK_Catalog_Node &node = nodes[n];
+        std::copy(unit_min, unit_min + 3, node.bbox_min);
+        std::copy(unit_max, unit_max + 3, node.bbox_max);
+        node.leaf = (n % LMK_CATALOG_NODE_SIZE != 0) || (n == nodes.size() - 1);
+        node.first = node.leaf ? next_entry++ : (int32_t)n + 1;
+        node.count = node.leaf ? 1 : LMK_CATALOG_NODE_SIZE;
+    }
+    ASSERT_EQ(next_entry, (int32_t)entries.size());
+    for (LMK_Catalog_Entry &entry : entries) {
+        memset(&entry, 0, sizeof(entry));
+        std::copy(unit_min, unit_min + 3, entry.bbox_min);
+        std::copy(unit_max, unit_max + 3, entry.bbox_max);
+    }
+    LMK_Catalog catalog = {(int32_t)entries.size(), entries.data(), (int32_t)nodes.size(), nodes.data(), 0};
+    double point[3] = {0.5, 0.5, 0.5};
+    EXPECT_EQ(LMK_Catalog_Query_Point(&catalog, point, 0.1, NULL, 0), (int32_t)entries.size());
+
+    // The last internal node points back at the root
+    nodes[(depth - 1) * LMK_CATALOG_NODE_SIZE].first = 0;
+    nodes[(depth - 1) * LMK_CATALOG_NODE_SIZE].count = 1;
+    EXPECT_EQ(LMK_Catalog_Query_Point(&catalog, point, 0.1, NULL, 0), -1);
+}
+
+// Test an overview sidecar is used only while the landmark file it was built from is unchanged
+TEST_F(LandmarkTest, OverviewFingerprintTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->ele[i] = 0.1f * i;
+    }
+    std::string path = temp_file("overview_test.lmk");
+    std::string sidecar = path + LMK_OVERVIEW_EXTENSION;
+    EXPECT_FALSE(Write_LMK_Overviews(path.c_str(), lmk, 4));
+    ASSERT_TRUE(Write_LMK(path.c_str(), lmk));
+    ASSERT_TRUE(Write_LMK_Overviews(path.c_str(), lmk, 4));
+    ASSERT_EQ(LMK_Overview_Count(path.c_str()), 2);
+    LMK level = {0};
+    int32_t read_level = -1;
+    ASSERT_TRUE(Read_LMK_Overview(path.c_str(), 2.0, &level, &read_level));
+    EXPECT_EQ(read_level, 1);
+    EXPECT_EQ(level.num_cols, lmk->num_cols / 2);
+    free_lmk(&level);
+
+    // A change to the header of the landmark file in place makes the sidecar stale
+    FILE *fp = fopen(path.c_str(), "r+b");
+    ASSERT_NE(fp, nullptr);
+    ASSERT_EQ(fseek(fp, LMK_HEADER_SIZE - 8, SEEK_SET), 0);
+    const uint8_t changed[8] = {0x40, 0, 0, 0, 0, 0, 0, 0};
+    ASSERT_EQ(fwrite(changed, 1, sizeof(changed), fp), sizeof(changed));
+    fclose(fp);
+    EXPECT_EQ(LMK_Overview_Count(path.c_str()), 0);
+    EXPECT_FALSE(Read_LMK_Overview_Level(path.c_str(), 1, &level));
+    ASSERT_TRUE(Read_LMK_Overview(path.c_str(), 2.0, &level, &read_level));
+    EXPECT_EQ(read_level, 0);
+    EXPECT_EQ(level.num_cols, lmk->num_cols);
+    free_lmk(&level);
+
+    // So does a change of its size
+    ASSERT_TRUE(Write_LMK(path.c_str(), lmk));
+    ASSERT_TRUE(Write_LMK_Overviews(path.c_str(), lmk, 4));
+    ASSERT_EQ(LMK_Overview_Count(path.c_str()), 2);
+    fp = fopen(path.c_str(), "ab");
+    ASSERT_NE(fp, nullptr);
+    fputc(0, fp);
+    fclose(fp);
+    EXPECT_EQ(LMK_Overview_Count(path.c_str()), 0);
+
+    // Writing the landmark file again removes its sidecar
+    struct stat st;
+    ASSERT_TRUE(Write_LMK(path.c_str(), lmk));
+    ASSERT_TRUE(Write_LMK_Overviews(path.c_str(), lmk, 4));
+    ASSERT_EQ(stat(sidecar.c_str(), &st), 0);
+    ASSERT_TRUE(Write_LMK(path.c_str(), lmk));
+    EXPECT_NE(stat(sidecar.c_str(), &st), 0);
+
+    // So does a patch in place, but not opening the file for patching
+    ASSERT_TRUE(Write_LMK_Overviews(path.c_str(), lmk, 4));
+    LMK_Patch patch;
+    ASSERT_TRUE(Open_LMK_Patch(path.c_str(), &patch));
+    ASSERT_TRUE(Close_LMK_Patch(&patch));
+    EXPECT_EQ(stat(sidecar.c_str(), &st), 0);
+    ASSERT_TRUE(Open_LMK_Patch(path.c_str(), &patch));
+    const uint8_t srm[2] = {7, 7};
+    ASSERT_TRUE(LMK_Patch_SRM(&patch, 0, 0, 2, 1, srm));
+    ASSERT_TRUE(Close_LMK_Patch(&patch));
+    EXPECT_NE(stat(sidecar.c_str(), &st), 0);
+
+    remove(sidecar.c_str());
+    remove_lmk(path);
+}
+
+// Test registration pyramids use the overviews of a landmark only where they match it
+TEST_F(LandmarkTest, RegistrationPyramidFallbackTest) {
+    LMK big = {0};
+    Copy_LMK_Header(lmk, &big);
+    big.num_cols = big.num_rows = 256;
+    big.num_pixels = big.num_cols * big.num_rows;
+    ASSERT_TRUE(allocate_lmk_arrays(&big, big.num_cols, big.num_rows));
+    for (int i = 0; i < big.num_pixels; i++) {
+        big.ele[i] = 0.01f * (i % 251);
+        big.srm[i] = (uint8_t)((i * 7919) % 251);
+    }
+    std::string path = temp_file("registration_pyramid.lmk");
+    std::string sidecar = path + LMK_OVERVIEW_EXTENSION;
+    ASSERT_TRUE(Write_LMK(path.c_str(), &big));
+    ASSERT_TRUE(Write_LMK_Overviews(path.c_str(), &big, 2));
+    LMK expected = {0};
+    ASSERT_TRUE(Downsample_LMK_2x(&big, &expected));
+    size_t bytes = sizeof(float) * expected.num_pixels;
+
+    RegistrationBase base;
+    ASSERT_TRUE(prepare_registration_base(&base, path.c_str(), 2));
+    ASSERT_EQ(base.num_levels, 3);
+    EXPECT_EQ(base.levels[1].resolution, expected.resolution);
+    EXPECT_EQ(memcmp(base.levels[1].ele, expected.ele, bytes), 0);
+    free_registration_base(&base);
+
+    // A level whose header does not match the landmark is built in memory instead
+    std::vector<char> data = read_file(sidecar);
+    const char *version = LMK_VERSION_V3;
+    auto header = std::search(data.begin(), data.end(), version, version + strlen(version));
+    ASSERT_NE(header, data.end());
+    const size_t resolution_offset = LMK_VERSION_SIZE + LMK_ID_SIZE + 3 * sizeof(uint32_t) + 2 * sizeof(double);
+    header[resolution_offset] ^= 0x10;
+    FILE *fp = fopen(sidecar.c_str(), "wb");
+    ASSERT_NE(fp, nullptr);
+    ASSERT_EQ(fwrite(data.data(), 1, data.size(), fp), data.size());
+    fclose(fp);
+    LMK level = {0};
+    ASSERT_TRUE(Read_LMK_Overview_Level(path.c_str(), 1, &level));
+    EXPECT_NE(level.resolution, expected.resolution);
+    free_lmk(&level);
+
+    ASSERT_TRUE(prepare_registration_base(&base, path.c_str(), 2));
+    ASSERT_EQ(base.num_levels, 3);
+    EXPECT_EQ(base.levels[1].resolution, expected.resolution);
+    EXPECT_EQ(memcmp(base.levels[1].ele, expected.ele, bytes), 0);
+    free_registration_base(&base);
+
+    free_lmk(&expected);
+    free_lmk(&big);
+    remove(sidecar.c_str());
+    remove_lmk(path);
+}
+
+// Test the int16 elevation encoding is kept compact by Read_LMK_Compact and expanded by Read_LMK
+TEST_F(LandmarkTest, CompactEleRoundTripTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->ele[i] = -1200.0f + 0.37f * i;
+    }
+    lmk->ele[7] = NAN;
+    std::string path = temp_file("compact_test.lmk");
+    EXPECT_TRUE(Write_LMK_Tiled(path.c_str(), lmk, 32, LMK_COMPRESSION_DEFLATE, LMK_ELE_INT16, false));
+
+    LMK header = {0};
+    LMK_Compact_Ele ele = {};
+    EXPECT_TRUE(Read_LMK_Compact(path.c_str(), LMK_ELE_INT16, &header, &ele));
+    EXPECT_EQ(ele.encoding, LMK_ELE_INT16);
+    EXPECT_TRUE(std::isnan(LMK_Compact_Ele_Value(&ele, 7, 0)));
+    EXPECT_NEAR(LMK_Compact_Ele_Value(&ele, 20, 30), lmk->ele[30 * lmk->num_cols + 20], ele.scale);
+    EXPECT_NEAR(Interpolate_LMK_Compact_ELE(&ele, 20.5, 30.25), Interpolate_LMK_ELE(lmk, 20.5, 30.25), ele.scale);
+
+    LMK read = {0};
+    EXPECT_TRUE(Read_LMK(path.c_str(), &read));
+    EXPECT_NEAR(read.ele[500], lmk->ele[500], ele.scale);
+    free_lmk_compact_ele(&ele);
+    free_lmk(&header);
+    free_lmk(&read);
+    remove_lmk(path);
+}
+
+// Test the vectorized correlation kernel matches the scalar loop on windows of every width
+TEST_F(LandmarkTest, CorrDotKernelTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->srm[i] = (uint8_t)((i * 7919) % 251 + 3);
+    }
+    corr_dot_fn dot = corr_select_dot();
+    for (size_t cols = 1; cols <= 40; cols++) {
+        const uint8_t *a = &lmk->srm[3];
+        const uint8_t *b = &lmk->srm[11 * lmk->num_cols + 5];
+        EXPECT_EQ(dot(a, lmk->num_cols, b, lmk->num_cols, cols, 17),
+                  corr_dot_scalar(a, lmk->num_cols, b, lmk->num_cols, cols, 17));
+    }
+}
+
+// Test the kernels specialized for common window sizes match the scalar loop at every offset
+TEST_F(LandmarkTest, CorrFixedKernelTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->srm[i] = (uint8_t)((i * 7919) % 251 + 3);
+    }
+    EXPECT_EQ(corr_select_fixed(15, 15, 40, 40), nullptr);
+    const size_t template_size = 15, search_size = 37;
+    const size_t offsets = search_size - template_size + 1;
+    corr_sumab_fn fixed = corr_select_fixed(template_size, template_size, search_size, search_size);
+    ASSERT_NE(fixed, nullptr);
+    const uint8_t *a = &lmk->srm[3];
+    const uint8_t *b = &lmk->srm[11 * lmk->num_cols + 5];
+    std::vector<double> sumab(offsets * offsets);
+    fixed(a, lmk->num_cols, b, lmk->num_cols, sumab.data());
+    for (size_t r = 0; r < offsets; r++) {
+        for (size_t c = 0; c < offsets; c++) {
+            EXPECT_EQ(sumab[r * offsets + c], (double)corr_dot_scalar(a, lmk->num_cols, b + r * lmk->num_cols + c,
+                                                                      lmk->num_cols, template_size, template_size));
+        }
+    }
+}
+
+// Test the pruned correlation search finds the same match as the exhaustive search
+TEST_F(LandmarkTest, CorrPrunedSearchTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->srm[i] = (uint8_t)((i * 7919) % 251 + 3);
+    }
+    double row1, col1, val1, covar1[3];
+    double row2, col2, val2, covar2[3];
+    ASSERT_TRUE(corimg_long(lmk->srm, lmk->num_cols, 40, 40, 15, 15,
+                            lmk->srm, lmk->num_cols, 30, 28, 35, 37, &row1, &col1, &val1, covar1));
+    ASSERT_TRUE(corimg_long_pruned(lmk->srm, lmk->num_cols, 40, 40, 15, 15,
+                                   lmk->srm, lmk->num_cols, 30, 28, 35, 37, 0.3, &row2, &col2, &val2, covar2));
+    EXPECT_EQ(row1, row2);
+    EXPECT_EQ(col1, col2);
+    EXPECT_EQ(val1, val2);
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(covar1[i], covar2[i]);
+    }
+}
+
+// Pseudo-random 8 bit image, the same for every call with the same seed
+static std::vector<uint8_t> random_image(size_t pixels, uint32_t seed) {
+    std::vector<uint8_t> image(pixels);
+    for (uint8_t &pixel : image) {
+        seed = seed * 1664525u + 1013904223u;
+        pixel = (uint8_t)(seed >> 24);
+    }
+    return image;
+}
+
+// Test the FFT path gives the sums and matches of the direct search, and is only chosen above its threshold
+TEST(CorrFftTest, MatchesDirectTest) {
+    const size_t width = 160;
+    std::vector<uint8_t> image = random_image(width * width, 7);
+
+    // Odd sizes and sizes the transform pads to a 2, 3, 5 smooth length
+    const size_t sizes[][4] = {{1, 1, 5, 3}, {7, 5, 23, 19}, {9, 9, 31, 17}, {15, 13, 41, 29}, {6, 11, 6, 11}};
+    for (const size_t *s : sizes) {
+        size_t offsets_cols = s[2] - s[0] + 1, offsets_rows = s[3] - s[1] + 1;
+        std::vector<double> sumab(offsets_cols * offsets_rows);
+        const uint8_t *img1 = &image[50 * width + 60];
+        const uint8_t *img2 = &image[40 * width + 45];
+        ASSERT_TRUE(corr_fft_sumab(img1, width, s[0], s[1], img2, width, s[2], s[3], sumab.data()));
+        for (size_t r = 0; r < offsets_rows; r++) {
+            for (size_t c = 0; c < offsets_cols; c++) {
+                double direct = (double)corr_dot_scalar(img1, width, img2 + r * width + c, width, s[0], s[1]);
+                ASSERT_EQ(sumab[r * offsets_cols + c], direct) << s[0] << "x" << s[1] << " in " << s[2] << "x" << s[3];
+            }
+        }
+    }
+
+    // Below CORR_FFT_MIN_WORK the direct kernel is always used, above it the cost model decides
+    EXPECT_FALSE(corr_use_fft(15, 15, 35, 37));
+    EXPECT_FALSE(corr_use_fft(64, 64, 63, 200));
+    EXPECT_LT(65.0 * 63 * 64 * 64, (double)CORR_FFT_MIN_WORK);
+    EXPECT_FALSE(corr_use_fft(64, 64, 128, 126));
+    EXPECT_GT(65.0 * 64 * 64 * 64, (double)CORR_FFT_MIN_WORK);
+    EXPECT_TRUE(corr_use_fft(64, 64, 128, 127));
+    EXPECT_FALSE(corr_use_fft(3, 3, 2000, 2000));
+
+    // A search on the FFT path finds what the exhaustive direct search finds, bit for bit
+    ASSERT_TRUE(corr_use_fft(64, 64, 128, 127));
+    double row1, col1, val1, covar1[3];
+    double row2, col2, val2, covar2[3];
+    ASSERT_TRUE(corimg_long(image.data(), width, 60, 55, 64, 64,
+                            image.data(), width, 30, 20, 128, 127, &row1, &col1, &val1, covar1));
+    ASSERT_TRUE(corimg_long_pruned(image.data(), width, 60, 55, 64, 64,
+                                   image.data(), width, 30, 20, 128, 127, -1.0, &row2, &col2, &val2, covar2));
+    EXPECT_EQ(row1, row2);
+    EXPECT_EQ(col1, col2);
+    EXPECT_EQ(val1, val2);
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(covar1[i], covar2[i]);
+    }
+    EXPECT_NEAR(row1, 55 + 31.5, 0.5);
+    EXPECT_NEAR(col1, 60 + 31.5, 0.5);
+}
+
+// Score of one offset the way corimg_long computed it before its sums were kept in integers
+static double float_corr_score(const uint8_t *a, size_t stride_a, const uint8_t *b, size_t stride_b,
+                               size_t cols, size_t rows) {
+    long n = (long)(cols * rows);
+    double suma = 0, sumasq = 0, sumb = 0, sumbsq = 0, sumabsq = 0;
+    for (size_t r = 0; r < rows; r++) {
+        for (size_t c = 0; c < cols; c++) {
+            unsigned long pa = a[r * stride_a + c], pb = b[r * stride_b + c];
+            suma += pa;
+            sumasq += pa * pa;
+            sumb += pb;
+            sumbsq += pb * pb;
+            sumabsq += (pa + pb) * (pa + pb);
+        }
+    }
+    double normsumasq = sumasq - suma * suma / n;
+    double normsumbsq = sumbsq - sumb * sumb / n;
+    long normsumab = (long)(sumabsq - sumasq - sumbsq - 2 * suma * sumb / n);
+    return ((double) normsumab) / ((double) (normsumasq + normsumbsq));
+}
+
+// Test the integer sums give exactly the floating point scores for templates of up to 2^18 pixels
+TEST(CorrIntegerTest, MatchesFloatScoresTest) {
+    const size_t width = 600;
+    std::vector<uint8_t> image = random_image(width * width, 13);
+
+    // Direct, fixed-size kernel, FFT and the largest template the exactness bound covers
+    const size_t sizes[][4] = {{7, 5, 23, 19}, {11, 11, 21, 21}, {15, 15, 35, 37}, {64, 64, 128, 127},
+                               {512, 512, 516, 515}};
+    for (const size_t *s : sizes) {
+        size_t offsets_cols = s[2] - s[0] + 1, offsets_rows = s[3] - s[1] + 1;
+        const uint8_t *img1 = &image[40 * width + 30];
+        const uint8_t *img2 = &image[20 * width + 10];
+
+        std::vector<double> expected(offsets_cols * offsets_rows);
+        size_t best = 0;
+        for (size_t r = 0; r < offsets_rows; r++) {
+            for (size_t c = 0; c < offsets_cols; c++) {
+                expected[r * offsets_cols + c] = float_corr_score(img1, width, img2 + r * width + c, width, s[0], s[1]);
+                if (expected[r * offsets_cols + c] > expected[best]) best = r * offsets_cols + c;
+            }
+        }
+
+        std::vector<CorrPeak> peaks(offsets_cols * offsets_rows);
+        int32_t num_peaks = corimg_long_peaks(image.data(), width, 30, 40, s[0], s[1],
+                                              image.data(), width, 10, 20, s[2], s[3],
+                                              peaks.data(), (int32_t)peaks.size());
+        ASSERT_GT(num_peaks, 0) << s[0] << "x" << s[1] << " in " << s[2] << "x" << s[3];
+        for (int32_t i = 0; i < num_peaks; i++) {
+            ASSERT_EQ(peaks[i].val, expected[peaks[i].row * offsets_cols + peaks[i].col])
+                << s[0] << "x" << s[1] << " in " << s[2] << "x" << s[3] << " peak " << i;
+        }
+        EXPECT_EQ(peaks[0].row * offsets_cols + peaks[0].col, best) << s[0] << "x" << s[1] << " in " << s[2] << "x" << s[3];
+    }
+}
+
+#ifdef WITH_CUDA
+// Test the CUDA backend finds what the CPU batch finds, including searches it must reject
+TEST(CorrCudaTest, MatchesCpuBatchTest) {
+    if (!corr_cuda_available()) {
+        GTEST_SKIP() << "no CUDA device";
+    }
+    const size_t width = 200;
+    std::vector<uint8_t> image = random_image(width * width, 11);
+    std::vector<uint8_t> flat(15 * 15, 77);
+    CorrDeviceImage *device = corr_cuda_upload(image.data(), width, width, width);
+    ASSERT_NE(device, nullptr);
+
+    std::vector<CorrTask> tasks;
+    for (size_t i = 0; i < 40; i++) {
+        CorrTask task = {0};
+        task.img1 = image.data();
+        task.rowBytes1 = width;
+        task.cols1 = 11 + 2 * (i % 4);
+        task.rows1 = 9 + 2 * (i % 3);
+        task.left1 = 20 + 3 * i;
+        task.top1 = 30 + 2 * i;
+        task.img2 = image.data();
+        task.rowBytes2 = width;
+        task.cols2 = task.cols1 + 20 + i % 5;
+        task.rows2 = task.rows1 + 18 + i % 7;
+        task.left2 = task.left1 - 9 - i % 3;
+        task.top2 = task.top1 - 8 - i % 5;
+        task.subpixel_model = (i < 30) ? CORR_SUBPIXEL_QUADRATIC : CORR_SUBPIXEL_TAYLOR;
+        tasks.push_back(task);
+    }
+    // A template without contrast, and one whose best offset is on the border of its search
+    tasks[5].img1 = flat.data();
+    tasks[5].rowBytes1 = 15;
+    tasks[5].left1 = tasks[5].top1 = 0;
+    tasks[9].left2 = tasks[9].left1;
+    tasks[9].top2 = tasks[9].top1;
+
+    std::vector<CorrResult> cpu(tasks.size()), gpu(tasks.size());
+    ASSERT_TRUE(corimg_long_batch(tasks.data(), tasks.size(), cpu.data()));
+    ASSERT_TRUE(corr_cuda_batch(device, tasks.data(), tasks.size(), gpu.data()));
+    EXPECT_FALSE(gpu[5].success);
+    for (size_t i = 0; i < tasks.size(); i++) {
+        ASSERT_EQ(gpu[i].success, cpu[i].success) << i;
+        if (!cpu[i].success) continue;
+        EXPECT_EQ(gpu[i].bestrow, cpu[i].bestrow) << i;
+        EXPECT_EQ(gpu[i].bestcol, cpu[i].bestcol) << i;
+        EXPECT_EQ(gpu[i].bestval, cpu[i].bestval) << i;
+        for (int k = 0; k < 3; k++) {
+            EXPECT_EQ(gpu[i].covar[k], cpu[i].covar[k]) << i;
+        }
+    }
+
+    // A task that does not search the uploaded image is left to the CPU
+    std::vector<uint8_t> other(image);
+    tasks[0].img2 = other.data();
+    EXPECT_FALSE(corr_cuda_batch(device, tasks.data(), tasks.size(), gpu.data()));
+    corr_cuda_free(device);
+}
+#endif
+
+// Test the batched subpixel refinement against subpixel_long and against surfaces each model fits exactly
+TEST_F(LandmarkTest, CorrSubpixelBatchTest) {
+    const size_t n = 37;
+    CorrSubpixelBatch batch = {0};
+    ASSERT_TRUE(corr_subpixel_batch_reserve(&batch, n));
+    double cbuff[n][9];
+    for (size_t i = 0; i < n; i++) {
+        for (int32_t k = 0; k < 9; k++) {
+            double x = k % 3 - 1.0 - 0.03 * (i % 7), y = k / 3 - 1.0 + 0.05 * (i % 5);
+            cbuff[i][k] = 0.9 - 0.2 * x * x - 0.15 * y * y + 0.03 * x * y + 0.01 * ((i * 31 + k * 17) % 13) / 13.0;
+        }
+        if (i == 11) cbuff[i][0] = 2.0;  // not a strong maximum
+        ASSERT_TRUE(corr_subpixel_gather(&batch, cbuff[i], 3, 3, 1, 1));
+    }
+    EXPECT_FALSE(corr_subpixel_gather(&batch, cbuff[0], 3, 3, 0, 1));
+    EXPECT_EQ(batch.count, n);
+
+    // The quadratic model gives what subpixel_long gives, bit for bit
+    corr_subpixel_refine(CORR_SUBPIXEL_QUADRATIC, &batch);
+    for (size_t i = 0; i < n; i++) {
+        double row, col, val, covar[3];
+        bool accepted = subpixel_long(1, 1, 3, 3, cbuff[i], &row, &col, &val, covar);
+        EXPECT_EQ(batch.accepted[i] != 0, accepted) << i;
+        if (!accepted) continue;
+        EXPECT_EQ(1 + batch.sub_row[i], row);
+        EXPECT_EQ(1 + batch.sub_col[i], col);
+        EXPECT_EQ(batch.val[i], val);
+        for (int32_t k = 0; k < 3; k++) {
+            EXPECT_EQ(batch.covar[k][i], covar[k]);
+        }
+    }
+    EXPECT_FALSE(batch.accepted[11]);
+
+    // The vector kernel and the scalar loop of the remaining peaks agree
+    for (int32_t model = 0; model < CORR_SUBPIXEL_NUM_MODELS; model++) {
+        corr_subpixel_refine((CorrSubpixelModel)model, &batch);
+        std::vector<double> sub_row(batch.sub_row, batch.sub_row + n), val(batch.val, batch.val + n);
+        size_t count = batch.count;
+        for (size_t i = 0; i < n; i++) {
+            CorrSubpixelBatch one = batch;
+            for (int32_t k = 0; k < 9; k++) one.scores[k] += i;
+            one.sub_row += i;
+            one.sub_col += i;
+            one.val += i;
+            for (int32_t k = 0; k < 3; k++) one.covar[k] += i;
+            one.accepted += i;
+            one.count = 1;
+            corr_subpixel_refine((CorrSubpixelModel)model, &one);
+        }
+        batch.count = count;
+        for (size_t i = 0; i < n; i++) {
+            EXPECT_EQ(batch.sub_row[i], sub_row[i]) << corr_subpixel_model_name(model) << " " << i;
+            EXPECT_EQ(batch.val[i], val[i]) << corr_subpixel_model_name(model) << " " << i;
+        }
+    }
+
+    // Each model recovers the peak of a surface of its own form
+    const double peak_x = 0.3, peak_y = -0.2;
+    for (int32_t model = 0; model < CORR_SUBPIXEL_NUM_MODELS; model++) {
+        batch.count = 0;
+        double q[9];
+        for (int32_t k = 0; k < 9; k++) {
+            double dx = k % 3 - 1.0 - peak_x, dy = k / 3 - 1.0 - peak_y;
+            q[k] = (model == CORR_SUBPIXEL_GAUSSIAN) ? 0.8 * exp(-dx * dx / 1.5 - dy * dy / 2.0)
+                 : (model == CORR_SUBPIXEL_PARABOLIC) ? 0.8 - 0.3 * dx * dx - 0.2 * dy * dy
+                 : 0.8 - 0.3 * dx * dx - 0.2 * dy * dy + 0.1 * dx * dy;
+        }
+        ASSERT_TRUE(corr_subpixel_gather(&batch, q, 3, 3, 1, 1));
+        corr_subpixel_refine((CorrSubpixelModel)model, &batch);
+        ASSERT_TRUE(batch.accepted[0]) << corr_subpixel_model_name(model);
+        EXPECT_NEAR(batch.sub_col[0], peak_x, 1e-12) << corr_subpixel_model_name(model);
+        EXPECT_NEAR(batch.sub_row[0], peak_y, 1e-12) << corr_subpixel_model_name(model);
+        EXPECT_NEAR(batch.val[0], 0.8, 1e-12) << corr_subpixel_model_name(model);
+        EXPECT_GT(batch.covar[0][0], 0.0);
+        EXPECT_GT(batch.covar[2][0], 0.0);
+    }
+    corr_subpixel_batch_free(&batch);
+    EXPECT_EQ(batch.arena, nullptr);
+
+    // corimg_long_batch refines its peaks together and still matches corimg_long
+    uint32_t state = 12345;
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        state = state * 1664525u + 1013904223u;
+        lmk->srm[i] = (uint8_t)(state >> 24);
+    }
+    std::vector<CorrTask> tasks(21);
+    for (size_t i = 0; i < tasks.size(); i++) {
+        CorrTask task = {0};
+        task.img1 = lmk->srm;
+        task.rowBytes1 = lmk->num_cols;
+        task.left1 = 30 + i;
+        task.top1 = 35 + 2 * i;
+        task.cols1 = task.rows1 = 15;
+        task.img2 = lmk->srm;
+        task.rowBytes2 = lmk->num_cols;
+        task.left2 = 22 + i;
+        task.top2 = 28 + 2 * i;
+        task.cols2 = task.rows2 = 31;
+        task.subpixel_model = (i < 14) ? CORR_SUBPIXEL_QUADRATIC : CORR_SUBPIXEL_TAYLOR;
+        tasks[i] = task;
+    }
+    std::vector<CorrResult> results(tasks.size());
+    ASSERT_TRUE(corimg_long_batch_threads(NULL, tasks.data(), tasks.size(), results.data(), 2));
+    for (size_t i = 0; i < 14; i++) {
+        double row, col, val, covar[3];
+        bool success = corimg_long(tasks[i].img1, tasks[i].rowBytes1, tasks[i].left1, tasks[i].top1, 15, 15,
+                                   tasks[i].img2, tasks[i].rowBytes2, tasks[i].left2, tasks[i].top2, 31, 31,
+                                   &row, &col, &val, covar);
+        ASSERT_EQ(results[i].success, success) << i;
+        if (!success) continue;
+        EXPECT_EQ(results[i].bestrow, row);
+        EXPECT_EQ(results[i].bestcol, col);
+        EXPECT_EQ(results[i].bestval, val);
+        for (int32_t k = 0; k < 3; k++) {
+            EXPECT_EQ(results[i].covar[k], covar[k]);
+        }
+    }
+    // The template is found where it was cut with every model
+    for (size_t i = 0; i < tasks.size(); i++) {
+        ASSERT_TRUE(results[i].success) << i;
+        EXPECT_NEAR(results[i].bestrow, tasks[i].top1 + 7, 0.5) << i;
+        EXPECT_NEAR(results[i].bestcol, tasks[i].left1 + 7, 0.5) << i;
+    }
+}
+
+// Test matching into a grid and reusing the grid gives the same results as matching every block
+TEST_F(LandmarkTest, MatchGridReuseTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->srm[i] = (uint8_t)((i * 7919) % 251 + 3);
+    }
+    LMK* child = new LMK;
+    memset(child, 0, sizeof(LMK));
+    ASSERT_TRUE(Copy_LMK(lmk, child));
+    for (int i = 0; i < child->num_pixels; i++) {
+        child->srm[i] = lmk->srm[(i + 2 * lmk->num_cols + 1) % lmk->num_pixels];
+    }
+    
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    parameters.matching.correlation_window_size = 11;
+    parameters.matching.search_window_size = 21;
+    parameters.sliding.block_size = 40;
+    parameters.sliding.step_size = 5;
+    parameters.sliding.min_n_features = 5;
+    parameters.sliding.num_threads = 2;
+    
+    CorrelationResults expected, first, reused;
+    ASSERT_TRUE(allocate_correlation_results(&expected, child->num_pixels));
+    ASSERT_TRUE(allocate_correlation_results(&first, child->num_pixels));
+    ASSERT_TRUE(allocate_correlation_results(&reused, child->num_pixels));
+    srand(1);
+    ASSERT_TRUE(MatchFeaturesWithLocalDistortion(parameters, lmk, child, &expected, 0, 0));
+    
+    MatchGrid grid;
+    ASSERT_TRUE(allocate_match_grid(&grid, &parameters, child->num_cols, child->num_rows));
+    srand(1);
+    ASSERT_TRUE(MatchFeaturesWithLocalDistortion_grid(parameters, lmk, child, &first, 0, 0, &grid));
+    for (int b = 0; b < grid.num_blocks; b++) {
+        EXPECT_TRUE(grid.block_matched[b]);
+    }
+    srand(1);
+    ASSERT_TRUE(MatchFeaturesWithLocalDistortion_grid(parameters, lmk, child, &reused, 0, 0, &grid));
+    
+    size_t bytes = sizeof(float) * child->num_pixels;
+    EXPECT_EQ(memcmp(expected.delta_x, first.delta_x, bytes), 0);
+    EXPECT_EQ(memcmp(expected.correlation, first.correlation, bytes), 0);
+    EXPECT_EQ(memcmp(expected.delta_x, reused.delta_x, bytes), 0);
+    EXPECT_EQ(memcmp(expected.correlation, reused.correlation, bytes), 0);
+    
+    free_match_grid(&grid);
+    destroy_correlation_results(&expected);
+    destroy_correlation_results(&first);
+    destroy_correlation_results(&reused);
+    free_lmk(child);
+    delete child;
+}
+
+// Test matching blocks on several threads gives exactly the results of matching them on one
+TEST_F(LandmarkTest, MatchThreadCountTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->srm[i] = (uint8_t)((i * 7919) % 251 + 3);
+    }
+    LMK* child = new LMK;
+    memset(child, 0, sizeof(LMK));
+    ASSERT_TRUE(Copy_LMK(lmk, child));
+    for (int i = 0; i < child->num_pixels; i++) {
+        child->srm[i] = lmk->srm[(i + 2 * lmk->num_cols + 1) % lmk->num_pixels];
+    }
+
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    parameters.matching.correlation_window_size = 11;
+    parameters.matching.search_window_size = 21;
+    parameters.sliding.block_size = 40;
+    parameters.sliding.step_size = 5;
+    parameters.sliding.min_n_features = 5;
+
+    CorrelationResults serial;
+    ASSERT_TRUE(allocate_correlation_results(&serial, child->num_pixels));
+    parameters.sliding.num_threads = 1;
+    srand(1);
+    ASSERT_TRUE(MatchFeaturesWithLocalDistortion(parameters, lmk, child, &serial, 0, 0));
+
+    size_t bytes = sizeof(float) * child->num_pixels;
+    const int32_t thread_counts[] = {2, 4, 7, 0};
+    for (int32_t num_threads : thread_counts) {
+        CorrelationResults parallel;
+        ASSERT_TRUE(allocate_correlation_results(&parallel, child->num_pixels));
+        parameters.sliding.num_threads = num_threads;
+        srand(1);
+        ASSERT_TRUE(MatchFeaturesWithLocalDistortion(parameters, lmk, child, &parallel, 0, 0));
+        EXPECT_EQ(memcmp(serial.delta_x, parallel.delta_x, bytes), 0) << num_threads << " threads";
+        EXPECT_EQ(memcmp(serial.delta_y, parallel.delta_y, bytes), 0) << num_threads << " threads";
+        EXPECT_EQ(memcmp(serial.delta_z, parallel.delta_z, bytes), 0) << num_threads << " threads";
+        EXPECT_EQ(memcmp(serial.correlation, parallel.correlation, bytes), 0) << num_threads << " threads";
+        destroy_correlation_results(&parallel);
+    }
+
+    destroy_correlation_results(&serial);
+    free_lmk(child);
+    delete child;
+}
+
+TEST_F(LandmarkTest, MatchJournalResumeTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->srm[i] = (uint8_t)((i * 7919) % 251 + 3);
+    }
+    LMK* child = new LMK;
+    memset(child, 0, sizeof(LMK));
+    ASSERT_TRUE(Copy_LMK(lmk, child));
+    for (int i = 0; i < child->num_pixels; i++) {
+        child->srm[i] = lmk->srm[(i + 2 * lmk->num_cols + 1) % lmk->num_pixels];
+    }
+    
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    parameters.matching.correlation_window_size = 11;
+    parameters.matching.search_window_size = 21;
+    parameters.sliding.block_size = 40;
+    parameters.sliding.step_size = 5;
+    parameters.sliding.min_n_features = 5;
+    
+    CorrelationResults expected, resumed;
+    ASSERT_TRUE(allocate_correlation_results(&expected, child->num_pixels));
+    ASSERT_TRUE(allocate_correlation_results(&resumed, child->num_pixels));
+    srand(1);
+    ASSERT_TRUE(MatchFeaturesWithLocalDistortion(parameters, lmk, child, &expected, 0, 0));
+    
+    // A whole run journals every block
+    std::string path = temp_file("match_journal.bin");
+    remove(path.c_str());
+    MatchGrid grid;
+    MatchJournal journal;
+    ASSERT_TRUE(allocate_match_grid(&grid, &parameters, child->num_cols, child->num_rows));
+    ASSERT_TRUE(open_match_journal(&journal, path.c_str(), &parameters, lmk, child, 0, 0, &grid, 0));
+    EXPECT_EQ(journal.restored_blocks, 0);
+    grid.journal = &journal;
+    srand(1);
+    ASSERT_TRUE(MatchFeaturesWithLocalDistortion_grid(parameters, lmk, child, &resumed, 0, 0, &grid));
+    ASSERT_TRUE(close_match_journal(&journal));
+    int32_t num_blocks = grid.num_blocks;
+    free_match_grid(&grid);
+    
+    // A run stopped in the middle of writing its last block resumes from the others
+    struct stat st;
+    ASSERT_EQ(stat(path.c_str(), &st), 0);
+    ASSERT_EQ(truncate(path.c_str(), st.st_size - 20), 0);
+    ASSERT_TRUE(allocate_match_grid(&grid, &parameters, child->num_cols, child->num_rows));
+    ASSERT_TRUE(open_match_journal(&journal, path.c_str(), &parameters, lmk, child, 0, 0, &grid, 0));
+    EXPECT_EQ(journal.restored_blocks, num_blocks - 1);
+    EXPECT_FALSE(grid.block_matched[num_blocks - 1]);
+    grid.journal = &journal;
+    srand(1);
+    ASSERT_TRUE(MatchFeaturesWithLocalDistortion_grid(parameters, lmk, child, &resumed, 0, 0, &grid));
+    ASSERT_TRUE(close_match_journal(&journal));
+    free_match_grid(&grid);
+    
+    size_t bytes = sizeof(float) * child->num_pixels;
+    EXPECT_EQ(memcmp(expected.delta_x, resumed.delta_x, bytes), 0);
+    EXPECT_EQ(memcmp(expected.delta_y, resumed.delta_y, bytes), 0);
+    EXPECT_EQ(memcmp(expected.correlation, resumed.correlation, bytes), 0);
+    
+    // The journal of another comparison is refused
+    ASSERT_TRUE(allocate_match_grid(&grid, &parameters, child->num_cols, child->num_rows));
+    ASSERT_TRUE(open_match_journal(&journal, path.c_str(), &parameters, lmk, child, 0, 0, &grid, 0));
+    EXPECT_EQ(journal.restored_blocks, num_blocks);
+    ASSERT_TRUE(close_match_journal(&journal));
+    child->srm[0]++;
+    EXPECT_FALSE(open_match_journal(&journal, path.c_str(), &parameters, lmk, child, 0, 0, &grid, 0));
+    free_match_grid(&grid);
+    remove(path.c_str());
+    
+    destroy_correlation_results(&expected);
+    destroy_correlation_results(&resumed);
+    free_lmk(child);
+    delete child;
+}
+
+TEST_F(LandmarkTest, SplatSingleFeatureTest) {
+    const double delta[3] = {1.5, -2.0, 0.25};
+    for (bool separable : {false, true}) {
+        SplatAccumulator splat;
+        ASSERT_TRUE(splat_init(&splat, 20, 10, 3, separable));
+        splat_add(&splat, 1.7, 4.2, delta, 0.8);
+        
+        CorrelationResults results;
+        ASSERT_TRUE(allocate_correlation_results(&results, 20 * 10));
+        ASSERT_TRUE(splat_finish(&splat, &results));
+        for (int row = 0; row < 10; row++) {
+            for (int col = 0; col < 20; col++) {
+                int index = row * 20 + col;
+                if (col <= 4 && row >= 1 && row <= 7) {
+                    EXPECT_FLOAT_EQ(results.delta_x[index], 1.5f);
+                    EXPECT_FLOAT_EQ(results.delta_y[index], -2.0f);
+                    EXPECT_FLOAT_EQ(results.delta_z[index], 0.25f);
+                    EXPECT_FLOAT_EQ(results.correlation[index], 0.8f);
+                } else {
+                    EXPECT_TRUE(std::isnan(results.delta_x[index]));
+                    EXPECT_TRUE(std::isnan(results.correlation[index]));
+                }
+            }
+        }
+        destroy_correlation_results(&results);
+        splat_free(&splat);
+    }
+}
+
+// Test that rows normalized as the features come in match a single pass at the end, with the same filtering
+TEST_F(LandmarkTest, SplatFinishRowsTest) {
+    const int cols = 300, rows = 260;
+    std::vector<float> expected[4];
+    for (int pass = 0; pass < 2; pass++) {
+        SplatAccumulator splat;
+        ASSERT_TRUE(splat_init(&splat, cols, rows, 4, false));
+        CorrelationResults results;
+        ASSERT_TRUE(allocate_correlation_results(&results, cols * rows));
+        for (int row = 0; row < rows; row += 3) {
+            if (pass == 1 && row % 30 == 0) splat_finish_rows(&splat, &results, row, 6.0);
+            for (int col = row % 5; col < cols; col += 7) {
+                const double delta[3] = {(col % 13) - 6.5, (row % 11) - 5.0, 0.01 * col};
+                splat_add(&splat, col, row, delta, 0.5 + 0.001 * row);
+            }
+        }
+        EXPECT_EQ(splat.finished_rows, pass == 1 ? 240 - 4 : 0);
+        ASSERT_TRUE(splat_finish_filtered(&splat, &results, 6.0));
+        float *maps[4] = {results.delta_x, results.delta_y, results.delta_z, results.correlation};
+        for (int k = 0; k < 4; k++) {
+            if (pass == 0) {
+                expected[k].assign(maps[k], maps[k] + cols * rows);
+            } else {
+                EXPECT_EQ(memcmp(expected[k].data(), maps[k], sizeof(float) * cols * rows), 0);
+            }
+        }
+        for (int i = 0; i < cols * rows; i++) {
+            EXPECT_FALSE(fabsf(results.delta_x[i]) > 6.0f);
+        }
+        destroy_correlation_results(&results);
+        splat_free(&splat);
+    }
+}
+
+// Test that a list of matches grows and densifies to the maps of its features
+TEST_F(LandmarkTest, SparseMatchesDensifyTest) {
+    SparseMatches matches;
+    ASSERT_TRUE(allocate_sparse_matches(&matches, 1));
+    const double deltas[3][3] = {{1.0, 2.0, 3.0}, {-1.0, 0.5, 0.0}, {500.0, 0.0, 0.0}};
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(sparse_matches_append(&matches, 2 + i * 8, 3, 2.5 + i * 8, 3.5, deltas[i], 0.9, i));
+    }
+    ASSERT_EQ(matches.count, 3u);
+    EXPECT_EQ(matches.child_col[2], 18);
+    EXPECT_DOUBLE_EQ(matches.base_col[1], 10.5);
+    EXPECT_EQ(matches.block[1], 1);
+    
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    parameters.sliding.feature_influence_window = 2;
+    parameters.sliding.max_delta_map = 100;
+    CorrelationResults results;
+    ASSERT_TRUE(allocate_correlation_results(&results, 24 * 8));
+    ASSERT_TRUE(densify_sparse_matches(parameters, &matches, 24, 8, &results));
+    EXPECT_FLOAT_EQ(results.delta_x[3 * 24 + 2], 1.0f);
+    EXPECT_FLOAT_EQ(results.delta_z[3 * 24 + 2], 3.0f);
+    EXPECT_FLOAT_EQ(results.delta_y[3 * 24 + 10], 0.5f);
+    EXPECT_TRUE(std::isnan(results.delta_x[3 * 24 + 18]));
+    EXPECT_FLOAT_EQ(results.correlation[3 * 24 + 18], 0.9f);
+    EXPECT_TRUE(std::isnan(results.delta_x[7 * 24 + 23]));
+    destroy_correlation_results(&results);
+    destroy_sparse_matches(&matches);
+}
+
+TEST_F(LandmarkTest, NanMaskCountTest) {
+    const int cols = 130, rows = 40;
+    std::vector<float> values(cols * rows, 0.0f);
+    srand(2);
+    for (size_t i = 0; i < values.size(); i++) {
+        if (rand() % 5 == 0) values[i] = NAN;
+    }
+    NanMask packed, counted;
+    ASSERT_TRUE(nan_mask_from_floats(&packed, values.data(), cols, rows, false));
+    ASSERT_TRUE(nan_mask_from_floats(&counted, values.data(), cols, rows, true));
+    for (int trial = 0; trial < 500; trial++) {
+        int left = rand() % (cols + 20) - 10, top = rand() % (rows + 20) - 10;
+        int width = rand() % 80, height = rand() % 30;
+        int expected = 0;
+        for (int row = top; row < top + height; row++) {
+            for (int col = left; col < left + width; col++) {
+                bool inside = col >= 0 && col < cols && row >= 0 && row < rows;
+                if (!inside || std::isnan(values[row * cols + col])) expected++;
+            }
+        }
+        EXPECT_EQ(nan_mask_count(&packed, left, top, width, height), expected);
+        EXPECT_EQ(nan_mask_count(&counted, left, top, width, height), expected);
+    }
+    nan_mask_free(&packed);
+    nan_mask_free(&counted);
+}
+
+TEST_F(LandmarkTest, RansacSeededTest) {
+    // Grid of points moved by a homography, one in five moved off it
+    const int n = 81;
+    double pre[2 * n], cur[2 * n], scores[n];
+    double truth[3][3] = {{1.01, 0.02, 3.0}, {-0.01, 0.99, -2.0}, {1e-5, 2e-5, 1.0}};
+    int outliers = 0;
+    for (int i = 0; i < n; i++) {
+        pre[2 * i] = (i % 9) * 5.0;
+        pre[2 * i + 1] = (i / 9) * 5.0;
+        homographyTransfer33D(truth, &pre[2 * i], &cur[2 * i]);
+        scores[i] = 0.9;
+        if (i % 5 == 2) {
+            cur[2 * i] += 8.0;
+            scores[i] = 0.4;
+            outliers++;
+        }
+    }
+    
+    RansacScratch scratch = {0};
+    for (bool prosac : {false, true}) {
+        double h[2][3][3];
+        for (int run = 0; run < 2; run++) {
+            RansacRng rng;
+            ransac_rng_seed(&rng, 42);
+            RansacOptions options;
+            ransac_default_options(&options, 1.0, &rng);
+            options.scores = prosac ? scores : NULL;
+            options.scratch = &scratch;
+            EXPECT_EQ(getHomographyFromPoints_RANSAC_ctx(pre, cur, n, h[run], &options), n - outliers);
+        }
+        EXPECT_EQ(memcmp(h[0], h[1], sizeof(h[0])), 0);
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                EXPECT_NEAR(h[0][r][c], truth[r][c], 1e-6);
+            }
+        }
+    }
+    
+    // Without a generator the samples come from rand(), as getHomographyFromPoints_RANSAC_frame draws them
+    double h[2][3][3];
+    srand(3);
+    EXPECT_EQ(getHomographyFromPoints_RANSAC_frame(pre, cur, n, h[0], 1.0), n - outliers);
+    int next_rand = rand();
+    RansacOptions options;
+    ransac_frame_options(&options, 1.0);
+    options.scratch = &scratch;
+    srand(3);
+    EXPECT_EQ(getHomographyFromPoints_RANSAC_ctx(pre, cur, n, h[1], &options), n - outliers);
+    EXPECT_EQ(rand(), next_rand);
+    EXPECT_EQ(memcmp(h[0], h[1], sizeof(h[0])), 0);
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            EXPECT_NEAR(h[0][r][c], truth[r][c], 1e-6);
+        }
+    }
+    ransac_scratch_free(&scratch);
+}
+
+// Test matching stops at a cancelled budget and matches every point within an open one
+TEST_F(LandmarkTest, MatchBudgetTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->srm[i] = (uint8_t)(((uint32_t)i * 2654435761u) >> 24);
+    }
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    parameters.matching.correlation_window_size = 11;
+    parameters.matching.search_window_size = 21;
+    
+    const int num_points = 150;
+    std::vector<double> points(num_points * 2), matched(num_points * 2), correlations(num_points);
+    double identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    MatchContext ctx;
+    ASSERT_TRUE(allocate_match_context(&ctx, &parameters, num_points));
+    
+    int32_t counts[3];
+    BudgetStatus statuses[3];
+    for (int run = 0; run < 3; run++) {
+        for (int i = 0; i < num_points; i++) {
+            points[i * 2] = 20 + (i % 15) * 4;
+            points[i * 2 + 1] = 20 + (i / 15) * 6;
+        }
+        TimeBudget budget;
+        time_budget_init(&budget, 3600);
+        if (run == 2) time_budget_cancel(&budget);
+        ctx.budget = (run == 0) ? NULL : &budget;
+        counts[run] = MatchFeaturesWithSearchIntegral_ctx(&ctx, parameters, lmk->srm, NULL, lmk->num_cols,
+                                                          lmk->num_rows, -1, lmk->srm, NULL, lmk->num_cols,
+                                                          lmk->num_rows, -1, NULL, identity, points.data(),
+                                                          matched.data(), correlations.data(), num_points);
+        statuses[run] = ctx.status;
+    }
+    EXPECT_EQ(counts[0], num_points);
+    EXPECT_EQ(statuses[0], BUDGET_COMPLETE);
+    EXPECT_EQ(counts[1], num_points);
+    EXPECT_EQ(statuses[1], BUDGET_COMPLETE);
+    EXPECT_EQ(counts[2], 0);
+    EXPECT_EQ(statuses[2], BUDGET_CANCELLED);
+    free_match_context(&ctx);
+}
+
+// Test the pyramid search matches the full resolution search when search windows are clipped by the image edge
+TEST_F(LandmarkTest, MatchPyramidEdgeTest) {
+    // Smoothed noise keeps its peaks after downsampling
+    std::vector<uint32_t> noise(lmk->num_pixels);
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        noise[i] = ((uint32_t)i * 2654435761u) >> 24;
+    }
+    for (int r = 0; r < lmk->num_rows; r++) {
+        for (int c = 0; c < lmk->num_cols; c++) {
+            uint32_t sum = 0;
+            for (int k = 0; k < 9; k++) {
+                int rr = std::min(std::max(r + k / 3 - 1, 0), lmk->num_rows - 1);
+                int cc = std::min(std::max(c + k % 3 - 1, 0), lmk->num_cols - 1);
+                sum += noise[rr * lmk->num_cols + cc];
+            }
+            lmk->srm[r * lmk->num_cols + c] = (uint8_t)(sum / 9);
+        }
+    }
+    // The search image is the top left corner of the template image, so windows near its edge hold no template
+    const int search_size = 80;
+    std::vector<uint8_t> search(search_size * search_size);
+    for (int r = 0; r < search_size; r++) {
+        memcpy(&search[r * search_size], &lmk->srm[r * lmk->num_cols], search_size);
+    }
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    parameters.matching.correlation_window_size = 11;
+    parameters.matching.search_window_size = 21;
+    
+    const int num_points = 400;
+    std::vector<double> points[2], matched[2], correlations[2];
+    double identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    int32_t counts[2];
+    for (int run = 0; run < 2; run++) {
+        parameters.matching.pyramid_levels = run;
+        points[run].resize(num_points * 2);
+        for (int i = 0; i < num_points; i++) {
+            points[run][i * 2] = 55 + (i % 20) * 2;
+            points[run][i * 2 + 1] = 55 + (i / 20) * 2;
+        }
+        matched[run].assign(num_points * 2, -1);
+        correlations[run].assign(num_points, -1);
+        MatchContext ctx;
+        ASSERT_TRUE(allocate_match_context(&ctx, &parameters, num_points));
+        counts[run] = MatchFeaturesWithSearchIntegral_ctx(&ctx, parameters, lmk->srm, NULL, lmk->num_cols,
+                                                          lmk->num_rows, -1, search.data(), NULL, search_size,
+                                                          search_size, -1, NULL, identity, points[run].data(),
+                                                          matched[run].data(), correlations[run].data(), num_points);
+        free_match_context(&ctx);
+    }
+    // Coarse peaks on the window border are lost, otherwise the pyramid finds the full resolution matches
+    EXPECT_GT(counts[0], 0);
+    int32_t found = 0;
+    for (int32_t i = 0, j = 0; i < counts[0] && j < counts[1]; i++) {
+        int32_t k = j;
+        while (k < counts[1] && (points[1][k * 2] != points[0][i * 2] || points[1][k * 2 + 1] != points[0][i * 2 + 1])) k++;
+        if (k == counts[1]) continue;
+        EXPECT_NEAR(matched[1][k * 2], matched[0][i * 2], 1e-6);
+        EXPECT_NEAR(matched[1][k * 2 + 1], matched[0][i * 2 + 1], 1e-6);
+        j = k + 1;
+        found++;
+    }
+    EXPECT_GE(found, counts[0] * 9 / 10);
+}
+
+// Test the bounding rectangle of the differences between two versions of a landmark
+TEST_F(LandmarkTest, LandmarkChangedRectTest) {
+    LMK edited = {0};
+    ASSERT_TRUE(Copy_LMK(lmk, &edited));
+    
+    LandmarkRect rect;
+    EXPECT_TRUE(landmark_changed_rect(lmk, &edited, &rect));
+    EXPECT_EQ(rect.width, 0);
+    EXPECT_EQ(rect.height, 0);
+    
+    edited.srm[20 * edited.num_cols + 30] = 0;
+    edited.ele[45 * edited.num_cols + 12] = NAN;
+    EXPECT_TRUE(landmark_changed_rect(lmk, &edited, &rect));
+    EXPECT_EQ(rect.left, 12);
+    EXPECT_EQ(rect.top, 20);
+    EXPECT_EQ(rect.width, 19);
+    EXPECT_EQ(rect.height, 26);
+    free_lmk(&edited);
+}
+
+// Test that the Forstner interest with a context matches the interest without one
+TEST_F(LandmarkTest, ForstnerCtxTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->srm[i] = (uint8_t)(((uint32_t)i * 2654435761u) >> 24);
+    }
+    std::vector<float> expected(lmk->num_pixels), interest(lmk->num_pixels);
+    ASSERT_EQ(int_forstner(lmk->srm, lmk->num_cols, lmk->num_rows, 0, 0, lmk->num_cols, lmk->num_rows, 9,
+                           expected.data()), SUCCESS);
+    
+    // Two contexts computing the top and bottom halves
+    ForstnerCtx top = {0}, bottom = {0};
+    ASSERT_EQ(int_forstner_ctx_alloc(&top, lmk->num_cols, 9), SUCCESS);
+    ASSERT_EQ(int_forstner_ctx_alloc(&bottom, lmk->num_cols, 9), SUCCESS);
+    int half = lmk->num_rows / 2;
+    ASSERT_EQ(int_forstner_ctx(&top, lmk->srm, lmk->num_cols, lmk->num_rows, 0, 0, lmk->num_cols, half, 9,
+                               interest.data()), SUCCESS);
+    ASSERT_EQ(int_forstner_ctx(&bottom, lmk->srm, lmk->num_cols, lmk->num_rows, 0, half, lmk->num_cols,
+                               lmk->num_rows - half, 9, interest.data()), SUCCESS);
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        EXPECT_EQ(interest[i], expected[i]);
+    }
+    int_forstner_ctx_free(&top);
+    int_forstner_ctx_free(&bottom);
+    EXPECT_EQ(top.m00_sums, nullptr);
+}
+
+// Test that the n-best list keeps the smallest interest values of the image
+TEST_F(LandmarkTest, ForstnerNBestTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->srm[i] = (uint8_t)(((uint32_t)i * 2654435761u) >> 24);
+    }
+    std::vector<float> interest(lmk->num_pixels);
+    ASSERT_EQ(int_forstner(lmk->srm, lmk->num_cols, lmk->num_rows, 0, 0, lmk->num_cols, lmk->num_rows, 9,
+                           interest.data()), SUCCESS);
+    std::vector<float> valid;
+    for (float value : interest) {
+        if (value >= 0) valid.push_back(value);
+    }
+    std::sort(valid.begin(), valid.end());
+    
+    const int max = 300;
+    std::vector<int> pos(max * 2);
+    std::vector<float> values(max);
+    int num = 0;
+    ASSERT_EQ(int_forstner_nbest(lmk->srm, lmk->num_cols, lmk->num_rows, 0, 0, lmk->num_cols, lmk->num_rows, 9,
+                                 max, &num, (int (*)[2])pos.data(), values.data()), SUCCESS);
+    ASSERT_EQ(num, max);
+    for (int i = 0; i < num; i++) {
+        EXPECT_EQ(values[i], interest[pos[i * 2 + 1] * lmk->num_cols + pos[i * 2]]);
+    }
+    std::sort(values.begin(), values.end());
+    for (int i = 0; i < num; i++) {
+        EXPECT_EQ(values[i], valid[i]);
+    }
+}
+
+// Test that evenly distributed features from a reused scratch match those of the allocating call
+TEST_F(LandmarkTest, ForstnerScratchTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->srm[i] = (uint8_t)(((uint32_t)i * 2654435761u) >> 24);
+    }
+    const int max = 50;
+    std::vector<int64_t> expected_pos(max * 2), pos(max * 2);
+    std::vector<float> expected_values(max), values(max);
+    int32_t expected_num = 0, num = 0;
+    ASSERT_EQ(int_forstner_nbest_even_distribution(lmk->srm, lmk->num_cols, lmk->num_rows, 0, 0, lmk->num_cols,
+                                                   lmk->num_rows, 9, max, &expected_num,
+                                                   (int64_t (*)[2])expected_pos.data(), expected_values.data(), 5),
+              SUCCESS);
+
+    ForstnerScratch scratch = {0};
+    scratch.num_threads = 1;
+    ASSERT_TRUE(forstner_scratch_reserve(&scratch, lmk->num_cols, lmk->num_rows, 9, 5));
+    size_t bytes = forstner_scratch_bytes(&scratch);
+    for (int run = 0; run < 2; run++) {
+        ASSERT_EQ(int_forstner_nbest_even_distribution_scratch(&scratch, lmk->srm, lmk->num_cols, lmk->num_rows, 0,
+                                                               0, lmk->num_cols, lmk->num_rows, 9, max, &num,
+                                                               (int64_t (*)[2])pos.data(), values.data(), 5),
+                  SUCCESS);
+        ASSERT_EQ(num, expected_num);
+        for (int i = 0; i < num; i++) {
+            EXPECT_EQ(pos[i * 2], expected_pos[i * 2]);
+            EXPECT_EQ(pos[i * 2 + 1], expected_pos[i * 2 + 1]);
+            EXPECT_EQ(values[i], expected_values[i]);
+        }
+        EXPECT_EQ(forstner_scratch_bytes(&scratch), bytes);
+    }
+    forstner_scratch_free(&scratch);
+}
+
+// Test that the batch projections give the values of the scalar projections and invert them
+TEST_F(LandmarkTest, MapProjectionBatchTest) {
+    const double lat0 = -85.0, lon0 = 30.0;
+    const int n = 64;
+    std::vector<double> lat(n), lon(n), x(n), y(n), lat_back(n), lon_back(n);
+    for (int i = 0; i < n; i++) {
+        lat[i] = lat0 + 0.05 * (i % 8) - 0.2;
+        lon[i] = lon0 + 0.3 * (i / 8) - 1.0;
+    }
+    const enum Projection types[4] = {UTM, STEREO, EQUIDISTANT_CYLINDRICAL, ORTHOGRAPHIC};
+    for (enum Projection type : types) {
+        MapProjection projection;
+        ASSERT_TRUE(map_projection_init(&projection, type, Moon, lat0, lon0));
+        ASSERT_TRUE(map_projection_forward(&projection, lat.data(), lon.data(), n, x.data(), y.data()));
+        for (int i = 0; i < n; i++) {
+            double expected_x, expected_y;
+            if (type == UTM) {
+                latlong2utm(lat[i], lon[i], lon0, &expected_x, &expected_y);
+            } else if (type == STEREO) {
+                LatLong2StereographicProjection(lat[i], lon[i], lat0, lon0, Moon, &expected_x, &expected_y);
+            } else if (type == EQUIDISTANT_CYLINDRICAL) {
+                // called as in ProjectLatLong, which passes the origin longitude first
+                LatLong2EquidistantCylindricalProjection(lat[i], lon[i], lon0, lat0, Moon, &expected_x, &expected_y);
+            } else {
+                orthographic_map_projection(lat[i], lon[i], lat0, lon0, Moon, &expected_x, &expected_y);
+            }
+            EXPECT_EQ(x[i], expected_x);
+            EXPECT_EQ(y[i], expected_y);
+        }
+        if (type == UTM) continue;  // the UTM inverse series is not exact away from the tropics
+        ASSERT_TRUE(map_projection_inverse(&projection, x.data(), y.data(), n, lat_back.data(), lon_back.data()));
+        for (int i = 0; i < n; i++) {
+            EXPECT_NEAR(lat_back[i], lat[i], 1e-9);
+            EXPECT_NEAR(lon_back[i], lon[i], 1e-9);
+        }
+    }
+    MapProjection projection;
+    EXPECT_FALSE(map_projection_init(&projection, Projection_UNDEFINED, Moon, lat0, lon0));
+}
+
+// Test that the batch geodetic conversions agree with the per-point conversions
+TEST_F(LandmarkTest, GeodeticBatchTest) {
+    const int n = 50;
+    std::vector<double> lat(n), lon(n), ele(n), lat_out(n), lon_out(n), ele_out(n);
+    std::vector<double> p(n * 3);
+    for (int i = 0; i < n; i++) {
+        lat[i] = -89.9 + 179.8 * i / (n - 1);
+        lon[i] = -179.0 + 7.3 * i;
+        ele[i] = -5000.0 + 250.0 * i;
+    }
+    const enum Planet bodies[3] = {Earth, Moon, Mars};
+    for (enum Planet body : bodies) {
+        LatLongHeight_to_ECEF_Batch(lat.data(), lon.data(), ele.data(), n, (double (*)[3])p.data(), body);
+        ECEF_to_LatLongHeight_Batch((const double (*)[3])p.data(), n, lat_out.data(), lon_out.data(),
+                                    ele_out.data(), body);
+        for (int i = 0; i < n; i++) {
+            double expected_p[3], expected_lat, expected_lon, expected_ele;
+            LatLongHeight_to_ECEF(lat[i], lon[i], ele[i], expected_p, body);
+            for (int k = 0; k < 3; k++) {
+                EXPECT_EQ(p[i * 3 + k], expected_p[k]);
+            }
+            ECEF_to_LatLongHeight(expected_p, &expected_lat, &expected_lon, &expected_ele, body);
+            if (body == Moon) {
+                EXPECT_EQ(lat_out[i], expected_lat);
+                EXPECT_EQ(ele_out[i], expected_ele);
+            }
+            EXPECT_NEAR(lat_out[i], lat[i], 1e-9);
+            EXPECT_EQ(lon_out[i], expected_lon);
+            EXPECT_NEAR(ele_out[i], ele[i], 1e-4);
+        }
+    }
+}
+
+static bool read_test_dem_tile(void *user, int32_t x0, int32_t y0, int32_t width, int32_t height, float *values) {
+    const std::vector<float> *dem = (const std::vector<float> *)user;
+    for (int32_t r = 0; r < height; r++) {
+        for (int32_t c = 0; c < width; c++) {
+            values[r * width + c] = (*dem)[(y0 + r) * 37 + x0 + c];
+        }
+    }
+    return true;
+}
+
+// Test that sampling a DEM through a small tile cache matches interpolating the DEM in memory
+TEST_F(LandmarkTest, DemTileCacheTest) {
+    const int32_t cols = 37, rows = 29;
+    std::vector<float> dem(cols * rows);
+    for (int32_t i = 0; i < cols * rows; i++) {
+        dem[i] = (i % 11 == 5) ? NAN : (float)(0.37 * (i % cols) - 0.11 * (i / cols) + 0.01 * (i % 7));
+    }
+    DemTileSource source = {read_test_dem_tile, &dem, cols, rows, 8, 3};
+    DemTileCache cache;
+    ASSERT_TRUE(dem_tile_cache_init(&cache, &source));
+    // Past the last row, inter_float_matrix reads one row beyond the array with a weight of 0
+    for (double y = -0.75; y <= rows - 1; y += 0.35) {
+        for (double x = -0.75; x < cols + 0.5; x += 0.45) {
+            double expected = inter_float_matrix(dem.data(), cols, rows, x, y);
+            double value = dem_tile_cache_interpolate(&cache, x, y);
+            if (std::isnan(expected)) {
+                EXPECT_TRUE(std::isnan(value));
+            } else {
+                EXPECT_EQ(value, expected);
+            }
+        }
+    }
+    EXPECT_FALSE(cache.failed);
+    dem_tile_cache_free(&cache);
+}
+
+TEST_F(LandmarkTest, HeightPyramidIntersectTest) {
+    // A ridge along column 60 occludes the ground behind it from a grazing ray
+    for (int i = 0; i < lmk->num_rows; i++) {
+        lmk->ele[i * lmk->num_cols + 60] = 20;
+    }
+    lmk->ele[10 * lmk->num_cols + 30] = NAN;
+    LMK_HeightPyramid pyramid;
+    ASSERT_TRUE(LMK_Height_Pyramid_Build(&pyramid, lmk));
+    EXPECT_EQ(pyramid.num_levels, 8);
+
+    double c[3], target[3], ray[3], hit[3];
+    LMK_Col_Row_Elevation2World(lmk, 10, 50, 10, c);
+    LMK_Col_Row_Elevation2World(lmk, 90, 50, 0, target);
+    for (int k = 0; k < 3; k++) ray[k] = target[k] - c[k];
+    ASSERT_TRUE(Intersect_LMK_ELE_Pyramid(lmk, &pyramid, c, ray, -1, hit));
+    double x, y, ele;
+    World2LMK_Col_Row_Ele(lmk, hit, &x, &y, &ele);
+    // The ray meets the face 20 * (x - 59) at x = 1191.25 / 20.125
+    EXPECT_NEAR(x, 1191.25 / 20.125, 1e-9);
+    EXPECT_NEAR(y, 50, 1e-9);
+    EXPECT_NEAR(ele, Interpolate_LMK_ELE(lmk, x, y), 1e-9);
+    EXPECT_FALSE(Intersect_LMK_ELE_Pyramid(lmk, &pyramid, c, ray, 10, hit));
+
+    // A vertical ray through a no-data hole misses
+    LMK_Col_Row_Elevation2World(lmk, 30.5, 10.5, 50, c);
+    LMK_Col_Row_Elevation2World(lmk, 30.5, 10.5, -50, target);
+    for (int k = 0; k < 3; k++) ray[k] = target[k] - c[k];
+    EXPECT_FALSE(Intersect_LMK_ELE_Pyramid(lmk, &pyramid, c, ray, -1, hit));
+    LMK_Height_Pyramid_Free(&pyramid);
+}
+
+TEST_F(LandmarkTest, IntersectBatchTest) {
+    for (int i = 0; i < lmk->num_rows; i++) {
+        for (int j = 0; j < lmk->num_cols; j++) {
+            lmk->ele[i * lmk->num_cols + j] = 10 * sin(0.2 * j) * cos(0.15 * i);
+        }
+    }
+    LMK_HeightPyramid pyramid;
+    ASSERT_TRUE(LMK_Height_Pyramid_Build(&pyramid, lmk));
+
+    // A 40 x 40 camera looking across the map from beyond its left edge
+    const int32_t width = 40;
+    std::vector<double> rays(3 * width * width), hits(3 * width * width), col_row(2 * width * width);
+    bool flags[width * width];
+    double c[3], target[3];
+    LMK_Col_Row_Elevation2World(lmk, -20, 50, 30, c);
+    for (int32_t v = 0; v < width; v++) {
+        for (int32_t u = 0; u < width; u++) {
+            LMK_Col_Row_Elevation2World(lmk, 130.0 * u / width, 2.5 * v, -10, target);
+            for (int k = 0; k < 3; k++) rays[3 * (v * width + u) + k] = target[k] - c[k];
+        }
+    }
+    size_t num_hits = Intersect_LMK_ELE_Batch(lmk, &pyramid, c, (const double (*)[3])rays.data(), width * width, -1,
+                                              (double (*)[3])hits.data(), flags,
+                                              (double (*)[2])col_row.data());
+    size_t expected_hits = 0;
+    for (int32_t i = 0; i < width * width; i++) {
+        double hit[3];
+        bool expected = Intersect_LMK_ELE_Pyramid(lmk, &pyramid, c, &rays[3 * i], -1, hit);
+        ASSERT_EQ(flags[i], expected);
+        if (!expected) continue;
+        expected_hits++;
+        double x, y, ele;
+        World2LMK_Col_Row_Ele(lmk, hit, &x, &y, &ele);
+        for (int k = 0; k < 3; k++) EXPECT_EQ(hits[3 * i + k], hit[k]);
+        EXPECT_NEAR(col_row[2 * i], x, 1e-9);
+        EXPECT_NEAR(col_row[2 * i + 1], y, 1e-9);
+    }
+    EXPECT_EQ(num_hits, expected_hits);
+    EXPECT_GT(num_hits, 0u);
+    EXPECT_LT(num_hits, (size_t)(width * width));
+    LMK_Height_Pyramid_Free(&pyramid);
+}
+
+TEST_F(LandmarkTest, RenderShadowTest) {
+    // A 10 m wall along column 70, lit from the right at 30 degrees, casts a shadow about 17 pixels long
+    for (int i = 0; i < lmk->num_rows; i++) {
+        lmk->ele[i * lmk->num_cols + 70] = 10;
+    }
+    LMK_HeightPyramid pyramid;
+    ASSERT_TRUE(LMK_Height_Pyramid_Build(&pyramid, lmk));
+    LMK_RenderCamera camera;
+    LMK_Render_Nadir_Camera(lmk, &camera);
+    EXPECT_EQ(camera.width, lmk->num_cols);
+    EXPECT_EQ(camera.height, lmk->num_rows);
+    LMK_RenderSettings settings = {};
+    settings.shader = LMK_RENDER_LAMBERT;
+    settings.albedo = 1.0;
+    settings.shadows = true;
+    LMK_Render_Sun_Direction(lmk, 30, 90, settings.sun);
+
+    std::vector<uint8_t> image(camera.width * camera.height);
+    ASSERT_TRUE(LMK_Render(lmk, &pyramid, &camera, &settings, image.data()));
+    const uint8_t *row = &image[50 * camera.width];
+    EXPECT_EQ(row[10], 127);
+    EXPECT_EQ(row[52], 127);
+    EXPECT_EQ(row[54], 0);
+    EXPECT_EQ(row[68], 0);
+    EXPECT_EQ(row[90], 127);
+
+    settings.shadows = false;
+    ASSERT_TRUE(LMK_Render(lmk, &pyramid, &camera, &settings, image.data()));
+    EXPECT_EQ(row[60], 127);
+    LMK_Height_Pyramid_Free(&pyramid);
+}
+
+TEST_F(LandmarkTest, InterpolateBatchTest) {
+    for (int i = 0; i < lmk->num_pixels; i++) {
+        lmk->ele[i] = (i % 13 == 4) ? NAN : (float)(0.3 * (i % 17) - 0.07 * (i % 23));
+        lmk->srm[i] = (uint8_t)(i * 37);
+    }
+    // Rows crossing every edge, with pixel centers and out of bounds samples
+    std::vector<double> col, row;
+    for (double y = -1.25; y < lmk->num_rows + 1; y += 0.5) {
+        std::vector<double> x(208), yy(208);
+        inter_affine_row(-1.5, y, 0.5, 0.003, x.size(), x.data(), yy.data());
+        col.insert(col.end(), x.begin(), x.end());
+        row.insert(row.end(), yy.begin(), yy.end());
+        col.push_back(std::floor(y) + 1);
+        row.push_back(std::floor(y));
+    }
+    size_t n = col.size();
+    std::vector<double> ele(n);
+    std::vector<uint8_t> srm(n);
+    std::unique_ptr<bool[]> valid(new bool[n]);
+    Interpolate_LMK_ELE_Batch(lmk, col.data(), row.data(), n, ele.data());
+    Interpolate_LMK_SRM_Batch(lmk, col.data(), row.data(), n, srm.data(), valid.get());
+    for (size_t i = 0; i < n; i++) {
+        double expected = Interpolate_LMK_ELE(lmk, col[i], row[i]);
+        if (std::isnan(expected)) {
+            EXPECT_TRUE(std::isnan(ele[i]));
+        } else {
+            EXPECT_EQ(ele[i], expected);
+        }
+        double expected_srm = Interpolate_LMK_SRM(lmk, col[i], row[i]);
+        EXPECT_EQ(valid[i], !std::isnan(expected_srm));
+        if (valid[i]) EXPECT_EQ(srm[i], expected_srm);
+    }
+
+    double h[3][3] = {{1.01, 0.02, 3.3}, {-0.015, 0.99, -2.1}, {1e-5, -2e-5, 1.0}};
+    double x[50], y[50];
+    inter_homography_row(h, -5, 17, 50, x, y);
+    for (int32_t i = 0; i < 50; i++) {
+        double op[2];
+        homographyTransfer33(h, -5 + i, 17, op);
+        EXPECT_EQ(x[i], op[0]);
+        EXPECT_EQ(y[i], op[1]);
+    }
+}
+
+TEST_F(LandmarkTest, ResampleAreaTest) {
+    // A ramp along the columns with a block of NAN elevations
+    for (int i = 0; i < lmk->num_rows; i++) {
+        for (int j = 0; j < lmk->num_cols; j++) {
+            bool hole = i >= 30 && i < 36 && j >= 30 && j < 36;
+            lmk->ele[i * lmk->num_cols + j] = hole ? NAN : (float)j;
+        }
+    }
+    const enum LMK_ResampleFilter filters[] = {LMK_RESAMPLE_AREA, LMK_RESAMPLE_LANCZOS};
+    for (enum LMK_ResampleFilter filter : filters) {
+        LMK coarse = {};
+        ASSERT_TRUE(Resample_LMK_Filtered(lmk, &coarse, 3.0, filter));
+        EXPECT_EQ(coarse.num_cols, 33);
+        EXPECT_EQ(coarse.num_rows, 33);
+        EXPECT_DOUBLE_EQ(coarse.resolution, 3.0);
+        EXPECT_NEAR(coarse.ele[20 * coarse.num_cols + 20], 60.0, 1e-4);
+        EXPECT_NEAR(coarse.ele[5 * coarse.num_cols + 7], 21.0, 1e-4);
+        EXPECT_TRUE(std::isnan(coarse.ele[11 * coarse.num_cols + 11]));
+        EXPECT_EQ(coarse.srm[20 * coarse.num_cols + 20], 100);
+        free_lmk(&coarse);
+    }
+
+    // Upsampling interpolates at the output pixel centers
+    LMK fine = {};
+    ASSERT_TRUE(ResampleLMK(lmk, &fine, 0.5));
+    EXPECT_EQ(fine.num_cols, 200);
+    for (int i = 0; i < fine.num_rows; i += 7) {
+        for (int j = 0; j < fine.num_cols; j += 3) {
+            double expected = Interpolate_LMK_ELE(lmk, j * 0.5, i * 0.5);
+            float value = fine.ele[i * fine.num_cols + j];
+            if (std::isnan(expected)) {
+                EXPECT_TRUE(std::isnan(value));
+            } else {
+                EXPECT_EQ(value, (float)expected);
+            }
+        }
+    }
+    free_lmk(&fine);
+
+    // ResampleLMK interpolates when downsampling too, the filters are opt-in
+    LMK coarse = {};
+    ASSERT_TRUE(ResampleLMK(lmk, &coarse, 3.0));
+    for (int i = 0; i < coarse.num_rows; i += 5) {
+        for (int j = 0; j < coarse.num_cols; j += 2) {
+            double expected = Interpolate_LMK_ELE(lmk, j * 3.0, i * 3.0);
+            float value = coarse.ele[i * coarse.num_cols + j];
+            if (std::isnan(expected)) {
+                EXPECT_TRUE(std::isnan(value));
+            } else {
+                EXPECT_EQ(value, (float)expected);
+            }
+        }
+    }
+    free_lmk(&coarse);
+    EXPECT_EQ(strToLMKResampleFilter(NULL), LMK_RESAMPLE_BILINEAR);
+    EXPECT_EQ(strToLMKResampleFilter("AREA"), LMK_RESAMPLE_AREA);
+    EXPECT_EQ(strToLMKResampleFilter("LANCZOS"), LMK_RESAMPLE_LANCZOS);
+    EXPECT_EQ(strToLMKResampleFilter("BOX"), LMK_ResampleFilter_UNDEFINED);
+}
+
+// Variants depend only on the seed and the variant index
+TEST_F(LandmarkTest, DistortVariantsTest) {
+    LMK_Distortion distortion;
+    LMK_Distortion_Init(&distortion);
+    distortion.gaussian = true;
+    distortion.gaussian_mean = 0.5;
+    distortion.gaussian_stddev = 2.0;
+
+    LMK a = {}, b = {}, c = {};
+    ASSERT_TRUE(Distort_LMK(lmk, &distortion, 42, 3, &a));
+    ASSERT_TRUE(Distort_LMK(lmk, &distortion, 42, 3, &b));
+    ASSERT_TRUE(Distort_LMK(lmk, &distortion, 42, 4, &c));
+    EXPECT_EQ(memcmp(a.ele, b.ele, sizeof(float) * a.num_pixels), 0);
+    EXPECT_NE(memcmp(a.ele, c.ele, sizeof(float) * a.num_pixels), 0);
+    EXPECT_EQ(memcmp(a.srm, lmk->srm, a.num_pixels), 0);
+
+    // Rows distorted alone get the noise of their pixels
+    std::vector<float> ele(3 * lmk->num_cols);
+    std::vector<uint8_t> srm(3 * lmk->num_cols);
+    LMK_Distort_Rows(lmk, &distortion, 42, 3, 17, 3, srm.data(), ele.data());
+    EXPECT_EQ(memcmp(ele.data(), &a.ele[17 * lmk->num_cols], sizeof(float) * ele.size()), 0);
+
+    double sum = 0.0, sum2 = 0.0;
+    for (int i = 0; i < a.num_pixels; i++) {
+        double d = a.ele[i] - lmk->ele[i];
+        sum += d;
+        sum2 += d * d;
+    }
+    double mean = sum / a.num_pixels;
+    EXPECT_NEAR(mean, 0.5, 0.1);
+    EXPECT_NEAR(std::sqrt(sum2 / a.num_pixels - mean * mean), 2.0, 0.1);
+    free_lmk(&a);
+    free_lmk(&b);
+    free_lmk(&c);
+}
+
+// The cubic and sine stages displace the elevations in the same pass
+TEST_F(LandmarkTest, DistortStagesTest) {
+    LMK_Distortion distortion;
+    LMK_Distortion_Init(&distortion);
+    distortion.cubic = true;
+    distortion.cubic_coefficients[3] = 2.0;
+    distortion.sine = true;
+    distortion.sine_amplitude = 3.0;
+    distortion.sine_frequency = 0.1;
+    distortion.sine_azimuth = 0.0;
+
+    LMK out = {};
+    ASSERT_TRUE(Distort_LMK(lmk, &distortion, 1, 0, &out));
+    // One cycle of the wave spans columns 45 to 55 of every row
+    EXPECT_FLOAT_EQ(out.ele[20 * lmk->num_cols + 10], 2.0f);
+    EXPECT_NEAR(out.ele[20 * lmk->num_cols + 47], 2.0 + 3.0 * std::sin(0.4 * M_PI), 1e-5);
+    EXPECT_NEAR(out.ele[70 * lmk->num_cols + 53], 2.0 + 3.0 * std::sin(1.6 * M_PI), 1e-5);
+    free_lmk(&out);
+}
+
+// Copies, bands and frame-only distortions share the arrays until one of them is written
+TEST_F(LandmarkTest, ShareCopyOnWriteTest) {
+    LMK shared = {0};
+    ASSERT_TRUE(Share_LMK(lmk, &shared));
+    EXPECT_EQ(shared.ele, lmk->ele);
+    EXPECT_EQ(shared.srm, lmk->srm);
+    EXPECT_TRUE(LMK_Is_Shared(lmk));
+
+    float *ele = LMK_Ele_Writable(&shared);
+    ASSERT_NE(ele, nullptr);
+    EXPECT_NE(ele, lmk->ele);
+    ele[5] = 42.0f;
+    EXPECT_FLOAT_EQ(lmk->ele[5], 0.0f);
+    EXPECT_EQ(shared.srm, lmk->srm);
+    EXPECT_EQ(LMK_Srm_Writable(lmk) == shared.srm, false);
+    EXPECT_FALSE(LMK_Is_Shared(lmk));
+    EXPECT_EQ(LMK_Ele_Writable(&shared), ele);
+
+    // A band of whole rows is a view at an offset, which outlives the landmark it was taken from
+    LMK source = {0};
+    ASSERT_TRUE(Copy_LMK(lmk, &source));
+    source.ele[30 * source.num_cols + 7] = 3.5f;
+    LMK band = {0};
+    ASSERT_TRUE(SubsetLMK(&source, &band, 0, 30, source.num_cols, 20));
+    EXPECT_EQ(band.ele, source.ele + 30 * source.num_cols);
+    free_lmk(&source);
+    EXPECT_FALSE(LMK_Is_Shared(&band));
+    EXPECT_FLOAT_EQ(band.ele[7], 3.5f);
+    free_lmk(&band);
+
+    LMK_Distortion distortion;
+    LMK_Distortion_Init(&distortion);
+    distortion.rotate_degrees = 10.0;
+    LMK moved = {0};
+    ASSERT_TRUE(Distort_LMK(lmk, &distortion, 1, 0, &moved));
+    EXPECT_EQ(moved.ele, lmk->ele);
+    EXPECT_NE(moved.mapRworld[0][1], lmk->mapRworld[0][1]);
+    free_lmk(&moved);
+    free_lmk(&shared);
+    EXPECT_FALSE(LMK_Is_Shared(lmk));
+}
+
+// Float anchor-relative deltas stay within the tolerance of the double world frame ones
+TEST_F(LandmarkTest, LocalFloatDeltaTest) {
+    // A landmark on the surface of the Moon, rotated about z, and a base shifted by a few meters
+    double angle = 0.3;
+    lmk->anchor_point[0] = 1737400.0;
+    lmk->anchor_point[1] = 12000.0;
+    lmk->anchor_point[2] = -8000.0;
+    double rotation[3][3] = {{cos(angle), sin(angle), 0.0}, {-sin(angle), cos(angle), 0.0}, {0.0, 0.0, 1.0}};
+    memcpy(lmk->mapRworld, rotation, sizeof(rotation));
+    calculateDerivedValuesVectors(lmk);
+    for (int32_t i = 0; i < lmk->num_pixels; i++) lmk->ele[i] = 1500.0f + 0.37f * (i % 97) - 0.21f * (i / 89);
+    lmk->ele[40 * lmk->num_cols + 40] = NAN;
+    LMK base = {0};
+    ASSERT_TRUE(Copy_LMK(lmk, &base));
+    base.anchor_point[0] += 3.0;
+    base.anchor_point[1] -= 2.0;
+    calculateDerivedValuesVectors(&base);
+
+    LMK_LocalPair pair;
+    ASSERT_TRUE(LMK_Local_Pair_Init(&pair, lmk, &base));
+    const int32_t n = 150;
+    std::vector<double> child_points(n * 2), base_points(n * 2);
+    std::vector<double> delta(n * 3);
+    std::unique_ptr<bool[]> valid(new bool[n]);
+    for (int32_t i = 0; i < n; i++) {
+        child_points[i * 2] = 4 + (i * 7) % 90;
+        child_points[i * 2 + 1] = 4 + (i * 11) % 90;
+        base_points[i * 2] = child_points[i * 2] + 0.25 + 0.01 * i;
+        base_points[i * 2 + 1] = child_points[i * 2 + 1] - 0.4;
+    }
+    child_points[0] = child_points[1] = 40;
+    LMK_Local_Pair_Delta_Batch(&pair, child_points.data(), base_points.data(), n, (double (*)[3])delta.data(),
+                               valid.get());
+    EXPECT_FALSE(valid[0]);
+    for (int32_t i = 1; i < n; i++) {
+        double child_world[3], base_world[3], delta_world[3], expected[3];
+        bool expected_valid = LMK_Col_Row2World(lmk, child_points[i * 2], child_points[i * 2 + 1], child_world);
+        expected_valid &= LMK_Col_Row2World(&base, base_points[i * 2], base_points[i * 2 + 1], base_world);
+        ASSERT_EQ(valid[i], expected_valid);
+        if (!expected_valid) continue;
+        for (int k = 0; k < 3; k++) delta_world[k] = child_world[k] - base_world[k];
+        for (int k = 0; k < 3; k++) {
+            expected[k] = lmk->mapRworld[k][0] * delta_world[0] + lmk->mapRworld[k][1] * delta_world[1] +
+                          lmk->mapRworld[k][2] * delta_world[2];
+            EXPECT_NEAR(delta[i * 3 + k], expected[k], LMK_LOCAL_FLOAT_TOLERANCE * lmk->resolution);
+        }
+    }
+
+    // Promoted to double, local coordinates give the world positions
+    float col[2] = {10.5f, 77.0f}, row[2] = {3.0f, 60.25f}, ele[2] = {1510.0f, 1490.5f};
+    float x[2], y[2], z[2];
+    double world[2][3];
+    LMK_Col_Row_Elevation2Local_Batch(lmk, col, row, ele, 2, x, y, z);
+    LMK_Local2World_Batch(lmk, x, y, z, 2, world);
+    for (int32_t i = 0; i < 2; i++) {
+        double expected[3];
+        LMK_Col_Row_Elevation2World(lmk, col[i], row[i], ele[i], expected);
+        for (int k = 0; k < 3; k++) EXPECT_NEAR(world[i][k], expected[k], LMK_LOCAL_FLOAT_TOLERANCE);
+    }
+
+    // The precision bound holds up to the landmark sizes it is documented for
+    LMK large = {0};
+    Copy_LMK_Header(lmk, &large);
+    large.num_cols = large.num_rows = 4500;
+    large.anchor_col = large.anchor_row = 2250.0;
+    calculateDerivedValuesVectors(&large);
+    EXPECT_TRUE(LMK_Local_Float_Fits(&large));
+    EXPECT_TRUE(LMK_Local_Pair_Init(&pair, &large, &large));
+    large.num_cols = large.num_rows = 8000;
+    large.anchor_col = large.anchor_row = 4000.0;
+    calculateDerivedValuesVectors(&large);
+    EXPECT_FALSE(LMK_Local_Float_Fits(&large));
+    EXPECT_FALSE(LMK_Local_Pair_Init(&pair, &large, &large));
+    free_lmk(&base);
+}
+
+// Derived layers are computed once, dropped with the elevation they came from and restored from their file
+TEST_F(LandmarkTest, DerivedLayersTest) {
+    int32_t cols = lmk->num_cols;
+    for (int32_t i = 0; i < lmk->num_pixels; i++) lmk->ele[i] = 0.5f * (i % cols);
+    lmk->ele[10 * cols + 10] = NAN;
+
+    const float *slope = LMK_Slope_Layer(lmk);
+    ASSERT_NE(slope, nullptr);
+    EXPECT_NEAR(slope[50 * cols + 50], atan(0.5) * 180.0 / M_PI, 1e-4);
+    EXPECT_NEAR(slope[50 * cols], atan(0.5) * 180.0 / M_PI, 1e-4);
+    EXPECT_TRUE(std::isnan(slope[10 * cols + 11]));
+    EXPECT_EQ(LMK_Slope_Layer(lmk), slope);
+
+    const uint8_t *shade = LMK_Hillshade_Layer(lmk);
+    ASSERT_NE(shade, nullptr);
+    EXPECT_GT(shade[50 * cols + 50], 0);
+    EXPECT_EQ(shade[20 * cols + 70], shade[50 * cols + 50]);
+    EXPECT_EQ(shade[10 * cols + 10], 0);
+
+    // World points are those of LMK_Col_Row2World at whole pixels
+    const double *world = LMK_World_Layer(lmk);
+    ASSERT_NE(world, nullptr);
+    double p[3];
+    ASSERT_TRUE(LMK_Col_Row2World(lmk, 40, 30, p));
+    for (int32_t k = 0; k < 3; k++) EXPECT_EQ(world[(30 * cols + 40) * 3 + k], p[k]);
+    EXPECT_TRUE(std::isnan(world[(10 * cols + 10) * 3]));
+
+    // A mask with counts serves the calls without them too
+    const NanMask *mask = lmk_nan_mask_layer(lmk, true);
+    ASSERT_NE(mask, nullptr);
+    EXPECT_EQ(nan_mask_count(mask, 0, 0, cols, lmk->num_rows), 1);
+    EXPECT_EQ(lmk_nan_mask_layer(lmk, false), mask);
+
+    const char *filename = "layers_test.lmk" LMK_LAYERS_SIDECAR_SUFFIX;
+    ASSERT_TRUE(LMK_Save_Layers(lmk, filename));
+    LMK copy = {0};
+    ASSERT_TRUE(Copy_LMK(lmk, &copy));
+    EXPECT_EQ(LMK_Layer(&copy, LMK_LAYER_SLOPE), nullptr);
+    ASSERT_TRUE(LMK_Load_Layers(&copy, filename));
+    const float *loaded = (const float *)LMK_Layer(&copy, LMK_LAYER_SLOPE);
+    ASSERT_NE(loaded, nullptr);
+    EXPECT_EQ(memcmp(loaded, slope, sizeof(float) * lmk->num_pixels), 0);
+    EXPECT_NE(LMK_Layer(&copy, LMK_LAYER_WORLD), nullptr);
+    EXPECT_EQ(LMK_Layer(&copy, LMK_LAYER_NAN_COUNTS), nullptr);
+    free_lmk(&copy);
+
+    // Writing the elevation drops the layers, and the file no longer applies
+    float *ele = LMK_Ele_Writable(lmk);
+    ASSERT_NE(ele, nullptr);
+    EXPECT_EQ(LMK_Layer(lmk, LMK_LAYER_SLOPE), nullptr);
+    EXPECT_EQ(LMK_Layer(lmk, LMK_LAYER_NAN_COUNTS), nullptr);
+    ele[0] = 1.0f;
+    EXPECT_FALSE(LMK_Load_Layers(lmk, filename));
+    EXPECT_EQ(LMK_Layer(lmk, LMK_LAYER_WORLD), nullptr);
+    unlink(filename);
+}
+
+// Patching a written landmark in place matches a rewrite of the whole file
+TEST_F(LandmarkTest, PatchInPlaceTest) {
+    const char *filename = "patch_test.lmk";
+    ASSERT_TRUE(Write_LMK(filename, lmk));
+
+    LMK_Patch patch;
+    ASSERT_TRUE(Open_LMK_Patch(filename, &patch));
+    EXPECT_EQ(patch.version, 3);
+    LMK header;
+    Copy_LMK_Header(lmk, &header);
+    header.anchor_point[2] += 10.0;
+    header.resolution = 2.0;
+    EXPECT_TRUE(LMK_Patch_Header(&patch, &header));
+    std::vector<uint8_t> srm(4 * 5, 200);
+    std::vector<float> ele(4 * 5, -3.0f);
+    EXPECT_TRUE(LMK_Patch_SRM(&patch, 10, 20, 4, 5, srm.data()));
+    EXPECT_TRUE(LMK_Patch_Ele(&patch, 10, 20, 4, 5, ele.data()));
+    EXPECT_FALSE(LMK_Patch_SRM(&patch, lmk->num_cols - 2, 0, 4, 1, srm.data()));
+    ASSERT_TRUE(Close_LMK_Patch(&patch));
+
+    LMK out = {};
+    ASSERT_TRUE(Read_LMK(filename, &out));
+    EXPECT_DOUBLE_EQ(out.resolution, 2.0);
+    EXPECT_DOUBLE_EQ(out.anchor_point[2], lmk->anchor_point[2] + 10.0);
+    for (int r = 0; r < out.num_rows; r++) {
+        for (int c = 0; c < out.num_cols; c++) {
+            int i = r * out.num_cols + c;
+            bool inside = c >= 10 && c < 14 && r >= 20 && r < 25;
+            EXPECT_EQ(out.srm[i], inside ? 200 : lmk->srm[i]);
+            EXPECT_EQ(out.ele[i], inside ? -3.0f : lmk->ele[i]);
+        }
+    }
+    // The ascii header is regenerated with the new resolution
+    FILE *fp = fopen("patch_test.lmk.txt", "r");
+    ASSERT_NE(fp, nullptr);
+    char text[4096] = {0};
+    fread(text, 1, sizeof(text) - 1, fp);
+    fclose(fp);
+    EXPECT_NE(strstr(text, "LMK_RESOLUTION 2.000000"), nullptr);
+    free_lmk(&out);
+    remove(filename);
+    remove("patch_test.lmk.txt");
+}
+
+// Streamed edits of a landmark file match the edits of the landmark in memory
+TEST_F(LandmarkTest, StreamEditTest) {
+    ASSERT_TRUE(Write_LMK("stream_in.lmk", lmk));
+
+    LMK expected = {}, out = {};
+    ASSERT_TRUE(Resample_LMK_Filtered(lmk, &expected, 2.5, LMK_RESAMPLE_AREA));
+    ASSERT_TRUE(Resample_LMK_File("stream_in.lmk", "stream_out.lmk", 2.5, LMK_RESAMPLE_AREA));
+    ASSERT_TRUE(Read_LMK("stream_out.lmk", &out));
+    ASSERT_EQ(out.num_pixels, expected.num_pixels);
+    EXPECT_EQ(memcmp(out.srm, expected.srm, out.num_pixels), 0);
+    EXPECT_EQ(memcmp(out.ele, expected.ele, sizeof(float) * out.num_pixels), 0);
+    free_lmk(&expected);
+    free_lmk(&out);
+
+    LMK crop = {}, crop_out = {};
+    ASSERT_TRUE(Crop_IntepolateLMK(lmk, &crop, 10, 20, 40, 30));
+    ASSERT_TRUE(Crop_Interpolate_LMK_File("stream_in.lmk", "stream_out.lmk", 10, 20, 40, 30));
+    ASSERT_TRUE(Read_LMK("stream_out.lmk", &crop_out));
+    EXPECT_EQ(memcmp(crop_out.srm, crop.srm, crop_out.num_pixels), 0);
+    for (int i = 0; i < crop_out.num_pixels; i++) {
+        EXPECT_TRUE(crop_out.ele[i] == crop.ele[i] || (std::isnan(crop_out.ele[i]) && std::isnan(crop.ele[i])));
+    }
+    EXPECT_DOUBLE_EQ(crop_out.anchor_point[0], crop.anchor_point[0]);
+    free_lmk(&crop);
+    free_lmk(&crop_out);
+
+    LMK sub = {};
+    EXPECT_FALSE(Subset_LMK_File("stream_in.lmk", "stream_out.lmk", 0, 0, lmk->num_cols + 1, 1));
+    ASSERT_TRUE(Subset_LMK_File("stream_in.lmk", "stream_out.lmk", 5, 7, 30, 20));
+    ASSERT_TRUE(Read_LMK("stream_out.lmk", &sub));
+    EXPECT_EQ(sub.ele[3 * 30 + 4], lmk->ele[10 * lmk->num_cols + 9]);
+    EXPECT_EQ(sub.srm[3 * 30 + 4], lmk->srm[10 * lmk->num_cols + 9]);
+    free_lmk(&sub);
+    remove("stream_in.lmk");
+    remove("stream_in.lmk.txt");
+    remove("stream_out.lmk");
+    remove("stream_out.lmk.txt");
+}
+
+TEST_F(LandmarkTest, DistributedPlanAndGatherTest) {
+    // No data in the top left corner
+    for (int32_t row = 0; row < 60; row++) {
+        for (int32_t col = 0; col < 30; col++) lmk->ele[row * lmk->num_cols + col] = NAN;
+    }
+    ASSERT_TRUE(Write_LMK("distributed_child.lmk", lmk));
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    parameters.sliding.block_size = 16;
+
+    DistributedPlan plan;
+    ASSERT_TRUE(Plan_Distributed_Match(&parameters, "distributed_child.lmk", 20, 3, &plan));
+    EXPECT_EQ(plan.tile_size, 32);
+    ASSERT_EQ(plan.num_tiles, 16);
+    int64_t valid = 0, area = 0;
+    for (int32_t t = 0; t < plan.num_tiles; t++) {
+        valid += plan.tiles[t].valid_pixels;
+        area += (int64_t)plan.tiles[t].rect.width * plan.tiles[t].rect.height;
+    }
+    EXPECT_EQ(valid, 100 * 100 - 60 * 30);
+    EXPECT_EQ(area, 100 * 100);
+    EXPECT_EQ(plan.tiles[0].valid_pixels, 2 * 32);
+    int64_t costs[3];
+    distributed_plan_costs(&plan, costs);
+    int64_t lightest = *std::min_element(costs, costs + 3);
+    int64_t heaviest = *std::max_element(costs, costs + 3);
+    EXPECT_LE(heaviest - lightest, 32 * 32 + 1);
+
+    mkdir("distributed_work", 0755);
+    ASSERT_TRUE(Write_Distributed_Plan("distributed_work/plan.txt", &plan));
+    DistributedPlan read;
+    ASSERT_TRUE(Read_Distributed_Plan("distributed_work/plan.txt", &read));
+    ASSERT_EQ(read.num_tiles, plan.num_tiles);
+    for (int32_t t = 0; t < plan.num_tiles; t++) {
+        EXPECT_EQ(read.tiles[t].rank, plan.tiles[t].rank);
+        EXPECT_EQ(read.tiles[t].valid_pixels, plan.tiles[t].valid_pixels);
+        EXPECT_EQ(memcmp(&read.tiles[t].rect, &plan.tiles[t].rect, sizeof(LandmarkRect)), 0);
+    }
+    free_distributed_plan(&read);
+
+    // Tiles holding the index of each pixel of the map are stitched back in place
+    char path[256];
+    for (int32_t t = 0; t < plan.num_tiles; t++) {
+        const LandmarkRect &rect = plan.tiles[t].rect;
+        std::vector<float> maps[4];
+        for (int k = 0; k < 4; k++) {
+            maps[k].resize((size_t)rect.width * rect.height);
+            for (int32_t y = 0; y < rect.height; y++) {
+                for (int32_t x = 0; x < rect.width; x++) {
+                    maps[k][y * rect.width + x] = (float)(k * 10000 + (rect.top + y) * 100 + rect.left + x);
+                }
+            }
+        }
+        CorrelationResults results = {maps[0].data(), maps[1].data(), maps[2].data(), maps[3].data()};
+        distributed_tile_filename(path, sizeof(path), "distributed_work", t);
+        ASSERT_TRUE(Write_Correlation_Results_Raster(path, &results, rect.width, rect.height, 16,
+                                                     LMK_COMPRESSION_DEFLATE));
+    }
+    ASSERT_TRUE(Gather_Distributed_Match(&plan, "distributed_work", "distributed_results.lmkr"));
+    std::vector<float> back[4];
+    for (int k = 0; k < 4; k++) back[k].resize(100 * 100);
+    CorrelationResults gathered = {back[0].data(), back[1].data(), back[2].data(), back[3].data()};
+    ASSERT_TRUE(Read_Correlation_Results_Raster("distributed_results.lmkr", &gathered, 100, 100));
+    for (int k = 0; k < 4; k++) {
+        for (int32_t i = 0; i < 100 * 100; i++) ASSERT_EQ(back[k][i], (float)(k * 10000 + i));
+    }
+
+    // A missing tile fails the gather
+    distributed_tile_filename(path, sizeof(path), "distributed_work", 5);
+    remove(path);
+    EXPECT_FALSE(Gather_Distributed_Match(&plan, "distributed_work", "distributed_results.lmkr"));
+    for (int32_t t = 0; t < plan.num_tiles; t++) {
+        distributed_tile_filename(path, sizeof(path), "distributed_work", t);
+        remove(path);
+    }
+    free_distributed_plan(&plan);
+    remove("distributed_work/plan.txt");
+    rmdir("distributed_work");
+    remove("distributed_results.lmkr");
+    remove("distributed_child.lmk");
+    remove("distributed_child.lmk.txt");
+}
+
+TEST(HomographyTest, TransferImageMaskTest) {
+    const int cols = 40, rows = 30;
+    std::vector<uint8_t> image(cols * rows), mask(cols * rows, 0);
+    for (int i = 0; i < cols * rows; i++) image[i] = (uint8_t)(i * 7);
+    for (int i = 10; i < 14; i++) {
+        for (int j = 5; j < 9; j++) mask[i * cols + j] = 1;
+    }
+    // A shift by 2.5 columns and 1.5 rows
+    double h[3][3] = {{1, 0, 2.5}, {0, 1, 1.5}, {0, 0, 1}};
+    std::vector<uint8_t> warped(cols * rows), warped_mask(cols * rows), expected(cols * rows);
+    ASSERT_EQ(transferImageMask(h, image.data(), mask.data(), cols, rows, warped.data(), warped_mask.data(), cols,
+                                rows), 1);
+    ASSERT_EQ(transferImage(h, image.data(), cols, rows, expected.data(), cols, rows), 1);
+    EXPECT_EQ(warped, expected);
+    EXPECT_EQ(warped_mask[5 * cols + 5], 0);
+    EXPECT_EQ(warped_mask[10 * cols + 4], 1);
+    EXPECT_EQ(warped_mask[5 * cols + 37], 1);
+    EXPECT_EQ(warped[5 * cols + 37], 0);
+}
+
+// Every eigenpair of Q diag(lambda) Q^T is recovered, Q a Householder reflection
+static void expect_jacobi_eigenpairs(int n, const double *lambda) {
+    std::vector<double> u(n), q(n * n), a(n * n, 0.0), w(n), v(n * n);
+    double uu = 0.0;
+    for (int i = 0; i < n; i++) {
+        u[i] = 1.0 + 0.37 * i - 0.05 * i * i;
+        uu += u[i] * u[i];
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) q[i * n + j] = (i == j ? 1.0 : 0.0) - 2.0 * u[i] * u[j] / uu;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            for (int k = 0; k < n; k++) a[i * n + j] += q[i * n + k] * lambda[k] * q[j * n + k];
+        }
+    }
+    ASSERT_TRUE(fixed_jacobi(a.data(), w.data(), v.data(), n));
+    for (int k = 0; k < n; k++) {
+        int found = -1;
+        for (int j = 0; j < n; j++) {
+            if (std::fabs(w[j] - lambda[k]) < 1e-12 * n) found = j;
+        }
+        ASSERT_GE(found, 0) << "eigenvalue " << lambda[k];
+        // Unit eigenvector, up to sign
+        double dot = 0.0;
+        for (int i = 0; i < n; i++) dot += v[i * n + found] * q[i * n + k];
+        EXPECT_NEAR(std::fabs(dot), 1.0, 1e-12);
+    }
+}
+
+TEST(HomographyTest, JacobiKnownEigenpairsTest) {
+    const double lambda3[3] = {3.0, -1.0, 0.5};
+    expect_jacobi_eigenpairs(3, lambda3);
+    const double lambda9[9] = {9.0, -4.0, 2.5, 0.25, 7.0, 1.0, 3.5, -2.0, 0.5};
+    expect_jacobi_eigenpairs(9, lambda9);
+
+    // jacobi33 on a matrix coupling x and y: eigenvectors (1, 1, 0), (1, -1, 0) and (0, 0, 1)
+    double a[3][3] = {{2, 1, 0}, {1, 2, 0}, {0, 0, 5}};
+    double w[3], v[3][3];
+    ASSERT_TRUE(jacobi33(a, w, v));
+    const double expected_w[3] = {3.0, 1.0, 5.0};
+    const double expected_v[3][3] = {{M_SQRT1_2, M_SQRT1_2, 0}, {M_SQRT1_2, -M_SQRT1_2, 0}, {0, 0, 1}};
+    for (int k = 0; k < 3; k++) {
+        int found = -1;
+        for (int j = 0; j < 3; j++) {
+            if (std::fabs(w[j] - expected_w[k]) < 1e-12) found = j;
+        }
+        ASSERT_GE(found, 0) << "eigenvalue " << expected_w[k];
+        double dot = 0.0;
+        for (int i = 0; i < 3; i++) dot += v[i][found] * expected_v[k][i];
+        EXPECT_NEAR(std::fabs(dot), 1.0, 1e-12);
+    }
+    // The input is left unchanged
+    EXPECT_EQ(a[0][1], 1.0);
+}
+
+// The smallest eigenvector of the normal equations is the homography of exact correspondences
+TEST(HomographyTest, EigenvalueHomographyTest) {
+    double intrinsics[3][3] = {{500, 0, 320}, {0, 500, 240}, {0, 0, 1}};
+    const double expected[3][3] = {{1.02, 0.03, 12.0}, {-0.02, 0.98, -7.5}, {1e-5, -2e-5, 1.0}};
+    std::vector<double> pre, cur;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 5; j++) {
+            double x = 40.0 + 130.0 * j + 3.0 * i, y = 30.0 + 120.0 * i - 2.0 * j;
+            double z = expected[2][0] * x + expected[2][1] * y + expected[2][2];
+            pre.push_back(x);
+            pre.push_back(y);
+            cur.push_back((expected[0][0] * x + expected[0][1] * y + expected[0][2]) / z);
+            cur.push_back((expected[1][0] * x + expected[1][1] * y + expected[1][2]) / z);
+        }
+    }
+    double h[3][3];
+    ASSERT_TRUE(getHomographyFromPoints_Eigenvalue(pre.data(), cur.data(), (int32_t)pre.size() / 2, intrinsics, h));
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            EXPECT_NEAR(h[i][j] / h[2][2], expected[i][j], 1e-6 * std::max(1.0, std::fabs(expected[i][j])));
+        }
+    }
+}
+
+TEST(ImageStreamTest, RoundTripTest) {
+    const int32_t cols = 53, rows = 41;
+    std::vector<uint8_t> image(3 * cols * rows), back(3 * cols * rows);
+    for (size_t i = 0; i < image.size(); i++) image[i] = (uint8_t)((i * i) / 7 + (i % cols) * 3);
+    const char *files[] = {"stream_rgb.png", "stream_gray.png", "stream_gray.pgm"};
+    for (int f = 0; f < 3; f++) {
+        int32_t channels = f == 0 ? 3 : 1;
+        size_t plane = (size_t)cols * rows;
+        // Rows are appended and read back in bands that do not match the staging buffers
+        Image_Writer *writer = Open_Image_Writer(files[f], cols, rows, channels);
+        ASSERT_NE(writer, nullptr);
+        for (int32_t row = 0; row < rows; row += 10) {
+            ASSERT_TRUE(Append_Image_Rows(writer, &image[(size_t)row * cols], plane, std::min(10, rows - row)));
+        }
+        ASSERT_TRUE(Close_Image_Writer(writer));
+
+        int32_t read_cols, read_rows, read_channels;
+        Image_Reader *reader = Open_Image_Reader(files[f], &read_cols, &read_rows, &read_channels);
+        ASSERT_NE(reader, nullptr);
+        EXPECT_EQ(read_cols, cols);
+        EXPECT_EQ(read_rows, rows);
+        EXPECT_EQ(read_channels, channels);
+        std::fill(back.begin(), back.end(), 0);
+        for (int32_t row = 0; row < rows; row += 7) {
+            ASSERT_TRUE(Read_Image_Rows(reader, &back[(size_t)row * cols], plane, std::min(7, rows - row)));
+        }
+        EXPECT_FALSE(Read_Image_Rows(reader, back.data(), plane, 1));
+        Close_Image_Reader(reader);
+        EXPECT_TRUE(std::equal(back.begin(), back.begin() + plane * channels, image.begin()));
+        remove(files[f]);
+    }
+}
+
+TEST(ResultsRasterTest, WindowRoundTripTest) {
+    const int32_t cols = 75, rows = 61;
+    std::vector<float> maps[4];
+    for (int k = 0; k < 4; k++) {
+        maps[k].resize(cols * rows);
+        for (int32_t i = 0; i < cols * rows; i++) {
+            maps[k][i] = (i % 5 == 0 || (i / cols) > 40) ? NAN : (float)(0.01 * k * i - 3.7 + 0.5 * (i % cols));
+        }
+    }
+    CorrelationResults results = {maps[0].data(), maps[1].data(), maps[2].data(), maps[3].data()};
+    ASSERT_TRUE(Write_Correlation_Results_Raster("results_test.lmkr", &results, cols, rows, 16,
+                                                 LMK_COMPRESSION_DEFLATE));
+
+    // Rows appended in bands that do not follow the tiles give the same raster
+    Results_Raster_Writer *writer = Open_Results_Raster_Writer("results_bands.lmkr", cols, rows, 4,
+                                                               correlation_results_band_names, 16,
+                                                               LMK_COMPRESSION_DEFLATE);
+    ASSERT_NE(writer, nullptr);
+    for (int32_t top = 0; top < rows; top += 23) {
+        const float *bands[4];
+        for (int k = 0; k < 4; k++) bands[k] = &maps[k][(size_t)top * cols];
+        ASSERT_TRUE(Append_Results_Raster_Rows(writer, bands, std::min(23, rows - top)));
+    }
+    ASSERT_TRUE(Close_Results_Raster_Writer(writer));
+
+    const char *files[] = {"results_test.lmkr", "results_bands.lmkr"};
+    for (const char *file : files) {
+        int32_t read_cols, read_rows, read_bands;
+        Results_Raster *raster = Open_Results_Raster(file, &read_cols, &read_rows, &read_bands);
+        ASSERT_NE(raster, nullptr);
+        EXPECT_EQ(read_cols, cols);
+        EXPECT_EQ(read_rows, rows);
+        EXPECT_EQ(read_bands, 4);
+        int32_t band = Results_Raster_Band(raster, "delta_z");
+        ASSERT_EQ(band, 2);
+        std::vector<float> window(20 * 30);
+        ASSERT_TRUE(Read_Results_Raster_Window(raster, band, 9, 13, 20, 30, window.data()));
+        for (int32_t y = 0; y < 30; y++) {
+            for (int32_t x = 0; x < 20; x++) {
+                float expected = maps[2][(size_t)(13 + y) * cols + 9 + x];
+                float value = window[y * 20 + x];
+                EXPECT_TRUE(value == expected || (std::isnan(value) && std::isnan(expected)));
+            }
+        }
+        EXPECT_FALSE(Read_Results_Raster_Window(raster, band, 60, 0, 20, 1, window.data()));
+        Close_Results_Raster(raster);
+    }
+
+    std::vector<float> back[4];
+    for (int k = 0; k < 4; k++) back[k].resize(cols * rows);
+    CorrelationResults read = {back[0].data(), back[1].data(), back[2].data(), back[3].data()};
+    ASSERT_TRUE(Read_Correlation_Results_Raster("results_bands.lmkr", &read, cols, rows));
+    for (int k = 0; k < 4; k++) {
+        EXPECT_EQ(memcmp(back[k].data(), maps[k].data(), sizeof(float) * cols * rows), 0);
+    }
+    EXPECT_FALSE(Read_Correlation_Results_Raster("results_bands.lmkr", &read, cols + 1, rows));
+    remove("results_test.lmkr");
+    remove("results_bands.lmkr");
+}
+
+TEST(PerfStatsTest, TimersAndCountersTest) {
+    perf_stats_enable(NULL, "landmark_tests");
+    perf_stats_reset();
+    ASSERT_TRUE(perf_stats_enabled());
+
+    PerfTimer timer;
+    perf_timer_begin(&timer, PERF_CORRELATE);
+    volatile double sum = 0;
+    for (int32_t i = 0; i < 100000; i++) sum += std::sqrt((double)i);
+    perf_timer_end(&timer);
+    perf_count(PERF_FEATURES_TRIED, 7);
+    perf_count(PERF_FEATURES_TRIED, 3);
+    perf_count(PERF_RANSAC_OUTLIERS, 2);
+
+    PerfStats stats;
+    perf_stats_snapshot(&stats);
+    EXPECT_EQ(stats.calls[PERF_CORRELATE], 1);
+    EXPECT_GE(stats.wall_seconds[PERF_CORRELATE], 0.0);
+    EXPECT_GE(stats.cpu_seconds[PERF_CORRELATE], 0.0);
+    EXPECT_EQ(stats.calls[PERF_LOAD], 0);
+    EXPECT_EQ(stats.counters[PERF_FEATURES_TRIED], 10);
+    EXPECT_EQ(stats.counters[PERF_RANSAC_OUTLIERS], 2);
+    EXPECT_EQ(stats.counters[PERF_FEATURES_NAN_SEARCH], 0);
+
+    FILE *fp = tmpfile();
+    ASSERT_NE(fp, nullptr);
+    ASSERT_TRUE(perf_stats_write(fp));
+    rewind(fp);
+    std::string json;
+    char buffer[256];
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) json += buffer;
+    fclose(fp);
+    EXPECT_NE(json.find("\"program\": \"landmark_tests\""), std::string::npos);
+    EXPECT_NE(json.find("\"correlate\": {\"calls\": 1,"), std::string::npos);
+    EXPECT_NE(json.find("\"features_tried\": 10"), std::string::npos);
+
+    perf_stats_reset();
+    perf_stats_snapshot(&stats);
+    EXPECT_EQ(stats.calls[PERF_CORRELATE], 0);
+    EXPECT_EQ(stats.counters[PERF_FEATURES_TRIED], 0);
+}
+
+TEST(MemStatsTest, BudgetAndPeaksTest) {
+    MemStats before;
+    mem_stats_snapshot(&before);
+    mem_stats_reset_peaks();
+
+    LMK lmk = {0};
+    lmk.num_cols = 100;
+    lmk.num_rows = 50;
+    lmk.num_pixels = lmk.num_cols * lmk.num_rows;
+    ASSERT_TRUE(allocate_lmk_arrays(&lmk, lmk.num_cols, lmk.num_rows));
+    size_t lmk_bytes = (size_t)lmk.num_pixels * (sizeof(uint8_t) + sizeof(float));
+    MemStats stats;
+    mem_stats_snapshot(&stats);
+    EXPECT_EQ(stats.current[MEM_LANDMARK], before.current[MEM_LANDMARK] + lmk_bytes);
+
+    // Over the budget a tracked allocation fails without being counted
+    mem_stats_set_budget(stats.current_total + 1000);
+    EXPECT_TRUE(mem_stats_fits(1000));
+    EXPECT_FALSE(mem_stats_fits(1001));
+    EXPECT_EQ(mem_malloc(MEM_CORRELATION, 2000), nullptr);
+    void *small = mem_calloc(MEM_CORRELATION, 10, 100);
+    ASSERT_NE(small, nullptr);
+    mem_stats_snapshot(&stats);
+    EXPECT_EQ(stats.current[MEM_CORRELATION], before.current[MEM_CORRELATION] + 1000);
+    mem_free(small);
+    mem_stats_set_budget(0);
+
+    free_lmk(&lmk);
+    mem_stats_snapshot(&stats);
+    EXPECT_EQ(stats.current_total, before.current_total);
+    EXPECT_EQ(stats.peak[MEM_LANDMARK], before.current[MEM_LANDMARK] + lmk_bytes);
+    EXPECT_EQ(stats.peak_total, before.current_total + lmk_bytes + 1000);
+
+    // The estimate counts both landmarks and the output maps
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    LMK base = {0};
+    base.num_cols = 200;
+    base.num_rows = 100;
+    size_t estimate = MatchFeaturesWithLocalDistortion_memory(&parameters, &base, &lmk, 0, -1);
+    EXPECT_GT(estimate, (size_t)(base.num_cols * base.num_rows + lmk.num_pixels) * 5 + lmk.num_pixels * 16);
+}
+
+TEST(MemStatsTest, PagePolicyTest) {
+    MemStats before;
+    mem_stats_snapshot(&before);
+    mem_stats_set_policy(MEM_POLICY_HUGE_PAGES | MEM_POLICY_FIRST_TOUCH);
+    EXPECT_EQ(mem_stats_policy(), (uint32_t)(MEM_POLICY_HUGE_PAGES | MEM_POLICY_FIRST_TOUCH));
+
+    // Large arrays follow the policy, read as zero from mem_calloc and count their requested bytes
+    size_t count = MEM_POLICY_MIN_BYTES / sizeof(float) + 1000;
+    float *large = (float *)mem_calloc(MEM_CORRELATION, count, sizeof(float));
+    ASSERT_NE(large, nullptr);
+    float *small = (float *)mem_malloc(MEM_CORRELATION, 4000);
+    ASSERT_NE(small, nullptr);
+#if defined(LINUX_OS) || defined(MAC_OS)
+    EXPECT_EQ((uintptr_t)large % MEM_HUGE_PAGE_BYTES, 0u);
+#endif
+    EXPECT_EQ(large[0], 0.0f);
+    EXPECT_EQ(large[count / 2], 0.0f);
+    EXPECT_EQ(large[count - 1], 0.0f);
+    large[count - 1] = 1.0f;
+    small[999] = 1.0f;
+    MemStats stats;
+    mem_stats_snapshot(&stats);
+    EXPECT_EQ(stats.current[MEM_CORRELATION], before.current[MEM_CORRELATION] + count * sizeof(float) + 4000);
+
+    mem_free(large);
+    mem_free(small);
+    mem_stats_set_policy(0);
+    mem_stats_snapshot(&stats);
+    EXPECT_EQ(stats.current_total, before.current_total);
+}
+
+static bool mark_range(void *user, int32_t thread, size_t begin, size_t end) {
+    std::vector<int> *marks = (std::vector<int> *)user;
+    for (size_t i = begin; i < end; i++) __atomic_add_fetch(&(*marks)[i], thread + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static bool fail_range(void *user, int32_t thread, size_t begin, size_t end) {
+    (void)user;
+    (void)thread;
+    (void)end;
+    return begin != 40;
+}
+
+static bool mark_tile(void *user, int32_t thread, int32_t left, int32_t top, int32_t width, int32_t height) {
+    (void)thread;
+    std::vector<int> *marks = (std::vector<int> *)user;
+    for (int32_t r = top; r < top + height; r++) {
+        for (int32_t c = left; c < left + width; c++) __atomic_add_fetch(&(*marks)[r * 37 + c], 1, __ATOMIC_RELAXED);
+    }
+    return true;
+}
+
+TEST(ParallelTest, LoopsAndThreadCountTest) {
+    parallel_set_num_threads(3);
+    EXPECT_EQ(parallel_num_threads(), 3);
+
+    // Every item runs once, on a thread below the thread count
+    std::vector<int> marks(1000, 0);
+    EXPECT_TRUE(parallel_for(marks.size(), 7, 0, mark_range, &marks));
+    for (int mark : marks) {
+        EXPECT_GE(mark, 1);
+        EXPECT_LE(mark, 3);
+    }
+    EXPECT_TRUE(parallel_for(0, 7, 0, mark_range, &marks));
+    EXPECT_FALSE(parallel_for(100, 10, 0, fail_range, NULL));
+
+    // Tiles at the edges are cut to the grid
+    std::vector<int> tiles(37 * 23, 0);
+    EXPECT_TRUE(parallel_for_tiles(37, 23, 8, 5, 0, mark_tile, &tiles));
+    EXPECT_EQ(std::count(tiles.begin(), tiles.end(), 1), (long)tiles.size());
+
+    ParallelScratch scratch = {};
+    void *buffer = parallel_scratch_reserve(&scratch, 2, 100);
+    ASSERT_NE(buffer, nullptr);
+    EXPECT_EQ(parallel_scratch_reserve(&scratch, 2, 50), buffer);
+    EXPECT_EQ(parallel_scratch_reserve(&scratch, PARALLEL_MAX_THREADS, 50), nullptr);
+    parallel_scratch_free(&scratch);
+    EXPECT_EQ(scratch.buffers[2], nullptr);
+
+    const double partials[] = {1.0, 2.0, 3.5};
+    EXPECT_DOUBLE_EQ(parallel_sum(partials, 3), 6.5);
+
+    parallel_set_num_threads(0);
+    EXPECT_GE(parallel_num_threads(), 1);
+}
+
+static void capture_message(void *user, LogLevel level, const char *message) {
+    std::vector<std::string> *messages = (std::vector<std::string> *)user;
+    messages->push_back(std::to_string((int)level) + " " + message);
+}
+
+static void capture_progress(void *user, const char *task, int64_t done, int64_t total) {
+    std::vector<std::string> *reports = (std::vector<std::string> *)user;
+    reports->push_back(std::string(task) + " " + std::to_string(done) + "/" + std::to_string(total));
+}
+
+// Configs without the later keys, such as the 12 key format of the first release, keep the defaults of the others
+TEST(ParametersTest, ConfigWithoutNewKeysTest) {
+    std::string path = temp_file("old_parameters.yaml");
+    FILE *fp = fopen(path.c_str(), "w");
+    ASSERT_NE(fp, nullptr);
+    fputs("feature_match:\n"
+          "  correlation_window_size: 35\n"
+          "  search_window_size: 71\n"
+          "  min_correlation: 0.4\n"
+          "forstner_feature_detector:\n"
+          "  window_size: 11\n"
+          "  min_dist_feature: 6.0\n"
+          "  num_features: 700\n"
+          "sliding_window:\n"
+          "  block_size: 150\n"
+          "  step_size: 3\n"
+          "  min_n_features: 25\n"
+          "  feature_influence_window: 9\n"
+          "  reprojection_threshold: 4.0\n"
+          "  max_delta_map: 300.0\n", fp);
+    fclose(fp);
+
+    Parameters parameters;
+    load_default_parameters(&parameters);
+    ASSERT_TRUE(read_parameterfile((char *)path.c_str(), &parameters));
+    EXPECT_EQ(parameters.matching.correlation_window_size, 35);
+    EXPECT_EQ(parameters.matching.search_window_size, 71);
+    EXPECT_FLOAT_EQ(parameters.matching.min_correlation, 0.4f);
+    EXPECT_EQ(parameters.detector.num_features, 700);
+    EXPECT_EQ(parameters.sliding.block_size, 150);
+    EXPECT_FLOAT_EQ(parameters.sliding.max_delta_map, 300.0f);
+    EXPECT_EQ(parameters.matching.pyramid_levels, DEFAULT_PYRAMID_LEVELS);
+    EXPECT_EQ(parameters.matching.prune_search, DEFAULT_PRUNE_SEARCH);
+    EXPECT_EQ(parameters.matching.subpixel_model, DEFAULT_SUBPIXEL_MODEL);
+    EXPECT_EQ(parameters.sliding.num_threads, DEFAULT_NUM_THREADS);
+    EXPECT_EQ(parameters.sliding.normalized_convolution, DEFAULT_NORMALIZED_CONVOLUTION);
+    EXPECT_EQ(parameters.sliding.float_coordinates, DEFAULT_FLOAT_COORDINATES);
+    EXPECT_EQ(parameters.sliding.seeded_ransac, DEFAULT_SEEDED_RANSAC);
+
+    // A single section with two keys
+    fp = fopen(path.c_str(), "w");
+    ASSERT_NE(fp, nullptr);
+    fputs("sliding_window:\n"
+          "  normalized_convolution: 1\n"
+          "  float_coordinates: 1\n", fp);
+    fclose(fp);
+    load_default_parameters(&parameters);
+    ASSERT_TRUE(read_parameterfile((char *)path.c_str(), &parameters));
+    EXPECT_TRUE(parameters.sliding.normalized_convolution);
+    EXPECT_TRUE(parameters.sliding.float_coordinates);
+    EXPECT_EQ(parameters.matching.correlation_window_size, DEFAULT_CORRELATION_WINDOW_SIZE | 1);
+    EXPECT_EQ(parameters.sliding.block_size, DEFAULT_BLOCK_SIZE);
+    remove(path.c_str());
+}
+
+TEST(LogTest, SinksLevelsAndRateTest) {
+    // Silent until a sink is registered
+    log_set_sink(NULL, NULL, LOG_LEVEL_DEBUG);
+    EXPECT_FALSE(log_enabled(LOG_LEVEL_ERROR));
+
+    std::vector<std::string> messages;
+    log_set_sink(capture_message, &messages, LOG_LEVEL_INFO);
+    EXPECT_TRUE(log_enabled(LOG_LEVEL_INFO));
+    EXPECT_FALSE(log_enabled(LOG_LEVEL_DEBUG));
+    log_message(LOG_LEVEL_INFO, "read %d rows", 12);
+    log_message(LOG_LEVEL_DEBUG, "dropped");
+    log_message(LOG_LEVEL_WARNING, "kept");
+    ASSERT_EQ(messages.size(), 2u);
+    EXPECT_EQ(messages[0], "2 read 12 rows");
+    EXPECT_EQ(messages[1], "1 kept");
+
+    // Only the first and last report of a task within the interval
+    std::vector<std::string> reports;
+    log_set_progress_sink(capture_progress, &reports, 1000.0);
+    for (int64_t row = 0; row <= 10; row++) log_progress("Rows", row, 10);
+    log_progress("Blocks", 3, 8);
+    ASSERT_EQ(reports.size(), 3u);
+    EXPECT_EQ(reports[0], "Rows 0/10");
+    EXPECT_EQ(reports[1], "Rows 10/10");
+    EXPECT_EQ(reports[2], "Blocks 3/8");
+
+    // Every report without an interval
+    reports.clear();
+    log_set_progress_sink(capture_progress, &reports, 0.0);
+    for (int64_t row = 0; row <= 10; row++) log_progress("Rows", row, 10);
+    EXPECT_EQ(reports.size(), 11u);
+
+    // -log_level is taken out of the arguments
+    char arg0[] = "prog", arg1[] = "-log_level", arg2[] = "silent", arg3[] = "-input";
+    char *argv[] = {arg0, arg1, arg2, arg3, NULL};
+    int32_t argc = 4;
+    log_init(&argc, argv);
+    EXPECT_EQ(argc, 2);
+    EXPECT_STREQ(argv[1], "-input");
+    EXPECT_FALSE(log_enabled(LOG_LEVEL_ERROR));
+    log_set_progress_sink(NULL, NULL, LOG_PROGRESS_INTERVAL);
+}
+
+TEST(FeatureSetTest, ReserveAndCompactTest) {
+    FeatureSet set = {0};
+    ASSERT_TRUE(feature_set_reserve(&set, 3));
+    for (int32_t i = 0; i < 3; i++) {
+        set.points[i * 2] = i;
+        set.points[i * 2 + 1] = 10 + i;
+        set.matches[i * 2] = 20 + i;
+        set.matches[i * 2 + 1] = 30 + i;
+        set.scores[i] = 0.5 + i;
+        set.strengths[i] = 1.0f + i;
+        set.keep[i] = i != 1;
+    }
+    set.count = 3;
+
+    // Growing keeps the features, and every column starts on a cache line
+    ASSERT_TRUE(feature_set_reserve(&set, 100));
+    EXPECT_EQ(set.capacity, 100);
+    EXPECT_EQ(set.count, 3);
+    EXPECT_EQ((uintptr_t)set.matches % 64, 0u);
+    EXPECT_EQ((uintptr_t)set.scores % 64, 0u);
+    EXPECT_EQ((uintptr_t)set.keep % 64, 0u);
+    EXPECT_EQ(set.matches[5], 32);
+
+    EXPECT_EQ(feature_set_compact(&set), 2);
+    EXPECT_EQ(set.points[2], 2);
+    EXPECT_EQ(set.points[3], 12);
+    EXPECT_EQ(set.matches[2], 22);
+    EXPECT_EQ(set.matches[3], 32);
+    EXPECT_EQ(set.scores[1], 2.5);
+    EXPECT_EQ(set.strengths[1], 3.0f);
+
+    // A smaller reserve leaves the set as it is
+    double *points = set.points;
+    ASSERT_TRUE(feature_set_reserve(&set, 10));
+    EXPECT_EQ(set.points, points);
+    feature_set_free(&set);
+    EXPECT_EQ(set.arena, nullptr);
+    EXPECT_EQ(set.capacity, 0);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
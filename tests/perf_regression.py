@@ -0,0 +1,376 @@
+##
+#  \file   `perf_regression.py`
+#  \brief  Time the end-to-end tools on the gold standard data and check them against stored baselines
+#
+#  Each case runs one tool at every requested thread count, set through `LANDMARK_TOOLS_NUM_THREADS`, and records
+#  the fastest wall time and the largest peak resident memory of its repeats. The outputs of every run are checked
+#  against the gold standard data within `GOLD_TOLERANCES`, bit for bit with `--exact`, or with the tolerances of the
+#  regression tests when `--fast` turns on the paths whose results are not bit identical. Synthetic cases scale a gold landmark up with
+#  `landmark_tools.synthetic_landmark` and check that the known displacement of the child is found.
+#
+#  With `--record` the measurements are written to the baseline file. Otherwise a run slower than its baseline by
+#  more than `time_tolerance`, or using more than `rss_tolerance` more memory, is a regression. Baselines depend on
+#  the machine, so record them on the machine that runs the gate.
+#
+#  python3 tests/perf_regression.py --threads 1 4 --repeat 3 --record
+#  python3 tests/perf_regression.py --threads 1 4 --repeat 3 --synthetic_scale 4 8 --report report.json
+#
+#  \copyright Copyright 2024 California Institute of Technology
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+
+import argparse
+import glob
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+import numpy as np
+
+# Path to the top-level repo directory
+TOP_DIR = Path(__file__).resolve().parent.parent
+TEST_DIR = Path(__file__).resolve().parent
+GOLD_DIR = TEST_DIR / "gold_standard_data"
+sys.path.insert(0, str(TOP_DIR / "scripts/python"))
+
+DEFAULT_BASELINE = TEST_DIR / "perf_baselines.json"
+DEFAULT_TIME_TOLERANCE = 0.25   # Fraction of the baseline time a run may add
+DEFAULT_TIME_SLACK = 0.05       # Seconds a run may add, so short runs are not failed by timer noise
+DEFAULT_RSS_TOLERANCE = 0.10    # Fraction of the baseline peak memory a run may add
+
+# Largest difference from a gold map on the pixels valid in both, unless --exact or --fast. Rounding differs with the
+# compiler, its instruction set and floating point contraction, far less than this, and the tools give the same
+# results at every thread count. Displacements are in meters for landmarks and in pixels for images.
+GOLD_TOLERANCES = {"dx": 1e-3, "dy": 1e-3, "dz": 1e-3, "correlation": 1e-4}
+GOLD_NAN_FRACTION = 1e-3        # Fraction of the pixels that may be valid in one of the output and the gold map only
+
+# Parameters turning on the paths whose results are not bit identical to the gold standard data. The keys not listed
+# keep the defaults the gold standard data were made with, see `ParametersTest.ConfigWithoutNewKeysTest`.
+FAST_PARAMETERS = """sliding_window:
+  normalized_convolution: 1
+  float_coordinates: 1
+"""
+
+# Displacement of the child of the synthetic cases, in pixels of the scaled landmark and in meters
+SYNTHETIC_SHIFT_PX = (1.5, -0.5)
+SYNTHETIC_SHIFT_Z = 2.0
+SYNTHETIC_INPUT = GOLD_DIR / "Haworth_final_adj_5mpp_surf_tif_rendered.lmk"
+
+
+def load_maps(prefix, width, height):
+    """Read the displacement and correlation maps written with `prefix`, keyed as `visualize_corr` keys them."""
+    maps = {}
+    for filepath in glob.glob(str(prefix) + "*.raw"):
+        for pattern, key in (("delta_x_", "dx"), ("delta_y_", "dy"), ("delta_z_", "dz"), ("corr_", "correlation")):
+            if pattern in filepath:
+                maps[key] = np.fromfile(filepath, dtype=np.float32).reshape((height, width))
+    return maps
+
+
+def compare_gold(prefix, gold_prefix, width, height, fast_tolerances, fast, exact):
+    """Check maps against the gold maps on shared pixels, within `fast_tolerances` if `fast`, else within
+    `GOLD_TOLERANCES` or bit for bit if `exact`."""
+    maps = load_maps(prefix, width, height)
+    gold = load_maps(gold_prefix, width, height)
+    if set(maps) != set(gold):
+        return False, f"maps {sorted(maps)} written, gold has {sorted(gold)}"
+    problems = []
+    for key, gold_map in sorted(gold.items()):
+        found = maps[key]
+        both = ~(np.isnan(found) | np.isnan(gold_map))
+        worst = np.max(np.abs(found[both] - gold_map[both])) if np.any(both) else 0.0
+        if exact:
+            if found.tobytes() != gold_map.tobytes():
+                differ = np.count_nonzero(~((found == gold_map) | (np.isnan(found) & np.isnan(gold_map))))
+                problems.append(f"{key}: {differ} pixels differ, at most {worst:.6g}")
+            continue
+        tolerance = fast_tolerances[key] if fast else GOLD_TOLERANCES[key]
+        if worst > tolerance:
+            problems.append(f"{key}: differs by {worst:.6g}, more than {tolerance}")
+        one_valid = np.count_nonzero(np.isnan(found) != np.isnan(gold_map))
+        if not fast and one_valid > GOLD_NAN_FRACTION * found.size:
+            problems.append(f"{key}: {one_valid} pixels valid in only one of the output and the gold map")
+    if problems:
+        return False, "; ".join(problems)
+    return True, "bit for bit" if exact else "within tolerance"
+
+
+def landmark_comparison_wy(work_dir, parameters):
+    prefix = work_dir / "comparison"
+    cmd = ["landmark_comparison",
+           "-l1", GOLD_DIR / "UTM_WY.lmk_demo.lmk",
+           "-l2", GOLD_DIR / "equal_rectangular_WY.lmk_demo.lmk",
+           "-o", prefix]
+    if parameters is not None:
+        cmd += ["-c", parameters]
+
+    def check(fast, exact):
+        return compare_gold(prefix, GOLD_DIR / "comparison_", 500, 500,
+                            {"dx": 1.0, "dy": 1.0, "dz": 1.0, "correlation": 0.05}, fast, exact)
+    return cmd, check
+
+
+def image_comparison_kaguya(work_dir, parameters):
+    cmd = ["image_comparison",
+           "-base_image", GOLD_DIR / "hillshade_intensity.pgm",
+           "-base_nan_mask", GOLD_DIR / "hillshade_mask.pgm",
+           "-base_nan_max_count", "0",
+           "-child_image", GOLD_DIR / "kaguya_intensity.pgm",
+           "-child_nan_mask", GOLD_DIR / "kaguya_mask.pgm",
+           "-child_nan_max_count", "0",
+           "-warp", "image",
+           "-output_dir", work_dir,
+           "-output_filename_prefix", "comparison",
+           "-homography_max_dist_between_matching_keypoints", "0"]
+    if parameters is not None:
+        cmd += ["-c", parameters]
+
+    def check(fast, exact):
+        return compare_gold(work_dir / "comparison", GOLD_DIR / "image_comparison_", 1000, 1000,
+                            {"dx": 5.0, "dy": 5.0, "correlation": 0.05}, fast, exact)
+    return cmd, check
+
+
+def synthetic_case(scale):
+    """Case comparing a gold landmark scaled up `scale` times to a copy displaced by the synthetic shift."""
+    def case(work_dir, parameters):
+        from landmark_tools import synthetic_landmark
+        base = work_dir.parent / f"synthetic_{scale}x_base.lmk"
+        child = work_dir.parent / f"synthetic_{scale}x_child.lmk"
+        if not (base.exists() and child.exists()):
+            synthetic_landmark.make_synthetic_pair(SYNTHETIC_INPUT, base, child, scale,
+                                                   SYNTHETIC_SHIFT_PX, SYNTHETIC_SHIFT_Z)
+        header = synthetic_landmark.read_header(base)
+        prefix = work_dir / "comparison"
+        cmd = ["landmark_comparison", "-l1", child, "-l2", base, "-o", prefix]
+        if parameters is not None:
+            cmd += ["-c", parameters]
+
+        def check(fast, exact):
+            return check_displacement(prefix, header)
+        return cmd, check
+    return case
+
+
+def check_displacement(prefix, header):
+    """Check the median displacement found between a synthetic pair is the one it was made with."""
+    maps = load_maps(prefix, header["num_cols"], header["num_rows"])
+    if not {"dx", "dy", "dz"} <= set(maps):
+        return False, f"maps {sorted(maps)} written"
+    horizontal = np.hypot(maps["dx"], maps["dy"])
+    found = horizontal[~np.isnan(horizontal)]
+    if found.size == 0:
+        return False, "no displacement found"
+    expected = np.hypot(*SYNTHETIC_SHIFT_PX) * header["resolution"]
+    horizontal_error = abs(np.median(found) - expected)
+    vertical_error = abs(abs(np.nanmedian(maps["dz"])) - SYNTHETIC_SHIFT_Z)
+    ok = horizontal_error <= 0.25 * header["resolution"] and vertical_error <= 0.25 * header["resolution"]
+    return ok, (f"median displacement off by {horizontal_error:.3g} m horizontally, {vertical_error:.3g} m "
+                f"vertically, on {found.size} pixels")
+
+
+CASES = {
+    "landmark_comparison_wy": landmark_comparison_wy,
+    "image_comparison_kaguya": image_comparison_kaguya,
+}
+
+
+def run_tool(cmd, env, log_path):
+    """Run a tool, returning its exit code, wall time in seconds and peak resident memory in MB."""
+    with open(log_path, "w") as log:
+        start = time.perf_counter()
+        process = subprocess.Popen([str(c) for c in cmd], env=env, stdout=log, stderr=subprocess.STDOUT)
+        _, status, usage = os.wait4(process.pid, 0)
+        seconds = time.perf_counter() - start
+    process.returncode = os.waitstatus_to_exitcode(status)
+    # ru_maxrss is in kilobytes on Linux and in bytes on macOS
+    rss_mb = usage.ru_maxrss / (1024.0 * 1024.0 if sys.platform == "darwin" else 1024.0)
+    return process.returncode, seconds, rss_mb
+
+
+def run_case(name, make_case, build_dir, work_root, threads, repeat, fast, exact):
+    """Run a case at every thread count, returning one result per thread count."""
+    results = []
+    parameters = None
+    if fast:
+        parameters = work_root / "fast_parameters.yaml"
+        parameters.write_text(FAST_PARAMETERS)
+
+    for num_threads in threads:
+        work_dir = work_root / f"{name}_{num_threads}"
+        work_dir.mkdir(parents=True, exist_ok=True)
+        cmd, check = make_case(work_dir, parameters)
+        cmd[0] = build_dir / cmd[0]
+        result = {"case": name, "threads": num_threads, "fast": fast}
+        if not cmd[0].exists():
+            result.update(status="skipped", message=f"{cmd[0]} not built")
+            results.append(result)
+            continue
+
+        env = dict(os.environ)
+        env.pop("LANDMARK_TOOLS_NUM_THREADS", None)
+        if num_threads > 0:
+            env["LANDMARK_TOOLS_NUM_THREADS"] = str(num_threads)
+        perf_path = work_dir / "perf_stats.json"
+        env["LANDMARK_TOOLS_PERF_STATS"] = str(perf_path)
+
+        times = []
+        rss = []
+        failure = None
+        for iteration in range(repeat):
+            code, seconds, rss_mb = run_tool(cmd, env, work_dir / f"log_{iteration}.txt")
+            if code != 0:
+                failure = f"exited with {code}, see {work_dir / f'log_{iteration}.txt'}"
+                break
+            times.append(seconds)
+            rss.append(rss_mb)
+            # Every run must give the same outputs, whatever its thread count
+            matches, message = check(fast, exact)
+            if not matches:
+                failure = f"outputs do not match: {message}"
+                break
+
+        if failure is not None:
+            result.update(status="failed", message=failure)
+        else:
+            result.update(status="ok", message=message, seconds=min(times), peak_rss_mb=max(rss))
+            if perf_path.exists():
+                try:
+                    result["perf_stats"] = json.loads(perf_path.read_text())
+                except ValueError:
+                    pass
+        results.append(result)
+    return results
+
+
+def baseline_key(result):
+    return f"{result['case']}{'_fast' if result['fast'] else ''}/threads={result['threads']}"
+
+
+def compare_baseline(result, baseline, time_tolerance, time_slack, rss_tolerance):
+    """Mark a measured result as a regression against its baseline entry, if it has one."""
+    entry = baseline.get("cases", {}).get(baseline_key(result))
+    if result["status"] != "ok" or entry is None:
+        return
+    time_limit = entry["seconds"] * (1.0 + time_tolerance) + time_slack
+    rss_limit = entry["peak_rss_mb"] * (1.0 + rss_tolerance)
+    result["baseline_seconds"] = entry["seconds"]
+    result["baseline_peak_rss_mb"] = entry["peak_rss_mb"]
+    problems = []
+    if result["seconds"] > time_limit:
+        problems.append(f"{result['seconds']:.3f} s over the {time_limit:.3f} s limit")
+    if result["peak_rss_mb"] > rss_limit:
+        problems.append(f"{result['peak_rss_mb']:.1f} MB over the {rss_limit:.1f} MB limit")
+    if problems:
+        result["status"] = "regressed"
+        result["message"] = "; ".join(problems)
+
+
+def machine():
+    return {"platform": platform.platform(), "processor": platform.processor(), "cpus": os.cpu_count()}
+
+
+def get_args():
+    parser = argparse.ArgumentParser(
+        description="Time the end-to-end tools on the gold standard data and check them against stored baselines"
+    )
+    parser.add_argument("--build_dir", type=Path, default=TOP_DIR / "build", help="Directory of the tools")
+    parser.add_argument("--cases", nargs="+", default=sorted(CASES), choices=sorted(CASES),
+                        help="Gold standard cases to run")
+    parser.add_argument("--synthetic_scale", type=int, nargs="*", default=[],
+                        help="Also run synthetic cases with the gold landmark scaled up by these factors")
+    parser.add_argument("--threads", type=int, nargs="+", default=None,
+                        help="Thread counts to run at, 0 for the default of the tools. 1, 2, 4 and the number of "
+                             "processors by default")
+    parser.add_argument("--repeat", type=int, default=3, help="Runs at each thread count, the fastest is kept")
+    parser.add_argument("--fast", action="store_true",
+                        help="Turn on normalized_convolution and float_coordinates and check outputs within the "
+                             "tolerances of the regression tests")
+    parser.add_argument("--exact", action="store_true",
+                        help="Check outputs against the gold standard data bit for bit rather than within "
+                             "GOLD_TOLERANCES. Ignored with --fast")
+    parser.add_argument("--baseline", type=Path, default=DEFAULT_BASELINE, help="Baseline file")
+    parser.add_argument("--record", action="store_true", help="Write the measurements to the baseline file")
+    parser.add_argument("--time_tolerance", type=float, default=None,
+                        help=f"Fraction of the baseline time a run may add, {DEFAULT_TIME_TOLERANCE} by default")
+    parser.add_argument("--rss_tolerance", type=float, default=None,
+                        help=f"Fraction of the baseline memory a run may add, {DEFAULT_RSS_TOLERANCE} by default")
+    parser.add_argument("--work_dir", type=Path, default=None,
+                        help="Directory of the outputs and synthetic landmarks, a temporary one by default")
+    parser.add_argument("--report", type=Path, default=None, help="Write the results to this JSON file")
+    return parser.parse_args()
+
+
+def main():
+    args = get_args()
+    threads = args.threads
+    args.repeat = max(1, args.repeat)
+    if threads is None:
+        threads = sorted({1, 2, 4, os.cpu_count() or 1})
+
+    baseline = {}
+    if args.baseline.exists():
+        baseline = json.loads(args.baseline.read_text())
+    tolerances = baseline.get("tolerances", {})
+    time_tolerance = args.time_tolerance if args.time_tolerance is not None else \
+        tolerances.get("time", DEFAULT_TIME_TOLERANCE)
+    time_slack = tolerances.get("time_slack_seconds", DEFAULT_TIME_SLACK)
+    rss_tolerance = args.rss_tolerance if args.rss_tolerance is not None else \
+        tolerances.get("rss", DEFAULT_RSS_TOLERANCE)
+    if not args.record and baseline and baseline.get("machine") != machine():
+        print(f"Baselines were recorded on {baseline.get('machine')}, times may not compare")
+
+    cases = [(name, CASES[name]) for name in args.cases]
+    cases += [(f"synthetic_{scale}x", synthetic_case(scale)) for scale in args.synthetic_scale]
+
+    with tempfile.TemporaryDirectory() as temp_dir:
+        work_root = args.work_dir if args.work_dir is not None else Path(temp_dir)
+        work_root.mkdir(parents=True, exist_ok=True)
+        results = []
+        for name, make_case in cases:
+            for result in run_case(name, make_case, args.build_dir, work_root, threads, args.repeat, args.fast,
+                                   args.exact and not args.fast):
+                if not args.record:
+                    compare_baseline(result, baseline, time_tolerance, time_slack, rss_tolerance)
+                results.append(result)
+                measured = ""
+                if "seconds" in result:
+                    measured = f"{result['seconds']:8.3f} s {result['peak_rss_mb']:9.1f} MB"
+                print(f"{baseline_key(result):45s} {result['status']:9s} {measured:22s} {result['message']}")
+
+    if args.record:
+        baseline.setdefault("tolerances", {"time": time_tolerance, "time_slack_seconds": time_slack,
+                                           "rss": rss_tolerance})
+        baseline["machine"] = machine()
+        entries = baseline.setdefault("cases", {})
+        for result in results:
+            if result["status"] == "ok":
+                entries[baseline_key(result)] = {"seconds": result["seconds"],
+                                                 "peak_rss_mb": result["peak_rss_mb"]}
+        args.baseline.write_text(json.dumps(baseline, indent=2, sort_keys=True) + "\n")
+        print(f"Recorded baselines in {args.baseline}")
+
+    if args.report is not None:
+        args.report.write_text(json.dumps({"machine": machine(), "results": results}, indent=2) + "\n")
+
+    failed = [r for r in results if r["status"] in ("failed", "regressed")]
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,120 @@
+from pathlib import Path
+import numpy as np
+import pytest
+
+# Path to the top-level repo directory
+TOP_DIR = Path(__file__).resolve().parent.parent
+TEST_DIR = Path(__file__).resolve().parent
+import landmark_tools.landmark as landmark
+lt = pytest.importorskip("landmark_tools._landmark_tools", reason="built with -DWITH_PYTHON=ON")
+
+LMK_PATH = TEST_DIR / "gold_standard_data/Haworth_final_adj_5mpp_surf_tif_rendered.lmk"
+
+
+def test_read_matches_python_reader():
+    """The maps of the extension are those of the pure python reader, as views of the C arrays"""
+    lmk = lt.read_lmk(LMK_PATH)
+    reference = landmark.Landmark(LMK_PATH)
+
+    ele = np.asarray(lmk.ele)
+    srm = np.asarray(lmk.srm)
+    assert ele.dtype == np.float32 and srm.dtype == np.uint8
+    assert ele.shape == (reference.num_rows, reference.num_cols)
+    np.testing.assert_array_equal(ele, reference.ele)
+    np.testing.assert_array_equal(srm, reference.srm)
+    assert lmk.resolution == reference.resolution
+
+    # Writes go to the landmark, not to a copy
+    ele[0, 0] = 1234.5
+    assert np.asarray(lmk.ele)[0, 0] == np.float32(1234.5)
+
+
+def test_views_keep_landmark_alive(tmp_path):
+    """A view outlives the landmark object it was taken from, and write round trips"""
+    ele = np.asarray(lt.read_lmk(LMK_PATH).ele)
+    expected = landmark.Landmark(LMK_PATH).ele
+    np.testing.assert_array_equal(ele, expected)
+
+    lmk = lt.read_lmk(LMK_PATH)
+    lmk.write(tmp_path / "copy.lmk")
+    np.testing.assert_array_equal(np.asarray(lt.read_lmk(tmp_path / "copy.lmk").ele), expected)
+
+
+def test_match_self():
+    """A landmark compared to itself in memory has sub-pixel disparity, as in test_landmark_comparison_self"""
+    lmk = lt.read_lmk(LMK_PATH)
+    results = lt.match(lmk, lmk.copy())
+    assert results.shape == lmk.shape
+    for key in ["delta_x", "delta_y", "delta_z"]:
+        delta = np.asarray(getattr(results, key))
+        assert np.nanmax(np.abs(delta)) < 5
+
+
+def test_create_landmark_flat_dem():
+    """A flat DEM makes a flat landmark with the reflectance map passed in"""
+    dem = np.full((400, 400), 100.0, dtype=np.float32)
+    srm = np.full((400, 400), 7, dtype=np.uint8)
+    lmk = lt.create_landmark(dem, srm, projection="EQ_CYLINDERICAL", origin=(-2000.0, 2000.0),
+                             pixel_size=(10.0, -10.0), num_cols=100, num_rows=100, resolution=20.0,
+                             anchor_lat=0.0, anchor_lon=0.0)
+    assert lmk.shape == (100, 100)
+    assert lmk.body == "Moon"
+    assert abs(np.asarray(lmk.ele)[50, 50]) < 1e-3
+    assert np.asarray(lmk.srm)[50, 50] == 7
+
+    with pytest.raises(ValueError):
+        lt.create_landmark(dem.astype(np.float64), projection="EQ_CYLINDERICAL", origin=(0.0, 0.0),
+                           pixel_size=(1.0, -1.0), num_cols=10, num_rows=10, resolution=1.0,
+                           anchor_lat=0.0, anchor_lon=0.0)
+
+
+def ramp_landmark():
+    """Landmark of a DEM sloping along its columns"""
+    dem = np.tile(100.0 + 0.5 * np.arange(400, dtype=np.float32), (400, 1))
+    return lt.create_landmark(dem, projection="EQ_CYLINDERICAL", origin=(-2000.0, 2000.0),
+                              pixel_size=(10.0, -10.0), num_cols=100, num_rows=100, resolution=20.0,
+                              anchor_lat=0.0, anchor_lon=0.0)
+
+
+def test_layer_views_block_drop_layers():
+    """The layers a view holds are not freed, and an array of dropped layers does not export them"""
+    lmk = ramp_landmark()
+    slope_array = lmk.slope
+    slope = np.asarray(slope_array)
+    expected = slope.copy()
+    assert not slope.flags.writeable
+    with pytest.raises(BufferError):
+        lmk.drop_layers()
+
+    # ele cannot be changed under the layer
+    ele = np.asarray(lmk.ele)
+    assert not ele.flags.writeable
+    np.testing.assert_array_equal(slope, expected)
+
+    del slope, ele
+    lmk.drop_layers()
+    with pytest.raises(BufferError):
+        np.asarray(slope_array)
+    np.testing.assert_array_equal(np.asarray(lmk.slope), expected)
+
+
+def test_writable_ele_drops_layers():
+    """The layers are computed again after ele is changed through a writable view"""
+    lmk = ramp_landmark()
+    before = np.asarray(lmk.slope).copy()
+    stale = lmk.slope
+
+    ele = np.asarray(lmk.ele)
+    assert ele.flags.writeable
+    ele[:, 50:] *= 2
+    # A layer computed while ele is writable is dropped with the view
+    during = lmk.slope
+    del ele
+
+    with pytest.raises(BufferError):
+        np.asarray(stale)
+    with pytest.raises(BufferError):
+        np.asarray(during)
+    after = np.asarray(lmk.slope)
+    assert after[50, 75] > 1.5 * before[50, 75]
+    np.testing.assert_array_equal(after[:, :40], before[:, :40])
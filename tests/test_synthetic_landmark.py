@@ -0,0 +1,45 @@
+from pathlib import Path
+import sys
+from test_helpers import run_cmd
+import numpy as np
+
+# Path to the top-level repo directory
+TOP_DIR = Path(__file__).resolve().parent.parent
+TEST_DIR = Path(__file__).resolve().parent
+import landmark_tools.landmark as landmark
+import landmark_tools.synthetic_landmark as synthetic_landmark
+import perf_regression
+
+def test_synthetic_landmark_size(tmp_path):
+    """A landmark scaled up covers the same ground with more pixels, and reads back as a landmark
+    """
+    base_path = tmp_path / "base.lmk"
+    synthetic_landmark.make_synthetic_pair(perf_regression.SYNTHETIC_INPUT, base_path, None, 2)
+
+    gt = landmark.Landmark(perf_regression.SYNTHETIC_INPUT)
+    L = landmark.Landmark(base_path)
+    assert L.num_cols == 2 * gt.num_cols
+    assert L.num_rows == 2 * gt.num_rows
+    assert L.resolution == gt.resolution / 2
+    np.testing.assert_array_equal(L.anchor_point, gt.anchor_point)
+    # The surfaces agree up to the added detail
+    mask = np.logical_not(np.logical_or(np.isnan(L.ele[::2, ::2]), np.isnan(gt.ele)))
+    np.testing.assert_allclose(L.ele[::2, ::2][mask], gt.ele[mask], rtol=0, atol=gt.resolution)
+
+def test_synthetic_landmark_comparison(tmp_path):
+    """landmark_comparison of a synthetic pair finds the displacement the child was made with
+    """
+    base_path = tmp_path / "base.lmk"
+    child_path = tmp_path / "child.lmk"
+    synthetic_landmark.make_synthetic_pair(perf_regression.SYNTHETIC_INPUT, base_path, child_path, 2,
+                                           perf_regression.SYNTHETIC_SHIFT_PX, perf_regression.SYNTHETIC_SHIFT_Z)
+
+    output_prefix = tmp_path / "comparison"
+    run_cmd([ TOP_DIR / "build/landmark_comparison",
+        "-l1", child_path,
+        "-l2", base_path,
+        "-o", output_prefix], 
+        cwd= TEST_DIR)
+
+    matches, message = perf_regression.check_displacement(output_prefix, synthetic_landmark.read_header(base_path))
+    assert matches, message